@@ -47,15 +47,42 @@ _tpm2_activatecredential()
             -o | --certinfo-data)
                 _filedir
                 return;;
+            --manifest)
+                _filedir
+                return;;
+            --eh-auth)
+                COMPREPLY=($(compgen -W "${auth_methods[*]}" -- "$cur"))
+                return;;
         esac
 
         COMPREPLY=($(compgen -W "-h --help -v --version -V --verbose -Q --quiet \
         -Z --enable-erata -T --tcti \
-        -c -C -p -P -i -o --credentialedkey-context --credentialkey-context --credentialedkey-auth --credentialkey-auth --credential-blob --certinfo-data --cphash " \
+        -c -C -p -P -i -o --credentialedkey-context --credentialkey-context --credentialedkey-auth --credentialkey-auth --credential-blob --certinfo-data --cphash --manifest --eh-auth " \
         -- "$cur"))
     } &&
     complete -F _tpm2_activatecredential tpm2_activatecredential
 # ex: filetype=sh
+# bash completion for tpm2_batch                   -*- shell-script -*-
+_tpm2_batch()
+    {
+        local cur prev words cword split
+        _init_completion -s || return
+        case $prev in
+            -h | --help)
+                COMPREPLY=( $(compgen -W "man no-man" -- "$cur") )
+                return;;
+            -T | --tcti)
+                COMPREPLY=( $(compgen -W "tabrmd mssim device none" -- "$cur") )
+                return;;
+        esac
+
+        COMPREPLY=($(compgen -W "-h --help -v --version -V --verbose -Q --quiet \
+        -Z --enable-erata -T --tcti \
+        -k --keep-going " \
+        -- "$cur"))
+    } &&
+    complete -F _tpm2_batch tpm2_batch
+# ex: filetype=sh
 # bash completion for tpm2_certify                   -*- shell-script -*-
 _tpm2_certify()
     {
@@ -111,11 +138,14 @@ _tpm2_certify()
             -f | --format)
                 COMPREPLY=($(compgen -W "${format_methods[*]}" -- "$cur"))
                 return;;
+            --manifest)
+                _filedir
+                return;;
         esac
 
         COMPREPLY=($(compgen -W "-h --help -v --version -V --verbose -Q --quiet \
         -Z --enable-erata -T --tcti \
-        -c -C -p -g -P -o -s -f --certifiedkey-context --signingkey-context --certifiedkey-auth --hash-algorithm --signingkey-auth --attestation --signature --format --cphash " \
+        -c -C -p -g -P -o -s -f --certifiedkey-context --signingkey-context --certifiedkey-auth --hash-algorithm --signingkey-auth --attestation --signature --format --cphash --manifest " \
         -- "$cur"))
     } &&
     complete -F _tpm2_certify tpm2_certify
@@ -163,6 +193,9 @@ _tpm2_certifyX509certutil()
             -s | --subject)
                 _filedir
                 return;;
+            --manifest)
+                _filedir
+                return;;
         esac
 
         COMPREPLY=($(compgen -W "-h --help -v --version -V --verbose -Q --quiet \
@@ -233,11 +266,14 @@ _tpm2_certifycreation()
             -q | --qualification)
                 _filedir
                 return;;
+            --manifest)
+                _filedir
+                return;;
         esac
 
         COMPREPLY=($(compgen -W "-h --help -v --version -V --verbose -Q --quiet \
         -Z --enable-erata -T --tcti \
-        -C -P -c -g -s -d -t -o -f -q --signingkey-context --signingkey-auth --certifiedkey-context --hash-algorithm --scheme --creation-hash --ticket --signature --format --qualification --cphash " \
+        -C -P -c -g -s -d -t -o -f -q --signingkey-context --signingkey-auth --certifiedkey-context --hash-algorithm --scheme --creation-hash --ticket --signature --format --qualification --cphash --manifest " \
         -- "$cur"))
     } &&
     complete -F _tpm2_certifycreation tpm2_certifycreation
@@ -285,11 +321,15 @@ _tpm2_changeauth()
             -r | --private)
                 _filedir
                 return;;
+            --manifest)
+                _filedir
+                return;;
         esac
 
         COMPREPLY=($(compgen -W "-h --help -v --version -V --verbose -Q --quiet \
         -Z --enable-erata -T --tcti \
-        -c -p -C -r --object-context --object-auth --parent-context --private --cphash " \
+        -c -p -C -r --object-context --object-auth --parent-context --private --cphash \
+        --manifest " \
         -- "$cur"))
     } &&
     complete -F _tpm2_changeauth tpm2_changeauth
@@ -435,11 +475,14 @@ _tpm2_checkquote()
             -F | --format)
                 COMPREPLY=($(compgen -W "${format_methods[*]}" -- "$cur"))
                 return;;
+            --manifest | --golden | --ak-ca | --ak-cache | --bundle)
+                _filedir
+                return;;
         esac
 
         COMPREPLY=($(compgen -W "-h --help -v --version -V --verbose -Q --quiet \
         -Z --enable-erata -T --tcti \
-        -u -g -m -s -f -l -q -F --public --hash-algorithm --message --signature --pcr --pcr-list --qualification --format " \
+        -u -g -m -s -f -l -q -F --public --hash-algorithm --message --signature --pcr --pcr-list --qualification --format --manifest --jobs --golden --ak-ca --ak-cache --ak-cache-ttl --bundle " \
         -- "$cur"))
     } &&
     complete -F _tpm2_checkquote tpm2_checkquote
@@ -626,11 +669,36 @@ _tpm2_commit()
 
         COMPREPLY=($(compgen -W "-h --help -v --version -V --verbose -Q --quiet \
         -Z --enable-erata -T --tcti \
-        -u -t -p -c --public --counter --auth --context --basepoint --eccpoint --eccpoint --eccpoint " \
+        -u -t -p -c --public --counter --auth --context --basepoint --eccpoint --eccpoint --eccpoint --pool --fill " \
         -- "$cur"))
     } &&
     complete -F _tpm2_commit tpm2_commit
 # ex: filetype=sh
+# bash completion for tpm2_cphash                   -*- shell-script -*-
+_tpm2_cphash()
+    {
+        local cur prev words cword split
+        local hash_methods=(sha1 sha256 sha384 sha512)
+        _init_completion -s || return
+        case $prev in
+            -h | --help)
+                COMPREPLY=( $(compgen -W "man no-man" -- "$cur") )
+                return;;
+            -T | --tcti)
+                COMPREPLY=( $(compgen -W "tabrmd mssim device none" -- "$cur") )
+                return;;
+            -g | --hash-algorithm)
+                COMPREPLY=($(compgen -W "${hash_methods[*]}" -- "$cur"))
+                return;;
+        esac
+
+        COMPREPLY=($(compgen -W "-h --help -v --version -V --verbose -Q --quiet \
+        -Z --enable-erata -T --tcti \
+        -g -k --hash-algorithm --keep-going " \
+        -- "$cur"))
+    } &&
+    complete -F _tpm2_cphash tpm2_cphash
+# ex: filetype=sh
 # bash completion for tpm2_create                   -*- shell-script -*-
 _tpm2_create()
     {
@@ -707,11 +775,14 @@ _tpm2_create()
             -l | --pcr-list)
                 _filedir
                 return;;
+            --manifest)
+                _filedir
+                return;;
         esac
 
         COMPREPLY=($(compgen -W "-h --help -v --version -V --verbose -Q --quiet \
         -Z --enable-erata -T --tcti \
-        -C -P -p -g -G -a -i -L -u -r -c -t -d -q -l --parent-context --parent-auth --key-auth --hash-algorithm --key-algorithm --attributes --sealing-input --policy --public --private --key-context --creation-ticket --creation-hash --outside-info --pcr-list --creation --template --cphash " \
+        -C -P -p -g -G -a -i -L -u -r -c -t -d -q -l --parent-context --parent-auth --key-auth --hash-algorithm --key-algorithm --attributes --sealing-input --policy --public --private --key-context --creation-ticket --creation-hash --outside-info --pcr-list --creation --template --cphash --manifest " \
         -- "$cur"))
     } &&
     complete -F _tpm2_create tpm2_create
@@ -780,11 +851,14 @@ _tpm2_createak()
             -q | --ak-qualified-name)
                 _filedir
                 return;;
+            --pool)
+                _filedir -d
+                return;;
         esac
 
         COMPREPLY=($(compgen -W "-h --help -v --version -V --verbose -Q --quiet \
         -Z --enable-erata -T --tcti \
-        -P -p -C -c -G -g -s -u -n -r -q --eh-auth --ak-auth --ek-context --ak-context --key-algorithm --hash-algorithm --signing-algorithm --public --ak-name --private --ak-qualified-name " \
+        -P -p -C -c -G -g -s -u -n -r -q --eh-auth --ak-auth --ek-context --ak-context --key-algorithm --hash-algorithm --signing-algorithm --public --ak-name --private --ak-qualified-name --pool --fill-pool --from-pool " \
         -- "$cur"))
     } &&
     complete -F _tpm2_createak tpm2_createak
@@ -838,11 +912,14 @@ _tpm2_createek()
             -t | --template)
                 _filedir
                 return;;
+            --load-template | --save-template)
+                _filedir
+                return;;
         esac
 
         COMPREPLY=($(compgen -W "-h --help -v --version -V --verbose -Q --quiet \
         -Z --enable-erata -T --tcti \
-        -P -w -c -G -u -t --eh-auth --owner-auth --ek-context --key-algorithm --public --template " \
+        -P -w -c -G -u -t --eh-auth --owner-auth --ek-context --key-algorithm --public --template --load-template --save-template " \
         -- "$cur"))
     } &&
     complete -F _tpm2_createek tpm2_createek
@@ -887,14 +964,15 @@ _tpm2_createpolicy()
             -l | --pcr-list)
                 _filedir
                 return;;
-            -f | --pcr)
+            -f | --pcr | --policy-tree)
                 _filedir
                 return;;
         esac
 
         COMPREPLY=($(compgen -W "-h --help -v --version -V --verbose -Q --quiet \
         -Z --enable-erata -T --tcti \
-        -L -g -l -f --policy --policy-algorithm --pcr-list --pcr --policy --policy " \
+        -L -g -l -f --policy --policy-algorithm --pcr-list --pcr --policy --policy \
+        --policy-tree " \
         -- "$cur"))
     } &&
     complete -F _tpm2_createpolicy tpm2_createpolicy
@@ -969,11 +1047,14 @@ _tpm2_createprimary()
             -l | --pcr-list)
                 _filedir
                 return;;
+            --load-template | --save-template)
+                _filedir
+                return;;
         esac
 
         COMPREPLY=($(compgen -W "-h --help -v --version -V --verbose -Q --quiet \
         -Z --enable-erata -T --tcti \
-        -C -P -p -g -G -c -L -a -u -t -d -q -l --hierarchy --hierarchy-auth --key-auth --hash-algorithm --key-algorithm --key-context --policy --attributes --unique-data --creation-ticket --creation-hash --outside-info --pcr-list --creation --template --cphash " \
+        -C -P -p -g -G -c -L -a -u -t -d -q -l --hierarchy --hierarchy-auth --key-auth --hash-algorithm --key-algorithm --key-context --policy --attributes --unique-data --creation-ticket --creation-hash --outside-info --pcr-list --creation --template --cphash --load-template --save-template " \
         -- "$cur"))
     } &&
     complete -F _tpm2_createprimary tpm2_createprimary
@@ -1091,11 +1172,14 @@ _tpm2_duplicate()
             -c | --key-context)
                 _filedir
                 return;;
+            --manifest | --archive)
+                _filedir
+                return;;
         esac
 
         COMPREPLY=($(compgen -W "-h --help -v --version -V --verbose -Q --quiet \
         -Z --enable-erata -T --tcti \
-        -G -i -o -C -r -s -p -c --wrapper-algorithm --encryptionkey-in --encryptionkey-out --parent-context --private --encrypted-seed --auth --key-context --cphash " \
+        -G -i -o -C -r -s -p -c --wrapper-algorithm --encryptionkey-in --encryptionkey-out --parent-context --private --encrypted-seed --auth --key-context --cphash --manifest --archive " \
         -- "$cur"))
     } &&
     complete -F _tpm2_duplicate tpm2_duplicate
@@ -1196,7 +1280,7 @@ _tpm2_ecdhzgen()
 
         COMPREPLY=($(compgen -W "-h --help -v --version -V --verbose -Q --quiet \
         -Z --enable-erata -T --tcti \
-        -c -p -u -o --key-context --key-auth --public --output " \
+        -c -p -u -o --key-context --key-auth --public --output --batch " \
         -- "$cur"))
     } &&
     complete -F _tpm2_ecdhzgen tpm2_ecdhzgen
@@ -1242,7 +1326,7 @@ _tpm2_ecephemeral()
 
         COMPREPLY=($(compgen -W "-h --help -v --version -V --verbose -Q --quiet \
         -Z --enable-erata -T --tcti \
-        -u -t --public --counter " \
+        -u -t --public --counter --pool --fill " \
         -- "$cur"))
     } &&
     complete -F _tpm2_ecephemeral tpm2_ecephemeral
@@ -1339,11 +1423,24 @@ _tpm2_eventlog()
             -T | --tcti)
                 COMPREPLY=( $(compgen -W "tabrmd mssim device none" -- "$cur") )
                 return;;
+            --checkpoint | --index | --reference | --predict | -o | --output)
+                _filedir
+                return;;
+            -g | --hash-algorithm)
+                COMPREPLY=($(compgen -W "${hash_methods[*]}" -- "$cur"))
+                return;;
+            --format)
+                COMPREPLY=($(compgen -W "yaml json tlv" -- "$cur"))
+                return;;
+            --ima)
+                COMPREPLY=($(compgen -W "${hash_methods[*]}" -- "$cur"))
+                return;;
         esac
 
         COMPREPLY=($(compgen -W "-h --help -v --version -V --verbose -Q --quiet \
-        -Z --enable-erata -T --tcti \
-        " \
+        -Z --enable-erata -T --tcti --eventlog-version --checkpoint --index \
+        --pcrs --event --format --replay-only --reference --json --ima \
+        --predict --policy -g --hash-algorithm -o --output" \
         -- "$cur"))
     } &&
     complete -F _tpm2_eventlog tpm2_eventlog
@@ -1391,11 +1488,15 @@ _tpm2_evictcontrol()
             -o | --output)
                 _filedir
                 return;;
+            --manifest)
+                _filedir
+                return;;
         esac
 
         COMPREPLY=($(compgen -W "-h --help -v --version -V --verbose -Q --quiet \
         -Z --enable-erata -T --tcti \
-        -C -c -P -o --hierarchy --object-context --auth --output --cphash " \
+        -C -c -P -o --hierarchy --object-context --auth --output --cphash \
+        --manifest " \
         -- "$cur"))
     } &&
     complete -F _tpm2_evictcontrol tpm2_evictcontrol
@@ -1444,7 +1545,7 @@ _tpm2_flushcontext()
 
         COMPREPLY=($(compgen -W "-h --help -v --version -V --verbose -Q --quiet \
         -Z --enable-erata -T --tcti \
-        -t -l -s --transient-object --loaded-session --saved-session " \
+        -t -l -s --transient-object --loaded-session --saved-session --all " \
         -- "$cur"))
     } &&
     complete -F _tpm2_flushcontext tpm2_flushcontext
@@ -1487,7 +1588,7 @@ _tpm2_getcap()
 
         COMPREPLY=($(compgen -W "-h --help -v --version -V --verbose -Q --quiet \
         -Z --enable-erata -T --tcti \
-        -l --list " \
+        -l --list --json " \
         -- "$cur"))
     } &&
     complete -F _tpm2_getcap tpm2_getcap
@@ -1642,11 +1743,18 @@ _tpm2_getekcertificate()
             -x | --offline)
                 _filedir
                 return;;
+            --manifest)
+                _filedir
+                return;;
+            --cache)
+                _filedir -d
+                return;;
         esac
 
         COMPREPLY=($(compgen -W "-h --help -v --version -V --verbose -Q --quiet \
         -Z --enable-erata -T --tcti \
-        -o -X -u -x --ek-certificate --allow-unverified --ek-public --offline " \
+        -o -X -u -x --ek-certificate --allow-unverified --ek-public --offline \
+        --raw --manifest --jobs --cache --cache-ttl --cache-only " \
         -- "$cur"))
     } &&
     complete -F _tpm2_getekcertificate tpm2_getekcertificate
@@ -1691,11 +1799,15 @@ _tpm2_getrandom()
             -S | --session)
                 _filedir
                 return;;
+            --feed | --stir)
+                _filedir
+                return;;
         esac
 
         COMPREPLY=($(compgen -W "-h --help -v --version -V --verbose -Q --quiet \
         -Z --enable-erata -T --tcti \
-        -o -f -S --output --force --session --hex --cphash --rphash " \
+        -o -f -S --output --force --session --hex --cphash --rphash --bulk \
+        --feed --interval --low-water --stir " \
         -- "$cur"))
     } &&
     complete -F _tpm2_getrandom tpm2_getrandom
@@ -1758,11 +1870,14 @@ _tpm2_getsessionauditdigest()
             -S | --session)
                 _filedir
                 return;;
+            --bundle | --verify)
+                _filedir
+                return;;
         esac
 
         COMPREPLY=($(compgen -W "-h --help -v --version -V --verbose -Q --quiet \
         -Z --enable-erata -T --tcti \
-        -P -c -p -q -s -m -f -g -S --hierarchy-auth --key-context --auth --qualification --signature --message --format --hash-algorithm --session " \
+        -P -c -p -q -s -m -f -g -S --hierarchy-auth --key-context --auth --qualification --signature --message --format --hash-algorithm --session --bundle --verify " \
         -- "$cur"))
     } &&
     complete -F _tpm2_getsessionauditdigest tpm2_getsessionauditdigest
@@ -1866,7 +1981,8 @@ _tpm2_gettime()
 
         COMPREPLY=($(compgen -W "-h --help -v --version -V --verbose -Q --quiet \
         -Z --enable-erata -T --tcti \
-        -c -p -P -g -s -q -o -f --key-context --auth --endorse-auth --hash-algorithm --scheme --qualification --signature --format --cphash " \
+        -c -p -P -g -s -q -o -f --key-context --auth --endorse-auth --hash-algorithm --scheme --qualification --signature --format --cphash \
+        --attestation --watch --polls --max-drift --attest-polls " \
         -- "$cur"))
     } &&
     complete -F _tpm2_gettime tpm2_gettime
@@ -1914,11 +2030,14 @@ _tpm2_hash()
             -t | --ticket)
                 _filedir
                 return;;
+            --files0-from)
+                _filedir
+                return;;
         esac
 
         COMPREPLY=($(compgen -W "-h --help -v --version -V --verbose -Q --quiet \
         -Z --enable-erata -T --tcti \
-        -C -g -o -t --hierarchy --hash-algorithm --output --ticket --hex " \
+        -C -g -o -t --hierarchy --hash-algorithm --output --ticket --hex --files0-from " \
         -- "$cur"))
     } &&
     complete -F _tpm2_hash tpm2_hash
@@ -2015,11 +2134,14 @@ _tpm2_hmac()
             -t | --ticket)
                 _filedir
                 return;;
+            --files0-from)
+                _filedir
+                return;;
         esac
 
         COMPREPLY=($(compgen -W "-h --help -v --version -V --verbose -Q --quiet \
         -Z --enable-erata -T --tcti \
-        -c -p -g -o -t --key-context --auth --hash-algorithm --output --ticket --hex --cphash " \
+        -c -p -g -o -t --key-context --auth --hash-algorithm --output --ticket --hex --cphash --files0-from " \
         -- "$cur"))
     } &&
     complete -F _tpm2_hmac tpm2_hmac
@@ -2094,11 +2216,14 @@ _tpm2_import()
             -s | --seed)
                 _filedir
                 return;;
+            --manifest)
+                _filedir
+                return;;
         esac
 
         COMPREPLY=($(compgen -W "-h --help -v --version -V --verbose -Q --quiet \
         -Z --enable-erata -T --tcti \
-        -G -g -i -C -U -k -r -u -a -P -p -L -s --key-algorithm --hash-algorithm --input --parent-context --parent-public --encryption-key --private --public --attributes --parent-auth --key-auth --policy --seed --passin --cphash " \
+        -G -g -i -C -U -k -r -u -a -P -p -L -s --key-algorithm --hash-algorithm --input --parent-context --parent-public --encryption-key --private --public --attributes --parent-auth --key-auth --policy --seed --passin --cphash --manifest --jobs " \
         -- "$cur"))
     } &&
     complete -F _tpm2_import tpm2_import
@@ -2137,7 +2262,7 @@ _tpm2_incrementalselftest()
         esac
 
         COMPREPLY=($(compgen -W "-h --help -v --version -V --verbose -Q --quiet \
-        -Z --enable-erata -T --tcti \
+        -Z --enable-erata -T --tcti --schedule \
         " \
         -- "$cur"))
     } &&
@@ -2192,11 +2317,14 @@ _tpm2_load()
             -c | --key-context)
                 _filedir
                 return;;
+            --manifest)
+                _filedir
+                return;;
         esac
 
         COMPREPLY=($(compgen -W "-h --help -v --version -V --verbose -Q --quiet \
         -Z --enable-erata -T --tcti \
-        -C -P -u -r -n -c --parent-context --auth --public --private --name --key-context --cphash " \
+        -C -P -u -r -n -c --parent-context --auth --public --private --name --key-context --cphash --manifest " \
         -- "$cur"))
     } &&
     complete -F _tpm2_load tpm2_load
@@ -2320,11 +2448,14 @@ _tpm2_makecredential()
             -o | --credential-blob)
                 _filedir
                 return;;
+            --manifest)
+                _filedir
+                return;;
         esac
 
         COMPREPLY=($(compgen -W "-h --help -v --version -V --verbose -Q --quiet \
         -Z --enable-erata -T --tcti \
-        -e -u -G -s -n -o --encryption-key --public --key-algorithm --secret --name --credential-blob " \
+        -e -u -G -s -n -o --encryption-key --public --key-algorithm --secret --name --credential-blob --manifest --jobs " \
         -- "$cur"))
     } &&
     complete -F _tpm2_makecredential tpm2_makecredential
@@ -2387,11 +2518,14 @@ _tpm2_nvcertify()
             -q | --qualification)
                 _filedir
                 return;;
+            --manifest)
+                _filedir
+                return;;
         esac
 
         COMPREPLY=($(compgen -W "-h --help -v --version -V --verbose -Q --quiet \
         -Z --enable-erata -T --tcti \
-        -C -P -c -p -g -s -f -o -q --signingkey-context --signingkey-auth --nvauthobj-context --nvauthobj-auth --hash-algorithm --scheme --format --signature --qualification --size --offset --cphash " \
+        -C -P -c -p -g -s -f -o -q --signingkey-context --signingkey-auth --nvauthobj-context --nvauthobj-auth --hash-algorithm --scheme --format --signature --qualification --size --offset --cphash --manifest " \
         -- "$cur"))
     } &&
     complete -F _tpm2_nvcertify tpm2_nvcertify
@@ -2448,11 +2582,14 @@ _tpm2_nvdefine()
             -g | --hash-algorithm)
                 COMPREPLY=($(compgen -W "${hash_methods[*]}" -- "$cur"))
                 return;;
+            --layout)
+                _filedir
+                return;;
         esac
 
         COMPREPLY=($(compgen -W "-h --help -v --version -V --verbose -Q --quiet \
         -Z --enable-erata -T --tcti \
-        -C -s -a -P -p -L --hierarchy --size --attributes --hierarchy-auth --index-auth --policy --hash-algorithm --cphash " \
+        -C -s -a -P -p -L --hierarchy --size --attributes --hierarchy-auth --index-auth --policy --hash-algorithm --cphash --layout " \
         -- "$cur"))
     } &&
     complete -F _tpm2_nvdefine tpm2_nvdefine
@@ -2501,7 +2638,7 @@ _tpm2_nvextend()
 
         COMPREPLY=($(compgen -W "-h --help -v --version -V --verbose -Q --quiet \
         -Z --enable-erata -T --tcti \
-        -C -P -i --hierarchy --auth --input --cphash " \
+        -C -P -i --hierarchy --auth --input --cphash --batch " \
         -- "$cur"))
     } &&
     complete -F _tpm2_nvextend tpm2_nvextend
@@ -2547,7 +2684,7 @@ _tpm2_nvincrement()
 
         COMPREPLY=($(compgen -W "-h --help -v --version -V --verbose -Q --quiet \
         -Z --enable-erata -T --tcti \
-        -C -P --hierarchy --auth --cphash " \
+        -C -P --hierarchy --auth --cphash --batch --coalesce --interval " \
         -- "$cur"))
     } &&
     complete -F _tpm2_nvincrement tpm2_nvincrement
@@ -2599,7 +2736,8 @@ _tpm2_nvread()
 
         COMPREPLY=($(compgen -W "-h --help -v --version -V --verbose -Q --quiet \
         -Z --enable-erata -T --tcti \
-        -C -o -P -s --hierarchy --output --auth --size --offset --cphash " \
+        -C -o -P -s --hierarchy --output --auth --size --offset --cphash \
+        --shadow --range " \
         -- "$cur"))
     } &&
     complete -F _tpm2_nvread tpm2_nvread
@@ -2681,11 +2819,17 @@ _tpm2_nvreadpublic()
             -T | --tcti)
                 COMPREPLY=( $(compgen -W "tabrmd mssim device none" -- "$cur") )
                 return;;
+            -C | --hierarchy)
+                COMPREPLY=($(compgen -W "o p" -- "$cur"))
+                return;;
+            -P | --auth)
+                COMPREPLY=($(compgen -W "${auth_methods[*]}" -- "$cur"))
+                return;;
         esac
 
         COMPREPLY=($(compgen -W "-h --help -v --version -V --verbose -Q --quiet \
         -Z --enable-erata -T --tcti \
-        " \
+        -C -P --hierarchy --auth --data " \
         -- "$cur"))
     } &&
     complete -F _tpm2_nvreadpublic tpm2_nvreadpublic
@@ -2734,7 +2878,7 @@ _tpm2_nvsetbits()
 
         COMPREPLY=($(compgen -W "-h --help -v --version -V --verbose -Q --quiet \
         -Z --enable-erata -T --tcti \
-        -C -P -i --hierarchy --auth --bits --cphash " \
+        -C -P -i --hierarchy --auth --bits --cphash --defer " \
         -- "$cur"))
     } &&
     complete -F _tpm2_nvsetbits tpm2_nvsetbits
@@ -2779,11 +2923,14 @@ _tpm2_nvundefine()
             -S | --session)
                 _filedir
                 return;;
+            --layout)
+                _filedir
+                return;;
         esac
 
         COMPREPLY=($(compgen -W "-h --help -v --version -V --verbose -Q --quiet \
         -Z --enable-erata -T --tcti \
-        -C -P -S --hierarchy --auth --session --cphash " \
+        -C -P -S --hierarchy --auth --session --cphash --layout " \
         -- "$cur"))
     } &&
     complete -F _tpm2_nvundefine tpm2_nvundefine
@@ -2832,7 +2979,7 @@ _tpm2_nvwrite()
 
         COMPREPLY=($(compgen -W "-h --help -v --version -V --verbose -Q --quiet \
         -Z --enable-erata -T --tcti \
-        -i -C -P --input --hierarchy --auth --offset --cphash " \
+        -i -C -P --input --hierarchy --auth --offset --cphash --diff " \
         -- "$cur"))
     } &&
     complete -F _tpm2_nvwrite tpm2_nvwrite
@@ -2964,7 +3111,7 @@ _tpm2_pcrevent()
 
         COMPREPLY=($(compgen -W "-h --help -v --version -V --verbose -Q --quiet \
         -Z --enable-erata -T --tcti \
-        -P --auth " \
+        -P --auth --host-hash " \
         -- "$cur"))
     } &&
     complete -F _tpm2_pcrevent tpm2_pcrevent
@@ -3000,11 +3147,14 @@ _tpm2_pcrextend()
             -T | --tcti)
                 COMPREPLY=( $(compgen -W "tabrmd mssim device none" -- "$cur") )
                 return;;
+            --manifest | --eventlog)
+                _filedir
+                return;;
         esac
 
         COMPREPLY=($(compgen -W "-h --help -v --version -V --verbose -Q --quiet \
         -Z --enable-erata -T --tcti \
-        " \
+        --manifest --eventlog " \
         -- "$cur"))
     } &&
     complete -F _tpm2_pcrextend tpm2_pcrextend
@@ -3018,7 +3168,7 @@ _tpm2_pcrread()
 
         local format_methods=(tss plain)
 
-        local pcr_format_methods=(values serialized)
+        local pcr_format_methods=(values serialized bundle)
 
         local signing_scheme=(rsassa rsapss ecdsa ecdaa sm2 ecshnorr hmac)
 
@@ -3053,7 +3203,7 @@ _tpm2_pcrread()
         COMPREPLY=($(compgen -W "-h --help -v --version -V --verbose -Q --quiet \
         -Z --enable-erata -T --tcti \
         -F --pcrs_format \
-        -o --output " \
+        -o --output --watch --polls --json " \
         -- "$cur"))
     } &&
     complete -F _tpm2_pcrread tpm2_pcrread
@@ -3093,7 +3243,7 @@ _tpm2_pcrreset()
 
         COMPREPLY=($(compgen -W "-h --help -v --version -V --verbose -Q --quiet \
         -Z --enable-erata -T --tcti \
-        " \
+        -e --extend --expected --json " \
         -- "$cur"))
     } &&
     complete -F _tpm2_pcrreset tpm2_pcrreset
@@ -3147,11 +3297,26 @@ _tpm2_policyauthorize()
             -t | --ticket)
                 _filedir
                 return;;
+            -c | --key-context)
+                _filedir
+                return;;
+            -s | --signature)
+                _filedir
+                return;;
+            -f | --scheme)
+                COMPREPLY=($(compgen -W "${signing_scheme[*]}" -- "$cur"))
+                return;;
+            -g | --hash-algorithm)
+                COMPREPLY=($(compgen -W "${hash_methods[*]}" -- "$cur"))
+                return;;
+            --ticket-cache)
+                _filedir
+                return;;
         esac
 
         COMPREPLY=($(compgen -W "-h --help -v --version -V --verbose -Q --quiet \
         -Z --enable-erata -T --tcti \
-        -L -S -i -q -n -t --policy --session --input --qualification --name --ticket " \
+        -L -S -i -q -n -t -c -s -f -g --policy --session --input --qualification --name --ticket --key-context --signature --scheme --hash-algorithm --ticket-cache " \
         -- "$cur"))
     } &&
     complete -F _tpm2_policyauthorize tpm2_policyauthorize
@@ -3680,11 +3845,17 @@ _tpm2_policyor()
             -l | --policy-list)
                 _filedir
                 return;;
+            --tree)
+                _filedir
+                return;;
+            --digest-list)
+                _filedir
+                return;;
         esac
 
         COMPREPLY=($(compgen -W "-h --help -v --version -V --verbose -Q --quiet \
         -Z --enable-erata -T --tcti \
-        -L -S -l --policy --session --policy-list " \
+        -L -S -l --policy --session --policy-list --tree --digest-list " \
         -- "$cur"))
     } &&
     complete -F _tpm2_policyor tpm2_policyor
@@ -3883,7 +4054,7 @@ _tpm2_policysecret()
 
         COMPREPLY=($(compgen -W "-h --help -v --version -V --verbose -Q --quiet \
         -Z --enable-erata -T --tcti \
-        -c -S -L -t -x -q --object-context --session --policy --expiration --nonce-tpm --qualification --ticket --timeout --cphash " \
+        -c -S -L -t -x -q --object-context --session --policy --expiration --nonce-tpm --qualification --ticket --timeout --cphash --ticket-cache " \
         -- "$cur"))
     } &&
     complete -F _tpm2_policysecret tpm2_policysecret
@@ -3946,11 +4117,14 @@ _tpm2_policysigned()
             -x | --nonce-tpm)
                 _filedir
                 return;;
+            --stream)
+                _filedir
+                return;;
         esac
 
         COMPREPLY=($(compgen -W "-h --help -v --version -V --verbose -Q --quiet \
         -Z --enable-erata -T --tcti \
-        -L -S -c -g -s -f -t -q -x --policy --session --key-context --hash-algorithm --signature --format --expiration --qualification --nonce-tpm --ticket --timeout " \
+        -L -S -c -g -s -f -t -q -x --policy --session --key-context --hash-algorithm --signature --format --expiration --qualification --nonce-tpm --ticket --timeout --cphash-input --ticket-cache --stream " \
         -- "$cur"))
     } &&
     complete -F _tpm2_policysigned tpm2_policysigned
@@ -4048,7 +4222,7 @@ _tpm2_policyticket()
 
         COMPREPLY=($(compgen -W "-h --help -v --version -V --verbose -Q --quiet \
         -Z --enable-erata -T --tcti \
-        -L -S -n -q --policy --session --name --qualification --ticket --timeout " \
+        -L -S -n -q --policy --session --name --qualification --ticket --timeout --cphash-input --ticket-cache " \
         -- "$cur"))
     } &&
     complete -F _tpm2_policyticket tpm2_policyticket
@@ -4091,7 +4265,7 @@ _tpm2_print()
 
         COMPREPLY=($(compgen -W "-h --help -v --version -V --verbose -Q --quiet \
         -Z --enable-erata -T --tcti \
-        -t --type " \
+        -t --type -f --format --name --json " \
         -- "$cur"))
     } &&
     complete -F _tpm2_print tpm2_print
@@ -4105,7 +4279,7 @@ _tpm2_quote()
 
         local format_methods=(tss plain)
 
-        local pcr_format_methods=(values serialized)
+        local pcr_format_methods=(values serialized bundle)
 
         local signing_scheme=(rsassa rsapss ecdsa ecdaa sm2 ecshnorr hmac)
 
@@ -4159,11 +4333,14 @@ _tpm2_quote()
             -g | --hash-algorithm)
                 COMPREPLY=($(compgen -W "${hash_methods[*]}" -- "$cur"))
                 return;;
+            --manifest | --bundle | --eventlog)
+                _filedir
+                return;;
         esac
 
         COMPREPLY=($(compgen -W "-h --help -v --version -V --verbose -Q --quiet \
         -Z --enable-erata -T --tcti -F --pcrs_format \
-        -c -p -l -m -s -f -o -q -g --key-context --auth --pcr-list --message --signature --format --pcr --qualification --hash-algorithm --cphash " \
+        -c -p -l -m -s -f -o -q -g --key-context --auth --pcr-list --message --signature --format --pcr --qualification --hash-algorithm --cphash --manifest --bundle --eventlog " \
         -- "$cur"))
     } &&
     complete -F _tpm2_quote tpm2_quote
@@ -4243,7 +4420,7 @@ _tpm2_readclock()
 
         COMPREPLY=($(compgen -W "-h --help -v --version -V --verbose -Q --quiet \
         -Z --enable-erata -T --tcti \
-        " \
+        --watch --polls --max-drift " \
         -- "$cur"))
     } &&
     complete -F _tpm2_readclock tpm2_readclock
@@ -4298,7 +4475,8 @@ _tpm2_readpublic()
 
         COMPREPLY=($(compgen -W "-h --help -v --version -V --verbose -Q --quiet \
         -Z --enable-erata -T --tcti \
-        -c -n -o -t -q --object-context --name --output --serialized-handle --qualified-name " \
+        -c -n -o -t -q --object-context --name --output --serialized-handle --qualified-name --json \
+        --persistent " \
         -- "$cur"))
     } &&
     complete -F _tpm2_readpublic tpm2_readpublic
@@ -4353,7 +4531,8 @@ _tpm2_rsadecrypt()
 
         COMPREPLY=($(compgen -W "-h --help -v --version -V --verbose -Q --quiet \
         -Z --enable-erata -T --tcti \
-        -c -p -o -s -l --key-context --auth --output --scheme --label --cphash " \
+        -c -p -o -s -l --key-context --auth --output --scheme --label --cphash \
+        --batch " \
         -- "$cur"))
     } &&
     complete -F _tpm2_rsadecrypt tpm2_rsadecrypt
@@ -4401,11 +4580,15 @@ _tpm2_rsaencrypt()
             -l | --label)
                 _filedir
                 return;;
+            -u | --public)
+                _filedir
+                return;;
         esac
 
         COMPREPLY=($(compgen -W "-h --help -v --version -V --verbose -Q --quiet \
         -Z --enable-erata -T --tcti \
-        -c -o -s -l --key-context --output --scheme --label " \
+        -c -o -s -l -u --key-context --output --scheme --label --public \
+        --batch " \
         -- "$cur"))
     } &&
     complete -F _tpm2_rsaencrypt tpm2_rsaencrypt
@@ -4496,6 +4679,27 @@ _tpm2_send()
     } &&
     complete -F _tpm2_send tpm2_send
 # ex: filetype=sh
+# bash completion for tpm2_serve                   -*- shell-script -*-
+_tpm2_serve()
+    {
+        local cur prev words cword split
+        _init_completion -s || return
+        case $prev in
+            -h | --help)
+                COMPREPLY=( $(compgen -W "man no-man" -- "$cur") )
+                return;;
+            -T | --tcti)
+                COMPREPLY=( $(compgen -W "tabrmd mssim device none" -- "$cur") )
+                return;;
+        esac
+
+        COMPREPLY=($(compgen -W "-h --help -v --version -V --verbose -Q --quiet \
+        -Z --enable-erata -T --tcti --nv-bits-interval --priority \
+        --max-long " \
+        -- "$cur"))
+    } &&
+    complete -F _tpm2_serve tpm2_serve
+# ex: filetype=sh
 # bash completion for tpm2_setclock                   -*- shell-script -*-
 _tpm2_setclock()
     {
@@ -4744,11 +4948,15 @@ _tpm2_sign()
             -f | --format)
                 COMPREPLY=($(compgen -W "${format_methods[*]}" -- "$cur"))
                 return;;
+            --manifest | --tree-manifest)
+                _filedir
+                return;;
         esac
 
         COMPREPLY=($(compgen -W "-h --help -v --version -V --verbose -Q --quiet \
         -Z --enable-erata -T --tcti \
-        -c -p -g -s -d -t -o -f --key-context --auth --hash-algorithm --scheme --digest --ticket --signature --format --cphash " \
+        -c -p -g -s -d -t -o -f --key-context --auth --hash-algorithm --scheme --digest --ticket --signature --format --cphash --commit-index --manifest --batch \
+        --tree-hash --tree-manifest " \
         -- "$cur"))
     } &&
     complete -F _tpm2_sign tpm2_sign
@@ -4793,11 +5001,15 @@ _tpm2_startauthsession()
             -S | --session)
                 _filedir
                 return;;
+            --pool)
+                _filedir -d
+                return;;
         esac
 
         COMPREPLY=($(compgen -W "-h --help -v --version -V --verbose -Q --quiet \
         -Z --enable-erata -T --tcti \
-        -g -c -S --hash-algorithm --key-context --session --policy --audit " \
+        -g -c -S --hash-algorithm --key-context --session --policy --audit \
+        --pool --fill-pool --from-pool " \
         -- "$cur"))
     } &&
     complete -F _tpm2_startauthsession tpm2_startauthsession
@@ -4880,7 +5092,7 @@ _tpm2_stirrandom()
 
         COMPREPLY=($(compgen -W "-h --help -v --version -V --verbose -Q --quiet \
         -Z --enable-erata -T --tcti \
-        " \
+        --stream " \
         -- "$cur"))
     } &&
     complete -F _tpm2_stirrandom tpm2_stirrandom
@@ -4965,11 +5177,18 @@ _tpm2_unseal()
             -o | --output)
                 _filedir
                 return;;
+            -C | --parent-context | --manifest)
+                _filedir
+                return;;
+            -P | --parent-auth)
+                COMPREPLY=($(compgen -W "${auth_methods[*]}" -- "$cur"))
+                return;;
         esac
 
         COMPREPLY=($(compgen -W "-h --help -v --version -V --verbose -Q --quiet \
         -Z --enable-erata -T --tcti \
-        -c -p -o --object-context --auth --output --cphash " \
+        -c -p -o --object-context --auth --output --cphash \
+        -C -P --parent-context --parent-auth --manifest --reseal " \
         -- "$cur"))
     } &&
     complete -F _tpm2_unseal tpm2_unseal
@@ -5026,11 +5245,15 @@ _tpm2_verifysignature()
             -t | --ticket)
                 _filedir
                 return;;
+            -u | --public | --manifest | --tree)
+                _filedir
+                return;;
         esac
 
         COMPREPLY=($(compgen -W "-h --help -v --version -V --verbose -Q --quiet \
         -Z --enable-erata -T --tcti \
-        -c -g -m -d -s -f -t --key-context --hash-algorithm --message --digest --signature --scheme --ticket --format " \
+        -c -g -m -d -s -f -t -u --key-context --hash-algorithm --message --digest --signature --scheme --ticket --format --public --manifest --jobs \
+        --tree --range " \
         -- "$cur"))
     } &&
     complete -F _tpm2_verifysignature tpm2_verifysignature
@@ -5078,11 +5301,15 @@ _tpm2_zgen2phase()
             -t | --counter)
                 _filedir
                 return;;
+            --peers | --pool | --output-ephemeral)
+                _filedir
+                return;;
         esac
 
         COMPREPLY=($(compgen -W "-h --help -v --version -V --verbose -Q --quiet \
         -Z --enable-erata -T --tcti \
-        -c -p -s -t --key-context --key-auth --scheme --counter --static --ephemeral --output --output " \
+        -c -p -s -t --key-context --key-auth --scheme --counter --static --ephemeral --output --output \
+        --batch --peers --pool --output-ephemeral " \
         -- "$cur"))
     } &&
     complete -F _tpm2_zgen2phase tpm2_zgen2phase
@@ -5092,7 +5319,7 @@ _tpm2() {
             _init_completion -s || return
 
             if ((cword == 1)); then
-                COMPREPLY=($(compgen -W "activatecredential certify certifyX509certutil certifycreation changeauth changeeps changepps checkquote clear clearcontrol clockrateadjust commit create createak createek createpolicy createprimary dictionarylockout duplicate ecdhkeygen ecdhzgen ecephemeral encryptdecrypt eventlog evictcontrol flushcontext getcap getcommandauditdigest geteccparameters getekcertificate getrandom getsessionauditdigest gettestresult gettime hash hierarchycontrol hmac import incrementalselftest load loadexternal makecredential nvcertify nvdefine nvextend nvincrement nvread nvreadlock nvreadpublic nvsetbits nvundefine nvwrite nvwritelock pcrallocate pcrevent pcrextend pcrread pcrreset policyauthorize policyauthorizenv policyauthvalue policycommandcode policycountertimer policycphash policyduplicationselect policylocality policynamehash policynv policynvwritten policyor policypassword policypcr policyrestart policysecret policysigned policytemplate policyticket print quote rc_decode readclock readpublic rsadecrypt rsaencrypt selftest send setclock setcommandauditstatus setprimarypolicy shutdown sign startauthsession startup stirrandom testparms unseal verifysignature zgen2phase " -- "$cur"))
+                COMPREPLY=($(compgen -W "activatecredential batch certify certifyX509certutil certifycreation changeauth changeeps changepps checkquote clear clearcontrol clockrateadjust commit cphash create createak createek createpolicy createprimary dictionarylockout duplicate ecdhkeygen ecdhzgen ecephemeral encryptdecrypt eventlog evictcontrol flushcontext getcap getcommandauditdigest geteccparameters getekcertificate getrandom getsessionauditdigest gettestresult gettime hash hierarchycontrol hmac import incrementalselftest load loadexternal makecredential nvcertify nvdefine nvextend nvincrement nvread nvreadlock nvreadpublic nvsetbits nvundefine nvwrite nvwritelock pcrallocate pcrevent pcrextend pcrread pcrreset policyauthorize policyauthorizenv policyauthvalue policycommandcode policycountertimer policycphash policyduplicationselect policylocality policynamehash policynv policynvwritten policyor policypassword policypcr policyrestart policysecret policysigned policytemplate policyticket print quote rc_decode readclock readpublic rsadecrypt rsaencrypt selftest send serve setclock setcommandauditstatus setprimarypolicy shutdown sign startauthsession startup stirrandom testparms unseal verifysignature zgen2phase " -- "$cur"))
             else
                 tpmcommand=_tpm2_$prev
                 type $tpmcommand &>/dev/null && $tpmcommand
@@ -9,13 +9,25 @@
 #include <stdlib.h>
 #include <string.h>
 #include <strings.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #include <tss2/tss2_mu.h>
 
 #include "files.h"
 #include "log.h"
+#include "object.h"
 #include "tpm2.h"
+#include "tpm2_ctx_archive.h"
+#include "tpm2_rpc.h"
+#include "tpm2_stats.h"
 #include "tpm2_tool.h"
+#include "tpm2_util.h"
 
 /**
  * This is the magic for the file header. The header is organized
@@ -60,6 +72,8 @@ static bool writex(FILE *f, UINT8 *data, size_t size) {
         index += wrote;
     } while (size > 0);
 
+    tpm2_stats_file_written(index);
+
     return true;
 }
 
@@ -81,6 +95,8 @@ static size_t readx(FILE *f, UINT8 *data, size_t size) {
         bread += fread(&data[bread], 1, size-bread, f);
     } while (bread < size && !feof(f) && errno == EINTR);
 
+    tpm2_stats_file_read(bread);
+
     return bread;
 }
 
@@ -163,13 +179,56 @@ bool file_read_bytes_from_file(FILE *f, UINT8 *buf, UINT16 *size,
     return true;
 }
 
+static bool load_bytes_from_archive(const char *path, const char *name,
+        UINT8 *buf, UINT16 *size) {
+
+    tpm2_ctx_archive archive;
+    if (!tpm2_ctx_archive_open(&archive, path)) {
+        return false;
+    }
+
+    const UINT8 *data = NULL;
+    size_t data_size = 0;
+    bool result = tpm2_ctx_archive_find(&archive, name, &data, &data_size);
+    if (!result) {
+        LOG_ERR("No member \"%s\" in archive \"%s\"", name, path);
+    } else if (data_size > *size) {
+        LOG_ERR("Member \"%s\" of archive \"%s\" is larger than buffer, got "
+                "%zu expected less than or equal to %u", name, path, data_size,
+                *size);
+        result = false;
+    } else {
+        memcpy(buf, data, data_size);
+        *size = data_size;
+    }
+
+    tpm2_ctx_archive_close(&archive);
+
+    return result;
+}
+
 bool files_load_bytes_from_path(const char *path, UINT8 *buf, UINT16 *size) {
 
     if (!buf || !size || !path) {
         return false;
     }
 
-    FILE *f = fopen(path, "rb");
+    /* what a tool of tpm2_batch or tpm2_serve saved to a reference */
+    /* the file of a reference is one of the daemon, not of the user */
+    char ref_file[PATH_MAX];
+    bool is_ref = tpm2_object_ref_file(path, ref_file);
+    if (is_ref) {
+        path = ref_file;
+    }
+
+    /* a member of an archive, ie a duplicate of tpm2_duplicate --manifest */
+    char archive_path[PATH_MAX];
+    const char *name;
+    if (!is_ref && tpm2_ctx_archive_split(path, archive_path, &name)) {
+        return load_bytes_from_archive(archive_path, name, buf, size);
+    }
+
+    FILE *f = is_ref ? fopen(path, "rb") : files_fopen(path, "rb");
     if (!f) {
         LOG_ERR("Could not open file \"%s\" error %s", path, strerror(errno));
         return false;
@@ -191,7 +250,14 @@ bool files_save_bytes_to_file(const char *path, UINT8 *buf, UINT16 size) {
         return true;
     }
 
-    FILE *fp = path ? fopen(path, "wb+") : stdout;
+    char ref_file[PATH_MAX];
+    bool is_ref = tpm2_object_ref_file(path, ref_file);
+    if (is_ref) {
+        path = ref_file;
+    }
+
+    FILE *fp = is_ref ? fopen(path, "wb+") :
+            path ? files_fopen(path, "wb+") : stdout;
     if (!fp) {
         LOG_ERR("Could not open file \"%s\", error: %s", path, strerror(errno));
         return false;
@@ -286,18 +352,61 @@ tool_rc files_save_tpm_context_to_file(ESYS_CONTEXT *ectx, ESYS_TR handle,
     return result ? tool_rc_success : tool_rc_general_error;
 }
 
+/* saves a context file as a member of an archive, ie to archive#name */
+static tool_rc save_to_archive(ESYS_CONTEXT *context, ESYS_TR handle,
+        const char *archive_path, const char *name) {
+
+    char *data = NULL;
+    size_t size = 0;
+    FILE *f = open_memstream(&data, &size);
+    if (!f) {
+        LOG_ERR("oom");
+        return tool_rc_general_error;
+    }
+
+    tool_rc rc = files_save_tpm_context_to_file(context, handle, f);
+    if (fclose(f)) {
+        LOG_ERR("oom");
+        rc = tool_rc_general_error;
+    }
+
+    if (rc == tool_rc_success && !tpm2_ctx_archive_store(archive_path, name,
+            (UINT8 *) data, size)) {
+        rc = tool_rc_general_error;
+    }
+
+    free(data);
+
+    return rc;
+}
+
 tool_rc files_save_tpm_context_to_path(ESYS_CONTEXT *context, ESYS_TR handle,
         const char *path) {
 
-    FILE *f = fopen(path, "w+b");
+    /* the object stays loaded for the next tools, no ContextSave */
+    if (tpm2_object_is_ref(path)) {
+        return tpm2_object_ref_save(context, handle, path);
+    }
+
+    char archive_path[PATH_MAX];
+    const char *name;
+    if (tpm2_ctx_archive_split(path, archive_path, &name)) {
+        return save_to_archive(context, handle, archive_path, name);
+    }
+
+    /* a tool loading the context in parallel never sees a partial one */
+    files_atomic atomic;
+    FILE *f = files_atomic_fopen(&atomic, path);
     if (!f) {
-        LOG_ERR("Error opening file \"%s\" due to error: %s", path,
-                strerror(errno));
         return tool_rc_general_error;
     }
 
     tool_rc rc = files_save_tpm_context_to_file(context, handle, f);
-    fclose(f);
+    bool result = files_atomic_close(&atomic, f, rc == tool_rc_success);
+    if (rc == tool_rc_success && !result) {
+        rc = tool_rc_general_error;
+    }
+
     return rc;
 }
 
@@ -461,10 +570,21 @@ tool_rc files_load_tpm_context_from_file(ESYS_CONTEXT *context,
     out: return rc;
 }
 
+bool files_is_tpm_context_file(FILE *f) {
+
+    return check_magic(f, true);
+}
+
 tool_rc files_load_tpm_context_from_path(ESYS_CONTEXT *context,
         ESYS_TR *tr_handle, const char *path) {
 
-    FILE *f = fopen(path, "rb");
+    char archive_path[PATH_MAX];
+    const char *name;
+    if (tpm2_ctx_archive_split(path, archive_path, &name)) {
+        return tpm2_ctx_archive_load(context, archive_path, name, tr_handle);
+    }
+
+    FILE *f = files_fopen(path, "rb");
     if (!f) {
         LOG_WARN("Error opening file \"%s\" due to error: %s", path,
                 strerror(errno));
@@ -484,7 +604,7 @@ bool files_does_file_exist(const char *path) {
         return false;
     }
 
-    FILE *fp = fopen(path, "rb");
+    FILE *fp = files_fopen(path, "rb");
     if (fp) {
         fclose(fp);
         LOG_WARN("Path: %s already exists. Please rename or delete the file!",
@@ -508,7 +628,7 @@ bool files_get_file_size_path(const char *path, unsigned long *file_size) {
         return false;
     }
 
-    FILE *fp = fopen(path, "rb");
+    FILE *fp = files_fopen(path, "rb");
     if (!fp) {
         LOG_ERR("Could not open file: \"%s\" error: %s", path, strerror(errno));
         return false;
@@ -580,6 +700,52 @@ bool files_write_bytes(FILE *out, uint8_t bytes[], size_t len) {
     return writex(out, bytes, len);
 }
 
+bool files_write_record(FILE *out, UINT8 data[], UINT16 size) {
+
+    BAIL_ON_NULL("FILE", out);
+    BAIL_ON_NULL("data", data);
+
+    return files_write_16(out, size) && writex(out, data, size);
+}
+
+bool files_read_record(FILE *out, UINT8 data[], UINT16 *size, bool *is_end) {
+
+    BAIL_ON_NULL("FILE", out);
+    BAIL_ON_NULL("data", data);
+    BAIL_ON_NULL("size", size);
+    BAIL_ON_NULL("is_end", is_end);
+
+    UINT8 header[sizeof(UINT16)];
+    size_t len = readx(out, header, sizeof(header));
+    *is_end = !len && !ferror(out);
+    if (*is_end) {
+        return true;
+    }
+
+    if (len != sizeof(header)) {
+        LOG_ERR("Truncated record size, read %zu of %zu bytes", len,
+                sizeof(header));
+        return false;
+    }
+
+    UINT16 record_size = (UINT16) (header[0] << 8 | header[1]);
+    if (record_size > *size) {
+        LOG_ERR("Record of %u bytes exceeds the maximum of %u bytes",
+                record_size, *size);
+        return false;
+    }
+
+    len = readx(out, data, record_size);
+    if (len != record_size) {
+        LOG_ERR("Truncated record, read %zu of %u bytes", len, record_size);
+        return false;
+    }
+
+    *size = record_size;
+
+    return true;
+}
+
 bool files_write_header(FILE *out, UINT32 version) {
 
     BAIL_ON_NULL("FILE", out);
@@ -617,7 +783,20 @@ bool files_load_bytes_from_buffer_or_file_or_stdin(const char *input_buffer,
     if (!input_buffer && !path) {
         UINT16 read_bytes = 0;
         while (1) {
-            read_bytes += fread(buf, 1, upper_bound, stdin);
+            size_t chunk = fread(&buf[read_bytes], 1,
+                    upper_bound - read_bytes, stdin);
+            tpm2_stats_file_read(chunk);
+            read_bytes += chunk;
+            if (read_bytes == upper_bound && !feof(stdin)
+                    && !ferror(stdin)) {
+                /* like for a file, input larger than the buffer is an error */
+                int c = fgetc(stdin);
+                if (c != EOF) {
+                    LOG_ERR("Input from stdin is larger than %u bytes",
+                            upper_bound);
+                    return false;
+                }
+            }
             if (feof(stdin)) {
                 *size = read_bytes;
                 return true;
@@ -658,7 +837,11 @@ tool_rc files_save_ESYS_TR(ESYS_CONTEXT *ectx, ESYS_TR handle, const char *path)
         return rc;
     }
 
-    bool result = files_save_bytes_to_file(path, buffer, size);
+    char archive_path[PATH_MAX];
+    const char *name;
+    bool result = tpm2_ctx_archive_split(path, archive_path, &name) ?
+            tpm2_ctx_archive_store(archive_path, name, buffer, size) :
+            files_save_bytes_to_file(path, buffer, size);
     free(buffer);
     return result ? tool_rc_success : tool_rc_general_error;
 }
@@ -883,3 +1066,674 @@ TPM2B_PUBLIC *public_data) {
 
     return tool_rc_success;
 }
+
+static void files_input_map(files_input *input) {
+
+    struct stat st;
+    int fd = fileno(input->file);
+    if (fd < 0 || fstat(fd, &st) || !S_ISREG(st.st_mode)) {
+        return;
+    }
+
+    /* mmap works on the descriptor, not on what stdio already buffered */
+    off_t offset = ftello(input->file);
+    if (offset < 0 || offset > st.st_size) {
+        return;
+    }
+
+    /* nothing to map, the stream reports EOF just as well */
+    if (!st.st_size) {
+        return;
+    }
+
+    void *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (map == MAP_FAILED) {
+        LOG_INFO("Could not map file, streaming instead, error: %s",
+                strerror(errno));
+        return;
+    }
+
+    madvise(map, st.st_size, MADV_SEQUENTIAL);
+    input->map = map;
+    input->map_size = st.st_size;
+    input->offset = offset;
+}
+
+bool files_input_open_file(files_input *input, FILE *f) {
+
+    memset(input, 0, sizeof(*input));
+    input->file = f;
+
+    /* anything that can't be mapped is streamed */
+    files_input_map(input);
+
+    return true;
+}
+
+bool files_input_open(files_input *input, const char *path) {
+
+    FILE *f = stdin;
+    if (path) {
+        f = files_fopen(path, "rb");
+        if (!f) {
+            LOG_ERR("Could not open file \"%s\", error: %s", path,
+                    strerror(errno));
+            return false;
+        }
+    }
+
+    bool result = files_input_open_file(input, f);
+    if (!result) {
+        if (path) {
+            fclose(f);
+        }
+        return false;
+    }
+
+    input->is_file_owned = !!path;
+
+    return true;
+}
+
+bool files_input_next(files_input *input, size_t max, const UINT8 **data,
+        size_t *size) {
+
+    if (input->map) {
+        size_t left = input->map_size - input->offset;
+        *size = left < max ? left : max;
+        *data = input->map + input->offset;
+        input->offset += *size;
+        tpm2_stats_file_read(*size);
+        return true;
+    }
+
+    if (input->buffer_size < max) {
+        UINT8 *tmp = realloc(input->buffer, max);
+        if (!tmp) {
+            LOG_ERR("oom");
+            return false;
+        }
+        input->buffer = tmp;
+        input->buffer_size = max;
+    }
+
+    *size = fread(input->buffer, 1, max, input->file);
+    tpm2_stats_file_read(*size);
+    if (ferror(input->file)) {
+        LOG_ERR("Error reading from input file");
+        return false;
+    }
+
+    *data = input->buffer;
+
+    return true;
+}
+
+bool files_input_read(files_input *input, UINT8 *buf, size_t max,
+        size_t *size) {
+
+    if (input->map) {
+        const UINT8 *data;
+        bool result = files_input_next(input, max, &data, size);
+        memcpy(buf, data, *size);
+        return result;
+    }
+
+    /* a pipe can return less than asked for before the end */
+    *size = 0;
+    while (*size < max && !feof(input->file)) {
+        size_t chunk = fread(&buf[*size], 1, max - *size, input->file);
+        tpm2_stats_file_read(chunk);
+        *size += chunk;
+        if (ferror(input->file)) {
+            LOG_ERR("Error reading from input file");
+            return false;
+        }
+    }
+
+    return true;
+}
+
+bool files_input_read_all(files_input *input, const UINT8 **data,
+        size_t *size) {
+
+    if (input->map) {
+        return files_input_next(input, input->map_size - input->offset, data,
+                size);
+    }
+
+    /* pseudo files like securityfs report no size, so grow as we go */
+    size_t used = 0;
+    while (!feof(input->file)) {
+        if (used == input->buffer_size) {
+            size_t new_size = input->buffer_size ?
+                    input->buffer_size * 2 : 16384;
+            UINT8 *tmp = realloc(input->buffer, new_size);
+            if (!tmp) {
+                LOG_ERR("oom");
+                return false;
+            }
+            input->buffer = tmp;
+            input->buffer_size = new_size;
+        }
+
+        size_t chunk = fread(&input->buffer[used], 1,
+                input->buffer_size - used, input->file);
+        tpm2_stats_file_read(chunk);
+        used += chunk;
+        if (ferror(input->file)) {
+            LOG_ERR("Error reading from input file");
+            return false;
+        }
+    }
+
+    *data = input->buffer;
+    *size = used;
+
+    return true;
+}
+
+bool files_input_at_end(files_input *input) {
+
+    if (input->map) {
+        return input->offset == input->map_size;
+    }
+
+    int c = fgetc(input->file);
+    if (c == EOF) {
+        return true;
+    }
+
+    ungetc(c, input->file);
+
+    return false;
+}
+
+void files_input_close(files_input *input) {
+
+    if (input->map) {
+        munmap(input->map, input->map_size);
+        /* leave a borrowed stream where the consumer stopped */
+        if (!input->is_file_owned) {
+            fseeko(input->file, input->offset, SEEK_SET);
+        }
+    }
+
+    if (input->is_file_owned) {
+        fclose(input->file);
+    }
+
+    free(input->buffer);
+    memset(input, 0, sizeof(*input));
+}
+
+int files_open(const char *path, int flags, mode_t mode) {
+
+    return tpm2_rpc_open(path, flags, mode);
+}
+
+FILE *files_fopen(const char *path, const char *mode) {
+
+    bool is_update = strchr(mode, '+');
+    int flags = is_update ? O_RDWR : O_WRONLY;
+    switch (mode[0]) {
+    case 'r':
+        flags = is_update ? O_RDWR : O_RDONLY;
+        break;
+    case 'w':
+        flags |= O_CREAT | O_TRUNC;
+        break;
+    case 'a':
+        flags |= O_CREAT | O_APPEND;
+        break;
+    default:
+        errno = EINVAL;
+        return NULL;
+    }
+
+    int fd = files_open(path, flags, 0666);
+    if (fd < 0) {
+        return NULL;
+    }
+
+    FILE *f = fdopen(fd, mode);
+    if (!f) {
+        int error = errno;
+        close(fd);
+        errno = error;
+    }
+
+    return f;
+}
+
+bool files_stat(const char *path, struct stat *st) {
+
+    int fd = files_open(path, O_PATH, 0);
+    if (fd < 0) {
+        return false;
+    }
+
+    bool result = !fstat(fd, st);
+    int error = errno;
+    close(fd);
+    errno = error;
+
+    return result;
+}
+
+DIR *files_opendir(const char *path) {
+
+    int fd = files_open(path, O_RDONLY | O_DIRECTORY, 0);
+    if (fd < 0) {
+        return NULL;
+    }
+
+    DIR *dir = fdopendir(fd);
+    if (!dir) {
+        int error = errno;
+        close(fd);
+        errno = error;
+    }
+
+    return dir;
+}
+
+char *files_temp_dir_create(const char *prefix, const char *what) {
+
+    const char *tmpdir = tpm2_util_getenv("TMPDIR");
+    if (!tmpdir || !tmpdir[0]) {
+        tmpdir = "/tmp";
+    }
+
+    size_t len = strlen(tmpdir) + strlen(prefix) + sizeof("/-XXXXXX");
+    char *dir = malloc(len);
+    if (!dir) {
+        LOG_ERR("oom");
+        return NULL;
+    }
+
+    snprintf(dir, len, "%s/%s-XXXXXX", tmpdir, prefix);
+    if (!mkdtemp(dir)) {
+        LOG_ERR("Could not create %s directory \"%s\", error: %s", what, dir,
+                strerror(errno));
+        free(dir);
+        return NULL;
+    }
+
+    return dir;
+}
+
+FILE *files_atomic_open(files_atomic *atomic, const char *path) {
+
+    atomic->dir_fd = -1;
+
+    /* replace the file a link points to, not the link */
+    if (!realpath(path, atomic->path)) {
+        int len = snprintf(atomic->path, sizeof(atomic->path), "%s", path);
+        if (len < 0 || (size_t) len >= sizeof(atomic->path)) {
+            LOG_ERR("Path \"%s\" is too long", path);
+            return NULL;
+        }
+    }
+
+    struct stat st;
+    bool is_existing = !stat(atomic->path, &st);
+    atomic->is_in_place = is_existing && !S_ISREG(st.st_mode);
+    if (atomic->is_in_place) {
+        atomic->tmp_path[0] = '\0';
+        FILE *f = fopen(atomic->path, "wb");
+        if (!f) {
+            LOG_ERR("Could not open path \"%s\", due to error: \"%s\"",
+                    atomic->path, strerror(errno));
+        }
+        return f;
+    }
+
+    int len = snprintf(atomic->tmp_path, sizeof(atomic->tmp_path), "%s.%ld",
+            atomic->path, (long) getpid());
+    if (len < 0 || (size_t) len >= sizeof(atomic->tmp_path)) {
+        LOG_ERR("Path \"%s\" is too long", path);
+        return NULL;
+    }
+
+    FILE *f = fopen(atomic->tmp_path, "w+b");
+    if (!f) {
+        LOG_ERR("Could not open path \"%s\", due to error: \"%s\"",
+                atomic->tmp_path, strerror(errno));
+        return NULL;
+    }
+
+    if (is_existing) {
+        int rc = fchmod(fileno(f), st.st_mode & 07777);
+        UNUSED(rc);
+    }
+
+    return f;
+}
+
+#define FILES_ATOMIC_LINK_MAX 8
+
+/* the last component of a path */
+static const char *atomic_name(const char *path) {
+
+    const char *name = strrchr(path, '/');
+
+    return name ? name + 1 : path;
+}
+
+FILE *files_atomic_fopen(files_atomic *atomic, const char *path) {
+
+    atomic->dir_fd = -1;
+    atomic->is_in_place = false;
+    atomic->tmp_path[0] = '\0';
+
+    int len = snprintf(atomic->path, sizeof(atomic->path), "%s", path);
+    if (len < 0 || (size_t) len >= sizeof(atomic->path)) {
+        LOG_ERR("Path \"%s\" is too long", path);
+        return NULL;
+    }
+
+    /*
+     * Resolve the links one at a time through the directories the client
+     * opens, there is no realpath() of the client. A file that is not a
+     * regular one, ie /dev/stdout, is written in place before its link, a
+     * magic one, is resolved.
+     */
+    struct stat st;
+    bool is_existing = false;
+    unsigned links;
+    for (links = 0; ; links++) {
+        const char *name = atomic_name(atomic->path);
+        char dir[PATH_MAX];
+        snprintf(dir, sizeof(dir), "%.*s", (int) (name - atomic->path),
+                atomic->path);
+
+        atomic->dir_fd = files_open(dir[0] ? dir : ".",
+                O_RDONLY | O_DIRECTORY, 0);
+        if (atomic->dir_fd < 0) {
+            LOG_ERR("Could not open the directory of \"%s\", due to error: "
+                    "\"%s\"", atomic->path, strerror(errno));
+            return NULL;
+        }
+
+        is_existing = !fstatat(atomic->dir_fd, name, &st, 0);
+        if (is_existing && !S_ISREG(st.st_mode)) {
+            atomic->is_in_place = true;
+            break;
+        }
+
+        struct stat link_st;
+        char target[PATH_MAX];
+        ssize_t size = links < FILES_ATOMIC_LINK_MAX
+                && !fstatat(atomic->dir_fd, name, &link_st,
+                        AT_SYMLINK_NOFOLLOW)
+                && S_ISLNK(link_st.st_mode) ?
+                readlinkat(atomic->dir_fd, name, target, sizeof(target) - 1) :
+                -1;
+        if (size < 0) {
+            break;
+        }
+        target[size] = '\0';
+
+        /* a relative link is relative to the directory of the link */
+        char resolved[PATH_MAX];
+        len = target[0] == '/' ?
+                snprintf(resolved, sizeof(resolved), "%s", target) :
+                snprintf(resolved, sizeof(resolved), "%s%s", dir, target);
+        if (len < 0 || (size_t) len >= sizeof(resolved)) {
+            LOG_ERR("Path \"%s\" is too long", target);
+            close(atomic->dir_fd);
+            atomic->dir_fd = -1;
+            return NULL;
+        }
+
+        memcpy(atomic->path, resolved, len + 1);
+        close(atomic->dir_fd);
+        atomic->dir_fd = -1;
+    }
+
+    if (atomic->is_in_place) {
+        close(atomic->dir_fd);
+        atomic->dir_fd = -1;
+        FILE *f = files_fopen(atomic->path, "wb");
+        if (!f) {
+            LOG_ERR("Could not open path \"%s\", due to error: \"%s\"",
+                    atomic->path, strerror(errno));
+        }
+        return f;
+    }
+
+    len = snprintf(atomic->tmp_path, sizeof(atomic->tmp_path), "%s.%ld",
+            atomic->path, (long) getpid());
+    if (len < 0 || (size_t) len >= sizeof(atomic->tmp_path)) {
+        LOG_ERR("Path \"%s\" is too long", path);
+        close(atomic->dir_fd);
+        atomic->dir_fd = -1;
+        return NULL;
+    }
+
+    /* created by the client, with its umask */
+    FILE *f = files_fopen(atomic->tmp_path, "w+b");
+    if (!f) {
+        LOG_ERR("Could not open path \"%s\", due to error: \"%s\"",
+                atomic->tmp_path, strerror(errno));
+        close(atomic->dir_fd);
+        atomic->dir_fd = -1;
+        return NULL;
+    }
+
+    if (is_existing) {
+        int rc = fchmod(fileno(f), st.st_mode & 07777);
+        UNUSED(rc);
+    }
+
+    return f;
+}
+
+bool files_atomic_close(files_atomic *atomic, FILE *f, bool commit) {
+
+    bool result = !fclose(f);
+    if (atomic->is_in_place) {
+        return commit && result;
+    }
+
+    int dir_fd = atomic->dir_fd;
+    atomic->dir_fd = -1;
+    if (dir_fd >= 0) {
+        const char *name = atomic_name(atomic->path);
+        const char *tmp_name = atomic_name(atomic->tmp_path);
+        if (commit && result && !renameat(dir_fd, tmp_name, dir_fd, name)) {
+            close(dir_fd);
+            return true;
+        }
+
+        if (commit) {
+            LOG_ERR("Could not replace \"%s\", due to error: \"%s\"",
+                    atomic->path, strerror(errno));
+        }
+
+        unlinkat(dir_fd, tmp_name, 0);
+        close(dir_fd);
+
+        return false;
+    }
+
+    if (commit && result && !rename(atomic->tmp_path, atomic->path)) {
+        return true;
+    }
+
+    if (commit) {
+        LOG_ERR("Could not replace \"%s\", due to error: \"%s\"", atomic->path,
+                strerror(errno));
+    }
+
+    unlink(atomic->tmp_path);
+
+    return false;
+}
+
+/* opens the directory of a path of the user, name is its last component */
+static int open_parent(const char *path, const char **name) {
+
+    *name = atomic_name(path);
+
+    char dir[PATH_MAX];
+    int len = snprintf(dir, sizeof(dir), "%.*s", (int) (*name - path), path);
+    if (len < 0 || (size_t) len >= sizeof(dir)) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+
+    return files_open(dir[0] ? dir : ".", O_RDONLY | O_DIRECTORY, 0);
+}
+
+bool files_rename(const char *old_path, const char *new_path) {
+
+    const char *old_name;
+    int old_dir = open_parent(old_path, &old_name);
+    if (old_dir < 0) {
+        return false;
+    }
+
+    const char *new_name;
+    int new_dir = open_parent(new_path, &new_name);
+    bool result = new_dir >= 0
+            && !renameat(old_dir, old_name, new_dir, new_name);
+
+    int error = errno;
+    close(old_dir);
+    if (new_dir >= 0) {
+        close(new_dir);
+    }
+    errno = error;
+
+    return result;
+}
+
+bool files_unlink(const char *path) {
+
+    const char *name;
+    int dir = open_parent(path, &name);
+    if (dir < 0) {
+        return false;
+    }
+
+    bool result = !unlinkat(dir, name, 0);
+
+    int error = errno;
+    close(dir);
+    errno = error;
+
+    return result;
+}
+
+#define FILES_LOCK_MAX 16
+#define FILES_LOCK_POLL_MS 10
+#define FILES_LOCK_TIMEOUT_MS 30000
+
+/* the files locked by this tool, a lock is shared by the users of a file */
+static struct {
+    int fd;
+    dev_t dev;
+    ino_t ino;
+    unsigned count;
+} files_locks[FILES_LOCK_MAX];
+static size_t files_lock_count;
+
+int files_lock(const char *path) {
+
+    unsigned waited = 0;
+    for (;;) {
+        int fd = files_open(path, O_RDONLY, 0);
+        if (fd < 0) {
+            LOG_ERR("Could not open path \"%s\", due to error: \"%s\"", path,
+                    strerror(errno));
+            return -1;
+        }
+
+        struct stat st;
+        if (fstat(fd, &st)) {
+            LOG_ERR("Could not stat path \"%s\", due to error: \"%s\"", path,
+                    strerror(errno));
+            close(fd);
+            return -1;
+        }
+
+        /* ie a session passed twice to a tool */
+        size_t i;
+        for (i = 0; i < files_lock_count; i++) {
+            if (files_locks[i].dev == st.st_dev
+                    && files_locks[i].ino == st.st_ino) {
+                close(fd);
+                files_locks[i].count++;
+                return files_locks[i].fd;
+            }
+        }
+
+        if (files_lock_count == FILES_LOCK_MAX) {
+            LOG_ERR("Too many locked files");
+            close(fd);
+            return -1;
+        }
+
+        while (flock(fd, LOCK_EX | LOCK_NB)) {
+            if (errno != EWOULDBLOCK && errno != EINTR) {
+                LOG_ERR("Could not lock path \"%s\", due to error: \"%s\"",
+                        path, strerror(errno));
+                close(fd);
+                return -1;
+            }
+
+            if (waited >= FILES_LOCK_TIMEOUT_MS) {
+                LOG_ERR("Timed out waiting for the lock of \"%s\"", path);
+                close(fd);
+                return -1;
+            }
+
+            if (!waited) {
+                LOG_INFO("Waiting for the lock of \"%s\"", path);
+            }
+
+            struct timespec ts = { .tv_nsec = FILES_LOCK_POLL_MS * 1000000L };
+            nanosleep(&ts, NULL);
+            waited += FILES_LOCK_POLL_MS;
+        }
+
+        /* the holder may have replaced the file, the new one is to lock */
+        struct stat current;
+        if (!files_stat(path, &current) || current.st_dev != st.st_dev
+                || current.st_ino != st.st_ino) {
+            close(fd);
+            continue;
+        }
+
+        files_locks[files_lock_count].fd = fd;
+        files_locks[files_lock_count].dev = st.st_dev;
+        files_locks[files_lock_count].ino = st.st_ino;
+        files_locks[files_lock_count].count = 1;
+        files_lock_count++;
+
+        return fd;
+    }
+}
+
+void files_unlock(int fd) {
+
+    if (fd < 0) {
+        return;
+    }
+
+    size_t i;
+    for (i = 0; i < files_lock_count; i++) {
+        if (files_locks[i].fd == fd) {
+            if (--files_locks[i].count) {
+                return;
+            }
+            files_locks[i] = files_locks[--files_lock_count];
+            break;
+        }
+    }
+
+    /* closing the last descriptor of the file releases the lock */
+    close(fd);
+}
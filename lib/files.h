@@ -3,9 +3,13 @@
 #ifndef FILES_H
 #define FILES_H
 
+#include <dirent.h>
+#include <limits.h>
 #include <stdbool.h>
 #include <stdio.h>
 
+#include <sys/stat.h>
+
 #include <tss2/tss2_esys.h>
 
 #include "tool_rc.h"
@@ -133,6 +137,17 @@ tool_rc files_load_tpm_context_from_path(ESYS_CONTEXT *context,
 tool_rc files_load_tpm_context_from_file(ESYS_CONTEXT *context,
         ESYS_TR *tr_handle, FILE *stream);
 
+/**
+ * Checks if a FILE stream is at a context file saved by
+ * files_save_tpm_context_to_file(), as opposed to a serialized ESYS_TR. The
+ * stream is left at the same position.
+ * @param f
+ *  The FILE stream to check.
+ * @return
+ *  True for a TPM context file, false otherwise.
+ */
+bool files_is_tpm_context_file(FILE *f);
+
 /**
  * Save an ESYS_TR to disk.
  * @param ectx
@@ -536,6 +551,36 @@ bool files_write_64(FILE *out, UINT64 data);
  */
 bool files_write_bytes(FILE *out, UINT8 data[], size_t size);
 
+/**
+ * Writes a record of a framed stream, its size as a 16 bit big endian value
+ * followed by its bytes, the same as a marshaled TPM2B.
+ * @param out
+ *  The file to write to.
+ * @param data
+ *  The record to write.
+ * @param size
+ *  The size of the record in bytes.
+ * @return
+ *  True on success, False otherwise.
+ */
+bool files_write_record(FILE *out, UINT8 data[], UINT16 size);
+
+/**
+ * Reads a record of a framed stream written by files_write_record().
+ * @param out
+ *  The file to read from.
+ * @param data
+ *  The buffer to read into, only valid on a True return.
+ * @param size
+ *  The size of the buffer on call, and the size of the record read on return.
+ * @param is_end
+ *  Set when the stream ended before a record, a True return then has no
+ *  record.
+ * @return
+ *  True on success, False on error or a truncated or oversized record.
+ */
+bool files_read_record(FILE *out, UINT8 data[], UINT16 *size, bool *is_end);
+
 /**
  * Reads a 16 bit value from a file converting from big endian to host
  * endianess.
@@ -628,4 +673,271 @@ bool files_load_attest_file(FILE *f, const char *path, TPMS_ATTEST *attest);
 tool_rc files_load_unique_data(const char *file_path,
 TPM2B_PUBLIC *public_data);
 
+/*
+ * A read only input that is mapped into memory when it is a regular file and
+ * streamed through an internal buffer otherwise, ie for pipes and stdin.
+ * Consumers get pointers to the data and never copy it themselves.
+ */
+typedef struct files_input files_input;
+struct files_input {
+    FILE *file;
+    bool is_file_owned;
+    UINT8 *map;
+    size_t map_size;
+    size_t offset;
+    UINT8 *buffer;
+    size_t buffer_size;
+};
+
+/**
+ * Opens an input by path.
+ * @param input
+ *  The input to initialize.
+ * @param path
+ *  The path of the file to open or NULL for stdin.
+ * @return
+ *  True on success, false otherwise.
+ */
+bool files_input_open(files_input *input, const char *path);
+
+/**
+ * Opens an input over an already opened FILE object, starting at its current
+ * position. The FILE object remains owned by the caller and is positioned at
+ * the end of the consumed data when the input is closed.
+ * @param input
+ *  The input to initialize.
+ * @param f
+ *  The FILE object to read.
+ * @return
+ *  True on success, false otherwise.
+ */
+bool files_input_open_file(files_input *input, FILE *f);
+
+/**
+ * Returns the next chunk of the input.
+ * @param input
+ *  The input to read.
+ * @param max
+ *  The maximum size of the chunk. For streamed inputs the chunk is only
+ *  shorter at the end of the input.
+ * @param data
+ *  Points to the chunk, valid until the next call or the input is closed.
+ * @param size
+ *  The size of the chunk, 0 at the end of the input.
+ * @return
+ *  True on success, false on a read error.
+ */
+bool files_input_next(files_input *input, size_t max, const UINT8 **data,
+        size_t *size);
+
+/**
+ * Like files_input_next(), but copies the chunk into a buffer of the caller,
+ * like the one of a TPM2B. Streamed inputs are read straight into it, without
+ * going through the stream buffer of the input.
+ * @param input
+ *  The input to read.
+ * @param buf
+ *  The buffer receiving the chunk.
+ * @param max
+ *  The maximum size of the chunk, at most the size of buf.
+ * @param size
+ *  The size of the chunk, 0 at the end of the input.
+ * @return
+ *  True on success, false on a read error.
+ */
+bool files_input_read(files_input *input, UINT8 *buf, size_t max,
+        size_t *size);
+
+/**
+ * Returns all of the remaining input at once. Mapped inputs are returned in
+ * place, streamed ones are read into a buffer that grows geometrically.
+ * @param input
+ *  The input to read.
+ * @param data
+ *  Points to the data, valid until the input is closed.
+ * @param size
+ *  The size of the data.
+ * @return
+ *  True on success, false on a read or allocation error.
+ */
+bool files_input_read_all(files_input *input, const UINT8 **data,
+        size_t *size);
+
+/**
+ * Checks if all of the input was consumed.
+ * @param input
+ *  The input to check.
+ * @return
+ *  True when no data is left, false otherwise.
+ */
+bool files_input_at_end(files_input *input);
+
+/**
+ * Releases the mapping or stream buffer of the input and closes the files
+ * opened by files_input_open().
+ * @param input
+ *  The input to close.
+ */
+void files_input_close(files_input *input);
+
+/**
+ * Creates a private directory under $TMPDIR, or /tmp without it, named
+ * "<prefix>-XXXXXX" with a unique suffix.
+ * @param prefix
+ *  The prefix of the name, ie "tpm2-pcrs".
+ * @param what
+ *  What the directory is for, for the error message.
+ * @return
+ *  The path of the directory, to free, or NULL on error.
+ */
+char *files_temp_dir_create(const char *prefix, const char *what);
+
+/**
+ * Opens a path named by the user of a tool, like an input or an output file.
+ * A tool run by tpm2_serve has its client open the path, with the rights and
+ * the working directory of the client, see tpm2_rpc_open(). The files of the
+ * tools themselves, like caches, pools and the references of tpm2_serve, are
+ * opened with open(2) and fopen(3).
+ * @param path
+ *  The path to open.
+ * @param flags
+ *  The flags of open(2).
+ * @param mode
+ *  The mode of a created file.
+ * @return
+ *  The descriptor, or -1 with errno set on error.
+ */
+int files_open(const char *path, int flags, mode_t mode);
+
+/**
+ * Like fopen(3) for a path named by the user of a tool, see files_open().
+ * @param path
+ *  The path to open.
+ * @param mode
+ *  The mode of fopen(3), ie "rb", "wb" or "a+b".
+ * @return
+ *  The stream, or NULL with errno set on error.
+ */
+FILE *files_fopen(const char *path, const char *mode);
+
+/**
+ * Like stat(2) for a path named by the user of a tool, see files_open().
+ * @param path
+ *  The path to stat.
+ * @param st
+ *  The status of the file, valid on success.
+ * @return
+ *  True on success, false with errno set on error.
+ */
+bool files_stat(const char *path, struct stat *st);
+
+/**
+ * Like opendir(3) for a directory named by the user of a tool, see
+ * files_open().
+ * @param path
+ *  The directory to open.
+ * @return
+ *  The directory stream, or NULL with errno set on error.
+ */
+DIR *files_opendir(const char *path);
+
+/*
+ * A file replaced atomically: it is written to a temporary file next to it,
+ * which is renamed over it once complete. Tools running in parallel read
+ * either the old or the new file, never a partial one, and a tool killed
+ * while writing leaves the old file in place.
+ *
+ * Anything but a regular file, ie /dev/stdout, a FIFO or /dev/fd/N, cannot be
+ * renamed over and is written in place.
+ */
+typedef struct files_atomic files_atomic;
+struct files_atomic {
+    char path[PATH_MAX];
+    char tmp_path[PATH_MAX];
+    bool is_in_place;
+    /* the directory of a file of the user, see files_atomic_fopen() */
+    int dir_fd;
+};
+
+/**
+ * Opens the temporary file of an atomic write. A symbolic link is resolved,
+ * so the file it points to is replaced, and the mode of an existing file is
+ * kept. An existing file that is not a regular file is opened itself.
+ * @param atomic
+ *  The atomic write to initialize.
+ * @param path
+ *  The file to replace or create.
+ * @return
+ *  The stream to write to, NULL on error.
+ */
+FILE *files_atomic_open(files_atomic *atomic, const char *path);
+
+/**
+ * Like files_atomic_open() for a path named by the user of a tool, see
+ * files_open(). The temporary file is created and renamed over the file
+ * through the directory the client opened.
+ * @param atomic
+ *  The atomic write to initialize.
+ * @param path
+ *  The file to replace or create.
+ * @return
+ *  The stream to write to, NULL on error.
+ */
+FILE *files_atomic_fopen(files_atomic *atomic, const char *path);
+
+/**
+ * Closes the temporary file of an atomic write, and renames it over the file
+ * or removes it.
+ * @param atomic
+ *  The atomic write.
+ * @param f
+ *  The stream returned by files_atomic_open().
+ * @param commit
+ *  True to replace the file, false to drop what was written.
+ * @return
+ *  True if the file was replaced, false if not or on error.
+ */
+bool files_atomic_close(files_atomic *atomic, FILE *f, bool commit);
+
+/**
+ * Like rename(2) for paths named by the user of a tool, through the
+ * directories the client opens, see files_open().
+ * @param old_path
+ *  The file to rename.
+ * @param new_path
+ *  The new path of the file.
+ * @return
+ *  True on success, false with errno set on error.
+ */
+bool files_rename(const char *old_path, const char *new_path);
+
+/**
+ * Like unlink(2) for a path named by the user of a tool, through the
+ * directory the client opens, see files_open().
+ * @param path
+ *  The file to remove.
+ * @return
+ *  True on success, false with errno set on error.
+ */
+bool files_unlink(const char *path);
+
+/**
+ * Takes an exclusive advisory lock on an existing file of the user, waiting
+ * for the tools holding it. The lock follows the file through atomic
+ * replacements, ie it is taken on the file currently at the path, and it is
+ * reentrant within a tool. The file is opened with files_open().
+ * @param path
+ *  The file to lock.
+ * @return
+ *  The descriptor holding the lock, -1 on error or timeout.
+ */
+int files_lock(const char *path);
+
+/**
+ * Releases a lock taken with files_lock().
+ * @param fd
+ *  The descriptor holding the lock, -1 is ignored.
+ */
+void files_unlock(int fd);
+
 #endif /* FILES_H */
@@ -1,19 +1,169 @@
 /* SPDX-License-Identifier: BSD-3-Clause */
 
+#include <inttypes.h>
+#include <pthread.h>
 #include <stdarg.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 
 #include "log.h"
 
 /*
- * Note that the logging library is not thread safe, thus calls on separate
- * threads will yield an interleaved output on stderr.
+ * The records of separate threads are assembled and written under the lock
+ * of the sink, one after the other, so they never interleave.
  */
 
-static log_level current_log_level = log_level_warning;
+/* messages longer than this are formatted on the heap */
+#define LOG_MESSAGE_MAX 1024
+
+typedef enum log_format log_format;
+enum log_format {
+    log_format_text,
+    log_format_kv,
+    log_format_json
+};
+
+/* the fields of a record logged with LOG_COMMAND() */
+typedef struct log_command_fields log_command_fields;
+struct log_command_fields {
+    TPM2_CC cc;
+    TSS2_RC rc;
+    uint64_t latency_us;
+};
+
+log_level _log_level = log_level_warning;
+
+static log_format current_log_format = log_format_text;
+
+/*
+ * The records are assembled here and written with one write to the
+ * unbuffered stderr, when buffered only once the buffer fills up.
+ */
+static struct {
+    /* guards data and size */
+    pthread_mutex_t lock;
+    bool is_buffered;
+    char data[BUFSIZ * 8];
+    size_t size;
+} sink = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+};
 
 void log_set_level(log_level value) {
-    current_log_level = value;
+    _log_level = value;
+}
+
+/* called with the lock of the sink held */
+static void sink_flush(void) {
+
+    if (sink.size) {
+        fwrite(sink.data, 1, sink.size, stderr);
+        sink.size = 0;
+    }
+}
+
+void log_flush(void) {
+
+    pthread_mutex_lock(&sink.lock);
+    sink_flush();
+    pthread_mutex_unlock(&sink.lock);
+}
+
+void log_init(void) {
+
+    const char *format = tpm2_util_getenv(TPM2TOOLS_ENV_LOG_FORMAT);
+    if (format && !strcmp(format, "kv")) {
+        current_log_format = log_format_kv;
+    } else if (format && !strcmp(format, "json")) {
+        current_log_format = log_format_json;
+    } else {
+        current_log_format = log_format_text;
+        if (format && format[0] && strcmp(format, "text")) {
+            LOG_WARN("Unknown log format \"%s\", using text", format);
+        }
+    }
+
+    const char *buffered = tpm2_util_getenv(TPM2TOOLS_ENV_LOG_BUFFERED);
+    bool is_buffered = buffered && buffered[0];
+    if (is_buffered && !sink.is_buffered) {
+        atexit(log_flush);
+    }
+    sink.is_buffered = is_buffered;
+}
+
+static void sink_put(const char *data, size_t size) {
+
+    while (size) {
+        if (sink.size == sizeof(sink.data)) {
+            sink_flush();
+        }
+
+        size_t chunk = sizeof(sink.data) - sink.size;
+        if (chunk > size) {
+            chunk = size;
+        }
+
+        memcpy(&sink.data[sink.size], data, chunk);
+        sink.size += chunk;
+        data += chunk;
+        size -= chunk;
+    }
+}
+
+static void sink_puts(const char *str) {
+
+    sink_put(str, strlen(str));
+}
+
+COMPILER_ATTR(format (printf, 1, 2))
+static void sink_printf(const char *fmt, ...) {
+
+    char buffer[128];
+
+    va_list argptr;
+    va_start(argptr, fmt);
+    int len = vsnprintf(buffer, sizeof(buffer), fmt, argptr);
+    va_end(argptr);
+
+    if (len > 0) {
+        sink_put(buffer, (size_t) len < sizeof(buffer) ?
+                (size_t) len : sizeof(buffer) - 1);
+    }
+}
+
+/* a JSON string body, which is also a valid quoted value of a kv record */
+static void sink_put_escaped(const char *str) {
+
+    const char *start = str;
+    for (; *str; str++) {
+        unsigned char c = (unsigned char) *str;
+        if (c != '"' && c != '\\' && c >= 0x20) {
+            continue;
+        }
+
+        sink_put(start, str - start);
+        start = str + 1;
+
+        switch (c) {
+        case '"':
+            sink_puts("\\\"");
+            break;
+        case '\\':
+            sink_puts("\\\\");
+            break;
+        case '\n':
+            sink_puts("\\n");
+            break;
+        case '\t':
+            sink_puts("\\t");
+            break;
+        default:
+            sink_printf("\\u%04x", c);
+        }
+    }
+
+    sink_put(start, str - start);
 }
 
 static const char *
@@ -32,29 +182,137 @@ get_level_msg(log_level level) {
     return value;
 }
 
-void _log(log_level level, const char *file, unsigned lineno, const char *fmt,
-        ...) {
+static void put_text(log_level level, const char *file, unsigned lineno,
+        const log_command_fields *fields, const char *message) {
+
+    /* Verbose output prints file and line on error */
+    if (_log_level >= log_level_verbose) {
+        sink_printf("%s on line: \"%u\" in file: \"", get_level_msg(level),
+                lineno);
+        sink_puts(file);
+        sink_puts("\": ");
+    } else {
+        sink_printf("%s: ", get_level_msg(level));
+    }
+
+    sink_puts(message);
+
+    if (fields) {
+        sink_printf(" cc: 0x%" PRIx32 " rc: 0x%" PRIx32 " latency-us: %"
+                PRIu64, fields->cc, fields->rc, fields->latency_us);
+    }
+}
+
+static void put_kv(log_level level, const char *file, unsigned lineno,
+        const log_command_fields *fields, const char *message) {
+
+    sink_printf("level=%s file=", get_level_msg(level));
+    sink_puts(file);
+    sink_printf(" line=%u", lineno);
+
+    if (fields) {
+        sink_printf(" cc=0x%" PRIx32 " rc=0x%" PRIx32 " latency_us=%" PRIu64,
+                fields->cc, fields->rc, fields->latency_us);
+    }
+
+    sink_puts(" msg=\"");
+    sink_put_escaped(message);
+    sink_puts("\"");
+}
+
+static void put_json(log_level level, const char *file, unsigned lineno,
+        const log_command_fields *fields, const char *message) {
+
+    sink_printf("{\"level\":\"%s\",\"file\":\"", get_level_msg(level));
+    sink_put_escaped(file);
+    sink_printf("\",\"line\":%u", lineno);
+
+    if (fields) {
+        sink_printf(",\"cc\":%" PRIu32 ",\"rc\":%" PRIu32 ",\"latency_us\":%"
+                PRIu64, fields->cc, fields->rc, fields->latency_us);
+    }
+
+    sink_puts(",\"msg\":\"");
+    sink_put_escaped(message);
+    sink_puts("\"}");
+}
+
+static void vlog(log_level level, const char *file, unsigned lineno,
+        const log_command_fields *fields, const char *fmt, va_list argptr) {
 
     /* Skip printing messages outside of the log level */
-    if (level > current_log_level)
+    if (level > _log_level) {
         return;
+    }
 
-    va_list argptr;
-    va_start(argptr, fmt);
+    char buffer[LOG_MESSAGE_MAX];
+    char *message = buffer;
 
-    /* Verbose output prints file and line on error */
-    if (current_log_level >= log_level_verbose) {
-        fprintf(stderr, "%s on line: \"%u\" in file: \"%s\": ",
-                get_level_msg(level), lineno, file);
-    } else {
-        fprintf(stderr, "%s: ", get_level_msg(level));
+    va_list copy;
+    va_copy(copy, argptr);
+    int len = vsnprintf(buffer, sizeof(buffer), fmt, argptr);
+    if (len >= (int) sizeof(buffer)) {
+        message = malloc(len + 1);
+        if (message) {
+            vsnprintf(message, len + 1, fmt, copy);
+        } else {
+            /* log what fits rather than nothing */
+            message = buffer;
+        }
+    } else if (len < 0) {
+        buffer[0] = '\0';
     }
+    va_end(copy);
+
+    pthread_mutex_lock(&sink.lock);
 
-    /* Print the user supplied message */
-    vfprintf(stderr, fmt, argptr);
+    switch (current_log_format) {
+    case log_format_kv:
+        put_kv(level, file, lineno, fields, message);
+        break;
+    case log_format_json:
+        put_json(level, file, lineno, fields, message);
+        break;
+    default:
+        put_text(level, file, lineno, fields, message);
+    }
 
     /* always add a new line so the user doesn't have to */
-    fprintf(stderr, "\n");
+    sink_puts("\n");
+
+    /* errors are written as they happen, even when buffered */
+    if (!sink.is_buffered || level == log_level_error) {
+        sink_flush();
+    }
+
+    pthread_mutex_unlock(&sink.lock);
+
+    if (message != buffer) {
+        free(message);
+    }
+}
 
+COMPILER_ATTR(cold)
+void _log(log_level level, const char *file, unsigned lineno, const char *fmt,
+        ...) {
+
+    va_list argptr;
+    va_start(argptr, fmt);
+    vlog(level, file, lineno, NULL, fmt, argptr);
+    va_end(argptr);
+}
+
+void _log_command(const char *file, unsigned lineno, TPM2_CC cc, TSS2_RC rc,
+        uint64_t latency_us, const char *fmt, ...) {
+
+    log_command_fields fields = {
+        .cc = cc,
+        .rc = rc,
+        .latency_us = latency_us,
+    };
+
+    va_list argptr;
+    va_start(argptr, fmt);
+    vlog(log_level_verbose, file, lineno, &fields, fmt, argptr);
     va_end(argptr);
 }
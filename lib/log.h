@@ -4,6 +4,7 @@
 #define SRC_LOG_H_
 
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
 
 #include <tss2/tss2_sys.h>
@@ -11,6 +12,19 @@
 #include <tss2/tss2_rc.h>
 #include "tpm2_util.h"
 
+/*
+ * Environment variable selecting the format of the log records, "text" (the
+ * default), "kv" for key=value pairs or "json" for a JSON object per line.
+ */
+#define TPM2TOOLS_ENV_LOG_FORMAT "TPM2TOOLS_LOG_FORMAT"
+
+/*
+ * Environment variable that, when defined, buffers the log records and
+ * writes them when the buffer fills up, an error is logged or the tool
+ * finishes, instead of writing every record as it is logged.
+ */
+#define TPM2TOOLS_ENV_LOG_BUFFERED "TPM2TOOLS_LOG_BUFFERED"
+
 typedef enum log_level log_level;
 enum log_level {
     log_level_error,
@@ -18,15 +32,40 @@ enum log_level {
     log_level_verbose
 };
 
+/*
+ * The most verbose level compiled in, see --with-max-log-level. Messages above
+ * it are dropped at compile time, their arguments are never evaluated.
+ */
+#ifndef LOG_LEVEL_MAX
+#define LOG_LEVEL_MAX log_level_verbose
+#endif
+
+/* Internal use only, the level set with log_set_level(). */
+extern log_level _log_level;
+
+/* cold, so the error and verbose paths are laid out apart from the hot code */
 void _log (log_level level, const char *file, unsigned lineno, const char *fmt, ...)
-    COMPILER_ATTR(format (printf, 4, 5));
+    COMPILER_ATTR(format (printf, 4, 5), cold);
+
+/*
+ * Internal use only.
+ *
+ * Checks the level before the call, so the arguments of a message that is not
+ * printed are not evaluated.
+ */
+#define _LOG(level, fmt, ...) \
+    do { \
+        if ((level) <= LOG_LEVEL_MAX && (level) <= _log_level) { \
+            _log((level), __FILE__, __LINE__, fmt, ##__VA_ARGS__); \
+        } \
+    } while (0)
 
 /*
  * Prints an error message. The fmt and variadic arguments mirror printf.
  *
  * Use this to log all error conditions.
  */
-#define LOG_ERR(fmt, ...) _log(log_level_error, __FILE__, __LINE__, fmt, ##__VA_ARGS__)
+#define LOG_ERR(fmt, ...) _LOG(log_level_error, fmt, ##__VA_ARGS__)
 
 /**
  * Prints an error message for a TSS2_Sys call to the TPM.
@@ -48,6 +87,7 @@ void _log (log_level level, const char *file, unsigned lineno, const char *fmt,
  * @param rc
  *  The rc to decode.
  */
+COMPILER_ATTR(cold)
 static inline void _LOG_PERR(const char *func, TSS2_RC rc) {
 
     LOG_ERR("%s(0x%X) - %s", func, rc, Tss2_RC_Decode(rc));
@@ -59,7 +99,7 @@ static inline void _LOG_PERR(const char *func, TSS2_RC rc) {
  * Use this to log a warning. A warning is when something is wrong, but it is not a fatal
  * issue.
  */
-#define LOG_WARN(fmt, ...) _log(log_level_warning, __FILE__, __LINE__, fmt, ##__VA_ARGS__)
+#define LOG_WARN(fmt, ...) _LOG(log_level_warning, fmt, ##__VA_ARGS__)
 
 /*
  * Prints an informational message. The fmt and variadic arguments mirror printf.
@@ -67,7 +107,25 @@ static inline void _LOG_PERR(const char *func, TSS2_RC rc) {
  * Informational messages are only shown when verboseness is increased. Valid messages
  * would be debugging type messages where additional, extraneous information is printed.
  */
-#define LOG_INFO(fmt, ...) _log(log_level_verbose, __FILE__, __LINE__, fmt, ##__VA_ARGS__)
+#define LOG_INFO(fmt, ...) _LOG(log_level_verbose, fmt, ##__VA_ARGS__)
+
+void _log_command(const char *file, unsigned lineno, TPM2_CC cc, TSS2_RC rc,
+        uint64_t latency_us, const char *fmt, ...)
+    COMPILER_ATTR(format (printf, 6, 7));
+
+/*
+ * Prints an informational message about a TPM command, carrying its command
+ * code, response code and latency in microseconds as fields of its own in
+ * the structured formats. The fmt and variadic arguments mirror printf.
+ */
+#define LOG_COMMAND(cc, rc, latency_us, fmt, ...) \
+    do { \
+        if (log_level_verbose <= LOG_LEVEL_MAX \
+                && log_level_verbose <= _log_level) { \
+            _log_command(__FILE__, __LINE__, (cc), (rc), (latency_us), fmt, \
+                    ##__VA_ARGS__); \
+        } \
+    } while (0)
 
 /**
  * Sets the log level so only messages <= to it print.
@@ -76,4 +134,15 @@ static inline void _LOG_PERR(const char *func, TSS2_RC rc) {
  */
 void log_set_level(log_level level);
 
+/**
+ * Selects the format and sink of the log records as requested by the
+ * TPM2TOOLS_LOG_FORMAT and TPM2TOOLS_LOG_BUFFERED environment variables.
+ */
+void log_init(void);
+
+/**
+ * Writes the buffered log records to stderr.
+ */
+void log_flush(void);
+
 #endif /* SRC_LOG_H_ */
@@ -1,21 +1,336 @@
 
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <limits.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <sys/stat.h>
 
 #include "files.h"
 #include "log.h"
 #include "object.h"
 #include "tool_rc.h"
+#include "tpm2.h"
 #include "tpm2_auth_util.h"
+#include "tpm2_capability.h"
+#include "tpm2_ctx_archive.h"
+#include "tpm2_util.h"
 
 #define NULL_OBJECT "null"
 #define NULL_OBJECT_LEN (sizeof(NULL_OBJECT) - 1)
 
+#define OBJECT_CACHE_VERSION 1
+
+/* an ESYS_TR of an object serializes to its handle, name and public area */
+#define OBJECT_CACHE_TR_MAX 4096
+
+/*
+ * The transient object slots left to the tools, cached objects are flushed
+ * before the TPM has fewer free slots than this.
+ */
+#define OBJECT_CACHE_SLOTS_FREE 2
+
+/*
+ * The directory of the objects loaded from context files that stay loaded
+ * for the next tool, NULL while the cache is disabled. Every entry holds the
+ * serialized ESYS_TR of an object and is named by the context file it was
+ * loaded from.
+ */
+static char *object_cache_dir;
+
+/*
+ * A named reference, ie "@key", holds an object a tool of tpm2_batch or
+ * tpm2_serve left loaded for the tools after it, so no ContextSave nor
+ * ContextLoad is needed in between. It lives in the object cache directory
+ * and is never evicted: "@key.tr" holds the serialized ESYS_TR like an entry
+ * of the cache and "@key.bin" the bytes a tool saved to "@key" as to a file,
+ * ie a TPM2B_PUBLIC or TPM2B_PRIVATE.
+ */
+#define OBJECT_REF_NAME_MAX 64
+
+static bool object_ref_path(const char *ref, const char *suffix,
+        char path[PATH_MAX]) {
+
+    if (!object_cache_dir || !ref || ref[0] != '@') {
+        return false;
+    }
+
+    const char *name = ref + 1;
+    size_t len = strlen(name);
+    if (!len || len > OBJECT_REF_NAME_MAX || strspn(name,
+            "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789._-")
+            != len) {
+        return false;
+    }
+
+    int path_len = snprintf(path, PATH_MAX, "%s/@%s%s", object_cache_dir,
+            name, suffix);
+
+    return path_len > 0 && path_len < PATH_MAX;
+}
+
+/*
+ * A context file is identified by its inode and recognized as unchanged by
+ * its size and modification time, so the path it was given by does not
+ * matter.
+ */
+static bool object_cache_path(FILE *f, char path[PATH_MAX]) {
+
+    if (!object_cache_dir || !files_is_tpm_context_file(f)) {
+        return false;
+    }
+
+    struct stat st;
+    if (fstat(fileno(f), &st)) {
+        return false;
+    }
+
+    int len = snprintf(path, PATH_MAX,
+            "%s/%jx-%jx-%jx-%jx.%09ld", object_cache_dir,
+            (uintmax_t) st.st_dev, (uintmax_t) st.st_ino,
+            (uintmax_t) st.st_size, (uintmax_t) st.st_mtim.tv_sec,
+            st.st_mtim.tv_nsec);
+
+    return len > 0 && len < PATH_MAX;
+}
+
+static bool object_cache_read(const char *path, TPM2B_NAME *name,
+        UINT8 *buffer, UINT32 *size) {
+
+    FILE *f = fopen(path, "rb");
+    if (!f) {
+        return false;
+    }
+
+    UINT32 version = 0;
+    bool result = files_read_header(f, &version)
+            && version == OBJECT_CACHE_VERSION
+            && files_read_16(f, &name->size)
+            && name->size <= sizeof(name->name)
+            && files_read_bytes(f, name->name, name->size)
+            && files_read_32(f, size)
+            && *size <= OBJECT_CACHE_TR_MAX
+            && files_read_bytes(f, buffer, *size);
+
+    fclose(f);
+
+    return result;
+}
+
+/*
+ * Another tool may have flushed the object and the TPM may have given its
+ * handle to another one since, so the object is only taken if the handle
+ * still holds an object of the same name. A stale entry is expected then, so
+ * the ReadPublic failing is not an error.
+ */
+static bool object_cache_open(ESYS_CONTEXT *ectx, const char *path,
+        ESYS_TR *handle) {
+
+    TPM2B_NAME name = { 0 };
+    UINT8 buffer[OBJECT_CACHE_TR_MAX];
+    UINT32 size = 0;
+    if (!object_cache_read(path, &name, buffer, &size)) {
+        return false;
+    }
+
+    ESYS_TR tr = ESYS_TR_NONE;
+    tool_rc rc = tpm2_tr_deserialize(ectx, buffer, size, &tr);
+    if (rc != tool_rc_success) {
+        return false;
+    }
+
+    TPM2B_NAME *loaded_name = NULL;
+    TSS2_RC rval = Esys_ReadPublic(ectx, tr, ESYS_TR_NONE, ESYS_TR_NONE,
+            ESYS_TR_NONE, NULL, &loaded_name, NULL);
+    bool result = rval == TSS2_RC_SUCCESS && loaded_name->size == name.size
+            && !memcmp(loaded_name->name, name.name, name.size);
+    Esys_Free(loaded_name);
+
+    if (!result) {
+        tpm2_close(ectx, &tr);
+        return false;
+    }
+
+    *handle = tr;
+
+    return true;
+}
+
+static bool object_cache_get(ESYS_CONTEXT *ectx, const char *path,
+        ESYS_TR *handle) {
+
+    bool result = object_cache_open(ectx, path, handle);
+    if (!result) {
+        unlink(path);
+        return false;
+    }
+
+    /* the modification time orders the entries by their last use */
+    utimensat(AT_FDCWD, path, NULL, 0);
+
+    LOG_INFO("Using cached object: ESYS_TR(0x%x)", *handle);
+
+    return true;
+}
+
+static void object_cache_flush(ESYS_CONTEXT *ectx, const char *path) {
+
+    ESYS_TR handle = ESYS_TR_NONE;
+    if (object_cache_open(ectx, path, &handle)) {
+        tool_rc rc = tpm2_flush_context(ectx, handle);
+        UNUSED(rc);
+    }
+
+    unlink(path);
+}
+
+/* flushes the object used the longest time ago */
+static bool object_cache_evict(ESYS_CONTEXT *ectx) {
+
+    DIR *dir = opendir(object_cache_dir);
+    if (!dir) {
+        return false;
+    }
+
+    char oldest[PATH_MAX] = { 0 };
+    struct timespec oldest_time = { 0 };
+    struct dirent *entry;
+    while ((entry = readdir(dir))) {
+        char path[PATH_MAX];
+        struct stat st;
+        /* the objects of the references are up to the tools */
+        if (entry->d_name[0] == '.' || entry->d_name[0] == '@'
+                || snprintf(path, sizeof(path), "%s/%s", object_cache_dir,
+                        entry->d_name) >= (int) sizeof(path)
+                || stat(path, &st)) {
+            continue;
+        }
+
+        if (!oldest[0] || st.st_mtim.tv_sec < oldest_time.tv_sec
+                || (st.st_mtim.tv_sec == oldest_time.tv_sec
+                        && st.st_mtim.tv_nsec < oldest_time.tv_nsec)) {
+            memcpy(oldest, path, sizeof(oldest));
+            oldest_time = st.st_mtim;
+        }
+    }
+    closedir(dir);
+
+    if (!oldest[0]) {
+        return false;
+    }
+
+    LOG_INFO("Flushing cached object \"%s\"", oldest);
+    object_cache_flush(ectx, oldest);
+
+    return true;
+}
+
+static UINT32 object_cache_slots_free(ESYS_CONTEXT *ectx) {
+
+    TPMS_CAPABILITY_DATA *capability_data = NULL;
+    tool_rc rc = tpm2_capability_get(ectx, TPM2_CAP_TPM_PROPERTIES,
+            TPM2_PT_HR_TRANSIENT_AVAIL, 1, &capability_data);
+    if (rc != tool_rc_success) {
+        return 0;
+    }
+
+    TPML_TAGGED_TPM_PROPERTY *properties =
+            &capability_data->data.tpmProperties;
+    UINT32 slots = properties->count
+            && properties->tpmProperty[0].property == TPM2_PT_HR_TRANSIENT_AVAIL ?
+            properties->tpmProperty[0].value : 0;
+    free(capability_data);
+
+    return slots;
+}
+
+static bool object_cache_write(const char *path, const TPM2B_NAME *name,
+        UINT8 *buffer, size_t size) {
+
+    files_atomic atomic;
+    FILE *f = files_atomic_open(&atomic, path);
+    if (!f) {
+        return false;
+    }
+
+    bool result = files_write_header(f, OBJECT_CACHE_VERSION)
+            && files_write_16(f, name->size)
+            && files_write_bytes(f, (UINT8 *) name->name, name->size)
+            && files_write_32(f, size)
+            && files_write_bytes(f, buffer, size);
+
+    if (!files_atomic_close(&atomic, f, result)) {
+        LOG_WARN("Could not write object cache entry \"%s\"", path);
+        return false;
+    }
+
+    return true;
+}
+
+static bool object_cache_serialize(ESYS_CONTEXT *ectx, ESYS_TR handle,
+        TPM2B_NAME **name, UINT8 **buffer, size_t *size) {
+
+    tool_rc rc = tpm2_tr_get_name(ectx, handle, name);
+    if (rc != tool_rc_success) {
+        return false;
+    }
+
+    rc = tpm2_tr_serialize(ectx, handle, buffer, size);
+    if (rc != tool_rc_success || *size > OBJECT_CACHE_TR_MAX) {
+        Esys_Free(*name);
+        free(*buffer);
+        return false;
+    }
+
+    return true;
+}
+
+static bool object_cache_put(ESYS_CONTEXT *ectx, const char *path,
+        ESYS_TR handle) {
+
+    /* make room for the objects the tools load besides the cached ones */
+    while (object_cache_slots_free(ectx) < OBJECT_CACHE_SLOTS_FREE
+            && object_cache_evict(ectx));
+
+    TPM2B_NAME *name = NULL;
+    UINT8 *buffer = NULL;
+    size_t size = 0;
+    if (!object_cache_serialize(ectx, handle, &name, &buffer, &size)) {
+        return false;
+    }
+
+    bool result = object_cache_write(path, name, buffer, size);
+    Esys_Free(name);
+    free(buffer);
+
+    return result;
+}
+
 static tool_rc do_ctx_file(ESYS_CONTEXT *ctx, const char *objectstr, FILE *f,
         tpm2_loaded_object *outobject) {
     /* assign a dummy transient handle */
     outobject->handle = TPM2_TRANSIENT_FIRST;
     outobject->path = objectstr;
-    return files_load_tpm_context_from_file(ctx, &outobject->tr_handle, f);
+
+    char cache_path[PATH_MAX];
+    bool is_cached = object_cache_path(f, cache_path);
+    if (is_cached && object_cache_get(ctx, cache_path,
+            &outobject->tr_handle)) {
+        return tool_rc_success;
+    }
+
+    tool_rc rc = files_load_tpm_context_from_file(ctx, &outobject->tr_handle,
+            f);
+    if (rc == tool_rc_success && is_cached) {
+        object_cache_put(ctx, cache_path, outobject->tr_handle);
+    }
+
+    return rc;
 }
 
 static tool_rc tpm2_util_object_load2(ESYS_CONTEXT *ctx, const char *objectstr,
@@ -41,15 +356,39 @@ static tool_rc tpm2_util_object_load2(ESYS_CONTEXT *ctx, const char *objectstr,
         return tool_rc_general_error;
     }
 
+    // 0. A reference of tpm2_batch or tpm2_serve, ie @key
+    char ref_path[PATH_MAX];
+    if (object_ref_path(objectstr, ".tr", ref_path)) {
+        outobject->handle = TPM2_TRANSIENT_FIRST;
+        outobject->path = objectstr;
+        if (!object_cache_open(ctx, ref_path, &outobject->tr_handle)) {
+            LOG_ERR("No object is loaded as \"%s\"", objectstr);
+            return tool_rc_general_error;
+        }
+        LOG_INFO("Using object \"%s\": ESYS_TR(0x%x)", objectstr,
+                outobject->tr_handle);
+        return tool_rc_success;
+    }
+
     // 1. Always attempt file
-    FILE *f = fopen(objectstr, "rb");
+    FILE *f = files_fopen(objectstr, "rb");
     if (f) {
         tool_rc rc = do_ctx_file(ctx, objectstr, f, outobject);
         fclose(f);
         return rc;
     }
 
-    // 2. Try to convert a hierarchy or raw handle
+    // 2. Try a context in an archive, ie archive#name
+    char archive_path[PATH_MAX];
+    const char *name;
+    if (tpm2_ctx_archive_split(objectstr, archive_path, &name)) {
+        outobject->handle = TPM2_TRANSIENT_FIRST;
+        outobject->path = objectstr;
+        return tpm2_ctx_archive_load(ctx, archive_path, name,
+                &outobject->tr_handle);
+    }
+
+    // 3. Try to convert a hierarchy or raw handle
     TPMI_RH_PROVISION handle;
     bool result = tpm2_util_handle_from_optarg(objectstr, &handle, flags);
     if (result) {
@@ -78,3 +417,155 @@ tool_rc tpm2_util_object_load_auth(ESYS_CONTEXT *ctx, const char *objectstr,
     return tpm2_util_object_load2(ctx, objectstr, auth, true, outobject,
             is_restricted_pswd_session, flags);
 }
+
+tool_rc tpm2_util_object_unload(ESYS_CONTEXT *ctx,
+        tpm2_loaded_object *object) {
+
+    if (object->tr_handle == ESYS_TR_NONE) {
+        return tool_rc_success;
+    }
+
+    tool_rc rc = tool_rc_success;
+    if (object->path) {
+        /* a serialized ESYS_TR, ie of a persistent object, is only closed */
+        FILE *f = files_fopen(object->path, "rb");
+        bool is_context = !f || files_is_tpm_context_file(f);
+        if (f) {
+            fclose(f);
+        }
+
+        /* a cached object stays loaded, the cache evicts it when needed */
+        rc = object_cache_dir || !is_context ?
+                tpm2_close(ctx, &object->tr_handle) :
+                tpm2_flush_context(ctx, object->tr_handle);
+    } else {
+        /* hierarchies are static ESYS_TRs, there is nothing to close */
+        UINT8 type = object->handle >> TPM2_HR_SHIFT;
+        if (type == TPM2_HT_NV_INDEX || type == TPM2_HT_PERSISTENT) {
+            rc = tpm2_close(ctx, &object->tr_handle);
+        }
+    }
+    object->tr_handle = ESYS_TR_NONE;
+
+    return rc;
+}
+
+tool_rc tpm2_object_cache_adopt(ESYS_CONTEXT *ectx, const char *path,
+        ESYS_TR *handle) {
+
+    char cache_path[PATH_MAX];
+    FILE *f = object_cache_dir ? files_fopen(path, "rb") : NULL;
+    bool is_cached = f && object_cache_path(f, cache_path);
+    if (f) {
+        fclose(f);
+    }
+
+    /* the cache holds the serialized ESYS_TR, the object stays loaded */
+    is_cached = is_cached && object_cache_put(ectx, cache_path, *handle);
+    if (is_cached) {
+        LOG_INFO("Caching object \"%s\": ESYS_TR(0x%x)", path, *handle);
+        return tpm2_close(ectx, handle);
+    }
+
+    tool_rc rc = tpm2_flush_context(ectx, *handle);
+    *handle = ESYS_TR_NONE;
+
+    return rc;
+}
+
+bool tpm2_object_is_ref(const char *path) {
+
+    char ref_path[PATH_MAX];
+
+    return object_ref_path(path, ".tr", ref_path);
+}
+
+bool tpm2_object_ref_file(const char *path, char file[PATH_MAX]) {
+
+    return object_ref_path(path, ".bin", file);
+}
+
+tool_rc tpm2_object_ref_save(ESYS_CONTEXT *ectx, ESYS_TR handle,
+        const char *ref) {
+
+    char path[PATH_MAX];
+    if (!object_ref_path(ref, ".tr", path)) {
+        LOG_ERR("Invalid object reference \"%s\"", ref);
+        return tool_rc_general_error;
+    }
+
+    TPM2B_NAME *name = NULL;
+    UINT8 *buffer = NULL;
+    size_t size = 0;
+    if (!object_cache_serialize(ectx, handle, &name, &buffer, &size)) {
+        LOG_ERR("Could not serialize the object of \"%s\"", ref);
+        return tool_rc_general_error;
+    }
+
+    /* a reference to another object releases the one it held */
+    TPM2B_NAME old_name = { 0 };
+    UINT8 old_buffer[OBJECT_CACHE_TR_MAX];
+    UINT32 old_size = 0;
+    bool is_other = object_cache_read(path, &old_name, old_buffer, &old_size)
+            && (old_size != size || memcmp(old_buffer, buffer, size));
+    if (is_other) {
+        object_cache_flush(ectx, path);
+    }
+
+    bool result = object_cache_write(path, name, buffer, size);
+    Esys_Free(name);
+    free(buffer);
+    if (!result) {
+        return tool_rc_general_error;
+    }
+
+    LOG_INFO("Keeping object as \"%s\": ESYS_TR(0x%x)", ref, handle);
+
+    return tool_rc_success;
+}
+
+tool_rc tpm2_object_cache_init(void) {
+
+    if (object_cache_dir) {
+        return tool_rc_success;
+    }
+
+    object_cache_dir = files_temp_dir_create("tpm2-objects", "object cache");
+    if (!object_cache_dir) {
+        return tool_rc_general_error;
+    }
+
+    return tool_rc_success;
+}
+
+void tpm2_object_cache_free(ESYS_CONTEXT *ectx) {
+
+    if (!object_cache_dir) {
+        return;
+    }
+
+    DIR *dir = opendir(object_cache_dir);
+    if (dir) {
+        struct dirent *entry;
+        while ((entry = readdir(dir))) {
+            if (entry->d_name[0] == '.') {
+                continue;
+            }
+
+            char path[PATH_MAX];
+            snprintf(path, sizeof(path), "%s/%s", object_cache_dir,
+                    entry->d_name);
+
+            if (ectx) {
+                object_cache_flush(ectx, path);
+            } else {
+                unlink(path);
+            }
+        }
+        closedir(dir);
+    }
+
+    rmdir(object_cache_dir);
+    free(object_cache_dir);
+    object_cache_dir = NULL;
+}
@@ -1,6 +1,8 @@
 #ifndef LIB_OBJECT_H_
 #define LIB_OBJECT_H_
 
+#include <limits.h>
+
 #include "tool_rc.h"
 #include "tpm2_session.h"
 #include "tpm2_util.h"
@@ -61,4 +63,100 @@ tool_rc tpm2_util_object_load_auth(ESYS_CONTEXT *ctx, const char *objectstr,
         const char *auth, tpm2_loaded_object *outobject,
         bool is_restricted_pswd_session, tpm2_handle_flags flags);
 
+/**
+ * Releases an object loaded by tpm2_util_object_load(), for tools loading
+ * many objects one after the other. An object loaded from a context is
+ * flushed, unless the object cache keeps it loaded, and the ESYS_TR of a
+ * persistent object or NV index is closed.
+ * @param ctx
+ * a TSS ESAPI context.
+ * @param object
+ * The object to release, its tr_handle is ESYS_TR_NONE afterwards.
+ * @return
+ *  tool_rc indicating status.
+ */
+tool_rc tpm2_util_object_unload(ESYS_CONTEXT *ctx,
+        tpm2_loaded_object *object);
+
+/**
+ * Hands an object over to the object cache after its context was saved to a
+ * file, so a later tool referencing the file uses the loaded object instead
+ * of loading the context again. Like for the other cached objects, the cache
+ * flushes it when the TPM runs low on transient object slots. Without the
+ * cache the object is flushed right away.
+ * @param ectx
+ *  The Enhanced System API (ESAPI) context.
+ * @param path
+ *  The context file the object was saved to.
+ * @param handle
+ *  The object, ESYS_TR_NONE afterwards.
+ * @return
+ *  tool_rc indicating status.
+ */
+tool_rc tpm2_object_cache_adopt(ESYS_CONTEXT *ectx, const char *path,
+        ESYS_TR *handle);
+
+/**
+ * Tells whether a path is a named reference, ie "@key", of the tools run by
+ * tpm2_batch and tpm2_serve. A reference holds an object a tool left loaded
+ * when saving its context to the reference, and the tools after it use the
+ * object as is when given the reference as an object, without a ContextSave
+ * nor a ContextLoad. Outside of tpm2_batch and tpm2_serve, or without the
+ * object cache, "@key" is a path like any other.
+ * @param path
+ *  The path.
+ * @return
+ *  true for a reference, false otherwise.
+ */
+bool tpm2_object_is_ref(const char *path);
+
+/**
+ * Maps a reference to the file of the private directory of the object cache
+ * that holds what tools save to the reference as to a file, so TPM2B
+ * structures pass from one tool to the next under the same name.
+ * @param path
+ *  The path, a reference or not.
+ * @param file
+ *  Receives the file of the reference.
+ * @return
+ *  true for a reference, false otherwise.
+ */
+bool tpm2_object_ref_file(const char *path, char file[PATH_MAX]);
+
+/**
+ * Keeps a loaded object as a reference, for the ContextSave of the tools to
+ * a reference. The object stays loaded until the reference is taken by
+ * another object or the object cache is freed, the tool must not flush it.
+ * @param ectx
+ *  The Enhanced System API (ESAPI) context.
+ * @param handle
+ *  The object.
+ * @param ref
+ *  The reference, ie "@key".
+ * @return
+ *  tool_rc indicating status.
+ */
+tool_rc tpm2_object_ref_save(ESYS_CONTEXT *ectx, ESYS_TR handle,
+        const char *ref);
+
+/**
+ * Enables the object cache for the tools run from now on, ie by tpm2_batch
+ * and tpm2_serve. An object loaded from a context file then stays loaded
+ * and the next tool referencing the same, unmodified context file uses it
+ * instead of loading the context again. The TPM is asked for the name of the
+ * object before it is reused, an object flushed in between is loaded anew.
+ * Cached objects are flushed least recently used first when the TPM runs low
+ * on transient object slots.
+ * @return
+ *  tool_rc indicating status.
+ */
+tool_rc tpm2_object_cache_init(void);
+
+/**
+ * Flushes the objects left in the cache and disables it.
+ * @param ectx
+ *  The Enhanced System API (ESAPI) context the cached objects belong to.
+ */
+void tpm2_object_cache_free(ESYS_CONTEXT *ectx);
+
 #endif /* LIB_OBJECT_H_ */
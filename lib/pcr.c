@@ -1,18 +1,27 @@
 /* SPDX-License-Identifier: BSD-3-Clause */
 
 #include <inttypes.h>
+#include <limits.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 
+#include <tss2/tss2_mu.h>
+
+#include "files.h"
 #include "log.h"
 #include "pcr.h"
 #include "tpm2.h"
 #include "tpm2_systemdeps.h"
 #include "tpm2_tool.h"
 #include "tpm2_alg_util.h"
+#include "tpm2_capability.h"
+#include "tpm2_host_cache.h"
+#include "tpm2_pipeline.h"
 #include "tpm2_util.h"
+#include "tpm2_writer.h"
 
 #define MAX(a,b) ((a>b)?a:b)
 
@@ -32,6 +41,9 @@ bool pcr_get_id(const char *arg, UINT32 *pcr_id) {
     return tpm2_util_handle_from_optarg(arg, pcr_id, TPM2_HANDLE_FLAGS_PCR);
 }
 
+/* the PCRs of a selection given as a list, ie of 24 PCRs */
+#define PCR_LIST_SELECT_SIZE 3
+
 static bool pcr_parse_list(const char *str, size_t len,
         TPMS_PCR_SELECTION *pcr_select) {
     char buf[4];
@@ -43,22 +55,16 @@ static bool pcr_parse_list(const char *str, size_t len,
         return false;
     }
 
-    pcr_select->sizeofSelect = 3;
-    pcr_select->pcrSelect[0] = 0;
-    pcr_select->pcrSelect[1] = 0;
-    pcr_select->pcrSelect[2] = 0;
+    pcr_select->sizeofSelect = PCR_LIST_SELECT_SIZE;
+    pcr_bitset bits = 0;
 
     if (!strncmp(str, "all", 3)) {
-        pcr_select->pcrSelect[0] = 0xff;
-        pcr_select->pcrSelect[1] = 0xff;
-        pcr_select->pcrSelect[2] = 0xff;
+        pcr_bitset_to_select(~(pcr_bitset) 0, pcr_select);
         return true;
     }
-    
+
     if (!strncmp(str, "none", 4)) {
-        pcr_select->pcrSelect[0] = 0x00;
-        pcr_select->pcrSelect[1] = 0x00;
-        pcr_select->pcrSelect[2] = 0x00;
+        pcr_bitset_to_select(0, pcr_select);
         return true;
     }
 
@@ -84,9 +90,11 @@ static bool pcr_parse_list(const char *str, size_t len,
             return false;
         }
 
-        pcr_select->pcrSelect[pcr / 8] |= (1 << (pcr % 8));
+        bits |= (pcr_bitset) 1 << pcr;
     } while (str);
 
+    pcr_bitset_to_select(bits, pcr_select);
+
     return true;
 }
 
@@ -157,47 +165,55 @@ static void shrink_pcr_selection(TPML_PCR_SELECTION *s) {
     s->count = i;
 }
 
+/* drops the PCRs s2 selects from s1 */
 static void pcr_update_pcr_selections(TPML_PCR_SELECTION *s1,
         TPML_PCR_SELECTION *s2) {
-    UINT32 i1, i2, j;
+    UINT32 i1, i2;
     for (i2 = 0; i2 < s2->count; i2++) {
+        pcr_bitset read = pcr_bitset_from_select(&s2->pcrSelections[i2]);
         for (i1 = 0; i1 < s1->count; i1++) {
-            if (s2->pcrSelections[i2].hash != s1->pcrSelections[i1].hash)
+            TPMS_PCR_SELECTION *sel = &s1->pcrSelections[i1];
+            if (s2->pcrSelections[i2].hash != sel->hash)
                 continue;
 
-            for (j = 0; j < s1->pcrSelections[i1].sizeofSelect; j++)
-                s1->pcrSelections[i1].pcrSelect[j] &=
-                        ~s2->pcrSelections[i2].pcrSelect[j];
+            pcr_bitset_to_select(pcr_bitset_from_select(sel) & ~read, sel);
         }
     }
 }
 
 static bool pcr_unset_pcr_sections(TPML_PCR_SELECTION *s) {
-    UINT32 i, j;
+    UINT32 i;
     for (i = 0; i < s->count; i++) {
-        for (j = 0; j < s->pcrSelections[i].sizeofSelect; j++) {
-            if (s->pcrSelections[i].pcrSelect[j]) {
-                return false;
-            }
+        if (pcr_bitset_from_select(&s->pcrSelections[i])) {
+            return false;
         }
     }
 
     return true;
 }
 
+/* the PCR index is padded to align the values of the first ten PCRs */
+static void pcr_print_digest(unsigned int pcr_id, const BYTE *digest,
+        size_t size) {
+
+    char key[16];
+    snprintf(key, sizeof(key), "%-2u", pcr_id);
+    tpm2_writer_hex(key, "0x", digest, size, true);
+}
+
 bool pcr_print_pcr_struct_le(TPML_PCR_SELECTION *pcr_select, tpm2_pcrs *pcrs) {
 
     UINT32 vi = 0, di = 0, i;
     bool result = true;
 
-    tpm2_tool_output("pcrs:\n");
+    tpm2_writer_map_start("pcrs");
 
     /* Loop through all PCR/hash banks */
-    for (i = 0; i < le32toh(pcr_select->count); i++) {
+    for (i = 0; result && i < le32toh(pcr_select->count); i++) {
         const char *alg_name = tpm2_alg_util_algtostr(
                 le16toh(pcr_select->pcrSelections[i].hash), tpm2_alg_util_flags_hash);
 
-        tpm2_tool_output("  %s:\n", alg_name);
+        tpm2_writer_map_start(alg_name);
 
         /* Loop through all PCRs in this bank */
         unsigned int pcr_id;
@@ -209,19 +225,13 @@ bool pcr_print_pcr_struct_le(TPML_PCR_SELECTION *pcr_select, tpm2_pcrs *pcrs) {
             }
             if (vi >= le64toh(pcrs->count) || di >= le32toh(pcrs->pcr_values[vi].count)) {
                 LOG_ERR("Something wrong, trying to print but nothing more");
-                return false;
+                result = false;
+                break;
             }
 
-            /* Print out PCR ID */
-            tpm2_tool_output("    %-2d: 0x", pcr_id);
-
-            /* Print out current PCR digest value */
+            /* Print out PCR ID and current PCR digest value */
             TPM2B_DIGEST *b = &pcrs->pcr_values[vi].digests[di];
-            int k;
-            for (k = 0; k < le16toh(b->size); k++) {
-                tpm2_tool_output("%02X", b->buffer[k]);
-            }
-            tpm2_tool_output("\n");
+            pcr_print_digest(pcr_id, b->buffer, le16toh(b->size));
 
             if (++di < le32toh(pcrs->pcr_values[vi].count)) {
                 continue;
@@ -232,8 +242,12 @@ bool pcr_print_pcr_struct_le(TPML_PCR_SELECTION *pcr_select, tpm2_pcrs *pcrs) {
                 continue;
             }
         }
+
+        tpm2_writer_end();
     }
 
+    tpm2_writer_end();
+
     return result;
 }
 
@@ -263,16 +277,15 @@ bool pcr_fwrite_serialized(const TPML_PCR_SELECTION *pcr_select,
         return false;
     }
 
-    tpm2_pcrs pcrs = *ppcrs;
-    for (size_t j = 0; j < pcrs.count; j++) {
-        TPML_DIGEST *pcr_value = &pcrs.pcr_values[j];
+    for (size_t j = 0; j < ppcrs->count; j++) {
+        TPML_DIGEST pcr_value = ppcrs->pcr_values[j];
 
-        for (size_t k = 0; k < pcr_value->count; k++) {
-            TPM2B_DIGEST *p = &pcr_value->digests[k];
+        for (size_t k = 0; k < pcr_value.count; k++) {
+            TPM2B_DIGEST *p = &pcr_value.digests[k];
             p->size = htole16(p->size);
         }
-        pcr_value->count = htole32(pcr_value->count);
-        fwrite_len = fwrite(pcr_value, sizeof(TPML_DIGEST), 1, output_file);
+        pcr_value.count = htole32(pcr_value.count);
+        fwrite_len = fwrite(&pcr_value, sizeof(TPML_DIGEST), 1, output_file);
         if (fwrite_len != 1) {
             LOG_ERR("write to output file failed: %s", strerror(errno));
             return false;
@@ -282,6 +295,201 @@ bool pcr_fwrite_serialized(const TPML_PCR_SELECTION *pcr_select,
     return true;
 }
 
+static const BYTE pcr_bundle_magic[] = { 'P', 'C', 'R', 'B' };
+
+bool pcr_bundle_write(const TPML_PCR_SELECTION *pcr_select,
+    const tpm2_pcrs *pcrs, FILE *output_file) {
+
+    if (pcr_select->count > TPM2_NUM_PCR_BANKS) {
+        LOG_ERR("PCR selection of %" PRIu32 " banks exceeds the maximum of %u",
+                pcr_select->count, TPM2_NUM_PCR_BANKS);
+        return false;
+    }
+
+    BYTE magic[sizeof(pcr_bundle_magic)];
+    memcpy(magic, pcr_bundle_magic, sizeof(magic));
+    UINT8 count = pcr_select->count;
+    bool result = files_write_bytes(output_file, magic, sizeof(magic))
+            && files_write_16(output_file, PCR_BUNDLE_VERSION)
+            && files_write_bytes(output_file, &count, 1);
+
+    UINT32 i;
+    for (i = 0; result && i < pcr_select->count; i++) {
+        TPMS_PCR_SELECTION sel = pcr_select->pcrSelections[i];
+        result = files_write_16(output_file, sel.hash)
+                && files_write_bytes(output_file, &sel.sizeofSelect, 1)
+                && files_write_bytes(output_file, sel.pcrSelect,
+                        sel.sizeofSelect);
+    }
+
+    /* the digests straight from the lists, in the order they were read */
+    size_t vi = 0;  /* value index */
+    UINT32 di = 0;  /* digest index */
+    for (i = 0; result && i < pcr_select->count; i++) {
+        const TPMS_PCR_SELECTION *sel = &pcr_select->pcrSelections[i];
+        pcr_bitset bits = pcr_bitset_from_select(sel);
+        unsigned pcr_id;
+        while (result && pcr_bitset_next(&bits, &pcr_id)) {
+            if (vi >= pcrs->count || di >= pcrs->pcr_values[vi].count) {
+                LOG_ERR("No value was read for PCR %u of bank 0x%x", pcr_id,
+                        sel->hash);
+                return false;
+            }
+
+            const TPM2B_DIGEST *digest = &pcrs->pcr_values[vi].digests[di];
+            result = files_write_record(output_file, (UINT8 *) digest->buffer,
+                    digest->size);
+
+            if (++di == pcrs->pcr_values[vi].count) {
+                di = 0;
+                vi++;
+            }
+        }
+    }
+
+    if (!result) {
+        LOG_ERR("write to output file failed: %s", strerror(errno));
+    }
+
+    return result;
+}
+
+bool pcr_bundle_is_bundle(FILE *input) {
+
+    BYTE magic[sizeof(pcr_bundle_magic)];
+    long position = ftell(input);
+    size_t len = fread(magic, 1, sizeof(magic), input);
+    if (position < 0 || fseek(input, position, SEEK_SET)) {
+        LOG_ERR("Could not seek in the PCR file: %s", strerror(errno));
+        return false;
+    }
+
+    return len == sizeof(magic) && !memcmp(magic, pcr_bundle_magic,
+            sizeof(magic));
+}
+
+bool pcr_bundle_reader_init(pcr_bundle_reader *reader, FILE *input) {
+
+    memset(reader, 0, sizeof(*reader));
+    reader->input = input;
+
+    BYTE magic[sizeof(pcr_bundle_magic)];
+    UINT16 version;
+    UINT8 count;
+    bool result = files_read_bytes(input, magic, sizeof(magic))
+            && files_read_16(input, &version)
+            && files_read_bytes(input, &count, 1);
+    if (!result || memcmp(magic, pcr_bundle_magic, sizeof(magic))) {
+        LOG_ERR("Malformed PCR bundle header");
+        return false;
+    }
+
+    if (version != PCR_BUNDLE_VERSION) {
+        LOG_ERR("Unsupported PCR bundle version %u, expected %u", version,
+                PCR_BUNDLE_VERSION);
+        return false;
+    }
+
+    if (count > TPM2_NUM_PCR_BANKS) {
+        LOG_ERR("Malformed PCR bundle, bank count cannot be greater than %u, "
+                "got: %u", TPM2_NUM_PCR_BANKS, count);
+        return false;
+    }
+
+    reader->pcr_select.count = count;
+    UINT32 i;
+    for (i = 0; i < count; i++) {
+        TPMS_PCR_SELECTION *sel = &reader->pcr_select.pcrSelections[i];
+        result = files_read_16(input, &sel->hash)
+                && files_read_bytes(input, &sel->sizeofSelect, 1)
+                && sel->sizeofSelect <= sizeof(sel->pcrSelect)
+                && files_read_bytes(input, sel->pcrSelect, sel->sizeofSelect);
+        if (!result || !tpm2_alg_util_get_hash_size(sel->hash)) {
+            LOG_ERR("Malformed PCR bundle selection of bank %" PRIu32, i);
+            return false;
+        }
+    }
+
+    return true;
+}
+
+bool pcr_bundle_reader_next(pcr_bundle_reader *reader, TPMI_ALG_HASH *hash,
+    unsigned *pcr_id, TPM2B_DIGEST *digest, bool *is_end) {
+
+    /* find the PCR the next digest belongs to */
+    const TPMS_PCR_SELECTION *sel = NULL;
+    for (; reader->bank < reader->pcr_select.count; reader->bank++,
+            reader->pcr_id = 0) {
+        sel = &reader->pcr_select.pcrSelections[reader->bank];
+        while (reader->pcr_id < sel->sizeofSelect * 8u
+                && !tpm2_util_is_pcr_select_bit_set(sel, reader->pcr_id)) {
+            reader->pcr_id++;
+        }
+        if (reader->pcr_id < sel->sizeofSelect * 8u) {
+            break;
+        }
+    }
+
+    *is_end = reader->bank == reader->pcr_select.count;
+    if (*is_end) {
+        if (fgetc(reader->input) != EOF) {
+            LOG_ERR("Malformed PCR bundle, data follows the last digest");
+            return false;
+        }
+        return true;
+    }
+
+    bool is_missing = false;
+    digest->size = sizeof(digest->buffer);
+    bool result = files_read_record(reader->input, digest->buffer,
+            &digest->size, &is_missing);
+    if (!result || is_missing
+            || digest->size != tpm2_alg_util_get_hash_size(sel->hash)) {
+        LOG_ERR("Malformed PCR bundle digest of PCR %u of bank 0x%x",
+                reader->pcr_id, sel->hash);
+        return false;
+    }
+
+    *hash = sel->hash;
+    *pcr_id = reader->pcr_id++;
+
+    return true;
+}
+
+bool pcr_bundle_read(FILE *input, TPML_PCR_SELECTION *pcr_select,
+    tpm2_pcrs *pcrs) {
+
+    pcr_bundle_reader reader;
+    bool result = pcr_bundle_reader_init(&reader, input);
+    if (!result) {
+        return false;
+    }
+
+    *pcr_select = reader.pcr_select;
+    pcrs->count = 0;
+
+    TPML_DIGEST *values = NULL;
+    while (true) {
+        TPMI_ALG_HASH hash;
+        unsigned pcr_id;
+        TPM2B_DIGEST digest;
+        bool is_end;
+        result = pcr_bundle_reader_next(&reader, &hash, &pcr_id, &digest,
+                &is_end);
+        if (!result || is_end) {
+            return result;
+        }
+
+        if (!values || values->count == ARRAY_LEN(values->digests)) {
+            values = pcr_pcrs_append(pcrs);
+            if (!values) {
+                return false;
+            }
+        }
+        values->digests[values->count++] = digest;
+    }
+}
+
 bool pcr_fwrite_values(const TPML_PCR_SELECTION *pcr_select,
     const tpm2_pcrs *pcrs, FILE *output_file) {
 
@@ -291,15 +499,9 @@ bool pcr_fwrite_values(const TPML_PCR_SELECTION *pcr_select,
     for (UINT32 i = 0; i < pcr_select->count; i++) {
         const TPMS_PCR_SELECTION *pcr_selection = &pcr_select->pcrSelections[i];
         // Loop through all PCRs in this bank
-        for (unsigned int pcr_id = 0; pcr_id < pcr_selection->sizeofSelect * 8u;
-            pcr_id++) {
-
-            bool is_pcr_select_bit_set = tpm2_util_is_pcr_select_bit_set(
-                pcr_selection, pcr_id);
-            if (! is_pcr_select_bit_set) {
-                // skip non-selected banks
-                continue;
-            }
+        pcr_bitset bits = pcr_bitset_from_select(pcr_selection);
+        unsigned int pcr_id;
+        while (pcr_bitset_next(&bits, &pcr_id)) {
             const TPML_DIGEST *pcr_value = &pcrs->pcr_values[vi];
             if (vi >= pcrs->count || di >= pcr_value->count) {
                 LOG_ERR("Something wrong, trying to print but nothing more");
@@ -330,57 +532,129 @@ bool pcr_print_values(const TPML_PCR_SELECTION *pcr_select,
 
     size_t vi = 0;  /* value index */
     UINT32 di = 0;  /* digest index */
+    bool result = true;
     // Loop through all PCR/hash banks
-    for (UINT32 i = 0; i < pcr_select->count; i++) {
+    for (UINT32 i = 0; result && i < pcr_select->count; i++) {
         const TPMS_PCR_SELECTION *pcr_selection = &pcr_select->pcrSelections[i];
         const char *alg_name = tpm2_alg_util_algtostr(pcr_selection->hash,
             tpm2_alg_util_flags_hash);
 
-        tpm2_tool_output("  %s:\n", alg_name);
+        tpm2_writer_map_start(alg_name);
 
         // Loop through all PCRs in this bank
-        for (unsigned int pcr_id = 0; pcr_id < pcr_selection->sizeofSelect * 8u;
-            pcr_id++) {
-
-            bool is_pcr_select_bit_set = tpm2_util_is_pcr_select_bit_set(
-                pcr_selection, pcr_id);
-            if (! is_pcr_select_bit_set) {
-                // skip non-selected banks
-                continue;
-            }
+        pcr_bitset bits = pcr_bitset_from_select(pcr_selection);
+        unsigned int pcr_id;
+        while (pcr_bitset_next(&bits, &pcr_id)) {
             const TPML_DIGEST *pcr_value = &pcrs->pcr_values[vi];
             if (vi >= pcrs->count || di >= pcr_value->count) {
                 LOG_ERR("Something wrong, trying to print but nothing more");
-                return false;
+                result = false;
+                break;
             }
 
-            // Print out PCR ID
-            tpm2_tool_output("    %-2d: 0x", pcr_id);
-
-            // Print out current PCR digest value
+            // Print out PCR ID and current PCR digest value
             const TPM2B_DIGEST *digest = &pcr_value->digests[di];
-            for (int k = 0; k < digest->size; k++) {
-                tpm2_tool_output("%02X", digest->buffer[k]);
-            }
-            tpm2_tool_output("\n");
+            pcr_print_digest(pcr_id, digest->buffer, digest->size);
 
             if (++di >= pcr_value->count) {
                 di = 0;
                 ++vi;
             }
         } /* end looping through all PCRs in a bank */
+
+        tpm2_writer_end();
     }  /* end looping through all PCR banks */
 
-    return true;
+    return result;
+}
+
+tool_rc pcr_read_update_counter(ESYS_CONTEXT *esys_context,
+        TPMI_ALG_HASH bank, UINT32 *pcr_update_counter) {
+
+    /* a bank without any PCR selected, so no digest comes back */
+    TPML_PCR_SELECTION pcr_select = {
+        .count = 1,
+        .pcrSelections[0] = {
+            .hash = bank,
+            .sizeofSelect = 3,
+        },
+    };
+
+    TPML_PCR_SELECTION *pcr_selection_out = NULL;
+    TPML_DIGEST *values = NULL;
+    tool_rc rc = tpm2_pcr_read(esys_context, ESYS_TR_NONE, ESYS_TR_NONE,
+            ESYS_TR_NONE, &pcr_select, pcr_update_counter, &pcr_selection_out,
+            &values);
+
+    free(pcr_selection_out);
+    free(values);
+
+    return rc;
+}
+
+bool pcr_print_changed_values(const TPML_PCR_SELECTION *pcr_select,
+        const tpm2_pcrs *old_pcrs, const tpm2_pcrs *pcrs, size_t *changed) {
+
+    *changed = 0;
+
+    /* both are read with the same selection, so their chunks match */
+    size_t vi = 0;
+    UINT32 di = 0;
+    UINT32 i;
+    bool result = true;
+    for (i = 0; result && i < pcr_select->count; i++) {
+        const TPMS_PCR_SELECTION *pcr_selection = &pcr_select->pcrSelections[i];
+        bool is_bank_output = false;
+
+        pcr_bitset bits = pcr_bitset_from_select(pcr_selection);
+        unsigned int pcr_id;
+        while (pcr_bitset_next(&bits, &pcr_id)) {
+            if (vi >= pcrs->count || vi >= old_pcrs->count ||
+                di >= pcrs->pcr_values[vi].count ||
+                di >= old_pcrs->pcr_values[vi].count) {
+                LOG_ERR("PCR values do not match the selection");
+                result = false;
+                break;
+            }
+
+            const TPM2B_DIGEST *digest = &pcrs->pcr_values[vi].digests[di];
+            const TPM2B_DIGEST *old = &old_pcrs->pcr_values[vi].digests[di];
+            if (digest->size != old->size ||
+                memcmp(digest->buffer, old->buffer, digest->size)) {
+                if (!is_bank_output) {
+                    tpm2_writer_map_start(tpm2_alg_util_algtostr(
+                            pcr_selection->hash, tpm2_alg_util_flags_hash));
+                    is_bank_output = true;
+                }
+
+                pcr_print_digest(pcr_id, digest->buffer, digest->size);
+                (*changed)++;
+            }
+
+            if (++di >= pcrs->pcr_values[vi].count) {
+                di = 0;
+                ++vi;
+            }
+        }
+
+        if (is_bank_output) {
+            tpm2_writer_end();
+        }
+    }
+
+    return result;
 }
 
 bool pcr_print_pcr_struct(TPML_PCR_SELECTION *pcr_select, tpm2_pcrs *pcrs) {
-    tpm2_tool_output("pcrs:\n");
-    return pcr_print_values(pcr_select, pcrs);
+    tpm2_writer_map_start("pcrs");
+    bool result = pcr_print_values(pcr_select, pcrs);
+    tpm2_writer_end();
+    return result;
 }
 
 bool pcr_print_pcr_selections(TPML_PCR_SELECTION *pcr_selections) {
-    tpm2_tool_output("selected-pcrs:\n");
+    bool result = true;
+    tpm2_writer_list_start("selected-pcrs");
 
     /* Iterate throught the pcr banks */
     UINT32 i;
@@ -389,33 +663,33 @@ bool pcr_print_pcr_selections(TPML_PCR_SELECTION *pcr_selections) {
         const char *halgstr = tpm2_alg_util_algtostr(
                 pcr_selections->pcrSelections[i].hash,
                 tpm2_alg_util_flags_hash);
-        if (halgstr != NULL) {
-            tpm2_tool_output("  - %s: [", halgstr);
-        } else {
+        if (halgstr == NULL) {
             LOG_ERR("Unsupported hash algorithm 0x%08x",
                     pcr_selections->pcrSelections[i].hash);
-            return false;
+            result = false;
+            break;
         }
 
+        tpm2_writer_map_start(NULL);
+        tpm2_writer_flow_start(halgstr);
+
         /* Iterate through the PCRs of the bank */
-        bool first = true;
         unsigned j;
         for (j = 0; j < pcr_selections->pcrSelections[i].sizeofSelect * 8;
                 j++) {
             if ((pcr_selections->pcrSelections[i].pcrSelect[j / 8]
                     & 1 << (j % 8)) != 0) {
-                if (first) {
-                    tpm2_tool_output(" %i", j);
-                    first = false;
-                } else {
-                    tpm2_tool_output(", %i", j);
-                }
+                tpm2_writer_number(NULL, "%u", j);
             }
         }
-        tpm2_tool_output(" ]\n");
+
+        tpm2_writer_end();
+        tpm2_writer_end();
     }
 
-    return true;
+    tpm2_writer_end();
+
+    return result;
 }
 
 bool pcr_parse_selections(const char *arg, TPML_PCR_SELECTION *pcr_select) {
@@ -455,12 +729,10 @@ bool pcr_parse_selections(const char *arg, TPML_PCR_SELECTION *pcr_select) {
 tool_rc pcr_get_banks(ESYS_CONTEXT *esys_context,
         TPMS_CAPABILITY_DATA *capability_data, tpm2_algorithm *algs) {
 
-    TPMI_YES_NO more_data;
     TPMS_CAPABILITY_DATA *capdata_ret;
 
-    tool_rc rc = tpm2_get_capability(esys_context, ESYS_TR_NONE, ESYS_TR_NONE,
-            ESYS_TR_NONE, TPM2_CAP_PCRS, no_argument, required_argument,
-            &more_data, &capdata_ret);
+    tool_rc rc = tpm2_capability_get(esys_context, TPM2_CAP_PCRS, no_argument,
+            required_argument, &capdata_ret);
     if (rc != tool_rc_success) {
         return rc;
     }
@@ -519,15 +791,16 @@ bool pcr_init_pcr_selection(TPMS_CAPABILITY_DATA *cap_data,
 bool pcr_check_pcr_selection(TPMS_CAPABILITY_DATA *cap_data,
         TPML_PCR_SELECTION *pcr_sel) {
 
-    UINT32 i, j, k;
+    UINT32 i, j;
 
     for (i = 0; i < pcr_sel->count; i++) {
+        TPMS_PCR_SELECTION *sel = &pcr_sel->pcrSelections[i];
         for (j = 0; j < cap_data->data.assignedPCR.count; j++) {
-            if (pcr_sel->pcrSelections[i].hash
-                    == cap_data->data.assignedPCR.pcrSelections[j].hash) {
-                for (k = 0; k < pcr_sel->pcrSelections[i].sizeofSelect; k++)
-                    pcr_sel->pcrSelections[i].pcrSelect[k] &=
-                            cap_data->data.assignedPCR.pcrSelections[j].pcrSelect[k];
+            const TPMS_PCR_SELECTION *assigned =
+                    &cap_data->data.assignedPCR.pcrSelections[j];
+            if (sel->hash == assigned->hash) {
+                pcr_bitset_to_select(pcr_bitset_from_select(sel)
+                        & pcr_bitset_from_select(assigned), sel);
                 break;
             }
         }
@@ -548,46 +821,721 @@ bool pcr_check_pcr_selection(TPMS_CAPABILITY_DATA *cap_data,
     return true;
 }
 
-tool_rc pcr_read_pcr_values(ESYS_CONTEXT *esys_context,
-        TPML_PCR_SELECTION *pcr_select, tpm2_pcrs *pcrs) {
+#define PCRS_CAPACITY_MIN 8
 
-    TPML_PCR_SELECTION pcr_selection_tmp;
-    TPML_PCR_SELECTION *pcr_selection_out;
-    UINT32 pcr_update_counter;
+TPML_DIGEST *pcr_pcrs_append(tpm2_pcrs *pcrs) {
+
+    if (pcrs->count == pcrs->capacity) {
+        size_t capacity = pcrs->capacity ?
+                pcrs->capacity * 2 : PCRS_CAPACITY_MIN;
+        TPML_DIGEST *values = realloc(pcrs->pcr_values,
+                capacity * sizeof(*values));
+        if (!values) {
+            LOG_ERR("oom");
+            return NULL;
+        }
+        pcrs->pcr_values = values;
+        pcrs->capacity = capacity;
+    }
 
-    //1. prepare pcrSelectionIn with g_pcrSelections
-    memcpy(&pcr_selection_tmp, pcr_select, sizeof(pcr_selection_tmp));
+    TPML_DIGEST *value = &pcrs->pcr_values[pcrs->count++];
+    memset(value, 0, sizeof(*value));
 
-    //2. call pcr_read
+    return value;
+}
+
+void pcr_pcrs_free(tpm2_pcrs *pcrs) {
+
+    free(pcrs->pcr_values);
+    pcrs->pcr_values = NULL;
+    pcrs->capacity = 0;
     pcrs->count = 0;
-    do {
-        TPML_DIGEST *v;
-        tool_rc rc = tpm2_pcr_read(esys_context, ESYS_TR_NONE, ESYS_TR_NONE,
-                ESYS_TR_NONE, &pcr_selection_tmp, &pcr_update_counter,
-                &pcr_selection_out, &v);
+}
+
+bool pcr_merge_selections(TPML_PCR_SELECTION *dest,
+        const TPML_PCR_SELECTION *src) {
+
+    UINT32 i;
+    for (i = 0; i < src->count; i++) {
+        const TPMS_PCR_SELECTION *sel = &src->pcrSelections[i];
+
+        TPMS_PCR_SELECTION *merged = NULL;
+        UINT32 j;
+        for (j = 0; j < dest->count; j++) {
+            if (dest->pcrSelections[j].hash == sel->hash) {
+                merged = &dest->pcrSelections[j];
+                break;
+            }
+        }
+
+        if (!merged) {
+            if (dest->count == ARRAY_LEN(dest->pcrSelections)) {
+                LOG_ERR("Too many PCR banks to merge");
+                return false;
+            }
+            merged = &dest->pcrSelections[dest->count++];
+            memset(merged, 0, sizeof(*merged));
+            merged->hash = sel->hash;
+        }
+
+        pcr_bitset bits = pcr_bitset_from_select(merged)
+                | pcr_bitset_from_select(sel);
+        if (sel->sizeofSelect > merged->sizeofSelect) {
+            merged->sizeofSelect = sel->sizeofSelect;
+        }
+        pcr_bitset_to_select(bits, merged);
+    }
+
+    return true;
+}
+
+/* the position of a PCR among the values read for a selection */
+static bool pcr_value_index(const TPML_PCR_SELECTION *pcr_select,
+        TPMI_ALG_HASH hash, unsigned pcr, size_t *index) {
+
+    size_t position = 0;
+    UINT32 i;
+    for (i = 0; i < pcr_select->count; i++) {
+        const TPMS_PCR_SELECTION *sel = &pcr_select->pcrSelections[i];
+        pcr_bitset bits = pcr_bitset_from_select(sel);
+
+        if (sel->hash == hash && pcr < sel->sizeofSelect * 8u
+                && (bits >> pcr & 1)) {
+            /* the PCRs of the bank below it come first */
+            *index = position
+                    + pcr_bitset_count(bits & (((pcr_bitset) 1 << pcr) - 1));
+            return true;
+        }
+        position += pcr_bitset_count(bits);
+    }
+
+    return false;
+}
+
+static const TPM2B_DIGEST *pcr_value_at(const tpm2_pcrs *pcrs, size_t index) {
+
+    size_t i;
+    for (i = 0; i < pcrs->count; i++) {
+        if (index < pcrs->pcr_values[i].count) {
+            return &pcrs->pcr_values[i].digests[index];
+        }
+        index -= pcrs->pcr_values[i].count;
+    }
+
+    return NULL;
+}
+
+bool pcr_select_pcr_values(const TPML_PCR_SELECTION *pcr_select,
+        const tpm2_pcrs *pcrs, const TPML_PCR_SELECTION *subset,
+        tpm2_pcrs *subset_pcrs) {
+
+    subset_pcrs->count = 0;
+
+    TPML_DIGEST *values = NULL;
+    UINT32 i;
+    for (i = 0; i < subset->count; i++) {
+        const TPMS_PCR_SELECTION *sel = &subset->pcrSelections[i];
+        pcr_bitset bits = pcr_bitset_from_select(sel);
+        unsigned pcr_id;
+        while (pcr_bitset_next(&bits, &pcr_id)) {
+            size_t index;
+            const TPM2B_DIGEST *value = pcr_value_index(pcr_select, sel->hash,
+                    pcr_id, &index) ? pcr_value_at(pcrs, index) : NULL;
+            if (!value) {
+                LOG_ERR("No value was read for PCR %u of bank 0x%x", pcr_id,
+                        sel->hash);
+                return false;
+            }
+
+            if (!values || values->count == ARRAY_LEN(values->digests)) {
+                values = pcr_pcrs_append(subset_pcrs);
+                if (!values) {
+                    return false;
+                }
+            }
+            values->digests[values->count++] = *value;
+        }
+    }
+
+    return true;
+}
+
+/*
+ * The TPM answers TPM2_PCR_Read with the selected PCRs in selection order,
+ * bank by bank and in ascending PCR order, but at most as many as fit into a
+ * TPML_DIGEST. Split the selection into chunks of that size so the reads do
+ * not depend on the previous response.
+ */
+#define PCR_READ_CHUNK_MAX ARRAY_LEN(((TPML_DIGEST *)NULL)->digests)
+
+static TPML_PCR_SELECTION *pcr_split_selection(
+        const TPML_PCR_SELECTION *pcr_select, size_t *chunk_count) {
+
+    size_t selected = 0;
+    UINT32 i;
+    for (i = 0; i < pcr_select->count; i++) {
+        selected += pcr_bitset_count(
+                pcr_bitset_from_select(&pcr_select->pcrSelections[i]));
+    }
+
+    *chunk_count = (selected + PCR_READ_CHUNK_MAX - 1) / PCR_READ_CHUNK_MAX;
+    if (!*chunk_count) {
+        return NULL;
+    }
+
+    TPML_PCR_SELECTION *chunks = calloc(*chunk_count, sizeof(*chunks));
+    if (!chunks) {
+        LOG_ERR("oom");
+        return NULL;
+    }
+
+    TPML_PCR_SELECTION *chunk = chunks;
+    size_t in_chunk = 0;
+    for (i = 0; i < pcr_select->count; i++) {
+        const TPMS_PCR_SELECTION *sel = &pcr_select->pcrSelections[i];
+        TPMS_PCR_SELECTION *out = NULL;
+        pcr_bitset bits = pcr_bitset_from_select(sel);
+        unsigned pcr_id;
+        while (pcr_bitset_next(&bits, &pcr_id)) {
+            if (in_chunk == PCR_READ_CHUNK_MAX) {
+                chunk++;
+                in_chunk = 0;
+                out = NULL;
+            }
+
+            if (!out) {
+                out = &chunk->pcrSelections[chunk->count++];
+                out->hash = sel->hash;
+                set_pcr_select_size(out, sel->sizeofSelect);
+            }
+
+            out->pcrSelect[pcr_id / 8] |= 1 << (pcr_id % 8);
+            in_chunk++;
+        }
+    }
 
+    return chunks;
+}
+
+#define PCR_CACHE_VERSION 1
+
+#define PCR_CACHE_SNAPSHOT "snapshot"
+
+/*
+ * The directory of the PCR snapshot shared by the tools run by tpm2_batch and
+ * tpm2_serve, NULL while the cache is disabled. The snapshot holds the values
+ * of the PCRs last read, the update counter of the TPM they were read at and
+ * the PCRs that do not change the counter.
+ */
+static char *pcr_cache_dir;
+
+typedef struct pcr_snapshot pcr_snapshot;
+struct pcr_snapshot {
+    UINT32 pcr_update_counter;
+    TPMS_PCR_SELECT no_increment;
+    TPML_PCR_SELECTION pcr_select;
+    tpm2_pcrs pcrs;
+};
+
+static bool pcr_snapshot_load(const char *path, pcr_snapshot *snapshot) {
+
+    FILE *f = fopen(path, "rb");
+    if (!f) {
+        return false;
+    }
+
+    UINT32 version;
+    UINT16 size = sizeof(snapshot->no_increment.pcrSelect);
+    bool is_end = false;
+    bool result = files_read_header(f, &version)
+            && version == PCR_CACHE_VERSION
+            && files_read_32(f, &snapshot->pcr_update_counter)
+            && files_read_record(f, snapshot->no_increment.pcrSelect, &size,
+                    &is_end) && !is_end;
+    snapshot->no_increment.sizeofSelect = size;
+
+    UINT8 buffer[sizeof(TPML_DIGEST)];
+    size = sizeof(buffer);
+    result = result && files_read_record(f, buffer, &size, &is_end) && !is_end
+            && Tss2_MU_TPML_PCR_SELECTION_Unmarshal(buffer, size, NULL,
+                    &snapshot->pcr_select) == TSS2_RC_SUCCESS;
+
+    while (result) {
+        size = sizeof(buffer);
+        result = files_read_record(f, buffer, &size, &is_end);
+        if (!result || is_end) {
+            break;
+        }
+
+        TPML_DIGEST *values = pcr_pcrs_append(&snapshot->pcrs);
+        result = values && Tss2_MU_TPML_DIGEST_Unmarshal(buffer, size, NULL,
+                values) == TSS2_RC_SUCCESS;
+    }
+
+    fclose(f);
+
+    if (!result) {
+        LOG_WARN("Ignoring the unreadable PCR snapshot \"%s\"", path);
+    }
+
+    return result;
+}
+
+static void pcr_snapshot_save(const char *path, const pcr_snapshot *snapshot) {
+
+    files_atomic atomic;
+    FILE *f = files_atomic_open(&atomic, path);
+    if (!f) {
+        return;
+    }
+
+    UINT8 no_increment[sizeof(snapshot->no_increment.pcrSelect)];
+    memcpy(no_increment, snapshot->no_increment.pcrSelect,
+            sizeof(no_increment));
+
+    UINT8 buffer[sizeof(TPML_DIGEST)];
+    size_t size = 0;
+    bool result = files_write_header(f, PCR_CACHE_VERSION)
+            && files_write_32(f, snapshot->pcr_update_counter)
+            && files_write_record(f, no_increment,
+                    snapshot->no_increment.sizeofSelect)
+            && Tss2_MU_TPML_PCR_SELECTION_Marshal(&snapshot->pcr_select,
+                    buffer, sizeof(buffer), &size) == TSS2_RC_SUCCESS
+            && files_write_record(f, buffer, size);
+
+    size_t i;
+    for (i = 0; result && i < snapshot->pcrs.count; i++) {
+        size = 0;
+        result = Tss2_MU_TPML_DIGEST_Marshal(&snapshot->pcrs.pcr_values[i],
+                buffer, sizeof(buffer), &size) == TSS2_RC_SUCCESS
+                && files_write_record(f, buffer, size);
+    }
+
+    if (!files_atomic_close(&atomic, f, result)) {
+        LOG_WARN("Could not write PCR snapshot \"%s\"", path);
+    }
+}
+
+static const TPMS_PCR_SELECTION *pcr_find_bank(
+        const TPML_PCR_SELECTION *pcr_select, TPMI_ALG_HASH hash) {
+
+    UINT32 i;
+    for (i = 0; i < pcr_select->count; i++) {
+        if (pcr_select->pcrSelections[i].hash == hash) {
+            return &pcr_select->pcrSelections[i];
+        }
+    }
+
+    return NULL;
+}
+
+static bool pcr_is_subset(const TPML_PCR_SELECTION *subset,
+        const TPML_PCR_SELECTION *pcr_select) {
+
+    UINT32 i;
+    for (i = 0; i < subset->count; i++) {
+        const TPMS_PCR_SELECTION *sel = &subset->pcrSelections[i];
+        const TPMS_PCR_SELECTION *bank = pcr_find_bank(pcr_select, sel->hash);
+
+        pcr_bitset bits = pcr_bitset_from_select(sel);
+        if (bits && (!bank || (bits & ~pcr_bitset_from_select(bank)))) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+static bool pcr_is_counted(const TPML_PCR_SELECTION *pcr_select,
+        const TPMS_PCR_SELECT *no_increment) {
+
+    pcr_bitset no_increment_bits = pcr_bitset_from_bytes(
+            no_increment->pcrSelect, no_increment->sizeofSelect);
+
+    UINT32 i;
+    for (i = 0; i < pcr_select->count; i++) {
+        if (pcr_bitset_from_select(&pcr_select->pcrSelections[i])
+                & no_increment_bits) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+static tool_rc pcr_read_no_increment(ESYS_CONTEXT *esys_context,
+        TPMS_PCR_SELECT *no_increment) {
+
+    TPMS_CAPABILITY_DATA *capability_data = NULL;
+    tool_rc rc = tpm2_capability_get(esys_context, TPM2_CAP_PCR_PROPERTIES,
+            TPM2_PT_PCR_NO_INCREMENT, 1, &capability_data);
+    if (rc != tool_rc_success) {
+        return rc;
+    }
+
+    TPML_TAGGED_PCR_PROPERTY *properties =
+            &capability_data->data.pcrProperties;
+    if (!properties->count
+            || properties->pcrProperty[0].tag != TPM2_PT_PCR_NO_INCREMENT
+            || properties->pcrProperty[0].sizeofSelect
+                    > sizeof(no_increment->pcrSelect)) {
+        LOG_ERR("TPM did not return the PCRs that do not change the update "
+                "counter");
+        free(capability_data);
+        return tool_rc_general_error;
+    }
+
+    no_increment->sizeofSelect = properties->pcrProperty[0].sizeofSelect;
+    memcpy(no_increment->pcrSelect, properties->pcrProperty[0].pcrSelect,
+            no_increment->sizeofSelect);
+    free(capability_data);
+
+    return tool_rc_success;
+}
+
+/*
+ * Answers a read from the snapshot while the update counter of the TPM is the
+ * one the snapshot was read at, which costs a read of the counter only.
+ * Otherwise reads anew and keeps the values as the snapshot unless one of the
+ * PCRs does not change the counter.
+ */
+static tool_rc pcr_cache_read(ESYS_CONTEXT *esys_context,
+        TPML_PCR_SELECTION *pcr_select, tpm2_pcrs *pcrs, UINT32 *counter) {
+
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s/" PCR_CACHE_SNAPSHOT, pcr_cache_dir);
+
+    pcr_snapshot snapshot = { 0 };
+    bool is_loaded = pcr_snapshot_load(path, &snapshot);
+
+    tool_rc rc;
+    if (is_loaded && pcr_is_subset(pcr_select, &snapshot.pcr_select)) {
+        rc = pcr_read_update_counter(esys_context,
+                pcr_select->pcrSelections[0].hash, counter);
         if (rc != tool_rc_success) {
-            return rc;
+            goto out;
+        }
+
+        if (*counter == snapshot.pcr_update_counter) {
+            LOG_INFO("Using the PCR values cached at update counter %"PRIu32,
+                    *counter);
+            rc = pcr_select_pcr_values(&snapshot.pcr_select, &snapshot.pcrs,
+                    pcr_select, pcrs) ?
+                    tool_rc_success : tool_rc_general_error;
+            goto out;
         }
+    }
 
-        pcrs->pcr_values[pcrs->count] = *v;
+    if (!is_loaded) {
+        rc = pcr_read_no_increment(esys_context, &snapshot.no_increment);
+        if (rc != tool_rc_success) {
+            goto out;
+        }
+    }
 
-        free(v);
+    rc = pcr_read_pcr_values_counter(esys_context, pcr_select, pcrs,
+            counter);
+    if (rc != tool_rc_success
+            || !pcr_is_counted(pcr_select, &snapshot.no_increment)) {
+        goto out;
+    }
 
-        //3. unmask pcrSelectionOut bits from pcrSelectionIn
-        pcr_update_pcr_selections(&pcr_selection_tmp, pcr_selection_out);
+    pcr_pcrs_free(&snapshot.pcrs);
+    snapshot.pcr_update_counter = *counter;
+    snapshot.pcr_select = *pcr_select;
+    snapshot.pcrs = *pcrs;
+    pcr_snapshot_save(path, &snapshot);
+    /* the values belong to the caller */
+    snapshot.pcrs.pcr_values = NULL;
+    snapshot.pcrs.count = 0;
 
+out:
+    pcr_pcrs_free(&snapshot.pcrs);
+
+    return rc;
+}
+
+/*
+ * The host cache keys the PCR values by the marshaled selection and keeps
+ * the marshaled digest lists one after the other, tagged with the update
+ * counter they were read at.
+ */
+static bool pcr_host_cache_key(const TPML_PCR_SELECTION *pcr_select,
+        UINT8 key[TPM2_HOST_CACHE_KEY_MAX], size_t *key_size) {
+
+    *key_size = 0;
+    return Tss2_MU_TPML_PCR_SELECTION_Marshal(pcr_select, key,
+            TPM2_HOST_CACHE_KEY_MAX, key_size) == TSS2_RC_SUCCESS;
+}
+
+/*
+ * Answers a read from the host cache while the update counter of the TPM is
+ * the one the entry was read at, which costs a read of the counter only.
+ */
+static tool_rc pcr_host_cache_read(ESYS_CONTEXT *esys_context,
+        const TPML_PCR_SELECTION *pcr_select, tpm2_pcrs *pcrs, bool *is_hit) {
+
+    *is_hit = false;
+
+    /* the values of another TPM are not used */
+    if (!tpm2_host_cache_identify(esys_context)) {
+        return tool_rc_success;
+    }
+
+    UINT8 key[TPM2_HOST_CACHE_KEY_MAX];
+    size_t key_size;
+    UINT8 value[TPM2_HOST_CACHE_VALUE_MAX];
+    size_t value_size;
+    UINT32 tag;
+    if (!pcr_host_cache_key(pcr_select, key, &key_size)
+            || !tpm2_host_cache_get(tpm2_host_cache_kind_pcrs, key, key_size,
+                    value, &value_size, &tag)) {
+        return tool_rc_success;
+    }
+
+    UINT32 counter;
+    tool_rc rc = pcr_read_update_counter(esys_context,
+            pcr_select->pcrSelections[0].hash, &counter);
+    if (rc != tool_rc_success || counter != tag) {
+        return rc;
+    }
+
+    pcrs->count = 0;
+    size_t offset = 0;
+    while (offset < value_size) {
+        TPML_DIGEST *values = pcr_pcrs_append(pcrs);
+        if (!values || Tss2_MU_TPML_DIGEST_Unmarshal(value, value_size,
+                &offset, values) != TSS2_RC_SUCCESS) {
+            pcrs->count = 0;
+            return tool_rc_success;
+        }
+    }
+
+    LOG_INFO("Using the PCR values of the host cache at update counter %"
+            PRIu32, counter);
+    *is_hit = true;
+
+    return tool_rc_success;
+}
+
+static void pcr_host_cache_put(ESYS_CONTEXT *esys_context,
+        const TPML_PCR_SELECTION *pcr_select, const tpm2_pcrs *pcrs,
+        UINT32 counter, UINT32 generation) {
+
+    if (!tpm2_host_cache_is_writer()) {
+        return;
+    }
+
+    /* the values of these PCRs may change under an unchanged counter */
+    TPMS_PCR_SELECT no_increment;
+    tool_rc rc = pcr_read_no_increment(esys_context, &no_increment);
+    if (rc != tool_rc_success || !pcr_is_counted(pcr_select, &no_increment)) {
+        return;
+    }
+
+    UINT8 key[TPM2_HOST_CACHE_KEY_MAX];
+    size_t key_size;
+    if (!pcr_host_cache_key(pcr_select, key, &key_size)) {
+        return;
+    }
+
+    UINT8 value[TPM2_HOST_CACHE_VALUE_MAX];
+    size_t value_size = 0;
+    size_t i;
+    for (i = 0; i < pcrs->count; i++) {
+        TSS2_RC rval = Tss2_MU_TPML_DIGEST_Marshal(&pcrs->pcr_values[i], value,
+                sizeof(value), &value_size);
+        if (rval != TSS2_RC_SUCCESS) {
+            /* too many PCRs for an entry */
+            return;
+        }
+    }
+
+    tpm2_host_cache_put(tpm2_host_cache_kind_pcrs, key, key_size, value,
+            value_size, counter, generation);
+}
+
+tool_rc pcr_read_pcr_values(ESYS_CONTEXT *esys_context,
+        TPML_PCR_SELECTION *pcr_select, tpm2_pcrs *pcrs) {
+
+    if (!pcr_select->count) {
+        return pcr_read_pcr_values_counter(esys_context, pcr_select, pcrs,
+                NULL);
+    }
+
+    bool is_hit;
+    tool_rc rc = pcr_host_cache_read(esys_context, pcr_select, pcrs, &is_hit);
+    if (rc != tool_rc_success || is_hit) {
+        return rc;
+    }
+
+    UINT32 generation = tpm2_host_cache_generation();
+    UINT32 counter;
+    rc = pcr_cache_dir ?
+            pcr_cache_read(esys_context, pcr_select, pcrs, &counter) :
+            pcr_read_pcr_values_counter(esys_context, pcr_select, pcrs,
+                    &counter);
+    if (rc == tool_rc_success) {
+        pcr_host_cache_put(esys_context, pcr_select, pcrs, counter,
+                generation);
+    }
+
+    return rc;
+}
+
+tool_rc pcr_cache_init(void) {
+
+    if (pcr_cache_dir) {
+        return tool_rc_success;
+    }
+
+    pcr_cache_dir = files_temp_dir_create("tpm2-pcrs", "PCR cache");
+    if (!pcr_cache_dir) {
+        return tool_rc_general_error;
+    }
+
+    return tool_rc_success;
+}
+
+void pcr_cache_free(void) {
+
+    if (!pcr_cache_dir) {
+        return;
+    }
+
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s/" PCR_CACHE_SNAPSHOT, pcr_cache_dir);
+    unlink(path);
+
+    rmdir(pcr_cache_dir);
+    free(pcr_cache_dir);
+    pcr_cache_dir = NULL;
+}
+
+typedef struct pcr_read_pipeline pcr_read_pipeline;
+struct pcr_read_pipeline {
+    TPML_PCR_SELECTION *chunks;
+    size_t chunk_count;
+    size_t chunk;
+    bool is_pending;
+    bool is_first;
+    tpm2_pcrs *pcrs;
+    TPML_DIGEST *value;
+    UINT32 *pcr_update_counter;
+};
+
+/*
+ * The next read of a chunk depends on what the TPM returned for the last one,
+ * so only the room for the response is made while the TPM is busy.
+ */
+static tool_rc pcr_read_prepare(void *userdata, bool *is_next) {
+
+    pcr_read_pipeline *read = (pcr_read_pipeline *) userdata;
+
+    *is_next = false;
+    if (read->is_pending) {
+        return tool_rc_success;
+    }
+
+    /* a TPM with smaller responses needs more than one read per chunk */
+    while (read->chunk < read->chunk_count
+            && pcr_unset_pcr_sections(&read->chunks[read->chunk])) {
+        read->chunk++;
+    }
+
+    *is_next = read->chunk < read->chunk_count;
+
+    return tool_rc_success;
+}
+
+static tool_rc pcr_read_submit(ESYS_CONTEXT *ectx, void *userdata) {
+
+    pcr_read_pipeline *read = (pcr_read_pipeline *) userdata;
+
+    tool_rc rc = tpm2_pcr_read_async(ectx, &read->chunks[read->chunk]);
+    if (rc != tool_rc_success) {
+        return rc;
+    }
+
+    read->is_pending = true;
+
+    /* make room for the response while the TPM is busy */
+    read->value = pcr_pcrs_append(read->pcrs);
+
+    return tool_rc_success;
+}
+
+static tool_rc pcr_read_finish(ESYS_CONTEXT *ectx, void *userdata) {
+
+    pcr_read_pipeline *read = (pcr_read_pipeline *) userdata;
+
+    UINT32 counter;
+    TPML_PCR_SELECTION *pcr_selection_out = NULL;
+    TPML_DIGEST *v = NULL;
+    tool_rc rc = tpm2_pcr_read_finish(ectx, &counter, &pcr_selection_out, &v);
+    read->is_pending = false;
+    if (rc != tool_rc_success) {
+        return rc;
+    }
+
+    /*
+     * an extension during the reads changes the counter after the first, so
+     * the values are known to be older than the next one
+     */
+    if (read->is_first && read->pcr_update_counter) {
+        *read->pcr_update_counter = counter;
+    }
+    read->is_first = false;
+
+    TPML_DIGEST *value = read->value;
+    if (!value) {
         free(pcr_selection_out);
+        free(v);
+        return tool_rc_general_error;
+    }
 
-        //4. goto step 2 if pcrSelctionIn still has bits set
-    } while (++pcrs->count < ARRAY_LEN(pcrs->pcr_values)
-            && !pcr_unset_pcr_sections(&pcr_selection_tmp));
+    /* only the digests returned, value is zeroed by the append */
+    value->count = v->count;
+    memcpy(value->digests, v->digests, v->count * sizeof(v->digests[0]));
+    pcr_update_pcr_selections(&read->chunks[read->chunk], pcr_selection_out);
 
-    if (pcrs->count >= ARRAY_LEN(pcrs->pcr_values)
-            && !pcr_unset_pcr_sections(&pcr_selection_tmp)) {
-        LOG_ERR("too much pcrs to get! try to split into multiple calls...");
+    free(pcr_selection_out);
+    free(v);
+
+    if (!value->count) {
+        LOG_ERR("TPM did not return all of the selected PCRs");
         return tool_rc_general_error;
     }
 
     return tool_rc_success;
 }
+
+tool_rc pcr_read_pcr_values_counter(ESYS_CONTEXT *esys_context,
+        TPML_PCR_SELECTION *pcr_select, tpm2_pcrs *pcrs,
+        UINT32 *pcr_update_counter) {
+
+    static const tpm2_pipeline_ops ops = {
+        .prepare = pcr_read_prepare,
+        .submit = pcr_read_submit,
+        .finish = pcr_read_finish,
+    };
+
+    pcrs->count = 0;
+
+    pcr_read_pipeline read = {
+        .is_first = true,
+        .pcrs = pcrs,
+        .pcr_update_counter = pcr_update_counter,
+    };
+
+    read.chunks = pcr_split_selection(pcr_select, &read.chunk_count);
+    if (!read.chunks) {
+        return read.chunk_count ? tool_rc_general_error : tool_rc_success;
+    }
+
+    tool_rc rc = tpm2_pipeline_run(esys_context, &ops, &read);
+
+    free(read.chunks);
+
+    return rc;
+}
@@ -6,6 +6,7 @@
 #include <errno.h>
 #include <stdio.h>
 #include <stdbool.h>
+#include <strings.h>
 
 #include <tss2/tss2_esys.h>
 
@@ -17,12 +18,123 @@ struct tpm2_algorithm {
     TPMI_ALG_HASH alg[TPM2_NUM_PCR_BANKS];
 };
 
+/*
+ * The PCRs of a bank as a word, bit n set for PCR n, so the set algebra on
+ * selections is done on words instead of on the bytes of pcrSelect. The TSS
+ * selects at most TPM2_PCR_SELECT_MAX, ie 4, bytes per bank.
+ */
+typedef UINT32 pcr_bitset;
+
+#define PCR_BITSET_BYTES_MAX sizeof(pcr_bitset)
+
+static inline pcr_bitset pcr_bitset_from_bytes(const BYTE *select,
+        UINT8 size) {
+
+    pcr_bitset bits = 0;
+    UINT8 i;
+    for (i = 0; i < size && i < PCR_BITSET_BYTES_MAX; i++) {
+        bits |= (pcr_bitset) select[i] << (i * 8);
+    }
+
+    return bits;
+}
+
+static inline pcr_bitset pcr_bitset_from_select(
+        const TPMS_PCR_SELECTION *sel) {
+
+    return pcr_bitset_from_bytes(sel->pcrSelect, sel->sizeofSelect);
+}
+
+/* writes the PCRs of the bitset the size of the selection covers */
+static inline void pcr_bitset_to_select(pcr_bitset bits,
+        TPMS_PCR_SELECTION *sel) {
+
+    UINT8 i;
+    for (i = 0; i < sel->sizeofSelect && i < PCR_BITSET_BYTES_MAX; i++) {
+        sel->pcrSelect[i] = bits >> (i * 8);
+    }
+}
+
+/* the number of PCRs set */
+static inline unsigned pcr_bitset_count(pcr_bitset bits) {
+
+    unsigned count = 0;
+    for (; bits; bits &= bits - 1) {
+        count++;
+    }
+
+    return count;
+}
+
+/*
+ * Takes the lowest PCR off the bitset, for iterating over the PCRs of a
+ * selection in ascending order. Returns false when none is left.
+ */
+static inline bool pcr_bitset_next(pcr_bitset *bits, unsigned *pcr) {
+
+    if (!*bits) {
+        return false;
+    }
+
+    *pcr = ffs(*bits) - 1;
+    *bits &= *bits - 1;
+
+    return true;
+}
+
 typedef struct tpm2_pcrs tpm2_pcrs;
 struct tpm2_pcrs {
     size_t count;
-    TPML_DIGEST pcr_values[TPM2_MAX_PCRS];
+    TPML_DIGEST *pcr_values;
+    size_t capacity;
 };
 
+/**
+ * Appends an empty digest list to pcrs, growing it as needed.
+ * @param pcrs
+ *  The PCR values to append to.
+ * @return
+ *  The new digest list or NULL if out of memory.
+ */
+TPML_DIGEST *pcr_pcrs_append(tpm2_pcrs *pcrs);
+
+/**
+ * Releases the digest lists of pcrs.
+ * @param pcrs
+ *  The PCR values to release.
+ */
+void pcr_pcrs_free(tpm2_pcrs *pcrs);
+
+/**
+ * Adds the PCRs selected by src to dest, merging the banks both select.
+ * @param dest
+ *  The selection to add to.
+ * @param src
+ *  The selection to add.
+ * @return
+ *  True on success, false if dest has no room for another bank.
+ */
+bool pcr_merge_selections(TPML_PCR_SELECTION *dest,
+        const TPML_PCR_SELECTION *src);
+
+/**
+ * Picks the values of a subset of the selected PCRs, in the order of the
+ * subset, so one read of merged selections serves each of them.
+ * @param pcr_select
+ *  The selection the PCRs were read for.
+ * @param pcrs
+ *  The values read for pcr_select.
+ * @param subset
+ *  The PCRs to pick, all of which pcr_select must select.
+ * @param subset_pcrs
+ *  The values picked. Must be released with pcr_pcrs_free().
+ * @return
+ *  True on success, false otherwise.
+ */
+bool pcr_select_pcr_values(const TPML_PCR_SELECTION *pcr_select,
+        const tpm2_pcrs *pcrs, const TPML_PCR_SELECTION *subset,
+        tpm2_pcrs *subset_pcrs);
+
 /**
  * Echo out all PCR banks according to g_pcrSelection & g_pcrs->.
  * @param pcrSelect
@@ -90,6 +202,80 @@ bool pcr_fwrite_values(const TPML_PCR_SELECTION *pcr_select,
 bool pcr_fwrite_serialized(const TPML_PCR_SELECTION *pcr_select,
     const tpm2_pcrs *pcrs, FILE *output_file);
 
+/*
+ * A PCR bundle holds a PCR selection and the values of only the selected
+ * PCRs. Unlike the serialized format it does not depend on the layout of the
+ * structures in memory. All integers are big endian:
+ *
+ *   magic "PCRB", u16 version, u8 bank count,
+ *   per bank: u16 hash algorithm, u8 select size, the select bytes,
+ *   per selected PCR in selection order: u16 digest size, the digest
+ */
+#define PCR_BUNDLE_VERSION 1
+
+typedef struct pcr_bundle_reader pcr_bundle_reader;
+struct pcr_bundle_reader {
+    FILE *input;
+    TPML_PCR_SELECTION pcr_select;
+    /* the bank and PCR of the next digest */
+    UINT32 bank;
+    unsigned pcr_id;
+};
+
+/**
+ * Writes the selected PCR values to a file as a PCR bundle.
+ *
+ * @param pcr_select the selected pcrs to be written
+ * @param pcrs the pcrs digests, in selection order
+ * @param output_file file to output the PCR bundle to
+ * @return true on success; false otherwise
+ */
+bool pcr_bundle_write(const TPML_PCR_SELECTION *pcr_select,
+    const tpm2_pcrs *pcrs, FILE *output_file);
+
+/**
+ * Tells whether a file holds a PCR bundle, without moving its position.
+ *
+ * @param input the seekable file to check
+ * @return true if the file starts with the magic of a PCR bundle
+ */
+bool pcr_bundle_is_bundle(FILE *input);
+
+/**
+ * Starts reading a PCR bundle, reading its header and selection.
+ *
+ * @param reader the reader to set up
+ * @param input the file to read the bundle from
+ * @return true on success; false on a malformed bundle
+ */
+bool pcr_bundle_reader_init(pcr_bundle_reader *reader, FILE *input);
+
+/**
+ * Reads the next digest of a PCR bundle, one at a time so a verifier needs
+ * no room for all of them.
+ *
+ * @param reader the reader set up with pcr_bundle_reader_init()
+ * @param hash the bank of the PCR
+ * @param pcr_id the index of the PCR
+ * @param digest the value of the PCR
+ * @param is_end set when the bundle ended, a true return then has no digest
+ * @return true on success; false on a malformed bundle
+ */
+bool pcr_bundle_reader_next(pcr_bundle_reader *reader, TPMI_ALG_HASH *hash,
+    unsigned *pcr_id, TPM2B_DIGEST *digest, bool *is_end);
+
+/**
+ * Reads a whole PCR bundle.
+ *
+ * @param input the file to read the bundle from
+ * @param pcr_select the selection of the bundle
+ * @param pcrs the values of the selected PCRs, in selection order. Must be
+ *  released with pcr_pcrs_free().
+ * @return true on success; false on a malformed bundle
+ */
+bool pcr_bundle_read(FILE *input, TPML_PCR_SELECTION *pcr_select,
+    tpm2_pcrs *pcrs);
+
 bool pcr_parse_selections(const char *arg, TPML_PCR_SELECTION *pcr_selections);
 
 tool_rc pcr_get_banks(ESYS_CONTEXT *esys_context,
@@ -101,7 +287,63 @@ bool pcr_init_pcr_selection(TPMS_CAPABILITY_DATA *cap_data,
 bool pcr_check_pcr_selection(TPMS_CAPABILITY_DATA *cap_data,
         TPML_PCR_SELECTION *pcr_selections);
 
+/**
+ * Reads the values of the selected PCRs. The selection is split up front into
+ * chunks of as many PCRs as fit into one response, which are read back to
+ * back.
+ * @param esys_context
+ *  The ESAPI context.
+ * @param pcr_selections
+ *  The PCRs to read.
+ * @param pcrs
+ *  The values read, in selection order. Must be released with
+ *  pcr_pcrs_free().
+ * @return
+ *  tool_rc indicating status.
+ */
 tool_rc pcr_read_pcr_values(ESYS_CONTEXT *esys_context,
         TPML_PCR_SELECTION *pcr_selections, tpm2_pcrs *pcrs);
 
+/**
+ * Enables the PCR cache for the tools run from now on, ie by tpm2_batch and
+ * tpm2_serve. The values read by pcr_read_pcr_values() are then kept with the
+ * update counter of the TPM, and a later read of the same or fewer PCRs is
+ * answered from them as long as the counter did not change, checked with a
+ * read that selects no PCR. PCRs that do not change the counter, like the
+ * debug PCR, are never cached.
+ * @return
+ *  tool_rc indicating status.
+ */
+tool_rc pcr_cache_init(void);
+
+/**
+ * Drops the cached PCR values and disables the cache.
+ */
+void pcr_cache_free(void);
+
+/**
+ * Like pcr_read_pcr_values(), and returns the update counter of the TPM as of
+ * the first read. The values are at least as recent as that counter.
+ */
+tool_rc pcr_read_pcr_values_counter(ESYS_CONTEXT *esys_context,
+        TPML_PCR_SELECTION *pcr_selections, tpm2_pcrs *pcrs,
+        UINT32 *pcr_update_counter);
+
+/**
+ * Reads only the update counter of the TPM, which changes with the values of
+ * the PCRs, with a read that selects no PCR of bank.
+ */
+tool_rc pcr_read_update_counter(ESYS_CONTEXT *esys_context,
+        TPMI_ALG_HASH bank, UINT32 *pcr_update_counter);
+
+/**
+ * Outputs the PCRs of the selection whose value in pcrs differs from the one
+ * in old_pcrs, under the name of their bank. Both are read with the
+ * selection.
+ * @param changed
+ *  The number of PCRs that changed.
+ */
+bool pcr_print_changed_values(const TPML_PCR_SELECTION *pcr_select,
+        const tpm2_pcrs *old_pcrs, const tpm2_pcrs *pcrs, size_t *changed);
+
 #endif /* SRC_PCR_H_ */
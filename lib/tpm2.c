@@ -1,5 +1,6 @@
 /* SPDX-License-Identifier: BSD-3-Clause */
 
+#include <stdlib.h>
 #include <string.h>
 #include <tss2/tss2_mu.h>
 #include <tss2/tss2_sys.h>
@@ -10,6 +11,9 @@
 #include "tpm2.h"
 #include "tpm2_alg_util.h"
 #include "tpm2_auth_util.h"
+#include "tpm2_cphash.h"
+#include "tpm2_host_cache.h"
+#include "tpm2_name_cache.h"
 #include "tpm2_openssl.h"
 #include "tpm2_session.h"
 #include "tpm2_tool.h"
@@ -40,6 +44,15 @@ tool_rc tpm2_from_tpm_public(ESYS_CONTEXT *esys_context, TPM2_HANDLE tpm_handle,
         ESYS_TR optional_session1, ESYS_TR optional_session2,
         ESYS_TR optional_session3, ESYS_TR *object) {
 
+    /* an audit or encrypt session needs the ReadPublic sent to the TPM */
+    bool is_cached = optional_session1 == ESYS_TR_NONE
+            && optional_session2 == ESYS_TR_NONE
+            && optional_session3 == ESYS_TR_NONE;
+    if (is_cached && tpm2_name_cache_get(esys_context, tpm_handle, object,
+            NULL)) {
+        return tool_rc_success;
+    }
+
     TSS2_RC rval = Esys_TR_FromTPMPublic(esys_context, tpm_handle,
             optional_session1, optional_session2, optional_session3, object);
     if (rval != TSS2_RC_SUCCESS) {
@@ -47,6 +60,11 @@ tool_rc tpm2_from_tpm_public(ESYS_CONTEXT *esys_context, TPM2_HANDLE tpm_handle,
         return tool_rc_from_tpm(rval);
     }
 
+    /* an index is cached with its public area by tpm2_util_nv_read_public() */
+    if (is_cached) {
+        tpm2_name_cache_put(esys_context, tpm_handle, *object, NULL);
+    }
+
     return tool_rc_success;
 }
 
@@ -89,6 +107,9 @@ tool_rc tpm2_tr_get_name(ESYS_CONTEXT *esys_context, ESYS_TR handle,
 
 tool_rc tpm2_close(ESYS_CONTEXT *esys_context, ESYS_TR *rsrc_handle) {
 
+    /* the number may be handed out again for another object */
+    tpm2_name_cache_forget(*rsrc_handle);
+
     TSS2_RC rval = Esys_TR_Close(esys_context, rsrc_handle);
     if (rval != TSS2_RC_SUCCESS) {
         LOG_PERR(Esys_TR_Close, rval);
@@ -112,6 +133,32 @@ tool_rc tpm2_nv_readpublic(ESYS_CONTEXT *esys_context, ESYS_TR nv_index,
     return tool_rc_success;
 }
 
+tool_rc tpm2_nv_readpublic_by_handle(ESYS_CONTEXT *esys_context,
+        TPMI_RH_NV_INDEX nv_index, TPM2B_NV_PUBLIC *nv_public,
+        TPM2B_NAME *nv_name) {
+
+    /*
+     * Without an ESYS_TR to resolve first, this takes one round trip to the
+     * TPM instead of two.
+     */
+    TSS2_SYS_CONTEXT *sys_context = NULL;
+    tool_rc rc = tpm2_getsapicontext(esys_context, &sys_context);
+    if (rc != tool_rc_success) {
+        return rc;
+    }
+
+    nv_public->size = 0;
+    nv_name->size = 0;
+    TSS2_RC rval = Tss2_Sys_NV_ReadPublic(sys_context, nv_index, NULL,
+            nv_public, nv_name, NULL);
+    if (rval != TSS2_RC_SUCCESS) {
+        LOG_PERR(Tss2_Sys_NV_ReadPublic, rval);
+        return tool_rc_from_tpm(rval);
+    }
+
+    return tool_rc_success;
+}
+
 tool_rc tpm2_getcap(ESYS_CONTEXT *esys_context, TPM2_CAP capability,
         UINT32 property, UINT32 property_count, TPMI_YES_NO *more_data,
         TPMS_CAPABILITY_DATA **capability_data) {
@@ -202,6 +249,36 @@ tpm2_nvread_skip_esapi_call:
     return rc;
 }
 
+tool_rc tpm2_nv_read_async(ESYS_CONTEXT *esys_context, ESYS_TR auth_handle,
+        ESYS_TR nv_index, ESYS_TR shandle, UINT16 size, UINT16 offset) {
+
+    TSS2_RC rval = Esys_NV_Read_Async(esys_context, auth_handle, nv_index,
+            shandle, ESYS_TR_NONE, ESYS_TR_NONE, size, offset);
+    if (rval != TSS2_RC_SUCCESS) {
+        LOG_PERR(Esys_NV_Read_Async, rval);
+        return tool_rc_from_tpm(rval);
+    }
+
+    return tool_rc_success;
+}
+
+tool_rc tpm2_nv_read_finish(ESYS_CONTEXT *esys_context,
+        TPM2B_MAX_NV_BUFFER **data) {
+
+    TSS2_RC rval;
+    do {
+        /* blocks with the default timeout, TRY_AGAIN means resubmitted */
+        rval = Esys_NV_Read_Finish(esys_context, data);
+    } while (rval == TSS2_ESYS_RC_TRY_AGAIN);
+
+    if (rval != TSS2_RC_SUCCESS) {
+        LOG_PERR(Esys_NV_Read_Finish, rval);
+        return tool_rc_from_tpm(rval);
+    }
+
+    return tool_rc_success;
+}
+
 tool_rc tpm2_context_save(ESYS_CONTEXT *esys_context, ESYS_TR save_handle,
         TPMS_CONTEXT **context) {
 
@@ -237,6 +314,28 @@ tool_rc tpm2_flush_context(ESYS_CONTEXT *esys_context, ESYS_TR flush_handle) {
     return tool_rc_success;
 }
 
+tool_rc tpm2_flush_context_by_handle(ESYS_CONTEXT *esys_context,
+        TPMI_DH_CONTEXT flush_handle) {
+
+    /*
+     * FlushContext takes no authorization, so the handle is flushed without
+     * resolving an ESYS_TR for it first, in one round trip instead of two.
+     */
+    TSS2_SYS_CONTEXT *sys_context = NULL;
+    tool_rc rc = tpm2_getsapicontext(esys_context, &sys_context);
+    if (rc != tool_rc_success) {
+        return rc;
+    }
+
+    TSS2_RC rval = Tss2_Sys_FlushContext(sys_context, flush_handle);
+    if (rval != TSS2_RC_SUCCESS) {
+        LOG_PERR(Tss2_Sys_FlushContext, rval);
+        return tool_rc_from_tpm(rval);
+    }
+
+    return tool_rc_success;
+}
+
 tool_rc tpm2_start_auth_session(ESYS_CONTEXT *esys_context, ESYS_TR tpm_key,
         ESYS_TR bind, const TPM2B_NONCE *nonce_caller, TPM2_SE session_type,
         const TPMT_SYM_DEF *symmetric, TPMI_ALG_HASH auth_hash,
@@ -353,6 +452,38 @@ tool_rc tpm2_pcr_read(ESYS_CONTEXT *esys_context, ESYS_TR shandle1,
     return tool_rc_success;
 }
 
+tool_rc tpm2_pcr_read_async(ESYS_CONTEXT *esys_context,
+        const TPML_PCR_SELECTION *pcr_selection_in) {
+
+    TSS2_RC rval = Esys_PCR_Read_Async(esys_context, ESYS_TR_NONE,
+            ESYS_TR_NONE, ESYS_TR_NONE, pcr_selection_in);
+    if (rval != TSS2_RC_SUCCESS) {
+        LOG_PERR(Esys_PCR_Read_Async, rval);
+        return tool_rc_from_tpm(rval);
+    }
+
+    return tool_rc_success;
+}
+
+tool_rc tpm2_pcr_read_finish(ESYS_CONTEXT *esys_context,
+        UINT32 *pcr_update_counter, TPML_PCR_SELECTION **pcr_selection_out,
+        TPML_DIGEST **pcr_values) {
+
+    TSS2_RC rval;
+    do {
+        /* blocks with the default timeout, TRY_AGAIN means resubmitted */
+        rval = Esys_PCR_Read_Finish(esys_context, pcr_update_counter,
+                pcr_selection_out, pcr_values);
+    } while (rval == TSS2_ESYS_RC_TRY_AGAIN);
+
+    if (rval != TSS2_RC_SUCCESS) {
+        LOG_PERR(Esys_PCR_Read_Finish, rval);
+        return tool_rc_from_tpm(rval);
+    }
+
+    return tool_rc_success;
+}
+
 tool_rc tpm2_policy_authorize(ESYS_CONTEXT *esys_context, ESYS_TR policy_session,
         ESYS_TR shandle1, ESYS_TR shandle2, ESYS_TR shandle3,
         const TPM2B_DIGEST *approved_policy, const TPM2B_NONCE *policy_ref,
@@ -468,13 +599,15 @@ tool_rc tpm2_policy_signed(ESYS_CONTEXT *esys_context,
 }
 
 tool_rc tpm2_policy_ticket(ESYS_CONTEXT *esys_context, ESYS_TR policy_session,
-    const TPM2B_TIMEOUT *timeout, const TPM2B_NONCE *policyref,
-    const TPM2B_NAME *authname, const TPMT_TK_AUTH *ticket) {
+    const TPM2B_TIMEOUT *timeout, const TPM2B_DIGEST *cphash,
+    const TPM2B_NONCE *policyref, const TPM2B_NAME *authname,
+    const TPMT_TK_AUTH *ticket) {
 
     TSS2_RC rval = Esys_PolicyTicket(esys_context, policy_session, ESYS_TR_NONE,
-        ESYS_TR_NONE, ESYS_TR_NONE, timeout, NULL, policyref, authname, ticket);
+        ESYS_TR_NONE, ESYS_TR_NONE, timeout, cphash, policyref, authname,
+        ticket);
     if (rval != TSS2_RC_SUCCESS) {
-        LOG_PERR(Esys_PolicySigned, rval);
+        LOG_PERR(Esys_PolicyTicket, rval);
         return tool_rc_from_tpm(rval);
     }
 
@@ -910,6 +1043,60 @@ tool_rc tpm2_getsessionauditdigest(ESYS_CONTEXT *esys_context,
     return tool_rc_success;
 }
 
+tool_rc tpm2_getsessionauditdigest_async(ESYS_CONTEXT *esys_context,
+        tpm2_loaded_object *privacy_object, tpm2_loaded_object *sign_object,
+        const TPMT_SIG_SCHEME *in_scheme, const TPM2B_DATA *qualifying_data,
+        ESYS_TR audit_session_handle) {
+
+    ESYS_TR privacy_object_session_handle = ESYS_TR_NONE;
+    tool_rc rc = tpm2_auth_util_get_shandle(esys_context,
+            privacy_object->tr_handle, privacy_object->session,
+            &privacy_object_session_handle);
+    if (rc != tool_rc_success) {
+        LOG_ERR("Failed to get auth entity obj session");
+        return rc;
+    }
+
+    ESYS_TR sign_object_session_handle = ESYS_TR_NONE;
+    rc = tpm2_auth_util_get_shandle(esys_context,
+            sign_object->tr_handle, sign_object->session,
+            &sign_object_session_handle);
+    if (rc != tool_rc_success) {
+        LOG_ERR("Failed to get auth entity obj session");
+        return rc;
+    }
+
+    TSS2_RC rval = Esys_GetSessionAuditDigest_Async(esys_context,
+            privacy_object->tr_handle, sign_object->tr_handle,
+            audit_session_handle, privacy_object_session_handle,
+            sign_object_session_handle, ESYS_TR_NONE, qualifying_data,
+            in_scheme);
+    if (rval != TSS2_RC_SUCCESS) {
+        LOG_PERR(Esys_GetSessionAuditDigest_Async, rval);
+        return tool_rc_from_tpm(rval);
+    }
+
+    return tool_rc_success;
+}
+
+tool_rc tpm2_getsessionauditdigest_finish(ESYS_CONTEXT *esys_context,
+        TPM2B_ATTEST **audit_info, TPMT_SIGNATURE **signature) {
+
+    TSS2_RC rval;
+    do {
+        /* blocks with the default timeout, TRY_AGAIN means resubmitted */
+        rval = Esys_GetSessionAuditDigest_Finish(esys_context, audit_info,
+                signature);
+    } while (rval == TSS2_ESYS_RC_TRY_AGAIN);
+
+    if (rval != TSS2_RC_SUCCESS) {
+        LOG_PERR(Esys_GetSessionAuditDigest_Finish, rval);
+        return tool_rc_from_tpm(rval);
+    }
+
+    return tool_rc_success;
+}
+
 tool_rc tpm2_policy_nv_written(ESYS_CONTEXT *esys_context,
         ESYS_TR policy_session, ESYS_TR shandle1, ESYS_TR shandle2,
         ESYS_TR shandle3, TPMI_YES_NO written_set) {
@@ -1041,6 +1228,9 @@ tpm2_evictcontrol_free_name1:
         goto tpm2_evictcontrol_skip_esapi_call;
     }
 
+    tpm2_name_cache_invalidate(persistent_handle);
+    tpm2_host_cache_invalidate();
+
     TSS2_RC rval = Esys_EvictControl(esys_context, auth_hierarchy_obj->tr_handle,
             to_persist_key_obj->tr_handle, shandle1, ESYS_TR_NONE, ESYS_TR_NONE,
             persistent_handle, new_object_handle);
@@ -1151,6 +1341,36 @@ tool_rc tpm2_sequence_update(ESYS_CONTEXT *esys_context, ESYS_TR sequence_handle
     return tool_rc_success;
 }
 
+tool_rc tpm2_sequence_update_async(ESYS_CONTEXT *esys_context,
+        ESYS_TR sequence_handle, ESYS_TR shandle,
+        const TPM2B_MAX_BUFFER *buffer) {
+
+    TSS2_RC rval = Esys_SequenceUpdate_Async(esys_context, sequence_handle,
+            shandle, ESYS_TR_NONE, ESYS_TR_NONE, buffer);
+    if (rval != TSS2_RC_SUCCESS) {
+        LOG_PERR(Esys_SequenceUpdate_Async, rval);
+        return tool_rc_from_tpm(rval);
+    }
+
+    return tool_rc_success;
+}
+
+tool_rc tpm2_sequence_update_finish(ESYS_CONTEXT *esys_context) {
+
+    TSS2_RC rval;
+    do {
+        /* blocks with the default timeout, TRY_AGAIN means resubmitted */
+        rval = Esys_SequenceUpdate_Finish(esys_context);
+    } while (rval == TSS2_ESYS_RC_TRY_AGAIN);
+
+    if (rval != TSS2_RC_SUCCESS) {
+        LOG_PERR(Esys_SequenceUpdate_Finish, rval);
+        return tool_rc_from_tpm(rval);
+    }
+
+    return tool_rc_success;
+}
+
 tool_rc tpm2_sequence_complete(ESYS_CONTEXT *esys_context,
         ESYS_TR sequence_handle, const TPM2B_MAX_BUFFER *buffer,
         TPMI_RH_HIERARCHY hierarchy, TPM2B_DIGEST **result,
@@ -1739,6 +1959,56 @@ tpm2_certify_skip_esapi_call:
     return rc;
 }
 
+tool_rc tpm2_certify_async(ESYS_CONTEXT *ectx,
+        tpm2_loaded_object *certifiedkey_obj,
+        tpm2_loaded_object *signingkey_obj,
+        const TPM2B_DATA *qualifying_data, const TPMT_SIG_SCHEME *scheme,
+        ESYS_TR shandle3) {
+
+    ESYS_TR certifiedkey_session_handle = ESYS_TR_NONE;
+    tool_rc rc = tpm2_auth_util_get_shandle(ectx, certifiedkey_obj->tr_handle,
+        certifiedkey_obj->session, &certifiedkey_session_handle);
+    if (rc != tool_rc_success) {
+        LOG_ERR("Failed to get session handle for TPM object");
+        return rc;
+    }
+
+    ESYS_TR signingkey_session_handle = ESYS_TR_NONE;
+    rc = tpm2_auth_util_get_shandle(ectx, signingkey_obj->tr_handle,
+        signingkey_obj->session, &signingkey_session_handle);
+    if (rc != tool_rc_success) {
+        LOG_ERR("Failed to get session handle for key");
+        return rc;
+    }
+
+    TSS2_RC rval = Esys_Certify_Async(ectx, certifiedkey_obj->tr_handle,
+            signingkey_obj->tr_handle, certifiedkey_session_handle,
+            signingkey_session_handle, shandle3, qualifying_data, scheme);
+    if (rval != TPM2_RC_SUCCESS) {
+        LOG_PERR(Esys_Certify_Async, rval);
+        return tool_rc_from_tpm(rval);
+    }
+
+    return tool_rc_success;
+}
+
+tool_rc tpm2_certify_finish(ESYS_CONTEXT *ectx, TPM2B_ATTEST **certify_info,
+        TPMT_SIGNATURE **signature) {
+
+    TSS2_RC rval;
+    do {
+        /* blocks with the default timeout, TRY_AGAIN means resubmitted */
+        rval = Esys_Certify_Finish(ectx, certify_info, signature);
+    } while (rval == TSS2_ESYS_RC_TRY_AGAIN);
+
+    if (rval != TPM2_RC_SUCCESS) {
+        LOG_PERR(Esys_Certify_Finish, rval);
+        return tool_rc_from_tpm(rval);
+    }
+
+    return tool_rc_success;
+}
+
 tool_rc tpm2_rsa_decrypt(ESYS_CONTEXT *ectx, tpm2_loaded_object *keyobj,
         const TPM2B_PUBLIC_KEY_RSA *cipher_text, const TPMT_RSA_DECRYPT *scheme,
         const TPM2B_DATA *label, TPM2B_PUBLIC_KEY_RSA **message,
@@ -1815,6 +2085,76 @@ tool_rc tpm2_rsa_encrypt(ESYS_CONTEXT *ectx, tpm2_loaded_object *keyobj,
     return tool_rc_success;
 }
 
+tool_rc tpm2_rsa_decrypt_async(ESYS_CONTEXT *ectx, tpm2_loaded_object *keyobj,
+        const TPM2B_PUBLIC_KEY_RSA *cipher_text, const TPMT_RSA_DECRYPT *scheme,
+        const TPM2B_DATA *label) {
+
+    ESYS_TR keyobj_session_handle = ESYS_TR_NONE;
+    tool_rc rc = tpm2_auth_util_get_shandle(ectx, keyobj->tr_handle,
+            keyobj->session, &keyobj_session_handle);
+    if (rc != tool_rc_success) {
+        return rc;
+    }
+
+    TSS2_RC rval = Esys_RSA_Decrypt_Async(ectx, keyobj->tr_handle,
+            keyobj_session_handle, ESYS_TR_NONE, ESYS_TR_NONE, cipher_text,
+            scheme, label);
+    if (rval != TPM2_RC_SUCCESS) {
+        LOG_PERR(Esys_RSA_Decrypt_Async, rval);
+        return tool_rc_from_tpm(rval);
+    }
+
+    return tool_rc_success;
+}
+
+tool_rc tpm2_rsa_decrypt_finish(ESYS_CONTEXT *ectx,
+        TPM2B_PUBLIC_KEY_RSA **message) {
+
+    TSS2_RC rval;
+    do {
+        /* blocks with the default timeout, TRY_AGAIN means resubmitted */
+        rval = Esys_RSA_Decrypt_Finish(ectx, message);
+    } while (rval == TSS2_ESYS_RC_TRY_AGAIN);
+
+    if (rval != TPM2_RC_SUCCESS) {
+        LOG_PERR(Esys_RSA_Decrypt_Finish, rval);
+        return tool_rc_from_tpm(rval);
+    }
+
+    return tool_rc_success;
+}
+
+tool_rc tpm2_rsa_encrypt_async(ESYS_CONTEXT *ectx, tpm2_loaded_object *keyobj,
+        const TPM2B_PUBLIC_KEY_RSA *message, const TPMT_RSA_DECRYPT *scheme,
+        const TPM2B_DATA *label) {
+
+    TSS2_RC rval = Esys_RSA_Encrypt_Async(ectx, keyobj->tr_handle,
+            ESYS_TR_NONE, ESYS_TR_NONE, ESYS_TR_NONE, message, scheme, label);
+    if (rval != TPM2_RC_SUCCESS) {
+        LOG_PERR(Esys_RSA_Encrypt_Async, rval);
+        return tool_rc_from_tpm(rval);
+    }
+
+    return tool_rc_success;
+}
+
+tool_rc tpm2_rsa_encrypt_finish(ESYS_CONTEXT *ectx,
+        TPM2B_PUBLIC_KEY_RSA **cipher_text) {
+
+    TSS2_RC rval;
+    do {
+        /* blocks with the default timeout, TRY_AGAIN means resubmitted */
+        rval = Esys_RSA_Encrypt_Finish(ectx, cipher_text);
+    } while (rval == TSS2_ESYS_RC_TRY_AGAIN);
+
+    if (rval != TPM2_RC_SUCCESS) {
+        LOG_PERR(Esys_RSA_Encrypt_Finish, rval);
+        return tool_rc_from_tpm(rval);
+    }
+
+    return tool_rc_success;
+}
+
 tool_rc tpm2_load(ESYS_CONTEXT *esys_context, tpm2_loaded_object *parentobj,
         const TPM2B_PRIVATE *in_private, const TPM2B_PUBLIC *in_public,
         ESYS_TR *object_handle, TPM2B_DIGEST *cp_hash) {
@@ -1880,52 +2220,34 @@ tpm2_load_skip_esapi_call:
 tool_rc tpm2_clear(ESYS_CONTEXT *esys_context,
 tpm2_loaded_object *auth_hierarchy, TPM2B_DIGEST *cp_hash) {
 
-    ESYS_TR shandle1 = ESYS_TR_NONE;
-    tool_rc rc = tpm2_auth_util_get_shandle(esys_context,
-            auth_hierarchy->tr_handle, auth_hierarchy->session, &shandle1);
-    if (rc != tool_rc_success) {
-        LOG_ERR("Failed to get shandle for hierarchy");
-        return rc;
-    }
-
     if (cp_hash) {
         /*
-         * Need sys_context to be able to calculate CpHash
+         * The name of a hierarchy is its handle, so the cpHash needs neither
+         * a SAPI context nor a TPM.
          */
-        TSS2_SYS_CONTEXT *sys_context = NULL;
-        rc = tpm2_getsapicontext(esys_context, &sys_context);
-        if(rc != tool_rc_success) {
-            LOG_ERR("Failed to acquire SAPI context.");
-            return rc;
-        }
-
-        TSS2_RC rval = Tss2_Sys_Clear_Prepare(sys_context,
-            auth_hierarchy->handle);
-        if (rval != TPM2_RC_SUCCESS) {
-            LOG_PERR(Tss2_Sys_Clear_Prepare, rval);
-            return tool_rc_general_error;
-        }
-
-        TPM2B_NAME *name1 = NULL;
-        rc = tpm2_tr_get_name(esys_context, auth_hierarchy->tr_handle,
-            &name1);
-        if (rc != tool_rc_success) {
-            goto tpm2_clear_free_name1;
-        }
-
-        cp_hash->size = tpm2_alg_util_get_hash_size(
-            tpm2_session_get_authhash(auth_hierarchy->session));
-        rc = tpm2_sapi_getcphash(sys_context, name1, NULL, NULL,
-            tpm2_session_get_authhash(auth_hierarchy->session), cp_hash);
+        tpm2_cphash c;
+        tpm2_cphash_init(&c, TPM2_CC_Clear);
+        tpm2_cphash_add_handle(&c, auth_hierarchy->handle);
 
         /*
          * Exit here without making the ESYS call since we just need the cpHash
          */
-tpm2_clear_free_name1:
-        Esys_Free(name1);
-        goto tpm2_clear_skip_esapi_call;
+        return tpm2_cphash_compute(&c,
+            tpm2_session_get_authhash(auth_hierarchy->session), cp_hash);
+    }
+
+    ESYS_TR shandle1 = ESYS_TR_NONE;
+    tool_rc rc = tpm2_auth_util_get_shandle(esys_context,
+            auth_hierarchy->tr_handle, auth_hierarchy->session, &shandle1);
+    if (rc != tool_rc_success) {
+        LOG_ERR("Failed to get shandle for hierarchy");
+        return rc;
     }
 
+    /* the owner objects and indices are gone, the cache keeps no hierarchy */
+    tpm2_name_cache_invalidate_type(TPM2_HT_PERSISTENT);
+    tpm2_name_cache_invalidate_type(TPM2_HT_NV_INDEX);
+    tpm2_host_cache_invalidate();
 
     TSS2_RC rval = Esys_Clear(esys_context, auth_hierarchy->tr_handle, shandle1,
             ESYS_TR_NONE, ESYS_TR_NONE);
@@ -1934,7 +2256,6 @@ tpm2_clear_free_name1:
         return tool_rc_from_tpm(rval);
     }
 
-tpm2_clear_skip_esapi_call:
     return rc;
 }
 
@@ -1942,49 +2263,28 @@ tool_rc tpm2_clearcontrol(ESYS_CONTEXT *esys_context,
         tpm2_loaded_object *auth_hierarchy, TPMI_YES_NO disable_clear,
         TPM2B_DIGEST *cp_hash) {
 
-    ESYS_TR shandle = ESYS_TR_NONE;
-    tool_rc rc = tpm2_auth_util_get_shandle(esys_context,
-            auth_hierarchy->tr_handle, auth_hierarchy->session, &shandle);
-    if (rc != tool_rc_success) {
-        return rc;
-    }
-
     if (cp_hash) {
         /*
-         * Need sys_context to be able to calculate CpHash
+         * The name of a hierarchy is its handle, so the cpHash needs neither
+         * a SAPI context nor a TPM.
          */
-        TSS2_SYS_CONTEXT *sys_context = NULL;
-        rc = tpm2_getsapicontext(esys_context, &sys_context);
-        if(rc != tool_rc_success) {
-            LOG_ERR("Failed to acquire SAPI context.");
-            return rc;
-        }
-
-        TSS2_RC rval = Tss2_Sys_ClearControl_Prepare(sys_context,
-            auth_hierarchy->handle, disable_clear);
-        if (rval != TPM2_RC_SUCCESS) {
-            LOG_PERR(Tss2_Sys_ClearControl_Prepare, rval);
-            return tool_rc_general_error;
-        }
-
-        TPM2B_NAME *name1 = NULL;
-        rc = tpm2_tr_get_name(esys_context, auth_hierarchy->tr_handle,
-            &name1);
-        if (rc != tool_rc_success) {
-            goto tpm2_clearcontrol_free_name1;
-        }
-
-        cp_hash->size = tpm2_alg_util_get_hash_size(
-            tpm2_session_get_authhash(auth_hierarchy->session));
-        rc = tpm2_sapi_getcphash(sys_context, name1, NULL, NULL,
-            tpm2_session_get_authhash(auth_hierarchy->session), cp_hash);
+        tpm2_cphash c;
+        tpm2_cphash_init(&c, TPM2_CC_ClearControl);
+        tpm2_cphash_add_handle(&c, auth_hierarchy->handle);
+        tpm2_cphash_add(&c, UINT8, disable_clear);
 
         /*
          * Exit here without making the ESYS call since we just need the cpHash
          */
-tpm2_clearcontrol_free_name1:
-        Esys_Free(name1);
-        goto tpm2_clearcontrol_skip_esapi_call;
+        return tpm2_cphash_compute(&c,
+            tpm2_session_get_authhash(auth_hierarchy->session), cp_hash);
+    }
+
+    ESYS_TR shandle = ESYS_TR_NONE;
+    tool_rc rc = tpm2_auth_util_get_shandle(esys_context,
+            auth_hierarchy->tr_handle, auth_hierarchy->session, &shandle);
+    if (rc != tool_rc_success) {
+        return rc;
     }
 
     TSS2_RC rval = Esys_ClearControl(esys_context, auth_hierarchy->tr_handle,
@@ -1993,7 +2293,7 @@ tpm2_clearcontrol_free_name1:
         LOG_PERR(Esys_ClearControl, rval);
         return tool_rc_from_tpm(rval);
     }
-tpm2_clearcontrol_skip_esapi_call:
+
     return rc;
 }
 
@@ -2195,6 +2495,48 @@ tpm2_duplicate_skip_esapi_call:
     return rc;
 }
 
+tool_rc tpm2_duplicate_async(ESYS_CONTEXT *esys_context,
+        tpm2_loaded_object *duplicable_key, tpm2_loaded_object *new_parent,
+        const TPM2B_DATA *in_key, const TPMT_SYM_DEF_OBJECT *sym_alg) {
+
+    ESYS_TR shandle1 = ESYS_TR_NONE;
+    tool_rc rc = tpm2_auth_util_get_shandle(esys_context,
+            duplicable_key->tr_handle, duplicable_key->session, &shandle1);
+    if (rc != tool_rc_success) {
+        LOG_ERR("Failed to get shandle");
+        return rc;
+    }
+
+    TSS2_RC rval = Esys_Duplicate_Async(esys_context,
+            duplicable_key->tr_handle, new_parent->tr_handle, shandle1,
+            ESYS_TR_NONE, ESYS_TR_NONE, in_key, sym_alg);
+    if (rval != TPM2_RC_SUCCESS) {
+        LOG_PERR(Esys_Duplicate_Async, rval);
+        return tool_rc_from_tpm(rval);
+    }
+
+    return tool_rc_success;
+}
+
+tool_rc tpm2_duplicate_finish(ESYS_CONTEXT *esys_context,
+        TPM2B_DATA **out_key, TPM2B_PRIVATE **duplicate,
+        TPM2B_ENCRYPTED_SECRET **encrypted_seed) {
+
+    TSS2_RC rval;
+    do {
+        /* blocks with the default timeout, TRY_AGAIN means resubmitted */
+        rval = Esys_Duplicate_Finish(esys_context, out_key, duplicate,
+                encrypted_seed);
+    } while (rval == TSS2_ESYS_RC_TRY_AGAIN);
+
+    if (rval != TPM2_RC_SUCCESS) {
+        LOG_PERR(Esys_Duplicate_Finish, rval);
+        return tool_rc_from_tpm(rval);
+    }
+
+    return tool_rc_success;
+}
+
 tool_rc tpm2_encryptdecrypt(ESYS_CONTEXT *esys_context,
         tpm2_loaded_object *encryption_key_obj, TPMI_YES_NO decrypt,
         TPMI_ALG_SYM_MODE mode, const TPM2B_IV *iv_in,
@@ -2283,6 +2625,70 @@ tpm2_encryptdecrypt_skip_esapi_call:
     return rc;
 }
 
+tool_rc tpm2_encryptdecrypt_async(ESYS_CONTEXT *esys_context,
+        tpm2_loaded_object *encryption_key_obj, unsigned version,
+        TPMI_YES_NO decrypt, TPMI_ALG_SYM_MODE mode, const TPM2B_IV *iv_in,
+        const TPM2B_MAX_BUFFER *input_data) {
+
+    ESYS_TR shandle1 = ESYS_TR_NONE;
+    tool_rc rc = tpm2_auth_util_get_shandle(esys_context,
+            encryption_key_obj->tr_handle, encryption_key_obj->session,
+            &shandle1);
+    if (rc != tool_rc_success) {
+        LOG_ERR("Failed to get shandle");
+        return rc;
+    }
+
+    TSS2_RC rval;
+    if (version == 2) {
+        rval = Esys_EncryptDecrypt2_Async(esys_context,
+                encryption_key_obj->tr_handle, shandle1, ESYS_TR_NONE,
+                ESYS_TR_NONE, input_data, decrypt, mode, iv_in);
+        if (rval != TSS2_RC_SUCCESS) {
+            LOG_PERR(Esys_EncryptDecrypt2_Async, rval);
+            return tool_rc_from_tpm(rval);
+        }
+    } else {
+        rval = Esys_EncryptDecrypt_Async(esys_context,
+                encryption_key_obj->tr_handle, shandle1, ESYS_TR_NONE,
+                ESYS_TR_NONE, decrypt, mode, iv_in, input_data);
+        if (rval != TSS2_RC_SUCCESS) {
+            LOG_PERR(Esys_EncryptDecrypt_Async, rval);
+            return tool_rc_from_tpm(rval);
+        }
+    }
+
+    return tool_rc_success;
+}
+
+tool_rc tpm2_encryptdecrypt_finish(ESYS_CONTEXT *esys_context,
+        unsigned version, TPM2B_MAX_BUFFER **output_data, TPM2B_IV **iv_out) {
+
+    TSS2_RC rval;
+    do {
+        /* blocks with the default timeout, TRY_AGAIN means resubmitted */
+        rval = version == 2 ?
+                Esys_EncryptDecrypt2_Finish(esys_context, output_data, iv_out) :
+                Esys_EncryptDecrypt_Finish(esys_context, output_data, iv_out);
+    } while (rval == TSS2_ESYS_RC_TRY_AGAIN);
+
+    /* the caller retries with TPM2_EncryptDecrypt */
+    if (version == 2 && tpm2_error_get(rval) == TPM2_RC_COMMAND_CODE) {
+        return tool_rc_unsupported;
+    }
+
+    if (rval != TSS2_RC_SUCCESS) {
+        if (version == 2) {
+            LOG_PERR(Esys_EncryptDecrypt2_Finish, rval);
+        } else {
+            LOG_PERR(Esys_EncryptDecrypt_Finish, rval);
+        }
+        return tool_rc_from_tpm(rval);
+    }
+
+    return tool_rc_success;
+}
+
 tool_rc tpm2_hierarchycontrol(ESYS_CONTEXT *esys_context,
         tpm2_loaded_object *auth_hierarchy, TPMI_RH_ENABLES enable,
         TPMI_YES_NO state, TPM2B_DIGEST *cp_hash) {
@@ -2339,6 +2745,9 @@ tpm2_hierarchycontrol_free_name1:
         return tool_rc_from_tpm(rval);
     }
 
+    /* a disabled hierarchy hides its objects and indices */
+    tpm2_host_cache_invalidate();
+
     rval = Esys_HierarchyControl(esys_context, auth_hierarchy->tr_handle,
             shandle, ESYS_TR_NONE, ESYS_TR_NONE, enable, state);
     if (rval != TPM2_RC_SUCCESS && rval != TPM2_RC_INITIALIZE) {
@@ -2612,6 +3021,9 @@ tpm2_nvdefinespace_free_name1:
     }
 
     ESYS_TR nvHandle;
+    tpm2_name_cache_invalidate(public_info->nvPublic.nvIndex);
+    tpm2_host_cache_invalidate();
+
     TSS2_RC rval = Esys_NV_DefineSpace(esys_context,
     auth_hierarchy_obj->tr_handle, shandle1, shandle2, shandle3, auth,
     public_info, &nvHandle);
@@ -2631,6 +3043,42 @@ tpm2_nvdefinespace_skip_esapi_call:
     return rc;
 }
 
+tool_rc tpm2_nv_definespace_async(ESYS_CONTEXT *esys_context,
+        ESYS_TR auth_handle, ESYS_TR shandle1, ESYS_TR shandle2,
+        ESYS_TR shandle3, const TPM2B_AUTH *auth,
+        const TPM2B_NV_PUBLIC *public_info) {
+
+    tpm2_name_cache_invalidate(public_info->nvPublic.nvIndex);
+    tpm2_host_cache_invalidate();
+
+    TSS2_RC rval = Esys_NV_DefineSpace_Async(esys_context, auth_handle,
+            shandle1, shandle2, shandle3, auth, public_info);
+    if (rval != TSS2_RC_SUCCESS) {
+        LOG_PERR(Esys_NV_DefineSpace_Async, rval);
+        return tool_rc_from_tpm(rval);
+    }
+
+    return tool_rc_success;
+}
+
+tool_rc tpm2_nv_definespace_finish(ESYS_CONTEXT *esys_context) {
+
+    ESYS_TR nv_handle = ESYS_TR_NONE;
+    TSS2_RC rval;
+    do {
+        /* blocks with the default timeout, TRY_AGAIN means resubmitted */
+        rval = Esys_NV_DefineSpace_Finish(esys_context, &nv_handle);
+    } while (rval == TSS2_ESYS_RC_TRY_AGAIN);
+
+    if (rval != TSS2_RC_SUCCESS) {
+        LOG_PERR(Esys_NV_DefineSpace_Finish, rval);
+        return tool_rc_from_tpm(rval);
+    }
+
+    /* the caller addresses the index by its handle */
+    return tpm2_close(esys_context, &nv_handle);
+}
+
 tool_rc tpm2_nv_increment(ESYS_CONTEXT *esys_context,
         tpm2_loaded_object *auth_hierarchy_obj, TPM2_HANDLE nv_index,
         TPM2B_DIGEST *cp_hash) {
@@ -2699,15 +3147,34 @@ tpm2_nvincrement_free_name1:
         goto tpm2_nvincrement_skip_esapi_call;
     }
 
-    rval = Esys_NV_Increment(esys_context, auth_hierarchy_obj->tr_handle,
-            esys_tr_nv_index, auth_hierarchy_obj_session_handle, ESYS_TR_NONE,
-            ESYS_TR_NONE);
+    rc = tpm2_nv_increment_tr(esys_context, auth_hierarchy_obj,
+            esys_tr_nv_index);
+
+tpm2_nvincrement_skip_esapi_call:
+    return rc;
+}
+
+tool_rc tpm2_nv_increment_tr(ESYS_CONTEXT *esys_context,
+        tpm2_loaded_object *auth_hierarchy_obj, ESYS_TR nv_index) {
+
+    ESYS_TR auth_hierarchy_obj_session_handle = ESYS_TR_NONE;
+    tool_rc rc = tpm2_auth_util_get_shandle(esys_context,
+            auth_hierarchy_obj->tr_handle, auth_hierarchy_obj->session,
+            &auth_hierarchy_obj_session_handle);
+    if (rc != tool_rc_success) {
+        LOG_ERR("Failed to get shandle");
+        return rc;
+    }
+
+    TSS2_RC rval = Esys_NV_Increment(esys_context,
+            auth_hierarchy_obj->tr_handle, nv_index,
+            auth_hierarchy_obj_session_handle, ESYS_TR_NONE, ESYS_TR_NONE);
     if (rval != TPM2_RC_SUCCESS) {
+        LOG_PERR(Esys_NV_Increment, rval);
         return tool_rc_from_tpm(rval);
     }
 
-tpm2_nvincrement_skip_esapi_call:
-    return rc;
+    return tool_rc_success;
 }
 
 tool_rc tpm2_nvreadlock(ESYS_CONTEXT *esys_context,
@@ -2777,6 +3244,8 @@ tpm2_readlock_free_name1:
         goto tpm2_nvreadlock_skip_esapi_call;
     }
 
+    tpm2_name_cache_invalidate(nv_index);
+
     rval = Esys_NV_ReadLock(esys_context, auth_hierarchy_obj->tr_handle,
             esys_tr_nv_handle, auth_hierarchy_obj_session_handle, ESYS_TR_NONE,
             ESYS_TR_NONE);
@@ -2857,6 +3326,8 @@ tpm2_nvwritelock_free_name1:
     }
 
 
+    tpm2_name_cache_invalidate(nv_index);
+
     rval = Esys_NV_WriteLock(esys_context, auth_hierarchy_obj->tr_handle,
             esys_tr_nv_handle, auth_hierarchy_obj_session_handle, ESYS_TR_NONE,
             ESYS_TR_NONE);
@@ -2919,6 +3390,8 @@ tpm2_globalnvwritelock_free_name1:
         goto tpm2_globalnvwritelock_skip_esapi_call;
     }
 
+    tpm2_name_cache_invalidate_type(TPM2_HT_NV_INDEX);
+
     TSS2_RC rval = Esys_NV_GlobalWriteLock(esys_context, auth_hierarchy_obj->tr_handle,
             auth_hierarchy_obj_session_handle, ESYS_TR_NONE, ESYS_TR_NONE);
     if (rval != TPM2_RC_SUCCESS) {
@@ -3183,6 +3656,9 @@ tpm2_nvundefine_free_name1:
         goto tpm2_nvundefine_skip_esapi_call;
     }
 
+    tpm2_name_cache_invalidate(nv_index);
+    tpm2_host_cache_invalidate();
+
     rval = Esys_NV_UndefineSpace(esys_context, auth_hierarchy_obj->tr_handle,
             esys_tr_nv_handle, auth_hierarchy_obj_session_handle, ESYS_TR_NONE,
             ESYS_TR_NONE);
@@ -3198,6 +3674,38 @@ tpm2_nvundefine_skip_esapi_call:
     return rc;
 }
 
+tool_rc tpm2_nvundefine_async(ESYS_CONTEXT *esys_context, ESYS_TR auth_handle,
+        TPM2_HANDLE nv_index, ESYS_TR esys_tr_nv_index, ESYS_TR shandle) {
+
+    tpm2_name_cache_invalidate(nv_index);
+    tpm2_host_cache_invalidate();
+
+    TSS2_RC rval = Esys_NV_UndefineSpace_Async(esys_context, auth_handle,
+            esys_tr_nv_index, shandle, ESYS_TR_NONE, ESYS_TR_NONE);
+    if (rval != TSS2_RC_SUCCESS) {
+        LOG_PERR(Esys_NV_UndefineSpace_Async, rval);
+        return tool_rc_from_tpm(rval);
+    }
+
+    return tool_rc_success;
+}
+
+tool_rc tpm2_nvundefine_finish(ESYS_CONTEXT *esys_context) {
+
+    TSS2_RC rval;
+    do {
+        /* blocks with the default timeout, TRY_AGAIN means resubmitted */
+        rval = Esys_NV_UndefineSpace_Finish(esys_context);
+    } while (rval == TSS2_ESYS_RC_TRY_AGAIN);
+
+    if (rval != TSS2_RC_SUCCESS) {
+        LOG_PERR(Esys_NV_UndefineSpace_Finish, rval);
+        return tool_rc_from_tpm(rval);
+    }
+
+    return tool_rc_success;
+}
+
 tool_rc tpm2_nvundefinespecial(ESYS_CONTEXT *esys_context,
         tpm2_loaded_object *auth_hierarchy_obj, TPM2_HANDLE nv_index,
         tpm2_session *policy_session, TPM2B_DIGEST *cp_hash) {
@@ -3267,6 +3775,9 @@ tpm2_nvundefinespecial_free_name1:
         goto tpm2_nvundefinespecial_skip_esapi_call;
     }
 
+    tpm2_name_cache_invalidate(nv_index);
+    tpm2_host_cache_invalidate();
+
     rval = Esys_NV_UndefineSpaceSpecial(esys_context,
             esys_tr_nv_handle,
             auth_hierarchy_obj->tr_handle,
@@ -3367,6 +3878,76 @@ tpm2_nvwrite_skip_esapi_call:
     return rc;
 }
 
+tool_rc tpm2_nvextend_async(ESYS_CONTEXT *esys_context,
+        tpm2_loaded_object *auth_hierarchy_obj, ESYS_TR nv_index,
+        const TPM2B_MAX_NV_BUFFER *data, ESYS_TR shandle2, ESYS_TR shandle3) {
+
+    ESYS_TR auth_hierarchy_obj_session_handle = ESYS_TR_NONE;
+    tool_rc rc = tpm2_auth_util_get_shandle(esys_context,
+            auth_hierarchy_obj->tr_handle, auth_hierarchy_obj->session,
+            &auth_hierarchy_obj_session_handle);
+    if (rc != tool_rc_success) {
+        LOG_ERR("Failed to get shandle");
+        return rc;
+    }
+
+    TSS2_RC rval = Esys_NV_Extend_Async(esys_context,
+            auth_hierarchy_obj->tr_handle, nv_index,
+            auth_hierarchy_obj_session_handle, shandle2, shandle3, data);
+    if (rval != TSS2_RC_SUCCESS) {
+        LOG_PERR(Esys_NV_Extend_Async, rval);
+        return tool_rc_from_tpm(rval);
+    }
+
+    return tool_rc_success;
+}
+
+tool_rc tpm2_nvextend_finish(ESYS_CONTEXT *esys_context) {
+
+    TSS2_RC rval;
+    do {
+        /* blocks with the default timeout, TRY_AGAIN means resubmitted */
+        rval = Esys_NV_Extend_Finish(esys_context);
+    } while (rval == TSS2_ESYS_RC_TRY_AGAIN);
+
+    if (rval != TSS2_RC_SUCCESS) {
+        LOG_PERR(Esys_NV_Extend_Finish, rval);
+        return tool_rc_from_tpm(rval);
+    }
+
+    return tool_rc_success;
+}
+
+tool_rc tpm2_nvwrite_async(ESYS_CONTEXT *esys_context, ESYS_TR auth_handle,
+        ESYS_TR nv_index, ESYS_TR shandle, const TPM2B_MAX_NV_BUFFER *data,
+        UINT16 offset) {
+
+    TSS2_RC rval = Esys_NV_Write_Async(esys_context, auth_handle, nv_index,
+            shandle, ESYS_TR_NONE, ESYS_TR_NONE, data, offset);
+    if (rval != TSS2_RC_SUCCESS) {
+        LOG_PERR(Esys_NV_Write_Async, rval);
+        return tool_rc_from_tpm(rval);
+    }
+
+    return tool_rc_success;
+}
+
+tool_rc tpm2_nvwrite_finish(ESYS_CONTEXT *esys_context) {
+
+    TSS2_RC rval;
+    do {
+        /* blocks with the default timeout, TRY_AGAIN means resubmitted */
+        rval = Esys_NV_Write_Finish(esys_context);
+    } while (rval == TSS2_ESYS_RC_TRY_AGAIN);
+
+    if (rval != TSS2_RC_SUCCESS) {
+        LOG_PERR(Esys_NV_Write_Finish, rval);
+        return tool_rc_from_tpm(rval);
+    }
+
+    return tool_rc_success;
+}
+
 tool_rc tpm2_pcr_allocate(ESYS_CONTEXT *esys_context,
         tpm2_loaded_object *auth_hierarchy_obj,
         const TPML_PCR_SELECTION *pcr_allocation) {
@@ -3385,6 +3966,8 @@ tool_rc tpm2_pcr_allocate(ESYS_CONTEXT *esys_context,
         return rc;
     }
 
+    tpm2_host_cache_invalidate();
+
     rval = Esys_PCR_Allocate(esys_context, ESYS_TR_RH_PLATFORM,
             auth_hierarchy_obj_session_handle, ESYS_TR_NONE, ESYS_TR_NONE,
             pcr_allocation, &allocation_success, &max_pcr, &size_needed,
@@ -3468,6 +4051,46 @@ tpm2_sign_skip_esapi_call:
     return rc;
 }
 
+tool_rc tpm2_sign_async(ESYS_CONTEXT *esys_context,
+        tpm2_loaded_object *signingkey_obj, const TPM2B_DIGEST *digest,
+        const TPMT_SIG_SCHEME *in_scheme, const TPMT_TK_HASHCHECK *validation) {
+
+    ESYS_TR signingkey_obj_session_handle = ESYS_TR_NONE;
+    tool_rc rc = tpm2_auth_util_get_shandle(esys_context,
+            signingkey_obj->tr_handle, signingkey_obj->session,
+            &signingkey_obj_session_handle);
+    if (rc != tool_rc_success) {
+        return rc;
+    }
+
+    TSS2_RC rval = Esys_Sign_Async(esys_context, signingkey_obj->tr_handle,
+            signingkey_obj_session_handle, ESYS_TR_NONE, ESYS_TR_NONE, digest,
+            in_scheme, validation);
+    if (rval != TPM2_RC_SUCCESS) {
+        LOG_PERR(Esys_Sign_Async, rval);
+        return tool_rc_from_tpm(rval);
+    }
+
+    return tool_rc_success;
+}
+
+tool_rc tpm2_sign_finish(ESYS_CONTEXT *esys_context,
+        TPMT_SIGNATURE **signature) {
+
+    TSS2_RC rval;
+    do {
+        /* blocks with the default timeout, TRY_AGAIN means resubmitted */
+        rval = Esys_Sign_Finish(esys_context, signature);
+    } while (rval == TSS2_ESYS_RC_TRY_AGAIN);
+
+    if (rval != TPM2_RC_SUCCESS) {
+        LOG_PERR(Esys_Sign_Finish, rval);
+        return tool_rc_from_tpm(rval);
+    }
+
+    return tool_rc_success;
+}
+
 tool_rc tpm2_nvcertify(ESYS_CONTEXT *esys_context,
     tpm2_loaded_object *signingkey_obj, tpm2_loaded_object *nvindex_authobj,
     TPM2_HANDLE nv_index, UINT16 offset, UINT16 size,
@@ -3567,6 +4190,57 @@ tpm2_nvcertify_skip_esapi_call:
     return rc;
 }
 
+tool_rc tpm2_nvcertify_async(ESYS_CONTEXT *esys_context,
+        tpm2_loaded_object *signingkey_obj,
+        tpm2_loaded_object *nvindex_authobj, ESYS_TR nv_index, UINT16 offset,
+        UINT16 size, const TPMT_SIG_SCHEME *in_scheme,
+        const TPM2B_DATA *policy_qualifier) {
+
+    ESYS_TR signingkey_obj_session_handle = ESYS_TR_NONE;
+    tool_rc rc = tpm2_auth_util_get_shandle(esys_context,
+            signingkey_obj->tr_handle, signingkey_obj->session,
+            &signingkey_obj_session_handle);
+    if (rc != tool_rc_success) {
+        return rc;
+    }
+
+    ESYS_TR nvindex_authobj_session_handle = ESYS_TR_NONE;
+    rc = tpm2_auth_util_get_shandle(esys_context,
+        nvindex_authobj->tr_handle, nvindex_authobj->session,
+        &nvindex_authobj_session_handle);
+    if (rc != tool_rc_success) {
+        return rc;
+    }
+
+    TSS2_RC rval = Esys_NV_Certify_Async(esys_context,
+            signingkey_obj->tr_handle, nvindex_authobj->tr_handle, nv_index,
+            signingkey_obj_session_handle, nvindex_authobj_session_handle,
+            ESYS_TR_NONE, policy_qualifier, in_scheme, size, offset);
+    if (rval != TPM2_RC_SUCCESS) {
+        LOG_PERR(Esys_NV_Certify_Async, rval);
+        return tool_rc_from_tpm(rval);
+    }
+
+    return tool_rc_success;
+}
+
+tool_rc tpm2_nvcertify_finish(ESYS_CONTEXT *esys_context,
+        TPM2B_ATTEST **certify_info, TPMT_SIGNATURE **signature) {
+
+    TSS2_RC rval;
+    do {
+        /* blocks with the default timeout, TRY_AGAIN means resubmitted */
+        rval = Esys_NV_Certify_Finish(esys_context, certify_info, signature);
+    } while (rval == TSS2_ESYS_RC_TRY_AGAIN);
+
+    if (rval != TPM2_RC_SUCCESS) {
+        LOG_PERR(Esys_NV_Certify_Finish, rval);
+        return tool_rc_from_tpm(rval);
+    }
+
+    return tool_rc_success;
+}
+
 tool_rc tpm2_certifycreation(ESYS_CONTEXT *esys_context,
     tpm2_loaded_object *signingkey_obj, tpm2_loaded_object *certifiedkey_obj,
     TPM2B_DIGEST *creation_hash, TPMT_SIG_SCHEME *in_scheme,
@@ -3769,6 +4443,47 @@ tpm2_quote_skip_esapi_call:
     return rc;
 }
 
+tool_rc tpm2_quote_async(ESYS_CONTEXT *esys_context,
+        tpm2_loaded_object *quote_obj, const TPMT_SIG_SCHEME *in_scheme,
+        const TPM2B_DATA *qualifying_data,
+        const TPML_PCR_SELECTION *pcr_select) {
+
+    ESYS_TR quote_obj_session_handle = ESYS_TR_NONE;
+    tool_rc rc = tpm2_auth_util_get_shandle(esys_context, quote_obj->tr_handle,
+            quote_obj->session, &quote_obj_session_handle);
+    if (rc != tool_rc_success) {
+        LOG_ERR("Failed to get shandle");
+        return rc;
+    }
+
+    TSS2_RC rval = Esys_Quote_Async(esys_context, quote_obj->tr_handle,
+            quote_obj_session_handle, ESYS_TR_NONE, ESYS_TR_NONE,
+            qualifying_data, in_scheme, pcr_select);
+    if (rval != TPM2_RC_SUCCESS) {
+        LOG_PERR(Esys_Quote_Async, rval);
+        return tool_rc_from_tpm(rval);
+    }
+
+    return tool_rc_success;
+}
+
+tool_rc tpm2_quote_finish(ESYS_CONTEXT *esys_context, TPM2B_ATTEST **quoted,
+        TPMT_SIGNATURE **signature) {
+
+    TSS2_RC rval;
+    do {
+        /* blocks with the default timeout, TRY_AGAIN means resubmitted */
+        rval = Esys_Quote_Finish(esys_context, quoted, signature);
+    } while (rval == TSS2_ESYS_RC_TRY_AGAIN);
+
+    if (rval != TPM2_RC_SUCCESS) {
+        LOG_PERR(Esys_Quote_Finish, rval);
+        return tool_rc_from_tpm(rval);
+    }
+
+    return tool_rc_success;
+}
+
 tool_rc tpm2_changeeps(ESYS_CONTEXT *ectx,
     tpm2_session *platform_hierarchy_session, TPM2B_DIGEST *cp_hash,
     TPM2B_DIGEST *rp_hash, TPMI_ALG_HASH parameter_hash_algorithm,
@@ -3818,6 +4533,8 @@ tpm2_changeeps_free_name1:
         return rc;
     }
 
+    tpm2_host_cache_invalidate();
+
     TSS2_RC rval = Esys_ChangeEPS(ectx, ESYS_TR_RH_PLATFORM,
         platform_hierarchy_session_handle, shandle2, shandle3);
     if (rval != TPM2_RC_SUCCESS) {
@@ -3881,6 +4598,8 @@ tpm2_changepps_free_name1:
         return rc;
     }
 
+    tpm2_host_cache_invalidate();
+
     TSS2_RC rval = Esys_ChangePPS(ectx, ESYS_TR_RH_PLATFORM,
         platform_hierarchy_session_handle, shandle2, shandle3);
     if (rval != TPM2_RC_SUCCESS) {
@@ -3991,6 +4710,35 @@ tool_rc tpm2_stirrandom(ESYS_CONTEXT *ectx,
     return tool_rc_success;
 }
 
+tool_rc tpm2_stirrandom_async(ESYS_CONTEXT *ectx,
+        const TPM2B_SENSITIVE_DATA *data) {
+
+    TSS2_RC rval = Esys_StirRandom_Async(ectx, ESYS_TR_NONE, ESYS_TR_NONE,
+        ESYS_TR_NONE, data);
+    if (rval != TPM2_RC_SUCCESS) {
+        LOG_PERR(Esys_StirRandom_Async, rval);
+        return tool_rc_from_tpm(rval);
+    }
+
+    return tool_rc_success;
+}
+
+tool_rc tpm2_stirrandom_finish(ESYS_CONTEXT *ectx) {
+
+    TSS2_RC rval;
+    do {
+        /* blocks with the default timeout, TRY_AGAIN means resubmitted */
+        rval = Esys_StirRandom_Finish(ectx);
+    } while (rval == TSS2_ESYS_RC_TRY_AGAIN);
+
+    if (rval != TPM2_RC_SUCCESS) {
+        LOG_PERR(Esys_StirRandom_Finish, rval);
+        return tool_rc_from_tpm(rval);
+    }
+
+    return tool_rc_success;
+}
+
 tool_rc tpm2_selftest(ESYS_CONTEXT *ectx, TPMI_YES_NO full_test) {
 
     TSS2_RC rval = Esys_SelfTest(ectx, ESYS_TR_NONE, ESYS_TR_NONE, ESYS_TR_NONE,
@@ -4060,6 +4808,55 @@ tool_rc tpm2_pcr_event(ESYS_CONTEXT *ectx,
     return tool_rc_success;
 }
 
+tool_rc tpm2_pcr_extend(ESYS_CONTEXT *ectx, ESYS_TR pcr,
+        tpm2_session *session, const TPML_DIGEST_VALUES *digests) {
+
+    ESYS_TR shandle1 = ESYS_TR_NONE;
+    tool_rc rc = tpm2_auth_util_get_shandle(ectx, pcr, session,
+            &shandle1);
+    if (rc != tool_rc_success) {
+        return rc;
+    }
+
+    TSS2_RC rval = Esys_PCR_Extend(ectx, pcr, shandle1, ESYS_TR_NONE,
+            ESYS_TR_NONE, digests);
+    if (rval != TSS2_RC_SUCCESS) {
+        LOG_PERR(Esys_PCR_Extend, rval);
+        return tool_rc_from_tpm(rval);
+    }
+
+    return tool_rc_success;
+}
+
+tool_rc tpm2_pcr_extend_async(ESYS_CONTEXT *ectx, TPMI_DH_PCR pcr_index,
+        const TPML_DIGEST_VALUES *digests) {
+
+    TSS2_RC rval = Esys_PCR_Extend_Async(ectx, pcr_index, ESYS_TR_PASSWORD,
+            ESYS_TR_NONE, ESYS_TR_NONE, digests);
+    if (rval != TSS2_RC_SUCCESS) {
+        LOG_PERR(Esys_PCR_Extend_Async, rval);
+        return tool_rc_from_tpm(rval);
+    }
+
+    return tool_rc_success;
+}
+
+tool_rc tpm2_pcr_extend_finish(ESYS_CONTEXT *ectx) {
+
+    TSS2_RC rval;
+    do {
+        /* blocks with the default timeout, TRY_AGAIN means resubmitted */
+        rval = Esys_PCR_Extend_Finish(ectx);
+    } while (rval == TSS2_ESYS_RC_TRY_AGAIN);
+
+    if (rval != TSS2_RC_SUCCESS) {
+        LOG_PERR(Esys_PCR_Extend_Finish, rval);
+        return tool_rc_from_tpm(rval);
+    }
+
+    return tool_rc_success;
+}
+
 tool_rc tpm2_getrandom(ESYS_CONTEXT *ectx, UINT16 count,
         TPM2B_DIGEST **random, TPM2B_DIGEST *cp_hash, TPM2B_DIGEST *rp_hash,
         ESYS_TR session_handle_1, ESYS_TR session_handle_2,
@@ -4113,6 +4910,36 @@ tpm2_getrandom_skip_esapi_call:
     return rc;
 }
 
+tool_rc tpm2_getrandom_async(ESYS_CONTEXT *ectx, UINT16 count,
+        ESYS_TR session_handle_1, ESYS_TR session_handle_2,
+        ESYS_TR session_handle_3) {
+
+    TSS2_RC rval = Esys_GetRandom_Async(ectx, session_handle_1,
+        session_handle_2, session_handle_3, count);
+    if (rval != TPM2_RC_SUCCESS) {
+        LOG_PERR(Esys_GetRandom_Async, rval);
+        return tool_rc_from_tpm(rval);
+    }
+
+    return tool_rc_success;
+}
+
+tool_rc tpm2_getrandom_finish(ESYS_CONTEXT *ectx, TPM2B_DIGEST **random) {
+
+    TSS2_RC rval;
+    do {
+        /* blocks with the default timeout, TRY_AGAIN means resubmitted */
+        rval = Esys_GetRandom_Finish(ectx, random);
+    } while (rval == TSS2_ESYS_RC_TRY_AGAIN);
+
+    if (rval != TPM2_RC_SUCCESS) {
+        LOG_PERR(Esys_GetRandom_Finish, rval);
+        return tool_rc_from_tpm(rval);
+    }
+
+    return tool_rc_success;
+}
+
 tool_rc tpm2_startup(ESYS_CONTEXT *ectx, TPM2_SU startup_type) {
 
     TSS2_RC rval = Esys_Startup(ectx, startup_type);
@@ -4136,6 +4963,34 @@ tool_rc tpm2_pcr_reset(ESYS_CONTEXT *ectx, ESYS_TR pcr_handle) {
     return tool_rc_success;
 }
 
+tool_rc tpm2_pcr_reset_async(ESYS_CONTEXT *ectx, ESYS_TR pcr_handle) {
+
+    TSS2_RC rval = Esys_PCR_Reset_Async(ectx, pcr_handle, ESYS_TR_PASSWORD,
+            ESYS_TR_NONE, ESYS_TR_NONE);
+    if (rval != TSS2_RC_SUCCESS) {
+        LOG_PERR(Esys_PCR_Reset_Async, rval);
+        return tool_rc_from_tpm(rval);
+    }
+
+    return tool_rc_success;
+}
+
+tool_rc tpm2_pcr_reset_finish(ESYS_CONTEXT *ectx) {
+
+    TSS2_RC rval;
+    do {
+        /* blocks with the default timeout, TRY_AGAIN means resubmitted */
+        rval = Esys_PCR_Reset_Finish(ectx);
+    } while (rval == TSS2_ESYS_RC_TRY_AGAIN);
+
+    if (rval != TSS2_RC_SUCCESS) {
+        LOG_PERR(Esys_PCR_Reset_Finish, rval);
+        return tool_rc_from_tpm(rval);
+    }
+
+    return tool_rc_success;
+}
+
 tool_rc tpm2_makecredential(ESYS_CONTEXT *ectx, ESYS_TR handle,
         const TPM2B_DIGEST *credential, const TPM2B_NAME *object_name,
         TPM2B_ID_OBJECT **credential_blob, TPM2B_ENCRYPTED_SECRET **secret) {
@@ -4494,6 +5349,45 @@ tool_rc tpm2_ecdhzgen(ESYS_CONTEXT *esys_context,
     return tool_rc_success;
 }
 
+tool_rc tpm2_ecdhzgen_async(ESYS_CONTEXT *esys_context,
+    tpm2_loaded_object *ecc_key_object, const TPM2B_ECC_POINT *Q) {
+
+    ESYS_TR ecc_key_obj_session_handle = ESYS_TR_NONE;
+    tool_rc rc = tpm2_auth_util_get_shandle(esys_context,
+        ecc_key_object->tr_handle, ecc_key_object->session,
+        &ecc_key_obj_session_handle);
+    if (rc != tool_rc_success) {
+        LOG_ERR("Failed to get shandle");
+        return rc;
+    }
+
+    TSS2_RC rval = Esys_ECDH_ZGen_Async(esys_context,
+            ecc_key_object->tr_handle, ecc_key_obj_session_handle,
+            ESYS_TR_NONE, ESYS_TR_NONE, Q);
+    if (rval != TSS2_RC_SUCCESS) {
+        LOG_PERR(Esys_ECDH_ZGen_Async, rval);
+        return tool_rc_from_tpm(rval);
+    }
+
+    return tool_rc_success;
+}
+
+tool_rc tpm2_ecdhzgen_finish(ESYS_CONTEXT *esys_context, TPM2B_ECC_POINT **Z) {
+
+    TSS2_RC rval;
+    do {
+        /* blocks with the default timeout, TRY_AGAIN means resubmitted */
+        rval = Esys_ECDH_ZGen_Finish(esys_context, Z);
+    } while (rval == TSS2_ESYS_RC_TRY_AGAIN);
+
+    if (rval != TSS2_RC_SUCCESS) {
+        LOG_PERR(Esys_ECDH_ZGen_Finish, rval);
+        return tool_rc_from_tpm(rval);
+    }
+
+    return tool_rc_success;
+}
+
 tool_rc tpm2_zgen2phase(ESYS_CONTEXT *esys_context,
     tpm2_loaded_object *ecc_key_object, TPM2B_ECC_POINT *Q1,
     TPM2B_ECC_POINT *Q2, TPM2B_ECC_POINT **Z1, TPM2B_ECC_POINT **Z2,
@@ -4519,6 +5413,49 @@ tool_rc tpm2_zgen2phase(ESYS_CONTEXT *esys_context,
         return tool_rc_success;
 }
 
+tool_rc tpm2_zgen2phase_async(ESYS_CONTEXT *esys_context,
+    tpm2_loaded_object *ecc_key_object, const TPM2B_ECC_POINT *Q1,
+    const TPM2B_ECC_POINT *Q2, TPMI_ECC_KEY_EXCHANGE keyexchange_scheme,
+    UINT16 commit_counter) {
+
+    ESYS_TR ecc_key_obj_session_handle = ESYS_TR_NONE;
+    tool_rc rc = tpm2_auth_util_get_shandle(esys_context,
+        ecc_key_object->tr_handle, ecc_key_object->session,
+        &ecc_key_obj_session_handle);
+    if (rc != tool_rc_success) {
+        LOG_ERR("Failed to get shandle");
+        return rc;
+    }
+
+    TSS2_RC rval = Esys_ZGen_2Phase_Async(esys_context,
+            ecc_key_object->tr_handle, ecc_key_obj_session_handle,
+            ESYS_TR_NONE, ESYS_TR_NONE, Q1, Q2, keyexchange_scheme,
+            commit_counter);
+    if (rval != TSS2_RC_SUCCESS) {
+        LOG_PERR(Esys_ZGen_2Phase_Async, rval);
+        return tool_rc_from_tpm(rval);
+    }
+
+    return tool_rc_success;
+}
+
+tool_rc tpm2_zgen2phase_finish(ESYS_CONTEXT *esys_context,
+    TPM2B_ECC_POINT **Z1, TPM2B_ECC_POINT **Z2) {
+
+    TSS2_RC rval;
+    do {
+        /* blocks with the default timeout, TRY_AGAIN means resubmitted */
+        rval = Esys_ZGen_2Phase_Finish(esys_context, Z1, Z2);
+    } while (rval == TSS2_ESYS_RC_TRY_AGAIN);
+
+    if (rval != TSS2_RC_SUCCESS) {
+        LOG_PERR(Esys_ZGen_2Phase_Finish, rval);
+        return tool_rc_from_tpm(rval);
+    }
+
+    return tool_rc_success;
+}
+
 tool_rc tpm2_getsapicontext(ESYS_CONTEXT *esys_context,
     TSS2_SYS_CONTEXT **sys_context) {
 
@@ -4531,8 +5468,7 @@ tool_rc tpm2_getsapicontext(ESYS_CONTEXT *esys_context,
     return tool_rc_success;
 }
 
-tool_rc tpm2_sapi_getrphash(TSS2_SYS_CONTEXT *sys_context,
-TSS2_RC response_code, TPM2B_DIGEST *rp_hash, TPMI_ALG_HASH halg) {
+static tool_rc tpm2_sapi_getcc(TSS2_SYS_CONTEXT *sys_context, TPM2_CC *cc) {
 
     uint8_t command_code[4];
     TSS2_RC rval = Tss2_Sys_GetCommandCode(sys_context, &command_code[0]);
@@ -4541,111 +5477,70 @@ TSS2_RC response_code, TPM2B_DIGEST *rp_hash, TPMI_ALG_HASH halg) {
         return tool_rc_general_error;
     }
 
-    const uint8_t *response_parameters;
-    size_t response_parameters_size;
-    rval = Tss2_Sys_GetRpBuffer(sys_context, &response_parameters_size,
-        &response_parameters);
+    rval = Tss2_MU_TPM2_CC_Unmarshal(command_code, sizeof(command_code), NULL,
+        cc);
     if (rval != TPM2_RC_SUCCESS) {
-        LOG_PERR(Tss2_Sys_GetRpBuffer, rval);
+        LOG_PERR(Tss2_MU_TPM2_CC_Unmarshal, rval);
         return tool_rc_general_error;
     }
 
-    uint16_t to_hash_len = sizeof(response_code) +
-                           sizeof(command_code) +
-                           response_parameters_size;
-
-    uint8_t *to_hash = malloc(to_hash_len);
-    if (!to_hash) {
-        LOG_ERR("oom");
-        return tool_rc_general_error;
-    }
-
-    //Response-Code
-    memcpy(to_hash, (uint8_t *)&response_code, sizeof(response_code));
-    uint16_t offset = sizeof(response_code);
-
+    return tool_rc_success;
+}
 
-    //Command-Code
-    memcpy(to_hash + offset, command_code, sizeof(command_code));
-    offset += sizeof(command_code);
+tool_rc tpm2_sapi_getrphash(TSS2_SYS_CONTEXT *sys_context,
+TSS2_RC response_code, TPM2B_DIGEST *rp_hash, TPMI_ALG_HASH halg) {
 
-    //RpBuffer
-    memcpy(to_hash + offset, response_parameters, response_parameters_size);
+    TPM2_CC cc;
+    tool_rc rc = tpm2_sapi_getcc(sys_context, &cc);
+    if (rc != tool_rc_success) {
+        return rc;
+    }
 
-    //rpHash
-    tool_rc rc = tool_rc_success;
-    bool result = tpm2_openssl_hash_compute_data(halg, to_hash, to_hash_len,
-        rp_hash);
-    free(to_hash);
-    if (!result) {
-        LOG_ERR("Failed rpHash digest calculation.");
-        rc = tool_rc_general_error;
+    const uint8_t *response_parameters;
+    size_t response_parameters_size;
+    TSS2_RC rval = Tss2_Sys_GetRpBuffer(sys_context, &response_parameters_size,
+        &response_parameters);
+    if (rval != TPM2_RC_SUCCESS) {
+        LOG_PERR(Tss2_Sys_GetRpBuffer, rval);
+        return tool_rc_general_error;
     }
 
-    return rc;
+    return tpm2_cphash_compute_rphash(response_code, cc, response_parameters,
+        response_parameters_size, halg, rp_hash);
 }
 
 tool_rc tpm2_sapi_getcphash(TSS2_SYS_CONTEXT *sys_context,
     const TPM2B_NAME *name1, const TPM2B_NAME *name2, const TPM2B_NAME *name3,
     TPMI_ALG_HASH halg, TPM2B_DIGEST *cp_hash) {
 
-    uint8_t command_code[4];
-    TSS2_RC rval = Tss2_Sys_GetCommandCode(sys_context, &command_code[0]);
-    if (rval != TPM2_RC_SUCCESS) {
-        LOG_PERR(Tss2_Sys_GetCommandCode, rval);
-        return tool_rc_general_error;
+    TPM2_CC cc;
+    tool_rc rc = tpm2_sapi_getcc(sys_context, &cc);
+    if (rc != tool_rc_success) {
+        return rc;
     }
 
     const uint8_t *command_parameters;
     size_t command_parameters_size;
-    rval = Tss2_Sys_GetCpBuffer(sys_context, &command_parameters_size,
+    TSS2_RC rval = Tss2_Sys_GetCpBuffer(sys_context, &command_parameters_size,
         &command_parameters);
     if (rval != TPM2_RC_SUCCESS) {
         LOG_PERR(Tss2_Sys_GetCpBuffer, rval);
         return tool_rc_general_error;
     }
 
-    uint16_t to_hash_len = sizeof(command_code) + command_parameters_size;
-    to_hash_len += name1 ? name1->size : 0;
-    to_hash_len += name2 ? name2->size : 0;
-    to_hash_len += name3 ? name3->size : 0;
-
-    uint8_t *to_hash = malloc(to_hash_len);
-    if (!to_hash) {
-        LOG_ERR("oom");
-        return tool_rc_general_error;
-    }
-
-    //Command-Code
-    memcpy(to_hash, command_code, sizeof(command_code));
-    uint16_t offset = sizeof(command_code);
+    tpm2_cphash c;
+    tpm2_cphash_init(&c, cc);
 
-    //Names
-    if (name1) {
-        memcpy(to_hash + offset, name1->name, name1->size);
-        offset += name1->size;
-    }
-    if (name2) {
-        memcpy(to_hash + offset, name2->name, name2->size);
-        offset += name2->size;
-    }
-    if (name3) {
-        memcpy(to_hash + offset, name3->name, name3->size);
-        offset += name3->size;
+    const TPM2B_NAME *names[] = { name1, name2, name3 };
+    size_t i;
+    for (i = 0; i < ARRAY_LEN(names); i++) {
+        if (names[i]) {
+            tpm2_cphash_add_name(&c, names[i]);
+        }
     }
 
-    //CpBuffer
-    memcpy(to_hash + offset, command_parameters, command_parameters_size);
+    tpm2_cphash_add_parameters(&c, command_parameters,
+        command_parameters_size);
 
-    //cpHash
-    tool_rc rc = tool_rc_success;
-    bool result = tpm2_openssl_hash_compute_data(halg, to_hash, to_hash_len,
-        cp_hash);
-    free(to_hash);
-    if (!result) {
-        LOG_ERR("Failed cpHash digest calculation.");
-        rc = tool_rc_general_error;
-    }
-
-    return rc;
+    return tpm2_cphash_compute(&c, halg, cp_hash);
 }
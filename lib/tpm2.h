@@ -23,6 +23,10 @@ tool_rc tpm2_tr_serialize(ESYS_CONTEXT *esys_context, ESYS_TR object,
 tool_rc tpm2_nv_readpublic(ESYS_CONTEXT *esys_context, ESYS_TR nv_index,
         TPM2B_NV_PUBLIC **nv_public, TPM2B_NAME **nv_name);
 
+tool_rc tpm2_nv_readpublic_by_handle(ESYS_CONTEXT *esys_context,
+        TPMI_RH_NV_INDEX nv_index, TPM2B_NV_PUBLIC *nv_public,
+        TPM2B_NAME *nv_name);
+
 tool_rc tpm2_readpublic(ESYS_CONTEXT *esys_context, ESYS_TR object_handle,
         TPM2B_PUBLIC **out_public, TPM2B_NAME **name,
         TPM2B_NAME **qualified_name);
@@ -36,6 +40,12 @@ tool_rc tpm2_nv_read(ESYS_CONTEXT *esys_context,
     UINT16 offset, TPM2B_MAX_NV_BUFFER **data, TPM2B_DIGEST *cp_hash,
     TPMI_ALG_HASH parameter_hash_algorithm);
 
+tool_rc tpm2_nv_read_async(ESYS_CONTEXT *esys_context, ESYS_TR auth_handle,
+        ESYS_TR nv_index, ESYS_TR shandle, UINT16 size, UINT16 offset);
+
+tool_rc tpm2_nv_read_finish(ESYS_CONTEXT *esys_context,
+        TPM2B_MAX_NV_BUFFER **data);
+
 tool_rc tpm2_context_save(ESYS_CONTEXT *esys_context, ESYS_TR save_handle,
         TPMS_CONTEXT **context);
 
@@ -44,6 +54,9 @@ tool_rc tpm2_context_load(ESYS_CONTEXT *esys_context,
 
 tool_rc tpm2_flush_context(ESYS_CONTEXT *esys_context, ESYS_TR flush_handle);
 
+tool_rc tpm2_flush_context_by_handle(ESYS_CONTEXT *esys_context,
+        TPMI_DH_CONTEXT flush_handle);
+
 tool_rc tpm2_start_auth_session(ESYS_CONTEXT *esys_context, ESYS_TR tpm_key,
         ESYS_TR bind, const TPM2B_NONCE *nonce_caller, TPM2_SE session_type,
         const TPMT_SYM_DEF *symmetric, TPMI_ALG_HASH auth_hash,
@@ -79,6 +92,13 @@ tool_rc tpm2_pcr_read(ESYS_CONTEXT *esys_context, ESYS_TR shandle1,
         const TPML_PCR_SELECTION *pcr_selection_in, UINT32 *pcr_update_counter,
         TPML_PCR_SELECTION **pcr_selection_out, TPML_DIGEST **pcr_values);
 
+tool_rc tpm2_pcr_read_async(ESYS_CONTEXT *esys_context,
+        const TPML_PCR_SELECTION *pcr_selection_in);
+
+tool_rc tpm2_pcr_read_finish(ESYS_CONTEXT *esys_context,
+        UINT32 *pcr_update_counter, TPML_PCR_SELECTION **pcr_selection_out,
+        TPML_DIGEST **pcr_values);
+
 tool_rc tpm2_policy_authorize(ESYS_CONTEXT *esys_context, ESYS_TR policy_session,
         ESYS_TR shandle1, ESYS_TR shandle2, ESYS_TR shandle3,
         const TPM2B_DIGEST *approved_policy, const TPM2B_NONCE *policy_ref,
@@ -112,8 +132,9 @@ tool_rc tpm2_policy_signed(ESYS_CONTEXT *esys_context,
         TPM2B_DIGEST *cphash);
 
 tool_rc tpm2_policy_ticket(ESYS_CONTEXT *esys_context, ESYS_TR policy_session,
-    const TPM2B_TIMEOUT *timeout, const TPM2B_NONCE *policyref,
-    const TPM2B_NAME *authname, const TPMT_TK_AUTH *ticket);
+    const TPM2B_TIMEOUT *timeout, const TPM2B_DIGEST *cphash,
+    const TPM2B_NONCE *policyref, const TPM2B_NAME *authname,
+    const TPMT_TK_AUTH *ticket);
 
 tool_rc tpm2_policy_authvalue(ESYS_CONTEXT *esys_context, ESYS_TR policy_session,
         ESYS_TR shandle1, ESYS_TR shandle2, ESYS_TR shandle3);
@@ -167,6 +188,12 @@ tool_rc tpm2_hash_sequence_start(ESYS_CONTEXT *esys_context, const TPM2B_AUTH *a
 tool_rc tpm2_sequence_update(ESYS_CONTEXT *esys_context, ESYS_TR sequence_handle,
         const TPM2B_MAX_BUFFER *buffer);
 
+tool_rc tpm2_sequence_update_async(ESYS_CONTEXT *esys_context,
+        ESYS_TR sequence_handle, ESYS_TR shandle,
+        const TPM2B_MAX_BUFFER *buffer);
+
+tool_rc tpm2_sequence_update_finish(ESYS_CONTEXT *esys_context);
+
 tool_rc tpm2_sequence_complete(ESYS_CONTEXT *esys_context,
         ESYS_TR sequence_handle, const TPM2B_MAX_BUFFER *buffer,
         TPMI_RH_HIERARCHY hierarchy, TPM2B_DIGEST **result,
@@ -229,6 +256,19 @@ tool_rc tpm2_certify(ESYS_CONTEXT *esys_context,
     TPMT_SIGNATURE **signature, TPM2B_DIGEST *cp_hash, TPM2B_DIGEST *rp_hash,
     TPMI_ALG_HASH parameter_hash_algorithm, ESYS_TR shandle3);
 
+/*
+ * Sends a TPM2_Certify without waiting for the response, so the outputs of
+ * the previous certification can be written meanwhile.
+ */
+tool_rc tpm2_certify_async(ESYS_CONTEXT *esys_context,
+        tpm2_loaded_object *certifiedkey_obj,
+        tpm2_loaded_object *signingkey_obj,
+        const TPM2B_DATA *qualifying_data, const TPMT_SIG_SCHEME *scheme,
+        ESYS_TR shandle3);
+
+tool_rc tpm2_certify_finish(ESYS_CONTEXT *esys_context,
+        TPM2B_ATTEST **certify_info, TPMT_SIGNATURE **signature);
+
 tool_rc tpm2_rsa_decrypt(ESYS_CONTEXT *esys_context, tpm2_loaded_object *keyobj,
         const TPM2B_PUBLIC_KEY_RSA *cipher_text,
         const TPMT_RSA_DECRYPT *in_scheme, const TPM2B_DATA *label,
@@ -238,6 +278,27 @@ tool_rc tpm2_rsa_encrypt(ESYS_CONTEXT *ectx, tpm2_loaded_object *keyobj,
         const TPM2B_PUBLIC_KEY_RSA *message, const TPMT_RSA_DECRYPT *scheme,
         const TPM2B_DATA *label, TPM2B_PUBLIC_KEY_RSA **cipher_text);
 
+/*
+ * Sends a TPM2_RSA_Decrypt without waiting for the message, so the previous
+ * one can be saved meanwhile. The inputs are marshaled before returning.
+ */
+tool_rc tpm2_rsa_decrypt_async(ESYS_CONTEXT *ectx, tpm2_loaded_object *keyobj,
+        const TPM2B_PUBLIC_KEY_RSA *cipher_text, const TPMT_RSA_DECRYPT *scheme,
+        const TPM2B_DATA *label);
+
+tool_rc tpm2_rsa_decrypt_finish(ESYS_CONTEXT *ectx,
+        TPM2B_PUBLIC_KEY_RSA **message);
+
+/*
+ * Same as tpm2_rsa_decrypt_async() for TPM2_RSA_Encrypt.
+ */
+tool_rc tpm2_rsa_encrypt_async(ESYS_CONTEXT *ectx, tpm2_loaded_object *keyobj,
+        const TPM2B_PUBLIC_KEY_RSA *message, const TPMT_RSA_DECRYPT *scheme,
+        const TPM2B_DATA *label);
+
+tool_rc tpm2_rsa_encrypt_finish(ESYS_CONTEXT *ectx,
+        TPM2B_PUBLIC_KEY_RSA **cipher_text);
+
 tool_rc tpm2_load(ESYS_CONTEXT *esys_context, tpm2_loaded_object *parentobj,
         const TPM2B_PRIVATE *in_private, const TPM2B_PUBLIC *in_public,
         ESYS_TR *object_handle, TPM2B_DIGEST *cp_hash);
@@ -266,12 +327,45 @@ tool_rc tpm2_duplicate(ESYS_CONTEXT *esys_context,
         TPM2B_DATA **out_key, TPM2B_PRIVATE **duplicate,
         TPM2B_ENCRYPTED_SECRET **encrypted_seed, TPM2B_DIGEST *cp_hash);
 
+/*
+ * Sends a TPM2_Duplicate without waiting for the response, so the previous
+ * duplicate can be written meanwhile. The inputs are marshaled before
+ * returning.
+ */
+tool_rc tpm2_duplicate_async(ESYS_CONTEXT *esys_context,
+        tpm2_loaded_object *duplicable_key, tpm2_loaded_object *new_parent,
+        const TPM2B_DATA *in_key, const TPMT_SYM_DEF_OBJECT *sym_alg);
+
+tool_rc tpm2_duplicate_finish(ESYS_CONTEXT *esys_context,
+        TPM2B_DATA **out_key, TPM2B_PRIVATE **duplicate,
+        TPM2B_ENCRYPTED_SECRET **encrypted_seed);
+
 tool_rc tpm2_encryptdecrypt(ESYS_CONTEXT *esys_context,
         tpm2_loaded_object *encryption_key_obj, TPMI_YES_NO decrypt,
         TPMI_ALG_SYM_MODE mode, const TPM2B_IV *iv_in,
         const TPM2B_MAX_BUFFER *input_data, TPM2B_MAX_BUFFER **output_data,
         TPM2B_IV **iv_out, TPM2B_DIGEST *cp_hash);
 
+/*
+ * Sends one TPM2_EncryptDecrypt2 command, version 2, or TPM2_EncryptDecrypt,
+ * version 1, without waiting for the response, so the caller can prepare the
+ * next chunk meanwhile. The input is marshalled right away and can be reused
+ * once this returns.
+ */
+tool_rc tpm2_encryptdecrypt_async(ESYS_CONTEXT *esys_context,
+        tpm2_loaded_object *encryption_key_obj, unsigned version,
+        TPMI_YES_NO decrypt, TPMI_ALG_SYM_MODE mode, const TPM2B_IV *iv_in,
+        const TPM2B_MAX_BUFFER *input_data);
+
+/*
+ * Collects the response of tpm2_encryptdecrypt_async(). Returns
+ * tool_rc_unsupported, without logging an error, when the TPM does not
+ * implement TPM2_EncryptDecrypt2 and the command should be sent again as
+ * version 1.
+ */
+tool_rc tpm2_encryptdecrypt_finish(ESYS_CONTEXT *esys_context,
+        unsigned version, TPM2B_MAX_BUFFER **output_data, TPM2B_IV **iv_out);
+
 tool_rc tpm2_hierarchycontrol(ESYS_CONTEXT *esys_context,
         tpm2_loaded_object *auth_hierarchy, TPMI_RH_ENABLES enable,
         TPMI_YES_NO state, TPM2B_DIGEST *cp_hash);
@@ -305,6 +399,17 @@ tool_rc tpm2_nv_definespace(ESYS_CONTEXT *esys_context,
     TPM2B_DIGEST *rp_hash, TPMI_ALG_HASH parameter_hash_algorithm,
     ESYS_TR shandle2, ESYS_TR shandle3);
 
+/*
+ * Sends a TPM2_NV_DefineSpace without waiting for the response, which is
+ * collected with tpm2_nv_definespace_finish().
+ */
+tool_rc tpm2_nv_definespace_async(ESYS_CONTEXT *esys_context,
+        ESYS_TR auth_handle, ESYS_TR shandle1, ESYS_TR shandle2,
+        ESYS_TR shandle3, const TPM2B_AUTH *auth,
+        const TPM2B_NV_PUBLIC *public_info);
+
+tool_rc tpm2_nv_definespace_finish(ESYS_CONTEXT *esys_context);
+
 tool_rc tpm2_nvextend(ESYS_CONTEXT *esys_context,
     tpm2_loaded_object *auth_hierarchy_obj, TPM2_HANDLE nv_index,
     TPM2B_MAX_NV_BUFFER *data, TPM2B_DIGEST *cp_hash, TPM2B_DIGEST *rp_hash,
@@ -315,6 +420,13 @@ tool_rc tpm2_nv_increment(ESYS_CONTEXT *esys_context,
         tpm2_loaded_object *auth_hierarchy_obj, TPM2_HANDLE nv_index,
         TPM2B_DIGEST *cp_hash);
 
+/*
+ * Same as tpm2_nv_increment() for an index already resolved to an ESYS_TR, so
+ * incrementing it again does not read its public area from the TPM each time.
+ */
+tool_rc tpm2_nv_increment_tr(ESYS_CONTEXT *esys_context,
+        tpm2_loaded_object *auth_hierarchy_obj, ESYS_TR nv_index);
+
 tool_rc tpm2_nvreadlock(ESYS_CONTEXT *esys_context,
         tpm2_loaded_object *auth_hierarchy_obj, TPM2_HANDLE nv_index,
         TPM2B_DIGEST *cp_hash);
@@ -339,6 +451,17 @@ tool_rc tpm2_nvundefine(ESYS_CONTEXT *esys_context,
         tpm2_loaded_object *auth_hierarchy_obj, TPM2_HANDLE nv_index,
          TPM2B_DIGEST *cp_hash);
 
+/*
+ * Sends a TPM2_NV_UndefineSpace of an index already resolved to an ESYS_TR
+ * without waiting for the response, which is collected with
+ * tpm2_nvundefine_finish(). ESAPI releases the ESYS_TR of the index when it
+ * is undefined. The handle of the index is for the name cache.
+ */
+tool_rc tpm2_nvundefine_async(ESYS_CONTEXT *esys_context, ESYS_TR auth_handle,
+        TPM2_HANDLE nv_index, ESYS_TR esys_tr_nv_index, ESYS_TR shandle);
+
+tool_rc tpm2_nvundefine_finish(ESYS_CONTEXT *esys_context);
+
 tool_rc tpm2_nvundefinespecial(ESYS_CONTEXT *esys_context,
         tpm2_loaded_object *auth_hierarchy_obj, TPM2_HANDLE nv_index,
         tpm2_session *policy_session,  TPM2B_DIGEST *cp_hash);
@@ -347,6 +470,22 @@ tool_rc tpm2_nvwrite(ESYS_CONTEXT *esys_context,
         tpm2_loaded_object *auth_hierarchy_obj, TPM2_HANDLE nvindex,
         const TPM2B_MAX_NV_BUFFER *data, UINT16 offset, TPM2B_DIGEST *cp_hash);
 
+/*
+ * Sends a TPM2_NV_Extend of an index already resolved to an ESYS_TR without
+ * waiting for the response, which is collected with tpm2_nvextend_finish().
+ */
+tool_rc tpm2_nvextend_async(ESYS_CONTEXT *esys_context,
+        tpm2_loaded_object *auth_hierarchy_obj, ESYS_TR nv_index,
+        const TPM2B_MAX_NV_BUFFER *data, ESYS_TR shandle2, ESYS_TR shandle3);
+
+tool_rc tpm2_nvextend_finish(ESYS_CONTEXT *esys_context);
+
+tool_rc tpm2_nvwrite_async(ESYS_CONTEXT *esys_context, ESYS_TR auth_handle,
+        ESYS_TR nv_index, ESYS_TR shandle, const TPM2B_MAX_NV_BUFFER *data,
+        UINT16 offset);
+
+tool_rc tpm2_nvwrite_finish(ESYS_CONTEXT *esys_context);
+
 tool_rc tpm2_pcr_allocate(ESYS_CONTEXT *esys_context,
         tpm2_loaded_object *auth_hierarchy_obj,
         const TPML_PCR_SELECTION *pcr_allocation);
@@ -356,11 +495,34 @@ tool_rc tpm2_sign(ESYS_CONTEXT *esys_context, tpm2_loaded_object *signingkey_obj
         TPMT_TK_HASHCHECK *validation, TPMT_SIGNATURE **signature,
         TPM2B_DIGEST *cp_hash);
 
+/*
+ * Sends a TPM2_Sign without waiting for the signature, so the previous one
+ * can be saved meanwhile. The digest is marshaled before returning.
+ */
+tool_rc tpm2_sign_async(ESYS_CONTEXT *esys_context,
+        tpm2_loaded_object *signingkey_obj, const TPM2B_DIGEST *digest,
+        const TPMT_SIG_SCHEME *in_scheme, const TPMT_TK_HASHCHECK *validation);
+
+tool_rc tpm2_sign_finish(ESYS_CONTEXT *esys_context,
+        TPMT_SIGNATURE **signature);
+
 tool_rc tpm2_quote(ESYS_CONTEXT *esys_context, tpm2_loaded_object *quote_obj,
         TPMT_SIG_SCHEME *in_scheme, TPM2B_DATA *qualifying_data,
         TPML_PCR_SELECTION *PCRselect, TPM2B_ATTEST **quoted,
         TPMT_SIGNATURE **signature, TPM2B_DIGEST *cp_hash);
 
+/*
+ * Sends a TPM2_Quote without waiting for the response, so the outputs of the
+ * previous quote can be written meanwhile.
+ */
+tool_rc tpm2_quote_async(ESYS_CONTEXT *esys_context,
+        tpm2_loaded_object *quote_obj, const TPMT_SIG_SCHEME *in_scheme,
+        const TPM2B_DATA *qualifying_data,
+        const TPML_PCR_SELECTION *pcr_select);
+
+tool_rc tpm2_quote_finish(ESYS_CONTEXT *esys_context, TPM2B_ATTEST **quoted,
+        TPMT_SIGNATURE **signature);
+
 tool_rc tpm2_changeeps(ESYS_CONTEXT *ectx,
     tpm2_session *platform_hierarchy_session, TPM2B_DIGEST *cp_hash,
     TPM2B_DIGEST *rp_hash, TPMI_ALG_HASH parameter_hash_algorithm,
@@ -385,6 +547,15 @@ tool_rc tpm2_incrementalselftest(ESYS_CONTEXT *ectx, const TPML_ALG *to_test,
 
 tool_rc tpm2_stirrandom(ESYS_CONTEXT *ectx, const TPM2B_SENSITIVE_DATA *data);
 
+/*
+ * Sends a TPM2_StirRandom without waiting for the response, so the next bytes
+ * to stir can be read meanwhile.
+ */
+tool_rc tpm2_stirrandom_async(ESYS_CONTEXT *ectx,
+        const TPM2B_SENSITIVE_DATA *data);
+
+tool_rc tpm2_stirrandom_finish(ESYS_CONTEXT *ectx);
+
 tool_rc tpm2_selftest(ESYS_CONTEXT *ectx, TPMI_YES_NO full_test);
 
 tool_rc tpm2_gettestresult(ESYS_CONTEXT *ectx, TPM2B_MAX_BUFFER **out_data,
@@ -397,15 +568,45 @@ tool_rc tpm2_loadexternal(ESYS_CONTEXT *ectx, const TPM2B_SENSITIVE *private,
 tool_rc tpm2_pcr_event(ESYS_CONTEXT *ectx, ESYS_TR pcr, tpm2_session *session,
         const TPM2B_EVENT *event_data, TPML_DIGEST_VALUES **digests);
 
+tool_rc tpm2_pcr_extend(ESYS_CONTEXT *ectx, ESYS_TR pcr,
+        tpm2_session *session, const TPML_DIGEST_VALUES *digests);
+
+/*
+ * Sends a TPM2_PCR_Extend with the password session without waiting for the
+ * response, so the next extension can be prepared meanwhile.
+ */
+tool_rc tpm2_pcr_extend_async(ESYS_CONTEXT *ectx, TPMI_DH_PCR pcr_index,
+        const TPML_DIGEST_VALUES *digests);
+
+tool_rc tpm2_pcr_extend_finish(ESYS_CONTEXT *ectx);
+
 tool_rc tpm2_getrandom(ESYS_CONTEXT *ectx, UINT16 count,
         TPM2B_DIGEST **random, TPM2B_DIGEST *cp_hash, TPM2B_DIGEST *rp_hash,
         ESYS_TR session_handle_1, ESYS_TR session_handle_2,
         ESYS_TR session_handle_3, TPMI_ALG_HASH param_hash_algorithm) ;
 
+/*
+ * Sends a TPM2_GetRandom without waiting for the response, so the random
+ * bytes of the previous one can be consumed meanwhile.
+ */
+tool_rc tpm2_getrandom_async(ESYS_CONTEXT *ectx, UINT16 count,
+        ESYS_TR session_handle_1, ESYS_TR session_handle_2,
+        ESYS_TR session_handle_3);
+
+tool_rc tpm2_getrandom_finish(ESYS_CONTEXT *ectx, TPM2B_DIGEST **random);
+
 tool_rc tpm2_startup(ESYS_CONTEXT *ectx, TPM2_SU startup_type);
 
 tool_rc tpm2_pcr_reset(ESYS_CONTEXT *ectx, ESYS_TR pcr_handle);
 
+/*
+ * Sends a TPM2_PCR_Reset with the password session without waiting for the
+ * response, so the next command can be prepared meanwhile.
+ */
+tool_rc tpm2_pcr_reset_async(ESYS_CONTEXT *ectx, ESYS_TR pcr_handle);
+
+tool_rc tpm2_pcr_reset_finish(ESYS_CONTEXT *ectx);
+
 tool_rc tpm2_makecredential(ESYS_CONTEXT *ectx, ESYS_TR handle,
         const TPM2B_DIGEST *credential, const TPM2B_NAME *object_name,
         TPM2B_ID_OBJECT **credential_blob, TPM2B_ENCRYPTED_SECRET **secret);
@@ -451,6 +652,20 @@ tool_rc tpm2_nvcertify(ESYS_CONTEXT *esys_context,
     TPMT_SIGNATURE **signature, TPM2B_DATA *policy_qualifier,
     TPM2B_DIGEST *cp_hash);
 
+/*
+ * Sends a TPM2_NV_Certify of an already resolved NV index without waiting
+ * for the response, so the outputs of the previous certification can be
+ * written meanwhile.
+ */
+tool_rc tpm2_nvcertify_async(ESYS_CONTEXT *esys_context,
+        tpm2_loaded_object *signingkey_obj,
+        tpm2_loaded_object *nvindex_authobj, ESYS_TR nv_index, UINT16 offset,
+        UINT16 size, const TPMT_SIG_SCHEME *in_scheme,
+        const TPM2B_DATA *policy_qualifier);
+
+tool_rc tpm2_nvcertify_finish(ESYS_CONTEXT *esys_context,
+        TPM2B_ATTEST **certify_info, TPMT_SIGNATURE **signature);
+
 tool_rc tpm2_setprimarypolicy(ESYS_CONTEXT *esys_context,
     tpm2_loaded_object *hierarchy_object, TPM2B_DIGEST *auth_policy,
     TPMI_ALG_HASH hash_algorithm, TPM2B_DIGEST *cp_hash);
@@ -479,6 +694,18 @@ tool_rc tpm2_getsessionauditdigest(ESYS_CONTEXT *esys_context,
         TPM2B_ATTEST **audit_info, TPMT_SIGNATURE **signature,
         ESYS_TR audit_session_handle);
 
+/*
+ * Sends a TPM2_GetSessionAuditDigest without waiting for the response, so the
+ * digest of the previous session can be written meanwhile.
+ */
+tool_rc tpm2_getsessionauditdigest_async(ESYS_CONTEXT *esys_context,
+        tpm2_loaded_object *privacy_object, tpm2_loaded_object *sign_object,
+        const TPMT_SIG_SCHEME *in_scheme, const TPM2B_DATA *qualifying_data,
+        ESYS_TR audit_session_handle);
+
+tool_rc tpm2_getsessionauditdigest_finish(ESYS_CONTEXT *esys_context,
+        TPM2B_ATTEST **audit_info, TPMT_SIGNATURE **signature);
+
 tool_rc tpm2_geteccparameters(ESYS_CONTEXT *esys_context,
     TPMI_ECC_CURVE curve_id, TPMS_ALGORITHM_DETAIL_ECC **parameters);
 
@@ -498,11 +725,31 @@ tool_rc tpm2_ecdhzgen(ESYS_CONTEXT *esys_context,
     tpm2_loaded_object *ecc_key_object, TPM2B_ECC_POINT **Z,
     TPM2B_ECC_POINT *Q);
 
+/*
+ * Same as tpm2_rsa_decrypt_async() for TPM2_ECDH_ZGen.
+ */
+tool_rc tpm2_ecdhzgen_async(ESYS_CONTEXT *esys_context,
+    tpm2_loaded_object *ecc_key_object, const TPM2B_ECC_POINT *Q);
+
+tool_rc tpm2_ecdhzgen_finish(ESYS_CONTEXT *esys_context, TPM2B_ECC_POINT **Z);
+
 tool_rc tpm2_zgen2phase(ESYS_CONTEXT *esys_context,
     tpm2_loaded_object *ecc_key_object, TPM2B_ECC_POINT *Q1,
     TPM2B_ECC_POINT *Q2, TPM2B_ECC_POINT **Z1, TPM2B_ECC_POINT **Z2,
     TPMI_ECC_KEY_EXCHANGE keyexchange_scheme, UINT16 commit_counter);
 
+/*
+ * Sends a TPM2_ZGen_2Phase without waiting for the response, so the next
+ * exchange can be prepared meanwhile.
+ */
+tool_rc tpm2_zgen2phase_async(ESYS_CONTEXT *esys_context,
+    tpm2_loaded_object *ecc_key_object, const TPM2B_ECC_POINT *Q1,
+    const TPM2B_ECC_POINT *Q2, TPMI_ECC_KEY_EXCHANGE keyexchange_scheme,
+    UINT16 commit_counter);
+
+tool_rc tpm2_zgen2phase_finish(ESYS_CONTEXT *esys_context,
+    TPM2B_ECC_POINT **Z1, TPM2B_ECC_POINT **Z2);
+
 tool_rc tpm2_getsapicontext(ESYS_CONTEXT *esys_context,
     TSS2_SYS_CONTEXT **sys_context);
 
@@ -0,0 +1,430 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+#include <errno.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <openssl/err.h>
+#include <openssl/pem.h>
+#include <openssl/x509.h>
+#include <openssl/x509_vfy.h>
+
+#include "files.h"
+#include "log.h"
+#include "tpm2_ak_cert.h"
+#include "tpm2_hex.h"
+#include "tpm2_openssl.h"
+#include "tpm2_util.h"
+
+/* "SHA256:" and the unpadded base64 of the digest */
+#define AK_CERT_FINGERPRINT_SIZE 52
+
+typedef struct ak_cert_entry ak_cert_entry;
+struct ak_cert_entry {
+    char fingerprint[AK_CERT_FINGERPRINT_SIZE];
+    /* seconds since the epoch */
+    uint64_t expires;
+    /* the DER of the SubjectPublicKeyInfo */
+    BYTE *pubkey;
+    size_t pubkey_size;
+};
+
+struct tpm2_ak_cert_verifier {
+    X509_STORE *store;
+    STACK_OF(X509) *intermediates;
+    const char *cache_path;
+    UINT32 ttl;
+    /* the first sorted entries are those of the cache file */
+    ak_cert_entry *entries;
+    size_t count;
+    size_t capacity;
+    size_t sorted;
+    bool is_dirty;
+};
+
+static int entry_cmp(const void *a, const void *b) {
+
+    const ak_cert_entry *x = (const ak_cert_entry *) a;
+    const ak_cert_entry *y = (const ak_cert_entry *) b;
+
+    return strcmp(x->fingerprint, y->fingerprint);
+}
+
+static ak_cert_entry *entry_add(tpm2_ak_cert_verifier *v) {
+
+    if (v->count == v->capacity) {
+        size_t capacity = v->capacity ? v->capacity * 2 : 64;
+        ak_cert_entry *entries = realloc(v->entries,
+                capacity * sizeof(*entries));
+        if (!entries) {
+            LOG_ERR("oom");
+            return NULL;
+        }
+        v->entries = entries;
+        v->capacity = capacity;
+    }
+
+    ak_cert_entry *entry = &v->entries[v->count++];
+    memset(entry, 0, sizeof(*entry));
+
+    return entry;
+}
+
+static bool ca_load(tpm2_ak_cert_verifier *v, const char *path) {
+
+    BIO *bio = tpm2_openssl_bio_open(path, "rb");
+    if (!bio) {
+        LOG_ERR("Could not open CA certificates \"%s\"", path);
+        return false;
+    }
+
+    size_t roots = 0;
+    X509 *cert;
+    while ((cert = PEM_read_bio_X509(bio, NULL, NULL, NULL))) {
+        /* the self signed certificates are the trust anchors */
+        bool is_root = X509_check_issued(cert, cert) == X509_V_OK;
+        int rc = is_root ? X509_STORE_add_cert(v->store, cert) :
+                sk_X509_push(v->intermediates, cert);
+        if (!rc) {
+            LOG_ERR("Could not add CA certificate of \"%s\": %s", path,
+                    tpm2_openssl_get_err());
+            X509_free(cert);
+            BIO_free(bio);
+            return false;
+        }
+
+        if (is_root) {
+            /* the store took a reference */
+            X509_free(cert);
+            roots++;
+        }
+    }
+    /* the end of the bundle */
+    ERR_clear_error();
+    BIO_free(bio);
+
+    if (!roots) {
+        LOG_ERR("No self signed root CA certificate in \"%s\"", path);
+        return false;
+    }
+
+    return true;
+}
+
+static void cache_load(tpm2_ak_cert_verifier *v) {
+
+    FILE *f = files_fopen(v->cache_path, "r");
+    if (!f) {
+        if (errno != ENOENT) {
+            LOG_WARN("Could not open AK certificate cache \"%s\", error: %s",
+                    v->cache_path, strerror(errno));
+        }
+        return;
+    }
+
+    uint64_t now = time(NULL);
+    char *line = NULL;
+    size_t line_size = 0;
+    while (getline(&line, &line_size, f) != -1) {
+        char *saveptr = NULL;
+        char *fingerprint = strtok_r(line, " \t\r\n", &saveptr);
+        char *expires = strtok_r(NULL, " \t\r\n", &saveptr);
+        char *pubkey = strtok_r(NULL, " \t\r\n", &saveptr);
+        if (!fingerprint || fingerprint[0] == '#') {
+            continue;
+        }
+
+        /* a broken or expired entry is dropped with the next save */
+        uint64_t expiry;
+        size_t hex_len = pubkey ? strlen(pubkey) : 0;
+        if (!expires || !hex_len || hex_len % 2
+                || strlen(fingerprint) >= AK_CERT_FINGERPRINT_SIZE
+                || !tpm2_util_string_to_uint64(expires, &expiry)
+                || expiry <= now) {
+            v->is_dirty = true;
+            continue;
+        }
+
+        ak_cert_entry *entry = entry_add(v);
+        if (!entry) {
+            break;
+        }
+        entry->pubkey = malloc(hex_len / 2);
+        if (!entry->pubkey
+                || !tpm2_hex_decode(pubkey, hex_len, entry->pubkey)) {
+            free(entry->pubkey);
+            v->count--;
+            v->is_dirty = true;
+            continue;
+        }
+        entry->pubkey_size = hex_len / 2;
+        entry->expires = expiry;
+        strcpy(entry->fingerprint, fingerprint);
+    }
+    free(line);
+    fclose(f);
+
+    qsort(v->entries, v->count, sizeof(*v->entries), entry_cmp);
+    v->sorted = v->count;
+}
+
+static void cache_save(tpm2_ak_cert_verifier *v) {
+
+    files_atomic atomic;
+    FILE *f = files_atomic_fopen(&atomic, v->cache_path);
+    if (!f) {
+        return;
+    }
+
+    qsort(v->entries, v->count, sizeof(*v->entries), entry_cmp);
+
+    uint64_t now = time(NULL);
+    bool result = true;
+    size_t i;
+    for (i = 0; result && i < v->count; i++) {
+        const ak_cert_entry *entry = &v->entries[i];
+        /* a certificate saved twice, ie under two paths, is saved once */
+        if (entry->expires <= now || (i && !strcmp(entry->fingerprint,
+                v->entries[i - 1].fingerprint))) {
+            continue;
+        }
+
+        char *hex = tpm2_hex_encode_alloc(entry->pubkey, entry->pubkey_size,
+                false);
+        result = hex && fprintf(f, "%s %"PRIu64" %s\n", entry->fingerprint,
+                entry->expires, hex) > 0;
+        free(hex);
+    }
+
+    if (!files_atomic_close(&atomic, f, result)) {
+        LOG_WARN("Could not write AK certificate cache \"%s\"",
+                v->cache_path);
+    }
+}
+
+tpm2_ak_cert_verifier *tpm2_ak_cert_verifier_new(const char *ca_path,
+        const char *cache_path, UINT32 ttl) {
+
+    tpm2_ak_cert_verifier *v = calloc(1, sizeof(*v));
+    if (!v) {
+        LOG_ERR("oom");
+        return NULL;
+    }
+
+    v->store = X509_STORE_new();
+    v->intermediates = sk_X509_new_null();
+    if (!v->store || !v->intermediates) {
+        LOG_ERR("oom");
+        goto error;
+    }
+
+    if (!ca_load(v, ca_path)) {
+        goto error;
+    }
+
+    v->cache_path = cache_path;
+    v->ttl = ttl;
+    if (cache_path) {
+        cache_load(v);
+    }
+
+    return v;
+
+error:
+    tpm2_ak_cert_verifier_free(v);
+    return NULL;
+}
+
+static X509 *cert_load(const char *path) {
+
+    BIO *bio = tpm2_openssl_bio_open(path, "rb");
+    if (!bio) {
+        LOG_ERR("Could not open AK certificate \"%s\"", path);
+        return NULL;
+    }
+
+    X509 *cert = PEM_read_bio_X509(bio, NULL, NULL, NULL);
+    if (!cert) {
+        /* not PEM, then DER */
+        ERR_clear_error();
+        if (BIO_reset(bio) == 0) {
+            cert = d2i_X509_bio(bio, NULL);
+        }
+    }
+    BIO_free(bio);
+
+    if (!cert) {
+        LOG_ERR("Could not read AK certificate \"%s\": %s", path,
+                tpm2_openssl_get_err());
+    }
+
+    return cert;
+}
+
+/* the base64 of the SHA256 of the DER, as for the fingerprints of keys */
+static bool cert_fingerprint(X509 *cert, char *fingerprint) {
+
+    BYTE *der = NULL;
+    int der_len = i2d_X509(cert, &der);
+    if (der_len <= 0) {
+        LOG_ERR("Could not encode AK certificate: %s", tpm2_openssl_get_err());
+        return false;
+    }
+
+    TPM2B_DIGEST digest = { .size = 0 };
+    bool result = tpm2_openssl_hash_compute_data(TPM2_ALG_SHA256, der,
+            der_len, &digest);
+    OPENSSL_free(der);
+    if (!result) {
+        return false;
+    }
+
+    strcpy(fingerprint, "SHA256:");
+    char *base64 = fingerprint + strlen(fingerprint);
+    int len = EVP_EncodeBlock((unsigned char *) base64, digest.buffer,
+            digest.size);
+    while (len > 0 && base64[len - 1] == '=') {
+        base64[--len] = '\0';
+    }
+
+    return true;
+}
+
+/* the seconds until the certificate expires, 0 if it did */
+static uint64_t cert_lifetime(X509 *cert) {
+
+    int days = 0;
+    int seconds = 0;
+    if (!ASN1_TIME_diff(&days, &seconds, NULL, X509_get0_notAfter(cert))
+            || days < 0 || seconds < 0) {
+        return 0;
+    }
+
+    return (uint64_t) days * 86400 + seconds;
+}
+
+static bool cert_verify(tpm2_ak_cert_verifier *v, X509 *cert,
+        const char *path) {
+
+    X509_STORE_CTX *sctx = X509_STORE_CTX_new();
+    if (!sctx) {
+        LOG_ERR("oom");
+        return false;
+    }
+
+    bool result = X509_STORE_CTX_init(sctx, v->store, cert, v->intermediates)
+            && X509_verify_cert(sctx) == 1;
+    if (!result) {
+        LOG_ERR("AK certificate \"%s\" does not verify: %s", path,
+                X509_verify_cert_error_string(
+                        X509_STORE_CTX_get_error(sctx)));
+    }
+    X509_STORE_CTX_free(sctx);
+
+    return result;
+}
+
+bool tpm2_ak_cert_verifier_get_pkey(tpm2_ak_cert_verifier *v,
+        const char *path, EVP_PKEY **pkey) {
+
+    X509 *cert = cert_load(path);
+    if (!cert) {
+        return false;
+    }
+
+    bool result = false;
+    ak_cert_entry key;
+    if (!cert_fingerprint(cert, key.fingerprint)) {
+        goto out;
+    }
+
+    uint64_t now = time(NULL);
+    ak_cert_entry *entry = bsearch(&key, v->entries, v->sorted,
+            sizeof(*v->entries), entry_cmp);
+    if (entry && entry->expires > now) {
+        const BYTE *p = entry->pubkey;
+        *pkey = d2i_PUBKEY(NULL, &p, entry->pubkey_size);
+        if (*pkey) {
+            LOG_INFO("AK certificate \"%s\" is cached as %s", path,
+                    key.fingerprint);
+            result = true;
+            goto out;
+        }
+        ERR_clear_error();
+    }
+
+    if (!cert_verify(v, cert, path)) {
+        goto out;
+    }
+
+    *pkey = X509_get_pubkey(cert);
+    if (!*pkey) {
+        LOG_ERR("Could not get the public key of AK certificate \"%s\": %s",
+                path, tpm2_openssl_get_err());
+        goto out;
+    }
+    result = true;
+
+    uint64_t lifetime = cert_lifetime(cert);
+    if (!v->cache_path || !v->ttl || !lifetime) {
+        goto out;
+    }
+
+    BYTE *der = NULL;
+    int der_len = i2d_PUBKEY(*pkey, &der);
+    if (der_len <= 0) {
+        ERR_clear_error();
+        goto out;
+    }
+
+    /* the new entries follow the sorted ones, until the cache is saved */
+    entry = entry_add(v);
+    if (!entry) {
+        OPENSSL_free(der);
+        goto out;
+    }
+    entry->pubkey = malloc(der_len);
+    if (!entry->pubkey) {
+        LOG_ERR("oom");
+        OPENSSL_free(der);
+        v->count--;
+        goto out;
+    }
+    memcpy(entry->pubkey, der, der_len);
+    OPENSSL_free(der);
+    entry->pubkey_size = der_len;
+    entry->expires = now + (lifetime < v->ttl ? lifetime : v->ttl);
+    strcpy(entry->fingerprint, key.fingerprint);
+    v->is_dirty = true;
+
+out:
+    X509_free(cert);
+
+    return result;
+}
+
+void tpm2_ak_cert_verifier_free(tpm2_ak_cert_verifier *v) {
+
+    if (!v) {
+        return;
+    }
+
+    if (v->cache_path && v->is_dirty) {
+        cache_save(v);
+    }
+
+    size_t i;
+    for (i = 0; i < v->count; i++) {
+        free(v->entries[i].pubkey);
+    }
+    free(v->entries);
+
+    X509_STORE_free(v->store);
+    sk_X509_pop_free(v->intermediates, X509_free);
+    free(v);
+}
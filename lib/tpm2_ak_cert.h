@@ -0,0 +1,61 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+#ifndef LIB_TPM2_AK_CERT_H_
+#define LIB_TPM2_AK_CERT_H_
+
+#include <stdbool.h>
+
+#include <openssl/evp.h>
+#include <tss2/tss2_tpm2_types.h>
+
+/*
+ * Verifies the certificates of attestation keys against a bundle of CA
+ * certificates, ie at a verifier checking the quotes of many devices. The
+ * public keys of the certificates verified are kept in a cache file keyed by
+ * the fingerprint of the certificate, so the certificate of a device seen
+ * before skips the path validation until it is older than the TTL.
+ */
+typedef struct tpm2_ak_cert_verifier tpm2_ak_cert_verifier;
+
+/* a day, the CAs of the AK certificates change far less often */
+#define TPM2_AK_CERT_CACHE_TTL_DEFAULT 86400
+
+/**
+ * Creates a verifier.
+ * @param ca_path
+ *  A PEM bundle of the root CA certificates, the self signed ones, and of
+ *  the intermediate CA certificates.
+ * @param cache_path
+ *  The cache file, which need not exist, or NULL for no cache.
+ * @param ttl
+ *  The seconds a verified certificate is cached for, at most until it
+ *  expires.
+ * @return
+ *  The verifier or NULL on error.
+ */
+tpm2_ak_cert_verifier *tpm2_ak_cert_verifier_new(const char *ca_path,
+        const char *cache_path, UINT32 ttl);
+
+/**
+ * Gets the public key of an AK certificate, verified or found in the cache.
+ * @param verifier
+ *  The verifier.
+ * @param path
+ *  The path of the certificate, in PEM or DER.
+ * @param pkey
+ *  Receives the public key, released with EVP_PKEY_free().
+ * @return
+ *  True if the certificate is valid, false otherwise.
+ */
+bool tpm2_ak_cert_verifier_get_pkey(tpm2_ak_cert_verifier *verifier,
+        const char *path, EVP_PKEY **pkey);
+
+/**
+ * Saves the cache, without the entries that expired, and releases the
+ * verifier.
+ * @param verifier
+ *  The verifier, NULL is ignored.
+ */
+void tpm2_ak_cert_verifier_free(tpm2_ak_cert_verifier *verifier);
+
+#endif /* LIB_TPM2_AK_CERT_H_ */
@@ -1,5 +1,6 @@
 /* SPDX-License-Identifier: BSD-3-Clause */
 
+#include <ctype.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -12,20 +13,18 @@
 #include "tpm2_alg_util.h"
 #include "tpm2_attr_util.h"
 #include "tpm2_errata.h"
+#include "tpm2_hex.h"
 
-typedef struct alg_pair alg_pair;
-struct alg_pair {
+typedef struct alg_entry alg_entry;
+struct alg_entry {
     const char *name;
-    TPM2_ALG_ID id;
     tpm2_alg_util_flags flags;
-    tpm2_alg_util_flags _flags;
 };
 
-typedef enum alg_iter_res alg_iter_res;
-enum alg_iter_res {
-    stop,
-    go,
-    found
+typedef struct alg_name alg_name;
+struct alg_name {
+    const char *name;
+    TPM2_ALG_ID id;
 };
 
 typedef enum alg_parser_rc alg_parser_rc;
@@ -35,86 +34,176 @@ enum alg_parser_rc {
     alg_parser_rc_done
 };
 
-typedef alg_iter_res (*alg_iter)(TPM2_ALG_ID id, const char *name,
-        tpm2_alg_util_flags flags, void *userdata);
-
-static void tpm2_alg_util_for_each_alg(alg_iter iterator, void *userdata) {
-
-    static const alg_pair algs[] = {
-
-        // Assymetric
-        { .name = "rsa", .id = TPM2_ALG_RSA, .flags = tpm2_alg_util_flags_asymmetric|tpm2_alg_util_flags_base },
-        { .name = "ecc", .id = TPM2_ALG_ECC, .flags = tpm2_alg_util_flags_asymmetric|tpm2_alg_util_flags_base },
-
-        // Symmetric
-        { .name = "tdes", .id = TPM2_ALG_TDES, .flags = tpm2_alg_util_flags_symmetric },
-        { .name = "aes", .id = TPM2_ALG_AES, .flags = tpm2_alg_util_flags_symmetric },
-        { .name = "camellia", .id = TPM2_ALG_CAMELLIA, .flags = tpm2_alg_util_flags_symmetric },
-
-        // Hash
-        { .name = "sha1", .id = TPM2_ALG_SHA1, .flags = tpm2_alg_util_flags_hash },
-        { .name = "sha256", .id = TPM2_ALG_SHA256, .flags = tpm2_alg_util_flags_hash },
-        { .name = "sha384", .id = TPM2_ALG_SHA384, .flags = tpm2_alg_util_flags_hash },
-        { .name = "sha512", .id = TPM2_ALG_SHA512, .flags = tpm2_alg_util_flags_hash },
-        { .name = "sm3_256", .id = TPM2_ALG_SM3_256, .flags = tpm2_alg_util_flags_hash },
-        { .name = "sha3_256", .id = TPM2_ALG_SHA3_256, .flags = tpm2_alg_util_flags_hash },
-        { .name = "sha3_384", .id = TPM2_ALG_SHA3_384, .flags = tpm2_alg_util_flags_hash },
-        { .name = "sha3_512", .id = TPM2_ALG_SHA3_512, .flags = tpm2_alg_util_flags_hash },
-
-        // Keyed hash
-        { .name = "hmac", .id = TPM2_ALG_HMAC, tpm2_alg_util_flags_keyedhash | tpm2_alg_util_flags_sig },
-        { .name = "xor", .id = TPM2_ALG_XOR, tpm2_alg_util_flags_keyedhash },
-        { .name = "cmac", .id = TPM2_ALG_CMAC, .flags = tpm2_alg_util_flags_sig },
-
-        // Mask Generation Functions
-        { .name = "mgf1", .id = TPM2_ALG_MGF1, .flags = tpm2_alg_util_flags_mgf },
-
-        // Signature Schemes
-        { .name = "rsassa", .id = TPM2_ALG_RSASSA, .flags = tpm2_alg_util_flags_sig },
-        { .name = "rsapss", .id = TPM2_ALG_RSAPSS, .flags = tpm2_alg_util_flags_sig },
-        { .name = "ecdsa", .id = TPM2_ALG_ECDSA, .flags = tpm2_alg_util_flags_sig },
-        { .name = "ecdaa", .id = TPM2_ALG_ECDAA, .flags = tpm2_alg_util_flags_sig },
-        { .name = "ecschnorr", .id = TPM2_ALG_ECSCHNORR, .flags = tpm2_alg_util_flags_sig },
-
-        // Assyemtric Encryption Scheme
-        { .name = "oaep", .id = TPM2_ALG_OAEP, .flags = tpm2_alg_util_flags_enc_scheme | tpm2_alg_util_flags_rsa_scheme },
-        { .name = "rsaes", .id = TPM2_ALG_RSAES, .flags = tpm2_alg_util_flags_enc_scheme | tpm2_alg_util_flags_rsa_scheme },
-        { .name = "ecdh", .id = TPM2_ALG_ECDH, .flags = tpm2_alg_util_flags_enc_scheme },
-
-
-        // XXX are these sigs?
-        { .name = "sm2", .id = TPM2_ALG_SM2, .flags = tpm2_alg_util_flags_sig },
-        { .name = "sm4", .id = TPM2_ALG_SM4, .flags = tpm2_alg_util_flags_sig },
-
-        // Key derivation functions
-        { .name = "kdf1_sp800_56a", .id = TPM2_ALG_KDF1_SP800_56A, .flags = tpm2_alg_util_flags_kdf },
-        { .name = "kdf2", .id = TPM2_ALG_KDF2, .flags = tpm2_alg_util_flags_kdf },
-        { .name = "kdf1_sp800_108", .id = TPM2_ALG_KDF1_SP800_108, .flags = tpm2_alg_util_flags_kdf },
-        { .name = "ecmqv", .id = TPM2_ALG_ECMQV, .flags = tpm2_alg_util_flags_kdf },
-
-        // Modes
-        { .name = "ctr", .id = TPM2_ALG_CTR, .flags = tpm2_alg_util_flags_mode },
-        { .name = "ofb", .id = TPM2_ALG_OFB, .flags = tpm2_alg_util_flags_mode },
-        { .name = "cbc", .id = TPM2_ALG_CBC, .flags = tpm2_alg_util_flags_mode },
-        { .name = "cfb", .id = TPM2_ALG_CFB, .flags = tpm2_alg_util_flags_mode },
-        { .name = "ecb", .id = TPM2_ALG_ECB, .flags = tpm2_alg_util_flags_mode },
-
-        { .name = "symcipher", .id = TPM2_ALG_SYMCIPHER, .flags = tpm2_alg_util_flags_base },
-        { .name = "keyedhash", .id = TPM2_ALG_KEYEDHASH, .flags = tpm2_alg_util_flags_base },
-
-        // Misc
-        { .name = "null", .id = TPM2_ALG_NULL, .flags = tpm2_alg_util_flags_misc | tpm2_alg_util_flags_rsa_scheme },
-    };
+/*
+ * The algorithms indexed by their ID, all IDs in use are below 0x50 so
+ * the table stays small. Entries without a name are no algorithm.
+ */
+static const alg_entry algs[] = {
+
+    // Assymetric
+    [TPM2_ALG_RSA] = { "rsa", tpm2_alg_util_flags_asymmetric|tpm2_alg_util_flags_base },
+    [TPM2_ALG_ECC] = { "ecc", tpm2_alg_util_flags_asymmetric|tpm2_alg_util_flags_base },
+
+    // Symmetric
+    [TPM2_ALG_TDES] = { "tdes", tpm2_alg_util_flags_symmetric },
+    [TPM2_ALG_AES] = { "aes", tpm2_alg_util_flags_symmetric },
+    [TPM2_ALG_CAMELLIA] = { "camellia", tpm2_alg_util_flags_symmetric },
+
+    // Hash
+    [TPM2_ALG_SHA1] = { "sha1", tpm2_alg_util_flags_hash },
+    [TPM2_ALG_SHA256] = { "sha256", tpm2_alg_util_flags_hash },
+    [TPM2_ALG_SHA384] = { "sha384", tpm2_alg_util_flags_hash },
+    [TPM2_ALG_SHA512] = { "sha512", tpm2_alg_util_flags_hash },
+    [TPM2_ALG_SM3_256] = { "sm3_256", tpm2_alg_util_flags_hash },
+    [TPM2_ALG_SHA3_256] = { "sha3_256", tpm2_alg_util_flags_hash },
+    [TPM2_ALG_SHA3_384] = { "sha3_384", tpm2_alg_util_flags_hash },
+    [TPM2_ALG_SHA3_512] = { "sha3_512", tpm2_alg_util_flags_hash },
+
+    // Keyed hash
+    [TPM2_ALG_HMAC] = { "hmac", tpm2_alg_util_flags_keyedhash | tpm2_alg_util_flags_sig },
+    [TPM2_ALG_XOR] = { "xor", tpm2_alg_util_flags_keyedhash },
+    [TPM2_ALG_CMAC] = { "cmac", tpm2_alg_util_flags_sig },
+
+    // Mask Generation Functions
+    [TPM2_ALG_MGF1] = { "mgf1", tpm2_alg_util_flags_mgf },
+
+    // Signature Schemes
+    [TPM2_ALG_RSASSA] = { "rsassa", tpm2_alg_util_flags_sig },
+    [TPM2_ALG_RSAPSS] = { "rsapss", tpm2_alg_util_flags_sig },
+    [TPM2_ALG_ECDSA] = { "ecdsa", tpm2_alg_util_flags_sig },
+    [TPM2_ALG_ECDAA] = { "ecdaa", tpm2_alg_util_flags_sig },
+    [TPM2_ALG_ECSCHNORR] = { "ecschnorr", tpm2_alg_util_flags_sig },
+
+    // Assyemtric Encryption Scheme
+    [TPM2_ALG_OAEP] = { "oaep", tpm2_alg_util_flags_enc_scheme | tpm2_alg_util_flags_rsa_scheme },
+    [TPM2_ALG_RSAES] = { "rsaes", tpm2_alg_util_flags_enc_scheme | tpm2_alg_util_flags_rsa_scheme },
+    [TPM2_ALG_ECDH] = { "ecdh", tpm2_alg_util_flags_enc_scheme },
+
+
+    // XXX are these sigs?
+    [TPM2_ALG_SM2] = { "sm2", tpm2_alg_util_flags_sig },
+    [TPM2_ALG_SM4] = { "sm4", tpm2_alg_util_flags_sig },
+
+    // Key derivation functions
+    [TPM2_ALG_KDF1_SP800_56A] = { "kdf1_sp800_56a", tpm2_alg_util_flags_kdf },
+    [TPM2_ALG_KDF2] = { "kdf2", tpm2_alg_util_flags_kdf },
+    [TPM2_ALG_KDF1_SP800_108] = { "kdf1_sp800_108", tpm2_alg_util_flags_kdf },
+    [TPM2_ALG_ECMQV] = { "ecmqv", tpm2_alg_util_flags_kdf },
+
+    // Modes
+    [TPM2_ALG_CTR] = { "ctr", tpm2_alg_util_flags_mode },
+    [TPM2_ALG_OFB] = { "ofb", tpm2_alg_util_flags_mode },
+    [TPM2_ALG_CBC] = { "cbc", tpm2_alg_util_flags_mode },
+    [TPM2_ALG_CFB] = { "cfb", tpm2_alg_util_flags_mode },
+    [TPM2_ALG_ECB] = { "ecb", tpm2_alg_util_flags_mode },
+
+    [TPM2_ALG_SYMCIPHER] = { "symcipher", tpm2_alg_util_flags_base },
+    [TPM2_ALG_KEYEDHASH] = { "keyedhash", tpm2_alg_util_flags_base },
+
+    // Misc
+    [TPM2_ALG_NULL] = { "null", tpm2_alg_util_flags_misc | tpm2_alg_util_flags_rsa_scheme },
+};
+
+/*
+ * The names of the algorithms above for a binary search on a name. The
+ * order of this table MUST be the strcmp() order of the names!
+ */
+static const alg_name alg_names[] = {
+    { "aes", TPM2_ALG_AES },
+    { "camellia", TPM2_ALG_CAMELLIA },
+    { "cbc", TPM2_ALG_CBC },
+    { "cfb", TPM2_ALG_CFB },
+    { "cmac", TPM2_ALG_CMAC },
+    { "ctr", TPM2_ALG_CTR },
+    { "ecb", TPM2_ALG_ECB },
+    { "ecc", TPM2_ALG_ECC },
+    { "ecdaa", TPM2_ALG_ECDAA },
+    { "ecdh", TPM2_ALG_ECDH },
+    { "ecdsa", TPM2_ALG_ECDSA },
+    { "ecmqv", TPM2_ALG_ECMQV },
+    { "ecschnorr", TPM2_ALG_ECSCHNORR },
+    { "hmac", TPM2_ALG_HMAC },
+    { "kdf1_sp800_108", TPM2_ALG_KDF1_SP800_108 },
+    { "kdf1_sp800_56a", TPM2_ALG_KDF1_SP800_56A },
+    { "kdf2", TPM2_ALG_KDF2 },
+    { "keyedhash", TPM2_ALG_KEYEDHASH },
+    { "mgf1", TPM2_ALG_MGF1 },
+    { "null", TPM2_ALG_NULL },
+    { "oaep", TPM2_ALG_OAEP },
+    { "ofb", TPM2_ALG_OFB },
+    { "rsa", TPM2_ALG_RSA },
+    { "rsaes", TPM2_ALG_RSAES },
+    { "rsapss", TPM2_ALG_RSAPSS },
+    { "rsassa", TPM2_ALG_RSASSA },
+    { "sha1", TPM2_ALG_SHA1 },
+    { "sha256", TPM2_ALG_SHA256 },
+    { "sha384", TPM2_ALG_SHA384 },
+    { "sha3_256", TPM2_ALG_SHA3_256 },
+    { "sha3_384", TPM2_ALG_SHA3_384 },
+    { "sha3_512", TPM2_ALG_SHA3_512 },
+    { "sha512", TPM2_ALG_SHA512 },
+    { "sm2", TPM2_ALG_SM2 },
+    { "sm3_256", TPM2_ALG_SM3_256 },
+    { "sm4", TPM2_ALG_SM4 },
+    { "symcipher", TPM2_ALG_SYMCIPHER },
+    { "tdes", TPM2_ALG_TDES },
+    { "xor", TPM2_ALG_XOR },
+};
+
+static const alg_entry *alg_from_id(TPM2_ALG_ID id) {
+
+    if (id >= ARRAY_LEN(algs) || !algs[id].name) {
+        return NULL;
+    }
+
+    return &algs[id];
+}
+
+static int compare_alg_name(const void *key, const void *entry) {
+
+    return strcmp((const char *) key, ((const alg_name *) entry)->name);
+}
+
+static const alg_name *alg_from_name(const char *name) {
+
+    return bsearch(name, alg_names, ARRAY_LEN(alg_names),
+            sizeof(alg_names[0]), compare_alg_name);
+}
+
+typedef struct key_size key_size;
+struct key_size {
+    const char *name;
+    UINT16 value;
+};
+
+static const key_size rsa_key_sizes[] = {
+    { "1024", 1024 },
+    { "2048", 2048 },
+    { "3072", 3072 },
+    { "4096", 4096 },
+};
+
+static const key_size ecc_curves[] = {
+    { "192", TPM2_ECC_NIST_P192 },
+    { "224", TPM2_ECC_NIST_P224 },
+    { "256", TPM2_ECC_NIST_P256 },
+    { "384", TPM2_ECC_NIST_P384 },
+    { "521", TPM2_ECC_NIST_P521 },
+};
+
+/* the key size extension is consumed as a whole or not at all */
+static bool key_size_lookup(const key_size *sizes, size_t count,
+        const char *ext, UINT16 *value) {
 
     size_t i;
-    for (i = 0; i < ARRAY_LEN(algs); i++) {
-        const alg_pair *alg = &algs[i];
-        alg_iter_res result = iterator(alg->id, alg->name, alg->flags,
-                userdata);
-        if (result != go) {
-            return;
+    for (i = 0; i < count; i++) {
+        if (!strcmp(ext, sizes[i].name)) {
+            *value = sizes[i].value;
+            return true;
         }
     }
+
+    return false;
 }
 
 static alg_parser_rc handle_sym_common(const char *ext, TPMT_SYM_DEF_OBJECT *s) {
@@ -292,25 +381,10 @@ static alg_parser_rc handle_rsa(const char *ext, TPM2B_PUBLIC *public) {
         ext = "2048";
     }
 
-    // Deal with bit size
-    if (!strncmp(ext, "1024", 4)) {
-        r->keyBits = 1024;
-        ext += 4;
-    } else if (!strncmp(ext, "2048", 4)) {
-        r->keyBits = 2048;
-        ext += 4;
-    } else if (!strncmp(ext, "4096", 4)) {
-        r->keyBits = 4096;
-        ext += 4;
-    } else if (!strncmp(ext, "3072", 4)) {
-        r->keyBits = 3072;
-        ext += 4;
-    } else {
-        r->keyBits = 2048;
-    }
+    bool result = key_size_lookup(rsa_key_sizes, ARRAY_LEN(rsa_key_sizes), ext,
+            &r->keyBits);
 
-    /* rsa extension should be consumed at this point */
-    return ext[0] == '\0' ? alg_parser_rc_continue : alg_parser_rc_error;
+    return result ? alg_parser_rc_continue : alg_parser_rc_error;
 }
 
 static alg_parser_rc handle_ecc(const char *ext, TPM2B_PUBLIC *public) {
@@ -325,27 +399,10 @@ static alg_parser_rc handle_ecc(const char *ext, TPM2B_PUBLIC *public) {
     TPMS_ECC_PARMS *e = &public->publicArea.parameters.eccDetail;
     e->kdf.scheme = TPM2_ALG_NULL;
 
-    if (!strncmp(ext, "192", 3)) {
-        e->curveID = TPM2_ECC_NIST_P192;
-        ext += 3;
-    } else if (!strncmp(ext, "224", 3)) {
-        e->curveID = TPM2_ECC_NIST_P224;
-        ext += 3;
-    } else if (!strncmp(ext, "256", 3)) {
-        e->curveID = TPM2_ECC_NIST_P256;
-        ext += 3;
-    } else if (!strncmp(ext, "384", 3)) {
-        e->curveID = TPM2_ECC_NIST_P384;
-        ext += 3;
-    } else if (!strncmp(ext, "521", 3)) {
-        e->curveID = TPM2_ECC_NIST_P521;
-        ext += 3;
-    } else {
-        e->curveID = TPM2_ECC_NIST_P256;
-    }
+    bool result = key_size_lookup(ecc_curves, ARRAY_LEN(ecc_curves), ext,
+            &e->curveID);
 
-    /* ecc extension should be consumed at this point */
-    return ext[0] == '\0' ? alg_parser_rc_continue : alg_parser_rc_error;
+    return result ? alg_parser_rc_continue : alg_parser_rc_error;
 }
 
 static alg_parser_rc handle_aes(const char *ext, TPM2B_PUBLIC *public) {
@@ -595,6 +652,85 @@ bool tpm2_alg_util_handle_ext_alg(const char *alg_spec, TPM2B_PUBLIC *public) {
     return false;
 }
 
+static bool algs_add(TPML_ALG *algs, TPM2_ALG_ID alg) {
+
+    if (alg == TPM2_ALG_NULL || alg == TPM2_ALG_ERROR) {
+        return true;
+    }
+
+    UINT32 i;
+    for (i = 0; i < algs->count; i++) {
+        if (algs->algorithms[i] == alg) {
+            return true;
+        }
+    }
+
+    if (algs->count == ARRAY_LEN(algs->algorithms)) {
+        LOG_ERR("Too many algorithms, got more than %zu",
+                ARRAY_LEN(algs->algorithms));
+        return false;
+    }
+
+    algs->algorithms[algs->count++] = alg;
+
+    return true;
+}
+
+static bool algs_add_symmetric(TPML_ALG *algs, const TPMT_SYM_DEF_OBJECT *sym) {
+
+    return algs_add(algs, sym->algorithm)
+            && (sym->algorithm == TPM2_ALG_NULL
+                    || sym->algorithm == TPM2_ALG_XOR
+                    || algs_add(algs, sym->mode.sym));
+}
+
+bool tpm2_alg_util_public_algs(const TPM2B_PUBLIC *public, TPML_ALG *algs) {
+
+    const TPMT_PUBLIC *p = &public->publicArea;
+    bool result = algs_add(algs, p->type) && algs_add(algs, p->nameAlg);
+
+    switch (p->type) {
+    case TPM2_ALG_RSA: {
+        const TPMS_RSA_PARMS *r = &p->parameters.rsaDetail;
+        return result && algs_add_symmetric(algs, &r->symmetric)
+                && algs_add(algs, r->scheme.scheme)
+                && (r->scheme.scheme == TPM2_ALG_NULL
+                        || r->scheme.scheme == TPM2_ALG_RSAES
+                        || algs_add(algs, r->scheme.details.anySig.hashAlg));
+    }
+    case TPM2_ALG_ECC: {
+        const TPMS_ECC_PARMS *e = &p->parameters.eccDetail;
+        return result && algs_add_symmetric(algs, &e->symmetric)
+                && algs_add(algs, e->scheme.scheme)
+                && (e->scheme.scheme == TPM2_ALG_NULL
+                        || algs_add(algs, e->scheme.details.anySig.hashAlg))
+                && algs_add(algs, e->kdf.scheme)
+                && (e->kdf.scheme == TPM2_ALG_NULL
+                        || algs_add(algs, e->kdf.details.mgf1.hashAlg));
+    }
+    case TPM2_ALG_KEYEDHASH: {
+        const TPMT_KEYEDHASH_SCHEME *k =
+                &p->parameters.keyedHashDetail.scheme;
+        if (!result || !algs_add(algs, k->scheme)) {
+            return false;
+        }
+        if (k->scheme == TPM2_ALG_HMAC) {
+            return algs_add(algs, k->details.hmac.hashAlg);
+        }
+        if (k->scheme == TPM2_ALG_XOR) {
+            return algs_add(algs, k->details.exclusiveOr.hashAlg)
+                    && algs_add(algs, k->details.exclusiveOr.kdf);
+        }
+        return true;
+    }
+    case TPM2_ALG_SYMCIPHER:
+        return result
+                && algs_add_symmetric(algs, &p->parameters.symDetail.sym);
+    default:
+        return result;
+    }
+}
+
 tool_rc tpm2_alg_util_handle_rsa_ext_alg(const char *alg_spec,
     TPM2B_PUBLIC *public) {
 
@@ -621,62 +757,32 @@ tool_rc tpm2_alg_util_handle_rsa_ext_alg(const char *alg_spec,
     return result ? tool_rc_success : tool_rc_general_error;
 }
 
-static alg_iter_res find_match(TPM2_ALG_ID id, const char *name,
-        tpm2_alg_util_flags flags, void *userdata) {
-
-    alg_pair *search_data = (alg_pair *) userdata;
-
-    /*
-     * if name, then search on name, else
-     * search by id.
-     */
-    if (search_data->name && !strcmp(search_data->name, name)) {
-        alg_iter_res res = search_data->flags & flags ? found : stop;
-        if (res == found) {
-            search_data->id = id;
-            search_data->_flags = flags;
-        }
-        return res;
-    } else if (search_data->id == id) {
-        alg_iter_res res = search_data->flags & flags ? found : stop;
-        if (res == found) {
-            search_data->name = name;
-            search_data->_flags = flags;
-        }
-        return res;
-    }
-
-    return go;
-}
-
 TPM2_ALG_ID tpm2_alg_util_strtoalg(const char *name, tpm2_alg_util_flags flags) {
 
-    alg_pair userdata = { .name = name, .id = TPM2_ALG_ERROR, .flags = flags };
+    if (!name) {
+        return TPM2_ALG_ERROR;
+    }
 
-    if (name) {
-        tpm2_alg_util_for_each_alg(find_match, &userdata);
+    const alg_name *n = alg_from_name(name);
+    if (!n || !(algs[n->id].flags & flags)) {
+        return TPM2_ALG_ERROR;
     }
 
-    return userdata.id;
+    return n->id;
 }
 
 const char *tpm2_alg_util_algtostr(TPM2_ALG_ID id, tpm2_alg_util_flags flags) {
 
-    alg_pair userdata = { .name = NULL, .id = id, .flags = flags };
-
-    tpm2_alg_util_for_each_alg(find_match, &userdata);
+    const alg_entry *alg = alg_from_id(id);
 
-    return userdata.name;
+    return alg && (alg->flags & flags) ? alg->name : NULL;
 }
 
 tpm2_alg_util_flags tpm2_alg_util_algtoflags(TPM2_ALG_ID id) {
 
-    alg_pair userdata = { .name = NULL, .id = id, .flags =
-            tpm2_alg_util_flags_any, ._flags = tpm2_alg_util_flags_none };
-
-    tpm2_alg_util_for_each_alg(find_match, &userdata);
+    const alg_entry *alg = alg_from_id(id);
 
-    return userdata._flags;
+    return alg ? alg->flags : tpm2_alg_util_flags_none;
 }
 
 TPM2_ALG_ID tpm2_alg_util_from_optarg(const char *optarg,
@@ -713,17 +819,206 @@ UINT16 tpm2_alg_util_get_hash_size(TPMI_ALG_HASH id) {
     return 0;
 }
 
-static const char *hex_to_byte_err(int rc) {
+typedef struct alg_name_key alg_name_key;
+struct alg_name_key {
+    const char *name;
+    size_t len;
+};
+
+static int compare_alg_name_len(const void *key, const void *entry) {
+
+    const alg_name_key *k = key;
+    const char *name = ((const alg_name *) entry)->name;
+
+    int rc = strncmp(k->name, name, k->len);
+
+    /* a key that is a prefix of the name sorts before it */
+    return rc ? rc : -(int) (unsigned char) name[k->len];
+}
+
+/* looks up a hash algorithm in the text without a terminating NUL byte */
+static TPM2_ALG_ID hash_alg_from_text(const char *text, size_t len) {
 
-    switch (rc) {
-    case -2:
-        return "String not even in length";
-    case -3:
-        return "Non hex digit found";
-    case -4:
-        return "Hex value too big for digest";
+    if (!len) {
+        return TPM2_ALG_ERROR;
     }
-    return "unknown";
+
+    /* a numerical id is short, it goes through the NUL terminated parsing */
+    if (isdigit((unsigned char) text[0])) {
+        char id[sizeof("0xFFFF")];
+        if (len >= sizeof(id)) {
+            return TPM2_ALG_ERROR;
+        }
+        memcpy(id, text, len);
+        id[len] = '\0';
+        return tpm2_alg_util_from_optarg(id, tpm2_alg_util_flags_hash);
+    }
+
+    alg_name_key key = { .name = text, .len = len };
+    const alg_name *n = bsearch(&key, alg_names, ARRAY_LEN(alg_names),
+            sizeof(alg_names[0]), compare_alg_name_len);
+    if (!n || !(algs[n->id].flags & tpm2_alg_util_flags_hash)) {
+        return TPM2_ALG_ERROR;
+    }
+
+    return n->id;
+}
+
+static bool is_digest_separator(char c) {
+
+    return c == ',' || isspace((unsigned char) c);
+}
+
+static size_t token_len(const char *p, const char *end) {
+
+    const char *t = p;
+    while (t < end && !is_digest_separator(*t)) {
+        t++;
+    }
+
+    return t - p;
+}
+
+int tpm2_alg_util_digest_next(const char **cursor, const char *end,
+        TPMT_HA *digest) {
+
+    const char *p = *cursor;
+
+    /* the separators and comments before the digest */
+    while (p < end) {
+        if (*p == '#') {
+            const char *eol = memchr(p, '\n', end - p);
+            p = eol ? eol : end;
+        } else if (is_digest_separator(*p)) {
+            p++;
+        } else {
+            break;
+        }
+    }
+
+    *cursor = p;
+    if (p == end) {
+        return 0;
+    }
+
+    const char *alg = p;
+    while (p < end && (isalnum((unsigned char) *p) || *p == '_')) {
+        p++;
+    }
+    size_t alg_len = p - alg;
+
+    if (p == end || *p != '=') {
+        LOG_ERR("Expecting = in <hash alg>=<hash value> spec, got: \"%.*s\"",
+                (int) token_len(alg, end), alg);
+        return -1;
+    }
+    p++;
+
+    TPM2_ALG_ID halg = hash_alg_from_text(alg, alg_len);
+    if (halg == TPM2_ALG_ERROR) {
+        LOG_ERR("Could not convert algorithm, got: \"%.*s\"", (int) alg_len,
+                alg);
+        return -1;
+    }
+
+    if (end - p >= 2 && p[0] == '0' && p[1] == 'x') {
+        p += 2;
+    }
+
+    size_t hex_len = token_len(p, end);
+    UINT16 expected_hash_size = tpm2_alg_util_get_hash_size(halg);
+    if (hex_len & 1) {
+        LOG_ERR("Error \"String not even in length\" converting hex string as"
+                " data, got: \"%.*s\"", (int) hex_len, p);
+        return -1;
+    }
+
+    if (hex_len / 2 != expected_hash_size) {
+        LOG_ERR("Algorithm \"%.*s\" expects a size of %u bytes, got: %zu",
+                (int) alg_len, alg, expected_hash_size, hex_len / 2);
+        return -1;
+    }
+
+    if (!tpm2_hex_decode(p, hex_len, (BYTE *) &digest->digest)) {
+        LOG_ERR("Error \"Non hex digit found\" converting hex string as data,"
+                " got: \"%.*s\"", (int) hex_len, p);
+        return -1;
+    }
+    digest->hashAlg = halg;
+
+    *cursor = p + hex_len;
+
+    return 1;
+}
+
+bool tpm2_alg_util_digest_list_load(const char *path, TPMI_ALG_HASH *halg,
+        TPM2B_DIGEST **digests, size_t *count) {
+
+    *digests = NULL;
+    *count = 0;
+
+    files_input input;
+    if (!files_input_open(&input, strcmp(path, "-") ? path : NULL)) {
+        return false;
+    }
+
+    const UINT8 *data;
+    size_t size;
+    bool result = files_input_read_all(&input, &data, &size);
+
+    const char *text = (const char *) data;
+    const char *cursor = text;
+    size_t capacity = 0;
+    while (result) {
+        TPMT_HA digest;
+        int rc = tpm2_alg_util_digest_next(&cursor, text + size, &digest);
+        if (rc <= 0) {
+            result = !rc;
+            break;
+        }
+
+        if (!*count) {
+            *halg = digest.hashAlg;
+        } else if (digest.hashAlg != *halg) {
+            LOG_ERR("All digests of a digest list should be of one algorithm");
+            result = false;
+            break;
+        }
+
+        if (*count == capacity) {
+            capacity = capacity ? capacity * 2 : 64;
+            TPM2B_DIGEST *tmp = realloc(*digests, capacity * sizeof(*tmp));
+            if (!tmp) {
+                LOG_ERR("oom");
+                result = false;
+                break;
+            }
+            *digests = tmp;
+        }
+
+        TPM2B_DIGEST *d = &(*digests)[(*count)++];
+        d->size = tpm2_alg_util_get_hash_size(digest.hashAlg);
+        memcpy(d->buffer, &digest.digest, d->size);
+    }
+
+    if (!result && data) {
+        size_t line = 1;
+        const char *p;
+        for (p = text; p < cursor; p++) {
+            line += *p == '\n';
+        }
+        LOG_ERR("%s:%zu: Invalid digest list", path, line);
+    }
+
+    files_input_close(&input);
+
+    if (!result) {
+        free(*digests);
+        *digests = NULL;
+        *count = 0;
+    }
+
+    return result;
 }
 
 bool pcr_parse_digest_list(char **argv, int len,
@@ -740,8 +1035,9 @@ bool pcr_parse_digest_list(char **argv, int len,
         UINT32 count = 0;
 
         /*
-         * Split <pcr index>:<hash alg>=<hash value>,... on : and separate with null byte, ie:
-         * <pce index> '\0' <hash alg>'\0'<data>
+         * Split <pcr index>:<hash alg>=<hash value>,... on : and separate
+         * the pcr index with a null byte, ie:
+         * <pcr index> '\0' <hash alg>=<hash value>,...
          *
          * Start by splitting out the pcr index, and validating it.
          */
@@ -764,72 +1060,23 @@ bool pcr_parse_digest_list(char **argv, int len,
             return false;
         }
 
-        /* now that the pcr_index is removed, parse the remaining <hash_name>=<hash_value>,.. */
-        char *digest_hash_tok;
-        char *save_ptr = NULL;
-
-        /* keep track of digests we have seen */
-
-        while ((digest_hash_tok = strtok_r(digest_spec_str, ",", &save_ptr))) {
-            digest_spec_str = NULL;
-
+        /* the remaining <hash_name>=<hash_value>,.. in a single pass */
+        const char *cursor = digest_spec_str;
+        const char *end = digest_spec_str + strlen(digest_spec_str);
+        TPMT_HA d;
+        int rc;
+        while ((rc = tpm2_alg_util_digest_next(&cursor, end, &d)) > 0) {
             if (count >= ARRAY_LEN(dspec->digests.digests)) {
                 LOG_ERR("Specified too many digests per spec, max is: %zu",
                         ARRAY_LEN(dspec->digests.digests));
                 return false;
             }
 
-            TPMT_HA *d = &dspec->digests.digests[count];
-
-            char *stralg = digest_hash_tok;
-            char *split = strchr(digest_hash_tok, '=');
-            if (!split) {
-                LOG_ERR("Expecting = in <hash alg>=<hash value> spec, got: "
-                        "\"%s\"", digest_hash_tok);
-                return false;
-            }
-            *split = '\0';
-            split++;
-
-            char *data = split;
-
-            /*
-             * Convert and validate the hash algorithm. It should be a hash algorithm
-             */
-            TPM2_ALG_ID alg = tpm2_alg_util_from_optarg(stralg,
-                    tpm2_alg_util_flags_hash);
-            if (alg == TPM2_ALG_ERROR) {
-                LOG_ERR("Could not convert algorithm, got: \"%s\"", stralg);
-                return false;
-            }
-
-            d->hashAlg = alg;
-
-            /* fill up the TPMT_HA structure with algorithm and digest */
-            BYTE *digest_data = (BYTE *) &d->digest;
-
-            UINT16 expected_hash_size = tpm2_alg_util_get_hash_size(alg);
-            /* strip any preceding hex on the data as tpm2_util_hex_to_byte_structure doesn't support it */
-            bool is_hex = !strncmp("0x", data, 2);
-            if (is_hex) {
-                data += 2;
-            }
-
-            UINT16 size = expected_hash_size;
-            int rc = tpm2_util_hex_to_byte_structure(data, &size, digest_data);
-            if (rc) {
-                LOG_ERR("Error \"%s\" converting hex string as data, got:"
-                        " \"%s\"", hex_to_byte_err(rc), data);
-                return false;
-            }
-
-            if (expected_hash_size != size) {
-                LOG_ERR("Algorithm \"%s\" expects a size of %u bytes, got: %u",
-                        stralg, expected_hash_size, size);
-                return false;
-            }
+            dspec->digests.digests[count++] = d;
+        }
 
-            count++;
+        if (rc < 0) {
+            return false;
         }
 
         if (!count) {
@@ -73,6 +73,41 @@ struct tpm2_pcr_digest_spec {
     TPMI_DH_PCR pcr_index;
 };
 
+/**
+ * Parses the next <hash alg>=<hash value> of a digest list, in a single pass
+ * over text that is neither copied nor modified and need not be NUL
+ * terminated. The digests are separated by commas or white space and a #
+ * comments out the rest of a line. The hash value may have a 0x prefix.
+ * @param cursor
+ *  The position to parse from, advanced past the parsed digest.
+ * @param end
+ *  The end of the text.
+ * @param digest
+ *  Receives the digest.
+ * @return
+ *  1 if a digest was parsed, 0 at the end of the text and -1 on an error,
+ *  logged via LOG_ERR.
+ */
+int tpm2_alg_util_digest_next(const char **cursor, const char *end,
+        TPMT_HA *digest);
+
+/**
+ * Loads a digest list of any length, as parsed by tpm2_alg_util_digest_next(),
+ * with all digests of one hash algorithm.
+ * @param path
+ *  The file of the list, - for stdin.
+ * @param halg
+ *  Receives the hash algorithm of the digests, unset for an empty list.
+ * @param digests
+ *  Receives the digests, to be released with free().
+ * @param count
+ *  Receives the number of digests.
+ * @return
+ *  True on success, false otherwise.
+ */
+bool tpm2_alg_util_digest_list_load(const char *path, TPMI_ALG_HASH *halg,
+        TPM2B_DIGEST **digests, size_t *count);
+
 /**
  * Parses an argv array that contains a digest specification at each location
  * within argv.
@@ -85,6 +120,8 @@ struct tpm2_pcr_digest_spec {
  *         strtoul with a base of 0.
  *       - An equals sign
  *       - The hex hash value,
+ *   with the algorithm hash specifications parsed by
+ *   tpm2_alg_util_digest_next().
  *
  *   This all distills to a string that looks like this:
  *   <pcr index>:<hash alg id>=<hash value>
@@ -162,6 +199,19 @@ tool_rc tpm2_alg_util_get_signature_scheme(ESYS_CONTEXT *context,
  */
 bool tpm2_alg_util_handle_ext_alg(const char *alg_spec, TPM2B_PUBLIC *public);
 
+/**
+ * Adds the algorithms an object of a public area uses, ie its type, name
+ * hash, schemes, symmetric algorithm and mode and their hashes, to a list,
+ * skipping TPM2_ALG_NULL and those already in the list.
+ * @param public
+ *  The public area, ie from tpm2_alg_util_handle_ext_alg().
+ * @param algs
+ *  The list to add to.
+ * @return
+ *  true on success, false if the list is full.
+ */
+bool tpm2_alg_util_public_algs(const TPM2B_PUBLIC *public, TPML_ALG *algs);
+
 /**
  * Retrieves the scheme information for an RSA key to be used in
  * TPM2_CC_RSA_Encrypt or TPM2_CC_RSA_Decrypt
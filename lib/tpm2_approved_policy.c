@@ -0,0 +1,283 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+#include <errno.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <tss2/tss2_mu.h>
+
+#include "files.h"
+#include "log.h"
+#include "tpm2_approved_policy.h"
+#include "tpm2_util.h"
+
+#define APPROVED_POLICY_VERSION 1
+
+/* the store is read whole, so keep it from growing without bounds */
+#define APPROVED_POLICY_MAX 1024
+
+typedef struct approved_policy_entry approved_policy_entry;
+struct approved_policy_entry {
+    tpm2_approved_policy_key key;
+    TPMT_TK_VERIFIED ticket;
+};
+
+typedef struct approved_policy_store approved_policy_store;
+struct approved_policy_store {
+    UINT32 reset_count;
+    UINT32 restart_count;
+    UINT32 count;
+    approved_policy_entry entries[APPROVED_POLICY_MAX];
+};
+
+static bool read_2b(FILE *f, UINT8 *buffer, size_t max, UINT16 *size) {
+
+    return files_read_16(f, size) && *size <= max
+            && files_read_bytes(f, buffer, *size);
+}
+
+static bool write_2b(FILE *f, const UINT8 *buffer, UINT16 size) {
+
+    return files_write_16(f, size)
+            && files_write_bytes(f, (UINT8 *) buffer, size);
+}
+
+static bool read_entry(FILE *f, approved_policy_entry *e) {
+
+    tpm2_approved_policy_key *k = &e->key;
+    UINT8 ticket[sizeof(TPMT_TK_VERIFIED)];
+    UINT16 ticket_size = 0;
+    bool result = read_2b(f, k->approved_policy.buffer,
+                    sizeof(k->approved_policy.buffer), &k->approved_policy.size)
+            && read_2b(f, k->policy_ref.buffer, sizeof(k->policy_ref.buffer),
+                    &k->policy_ref.size)
+            && read_2b(f, k->signer_name.name, sizeof(k->signer_name.name),
+                    &k->signer_name.size)
+            && read_2b(f, ticket, sizeof(ticket), &ticket_size);
+    if (!result) {
+        return false;
+    }
+
+    size_t offset = 0;
+    TSS2_RC rval = Tss2_MU_TPMT_TK_VERIFIED_Unmarshal(ticket, ticket_size,
+            &offset, &e->ticket);
+
+    return rval == TSS2_RC_SUCCESS;
+}
+
+static bool write_entry(FILE *f, const approved_policy_entry *e) {
+
+    const tpm2_approved_policy_key *k = &e->key;
+    UINT8 ticket[sizeof(TPMT_TK_VERIFIED)];
+    size_t offset = 0;
+    TSS2_RC rval = Tss2_MU_TPMT_TK_VERIFIED_Marshal(&e->ticket, ticket,
+            sizeof(ticket), &offset);
+    if (rval != TSS2_RC_SUCCESS) {
+        LOG_PERR(Tss2_MU_TPMT_TK_VERIFIED_Marshal, rval);
+        return false;
+    }
+
+    return write_2b(f, k->approved_policy.buffer, k->approved_policy.size)
+            && write_2b(f, k->policy_ref.buffer, k->policy_ref.size)
+            && write_2b(f, k->signer_name.name, k->signer_name.size)
+            && write_2b(f, ticket, offset);
+}
+
+static bool key_equal(const tpm2_approved_policy_key *a,
+        const tpm2_approved_policy_key *b) {
+
+    return a->approved_policy.size == b->approved_policy.size
+            && !memcmp(a->approved_policy.buffer, b->approved_policy.buffer,
+                    a->approved_policy.size)
+            && a->policy_ref.size == b->policy_ref.size
+            && !memcmp(a->policy_ref.buffer, b->policy_ref.buffer,
+                    a->policy_ref.size)
+            && a->signer_name.size == b->signer_name.size
+            && !memcmp(a->signer_name.name, b->signer_name.name,
+                    a->signer_name.size);
+}
+
+/*
+ * Reads the entries of the store. A missing store, one of another epoch or a
+ * damaged one holds no entries. Without a clock the epoch of the file is
+ * kept, for dropping an entry.
+ */
+static void store_load(const char *path, const TPMS_CLOCK_INFO *clock_info,
+        approved_policy_store *store) {
+
+    store->count = 0;
+    if (clock_info) {
+        store->reset_count = clock_info->resetCount;
+        store->restart_count = clock_info->restartCount;
+    }
+
+    FILE *f = files_fopen(path, "rb");
+    if (!f) {
+        if (errno != ENOENT) {
+            LOG_WARN("Could not open approved-policy store \"%s\", error: %s",
+                    path, strerror(errno));
+        }
+        return;
+    }
+
+    UINT32 version = 0;
+    UINT32 reset_count = 0;
+    UINT32 restart_count = 0;
+    UINT32 count = 0;
+    bool result = files_read_header(f, &version)
+            && version == APPROVED_POLICY_VERSION
+            && files_read_32(f, &reset_count)
+            && files_read_32(f, &restart_count)
+            && files_read_32(f, &count)
+            && count <= ARRAY_LEN(store->entries);
+
+    bool is_epoch = result && (!clock_info
+            || (reset_count == store->reset_count
+                    && restart_count == store->restart_count));
+    if (is_epoch) {
+        store->reset_count = reset_count;
+        store->restart_count = restart_count;
+    }
+
+    UINT32 i;
+    for (i = 0; is_epoch && result && i < count; i++) {
+        result = read_entry(f, &store->entries[i]);
+    }
+
+    fclose(f);
+
+    if (result && is_epoch) {
+        store->count = count;
+    } else if (!result) {
+        LOG_INFO("Approved-policy store \"%s\" is damaged, dropping it",
+                path);
+    }
+}
+
+static bool store_save(const char *path, const approved_policy_store *store) {
+
+    files_atomic atomic;
+    FILE *f = files_atomic_fopen(&atomic, path);
+    if (!f) {
+        return false;
+    }
+
+    bool result = files_write_header(f, APPROVED_POLICY_VERSION)
+            && files_write_32(f, store->reset_count)
+            && files_write_32(f, store->restart_count)
+            && files_write_32(f, store->count);
+
+    UINT32 i;
+    for (i = 0; result && i < store->count; i++) {
+        result = write_entry(f, &store->entries[i]);
+    }
+
+    if (!files_atomic_close(&atomic, f, result)) {
+        LOG_ERR("Could not write approved-policy store \"%s\"", path);
+        return false;
+    }
+
+    return true;
+}
+
+/* drops the entry of a key, returning whether there was one */
+static bool store_drop(approved_policy_store *store,
+        const tpm2_approved_policy_key *key) {
+
+    UINT32 i;
+    for (i = 0; i < store->count; i++) {
+        if (key_equal(&store->entries[i].key, key)) {
+            store->count--;
+            memmove(&store->entries[i], &store->entries[i + 1],
+                    (store->count - i) * sizeof(store->entries[0]));
+            return true;
+        }
+    }
+
+    return false;
+}
+
+bool tpm2_approved_policy_put(const char *path,
+        const TPMS_CLOCK_INFO *clock_info, const tpm2_approved_policy_key *key,
+        const TPMT_TK_VERIFIED *ticket) {
+
+    if (ticket->hierarchy == TPM2_RH_NULL || !ticket->digest.size) {
+        LOG_ERR("The NULL hierarchy does not produce a verification ticket "
+                "to store");
+        return false;
+    }
+
+    approved_policy_store *store = malloc(sizeof(*store));
+    if (!store) {
+        LOG_ERR("oom");
+        return false;
+    }
+
+    store_load(path, clock_info, store);
+    store_drop(store, key);
+
+    /* make room by dropping the oldest entry */
+    if (store->count == ARRAY_LEN(store->entries)) {
+        store_drop(store, &store->entries[0].key);
+    }
+
+    approved_policy_entry *e = &store->entries[store->count++];
+    e->key = *key;
+    e->ticket = *ticket;
+
+    bool result = store_save(path, store);
+    free(store);
+
+    return result;
+}
+
+bool tpm2_approved_policy_get(const char *path,
+        const TPMS_CLOCK_INFO *clock_info, const tpm2_approved_policy_key *key,
+        TPMT_TK_VERIFIED *ticket) {
+
+    approved_policy_store *store = malloc(sizeof(*store));
+    if (!store) {
+        LOG_ERR("oom");
+        return false;
+    }
+
+    store_load(path, clock_info, store);
+
+    bool result = false;
+    UINT32 i;
+    for (i = 0; i < store->count; i++) {
+        if (key_equal(&store->entries[i].key, key)) {
+            *ticket = store->entries[i].ticket;
+            result = true;
+            break;
+        }
+    }
+
+    free(store);
+
+    return result;
+}
+
+bool tpm2_approved_policy_remove(const char *path,
+        const tpm2_approved_policy_key *key) {
+
+    approved_policy_store *store = malloc(sizeof(*store));
+    if (!store) {
+        LOG_ERR("oom");
+        return false;
+    }
+
+    store_load(path, NULL, store);
+
+    bool result = true;
+    if (store_drop(store, key)) {
+        result = store_save(path, store);
+    }
+
+    free(store);
+
+    return result;
+}
@@ -0,0 +1,75 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+#ifndef LIB_TPM2_APPROVED_POLICY_H_
+#define LIB_TPM2_APPROVED_POLICY_H_
+
+#include <stdbool.h>
+
+#include <tss2/tss2_tpm2_types.h>
+
+/*
+ * An approved-policy store keeps the verification tickets of the signatures
+ * over approved policies in a file, so that a later PolicyAuthorize of the
+ * same approved policy skips the VerifySignature that produced the ticket.
+ *
+ * A ticket is for the approved policy, the policyRef and the name of the key
+ * that verified the signature, the key of an entry. The whole store is valid
+ * for the reset and restart counts of the TPM it was written with, a TPM
+ * Reset or Restart starts it empty. As the store does not identify the TPM,
+ * use a separate file for every TPM.
+ */
+typedef struct tpm2_approved_policy_key tpm2_approved_policy_key;
+struct tpm2_approved_policy_key {
+    TPM2B_DIGEST approved_policy;
+    TPM2B_NONCE policy_ref;
+    TPM2B_NAME signer_name;
+};
+
+/**
+ * Adds a verification ticket to the store, replacing the one stored under the
+ * same key, or all of them when the store is of another epoch.
+ * @param path
+ *  The path of the store, which is created if needed.
+ * @param clock_info
+ *  The clock of the TPM, of which the reset and restart counts are the epoch.
+ * @param key
+ *  The approved policy, policyRef and signer name the ticket is for.
+ * @param ticket
+ *  The ticket, of a hierarchy other than the null one.
+ * @return
+ *  True on success, false on error.
+ */
+bool tpm2_approved_policy_put(const char *path,
+        const TPMS_CLOCK_INFO *clock_info, const tpm2_approved_policy_key *key,
+        const TPMT_TK_VERIFIED *ticket);
+
+/**
+ * Looks up the verification ticket stored under a key.
+ * @param path
+ *  The path of the store.
+ * @param clock_info
+ *  The clock of the TPM, the store is empty for another epoch.
+ * @param key
+ *  The approved policy, policyRef and signer name to look up.
+ * @param ticket
+ *  Receives the ticket.
+ * @return
+ *  True if a ticket of the epoch is stored under the key, false otherwise.
+ */
+bool tpm2_approved_policy_get(const char *path,
+        const TPMS_CLOCK_INFO *clock_info, const tpm2_approved_policy_key *key,
+        TPMT_TK_VERIFIED *ticket);
+
+/**
+ * Drops the ticket stored under a key, ie one the TPM did not accept.
+ * @param path
+ *  The path of the store.
+ * @param key
+ *  The key of the ticket.
+ * @return
+ *  True on success, false if the store could not be written.
+ */
+bool tpm2_approved_policy_remove(const char *path,
+        const tpm2_approved_policy_key *key);
+
+#endif /* LIB_TPM2_APPROVED_POLICY_H_ */
@@ -0,0 +1,51 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+#include <stdlib.h>
+
+#include "log.h"
+#include "tpm2_arena.h"
+
+#define ARENA_CAPACITY_MIN 16
+
+static tpm2_arena invocation_arena;
+
+bool tpm2_arena_adopt(tpm2_arena *arena, void *ptr) {
+
+    if (!ptr) {
+        return true;
+    }
+
+    if (arena->count == arena->capacity) {
+        size_t capacity = arena->capacity ?
+                arena->capacity * 2 : ARENA_CAPACITY_MIN;
+        void **ptrs = realloc(arena->ptrs, capacity * sizeof(*ptrs));
+        if (!ptrs) {
+            LOG_ERR("oom");
+            free(ptr);
+            return false;
+        }
+        arena->ptrs = ptrs;
+        arena->capacity = capacity;
+    }
+
+    arena->ptrs[arena->count++] = ptr;
+
+    return true;
+}
+
+void tpm2_arena_release(tpm2_arena *arena) {
+
+    /* newest first, like a stack of allocations */
+    while (arena->count) {
+        free(arena->ptrs[--arena->count]);
+    }
+
+    free(arena->ptrs);
+    arena->ptrs = NULL;
+    arena->capacity = 0;
+}
+
+tpm2_arena *tpm2_arena_invocation(void) {
+
+    return &invocation_arena;
+}
@@ -0,0 +1,49 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+#ifndef LIB_TPM2_ARENA_H_
+#define LIB_TPM2_ARENA_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/*
+ * Owns heap allocations, ie the outputs ESAPI returns, and releases them all
+ * at once. Callers move a result into an arena right after the call that
+ * returned it, so no error path needs to free it.
+ */
+typedef struct tpm2_arena tpm2_arena;
+struct tpm2_arena {
+    void **ptrs;
+    size_t count;
+    size_t capacity;
+};
+
+/**
+ * Moves an allocation into the arena.
+ * @param arena
+ *  The arena to take ownership.
+ * @param ptr
+ *  An allocation released with free(), NULL is ignored.
+ * @return
+ *  true on success. On failure ptr is released right away, so the arena takes
+ *  ownership either way.
+ */
+bool tpm2_arena_adopt(tpm2_arena *arena, void *ptr);
+
+/**
+ * Releases all allocations owned by the arena. The arena can be used again
+ * afterwards.
+ * @param arena
+ *  The arena to release.
+ */
+void tpm2_arena_release(tpm2_arena *arena);
+
+/**
+ * The arena of the running tool. It is released when the tool finishes, after
+ * onstop, also for every tool run by tpm2_batch and tpm2_serve.
+ * @return
+ *  The arena of the tool invocation.
+ */
+tpm2_arena *tpm2_arena_invocation(void);
+
+#endif /* LIB_TPM2_ARENA_H_ */
@@ -269,6 +269,36 @@ static dispatch_table nv_attr_table[] = { // Bit Index
     dispatch_no_arg_add(read_stclear),    // 31
 };
 
+/*
+ * The bit indices of nv_attr_table in the strcmp() order of their names,
+ * for a binary search on an attribute name. Fields are listed by their
+ * first bit and reserved bits not at all.
+ */
+static const UINT8 nv_attr_names[] = {
+    18, /* authread */
+    2,  /* authwrite */
+    27, /* clear_stclear */
+    15, /* globallock */
+    25, /* no_da */
+    4,  /* nt */
+    26, /* orderly */
+    17, /* ownerread */
+    1,  /* ownerwrite */
+    30, /* platformcreate */
+    10, /* policydelete */
+    19, /* policyread */
+    3,  /* policywrite */
+    16, /* ppread */
+    0,  /* ppwrite */
+    31, /* read_stclear */
+    28, /* readlocked */
+    14, /* write_stclear */
+    12, /* writeall */
+    13, /* writedefine */
+    11, /* writelocked */
+    29, /* written */
+};
+
 static bool fixedtpm(TPMA_OBJECT *obj, char *arg) {
 
     UNUSED(arg);
@@ -381,6 +411,21 @@ static dispatch_table obj_attr_table[] = {         // Bit Index
         dispatch_reserved(31),                     // 31
 };
 
+/* the bit indices of obj_attr_table in the strcmp() order of their names */
+static const UINT8 obj_attr_names[] = {
+    7,  /* adminwithpolicy */
+    17, /* decrypt */
+    11, /* encryptedduplication */
+    4,  /* fixedparent */
+    1,  /* fixedtpm */
+    10, /* noda */
+    16, /* restricted */
+    5,  /* sensitivedataorigin */
+    18, /* sign */
+    2,  /* stclear */
+    6,  /* userwithauth */
+};
+
 static bool token_match(const char *name, const char *token, bool has_arg,
         char **sep) {
 
@@ -440,8 +485,41 @@ static dispatch_error handle_dispatch(dispatch_table *d, char *token,
     return result ? dispatch_ok : dispatch_err;
 }
 
+/* finds the entry named exactly like the token, up to an argument */
+static dispatch_table *find_dispatch(dispatch_table *table,
+        const UINT8 *names, size_t count, const char *token) {
+
+    size_t len = strcspn(token, "=");
+
+    size_t low = 0;
+    size_t high = count;
+    while (low < high) {
+        size_t mid = low + (high - low) / 2;
+        dispatch_table *d = &table[names[mid]];
+
+        int rc = strncmp(token, d->name, len);
+        if (!rc && d->name[len]) {
+            /* the token is a prefix of the name, so it sorts before it */
+            rc = -1;
+        }
+
+        if (!rc) {
+            return d;
+        }
+
+        if (rc < 0) {
+            high = mid;
+        } else {
+            low = mid + 1;
+        }
+    }
+
+    return NULL;
+}
+
 static bool common_strtoattr(char *attribute_list, void *attrs,
-        dispatch_table *table, size_t size) {
+        dispatch_table *table, size_t size, const UINT8 *names,
+        size_t names_count) {
 
     char *token;
     char *save;
@@ -461,6 +539,21 @@ static bool common_strtoattr(char *attribute_list, void *attrs,
 
         bool did_dispatch = false;
 
+        dispatch_table *named = find_dispatch(table, names, names_count,
+                token);
+        if (named) {
+            dispatch_error err = handle_dispatch(named, token, attrs);
+            if (err == dispatch_ok) {
+                continue;
+            } else if (err == dispatch_err) {
+                return false;
+            }
+        }
+
+        /*
+         * Not an exact name, tokens that are the prefix of a name match
+         * the first such name in bit order.
+         */
         size_t i;
         for (i = 0; i < size; i++) {
             dispatch_table *d = &table[i];
@@ -493,14 +586,16 @@ bool tpm2_attr_util_nv_strtoattr(char *attribute_list, TPMA_NV *nvattrs) {
 
     memset(nvattrs, 0, sizeof(*nvattrs));
     return common_strtoattr(attribute_list, nvattrs, nv_attr_table,
-            ARRAY_LEN(nv_attr_table));
+            ARRAY_LEN(nv_attr_table), nv_attr_names,
+            ARRAY_LEN(nv_attr_names));
 }
 
 bool tpm2_attr_util_obj_strtoattr(char *attribute_list, TPMA_OBJECT *objattrs) {
 
     memset(objattrs, 0, sizeof(*objattrs));
     return common_strtoattr(attribute_list, objattrs, obj_attr_table,
-            ARRAY_LEN(obj_attr_table));
+            ARRAY_LEN(obj_attr_table), obj_attr_names,
+            ARRAY_LEN(obj_attr_names));
 }
 
 static UINT8 find_first_set(UINT32 bits) {
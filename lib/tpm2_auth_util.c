@@ -13,6 +13,7 @@
 #include "pcr.h"
 #include "tpm2.h"
 #include "tpm2_auth_util.h"
+#include "tpm2_name_cache.h"
 #include "tpm2_policy.h"
 
 #define HEX_PREFIX "hex:"
@@ -30,6 +31,66 @@
 #define PCR_PREFIX "pcr:"
 #define PCR_PREFIX_LEN sizeof(PCR_PREFIX) - 1
 
+/*
+ * The auth values read with "file:" during the invocation of a tool, so that
+ * a file, or stdin, given for several authorizations of a command, like a
+ * parent and its key, is read once.
+ */
+#define AUTH_FILE_CACHE_LEN 4
+
+typedef struct auth_file auth_file;
+struct auth_file {
+    char *path;
+    TPM2B_AUTH auth;
+};
+
+static struct {
+    auth_file entries[AUTH_FILE_CACHE_LEN];
+    size_t count;
+} auth_file_cache;
+
+static const TPM2B_AUTH *auth_file_cache_get(const char *path) {
+
+    size_t i;
+    for (i = 0; i < auth_file_cache.count; i++) {
+        if (!strcmp(auth_file_cache.entries[i].path, path)) {
+            return &auth_file_cache.entries[i].auth;
+        }
+    }
+
+    return NULL;
+}
+
+static void auth_file_cache_put(const char *path, const TPM2B_AUTH *auth) {
+
+    if (auth_file_cache.count == AUTH_FILE_CACHE_LEN) {
+        return;
+    }
+
+    char *key = strdup(path);
+    if (!key) {
+        /* not an error, the file is read again */
+        return;
+    }
+
+    auth_file *entry = &auth_file_cache.entries[auth_file_cache.count++];
+    entry->path = key;
+    entry->auth = *auth;
+}
+
+void tpm2_auth_util_cache_clear(void) {
+
+    size_t i;
+    for (i = 0; i < auth_file_cache.count; i++) {
+        auth_file *entry = &auth_file_cache.entries[i];
+        free(entry->path);
+        /* the auth values are secrets, do not leave them behind */
+        memset(entry, 0, sizeof(*entry));
+    }
+
+    auth_file_cache.count = 0;
+}
+
 static bool handle_hex_password(const char *password, TPM2B_AUTH *auth) {
 
     /* if it is hex, then skip the prefix */
@@ -197,8 +258,8 @@ static bool parse_pcr(const char *policy, char **pcr_str, char **raw_path) {
     return true;
 }
 
-static tool_rc handle_pcr(ESYS_CONTEXT *ectx, const char *policy,
-        tpm2_session **session) {
+static tool_rc satisfy_pcr(ESYS_CONTEXT *ectx, const char *policy,
+        tpm2_session *s) {
     tool_rc rc = tool_rc_general_error;
 
     char *pcr_str, *raw_path;
@@ -215,34 +276,50 @@ static tool_rc handle_pcr(ESYS_CONTEXT *ectx, const char *policy,
         goto out;
     }
 
+    /*
+     * Without expected values the TPM extends the policy digest of the
+     * session with its current PCRs, there is no need to read and hash them
+     * here first.
+     */
+    if (!raw_path) {
+        static const TPM2B_DIGEST current = { .size = 0 };
+        rc = tpm2_policy_pcr(ectx, tpm2_session_get_handle(s),
+                ESYS_TR_NONE, ESYS_TR_NONE, ESYS_TR_NONE, &current, &pcrs);
+    } else {
+        rc = tpm2_policy_build_pcr(ectx, s, raw_path, &pcrs, NULL);
+    }
+
+out:
+    free(pcr_str);
+
+    return rc;
+}
+
+static tool_rc handle_pcr(ESYS_CONTEXT *ectx, const char *policy,
+        tpm2_session **session) {
+
     tpm2_session_data *d = tpm2_session_data_new(TPM2_SE_POLICY);
     if (!d) {
         LOG_ERR("oom");
-        goto out;
+        return tool_rc_general_error;
     }
 
     tpm2_session *s = NULL;
-    tool_rc tmp_rc = tpm2_session_open(ectx, d, &s);
-    if (tmp_rc != tool_rc_success) {
+    tool_rc rc = tpm2_session_open(ectx, d, &s);
+    if (rc != tool_rc_success) {
         LOG_ERR("Could not start tpm session");
-        rc = tmp_rc;
-        goto out;
+        return rc;
     }
 
-    tmp_rc = tpm2_policy_build_pcr(ectx, s, raw_path, &pcrs, NULL);
-    if (tmp_rc != tool_rc_success) {
+    rc = satisfy_pcr(ectx, policy, s);
+    if (rc != tool_rc_success) {
         tpm2_session_close(&s);
-        rc = tmp_rc;
-        goto out;
+        return rc;
     }
 
     *session = s;
-    rc = tool_rc_success;
 
-out:
-    free(pcr_str);
-
-    return rc;
+    return tool_rc_success;
 }
 
 static tool_rc console_display_echo_control(bool echo) {
@@ -271,6 +348,14 @@ static tool_rc handle_file(ESYS_CONTEXT *ectx, const char *path,
         tpm2_session **session) {
 
     path += FILE_PREFIX_LEN;
+
+    const TPM2B_AUTH *cached = auth_file_cache_get(path);
+    if (cached) {
+        TPM2B_AUTH auth = *cached;
+        return start_hmac_session(ectx, &auth, session);
+    }
+
+    const char *cache_key = path;
     path = strcmp("-", path) ? path : NULL;
 
     TPM2B_AUTH auth = { 0 };
@@ -283,7 +368,8 @@ static tool_rc handle_file(ESYS_CONTEXT *ectx, const char *path,
      * path and fail as path "" is not valid.
      */
     bool is_a_tty = isatty(STDIN_FILENO);
-    if (!is_a_tty || path) {
+    bool is_prompt = is_a_tty && !path;
+    if (!is_prompt) {
 
         UINT16 size = sizeof(buffer) - 1;
 
@@ -335,6 +421,11 @@ static tool_rc handle_file(ESYS_CONTEXT *ectx, const char *path,
         return tool_rc_general_error;
     }
 
+    /* a password typed at the prompt is asked for every time */
+    if (!is_prompt) {
+        auth_file_cache_put(cache_key, &auth);
+    }
+
     return start_hmac_session(ectx, &auth, session);
 }
 
@@ -375,10 +466,43 @@ tool_rc tpm2_auth_util_from_optarg(ESYS_CONTEXT *ectx, const char *password,
     return handle_password_session(ectx, password, session);
 }
 
+tool_rc tpm2_auth_util_restart(ESYS_CONTEXT *ectx, const char *password,
+        tpm2_session *session) {
+
+    password = password ? password : "";
+
+    if (!strncmp(password, SESSION_PREFIX, SESSION_PREFIX_LEN)) {
+        LOG_ERR("Cannot satisfy the policy of password type \"session:\" "
+                "again");
+        return tool_rc_general_error;
+    }
+
+    if (strncmp(password, PCR_PREFIX, PCR_PREFIX_LEN)) {
+        return tool_rc_success;
+    }
+
+    tool_rc rc = tpm2_session_restart(ectx, session);
+    if (rc != tool_rc_success) {
+        return rc;
+    }
+
+    return satisfy_pcr(ectx, password, session);
+}
+
 tool_rc tpm2_auth_util_get_shandle(ESYS_CONTEXT *ectx, ESYS_TR object,
         tpm2_session *session, ESYS_TR *out) {
 
     *out = tpm2_session_get_handle(session);
+    if (*out == ESYS_TR_NONE) {
+        LOG_ERR("Could not use the authorization session");
+        return tool_rc_general_error;
+    }
+
+    /* a wrong name in the HMAC counts as a failed authorization */
+    tool_rc rc = tpm2_name_cache_confirm(ectx, object);
+    if (rc != tool_rc_success) {
+        return rc;
+    }
 
     const TPM2B_AUTH *auth = tpm2_session_get_auth_value(session);
 
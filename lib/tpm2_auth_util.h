@@ -42,6 +42,25 @@
 tool_rc tpm2_auth_util_from_optarg(ESYS_CONTEXT *ctx, const char *password,
         tpm2_session **session, bool is_restricted);
 
+/**
+ * Readies a session returned by tpm2_auth_util_from_optarg() to authorize
+ * another command. The policy session of a "pcr:" auth is restarted and its
+ * PCR policy satisfied again, without starting a new session, other sessions
+ * are left as they are.
+ *
+ * @param ectx
+ *  Enhanced System API (ESAPI) context
+ * @param password
+ *  The optarg the session was returned for.
+ * @param session
+ *  The session to ready.
+ * @return
+ *  A tool_rc indicating status, an error for "session:" auths whose policy
+ *  is not known.
+ */
+tool_rc tpm2_auth_util_restart(ESYS_CONTEXT *ectx, const char *password,
+        tpm2_session *session);
+
 /**
  * Set up authorisation for a handle and return a session handle for use in
  * ESAPI calls.
@@ -62,6 +81,13 @@ tool_rc tpm2_auth_util_from_optarg(ESYS_CONTEXT *ctx, const char *password,
 tool_rc tpm2_auth_util_get_shandle(ESYS_CONTEXT *ectx, ESYS_TR for_auth,
         tpm2_session *session, ESYS_TR *handle);
 
+/**
+ * Forgets the auth values read with "file:". The file, or stdin, of a
+ * "file:" auth is read once per invocation of a tool, later auths naming it
+ * reuse the value read, until this is called at the end of the invocation.
+ */
+void tpm2_auth_util_cache_clear(void);
+
 /**
  * Populate a string password in a TPM2B_AUTH structure.
  *
@@ -1,12 +1,23 @@
 /* SPDX-License-Identifier: BSD-3-Clause */
 
+#include <errno.h>
+#include <limits.h>
 #include <stdbool.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 
+#include <tss2/tss2_mu.h>
+
+#include "files.h"
 #include "log.h"
 #include "tpm2.h"
 #include "tpm2_capability.h"
+#include "tpm2_host_cache.h"
+#include "tpm2_openssl.h"
+#include "tpm2_options.h"
+#include "tpm2_util.h"
 
 #define APPEND_CAPABILITY_INFORMATION(capability, field, subfield, max_count) \
     if (fetched_data->data.capability.count > max_count - property_count) { \
@@ -26,7 +37,7 @@
         more_data = false; \
     }
 
-tool_rc tpm2_capability_get(ESYS_CONTEXT *ectx, TPM2_CAP capability,
+static tool_rc capability_get(ESYS_CONTEXT *ectx, TPM2_CAP capability,
         UINT32 property, UINT32 count, TPMS_CAPABILITY_DATA **capability_data) {
 
     TPMI_YES_NO more_data;
@@ -134,57 +145,938 @@ tool_rc tpm2_capability_get(ESYS_CONTEXT *ectx, TPM2_CAP capability,
     return tool_rc_success;
 }
 
-tool_rc tpm2_capability_find_vacant_persistent_handle(ESYS_CONTEXT *ctx,
-        bool is_platform, TPMI_DH_PERSISTENT *vacant) {
+/* the identity of the TPM of this process, read once */
+static struct {
+    bool is_read;
+    tpm2_capability_identity identity;
+} tpm_identity;
 
-    TPMS_CAPABILITY_DATA *capability_data;
-    bool handle_found = false;
-    tool_rc rc = tpm2_capability_get(ctx, TPM2_CAP_HANDLES,
-            TPM2_PERSISTENT_FIRST, TPM2_MAX_CAP_HANDLES, &capability_data);
+static void identity_from_properties(const TPMS_TAGGED_PROPERTY *properties,
+        UINT32 count, tpm2_capability_identity *identity) {
+
+    memset(identity, 0, sizeof(*identity));
+
+    UINT32 i;
+    for (i = 0; i < count; i++) {
+        UINT32 property = properties[i].property;
+        if (property >= TPM2_PT_MANUFACTURER
+                && property <= TPM2_PT_FIRMWARE_VERSION_2) {
+            identity->properties[property - TPM2_PT_MANUFACTURER] =
+                    properties[i].value;
+        }
+    }
+
+    /* two TPMs of the same model are told apart by their TCTIs */
+    const char *tcti = tpm2_options_get_tcti();
+    TPM2B_DIGEST digest = TPM2B_TYPE_INIT(TPM2B_DIGEST, buffer);
+    if (tpm2_openssl_hash_compute_data(TPM2_ALG_SHA256, (BYTE *) tcti,
+            strlen(tcti), &digest) && digest.size == sizeof(identity->tcti)) {
+        memcpy(identity->tcti, digest.buffer, sizeof(identity->tcti));
+    }
+}
+
+tool_rc tpm2_capability_identity_get(ESYS_CONTEXT *ectx,
+        tpm2_capability_identity *identity) {
+
+    if (!tpm_identity.is_read) {
+        TPMS_CAPABILITY_DATA *capability_data = NULL;
+        tool_rc rc = capability_get(ectx, TPM2_CAP_TPM_PROPERTIES,
+                TPM2_PT_MANUFACTURER, TPM2_CAPABILITY_IDENTITY_COUNT,
+                &capability_data);
+        if (rc != tool_rc_success) {
+            return rc;
+        }
+
+        const TPML_TAGGED_TPM_PROPERTY *properties =
+                &capability_data->data.tpmProperties;
+        identity_from_properties(properties->tpmProperty, properties->count,
+                &tpm_identity.identity);
+        free(capability_data);
+        tpm_identity.is_read = true;
+    }
+
+    *identity = tpm_identity.identity;
+
+    return tool_rc_success;
+}
+
+bool tpm2_capability_identity_write(FILE *f,
+        const tpm2_capability_identity *identity) {
+
+    bool result = true;
+    size_t i;
+    for (i = 0; result && i < ARRAY_LEN(identity->properties); i++) {
+        result = files_write_32(f, identity->properties[i]);
+    }
+
+    return result && files_write_bytes(f, (UINT8 *) identity->tcti,
+            sizeof(identity->tcti));
+}
+
+bool tpm2_capability_identity_read(FILE *f,
+        tpm2_capability_identity *identity) {
+
+    bool result = true;
+    size_t i;
+    for (i = 0; result && i < ARRAY_LEN(identity->properties); i++) {
+        result = files_read_32(f, &identity->properties[i]);
+    }
+
+    return result && files_read_bytes(f, identity->tcti,
+            sizeof(identity->tcti));
+}
+
+#define CAPABILITY_CACHE_VERSION 4
+
+/*
+ * The TPM2_PT_FIXED group of the TPM properties, as reported by the TPM. They
+ * only change with a firmware update, which requires a reboot, so an on-disk
+ * copy is valid for the boot it was taken in, and for the TPM it was taken
+ * from: several TPMs, ie through TPM2TOOLS_TARGETS, or a simulator started
+ * anew with another firmware do not share it.
+ */
+typedef struct fixed_properties_cache fixed_properties_cache;
+struct fixed_properties_cache {
+    bool is_loaded;
+    bool is_disabled;
+    tpm2_capability_identity identity;
+    UINT32 count;
+    TPMS_TAGGED_PROPERTY property[TPM2_MAX_TPM_PROPERTIES];
+};
+
+static fixed_properties_cache fixed_cache;
+
+/* more than the algorithms and curves of any TPM */
+#define PARAMS_CACHE_MAX 256
+
+typedef enum params_kind params_kind;
+enum params_kind {
+    params_kind_test = 1,
+    params_kind_ecc = 2,
+    params_kind_fact = 3,
+};
+
+/*
+ * The answer of the TPM to a TestParms or ECC_Parameters, keyed by the
+ * marshaled parameters or curve. The value is the marshaled
+ * TPMS_ALGORITHM_DETAIL_ECC of a curve. A fact is keyed by its marshaled
+ * tpm2_capability_fact, the value is the marshaled UINT32.
+ */
+typedef struct params_entry params_entry;
+struct params_entry {
+    UINT16 kind;
+    UINT16 key_size;
+    UINT8 key[sizeof(TPMT_PUBLIC_PARMS)];
+    UINT32 rc;
+    UINT16 value_size;
+    UINT8 value[sizeof(TPMS_ALGORITHM_DETAIL_ECC)];
+};
+
+/*
+ * The results of TestParms and ECC_Parameters depend on the firmware only,
+ * so unlike the fixed properties they outlive a reboot. They are kept as long
+ * as the identity the TPM reports stays the same.
+ */
+static struct {
+    tpm2_capability_identity identity;
+    bool is_checked;
+    size_t count;
+    params_entry *entries;
+} params_cache;
+
+static bool params_cache_read(FILE *f) {
+
+    tpm2_capability_identity identity;
+    UINT32 count = 0;
+    bool result = tpm2_capability_identity_read(f, &identity)
+            && files_read_32(f, &count) && count <= PARAMS_CACHE_MAX;
+    if (!result) {
+        return false;
+    }
+
+    params_entry *entries = count ? calloc(count, sizeof(*entries)) : NULL;
+    if (count && !entries) {
+        LOG_ERR("oom");
+        return false;
+    }
+
+    size_t i;
+    for (i = 0; result && i < count; i++) {
+        params_entry *e = &entries[i];
+        result = files_read_16(f, &e->kind)
+                && files_read_16(f, &e->key_size)
+                && e->key_size <= sizeof(e->key)
+                && files_read_bytes(f, e->key, e->key_size)
+                && files_read_32(f, &e->rc)
+                && files_read_16(f, &e->value_size)
+                && e->value_size <= sizeof(e->value)
+                && files_read_bytes(f, e->value, e->value_size);
+    }
+
+    if (!result) {
+        free(entries);
+        return false;
+    }
+
+    free(params_cache.entries);
+    params_cache.identity = identity;
+    params_cache.count = count;
+    params_cache.entries = entries;
+
+    return true;
+}
+
+static bool params_cache_write(FILE *f) {
+
+    bool result = tpm2_capability_identity_write(f, &params_cache.identity)
+            && files_write_32(f, params_cache.count);
+
+    size_t i;
+    for (i = 0; result && i < params_cache.count; i++) {
+        params_entry *e = &params_cache.entries[i];
+        result = files_write_16(f, e->kind)
+                && files_write_16(f, e->key_size)
+                && files_write_bytes(f, e->key, e->key_size)
+                && files_write_32(f, e->rc)
+                && files_write_16(f, e->value_size)
+                && files_write_bytes(f, e->value, e->value_size);
+    }
+
+    return result;
+}
+
+/*
+ * Reads the cache file. The fixed properties are only taken from a file of
+ * the current boot and of the TPM of identity, the parameter results from any
+ * file of this version.
+ */
+static bool fixed_cache_load(const char *path, const char *boot_id,
+        const tpm2_capability_identity *identity) {
+
+    FILE *f = fopen(path, "rb");
+    if (!f) {
+        return false;
+    }
+
+    uint32_t version = 0;
+    char saved_boot_id[TPM2_UTIL_BOOT_ID_LEN];
+    tpm2_capability_identity saved_identity;
+    UINT32 count = 0;
+    bool result = files_read_header(f, &version)
+            && version == CAPABILITY_CACHE_VERSION
+            && files_read_bytes(f, (UINT8 *) saved_boot_id,
+                    sizeof(saved_boot_id))
+            && tpm2_capability_identity_read(f, &saved_identity)
+            && files_read_32(f, &count)
+            && count <= ARRAY_LEN(fixed_cache.property);
+
+    TPMS_TAGGED_PROPERTY property[TPM2_MAX_TPM_PROPERTIES];
+    UINT32 i;
+    for (i = 0; result && i < count; i++) {
+        result = files_read_32(f, &property[i].property)
+                && files_read_32(f, &property[i].value);
+    }
+
+    result = result && params_cache_read(f);
+
+    fclose(f);
+
+    if (!result || memcmp(saved_boot_id, boot_id, sizeof(saved_boot_id))
+            || memcmp(&saved_identity, identity, sizeof(saved_identity))) {
+        LOG_INFO("Capability cache \"%s\" is stale, refreshing it", path);
+        return false;
+    }
+
+    fixed_cache.identity = *identity;
+    memcpy(fixed_cache.property, property, count * sizeof(property[0]));
+    fixed_cache.count = count;
+
+    return true;
+}
+
+static void fixed_cache_save(const char *path, const char *boot_id) {
+
+    files_atomic atomic;
+    FILE *f = files_atomic_open(&atomic, path);
+    if (!f) {
+        return;
+    }
+
+    bool result = files_write_header(f, CAPABILITY_CACHE_VERSION)
+            && files_write_bytes(f, (UINT8 *) boot_id, TPM2_UTIL_BOOT_ID_LEN)
+            && tpm2_capability_identity_write(f, &fixed_cache.identity)
+            && files_write_32(f, fixed_cache.count);
+
+    UINT32 i;
+    for (i = 0; result && i < fixed_cache.count; i++) {
+        result = files_write_32(f, fixed_cache.property[i].property)
+                && files_write_32(f, fixed_cache.property[i].value);
+    }
+
+    result = result && params_cache_write(f);
+
+    if (!files_atomic_close(&atomic, f, result)) {
+        LOG_WARN("Could not write capability cache \"%s\"", path);
+    }
+}
+
+static tool_rc fixed_cache_fill(ESYS_CONTEXT *ectx) {
+
+    TPMS_CAPABILITY_DATA *capability_data = NULL;
+    tool_rc rc = capability_get(ectx, TPM2_CAP_TPM_PROPERTIES, TPM2_PT_FIXED,
+            TPM2_MAX_TPM_PROPERTIES, &capability_data);
     if (rc != tool_rc_success) {
         return rc;
     }
 
-    UINT32 count = capability_data->data.handles.count;
-    if (count == 0) {
-        /* There aren't any persistent handles, so use the first */
-        *vacant = is_platform ? TPM2_PLATFORM_PERSISTENT : TPM2_PERSISTENT_FIRST;
-        handle_found = true;
-    } else if (count == TPM2_MAX_CAP_HANDLES) {
-        /* All persistent handles are already in use */
-        goto out;
-    } else if (count < TPM2_MAX_CAP_HANDLES) {
-        /*
-         * iterate over used handles to ensure we're selecting
-         * the next available handle.
-         *
-         * Platform handles start at a higher hange
-         */
+    /* the TPM continues with the variable properties, those are not cached */
+    TPML_TAGGED_TPM_PROPERTY *properties =
+            &capability_data->data.tpmProperties;
+    UINT32 i;
+    for (i = 0; i < properties->count &&
+            properties->tpmProperty[i].property < TPM2_PT_VAR; i++) {
+        fixed_cache.property[i] = properties->tpmProperty[i];
+    }
+    fixed_cache.count = i;
+
+    free(capability_data);
+
+    return tool_rc_success;
+}
+
+static bool fixed_cache_init(ESYS_CONTEXT *ectx) {
+
+    const char *path = tpm2_util_getenv(TPM2TOOLS_ENV_CAPABILITY_CACHE);
+    if (!path || !path[0]) {
+        return false;
+    }
+
+    char boot_id[TPM2_UTIL_BOOT_ID_LEN];
+    bool result = tpm2_util_get_boot_id(boot_id);
+    if (!result) {
+        LOG_WARN("Could not read the boot id, not using the capability cache");
+        return false;
+    }
+
+    /* the TPM tells who it is, the cache of another TPM is not used */
+    tpm2_capability_identity identity;
+    tool_rc rc = tpm2_capability_identity_get(ectx, &identity);
+    if (rc != tool_rc_success) {
+        return false;
+    }
+
+    result = fixed_cache_load(path, boot_id, &identity);
+    if (result) {
+        return true;
+    }
+
+    rc = fixed_cache_fill(ectx);
+    if (rc != tool_rc_success) {
+        return false;
+    }
+    fixed_cache.identity = identity;
+
+    fixed_cache_save(path, boot_id);
+
+    return true;
+}
+
+/*
+ * Answers a TPM2_CAP_TPM_PROPERTIES query from the cache when the answer of
+ * the TPM would only consist of fixed properties, ie the cache holds at least
+ * count properties at or after property. Everything else goes to the TPM.
+ */
+static bool fixed_cache_get(ESYS_CONTEXT *ectx, UINT32 property, UINT32 count,
+        TPMS_CAPABILITY_DATA **capability_data) {
+
+    if (property < TPM2_PT_FIXED || property >= TPM2_PT_VAR || !count
+            || count > TPM2_MAX_TPM_PROPERTIES || fixed_cache.is_disabled) {
+        return false;
+    }
+
+    if (!fixed_cache.is_loaded) {
+        fixed_cache.is_loaded = fixed_cache_init(ectx);
+        if (!fixed_cache.is_loaded) {
+            fixed_cache.is_disabled = true;
+            return false;
+        }
+    }
+
+    UINT32 first = 0;
+    while (first < fixed_cache.count &&
+            fixed_cache.property[first].property < property) {
+        first++;
+    }
+
+    if (fixed_cache.count - first < count) {
+        return false;
+    }
+
+    *capability_data = calloc(1, sizeof(**capability_data));
+    if (!*capability_data) {
+        LOG_ERR("oom");
+        return false;
+    }
+
+    LOG_INFO("GetCapability: capability: 0x%x, property: 0x%x from cache",
+            TPM2_CAP_TPM_PROPERTIES, property);
+
+    (*capability_data)->capability = TPM2_CAP_TPM_PROPERTIES;
+    (*capability_data)->data.tpmProperties.count = count;
+    memcpy((*capability_data)->data.tpmProperties.tpmProperty,
+            &fixed_cache.property[first], count * sizeof(fixed_cache.property[0]));
+
+    return true;
+}
+
+/*
+ * The capabilities that only change with a reboot or a firmware update. The
+ * handles change with the commands of any tool and are always read from the
+ * TPM.
+ */
+static bool host_cache_is_cacheable(TPM2_CAP capability, UINT32 property) {
+
+    switch (capability) {
+    case TPM2_CAP_ALGS:
+    case TPM2_CAP_COMMANDS:
+    case TPM2_CAP_PCRS:
+    case TPM2_CAP_PCR_PROPERTIES:
+    case TPM2_CAP_ECC_CURVES:
+        return true;
+    case TPM2_CAP_TPM_PROPERTIES:
+        return property < TPM2_PT_VAR;
+    default:
+        return false;
+    }
+}
+
+typedef struct host_cache_key host_cache_key;
+struct host_cache_key {
+    UINT32 capability;
+    UINT32 property;
+    UINT32 count;
+};
+
+static bool host_cache_get(TPM2_CAP capability, UINT32 property, UINT32 count,
+        TPMS_CAPABILITY_DATA **capability_data) {
+
+    host_cache_key key = {
+        .capability = capability,
+        .property = property,
+        .count = count,
+    };
+
+    UINT8 value[TPM2_HOST_CACHE_VALUE_MAX];
+    size_t value_size;
+    bool result = tpm2_host_cache_get(tpm2_host_cache_kind_capability,
+            (UINT8 *) &key, sizeof(key), value, &value_size, NULL);
+    if (!result) {
+        return false;
+    }
+
+    *capability_data = calloc(1, sizeof(**capability_data));
+    if (!*capability_data) {
+        LOG_ERR("oom");
+        return false;
+    }
+
+    size_t offset = 0;
+    TSS2_RC rval = Tss2_MU_TPMS_CAPABILITY_DATA_Unmarshal(value, value_size,
+            &offset, *capability_data);
+    if (rval != TPM2_RC_SUCCESS || offset != value_size) {
+        free(*capability_data);
+        *capability_data = NULL;
+        return false;
+    }
+
+    LOG_INFO("GetCapability: capability: 0x%x, property: 0x%x from host cache",
+            capability, property);
+
+    return true;
+}
+
+static void host_cache_put(TPM2_CAP capability, UINT32 property, UINT32 count,
+        const TPMS_CAPABILITY_DATA *capability_data, UINT32 generation) {
+
+    /* the answer may run into the variable properties */
+    if (capability == TPM2_CAP_TPM_PROPERTIES) {
+        const TPML_TAGGED_TPM_PROPERTY *properties =
+                &capability_data->data.tpmProperties;
         UINT32 i;
-        for (i = is_platform ? TPM2_PLATFORM_PERSISTENT : TPM2_PERSISTENT_FIRST;
-                i <= (UINT32) TPM2_PERSISTENT_LAST; ++i) {
-            bool inuse = false;
-            UINT32 c;
-            for (c = 0; c < count; ++c) {
-                if (capability_data->data.handles.handle[c] == i) {
-                    inuse = true;
-                    break;
-                }
+        for (i = 0; i < properties->count; i++) {
+            if (properties->tpmProperty[i].property >= TPM2_PT_VAR) {
+                return;
             }
+        }
+    }
 
-            if (!is_platform && i >= TPM2_PLATFORM_PERSISTENT) {
-                break;
-            }
+    host_cache_key key = {
+        .capability = capability,
+        .property = property,
+        .count = count,
+    };
+
+    UINT8 value[TPM2_HOST_CACHE_VALUE_MAX];
+    size_t value_size = 0;
+    TSS2_RC rval = Tss2_MU_TPMS_CAPABILITY_DATA_Marshal(capability_data, value,
+            sizeof(value), &value_size);
+    if (rval != TPM2_RC_SUCCESS) {
+        return;
+    }
+
+    tpm2_host_cache_put(tpm2_host_cache_kind_capability, (UINT8 *) &key,
+            sizeof(key), value, value_size, 0, generation);
+}
+
+tool_rc tpm2_capability_get(ESYS_CONTEXT *ectx, TPM2_CAP capability,
+        UINT32 property, UINT32 count, TPMS_CAPABILITY_DATA **capability_data) {
+
+    if (capability == TPM2_CAP_TPM_PROPERTIES) {
+        bool result = fixed_cache_get(ectx, property, count, capability_data);
+        if (result) {
+            return tool_rc_success;
+        }
+    }
+
+    bool is_cacheable = host_cache_is_cacheable(capability, property)
+            && tpm2_host_cache_identify(ectx);
+    if (is_cacheable && host_cache_get(capability, property, count,
+            capability_data)) {
+        return tool_rc_success;
+    }
+
+    UINT32 generation = is_cacheable ? tpm2_host_cache_generation() : 0;
+
+    tool_rc rc = capability_get(ectx, capability, property, count,
+            capability_data);
+    if (rc == tool_rc_success && is_cacheable) {
+        host_cache_put(capability, property, count, *capability_data,
+                generation);
+    }
+
+    return rc;
+}
+
+void tpm2_capability_cache_fixed(const TPMS_TAGGED_PROPERTY *properties,
+        UINT32 count) {
+
+    const char *path = tpm2_util_getenv(TPM2TOOLS_ENV_CAPABILITY_CACHE);
+    if (!path || !path[0] || fixed_cache.is_loaded
+            || count > ARRAY_LEN(fixed_cache.property)) {
+        return;
+    }
+
+    char boot_id[TPM2_UTIL_BOOT_ID_LEN];
+    if (!tpm2_util_get_boot_id(boot_id)) {
+        return;
+    }
+
+    /* the properties were just read from the TPM, they tell its identity */
+    tpm2_capability_identity identity;
+    identity_from_properties(properties, count, &identity);
+
+    /* still valid for this boot and TPM, no need to write it again */
+    if (fixed_cache_load(path, boot_id, &identity)) {
+        fixed_cache.is_loaded = true;
+        return;
+    }
+
+    fixed_cache.identity = identity;
+    memcpy(fixed_cache.property, properties, count * sizeof(*properties));
+    fixed_cache.count = count;
+    fixed_cache.is_loaded = true;
+
+    fixed_cache_save(path, boot_id);
+}
+
+/*
+ * With at most used->count of the handles from first on in use, the first
+ * count vacant ones lie among the first used->count + count handles. Only
+ * that window is mapped in a bitmap, marked from the used handles and
+ * scanned once.
+ */
+static bool find_vacant_handles(const TPML_HANDLE *used, bool is_complete,
+        TPM2_HANDLE first, TPM2_HANDLE last, UINT32 count,
+        TPMI_DH_PERSISTENT *vacant) {
 
-            if (!inuse) {
-                *vacant = i;
-                handle_found = true;
-                break;
+    UINT64 window = (UINT64) used->count + count;
+    if (window > (UINT64) last - first + 1) {
+        window = (UINT64) last - first + 1;
+    }
+
+    /* the TPM did not report all used handles, only those below the highest */
+    if (!is_complete) {
+        TPM2_HANDLE highest = 0;
+        UINT32 i;
+        for (i = 0; i < used->count; i++) {
+            if (used->handle[i] > highest) {
+                highest = used->handle[i];
             }
         }
+        UINT64 known = highest > first ? highest - first : 0;
+        if (window > known) {
+            window = known;
+        }
+    }
+
+    UINT32 *bitmap = calloc(window / 32 + 1, sizeof(*bitmap));
+    if (!bitmap) {
+        LOG_ERR("oom");
+        return false;
+    }
+
+    UINT32 i;
+    for (i = 0; i < used->count; i++) {
+        TPM2_HANDLE handle = used->handle[i];
+        if (handle >= first && handle - first < window) {
+            UINT32 bit = handle - first;
+            bitmap[bit / 32] |= 1U << (bit % 32);
+        }
+    }
+
+    UINT32 found = 0;
+    UINT64 bit;
+    for (bit = 0; bit < window && found < count; bit++) {
+        /* skip words of used handles at once */
+        if (!(bit % 32) && bitmap[bit / 32] == UINT32_MAX) {
+            bit += 31;
+            continue;
+        }
+        if (!(bitmap[bit / 32] & (1U << (bit % 32)))) {
+            vacant[found++] = first + bit;
+        }
+    }
+
+    free(bitmap);
+
+    return found == count;
+}
+
+tool_rc tpm2_capability_find_vacant_persistent_handles(ESYS_CONTEXT *ctx,
+        bool is_platform, UINT32 count, TPMI_DH_PERSISTENT *vacant) {
+
+    TPMS_CAPABILITY_DATA *capability_data;
+    tool_rc rc = tpm2_capability_get(ctx, TPM2_CAP_HANDLES,
+            TPM2_PERSISTENT_FIRST, TPM2_MAX_CAP_HANDLES, &capability_data);
+    if (rc != tool_rc_success) {
+        return rc;
+    }
+
+    /* platform handles start at a higher range */
+    TPM2_HANDLE first = is_platform ?
+            TPM2_PLATFORM_PERSISTENT : TPM2_PERSISTENT_FIRST;
+    TPM2_HANDLE last = is_platform ?
+            TPM2_PERSISTENT_LAST : TPM2_PLATFORM_PERSISTENT - 1;
+
+    TPML_HANDLE *used = &capability_data->data.handles;
+    bool is_complete = used->count < TPM2_MAX_CAP_HANDLES;
+    bool result = find_vacant_handles(used, is_complete, first, last, count,
+            vacant);
+
+    free(capability_data);
+    return result ? tool_rc_success : tool_rc_general_error;
+}
+
+tool_rc tpm2_capability_find_vacant_persistent_handle(ESYS_CONTEXT *ctx,
+        bool is_platform, TPMI_DH_PERSISTENT *vacant) {
+
+    return tpm2_capability_find_vacant_persistent_handles(ctx, is_platform, 1,
+            vacant);
+}
+
+UINT16 tpm2_capability_max_buffer_size(ESYS_CONTEXT *ctx) {
+
+    /* every chunked tool asks for each chunk, so the TPM is asked once */
+    static UINT16 max_buffer_size;
+    if (max_buffer_size) {
+        return max_buffer_size;
+    }
+
+    UINT16 tss_max = BUFFER_SIZE(TPM2B_MAX_BUFFER, buffer);
+    if (!ctx) {
+        return tss_max;
+    }
+
+    TPMS_CAPABILITY_DATA *capability_data = NULL;
+    tool_rc rc = tpm2_capability_get(ctx, TPM2_CAP_TPM_PROPERTIES,
+            TPM2_PT_INPUT_BUFFER, 1, &capability_data);
+    if (rc != tool_rc_success) {
+        LOG_WARN("Could not read TPM2_PT_INPUT_BUFFER, using chunks of %u "
+                "bytes", tss_max);
+        return tss_max;
     }
 
-out:
+    TPML_TAGGED_TPM_PROPERTY *properties =
+            &capability_data->data.tpmProperties;
+    UINT32 value = properties->count
+            && properties->tpmProperty[0].property == TPM2_PT_INPUT_BUFFER ?
+            properties->tpmProperty[0].value : tss_max;
     free(capability_data);
-    return handle_found ? tool_rc_success : tool_rc_general_error;
+
+    /* the TSS cannot marshal more than its TPM2B_MAX_BUFFER holds */
+    max_buffer_size = value && value < tss_max ? value : tss_max;
+    LOG_INFO("Using chunks of %u bytes", max_buffer_size);
+
+    return max_buffer_size;
+}
+
+static bool params_cache_check(ESYS_CONTEXT *ectx) {
+
+    if (params_cache.is_checked) {
+        return true;
+    }
+
+    /*
+     * The identity is read from the TPM, not from the fixed properties of
+     * the file the results are checked against.
+     */
+    tpm2_capability_identity identity;
+    tool_rc rc = tpm2_capability_identity_get(ectx, &identity);
+    if (rc != tool_rc_success) {
+        return false;
+    }
+
+    /* another TPM or a firmware update, the results may differ */
+    if (memcmp(&identity, &params_cache.identity, sizeof(identity))) {
+        free(params_cache.entries);
+        params_cache.entries = NULL;
+        params_cache.count = 0;
+        params_cache.identity = identity;
+    }
+
+    params_cache.is_checked = true;
+
+    return true;
+}
+
+static params_entry *params_cache_find(params_kind kind, const UINT8 *key,
+        size_t key_size) {
+
+    size_t i;
+    for (i = 0; i < params_cache.count; i++) {
+        params_entry *e = &params_cache.entries[i];
+        if (e->kind == kind && e->key_size == key_size
+                && !memcmp(e->key, key, key_size)) {
+            return e;
+        }
+    }
+
+    return NULL;
+}
+
+static void params_cache_add(params_kind kind, const UINT8 *key,
+        size_t key_size, UINT32 rc, const UINT8 *value, size_t value_size) {
+
+    if (params_cache.count >= PARAMS_CACHE_MAX) {
+        return;
+    }
+
+    params_entry *entries = realloc(params_cache.entries,
+            (params_cache.count + 1) * sizeof(*entries));
+    if (!entries) {
+        LOG_WARN("oom, not caching the result");
+        return;
+    }
+    params_cache.entries = entries;
+
+    params_entry *e = &entries[params_cache.count++];
+    memset(e, 0, sizeof(*e));
+    e->kind = kind;
+    e->key_size = key_size;
+    memcpy(e->key, key, key_size);
+    e->rc = rc;
+    e->value_size = value_size;
+    if (value_size) {
+        memcpy(e->value, value, value_size);
+    }
+
+    /* written right away, most tools ask for a single result */
+    const char *path = tpm2_util_getenv(TPM2TOOLS_ENV_CAPABILITY_CACHE);
+    char boot_id[TPM2_UTIL_BOOT_ID_LEN];
+    if (path && tpm2_util_get_boot_id(boot_id)) {
+        fixed_cache_save(path, boot_id);
+    }
+}
+
+static tool_rc test_parms_rc(TSS2_RC rval) {
+
+    if (rval == TSS2_RC_SUCCESS) {
+        return tool_rc_success;
+    }
+
+    /*
+     * TODO: this is a good candidate for flatten support via Tss2_RC_Decode(rval);
+     */
+    if ((rval & (TPM2_RC_P | TPM2_RC_1)) == (TPM2_RC_P | TPM2_RC_1)) {
+        rval &= ~(TPM2_RC_P | TPM2_RC_1);
+        switch (rval) {
+        case TPM2_RC_CURVE:
+            LOG_ERR("Specified elliptic curve is unsupported");
+            break;
+        case TPM2_RC_HASH:
+            LOG_ERR("Specified hash is unsupported");
+            break;
+        case TPM2_RC_SCHEME:
+            LOG_ERR("Specified signing scheme is unsupported or "
+                    "incompatible");
+            break;
+        case TPM2_RC_KDF:
+            LOG_ERR("Specified key derivation function is unsupported");
+            break;
+        case TPM2_RC_MGF:
+            LOG_ERR("Specified mask generation function is unsupported");
+            break;
+        case TPM2_RC_KEY_SIZE:
+            LOG_ERR("Specified key size is unsupported");
+            break;
+        case TPM2_RC_SYMMETRIC:
+            LOG_ERR(
+                    "Specified symmetric algorithm or key length is "
+                    "unsupported");
+            break;
+        case TPM2_RC_ASYMMETRIC:
+            LOG_ERR("Specified asymmetric algorithm is unsupported");
+            break;
+        case TPM2_RC_MODE:
+            LOG_ERR("Specified symmetric mode unsupported");
+            break;
+        case TPM2_RC_VALUE:
+        default:
+            LOG_ERR("Unsupported algorithm specification");
+            break;
+        }
+        return tool_rc_unsupported;
+    }
+
+    LOG_PERR(Esys_TestParms, rval);
+    return tool_rc_general_error;
+}
+
+tool_rc tpm2_capability_test_parms(ESYS_CONTEXT *ectx,
+        const TPMT_PUBLIC_PARMS *parms) {
+
+    UINT8 key[sizeof(TPMT_PUBLIC_PARMS)];
+    size_t key_size = 0;
+    bool is_cached = params_cache_check(ectx)
+            && Tss2_MU_TPMT_PUBLIC_PARMS_Marshal(parms, key, sizeof(key),
+                    &key_size) == TSS2_RC_SUCCESS;
+
+    params_entry *e = is_cached ?
+            params_cache_find(params_kind_test, key, key_size) : NULL;
+    if (e) {
+        LOG_INFO("TestParms: type: 0x%x from cache", parms->type);
+        return test_parms_rc(e->rc);
+    }
+
+    TSS2_RC rval = Esys_TestParms(ectx, ESYS_TR_NONE, ESYS_TR_NONE,
+            ESYS_TR_NONE, parms);
+
+    /* the verdict of the TPM on the parameters, not a failure to ask it */
+    bool is_verdict = rval == TSS2_RC_SUCCESS
+            || (!(rval & TSS2_RC_LAYER_MASK)
+                    && (rval & (TPM2_RC_P | TPM2_RC_1))
+                            == (TPM2_RC_P | TPM2_RC_1));
+    if (is_cached && is_verdict) {
+        params_cache_add(params_kind_test, key, key_size, rval, NULL, 0);
+    }
+
+    return test_parms_rc(rval);
+}
+
+tool_rc tpm2_capability_ecc_parameters(ESYS_CONTEXT *ectx,
+        TPMI_ECC_CURVE curve_id, TPMS_ALGORITHM_DETAIL_ECC **parameters) {
+
+    UINT8 key[sizeof(curve_id)];
+    size_t key_size = 0;
+    bool is_cached = params_cache_check(ectx)
+            && Tss2_MU_UINT16_Marshal(curve_id, key, sizeof(key),
+                    &key_size) == TSS2_RC_SUCCESS;
+
+    params_entry *e = is_cached ?
+            params_cache_find(params_kind_ecc, key, key_size) : NULL;
+    if (e) {
+        *parameters = calloc(1, sizeof(**parameters));
+        if (!*parameters) {
+            LOG_ERR("oom");
+            return tool_rc_general_error;
+        }
+
+        size_t offset = 0;
+        TSS2_RC rval = Tss2_MU_TPMS_ALGORITHM_DETAIL_ECC_Unmarshal(e->value,
+                e->value_size, &offset, *parameters);
+        if (rval == TSS2_RC_SUCCESS) {
+            LOG_INFO("ECC_Parameters: curve: 0x%x from cache", curve_id);
+            return tool_rc_success;
+        }
+
+        /* a broken entry, ask the TPM */
+        free(*parameters);
+        *parameters = NULL;
+        is_cached = false;
+    }
+
+    tool_rc rc = tpm2_geteccparameters(ectx, curve_id, parameters);
+    if (rc != tool_rc_success || !is_cached) {
+        return rc;
+    }
+
+    UINT8 value[sizeof(TPMS_ALGORITHM_DETAIL_ECC)];
+    size_t value_size = 0;
+    TSS2_RC rval = Tss2_MU_TPMS_ALGORITHM_DETAIL_ECC_Marshal(*parameters,
+            value, sizeof(value), &value_size);
+    if (rval == TSS2_RC_SUCCESS) {
+        params_cache_add(params_kind_ecc, key, key_size, TSS2_RC_SUCCESS,
+                value, value_size);
+    }
+
+    return tool_rc_success;
+}
+
+bool tpm2_capability_fact_get(ESYS_CONTEXT *ectx, tpm2_capability_fact fact,
+        UINT32 *value) {
+
+    UINT8 key[sizeof(UINT16)];
+    size_t key_size = 0;
+    bool is_cached = params_cache_check(ectx)
+            && Tss2_MU_UINT16_Marshal(fact, key, sizeof(key),
+                    &key_size) == TSS2_RC_SUCCESS;
+
+    params_entry *e = is_cached ?
+            params_cache_find(params_kind_fact, key, key_size) : NULL;
+    if (!e) {
+        return false;
+    }
+
+    size_t offset = 0;
+    TSS2_RC rval = Tss2_MU_UINT32_Unmarshal(e->value, e->value_size, &offset,
+            value);
+    if (rval != TSS2_RC_SUCCESS) {
+        return false;
+    }
+
+    LOG_INFO("Fact: 0x%x from cache", fact);
+
+    return true;
+}
+
+void tpm2_capability_fact_put(ESYS_CONTEXT *ectx, tpm2_capability_fact fact,
+        UINT32 value) {
+
+    UINT8 key[sizeof(UINT16)];
+    size_t key_size = 0;
+    bool is_cached = params_cache_check(ectx)
+            && Tss2_MU_UINT16_Marshal(fact, key, sizeof(key),
+                    &key_size) == TSS2_RC_SUCCESS;
+    if (!is_cached || params_cache_find(params_kind_fact, key, key_size)) {
+        return;
+    }
+
+    UINT8 buffer[sizeof(UINT32)];
+    size_t buffer_size = 0;
+    TSS2_RC rval = Tss2_MU_UINT32_Marshal(value, buffer, sizeof(buffer),
+            &buffer_size);
+    if (rval == TSS2_RC_SUCCESS) {
+        params_cache_add(params_kind_fact, key, key_size, TSS2_RC_SUCCESS,
+                buffer, buffer_size);
+    }
 }
@@ -3,11 +3,77 @@
 #ifndef LIB_TPM2_CAPABILITY_H_
 #define LIB_TPM2_CAPABILITY_H_
 
+#include <stdbool.h>
+#include <stdio.h>
+
 #include <tss2/tss2_esys.h>
 
+/*
+ * Environment variable naming a file to cache the fixed TPM properties in
+ * across tool invocations.
+ */
+#define TPM2TOOLS_ENV_CAPABILITY_CACHE "TPM2TOOLS_CAPABILITY_CACHE"
+
+/* the properties from TPM2_PT_MANUFACTURER to TPM2_PT_FIRMWARE_VERSION_2 */
+#define TPM2_CAPABILITY_IDENTITY_COUNT \
+    (TPM2_PT_FIRMWARE_VERSION_2 - TPM2_PT_MANUFACTURER + 1)
+
+/*
+ * What tells a TPM apart from the other TPMs of a host to the caches that
+ * outlive a tool: the manufacturer, vendor strings and firmware version the
+ * TPM reports, and the TCTI the tools reach it through.
+ */
+typedef struct tpm2_capability_identity tpm2_capability_identity;
+struct tpm2_capability_identity {
+    UINT32 properties[TPM2_CAPABILITY_IDENTITY_COUNT];
+    /* the SHA256 digest of the configuration of the TCTI */
+    UINT8 tcti[TPM2_SHA256_DIGEST_SIZE];
+};
+
+/**
+ * Reads the identity of the TPM from the TPM, once per process.
+ * @param ectx
+ *  Enhanced System API (ESAPI) context
+ * @param identity
+ *  Receives the identity.
+ * @return
+ *  tool_rc indicating status.
+ */
+tool_rc tpm2_capability_identity_get(ESYS_CONTEXT *ectx,
+        tpm2_capability_identity *identity);
+
+/**
+ * Writes an identity to a cache file.
+ * @param f
+ *  The file.
+ * @param identity
+ *  The identity.
+ * @return
+ *  True on success, false on error.
+ */
+bool tpm2_capability_identity_write(FILE *f,
+        const tpm2_capability_identity *identity);
+
+/**
+ * Reads an identity written with tpm2_capability_identity_write().
+ * @param f
+ *  The file.
+ * @param identity
+ *  Receives the identity.
+ * @return
+ *  True on success, false on error.
+ */
+bool tpm2_capability_identity_read(FILE *f,
+        tpm2_capability_identity *identity);
+
 /**
  * Invokes GetCapability to retrieve the current value of a capability from the
  * TPM.
+ *
+ * When the environment variable TPM2TOOLS_CAPABILITY_CACHE is set, queries
+ * for properties in the TPM2_PT_FIXED group are answered from the cache file
+ * it names. The cache is filled with a single query on first use and is valid
+ * until the next reboot, for the TPM of the identity it was filled from.
  * @param context
  *  Enhanced system api (ESAPI) context
  * @param capability
@@ -24,6 +90,53 @@
 tool_rc tpm2_capability_get(ESYS_CONTEXT *context, TPM2_CAP capability,
         UINT32 property, UINT32 count, TPMS_CAPABILITY_DATA **capability_data);
 
+/**
+ * Fills the capability cache named by TPM2TOOLS_CAPABILITY_CACHE with the
+ * fixed TPM properties a caller read from the TPM anyway, sparing later tools
+ * the query. Does nothing without the environment variable or when the cache
+ * is already valid.
+ * @param properties
+ *  The properties of the TPM2_PT_FIXED group, in ascending order.
+ * @param count
+ *  The number of properties.
+ */
+void tpm2_capability_cache_fixed(const TPMS_TAGGED_PROPERTY *properties,
+        UINT32 count);
+
+/**
+ * Invokes TestParms to check whether the TPM supports the parameters of a
+ * key, logging the parameter it rejects.
+ *
+ * With the capability cache, the verdict for the parameters is kept in the
+ * cache file along with the manufacturer and firmware version of the TPM, and
+ * reused across reboots until these change.
+ * @param ectx
+ *  Enhanced System API (ESAPI) context
+ * @param parms
+ *  The parameters to test.
+ * @return
+ *  tool_rc_success if supported, tool_rc_unsupported if the TPM rejects the
+ *  parameters, another tool_rc on failure.
+ */
+tool_rc tpm2_capability_test_parms(ESYS_CONTEXT *ectx,
+        const TPMT_PUBLIC_PARMS *parms);
+
+/**
+ * Invokes ECC_Parameters to retrieve the parameters of a curve. With the
+ * capability cache, they are kept like the results of
+ * tpm2_capability_test_parms().
+ * @param ectx
+ *  Enhanced System API (ESAPI) context
+ * @param curve_id
+ *  The curve.
+ * @param parameters
+ *  Receives the parameters of the curve, to free().
+ * @return
+ *  tool_rc indicating status.
+ */
+tool_rc tpm2_capability_ecc_parameters(ESYS_CONTEXT *ectx,
+        TPMI_ECC_CURVE curve_id, TPMS_ALGORITHM_DETAIL_ECC **parameters);
+
 /**
  * Attempts to find a vacant handle in the persistent handle namespace.
  * @param ctx
@@ -39,4 +152,73 @@ tool_rc tpm2_capability_get(ESYS_CONTEXT *context, TPM2_CAP capability,
 tool_rc tpm2_capability_find_vacant_persistent_handle(ESYS_CONTEXT *ctx,
         bool is_platform, TPMI_DH_PERSISTENT *vacant);
 
+/**
+ * Finds several vacant handles in the persistent handle namespace with a
+ * single query of the TPM, for persisting many objects in one go.
+ * @param ctx
+ *  Enhanced System API (ESAPI) context
+ * @param is_platform
+ *  true if the persistent handles should be in the persistent range allocated
+ *  for platform hierarchy, false otherwise.
+ * @param count
+ *  The number of vacant handles to find.
+ * @param vacant
+ *  Receives count vacant handles, in ascending order, if True returned.
+ * @return
+ *  tool_rc indicating status.
+ */
+tool_rc tpm2_capability_find_vacant_persistent_handles(ESYS_CONTEXT *ctx,
+        bool is_platform, UINT32 count, TPMI_DH_PERSISTENT *vacant);
+
+/**
+ * The size of the chunks to send large input in, ie to hash and HMAC
+ * sequences or to EncryptDecrypt: TPM2_PT_INPUT_BUFFER, bounded by the
+ * TPM2B_MAX_BUFFER of the TSS. The property is a fixed one, so it comes from
+ * the capability cache when enabled, and it is only read once per process.
+ * @param ctx
+ *  Enhanced System API (ESAPI) context, NULL for the bound of the TSS.
+ * @return
+ *  The chunk size, the bound of the TSS if the TPM does not report one.
+ */
+UINT16 tpm2_capability_max_buffer_size(ESYS_CONTEXT *ctx);
+
+/*
+ * The facts the tools derive from the fixed properties of a TPM, which are
+ * as fixed as the properties are.
+ */
+typedef enum tpm2_capability_fact tpm2_capability_fact;
+enum tpm2_capability_fact {
+    /* the bitmap of the tpm2_errata_index_t the TPM needs fixups for */
+    tpm2_capability_fact_errata = 1,
+};
+
+/**
+ * Looks up a fact in the capability cache, where it is kept like the results
+ * of tpm2_capability_test_parms(), as long as the firmware of the TPM stays
+ * the same.
+ * @param ectx
+ *  Enhanced System API (ESAPI) context
+ * @param fact
+ *  The fact to look up.
+ * @param value
+ *  Receives the value of the fact.
+ * @return
+ *  true if the cache holds the fact, false otherwise or without a cache.
+ */
+bool tpm2_capability_fact_get(ESYS_CONTEXT *ectx, tpm2_capability_fact fact,
+        UINT32 *value);
+
+/**
+ * Adds a fact to the capability cache, a fact already cached is kept.
+ * Without a cache, nothing is done.
+ * @param ectx
+ *  Enhanced System API (ESAPI) context
+ * @param fact
+ *  The fact to add.
+ * @param value
+ *  The value of the fact, derived from the fixed properties of the TPM.
+ */
+void tpm2_capability_fact_put(ESYS_CONTEXT *ectx, tpm2_capability_fact fact,
+        UINT32 value);
+
 #endif /* LIB_TPM2_CAPABILITY_H_ */
@@ -0,0 +1,437 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <sys/file.h>
+
+#include "files.h"
+#include "log.h"
+#include "tpm2_capture.h"
+#include "tpm2_util.h"
+
+#define CAPTURE_MAGIC "TPM2CAPT"
+#define CAPTURE_MAGIC_SIZE 8
+
+/* the offset of the sequence number of the next record in the header */
+#define CAPTURE_NEXT_SEQ_OFFSET 24
+
+/* the tag and size fields precede the command and response code */
+#define CAPTURE_CODE_OFFSET 6
+
+/* keep a ring file within a few hundred MiB */
+#define CAPTURE_ENTRIES_MAX 65536
+
+static uint64_t now_ns(clockid_t clock) {
+
+    struct timespec ts;
+    clock_gettime(clock, &ts);
+
+    return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static UINT32 get_u32(const uint8_t *p) {
+
+    return (UINT32) p[0] << 24 | p[1] << 16 | p[2] << 8 | p[3];
+}
+
+static uint64_t get_u64(const uint8_t *p) {
+
+    return (uint64_t) get_u32(p) << 32 | get_u32(&p[4]);
+}
+
+static void put_u32(uint8_t *p, UINT32 value) {
+
+    p[0] = value >> 24;
+    p[1] = value >> 16;
+    p[2] = value >> 8;
+    p[3] = value;
+}
+
+static void put_u64(uint8_t *p, uint64_t value) {
+
+    put_u32(p, value >> 32);
+    put_u32(&p[4], value);
+}
+
+/*
+ * A TCTI forwarding to the one loaded for the tool, which records every
+ * command with its response code and latency in a ring file.
+ */
+typedef struct capture_tcti capture_tcti;
+struct capture_tcti {
+    TSS2_TCTI_CONTEXT_COMMON_V2 common;
+    TSS2_TCTI_CONTEXT *inner;
+    char *path;
+    UINT32 entries;
+    bool is_in_flight;
+    uint64_t sent_ns;
+    uint64_t sent_realtime_ns;
+    size_t command_size;
+    uint8_t command[TPM2_MAX_SIZE];
+};
+
+static bool write_all(int fd, const uint8_t *buf, size_t size, off_t offset) {
+
+    while (size) {
+        ssize_t n = pwrite(fd, buf, size, offset);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        buf += n;
+        size -= n;
+        offset += n;
+    }
+
+    return true;
+}
+
+static bool read_all(int fd, uint8_t *buf, size_t size, off_t offset) {
+
+    while (size) {
+        ssize_t n = pread(fd, buf, size, offset);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return false;
+        }
+        buf += n;
+        size -= n;
+        offset += n;
+    }
+
+    return true;
+}
+
+/*
+ * The header of the ring file, creating it for an empty file. An existing
+ * ring keeps its size, so tools configured differently share one ring.
+ */
+static bool load_header(int fd, UINT32 entries, uint8_t *header) {
+
+    off_t size = lseek(fd, 0, SEEK_END);
+    if (size < 0) {
+        return false;
+    }
+
+    if (size == 0) {
+        memcpy(header, CAPTURE_MAGIC, CAPTURE_MAGIC_SIZE);
+        put_u32(&header[8], TPM2_CAPTURE_VERSION);
+        put_u32(&header[12], entries);
+        put_u32(&header[16], TPM2_CAPTURE_SLOT_SIZE);
+        put_u32(&header[20], 0);
+        put_u64(&header[CAPTURE_NEXT_SEQ_OFFSET], 0);
+        return write_all(fd, header, TPM2_CAPTURE_HEADER_SIZE, 0);
+    }
+
+    if (!read_all(fd, header, TPM2_CAPTURE_HEADER_SIZE, 0)) {
+        return false;
+    }
+
+    return !memcmp(header, CAPTURE_MAGIC, CAPTURE_MAGIC_SIZE)
+            && get_u32(&header[8]) == TPM2_CAPTURE_VERSION
+            && get_u32(&header[12])
+            && get_u32(&header[16]) == TPM2_CAPTURE_SLOT_SIZE;
+}
+
+/*
+ * Every record opens the ring file anew, so the records of the tools sharing
+ * a ring, like the forked children of a batch, are serialized by the lock.
+ */
+static void record_command(capture_tcti *tcti, TSS2_RC rc,
+        size_t response_size, uint64_t latency_ns) {
+
+    int fd = open(tcti->path, O_RDWR | O_CREAT, 0600);
+    if (fd < 0) {
+        LOG_WARN("Could not open capture file \"%s\", error: %s", tcti->path,
+                strerror(errno));
+        return;
+    }
+
+    if (flock(fd, LOCK_EX)) {
+        LOG_WARN("Could not lock capture file \"%s\", error: %s", tcti->path,
+                strerror(errno));
+        close(fd);
+        return;
+    }
+
+    uint8_t header[TPM2_CAPTURE_HEADER_SIZE];
+    if (!load_header(fd, tcti->entries, header)) {
+        LOG_WARN("\"%s\" is not a TPM command capture file", tcti->path);
+        goto out;
+    }
+
+    UINT32 entries = get_u32(&header[12]);
+    uint64_t seq = get_u64(&header[CAPTURE_NEXT_SEQ_OFFSET]);
+
+    uint8_t record[TPM2_CAPTURE_RECORD_HEADER_SIZE];
+    put_u64(&record[0], seq);
+    put_u64(&record[8], tcti->sent_realtime_ns);
+    put_u64(&record[16], latency_ns);
+    put_u32(&record[24], get_u32(&tcti->command[CAPTURE_CODE_OFFSET]));
+    put_u32(&record[28], rc);
+    put_u32(&record[32], tcti->command_size);
+    put_u32(&record[36], response_size);
+
+    off_t offset = TPM2_CAPTURE_HEADER_SIZE
+            + (off_t) (seq % entries) * TPM2_CAPTURE_SLOT_SIZE;
+
+    /* the sequence number last, so a reader never sees a torn record */
+    put_u64(&header[CAPTURE_NEXT_SEQ_OFFSET], seq + 1);
+    bool result = write_all(fd, record, sizeof(record), offset)
+            && write_all(fd, tcti->command, tcti->command_size,
+                    offset + sizeof(record))
+            && write_all(fd, &header[CAPTURE_NEXT_SEQ_OFFSET], sizeof(seq),
+                    CAPTURE_NEXT_SEQ_OFFSET);
+    if (!result) {
+        LOG_WARN("Could not write capture file \"%s\", error: %s", tcti->path,
+                strerror(errno));
+    }
+
+out:
+    flock(fd, LOCK_UN);
+    close(fd);
+}
+
+static TSS2_RC capture_tcti_transmit(TSS2_TCTI_CONTEXT *tcti_context,
+        size_t size, const uint8_t *command) {
+
+    capture_tcti *tcti = (capture_tcti *) tcti_context;
+
+    TSS2_RC rval = Tss2_Tcti_Transmit(tcti->inner, size, command);
+    if (rval != TSS2_RC_SUCCESS) {
+        return rval;
+    }
+
+    tcti->is_in_flight = size >= TPM2_COMMAND_HEADER_SIZE
+            && size <= sizeof(tcti->command);
+    if (tcti->is_in_flight) {
+        memcpy(tcti->command, command, size);
+        tcti->command_size = size;
+        tcti->sent_realtime_ns = now_ns(CLOCK_REALTIME);
+        tcti->sent_ns = now_ns(CLOCK_MONOTONIC);
+    }
+
+    return rval;
+}
+
+static TSS2_RC capture_tcti_receive(TSS2_TCTI_CONTEXT *tcti_context,
+        size_t *size, uint8_t *response, int32_t timeout) {
+
+    capture_tcti *tcti = (capture_tcti *) tcti_context;
+
+    TSS2_RC rval = Tss2_Tcti_Receive(tcti->inner, size, response, timeout);
+
+    /* a NULL response only queries the size, the command is still running */
+    if (!tcti->is_in_flight || !response || rval == TSS2_TCTI_RC_TRY_AGAIN) {
+        return rval;
+    }
+
+    tcti->is_in_flight = false;
+    uint64_t latency_ns = now_ns(CLOCK_MONOTONIC) - tcti->sent_ns;
+
+    if (rval != TSS2_RC_SUCCESS) {
+        record_command(tcti, rval, 0, latency_ns);
+    } else if (*size >= TPM2_RESPONSE_HEADER_SIZE) {
+        record_command(tcti, get_u32(&response[CAPTURE_CODE_OFFSET]), *size,
+                latency_ns);
+    }
+
+    return rval;
+}
+
+static TSS2_RC capture_tcti_cancel(TSS2_TCTI_CONTEXT *tcti_context) {
+
+    capture_tcti *tcti = (capture_tcti *) tcti_context;
+    tcti->is_in_flight = false;
+
+    return Tss2_Tcti_Cancel(tcti->inner);
+}
+
+static TSS2_RC capture_tcti_get_poll_handles(TSS2_TCTI_CONTEXT *tcti_context,
+        TSS2_TCTI_POLL_HANDLE *handles, size_t *num_handles) {
+
+    capture_tcti *tcti = (capture_tcti *) tcti_context;
+
+    return Tss2_Tcti_GetPollHandles(tcti->inner, handles, num_handles);
+}
+
+static TSS2_RC capture_tcti_set_locality(TSS2_TCTI_CONTEXT *tcti_context,
+        uint8_t locality) {
+
+    capture_tcti *tcti = (capture_tcti *) tcti_context;
+
+    return Tss2_Tcti_SetLocality(tcti->inner, locality);
+}
+
+static TSS2_RC capture_tcti_make_sticky(TSS2_TCTI_CONTEXT *tcti_context,
+        TPM2_HANDLE *handle, uint8_t sticky) {
+
+    capture_tcti *tcti = (capture_tcti *) tcti_context;
+
+    return Tss2_Tcti_MakeSticky(tcti->inner, handle, sticky);
+}
+
+static UINT32 get_entries(void) {
+
+    const char *value = tpm2_util_getenv(TPM2TOOLS_ENV_CAPTURE_ENTRIES);
+    if (!value) {
+        return TPM2_CAPTURE_ENTRIES_DEFAULT;
+    }
+
+    UINT32 entries;
+    bool result = tpm2_util_string_to_uint32(value, &entries);
+    if (!result || !entries || entries > CAPTURE_ENTRIES_MAX) {
+        LOG_WARN("Invalid %s value \"%s\", expected 1 to %u, using %u",
+                TPM2TOOLS_ENV_CAPTURE_ENTRIES, value, CAPTURE_ENTRIES_MAX,
+                TPM2_CAPTURE_ENTRIES_DEFAULT);
+        return TPM2_CAPTURE_ENTRIES_DEFAULT;
+    }
+
+    return entries;
+}
+
+TSS2_TCTI_CONTEXT *tpm2_capture_tcti_wrap(TSS2_TCTI_CONTEXT *tcti) {
+
+    const char *path = tpm2_util_getenv(TPM2TOOLS_ENV_CAPTURE_FILE);
+    if (!path || !path[0] || !tcti) {
+        return tcti;
+    }
+
+    capture_tcti *wrapper = calloc(1, sizeof(*wrapper));
+    if (!wrapper) {
+        LOG_WARN("oom, not capturing TPM commands");
+        return tcti;
+    }
+
+    wrapper->path = strdup(path);
+    if (!wrapper->path) {
+        LOG_WARN("oom, not capturing TPM commands");
+        free(wrapper);
+        return tcti;
+    }
+
+    /*
+     * The wrapped TCTI stays owned by the caller, who finalizes it after
+     * unwrapping, so there is no finalize to forward.
+     */
+    wrapper->common.v1.magic = TSS2_TCTI_MAGIC(tcti);
+    wrapper->common.v1.version = 2;
+    wrapper->common.v1.transmit = capture_tcti_transmit;
+    wrapper->common.v1.receive = capture_tcti_receive;
+    wrapper->common.v1.cancel = capture_tcti_cancel;
+    wrapper->common.v1.getPollHandles = capture_tcti_get_poll_handles;
+    wrapper->common.v1.setLocality = capture_tcti_set_locality;
+    wrapper->common.makeSticky = capture_tcti_make_sticky;
+    wrapper->inner = tcti;
+    wrapper->entries = get_entries();
+
+    return (TSS2_TCTI_CONTEXT *) wrapper;
+}
+
+TSS2_TCTI_CONTEXT *tpm2_capture_tcti_unwrap(TSS2_TCTI_CONTEXT *tcti) {
+
+    if (!tcti || TSS2_TCTI_TRANSMIT(tcti) != capture_tcti_transmit) {
+        return tcti;
+    }
+
+    capture_tcti *wrapper = (capture_tcti *) tcti;
+    TSS2_TCTI_CONTEXT *inner = wrapper->inner;
+    free(wrapper->path);
+    free(wrapper);
+
+    return inner;
+}
+
+bool tpm2_capture_reader_init(tpm2_capture_reader *reader, FILE *input) {
+
+    memset(reader, 0, sizeof(*reader));
+
+    char magic[CAPTURE_MAGIC_SIZE];
+    UINT32 version;
+    UINT32 reserved;
+    UINT64 next_seq;
+    bool result = files_read_bytes(input, (UINT8 *) magic, sizeof(magic))
+            && !memcmp(magic, CAPTURE_MAGIC, sizeof(magic))
+            && files_read_32(input, &version)
+            && files_read_32(input, &reader->entries)
+            && files_read_32(input, &reader->slot_size)
+            && files_read_32(input, &reserved)
+            && files_read_64(input, &next_seq);
+    if (!result) {
+        LOG_ERR("Input is not a TPM command capture file");
+        return false;
+    }
+
+    if (version != TPM2_CAPTURE_VERSION || !reader->entries
+            || reader->slot_size != TPM2_CAPTURE_SLOT_SIZE) {
+        LOG_ERR("Unsupported TPM command capture file version %u", version);
+        return false;
+    }
+
+    reader->input = input;
+    reader->end = next_seq;
+    reader->seq = next_seq > reader->entries ? next_seq - reader->entries : 0;
+
+    return true;
+}
+
+int tpm2_capture_reader_next(tpm2_capture_reader *reader,
+        tpm2_capture_record *record) {
+
+    for (; reader->seq < reader->end; reader->seq++) {
+
+        off_t offset = TPM2_CAPTURE_HEADER_SIZE
+                + (off_t) (reader->seq % reader->entries) * reader->slot_size;
+        if (fseeko(reader->input, offset, SEEK_SET)) {
+            LOG_ERR("Could not seek capture file, error: %s", strerror(errno));
+            return -1;
+        }
+
+        UINT64 seq;
+        bool result = files_read_64(reader->input, &seq)
+                && files_read_64(reader->input, &record->time_ns)
+                && files_read_64(reader->input, &record->latency_ns)
+                && files_read_32(reader->input, &record->cc)
+                && files_read_32(reader->input, &record->rc)
+                && files_read_32(reader->input, &record->command_size)
+                && files_read_32(reader->input, &record->response_size);
+        if (!result) {
+            LOG_ERR("Could not read capture record %" PRIu64, reader->seq);
+            return -1;
+        }
+
+        /* overwritten by a writer since the header was read */
+        if (seq != reader->seq) {
+            continue;
+        }
+
+        if (record->command_size < TPM2_COMMAND_HEADER_SIZE
+                || record->command_size > sizeof(record->command)) {
+            LOG_ERR("Capture record %" PRIu64 " has an invalid command size %u",
+                    seq, record->command_size);
+            return -1;
+        }
+
+        if (!files_read_bytes(reader->input, record->command,
+                record->command_size)) {
+            LOG_ERR("Could not read capture record %" PRIu64, seq);
+            return -1;
+        }
+
+        record->seq = seq;
+        reader->seq++;
+        return 1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,110 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+#ifndef LIB_TPM2_CAPTURE_H_
+#define LIB_TPM2_CAPTURE_H_
+
+#include <stdbool.h>
+#include <stdio.h>
+
+#include <tss2/tss2_tcti.h>
+
+#include "tpm2_header.h"
+
+/*
+ * Environment variable naming the ring file the TPM commands of every tool
+ * are recorded in. Unset disables capturing.
+ */
+#define TPM2TOOLS_ENV_CAPTURE_FILE "TPM2TOOLS_CAPTURE_FILE"
+
+/*
+ * Environment variable with the number of commands a new ring file holds,
+ * the oldest commands are overwritten once it is full.
+ */
+#define TPM2TOOLS_ENV_CAPTURE_ENTRIES "TPM2TOOLS_CAPTURE_ENTRIES"
+
+#define TPM2_CAPTURE_ENTRIES_DEFAULT 256
+
+/*
+ * The ring file, all integers big endian:
+ *
+ * header: "TPM2CAPT", u32 version, u32 entries, u32 slot size, u32 reserved,
+ *         u64 sequence number of the next record
+ * slots:  entries times slot size bytes, the record with sequence number n
+ *         in slot n % entries
+ * record: u64 sequence number, u64 realtime the command was sent at in ns,
+ *         u64 latency in ns, u32 command code, u32 response code, u32 command
+ *         size, u32 response size, followed by the command
+ *
+ * A response code of the TCTI layer records a command that got no response.
+ */
+#define TPM2_CAPTURE_VERSION 1
+
+#define TPM2_CAPTURE_HEADER_SIZE 32
+#define TPM2_CAPTURE_RECORD_HEADER_SIZE 40
+#define TPM2_CAPTURE_SLOT_SIZE \
+    (TPM2_CAPTURE_RECORD_HEADER_SIZE + TPM2_MAX_SIZE)
+
+typedef struct tpm2_capture_record tpm2_capture_record;
+struct tpm2_capture_record {
+    uint64_t seq;
+    uint64_t time_ns;
+    uint64_t latency_ns;
+    TPM2_CC cc;
+    TPM2_RC rc;
+    UINT32 command_size;
+    UINT32 response_size;
+    UINT8 command[TPM2_MAX_SIZE];
+};
+
+typedef struct tpm2_capture_reader tpm2_capture_reader;
+struct tpm2_capture_reader {
+    FILE *input;
+    UINT32 entries;
+    UINT32 slot_size;
+    uint64_t seq;
+    uint64_t end;
+};
+
+/**
+ * Wraps a TCTI to record the commands sent through it in the ring file named
+ * by TPM2TOOLS_CAPTURE_FILE. Without it the TCTI is returned as is.
+ * @param tcti
+ *  The TCTI to wrap.
+ * @return
+ *  The TCTI to hand to ESAPI.
+ */
+TSS2_TCTI_CONTEXT *tpm2_capture_tcti_wrap(TSS2_TCTI_CONTEXT *tcti);
+
+/**
+ * Releases a TCTI returned by tpm2_capture_tcti_wrap().
+ * @param tcti
+ *  A TCTI returned by tpm2_capture_tcti_wrap().
+ * @return
+ *  The wrapped TCTI, which is still to be finalized by the caller.
+ */
+TSS2_TCTI_CONTEXT *tpm2_capture_tcti_unwrap(TSS2_TCTI_CONTEXT *tcti);
+
+/**
+ * Starts reading the records of a ring file, oldest first.
+ * @param reader
+ *  The reader to initialize.
+ * @param input
+ *  The ring file, which has to be seekable.
+ * @return
+ *  True on success, false if input is not a ring file.
+ */
+bool tpm2_capture_reader_init(tpm2_capture_reader *reader, FILE *input);
+
+/**
+ * Reads the next record of a ring file.
+ * @param reader
+ *  The reader.
+ * @param record
+ *  The record read.
+ * @return
+ *  1 if a record was read, 0 after the newest record, -1 on error.
+ */
+int tpm2_capture_reader_next(tpm2_capture_reader *reader,
+        tpm2_capture_record *record);
+
+#endif /* LIB_TPM2_CAPTURE_H_ */
@@ -0,0 +1,161 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+#include <errno.h>
+#include <inttypes.h>
+#include <string.h>
+#include <time.h>
+
+#include "tpm2.h"
+#include "tpm2_clock_monitor.h"
+#include "tpm2_util.h"
+#include "tpm2_writer.h"
+
+static const struct {
+    tpm2_clock_anomaly anomaly;
+    const char *name;
+} anomaly_names[] = {
+    { tpm2_clock_anomaly_reset,     "reset"     },
+    { tpm2_clock_anomaly_restart,   "restart"   },
+    { tpm2_clock_anomaly_backwards, "backwards" },
+    { tpm2_clock_anomaly_unsafe,    "unsafe"    },
+    { tpm2_clock_anomaly_drift,     "drift"     },
+};
+
+static void rebase(tpm2_clock_monitor *m, const TPMS_TIME_INFO *info,
+        UINT64 host) {
+
+    m->clock_base = info->clockInfo.clock;
+    m->host_base = host;
+}
+
+void tpm2_clock_monitor_init(tpm2_clock_monitor *m, UINT64 max_drift) {
+
+    memset(m, 0, sizeof(*m));
+    m->max_drift = max_drift;
+}
+
+UINT32 tpm2_clock_monitor_sample(tpm2_clock_monitor *m,
+        const TPMS_TIME_INFO *info, UINT64 host) {
+
+    if (!m->is_started) {
+        m->is_started = true;
+        m->last = *info;
+        m->last_host = host;
+        rebase(m, info, host);
+        return 0;
+    }
+
+    const TPMS_CLOCK_INFO *clock = &info->clockInfo;
+    const TPMS_CLOCK_INFO *last = &m->last.clockInfo;
+
+    m->delta_time = (INT64) (info->time - m->last.time);
+    m->delta_clock = (INT64) (clock->clock - last->clock);
+    m->delta_host = (INT64) (host - m->last_host);
+    m->drift = (INT64) (clock->clock - m->clock_base)
+            - (INT64) (host - m->host_base);
+
+    UINT32 anomalies = 0;
+    if (clock->resetCount != last->resetCount) {
+        anomalies |= tpm2_clock_anomaly_reset;
+    }
+    if (clock->restartCount != last->restartCount) {
+        anomalies |= tpm2_clock_anomaly_restart;
+    }
+    if (clock->clock < last->clock) {
+        anomalies |= tpm2_clock_anomaly_backwards;
+    }
+    if (last->safe && !clock->safe) {
+        anomalies |= tpm2_clock_anomaly_unsafe;
+    }
+    UINT64 drift = m->drift < 0 ? -(UINT64) m->drift : (UINT64) m->drift;
+    if (drift > m->max_drift) {
+        anomalies |= tpm2_clock_anomaly_drift;
+    }
+
+    /* the clock after an anomaly is the one to compare with */
+    if (anomalies) {
+        rebase(m, info, host);
+    }
+
+    m->last = *info;
+    m->last_host = host;
+
+    return anomalies;
+}
+
+static UINT64 host_time(void) {
+
+    struct timespec ts = { 0 };
+    clock_gettime(CLOCK_REALTIME, &ts);
+
+    return (UINT64) ts.tv_sec * 1000 + (UINT64) ts.tv_nsec / 1000000;
+}
+
+tool_rc tpm2_clock_monitor_read(ESYS_CONTEXT *ectx, tpm2_clock_monitor *m,
+        TPMS_TIME_INFO *info, UINT32 *anomalies) {
+
+    UINT64 before = host_time();
+
+    TPMS_TIME_INFO *current_time = NULL;
+    tool_rc rc = tpm2_readclock(ectx, &current_time);
+    if (rc != tool_rc_success) {
+        return rc;
+    }
+
+    /* the TPM sampled its clock somewhere in between */
+    UINT64 after = host_time();
+    UINT64 host = after > before ? before + (after - before) / 2 : after;
+
+    *info = *current_time;
+    Esys_Free(current_time);
+
+    *anomalies = tpm2_clock_monitor_sample(m, info, host);
+
+    return tool_rc_success;
+}
+
+void tpm2_clock_monitor_print(const tpm2_clock_monitor *m, UINT32 poll,
+        UINT32 anomalies) {
+
+    const TPMS_TIME_INFO *info = &m->last;
+
+    tpm2_writer_number("poll", "%"PRIu32, poll);
+    tpm2_writer_number("time", "%"PRIu64, info->time);
+
+    tpm2_writer_map_start("clock_info");
+    tpm2_writer_number("clock", "%"PRIu64, info->clockInfo.clock);
+    tpm2_writer_number("reset_count", "%"PRIu32, info->clockInfo.resetCount);
+    tpm2_writer_number("restart_count", "%"PRIu32,
+            info->clockInfo.restartCount);
+    tpm2_writer_value("safe", tpm2_writer_type_bool, "%s",
+            info->clockInfo.safe ? "yes" : "no");
+    tpm2_writer_end();
+
+    /* the first sample has nothing to compare with */
+    if (!poll) {
+        return;
+    }
+
+    tpm2_writer_map_start("delta");
+    tpm2_writer_number("time", "%"PRIi64, m->delta_time);
+    tpm2_writer_number("clock", "%"PRIi64, m->delta_clock);
+    tpm2_writer_number("host", "%"PRIi64, m->delta_host);
+    tpm2_writer_end();
+
+    tpm2_writer_number("drift", "%"PRIi64, m->drift);
+
+    tpm2_writer_flow_start("anomalies");
+    size_t i;
+    for (i = 0; i < ARRAY_LEN(anomaly_names); i++) {
+        if (anomalies & anomaly_names[i].anomaly) {
+            tpm2_writer_string(NULL, "%s", anomaly_names[i].name);
+        }
+    }
+    tpm2_writer_end();
+}
+
+void tpm2_clock_monitor_sleep(UINT32 seconds) {
+
+    struct timespec ts = { .tv_sec = seconds };
+    while (nanosleep(&ts, &ts) && errno == EINTR);
+}
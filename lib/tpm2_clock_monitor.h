@@ -0,0 +1,115 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+#ifndef LIB_TPM2_CLOCK_MONITOR_H_
+#define LIB_TPM2_CLOCK_MONITOR_H_
+
+#include <stdbool.h>
+
+#include <tss2/tss2_esys.h>
+
+#include "tool_rc.h"
+
+/*
+ * The clock monitor of the --watch option of tpm2_readclock and
+ * tpm2_gettime. It compares every sample of the TPM clock with the one
+ * before it and with the time of the host, and tells the anomalies apart
+ * from the regular progress of the clock, so the tools only output the
+ * samples with an anomaly.
+ *
+ * The drift is how far the clock of the TPM got ahead of the real time of the
+ * host, in ms, since the first sample or the last anomaly, where the monitor
+ * starts over so that an anomaly is reported once.
+ */
+typedef enum tpm2_clock_anomaly tpm2_clock_anomaly;
+enum tpm2_clock_anomaly {
+    /* resetCount changed, a TPM Reset */
+    tpm2_clock_anomaly_reset = 1 << 0,
+    /* restartCount changed, a TPM Restart or Resume */
+    tpm2_clock_anomaly_restart = 1 << 1,
+    /* the clock went back, it was not saved to NV in time */
+    tpm2_clock_anomaly_backwards = 1 << 2,
+    /* the safe flag went down */
+    tpm2_clock_anomaly_unsafe = 1 << 3,
+    /* the drift is over the maximum */
+    tpm2_clock_anomaly_drift = 1 << 4,
+};
+
+typedef struct tpm2_clock_monitor tpm2_clock_monitor;
+struct tpm2_clock_monitor {
+    /* the largest drift that is no anomaly, in ms */
+    UINT64 max_drift;
+    bool is_started;
+    /* the last sample and the host time it was taken at */
+    TPMS_TIME_INFO last;
+    UINT64 last_host;
+    /* where the drift is measured from */
+    UINT64 clock_base;
+    UINT64 host_base;
+    /* the progress since the sample before the last one */
+    INT64 delta_time;
+    INT64 delta_clock;
+    INT64 delta_host;
+    INT64 drift;
+};
+
+/**
+ * Starts a monitor.
+ * @param m
+ *  The monitor.
+ * @param max_drift
+ *  The largest drift that is no anomaly, in ms.
+ */
+void tpm2_clock_monitor_init(tpm2_clock_monitor *m, UINT64 max_drift);
+
+/**
+ * Adds a sample of the clock to the monitor.
+ * @param m
+ *  The monitor.
+ * @param info
+ *  The sample.
+ * @param host
+ *  The real time of the host when the sample was taken, in ms.
+ * @return
+ *  The tpm2_clock_anomaly flags of the sample, 0 for the first sample.
+ */
+UINT32 tpm2_clock_monitor_sample(tpm2_clock_monitor *m,
+        const TPMS_TIME_INFO *info, UINT64 host);
+
+/**
+ * Invokes ReadClock and adds the result to the monitor, timestamped halfway
+ * through the command.
+ * @param ectx
+ *  The ESAPI context.
+ * @param m
+ *  The monitor.
+ * @param info
+ *  Receives the sample.
+ * @param anomalies
+ *  Receives the tpm2_clock_anomaly flags of the sample.
+ * @return
+ *  tool_rc indicating status.
+ */
+tool_rc tpm2_clock_monitor_read(ESYS_CONTEXT *ectx, tpm2_clock_monitor *m,
+        TPMS_TIME_INFO *info, UINT32 *anomalies);
+
+/**
+ * Outputs the last sample, its deltas, the drift and the anomalies as the
+ * entries of the current map of the writer.
+ * @param m
+ *  The monitor.
+ * @param poll
+ *  The number of the poll, 0 for the first sample.
+ * @param anomalies
+ *  The tpm2_clock_anomaly flags of the sample.
+ */
+void tpm2_clock_monitor_print(const tpm2_clock_monitor *m, UINT32 poll,
+        UINT32 anomalies);
+
+/**
+ * Sleeps between the polls.
+ * @param seconds
+ *  The interval of the polls.
+ */
+void tpm2_clock_monitor_sleep(UINT32 seconds);
+
+#endif /* LIB_TPM2_CLOCK_MONITOR_H_ */
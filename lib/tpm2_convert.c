@@ -1,5 +1,6 @@
 /* SPDX-License-Identifier: BSD-3-Clause */
 
+#include <errno.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -11,15 +12,14 @@
 #include <openssl/evp.h>
 #include <openssl/pem.h>
 
+#include <tss2/tss2_mu.h>
+
 #include "files.h"
 #include "log.h"
 #include "tpm2_alg_util.h"
 #include "tpm2_convert.h"
 #include "tpm2_openssl.h"
 
-static bool tpm2_convert_pubkey_ssl(TPMT_PUBLIC *public,
-        tpm2_convert_pubkey_fmt format, const char *path);
-
 tpm2_convert_pcrs_output_fmt tpm2_convert_pcrs_output_fmt_from_optarg(
     const char *label) {
 
@@ -27,6 +27,8 @@ tpm2_convert_pcrs_output_fmt tpm2_convert_pcrs_output_fmt_from_optarg(
         return pcrs_output_format_values;
     } else if (strcasecmp(label, "serialized") == 0) {
         return pcrs_output_format_serialized;
+    } else if (strcasecmp(label, "bundle") == 0) {
+        return pcrs_output_format_bundle;
     }
 
     LOG_ERR("Invalid pcrs output format '%s' specified", label);
@@ -43,6 +45,8 @@ tpm2_convert_pubkey_fmt tpm2_convert_pubkey_fmt_from_optarg(const char *label) {
         return pubkey_format_tss;
     } else if (strcasecmp(label, "tpmt") == 0) {
         return pubkey_format_tpmt;
+    } else if (strcasecmp(label, "ssh") == 0) {
+        return pubkey_format_ssh;
     }
 
     LOG_ERR("Invalid public key output format '%s' specified", label);
@@ -70,25 +74,9 @@ static void print_ssl_error(const char *failed_action) {
     LOG_ERR("%s: %s", failed_action, errstr);
 }
 
-bool tpm2_convert_pubkey_save(TPM2B_PUBLIC *public,
-        tpm2_convert_pubkey_fmt format, const char *path) {
-
-    if (format == pubkey_format_der || format == pubkey_format_pem) {
-        return tpm2_convert_pubkey_ssl(&public->publicArea, format, path);
-    } else if (format == pubkey_format_tss) {
-        return files_save_public(public, path);
-    } else if (format == pubkey_format_tpmt) {
-        return files_save_template(&public->publicArea, path);
-    }
-
-    LOG_ERR("Unsupported public key output format.");
-    return false;
-}
-
-static bool convert_pubkey_RSA(TPMT_PUBLIC *public,
-        tpm2_convert_pubkey_fmt format, BIO *bio) {
+static EVP_PKEY *convert_pubkey_RSA(TPMT_PUBLIC *public) {
 
-    bool ret = false;
+    EVP_PKEY *pkey = NULL;
     RSA *ssl_rsa_key = NULL;
     BIGNUM *e = NULL, *n = NULL;
 
@@ -122,26 +110,16 @@ static bool convert_pubkey_RSA(TPMT_PUBLIC *public,
     /* modulus and exponent components are now owned by the RSA struct */
     n = e = NULL;
 
-    int ssl_res = 0;
-
-    switch (format) {
-    case pubkey_format_pem:
-        ssl_res = PEM_write_bio_RSA_PUBKEY(bio, ssl_rsa_key);
-        break;
-    case pubkey_format_der:
-        ssl_res = i2d_RSA_PUBKEY_bio(bio, ssl_rsa_key);
-        break;
-    default:
-        LOG_ERR("Invalid OpenSSL target format %d encountered", format);
-        goto error;
-    }
-
-    if (ssl_res <= 0) {
-        print_ssl_error("OpenSSL public key conversion failed");
+    pkey = EVP_PKEY_new();
+    if (!pkey || !EVP_PKEY_assign_RSA(pkey, ssl_rsa_key)) {
+        print_ssl_error("Failed to wrap the RSA key");
+        EVP_PKEY_free(pkey);
+        pkey = NULL;
         goto error;
     }
 
-    ret = true;
+    /* the RSA struct is now owned by the EVP_PKEY */
+    ssl_rsa_key = NULL;
 
     error: if (n) {
         BN_free(n);
@@ -153,11 +131,10 @@ static bool convert_pubkey_RSA(TPMT_PUBLIC *public,
         RSA_free(ssl_rsa_key);
     }
 
-    return ret;
+    return pkey;
 }
 
-static bool convert_pubkey_ECC(TPMT_PUBLIC *public,
-        tpm2_convert_pubkey_fmt format, BIO *bio) {
+static EVP_PKEY *convert_pubkey_ECC(TPMT_PUBLIC *public) {
 
     BIGNUM *x = NULL;
     BIGNUM *y = NULL;
@@ -165,14 +142,14 @@ static bool convert_pubkey_ECC(TPMT_PUBLIC *public,
     EC_POINT *point = NULL;
     const EC_GROUP *group = NULL;
 
-    bool result = false;
+    EVP_PKEY *pkey = NULL;
 
     TPMS_ECC_PARMS *tpm_ecc = &public->parameters.eccDetail;
     TPMS_ECC_POINT *tpm_point = &public->unique.ecc;
 
     int nid = tpm2_ossl_curve_to_nid(tpm_ecc->curveID);
     if (nid < 0) {
-        return false;
+        return NULL;
     }
 
     /*
@@ -181,7 +158,7 @@ static bool convert_pubkey_ECC(TPMT_PUBLIC *public,
     key = EC_KEY_new_by_curve_name(nid);
     if (!key) {
         print_ssl_error("Failed to create EC key from nid");
-        return false;
+        return NULL;
     }
 
     group = EC_KEY_get0_group(key);
@@ -222,26 +199,16 @@ static bool convert_pubkey_ECC(TPMT_PUBLIC *public,
         goto out;
     }
 
-    int ssl_res = 0;
-
-    switch (format) {
-    case pubkey_format_pem:
-        ssl_res = PEM_write_bio_EC_PUBKEY(bio, key);
-        break;
-    case pubkey_format_der:
-        ssl_res = i2d_EC_PUBKEY_bio(bio, key);
-        break;
-    default:
-        LOG_ERR("Invalid OpenSSL target format %d encountered", format);
-        goto out;
-    }
-
-    if (ssl_res <= 0) {
-        print_ssl_error("OpenSSL public key conversion failed");
+    pkey = EVP_PKEY_new();
+    if (!pkey || !EVP_PKEY_assign_EC_KEY(pkey, key)) {
+        print_ssl_error("Failed to wrap the EC key");
+        EVP_PKEY_free(pkey);
+        pkey = NULL;
         goto out;
     }
 
-    result = true;
+    /* the EC key is now owned by the EVP_PKEY */
+    key = NULL;
 
 out:
     if (x) {
@@ -257,45 +224,248 @@ out:
         EC_KEY_free(key);
     }
 
-    return result;
+    return pkey;
 }
 
-static bool tpm2_convert_pubkey_bio(TPMT_PUBLIC *public,
-        tpm2_convert_pubkey_fmt format, BIO *bio) {
-
-    bool result = false;
+static EVP_PKEY *convert_pubkey_pkey(TPMT_PUBLIC *public) {
 
     switch (public->type) {
     case TPM2_ALG_RSA:
-        result = convert_pubkey_RSA(public, format, bio);
-        break;
+        return convert_pubkey_RSA(public);
     case TPM2_ALG_ECC:
-        result = convert_pubkey_ECC(public, format, bio);
-        break;
+        return convert_pubkey_ECC(public);
     default:
         LOG_ERR(
-                "Unsupported key type for requested output format. Only RSA is supported.");
+                "Unsupported key type for requested output format. Only RSA and ECC are supported.");
     }
 
-    ERR_free_strings();
-    return result;
+    return NULL;
 }
 
-static bool tpm2_convert_pubkey_ssl(TPMT_PUBLIC *public,
-        tpm2_convert_pubkey_fmt format, const char *path) {
+static bool convert_pkey_bio(EVP_PKEY *pkey, tpm2_convert_pubkey_fmt format,
+        BIO *bio) {
 
-    BIO *bio = path ? BIO_new_file(path, "wb") : BIO_new_fp(stdout, BIO_NOCLOSE);
+    int ssl_res = 0;
+
+    switch (format) {
+    case pubkey_format_pem:
+        ssl_res = PEM_write_bio_PUBKEY(bio, pkey);
+        break;
+    case pubkey_format_der:
+        ssl_res = i2d_PUBKEY_bio(bio, pkey);
+        break;
+    default:
+        LOG_ERR("Invalid OpenSSL target format %d encountered", format);
+        return false;
+    }
+
+    if (ssl_res <= 0) {
+        print_ssl_error("OpenSSL public key conversion failed");
+        return false;
+    }
+
+    return true;
+}
+
+static bool convert_pkey_ssl(EVP_PKEY *pkey, tpm2_convert_pubkey_fmt format,
+        const char *path) {
+
+    BIO *bio = path ? tpm2_openssl_bio_open(path, "wb") :
+            BIO_new_fp(stdout, BIO_NOCLOSE);
     if (!bio) {
         LOG_ERR("Failed to open public key output file '%s': %s", path ? path : "<stdin>",
                 ERR_error_string(ERR_get_error(), NULL));
         return false;
     }
 
-    bool result = tpm2_convert_pubkey_bio(public, format, bio);
+    bool result = convert_pkey_bio(pkey, format, bio);
     BIO_free(bio);
     return result;
 }
 
+/* the string and mpint encodings of RFC 4251 section 5 */
+typedef struct ssh_blob ssh_blob;
+struct ssh_blob {
+    BYTE data[1024];
+    size_t len;
+};
+
+static bool ssh_put_string(ssh_blob *blob, const BYTE *data, size_t len) {
+
+    if (len > sizeof(blob->data) - sizeof(UINT32) - blob->len) {
+        LOG_ERR("Public key too large for the SSH format");
+        return false;
+    }
+
+    UINT32 size = tpm2_util_hton_32(len);
+    memcpy(&blob->data[blob->len], &size, sizeof(size));
+    memcpy(&blob->data[blob->len + sizeof(size)], data, len);
+    blob->len += sizeof(size) + len;
+
+    return true;
+}
+
+static bool ssh_put_mpint(ssh_blob *blob, const BYTE *data, size_t len) {
+
+    while (len && !data[0]) {
+        data++;
+        len--;
+    }
+
+    /* a set top bit would make the integer negative */
+    BYTE buffer[TPM2_MAX_RSA_KEY_BYTES + 1] = { 0 };
+    bool is_padded = len && (data[0] & 0x80);
+    if (len > sizeof(buffer) - is_padded) {
+        LOG_ERR("Public key too large for the SSH format");
+        return false;
+    }
+    memcpy(&buffer[is_padded], data, len);
+
+    return ssh_put_string(blob, buffer, len + is_padded);
+}
+
+/* a coordinate, left padded to the size of the field of the curve */
+static void ssh_coordinate(const TPM2B_ECC_PARAMETER *c, size_t size,
+        BYTE *buffer) {
+
+    size_t len = c->size < size ? c->size : size;
+    memset(buffer, 0, size - len);
+    memcpy(&buffer[size - len], &c->buffer[c->size - len], len);
+}
+
+static bool convert_pubkey_ssh(TPMT_PUBLIC *public, const char *path) {
+
+    ssh_blob blob = { .len = 0 };
+    const char *type = NULL;
+    bool result = false;
+
+    if (public->type == TPM2_ALG_RSA) {
+        type = "ssh-rsa";
+        UINT32 exponent = public->parameters.rsaDetail.exponent;
+        exponent = tpm2_util_hton_32(exponent ? exponent : 0x10001);
+        result = ssh_put_string(&blob, (BYTE *) type, strlen(type))
+                && ssh_put_mpint(&blob, (BYTE *) &exponent, sizeof(exponent))
+                && ssh_put_mpint(&blob, public->unique.rsa.buffer,
+                        public->unique.rsa.size);
+    } else if (public->type == TPM2_ALG_ECC) {
+        const char *curve = NULL;
+        size_t size = 0;
+        switch (public->parameters.eccDetail.curveID) {
+        case TPM2_ECC_NIST_P256:
+            type = "ecdsa-sha2-nistp256";
+            curve = "nistp256";
+            size = 32;
+            break;
+        case TPM2_ECC_NIST_P384:
+            type = "ecdsa-sha2-nistp384";
+            curve = "nistp384";
+            size = 48;
+            break;
+        case TPM2_ECC_NIST_P521:
+            type = "ecdsa-sha2-nistp521";
+            curve = "nistp521";
+            size = 66;
+            break;
+        default:
+            LOG_ERR("Only the NIST P-256, P-384 and P-521 curves are "
+                    "supported by the SSH format");
+            return false;
+        }
+
+        /* an uncompressed point */
+        BYTE point[1 + 2 * 66] = { 0x04 };
+        ssh_coordinate(&public->unique.ecc.x, size, &point[1]);
+        ssh_coordinate(&public->unique.ecc.y, size, &point[1 + size]);
+
+        result = ssh_put_string(&blob, (BYTE *) type, strlen(type))
+                && ssh_put_string(&blob, (BYTE *) curve, strlen(curve))
+                && ssh_put_string(&blob, point, 1 + 2 * size);
+    } else {
+        LOG_ERR("Unsupported key type for the SSH format. Only RSA and ECC "
+                "are supported.");
+        return false;
+    }
+
+    if (!result) {
+        return false;
+    }
+
+    FILE *f = path ? files_fopen(path, "w") : stdout;
+    if (!f) {
+        LOG_ERR("Failed to open public key output file '%s': %s", path,
+                strerror(errno));
+        return false;
+    }
+
+    tpm2_base64_stream stream;
+    tpm2_base64_stream_init(&stream, tpm2_base64_flags_none,
+            tpm2_base64_file_sink, f);
+
+    result = fprintf(f, "%s ", type) > 0
+            && tpm2_base64_encode_update(&stream, blob.data, blob.len)
+            && tpm2_base64_encode_final(&stream)
+            && fputc('\n', f) != EOF;
+
+    if (path) {
+        result = !fclose(f) && result;
+    }
+
+    if (!result) {
+        LOG_ERR("Failed to write public key output file '%s'",
+                path ? path : "<stdout>");
+    }
+
+    return result;
+}
+
+void tpm2_convert_pubkey_init(tpm2_convert_pubkey *key, TPM2B_PUBLIC *public) {
+
+    key->public = public;
+    key->pkey = NULL;
+}
+
+bool tpm2_convert_pubkey_write(tpm2_convert_pubkey *key,
+        tpm2_convert_pubkey_fmt format, const char *path) {
+
+    if (format == pubkey_format_der || format == pubkey_format_pem) {
+        /* built once, for all of the OpenSSL formats */
+        if (!key->pkey) {
+            key->pkey = convert_pubkey_pkey(&key->public->publicArea);
+            if (!key->pkey) {
+                return false;
+            }
+        }
+        return convert_pkey_ssl(key->pkey, format, path);
+    } else if (format == pubkey_format_ssh) {
+        return convert_pubkey_ssh(&key->public->publicArea, path);
+    } else if (format == pubkey_format_tss) {
+        return files_save_public(key->public, path);
+    } else if (format == pubkey_format_tpmt) {
+        return files_save_template(&key->public->publicArea, path);
+    }
+
+    LOG_ERR("Unsupported public key output format.");
+    return false;
+}
+
+void tpm2_convert_pubkey_free(tpm2_convert_pubkey *key) {
+
+    EVP_PKEY_free(key->pkey);
+    key->pkey = NULL;
+}
+
+bool tpm2_convert_pubkey_save(TPM2B_PUBLIC *public,
+        tpm2_convert_pubkey_fmt format, const char *path) {
+
+    tpm2_convert_pubkey key;
+    tpm2_convert_pubkey_init(&key, public);
+
+    bool result = tpm2_convert_pubkey_write(&key, format, path);
+    tpm2_convert_pubkey_free(&key);
+
+    return result;
+}
+
 bool tpm2_convert_sig_save(TPMT_SIGNATURE *signature,
         tpm2_convert_sig_fmt format, const char *path) {
 
@@ -321,6 +491,39 @@ bool tpm2_convert_sig_save(TPMT_SIGNATURE *signature,
     }
 }
 
+bool tpm2_convert_sig_write(TPMT_SIGNATURE *signature,
+        tpm2_convert_sig_fmt format, FILE *f) {
+
+    switch (format) {
+    case signature_format_tss: {
+        UINT8 buffer[sizeof(*signature)];
+        size_t offset = 0;
+        TSS2_RC rc = Tss2_MU_TPMT_SIGNATURE_Marshal(signature, buffer,
+                sizeof(buffer), &offset);
+        if (rc != TSS2_RC_SUCCESS) {
+            LOG_ERR("Error serializing signature structure: 0x%x", rc);
+            return false;
+        }
+
+        return files_write_bytes(f, buffer, offset);
+    }
+    case signature_format_plain: {
+        UINT16 size;
+        UINT8 *buffer = tpm2_convert_sig(&size, signature);
+        if (buffer == NULL) {
+            return false;
+        }
+
+        bool ret = files_write_bytes(f, buffer, size);
+        free(buffer);
+        return ret;
+    }
+    default:
+        LOG_ERR("Unsupported signature output format.");
+        return false;
+    }
+}
+
 /**
  * Parses the ASN1 format for an ECDSA Signature
  *
@@ -452,13 +655,17 @@ bool tpm2_convert_sig_load_plain(const char *path,
                 &signature->size);
     }
 
-    *halg = tmp.signature.any.hashAlg;
+    return tpm2_convert_sig_to_plain(&tmp, signature, halg);
+}
 
-    /* Then convert it to plain, but into a buffer */
-    UINT8 *buffer;
-    UINT16 size;
+bool tpm2_convert_sig_to_plain(TPMT_SIGNATURE *tss_sig,
+        TPM2B_MAX_BUFFER *signature, TPMI_ALG_HASH *halg) {
+
+    *halg = tss_sig->signature.any.hashAlg;
 
-    buffer = tpm2_convert_sig(&size, &tmp);
+    /* convert it to plain, but into a buffer */
+    UINT16 size;
+    UINT8 *buffer = tpm2_convert_sig(&size, tss_sig);
     if (buffer == NULL) {
         return false;
     }
@@ -606,18 +813,22 @@ bool tpm2_public_load_pkey(const char *path, EVP_PKEY **pkey) {
      * If none of them convert, we try it as a plain signature.
      */
     TPM2B_PUBLIC public = { 0 };
-    bool ret = files_load_template_silent(path, &public.publicArea);
+    bool ret = files_load_template_silent(path, &public.publicArea)
+            || files_load_public_silent(path, &public);
     if (ret) {
-        goto convert_to_pem;
-    }
+        /* a TPM public key converts straight to the OpenSSL key */
+        p = convert_pubkey_pkey(&public.publicArea);
+        if (!p) {
+            return false;
+        }
 
-    ret = files_load_public_silent(path, &public);
-    if (ret) {
-        goto convert_to_pem;
+        *pkey = p;
+
+        return true;
     }
 
     /* not a tss format, just treat it as a pem file */
-    bio = BIO_new_file(path, "rb");
+    bio = tpm2_openssl_bio_open(path, "rb");
     if (!bio) {
         LOG_ERR("Failed to open public key output file '%s': %s", path,
                 ERR_error_string(ERR_get_error(), NULL));
@@ -625,22 +836,6 @@ bool tpm2_public_load_pkey(const char *path, EVP_PKEY **pkey) {
     }
 
     /* not a tpm data structure, must be pem */
-    goto try_pem;
-
-convert_to_pem:
-    bio = BIO_new(BIO_s_mem());
-    if (!bio) {
-        LOG_ERR("Failed to allocate memory bio: %s",
-                ERR_error_string(ERR_get_error(), NULL));
-        return false;
-    }
-
-    ret = tpm2_convert_pubkey_bio(&public.publicArea, pubkey_format_pem, bio);
-    if (!ret) {
-        goto out;
-    }
-
-try_pem:
     p = PEM_read_bio_PUBKEY(bio, NULL, NULL, NULL);
     if (!p) {
         LOG_ERR("Failed to convert public key from file '%s': %s", path,
@@ -660,68 +855,331 @@ out:
     return result;
 }
 
-bool tpm2_base64_encode(BYTE *buffer, size_t buffer_length, char *base64) {
+/* the line length of PEM and EVP_EncodeUpdate() */
+#define BASE64_LINE_LENGTH 64
+/* the output collected before it is handed to the sink */
+#define BASE64_CHUNK 1024
+
+/* the table values of characters that are no base64 digit */
+#define BASE64_INVALID -1
+#define BASE64_SPACE -2
+#define BASE64_PAD -3
+
+static const char base64_digits[] =
+    "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+static const char base64_url_digits[] =
+    "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789-_";
+
+static const signed char base64_values[256] = {
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -2, -2, -1, -1, -2, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -2, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 62, -1, -1, -1, 63,
+    52, 53, 54, 55, 56, 57, 58, 59, 60, 61, -1, -1, -1, -3, -1, -1,
+    -1,  0,  1,  2,  3,  4,  5,  6,  7,  8,  9, 10, 11, 12, 13, 14,
+    15, 16, 17, 18, 19, 20, 21, 22, 23, 24, 25, -1, -1, -1, -1, -1,
+    -1, 26, 27, 28, 29, 30, 31, 32, 33, 34, 35, 36, 37, 38, 39, 40,
+    41, 42, 43, 44, 45, 46, 47, 48, 49, 50, 51, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+};
+
+static const signed char base64_url_values[256] = {
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -2, -2, -1, -1, -2, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -2, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 62, -1, -1,
+    52, 53, 54, 55, 56, 57, 58, 59, 60, 61, -1, -1, -1, -3, -1, -1,
+    -1,  0,  1,  2,  3,  4,  5,  6,  7,  8,  9, 10, 11, 12, 13, 14,
+    15, 16, 17, 18, 19, 20, 21, 22, 23, 24, 25, -1, -1, -1, -1, 63,
+    -1, 26, 27, 28, 29, 30, 31, 32, 33, 34, 35, 36, 37, 38, 39, 40,
+    41, 42, 43, 44, 45, 46, 47, 48, 49, 50, 51, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+};
+
+/* collects the output of one update call to hand it to the sink in chunks */
+typedef struct base64_chunk base64_chunk;
+struct base64_chunk {
+    tpm2_base64_stream *stream;
+    size_t len;
+    char data[BASE64_CHUNK];
+};
+
+static bool chunk_flush(base64_chunk *chunk) {
+
+    if (!chunk->len) {
+        return true;
+    }
 
-    unsigned char out[1024];
-    int outl;
+    tpm2_base64_stream *stream = chunk->stream;
+    bool result = stream->sink(chunk->data, chunk->len, stream->userdata);
+    chunk->len = 0;
 
-    EVP_ENCODE_CTX *ctx = EVP_ENCODE_CTX_new();
-    EVP_EncodeInit(ctx);
+    return result;
+}
 
-#if defined(LIB_TPM2_OPENSSL_OPENSSL_PRE11)
-    EVP_EncodeUpdate(ctx, out, &outl, buffer, buffer_length);
-#else
-    int rc = EVP_EncodeUpdate(ctx, out, &outl, buffer, buffer_length);
-    if(rc < 0) {
-        LOG_ERR("EVP_DecodeUpdate failed with %d\n", rc);
-        EVP_ENCODE_CTX_free(ctx);
+static bool chunk_put(base64_chunk *chunk, char c) {
+
+    if (chunk->len == sizeof(chunk->data) && !chunk_flush(chunk)) {
         return false;
     }
-#endif
 
-    EVP_EncodeFinal(ctx, out, &outl); // no return value
+    chunk->data[chunk->len++] = c;
 
-    EVP_ENCODE_CTX_free(ctx);
+    return true;
+}
+
+static bool encode_put(base64_chunk *chunk, char c) {
+
+    tpm2_base64_stream *stream = chunk->stream;
 
-    strcpy(base64, (char*) out);
+    if (!chunk_put(chunk, c)) {
+        return false;
+    }
+
+    if ((stream->flags & tpm2_base64_flags_lines)
+            && ++stream->column == BASE64_LINE_LENGTH) {
+        stream->column = 0;
+        return chunk_put(chunk, '\n');
+    }
 
     return true;
 }
 
-bool tpm2_base64_decode(char *base64, BYTE *buffer, size_t *buffer_length) {
+void tpm2_base64_stream_init(tpm2_base64_stream *stream,
+        tpm2_base64_flags flags, tpm2_base64_sink sink, void *userdata) {
 
-    bool is_base64_bufferlen_valid = strlen(base64) > 1024 ? false : true;
-    if (!is_base64_bufferlen_valid) {
+    memset(stream, 0, sizeof(*stream));
+    stream->flags = flags;
+    stream->sink = sink;
+    stream->userdata = userdata;
+}
+
+bool tpm2_base64_encode_update(tpm2_base64_stream *stream, const BYTE *data,
+        size_t len) {
+
+    const char *digits = (stream->flags & tpm2_base64_flags_url) ?
+            base64_url_digits : base64_digits;
+
+    base64_chunk chunk = { .stream = stream };
+
+    size_t i;
+    for (i = 0; i < len; i++) {
+        stream->bits = stream->bits << 8 | data[i];
+        if (++stream->count < 3) {
+            continue;
+        }
+
+        UINT32 bits = stream->bits;
+        bool result = encode_put(&chunk, digits[(bits >> 18) & 0x3f])
+                && encode_put(&chunk, digits[(bits >> 12) & 0x3f])
+                && encode_put(&chunk, digits[(bits >> 6) & 0x3f])
+                && encode_put(&chunk, digits[bits & 0x3f]);
+        if (!result) {
+            return false;
+        }
+
+        stream->bits = 0;
+        stream->count = 0;
+    }
+
+    return chunk_flush(&chunk);
+}
+
+bool tpm2_base64_encode_final(tpm2_base64_stream *stream) {
+
+    const char *digits = (stream->flags & tpm2_base64_flags_url) ?
+            base64_url_digits : base64_digits;
+    bool is_padded = !(stream->flags & tpm2_base64_flags_no_pad);
+
+    base64_chunk chunk = { .stream = stream };
+
+    bool result = true;
+    if (stream->count) {
+        /* align the pending bytes as the start of a group of 3 */
+        UINT32 bits = stream->bits << (8 * (3 - stream->count));
+        result = encode_put(&chunk, digits[(bits >> 18) & 0x3f])
+                && encode_put(&chunk, digits[(bits >> 12) & 0x3f]);
+        if (result && stream->count == 2) {
+            result = encode_put(&chunk, digits[(bits >> 6) & 0x3f]);
+        }
+
+        unsigned pad;
+        for (pad = stream->count; result && is_padded && pad < 3; pad++) {
+            result = encode_put(&chunk, '=');
+        }
+    }
+
+    if (result && stream->column) {
+        result = chunk_put(&chunk, '\n');
+    }
+
+    stream->bits = 0;
+    stream->count = 0;
+    stream->column = 0;
+
+    return result && chunk_flush(&chunk);
+}
+
+bool tpm2_base64_decode_update(tpm2_base64_stream *stream,
+        const char *base64, size_t len) {
+
+    const signed char *values = (stream->flags & tpm2_base64_flags_url) ?
+            base64_url_values : base64_values;
+
+    base64_chunk chunk = { .stream = stream };
+
+    size_t i;
+    for (i = 0; i < len; i++) {
+        int value = values[(unsigned char) base64[i]];
+        if (value == BASE64_SPACE) {
+            continue;
+        }
+
+        if (value == BASE64_PAD) {
+            stream->pad++;
+            continue;
+        }
+
+        /* nothing but padding follows the padding */
+        if (value == BASE64_INVALID || stream->pad) {
+            LOG_ERR("Invalid base64 character '%c'", base64[i]);
+            return false;
+        }
+
+        stream->bits = stream->bits << 6 | value;
+        if (++stream->count < 4) {
+            continue;
+        }
+
+        UINT32 bits = stream->bits;
+        bool result = chunk_put(&chunk, (char) (bits >> 16))
+                && chunk_put(&chunk, (char) (bits >> 8))
+                && chunk_put(&chunk, (char) bits);
+        if (!result) {
+            return false;
+        }
+
+        stream->bits = 0;
+        stream->count = 0;
+    }
+
+    return chunk_flush(&chunk);
+}
+
+bool tpm2_base64_decode_final(tpm2_base64_stream *stream) {
+
+    unsigned count = stream->count;
+    unsigned pad = stream->pad;
+
+    /* align the pending digits as the start of a group of 4 */
+    UINT32 bits = count ? stream->bits << 6 * (4 - count) : 0;
+
+    stream->bits = 0;
+    stream->count = 0;
+    stream->pad = 0;
+
+    /* a single digit holds no byte, padding must complete the group */
+    if (count == 1 || pad > 2 || (pad && (count + pad) % 4)) {
+        LOG_ERR("Truncated base64 data");
         return false;
     }
 
-    unsigned char base64u[1024];
-    memcpy(base64u, base64, strlen(base64));
+    base64_chunk chunk = { .stream = stream };
+
+    bool result = true;
+    if (count >= 2) {
+        result = chunk_put(&chunk, (char) (bits >> 16));
+    }
+
+    if (result && count == 3) {
+        result = chunk_put(&chunk, (char) (bits >> 8));
+    }
+
+    return result && chunk_flush(&chunk);
+}
+
+bool tpm2_base64_file_sink(const void *data, size_t len, void *userdata) {
+
+    return files_write_bytes((FILE *) userdata, (UINT8 *) data, len);
+}
+
+/* the whole buffer codecs below are bounded like the ones they replace */
+#define BASE64_BUFFER_SIZE 1024
+
+typedef struct base64_buffer base64_buffer;
+struct base64_buffer {
+    BYTE *data;
+    size_t len;
+    size_t size;
+};
+
+static bool buffer_sink(const void *data, size_t len, void *userdata) {
 
-    EVP_ENCODE_CTX *ctx = EVP_ENCODE_CTX_new();
-    EVP_DecodeInit(ctx);
-    unsigned char out[1024];
-    int outl;
-    int rc = EVP_DecodeUpdate(ctx, out, &outl, base64u, strlen(base64));
-    if(rc < 0) {
-        LOG_ERR("EVP_DecodeUpdate failed with %d\n", rc);
-        EVP_ENCODE_CTX_free(ctx);
+    base64_buffer *buffer = (base64_buffer *) userdata;
+    if (len > buffer->size - buffer->len) {
+        LOG_ERR("base64 conversion exceeds %zu bytes", buffer->size);
         return false;
     }
 
-    *buffer_length = outl;
+    memcpy(&buffer->data[buffer->len], data, len);
+    buffer->len += len;
 
-    rc = EVP_DecodeFinal(ctx, out, &outl);
-    if(rc < 0) {
-        LOG_ERR("EVP_DecodeFinal failed with %d\n", rc);
-        EVP_ENCODE_CTX_free(ctx);
+    return true;
+}
+
+bool tpm2_base64_encode(BYTE *buffer, size_t buffer_length, char *base64) {
+
+    /* leaves room for the NUL */
+    base64_buffer out = {
+        .data = (BYTE *) base64,
+        .size = BASE64_BUFFER_SIZE - 1,
+    };
+
+    tpm2_base64_stream stream;
+    tpm2_base64_stream_init(&stream, tpm2_base64_flags_lines, buffer_sink,
+            &out);
+
+    bool result = tpm2_base64_encode_update(&stream, buffer, buffer_length)
+            && tpm2_base64_encode_final(&stream);
+    base64[result ? out.len : 0] = '\0';
+
+    return result;
+}
+
+bool tpm2_base64_decode(char *base64, BYTE *buffer, size_t *buffer_length) {
+
+    size_t len = strlen(base64);
+    if (len > BASE64_BUFFER_SIZE) {
         return false;
     }
 
-    EVP_ENCODE_CTX_free(ctx);
+    base64_buffer out = {
+        .data = buffer,
+        .size = BASE64_BUFFER_SIZE,
+    };
 
-    *buffer_length += outl;
-    memcpy(buffer, out, *buffer_length);
+    tpm2_base64_stream stream;
+    tpm2_base64_stream_init(&stream, tpm2_base64_flags_none, buffer_sink,
+            &out);
 
-    return true;
+    bool result = tpm2_base64_decode_update(&stream, base64, len)
+            && tpm2_base64_decode_final(&stream);
+    if (result) {
+        *buffer_length = out.len;
+    }
+
+    return result;
 }
@@ -4,6 +4,8 @@
 #define CONVERSION_H
 
 #include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
 
 #include <openssl/evp.h>
 
@@ -15,6 +17,7 @@ enum tpm2_convert_pubkey_fmt {
     pubkey_format_pem,
     pubkey_format_der,
     pubkey_format_tpmt,
+    pubkey_format_ssh,
     pubkey_format_err
 };
 
@@ -29,6 +32,7 @@ typedef enum tpm2_convert_pcrs_output_fmt tpm2_convert_pcrs_output_fmt;
 enum tpm2_convert_pcrs_output_fmt {
     pcrs_output_format_values,
     pcrs_output_format_serialized,
+    pcrs_output_format_bundle,
     pcrs_output_format_err
 };
 
@@ -64,6 +68,37 @@ tpm2_convert_pubkey_fmt tpm2_convert_pubkey_fmt_from_optarg(const char *label);
 bool tpm2_convert_pubkey_save(TPM2B_PUBLIC *public,
         tpm2_convert_pubkey_fmt format, const char *path);
 
+/*
+ * A public key written in several formats. The OpenSSL key of the PEM and DER
+ * formats is built on the first write of either and reused by the others.
+ */
+typedef struct tpm2_convert_pubkey tpm2_convert_pubkey;
+struct tpm2_convert_pubkey {
+    TPM2B_PUBLIC *public;
+    EVP_PKEY *pkey;
+};
+
+/**
+ * Starts writing a public key.
+ * @param key
+ *  The key to initialize, released with tpm2_convert_pubkey_free().
+ * @param public
+ *  The public key, which must outlive the key.
+ */
+void tpm2_convert_pubkey_init(tpm2_convert_pubkey *key, TPM2B_PUBLIC *public);
+
+/**
+ * Like tpm2_convert_pubkey_save() for a key started with
+ * tpm2_convert_pubkey_init().
+ */
+bool tpm2_convert_pubkey_write(tpm2_convert_pubkey *key,
+        tpm2_convert_pubkey_fmt format, const char *path);
+
+/**
+ * Releases the OpenSSL key of a key.
+ */
+void tpm2_convert_pubkey_free(tpm2_convert_pubkey *key);
+
 /**
  * Parses the given command line signature format option string and returns
  * the corresponding signature_format enum value.
@@ -84,6 +119,14 @@ tpm2_convert_sig_fmt tpm2_convert_sig_fmt_from_optarg(const char *label);
 bool tpm2_convert_sig_save(TPMT_SIGNATURE *signature,
         tpm2_convert_sig_fmt format, const char *path);
 
+/**
+ * Like tpm2_convert_sig_save, but appends the signature to an open stream.
+ * Both formats are self delimiting for a given key, so signatures can be
+ * written back to back.
+ */
+bool tpm2_convert_sig_write(TPMT_SIGNATURE *signature,
+        tpm2_convert_sig_fmt format, FILE *f);
+
 /**
  * Like tpm2_convert_save with the "plain" signature option.
  *
@@ -134,8 +177,131 @@ bool tpm2_convert_sig_load(const char *path, tpm2_convert_sig_fmt format,
 bool tpm2_convert_sig_load_plain(const char *path,
         TPM2B_MAX_BUFFER *signature, TPMI_ALG_HASH *halg);
 
+/**
+ * Converts a TSS signature to a plain one, as tpm2_convert_sig_load_plain()
+ * does for a signature file.
+ * @param tss_sig
+ *  The TSS signature.
+ * @param signature
+ *  The plain signature.
+ * @param halg
+ *  The hash algorithm of the signature.
+ * @return
+ *  true on success, false on error.
+ */
+bool tpm2_convert_sig_to_plain(TPMT_SIGNATURE *tss_sig,
+        TPM2B_MAX_BUFFER *signature, TPMI_ALG_HASH *halg);
+
 bool tpm2_public_load_pkey(const char *path, EVP_PKEY **pkey);
 
+/**
+ * Receives the output of a base64 stream, one chunk at a time.
+ * @param data
+ *  The chunk, base64 characters when encoding and bytes when decoding.
+ * @param len
+ *  The length of the chunk.
+ * @param userdata
+ *  The userdata given to tpm2_base64_stream_init().
+ * @return
+ *  true on success, false to fail the conversion.
+ */
+typedef bool (*tpm2_base64_sink)(const void *data, size_t len, void *userdata);
+
+typedef enum tpm2_base64_flags tpm2_base64_flags;
+enum tpm2_base64_flags {
+    tpm2_base64_flags_none    = 0,
+    /* the URL and filename safe alphabet of RFC 4648 section 5 */
+    tpm2_base64_flags_url     = 1 << 0,
+    /* no trailing '=' when encoding, decoding accepts it either way */
+    tpm2_base64_flags_no_pad  = 1 << 1,
+    /* break encoded lines after 64 characters like PEM does */
+    tpm2_base64_flags_lines   = 1 << 2,
+};
+
+/*
+ * Converts base64 in chunks of any size, so data is encoded or decoded
+ * straight from its source, eg a mapped file, into the sink without a copy
+ * of the whole data. Decoding skips whitespace.
+ */
+typedef struct tpm2_base64_stream tpm2_base64_stream;
+struct tpm2_base64_stream {
+    tpm2_base64_flags flags;
+    tpm2_base64_sink sink;
+    void *userdata;
+    /* the bytes or digits short of a complete group */
+    UINT32 bits;
+    unsigned count;
+    /* the padding characters seen when decoding */
+    unsigned pad;
+    /* the length of the current line when encoding */
+    size_t column;
+};
+
+/**
+ * Starts a base64 conversion, in either direction.
+ * @param stream
+ *  The stream to initialize.
+ * @param flags
+ *  The tpm2_base64_flags of the conversion.
+ * @param sink
+ *  Receives the output.
+ * @param userdata
+ *  Passed to the sink.
+ */
+void tpm2_base64_stream_init(tpm2_base64_stream *stream,
+        tpm2_base64_flags flags, tpm2_base64_sink sink, void *userdata);
+
+/**
+ * Encodes the next chunk of data.
+ * @param stream
+ *  The stream.
+ * @param data
+ *  The chunk.
+ * @param len
+ *  The length of the chunk.
+ * @return
+ *  true on success, false if the sink failed.
+ */
+bool tpm2_base64_encode_update(tpm2_base64_stream *stream, const BYTE *data,
+        size_t len);
+
+/**
+ * Encodes the remaining bytes with padding and ends the last line.
+ * @param stream
+ *  The stream, which can be reused for another conversion.
+ * @return
+ *  true on success, false if the sink failed.
+ */
+bool tpm2_base64_encode_final(tpm2_base64_stream *stream);
+
+/**
+ * Decodes the next chunk of base64 characters.
+ * @param stream
+ *  The stream.
+ * @param base64
+ *  The chunk, need not be NUL terminated.
+ * @param len
+ *  The length of the chunk.
+ * @return
+ *  true on success, false on invalid characters or if the sink failed.
+ */
+bool tpm2_base64_decode_update(tpm2_base64_stream *stream,
+        const char *base64, size_t len);
+
+/**
+ * Decodes the remaining digits.
+ * @param stream
+ *  The stream, which can be reused for another conversion.
+ * @return
+ *  true on success, false on truncated data or if the sink failed.
+ */
+bool tpm2_base64_decode_final(tpm2_base64_stream *stream);
+
+/**
+ * A tpm2_base64_sink writing to the FILE passed as userdata.
+ */
+bool tpm2_base64_file_sink(const void *data, size_t len, void *userdata);
+
 /**
  * Encode a binary buffer to a Base64-encoded String.
  * @param buffer
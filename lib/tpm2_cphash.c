@@ -0,0 +1,174 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+#include <string.h>
+
+#include "log.h"
+#include "tpm2_cphash.h"
+#include "tpm2_openssl.h"
+
+void tpm2_cphash_init(tpm2_cphash *c, TPM2_CC cc) {
+
+    memset(c, 0, sizeof(*c));
+    c->cc = cc;
+}
+
+bool tpm2_cphash_check(tpm2_cphash *c, TSS2_RC rval) {
+
+    if (rval != TSS2_RC_SUCCESS) {
+        LOG_ERR("Could not marshal the parameters of command 0x%x", c->cc);
+        c->error = true;
+        return false;
+    }
+
+    return true;
+}
+
+bool tpm2_cphash_add_name(tpm2_cphash *c, const TPM2B_NAME *name) {
+
+    if (c->names_count >= TPM2_CPHASH_NAMES_MAX
+            || name->size > sizeof(name->name)) {
+        LOG_ERR("Command 0x%x takes no more handles", c->cc);
+        c->error = true;
+        return false;
+    }
+
+    c->names[c->names_count++] = *name;
+
+    return true;
+}
+
+bool tpm2_cphash_handle_name(TPM2_HANDLE handle, TPM2B_NAME *name) {
+
+    switch (handle >> TPM2_HR_SHIFT) {
+    case TPM2_HT_PCR:
+    case TPM2_HT_HMAC_SESSION:
+    case TPM2_HT_POLICY_SESSION:
+    case TPM2_HT_PERMANENT:
+        break;
+    default:
+        return false;
+    }
+
+    size_t offset = 0;
+    TSS2_RC rval = Tss2_MU_TPM2_HANDLE_Marshal(handle, name->name,
+            sizeof(name->name), &offset);
+    if (rval != TSS2_RC_SUCCESS) {
+        LOG_PERR(Tss2_MU_TPM2_HANDLE_Marshal, rval);
+        return false;
+    }
+    name->size = offset;
+
+    return true;
+}
+
+bool tpm2_cphash_add_handle(tpm2_cphash *c, TPM2_HANDLE handle) {
+
+    TPM2B_NAME name = { .size = 0 };
+    bool result = tpm2_cphash_handle_name(handle, &name);
+    if (!result) {
+        LOG_ERR("The name of handle 0x%x is not the handle, it has to be "
+                "read from the TPM or its public area", handle);
+        c->error = true;
+        return false;
+    }
+
+    return tpm2_cphash_add_name(c, &name);
+}
+
+bool tpm2_cphash_add_parameters(tpm2_cphash *c, const UINT8 *parameters,
+        size_t size) {
+
+    if (size > sizeof(c->parameters) - c->parameters_size) {
+        LOG_ERR("The parameters of command 0x%x exceed %u bytes", c->cc,
+                TPM2_MAX_SIZE);
+        c->error = true;
+        return false;
+    }
+
+    memcpy(&c->parameters[c->parameters_size], parameters, size);
+    c->parameters_size += size;
+
+    return true;
+}
+
+tool_rc tpm2_cphash_compute(const tpm2_cphash *c, TPMI_ALG_HASH halg,
+        TPM2B_DIGEST *cp_hash) {
+
+    if (c->error) {
+        return tool_rc_general_error;
+    }
+
+    UINT8 to_hash[sizeof(TPM2_CC) + TPM2_CPHASH_NAMES_MAX * sizeof(TPMU_NAME)
+        + TPM2_MAX_SIZE];
+    size_t offset = 0;
+
+    //Command-Code
+    TSS2_RC rval = Tss2_MU_TPM2_CC_Marshal(c->cc, to_hash, sizeof(to_hash),
+            &offset);
+    if (rval != TSS2_RC_SUCCESS) {
+        LOG_PERR(Tss2_MU_TPM2_CC_Marshal, rval);
+        return tool_rc_general_error;
+    }
+
+    //Names
+    UINT8 i;
+    for (i = 0; i < c->names_count; i++) {
+        memcpy(&to_hash[offset], c->names[i].name, c->names[i].size);
+        offset += c->names[i].size;
+    }
+
+    //CpBuffer
+    memcpy(&to_hash[offset], c->parameters, c->parameters_size);
+    offset += c->parameters_size;
+
+    //cpHash
+    bool result = tpm2_openssl_hash_compute_data(halg, to_hash, offset,
+            cp_hash);
+    if (!result) {
+        LOG_ERR("Failed cpHash digest calculation.");
+        return tool_rc_general_error;
+    }
+
+    return tool_rc_success;
+}
+
+tool_rc tpm2_cphash_compute_rphash(TSS2_RC response_code, TPM2_CC cc,
+        const UINT8 *parameters, size_t size, TPMI_ALG_HASH halg,
+        TPM2B_DIGEST *rp_hash) {
+
+    UINT8 to_hash[sizeof(TSS2_RC) + sizeof(TPM2_CC) + TPM2_MAX_SIZE];
+    if (size > TPM2_MAX_SIZE) {
+        LOG_ERR("The response parameters exceed %u bytes", TPM2_MAX_SIZE);
+        return tool_rc_general_error;
+    }
+
+    //Response-Code
+    size_t offset = 0;
+    TSS2_RC rval = Tss2_MU_UINT32_Marshal(response_code, to_hash,
+            sizeof(to_hash), &offset);
+    if (rval != TSS2_RC_SUCCESS) {
+        LOG_PERR(Tss2_MU_UINT32_Marshal, rval);
+        return tool_rc_general_error;
+    }
+
+    //Command-Code
+    rval = Tss2_MU_TPM2_CC_Marshal(cc, to_hash, sizeof(to_hash), &offset);
+    if (rval != TSS2_RC_SUCCESS) {
+        LOG_PERR(Tss2_MU_TPM2_CC_Marshal, rval);
+        return tool_rc_general_error;
+    }
+
+    //RpBuffer
+    memcpy(&to_hash[offset], parameters, size);
+    offset += size;
+
+    //rpHash
+    bool result = tpm2_openssl_hash_compute_data(halg, to_hash, offset,
+            rp_hash);
+    if (!result) {
+        LOG_ERR("Failed rpHash digest calculation.");
+        return tool_rc_general_error;
+    }
+
+    return tool_rc_success;
+}
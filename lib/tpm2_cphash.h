@@ -0,0 +1,147 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+#ifndef LIB_TPM2_CPHASH_H_
+#define LIB_TPM2_CPHASH_H_
+
+#include <stdbool.h>
+
+#include <tss2/tss2_mu.h>
+#include <tss2/tss2_tpm2_types.h>
+
+#include "tool_rc.h"
+#include "tpm2_header.h"
+
+/*
+ * Computes the command parameter hash of a command on the host:
+ *
+ * cpHash ≔ H(commandCode || name1 || name2 || name3 || cpBuffer)
+ *
+ * The parameters are marshaled with the Tss2_MU_* functions in the order of
+ * the command, so that a cpHash does not need a SAPI context, nor a TPM to
+ * look up the names of permanent handles.
+ */
+#define TPM2_CPHASH_NAMES_MAX 3
+
+typedef struct tpm2_cphash tpm2_cphash;
+struct tpm2_cphash {
+    TPM2_CC cc;
+    UINT8 names_count;
+    TPM2B_NAME names[TPM2_CPHASH_NAMES_MAX];
+    UINT8 parameters[TPM2_MAX_SIZE];
+    size_t parameters_size;
+    bool error;
+};
+
+/**
+ * Starts the cpHash of a command.
+ * @param c
+ *  The cpHash to initialize.
+ * @param cc
+ *  The command code of the command.
+ */
+void tpm2_cphash_init(tpm2_cphash *c, TPM2_CC cc);
+
+/**
+ * Appends the name of the next handle of the command.
+ * @param c
+ *  The cpHash.
+ * @param name
+ *  The name of the entity the handle refers to.
+ * @return
+ *  True on success, false if the command has no more handles.
+ */
+bool tpm2_cphash_add_name(tpm2_cphash *c, const TPM2B_NAME *name);
+
+/**
+ * Gets the name of a handle that is its own name, a permanent handle, a PCR or
+ * a session.
+ * @param handle
+ *  The handle.
+ * @param name
+ *  The name of the handle.
+ * @return
+ *  True on success, false if the handle refers to an object or an NV index.
+ */
+bool tpm2_cphash_handle_name(TPM2_HANDLE handle, TPM2B_NAME *name);
+
+/**
+ * Appends the name of a handle that is its own name, a permanent handle, a
+ * PCR or a session.
+ * @param c
+ *  The cpHash.
+ * @param handle
+ *  The handle.
+ * @return
+ *  True on success, false if the handle refers to an object or an NV index,
+ *  whose names are derived from their public areas.
+ */
+bool tpm2_cphash_add_handle(tpm2_cphash *c, TPM2_HANDLE handle);
+
+/**
+ * Appends already marshaled parameters.
+ * @param c
+ *  The cpHash.
+ * @param parameters
+ *  The marshaled parameters.
+ * @param size
+ *  The size of parameters.
+ * @return
+ *  True on success, false if they do not fit a command.
+ */
+bool tpm2_cphash_add_parameters(tpm2_cphash *c, const UINT8 *parameters,
+        size_t size);
+
+bool tpm2_cphash_check(tpm2_cphash *c, TSS2_RC rval);
+
+/*
+ * Appends a parameter marshaled with Tss2_MU_<type>_Marshal(), for example:
+ *
+ * tpm2_cphash_add(&c, UINT8, disable_clear);
+ * tpm2_cphash_add(&c, TPM2B_DIGEST, &auth_policy);
+ *
+ * A failure is remembered and reported by tpm2_cphash_compute().
+ */
+#define tpm2_cphash_add(c, type, value) \
+    tpm2_cphash_check((c), Tss2_MU_##type##_Marshal((value), \
+        (c)->parameters, sizeof((c)->parameters), &(c)->parameters_size))
+
+/**
+ * Computes the cpHash.
+ * @param c
+ *  The cpHash.
+ * @param halg
+ *  The hash algorithm of the cpHash.
+ * @param cp_hash
+ *  The cpHash computed.
+ * @return
+ *  tool_rc_success on success, tool_rc_general_error if a name or parameter
+ *  could not be appended or the hash failed.
+ */
+tool_rc tpm2_cphash_compute(const tpm2_cphash *c, TPMI_ALG_HASH halg,
+        TPM2B_DIGEST *cp_hash);
+
+/**
+ * Computes the response parameter hash of a command on the host:
+ *
+ * rpHash ≔ H(responseCode || commandCode || rpBuffer)
+ *
+ * @param response_code
+ *  The response code of the command.
+ * @param cc
+ *  The command code of the command.
+ * @param parameters
+ *  The marshaled response parameters.
+ * @param size
+ *  The size of parameters.
+ * @param halg
+ *  The hash algorithm of the rpHash.
+ * @param rp_hash
+ *  The rpHash computed.
+ * @return
+ *  tool_rc_success on success, tool_rc_general_error otherwise.
+ */
+tool_rc tpm2_cphash_compute_rphash(TSS2_RC response_code, TPM2_CC cc,
+        const UINT8 *parameters, size_t size, TPMI_ALG_HASH halg,
+        TPM2B_DIGEST *rp_hash);
+
+#endif /* LIB_TPM2_CPHASH_H_ */
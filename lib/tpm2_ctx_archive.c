@@ -0,0 +1,377 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <sys/stat.h>
+
+#include "log.h"
+#include "tpm2_ctx_archive.h"
+#include "tpm2_systemdeps.h"
+
+#define CTX_ARCHIVE_MAGIC 0xBADCA7C0
+#define CTX_ARCHIVE_VERSION 1
+
+#define CTX_ARCHIVE_HEADER_SIZE (3 * sizeof(UINT32))
+#define CTX_ARCHIVE_ENTRY_SIZE (4 * sizeof(UINT32))
+
+typedef struct archive_entry archive_entry;
+struct archive_entry {
+    const UINT8 *name;
+    size_t name_size;
+    const UINT8 *data;
+    size_t size;
+};
+
+static UINT32 read_32(const UINT8 *p) {
+
+    UINT32 value;
+    memcpy(&value, p, sizeof(value));
+
+    return be32toh(value);
+}
+
+static bool is_in_archive(const tpm2_ctx_archive *archive, UINT32 offset,
+        UINT32 size) {
+
+    return offset <= archive->size && size <= archive->size - offset;
+}
+
+static int compare_names(const UINT8 *a, size_t a_size, const UINT8 *b,
+        size_t b_size) {
+
+    int rc = memcmp(a, b, a_size < b_size ? a_size : b_size);
+    if (rc) {
+        return rc;
+    }
+
+    return a_size < b_size ? -1 : a_size > b_size;
+}
+
+static int compare_entries(const void *a, const void *b) {
+
+    const archive_entry *x = (const archive_entry *) a;
+    const archive_entry *y = (const archive_entry *) b;
+
+    return compare_names(x->name, x->name_size, y->name, y->name_size);
+}
+
+/* reads the index entry i, which tpm2_ctx_archive_open() bounds checked */
+static bool get_entry(const tpm2_ctx_archive *archive, UINT32 i,
+        archive_entry *entry) {
+
+    const UINT8 *p = archive->data + CTX_ARCHIVE_HEADER_SIZE
+            + (size_t) i * CTX_ARCHIVE_ENTRY_SIZE;
+
+    UINT32 name_offset = read_32(p);
+    UINT32 name_size = read_32(p + 4);
+    UINT32 data_offset = read_32(p + 8);
+    UINT32 data_size = read_32(p + 12);
+    if (!is_in_archive(archive, name_offset, name_size)
+            || !is_in_archive(archive, data_offset, data_size)) {
+        LOG_ERR("Malformed context archive, entry %u is out of bounds", i);
+        return false;
+    }
+
+    entry->name = archive->data + name_offset;
+    entry->name_size = name_size;
+    entry->data = archive->data + data_offset;
+    entry->size = data_size;
+
+    return true;
+}
+
+bool tpm2_ctx_archive_split(const char *member, char archive_path[PATH_MAX],
+        const char **name) {
+
+    const char *separator = strrchr(member, TPM2_CTX_ARCHIVE_SEPARATOR);
+    if (!separator || separator == member || !separator[1]) {
+        return false;
+    }
+
+    struct stat st;
+    if (files_stat(member, &st)) {
+        return false;
+    }
+
+    size_t len = separator - member;
+    if (len >= PATH_MAX) {
+        return false;
+    }
+
+    memcpy(archive_path, member, len);
+    archive_path[len] = '\0';
+    *name = separator + 1;
+
+    return true;
+}
+
+bool tpm2_ctx_archive_open(tpm2_ctx_archive *archive, const char *path) {
+
+    memset(archive, 0, sizeof(*archive));
+
+    if (!files_input_open(&archive->input, path)) {
+        return false;
+    }
+
+    if (!files_input_read_all(&archive->input, &archive->data,
+            &archive->size)) {
+        goto err;
+    }
+
+    if (archive->size < CTX_ARCHIVE_HEADER_SIZE
+            || read_32(archive->data) != CTX_ARCHIVE_MAGIC) {
+        LOG_ERR("\"%s\" is not a context archive", path);
+        goto err;
+    }
+
+    UINT32 version = read_32(archive->data + 4);
+    if (version != CTX_ARCHIVE_VERSION) {
+        LOG_ERR("Unsupported context archive version, got: %u", version);
+        goto err;
+    }
+
+    archive->count = read_32(archive->data + 8);
+    if (archive->count > (archive->size - CTX_ARCHIVE_HEADER_SIZE)
+            / CTX_ARCHIVE_ENTRY_SIZE) {
+        LOG_ERR("Malformed context archive \"%s\", index is truncated", path);
+        goto err;
+    }
+
+    return true;
+
+err:
+    files_input_close(&archive->input);
+    return false;
+}
+
+bool tpm2_ctx_archive_find(const tpm2_ctx_archive *archive, const char *name,
+        const UINT8 **data, size_t *size) {
+
+    size_t name_size = strlen(name);
+
+    UINT32 low = 0;
+    UINT32 high = archive->count;
+    while (low < high) {
+        UINT32 mid = low + (high - low) / 2;
+
+        archive_entry entry;
+        if (!get_entry(archive, mid, &entry)) {
+            return false;
+        }
+
+        int rc = compare_names((const UINT8 *) name, name_size, entry.name,
+                entry.name_size);
+        if (!rc) {
+            *data = entry.data;
+            *size = entry.size;
+            return true;
+        }
+
+        if (rc < 0) {
+            high = mid;
+        } else {
+            low = mid + 1;
+        }
+    }
+
+    return false;
+}
+
+void tpm2_ctx_archive_close(tpm2_ctx_archive *archive) {
+
+    files_input_close(&archive->input);
+    archive->data = NULL;
+    archive->size = 0;
+    archive->count = 0;
+}
+
+static bool write_archive(FILE *f, archive_entry *entries, UINT32 count) {
+
+    /* the names follow the index, the contexts follow the names */
+    size_t offset = CTX_ARCHIVE_HEADER_SIZE
+            + (size_t) count * CTX_ARCHIVE_ENTRY_SIZE;
+    size_t name_offset = offset;
+    UINT32 i;
+    for (i = 0; i < count; i++) {
+        offset += entries[i].name_size;
+    }
+    size_t data_offset = offset;
+    for (i = 0; i < count; i++) {
+        offset += entries[i].size;
+    }
+
+    if (offset > UINT32_MAX) {
+        LOG_ERR("Context archive grows beyond 4GiB");
+        return false;
+    }
+
+    bool result = files_write_32(f, CTX_ARCHIVE_MAGIC)
+            && files_write_32(f, CTX_ARCHIVE_VERSION)
+            && files_write_32(f, count);
+
+    for (i = 0; result && i < count; i++) {
+        result = files_write_32(f, name_offset)
+                && files_write_32(f, entries[i].name_size)
+                && files_write_32(f, data_offset)
+                && files_write_32(f, entries[i].size);
+        name_offset += entries[i].name_size;
+        data_offset += entries[i].size;
+    }
+
+    for (i = 0; result && i < count; i++) {
+        result = files_write_bytes(f, (UINT8 *) entries[i].name,
+                entries[i].name_size);
+    }
+
+    for (i = 0; result && i < count; i++) {
+        result = files_write_bytes(f, (UINT8 *) entries[i].data,
+                entries[i].size);
+    }
+
+    return result;
+}
+
+/* replaces the archive atomically so readers never see a torn one */
+static bool save_archive(const char *path, archive_entry *entries,
+        UINT32 count) {
+
+    files_atomic atomic;
+    FILE *f = files_atomic_fopen(&atomic, path);
+    if (!f) {
+        return false;
+    }
+
+    bool result = write_archive(f, entries, count);
+    if (!files_atomic_close(&atomic, f, result)) {
+        LOG_ERR("Could not write context archive \"%s\"", path);
+        return false;
+    }
+
+    return true;
+}
+
+bool tpm2_ctx_archive_store(const char *path, const char *name,
+        const UINT8 *data, size_t size) {
+
+    tpm2_ctx_archive archive = { 0 };
+    bool is_open = false;
+    struct stat st;
+    if (files_stat(path, &st)) {
+        is_open = tpm2_ctx_archive_open(&archive, path);
+        if (!is_open) {
+            return false;
+        }
+    }
+
+    bool result = false;
+    archive_entry *entries = calloc(archive.count + 1, sizeof(*entries));
+    if (!entries) {
+        LOG_ERR("oom");
+        goto out;
+    }
+
+    archive_entry added = {
+        .name = (const UINT8 *) name,
+        .name_size = strlen(name),
+        .data = data,
+        .size = size,
+    };
+
+    /* the context replaces the one of the same name */
+    UINT32 count = 0;
+    UINT32 i;
+    for (i = 0; i < archive.count; i++) {
+        if (!get_entry(&archive, i, &entries[count])) {
+            goto out;
+        }
+        if (compare_entries(&entries[count], &added)) {
+            count++;
+        }
+    }
+    entries[count++] = added;
+
+    qsort(entries, count, sizeof(*entries), compare_entries);
+
+    result = save_archive(path, entries, count);
+
+out:
+    free(entries);
+    if (is_open) {
+        tpm2_ctx_archive_close(&archive);
+    }
+
+    return result;
+}
+
+bool tpm2_ctx_archive_write(const char *path,
+        const tpm2_ctx_archive_member *members, UINT32 count) {
+
+    archive_entry *entries = calloc(count ? count : 1, sizeof(*entries));
+    if (!entries) {
+        LOG_ERR("oom");
+        return false;
+    }
+
+    UINT32 i;
+    for (i = 0; i < count; i++) {
+        entries[i].name = (const UINT8 *) members[i].name;
+        entries[i].name_size = strlen(members[i].name);
+        entries[i].data = members[i].data;
+        entries[i].size = members[i].size;
+    }
+
+    qsort(entries, count, sizeof(*entries), compare_entries);
+
+    /* a lookup would only ever find one of the same name */
+    bool result = true;
+    for (i = 1; i < count; i++) {
+        if (!compare_entries(&entries[i - 1], &entries[i])) {
+            LOG_ERR("Context \"%.*s\" is given twice for archive \"%s\"",
+                    (int) entries[i].name_size, entries[i].name, path);
+            result = false;
+            break;
+        }
+    }
+
+    result = result && save_archive(path, entries, count);
+    free(entries);
+
+    return result;
+}
+
+tool_rc tpm2_ctx_archive_load(ESYS_CONTEXT *ectx, const char *path,
+        const char *name, ESYS_TR *handle) {
+
+    tpm2_ctx_archive archive;
+    if (!tpm2_ctx_archive_open(&archive, path)) {
+        return tool_rc_general_error;
+    }
+
+    tool_rc rc = tool_rc_general_error;
+    const UINT8 *data = NULL;
+    size_t size = 0;
+    if (!tpm2_ctx_archive_find(&archive, name, &data, &size)) {
+        LOG_ERR("No context \"%s\" in archive \"%s\"", name, path);
+        goto out;
+    }
+
+    /* the context file is parsed straight from the mapping */
+    FILE *f = fmemopen((void *) data, size, "rb");
+    if (!f) {
+        LOG_ERR("Could not open context \"%s\", error: %s", name,
+                strerror(errno));
+        goto out;
+    }
+
+    rc = files_load_tpm_context_from_file(ectx, handle, f);
+    fclose(f);
+
+out:
+    tpm2_ctx_archive_close(&archive);
+
+    return rc;
+}
@@ -0,0 +1,143 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+#ifndef LIB_TPM2_CTX_ARCHIVE_H_
+#define LIB_TPM2_CTX_ARCHIVE_H_
+
+#include <limits.h>
+#include <stdbool.h>
+
+#include <tss2/tss2_esys.h>
+
+#include "files.h"
+#include "tool_rc.h"
+
+/* separates the archive path from the name of a context in it */
+#define TPM2_CTX_ARCHIVE_SEPARATOR '#'
+
+/*
+ * An archive holds many context files, ie TPM contexts and serialized ESYS_TR
+ * objects, each under a name. It is laid out as, all numbers big endian:
+ *   U32 magic
+ *   U32 version
+ *   U32 count
+ *   count index entries, sorted by name:
+ *     U32 name offset, U32 name size, U32 data offset, U32 data size
+ *   the names and the data the index entries point to
+ * The archive is mapped and the index searched in place, so a lookup reads
+ * neither the other names nor the other contexts.
+ */
+typedef struct tpm2_ctx_archive tpm2_ctx_archive;
+struct tpm2_ctx_archive {
+    files_input input;
+    const UINT8 *data;
+    size_t size;
+    UINT32 count;
+};
+
+/**
+ * Splits a context argument of the form archive#name. Arguments naming an
+ * existing file are never split, so such files stay usable as before.
+ * @param member
+ *  The context argument.
+ * @param archive_path
+ *  Receives the path of the archive.
+ * @param name
+ *  Receives the name of the context in the archive, pointing into member.
+ * @return
+ *  True if member names a context in an archive, false otherwise.
+ */
+bool tpm2_ctx_archive_split(const char *member, char archive_path[PATH_MAX],
+        const char **name);
+
+/**
+ * Opens and maps an archive.
+ * @param archive
+ *  The archive to initialize.
+ * @param path
+ *  The path of the archive.
+ * @return
+ *  True on success, false if the file is no valid archive.
+ */
+bool tpm2_ctx_archive_open(tpm2_ctx_archive *archive, const char *path);
+
+/**
+ * Looks up a context in an archive.
+ * @param archive
+ *  The archive opened with tpm2_ctx_archive_open().
+ * @param name
+ *  The name of the context.
+ * @param data
+ *  Receives the context file, valid until the archive is closed.
+ * @param size
+ *  Receives the size of the context file.
+ * @return
+ *  True if the archive holds the context, false otherwise.
+ */
+bool tpm2_ctx_archive_find(const tpm2_ctx_archive *archive, const char *name,
+        const UINT8 **data, size_t *size);
+
+/**
+ * Unmaps an archive.
+ * @param archive
+ *  The archive opened with tpm2_ctx_archive_open().
+ */
+void tpm2_ctx_archive_close(tpm2_ctx_archive *archive);
+
+/**
+ * Adds a context file to an archive or replaces the one of the same name.
+ * The archive is created if it does not exist and is replaced atomically.
+ * @param path
+ *  The path of the archive.
+ * @param name
+ *  The name of the context.
+ * @param data
+ *  The context file.
+ * @param size
+ *  The size of the context file.
+ * @return
+ *  True on success, false otherwise.
+ */
+bool tpm2_ctx_archive_store(const char *path, const char *name,
+        const UINT8 *data, size_t size);
+
+typedef struct tpm2_ctx_archive_member tpm2_ctx_archive_member;
+struct tpm2_ctx_archive_member {
+    const char *name;
+    const UINT8 *data;
+    size_t size;
+};
+
+/**
+ * Writes an archive holding the given contexts at once, replacing the file
+ * atomically. Unlike tpm2_ctx_archive_store() the archive is written once for
+ * all of them, and the contexts it held before are dropped.
+ * @param path
+ *  The path of the archive.
+ * @param members
+ *  The contexts, their names being distinct.
+ * @param count
+ *  The number of contexts.
+ * @return
+ *  True on success, false otherwise.
+ */
+bool tpm2_ctx_archive_write(const char *path,
+        const tpm2_ctx_archive_member *members, UINT32 count);
+
+/**
+ * Loads a context kept in an archive, like
+ * files_load_tpm_context_from_path() does for a context file.
+ * @param ectx
+ *  The Enhanced System API (ESAPI) context
+ * @param path
+ *  The path of the archive.
+ * @param name
+ *  The name of the context.
+ * @param handle
+ *  Receives the ESYS_TR of the loaded object.
+ * @return
+ *  tool_rc indicating status.
+ */
+tool_rc tpm2_ctx_archive_load(ESYS_CONTEXT *ectx, const char *path,
+        const char *name, ESYS_TR *handle);
+
+#endif /* LIB_TPM2_CTX_ARCHIVE_H_ */
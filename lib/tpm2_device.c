@@ -0,0 +1,263 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "log.h"
+#include "tpm2_device.h"
+#include "tpm2_header.h"
+#include "tpm2_util.h"
+
+#define DEVICE_TCTI_MAGIC 0x7470326465766963ULL
+
+#define DEVICE_TCTI_PREFIX "device"
+
+/* the tag precedes the size field in a response */
+#define DEVICE_SIZE_OFFSET 2
+
+typedef struct device_tcti device_tcti;
+struct device_tcti {
+    TSS2_TCTI_CONTEXT_COMMON_V2 common;
+    int fd;
+    bool is_in_flight;
+};
+
+static TSS2_RC device_tcti_transmit(TSS2_TCTI_CONTEXT *tcti_context,
+        size_t size, const uint8_t *command) {
+
+    device_tcti *tcti = (device_tcti *) tcti_context;
+
+    if (tcti->is_in_flight) {
+        return TSS2_TCTI_RC_BAD_SEQUENCE;
+    }
+
+    if (!command || size < TPM2_COMMAND_HEADER_SIZE || size > TPM2_MAX_SIZE) {
+        return TSS2_TCTI_RC_BAD_VALUE;
+    }
+
+    /* the TPM driver takes a command in a single write */
+    ssize_t n;
+    do {
+        n = write(tcti->fd, command, size);
+    } while (n < 0 && errno == EINTR);
+
+    if (n < 0 || (size_t) n != size) {
+        LOG_ERR("Could not write command to the TPM device: %s",
+                n < 0 ? strerror(errno) : "short write");
+        return TSS2_TCTI_RC_IO_ERROR;
+    }
+
+    tcti->is_in_flight = true;
+
+    return TSS2_RC_SUCCESS;
+}
+
+static TSS2_RC device_tcti_receive(TSS2_TCTI_CONTEXT *tcti_context,
+        size_t *size, uint8_t *response, int32_t timeout) {
+
+    device_tcti *tcti = (device_tcti *) tcti_context;
+
+    if (!tcti->is_in_flight) {
+        return TSS2_TCTI_RC_BAD_SEQUENCE;
+    }
+
+    if (!size) {
+        return TSS2_TCTI_RC_BAD_REFERENCE;
+    }
+
+    /* the response size is only known once it was read */
+    if (!response) {
+        *size = TPM2_MAX_SIZE;
+        return TSS2_RC_SUCCESS;
+    }
+
+    struct pollfd pfd = {
+        .fd = tcti->fd,
+        .events = POLLIN,
+    };
+
+    int rc;
+    do {
+        rc = poll(&pfd, 1, timeout);
+    } while (rc < 0 && errno == EINTR);
+
+    if (rc < 0) {
+        LOG_ERR("Could not poll the TPM device: %s", strerror(errno));
+        return TSS2_TCTI_RC_IO_ERROR;
+    }
+
+    if (rc == 0) {
+        return TSS2_TCTI_RC_TRY_AGAIN;
+    }
+
+    ssize_t n;
+    do {
+        n = read(tcti->fd, response, *size);
+    } while (n < 0 && errno == EINTR);
+
+    if (n < 0 && errno == EAGAIN) {
+        return TSS2_TCTI_RC_TRY_AGAIN;
+    }
+
+    tcti->is_in_flight = false;
+
+    if (n < 0) {
+        LOG_ERR("Could not read response from the TPM device: %s",
+                strerror(errno));
+        return TSS2_TCTI_RC_IO_ERROR;
+    }
+
+    if ((size_t) n < TPM2_RESPONSE_HEADER_SIZE) {
+        LOG_ERR("Short response from the TPM device, got %zd bytes", n);
+        return TSS2_TCTI_RC_MALFORMED_RESPONSE;
+    }
+
+    const uint8_t *p = &response[DEVICE_SIZE_OFFSET];
+    UINT32 response_size = (UINT32) p[0] << 24 | p[1] << 16 | p[2] << 8 | p[3];
+    if (response_size != (size_t) n) {
+        LOG_ERR("Response size %u does not match the %zd bytes read",
+                response_size, n);
+        return TSS2_TCTI_RC_MALFORMED_RESPONSE;
+    }
+
+    *size = n;
+
+    return TSS2_RC_SUCCESS;
+}
+
+static void device_tcti_finalize(TSS2_TCTI_CONTEXT *tcti_context) {
+
+    device_tcti *tcti = (device_tcti *) tcti_context;
+
+    close(tcti->fd);
+    tcti->fd = -1;
+}
+
+static TSS2_RC device_tcti_cancel(TSS2_TCTI_CONTEXT *tcti_context) {
+    UNUSED(tcti_context);
+
+    return TSS2_TCTI_RC_NOT_IMPLEMENTED;
+}
+
+static TSS2_RC device_tcti_get_poll_handles(TSS2_TCTI_CONTEXT *tcti_context,
+        TSS2_TCTI_POLL_HANDLE *handles, size_t *num_handles) {
+
+    device_tcti *tcti = (device_tcti *) tcti_context;
+
+    if (!num_handles) {
+        return TSS2_TCTI_RC_BAD_REFERENCE;
+    }
+
+    if (handles) {
+        if (*num_handles < 1) {
+            return TSS2_TCTI_RC_INSUFFICIENT_BUFFER;
+        }
+        handles[0].fd = tcti->fd;
+        handles[0].events = POLLIN;
+        handles[0].revents = 0;
+    }
+
+    *num_handles = 1;
+
+    return TSS2_RC_SUCCESS;
+}
+
+static TSS2_RC device_tcti_set_locality(TSS2_TCTI_CONTEXT *tcti_context,
+        uint8_t locality) {
+    UNUSED(tcti_context);
+    UNUSED(locality);
+
+    return TSS2_TCTI_RC_NOT_IMPLEMENTED;
+}
+
+static TSS2_RC device_tcti_make_sticky(TSS2_TCTI_CONTEXT *tcti_context,
+        TPM2_HANDLE *handle, uint8_t sticky) {
+    UNUSED(tcti_context);
+    UNUSED(handle);
+    UNUSED(sticky);
+
+    return TSS2_TCTI_RC_NOT_IMPLEMENTED;
+}
+
+static const char *device_path(const char *conf) {
+
+    size_t len = strlen(DEVICE_TCTI_PREFIX);
+    if (!conf || strncmp(conf, DEVICE_TCTI_PREFIX, len)) {
+        return NULL;
+    }
+
+    conf += len;
+    if (!*conf) {
+        return TPM2_DEVICE_PATH_DEFAULT;
+    }
+
+    if (*conf != ':') {
+        return NULL;
+    }
+
+    conf++;
+
+    return *conf ? conf : TPM2_DEVICE_PATH_DEFAULT;
+}
+
+bool tpm2_device_tcti_init(const char *conf, TSS2_TCTI_CONTEXT **tcti) {
+
+    const char *value = tpm2_util_getenv(TPM2TOOLS_ENV_DEVICE_FAST_PATH);
+    if (value && !strcmp(value, "0")) {
+        return false;
+    }
+
+    const char *path = device_path(conf);
+    if (!path) {
+        return false;
+    }
+
+    int fd = open(path, O_RDWR | O_NONBLOCK | O_CLOEXEC);
+    if (fd < 0) {
+        LOG_INFO("Could not open \"%s\", trying the TCTI loader: %s", path,
+                strerror(errno));
+        return false;
+    }
+
+    device_tcti *device = calloc(1, sizeof(*device));
+    if (!device) {
+        LOG_WARN("oom, using the TCTI loader");
+        close(fd);
+        return false;
+    }
+
+    device->common.v1.magic = DEVICE_TCTI_MAGIC;
+    device->common.v1.version = 2;
+    device->common.v1.transmit = device_tcti_transmit;
+    device->common.v1.receive = device_tcti_receive;
+    device->common.v1.finalize = device_tcti_finalize;
+    device->common.v1.cancel = device_tcti_cancel;
+    device->common.v1.getPollHandles = device_tcti_get_poll_handles;
+    device->common.v1.setLocality = device_tcti_set_locality;
+    device->common.makeSticky = device_tcti_make_sticky;
+    device->fd = fd;
+
+    LOG_INFO("Using the built in device TCTI for \"%s\"", path);
+
+    *tcti = (TSS2_TCTI_CONTEXT *) device;
+
+    return true;
+}
+
+bool tpm2_device_tcti_finalize(TSS2_TCTI_CONTEXT **tcti) {
+
+    if (!*tcti || TSS2_TCTI_MAGIC(*tcti) != DEVICE_TCTI_MAGIC
+            || TSS2_TCTI_TRANSMIT(*tcti) != device_tcti_transmit) {
+        return false;
+    }
+
+    Tss2_Tcti_Finalize(*tcti);
+    free(*tcti);
+    *tcti = NULL;
+
+    return true;
+}
@@ -0,0 +1,42 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+#ifndef LIB_TPM2_DEVICE_H_
+#define LIB_TPM2_DEVICE_H_
+
+#include <stdbool.h>
+
+#include <tss2/tss2_tcti.h>
+
+/*
+ * Environment variable that, when set to 0, sends device TCTI configurations
+ * to the TCTI loader as well.
+ */
+#define TPM2TOOLS_ENV_DEVICE_FAST_PATH "TPM2TOOLS_DEVICE_FAST_PATH"
+
+#define TPM2_DEVICE_PATH_DEFAULT "/dev/tpmrm0"
+
+/**
+ * Initializes a built in TCTI for a TPM character device, sparing the
+ * dlopen() and configuration parsing of the TCTI loader. The device is opened
+ * non-blocking and responses are waited for with poll(), so the poll handle
+ * reports when a command completes.
+ * @param conf
+ *  The TCTI configuration, ie "device" or "device:/dev/tpmrm0".
+ * @param tcti
+ *  The TCTI initialized.
+ * @return
+ *  True if the TCTI was initialized, false if conf is not a device
+ *  configuration or the device could not be opened, leaving it to the loader.
+ */
+bool tpm2_device_tcti_init(const char *conf, TSS2_TCTI_CONTEXT **tcti);
+
+/**
+ * Finalizes and frees a TCTI of tpm2_device_tcti_init().
+ * @param tcti
+ *  The TCTI to finalize, set to NULL when it was a device TCTI.
+ * @return
+ *  True if tcti was a device TCTI, false if it is left to the loader.
+ */
+bool tpm2_device_tcti_finalize(TSS2_TCTI_CONTEXT **tcti);
+
+#endif /* LIB_TPM2_DEVICE_H_ */
@@ -0,0 +1,269 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/file.h>
+#include <unistd.h>
+
+#include <tss2/tss2_mu.h>
+
+#include "files.h"
+#include "log.h"
+#include "tpm2_ecc_pool.h"
+
+#define ECC_POOL_VERSION 1
+
+/* after the header of files_write_header() and the command code */
+#define ECC_POOL_TAKEN_OFFSET 12
+
+size_t tpm2_ecc_pool_points(TPM2_CC cc) {
+
+    switch (cc) {
+    case TPM2_CC_EC_Ephemeral:
+        return 1;
+    case TPM2_CC_Commit:
+        return 3;
+    default:
+        return 0;
+    }
+}
+
+/* opens the pool with an exclusive lock, released by fclose() */
+static FILE *pool_open(const char *path, bool is_create) {
+
+    int fd = files_open(path, O_RDWR | (is_create ? O_CREAT : 0), 0600);
+    if (fd < 0) {
+        LOG_ERR("Could not open pool \"%s\", error: %s", path,
+                strerror(errno));
+        return NULL;
+    }
+
+    if (flock(fd, LOCK_EX)) {
+        LOG_ERR("Could not lock pool \"%s\", error: %s", path,
+                strerror(errno));
+        close(fd);
+        return NULL;
+    }
+
+    FILE *f = fdopen(fd, "r+b");
+    if (!f) {
+        LOG_ERR("Could not open pool \"%s\", error: %s", path,
+                strerror(errno));
+        close(fd);
+    }
+
+    return f;
+}
+
+static bool pool_read_header(FILE *f, const char *path, TPM2_CC cc,
+        const TPM2B_NAME *owner, UINT32 *taken) {
+
+    UINT32 version = 0;
+    UINT32 pool_cc = 0;
+    TPM2B_NAME pool_owner = { .size = 0 };
+    bool result = files_read_header(f, &version)
+            && version == ECC_POOL_VERSION
+            && files_read_32(f, &pool_cc)
+            && files_read_32(f, taken)
+            && files_read_16(f, &pool_owner.size)
+            && pool_owner.size <= sizeof(pool_owner.name)
+            && files_read_bytes(f, pool_owner.name, pool_owner.size);
+    if (!result) {
+        LOG_ERR("\"%s\" is not a pool", path);
+        return false;
+    }
+
+    if (pool_cc != cc) {
+        LOG_ERR("Pool \"%s\" holds the results of command 0x%x, not 0x%x",
+                path, pool_cc, cc);
+        return false;
+    }
+
+    if (owner && (owner->size != pool_owner.size
+            || memcmp(owner->name, pool_owner.name, owner->size))) {
+        LOG_ERR("Pool \"%s\" is for another %s", path,
+                cc == TPM2_CC_Commit ? "key" : "curve");
+        return false;
+    }
+
+    return true;
+}
+
+static bool pool_write_header(FILE *f, TPM2_CC cc, const TPM2B_NAME *owner) {
+
+    return files_write_header(f, ECC_POOL_VERSION)
+            && files_write_32(f, cc)
+            && files_write_32(f, 0)
+            && files_write_16(f, owner->size)
+            && files_write_bytes(f, (UINT8 *) owner->name, owner->size);
+}
+
+static bool pool_write_taken(FILE *f, UINT32 taken) {
+
+    return !fseek(f, ECC_POOL_TAKEN_OFFSET, SEEK_SET)
+            && files_write_32(f, taken)
+            && !fflush(f);
+}
+
+static bool pool_is_end(FILE *f) {
+
+    int c = fgetc(f);
+    if (c == EOF) {
+        return true;
+    }
+
+    ungetc(c, f);
+
+    return false;
+}
+
+static bool pool_read_entry(FILE *f, size_t points,
+        tpm2_ecc_pool_entry *entry) {
+
+    bool result = files_read_16(f, &entry->counter);
+
+    size_t i;
+    for (i = 0; result && i < points; i++) {
+        UINT8 buffer[sizeof(TPM2B_ECC_POINT)];
+        UINT16 size = 0;
+        result = files_read_16(f, &size)
+                && size <= sizeof(buffer) - sizeof(size)
+                && files_read_bytes(f, &buffer[sizeof(size)], size);
+        if (!result) {
+            break;
+        }
+
+        /* the size read is the one of the marshaled TPM2B */
+        buffer[0] = size >> 8;
+        buffer[1] = size & 0xff;
+
+        size_t offset = 0;
+        TSS2_RC rval = Tss2_MU_TPM2B_ECC_POINT_Unmarshal(buffer,
+                sizeof(size) + size, &offset, &entry->points[i]);
+        result = rval == TSS2_RC_SUCCESS;
+    }
+
+    return result;
+}
+
+static bool pool_write_entry(FILE *f, size_t points,
+        const tpm2_ecc_pool_entry *entry) {
+
+    bool result = files_write_16(f, entry->counter);
+
+    size_t i;
+    for (i = 0; result && i < points; i++) {
+        UINT8 buffer[sizeof(TPM2B_ECC_POINT)];
+        size_t offset = 0;
+        TSS2_RC rval = Tss2_MU_TPM2B_ECC_POINT_Marshal(&entry->points[i],
+                buffer, sizeof(buffer), &offset);
+        if (rval != TSS2_RC_SUCCESS) {
+            LOG_PERR(Tss2_MU_TPM2B_ECC_POINT_Marshal, rval);
+            return false;
+        }
+
+        result = files_write_bytes(f, buffer, offset);
+    }
+
+    return result;
+}
+
+/* counts the entries from the current position to the end */
+static bool pool_count(FILE *f, size_t points, size_t *count) {
+
+    *count = 0;
+    while (!pool_is_end(f)) {
+        tpm2_ecc_pool_entry entry;
+        if (!pool_read_entry(f, points, &entry)) {
+            return false;
+        }
+        (*count)++;
+    }
+
+    return true;
+}
+
+bool tpm2_ecc_pool_add(const char *path, TPM2_CC cc, const TPM2B_NAME *owner,
+        const tpm2_ecc_pool_entry *entries, size_t count, size_t *remaining) {
+
+    size_t points = tpm2_ecc_pool_points(cc);
+
+    FILE *f = pool_open(path, true);
+    if (!f) {
+        return false;
+    }
+
+    bool result = true;
+    size_t total = 0;
+    UINT32 taken = 0;
+    if (pool_is_end(f)) {
+        result = pool_write_header(f, cc, owner);
+    } else {
+        result = pool_read_header(f, path, cc, owner, &taken);
+        long entries_offset = ftell(f);
+        result = result && entries_offset >= 0
+                && pool_count(f, points, &total);
+        if (!result) {
+            goto out;
+        }
+
+        /* the file only grows while entries are left to take */
+        if (taken >= total) {
+            result = !fflush(f) && !ftruncate(fileno(f), entries_offset)
+                    && pool_write_taken(f, 0);
+            total = taken = 0;
+        }
+    }
+
+    result = result && !fseek(f, 0, SEEK_END);
+
+    size_t i;
+    for (i = 0; result && i < count; i++) {
+        result = pool_write_entry(f, points, &entries[i]);
+    }
+
+    if (result) {
+        *remaining = total - taken + count;
+    }
+
+out:
+    result = !fclose(f) && result;
+    if (!result) {
+        LOG_ERR("Could not add to pool \"%s\"", path);
+    }
+
+    return result;
+}
+
+bool tpm2_ecc_pool_take(const char *path, TPM2_CC cc, const TPM2B_NAME *owner,
+        tpm2_ecc_pool_entry *entry, size_t *remaining) {
+
+    size_t points = tpm2_ecc_pool_points(cc);
+
+    FILE *f = pool_open(path, false);
+    if (!f) {
+        return false;
+    }
+
+    UINT32 taken = 0;
+    bool result = pool_read_header(f, path, cc, owner, &taken);
+
+    UINT32 i;
+    for (i = 0; result && i <= taken; i++) {
+        if (pool_is_end(f)) {
+            LOG_ERR("Pool \"%s\" is empty", path);
+            result = false;
+            break;
+        }
+        result = pool_read_entry(f, points, entry);
+    }
+
+    result = result && pool_count(f, points, remaining)
+            && pool_write_taken(f, taken + 1);
+
+    fclose(f);
+
+    return result;
+}
@@ -0,0 +1,83 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+#ifndef LIB_TPM2_ECC_POOL_H_
+#define LIB_TPM2_ECC_POOL_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include <tss2/tss2_tpm2_types.h>
+
+/*
+ * A pool keeps the results of TPM2_EC_Ephemeral or TPM2_Commit run ahead of
+ * time, ie the commit counter with the ephemeral point Q, or with the points
+ * K, L and E, so that a latency critical TPM2_ZGen_2Phase or ECDAA signature
+ * only pays for its own command. It is laid out as, all numbers big endian:
+ *   the header of files_write_header()
+ *   U32 command code, TPM2_CC_EC_Ephemeral or TPM2_CC_Commit
+ *   U32 count of entries taken
+ *   TPM2B owner, the curve of EC_Ephemeral or the name of the Commit key
+ *   the entries, oldest first:
+ *     U16 counter, then the marshaled TPM2B_ECC_POINTs
+ * Entries are taken oldest first and each once, under a lock of the pool file,
+ * so concurrent consumers never get the same counter.
+ */
+#define TPM2_ECC_POOL_POINTS_MAX 3
+
+typedef struct tpm2_ecc_pool_entry tpm2_ecc_pool_entry;
+struct tpm2_ecc_pool_entry {
+    UINT16 counter;
+    /* Q of EC_Ephemeral, K, L and E of Commit */
+    TPM2B_ECC_POINT points[TPM2_ECC_POOL_POINTS_MAX];
+};
+
+/**
+ * The number of points an entry of a command holds.
+ * @param cc
+ *  TPM2_CC_EC_Ephemeral or TPM2_CC_Commit.
+ * @return
+ *  The number of points, 0 for other commands.
+ */
+size_t tpm2_ecc_pool_points(TPM2_CC cc);
+
+/**
+ * Appends entries to a pool, creating it if needed. The entries already taken
+ * are dropped first when none is left.
+ * @param path
+ *  The path of the pool.
+ * @param cc
+ *  The command that produced the entries.
+ * @param owner
+ *  The curve or key the entries were produced for, which has to match the
+ *  one of an existing pool.
+ * @param entries
+ *  The entries to append, oldest first.
+ * @param count
+ *  The number of entries.
+ * @param remaining
+ *  Receives the number of entries left in the pool.
+ * @return
+ *  True on success, false on error.
+ */
+bool tpm2_ecc_pool_add(const char *path, TPM2_CC cc, const TPM2B_NAME *owner,
+        const tpm2_ecc_pool_entry *entries, size_t count, size_t *remaining);
+
+/**
+ * Takes the oldest entry of a pool.
+ * @param path
+ *  The path of the pool.
+ * @param cc
+ *  The command the entry has to be produced by.
+ * @param owner
+ *  The curve or key the entry has to be produced for, NULL for any.
+ * @param entry
+ *  Receives the entry.
+ * @param remaining
+ *  Receives the number of entries left in the pool.
+ * @return
+ *  True on success, false on error or if the pool is empty.
+ */
+bool tpm2_ecc_pool_take(const char *path, TPM2_CC cc, const TPM2B_NAME *owner,
+        tpm2_ecc_pool_entry *entry, size_t *remaining);
+
+#endif /* LIB_TPM2_ECC_POOL_H_ */
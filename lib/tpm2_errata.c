@@ -5,6 +5,7 @@
 #include <stdlib.h>
 
 #include "log.h"
+#include "tpm2_arena.h"
 #include "tpm2_errata.h"
 #include "tpm2_capability.h"
 
@@ -51,6 +52,12 @@ static struct tpm2_errata_info {
 
 static struct tpm2_errata_info *this_errata_info;
 
+/*
+ * The errata the TPM needs fixups for, a bit per tpm2_errata_index_t. It
+ * depends on fixed properties only, so the capability cache keeps it.
+ */
+static UINT32 this_errata_bitmap;
+
 static void fixup_sign_decrypt_attribute_encoding(va_list *ap);
 
 /*
@@ -97,7 +104,7 @@ void tpm2_errata_fixup(tpm2_errata_index_t index, ...) {
      * There was no match against the TPMs details to a
      * known errata.
      */
-    if (!this_errata_info) {
+    if (!this_errata_bitmap) {
         return;
     }
 
@@ -111,8 +118,7 @@ void tpm2_errata_fixup(tpm2_errata_index_t index, ...) {
      * Check to see if that errata matches the tpm's
      * information and thus needs to be applied.
      */
-    bool res = errata_match(errata);
-    if (res == false) {
+    if (!(this_errata_bitmap & (1u << index))) {
         return;
     }
 
@@ -177,19 +183,48 @@ static void process(TPMS_CAPABILITY_DATA *capability_data) {
             day_of_year);
 }
 
+/* the errata of errata_desc_list matching the TPM */
+static UINT32 errata_detect(void) {
+
+    UINT32 bitmap = 0;
+    size_t i;
+    for (i = 0; this_errata_info && i < ARRAY_LEN(errata_desc_list); ++i) {
+        if (errata_match(&errata_desc_list[i])) {
+            bitmap |= 1u << i;
+        }
+    }
+
+    return bitmap;
+}
+
 void tpm2_errata_init(ESYS_CONTEXT *ctx) {
 
-    TPMS_CAPABILITY_DATA *capability_data;
+    this_errata_info = NULL;
+    this_errata_bitmap = 0;
+
+    /* an errata enabled run asks the TPM nothing once the cache knows */
+    UINT32 bitmap = 0;
+    if (tpm2_capability_fact_get(ctx, tpm2_capability_fact_errata, &bitmap)) {
+        this_errata_bitmap = bitmap;
+        return;
+    }
+
+    TPMS_CAPABILITY_DATA *capability_data = NULL;
     tool_rc rc = tpm2_capability_get(ctx, TPM2_CAP_TPM_PROPERTIES,
             TPM2_PT_LEVEL, TPM2_PT_YEAR - TPM2_PT_LEVEL + 1, &capability_data);
-    if (rc != tool_rc_success) {
+    bool is_adopted = tpm2_arena_adopt(tpm2_arena_invocation(),
+            capability_data);
+    if (rc != tool_rc_success || !is_adopted) {
         LOG_ERR("Failed to GetCapability: capability: 0x%x, property: 0x%x, ",
                 TPM2_CAP_TPM_PROPERTIES, TPM2_PT_LEVEL);
         return;
     }
 
     process(capability_data);
-    free(capability_data);
+
+    this_errata_bitmap = errata_detect();
+    tpm2_capability_fact_put(ctx, tpm2_capability_fact_errata,
+            this_errata_bitmap);
 }
 
 static void fixup_sign_decrypt_attribute_encoding(va_list *ap) {
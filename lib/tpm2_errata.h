@@ -19,7 +19,10 @@ typedef enum {
 } tpm2_errata_index_t;
 
 /**
- * Initialize errata subsystem
+ * Initialize errata subsystem, detecting the errata the TPM needs fixups
+ * for. With the capability cache of TPM2TOOLS_CAPABILITY_CACHE, the result
+ * is cached as long as the firmware of the TPM stays the same, and later
+ * runs query nothing.
  *
  * @param ctx
  *  ESAPI context to be queried.
@@ -1,14 +1,219 @@
+#include <errno.h>
 #include <inttypes.h>
 #include <stdlib.h>
 #include <string.h>
 
 #include <tss2/tss2_tpm2_types.h>
 
+#include "files.h"
 #include "log.h"
 #include "efi_event.h"
 #include "tpm2_alg_util.h"
 #include "tpm2_eventlog.h"
+#include "tpm2_hex.h"
 #include "tpm2_openssl.h"
+#include "tpm2_util.h"
+#include "tpm2_work_pool.h"
+
+/*
+ * The extends of one PCR bank in log order. The digests point into the event
+ * log, which outlives the replay.
+ */
+typedef struct {
+    uint8_t pcr_index;
+    BYTE const *digest;
+} replay_extend;
+
+typedef struct {
+    TPMI_ALG_HASH alg;
+    uint8_t *pcrs;
+    size_t digest_size;
+    replay_extend *extends;
+    size_t count;
+    size_t capacity;
+    bool result;
+} replay_bank;
+
+struct tpm2_eventlog_replay {
+    replay_bank banks[5];
+};
+
+#define REPLAY_EXTENDS_MIN 64
+
+/* the extends queued before, of a scratch, are kept for their capacity */
+static void replay_init(tpm2_eventlog_replay *replay,
+        tpm2_eventlog_context *ctx) {
+
+    replay_bank banks[] = {
+        { TPM2_ALG_SHA1, (uint8_t *)ctx->sha1_pcrs,
+          sizeof(ctx->sha1_pcrs[0]), NULL, 0, 0, true },
+        { TPM2_ALG_SHA256, (uint8_t *)ctx->sha256_pcrs,
+          sizeof(ctx->sha256_pcrs[0]), NULL, 0, 0, true },
+        { TPM2_ALG_SHA384, (uint8_t *)ctx->sha384_pcrs,
+          sizeof(ctx->sha384_pcrs[0]), NULL, 0, 0, true },
+        { TPM2_ALG_SHA512, (uint8_t *)ctx->sha512_pcrs,
+          sizeof(ctx->sha512_pcrs[0]), NULL, 0, 0, true },
+        { TPM2_ALG_SM3_256, (uint8_t *)ctx->sm3_256_pcrs,
+          sizeof(ctx->sm3_256_pcrs[0]), NULL, 0, 0, true },
+    };
+
+    size_t i;
+    for (i = 0; i < ARRAY_LEN(banks); i++) {
+        banks[i].extends = replay->banks[i].extends;
+        banks[i].capacity = replay->banks[i].capacity;
+    }
+
+    memcpy(replay->banks, banks, sizeof(replay->banks));
+}
+
+static void replay_free(tpm2_eventlog_replay *replay) {
+
+    size_t i;
+    for (i = 0; i < ARRAY_LEN(replay->banks); i++) {
+        free(replay->banks[i].extends);
+        replay->banks[i].extends = NULL;
+    }
+}
+
+static bool replay_queue(tpm2_eventlog_replay *replay, TPMI_ALG_HASH alg,
+        unsigned pcr_index, BYTE const *digest) {
+
+    size_t i;
+    for (i = 0; i < ARRAY_LEN(replay->banks); i++) {
+        replay_bank *bank = &replay->banks[i];
+        if (bank->alg != alg) {
+            continue;
+        }
+
+        if (bank->count == bank->capacity) {
+            size_t capacity = bank->capacity ?
+                    bank->capacity * 2 : REPLAY_EXTENDS_MIN;
+            replay_extend *extends = realloc(bank->extends,
+                    capacity * sizeof(*extends));
+            if (!extends) {
+                LOG_ERR("oom");
+                return false;
+            }
+            bank->extends = extends;
+            bank->capacity = capacity;
+        }
+
+        bank->extends[bank->count].pcr_index = pcr_index;
+        bank->extends[bank->count].digest = digest;
+        bank->count++;
+        return true;
+    }
+
+    return false;
+}
+
+/*
+ * Runs the extend chain of a bank with a single digest context. This may run
+ * on a worker of a pool so it must not log, failures are reported by the
+ * delivery.
+ */
+static void replay_bank_run(replay_bank *bank) {
+
+    bank->result = false;
+
+    const EVP_MD *md = tpm2_openssl_halg_from_tpmhalg(bank->alg);
+    if (!md) {
+        return;
+    }
+
+    EVP_MD_CTX *mdctx = tpm2_openssl_md_ctx_get();
+    if (!mdctx) {
+        return;
+    }
+
+    size_t i;
+    for (i = 0; i < bank->count; i++) {
+        uint8_t *pcr = bank->pcrs +
+                bank->extends[i].pcr_index * bank->digest_size;
+
+        // extend operation is pcr = HASH(pcr + data)
+        unsigned size = bank->digest_size;
+        int rc = EVP_DigestInit_ex(mdctx, md, NULL)
+                && EVP_DigestUpdate(mdctx, pcr, bank->digest_size)
+                && EVP_DigestUpdate(mdctx, bank->extends[i].digest,
+                        bank->digest_size)
+                && EVP_DigestFinal_ex(mdctx, pcr, &size);
+        if (!rc) {
+            goto out;
+        }
+    }
+
+    bank->result = true;
+
+out:
+    tpm2_openssl_md_ctx_put(mdctx);
+}
+
+/* the banks with extends to run */
+typedef struct {
+    replay_bank **banks;
+    bool result;
+} replay_state;
+
+static bool replay_work(tpm2_work_worker *worker, size_t index,
+        void *userdata) {
+
+    UNUSED(worker);
+
+    replay_state *state = (replay_state *)userdata;
+    replay_bank_run(state->banks[index]);
+
+    return state->banks[index]->result;
+}
+
+static bool replay_deliver(size_t index, bool result, void *userdata) {
+
+    replay_state *state = (replay_state *)userdata;
+    if (!result) {
+        LOG_ERR("%s PCR extend failed",
+                tpm2_alg_util_algtostr(state->banks[index]->alg,
+                        tpm2_alg_util_flags_hash));
+        state->result = false;
+    }
+
+    return true;
+}
+
+/*
+ * The banks are independent of each other, so they are extended on a work
+ * pool with a worker per bank, unless is_serial, ie when the caller runs in
+ * a job of a pool already. The order of the extends within a bank is the log
+ * order, which keeps the PCR values identical to extending them while
+ * parsing.
+ */
+static bool replay_run(tpm2_eventlog_replay *replay, bool is_serial) {
+
+    replay_bank *banks[ARRAY_LEN(replay->banks)];
+    replay_state state = {
+        .banks = banks,
+        .result = true,
+    };
+
+    size_t count = 0;
+    size_t i;
+    for (i = 0; i < ARRAY_LEN(replay->banks); i++) {
+        if (replay->banks[i].count) {
+            banks[count++] = &replay->banks[i];
+        }
+    }
+
+    if (!is_serial && tpm2_work_pool_run(count, count, replay_work,
+            replay_deliver, &state)) {
+        return state.result;
+    }
+
+    /* serially, or when the pool could not be set up, before any delivery */
+    for (i = 0; i < count; i++) {
+        replay_deliver(i, replay_work(NULL, i, &state), &state);
+    }
+
+    return state.result;
+}
 
 bool digest2_accumulator_callback(TCG_DIGEST2 const *digest, size_t size,
                                   void *data){
@@ -80,9 +285,19 @@ bool foreach_digest2(tpm2_eventlog_context *ctx, unsigned pcr_index, TCG_DIGEST2
             LOG_WARN("PCR%d algorithm %d unsupported", pcr_index, alg);
         }
 
-        if (pcr && !tpm2_openssl_pcr_extend(alg, pcr, digest->Digest, alg_size)) {
-            LOG_ERR("PCR%d extend failed", pcr_index);
-            return false;
+        if (pcr && !ctx->skip_extend) {
+            /* a prediction extends the planned measurement instead */
+            BYTE const *extend = ctx->plan ?
+                tpm2_eventlog_plan_replace(ctx, alg, pcr_index,
+                        digest->Digest, alg_size) :
+                digest->Digest;
+            bool result = ctx->replay ?
+                replay_queue(ctx->replay, alg, pcr_index, extend) :
+                tpm2_openssl_pcr_extend(alg, pcr, extend, alg_size);
+            if (!result) {
+                LOG_ERR("PCR%d extend failed", pcr_index);
+                return false;
+            }
         }
 
         if (ctx->digest2_cb != NULL) {
@@ -178,6 +393,7 @@ bool parse_event2(TCG_EVENT_HEADER2 const *eventhdr, size_t buf_size,
     tpm2_eventlog_context ctx = {
         .data = digests_size,
         .digest2_cb = digest2_accumulator_callback,
+        .skip_extend = true,
     };
     ret = foreach_digest2(&ctx, eventhdr->PCRIndex,
                           eventhdr->Digests, eventhdr->DigestCount,
@@ -203,17 +419,55 @@ bool parse_event2(TCG_EVENT_HEADER2 const *eventhdr, size_t buf_size,
     return true;
 }
 
+static bool parse_sha1_log_event_size(TCG_EVENT const *event, size_t size,
+        size_t *event_size) {
+
+    /* enough size for the 1.2 event structure */
+    if (size < sizeof(*event)) {
+        LOG_ERR("insufficient size for SpecID event header");
+        return false;
+    }
+
+    /* buffer size must be sufficient to hold event and event data */
+    if (size < sizeof(*event) + (sizeof(event->event[0]) *
+                                 event->eventDataSize)) {
+        LOG_ERR("insufficient size for SpecID event data");
+        return false;
+    }
+    *event_size = sizeof(*event) + event->eventDataSize;
+    return true;
+}
+
+/* flags a digest of a measured event that is not in the reference database */
+static bool reference_appraise(tpm2_eventlog_context *ctx, UINT32 type,
+        unsigned pcr_index, TPMI_ALG_HASH alg, BYTE const *digest,
+        size_t size) {
+
+    if (!ctx->reference || type == EV_NO_ACTION
+            || tpm2_eventlog_reference_contains(ctx->reference, digest, size)) {
+        return true;
+    }
+
+    ctx->unknown_digests++;
+
+    return !ctx->unknown_digest_cb || ctx->unknown_digest_cb(ctx->event_count,
+            pcr_index, alg, digest, size, ctx->data);
+}
+
 bool parse_sha1_log_event(tpm2_eventlog_context *ctx, TCG_EVENT const *event, size_t size,
                       size_t *event_size) {
 
     uint8_t *pcr = NULL;
 
-    /* enough size for the 1.2 event structure */
-    if (size < sizeof(*event)) {
-        LOG_ERR("insufficient size for SpecID event header");
+    if (!parse_sha1_log_event_size(event, size, event_size)) {
+        return false;
+    }
+
+    if (event->pcrIndex >= TPM2_MAX_PCRS) {
+        LOG_ERR("PCR index %"PRIu32" of event %zu is out of range",
+                event->pcrIndex, ctx->event_count);
         return false;
     }
-    *event_size = sizeof(*event);
 
     pcr = ctx->sha1_pcrs[ event->pcrIndex];
     if (pcr) {
@@ -221,14 +475,80 @@ bool parse_sha1_log_event(tpm2_eventlog_context *ctx, TCG_EVENT const *event, si
         ctx->sha1_used |= (1 << event->pcrIndex);
     }
 
-    /* buffer size must be sufficient to hold event and event data */
-    if (size < sizeof(*event) + (sizeof(event->event[0]) *
-                                 event->eventDataSize)) {
-        LOG_ERR("insufficient size for SpecID event data");
+    return reference_appraise(ctx, event->eventType, event->pcrIndex,
+            TPM2_ALG_SHA1, event->digest, sizeof(event->digest));
+}
+
+/*
+ * Replays a SHA1 log when nothing but the PCRs and the appraisal is asked
+ * for, ie a replay only of the logs of a TPM 1.2. The events are fixed size
+ * headers followed by their data, so the walk needs no callback per event and
+ * all the extends go through one digest context, without allocating.
+ */
+static bool sha1_log_replay(tpm2_eventlog_context *ctx,
+        TCG_EVENT const *eventhdr_start, size_t size) {
+
+    const EVP_MD *md = tpm2_openssl_halg_from_tpmhalg(TPM2_ALG_SHA1);
+    EVP_MD_CTX *mdctx = md ? tpm2_openssl_md_ctx_get() : NULL;
+    if (!mdctx) {
         return false;
     }
-    *event_size += event->eventDataSize;
-    return true;
+
+    BYTE const *next = (BYTE const *)eventhdr_start;
+    uint32_t used = 0;
+    bool ret = false;
+
+    while (size) {
+        TCG_EVENT const *event = (TCG_EVENT const *)next;
+        if (size < sizeof(*event)
+                || size - sizeof(*event) < event->eventDataSize) {
+            LOG_ERR("insufficient size for event %zu of the SHA1 log",
+                    ctx->event_count);
+            goto out;
+        }
+        size_t event_size = sizeof(*event) + event->eventDataSize;
+
+        UINT32 pcr_index = event->pcrIndex;
+        if (pcr_index >= TPM2_MAX_PCRS) {
+            LOG_ERR("PCR index %"PRIu32" of event %zu is out of range",
+                    pcr_index, ctx->event_count);
+            goto out;
+        }
+
+        /* extend operation is pcr = HASH(pcr + data) */
+        uint8_t *pcr = ctx->sha1_pcrs[pcr_index];
+        unsigned digest_size = TPM2_SHA1_DIGEST_SIZE;
+        int rc = EVP_DigestInit_ex(mdctx, md, NULL)
+                && EVP_DigestUpdate(mdctx, pcr, TPM2_SHA1_DIGEST_SIZE)
+                && EVP_DigestUpdate(mdctx, event->digest,
+                        sizeof(event->digest))
+                && EVP_DigestFinal_ex(mdctx, pcr, &digest_size);
+        if (!rc) {
+            LOG_ERR("%s", tpm2_openssl_get_err());
+            goto out;
+        }
+        used |= UINT32_C(1) << pcr_index;
+
+        if (ctx->reference && !reference_appraise(ctx, event->eventType,
+                pcr_index, TPM2_ALG_SHA1, event->digest,
+                sizeof(event->digest))) {
+            goto out;
+        }
+
+        ctx->log_offset += event_size;
+        ctx->last_event_size = event_size;
+        ctx->event_count++;
+        next += event_size;
+        size -= event_size;
+    }
+
+    ret = true;
+
+out:
+    ctx->sha1_used |= used;
+    tpm2_openssl_md_ctx_put(mdctx);
+
+    return ret;
 }
 
 bool foreach_sha1_log_event(tpm2_eventlog_context *ctx, TCG_EVENT const *eventhdr_start, size_t size) {
@@ -242,6 +562,10 @@ bool foreach_sha1_log_event(tpm2_eventlog_context *ctx, TCG_EVENT const *eventhd
         return true;
     }
 
+    if (ctx->skip_body && !ctx->log_eventhdr_cb && !ctx->event2_cb) {
+        return sha1_log_replay(ctx, eventhdr_start, size);
+    }
+
     TCG_EVENT const *eventhdr;
     size_t event_size;
     bool ret;
@@ -266,7 +590,7 @@ bool foreach_sha1_log_event(tpm2_eventlog_context *ctx, TCG_EVENT const *eventhd
             }
         }
 
-        ret = parse_event2body(event, eventhdr->eventType);
+        ret = ctx->skip_body || parse_event2body(event, eventhdr->eventType);
         if (ret != true) {
             return ret;
         }
@@ -279,18 +603,46 @@ bool foreach_sha1_log_event(tpm2_eventlog_context *ctx, TCG_EVENT const *eventhd
                 return false;
             }
         }
+
+        ctx->log_offset += event_size;
+        ctx->last_event_size = event_size;
+        ctx->event_count++;
     }
 
     return true;
 }
 
+typedef enum verify_status verify_status;
+enum verify_status {
+    verify_status_ok,
+    verify_status_no_hash,
+    verify_status_mismatch,
+    verify_status_bad_pcr,
+    verify_status_bad_format,
+};
+
+static bool verify_hash(EVP_MD_CTX *mdctx, TPMI_ALG_HASH alg,
+        BYTE const *data, size_t size, BYTE *digest) {
+
+    const EVP_MD *md = tpm2_openssl_halg_from_tpmhalg(alg);
+    if (!md) {
+        return false;
+    }
+
+    unsigned digest_size = 0;
+    return EVP_DigestInit_ex(mdctx, md, NULL)
+            && EVP_DigestUpdate(mdctx, data, size)
+            && EVP_DigestFinal_ex(mdctx, digest, &digest_size);
+}
+
 /*
- * For event types where digest can be verified from their event payload,
- * perform verification to ensure event payload was not tempered
+ * Checks the digests of an event against its payload. This may run on its own
+ * thread so it must not log, verify_log() reports the status.
  */
-bool verify_digests(size_t eventnum, TCG_EVENT_HEADER2 const *eventhdr, TCG_EVENT2 *event) {
+static verify_status verify_event(EVP_MD_CTX *mdctx,
+        TCG_EVENT_HEADER2 const *eventhdr, TCG_EVENT2 const *event) {
 
-size_t i;
+    size_t i;
 
     TCG_DIGEST2 const *digest = eventhdr->Digests;
     UINT32 digest_count = eventhdr->DigestCount;
@@ -303,19 +655,17 @@ size_t i;
     case EV_EFI_GPT_EVENT:
         for (i = 0; i < digest_count; i++) {
             TPMI_ALG_HASH alg = digest->AlgorithmId;
-            TPM2B_DIGEST calc_digest;
+            BYTE calc_digest[EVP_MAX_MD_SIZE];
 
-            bool result = tpm2_openssl_hash_compute_data(alg, event->Event,
-            event->EventSize, &calc_digest);
+            bool result = verify_hash(mdctx, alg, event->Event,
+                    event->EventSize, calc_digest);
             if (!result) {
-                LOG_WARN("Event %zu: Cannot calculate hash value from data", eventnum - 1);
-                return false;
+                return verify_status_no_hash;
             }
 
             size_t alg_size = tpm2_alg_util_get_hash_size(alg);
-            if (memcmp(calc_digest.buffer, digest->Digest, alg_size) != 0) {
-                LOG_WARN("Event %zu's digest does not match its payload", eventnum - 1);
-                return false;
+            if (memcmp(calc_digest, digest->Digest, alg_size) != 0) {
+                return verify_status_mismatch;
             }
 
             digest = (TCG_DIGEST2*)((uintptr_t)digest->Digest + alg_size);
@@ -327,19 +677,18 @@ size_t i;
         /* PCR9: used to measure loaded kernel and initramfs images which cannot
            be verified from eventlog alone */
         if (eventhdr->PCRIndex == 9) {
-            return true;
+            return verify_status_ok;
         }
 
         /* PCR14: used to measure MokList, MokListX, and MokSBState which cannot
            be verified from eventlog alone */
         if (eventhdr->PCRIndex == 14) {
-            return true;
+            return verify_status_ok;
         }
 
         /* PCR8: used to measure grub and kernel command line */
         if (eventhdr->PCRIndex != 8) {
-            LOG_WARN("Event %zu is unexpectedly not extending either PCR 8, 9, or 14", eventnum - 1);
-            return false;
+            return verify_status_bad_pcr;
         }
 
         /* Digest is applied on the string between "^[a-zA-Z_]+:? " and EOL,
@@ -353,33 +702,29 @@ size_t i;
             }
 
             if (j + 1 >= event->EventSize || event->Event[event->EventSize - 1] != '\0') {
-                LOG_WARN("Event %zu's event data is in unexpected format", eventnum - 1);
-                return false;
+                return verify_status_bad_format;
             }
 
-            TPM2B_DIGEST calc_digest;
+            BYTE calc_digest[EVP_MAX_MD_SIZE];
             TPMI_ALG_HASH alg = digest->AlgorithmId;
             /* First try to calculate the hash excluding the trailing \0 */
-            bool result = tpm2_openssl_hash_compute_data(alg,
-            event->Event + (j + 1), event->EventSize - (j + 2), &calc_digest);
+            bool result = verify_hash(mdctx, alg, event->Event + (j + 1),
+                    event->EventSize - (j + 2), calc_digest);
             if (!result) {
-                LOG_WARN("Event %zu: Cannot calculate hash value from data", eventnum - 1);
-                return false;
+                return verify_status_no_hash;
             }
 
             size_t alg_size = tpm2_alg_util_get_hash_size(alg);
-            if (memcmp(calc_digest.buffer, digest->Digest, alg_size) != 0) {
+            if (memcmp(calc_digest, digest->Digest, alg_size) != 0) {
                 /* Next try to calculate the hash including the trailing \0 */
-                bool result = tpm2_openssl_hash_compute_data(alg,
-                event->Event + (j + 1), event->EventSize - (j + 1), &calc_digest);
+                bool result = verify_hash(mdctx, alg, event->Event + (j + 1),
+                        event->EventSize - (j + 1), calc_digest);
                 if (!result) {
-                    LOG_WARN("Event %zu: Cannot calculate hash value from data", eventnum - 1);
-                    return false;
+                    return verify_status_no_hash;
                 }
 
-                if (memcmp(calc_digest.buffer, digest->Digest, alg_size) != 0) {
-                    LOG_WARN("Event %zu's digest does not match its payload", eventnum - 1);
-                    return false;
+                if (memcmp(calc_digest, digest->Digest, alg_size) != 0) {
+                    return verify_status_mismatch;
                 }
             }
             digest = (TCG_DIGEST2*)((uintptr_t)digest->Digest + alg_size);
@@ -387,9 +732,166 @@ size_t i;
         break;
     }
 
+    return verify_status_ok;
+}
+
+static bool verify_log(size_t eventnum, verify_status status) {
+
+    switch (status) {
+    case verify_status_ok:
+        return true;
+    case verify_status_no_hash:
+        LOG_WARN("Event %zu: Cannot calculate hash value from data", eventnum - 1);
+        break;
+    case verify_status_mismatch:
+        LOG_WARN("Event %zu's digest does not match its payload", eventnum - 1);
+        break;
+    case verify_status_bad_pcr:
+        LOG_WARN("Event %zu is unexpectedly not extending either PCR 8, 9, or 14", eventnum - 1);
+        break;
+    case verify_status_bad_format:
+        LOG_WARN("Event %zu's event data is in unexpected format", eventnum - 1);
+        break;
+    }
+
+    return false;
+}
+
+/*
+ * For event types where digest can be verified from their event payload,
+ * perform verification to ensure event payload was not tempered
+ */
+bool verify_digests(size_t eventnum, TCG_EVENT_HEADER2 const *eventhdr, TCG_EVENT2 *event) {
+
+    EVP_MD_CTX *mdctx = tpm2_openssl_md_ctx_get();
+    if (!mdctx) {
+        return verify_log(eventnum, verify_status_no_hash);
+    }
+
+    verify_status status = verify_event(mdctx, eventhdr, event);
+    tpm2_openssl_md_ctx_put(mdctx);
+
+    return verify_log(eventnum, status);
+}
+
+static bool verify_is_payload_event(UINT32 event_type) {
+
+    switch (event_type) {
+    case EV_S_CRTM_VERSION:
+    case EV_SEPARATOR:
+    case EV_EFI_VARIABLE_DRIVER_CONFIG:
+    case EV_EFI_GPT_EVENT:
+    case EV_IPL:
+        return true;
+    }
+
+    return false;
+}
+
+/*
+ * The events with a payload to verify, recorded by the walk over the log and
+ * verified once it completed. The events point into the event log, which
+ * outlives the verification.
+ */
+typedef struct {
+    size_t eventnum;
+    TCG_EVENT_HEADER2 const *eventhdr;
+    TCG_EVENT2 const *event;
+    verify_status status;
+} verify_job;
+
+struct tpm2_eventlog_verify {
+    verify_job *jobs;
+    size_t count;
+    size_t capacity;
+    /* the events that failed to verify */
+    size_t failures;
+};
+
+#define VERIFY_JOBS_MIN 64
+/* below that many events per worker, starting a worker costs more */
+#define VERIFY_JOBS_PER_THREAD 16
+
+static bool verify_queue(tpm2_eventlog_verify *verify, size_t eventnum,
+        TCG_EVENT_HEADER2 const *eventhdr, TCG_EVENT2 const *event) {
+
+    if (verify->count == verify->capacity) {
+        size_t capacity = verify->capacity ?
+                verify->capacity * 2 : VERIFY_JOBS_MIN;
+        verify_job *jobs = realloc(verify->jobs, capacity * sizeof(*jobs));
+        if (!jobs) {
+            LOG_ERR("oom");
+            return false;
+        }
+        verify->jobs = jobs;
+        verify->capacity = capacity;
+    }
+
+    verify_job *job = &verify->jobs[verify->count++];
+    job->eventnum = eventnum;
+    job->eventhdr = eventhdr;
+    job->event = event;
+    job->status = verify_status_ok;
+
+    return true;
+}
+
+static bool verify_work(tpm2_work_worker *worker, size_t index,
+        void *userdata) {
+
+    UNUSED(worker);
+
+    tpm2_eventlog_verify *verify = (tpm2_eventlog_verify *)userdata;
+    verify_job *job = &verify->jobs[index];
+
+    /* the digest context of the worker, not one per digest */
+    EVP_MD_CTX *mdctx = tpm2_openssl_md_ctx_get();
+    job->status = mdctx ? verify_event(mdctx, job->eventhdr, job->event) :
+            verify_status_no_hash;
+    tpm2_openssl_md_ctx_put(mdctx);
+
+    return true;
+}
+
+static bool verify_deliver(size_t index, bool result, void *userdata) {
+
+    UNUSED(result);
+
+    tpm2_eventlog_verify *verify = (tpm2_eventlog_verify *)userdata;
+    if (!verify_log(verify->jobs[index].eventnum,
+            verify->jobs[index].status)) {
+        verify->failures++;
+    }
+
     return true;
 }
 
+/*
+ * The payloads of the events are independent of each other, so they are
+ * verified on a work pool, unless is_serial, ie when the caller runs in a job
+ * of a pool already. The warnings are logged in log order.
+ */
+static size_t verify_run(tpm2_eventlog_verify *verify, bool is_serial) {
+
+    verify->failures = 0;
+
+    UINT32 jobs = tpm2_work_pool_workers(0,
+            (verify->count + VERIFY_JOBS_PER_THREAD - 1) /
+            VERIFY_JOBS_PER_THREAD);
+    if (!is_serial && tpm2_work_pool_run(verify->count, jobs, verify_work,
+            verify_deliver, verify)) {
+        return verify->failures;
+    }
+
+    /* serially, or when the pool could not be set up, before any delivery */
+    size_t i;
+    for (i = 0; i < verify->count; i++) {
+        verify_deliver(i, verify_work(NULL, i, verify), verify);
+    }
+
+    return verify->failures;
+}
+
 bool foreach_event2(tpm2_eventlog_context *ctx, TCG_EVENT_HEADER2 const *eventhdr_start, size_t size) {
 
     if (eventhdr_start == NULL) {
@@ -432,14 +934,40 @@ bool foreach_event2(tpm2_eventlog_context *ctx, TCG_EVENT_HEADER2 const *eventhd
             return false;
         }
 
+        /* parse_event2() checked the sizes of the digests */
+        TCG_DIGEST2 const *digest = eventhdr->Digests;
+        UINT32 i;
+        for (i = 0; ctx->reference && i < eventhdr->DigestCount; i++) {
+            size_t alg_size = tpm2_alg_util_get_hash_size(digest->AlgorithmId);
+            ret = reference_appraise(ctx, eventhdr->EventType,
+                    eventhdr->PCRIndex, digest->AlgorithmId, digest->Digest,
+                    alg_size);
+            if (!ret) {
+                return false;
+            }
+            digest = (TCG_DIGEST2 *)((uintptr_t)digest->Digest + alg_size);
+        }
+
+        if (ctx->skip_body) {
+            goto next;
+        }
+
         ret = parse_event2body(event, eventhdr->EventType);
         if (ret != true) {
             return ret;
         }
 
-        /* digest verification */
-        if (ctx->data != 0) {
-            verify_digests(*(size_t*)ctx->data, eventhdr, event);
+        /* digest verification, deferred to after the walk by parse_eventlog() */
+        if (ctx->data != 0 && verify_is_payload_event(eventhdr->EventType)) {
+            size_t eventnum = *(size_t*)ctx->data;
+            if (ctx->verify) {
+                ret = verify_queue(ctx->verify, eventnum, eventhdr, event);
+                if (!ret) {
+                    return false;
+                }
+            } else if (!verify_digests(eventnum, eventhdr, event)) {
+                ctx->verify_failures++;
+            }
         }
 
         /* event data callback */
@@ -449,6 +977,11 @@ bool foreach_event2(tpm2_eventlog_context *ctx, TCG_EVENT_HEADER2 const *eventhd
                 return false;
             }
         }
+
+next:
+        ctx->log_offset += event_size;
+        ctx->last_event_size = event_size;
+        ctx->event_count++;
     }
 
     return true;
@@ -533,12 +1066,37 @@ bool specid_event(TCG_EVENT const *event, size_t size,
     return true;
 }
 
-bool parse_eventlog(tpm2_eventlog_context *ctx, BYTE const *eventlog, size_t size) {
+static bool parse_eventlog_events(tpm2_eventlog_context *ctx,
+        BYTE const *eventlog, size_t size) {
 
     if(!eventlog) {
         return false;
     }
 
+    /* resume after the events replayed up to the checkpoint */
+    if (ctx->log_offset) {
+        if (ctx->is_ima_log) {
+            LOG_ERR("The checkpoint is of an IMA measurement list");
+            return false;
+        }
+
+        if (ctx->log_offset > size) {
+            LOG_ERR("Event log is shorter than the checkpoint, got: %zu, "
+                    "expected at least: %zu", size, ctx->log_offset);
+            return false;
+        }
+
+        BYTE const *resume = eventlog + ctx->log_offset;
+        size -= ctx->log_offset;
+        if (!size) {
+            return true;
+        }
+
+        return ctx->is_sha1_log ?
+            foreach_sha1_log_event(ctx, (TCG_EVENT const *)resume, size) :
+            foreach_event2(ctx, (TCG_EVENT_HEADER2 const *)resume, size);
+    }
+
     if(size < sizeof(TCG_EVENT)) {
         return false;
     }
@@ -553,6 +1111,11 @@ bool parse_eventlog(tpm2_eventlog_context *ctx, BYTE const *eventlog, size_t siz
 
         size -= (uintptr_t)next - (uintptr_t)eventlog;
 
+        ctx->is_sha1_log = false;
+        ctx->log_offset = (uintptr_t)next - (uintptr_t)eventlog;
+        ctx->last_event_size = ctx->log_offset;
+        ctx->event_count = 1;
+
         if (ctx->specid_cb) {
             ret = ctx->specid_cb(event, ctx->data);
             if (!ret) {
@@ -564,5 +1127,1113 @@ bool parse_eventlog(tpm2_eventlog_context *ctx, BYTE const *eventlog, size_t siz
     }
 
     /* No specid event found. sha1 log format will be parsed. */
+    ctx->is_sha1_log = true;
     return foreach_sha1_log_event(ctx, event, size);
 }
+
+struct tpm2_eventlog_scratch {
+    tpm2_eventlog_replay replay;
+    tpm2_eventlog_verify verify;
+};
+
+tpm2_eventlog_scratch *tpm2_eventlog_scratch_new(void) {
+
+    tpm2_eventlog_scratch *scratch = calloc(1, sizeof(*scratch));
+    if (!scratch) {
+        LOG_ERR("oom");
+        return NULL;
+    }
+
+    return scratch;
+}
+
+void tpm2_eventlog_scratch_free(tpm2_eventlog_scratch *scratch) {
+
+    if (!scratch) {
+        return;
+    }
+
+    replay_free(&scratch->replay);
+    free(scratch->verify.jobs);
+    free(scratch);
+}
+
+void tpm2_eventlog_context_reset(tpm2_eventlog_context *ctx) {
+
+    tpm2_eventlog_context reset = {
+        .data = ctx->data,
+        .specid_cb = ctx->specid_cb,
+        .log_eventhdr_cb = ctx->log_eventhdr_cb,
+        .event2hdr_cb = ctx->event2hdr_cb,
+        .digest2_cb = ctx->digest2_cb,
+        .event2_cb = ctx->event2_cb,
+        .eventlog_version = ctx->eventlog_version,
+        .skip_extend = ctx->skip_extend,
+        .skip_body = ctx->skip_body,
+        .reference = ctx->reference,
+        .unknown_digest_cb = ctx->unknown_digest_cb,
+        .ima_event_cb = ctx->ima_event_cb,
+        .scratch = ctx->scratch,
+        .plan = ctx->plan,
+    };
+
+    *ctx = reset;
+}
+
+typedef bool (*eventlog_walk)(tpm2_eventlog_context *ctx, void *data);
+
+/*
+ * Runs a walk over the events with the PCR extends and the payload
+ * verification deferred to after it.
+ */
+static bool parse_eventlog_deferred(tpm2_eventlog_context *ctx,
+        eventlog_walk walk, void *data) {
+
+    tpm2_eventlog_scratch local = { 0 };
+    tpm2_eventlog_scratch *scratch = ctx->scratch ? ctx->scratch : &local;
+
+    tpm2_eventlog_replay *replay = &scratch->replay;
+    replay_init(replay, ctx);
+
+    tpm2_eventlog_verify *verify = &scratch->verify;
+    verify->count = 0;
+
+    ctx->replay = replay;
+    ctx->verify = verify;
+    bool ret = walk(ctx, data);
+    ctx->replay = NULL;
+    ctx->verify = NULL;
+
+    if (ret) {
+        bool is_serial = ctx->scratch != NULL;
+        ctx->verify_failures += verify_run(verify, is_serial);
+        ret = replay_run(replay, is_serial);
+    }
+
+    if (!ctx->scratch) {
+        replay_free(replay);
+        free(verify->jobs);
+    }
+
+    return ret;
+}
+
+typedef struct {
+    BYTE const *eventlog;
+    size_t size;
+} eventlog_walk_all;
+
+static bool parse_eventlog_walk_all(tpm2_eventlog_context *ctx, void *data) {
+
+    eventlog_walk_all *all = (eventlog_walk_all *)data;
+
+    return parse_eventlog_events(ctx, all->eventlog, all->size);
+}
+
+bool parse_eventlog(tpm2_eventlog_context *ctx, BYTE const *eventlog, size_t size) {
+
+    eventlog_walk_all all = {
+        .eventlog = eventlog,
+        .size = size,
+    };
+
+    bool ret = parse_eventlog_deferred(ctx, parse_eventlog_walk_all, &all);
+    if (ret && ctx->plan) {
+        ret = tpm2_eventlog_plan_finish(ctx);
+    }
+
+    return ret;
+}
+
+#define INDEX_ENTRIES_MIN 256
+
+static bool index_add(tpm2_eventlog_index *index, size_t offset,
+        size_t size, UINT32 pcr_index, UINT32 type) {
+
+    if (size > UINT32_MAX) {
+        LOG_ERR("Event at offset %zu too large to index: %zu", offset, size);
+        return false;
+    }
+
+    if (index->count == index->capacity) {
+        size_t capacity = index->capacity ?
+                index->capacity * 2 : INDEX_ENTRIES_MIN;
+        tpm2_eventlog_index_entry *entries = realloc(index->entries,
+                capacity * sizeof(*entries));
+        if (!entries) {
+            LOG_ERR("oom");
+            return false;
+        }
+        index->entries = entries;
+        index->capacity = capacity;
+    }
+
+    tpm2_eventlog_index_entry *entry = &index->entries[index->count++];
+    entry->offset = offset;
+    entry->size = size;
+    entry->pcr_index = pcr_index;
+    entry->type = type;
+
+    index->log_offset = offset + size;
+
+    return true;
+}
+
+bool tpm2_eventlog_index_build(tpm2_eventlog_index *index,
+        BYTE const *eventlog, size_t size) {
+
+    if (index->log_offset > size) {
+        LOG_ERR("Event log is shorter than its index, got: %zu, "
+                "expected at least: %zu", size, index->log_offset);
+        return false;
+    }
+
+    if (!index->log_offset) {
+        if (size < sizeof(TCG_EVENT)) {
+            LOG_ERR("Event log too small to index: %zu", size);
+            return false;
+        }
+
+        TCG_EVENT const *event = (TCG_EVENT const *)eventlog;
+        index->is_sha1_log = event->eventType != EV_NO_ACTION;
+        if (!index->is_sha1_log) {
+            TCG_EVENT_HEADER2 *next;
+            bool ret = specid_event(event, size, &next);
+            if (!ret) {
+                return false;
+            }
+
+            ret = index_add(index, 0, (uintptr_t)next - (uintptr_t)eventlog,
+                    event->pcrIndex, event->eventType);
+            if (!ret) {
+                return false;
+            }
+        }
+    }
+
+    /* only the events appended since the index was built are walked */
+    while (index->log_offset < size) {
+        size_t offset = index->log_offset;
+        size_t event_size = 0;
+        UINT32 pcr_index;
+        UINT32 type;
+        bool ret;
+        if (index->is_sha1_log) {
+            TCG_EVENT const *event = (TCG_EVENT const *)(eventlog + offset);
+            ret = parse_sha1_log_event_size(event, size - offset, &event_size);
+            pcr_index = ret ? event->pcrIndex : 0;
+            type = ret ? event->eventType : 0;
+        } else {
+            TCG_EVENT_HEADER2 const *eventhdr =
+                    (TCG_EVENT_HEADER2 const *)(eventlog + offset);
+            size_t digests_size = 0;
+            ret = parse_event2(eventhdr, size - offset, &event_size,
+                    &digests_size);
+            pcr_index = ret ? eventhdr->PCRIndex : 0;
+            type = ret ? eventhdr->EventType : 0;
+        }
+
+        if (!ret) {
+            LOG_ERR("Could not index event %zu at offset %zu", index->count,
+                    offset);
+            return false;
+        }
+
+        ret = index_add(index, offset, event_size, pcr_index, type);
+        if (!ret) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+void tpm2_eventlog_index_free(tpm2_eventlog_index *index) {
+
+    free(index->entries);
+    memset(index, 0, sizeof(*index));
+}
+
+typedef struct {
+    BYTE const *eventlog;
+    tpm2_eventlog_index const *index;
+    tpm2_eventlog_filter const *filter;
+} eventlog_walk_index;
+
+static bool index_filter_matches(tpm2_eventlog_filter const *filter,
+        tpm2_eventlog_index_entry const *entry, size_t num) {
+
+    if (filter->is_event && filter->event != num) {
+        return false;
+    }
+
+    if (!filter->pcrs) {
+        return true;
+    }
+
+    return entry->pcr_index < TPM2_MAX_PCRS &&
+            (filter->pcrs & (UINT32_C(1) << entry->pcr_index));
+}
+
+static bool parse_eventlog_walk_index(tpm2_eventlog_context *ctx,
+        void *data) {
+
+    eventlog_walk_index *walk = (eventlog_walk_index *)data;
+    tpm2_eventlog_index const *index = walk->index;
+
+    size_t i;
+    for (i = 0; i < index->count; i++) {
+        tpm2_eventlog_index_entry const *entry = &index->entries[i];
+        if (!index_filter_matches(walk->filter, entry, i)) {
+            continue;
+        }
+
+        if (ctx->data) {
+            *(size_t *)ctx->data = i;
+        }
+
+        BYTE const *event = walk->eventlog + entry->offset;
+        bool ret;
+        if (index->is_sha1_log) {
+            ret = foreach_sha1_log_event(ctx, (TCG_EVENT const *)event,
+                    entry->size);
+        } else if (!i) {
+            /* the specid event, validated when indexing */
+            ret = !ctx->specid_cb ||
+                    ctx->specid_cb((TCG_EVENT const *)event, ctx->data);
+        } else {
+            ret = foreach_event2(ctx, (TCG_EVENT_HEADER2 const *)event,
+                    entry->size);
+        }
+
+        if (!ret) {
+            return false;
+        }
+    }
+
+    /* the events walked are not a replay position to resume from */
+    ctx->log_offset = 0;
+    ctx->last_event_size = 0;
+    ctx->event_count = 0;
+
+    return true;
+}
+
+bool parse_eventlog_index(tpm2_eventlog_context *ctx, BYTE const *eventlog,
+        size_t size, tpm2_eventlog_index const *index,
+        tpm2_eventlog_filter const *filter) {
+
+    if (!eventlog || index->log_offset > size) {
+        LOG_ERR("Event log does not match its index");
+        return false;
+    }
+
+    if (filter->is_event && filter->event >= index->count) {
+        LOG_ERR("Event %zu is not in the log of %zu events", filter->event,
+                index->count);
+        return false;
+    }
+
+    eventlog_walk_index walk = {
+        .eventlog = eventlog,
+        .index = index,
+        .filter = filter,
+    };
+
+    return parse_eventlog_deferred(ctx, parse_eventlog_walk_index, &walk);
+}
+
+#define CHECKPOINT_VERSION 1
+
+/* the kind of log of a checkpoint, a SHA1 log was saved as a boolean first */
+#define CHECKPOINT_LOG_AGILE 0
+#define CHECKPOINT_LOG_SHA1 1
+#define CHECKPOINT_LOG_IMA 2
+
+static bool event_digest(BYTE const *eventlog, size_t log_offset,
+        size_t event_size, TPM2B_DIGEST *digest) {
+
+    /* events larger than that are identified by their start */
+    size_t size = event_size > UINT16_MAX ? UINT16_MAX : event_size;
+
+    return tpm2_openssl_hash_compute_data(TPM2_ALG_SHA256,
+            (BYTE *)eventlog + log_offset - event_size, size, digest);
+}
+
+static bool last_event_digest(tpm2_eventlog_context const *ctx,
+        BYTE const *eventlog, TPM2B_DIGEST *digest) {
+
+    return event_digest(eventlog, ctx->log_offset, ctx->last_event_size,
+            digest);
+}
+
+/*
+ * The PCR banks in checkpoint order, each saved as the used mask followed by
+ * the accumulators of all PCRs.
+ */
+#define CHECKPOINT_BANKS(ctx) { \
+        { &(ctx)->sha1_used, (uint8_t *)(ctx)->sha1_pcrs, \
+          sizeof((ctx)->sha1_pcrs) }, \
+        { &(ctx)->sha256_used, (uint8_t *)(ctx)->sha256_pcrs, \
+          sizeof((ctx)->sha256_pcrs) }, \
+        { &(ctx)->sha384_used, (uint8_t *)(ctx)->sha384_pcrs, \
+          sizeof((ctx)->sha384_pcrs) }, \
+        { &(ctx)->sha512_used, (uint8_t *)(ctx)->sha512_pcrs, \
+          sizeof((ctx)->sha512_pcrs) }, \
+        { &(ctx)->sm3_256_used, (uint8_t *)(ctx)->sm3_256_pcrs, \
+          sizeof((ctx)->sm3_256_pcrs) }, \
+    }
+
+typedef struct {
+    uint32_t *used;
+    uint8_t *pcrs;
+    size_t size;
+} checkpoint_bank;
+
+bool tpm2_eventlog_checkpoint_save(tpm2_eventlog_context *ctx,
+        BYTE const *eventlog, const char *path) {
+
+    if (!ctx->log_offset || !ctx->last_event_size) {
+        LOG_ERR("Nothing replayed, not saving a checkpoint");
+        return false;
+    }
+
+    TPM2B_DIGEST digest = { .size = 0 };
+    bool result = last_event_digest(ctx, eventlog, &digest);
+    if (!result) {
+        LOG_ERR("Could not compute the digest of the last event");
+        return false;
+    }
+
+    /* a poll killed while saving leaves the previous checkpoint */
+    files_atomic atomic;
+    FILE *f = files_atomic_fopen(&atomic, path);
+    if (!f) {
+        LOG_ERR("Could not open checkpoint file \"%s\", error: %s", path,
+                strerror(errno));
+        return false;
+    }
+
+    uint32_t log_kind = ctx->is_ima_log ? CHECKPOINT_LOG_IMA :
+            ctx->is_sha1_log ? CHECKPOINT_LOG_SHA1 : CHECKPOINT_LOG_AGILE;
+
+    result = files_write_header(f, CHECKPOINT_VERSION)
+            && files_write_32(f, log_kind)
+            && files_write_64(f, ctx->log_offset)
+            && files_write_64(f, ctx->event_count)
+            && files_write_32(f, ctx->last_event_size)
+            && files_write_bytes(f, digest.buffer, digest.size);
+
+    checkpoint_bank banks[] = CHECKPOINT_BANKS(ctx);
+    size_t i;
+    for (i = 0; result && i < ARRAY_LEN(banks); i++) {
+        result = files_write_32(f, *banks[i].used)
+                && files_write_bytes(f, banks[i].pcrs, banks[i].size);
+    }
+
+    result = files_atomic_close(&atomic, f, result);
+    if (!result) {
+        LOG_ERR("Could not write checkpoint file \"%s\"", path);
+    }
+
+    return result;
+}
+
+bool tpm2_eventlog_checkpoint_load(tpm2_eventlog_context *ctx,
+        const char *path) {
+
+    FILE *f = files_fopen(path, "rb");
+    if (!f) {
+        LOG_ERR("Could not open checkpoint file \"%s\", error: %s", path,
+                strerror(errno));
+        return false;
+    }
+
+    uint32_t version = 0;
+    uint32_t log_kind = 0;
+    uint64_t log_offset = 0;
+    uint64_t event_count = 0;
+    uint32_t last_event_size = 0;
+
+    bool result = files_read_header(f, &version);
+    if (!result || version != CHECKPOINT_VERSION) {
+        LOG_ERR("Unsupported checkpoint file \"%s\"", path);
+        fclose(f);
+        return false;
+    }
+
+    result = files_read_32(f, &log_kind)
+            && files_read_64(f, &log_offset)
+            && files_read_64(f, &event_count)
+            && files_read_32(f, &last_event_size)
+            && files_read_bytes(f, ctx->last_event_digest,
+                    sizeof(ctx->last_event_digest));
+
+    checkpoint_bank banks[] = CHECKPOINT_BANKS(ctx);
+    size_t i;
+    for (i = 0; result && i < ARRAY_LEN(banks); i++) {
+        result = files_read_32(f, banks[i].used)
+                && files_read_bytes(f, banks[i].pcrs, banks[i].size);
+    }
+
+    fclose(f);
+
+    if (!result || !last_event_size || last_event_size > log_offset
+            || log_kind > CHECKPOINT_LOG_IMA) {
+        LOG_ERR("Malformed checkpoint file \"%s\"", path);
+        tpm2_eventlog_checkpoint_reset(ctx);
+        return false;
+    }
+
+    ctx->is_sha1_log = log_kind == CHECKPOINT_LOG_SHA1;
+    ctx->is_ima_log = log_kind == CHECKPOINT_LOG_IMA;
+    ctx->log_offset = log_offset;
+    ctx->event_count = event_count;
+    ctx->last_event_size = last_event_size;
+
+    return true;
+}
+
+bool tpm2_eventlog_checkpoint_matches(tpm2_eventlog_context const *ctx,
+        BYTE const *eventlog, size_t size) {
+
+    if (!ctx->log_offset || ctx->log_offset > size) {
+        return false;
+    }
+
+    /* the last replayed event identifies the log, logs only ever grow */
+    TPM2B_DIGEST digest = { .size = 0 };
+    bool result = last_event_digest(ctx, eventlog, &digest);
+    if (!result) {
+        return false;
+    }
+
+    return digest.size == sizeof(ctx->last_event_digest) &&
+        !memcmp(digest.buffer, ctx->last_event_digest, digest.size);
+}
+
+void tpm2_eventlog_checkpoint_reset(tpm2_eventlog_context *ctx) {
+
+    checkpoint_bank banks[] = CHECKPOINT_BANKS(ctx);
+    size_t i;
+    for (i = 0; i < ARRAY_LEN(banks); i++) {
+        *banks[i].used = 0;
+        memset(banks[i].pcrs, 0, banks[i].size);
+    }
+
+    ctx->is_sha1_log = false;
+    ctx->is_ima_log = false;
+    ctx->log_offset = 0;
+    ctx->event_count = 0;
+    ctx->last_event_size = 0;
+    memset(ctx->last_event_digest, 0, sizeof(ctx->last_event_digest));
+}
+
+#define INDEX_VERSION 1
+
+/* the offset, size, PCR index and type of an event */
+#define INDEX_ENTRY_SIZE (sizeof(uint64_t) + 3 * sizeof(uint32_t))
+
+static bool index_last_event_digest(tpm2_eventlog_index const *index,
+        BYTE const *eventlog, TPM2B_DIGEST *digest) {
+
+    return event_digest(eventlog, index->log_offset,
+            index->entries[index->count - 1].size, digest);
+}
+
+bool tpm2_eventlog_index_save(tpm2_eventlog_index const *index,
+        BYTE const *eventlog, const char *path) {
+
+    if (!index->count) {
+        LOG_ERR("Nothing indexed, not saving an index");
+        return false;
+    }
+
+    TPM2B_DIGEST digest = { .size = 0 };
+    bool result = index_last_event_digest(index, eventlog, &digest);
+    if (!result) {
+        LOG_ERR("Could not compute the digest of the last event");
+        return false;
+    }
+
+    files_atomic atomic;
+    FILE *f = files_atomic_fopen(&atomic, path);
+    if (!f) {
+        LOG_ERR("Could not open index file \"%s\", error: %s", path,
+                strerror(errno));
+        return false;
+    }
+
+    result = files_write_header(f, INDEX_VERSION)
+            && files_write_32(f, index->is_sha1_log)
+            && files_write_64(f, index->count)
+            && files_write_bytes(f, digest.buffer, digest.size);
+
+    size_t i;
+    for (i = 0; result && i < index->count; i++) {
+        tpm2_eventlog_index_entry const *entry = &index->entries[i];
+        result = files_write_64(f, entry->offset)
+                && files_write_32(f, entry->size)
+                && files_write_32(f, entry->pcr_index)
+                && files_write_32(f, entry->type);
+    }
+
+    result = files_atomic_close(&atomic, f, result);
+    if (!result) {
+        LOG_ERR("Could not write index file \"%s\"", path);
+    }
+
+    return result;
+}
+
+bool tpm2_eventlog_index_load(tpm2_eventlog_index *index, const char *path) {
+
+    FILE *f = files_fopen(path, "rb");
+    if (!f) {
+        LOG_ERR("Could not open index file \"%s\", error: %s", path,
+                strerror(errno));
+        return false;
+    }
+
+    uint32_t version = 0;
+    uint32_t is_sha1_log = 0;
+    uint64_t count = 0;
+
+    bool result = files_read_header(f, &version);
+    if (!result || version != INDEX_VERSION) {
+        LOG_ERR("Unsupported index file \"%s\"", path);
+        fclose(f);
+        return false;
+    }
+
+    tpm2_eventlog_index_free(index);
+
+    result = files_read_32(f, &is_sha1_log)
+            && files_read_64(f, &count)
+            && files_read_bytes(f, index->last_event_digest,
+                    sizeof(index->last_event_digest));
+
+    index->is_sha1_log = !!is_sha1_log;
+
+    /* a count the file cannot hold is malformed, not allocated */
+    unsigned long file_size = 0;
+    result = result && files_get_file_size(f, &file_size, path)
+            && count <= file_size / INDEX_ENTRY_SIZE;
+
+    if (result && count && count <= SIZE_MAX / sizeof(*index->entries)) {
+        index->entries = malloc(count * sizeof(*index->entries));
+        index->capacity = index->entries ? count : 0;
+    }
+    result = result && count && index->capacity == count;
+
+    uint64_t log_offset = 0;
+    size_t i;
+    for (i = 0; result && i < count; i++) {
+        tpm2_eventlog_index_entry *entry = &index->entries[i];
+        uint64_t offset = 0;
+        result = files_read_64(f, &offset)
+                && files_read_32(f, &entry->size)
+                && files_read_32(f, &entry->pcr_index)
+                && files_read_32(f, &entry->type)
+                /* the events follow each other */
+                && offset == log_offset && entry->size;
+        entry->offset = offset;
+        log_offset = offset + entry->size;
+    }
+
+    fclose(f);
+
+    if (!result) {
+        LOG_ERR("Malformed index file \"%s\"", path);
+        tpm2_eventlog_index_free(index);
+        return false;
+    }
+
+    index->count = count;
+    index->log_offset = log_offset;
+
+    return true;
+}
+
+bool tpm2_eventlog_index_matches(tpm2_eventlog_index const *index,
+        BYTE const *eventlog, size_t size) {
+
+    if (!index->count || index->log_offset > size) {
+        return false;
+    }
+
+    /* the last indexed event identifies the log, logs only ever grow */
+    TPM2B_DIGEST digest = { .size = 0 };
+    bool result = index_last_event_digest(index, eventlog, &digest);
+    if (!result) {
+        return false;
+    }
+
+    return digest.size == sizeof(index->last_event_digest) &&
+        !memcmp(digest.buffer, index->last_event_digest, digest.size);
+}
+
+bool tpm2_eventlog_replayed_pcrs(tpm2_eventlog_context const *ctx,
+        TPML_PCR_SELECTION *pcr_select, tpm2_pcrs *pcrs) {
+
+    struct {
+        TPMI_ALG_HASH alg;
+        uint32_t used;
+        uint8_t const *pcrs;
+        size_t size;
+    } banks[] = {
+        { TPM2_ALG_SHA1, ctx->sha1_used, (uint8_t const *)ctx->sha1_pcrs,
+          sizeof(ctx->sha1_pcrs[0]) },
+        { TPM2_ALG_SHA256, ctx->sha256_used,
+          (uint8_t const *)ctx->sha256_pcrs, sizeof(ctx->sha256_pcrs[0]) },
+        { TPM2_ALG_SHA384, ctx->sha384_used,
+          (uint8_t const *)ctx->sha384_pcrs, sizeof(ctx->sha384_pcrs[0]) },
+        { TPM2_ALG_SHA512, ctx->sha512_used,
+          (uint8_t const *)ctx->sha512_pcrs, sizeof(ctx->sha512_pcrs[0]) },
+        { TPM2_ALG_SM3_256, ctx->sm3_256_used,
+          (uint8_t const *)ctx->sm3_256_pcrs, sizeof(ctx->sm3_256_pcrs[0]) },
+    };
+
+    memset(pcr_select, 0, sizeof(*pcr_select));
+
+    /* the values of all banks follow each other, as TPM2_PCR_Read returns */
+    TPML_DIGEST *values = NULL;
+    size_t i;
+    for (i = 0; i < ARRAY_LEN(banks); i++) {
+        if (!banks[i].used) {
+            continue;
+        }
+
+        TPMS_PCR_SELECTION *selection =
+                &pcr_select->pcrSelections[pcr_select->count++];
+        selection->hash = banks[i].alg;
+        selection->sizeofSelect = banks[i].used >> 24 ? 4 : 3;
+
+        unsigned pcr;
+        for (pcr = 0; pcr < TPM2_MAX_PCRS; pcr++) {
+            if (!(banks[i].used & (UINT32_C(1) << pcr))) {
+                continue;
+            }
+            selection->pcrSelect[pcr / 8] |= 1 << (pcr % 8);
+
+            if (!values || values->count == ARRAY_LEN(values->digests)) {
+                values = pcr_pcrs_append(pcrs);
+                if (!values) {
+                    return false;
+                }
+            }
+
+            TPM2B_DIGEST *digest = &values->digests[values->count++];
+            digest->size = banks[i].size;
+            memcpy(digest->buffer, banks[i].pcrs + pcr * banks[i].size,
+                    banks[i].size);
+        }
+    }
+
+    return true;
+}
+
+/* the replay state a worker reuses for all the logs it replays */
+typedef struct {
+    tpm2_eventlog_context *ctx;
+    tpm2_eventlog_scratch *scratch;
+} batch_worker;
+
+typedef struct {
+    tpm2_eventlog_batch_job *jobs;
+    tpm2_eventlog_reference const *reference;
+    tpm2_eventlog_plan const *plan;
+    /* set up by the first job of each worker */
+    batch_worker *workers;
+} eventlog_batch;
+
+static void batch_job_run(tpm2_eventlog_context *ctx,
+        tpm2_eventlog_batch_job *job) {
+
+    job->result = false;
+
+    files_input input;
+    if (!files_input_open(&input, job->path)) {
+        return;
+    }
+
+    tpm2_eventlog_context_reset(ctx);
+
+    const UINT8 *eventlog;
+    size_t size;
+    bool ret = files_input_read_all(&input, &eventlog, &size)
+            && parse_eventlog(ctx, eventlog, size);
+    if (!ret) {
+        LOG_ERR("Could not replay event log \"%s\"", job->path);
+        goto out;
+    }
+
+    job->unknown_digests = ctx->unknown_digests;
+    job->result = tpm2_eventlog_replayed_pcrs(ctx, &job->pcr_select,
+            &job->pcrs);
+
+out:
+    files_input_close(&input);
+}
+
+static bool batch_work(tpm2_work_worker *worker, size_t index,
+        void *userdata) {
+
+    eventlog_batch *batch = (eventlog_batch *)userdata;
+    batch_worker *w = &batch->workers[tpm2_work_worker_index(worker)];
+    tpm2_eventlog_batch_job *job = &batch->jobs[index];
+
+    if (!w->ctx) {
+        /* the context is on the heap, for the PCR banks of it */
+        w->ctx = calloc(1, sizeof(*w->ctx));
+        w->scratch = tpm2_eventlog_scratch_new();
+        if (w->ctx) {
+            w->ctx->skip_body = true;
+            w->ctx->reference = batch->reference;
+            w->ctx->plan = batch->plan;
+            w->ctx->scratch = w->scratch;
+        }
+    }
+
+    if (!w->ctx || !w->scratch) {
+        job->result = false;
+        return false;
+    }
+
+    batch_job_run(w->ctx, job);
+
+    return job->result;
+}
+
+/* the results are in the jobs, every log is replayed */
+static bool batch_deliver(size_t index, bool result, void *userdata) {
+
+    UNUSED(index);
+    UNUSED(result);
+    UNUSED(userdata);
+
+    return true;
+}
+
+bool tpm2_eventlog_batch(tpm2_eventlog_batch_job *jobs, size_t count,
+        tpm2_eventlog_reference const *reference,
+        tpm2_eventlog_plan const *plan, unsigned threads) {
+
+    if (!count) {
+        return true;
+    }
+
+    UINT32 workers = tpm2_work_pool_workers(threads, count);
+
+    batch_worker *batch_workers = calloc(workers, sizeof(*batch_workers));
+    if (!batch_workers) {
+        LOG_ERR("oom");
+        return false;
+    }
+
+    eventlog_batch batch = {
+        .jobs = jobs,
+        .reference = reference,
+        .plan = plan,
+        .workers = batch_workers,
+    };
+
+    bool result = tpm2_work_pool_run(count, threads, batch_work,
+            batch_deliver, &batch);
+
+    UINT32 i;
+    for (i = 0; i < workers; i++) {
+        tpm2_eventlog_scratch_free(batch.workers[i].scratch);
+        free(batch.workers[i].ctx);
+    }
+    free(batch.workers);
+
+    if (!result) {
+        return false;
+    }
+
+    size_t j;
+    for (j = 0; j < count; j++) {
+        result &= jobs[j].result;
+    }
+
+    return result;
+}
+
+static int reference_digest_cmp(const void *a, const void *b) {
+
+    tpm2_eventlog_reference_digest const *x = a;
+    tpm2_eventlog_reference_digest const *y = b;
+
+    if (x->size != y->size) {
+        return x->size < y->size ? -1 : 1;
+    }
+
+    return memcmp(x->digest, y->digest, x->size);
+}
+
+static tpm2_eventlog_reference_digest *reference_append(
+        tpm2_eventlog_reference *ref) {
+
+    if (ref->count == ref->capacity) {
+        size_t capacity = ref->capacity ? ref->capacity * 2 : 64;
+        tpm2_eventlog_reference_digest *digests = realloc(ref->digests,
+                capacity * sizeof(*digests));
+        if (!digests) {
+            LOG_ERR("oom");
+            return NULL;
+        }
+        ref->digests = digests;
+        ref->capacity = capacity;
+    }
+
+    return &ref->digests[ref->count++];
+}
+
+bool tpm2_eventlog_reference_parse(tpm2_eventlog_reference *ref,
+        char const *text, size_t size) {
+
+    bool is_sorted = true;
+    size_t line_number = 0;
+    char const *end = text + size;
+    while (text < end) {
+        char const *eol = memchr(text, '\n', end - text);
+        char const *next = eol ? eol + 1 : end;
+        char const *comment = memchr(text, '#', (eol ? eol : end) - text);
+        char const *last = comment ? comment : eol ? eol : end;
+        line_number++;
+
+        while (text < last && strchr(" \t\r", *text)) {
+            text++;
+        }
+        while (last > text && strchr(" \t\r", last[-1])) {
+            last--;
+        }
+
+        size_t len = last - text;
+        if (!len) {
+            text = next;
+            continue;
+        }
+
+        tpm2_eventlog_reference_digest *entry = reference_append(ref);
+        if (!entry) {
+            return false;
+        }
+
+        if (len % 2 || len / 2 > sizeof(entry->digest)
+                || !tpm2_hex_decode(text, len, entry->digest)) {
+            LOG_ERR("Invalid reference digest on line %zu", line_number);
+            ref->count--;
+            return false;
+        }
+        entry->size = len / 2;
+
+        if (ref->count > 1 && reference_digest_cmp(entry - 1, entry) > 0) {
+            is_sorted = false;
+        }
+
+        text = next;
+    }
+
+    if (!is_sorted) {
+        qsort(ref->digests, ref->count, sizeof(*ref->digests),
+                reference_digest_cmp);
+    }
+
+    return true;
+}
+
+bool tpm2_eventlog_reference_load(tpm2_eventlog_reference *ref,
+        const char *path) {
+
+    files_input input;
+    if (!files_input_open(&input, path)) {
+        return false;
+    }
+
+    const UINT8 *text;
+    size_t size;
+    bool result = files_input_read_all(&input, &text, &size)
+            && tpm2_eventlog_reference_parse(ref, (char const *)text, size);
+    files_input_close(&input);
+
+    if (!result) {
+        LOG_ERR("Could not load reference database \"%s\"", path);
+    }
+
+    return result;
+}
+
+bool tpm2_eventlog_reference_contains(tpm2_eventlog_reference const *ref,
+        BYTE const *digest, size_t size) {
+
+    if (size > sizeof(ref->digests->digest)) {
+        return false;
+    }
+
+    tpm2_eventlog_reference_digest key = { .size = size };
+    memcpy(key.digest, digest, size);
+
+    return ref->count && bsearch(&key, ref->digests, ref->count,
+            sizeof(*ref->digests), reference_digest_cmp);
+}
+
+void tpm2_eventlog_reference_free(tpm2_eventlog_reference *ref) {
+
+    free(ref->digests);
+    memset(ref, 0, sizeof(*ref));
+}
+
+#define SPECID_SIGNATURE "Spec ID Event03"
+
+/* the fields of event logs are little endian */
+static BYTE *eventlog_put(BYTE *p, uint32_t value, size_t size) {
+
+    size_t i;
+    for (i = 0; i < size; i++) {
+        *p++ = (BYTE)(value >> (8 * i));
+    }
+
+    return p;
+}
+
+bool tpm2_eventlog_write_specid(FILE *f, TPMI_ALG_HASH const *algs,
+        UINT32 count) {
+
+    if (!count || count > TPM2_NUM_PCR_BANKS) {
+        LOG_ERR("Invalid number of SpecID algorithms, got: %" PRIu32, count);
+        return false;
+    }
+
+    BYTE buf[sizeof(TCG_EVENT) + sizeof(TCG_SPECID_EVENT) +
+             TPM2_NUM_PCR_BANKS * sizeof(TCG_SPECID_ALG) +
+             sizeof(TCG_VENDOR_INFO)] = { 0 };
+
+    UINT32 event_size = sizeof(TCG_SPECID_EVENT) +
+            count * sizeof(TCG_SPECID_ALG) + sizeof(TCG_VENDOR_INFO);
+
+    /* an EV_NO_ACTION of PCR 0 with a zero SHA1 digest */
+    BYTE *p = eventlog_put(buf, 0, sizeof(UINT32));
+    p = eventlog_put(p, EV_NO_ACTION, sizeof(UINT32));
+    p += sizeof(((TCG_EVENT *)NULL)->digest);
+    p = eventlog_put(p, event_size, sizeof(UINT32));
+
+    memcpy(p, SPECID_SIGNATURE, sizeof(SPECID_SIGNATURE));
+    p += sizeof(((TCG_SPECID_EVENT *)NULL)->Signature);
+    /* client platform class, spec 2.0 errata 0, UINTN of 64 bits */
+    p = eventlog_put(p, 0, sizeof(UINT32));
+    *p++ = 0;
+    *p++ = 2;
+    *p++ = 0;
+    *p++ = 2;
+    p = eventlog_put(p, count, sizeof(UINT32));
+
+    UINT32 i;
+    for (i = 0; i < count; i++) {
+        UINT16 size = tpm2_alg_util_get_hash_size(algs[i]);
+        if (!size) {
+            LOG_ERR("Not a hash algorithm, got: 0x%x", algs[i]);
+            return false;
+        }
+        p = eventlog_put(p, algs[i], sizeof(UINT16));
+        p = eventlog_put(p, size, sizeof(UINT16));
+    }
+
+    /* no vendor info */
+    *p++ = 0;
+
+    if (fwrite(buf, p - buf, 1, f) != 1) {
+        LOG_ERR("Could not write the SpecID event");
+        return false;
+    }
+
+    return true;
+}
+
+bool tpm2_eventlog_write_event2(FILE *f, UINT32 pcr_index, UINT32 type,
+        TPML_DIGEST_VALUES const *digests, BYTE const *data, UINT32 size) {
+
+    BYTE buf[sizeof(TCG_EVENT_HEADER2) +
+             ARRAY_LEN(digests->digests) * sizeof(TPMT_HA) +
+             sizeof(TCG_EVENT2)];
+
+    if (digests->count > ARRAY_LEN(digests->digests)) {
+        LOG_ERR("Too many digests, got: %" PRIu32, digests->count);
+        return false;
+    }
+
+    BYTE *p = eventlog_put(buf, pcr_index, sizeof(UINT32));
+    p = eventlog_put(p, type, sizeof(UINT32));
+    p = eventlog_put(p, digests->count, sizeof(UINT32));
+
+    UINT32 i;
+    for (i = 0; i < digests->count; i++) {
+        TPMT_HA const *digest = &digests->digests[i];
+        UINT16 digest_size = tpm2_alg_util_get_hash_size(digest->hashAlg);
+        if (!digest_size) {
+            LOG_ERR("Not a hash algorithm, got: 0x%x", digest->hashAlg);
+            return false;
+        }
+        p = eventlog_put(p, digest->hashAlg, sizeof(UINT16));
+        memcpy(p, &digest->digest, digest_size);
+        p += digest_size;
+    }
+
+    p = eventlog_put(p, size, sizeof(UINT32));
+
+    if (fwrite(buf, p - buf, 1, f) != 1 ||
+        (size && fwrite(data, size, 1, f) != 1)) {
+        LOG_ERR("Could not write the event of PCR %" PRIu32, pcr_index);
+        return false;
+    }
+
+    return true;
+}
+
+bool tpm2_eventlog_read_specid(FILE *f, TPMI_ALG_HASH *algs, UINT32 *count) {
+
+    TCG_EVENT hdr;
+    if (fread(&hdr, sizeof(hdr), 1, f) != 1) {
+        LOG_ERR("Could not read the SpecID event");
+        return false;
+    }
+
+    /* the algorithms of all banks, and vendor info up to its maximum */
+    BYTE buf[sizeof(TCG_EVENT) + sizeof(TCG_SPECID_EVENT) +
+             TPM2_NUM_PCR_BANKS * sizeof(TCG_SPECID_ALG) +
+             sizeof(TCG_VENDOR_INFO) + UINT8_MAX];
+    if (hdr.eventDataSize > sizeof(buf) - sizeof(hdr)) {
+        LOG_ERR("SpecID event is too large, got: %" PRIu32,
+                hdr.eventDataSize);
+        return false;
+    }
+
+    memcpy(buf, &hdr, sizeof(hdr));
+    if (hdr.eventDataSize &&
+        fread(buf + sizeof(hdr), hdr.eventDataSize, 1, f) != 1) {
+        LOG_ERR("Could not read the SpecID event");
+        return false;
+    }
+
+    TCG_EVENT_HEADER2 *next;
+    TCG_EVENT const *event = (TCG_EVENT const *)buf;
+    if (!specid_event(event, sizeof(hdr) + hdr.eventDataSize, &next)) {
+        return false;
+    }
+
+    TCG_SPECID_EVENT const *specid = (TCG_SPECID_EVENT const *)event->event;
+    if (specid->numberOfAlgorithms > TPM2_NUM_PCR_BANKS) {
+        LOG_ERR("Too many SpecID algorithms, got: %" PRIu32,
+                specid->numberOfAlgorithms);
+        return false;
+    }
+
+    UINT32 i;
+    for (i = 0; i < specid->numberOfAlgorithms; i++) {
+        algs[i] = specid->digestSizes[i].algorithmId;
+    }
+    *count = specid->numberOfAlgorithms;
+
+    return true;
+}
@@ -3,11 +3,13 @@
 #define TPM2_EVENTLOG_H
 
 #include <stdbool.h>
+#include <stdio.h>
 #include <stdlib.h>
 
 #include <tss2/tss2_tpm2_types.h>
 
 #include "efi_event.h"
+#include "pcr.h"
 
 typedef bool (*DIGEST2_CALLBACK)(TCG_DIGEST2 const *digest, size_t size,
                                  void *data);
@@ -18,7 +20,39 @@ typedef bool (*EVENT2DATA_CALLBACK)(TCG_EVENT2 const *event, UINT32 type,
 typedef bool (*SPECID_CALLBACK)(TCG_EVENT const *event, void *data);
 typedef bool (*LOG_EVENT_CALLBACK)(TCG_EVENT const *event_hdr, size_t size,
                                    void *data);
+typedef bool (*UNKNOWN_DIGEST_CALLBACK)(size_t eventnum, unsigned pcr_index,
+                                        TPMI_ALG_HASH alg, BYTE const *digest,
+                                        size_t size, void *data);
 
+/*
+ * An entry of the Linux IMA runtime measurement list. The names point into
+ * the list and are not nul terminated.
+ */
+typedef struct {
+    UINT32 pcr_index;
+    /* the digest of the template data, extended into the PCR */
+    TPMI_ALG_HASH template_alg;
+    TPM2B_DIGEST template_digest;
+    char const *template_name;
+    size_t template_name_size;
+    /* the measurement of the file, alg TPM2_ALG_NULL when the template has none */
+    TPMI_ALG_HASH file_alg;
+    TPM2B_DIGEST file_digest;
+    char const *file_name;
+    size_t file_name_size;
+    /* a measurement IMA could not take, which extends the PCR with ones */
+    bool is_violation;
+} tpm2_eventlog_ima_event;
+
+typedef bool (*IMA_EVENT_CALLBACK)(size_t eventnum,
+                                   tpm2_eventlog_ima_event const *event,
+                                   void *data);
+
+typedef struct tpm2_eventlog_replay tpm2_eventlog_replay;
+typedef struct tpm2_eventlog_verify tpm2_eventlog_verify;
+typedef struct tpm2_eventlog_reference tpm2_eventlog_reference;
+typedef struct tpm2_eventlog_scratch tpm2_eventlog_scratch;
+typedef struct tpm2_eventlog_plan tpm2_eventlog_plan;
 
 typedef struct {
     void *data;
@@ -38,18 +72,270 @@ typedef struct {
     uint8_t sha512_pcrs[TPM2_MAX_PCRS][TPM2_SHA512_DIGEST_SIZE];
     uint8_t sm3_256_pcrs[TPM2_MAX_PCRS][TPM2_SM3_256_DIGEST_SIZE];
     uint32_t eventlog_version;
+    /* replay position, saved and restored with checkpoints */
+    size_t log_offset;
+    size_t event_count;
+    size_t last_event_size;
+    uint8_t last_event_digest[TPM2_SHA256_DIGEST_SIZE];
+    bool is_sha1_log;
+    /* set by parse_eventlog() to defer the PCR extends to a replay per bank */
+    tpm2_eventlog_replay *replay;
+    /* walk the digests without extending the PCRs, ie to size an event */
+    bool skip_extend;
+    /* set by parse_eventlog() to defer the payload verification of events */
+    tpm2_eventlog_verify *verify;
+    /* events whose digests do not match their payload, when data is set */
+    size_t verify_failures;
+    /* only validate the event structure and replay, skip the event bodies */
+    bool skip_body;
+    /* the digests of measured events missing from reference, when set */
+    tpm2_eventlog_reference const *reference;
+    UNKNOWN_DIGEST_CALLBACK unknown_digest_cb;
+    size_t unknown_digests;
+    /* set by parse_ima_log(), to tell the checkpoints of IMA lists apart */
+    bool is_ima_log;
+    IMA_EVENT_CALLBACK ima_event_cb;
+    /*
+     * the queues of the deferred extends and verifications, kept from one
+     * parse to the next when set, which replays and verifies on the calling
+     * thread only, ie a worker parsing many logs
+     */
+    tpm2_eventlog_scratch *scratch;
+    /* the planned measurements the replay predicts the PCRs with, when set */
+    tpm2_eventlog_plan const *plan;
+    /* the replacements of the plan that matched an event */
+    uint64_t plan_replaced;
 } tpm2_eventlog_context;
 
 bool digest2_accumulator_callback(TCG_DIGEST2 const *digest, size_t size,
                                   void *data);
 
 bool parse_event2body(TCG_EVENT2 const *event, UINT32 type);
+bool verify_digests(size_t eventnum, TCG_EVENT_HEADER2 const *eventhdr,
+                    TCG_EVENT2 *event);
 bool foreach_digest2(tpm2_eventlog_context *ctx, unsigned pcr_index,
                      TCG_DIGEST2 const *event_hdr, size_t count, size_t size);
 bool parse_event2(TCG_EVENT_HEADER2 const *eventhdr, size_t buf_size,
                   size_t *event_size, size_t *digests_size);
 bool foreach_event2(tpm2_eventlog_context *ctx, TCG_EVENT_HEADER2 const *eventhdr_start, size_t size);
 bool specid_event(TCG_EVENT const *event, size_t size, TCG_EVENT_HEADER2 **next);
+/*
+ * The PCR extends of all events are queued per bank while parsing and the
+ * banks are replayed in parallel once the whole log has been parsed, so the
+ * PCR values in ctx are only valid after parse_eventlog() returned. The
+ * payloads of the events are verified the same way, on a work pool once the
+ * whole log has been walked.
+ *
+ * When ctx->log_offset is set, ie by tpm2_eventlog_checkpoint_load(), parsing
+ * resumes at that offset and only the events appended since are replayed.
+ */
 bool parse_eventlog(tpm2_eventlog_context *ctx, BYTE const *eventlog, size_t size);
 
+/*
+ * The scratch of a context parsing many logs, one per thread, released with
+ * tpm2_eventlog_scratch_free().
+ */
+tpm2_eventlog_scratch *tpm2_eventlog_scratch_new(void);
+void tpm2_eventlog_scratch_free(tpm2_eventlog_scratch *scratch);
+
+/*
+ * Clears the replayed PCRs, the replay position and the counters of ctx for
+ * the next log, keeping its callbacks, options, reference and scratch.
+ */
+void tpm2_eventlog_context_reset(tpm2_eventlog_context *ctx);
+
+/*
+ * Checkpoints save the replay position and the PCR accumulators of a context
+ * so a growing log can be replayed incrementally.
+ */
+bool tpm2_eventlog_checkpoint_save(tpm2_eventlog_context *ctx,
+        BYTE const *eventlog, const char *path);
+bool tpm2_eventlog_checkpoint_load(tpm2_eventlog_context *ctx,
+        const char *path);
+bool tpm2_eventlog_checkpoint_matches(tpm2_eventlog_context const *ctx,
+        BYTE const *eventlog, size_t size);
+void tpm2_eventlog_checkpoint_reset(tpm2_eventlog_context *ctx);
+
+/*
+ * An index records where each event of a log starts, so the events of some
+ * PCRs or a single event are parsed without walking the whole log. Entry N is
+ * event N, the SpecID event being event 0 of a crypto agile log.
+ */
+typedef struct {
+    uint64_t offset;
+    uint32_t size;
+    uint32_t pcr_index;
+    uint32_t type;
+} tpm2_eventlog_index_entry;
+
+typedef struct {
+    tpm2_eventlog_index_entry *entries;
+    size_t count;
+    size_t capacity;
+    bool is_sha1_log;
+    /* end of the last indexed event, where building the index resumes */
+    size_t log_offset;
+    uint8_t last_event_digest[TPM2_SHA256_DIGEST_SIZE];
+} tpm2_eventlog_index;
+
+typedef struct {
+    /* mask of the PCRs to parse the events of, 0 for all of them */
+    uint32_t pcrs;
+    /* parse only event number event */
+    bool is_event;
+    size_t event;
+} tpm2_eventlog_filter;
+
+/*
+ * Walks the structure of the events only, without hashing or callbacks. An
+ * index built or loaded before is extended with the events appended since.
+ */
+bool tpm2_eventlog_index_build(tpm2_eventlog_index *index,
+        BYTE const *eventlog, size_t size);
+void tpm2_eventlog_index_free(tpm2_eventlog_index *index);
+bool tpm2_eventlog_index_save(tpm2_eventlog_index const *index,
+        BYTE const *eventlog, const char *path);
+bool tpm2_eventlog_index_load(tpm2_eventlog_index *index, const char *path);
+bool tpm2_eventlog_index_matches(tpm2_eventlog_index const *index,
+        BYTE const *eventlog, size_t size);
+
+/*
+ * Like parse_eventlog(), but parses only the indexed events matching filter.
+ * When ctx->data is set it is the event counter of the callbacks, which is
+ * set to the number of each event before it is parsed. The PCR values are
+ * those of the PCRs selected. A filtered parse is no replay position, so no
+ * checkpoint can be saved from it.
+ */
+bool parse_eventlog_index(tpm2_eventlog_context *ctx, BYTE const *eventlog,
+        size_t size, tpm2_eventlog_index const *index,
+        tpm2_eventlog_filter const *filter);
+
+/*
+ * The replayed PCR values of ctx as a selection of the PCRs extended by the
+ * log and their values, ie for pcr_print_pcr_struct(). pcrs is released with
+ * pcr_pcrs_free().
+ */
+bool tpm2_eventlog_replayed_pcrs(tpm2_eventlog_context const *ctx,
+        TPML_PCR_SELECTION *pcr_select, tpm2_pcrs *pcrs);
+
+/*
+ * A log of a batch, replayed from its file like a replay only, ie of the
+ * many machines a verifier appraises.
+ */
+typedef struct {
+    const char *path;
+    /* the replayed PCRs, pcrs is released with pcr_pcrs_free() */
+    TPML_PCR_SELECTION pcr_select;
+    tpm2_pcrs pcrs;
+    /* the digests missing from the reference database, when given */
+    size_t unknown_digests;
+    /* true if the log was read and replayed */
+    bool result;
+} tpm2_eventlog_batch_job;
+
+/*
+ * Replays many logs on a work pool, each worker with a context and a scratch
+ * of its own that are reused from one log to the next. The logs are
+ * appraised against reference when set. threads is the number of workers,
+ * 0 for one per online processor. Returns true if every log was replayed.
+ */
+bool tpm2_eventlog_batch(tpm2_eventlog_batch_job *jobs, size_t count,
+        tpm2_eventlog_reference const *reference,
+        tpm2_eventlog_plan const *plan, unsigned threads);
+
+/*
+ * A reference database of known good event digests, ie the allowlists of
+ * firmware and OS vendors, a hex digest per line. The digests are kept sorted
+ * by size, then value, so the event walk looks up every digest it meets with
+ * a binary search. The digests are matched whatever the bank of the event, as
+ * their size tells the bank apart, and EV_NO_ACTION events are not appraised,
+ * being measured nowhere.
+ */
+typedef struct {
+    uint16_t size;
+    BYTE digest[sizeof(TPMU_HA)];
+} tpm2_eventlog_reference_digest;
+
+struct tpm2_eventlog_reference {
+    tpm2_eventlog_reference_digest *digests;
+    size_t count;
+    size_t capacity;
+};
+
+/*
+ * Adds the digests of text, skipping empty lines and everything after a '#'.
+ * A text that is sorted already is not sorted again.
+ */
+bool tpm2_eventlog_reference_parse(tpm2_eventlog_reference *ref,
+        char const *text, size_t size);
+bool tpm2_eventlog_reference_load(tpm2_eventlog_reference *ref,
+        const char *path);
+bool tpm2_eventlog_reference_contains(tpm2_eventlog_reference const *ref,
+        BYTE const *digest, size_t size);
+void tpm2_eventlog_reference_free(tpm2_eventlog_reference *ref);
+
+/*
+ * Replays the Linux IMA runtime measurement list, the ascii or the binary
+ * runtime_measurements of securityfs, which is told from the first byte of
+ * the list. The template digests of the entries, of algorithm alg, are
+ * extended into the bank of alg as they are parsed, TPM2_ALG_NULL being SHA1
+ * for a binary list, the default of the kernel, and the algorithm of the
+ * size of the first template digest for an ascii one, on one digest context
+ * and without allocating, as the list has as many entries as files were
+ * measured since boot. The binary list is in the canonical, little endian,
+ * format.
+ *
+ * The file digests of the ima, ima-ng and ima-sig style templates are
+ * appraised against ctx->reference when set, violations being left out, and
+ * every entry is passed to ctx->ima_event_cb when set. Like for
+ * parse_eventlog(), a ctx->log_offset restored from a checkpoint of an IMA
+ * list resumes the replay after the entries replayed up to it.
+ */
+bool parse_ima_log(tpm2_eventlog_context *ctx, BYTE const *log, size_t size,
+        TPMI_ALG_HASH alg);
+
+/*
+ * A plan of the measurements of a future boot, ie after a kernel or boot
+ * loader update, that parse_eventlog() predicts the PCRs with. A line of the
+ * plan is either of:
+ *   replace <pcr> <alg>=<digest> <alg>=<digest>
+ *     extends the second digest instead of the first wherever the log
+ *     measures the first into the PCR
+ *   append <pcr> <alg>=<digest>...
+ *     extends the digests after those of the log, in plan order
+ * and everything after a '#' is a comment. Every replacement must match an
+ * event of the log. A plan is shared by the workers of a batch.
+ */
+#define TPM2_EVENTLOG_PLAN_REPLACE_MAX 64
+
+bool tpm2_eventlog_plan_load(tpm2_eventlog_plan **plan, const char *path);
+void tpm2_eventlog_plan_free(tpm2_eventlog_plan *plan);
+
+/* the digest to extend for a digest of the log, by ctx->plan */
+BYTE const *tpm2_eventlog_plan_replace(tpm2_eventlog_context *ctx,
+        TPMI_ALG_HASH alg, unsigned pcr_index, BYTE const *digest,
+        size_t size);
+
+/*
+ * Checks the replacements of ctx->plan matched and extends its appended
+ * digests, once the log was replayed.
+ */
+bool tpm2_eventlog_plan_finish(tpm2_eventlog_context *ctx);
+
+/*
+ * Writing a crypto agile event log, ie while measuring. A new log starts with
+ * the SpecID event declaring the algorithms of the digests, its events each
+ * carry a digest of every one of them.
+ */
+bool tpm2_eventlog_write_specid(FILE *f, TPMI_ALG_HASH const *algs,
+        UINT32 count);
+bool tpm2_eventlog_write_event2(FILE *f, UINT32 pcr_index, UINT32 type,
+        TPML_DIGEST_VALUES const *digests, BYTE const *data, UINT32 size);
+
+/*
+ * Reads the algorithms of the SpecID event at the start of the crypto agile
+ * log in f.
+ */
+bool tpm2_eventlog_read_specid(FILE *f, TPMI_ALG_HASH *algs, UINT32 *count);
+
 #endif
@@ -0,0 +1,444 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <tss2/tss2_tpm2_types.h>
+
+#include "files.h"
+#include "log.h"
+#include "efi_event.h"
+#include "tpm2_alg_util.h"
+#include "tpm2_eventlog.h"
+#include "tpm2_eventlog_emit.h"
+#include "tpm2_eventlog_yaml.h"
+#include "tpm2_hex.h"
+#include "tpm2_tool_output.h"
+#include "tpm2_util.h"
+
+#define RECORD_CAPACITY_MIN 4096
+
+static void emit_write(tpm2_eventlog_emitter *e, const void *data,
+        size_t len) {
+
+    if (e->out && len && fwrite(data, 1, len, e->out) != len) {
+        e->result = false;
+    }
+}
+
+static void emit_string(tpm2_eventlog_emitter *e, const char *s) {
+
+    emit_write(e, s, strlen(s));
+}
+
+static void emit_hex(tpm2_eventlog_emitter *e, BYTE const *data, size_t len) {
+
+    if (e->out && !tpm2_hex_fprint(e->out, data, len, false)) {
+        e->result = false;
+    }
+}
+
+static void emit_json_uint(tpm2_eventlog_emitter *e, const char *name,
+        uint64_t value) {
+
+    if (e->out && fprintf(e->out, "\"%s\":%" PRIu64, name, value) < 0) {
+        e->result = false;
+    }
+}
+
+static char const *emit_alg_name(TPMI_ALG_HASH alg) {
+
+    char const *name = tpm2_alg_util_algtostr(alg, tpm2_alg_util_flags_hash);
+    return name ? name : "unknown";
+}
+
+static bool record_reserve(tpm2_eventlog_emitter *e, size_t len) {
+
+    if (e->record_len + len <= e->record_capacity) {
+        return true;
+    }
+
+    size_t capacity = e->record_capacity ?
+            e->record_capacity : RECORD_CAPACITY_MIN;
+    while (capacity < e->record_len + len) {
+        capacity *= 2;
+    }
+
+    BYTE *record = realloc(e->record, capacity);
+    if (!record) {
+        LOG_ERR("oom");
+        e->result = false;
+        return false;
+    }
+
+    e->record = record;
+    e->record_capacity = capacity;
+
+    return true;
+}
+
+static void record_append(tpm2_eventlog_emitter *e, const void *data,
+        size_t len) {
+
+    if (record_reserve(e, len)) {
+        memcpy(&e->record[e->record_len], data, len);
+        e->record_len += len;
+    }
+}
+
+static void put_be16(BYTE *p, uint16_t value) {
+
+    p[0] = value >> 8;
+    p[1] = value;
+}
+
+static void put_be32(BYTE *p, uint32_t value) {
+
+    p[0] = value >> 24;
+    p[1] = value >> 16;
+    p[2] = value >> 8;
+    p[3] = value;
+}
+
+static void record_append_16(tpm2_eventlog_emitter *e, uint16_t value) {
+
+    BYTE be[2];
+    put_be16(be, value);
+    record_append(e, be, sizeof(be));
+}
+
+static void record_append_32(tpm2_eventlog_emitter *e, uint32_t value) {
+
+    BYTE be[4];
+    put_be32(be, value);
+    record_append(e, be, sizeof(be));
+}
+
+static void tlv_write(tpm2_eventlog_emitter *e, uint8_t tag,
+        BYTE const *value, uint32_t len) {
+
+    BYTE header[5] = { tag };
+    put_be32(&header[1], len);
+    emit_write(e, header, sizeof(header));
+    emit_write(e, value, len);
+}
+
+/*
+ * An event is emitted over several callbacks: the header opens it, each
+ * digest is added to it and the event data closes it.
+ */
+static void emit_event_open(tpm2_eventlog_emitter *e, UINT32 pcr_index,
+        UINT32 type) {
+
+    size_t num = e->count++;
+
+    if (e->format == tpm2_eventlog_format_tlv) {
+        e->record_len = 0;
+        record_append_32(e, num);
+        record_append_32(e, pcr_index);
+        record_append_32(e, type);
+        e->digest_count_offset = e->record_len;
+        e->digest_count = 0;
+        record_append_32(e, 0);
+        return;
+    }
+
+    emit_string(e, e->is_first_event ? "\n{" : ",\n{");
+    e->is_first_event = false;
+    e->is_first_digest = true;
+    emit_json_uint(e, "EventNum", num);
+    emit_string(e, ",");
+    emit_json_uint(e, "PCRIndex", pcr_index);
+    emit_string(e, ",\"EventType\":\"");
+    emit_string(e, eventtype_to_string(type));
+    emit_string(e, "\",\"Digests\":[");
+}
+
+static void emit_event_digest(tpm2_eventlog_emitter *e, TPMI_ALG_HASH alg,
+        BYTE const *digest, size_t size) {
+
+    if (e->format == tpm2_eventlog_format_tlv) {
+        record_append_16(e, alg);
+        record_append_16(e, size);
+        record_append(e, digest, size);
+        e->digest_count++;
+        return;
+    }
+
+    emit_string(e, e->is_first_digest ? "{\"AlgorithmId\":\"" :
+            ",{\"AlgorithmId\":\"");
+    e->is_first_digest = false;
+    emit_string(e, emit_alg_name(alg));
+    emit_string(e, "\",\"Digest\":\"");
+    emit_hex(e, digest, size);
+    emit_string(e, "\"}");
+}
+
+static void emit_event_close(tpm2_eventlog_emitter *e, BYTE const *data,
+        UINT32 size) {
+
+    if (e->format == tpm2_eventlog_format_tlv) {
+        if (e->result) {
+            put_be32(&e->record[e->digest_count_offset], e->digest_count);
+        }
+        record_append_32(e, size);
+        record_append(e, data, size);
+        if (e->result) {
+            tlv_write(e, TPM2_EVENTLOG_TLV_TAG_EVENT, e->record,
+                    e->record_len);
+        }
+        return;
+    }
+
+    emit_string(e, "],");
+    emit_json_uint(e, "EventSize", size);
+    emit_string(e, ",\"Event\":\"");
+    emit_hex(e, data, size);
+    emit_string(e, "\"}");
+}
+
+static bool emit_specid_callback(TCG_EVENT const *event, void *data) {
+
+    tpm2_eventlog_emitter *e = (tpm2_eventlog_emitter *)data;
+
+    emit_event_open(e, event->pcrIndex, event->eventType);
+    emit_event_digest(e, TPM2_ALG_SHA1, event->digest, sizeof(event->digest));
+    emit_event_close(e, event->event, event->eventDataSize);
+
+    return e->result;
+}
+
+static bool emit_sha1_log_eventhdr_callback(TCG_EVENT const *eventhdr,
+        size_t size, void *data) {
+
+    UNUSED(size);
+
+    tpm2_eventlog_emitter *e = (tpm2_eventlog_emitter *)data;
+
+    emit_event_open(e, eventhdr->pcrIndex, eventhdr->eventType);
+    emit_event_digest(e, TPM2_ALG_SHA1, eventhdr->digest,
+            sizeof(eventhdr->digest));
+
+    return e->result;
+}
+
+static bool emit_event2hdr_callback(TCG_EVENT_HEADER2 const *eventhdr,
+        size_t size, void *data) {
+
+    UNUSED(size);
+
+    tpm2_eventlog_emitter *e = (tpm2_eventlog_emitter *)data;
+
+    emit_event_open(e, eventhdr->PCRIndex, eventhdr->EventType);
+
+    return e->result;
+}
+
+static bool emit_digest2_callback(TCG_DIGEST2 const *digest, size_t size,
+        void *data) {
+
+    tpm2_eventlog_emitter *e = (tpm2_eventlog_emitter *)data;
+
+    emit_event_digest(e, digest->AlgorithmId, digest->Digest, size);
+
+    return e->result;
+}
+
+static bool emit_event2_callback(TCG_EVENT2 const *event, UINT32 type,
+        void *data, uint32_t eventlog_version) {
+
+    UNUSED(type);
+    UNUSED(eventlog_version);
+
+    tpm2_eventlog_emitter *e = (tpm2_eventlog_emitter *)data;
+
+    emit_event_close(e, event->Event, event->EventSize);
+
+    return e->result;
+}
+
+void tpm2_eventlog_emitter_init(tpm2_eventlog_emitter *emitter,
+        tpm2_eventlog_format format, FILE *out, tpm2_eventlog_context *ctx) {
+
+    memset(emitter, 0, sizeof(*emitter));
+    emitter->format = format;
+    emitter->out = out;
+    emitter->is_first_event = true;
+    emitter->result = true;
+
+    ctx->data = emitter;
+    ctx->specid_cb = emit_specid_callback;
+    ctx->log_eventhdr_cb = emit_sha1_log_eventhdr_callback;
+    ctx->event2hdr_cb = emit_event2hdr_callback;
+    ctx->digest2_cb = emit_digest2_callback;
+    ctx->event2_cb = emit_event2_callback;
+}
+
+bool tpm2_eventlog_emitter_begin(tpm2_eventlog_emitter *emitter) {
+
+    if (emitter->format == tpm2_eventlog_format_tlv) {
+        BYTE version[4];
+        put_be32(version, TPM2_EVENTLOG_TLV_VERSION);
+        tlv_write(emitter, TPM2_EVENTLOG_TLV_TAG_VERSION, version,
+                sizeof(version));
+    } else {
+        emit_string(emitter, "{\"events\":[");
+    }
+
+    return emitter->result;
+}
+
+bool tpm2_eventlog_emitter_end(tpm2_eventlog_emitter *emitter,
+        tpm2_eventlog_context const *ctx) {
+
+    struct {
+        TPMI_ALG_HASH alg;
+        uint32_t used;
+        uint8_t const *pcrs;
+        size_t size;
+    } banks[] = {
+        { TPM2_ALG_SHA1, ctx->sha1_used, (uint8_t const *)ctx->sha1_pcrs,
+          sizeof(ctx->sha1_pcrs[0]) },
+        { TPM2_ALG_SHA256, ctx->sha256_used,
+          (uint8_t const *)ctx->sha256_pcrs, sizeof(ctx->sha256_pcrs[0]) },
+        { TPM2_ALG_SHA384, ctx->sha384_used,
+          (uint8_t const *)ctx->sha384_pcrs, sizeof(ctx->sha384_pcrs[0]) },
+        { TPM2_ALG_SHA512, ctx->sha512_used,
+          (uint8_t const *)ctx->sha512_pcrs, sizeof(ctx->sha512_pcrs[0]) },
+        { TPM2_ALG_SM3_256, ctx->sm3_256_used,
+          (uint8_t const *)ctx->sm3_256_pcrs, sizeof(ctx->sm3_256_pcrs[0]) },
+    };
+
+    bool is_tlv = emitter->format == tpm2_eventlog_format_tlv;
+    if (!is_tlv) {
+        emit_string(emitter, "\n],\"pcrs\":{");
+    }
+
+    bool is_first_bank = true;
+    size_t i;
+    for (i = 0; i < ARRAY_LEN(banks); i++) {
+        if (!banks[i].used) {
+            continue;
+        }
+
+        if (!is_tlv) {
+            emit_string(emitter, is_first_bank ? "\"" : ",\"");
+            emit_string(emitter, emit_alg_name(banks[i].alg));
+            emit_string(emitter, "\":{");
+        }
+        is_first_bank = false;
+
+        bool is_first_pcr = true;
+        unsigned pcr;
+        for (pcr = 0; pcr < TPM2_MAX_PCRS; pcr++) {
+            if (!(banks[i].used & (UINT32_C(1) << pcr))) {
+                continue;
+            }
+
+            uint8_t const *value = banks[i].pcrs + pcr * banks[i].size;
+            if (is_tlv) {
+                BYTE record[3 + sizeof(TPMU_HA)];
+                put_be16(record, banks[i].alg);
+                record[2] = pcr;
+                memcpy(&record[3], value, banks[i].size);
+                tlv_write(emitter, TPM2_EVENTLOG_TLV_TAG_PCR, record,
+                        3 + banks[i].size);
+                continue;
+            }
+
+            if (emitter->out && fprintf(emitter->out, "%s\"%u\":\"",
+                    is_first_pcr ? "" : ",", pcr) < 0) {
+                emitter->result = false;
+            }
+            is_first_pcr = false;
+            emit_hex(emitter, value, banks[i].size);
+            emit_string(emitter, "\"");
+        }
+
+        if (!is_tlv) {
+            emit_string(emitter, "}");
+        }
+    }
+
+    if (is_tlv) {
+        tlv_write(emitter, TPM2_EVENTLOG_TLV_TAG_END, NULL, 0);
+    } else {
+        emit_string(emitter, "}}\n");
+    }
+
+    return emitter->result;
+}
+
+void tpm2_eventlog_emitter_free(tpm2_eventlog_emitter *emitter) {
+
+    free(emitter->record);
+    emitter->record = NULL;
+    emitter->record_len = emitter->record_capacity = 0;
+}
+
+bool tpm2_eventlog_emit_checkpoint(UINT8 const *eventlog, size_t size,
+        tpm2_eventlog_format format, const char *checkpoint_path) {
+
+    tpm2_eventlog_context ctx = { 0 };
+    tpm2_eventlog_emitter emitter;
+    tpm2_eventlog_emitter_init(&emitter, format,
+            output_enabled ? stdout : NULL, &ctx);
+
+    bool result = false;
+
+    /* only the events appended since the checkpoint are output */
+    if (checkpoint_path && files_does_file_exist(checkpoint_path)) {
+        result = tpm2_eventlog_checkpoint_load(&ctx, checkpoint_path);
+        if (!result) {
+            goto out;
+        }
+
+        if (tpm2_eventlog_checkpoint_matches(&ctx, eventlog, size)) {
+            emitter.count = ctx.event_count;
+        } else {
+            LOG_WARN("Event log does not continue checkpoint \"%s\", "
+                    "replaying it from the start", checkpoint_path);
+            tpm2_eventlog_checkpoint_reset(&ctx);
+        }
+    }
+
+    result = tpm2_eventlog_emitter_begin(&emitter)
+            && parse_eventlog(&ctx, eventlog, size);
+    if (!result) {
+        goto out;
+    }
+
+    if (checkpoint_path) {
+        result = tpm2_eventlog_checkpoint_save(&ctx, eventlog,
+                checkpoint_path);
+        if (!result) {
+            goto out;
+        }
+    }
+
+    result = tpm2_eventlog_emitter_end(&emitter, &ctx);
+
+out:
+    tpm2_eventlog_emitter_free(&emitter);
+
+    return result;
+}
+
+bool tpm2_eventlog_emit_index(UINT8 const *eventlog, size_t size,
+        tpm2_eventlog_format format, tpm2_eventlog_index const *index,
+        tpm2_eventlog_filter const *filter) {
+
+    tpm2_eventlog_context ctx = { 0 };
+    tpm2_eventlog_emitter emitter;
+    tpm2_eventlog_emitter_init(&emitter, format,
+            output_enabled ? stdout : NULL, &ctx);
+
+    bool result = tpm2_eventlog_emitter_begin(&emitter)
+            && parse_eventlog_index(&ctx, eventlog, size, index, filter)
+            && tpm2_eventlog_emitter_end(&emitter, &ctx);
+
+    tpm2_eventlog_emitter_free(&emitter);
+
+    return result;
+}
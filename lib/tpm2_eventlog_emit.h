@@ -0,0 +1,99 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+#ifndef TPM2_EVENTLOG_EMIT_H
+#define TPM2_EVENTLOG_EMIT_H
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "tpm2_eventlog.h"
+
+/*
+ * Machine readable alternatives to the YAML output of an event log. They
+ * output the event headers, the digests and the raw event data without
+ * decoding the event bodies, and the replayed PCR values.
+ */
+typedef enum tpm2_eventlog_format tpm2_eventlog_format;
+enum tpm2_eventlog_format {
+    tpm2_eventlog_format_yaml,
+    tpm2_eventlog_format_json,
+    tpm2_eventlog_format_tlv,
+};
+
+/*
+ * The records of the TLV format, each a one byte tag, a 32 bit big endian
+ * length and that many bytes of value. The integers of the values are big
+ * endian as well.
+ *
+ * version: u32 format version
+ * event:   u32 number, u32 PCR index, u32 event type, u32 digest count,
+ *          per digest u16 algorithm and u16 size followed by the digest,
+ *          u32 event size followed by the event data
+ * pcr:     u16 algorithm, u8 PCR index followed by the PCR value
+ * end:     empty, the last record
+ */
+#define TPM2_EVENTLOG_TLV_VERSION 1
+
+#define TPM2_EVENTLOG_TLV_TAG_END     0x00
+#define TPM2_EVENTLOG_TLV_TAG_VERSION 0x01
+#define TPM2_EVENTLOG_TLV_TAG_EVENT   0x02
+#define TPM2_EVENTLOG_TLV_TAG_PCR     0x03
+
+typedef struct tpm2_eventlog_emitter tpm2_eventlog_emitter;
+struct tpm2_eventlog_emitter {
+    /* the event counter the library expects ctx->data to point at, first */
+    size_t count;
+    tpm2_eventlog_format format;
+    FILE *out;
+    bool is_first_event;
+    bool is_first_digest;
+    /* the TLV record of the event being emitted, reused for every event */
+    BYTE *record;
+    size_t record_len;
+    size_t record_capacity;
+    size_t digest_count_offset;
+    uint32_t digest_count;
+    bool result;
+};
+
+/**
+ * Sets up an emitter and installs its callbacks in ctx.
+ * @param emitter
+ *  The emitter to set up.
+ * @param format
+ *  The JSON or TLV format.
+ * @param out
+ *  Where to output to, NULL to output nothing.
+ * @param ctx
+ *  The context to parse the event log with.
+ */
+void tpm2_eventlog_emitter_init(tpm2_eventlog_emitter *emitter,
+        tpm2_eventlog_format format, FILE *out, tpm2_eventlog_context *ctx);
+
+/**
+ * Outputs what precedes the events.
+ */
+bool tpm2_eventlog_emitter_begin(tpm2_eventlog_emitter *emitter);
+
+/**
+ * Outputs the replayed PCR values of ctx and what follows the events.
+ */
+bool tpm2_eventlog_emitter_end(tpm2_eventlog_emitter *emitter,
+        tpm2_eventlog_context const *ctx);
+
+void tpm2_eventlog_emitter_free(tpm2_eventlog_emitter *emitter);
+
+/**
+ * Like yaml_eventlog_checkpoint(), in the JSON or TLV format.
+ */
+bool tpm2_eventlog_emit_checkpoint(UINT8 const *eventlog, size_t size,
+        tpm2_eventlog_format format, const char *checkpoint_path);
+
+/**
+ * Like yaml_eventlog_index(), in the JSON or TLV format.
+ */
+bool tpm2_eventlog_emit_index(UINT8 const *eventlog, size_t size,
+        tpm2_eventlog_format format, tpm2_eventlog_index const *index,
+        tpm2_eventlog_filter const *filter);
+
+#endif
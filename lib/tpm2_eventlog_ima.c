@@ -0,0 +1,476 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <tss2/tss2_tpm2_types.h>
+
+#include "log.h"
+#include "tpm2_alg_util.h"
+#include "tpm2_eventlog.h"
+#include "tpm2_hex.h"
+#include "tpm2_openssl.h"
+#include "tpm2_util.h"
+
+/* the longest template name the kernel accepts */
+#define IMA_TEMPLATE_NAME_LEN_MAX 255
+
+/* the template of the original format, which has its own binary layout */
+#define IMA_TEMPLATE_IMA "ima"
+#define IMA_TEMPLATE_IMA_NG "ima-ng"
+
+/* the algorithms of the file digests, by their name in the kernel */
+static const struct {
+    const char *name;
+    TPMI_ALG_HASH alg;
+} ima_algs[] = {
+    { "sha1", TPM2_ALG_SHA1 },
+    { "sha256", TPM2_ALG_SHA256 },
+    { "sha384", TPM2_ALG_SHA384 },
+    { "sha512", TPM2_ALG_SHA512 },
+    { "sm3", TPM2_ALG_SM3_256 },
+    { "sm3-256", TPM2_ALG_SM3_256 },
+};
+
+static TPMI_ALG_HASH ima_alg_from_name(char const *name, size_t size) {
+
+    size_t i;
+    for (i = 0; i < ARRAY_LEN(ima_algs); i++) {
+        if (strlen(ima_algs[i].name) == size
+                && !memcmp(ima_algs[i].name, name, size)) {
+            return ima_algs[i].alg;
+        }
+    }
+
+    return TPM2_ALG_NULL;
+}
+
+static bool ima_name_is(char const *name, size_t size, char const *expected) {
+
+    return strlen(expected) == size && !memcmp(name, expected, size);
+}
+
+static UINT32 ima_le32(BYTE const *p) {
+
+    return (UINT32) p[0] | (UINT32) p[1] << 8 | (UINT32) p[2] << 16
+            | (UINT32) p[3] << 24;
+}
+
+/* the accumulators of the bank of alg in ctx */
+static bool ima_bank(tpm2_eventlog_context *ctx, TPMI_ALG_HASH alg,
+        uint8_t **pcrs, uint32_t **used) {
+
+    switch (alg) {
+    case TPM2_ALG_SHA1:
+        *pcrs = (uint8_t *) ctx->sha1_pcrs;
+        *used = &ctx->sha1_used;
+        return true;
+    case TPM2_ALG_SHA256:
+        *pcrs = (uint8_t *) ctx->sha256_pcrs;
+        *used = &ctx->sha256_used;
+        return true;
+    case TPM2_ALG_SHA384:
+        *pcrs = (uint8_t *) ctx->sha384_pcrs;
+        *used = &ctx->sha384_used;
+        return true;
+    case TPM2_ALG_SHA512:
+        *pcrs = (uint8_t *) ctx->sha512_pcrs;
+        *used = &ctx->sha512_used;
+        return true;
+    case TPM2_ALG_SM3_256:
+        *pcrs = (uint8_t *) ctx->sm3_256_pcrs;
+        *used = &ctx->sm3_256_used;
+        return true;
+    }
+
+    return false;
+}
+
+static bool ima_set_digest(TPM2B_DIGEST *digest, BYTE const *data,
+        size_t size) {
+
+    if (size > sizeof(digest->buffer)) {
+        return false;
+    }
+
+    digest->size = size;
+    memcpy(digest->buffer, data, size);
+
+    return true;
+}
+
+/*
+ * The file digest of the first field of the template data, a d-ng field of
+ * "<alg>:\0" and the digest, or a SHA1 d field, and the file name of the
+ * second, a n-ng field. Other fields leave the entry without a file digest.
+ */
+static void ima_binary_fields(BYTE const *data, size_t size,
+        tpm2_eventlog_ima_event *event) {
+
+    if (size < sizeof(UINT32) || size - sizeof(UINT32) < ima_le32(data)) {
+        return;
+    }
+    size_t field_size = ima_le32(data);
+    BYTE const *field = data + sizeof(UINT32);
+
+    BYTE const *colon = memchr(field, ':', field_size);
+    if (colon && (size_t) (colon - field) + 1 < field_size
+            && !colon[1]) {
+        size_t name_size = colon - field;
+        size_t digest_size = field_size - name_size - 2;
+        TPMI_ALG_HASH alg = ima_alg_from_name((char const *) field,
+                name_size);
+        if (alg == TPM2_ALG_NULL
+                || tpm2_alg_util_get_hash_size(alg) != digest_size
+                || !ima_set_digest(&event->file_digest, colon + 2,
+                        digest_size)) {
+            return;
+        }
+        event->file_alg = alg;
+    } else if (field_size == TPM2_SHA1_DIGEST_SIZE) {
+        ima_set_digest(&event->file_digest, field, field_size);
+        event->file_alg = TPM2_ALG_SHA1;
+    } else {
+        return;
+    }
+
+    data = field + field_size;
+    size -= sizeof(UINT32) + field_size;
+    if (size < sizeof(UINT32) || size - sizeof(UINT32) < ima_le32(data)) {
+        return;
+    }
+
+    event->file_name = (char const *) data + sizeof(UINT32);
+    event->file_name_size = strnlen(event->file_name, ima_le32(data));
+}
+
+/*
+ * An entry of the binary list, the PCR index, the template digest, the
+ * template name and the template data, but for the ima template whose fields
+ * follow its name without the size of the data.
+ */
+static bool ima_binary_entry(BYTE const *entry, size_t size,
+        TPMI_ALG_HASH alg, size_t eventnum, tpm2_eventlog_ima_event *event,
+        size_t *entry_size) {
+
+    size_t digest_size = tpm2_alg_util_get_hash_size(alg);
+    size_t offset = sizeof(UINT32) + digest_size + sizeof(UINT32);
+    if (size < offset) {
+        goto truncated;
+    }
+
+    event->pcr_index = ima_le32(entry);
+    event->template_alg = alg;
+    ima_set_digest(&event->template_digest, entry + sizeof(UINT32),
+            digest_size);
+
+    size_t name_size = ima_le32(entry + offset - sizeof(UINT32));
+    if (name_size > IMA_TEMPLATE_NAME_LEN_MAX) {
+        LOG_ERR("Template name of entry %zu is too long, got: %zu", eventnum,
+                name_size);
+        return false;
+    }
+    if (size - offset < name_size) {
+        goto truncated;
+    }
+    event->template_name = (char const *) entry + offset;
+    event->template_name_size = name_size;
+    offset += name_size;
+
+    if (ima_name_is(event->template_name, name_size, IMA_TEMPLATE_IMA)) {
+        /* the SHA1 file digest, then the size of the file name and the name */
+        if (size - offset < TPM2_SHA1_DIGEST_SIZE + sizeof(UINT32)) {
+            goto truncated;
+        }
+        ima_set_digest(&event->file_digest, entry + offset,
+                TPM2_SHA1_DIGEST_SIZE);
+        event->file_alg = TPM2_ALG_SHA1;
+        offset += TPM2_SHA1_DIGEST_SIZE;
+
+        size_t file_name_size = ima_le32(entry + offset);
+        offset += sizeof(UINT32);
+        if (size - offset < file_name_size) {
+            goto truncated;
+        }
+        event->file_name = (char const *) entry + offset;
+        event->file_name_size = strnlen(event->file_name, file_name_size);
+        offset += file_name_size;
+    } else {
+        if (size - offset < sizeof(UINT32)) {
+            goto truncated;
+        }
+        size_t data_size = ima_le32(entry + offset);
+        offset += sizeof(UINT32);
+        if (size - offset < data_size) {
+            goto truncated;
+        }
+        ima_binary_fields(entry + offset, data_size, event);
+        offset += data_size;
+    }
+
+    *entry_size = offset;
+
+    return true;
+
+truncated:
+    LOG_ERR("insufficient size for entry %zu of the IMA list", eventnum);
+    return false;
+}
+
+/* the next field of a line, up to a space or the end of the line */
+static bool ima_ascii_field(char const **line, char const *end,
+        char const **field, size_t *size) {
+
+    char const *p = *line;
+    while (p < end && *p == ' ') {
+        p++;
+    }
+
+    char const *space = memchr(p, ' ', end - p);
+    char const *stop = space ? space : end;
+    *field = p;
+    *size = stop - p;
+    *line = stop;
+
+    return *size > 0;
+}
+
+/*
+ * An entry of the ascii list, a line of the PCR index, the hex template
+ * digest, the template name, the file digest, "<alg>:" and hex but for the
+ * ima template, and the file name. The file name of the ima and ima-ng
+ * templates is the rest of the line, as it may hold spaces, other templates
+ * append more fields.
+ */
+static bool ima_ascii_entry(char const *entry, size_t size,
+        TPMI_ALG_HASH alg, size_t eventnum, tpm2_eventlog_ima_event *event,
+        size_t *entry_size) {
+
+    char const *newline = memchr(entry, '\n', size);
+    char const *end = newline ? newline : entry + size;
+    *entry_size = newline ? (size_t) (newline - entry) + 1 : size;
+
+    char const *line = entry;
+    char const *field;
+    size_t field_size;
+
+    /* the PCR index */
+    if (!ima_ascii_field(&line, end, &field, &field_size)
+            || field_size > 2) {
+        goto malformed;
+    }
+    char pcr[3] = { 0 };
+    memcpy(pcr, field, field_size);
+    if (!tpm2_util_string_to_uint32(pcr, &event->pcr_index)) {
+        goto malformed;
+    }
+
+    size_t digest_size = tpm2_alg_util_get_hash_size(alg);
+    if (!ima_ascii_field(&line, end, &field, &field_size)
+            || field_size != 2 * digest_size
+            || !tpm2_hex_decode(field, field_size,
+                    event->template_digest.buffer)) {
+        LOG_ERR("Template digest of entry %zu is not a %s digest", eventnum,
+                tpm2_alg_util_algtostr(alg, tpm2_alg_util_flags_hash));
+        return false;
+    }
+    event->template_digest.size = digest_size;
+    event->template_alg = alg;
+
+    if (!ima_ascii_field(&line, end, &event->template_name,
+            &event->template_name_size)) {
+        goto malformed;
+    }
+
+    if (!ima_ascii_field(&line, end, &field, &field_size)) {
+        /* a template without fields, ie only keeping a buffer digest */
+        return true;
+    }
+
+    TPMI_ALG_HASH file_alg = TPM2_ALG_SHA1;
+    char const *colon = memchr(field, ':', field_size);
+    if (colon) {
+        file_alg = ima_alg_from_name(field, colon - field);
+        field_size -= colon + 1 - field;
+        field = colon + 1;
+    }
+
+    size_t file_digest_size = tpm2_alg_util_get_hash_size(file_alg);
+    if (file_alg != TPM2_ALG_NULL && field_size == 2 * file_digest_size
+            && tpm2_hex_decode(field, field_size,
+                    event->file_digest.buffer)) {
+        event->file_digest.size = file_digest_size;
+        event->file_alg = file_alg;
+    }
+
+    bool is_rest = ima_name_is(event->template_name,
+            event->template_name_size, IMA_TEMPLATE_IMA)
+            || ima_name_is(event->template_name, event->template_name_size,
+                    IMA_TEMPLATE_IMA_NG);
+    if (is_rest) {
+        event->file_name = line < end ? line + 1 : end;
+        event->file_name_size = end - event->file_name;
+    } else if (ima_ascii_field(&line, end, &event->file_name,
+            &event->file_name_size)) {
+        /* the signature, the buffer and so on are not decoded */
+    }
+
+    return true;
+
+malformed:
+    LOG_ERR("Malformed entry %zu of the IMA list", eventnum);
+    return false;
+}
+
+/* the algorithm of the size of the template digest of the first entry */
+static TPMI_ALG_HASH ima_ascii_alg(char const *log, size_t size) {
+
+    static const TPMI_ALG_HASH algs[] = {
+        TPM2_ALG_SHA1, TPM2_ALG_SHA256, TPM2_ALG_SHA384, TPM2_ALG_SHA512,
+    };
+
+    char const *newline = memchr(log, '\n', size);
+    char const *end = newline ? newline : log + size;
+    char const *field;
+    size_t field_size;
+    if (ima_ascii_field(&log, end, &field, &field_size)
+            && ima_ascii_field(&log, end, &field, &field_size)) {
+        size_t i;
+        for (i = 0; i < ARRAY_LEN(algs); i++) {
+            if (field_size == 2U * tpm2_alg_util_get_hash_size(algs[i])) {
+                return algs[i];
+            }
+        }
+    }
+
+    return TPM2_ALG_SHA1;
+}
+
+static bool ima_is_violation(TPM2B_DIGEST const *digest) {
+
+    UINT16 i;
+    for (i = 0; i < digest->size; i++) {
+        if (digest->buffer[i]) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+bool parse_ima_log(tpm2_eventlog_context *ctx, BYTE const *log, size_t size,
+        TPMI_ALG_HASH alg) {
+
+    if (!log) {
+        return false;
+    }
+
+    if (ctx->log_offset && !ctx->is_ima_log) {
+        LOG_ERR("The checkpoint is not of an IMA measurement list");
+        return false;
+    }
+
+    if (ctx->log_offset > size) {
+        LOG_ERR("IMA list is shorter than the checkpoint, got: %zu, "
+                "expected at least: %zu", size, ctx->log_offset);
+        return false;
+    }
+
+    /* the ascii list starts with the digits of a PCR index */
+    bool is_ascii = size && log[0] >= '0' && log[0] <= '9';
+    if (alg == TPM2_ALG_NULL) {
+        alg = is_ascii ? ima_ascii_alg((char const *) log, size) :
+                TPM2_ALG_SHA1;
+    }
+
+    uint8_t *pcrs;
+    uint32_t *used;
+    if (!ima_bank(ctx, alg, &pcrs, &used)) {
+        LOG_ERR("Unsupported IMA template hash algorithm 0x%x", alg);
+        return false;
+    }
+    size_t digest_size = tpm2_alg_util_get_hash_size(alg);
+
+    const EVP_MD *md = tpm2_openssl_halg_from_tpmhalg(alg);
+    EVP_MD_CTX *mdctx = md ? tpm2_openssl_md_ctx_get() : NULL;
+    if (!mdctx) {
+        return false;
+    }
+
+    BYTE ones[sizeof(TPMU_HA)];
+    memset(ones, 0xff, sizeof(ones));
+
+    ctx->is_ima_log = true;
+
+    bool ret = false;
+    while (ctx->log_offset < size) {
+        BYTE const *entry = log + ctx->log_offset;
+        size_t remaining = size - ctx->log_offset;
+        tpm2_eventlog_ima_event event = { .file_alg = TPM2_ALG_NULL };
+        size_t entry_size = 0;
+
+        bool result = is_ascii ?
+                ima_ascii_entry((char const *) entry, remaining, alg,
+                        ctx->event_count, &event, &entry_size) :
+                ima_binary_entry(entry, remaining, alg, ctx->event_count,
+                        &event, &entry_size);
+        if (!result) {
+            goto out;
+        }
+
+        if (event.pcr_index >= TPM2_MAX_PCRS) {
+            LOG_ERR("PCR index %"PRIu32" of entry %zu is out of range",
+                    event.pcr_index, ctx->event_count);
+            goto out;
+        }
+
+        /* a violation is logged with zeros but extended with ones */
+        event.is_violation = ima_is_violation(&event.template_digest);
+        BYTE const *digest = event.is_violation ?
+                ones : event.template_digest.buffer;
+
+        if (!ctx->skip_extend) {
+            /* extend operation is pcr = HASH(pcr + data) */
+            uint8_t *pcr = pcrs + event.pcr_index * digest_size;
+            unsigned pcr_size = digest_size;
+            int rc = EVP_DigestInit_ex(mdctx, md, NULL)
+                    && EVP_DigestUpdate(mdctx, pcr, digest_size)
+                    && EVP_DigestUpdate(mdctx, digest, digest_size)
+                    && EVP_DigestFinal_ex(mdctx, pcr, &pcr_size);
+            if (!rc) {
+                LOG_ERR("%s", tpm2_openssl_get_err());
+                goto out;
+            }
+            *used |= UINT32_C(1) << event.pcr_index;
+        }
+
+        if (ctx->reference && event.file_alg != TPM2_ALG_NULL
+                && !event.is_violation
+                && !tpm2_eventlog_reference_contains(ctx->reference,
+                        event.file_digest.buffer, event.file_digest.size)) {
+            ctx->unknown_digests++;
+            if (ctx->unknown_digest_cb && !ctx->unknown_digest_cb(
+                    ctx->event_count, event.pcr_index, event.file_alg,
+                    event.file_digest.buffer, event.file_digest.size,
+                    ctx->data)) {
+                goto out;
+            }
+        }
+
+        if (ctx->ima_event_cb && !ctx->ima_event_cb(ctx->event_count, &event,
+                ctx->data)) {
+            goto out;
+        }
+
+        ctx->log_offset += entry_size;
+        ctx->last_event_size = entry_size;
+        ctx->event_count++;
+    }
+
+    ret = true;
+
+out:
+    tpm2_openssl_md_ctx_put(mdctx);
+
+    return ret;
+}
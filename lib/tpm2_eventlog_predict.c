@@ -0,0 +1,320 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <tss2/tss2_tpm2_types.h>
+
+#include "files.h"
+#include "log.h"
+#include "tpm2_alg_util.h"
+#include "tpm2_eventlog.h"
+#include "tpm2_openssl.h"
+#include "tpm2_util.h"
+
+/* a measurement of the log that the plan swaps for another one */
+typedef struct {
+    UINT32 pcr_index;
+    TPMT_HA from;
+    TPMT_HA to;
+} plan_replace;
+
+/* a measurement of the plan taken after those of the log */
+typedef struct {
+    UINT32 pcr_index;
+    TPMT_HA digest;
+} plan_append;
+
+struct tpm2_eventlog_plan {
+    plan_replace replaces[TPM2_EVENTLOG_PLAN_REPLACE_MAX];
+    size_t replace_count;
+    plan_append *appends;
+    size_t append_count;
+    size_t append_capacity;
+};
+
+#define PLAN_APPENDS_MIN 16
+
+static bool plan_add_append(tpm2_eventlog_plan *plan, UINT32 pcr_index,
+        const TPMT_HA *digest) {
+
+    if (plan->append_count == plan->append_capacity) {
+        size_t capacity = plan->append_capacity ?
+                plan->append_capacity * 2 : PLAN_APPENDS_MIN;
+        plan_append *appends = realloc(plan->appends,
+                capacity * sizeof(*appends));
+        if (!appends) {
+            LOG_ERR("oom");
+            return false;
+        }
+        plan->appends = appends;
+        plan->append_capacity = capacity;
+    }
+
+    plan_append *append = &plan->appends[plan->append_count++];
+    append->pcr_index = pcr_index;
+    append->digest = *digest;
+
+    return true;
+}
+
+/* the next word of a line, which is not nul terminated */
+static bool plan_word(const char **cursor, const char *end, const char **word,
+        size_t *size) {
+
+    const char *p = *cursor;
+    while (p < end && (*p == ' ' || *p == '\t' || *p == '\r')) {
+        p++;
+    }
+
+    *word = p;
+    while (p < end && *p != ' ' && *p != '\t' && *p != '\r' && *p != '#') {
+        p++;
+    }
+
+    *size = p - *word;
+    *cursor = p;
+
+    return *size > 0;
+}
+
+static bool plan_parse_line(tpm2_eventlog_plan *plan, const char *line,
+        const char *end, size_t line_number) {
+
+    const char *cursor = line;
+    const char *word;
+    size_t size;
+    if (!plan_word(&cursor, end, &word, &size)) {
+        /* an empty line or a comment */
+        return true;
+    }
+
+    bool is_replace = size == strlen("replace")
+            && !memcmp(word, "replace", size);
+    bool is_append = size == strlen("append")
+            && !memcmp(word, "append", size);
+    if (!is_replace && !is_append) {
+        LOG_ERR("Line %zu of the plan: unknown statement \"%.*s\", expected "
+                "replace or append", line_number, (int) size, word);
+        return false;
+    }
+
+    char pcr[16];
+    UINT32 pcr_index;
+    if (!plan_word(&cursor, end, &word, &size) || size >= sizeof(pcr)) {
+        LOG_ERR("Line %zu of the plan: expected a PCR index", line_number);
+        return false;
+    }
+    memcpy(pcr, word, size);
+    pcr[size] = '\0';
+    if (!tpm2_util_string_to_uint32(pcr, &pcr_index)
+            || pcr_index >= TPM2_MAX_PCRS) {
+        LOG_ERR("Line %zu of the plan: invalid PCR index, got: \"%s\"",
+                line_number, pcr);
+        return false;
+    }
+
+    TPMT_HA digests[2];
+    size_t count = 0;
+    while (true) {
+        TPMT_HA digest;
+        int rc = tpm2_alg_util_digest_next(&cursor, end, &digest);
+        if (rc < 0) {
+            LOG_ERR("Line %zu of the plan: invalid digest", line_number);
+            return false;
+        }
+        if (!rc) {
+            break;
+        }
+
+        if (is_append) {
+            if (!plan_add_append(plan, pcr_index, &digest)) {
+                return false;
+            }
+        } else if (count < ARRAY_LEN(digests)) {
+            digests[count] = digest;
+        }
+        count++;
+    }
+
+    if (is_append) {
+        if (!count) {
+            LOG_ERR("Line %zu of the plan: expected: append <pcr> "
+                    "<alg>=<digest>...", line_number);
+            return false;
+        }
+        return true;
+    }
+
+    if (count != 2 || digests[0].hashAlg != digests[1].hashAlg) {
+        LOG_ERR("Line %zu of the plan: expected: replace <pcr> "
+                "<alg>=<digest> <alg>=<digest>, of one algorithm",
+                line_number);
+        return false;
+    }
+
+    if (plan->replace_count == ARRAY_LEN(plan->replaces)) {
+        LOG_ERR("Line %zu of the plan: more than %zu replacements",
+                line_number, ARRAY_LEN(plan->replaces));
+        return false;
+    }
+
+    plan_replace *replace = &plan->replaces[plan->replace_count++];
+    replace->pcr_index = pcr_index;
+    replace->from = digests[0];
+    replace->to = digests[1];
+
+    return true;
+}
+
+bool tpm2_eventlog_plan_load(tpm2_eventlog_plan **plan, const char *path) {
+
+    *plan = calloc(1, sizeof(**plan));
+    if (!*plan) {
+        LOG_ERR("oom");
+        return false;
+    }
+
+    files_input input;
+    if (!files_input_open(&input, strcmp(path, "-") ? path : NULL)) {
+        goto error;
+    }
+
+    const UINT8 *data;
+    size_t size;
+    bool result = files_input_read_all(&input, &data, &size);
+
+    const char *text = (const char *) data;
+    const char *end = text + size;
+    size_t line_number = 0;
+    while (result && text < end) {
+        const char *line_end = memchr(text, '\n', end - text);
+        if (!line_end) {
+            line_end = end;
+        }
+
+        result = plan_parse_line(*plan, text, line_end, ++line_number);
+        text = line_end + 1;
+    }
+
+    files_input_close(&input);
+
+    if (result) {
+        return true;
+    }
+
+    LOG_ERR("Could not load the plan \"%s\"", path);
+
+error:
+    tpm2_eventlog_plan_free(*plan);
+    *plan = NULL;
+
+    return false;
+}
+
+void tpm2_eventlog_plan_free(tpm2_eventlog_plan *plan) {
+
+    if (!plan) {
+        return;
+    }
+
+    free(plan->appends);
+    free(plan);
+}
+
+BYTE const *tpm2_eventlog_plan_replace(tpm2_eventlog_context *ctx,
+        TPMI_ALG_HASH alg, unsigned pcr_index, BYTE const *digest,
+        size_t size) {
+
+    const tpm2_eventlog_plan *plan = ctx->plan;
+
+    size_t i;
+    for (i = 0; i < plan->replace_count; i++) {
+        const plan_replace *replace = &plan->replaces[i];
+        if (replace->pcr_index == pcr_index && replace->from.hashAlg == alg
+                && !memcmp(&replace->from.digest, digest, size)) {
+            ctx->plan_replaced |= UINT64_C(1) << i;
+            return (BYTE const *) &replace->to.digest;
+        }
+    }
+
+    return digest;
+}
+
+/* the accumulators of the bank of alg in ctx */
+static bool plan_bank(tpm2_eventlog_context *ctx, TPMI_ALG_HASH alg,
+        uint8_t **pcrs, uint32_t **used) {
+
+    switch (alg) {
+    case TPM2_ALG_SHA1:
+        *pcrs = (uint8_t *) ctx->sha1_pcrs;
+        *used = &ctx->sha1_used;
+        return true;
+    case TPM2_ALG_SHA256:
+        *pcrs = (uint8_t *) ctx->sha256_pcrs;
+        *used = &ctx->sha256_used;
+        return true;
+    case TPM2_ALG_SHA384:
+        *pcrs = (uint8_t *) ctx->sha384_pcrs;
+        *used = &ctx->sha384_used;
+        return true;
+    case TPM2_ALG_SHA512:
+        *pcrs = (uint8_t *) ctx->sha512_pcrs;
+        *used = &ctx->sha512_used;
+        return true;
+    case TPM2_ALG_SM3_256:
+        *pcrs = (uint8_t *) ctx->sm3_256_pcrs;
+        *used = &ctx->sm3_256_used;
+        return true;
+    }
+
+    return false;
+}
+
+bool tpm2_eventlog_plan_finish(tpm2_eventlog_context *ctx) {
+
+    const tpm2_eventlog_plan *plan = ctx->plan;
+
+    if (ctx->is_sha1_log && plan->replace_count) {
+        LOG_ERR("The measurements of a log of a TPM 1.2 cannot be replaced");
+        return false;
+    }
+
+    /* a replacement that matched no event is a typo or the wrong log */
+    size_t i;
+    for (i = 0; i < plan->replace_count; i++) {
+        if (!(ctx->plan_replaced & (UINT64_C(1) << i))) {
+            LOG_ERR("No %s measurement of PCR %"PRIu32" to replace matches "
+                    "an event of the log",
+                    tpm2_alg_util_algtostr(plan->replaces[i].from.hashAlg,
+                            tpm2_alg_util_flags_hash),
+                    plan->replaces[i].pcr_index);
+            return false;
+        }
+    }
+
+    for (i = 0; i < plan->append_count; i++) {
+        const plan_append *append = &plan->appends[i];
+        TPMI_ALG_HASH alg = append->digest.hashAlg;
+
+        uint8_t *pcrs;
+        uint32_t *used;
+        if (!plan_bank(ctx, alg, &pcrs, &used)) {
+            LOG_ERR("Cannot predict the PCRs of bank %s",
+                    tpm2_alg_util_algtostr(alg, tpm2_alg_util_flags_hash));
+            return false;
+        }
+
+        UINT16 size = tpm2_alg_util_get_hash_size(alg);
+        bool result = tpm2_openssl_pcr_extend(alg,
+                pcrs + append->pcr_index * size,
+                (BYTE const *) &append->digest.digest, size);
+        if (!result) {
+            LOG_ERR("PCR%"PRIu32" extend failed", append->pcr_index);
+            return false;
+        }
+        *used |= UINT32_C(1) << append->pcr_index;
+    }
+
+    return true;
+}
@@ -8,11 +8,13 @@
 
 #include <tss2/tss2_tpm2_types.h>
 
+#include "files.h"
 #include "log.h"
 #include "efi_event.h"
 #include "tpm2_alg_util.h"
 #include "tpm2_eventlog.h"
 #include "tpm2_eventlog_yaml.h"
+#include "tpm2_hex.h"
 #include "tpm2_tool.h"
 #include "tpm2_tool_output.h"
 
@@ -98,12 +100,13 @@ char const *eventtype_to_string (UINT32 event_type) {
 }
 void bytes_to_str(uint8_t const *buf, size_t size, char *dest, size_t dest_size) {
 
-    size_t i, j;
-
-    for(i = 0, j = 0; i < size && j < dest_size - 2; ++i, j+=2) {
-        sprintf(&dest[j], "%02x", buf[i]);
+    if (!dest_size) {
+        return;
     }
-    dest[j] = '\0';
+
+    /* as much as fits, leaving room for the NUL */
+    size_t max = (dest_size - 1) / 2;
+    tpm2_hex_encode(buf, size < max ? size : max, dest, false);
 }
 void yaml_event2hdr(TCG_EVENT_HEADER2 const *eventhdr, size_t size) {
 
@@ -144,49 +147,105 @@ bool yaml_digest2(TCG_DIGEST2 const *digest, size_t size) {
 
     return true;
 }
-static char *yaml_utf16_to_str(UTF16_CHAR *data, size_t len) {
+#define YAML_BUFFER_MIN 256
+/*
+ * Returns the buffer with room for at least size bytes, growing it if needed.
+ * The previous contents are not preserved.
+ */
+static char *yaml_buffer_get(yaml_buffer *buffer, size_t size) {
 
-    int ret = 0;
-    mbstate_t st;
+    if (size <= buffer->size) {
+        return buffer->data;
+    }
 
-    memset(&st, '\0', sizeof(st));
+    size_t new_size = buffer->size ? buffer->size : YAML_BUFFER_MIN;
+    while (new_size < size) {
+        new_size *= 2;
+    }
 
-    char *mbstr = calloc(len + 1, MB_CUR_MAX);
-    char *tmp = mbstr;
-    if (mbstr == NULL) {
+    /* nothing to preserve, so no need to realloc */
+    char *data = malloc(new_size);
+    if (!data) {
         LOG_ERR("failed to allocate data: %s\n", strerror(errno));
         return NULL;
     }
 
-    for(size_t i = 0; i < len; ++i, tmp += ret) {
-        ret = c16rtomb(tmp, data[i].c, &st);
-        if (ret < 0) {
+    free(buffer->data);
+    buffer->data = data;
+    buffer->size = new_size;
+
+    return data;
+}
+void yaml_scratch_free(yaml_scratch *scratch) {
+
+    free(scratch->name.data);
+    free(scratch->text.data);
+    memset(scratch, 0, sizeof(*scratch));
+}
+/* the hex string of size bytes, in the text buffer of scratch */
+static char *yaml_hex(yaml_scratch *scratch, uint8_t const *buf, size_t size) {
+
+    char *hexstr = yaml_buffer_get(&scratch->text,
+            BYTES_TO_HEX_STRING_SIZE(size));
+    if (!hexstr) {
+        return NULL;
+    }
+
+    bytes_to_str(buf, size, hexstr, BYTES_TO_HEX_STRING_SIZE(size));
+
+    return hexstr;
+}
+/*
+ * The multibyte string of the UTF-16 string, in the name buffer of scratch.
+ * The names in event logs are nearly always ASCII, which is copied as is,
+ * the conversion of the locale is only used from the first other character
+ * on.
+ */
+static char *yaml_utf16_to_str(UTF16_CHAR *data, size_t len,
+        yaml_scratch *scratch) {
+
+    char *mbstr = yaml_buffer_get(&scratch->name, len * MB_CUR_MAX + 1);
+    if (mbstr == NULL) {
+        return NULL;
+    }
+
+    size_t i = 0;
+    char *tmp = mbstr;
+    for(; i < len && data[i].c < 0x80; ++i) {
+        *tmp++ = (char)data[i].c;
+    }
+
+    mbstate_t st;
+    memset(&st, '\0', sizeof(st));
+
+    for(; i < len; ++i) {
+        size_t ret = c16rtomb(tmp, data[i].c, &st);
+        if (ret == (size_t)-1) {
             LOG_ERR("c16rtomb failed: %s", strerror(errno));
-            free(mbstr);
             return NULL;
         }
+        tmp += ret;
     }
+    *tmp = '\0';
+
     return mbstr;
 }
-#define VAR_DATA_HEX_SIZE(data) BYTES_TO_HEX_STRING_SIZE(data->VariableDataLength)
-static bool yaml_uefi_var_data(UEFI_VARIABLE_DATA *data) {
+static bool yaml_uefi_var_data(UEFI_VARIABLE_DATA *data,
+        yaml_scratch *scratch) {
 
     if (data->VariableDataLength == 0) {
         return true;
     }
 
-    char *var_data = calloc (1, VAR_DATA_HEX_SIZE(data));
     uint8_t *variable_data = (uint8_t*)&data->UnicodeName[
         data->UnicodeNameLength];
+    char *var_data = yaml_hex(scratch, variable_data,
+            data->VariableDataLength);
     if (var_data == NULL) {
-        LOG_ERR("failled to allocate data: %s\n", strerror(errno));
         return false;
     }
-    bytes_to_str(variable_data, data->VariableDataLength, var_data,
-                 VAR_DATA_HEX_SIZE(data));
 
     tpm2_tool_output("    VariableData: \"%s\"\n", var_data);
-    free(var_data);
 
     return true;
 }
@@ -231,44 +290,41 @@ static bool yaml_uefi_post_code(const TCG_EVENT2* const event) {
 }
 /*
  * Parses Device Path field using the efivar library if present, otherwise,
- * print the field in raw byte format
+ * print the field in raw byte format. The text is in the text buffer of
+ * scratch.
  */
+static char *yaml_devicepath(BYTE* dp, UINT64 dp_len, yaml_scratch *scratch) {
 #ifdef HAVE_EFIVAR_EFIVAR_H
-char *yaml_devicepath(BYTE* dp, UINT64 dp_len) {
-    int ret;
-    ret = efidp_format_device_path(NULL, 0, (const_efidp)dp, dp_len);
-    if (ret < 0) {
-        LOG_ERR("failed to allocate memory: %s\n", strerror(errno));
+    /* try the buffer as is first, most paths fit the buffer of the last */
+    char *text_path = yaml_buffer_get(&scratch->text, YAML_BUFFER_MIN);
+    if (!text_path) {
         return NULL;
     }
 
-    int text_path_len;
-    char *text_path;
-    text_path_len = ret + 1;
-    text_path = (char*)malloc(text_path_len);
-    if (!text_path) {
-        LOG_ERR("failed to allocate memory: %s\n", strerror(errno));
-        return NULL;
+    ssize_t ret = efidp_format_device_path(text_path, scratch->text.size,
+            (const_efidp)dp, dp_len);
+    if (ret >= 0 && (size_t)ret >= scratch->text.size) {
+        text_path = yaml_buffer_get(&scratch->text, ret + 1);
+        if (!text_path) {
+            return NULL;
+        }
+        ret = efidp_format_device_path(text_path, scratch->text.size,
+                (const_efidp)dp, dp_len);
     }
-  
-    ret = efidp_format_device_path(text_path,
-            text_path_len, (const_efidp)dp, dp_len);
-    if (ret < 0) {
-        free(text_path);
-        LOG_ERR("cannot parse device path\n");
-        return NULL;
+    if (ret >= 0) {
+        return text_path;
     }
-
-    return text_path; 
-}
 #endif
+    /* fallback to printing the raw bytes if devicepath cannot be parsed */
+    return yaml_hex(scratch, dp, dp_len);
+}
 /*
  * TCG PC Client FPF section 9.2.6
  * The tpm2_eventlog module validates the event structure but nothing within
  * the event data buffer so we must do that here.
  */
 static bool yaml_uefi_var(UEFI_VARIABLE_DATA *data, size_t size, UINT32 type,
-                          uint32_t eventlog_version) {
+                          uint32_t eventlog_version, yaml_scratch *scratch) {
 
     char uuidstr[37] = { 0 };
     size_t start = 0;
@@ -293,7 +349,8 @@ static bool yaml_uefi_var(UEFI_VARIABLE_DATA *data, size_t size, UINT32 type,
         return false;
     }
 
-    char *ret = yaml_utf16_to_str(data->UnicodeName, data->UnicodeNameLength);
+    char *ret = yaml_utf16_to_str(data->UnicodeName, data->UnicodeNameLength,
+            scratch);
     if (!ret) {
         return false;
     }
@@ -320,7 +377,6 @@ static bool yaml_uefi_var(UEFI_VARIABLE_DATA *data, size_t size, UINT32 type,
                 (strlen(ret) == 2 && strncmp(ret, "db", 2) == 0) ||
                 (strlen(ret) == 3 && strncmp(ret, "dbx", 3) == 0)) {
 
-                free(ret);
                 tpm2_tool_output("    VariableData:\n");
                 uint8_t *variable_data = (uint8_t *)&data->UnicodeName[
                     data->UnicodeNameLength];
@@ -367,19 +423,15 @@ static bool yaml_uefi_var(UEFI_VARIABLE_DATA *data, size_t size, UINT32 type,
                     int i;
                     for (i = 0; i < signatures; i++) {
                         EFI_SIGNATURE_DATA *s = (EFI_SIGNATURE_DATA *)signature;
-                        char *sdata = calloc (1,
-                            BYTES_TO_HEX_STRING_SIZE(slist->SignatureSize-16));
+                        char *sdata = yaml_hex(scratch, s->SignatureData,
+                            slist->SignatureSize-16);
                         if (sdata == NULL) {
-                            LOG_ERR("Failled to allocate data: %s\n", strerror(errno));
                             return false;
                         }
-                        bytes_to_str(s->SignatureData, slist->SignatureSize-16,
-                            sdata, BYTES_TO_HEX_STRING_SIZE(slist->SignatureSize-16));
                         guid_unparse_lower(s->SignatureOwner, uuidstr);
                         tpm2_tool_output("      - SignatureOwner: %s\n"
                                          "        SignatureData: %s\n",
                                          uuidstr, sdata);
-                        free(sdata);
 
                         signature += slist->SignatureSize;
                         start += slist->SignatureSize;
@@ -392,7 +444,6 @@ static bool yaml_uefi_var(UEFI_VARIABLE_DATA *data, size_t size, UINT32 type,
                 }
                 return true;
             } else if ((strlen(ret) == 10 && strncmp(ret, "SecureBoot", 10) == 0)) {
-                free(ret);
                 tpm2_tool_output("    VariableData:\n"
                                  "      Enabled: ");
                 if (data->VariableDataLength == 0) {
@@ -414,28 +465,22 @@ static bool yaml_uefi_var(UEFI_VARIABLE_DATA *data, size_t size, UINT32 type,
             }
             /* Other variables will be printed as a hex string */
         } else if (type == EV_EFI_VARIABLE_AUTHORITY) {
-            free(ret);
             tpm2_tool_output("    VariableData:\n");
             
             EFI_SIGNATURE_DATA *s= (EFI_SIGNATURE_DATA *)&data->UnicodeName[
                 data->UnicodeNameLength];
-            char *sdata = calloc (1,
-                BYTES_TO_HEX_STRING_SIZE(data->VariableDataLength - 16));
+            char *sdata = yaml_hex(scratch, s->SignatureData,
+                data->VariableDataLength - 16);
             if (sdata == NULL) {
-                LOG_ERR("Failled to allocate data: %s\n", strerror(errno));
                 return false;
             }
-            bytes_to_str(s->SignatureData, data->VariableDataLength - 16,
-                sdata, BYTES_TO_HEX_STRING_SIZE(data->VariableDataLength - 16));
             guid_unparse_lower(s->SignatureOwner, uuidstr);
             tpm2_tool_output("    - SignatureOwner: %s\n"
                              "      SignatureData: %s\n",
                              uuidstr, sdata);
-            free(sdata);
             return true;
         } else if (type == EV_EFI_VARIABLE_BOOT) {
             if ((strlen(ret) == 9 && strncmp(ret, "BootOrder", 9) == 0)) {
-                free(ret);
                 tpm2_tool_output("    VariableData:\n");
                 
                 if (data->VariableDataLength % 2 != 0) {
@@ -457,7 +502,6 @@ static bool yaml_uefi_var(UEFI_VARIABLE_DATA *data, size_t size, UINT32 type,
                 isxdigit((int)ret[4]) && isxdigit((int)ret[5]) &&
                 isxdigit((int)ret[6]) && isxdigit((int)ret[7])) {
 
-                free(ret);
                 tpm2_tool_output("    VariableData:\n"
                                  "      Enabled: ");
                 EFI_LOAD_OPTION *loadopt = (EFI_LOAD_OPTION*)&data->UnicodeName[
@@ -481,40 +525,21 @@ static bool yaml_uefi_var(UEFI_VARIABLE_DATA *data, size_t size, UINT32 type,
                 tpm2_tool_output("\"\n");
 
                 uint8_t *devpath = (uint8_t*)&loadopt->Description[++i];
-                size_t devpath_len =  (data->VariableDataLength -
-                    sizeof(EFI_LOAD_OPTION) - sizeof(UINT16) * i) * 2 + 1;
+                size_t devpath_len = data->VariableDataLength -
+                    sizeof(EFI_LOAD_OPTION) - sizeof(UINT16) * i;
 
-                char *buf = calloc(1, devpath_len);
-                if (!buf) {
-                    LOG_ERR("failed to allocate memory: %s\n", strerror(errno));
+                char *dp = yaml_devicepath(devpath, devpath_len, scratch);
+                if (!dp) {
                     return false;
                 }
-
-#ifdef HAVE_EFIVAR_EFIVAR_H
-                char *dp = yaml_devicepath(devpath, devpath_len);
-                if (dp) {
-                    tpm2_tool_output("      DevicePath: '%s'\n", dp);
-                    free(dp);
-                } else {
-                    /* fallback to printing the raw bytes if devicepath cannot be parsed */
-                    bytes_to_str(devpath, data->VariableDataLength -
-                        sizeof(EFI_LOAD_OPTION) - sizeof(UINT16) * i, buf, devpath_len);
-                    tpm2_tool_output("      DevicePath: '%s'\n", buf);
-                }
-#else
-                bytes_to_str(devpath, data->VariableDataLength -
-                    sizeof(EFI_LOAD_OPTION) - sizeof(UINT16) * i, buf, devpath_len);
-                tpm2_tool_output("      DevicePath: '%s'\n", buf);
-#endif
-                free(buf);
+                tpm2_tool_output("      DevicePath: '%s'\n", dp);
                 return true;
             }
         }
         /* Other event types will be printed as a hex string */
     }
 
-    free(ret);
-    return yaml_uefi_var_data(data);
+    return yaml_uefi_var_data(data, scratch);
 }
 /* TCG PC Client FPF section 9.2.5 */
 bool yaml_uefi_platfwblob(UEFI_PLATFORM_FIRMWARE_BLOB *data) {
@@ -560,14 +585,8 @@ bool yaml_ipl(UINT8 const *description, size_t size) {
     return true;
 }
 /* TCG PC Client PFP section 9.2.3 */
-bool yaml_uefi_image_load(UEFI_IMAGE_LOAD_EVENT *data, size_t size) {
-
-    size_t devpath_len = (size - sizeof(*data)) * 2 + 1;
-    char *buf = calloc(1, devpath_len);
-    if (!buf) {
-        LOG_ERR("failed to allocate memory: %s\n", strerror(errno));
-        return false;
-    }
+bool yaml_uefi_image_load(UEFI_IMAGE_LOAD_EVENT *data, size_t size,
+        yaml_scratch *scratch) {
 
     tpm2_tool_output("  Event:\n"
                      "    ImageLocationInMemory: 0x%" PRIx64 "\n"
@@ -577,27 +596,19 @@ bool yaml_uefi_image_load(UEFI_IMAGE_LOAD_EVENT *data, size_t size) {
                      data->ImageLocationInMemory, data->ImageLengthInMemory,
                      data->ImageLinkTimeAddress, data->LengthOfDevicePath);
 
-#ifdef HAVE_EFIVAR_EFIVAR_H
-    char *dp = yaml_devicepath(data->DevicePath, data->LengthOfDevicePath); 
-    if (dp) {
-        tpm2_tool_output("    DevicePath: '%s'\n", dp);
-        free(dp);
-    } else {
-        /* fallback to printing the raw bytes if devicepath cannot be parsed */
-        bytes_to_str(data->DevicePath, size - sizeof(*data), buf, devpath_len);
-        tpm2_tool_output("    DevicePath: '%s'\n", buf);
+    char *dp = yaml_devicepath(data->DevicePath, size - sizeof(*data),
+            scratch);
+    if (!dp) {
+        return false;
     }
-#else
-    bytes_to_str(data->DevicePath, size - sizeof(*data), buf, devpath_len);
-    tpm2_tool_output("    DevicePath: '%s'\n", buf);
-#endif
+    tpm2_tool_output("    DevicePath: '%s'\n", dp);
 
-    free(buf);
     return true;
 }
 #define EVENT_BUF_MAX BYTES_TO_HEX_STRING_SIZE(1024)
 /* TCG PC Client PFP section 9.2.6 */
-bool yaml_gpt(UEFI_GPT_DATA *data, size_t size, uint32_t eventlog_version) {
+bool yaml_gpt(UEFI_GPT_DATA *data, size_t size, uint32_t eventlog_version,
+        yaml_scratch *scratch) {
 
     if (size < sizeof(*data)) {
         LOG_ERR("EventSize(%zu) is too small\n", size);
@@ -656,7 +667,11 @@ bool yaml_gpt(UEFI_GPT_DATA *data, size_t size, uint32_t eventlog_version) {
             tpm2_tool_output("    - PartitionTypeGUID: %s\n", guid);
             guid_unparse_lower(partition->UniquePartitionGUID, guid);
             size_t len = sizeof(partition->PartitionName) / sizeof(UTF16_CHAR);
-            char *part_name = yaml_utf16_to_str(partition->PartitionName, len);
+            char *part_name = yaml_utf16_to_str(partition->PartitionName, len,
+                    scratch);
+            if (!part_name) {
+                return false;
+            }
             tpm2_tool_output("      UniquePartitionGUID: %s\n"
                              "      StartingLBA: 0x%" PRIx64 "\n"
                              "      EndingLBA: 0x%" PRIx64 "\n"
@@ -667,7 +682,6 @@ bool yaml_gpt(UEFI_GPT_DATA *data, size_t size, uint32_t eventlog_version) {
                              partition->EndingLBA,
                              partition->Attributes,
                              part_name);
-            free(part_name);
             size -= sizeof(*partition);
         }
 
@@ -700,7 +714,8 @@ bool yaml_no_action(EV_NO_ACTION_STRUCT *data, size_t size, uint32_t eventlog_ve
     return true;
 }
 
-bool yaml_event2data(TCG_EVENT2 const *event, UINT32 type, uint32_t eventlog_version) {
+static bool yaml_event2data_scratch(TCG_EVENT2 const *event, UINT32 type,
+        uint32_t eventlog_version, yaml_scratch *scratch) {
 
     char hexstr[EVENT_BUF_MAX] = { 0, };
 
@@ -715,7 +730,8 @@ bool yaml_event2data(TCG_EVENT2 const *event, UINT32 type, uint32_t eventlog_ver
     case EV_EFI_VARIABLE_BOOT:
     case EV_EFI_VARIABLE_AUTHORITY:
         return yaml_uefi_var((UEFI_VARIABLE_DATA*)event->Event,
-                                event->EventSize, type, eventlog_version);
+                                event->EventSize, type, eventlog_version,
+                                scratch);
     case EV_POST_CODE:
         return yaml_uefi_post_code(event);
     case EV_S_CRTM_CONTENTS:
@@ -729,10 +745,10 @@ bool yaml_event2data(TCG_EVENT2 const *event, UINT32 type, uint32_t eventlog_ver
     case EV_EFI_BOOT_SERVICES_DRIVER:
     case EV_EFI_RUNTIME_SERVICES_DRIVER:
         return yaml_uefi_image_load((UEFI_IMAGE_LOAD_EVENT*)event->Event,
-                                    event->EventSize);
+                                    event->EventSize, scratch);
     case EV_EFI_GPT_EVENT:
         return yaml_gpt((UEFI_GPT_DATA*)event->Event,
-                        event->EventSize, eventlog_version);
+                        event->EventSize, eventlog_version, scratch);
     case EV_NO_ACTION:
         return yaml_no_action((EV_NO_ACTION_STRUCT*)event->Event, event->EventSize, eventlog_version);
     default:
@@ -741,12 +757,25 @@ bool yaml_event2data(TCG_EVENT2 const *event, UINT32 type, uint32_t eventlog_ver
         return true;
     }
 }
+bool yaml_event2data(TCG_EVENT2 const *event, UINT32 type, uint32_t eventlog_version) {
+
+    yaml_scratch scratch = { 0 };
+    bool result = yaml_event2data_scratch(event, type, eventlog_version,
+            &scratch);
+    yaml_scratch_free(&scratch);
+
+    return result;
+}
 bool yaml_event2data_callback(TCG_EVENT2 const *event, UINT32 type,
                               void *data, uint32_t eventlog_version) {
 
-    (void)data;
+    yaml_eventlog_state *state = (yaml_eventlog_state*)data;
+    if (!state) {
+        return yaml_event2data(event, type, eventlog_version);
+    }
 
-    return yaml_event2data(event, type, eventlog_version);
+    return yaml_event2data_scratch(event, type, eventlog_version,
+            &state->scratch);
 }
 bool yaml_digest2_callback(TCG_DIGEST2 const *digest, size_t size,
                             void *data_in) {
@@ -843,22 +872,16 @@ void yaml_specid_algs(TCG_SPECID_ALG const *alg, size_t count) {
 }
 bool yaml_specid_vendor(TCG_VENDOR_INFO *vendor) {
 
-    char *vendinfo_str;
+    /* vendorInfoSize is a byte, so the string always fits the stack */
+    char vendinfo_str[BYTES_TO_HEX_STRING_SIZE(UINT8_MAX)] = { 0, };
 
     tpm2_tool_output("    vendorInfoSize: %" PRIu8 "\n", vendor->vendorInfoSize);
     if (vendor->vendorInfoSize == 0) {
         return true;
     }
-    vendinfo_str = calloc(1, vendor->vendorInfoSize * 2 + 1);
-    if (vendinfo_str == NULL) {
-        LOG_ERR("failed to allocate memory for vendorInfo: %s\n",
-                strerror(errno));
-        return false;
-    }
     bytes_to_str(vendor->vendorInfo, vendor->vendorInfoSize, vendinfo_str,
-                 vendor->vendorInfoSize * 2 + 1);
+                 sizeof(vendinfo_str));
     tpm2_tool_output("    vendorInfo: \"%s\"\n", vendinfo_str);
-    free(vendinfo_str);
     return true;
 }
 bool yaml_specid_event(TCG_EVENT const *event, size_t *count) {
@@ -942,15 +965,21 @@ static void yaml_eventlog_pcrs(tpm2_eventlog_context *ctx) {
 
 bool yaml_eventlog(UINT8 const *eventlog, size_t size, uint32_t eventlog_version) {
 
+    return yaml_eventlog_checkpoint(eventlog, size, eventlog_version, NULL);
+}
+
+bool yaml_eventlog_checkpoint(UINT8 const *eventlog, size_t size,
+        uint32_t eventlog_version, const char *checkpoint_path) {
+
     if (eventlog_version < MIN_EVLOG_YAML_VERSION || 
         eventlog_version > MAX_EVLOG_YAML_VERSION) {
         LOG_ERR("Unexpected YAML version number: %u\n", eventlog_version);
         return false;
     }
 
-    size_t count = 0;
+    yaml_eventlog_state state = { 0 };
     tpm2_eventlog_context ctx = {
-        .data = &count,
+        .data = &state,
         .specid_cb = yaml_specid_callback,
         .event2hdr_cb = yaml_event2hdr_callback,
         .log_eventhdr_cb = yaml_sha1_log_eventhdr_callback,
@@ -959,10 +988,68 @@ bool yaml_eventlog(UINT8 const *eventlog, size_t size, uint32_t eventlog_version
         .eventlog_version = eventlog_version,
     };
 
+    /* only the events appended since the checkpoint are output */
+    if (checkpoint_path && files_does_file_exist(checkpoint_path)) {
+        bool result = tpm2_eventlog_checkpoint_load(&ctx, checkpoint_path);
+        if (!result) {
+            return false;
+        }
+
+        if (tpm2_eventlog_checkpoint_matches(&ctx, eventlog, size)) {
+            state.count = ctx.event_count;
+        } else {
+            LOG_WARN("Event log does not continue checkpoint \"%s\", "
+                    "replaying it from the start", checkpoint_path);
+            tpm2_eventlog_checkpoint_reset(&ctx);
+        }
+    }
+
     tpm2_tool_output("---\n");
     tpm2_tool_output("version: %u\n", eventlog_version);
     tpm2_tool_output("events:\n");
     bool rc = parse_eventlog(&ctx, eventlog, size);
+    yaml_scratch_free(&state.scratch);
+    if (!rc) {
+        return rc;
+    }
+
+    if (checkpoint_path) {
+        rc = tpm2_eventlog_checkpoint_save(&ctx, eventlog, checkpoint_path);
+        if (!rc) {
+            return rc;
+        }
+    }
+
+    yaml_eventlog_pcrs(&ctx);
+    return true;
+}
+
+bool yaml_eventlog_index(UINT8 const *eventlog, size_t size,
+        uint32_t eventlog_version, tpm2_eventlog_index const *index,
+        tpm2_eventlog_filter const *filter) {
+
+    if (eventlog_version < MIN_EVLOG_YAML_VERSION ||
+        eventlog_version > MAX_EVLOG_YAML_VERSION) {
+        LOG_ERR("Unexpected YAML version number: %u\n", eventlog_version);
+        return false;
+    }
+
+    yaml_eventlog_state state = { 0 };
+    tpm2_eventlog_context ctx = {
+        .data = &state,
+        .specid_cb = yaml_specid_callback,
+        .event2hdr_cb = yaml_event2hdr_callback,
+        .log_eventhdr_cb = yaml_sha1_log_eventhdr_callback,
+        .digest2_cb = yaml_digest2_callback,
+        .event2_cb = yaml_event2data_callback,
+        .eventlog_version = eventlog_version,
+    };
+
+    tpm2_tool_output("---\n");
+    tpm2_tool_output("version: %u\n", eventlog_version);
+    tpm2_tool_output("events:\n");
+    bool rc = parse_eventlog_index(&ctx, eventlog, size, index, filter);
+    yaml_scratch_free(&state.scratch);
     if (!rc) {
         return rc;
     }
@@ -11,6 +11,37 @@
 #define MIN_EVLOG_YAML_VERSION 1
 #define MAX_EVLOG_YAML_VERSION 2
 
+typedef struct yaml_buffer yaml_buffer;
+struct yaml_buffer {
+    char *data;
+    size_t size;
+};
+
+/*
+ * The buffers the decoded strings of the event bodies are output from. They
+ * are reused for every event and only grow, so once they fit the largest
+ * event of a log the output allocates no more memory.
+ */
+typedef struct yaml_scratch yaml_scratch;
+struct yaml_scratch {
+    /* the decoded UTF-16 names */
+    yaml_buffer name;
+    /* the hex strings and device paths */
+    yaml_buffer text;
+};
+
+void yaml_scratch_free(yaml_scratch *scratch);
+
+/*
+ * The data of the YAML callbacks. The event counter the library expects
+ * ctx->data to point at comes first.
+ */
+typedef struct yaml_eventlog_state yaml_eventlog_state;
+struct yaml_eventlog_state {
+    size_t count;
+    yaml_scratch scratch;
+};
+
 char const *eventtype_to_string (UINT32 event_type);
 void yaml_event2hdr(TCG_EVENT_HEADER2 const *event_hdr, size_t size);
 bool yaml_digest2(TCG_DIGEST2 const *digest, size_t size);
@@ -22,5 +53,19 @@ bool yaml_event2data_callback(TCG_EVENT2 const *event, UINT32 type, void *data,
                               uint32_t eventlog_version);
 
 bool yaml_eventlog(UINT8 const *eventlog, size_t size, uint32_t eventlog_version);
+/*
+ * Like yaml_eventlog(), but resumes from the checkpoint at checkpoint_path if
+ * it exists and the log continues it, then saves the new replay position to
+ * it.
+ */
+bool yaml_eventlog_checkpoint(UINT8 const *eventlog, size_t size,
+        uint32_t eventlog_version, const char *checkpoint_path);
+/*
+ * Like yaml_eventlog(), but outputs only the indexed events matching filter,
+ * and the PCR values of the PCRs they extend.
+ */
+bool yaml_eventlog_index(UINT8 const *eventlog, size_t size,
+        uint32_t eventlog_version, tpm2_eventlog_index const *index,
+        tpm2_eventlog_filter const *filter);
 
 #endif
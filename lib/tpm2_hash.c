@@ -1,34 +1,243 @@
 /* SPDX-License-Identifier: BSD-3-Clause */
 
+#include <errno.h>
+#include <fcntl.h>
 #include <stdbool.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
 #include "files.h"
 #include "log.h"
 #include "tpm2.h"
+#include "tpm2_capability.h"
 #include "tpm2_hash.h"
+#include "tpm2_openssl.h"
+#include "tpm2_pipeline.h"
+#include "tpm2_util.h"
+
+/* read size for host side hashing, not bound to TPM2_MAX_DIGEST_BUFFER */
+#define HOST_HASH_CHUNK_SIZE (16 * 1024)
+
+/*
+ * Computes the digest with OpenSSL. Used when the caller does not need a
+ * validation ticket, which only the TPM can produce. Returns
+ * tool_rc_unsupported without consuming any input when OpenSSL doesn't
+ * know the algorithm, so the caller can fall back to the TPM.
+ */
+static tool_rc tpm2_hash_host(TPMI_ALG_HASH halg, FILE *infilep,
+        BYTE *inbuffer, UINT16 inbuffer_len, TPM2B_DIGEST **result) {
+
+    const EVP_MD *md = tpm2_openssl_halg_from_tpmhalg(halg);
+    if (!md) {
+        return tool_rc_unsupported;
+    }
+
+    EVP_MD_CTX *mdctx = tpm2_openssl_md_ctx_get();
+    if (!mdctx) {
+        return tool_rc_general_error;
+    }
+
+    tool_rc rc = tool_rc_general_error;
+    TPM2B_DIGEST *digest = NULL;
+
+    int ok = EVP_DigestInit_ex(mdctx, md, NULL);
+    if (!ok) {
+        LOG_ERR("%s", tpm2_openssl_get_err());
+        goto out;
+    }
+
+    if (infilep) {
+        /* regular files are hashed straight from the mapping */
+        files_input input;
+        files_input_open_file(&input, infilep);
+
+        const UINT8 *chunk;
+        size_t chunk_size;
+        do {
+            bool result = files_input_next(&input, HOST_HASH_CHUNK_SIZE,
+                    &chunk, &chunk_size);
+            if (!result) {
+                files_input_close(&input);
+                goto out;
+            }
+
+            ok = EVP_DigestUpdate(mdctx, chunk, chunk_size);
+            if (!ok) {
+                LOG_ERR("%s", tpm2_openssl_get_err());
+                files_input_close(&input);
+                goto out;
+            }
+        } while (chunk_size);
+
+        files_input_close(&input);
+    } else {
+        ok = EVP_DigestUpdate(mdctx, inbuffer, inbuffer_len);
+        if (!ok) {
+            LOG_ERR("%s", tpm2_openssl_get_err());
+            goto out;
+        }
+    }
+
+    digest = calloc(1, sizeof(*digest));
+    if (!digest) {
+        LOG_ERR("oom");
+        goto out;
+    }
+
+    unsigned size = EVP_MD_size(md);
+    ok = EVP_DigestFinal_ex(mdctx, digest->buffer, &size);
+    if (!ok) {
+        LOG_ERR("%s", tpm2_openssl_get_err());
+        free(digest);
+        goto out;
+    }
+
+    digest->size = size;
+    *result = digest;
+    rc = tool_rc_success;
+
+out:
+    tpm2_openssl_md_ctx_put(mdctx);
+
+    return rc;
+}
+
+/*
+ * Fills the buffer with a chunk of data, stopping short only at the end of
+ * input. This is the only copy of the data on its way to the TPM, streams
+ * are read straight into the buffer.
+ */
+static bool read_chunk(files_input *input, UINT16 chunk_size,
+        TPM2B_MAX_BUFFER *buffer) {
+
+    size_t size;
+    bool result = files_input_read(input, buffer->buffer, chunk_size, &size);
+    buffer->size = size;
+
+    return result;
+}
+
+typedef struct sequence_feed sequence_feed;
+struct sequence_feed {
+    files_input in;
+    UINT16 chunk_size;
+    ESYS_TR sequence_handle;
+    ESYS_TR shandle;
+    /* the chunk at the TPM, and the one read while it works on it */
+    TPM2B_MAX_BUFFER *cur;
+    TPM2B_MAX_BUFFER *next;
+    bool is_read;
+};
+
+/*
+ * Only a short chunk marks the end of input, it goes with the sequence
+ * complete. Every full one is sent as an update, when the input ends on a
+ * chunk boundary the complete is sent with an empty buffer.
+ */
+static tool_rc sequence_feed_prepare(void *userdata, bool *is_next) {
+
+    sequence_feed *feed = (sequence_feed *) userdata;
+
+    if (!feed->is_read) {
+        if (!read_chunk(&feed->in, feed->chunk_size, feed->next)) {
+            return tool_rc_general_error;
+        }
+        feed->is_read = true;
+    }
+
+    *is_next = feed->next->size == feed->chunk_size;
+
+    return tool_rc_success;
+}
+
+static tool_rc sequence_feed_submit(ESYS_CONTEXT *ectx, void *userdata) {
+
+    sequence_feed *feed = (sequence_feed *) userdata;
+
+    TPM2B_MAX_BUFFER *tmp = feed->cur;
+    feed->cur = feed->next;
+    feed->next = tmp;
+    feed->is_read = false;
+
+    return tpm2_sequence_update_async(ectx, feed->sequence_handle,
+            feed->shandle, feed->cur);
+}
+
+static tool_rc sequence_feed_finish(ESYS_CONTEXT *ectx, void *userdata) {
+
+    UNUSED(userdata);
+
+    return tpm2_sequence_update_finish(ectx);
+}
+
+tool_rc tpm2_hash_sequence_feed(ESYS_CONTEXT *ectx, ESYS_TR sequence_handle,
+        ESYS_TR shandle, FILE *input, TPM2B_MAX_BUFFER *last) {
+
+    static const tpm2_pipeline_ops ops = {
+        .prepare = sequence_feed_prepare,
+        .submit = sequence_feed_submit,
+        .finish = sequence_feed_finish,
+    };
+
+    /*
+     * Double buffered: while the TPM works on the update of one buffer, the
+     * next one is read from the input. The chunk read last is held back and
+     * returned for the sequence complete call, last is one of the buffers so
+     * it is only copied when the count of chunks is even.
+     */
+    TPM2B_MAX_BUFFER buffer;
+    sequence_feed feed = {
+        .chunk_size = tpm2_capability_max_buffer_size(ectx),
+        .sequence_handle = sequence_handle,
+        .shandle = shandle,
+        .cur = &buffer,
+        .next = last,
+    };
+
+    files_input_open_file(&feed.in, input);
+
+    tool_rc rc = tpm2_pipeline_run(ectx, &ops, &feed);
+    if (rc == tool_rc_success && feed.next != last) {
+        last->size = feed.next->size;
+        memcpy(last->buffer, feed.next->buffer, feed.next->size);
+    }
+
+    files_input_close(&feed.in);
+
+    return rc;
+}
 
 static tool_rc tpm2_hash_common(ESYS_CONTEXT *ectx, TPMI_ALG_HASH halg,
         TPMI_RH_HIERARCHY hierarchy, FILE *infilep, BYTE *inbuffer,
         UINT16 inbuffer_len, TPM2B_DIGEST **result,
         TPMT_TK_HASHCHECK **validation) {
-    bool use_left = true, done;
+    bool use_left = true;
     unsigned long left = inbuffer_len;
-    size_t bytes_read;
     TPM2B_AUTH null_auth = TPM2B_EMPTY_INIT;
     TPMI_DH_OBJECT sequence_handle;
     TPM2B_MAX_BUFFER buffer;
 
+    /* only the TPM can produce a ticket, anything else is done on the host */
+    if (!validation) {
+        tool_rc rc = tpm2_hash_host(halg, infilep, inbuffer, inbuffer_len,
+                result);
+        if (rc != tool_rc_unsupported) {
+            return rc;
+        }
+        LOG_INFO("Hash algorithm 0x%x not supported by OpenSSL, hashing with "
+                "the TPM", halg);
+    }
+
     /*  if we're using infilep, get file size */
     if (!!infilep) {
         /* Suppress error reporting with NULL path */
         use_left = files_get_file_size(infilep, &left, NULL);
     }
 
-    /* if data length is non-zero (valid) and less than 1024, just do it in one
-     hash invocation */
-    if (use_left && left <= TPM2_MAX_DIGEST_BUFFER) {
+    /* if the data fits in a chunk, just do it in one hash invocation */
+    UINT16 chunk_size = tpm2_capability_max_buffer_size(ectx);
+    if (use_left && left <= chunk_size) {
         buffer.size = left;
         if (!!infilep) {
             bool res = files_read_bytes(infilep, buffer.buffer, buffer.size);
@@ -53,60 +262,33 @@ static tool_rc tpm2_hash_common(ESYS_CONTEXT *ectx, TPMI_ALG_HASH halg,
         return rc;
     }
 
-    /* If we know the file size, we decrement the amount read and terminate
-     * the loop when 1 block is left, else we go till feof.
-     */
-    done = false;
-    while (!done) {
-        /*  if we're using infilep, read the file. Otherwise, directly
-         copy into our local buffer. */
-        buffer.size = BUFFER_SIZE(typeof(buffer), buffer);
-        if (!!infilep) {
-            bytes_read = fread(buffer.buffer, 1, buffer.size, infilep);
-            if (ferror(infilep)) {
-                LOG_ERR("Error reading from input file");
-                return tool_rc_general_error;
-            } else {
-                buffer.size = bytes_read;
-            }
-        } else {
-            memcpy(buffer.buffer, inbuffer, buffer.size);
-            inbuffer = inbuffer + buffer.size;
-        }
-
-        rc = tpm2_sequence_update(ectx, sequence_handle, &buffer);
+    if (!!infilep) {
+        rc = tpm2_hash_sequence_feed(ectx, sequence_handle, ESYS_TR_PASSWORD,
+                infilep, &buffer);
         if (rc != tool_rc_success) {
             return rc;
         }
 
-        if (use_left) {
-            left -= buffer.size;
-            if (left <= TPM2_MAX_DIGEST_BUFFER) {
-                done = true;
-                continue;
-            }
-        } else if (!!infilep && feof(infilep)) {
-            done = true;
-        }
-    } /* end file read/hash update loop */
+        return tpm2_sequence_complete(ectx, sequence_handle, &buffer,
+                hierarchy, result, validation);
+    }
 
-    /*  if there is data left, get the last bit of data from the file or
-     buffer or set the size to zero */
-    if (use_left) {
-        buffer.size = left;
-        if (!!infilep) {
-            bool res = files_read_bytes(infilep, buffer.buffer, buffer.size);
-            if (!res) {
-                LOG_ERR("Error reading from input file.");
-                return tool_rc_general_error;
-            }
-        } else {
-            memcpy(buffer.buffer, inbuffer, buffer.size);
+    /* We know the buffer size, send all but the last block as updates */
+    while (left > chunk_size) {
+        buffer.size = chunk_size;
+        memcpy(buffer.buffer, inbuffer, buffer.size);
+        inbuffer = inbuffer + buffer.size;
+        left -= buffer.size;
+
+        rc = tpm2_sequence_update(ectx, sequence_handle, &buffer);
+        if (rc != tool_rc_success) {
+            return rc;
         }
-    } else {
-        buffer.size = 0;
     }
 
+    buffer.size = left;
+    memcpy(buffer.buffer, inbuffer, buffer.size);
+
     return tpm2_sequence_complete(ectx, sequence_handle,
             &buffer, hierarchy, result, validation);
 }
@@ -134,3 +316,121 @@ tool_rc tpm2_hash_file(ESYS_CONTEXT *ectx, TPMI_ALG_HASH halg,
     return tpm2_hash_common(ectx, halg, hierarchy, input, NULL, 0, result,
         validation);
 }
+
+typedef struct hash_files hash_files;
+struct hash_files {
+    char **paths;
+    size_t count;
+    size_t index;
+    FILE *list;
+};
+
+/* the next path, to free(), NULL at the end or on error */
+static char *hash_files_next(hash_files *files, bool *is_error) {
+
+    if (files->paths) {
+        if (files->index == files->count) {
+            return NULL;
+        }
+
+        char *path = strdup(files->paths[files->index++]);
+        if (!path) {
+            LOG_ERR("oom");
+            *is_error = true;
+        }
+
+        return path;
+    }
+
+    char *path = NULL;
+    size_t size = 0;
+    ssize_t len;
+    /* empty entries, as of a trailing NUL, are skipped */
+    while ((len = getdelim(&path, &size, '\0', files->list)) == 1
+            && !path[0]) {
+    }
+
+    if (len < 0) {
+        if (ferror(files->list)) {
+            LOG_ERR("Could not read the list of files, error: %s",
+                    strerror(errno));
+            *is_error = true;
+        }
+        free(path);
+        return NULL;
+    }
+
+    if (path[len - 1] == '\0') {
+        path[len - 1] = '\0';
+    }
+
+    return path;
+}
+
+static FILE *hash_files_open(const char *path) {
+
+    FILE *f = files_fopen(path, "rb");
+    if (!f) {
+        LOG_ERR("Could not open input file \"%s\", error: %s", path,
+                strerror(errno));
+        return NULL;
+    }
+
+    /* read ahead while the previous file is hashed, a hint only */
+    posix_fadvise(fileno(f), 0, 0, POSIX_FADV_WILLNEED);
+
+    return f;
+}
+
+tool_rc tpm2_hash_files(ESYS_CONTEXT *ectx, char **paths, size_t count,
+        FILE *list, FILE *out, tpm2_hash_files_cb cb, void *userdata) {
+
+    hash_files files = {
+        .paths = paths,
+        .count = count,
+        .list = list,
+    };
+
+    bool is_error = false;
+    char *path = hash_files_next(&files, &is_error);
+    FILE *input = path ? hash_files_open(path) : NULL;
+
+    tool_rc rc = tool_rc_success;
+    while (path) {
+
+        char *next_path = hash_files_next(&files, &is_error);
+        FILE *next_input = next_path ? hash_files_open(next_path) : NULL;
+
+        if (!input) {
+            is_error = true;
+        } else {
+            TPM2B_DIGEST *digest = NULL;
+            rc = cb(ectx, input, &digest, userdata);
+            fclose(input);
+            if (rc == tool_rc_success && out) {
+                tpm2_util_hexdump2(out, digest->buffer, digest->size);
+                fprintf(out, "  %s\n", path);
+            }
+            free(digest);
+        }
+
+        free(path);
+        path = next_path;
+        input = next_input;
+
+        if (rc != tool_rc_success) {
+            break;
+        }
+    }
+
+    if (input) {
+        fclose(input);
+    }
+    free(path);
+
+    if (rc == tool_rc_success && (is_error || (out && fflush(out)))) {
+        rc = tool_rc_general_error;
+    }
+
+    return rc;
+}
@@ -4,11 +4,14 @@
 #define SRC_TPM_HASH_H_
 
 #include <stdbool.h>
+#include <stdio.h>
 
 #include <tss2/tss2_esys.h>
 
+#include "tool_rc.h"
+
 /**
- * Hashes a BYTE array via the tpm.
+ * Hashes a BYTE array via the tpm or the host.
  * @param context
  *  The esapi context.
  * @param hash_alg
@@ -23,7 +26,9 @@
  *  The digest result.
  * @param validation
  *  The validation ticket. Note that some hierarchies don't produce a
- *  validation ticket and thus size will be 0.
+ *  validation ticket and thus size will be 0. When NULL, no ticket is
+ *  needed and the digest is computed on the host, falling back to the tpm
+ *  only for algorithms the host does not support.
  * @return
  *  A tool_rc indicating status.
  */
@@ -32,7 +37,7 @@ tool_rc tpm2_hash_compute_data(ESYS_CONTEXT *context, TPMI_ALG_HASH halg,
         TPM2B_DIGEST **result, TPMT_TK_HASHCHECK **validation);
 
 /**
- * Hashes a FILE * object via the tpm.
+ * Hashes a FILE * object via the tpm or the host.
  * @param context
  *  The esapi context.
  * @param hash_alg
@@ -45,7 +50,9 @@ tool_rc tpm2_hash_compute_data(ESYS_CONTEXT *context, TPMI_ALG_HASH halg,
  *  The digest result.
  * @param validation
  *  The validation ticket. Note that some hierarchies don't produce a
- *  validation ticket and thus size will be 0.
+ *  validation ticket and thus size will be 0. When NULL, no ticket is
+ *  needed and the digest is computed on the host, falling back to the tpm
+ *  only for algorithms the host does not support.
  * @return
  *  A tool_rc indicating status.
  */
@@ -53,4 +60,67 @@ tool_rc tpm2_hash_file(ESYS_CONTEXT *ectx, TPMI_ALG_HASH halg,
         TPMI_RH_HIERARCHY hierarchy, FILE *input, TPM2B_DIGEST **result,
         TPMT_TK_HASHCHECK **validation);
 
+/**
+ * Feeds a FILE * object into a started hash or HMAC sequence. Reading the
+ * next chunk from the file overlaps with the TPM processing the update of
+ * the previous one.
+ * @param ectx
+ *  The esapi context.
+ * @param sequence_handle
+ *  The handle of the started sequence.
+ * @param shandle
+ *  The session handle authorizing the sequence updates.
+ * @param input
+ *  The FILE object to read until EOF.
+ * @param last
+ *  The final chunk of input, not sent to the TPM and to be passed to the
+ *  sequence complete call. Might be empty.
+ * @return
+ *  A tool_rc indicating status.
+ */
+tool_rc tpm2_hash_sequence_feed(ESYS_CONTEXT *ectx, ESYS_TR sequence_handle,
+        ESYS_TR shandle, FILE *input, TPM2B_MAX_BUFFER *last);
+
+/**
+ * Computes the digest of one of the files of tpm2_hash_files().
+ * @param ectx
+ *  The esapi context.
+ * @param input
+ *  The file to read until EOF.
+ * @param result
+ *  The digest result.
+ * @param userdata
+ *  The userdata passed to tpm2_hash_files().
+ * @return
+ *  A tool_rc indicating status.
+ */
+typedef tool_rc (*tpm2_hash_files_cb)(ESYS_CONTEXT *ectx, FILE *input,
+        TPM2B_DIGEST **result, void *userdata);
+
+/**
+ * Computes the digest of many files and writes a "<hex digest>  <path>" line
+ * per file, like sha256sum. While the digest of a file is computed, the next
+ * file is opened and the kernel asked to read it ahead. A file that can't be
+ * opened is reported and skipped, an error of the callback stops at that
+ * file.
+ * @param ectx
+ *  The esapi context.
+ * @param paths
+ *  The paths of the files, NULL to read them from list.
+ * @param count
+ *  The count of paths.
+ * @param list
+ *  A stream of NUL separated paths, used when paths is NULL.
+ * @param out
+ *  The stream to write the lines to, NULL for none.
+ * @param cb
+ *  Computes the digest of a file.
+ * @param userdata
+ *  Passed to the callback.
+ * @return
+ *  A tool_rc indicating status, an error when any file was skipped.
+ */
+tool_rc tpm2_hash_files(ESYS_CONTEXT *ectx, char **paths, size_t count,
+        FILE *list, FILE *out, tpm2_hash_files_cb cb, void *userdata);
+
 #endif /* SRC_TPM_HASH_H_ */
@@ -0,0 +1,129 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "log.h"
+#include "tpm2_hex.h"
+#include "tpm2_tool_output.h"
+
+/* the bytes encoded one at a time into stdio */
+#define HEX_PRINT_CHUNK 256
+
+/* the two digits of every byte value, so encoding is one copy per byte */
+static const char hex_pairs_lower[] =
+    "000102030405060708090a0b0c0d0e0f101112131415161718191a1b1c1d1e1f"
+    "202122232425262728292a2b2c2d2e2f303132333435363738393a3b3c3d3e3f"
+    "404142434445464748494a4b4c4d4e4f505152535455565758595a5b5c5d5e5f"
+    "606162636465666768696a6b6c6d6e6f707172737475767778797a7b7c7d7e7f"
+    "808182838485868788898a8b8c8d8e8f909192939495969798999a9b9c9d9e9f"
+    "a0a1a2a3a4a5a6a7a8a9aaabacadaeafb0b1b2b3b4b5b6b7b8b9babbbcbdbebf"
+    "c0c1c2c3c4c5c6c7c8c9cacbcccdcecfd0d1d2d3d4d5d6d7d8d9dadbdcdddedf"
+    "e0e1e2e3e4e5e6e7e8e9eaebecedeeeff0f1f2f3f4f5f6f7f8f9fafbfcfdfeff";
+
+static const char hex_pairs_upper[] =
+    "000102030405060708090A0B0C0D0E0F101112131415161718191A1B1C1D1E1F"
+    "202122232425262728292A2B2C2D2E2F303132333435363738393A3B3C3D3E3F"
+    "404142434445464748494A4B4C4D4E4F505152535455565758595A5B5C5D5E5F"
+    "606162636465666768696A6B6C6D6E6F707172737475767778797A7B7C7D7E7F"
+    "808182838485868788898A8B8C8D8E8F909192939495969798999A9B9C9D9E9F"
+    "A0A1A2A3A4A5A6A7A8A9AAABACADAEAFB0B1B2B3B4B5B6B7B8B9BABBBCBDBEBF"
+    "C0C1C2C3C4C5C6C7C8C9CACBCCCDCECFD0D1D2D3D4D5D6D7D8D9DADBDCDDDEDF"
+    "E0E1E2E3E4E5E6E7E8E9EAEBECEDEEEFF0F1F2F3F4F5F6F7F8F9FAFBFCFDFEFF";
+
+/* the value of every hex digit and -1 for all other characters */
+static const signed char hex_values[256] = {
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+     0,  1,  2,  3,  4,  5,  6,  7,  8,  9, -1, -1, -1, -1, -1, -1,
+    -1, 10, 11, 12, 13, 14, 15, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, 10, 11, 12, 13, 14, 15, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+};
+
+size_t tpm2_hex_encode(const BYTE *data, size_t len, char *hex,
+        bool is_upper) {
+
+    const char *pairs = is_upper ? hex_pairs_upper : hex_pairs_lower;
+
+    size_t i;
+    for (i = 0; i < len; i++) {
+        memcpy(&hex[2 * i], &pairs[2 * data[i]], 2);
+    }
+    hex[2 * len] = '\0';
+
+    return 2 * len;
+}
+
+char *tpm2_hex_encode_alloc(const BYTE *data, size_t len, bool is_upper) {
+
+    char *hex = malloc(TPM2_HEX_SIZE(len));
+    if (!hex) {
+        LOG_ERR("oom");
+        return NULL;
+    }
+
+    tpm2_hex_encode(data, len, hex, is_upper);
+
+    return hex;
+}
+
+bool tpm2_hex_decode(const char *hex, size_t hex_len, BYTE *data) {
+
+    if (hex_len % 2) {
+        return false;
+    }
+
+    size_t i;
+    for (i = 0; i < hex_len; i += 2) {
+        int high = hex_values[(unsigned char) hex[i]];
+        int low = hex_values[(unsigned char) hex[i + 1]];
+        /* either one being -1 makes the or negative */
+        if ((high | low) < 0) {
+            return false;
+        }
+
+        if (data) {
+            data[i / 2] = high << 4 | low;
+        }
+    }
+
+    return true;
+}
+
+bool tpm2_hex_fprint(FILE *f, const BYTE *data, size_t len, bool is_upper) {
+
+    char hex[TPM2_HEX_SIZE(HEX_PRINT_CHUNK)];
+
+    while (len) {
+        size_t chunk = len < HEX_PRINT_CHUNK ? len : HEX_PRINT_CHUNK;
+        size_t hex_len = tpm2_hex_encode(data, chunk, hex, is_upper);
+        if (fwrite(hex, 1, hex_len, f) != hex_len) {
+            return false;
+        }
+
+        data += chunk;
+        len -= chunk;
+    }
+
+    return true;
+}
+
+void tpm2_hex_print(const BYTE *data, size_t len, bool is_upper) {
+
+    if (!output_enabled) {
+        return;
+    }
+
+    tpm2_hex_fprint(stdout, data, len, is_upper);
+}
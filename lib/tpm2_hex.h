@@ -0,0 +1,85 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+#ifndef LIB_TPM2_HEX_H_
+#define LIB_TPM2_HEX_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+
+#include <tss2/tss2_tpm2_types.h>
+
+/* the size of the buffer holding the hex string of len bytes */
+#define TPM2_HEX_SIZE(len) (2 * (len) + 1)
+
+/**
+ * Encodes bytes as a hex string.
+ * @param data
+ *  The bytes to encode.
+ * @param len
+ *  The number of bytes.
+ * @param hex
+ *  Receives the NUL terminated hex string, at least TPM2_HEX_SIZE(len)
+ *  bytes.
+ * @param is_upper
+ *  True for upper case digits, false for lower case ones.
+ * @return
+ *  The length of the hex string, ie 2 * len.
+ */
+size_t tpm2_hex_encode(const BYTE *data, size_t len, char *hex,
+        bool is_upper);
+
+/**
+ * Like tpm2_hex_encode(), but returns the hex string in a buffer of its
+ * own.
+ * @param data
+ *  The bytes to encode.
+ * @param len
+ *  The number of bytes.
+ * @param is_upper
+ *  True for upper case digits, false for lower case ones.
+ * @return
+ *  The hex string to free(), NULL on failure.
+ */
+char *tpm2_hex_encode_alloc(const BYTE *data, size_t len, bool is_upper);
+
+/**
+ * Decodes a hex string of either case without a "0x" prefix.
+ * @param hex
+ *  The hex string, need not be NUL terminated.
+ * @param hex_len
+ *  The number of characters to decode.
+ * @param data
+ *  Receives hex_len / 2 bytes or NULL to only validate the string.
+ * @return
+ *  True on success, false if hex_len is odd or a character is no hex digit.
+ */
+bool tpm2_hex_decode(const char *hex, size_t hex_len, BYTE *data);
+
+/**
+ * Writes bytes as a hex string to a stream, without a trailing newline.
+ * @param f
+ *  The stream.
+ * @param data
+ *  The bytes to write.
+ * @param len
+ *  The number of bytes.
+ * @param is_upper
+ *  True for upper case digits, false for lower case ones.
+ * @return
+ *  True on success, false on a write error.
+ */
+bool tpm2_hex_fprint(FILE *f, const BYTE *data, size_t len, bool is_upper);
+
+/**
+ * Like tpm2_hex_fprint() to stdout, but respecting the -Q option.
+ * @param data
+ *  The bytes to write.
+ * @param len
+ *  The number of bytes.
+ * @param is_upper
+ *  True for upper case digits, false for lower case ones.
+ */
+void tpm2_hex_print(const BYTE *data, size_t len, bool is_upper);
+
+#endif /* LIB_TPM2_HEX_H_ */
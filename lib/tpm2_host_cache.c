@@ -0,0 +1,504 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "log.h"
+#include "tpm2_host_cache.h"
+#include "tpm2_util.h"
+
+/* "TPHC" */
+#define HOST_CACHE_MAGIC 0x54504843
+#define HOST_CACHE_VERSION 2
+
+#define HOST_CACHE_SLOTS 64
+
+/* the reads a reader retries while writers keep changing the cache */
+#define HOST_CACHE_RETRIES 16
+
+typedef struct host_cache_slot host_cache_slot;
+struct host_cache_slot {
+    /* a tpm2_host_cache_kind, 0 for a free slot */
+    UINT32 kind;
+    UINT32 generation;
+    UINT32 tag;
+    UINT16 key_size;
+    UINT16 value_size;
+    /* the replacement order, the slot with the lowest stamp goes first */
+    UINT64 stamp;
+    UINT8 key[TPM2_HOST_CACHE_KEY_MAX];
+    UINT8 value[TPM2_HOST_CACHE_VALUE_MAX];
+};
+
+typedef struct host_cache_header host_cache_header;
+struct host_cache_header {
+    UINT32 magic;
+    UINT32 version;
+    UINT32 slot_count;
+    UINT32 slot_size;
+    char boot_id[TPM2_UTIL_BOOT_ID_LEN];
+    /* the TPM the entries were read from */
+    tpm2_capability_identity identity;
+    /* odd while a writer changes the slots */
+    UINT32 seq;
+    /* bumped by the tools that change the handles or hierarchies */
+    UINT32 generation;
+    UINT64 stamp;
+};
+
+typedef struct host_cache_map host_cache_map;
+struct host_cache_map {
+    host_cache_header header;
+    host_cache_slot slots[HOST_CACHE_SLOTS];
+};
+
+/*
+ * The mapping of this process. A forked child maps the file anew, as an
+ * flock() of the inherited descriptor would not exclude the parent.
+ */
+static struct {
+    bool is_opened;
+    bool is_writer;
+    bool is_writable;
+    bool is_invalidated;
+    bool is_identified;
+    pid_t pid;
+    int fd;
+    host_cache_map *map;
+    char boot_id[TPM2_UTIL_BOOT_ID_LEN];
+    tpm2_capability_identity identity;
+} cache = {
+    .fd = -1,
+};
+
+static void cache_close(void) {
+
+    if (cache.map) {
+        munmap(cache.map, sizeof(*cache.map));
+        cache.map = NULL;
+    }
+
+    if (cache.fd >= 0) {
+        close(cache.fd);
+        cache.fd = -1;
+    }
+
+    cache.is_opened = false;
+    cache.is_writable = false;
+}
+
+/*
+ * Creates the file with an empty cache under a temporary name and links it
+ * into place, so a concurrent tool never maps a file smaller than the cache.
+ */
+static int cache_create(const char *path) {
+
+    char tmp_path[PATH_MAX];
+    int len = snprintf(tmp_path, sizeof(tmp_path), "%s.%ld", path,
+            (long) getpid());
+    if (len < 0 || (size_t) len >= sizeof(tmp_path)) {
+        LOG_WARN("Host cache path \"%s\" is too long", path);
+        return -1;
+    }
+
+    /* every tool reads the cache, only its owner writes it */
+    int fd = open(tmp_path, O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+    if (fd < 0 || fchmod(fd, 0644)) {
+        LOG_WARN("Could not create host cache \"%s\", error: %s", tmp_path,
+                strerror(errno));
+        if (fd >= 0) {
+            close(fd);
+            unlink(tmp_path);
+        }
+        return -1;
+    }
+
+    host_cache_header header = {
+        .magic = HOST_CACHE_MAGIC,
+        .version = HOST_CACHE_VERSION,
+        .slot_count = HOST_CACHE_SLOTS,
+        .slot_size = sizeof(host_cache_slot),
+    };
+    memcpy(header.boot_id, cache.boot_id, sizeof(header.boot_id));
+    header.identity = cache.identity;
+
+    bool result = !ftruncate(fd, sizeof(host_cache_map))
+            && pwrite(fd, &header, sizeof(header), 0) == sizeof(header);
+    if (!result) {
+        LOG_WARN("Could not write host cache \"%s\", error: %s", tmp_path,
+                strerror(errno));
+        close(fd);
+        unlink(tmp_path);
+        return -1;
+    }
+
+    /* another writer may have been first, its cache is taken then */
+    if (link(tmp_path, path)) {
+        close(fd);
+        fd = errno == EEXIST ? open(path, O_RDWR | O_CLOEXEC) : -1;
+    }
+    unlink(tmp_path);
+
+    return fd;
+}
+
+/*
+ * The answers are used without asking the TPM, so only a file no other user
+ * could have written is trusted: one not writable by the group or others,
+ * owned by root, by this user, or by the owner of a directory only its owner
+ * can add files to, ie the one of tpm2_serve.
+ */
+static bool cache_is_trusted(const char *path, const struct stat *st) {
+
+    if (st->st_mode & (S_IWGRP | S_IWOTH)) {
+        return false;
+    }
+
+    if (st->st_uid == 0 || st->st_uid == geteuid()) {
+        return true;
+    }
+
+    char dir[PATH_MAX];
+    snprintf(dir, sizeof(dir), "%s", path);
+    char *slash = strrchr(dir, '/');
+    if (!slash) {
+        snprintf(dir, sizeof(dir), ".");
+    } else if (slash == dir) {
+        slash[1] = '\0';
+    } else {
+        slash[0] = '\0';
+    }
+
+    struct stat dir_st;
+    return !stat(dir, &dir_st) && dir_st.st_uid == st->st_uid
+            && !(dir_st.st_mode & (S_IWGRP | S_IWOTH));
+}
+
+static host_cache_map *cache_map(void) {
+
+    if (cache.is_opened && cache.pid != getpid()) {
+        cache_close();
+    }
+
+    if (cache.is_opened) {
+        return cache.map;
+    }
+    cache.is_opened = true;
+    cache.pid = getpid();
+
+    const char *path = tpm2_util_getenv(TPM2TOOLS_ENV_HOST_CACHE);
+    if (!path || !path[0]) {
+        return NULL;
+    }
+
+    if (!tpm2_util_get_boot_id(cache.boot_id)) {
+        LOG_WARN("Could not read the boot id, not using the host cache");
+        return NULL;
+    }
+
+    /* only the writers open the cache for writing, ie it may be root's */
+    int fd = open(path, (cache.is_writer ? O_RDWR : O_RDONLY) | O_CLOEXEC);
+    if (fd < 0 && errno == ENOENT && cache.is_writer) {
+        fd = cache_create(path);
+    }
+
+    if (fd < 0) {
+        if (errno != ENOENT) {
+            LOG_WARN("Could not open host cache \"%s\", error: %s", path,
+                    strerror(errno));
+        }
+        return NULL;
+    }
+    cache.fd = fd;
+
+    struct stat st;
+    if (fstat(fd, &st) || st.st_size != sizeof(host_cache_map)) {
+        LOG_WARN("Ignoring the host cache \"%s\" of another layout", path);
+        cache_close();
+        cache.is_opened = true;
+        return NULL;
+    }
+
+    if (!S_ISREG(st.st_mode) || !cache_is_trusted(path, &st)) {
+        LOG_WARN("Ignoring the host cache \"%s\" other users could write",
+                path);
+        cache_close();
+        cache.is_opened = true;
+        return NULL;
+    }
+
+    /* a writer does not fill the cache of another user */
+    cache.is_writable = cache.is_writer && st.st_uid == geteuid();
+
+    void *map = mmap(NULL, sizeof(host_cache_map),
+            PROT_READ | (cache.is_writable ? PROT_WRITE : 0), MAP_SHARED, fd,
+            0);
+    if (map == MAP_FAILED) {
+        LOG_WARN("Could not map host cache \"%s\", error: %s", path,
+                strerror(errno));
+        cache_close();
+        cache.is_opened = true;
+        return NULL;
+    }
+    cache.map = map;
+
+    const host_cache_header *header = &cache.map->header;
+    if (header->magic != HOST_CACHE_MAGIC
+            || header->version != HOST_CACHE_VERSION
+            || header->slot_count != HOST_CACHE_SLOTS
+            || header->slot_size != sizeof(host_cache_slot)) {
+        LOG_WARN("Ignoring the host cache \"%s\" of another layout", path);
+        cache_close();
+        cache.is_opened = true;
+        return NULL;
+    }
+
+    return cache.map;
+}
+
+void tpm2_host_cache_enable_writes(void) {
+
+    cache.is_writer = true;
+
+    /* a cache that was missing may be created now */
+    if (cache.is_opened && !cache.map) {
+        cache.is_opened = false;
+    }
+}
+
+bool tpm2_host_cache_is_writer(void) {
+
+    return cache.is_writer;
+}
+
+void tpm2_host_cache_set_identity(const tpm2_capability_identity *identity) {
+
+    cache.identity = *identity;
+    cache.is_identified = true;
+}
+
+bool tpm2_host_cache_identify(ESYS_CONTEXT *ectx) {
+
+    if (cache.is_identified) {
+        return true;
+    }
+
+    /* no need to ask the TPM without a cache */
+    const char *path = tpm2_util_getenv(TPM2TOOLS_ENV_HOST_CACHE);
+    if (!path || !path[0]) {
+        return false;
+    }
+
+    tpm2_capability_identity identity;
+    tool_rc rc = tpm2_capability_identity_get(ectx, &identity);
+    if (rc != tool_rc_success) {
+        return false;
+    }
+
+    tpm2_host_cache_set_identity(&identity);
+
+    return true;
+}
+
+UINT32 tpm2_host_cache_generation(void) {
+
+    host_cache_map *map = cache_map();
+
+    return map ? __atomic_load_n(&map->header.generation, __ATOMIC_ACQUIRE) :
+            0;
+}
+
+/* copies the slot of a key out, the caller checks the sequence number */
+static bool slots_find(const host_cache_map *map, tpm2_host_cache_kind kind,
+        const UINT8 *key, size_t key_size, UINT8 *value, size_t *value_size,
+        UINT32 *tag) {
+
+    const host_cache_header *header = &map->header;
+    if (memcmp(header->boot_id, cache.boot_id, sizeof(cache.boot_id))
+            || memcmp(&header->identity, &cache.identity,
+                    sizeof(cache.identity))) {
+        return false;
+    }
+
+    UINT32 generation = __atomic_load_n(&header->generation,
+            __ATOMIC_RELAXED);
+
+    size_t i;
+    for (i = 0; i < ARRAY_LEN(map->slots); i++) {
+        const host_cache_slot *slot = &map->slots[i];
+        if (slot->kind != (UINT32) kind || slot->key_size != key_size
+                || slot->generation != generation
+                || memcmp(slot->key, key, key_size)) {
+            continue;
+        }
+
+        /* a torn slot is retried with the sequence number */
+        size_t size = slot->value_size;
+        if (size > sizeof(slot->value)) {
+            return false;
+        }
+
+        memcpy(value, slot->value, size);
+        *value_size = size;
+        if (tag) {
+            *tag = slot->tag;
+        }
+
+        return true;
+    }
+
+    return false;
+}
+
+bool tpm2_host_cache_get(tpm2_host_cache_kind kind, const UINT8 *key,
+        size_t key_size, UINT8 *value, size_t *value_size, UINT32 *tag) {
+
+    if (!cache.is_identified) {
+        return false;
+    }
+
+    host_cache_map *map = cache_map();
+    if (!map || key_size > TPM2_HOST_CACHE_KEY_MAX) {
+        return false;
+    }
+
+    unsigned i;
+    for (i = 0; i < HOST_CACHE_RETRIES; i++) {
+        UINT32 seq = __atomic_load_n(&map->header.seq, __ATOMIC_ACQUIRE);
+        if (seq & 1) {
+            sched_yield();
+            continue;
+        }
+
+        bool result = slots_find(map, kind, key, key_size, value, value_size,
+                tag);
+
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&map->header.seq, __ATOMIC_RELAXED) == seq) {
+            return result;
+        }
+    }
+
+    return false;
+}
+
+static host_cache_slot *slots_choose(host_cache_map *map,
+        tpm2_host_cache_kind kind, const UINT8 *key, size_t key_size) {
+
+    host_cache_slot *oldest = &map->slots[0];
+
+    size_t i;
+    for (i = 0; i < ARRAY_LEN(map->slots); i++) {
+        host_cache_slot *slot = &map->slots[i];
+        if (slot->kind == (UINT32) kind && slot->key_size == key_size
+                && !memcmp(slot->key, key, key_size)) {
+            return slot;
+        }
+
+        if (!oldest->kind) {
+            continue;
+        }
+
+        if (!slot->kind || slot->stamp < oldest->stamp) {
+            oldest = slot;
+        }
+    }
+
+    return oldest;
+}
+
+void tpm2_host_cache_put(tpm2_host_cache_kind kind, const UINT8 *key,
+        size_t key_size, const UINT8 *value, size_t value_size, UINT32 tag,
+        UINT32 generation) {
+
+    if (!cache.is_writer || !cache.is_identified
+            || key_size > TPM2_HOST_CACHE_KEY_MAX
+            || value_size > TPM2_HOST_CACHE_VALUE_MAX) {
+        return;
+    }
+
+    host_cache_map *map = cache_map();
+    if (!map || !cache.is_writable || flock(cache.fd, LOCK_EX)) {
+        return;
+    }
+
+    host_cache_header *header = &map->header;
+    if (__atomic_load_n(&header->generation, __ATOMIC_ACQUIRE) != generation) {
+        goto out;
+    }
+
+    /* a writer that died while changing the slots left the sequence odd */
+    UINT32 seq = header->seq;
+    bool is_torn = seq & 1;
+    if (!is_torn) {
+        __atomic_store_n(&header->seq, ++seq, __ATOMIC_RELAXED);
+    }
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+    /* the entries of another boot or TPM are dropped */
+    if (is_torn
+            || memcmp(header->boot_id, cache.boot_id, sizeof(cache.boot_id))
+            || memcmp(&header->identity, &cache.identity,
+                    sizeof(cache.identity))) {
+        size_t i;
+        for (i = 0; i < ARRAY_LEN(map->slots); i++) {
+            map->slots[i].kind = 0;
+        }
+        memcpy(header->boot_id, cache.boot_id, sizeof(cache.boot_id));
+        header->identity = cache.identity;
+    }
+
+    host_cache_slot *slot = slots_choose(map, kind, key, key_size);
+    slot->kind = kind;
+    slot->generation = generation;
+    slot->tag = tag;
+    slot->key_size = key_size;
+    slot->value_size = value_size;
+    slot->stamp = ++header->stamp;
+    memcpy(slot->key, key, key_size);
+    memcpy(slot->value, value, value_size);
+
+    __atomic_store_n(&header->seq, seq + 1, __ATOMIC_RELEASE);
+
+out:
+    flock(cache.fd, LOCK_UN);
+}
+
+static void generation_bump(void) {
+
+    /*
+     * Only the writers bump the generation. The cache keeps nothing the
+     * commands of the other tools change: no handles, no public areas, and
+     * the PCR values are checked with the update counter.
+     */
+    host_cache_map *map = cache_map();
+    if (!map || !cache.is_writable) {
+        return;
+    }
+
+    __atomic_add_fetch(&map->header.generation, 1, __ATOMIC_SEQ_CST);
+}
+
+void tpm2_host_cache_invalidate(void) {
+
+    generation_bump();
+    cache.is_invalidated = true;
+}
+
+void tpm2_host_cache_finish(void) {
+
+    if (cache.is_invalidated) {
+        generation_bump();
+        cache.is_invalidated = false;
+    }
+}
@@ -0,0 +1,152 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+#ifndef LIB_TPM2_HOST_CACHE_H_
+#define LIB_TPM2_HOST_CACHE_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include <tss2/tss2_esys.h>
+
+#include "tool_rc.h"
+#include "tpm2_capability.h"
+
+/*
+ * Environment variable naming a file, ie in /dev/shm, mapped as a cache of
+ * TPM facts shared by all tools on the host.
+ */
+#define TPM2TOOLS_ENV_HOST_CACHE "TPM2TOOLS_HOST_CACHE"
+
+/*
+ * The host cache keeps the answers of the TPM that many independent tools ask
+ * for again and again, the PCR banks and other fixed capabilities and the PCR
+ * values, in a file every tool maps shared. tpm2_serve and the tools it runs
+ * fill it, every other tool only reads it, without locking, so a reader never
+ * waits for a writer or another reader. The file is created 0644 by
+ * tpm2_serve, the other tools open it read only and ignore a file other users
+ * could have written.
+ *
+ * The file is laid out as a header and a fixed number of slots, in the byte
+ * order of the host, versioned by the layout. A writer takes an flock() to
+ * exclude other writers and makes the sequence number of the header odd while
+ * it changes a slot. A reader copies a slot out and retries when the sequence
+ * number was odd or changed meanwhile.
+ *
+ * Entries are tied to the boot, which a firmware update or a PCR allocation
+ * takes effect with, and to the identity of the TPM, and carry the generation
+ * of the header they were read at. The writers that change the TPM bump the
+ * generation before and after the command, invalidating all entries. The PCR
+ * values carry the pcrUpdateCounter they were read at as their tag, the
+ * caller reads the counter anew to check.
+ *
+ * The handles and the public areas of objects are not kept: they change with
+ * the commands of any tool, and the TPM would have to confirm them anyway.
+ */
+
+typedef enum tpm2_host_cache_kind tpm2_host_cache_kind;
+enum tpm2_host_cache_kind {
+    tpm2_host_cache_kind_capability = 1,
+    tpm2_host_cache_kind_pcrs = 2,
+};
+
+/* the largest key and value of an entry */
+#define TPM2_HOST_CACHE_KEY_MAX 256
+#define TPM2_HOST_CACHE_VALUE_MAX 8192
+
+/**
+ * Makes this process and the tools it forks writers of the host cache, ie
+ * tpm2_serve.
+ */
+void tpm2_host_cache_enable_writes(void);
+
+/**
+ * Tells if this process adds entries to the host cache, so the answers that
+ * needed more checks than reading them are only checked by writers.
+ * @return
+ *  True after tpm2_host_cache_enable_writes(), false otherwise.
+ */
+bool tpm2_host_cache_is_writer(void);
+
+/**
+ * Ties the host cache to the TPM of an identity, the entries of other TPMs
+ * are not used. Without an identity the cache is neither read nor written.
+ * @param identity
+ *  The identity of the TPM.
+ */
+void tpm2_host_cache_set_identity(const tpm2_capability_identity *identity);
+
+/**
+ * Reads the identity of the TPM for tpm2_host_cache_set_identity() when
+ * TPM2TOOLS_HOST_CACHE is set, once per process.
+ * @param ectx
+ *  Enhanced System API (ESAPI) context
+ * @return
+ *  True when the host cache can be used, false otherwise.
+ */
+bool tpm2_host_cache_identify(ESYS_CONTEXT *ectx);
+
+/**
+ * Gets the generation of the host cache, to pass to tpm2_host_cache_put()
+ * for an answer read from the TPM after the call.
+ * @return
+ *  The generation, 0 without the cache.
+ */
+UINT32 tpm2_host_cache_generation(void);
+
+/**
+ * Looks up an entry in the host cache named by TPM2TOOLS_HOST_CACHE.
+ * @param kind
+ *  The kind of the entry.
+ * @param key
+ *  The key of the entry.
+ * @param key_size
+ *  The size of the key, at most TPM2_HOST_CACHE_KEY_MAX.
+ * @param value
+ *  Receives the value, of at most TPM2_HOST_CACHE_VALUE_MAX bytes.
+ * @param value_size
+ *  Receives the size of the value.
+ * @param tag
+ *  Receives the tag of the entry, NULL if not needed.
+ * @return
+ *  True on a hit, false without the environment variable or on a miss.
+ */
+bool tpm2_host_cache_get(tpm2_host_cache_kind kind, const UINT8 *key,
+        size_t key_size, UINT8 *value, size_t *value_size, UINT32 *tag);
+
+/**
+ * Adds an entry to the host cache, replacing the entry of the key or the
+ * oldest one. Does nothing in a process that is not a writer or when the
+ * generation changed since the answer was read.
+ * @param kind
+ *  The kind of the entry.
+ * @param key
+ *  The key of the entry.
+ * @param key_size
+ *  The size of the key, at most TPM2_HOST_CACHE_KEY_MAX.
+ * @param value
+ *  The value, of at most TPM2_HOST_CACHE_VALUE_MAX bytes.
+ * @param value_size
+ *  The size of the value.
+ * @param tag
+ *  The tag of the entry, ie the pcrUpdateCounter of PCR values.
+ * @param generation
+ *  The generation from tpm2_host_cache_generation() before the TPM was asked.
+ */
+void tpm2_host_cache_put(tpm2_host_cache_kind kind, const UINT8 *key,
+        size_t key_size, const UINT8 *value, size_t value_size, UINT32 tag,
+        UINT32 generation);
+
+/**
+ * Invalidates all entries of the host cache, before a command that changes
+ * the handles or hierarchies of the TPM. The generation is bumped again when
+ * the tool finishes, so an answer read while the command ran is not kept.
+ */
+void tpm2_host_cache_invalidate(void);
+
+/**
+ * Bumps the generation again after a tool invalidated the host cache, called
+ * once the tool finished.
+ */
+void tpm2_host_cache_finish(void);
+
+#endif /* LIB_TPM2_HOST_CACHE_H_ */
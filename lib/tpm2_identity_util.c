@@ -6,6 +6,7 @@
 
 #include <tss2/tss2_mu.h>
 
+#include <openssl/crypto.h>
 #include <openssl/rand.h>
 
 #include "log.h"
@@ -14,9 +15,24 @@
 #include "tpm2_kdfa.h"
 #include "tpm2_kdfe.h"
 #include "tpm2_openssl.h"
+#include "tpm2_util.h"
+#include "tpm2_work_pool.h"
 
 // Identity-related functionality that the TPM normally does, but using OpenSSL
 
+struct tpm2_identity_util_parent {
+    TPM2B_PUBLIC public;
+    /* the OpenSSL key of the parent, one of them is set */
+    RSA *rsa;
+    EC_POINT *point;
+};
+
+struct tpm2_identity_util_wrapper {
+    EVP_CIPHER_CTX *cipher;
+    HMAC_CTX *hmac;
+    tpm2_kdfa_ctx *kdfa;
+};
+
 #if defined(LIBRESSL_VERSION_NUMBER)
 static int RSA_padding_add_PKCS1_OAEP_mgf1(unsigned char *to, int tlen,
         const unsigned char *from, int flen, const unsigned char *param, int plen,
@@ -98,23 +114,55 @@ static TPM2_KEY_BITS get_pub_asym_key_bits(TPM2B_PUBLIC *public) {
     return 0;
 }
 
-static bool share_secret_with_tpm2_rsa_public_key(TPM2B_DIGEST *protection_seed,
-        TPM2B_PUBLIC *parent_pub, const unsigned char *label, int label_len,
-        TPM2B_ENCRYPTED_SECRET *encrypted_protection_seed) {
-    bool rval = false;
-    RSA *rsa = NULL;
+static RSA *rsa_from_tpm2_public(TPM2B_PUBLIC *parent_pub) {
 
-    // Public modulus (RSA-only!)
     TPMI_RSA_KEY_BITS mod_size_bits =
             parent_pub->publicArea.parameters.rsaDetail.keyBits;
     UINT16 mod_size = mod_size_bits / 8;
     TPM2B *pub_key_val = (TPM2B *) &parent_pub->publicArea.unique.rsa;
-    unsigned char *pub_modulus = malloc(mod_size);
-    if (pub_modulus == NULL) {
-        LOG_ERR("Failed to allocate memory to store public key's modulus.");
-        return false;
+    if (mod_size > pub_key_val->size) {
+        LOG_ERR("RSA public modulus is too short, got %u bytes, expected %u",
+                pub_key_val->size, mod_size);
+        return NULL;
+    }
+
+    RSA *rsa = RSA_new();
+    BIGNUM *n = BN_bin2bn(pub_key_val->buffer, mod_size, NULL);
+    BIGNUM *e = BN_new();
+    if (!rsa || !n || !e) {
+        LOG_ERR("oom");
+        goto error;
+    }
+
+    /* like the TPM for an exponent of 0, the default exponent */
+    int return_code = BN_set_word(e, RSA_F4);
+    if (return_code != 1) {
+        LOG_ERR("BN_set_word failed\n");
+        goto error;
+    }
+
+    if (!RSA_set0_key(rsa, n, e, NULL)) {
+        LOG_ERR("RSA_set0_key failed\n");
+        goto error;
     }
-    memcpy(pub_modulus, pub_key_val->buffer, mod_size);
+
+    return rsa;
+
+error:
+    BN_free(n);
+    BN_free(e);
+    RSA_free(rsa);
+    return NULL;
+}
+
+static bool share_secret_with_tpm2_rsa_public_key(RSA *rsa,
+        TPM2B_DIGEST *protection_seed, TPM2B_PUBLIC *parent_pub,
+        const unsigned char *label, int label_len,
+        TPM2B_ENCRYPTED_SECRET *encrypted_protection_seed) {
+
+    TPMI_RSA_KEY_BITS mod_size_bits =
+            parent_pub->publicArea.parameters.rsaDetail.keyBits;
+    UINT16 mod_size = mod_size_bits / 8;
 
     TPMI_ALG_HASH parent_name_alg = parent_pub->publicArea.nameAlg;
 
@@ -125,7 +173,7 @@ static bool share_secret_with_tpm2_rsa_public_key(TPM2B_DIGEST *protection_seed,
     int return_code = RAND_bytes(protection_seed->buffer, protection_seed->size);
     if (return_code != 1) {
         LOG_ERR("Failed to get random bytes");
-        goto error;
+        return false;
     }
 
     /*
@@ -137,61 +185,26 @@ static bool share_secret_with_tpm2_rsa_public_key(TPM2B_DIGEST *protection_seed,
             tpm2_openssl_halg_from_tpmhalg(parent_name_alg), NULL);
     if (return_code != 1) {
         LOG_ERR("Failed RSA_padding_add_PKCS1_OAEP_mgf1\n");
-        goto error;
-    }
-    BIGNUM* bne = BN_new();
-    if (!bne) {
-        LOG_ERR("BN_new for bne failed\n");
-        goto error;
-    }
-    return_code = BN_set_word(bne, RSA_F4);
-    if (return_code != 1) {
-        LOG_ERR("BN_set_word failed\n");
-        BN_free(bne);
-        goto error;
-    }
-    rsa = RSA_new();
-    if (!rsa) {
-        LOG_ERR("RSA_new failed\n");
-        BN_free(bne);
-        goto error;
-    }
-    return_code = RSA_generate_key_ex(rsa, mod_size_bits, bne, NULL);
-    BN_free(bne);
-    if (return_code != 1) {
-        LOG_ERR("RSA_generate_key_ex failed\n");
-        goto error;
-    }
-    BIGNUM *n = BN_bin2bn(pub_modulus, mod_size, NULL);
-    if (n == NULL) {
-        LOG_ERR("BN_bin2bn failed\n");
-        goto error;
-    }
-    if (!RSA_set0_key(rsa, n, NULL, NULL)) {
-        LOG_ERR("RSA_set0_key failed\n");
-        BN_free(n);
-        goto error;
+        return false;
     }
+
     // Encrypting
     encrypted_protection_seed->size = mod_size;
     return_code = RSA_public_encrypt(mod_size, encoded,
             encrypted_protection_seed->secret, rsa, RSA_NO_PADDING);
+    OPENSSL_cleanse(encoded, sizeof(encoded));
     if (return_code < 0) {
         LOG_ERR("Failed RSA_public_encrypt\n");
-        goto error;
+        return false;
     }
 
-    rval = true;
-
-error:
-    free(pub_modulus);
-    RSA_free(rsa);
-    return rval;
+    return true;
 }
 
-bool tpm2_identity_util_calc_outer_integrity_hmac_key_and_dupsensitive_enc_key(
-        TPM2B_PUBLIC *parent_pub, TPM2B_NAME *pubname,
-        TPM2B_DIGEST *protection_seed, TPM2B_MAX_BUFFER *protection_hmac_key,
+/* both keys derive from the seed, which keys the KDFa context once */
+static bool calc_protection_keys(tpm2_kdfa_ctx *kdfa, TPM2B_PUBLIC *parent_pub,
+        TPM2B_NAME *pubname, TPM2B_DIGEST *protection_seed,
+        TPM2B_MAX_BUFFER *protection_hmac_key,
         TPM2B_MAX_BUFFER *protection_enc_key) {
 
     TPM2B null_2b = { .size = 0 };
@@ -199,16 +212,22 @@ bool tpm2_identity_util_calc_outer_integrity_hmac_key_and_dupsensitive_enc_key(
     TPMI_ALG_HASH parent_alg = parent_pub->publicArea.nameAlg;
     UINT16 parent_hash_size = tpm2_alg_util_get_hash_size(parent_alg);
 
-    TSS2_RC rval = tpm2_kdfa(parent_alg, (TPM2B *) protection_seed, "INTEGRITY",
-            &null_2b, &null_2b, parent_hash_size * 8, protection_hmac_key);
+    TSS2_RC rval = tpm2_kdfa_ctx_init(kdfa, parent_alg,
+            (TPM2B *) protection_seed);
+    if (rval != TPM2_RC_SUCCESS) {
+        return false;
+    }
+
+    rval = tpm2_kdfa_ctx_derive(kdfa, "INTEGRITY", &null_2b, &null_2b,
+            parent_hash_size * 8, protection_hmac_key);
     if (rval != TPM2_RC_SUCCESS) {
         return false;
     }
 
     TPM2_KEY_BITS pub_key_bits = get_pub_asym_key_bits(parent_pub);
 
-    rval = tpm2_kdfa(parent_alg, (TPM2B *) protection_seed, "STORAGE",
-            (TPM2B *) pubname, &null_2b, pub_key_bits, protection_enc_key);
+    rval = tpm2_kdfa_ctx_derive(kdfa, "STORAGE", (TPM2B *) pubname, &null_2b,
+            pub_key_bits, protection_enc_key);
     if (rval != TPM2_RC_SUCCESS) {
         return false;
     }
@@ -216,29 +235,104 @@ bool tpm2_identity_util_calc_outer_integrity_hmac_key_and_dupsensitive_enc_key(
     return true;
 }
 
-bool tpm2_identity_util_share_secret_with_public_key(
-        TPM2B_DIGEST *protection_seed, TPM2B_PUBLIC *parent_pub,
-        const unsigned char *label, int label_len,
-        TPM2B_ENCRYPTED_SECRET *encrypted_protection_seed) {
-    bool result = false;
-    TPMI_ALG_PUBLIC alg = parent_pub->publicArea.type;
+bool tpm2_identity_util_calc_outer_integrity_hmac_key_and_dupsensitive_enc_key(
+        TPM2B_PUBLIC *parent_pub, TPM2B_NAME *pubname,
+        TPM2B_DIGEST *protection_seed, TPM2B_MAX_BUFFER *protection_hmac_key,
+        TPM2B_MAX_BUFFER *protection_enc_key) {
+
+    tpm2_kdfa_ctx *kdfa = tpm2_kdfa_ctx_new();
+    if (!kdfa) {
+        return false;
+    }
 
+    bool result = calc_protection_keys(kdfa, parent_pub, pubname,
+            protection_seed, protection_hmac_key, protection_enc_key);
+
+    tpm2_kdfa_ctx_free(kdfa);
+
+    return result;
+}
+
+tpm2_identity_util_parent *tpm2_identity_util_parent_new(
+        TPM2B_PUBLIC *parent_pub) {
+
+    tpm2_identity_util_parent *parent = calloc(1, sizeof(*parent));
+    if (!parent) {
+        LOG_ERR("oom");
+        return NULL;
+    }
+
+    parent->public = *parent_pub;
+
+    TPMI_ALG_PUBLIC alg = parent_pub->publicArea.type;
     switch (alg) {
     case TPM2_ALG_RSA:
-        result = share_secret_with_tpm2_rsa_public_key(protection_seed,
-                parent_pub, label, label_len, encrypted_protection_seed);
+        parent->rsa = rsa_from_tpm2_public(&parent->public);
+        if (!parent->rsa) {
+            goto error;
+        }
         break;
     case TPM2_ALG_ECC:
-        result = ecdh_derive_seed_and_encrypted_seed(parent_pub,
-                label, label_len,
-                protection_seed, encrypted_protection_seed);
+        parent->point = tpm2_get_EC_public_key(&parent->public);
+        if (!parent->point) {
+            LOG_ERR("Could not get parent's public key");
+            goto error;
+        }
         break;
     default:
         LOG_ERR("Cannot handle algorithm, got: %s",
                 tpm2_alg_util_algtostr(alg, tpm2_alg_util_flags_any));
+        goto error;
+    }
+
+    return parent;
+
+error:
+    tpm2_identity_util_parent_free(parent);
+    return NULL;
+}
+
+void tpm2_identity_util_parent_free(tpm2_identity_util_parent *parent) {
+
+    if (!parent) {
+        return;
+    }
+
+    RSA_free(parent->rsa);
+    EC_POINT_free(parent->point);
+    free(parent);
+}
+
+bool tpm2_identity_util_parent_share_secret(tpm2_identity_util_parent *parent,
+        TPM2B_DIGEST *protection_seed, const unsigned char *label,
+        int label_len, TPM2B_ENCRYPTED_SECRET *encrypted_protection_seed) {
+
+    if (parent->rsa) {
+        return share_secret_with_tpm2_rsa_public_key(parent->rsa,
+                protection_seed, &parent->public, label, label_len,
+                encrypted_protection_seed);
+    }
+
+    return ecdh_derive_seed_with_public_point(&parent->public, parent->point,
+            label, label_len, protection_seed, encrypted_protection_seed);
+}
+
+bool tpm2_identity_util_share_secret_with_public_key(
+        TPM2B_DIGEST *protection_seed, TPM2B_PUBLIC *parent_pub,
+        const unsigned char *label, int label_len,
+        TPM2B_ENCRYPTED_SECRET *encrypted_protection_seed) {
+
+    tpm2_identity_util_parent *parent = tpm2_identity_util_parent_new(
+            parent_pub);
+    if (!parent) {
         return false;
     }
 
+    bool result = tpm2_identity_util_parent_share_secret(parent,
+            protection_seed, label, label_len, encrypted_protection_seed);
+
+    tpm2_identity_util_parent_free(parent);
+
     return result;
 }
 
@@ -248,9 +342,8 @@ static const EVP_CIPHER *tpm_alg_to_ossl(TPMT_SYM_DEF_OBJECT *sym) {
     case TPM2_ALG_AES: {
         switch (sym->keyBits.aes) {
         case 128:
-            return EVP_aes_128_cfb();
         case 256:
-            return EVP_aes_256_cfb();
+            return tpm2_openssl_aes_cfb_from_key_bits(sym->keyBits.aes);
             /* no default */
         }
     }
@@ -262,12 +355,10 @@ static const EVP_CIPHER *tpm_alg_to_ossl(TPMT_SYM_DEF_OBJECT *sym) {
     return NULL;
 }
 
-static bool aes_encrypt_buffers(TPMT_SYM_DEF_OBJECT *sym,
+static bool aes_encrypt_buffers(EVP_CIPHER_CTX *ctx, TPMT_SYM_DEF_OBJECT *sym,
         uint8_t *encryption_key, uint8_t *buf1, size_t buf1_len, uint8_t *buf2,
         size_t buf2_len, TPM2B_MAX_BUFFER *cipher_text) {
 
-    bool result = false;
-
     unsigned offset = 0;
     size_t total_len = buf1_len + buf2_len;
 
@@ -289,8 +380,7 @@ static bool aes_encrypt_buffers(TPMT_SYM_DEF_OBJECT *sym,
         return false;
     }
 
-    EVP_CIPHER_CTX *ctx = tpm2_openssl_cipher_new();
-
+    /* initializing the context again resets it for this key */
     int rc = EVP_EncryptInit_ex(ctx, cipher, NULL, encryption_key, iv);
     if (!rc) {
         return false;
@@ -318,7 +408,7 @@ static bool aes_encrypt_buffers(TPMT_SYM_DEF_OBJECT *sym,
                 b, l);
         if (!rc) {
             LOG_ERR("Encrypt failed");
-            goto out;
+            return false;
         }
 
         offset += l;
@@ -328,40 +418,94 @@ static bool aes_encrypt_buffers(TPMT_SYM_DEF_OBJECT *sym,
     rc = EVP_EncryptFinal_ex(ctx, NULL, &tmp_len);
     if (!rc) {
         LOG_ERR("Encrypt failed");
-        goto out;
+        return false;
     }
 
     cipher_text->size = total_len;
 
-    result = true;
-
-out:
-    tpm2_openssl_cipher_free(ctx);
-
-    return result;
+    return true;
 }
 
-static void hmac_outer_integrity(TPMI_ALG_HASH parent_name_alg,
+static bool hmac_outer_integrity(HMAC_CTX *ctx, TPMI_ALG_HASH parent_name_alg,
         uint8_t *buffer1, uint16_t buffer1_size, uint8_t *buffer2,
         uint16_t buffer2_size, uint8_t *hmac_key,
         TPM2B_DIGEST *outer_integrity_hmac) {
 
-    uint8_t to_hmac_buffer[TPM2_MAX_DIGEST_BUFFER];
-    memcpy(to_hmac_buffer, buffer1, buffer1_size);
-    memcpy(to_hmac_buffer + buffer1_size, buffer2, buffer2_size);
-    uint32_t size = 0;
+    unsigned size = sizeof(outer_integrity_hmac->buffer);
 
     UINT16 hash_size = tpm2_alg_util_get_hash_size(parent_name_alg);
 
-    HMAC(tpm2_openssl_halg_from_tpmhalg(parent_name_alg), hmac_key, hash_size,
-            to_hmac_buffer, buffer1_size + buffer2_size,
-            outer_integrity_hmac->buffer, &size);
+    int rc = HMAC_Init_ex(ctx, hmac_key, hash_size,
+            tpm2_openssl_halg_from_tpmhalg(parent_name_alg), NULL)
+            && HMAC_Update(ctx, buffer1, buffer1_size)
+            && HMAC_Update(ctx, buffer2, buffer2_size)
+            && HMAC_Final(ctx, outer_integrity_hmac->buffer, &size);
+    if (!rc) {
+        LOG_ERR("HMAC failed: %s", ERR_error_string(ERR_get_error(), NULL));
+        return false;
+    }
+
     outer_integrity_hmac->size = size;
+
+    return true;
 }
 
-bool tpm2_identity_util_calculate_inner_integrity(TPMI_ALG_HASH name_alg,
-        TPM2B_SENSITIVE *sensitive, TPM2B_NAME *pubname,
-        TPM2B_DATA *enc_sensitive_key, TPMT_SYM_DEF_OBJECT *sym_alg,
+static bool wrapper_init(tpm2_identity_util_wrapper *wrapper) {
+
+    wrapper->cipher = tpm2_openssl_cipher_new();
+    wrapper->hmac = tpm2_openssl_hmac_new();
+    wrapper->kdfa = tpm2_kdfa_ctx_new();
+    if (!wrapper->cipher || !wrapper->hmac || !wrapper->kdfa) {
+        LOG_ERR("oom");
+        return false;
+    }
+
+    return true;
+}
+
+static void wrapper_cleanup(tpm2_identity_util_wrapper *wrapper) {
+
+    if (wrapper->cipher) {
+        tpm2_openssl_cipher_free(wrapper->cipher);
+    }
+
+    if (wrapper->hmac) {
+        tpm2_openssl_hmac_free(wrapper->hmac);
+    }
+
+    tpm2_kdfa_ctx_free(wrapper->kdfa);
+}
+
+tpm2_identity_util_wrapper *tpm2_identity_util_wrapper_new(void) {
+
+    tpm2_identity_util_wrapper *wrapper = calloc(1, sizeof(*wrapper));
+    if (!wrapper) {
+        LOG_ERR("oom");
+        return NULL;
+    }
+
+    if (!wrapper_init(wrapper)) {
+        tpm2_identity_util_wrapper_free(wrapper);
+        return NULL;
+    }
+
+    return wrapper;
+}
+
+void tpm2_identity_util_wrapper_free(tpm2_identity_util_wrapper *wrapper) {
+
+    if (!wrapper) {
+        return;
+    }
+
+    wrapper_cleanup(wrapper);
+    free(wrapper);
+}
+
+static bool calculate_inner_integrity(EVP_CIPHER_CTX *ctx,
+        TPMI_ALG_HASH name_alg, TPM2B_SENSITIVE *sensitive,
+        TPM2B_NAME *pubname, TPM2B_DATA *enc_sensitive_key,
+        TPMT_SYM_DEF_OBJECT *sym_alg,
         TPM2B_MAX_BUFFER *encrypted_inner_integrity) {
 
     TSS2_RC rval;
@@ -416,15 +560,40 @@ bool tpm2_identity_util_calculate_inner_integrity(TPMI_ALG_HASH name_alg,
     encrypted_inner_integrity->size = marshalled_sensitive_size_info
             + marshalled_sensitive_size + pubname->size;
 
-    return aes_encrypt_buffers(sym_alg, enc_sensitive_key->buffer,
+    bool result = aes_encrypt_buffers(ctx, sym_alg, enc_sensitive_key->buffer,
             marshalled_sensitive_and_name_digest, hash_size + digest_size_info,
             buffer_marshalled_sensitiveArea,
             marshalled_sensitive_size_info + marshalled_sensitive_size,
             encrypted_inner_integrity);
+
+    OPENSSL_cleanse(buffer_marshalled_sensitiveArea,
+            sizeof(buffer_marshalled_sensitiveArea));
+
+    return result;
 }
 
-void tpm2_identity_util_calculate_outer_integrity(TPMI_ALG_HASH parent_name_alg,
-        TPM2B_NAME *pubname, TPM2B_MAX_BUFFER *marshalled_sensitive,
+bool tpm2_identity_util_calculate_inner_integrity(TPMI_ALG_HASH name_alg,
+        TPM2B_SENSITIVE *sensitive, TPM2B_NAME *pubname,
+        TPM2B_DATA *enc_sensitive_key, TPMT_SYM_DEF_OBJECT *sym_alg,
+        TPM2B_MAX_BUFFER *encrypted_inner_integrity) {
+
+    EVP_CIPHER_CTX *ctx = tpm2_openssl_cipher_new();
+    if (!ctx) {
+        LOG_ERR("oom");
+        return false;
+    }
+
+    bool result = calculate_inner_integrity(ctx, name_alg, sensitive, pubname,
+            enc_sensitive_key, sym_alg, encrypted_inner_integrity);
+
+    tpm2_openssl_cipher_free(ctx);
+
+    return result;
+}
+
+static bool calculate_outer_integrity(tpm2_identity_util_wrapper *wrapper,
+        TPMI_ALG_HASH parent_name_alg, TPM2B_NAME *pubname,
+        TPM2B_MAX_BUFFER *marshalled_sensitive,
         TPM2B_MAX_BUFFER *protection_hmac_key,
         TPM2B_MAX_BUFFER *protection_enc_key, TPMT_SYM_DEF_OBJECT *sym_alg,
         TPM2B_MAX_BUFFER *encrypted_duplicate_sensitive,
@@ -433,15 +602,37 @@ void tpm2_identity_util_calculate_outer_integrity(TPMI_ALG_HASH parent_name_alg,
     //Calculate dupSensitive
     encrypted_duplicate_sensitive->size = marshalled_sensitive->size;
 
-    aes_encrypt_buffers(sym_alg, protection_enc_key->buffer,
-            marshalled_sensitive->buffer, marshalled_sensitive->size,
-            NULL, 0, encrypted_duplicate_sensitive);
+    bool result = aes_encrypt_buffers(wrapper->cipher, sym_alg,
+            protection_enc_key->buffer, marshalled_sensitive->buffer,
+            marshalled_sensitive->size, NULL, 0,
+            encrypted_duplicate_sensitive);
+    if (!result) {
+        return false;
+    }
+
     //Calculate outerHMAC
-    hmac_outer_integrity(parent_name_alg, encrypted_duplicate_sensitive->buffer,
+    return hmac_outer_integrity(wrapper->hmac, parent_name_alg,
+            encrypted_duplicate_sensitive->buffer,
             encrypted_duplicate_sensitive->size, pubname->name, pubname->size,
             protection_hmac_key->buffer, outer_hmac);
 }
 
+void tpm2_identity_util_calculate_outer_integrity(TPMI_ALG_HASH parent_name_alg,
+        TPM2B_NAME *pubname, TPM2B_MAX_BUFFER *marshalled_sensitive,
+        TPM2B_MAX_BUFFER *protection_hmac_key,
+        TPM2B_MAX_BUFFER *protection_enc_key, TPMT_SYM_DEF_OBJECT *sym_alg,
+        TPM2B_MAX_BUFFER *encrypted_duplicate_sensitive,
+        TPM2B_DIGEST *outer_hmac) {
+
+    tpm2_identity_util_wrapper wrapper = { 0 };
+    if (wrapper_init(&wrapper)) {
+        calculate_outer_integrity(&wrapper, parent_name_alg, pubname,
+                marshalled_sensitive, protection_hmac_key, protection_enc_key,
+                sym_alg, encrypted_duplicate_sensitive, outer_hmac);
+    }
+    wrapper_cleanup(&wrapper);
+}
+
 bool tpm2_identity_create_name(TPM2B_PUBLIC *public, TPM2B_NAME *pubname) {
 
     /*
@@ -492,3 +683,399 @@ bool tpm2_identity_create_name(TPM2B_PUBLIC *public, TPM2B_NAME *pubname) {
 
     return true;
 }
+
+static bool marshal_sensitive(TPM2B_SENSITIVE *sensitive,
+        TPM2B_MAX_BUFFER *marshalled_sensitive) {
+
+    size_t marshalled_sensitive_size = 0;
+    TSS2_RC rval = Tss2_MU_TPMT_SENSITIVE_Marshal(&sensitive->sensitiveArea,
+            marshalled_sensitive->buffer + sizeof(marshalled_sensitive->size),
+            sizeof(marshalled_sensitive->buffer)
+                    - sizeof(marshalled_sensitive->size),
+            &marshalled_sensitive_size);
+    if (rval != TPM2_RC_SUCCESS) {
+        LOG_ERR("Error serializing sensitive area");
+        return false;
+    }
+
+    size_t marshalled_sensitive_size_info = 0;
+    rval = Tss2_MU_UINT16_Marshal(marshalled_sensitive_size,
+            marshalled_sensitive->buffer, sizeof(marshalled_sensitive->size),
+            &marshalled_sensitive_size_info);
+    if (rval != TPM2_RC_SUCCESS) {
+        LOG_ERR("Error serializing sensitive area size");
+        return false;
+    }
+
+    marshalled_sensitive->size = marshalled_sensitive_size
+            + marshalled_sensitive_size_info;
+
+    return true;
+}
+
+static bool marshal_duplicate(TPMI_ALG_HASH parent_name_alg,
+        TPM2B_MAX_BUFFER *encrypted_duplicate_sensitive,
+        TPM2B_DIGEST *outer_hmac, TPM2B_PRIVATE *duplicate) {
+
+    UINT16 parent_hash_size = tpm2_alg_util_get_hash_size(parent_name_alg);
+    size_t size = sizeof(parent_hash_size) + parent_hash_size
+            + encrypted_duplicate_sensitive->size;
+    if (size > sizeof(duplicate->buffer)) {
+        LOG_ERR("Duplicate too big, got %zu, expected less then %zu", size,
+                sizeof(duplicate->buffer));
+        return false;
+    }
+
+    size_t hmac_size_offset = 0;
+    TSS2_RC rval = Tss2_MU_UINT16_Marshal(parent_hash_size, duplicate->buffer,
+            sizeof(parent_hash_size), &hmac_size_offset);
+    if (rval != TPM2_RC_SUCCESS) {
+        LOG_ERR("Error serializing parent hash size");
+        return false;
+    }
+
+    memcpy(duplicate->buffer + hmac_size_offset, outer_hmac->buffer,
+            parent_hash_size);
+    memcpy(duplicate->buffer + hmac_size_offset + parent_hash_size,
+            encrypted_duplicate_sensitive->buffer,
+            encrypted_duplicate_sensitive->size);
+    duplicate->size = size;
+
+    return true;
+}
+
+static bool wrap_job(tpm2_identity_util_wrapper *wrapper,
+        tpm2_identity_util_wrap_job *job) {
+
+    TPM2B_PUBLIC *parent_pub = job->parent_pub;
+    TPMI_ALG_HASH parent_name_alg = parent_pub->publicArea.nameAlg;
+    TPMT_SYM_DEF_OBJECT *sym_alg =
+            &parent_pub->publicArea.parameters.rsaDetail.symmetric;
+
+    TPM2B_NAME pubname = TPM2B_TYPE_INIT(TPM2B_NAME, name);
+    bool result = tpm2_identity_create_name(job->public, &pubname);
+    if (!result) {
+        return false;
+    }
+
+    TPM2B_MAX_BUFFER hmac_key;
+    TPM2B_MAX_BUFFER enc_key;
+    TPM2B_MAX_BUFFER sensitive = TPM2B_EMPTY_INIT;
+    TPM2B_DIGEST outer_hmac = TPM2B_EMPTY_INIT;
+    TPM2B_MAX_BUFFER encrypted_duplicate_sensitive = TPM2B_EMPTY_INIT;
+    result = calc_protection_keys(wrapper->kdfa, parent_pub, &pubname,
+            &job->sensitive->sensitiveArea.seedValue, &hmac_key, &enc_key);
+    if (!result) {
+        goto out;
+    }
+
+    /* without an inner wrapping key the sensitive area is only marshalled */
+    result = job->enc_sensitive_key ?
+            calculate_inner_integrity(wrapper->cipher,
+                    job->public->publicArea.nameAlg, job->sensitive, &pubname,
+                    job->enc_sensitive_key, sym_alg, &sensitive) :
+            marshal_sensitive(job->sensitive, &sensitive);
+    if (!result) {
+        goto out;
+    }
+
+    result = calculate_outer_integrity(wrapper, parent_name_alg, &pubname,
+            &sensitive, &hmac_key, &enc_key, sym_alg,
+            &encrypted_duplicate_sensitive, &outer_hmac)
+            && marshal_duplicate(parent_name_alg,
+                    &encrypted_duplicate_sensitive, &outer_hmac,
+                    &job->duplicate);
+
+out:
+    OPENSSL_cleanse(&sensitive, sizeof(sensitive));
+    OPENSSL_cleanse(&hmac_key, sizeof(hmac_key));
+    OPENSSL_cleanse(&enc_key, sizeof(enc_key));
+
+    return result;
+}
+
+bool tpm2_identity_util_wrap(tpm2_identity_util_wrapper *wrapper,
+        tpm2_identity_util_wrap_job *job) {
+
+    job->result = false;
+
+    tpm2_identity_util_wrapper tmp = { 0 };
+    if (!wrapper) {
+        wrapper = &tmp;
+        if (!wrapper_init(wrapper)) {
+            wrapper_cleanup(wrapper);
+            return false;
+        }
+    }
+
+    job->result = wrap_job(wrapper, job);
+
+    if (wrapper == &tmp) {
+        wrapper_cleanup(wrapper);
+    }
+
+    return job->result;
+}
+
+static bool make_credential(tpm2_identity_util_wrapper *wrapper,
+        tpm2_identity_util_parent *parent, TPM2B_NAME *name,
+        TPM2B_DIGEST *credential, TPM2B_ID_OBJECT *cred_blob,
+        TPM2B_ENCRYPTED_SECRET *secret) {
+
+    TPM2B_PUBLIC *parent_pub = &parent->public;
+    TPMI_ALG_HASH parent_name_alg = parent_pub->publicArea.nameAlg;
+
+    TPM2B_DIGEST seed = TPM2B_TYPE_INIT(TPM2B_DIGEST, buffer);
+    static const unsigned char label[] = "IDENTITY";
+    bool result = tpm2_identity_util_parent_share_secret(parent, &seed, label,
+            sizeof(label), secret);
+    if (!result) {
+        LOG_ERR("Failed Seed Encryption");
+        return false;
+    }
+
+    TPM2B_MAX_BUFFER hmac_key;
+    TPM2B_MAX_BUFFER enc_key;
+    TPM2B_MAX_BUFFER marshalled_credential = TPM2B_EMPTY_INIT;
+    TPM2B_MAX_BUFFER encrypted_credential = TPM2B_EMPTY_INIT;
+    TPM2B_DIGEST outer_hmac = TPM2B_EMPTY_INIT;
+    result = calc_protection_keys(wrapper->kdfa, parent_pub, name, &seed,
+            &hmac_key, &enc_key);
+    if (!result) {
+        goto out;
+    }
+
+    /* the credential is encrypted as a block with its size */
+    size_t offset = 0;
+    TSS2_RC rval = Tss2_MU_TPM2B_DIGEST_Marshal(credential,
+            marshalled_credential.buffer, sizeof(marshalled_credential.buffer),
+            &offset);
+    if (rval != TPM2_RC_SUCCESS) {
+        LOG_ERR("Error serializing the credential");
+        result = false;
+        goto out;
+    }
+    marshalled_credential.size = offset;
+
+    result = calculate_outer_integrity(wrapper, parent_name_alg, name,
+            &marshalled_credential, &hmac_key, &enc_key,
+            &parent_pub->publicArea.parameters.rsaDetail.symmetric,
+            &encrypted_credential, &outer_hmac);
+    if (!result) {
+        goto out;
+    }
+
+    /*
+     * cred_blob = outer_hmac || encrypted_credential, without the size of
+     * the encrypted credential, it is encrypted with the blob.
+     */
+    size_t size = sizeof(outer_hmac.size) + outer_hmac.size
+            + encrypted_credential.size;
+    if (size > sizeof(cred_blob->credential)) {
+        LOG_ERR("Credential blob too big, got %zu, expected less then %zu",
+                size, sizeof(cred_blob->credential));
+        result = false;
+        goto out;
+    }
+
+    offset = 0;
+    rval = Tss2_MU_UINT16_Marshal(outer_hmac.size, cred_blob->credential,
+            sizeof(outer_hmac.size), &offset);
+    if (rval != TPM2_RC_SUCCESS) {
+        LOG_ERR("Error serializing the outer HMAC size");
+        result = false;
+        goto out;
+    }
+
+    memcpy(cred_blob->credential + offset, outer_hmac.buffer, outer_hmac.size);
+    offset += outer_hmac.size;
+    memcpy(cred_blob->credential + offset, encrypted_credential.buffer,
+            encrypted_credential.size);
+    cred_blob->size = size;
+
+out:
+    OPENSSL_cleanse(&seed, sizeof(seed));
+    OPENSSL_cleanse(&marshalled_credential, sizeof(marshalled_credential));
+    OPENSSL_cleanse(&hmac_key, sizeof(hmac_key));
+    OPENSSL_cleanse(&enc_key, sizeof(enc_key));
+
+    return result;
+}
+
+bool tpm2_identity_util_make_credential(tpm2_identity_util_wrapper *wrapper,
+        tpm2_identity_util_parent *parent, TPM2B_NAME *name,
+        TPM2B_DIGEST *credential, TPM2B_ID_OBJECT *cred_blob,
+        TPM2B_ENCRYPTED_SECRET *secret) {
+
+    tpm2_identity_util_wrapper tmp = { 0 };
+    if (!wrapper) {
+        wrapper = &tmp;
+        if (!wrapper_init(wrapper)) {
+            wrapper_cleanup(wrapper);
+            return false;
+        }
+    }
+
+    bool result = make_credential(wrapper, parent, name, credential,
+            cred_blob, secret);
+
+    if (wrapper == &tmp) {
+        wrapper_cleanup(wrapper);
+    }
+
+    return result;
+}
+
+/*
+ * Independent jobs run on a work pool. A worker may set up state once, on its
+ * first job, for all the jobs it runs.
+ */
+typedef struct job_batch job_batch;
+struct job_batch {
+    void *jobs;
+    size_t count;
+    void *(*worker_init)(void);
+    void (*worker_cleanup)(void *state);
+    void (*run)(void *jobs, size_t index, void *state);
+    /* the state of every worker */
+    void **states;
+};
+
+static bool job_batch_work(tpm2_work_worker *worker, size_t index,
+        void *userdata) {
+
+    job_batch *batch = (job_batch *) userdata;
+
+    void *state = NULL;
+    if (batch->states) {
+        void **worker_state = &batch->states[tpm2_work_worker_index(worker)];
+        if (!*worker_state) {
+            *worker_state = batch->worker_init();
+        }
+        state = *worker_state;
+    }
+
+    batch->run(batch->jobs, index, state);
+
+    return true;
+}
+
+/* the results are in the jobs, every job runs */
+static bool job_batch_deliver(size_t index, bool result, void *userdata) {
+
+    UNUSED(index);
+    UNUSED(result);
+    UNUSED(userdata);
+
+    return true;
+}
+
+static bool job_batch_run(job_batch *batch, unsigned threads) {
+
+    if (!batch->count) {
+        return true;
+    }
+
+    UINT32 workers = tpm2_work_pool_workers(threads, batch->count);
+    if (batch->worker_init) {
+        batch->states = calloc(workers, sizeof(*batch->states));
+        if (!batch->states) {
+            LOG_ERR("oom");
+            return false;
+        }
+    }
+
+    bool result = tpm2_work_pool_run(batch->count, threads, job_batch_work,
+            job_batch_deliver, batch);
+
+    if (batch->states) {
+        UINT32 i;
+        for (i = 0; i < workers; i++) {
+            batch->worker_cleanup(batch->states[i]);
+        }
+        free(batch->states);
+        batch->states = NULL;
+    }
+
+    return result;
+}
+
+/* the contexts are set up once per worker, not once per key */
+static void *wrap_worker_init(void) {
+
+    return tpm2_identity_util_wrapper_new();
+}
+
+static void wrap_worker_cleanup(void *state) {
+
+    tpm2_identity_util_wrapper_free((tpm2_identity_util_wrapper *) state);
+}
+
+static void wrap_run(void *jobs, size_t index, void *state) {
+
+    tpm2_identity_util_wrap_job *job =
+            &((tpm2_identity_util_wrap_job *) jobs)[index];
+
+    if (state) {
+        tpm2_identity_util_wrap((tpm2_identity_util_wrapper *) state, job);
+    } else {
+        job->result = false;
+    }
+}
+
+bool tpm2_identity_util_wrap_batch(tpm2_identity_util_wrap_job *jobs,
+        size_t count, unsigned threads) {
+
+    job_batch batch = {
+        .jobs = jobs,
+        .count = count,
+        .worker_init = wrap_worker_init,
+        .worker_cleanup = wrap_worker_cleanup,
+        .run = wrap_run,
+    };
+
+    if (!job_batch_run(&batch, threads)) {
+        return false;
+    }
+
+    bool result = true;
+    size_t i;
+    for (i = 0; i < count; i++) {
+        result &= jobs[i].result;
+    }
+
+    return result;
+}
+
+static void name_run(void *jobs, size_t index, void *state) {
+
+    UNUSED(state);
+
+    tpm2_identity_util_name_job *job =
+            &((tpm2_identity_util_name_job *) jobs)[index];
+
+    job->name.size = sizeof(job->name.name);
+    job->result = tpm2_identity_create_name(&job->public, &job->name);
+}
+
+bool tpm2_identity_util_name_batch(tpm2_identity_util_name_job *jobs,
+        size_t count, unsigned threads) {
+
+    job_batch batch = {
+        .jobs = jobs,
+        .count = count,
+        .run = name_run,
+    };
+
+    if (!job_batch_run(&batch, threads)) {
+        return false;
+    }
+
+    bool result = true;
+    size_t i;
+    for (i = 0; i < count; i++) {
+        result &= jobs[i].result;
+    }
+
+    return result;
+}
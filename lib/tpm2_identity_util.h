@@ -3,6 +3,9 @@
 #ifndef LIB_TPM2_IDENTITY_UTIL_H_
 #define LIB_TPM2_IDENTITY_UTIL_H_
 
+#include <stdbool.h>
+#include <stddef.h>
+
 #include <tss2/tss2_sys.h>
 
 #include <openssl/err.h>
@@ -52,6 +55,41 @@ bool tpm2_identity_util_share_secret_with_public_key(
         const unsigned char *label, int label_len,
         TPM2B_ENCRYPTED_SECRET *encrypted_protection_seed);
 
+/*
+ * The OpenSSL key of a parent, eg an EK, set up once to share the secrets of
+ * many credentials or duplicates with it.
+ */
+typedef struct tpm2_identity_util_parent tpm2_identity_util_parent;
+
+/**
+ * Sets up the OpenSSL key of an RSA or ECC parent.
+ *
+ * @param parent_pub
+ *  The public key of the parent, it is copied.
+ * @return
+ *  The parent or NULL on failure. Free it with
+ *  tpm2_identity_util_parent_free().
+ */
+tpm2_identity_util_parent *tpm2_identity_util_parent_new(
+        TPM2B_PUBLIC *parent_pub);
+
+/**
+ * Frees a parent allocated with tpm2_identity_util_parent_new().
+ *
+ * @param parent
+ *  The parent to free, may be NULL.
+ */
+void tpm2_identity_util_parent_free(tpm2_identity_util_parent *parent);
+
+/**
+ * Like tpm2_identity_util_share_secret_with_public_key() for a parent set up
+ * with tpm2_identity_util_parent_new(). A parent is used by any number of
+ * threads at a time.
+ */
+bool tpm2_identity_util_parent_share_secret(tpm2_identity_util_parent *parent,
+        TPM2B_DIGEST *protection_seed, const unsigned char *label,
+        int label_len, TPM2B_ENCRYPTED_SECRET *encrypted_protection_seed);
+
 /**
  * Marshalls Credential Value and encrypts it with the symmetric encryption key.
  *
@@ -112,4 +150,128 @@ void tpm2_identity_util_calculate_outer_integrity(TPMI_ALG_HASH parent_name_alg,
  */
 bool tpm2_identity_create_name(TPM2B_PUBLIC *public, TPM2B_NAME *pubname);
 
+/*
+ * The OpenSSL contexts wrapping keys, kept to wrap many keys without setting
+ * them up for each one. A wrapper is used by one thread at a time.
+ */
+typedef struct tpm2_identity_util_wrapper tpm2_identity_util_wrapper;
+
+/**
+ * A key to wrap for a parent, ie to turn into the duplicate the parent
+ * imports with TPM2_Import, without involving the TPM.
+ */
+typedef struct tpm2_identity_util_wrap_job tpm2_identity_util_wrap_job;
+struct tpm2_identity_util_wrap_job {
+    /* the parent, its symmetric algorithm protects the duplicate */
+    TPM2B_PUBLIC *parent_pub;
+    TPM2B_PUBLIC *public;
+    /* the seed value of the sensitive area is the protection seed */
+    TPM2B_SENSITIVE *sensitive;
+    /* the inner wrapping key, NULL for no inner integrity */
+    TPM2B_DATA *enc_sensitive_key;
+    /* receives the duplicate */
+    TPM2B_PRIVATE duplicate;
+    /* true if the duplicate was computed */
+    bool result;
+};
+
+/**
+ * Allocates the OpenSSL contexts to wrap keys with.
+ *
+ * @return
+ *  The wrapper or NULL on failure. Free it with
+ *  tpm2_identity_util_wrapper_free().
+ */
+tpm2_identity_util_wrapper *tpm2_identity_util_wrapper_new(void);
+
+/**
+ * Frees a wrapper allocated with tpm2_identity_util_wrapper_new().
+ *
+ * @param wrapper
+ *  The wrapper to free, may be NULL.
+ */
+void tpm2_identity_util_wrapper_free(tpm2_identity_util_wrapper *wrapper);
+
+/**
+ * Wraps a key for its parent: computes the name, the protection keys, the
+ * inner integrity if requested and the outer integrity.
+ *
+ * @param wrapper
+ *  The contexts to use or NULL to set up temporary ones.
+ * @param job
+ *  The key to wrap, job->duplicate and job->result are set.
+ * @return
+ *  True on success, false on failure.
+ */
+bool tpm2_identity_util_wrap(tpm2_identity_util_wrapper *wrapper,
+        tpm2_identity_util_wrap_job *job);
+
+/**
+ * Makes a credential for an object of a parent without involving the TPM, the
+ * equivalent of TPM2_MakeCredential.
+ *
+ * @param wrapper
+ *  The contexts to use or NULL to set up temporary ones.
+ * @param parent
+ *  The parent protecting the credential, eg an EK.
+ * @param name
+ *  The Name of the object the credential is bound to.
+ * @param credential
+ *  The credential value.
+ * @param cred_blob
+ *  The credential blob to populate.
+ * @param secret
+ *  The secret the parent decrypts the blob with to populate.
+ * @return
+ *  True on success, false on failure.
+ */
+bool tpm2_identity_util_make_credential(tpm2_identity_util_wrapper *wrapper,
+        tpm2_identity_util_parent *parent, TPM2B_NAME *name,
+        TPM2B_DIGEST *credential, TPM2B_ID_OBJECT *cred_blob,
+        TPM2B_ENCRYPTED_SECRET *secret);
+
+/**
+ * Wraps independent keys, eg the same key for many parents, on a work pool,
+ * each worker with its own wrapper.
+ *
+ * @param jobs
+ *  The keys to wrap, the result of each one is set.
+ * @param count
+ *  The number of jobs.
+ * @param threads
+ *  The number of worker threads, 0 for one per online processor.
+ * @return
+ *  True if every key was wrapped, false otherwise.
+ */
+bool tpm2_identity_util_wrap_batch(tpm2_identity_util_wrap_job *jobs,
+        size_t count, unsigned threads);
+
+/**
+ * A public area to compute the name of, without involving the TPM.
+ */
+typedef struct tpm2_identity_util_name_job tpm2_identity_util_name_job;
+struct tpm2_identity_util_name_job {
+    TPM2B_PUBLIC public;
+    /* receives the name */
+    TPM2B_NAME name;
+    /* true if the name was computed */
+    bool result;
+};
+
+/**
+ * Computes the names of many public areas, eg of exported objects to index
+ * them, on a work pool.
+ *
+ * @param jobs
+ *  The public areas, the name and the result of each one are set.
+ * @param count
+ *  The number of jobs.
+ * @param threads
+ *  The number of worker threads, 0 for one per online processor.
+ * @return
+ *  True if every name was computed, false otherwise.
+ */
+bool tpm2_identity_util_name_batch(tpm2_identity_util_name_job *jobs,
+        size_t count, unsigned threads);
+
 #endif /* LIB_TPM2_IDENTITY_UTIL_H_ */
@@ -1,38 +1,49 @@
 /* SPDX-License-Identifier: BSD-3-Clause */
 
+#include <stdlib.h>
 #include <string.h>
 
 #include "log.h"
 #include "tpm2_kdfa.h"
 #include "tpm2_openssl.h"
 
-TSS2_RC tpm2_kdfa(TPMI_ALG_HASH hash_alg, TPM2B *key, char *label,
-        TPM2B *context_u, TPM2B *context_v, UINT16 bits,
-        TPM2B_MAX_BUFFER *result_key) {
-    TPM2B_DIGEST tpm2b_label, tpm2b_bits, tpm2b_i_2;
-    TPM2B_DIGEST *buffer_list[8];
-    TSS2_RC rval = TPM2_RC_SUCCESS;
-    int i, j;
-    UINT16 bytes = bits / 8;
+struct tpm2_kdfa_ctx {
+    HMAC_CTX *hmac;
+    bool is_keyed;
+};
 
-    result_key->size = 0;
+tpm2_kdfa_ctx *tpm2_kdfa_ctx_new(void) {
 
-    tpm2b_i_2.size = 4;
+    tpm2_kdfa_ctx *ctx = calloc(1, sizeof(*ctx));
+    if (!ctx) {
+        LOG_ERR("oom");
+        return NULL;
+    }
 
-    tpm2b_bits.size = 4;
-    UINT32 bits_be = tpm2_util_hton_32(bits);
-    memcpy(&tpm2b_bits.buffer[0], &bits_be, sizeof(bits_be));
+    ctx->hmac = tpm2_openssl_hmac_new();
+    if (!ctx->hmac) {
+        LOG_ERR("HMAC context allocation failed");
+        free(ctx);
+        return NULL;
+    }
 
-    for(i = 0; label[i] != 0 ;i++ );
+    return ctx;
+}
+
+void tpm2_kdfa_ctx_free(tpm2_kdfa_ctx *ctx) {
 
-    tpm2b_label.size = i + 1;
-    for (i = 0; i < tpm2b_label.size; i++) {
-        tpm2b_label.buffer[i] = label[i];
+    if (!ctx) {
+        return;
     }
 
-    result_key->size = 0;
+    tpm2_openssl_hmac_free(ctx->hmac);
+    free(ctx);
+}
+
+TSS2_RC tpm2_kdfa_ctx_init(tpm2_kdfa_ctx *ctx, TPMI_ALG_HASH hash_alg,
+        TPM2B *key) {
 
-    i = 1;
+    ctx->is_keyed = false;
 
     const EVP_MD *md = tpm2_openssl_halg_from_tpmhalg(hash_alg);
     if (!md) {
@@ -40,67 +51,94 @@ TSS2_RC tpm2_kdfa(TPMI_ALG_HASH hash_alg, TPM2B *key, char *label,
         return TPM2_RC_HASH;
     }
 
-    HMAC_CTX *ctx = tpm2_openssl_hmac_new();
-    if (!ctx) {
-        LOG_ERR("HMAC context allocation failed");
+    int rc = HMAC_Init_ex(ctx->hmac, key->buffer, key->size, md, NULL);
+    if (!rc) {
+        LOG_ERR("HMAC Init failed: %s", ERR_error_string(rc, NULL));
         return TPM2_RC_MEMORY;
     }
 
-    int rc = HMAC_Init_ex(ctx, key->buffer, key->size, md, NULL);
-    if (!rc) {
-        LOG_ERR("HMAC Init failed: %s", ERR_error_string(rc, NULL));
-        rval = TPM2_RC_MEMORY;
-        goto err;
+    ctx->is_keyed = true;
+
+    return TPM2_RC_SUCCESS;
+}
+
+TSS2_RC tpm2_kdfa_ctx_derive(tpm2_kdfa_ctx *ctx, const char *label,
+        TPM2B *context_u, TPM2B *context_v, UINT16 bits,
+        TPM2B_MAX_BUFFER *result_key) {
+
+    if (!ctx->is_keyed) {
+        LOG_ERR("KDFa context has no key");
+        return TSS2_SYS_RC_BAD_SEQUENCE;
     }
 
-    // TODO Why is this a loop? It appears to only execute once.
-    while (result_key->size < bytes) {
-        TPM2B_DIGEST tmpResult;
-        // Inner loop
-        bits_be = tpm2_util_hton_32(i);
-        memcpy(&tpm2b_i_2.buffer[0], &bits_be, sizeof(bits_be));
-
-        j = 0;
-        buffer_list[j++] = (TPM2B_DIGEST *) &(tpm2b_i_2);
-        buffer_list[j++] = (TPM2B_DIGEST *) &(tpm2b_label);
-        buffer_list[j++] = (TPM2B_DIGEST *) context_u;
-        buffer_list[j++] = (TPM2B_DIGEST *) context_v;
-        buffer_list[j++] = (TPM2B_DIGEST *) &(tpm2b_bits);
-        buffer_list[j] = (TPM2B_DIGEST *) 0;
-
-        int c;
-        for (c = 0; c < j; c++) {
-            TPM2B_DIGEST *digest = buffer_list[c];
-            int rc = HMAC_Update(ctx, digest->buffer, digest->size);
-            if (!rc) {
-                LOG_ERR("HMAC Update failed: %s", ERR_error_string(rc, NULL));
-                rval = TPM2_RC_MEMORY;
-                goto err;
-            }
-        }
+    UINT16 bytes = bits / 8;
+    if (bytes > sizeof(result_key->buffer)) {
+        LOG_ERR("KDFa output too big, got %u bytes, expected at most %zu",
+                bytes, sizeof(result_key->buffer));
+        return TSS2_SYS_RC_BAD_VALUE;
+    }
 
-        unsigned size = sizeof(tmpResult.buffer);
-        int rc = HMAC_Final(ctx, tmpResult.buffer, &size);
+    UINT32 bits_be = tpm2_util_hton_32(bits);
+
+    /* the label is hashed with its NUL terminator */
+    size_t label_size = strlen(label) + 1;
+
+    result_key->size = 0;
+
+    UINT32 i;
+    for (i = 1; result_key->size < bytes; i++) {
+
+        UINT32 i_be = tpm2_util_hton_32(i);
+
+        /* resets the HMAC to its key, without scheduling the key again */
+        unsigned char digest[EVP_MAX_MD_SIZE];
+        unsigned size = sizeof(digest);
+        int rc = HMAC_Init_ex(ctx->hmac, NULL, 0, NULL, NULL)
+                && HMAC_Update(ctx->hmac, (unsigned char *) &i_be,
+                        sizeof(i_be))
+                && HMAC_Update(ctx->hmac, (const unsigned char *) label,
+                        label_size)
+                && HMAC_Update(ctx->hmac, context_u->buffer, context_u->size)
+                && HMAC_Update(ctx->hmac, context_v->buffer, context_v->size)
+                && HMAC_Update(ctx->hmac, (unsigned char *) &bits_be,
+                        sizeof(bits_be))
+                && HMAC_Final(ctx->hmac, digest, &size);
         if (!rc) {
-            LOG_ERR("HMAC Final failed: %s", ERR_error_string(rc, NULL));
-            rval = TPM2_RC_MEMORY;
-            goto err;
+            LOG_ERR("HMAC failed: %s",
+                    ERR_error_string(ERR_get_error(), NULL));
+            return TPM2_RC_MEMORY;
         }
 
-        tmpResult.size = size;
+        /* the last block is truncated to the desired size */
+        UINT16 left = bytes - result_key->size;
+        UINT16 n = size < left ? size : left;
+        memcpy(&result_key->buffer[result_key->size], digest, n);
+        result_key->size += n;
 
-        bool res = tpm2_util_concat_buffer(result_key, (TPM2B *) &tmpResult);
-        if (!res) {
-            rval = TSS2_SYS_RC_BAD_VALUE;
-            goto err;
-        }
+        OPENSSL_cleanse(digest, sizeof(digest));
     }
 
-    // Truncate the result to the desired size.
-    result_key->size = bytes;
+    return TPM2_RC_SUCCESS;
+}
+
+TSS2_RC tpm2_kdfa(TPMI_ALG_HASH hash_alg, TPM2B *key, char *label,
+        TPM2B *context_u, TPM2B *context_v, UINT16 bits,
+        TPM2B_MAX_BUFFER *result_key) {
+
+    result_key->size = 0;
+
+    tpm2_kdfa_ctx *ctx = tpm2_kdfa_ctx_new();
+    if (!ctx) {
+        return TPM2_RC_MEMORY;
+    }
+
+    TSS2_RC rval = tpm2_kdfa_ctx_init(ctx, hash_alg, key);
+    if (rval == TPM2_RC_SUCCESS) {
+        rval = tpm2_kdfa_ctx_derive(ctx, label, context_u, context_v, bits,
+                result_key);
+    }
 
-err:
-    tpm2_openssl_hmac_free(ctx);
+    tpm2_kdfa_ctx_free(ctx);
 
     return rval;
 }
@@ -5,17 +5,65 @@
 
 #include <tss2/tss2_sys.h>
 
-/* TODO DOCUMENT ME */
+/*
+ * A KDFa context keeps the keyed HMAC state, so many keys derive from a
+ * key scheduled once and a context is reused across keys.
+ */
+typedef struct tpm2_kdfa_ctx tpm2_kdfa_ctx;
+
+/**
+ * Allocates a KDFa context, without a key.
+ * @return
+ *  The context or NULL on error. Free it with tpm2_kdfa_ctx_free().
+ */
+tpm2_kdfa_ctx *tpm2_kdfa_ctx_new(void);
+
+/**
+ * Frees a KDFa context.
+ * @param ctx
+ *  The context to free, may be NULL.
+ */
+void tpm2_kdfa_ctx_free(tpm2_kdfa_ctx *ctx);
+
 /**
- *
- * @param hashAlg
+ * Keys a KDFa context, replacing any previous key.
+ * @param ctx
+ *  The context to key.
+ * @param hash_alg
+ *  The hashing algorithm of the HMAC.
  * @param key
+ *  The key, ie. a seed.
+ * @return
+ *  TPM2_RC_SUCCESS on success.
+ */
+TSS2_RC tpm2_kdfa_ctx_init(tpm2_kdfa_ctx *ctx, TPMI_ALG_HASH hash_alg,
+        TPM2B *key);
+
+/**
+ * Derives a key with the KDFa of the key of the context as defined in
+ * Section 11.4.9.2 of TPM 2.0 Library Specification Part 1.
+ * @param ctx
+ *  A context keyed with tpm2_kdfa_ctx_init().
  * @param label
- * @param contextU
- * @param contextV
+ *  The label, ie. "STORAGE", the NUL terminator is part of the input.
+ * @param context_u
+ *  The first context value.
+ * @param context_v
+ *  The second context value.
  * @param bits
- * @param resultKey
+ *  The number of bits to derive.
+ * @param result_key
+ *  The derived key.
  * @return
+ *  TPM2_RC_SUCCESS on success.
+ */
+TSS2_RC tpm2_kdfa_ctx_derive(tpm2_kdfa_ctx *ctx, const char *label,
+        TPM2B *context_u, TPM2B *context_v, UINT16 bits,
+        TPM2B_MAX_BUFFER *result_key);
+
+/**
+ * Derives a single key with KDFa, see tpm2_kdfa_ctx_derive() for the
+ * parameters.
  */
 TSS2_RC tpm2_kdfa(TPMI_ALG_HASH hash_alg, TPM2B *key, char *label,
         TPM2B *context_u, TPM2B *context_v, UINT16 bits,
@@ -56,7 +56,7 @@ TSS2_RC tpm2_kdfe(
     return rval;
 }
 
-static EC_POINT * tpm2_get_EC_public_key(TPM2B_PUBLIC *public) {
+EC_POINT *tpm2_get_EC_public_key(TPM2B_PUBLIC *public) {
     EC_POINT *q = NULL;
     BIGNUM *bn_qx, *bn_qy;
     EC_KEY *key;
@@ -171,8 +171,8 @@ static int get_ECDH_shared_secret(EC_KEY *key,
 
 
 
-bool ecdh_derive_seed_and_encrypted_seed(
-        TPM2B_PUBLIC *parent_pub,
+bool ecdh_derive_seed_with_public_point(
+        TPM2B_PUBLIC *parent_pub, const EC_POINT *qsv,
         const unsigned char *label, int label_len,
         TPM2B_DIGEST *seed,
         TPM2B_ENCRYPTED_SECRET *out_sym_seed) {
@@ -182,7 +182,6 @@ bool ecdh_derive_seed_and_encrypted_seed(
     UINT16 parent_hash_size = tpm2_alg_util_get_hash_size(parent_name_alg);
     bool result = false;
     EC_KEY *key = NULL;
-    EC_POINT *qsv = NULL;
     TPMS_ECC_POINT qeu;
     bool qeu_is_valid;
     TPM2B_ECC_PARAMETER ecc_secret;
@@ -216,13 +215,6 @@ bool ecdh_derive_seed_and_encrypted_seed(
     }
     out_sym_seed->size = offset;
 
-    /* get parents public key */
-    qsv = tpm2_get_EC_public_key(parent_pub);
-    if (qsv == NULL) {
-        LOG_ERR("Could not get parent's public key");
-        goto out;
-    }
-
     get_ECDH_shared_secret(key, qsv, &ecc_secret);
 
     /* derive seed using KDFe */
@@ -232,14 +224,34 @@ bool ecdh_derive_seed_and_encrypted_seed(
             party_u_info, party_v_info, parent_hash_size * 8,
             (TPM2B_MAX_BUFFER *) seed);
 
+    OPENSSL_cleanse(&ecc_secret, sizeof(ecc_secret));
+
     result = true;
 
 out:
-    if (qsv) {
-        EC_POINT_free(qsv);
-    }
     if (key) {
         EC_KEY_free(key);
     }
     return result;
 }
+
+bool ecdh_derive_seed_and_encrypted_seed(
+        TPM2B_PUBLIC *parent_pub,
+        const unsigned char *label, int label_len,
+        TPM2B_DIGEST *seed,
+        TPM2B_ENCRYPTED_SECRET *out_sym_seed) {
+
+    /* get parents public key */
+    EC_POINT *qsv = tpm2_get_EC_public_key(parent_pub);
+    if (qsv == NULL) {
+        LOG_ERR("Could not get parent's public key");
+        return false;
+    }
+
+    bool result = ecdh_derive_seed_with_public_point(parent_pub, qsv, label,
+            label_len, seed, out_sym_seed);
+
+    EC_POINT_free(qsv);
+
+    return result;
+}
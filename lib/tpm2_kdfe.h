@@ -5,6 +5,8 @@
 
 #include <tss2/tss2_sys.h>
 
+#include <openssl/ec.h>
+
 /**
  * The KDFe function, defined in Appendix C.6.1 of TPM 2.0 Library
  * Specification Part1
@@ -59,4 +61,40 @@ bool ecdh_derive_seed_and_encrypted_seed(
         TPM2B_DIGEST *seed, TPM2B_ENCRYPTED_SECRET *out_sym_seed);
 
 
+/**
+ * Converts the point of an ECC public key to an OpenSSL point.
+ *
+ * @param public
+ *  The ECC public key.
+ * @return
+ *  The point or NULL on error. Free it with EC_POINT_free().
+ */
+EC_POINT *tpm2_get_EC_public_key(TPM2B_PUBLIC *public);
+
+/**
+ * Like ecdh_derive_seed_and_encrypted_seed(), with the point of the parent
+ * converted before, so that many seeds are derived for a parent without
+ * converting its point each time.
+ *
+ * @param[in] parent_pub
+ *  The parents ECC public key.
+ * @param[in] qsv
+ *  The point of parent_pub, see tpm2_get_EC_public_key().
+ * @param[in] label
+ *  The label value. ie. "DUPLICATE\0" or "IDENTITY\0".
+ * @param[in] label_len
+ *  Length of the label.
+ * @param[out] seed
+ *  The derived seed value
+ * @param[out] out_sym_seed
+ *  protedted seed value, ie the public key for the ephemeral key.
+ * @return
+ *  True on success, false otherwise.
+ */
+bool ecdh_derive_seed_with_public_point(
+        TPM2B_PUBLIC *parent_pub, const EC_POINT *qsv,
+        const unsigned char *label, int label_len,
+        TPM2B_DIGEST *seed, TPM2B_ENCRYPTED_SECRET *out_sym_seed);
+
+
 #endif /* SRC_TPM_KDFE_H_ */
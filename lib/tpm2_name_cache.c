@@ -0,0 +1,621 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+#include <dirent.h>
+#include <errno.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <sys/stat.h>
+
+#include <tss2/tss2_mu.h>
+
+#include "files.h"
+#include "log.h"
+#include "tpm2.h"
+#include "tpm2_capability.h"
+#include "tpm2_name_cache.h"
+#include "tpm2_util.h"
+
+#define NAME_CACHE_VERSION 2
+
+#define NAME_CACHE_SNAPSHOT "snapshot"
+
+/* the attributes that change the name of a written index until a reboot */
+#define NAME_CACHE_NV_LOCKED \
+    (TPMA_NV_WRITELOCKED | TPMA_NV_READLOCKED)
+
+/* the ESYS_TRs of one tool the TPM has not confirmed yet */
+#define NAME_CACHE_UNCONFIRMED_MAX 16
+
+/* the snapshot read by this process, loaded once */
+static struct {
+    char dir[PATH_MAX];
+    UINT8 *data;
+    size_t size;
+} snapshot;
+
+/* the TPM the entries are read for, no entry is used without it */
+static struct {
+    bool is_set;
+    tpm2_capability_identity identity;
+} tpm;
+
+/* the directory last checked to be private to this user */
+static struct {
+    char dir[PATH_MAX];
+    bool is_private;
+} checked;
+
+/* the ESYS_TRs built from entries, until the TPM confirmed their names */
+static struct {
+    size_t count;
+    struct {
+        ESYS_TR tr;
+        TPM2_HANDLE handle;
+    } entries[NAME_CACHE_UNCONFIRMED_MAX];
+} unconfirmed;
+
+/*
+ * Whoever can write to the directory can make the tools use wrong names, so
+ * only a directory of this user that no one else can access is used.
+ */
+static bool dir_is_private(const char *dir) {
+
+    if (!strcmp(checked.dir, dir)) {
+        return checked.is_private;
+    }
+
+    struct stat st;
+    if (stat(dir, &st)) {
+        /* a missing directory is created by the first write */
+        return false;
+    }
+
+    snprintf(checked.dir, sizeof(checked.dir), "%s", dir);
+    checked.is_private = S_ISDIR(st.st_mode) && st.st_uid == geteuid()
+            && !(st.st_mode & (S_IRWXG | S_IRWXO));
+    if (!checked.is_private) {
+        LOG_WARN("Ignoring name cache \"%s\" other users can access", dir);
+    }
+
+    return checked.is_private;
+}
+
+static void snapshot_drop(const char *dir) {
+
+    char path[PATH_MAX];
+    int len = snprintf(path, sizeof(path), "%s/" NAME_CACHE_SNAPSHOT, dir);
+    if (len > 0 && (size_t) len < sizeof(path) && unlink(path)
+            && errno != ENOENT) {
+        LOG_WARN("Could not drop name cache snapshot \"%s\", error: %s", path,
+                strerror(errno));
+    }
+
+    if (!strcmp(snapshot.dir, dir)) {
+        free(snapshot.data);
+        snapshot.data = NULL;
+        snapshot.size = 0;
+    }
+}
+
+static bool entry_path(const char *dir, TPM2_HANDLE handle,
+        char path[PATH_MAX]) {
+
+    int len = snprintf(path, PATH_MAX, "%s/%08x", dir, handle);
+
+    return len > 0 && len < PATH_MAX;
+}
+
+static const char *cache_dir(void) {
+
+    const char *dir = tpm2_util_getenv(TPM2TOOLS_ENV_NAME_CACHE);
+
+    return dir && dir[0] ? dir : NULL;
+}
+
+/* the size of the header of an entry or the snapshot */
+#define NAME_CACHE_HEADER_SIZE \
+    (sizeof(UINT32) * 2 + TPM2_UTIL_BOOT_ID_LEN \
+            + sizeof(UINT32) * TPM2_CAPABILITY_IDENTITY_COUNT \
+            + TPM2_SHA256_DIGEST_SIZE)
+
+static bool header_read(FILE *f, const char boot_id[TPM2_UTIL_BOOT_ID_LEN]) {
+
+    UINT32 version = 0;
+    char saved_boot_id[TPM2_UTIL_BOOT_ID_LEN];
+    tpm2_capability_identity saved_identity;
+
+    return tpm.is_set
+            && files_read_header(f, &version)
+            && version == NAME_CACHE_VERSION
+            && files_read_bytes(f, (UINT8 *) saved_boot_id,
+                    sizeof(saved_boot_id))
+            && !memcmp(saved_boot_id, boot_id, sizeof(saved_boot_id))
+            && tpm2_capability_identity_read(f, &saved_identity)
+            && !memcmp(&saved_identity, &tpm.identity,
+                    sizeof(saved_identity));
+}
+
+static bool header_write(FILE *f, const char boot_id[TPM2_UTIL_BOOT_ID_LEN]) {
+
+    return tpm.is_set
+            && files_write_header(f, NAME_CACHE_VERSION)
+            && files_write_bytes(f, (UINT8 *) boot_id,
+                    TPM2_UTIL_BOOT_ID_LEN)
+            && tpm2_capability_identity_write(f, &tpm.identity);
+}
+
+/* the handle and what follows of an entry, the records of a snapshot */
+static bool record_read(FILE *f, TPM2_HANDLE *handle, UINT8 *tr,
+        size_t *tr_size, TPM2B_NV_PUBLIC *nv_public) {
+
+    UINT32 size = 0;
+    UINT8 public[sizeof(TPM2B_NV_PUBLIC)];
+    UINT16 public_size = 0;
+    bool result = files_read_32(f, handle)
+            && files_read_32(f, &size)
+            && size <= TPM2_NAME_CACHE_TR_MAX
+            && files_read_bytes(f, tr, size)
+            && files_read_16(f, &public_size)
+            && public_size <= sizeof(public)
+            && files_read_bytes(f, public, public_size);
+    if (!result) {
+        return false;
+    }
+
+    nv_public->size = 0;
+    if (public_size) {
+        size_t offset = 0;
+        TSS2_RC rval = Tss2_MU_TPM2B_NV_PUBLIC_Unmarshal(public, public_size,
+                &offset, nv_public);
+        if (rval != TSS2_RC_SUCCESS) {
+            return false;
+        }
+    }
+
+    *tr_size = size;
+
+    return true;
+}
+
+static bool record_write(FILE *f, TPM2_HANDLE handle, const UINT8 *tr,
+        size_t tr_size, const TPM2B_NV_PUBLIC *nv_public) {
+
+    UINT8 public[sizeof(TPM2B_NV_PUBLIC)];
+    size_t public_size = 0;
+    if (nv_public) {
+        TSS2_RC rval = Tss2_MU_TPM2B_NV_PUBLIC_Marshal(nv_public, public,
+                sizeof(public), &public_size);
+        if (rval != TSS2_RC_SUCCESS) {
+            LOG_PERR(Tss2_MU_TPM2B_NV_PUBLIC_Marshal, rval);
+            return false;
+        }
+    }
+
+    return files_write_32(f, handle)
+            && files_write_32(f, tr_size)
+            && files_write_bytes(f, (UINT8 *) tr, tr_size)
+            && files_write_16(f, public_size)
+            && files_write_bytes(f, public, public_size);
+}
+
+bool tpm2_name_cache_read(const char *dir, TPM2_HANDLE handle, UINT8 *tr,
+        size_t *tr_size, TPM2B_NV_PUBLIC *nv_public) {
+
+    char path[PATH_MAX];
+    char boot_id[TPM2_UTIL_BOOT_ID_LEN];
+    if (!tpm.is_set || !dir_is_private(dir) || !entry_path(dir, handle, path)
+            || !tpm2_util_get_boot_id(boot_id)) {
+        return false;
+    }
+
+    FILE *f = fopen(path, "rb");
+    if (!f) {
+        return false;
+    }
+
+    TPM2_HANDLE saved_handle = 0;
+    bool result = header_read(f, boot_id)
+            && record_read(f, &saved_handle, tr, tr_size, nv_public)
+            && saved_handle == handle;
+    fclose(f);
+
+    if (!result) {
+        /* an entry of an earlier boot or another TPM is expected, only drop it */
+        unlink(path);
+        return false;
+    }
+
+    return true;
+}
+
+bool tpm2_name_cache_write(const char *dir, TPM2_HANDLE handle,
+        const UINT8 *tr, size_t tr_size, const TPM2B_NV_PUBLIC *nv_public) {
+
+    char boot_id[TPM2_UTIL_BOOT_ID_LEN];
+    if (tr_size > TPM2_NAME_CACHE_TR_MAX || !tpm2_util_get_boot_id(boot_id)) {
+        return false;
+    }
+
+    if (mkdir(dir, 0700) && errno != EEXIST) {
+        LOG_WARN("Could not create name cache \"%s\", error: %s", dir,
+                strerror(errno));
+        return false;
+    }
+
+    if (!dir_is_private(dir)) {
+        return false;
+    }
+
+    char path[PATH_MAX];
+    if (!entry_path(dir, handle, path)) {
+        return false;
+    }
+
+    files_atomic atomic;
+    FILE *f = files_atomic_open(&atomic, path);
+    if (!f) {
+        return false;
+    }
+
+    bool result = header_write(f, boot_id)
+            && record_write(f, handle, tr, tr_size, nv_public);
+
+    if (!files_atomic_close(&atomic, f, result)) {
+        LOG_WARN("Could not write name cache entry \"%s\"", path);
+        return false;
+    }
+
+    return true;
+}
+
+bool tpm2_name_cache_snapshot_read(const char *dir, TPM2_HANDLE handle,
+        UINT8 *tr, size_t *tr_size, TPM2B_NV_PUBLIC *nv_public) {
+
+    if (strcmp(snapshot.dir, dir)) {
+        free(snapshot.data);
+        snapshot.data = NULL;
+        snapshot.size = 0;
+        snprintf(snapshot.dir, sizeof(snapshot.dir), "%s", dir);
+
+        char path[PATH_MAX];
+        int len = snprintf(path, sizeof(path), "%s/" NAME_CACHE_SNAPSHOT, dir);
+        unsigned long size = 0;
+        FILE *f = len > 0 && (size_t) len < sizeof(path) ?
+                fopen(path, "rb") : NULL;
+        if (!f) {
+            return false;
+        }
+
+        bool result = dir_is_private(dir)
+                && files_get_file_size(f, &size, NULL) && size;
+        snapshot.data = result ? malloc(size) : NULL;
+        result = snapshot.data && files_read_bytes(f, snapshot.data, size);
+        fclose(f);
+        if (!result) {
+            free(snapshot.data);
+            snapshot.data = NULL;
+            return false;
+        }
+        snapshot.size = size;
+    }
+
+    char boot_id[TPM2_UTIL_BOOT_ID_LEN];
+    if (!snapshot.data || !tpm2_util_get_boot_id(boot_id)) {
+        return false;
+    }
+
+    FILE *f = fmemopen(snapshot.data, snapshot.size, "rb");
+    if (!f) {
+        return false;
+    }
+
+    UINT32 count = 0;
+    bool result = header_read(f, boot_id) && files_read_32(f, &count);
+
+    UINT32 i;
+    for (i = 0; result && i < count; i++) {
+        TPM2_HANDLE saved_handle = 0;
+        result = record_read(f, &saved_handle, tr, tr_size, nv_public);
+        if (result && saved_handle == handle) {
+            break;
+        }
+    }
+    fclose(f);
+
+    return result && i < count;
+}
+
+bool tpm2_name_cache_snapshot_write(const char *dir) {
+
+    /* without the identity of the TPM every entry would look stale */
+    char boot_id[TPM2_UTIL_BOOT_ID_LEN];
+    if (!tpm.is_set || !dir_is_private(dir)
+            || !tpm2_util_get_boot_id(boot_id)) {
+        return false;
+    }
+
+    DIR *d = opendir(dir);
+    if (!d) {
+        return false;
+    }
+
+    char path[PATH_MAX];
+    int len = snprintf(path, sizeof(path), "%s/" NAME_CACHE_SNAPSHOT, dir);
+    files_atomic atomic;
+    FILE *f = len > 0 && (size_t) len < sizeof(path) ?
+            files_atomic_open(&atomic, path) : NULL;
+    if (!f) {
+        closedir(d);
+        return false;
+    }
+
+    /* the count is written once the entries are */
+    UINT32 count = 0;
+    bool result = header_write(f, boot_id) && files_write_32(f, count);
+
+    struct dirent *e;
+    while (result && (e = readdir(d))) {
+        char *end = NULL;
+        unsigned long handle = strtoul(e->d_name, &end, 16);
+        if (strlen(e->d_name) != 8 || *end) {
+            continue;
+        }
+
+        UINT8 tr[TPM2_NAME_CACHE_TR_MAX];
+        size_t tr_size = 0;
+        TPM2B_NV_PUBLIC public = { 0 };
+        if (!tpm2_name_cache_read(dir, handle, tr, &tr_size, &public)) {
+            continue;
+        }
+
+        result = record_write(f, handle, tr, tr_size,
+                public.size ? &public : NULL);
+        count++;
+    }
+    closedir(d);
+
+    /* after the header of files_write_header(), the boot id and identity */
+    result = result
+            && !fseek(f, NAME_CACHE_HEADER_SIZE, SEEK_SET)
+            && files_write_32(f, count);
+    if (!files_atomic_close(&atomic, f, result)) {
+        LOG_WARN("Could not write name cache snapshot \"%s\"", path);
+        return false;
+    }
+
+    return true;
+}
+
+void tpm2_name_cache_remove(const char *dir, TPM2_HANDLE handle) {
+
+    /* the snapshot is written again by the next tpm2_batch or tpm2_serve */
+    snapshot_drop(dir);
+
+    char path[PATH_MAX];
+    if (entry_path(dir, handle, path) && unlink(path) && errno != ENOENT) {
+        LOG_WARN("Could not drop name cache entry \"%s\", error: %s", path,
+                strerror(errno));
+    }
+}
+
+void tpm2_name_cache_remove_type(const char *dir, TPM2_HT type) {
+
+    snapshot_drop(dir);
+
+    DIR *d = opendir(dir);
+    if (!d) {
+        return;
+    }
+
+    struct dirent *e;
+    while ((e = readdir(d))) {
+        /* only entries, not the temporary files of a concurrent write */
+        char *end = NULL;
+        unsigned long handle = strtoul(e->d_name, &end, 16);
+        if (strlen(e->d_name) != 8 || *end
+                || (handle >> TPM2_HR_SHIFT) != type) {
+            continue;
+        }
+
+        tpm2_name_cache_remove(dir, handle);
+    }
+
+    closedir(d);
+}
+
+static bool is_cacheable(TPM2_HANDLE handle, const TPM2B_NV_PUBLIC *nv_public) {
+
+    TPM2_HT type = handle >> TPM2_HR_SHIFT;
+    if (type == TPM2_HT_PERSISTENT) {
+        return true;
+    }
+
+    /*
+     * The first write and the locks change the name of an index, and the
+     * written bit of a TPMA_NV_CLEAR_STCLEAR index clears on TPM Restart,
+     * which keeps the boot id.
+     */
+    if (type == TPM2_HT_NV_INDEX && nv_public) {
+        TPMA_NV attributes = nv_public->nvPublic.attributes;
+        return (attributes & TPMA_NV_WRITTEN)
+                && !(attributes & (NAME_CACHE_NV_LOCKED | TPMA_NV_CLEAR_STCLEAR));
+    }
+
+    return false;
+}
+
+void tpm2_name_cache_set_identity(const tpm2_capability_identity *identity) {
+
+    tpm.identity = *identity;
+    tpm.is_set = true;
+}
+
+/* the entries are only used for the TPM they were read from */
+static bool cache_identify(ESYS_CONTEXT *ectx) {
+
+    if (tpm.is_set) {
+        return true;
+    }
+
+    tpm2_capability_identity identity;
+    tool_rc rc = tpm2_capability_identity_get(ectx, &identity);
+    if (rc != tool_rc_success) {
+        return false;
+    }
+
+    tpm2_name_cache_set_identity(&identity);
+
+    return true;
+}
+
+bool tpm2_name_cache_get(ESYS_CONTEXT *ectx, TPM2_HANDLE handle,
+        ESYS_TR *object, TPM2B_NV_PUBLIC **nv_public) {
+
+    /* the names of the TRs handed out are confirmed before use */
+    const char *dir = cache_dir();
+    if (!dir || unconfirmed.count >= ARRAY_LEN(unconfirmed.entries)
+            || !cache_identify(ectx)) {
+        return false;
+    }
+
+    UINT8 tr[TPM2_NAME_CACHE_TR_MAX];
+    size_t tr_size = 0;
+    TPM2B_NV_PUBLIC public = { 0 };
+    bool result = tpm2_name_cache_snapshot_read(dir, handle, tr, &tr_size,
+            &public)
+            || tpm2_name_cache_read(dir, handle, tr, &tr_size, &public);
+    if (!result || (nv_public && !public.size)) {
+        return false;
+    }
+
+    TSS2_RC rval = Esys_TR_Deserialize(ectx, tr, tr_size, object);
+    if (rval != TSS2_RC_SUCCESS) {
+        LOG_INFO("Dropping name cache entry of 0x%x", handle);
+        tpm2_name_cache_remove(dir, handle);
+        return false;
+    }
+
+    if (nv_public) {
+        *nv_public = malloc(sizeof(**nv_public));
+        if (!*nv_public) {
+            LOG_ERR("oom");
+            tpm2_close(ectx, object);
+            return false;
+        }
+        **nv_public = public;
+    }
+
+    unconfirmed.entries[unconfirmed.count].tr = *object;
+    unconfirmed.entries[unconfirmed.count].handle = handle;
+    unconfirmed.count++;
+
+    LOG_INFO("Using cached name of 0x%x", handle);
+
+    return true;
+}
+
+void tpm2_name_cache_forget(ESYS_TR object) {
+
+    size_t i;
+    for (i = 0; i < unconfirmed.count; i++) {
+        if (unconfirmed.entries[i].tr == object) {
+            unconfirmed.entries[i] = unconfirmed.entries[--unconfirmed.count];
+            return;
+        }
+    }
+}
+
+tool_rc tpm2_name_cache_confirm(ESYS_CONTEXT *ectx, ESYS_TR object) {
+
+    size_t i;
+    for (i = 0; i < unconfirmed.count; i++) {
+        if (unconfirmed.entries[i].tr == object) {
+            break;
+        }
+    }
+
+    if (object == ESYS_TR_NONE || i == unconfirmed.count) {
+        return tool_rc_success;
+    }
+
+    TPM2_HANDLE handle = unconfirmed.entries[i].handle;
+    unconfirmed.entries[i] = unconfirmed.entries[--unconfirmed.count];
+
+    TPM2B_NAME *cached_name = NULL;
+    TSS2_RC rval = Esys_TR_GetName(ectx, object, &cached_name);
+    if (rval != TSS2_RC_SUCCESS) {
+        LOG_PERR(Esys_TR_GetName, rval);
+        return tool_rc_from_tpm(rval);
+    }
+
+    TPM2B_NAME *name = NULL;
+    tool_rc rc = (handle >> TPM2_HR_SHIFT) == TPM2_HT_NV_INDEX ?
+            tpm2_nv_readpublic(ectx, object, NULL, &name) :
+            tpm2_readpublic(ectx, object, NULL, &name, NULL);
+    if (rc != tool_rc_success) {
+        free(cached_name);
+        return rc;
+    }
+
+    bool is_match = name->size == cached_name->size
+            && !memcmp(name->name, cached_name->name, name->size);
+    free(cached_name);
+    free(name);
+    if (!is_match) {
+        LOG_ERR("The cached name of 0x%x does not match the TPM, dropped it,"
+                " run the command again", handle);
+        tpm2_name_cache_invalidate(handle);
+        return tool_rc_general_error;
+    }
+
+    return tool_rc_success;
+}
+
+void tpm2_name_cache_put(ESYS_CONTEXT *ectx, TPM2_HANDLE handle,
+        ESYS_TR object, const TPM2B_NV_PUBLIC *nv_public) {
+
+    const char *dir = cache_dir();
+    if (!dir || !is_cacheable(handle, nv_public) || !cache_identify(ectx)) {
+        return;
+    }
+
+    UINT8 *tr = NULL;
+    size_t tr_size = 0;
+    TSS2_RC rval = Esys_TR_Serialize(ectx, object, &tr, &tr_size);
+    if (rval != TSS2_RC_SUCCESS) {
+        return;
+    }
+
+    bool result = tpm2_name_cache_write(dir, handle, tr, tr_size, nv_public);
+    UNUSED(result);
+    free(tr);
+}
+
+void tpm2_name_cache_invalidate(TPM2_HANDLE handle) {
+
+    const char *dir = cache_dir();
+    if (dir) {
+        tpm2_name_cache_remove(dir, handle);
+    }
+}
+
+void tpm2_name_cache_save_snapshot(ESYS_CONTEXT *ectx) {
+
+    const char *dir = cache_dir();
+    if (dir && cache_identify(ectx)) {
+        bool result = tpm2_name_cache_snapshot_write(dir);
+        UNUSED(result);
+    }
+}
+
+void tpm2_name_cache_invalidate_type(TPM2_HT type) {
+
+    const char *dir = cache_dir();
+    if (dir) {
+        tpm2_name_cache_remove_type(dir, type);
+    }
+}
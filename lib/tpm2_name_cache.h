@@ -0,0 +1,222 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+#ifndef LIB_TPM2_NAME_CACHE_H_
+#define LIB_TPM2_NAME_CACHE_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include <tss2/tss2_esys.h>
+
+#include "tool_rc.h"
+#include "tpm2_capability.h"
+
+/*
+ * Environment variable naming a directory to cache the ESYS_TRs of persistent
+ * objects and NV indices in across tool invocations.
+ */
+#define TPM2TOOLS_ENV_NAME_CACHE "TPM2TOOLS_NAME_CACHE"
+
+/* an ESYS_TR serializes to its handle, name and public area */
+#define TPM2_NAME_CACHE_TR_MAX 4096
+
+/*
+ * The name of a persistent object or of an NV index only changes when it is
+ * evicted or undefined, or for an index, when it is written the first time or
+ * locked. So the ESYS_TR Esys_TR_FromTPMPublic() builds from a ReadPublic, and
+ * the public area of an index, are kept in a directory with an entry per
+ * handle, and later lookups are answered without asking the TPM. The tools
+ * that evict, undefine or lock drop the entries they affect, and every entry
+ * is tied to the boot it was written in, as the lock bits clear on a reboot,
+ * and to the identity of the TPM. NV indices are only cached once written and
+ * while not locked. The directory is private to its user, created 0700, and
+ * one other users can access is not used.
+ *
+ * A name from the cache is confirmed with the TPM, by a ReadPublic or an
+ * NV_ReadPublic, before its ESYS_TR salts a session or is authorized, so a
+ * wrong entry never leaks a salt or counts as a failed authorization.
+ *
+ * An entry is laid out as, all numbers big endian:
+ *   the header of files_write_header()
+ *   the boot id
+ *   the tpm2_capability_identity of the TPM
+ *   U32 handle
+ *   U32 size, then the serialized ESYS_TR
+ *   U16 size, then the marshaled TPM2B_NV_PUBLIC of an index, 0 for an object
+ *
+ * tpm2_batch and tpm2_serve gather the entries into a snapshot when they exit,
+ * so the next tools read the names of every handle they use with a single file
+ * read. The snapshot is laid out as the header, boot id and identity of an
+ * entry, a U32
+ * count, then the handle and what follows of every entry. It is dropped with
+ * any entry.
+ */
+
+/**
+ * Sets the identity of the TPM the entries are read and written for. Without
+ * one no entry is read or written. tpm2_name_cache_get() reads it from the TPM.
+ * @param identity
+ *  The identity of the TPM.
+ */
+void tpm2_name_cache_set_identity(const tpm2_capability_identity *identity);
+
+/**
+ * Reads the entry of a handle.
+ * @param dir
+ *  The cache directory.
+ * @param handle
+ *  The persistent or NV index handle.
+ * @param tr
+ *  Receives the serialized ESYS_TR, of at most TPM2_NAME_CACHE_TR_MAX bytes.
+ * @param tr_size
+ *  Receives the size of the serialized ESYS_TR.
+ * @param nv_public
+ *  Receives the public area of an index, of size 0 for an object.
+ * @return
+ *  True if there is a valid entry for the handle, false otherwise.
+ */
+bool tpm2_name_cache_read(const char *dir, TPM2_HANDLE handle, UINT8 *tr,
+        size_t *tr_size, TPM2B_NV_PUBLIC *nv_public);
+
+/**
+ * Writes the entry of a handle, creating the directory if needed.
+ * @param dir
+ *  The cache directory.
+ * @param handle
+ *  The persistent or NV index handle.
+ * @param tr
+ *  The serialized ESYS_TR.
+ * @param tr_size
+ *  The size of the serialized ESYS_TR.
+ * @param nv_public
+ *  The public area of an index, NULL for an object.
+ * @return
+ *  True on success, false on error.
+ */
+bool tpm2_name_cache_write(const char *dir, TPM2_HANDLE handle,
+        const UINT8 *tr, size_t tr_size, const TPM2B_NV_PUBLIC *nv_public);
+
+/**
+ * Looks up the entry of a handle in the snapshot, read once per process.
+ * @param dir
+ *  The cache directory.
+ * @param handle
+ *  The persistent or NV index handle.
+ * @param tr
+ *  Receives the serialized ESYS_TR, of at most TPM2_NAME_CACHE_TR_MAX bytes.
+ * @param tr_size
+ *  Receives the size of the serialized ESYS_TR.
+ * @param nv_public
+ *  Receives the public area of an index, of size 0 for an object.
+ * @return
+ *  True if the snapshot of the current boot holds the handle, false otherwise.
+ */
+bool tpm2_name_cache_snapshot_read(const char *dir, TPM2_HANDLE handle,
+        UINT8 *tr, size_t *tr_size, TPM2B_NV_PUBLIC *nv_public);
+
+/**
+ * Gathers the valid entries into the snapshot, replacing it atomically.
+ * @param dir
+ *  The cache directory.
+ * @return
+ *  True on success, false on error.
+ */
+bool tpm2_name_cache_snapshot_write(const char *dir);
+
+/**
+ * Drops the entry of a handle, if any, and the snapshot.
+ * @param dir
+ *  The cache directory.
+ * @param handle
+ *  The persistent or NV index handle.
+ */
+void tpm2_name_cache_remove(const char *dir, TPM2_HANDLE handle);
+
+/**
+ * Drops the entries of every handle of a type, and the snapshot.
+ * @param dir
+ *  The cache directory.
+ * @param type
+ *  The handle type, TPM2_HT_PERSISTENT or TPM2_HT_NV_INDEX.
+ */
+void tpm2_name_cache_remove_type(const char *dir, TPM2_HT type);
+
+/**
+ * Looks up the ESYS_TR of a handle in the cache named by
+ * TPM2TOOLS_NAME_CACHE.
+ * @param ectx
+ *  The ESAPI context.
+ * @param handle
+ *  The persistent or NV index handle.
+ * @param object
+ *  Receives the ESYS_TR, to close with tpm2_close().
+ * @param nv_public
+ *  Receives the public area of an index, to free(), NULL if not needed. No
+ *  entry is found without a public area then.
+ * @return
+ *  True on a cache hit, false without the environment variable or on a miss.
+ */
+bool tpm2_name_cache_get(ESYS_CONTEXT *ectx, TPM2_HANDLE handle,
+        ESYS_TR *object, TPM2B_NV_PUBLIC **nv_public);
+
+/**
+ * Adds the ESYS_TR of a handle to the cache named by TPM2TOOLS_NAME_CACHE.
+ * Does nothing without the environment variable, or for an index that is not
+ * written yet or is locked.
+ * @param ectx
+ *  The ESAPI context.
+ * @param handle
+ *  The persistent or NV index handle.
+ * @param object
+ *  The ESYS_TR of the handle.
+ * @param nv_public
+ *  The public area of an index, NULL for an object.
+ */
+void tpm2_name_cache_put(ESYS_CONTEXT *ectx, TPM2_HANDLE handle,
+        ESYS_TR object, const TPM2B_NV_PUBLIC *nv_public);
+
+/**
+ * Confirms the name of an ESYS_TR from tpm2_name_cache_get() with the TPM,
+ * once, before the ESYS_TR salts a session or is authorized. Does nothing
+ * for other ESYS_TRs.
+ * @param ectx
+ *  The ESAPI context.
+ * @param object
+ *  The ESYS_TR.
+ * @return
+ *  tool_rc indicating status, an error when the TPM holds another name, then
+ *  the entry is dropped.
+ */
+tool_rc tpm2_name_cache_confirm(ESYS_CONTEXT *ectx, ESYS_TR object);
+
+/**
+ * Forgets that an ESYS_TR came from the cache, when it is closed.
+ * @param object
+ *  The ESYS_TR.
+ */
+void tpm2_name_cache_forget(ESYS_TR object);
+
+/**
+ * Drops the entry of a handle, from the cache named by TPM2TOOLS_NAME_CACHE,
+ * before a command that changes its name or frees it.
+ * @param handle
+ *  The persistent or NV index handle.
+ */
+void tpm2_name_cache_invalidate(TPM2_HANDLE handle);
+
+/**
+ * Writes the snapshot of the cache named by TPM2TOOLS_NAME_CACHE, if any.
+ * @param ectx
+ *  The ESAPI context, to read the identity of the TPM with.
+ */
+void tpm2_name_cache_save_snapshot(ESYS_CONTEXT *ectx);
+
+/**
+ * Drops every entry of a handle type, from the cache named by
+ * TPM2TOOLS_NAME_CACHE, before a command that affects all of them.
+ * @param type
+ *  The handle type, TPM2_HT_PERSISTENT or TPM2_HT_NV_INDEX.
+ */
+void tpm2_name_cache_invalidate_type(TPM2_HT type);
+
+#endif /* LIB_TPM2_NAME_CACHE_H_ */
@@ -0,0 +1,416 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+#include <dirent.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "files.h"
+#include "log.h"
+#include "object.h"
+#include "tpm2.h"
+#include "tpm2_nv_bits.h"
+#include "tpm2_session.h"
+#include "tpm2_util.h"
+
+#define NV_BITS_VERSION 2
+
+/* "hex:" and the 64 bytes of the largest digest, with room to spare */
+#define NV_BITS_AUTH_MAX 256
+
+static char *nv_bits_dir;
+
+typedef struct nv_bits_record nv_bits_record;
+struct nv_bits_record {
+    TPMI_RH_PROVISION auth_handle;
+    UINT64 pending;
+    UINT64 shadow;
+    bool is_shadow;
+    /* the authorization the TPM accepted for the index, if any */
+    bool is_verified;
+    char auth_str[NV_BITS_AUTH_MAX + 1];
+};
+
+static bool record_path(TPMI_RH_NV_INDEX nv_index, char path[PATH_MAX]) {
+
+    int len = snprintf(path, PATH_MAX, "%s/%08"PRIx32, nv_bits_dir, nv_index);
+    if (len < 0 || len >= PATH_MAX) {
+        LOG_ERR("NV bits queue path is too long");
+        return false;
+    }
+
+    return true;
+}
+
+/* a missing or damaged record is one without pending bits nor a shadow */
+static void record_load(TPMI_RH_NV_INDEX nv_index, nv_bits_record *r) {
+
+    memset(r, 0, sizeof(*r));
+
+    char path[PATH_MAX];
+    if (!record_path(nv_index, path)) {
+        return;
+    }
+
+    FILE *f = fopen(path, "rb");
+    if (!f) {
+        return;
+    }
+
+    UINT32 version = 0;
+    UINT16 is_shadow = 0;
+    UINT16 is_verified = 0;
+    UINT16 size = NV_BITS_AUTH_MAX;
+    bool is_end = false;
+    bool result = files_read_header(f, &version)
+            && version == NV_BITS_VERSION
+            && files_read_32(f, &r->auth_handle)
+            && files_read_64(f, &r->pending)
+            && files_read_64(f, &r->shadow)
+            && files_read_16(f, &is_shadow)
+            && files_read_16(f, &is_verified)
+            && files_read_record(f, (UINT8 *) r->auth_str, &size, &is_end)
+            && !is_end;
+
+    fclose(f);
+
+    if (!result) {
+        LOG_WARN("NV bits of index 0x%"PRIx32" are damaged, dropping them",
+                nv_index);
+        memset(r, 0, sizeof(*r));
+        return;
+    }
+
+    r->is_shadow = is_shadow;
+    r->is_verified = is_verified;
+    r->auth_str[size] = '\0';
+}
+
+static bool record_save(TPMI_RH_NV_INDEX nv_index, const nv_bits_record *r) {
+
+    char path[PATH_MAX];
+    if (!record_path(nv_index, path)) {
+        return false;
+    }
+
+    files_atomic atomic;
+    FILE *f = files_atomic_open(&atomic, path);
+    if (!f) {
+        return false;
+    }
+
+    bool result = files_write_header(f, NV_BITS_VERSION)
+            && files_write_32(f, r->auth_handle)
+            && files_write_64(f, r->pending)
+            && files_write_64(f, r->shadow)
+            && files_write_16(f, r->is_shadow)
+            && files_write_16(f, r->is_verified)
+            && files_write_record(f, (UINT8 *) r->auth_str,
+                    strlen(r->auth_str));
+
+    if (!files_atomic_close(&atomic, f, result)) {
+        LOG_ERR("Could not write NV bits record \"%s\"", path);
+        return false;
+    }
+
+    return true;
+}
+
+static void record_remove(TPMI_RH_NV_INDEX nv_index) {
+
+    char path[PATH_MAX];
+    if (record_path(nv_index, path)) {
+        unlink(path);
+    }
+}
+
+bool tpm2_nv_bits_is_enabled(void) {
+
+    return nv_bits_dir != NULL;
+}
+
+bool tpm2_nv_bits_add(TPMI_RH_NV_INDEX nv_index, TPMI_RH_PROVISION auth_handle,
+        const char *auth_str, UINT64 bits, bool *is_queued) {
+
+    *is_queued = false;
+
+    if (!nv_bits_dir) {
+        LOG_ERR("The NV bits queue is not enabled");
+        return false;
+    }
+
+    nv_bits_record r;
+    record_load(nv_index, &r);
+
+    /*
+     * Only the authorization the TPM accepted for the index is queued,
+     * another one is sent to the TPM by the caller, so a wrong password is
+     * neither reported as set nor replaces the one of the queue.
+     */
+    auth_str = auth_str ? auth_str : "";
+    if (!r.is_verified || r.auth_handle != auth_handle
+            || strcmp(r.auth_str, auth_str)) {
+        return true;
+    }
+
+    r.pending |= bits;
+    *is_queued = true;
+
+    return record_save(nv_index, &r);
+}
+
+bool tpm2_nv_bits_verified(TPMI_RH_NV_INDEX nv_index,
+        TPMI_RH_PROVISION auth_handle, const char *auth_str) {
+
+    if (!nv_bits_dir) {
+        return true;
+    }
+
+    auth_str = auth_str ? auth_str : "";
+    if (strlen(auth_str) > NV_BITS_AUTH_MAX) {
+        LOG_WARN("The authorization value is too long to defer");
+        return true;
+    }
+
+    nv_bits_record r;
+    record_load(nv_index, &r);
+
+    /* the bits pending under another authorization are set with this one */
+    r.auth_handle = auth_handle;
+    r.is_verified = true;
+    snprintf(r.auth_str, sizeof(r.auth_str), "%s", auth_str);
+
+    return record_save(nv_index, &r);
+}
+
+bool tpm2_nv_bits_set(TPMI_RH_NV_INDEX nv_index, UINT64 bits) {
+
+    if (!nv_bits_dir) {
+        return true;
+    }
+
+    nv_bits_record r;
+    record_load(nv_index, &r);
+    if (!r.is_shadow) {
+        return true;
+    }
+
+    r.shadow |= bits;
+
+    return record_save(nv_index, &r);
+}
+
+bool tpm2_nv_bits_read(TPMI_RH_NV_INDEX nv_index, UINT64 *value) {
+
+    if (!nv_bits_dir) {
+        return false;
+    }
+
+    nv_bits_record r;
+    record_load(nv_index, &r);
+    if (!r.is_shadow) {
+        return false;
+    }
+
+    *value = r.shadow | r.pending;
+
+    return true;
+}
+
+bool tpm2_nv_bits_shadow(TPMI_RH_NV_INDEX nv_index, UINT64 *value) {
+
+    if (!nv_bits_dir) {
+        return true;
+    }
+
+    nv_bits_record r;
+    record_load(nv_index, &r);
+
+    r.shadow = *value;
+    r.is_shadow = true;
+    *value |= r.pending;
+
+    return record_save(nv_index, &r);
+}
+
+void tpm2_nv_bits_drop(TPMI_RH_NV_INDEX nv_index) {
+
+    if (nv_bits_dir) {
+        record_remove(nv_index);
+    }
+}
+
+static tool_rc flush_index(ESYS_CONTEXT *ectx, TPMI_RH_NV_INDEX nv_index) {
+
+    nv_bits_record r;
+    record_load(nv_index, &r);
+    if (!r.pending) {
+        return tool_rc_success;
+    }
+
+    char auth_hierarchy[sizeof("0x00000000")];
+    snprintf(auth_hierarchy, sizeof(auth_hierarchy), "0x%08"PRIx32,
+            r.auth_handle);
+
+    tpm2_loaded_object object = { 0 };
+    tool_rc rc = tpm2_util_object_load_auth(ectx, auth_hierarchy, r.auth_str,
+            &object, false,
+            TPM2_HANDLE_FLAGS_NV | TPM2_HANDLE_FLAGS_O | TPM2_HANDLE_FLAGS_P);
+    if (rc != tool_rc_success) {
+        LOG_ERR("Invalid handle authorization for the NV bits of index "
+                "0x%"PRIx32, nv_index);
+        return rc;
+    }
+
+    TPM2B_DIGEST cp_hash = { 0 };
+    TPM2B_DIGEST rp_hash = { 0 };
+    rc = tpm2_nvsetbits(ectx, &object, nv_index, r.pending, &cp_hash,
+            &rp_hash, TPM2_ALG_ERROR, ESYS_TR_NONE, ESYS_TR_NONE);
+
+    /* the password session goes back to the session pool of the daemon */
+    tool_rc tmp_rc = tpm2_session_close(&object.session);
+    if (tmp_rc != tool_rc_success && rc == tool_rc_success) {
+        rc = tmp_rc;
+    }
+
+    tmp_rc = tpm2_util_object_unload(ectx, &object);
+    if (tmp_rc != tool_rc_success && rc == tool_rc_success) {
+        rc = tmp_rc;
+    }
+
+    /*
+     * The TPM refused the authorization, ie it was changed since it was
+     * checked. Retrying it every interval would count towards a lockout, so
+     * the bits are dropped along with the authorization.
+     */
+    if (rc != tool_rc_success) {
+        LOG_ERR("Could not set the bits 0x%"PRIx64" of NV index 0x%"PRIx32
+                ", dropping them", r.pending, nv_index);
+        r.pending = 0;
+        r.is_verified = false;
+        r.auth_str[0] = '\0';
+        bool result = record_save(nv_index, &r);
+        UNUSED(result);
+        return rc;
+    }
+
+    LOG_INFO("Set the bits 0x%"PRIx64" of NV index 0x%"PRIx32, r.pending,
+            nv_index);
+
+    r.shadow |= r.pending;
+    r.pending = 0;
+
+    return record_save(nv_index, &r) ? tool_rc_success : tool_rc_general_error;
+}
+
+tool_rc tpm2_nv_bits_flush(ESYS_CONTEXT *ectx) {
+
+    if (!nv_bits_dir) {
+        return tool_rc_success;
+    }
+
+    DIR *dir = opendir(nv_bits_dir);
+    if (!dir) {
+        LOG_ERR("Could not open NV bits queue \"%s\", error: %s",
+                nv_bits_dir, strerror(errno));
+        return tool_rc_general_error;
+    }
+
+    /* the records are rewritten while flushing, gather the indices first */
+    TPMI_RH_NV_INDEX *indices = NULL;
+    size_t count = 0;
+    size_t capacity = 0;
+    tool_rc rc = tool_rc_success;
+    struct dirent *entry;
+    while ((entry = readdir(dir))) {
+        char *end = NULL;
+        unsigned long nv_index = strtoul(entry->d_name, &end, 16);
+        if (strlen(entry->d_name) != 8 || *end) {
+            continue;
+        }
+
+        if (count == capacity) {
+            capacity = capacity ? 2 * capacity : 16;
+            TPMI_RH_NV_INDEX *tmp = realloc(indices,
+                    capacity * sizeof(*indices));
+            if (!tmp) {
+                LOG_ERR("oom");
+                rc = tool_rc_general_error;
+                goto out;
+            }
+            indices = tmp;
+        }
+        indices[count++] = nv_index;
+    }
+
+    size_t i;
+    for (i = 0; i < count; i++) {
+        tool_rc tmp_rc = flush_index(ectx, indices[i]);
+        if (tmp_rc != tool_rc_success) {
+            rc = tmp_rc;
+        }
+    }
+
+out:
+    free(indices);
+    closedir(dir);
+
+    return rc;
+}
+
+tool_rc tpm2_nv_bits_init(void) {
+
+    if (nv_bits_dir) {
+        return tool_rc_success;
+    }
+
+    nv_bits_dir = files_temp_dir_create("tpm2-nvbits", "NV bits queue");
+    if (!nv_bits_dir) {
+        return tool_rc_general_error;
+    }
+
+    return tool_rc_success;
+}
+
+void tpm2_nv_bits_free(ESYS_CONTEXT *ectx) {
+
+    if (!nv_bits_dir) {
+        return;
+    }
+
+    tpm2_nv_bits_flush(ectx);
+
+    DIR *dir = opendir(nv_bits_dir);
+    if (dir) {
+        struct dirent *entry;
+        while ((entry = readdir(dir))) {
+            if (entry->d_name[0] == '.') {
+                continue;
+            }
+
+            char *end = NULL;
+            unsigned long nv_index = strtoul(entry->d_name, &end, 16);
+            nv_bits_record r = { 0 };
+            if (strlen(entry->d_name) == 8 && !*end) {
+                record_load(nv_index, &r);
+            }
+            if (r.pending) {
+                LOG_ERR("Dropping the bits 0x%"PRIx64" of NV index 0x%lx "
+                        "that could not be set", r.pending, nv_index);
+            }
+
+            char path[PATH_MAX];
+            snprintf(path, sizeof(path), "%s/%s", nv_bits_dir, entry->d_name);
+            unlink(path);
+        }
+        closedir(dir);
+    }
+
+    rmdir(nv_bits_dir);
+    free(nv_bits_dir);
+    nv_bits_dir = NULL;
+}
@@ -0,0 +1,140 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+#ifndef LIB_TPM2_NV_BITS_H_
+#define LIB_TPM2_NV_BITS_H_
+
+#include <stdbool.h>
+
+#include <tss2/tss2_esys.h>
+
+#include "tool_rc.h"
+
+/*
+ * The NV bits queue of tpm2_serve collects the bits tpm2_nvsetbits is asked
+ * to set with --defer. As NV_SetBits ORs the bits into the index, the bits of
+ * the requests for an index merge into one pending mask, which the daemon
+ * sets with a single NV_SetBits every interval. Only requests with the
+ * authorization the TPM last accepted for the index are queued: a request
+ * with another one sets its bits at once, which checks it, and makes it the
+ * one of the queue. Bits the TPM refuses to set are dropped with the
+ * authorization, rather than retried towards a lockout.
+ *
+ * Alongside the pending mask the queue keeps a shadow of the value of the
+ * index, valid once a tool read the index through tpm2_nv_bits_shadow(). The
+ * bits set by the daemon are ORed into it, so a read is answered from the
+ * shadow and the pending bits without the TPM. Bits set by programs not
+ * talking to the daemon are not seen.
+ *
+ * The queue lives in a private directory, one file per index, like the PCR
+ * cache, so the forked tools of the daemon share it.
+ */
+
+/**
+ * Enables the NV bits queue for the tools run from now on.
+ * @return
+ *  tool_rc indicating status.
+ */
+tool_rc tpm2_nv_bits_init(void);
+
+/**
+ * Sets the pending bits, reports the bits that could not be set and disables
+ * the queue.
+ * @param ectx
+ *  The ESAPI context to set the bits with.
+ */
+void tpm2_nv_bits_free(ESYS_CONTEXT *ectx);
+
+/**
+ * Tells whether the queue is enabled, ie the tool runs under tpm2_serve
+ * started with --nv-bits-interval.
+ * @return
+ *  true if enabled, false otherwise.
+ */
+bool tpm2_nv_bits_is_enabled(void);
+
+/**
+ * Adds bits to the pending mask of an index, if the authorization is the one
+ * the TPM accepted for the index.
+ * @param nv_index
+ *  The index to set the bits of.
+ * @param auth_handle
+ *  The handle authorizing NV_SetBits, the owner, the platform or the index.
+ * @param auth_str
+ *  The authorization value, a password, ie "str:" or "hex:", or NULL.
+ * @param bits
+ *  The bits to set.
+ * @param is_queued
+ *  Set to false when the authorization was not accepted yet, then the caller
+ *  sets the bits itself and calls tpm2_nv_bits_verified() on success.
+ * @return
+ *  true on success, false otherwise.
+ */
+bool tpm2_nv_bits_add(TPMI_RH_NV_INDEX nv_index, TPMI_RH_PROVISION auth_handle,
+        const char *auth_str, UINT64 bits, bool *is_queued);
+
+/**
+ * Records the authorization the TPM accepted for setting the bits of an
+ * index, for the requests queued from now on.
+ * @param nv_index
+ *  The index the bits were set in.
+ * @param auth_handle
+ *  The handle that authorized NV_SetBits.
+ * @param auth_str
+ *  The authorization value, a password, or NULL.
+ * @return
+ *  true on success, false otherwise.
+ */
+bool tpm2_nv_bits_verified(TPMI_RH_NV_INDEX nv_index,
+        TPMI_RH_PROVISION auth_handle, const char *auth_str);
+
+/**
+ * Records bits set in the TPM by a tool, ORing them into a valid shadow.
+ * @param nv_index
+ *  The index the bits were set in.
+ * @param bits
+ *  The bits set.
+ * @return
+ *  true on success, false otherwise.
+ */
+bool tpm2_nv_bits_set(TPMI_RH_NV_INDEX nv_index, UINT64 bits);
+
+/**
+ * Reads the value of an index from its shadow.
+ * @param nv_index
+ *  The index to read.
+ * @param value
+ *  Receives the shadow ORed with the pending bits.
+ * @return
+ *  true if the index has a valid shadow, false otherwise.
+ */
+bool tpm2_nv_bits_read(TPMI_RH_NV_INDEX nv_index, UINT64 *value);
+
+/**
+ * Makes a value read from the TPM the shadow of an index.
+ * @param nv_index
+ *  The index read.
+ * @param value
+ *  The value read from the TPM on call, ORed with the pending bits on return.
+ * @return
+ *  true on success, false otherwise.
+ */
+bool tpm2_nv_bits_shadow(TPMI_RH_NV_INDEX nv_index, UINT64 *value);
+
+/**
+ * Drops the pending bits and the shadow of an index, ie one undefined.
+ * @param nv_index
+ *  The index to drop.
+ */
+void tpm2_nv_bits_drop(TPMI_RH_NV_INDEX nv_index);
+
+/**
+ * Sets the pending bits of every index, one NV_SetBits per index. Bits the
+ * TPM refused to set are dropped.
+ * @param ectx
+ *  The ESAPI context to set the bits with.
+ * @return
+ *  tool_rc indicating status, the error of the last failed index.
+ */
+tool_rc tpm2_nv_bits_flush(ESYS_CONTEXT *ectx);
+
+#endif /* LIB_TPM2_NV_BITS_H_ */
@@ -0,0 +1,184 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "files.h"
+#include "log.h"
+#include "tpm2_attr_util.h"
+#include "tpm2_capability.h"
+#include "tpm2_nv_layout.h"
+#include "tpm2_util.h"
+
+#define LAYOUT_FIELDS_MIN 3
+#define LAYOUT_FIELDS_MAX 5
+
+/* "-" stands for a field left to the defaults */
+static const char *layout_field(const char *field) {
+
+    return strcmp(field, "-") ? field : NULL;
+}
+
+static bool layout_parse(tpm2_nv_layout *layout, tpm2_nv_layout_entry *entry,
+        char **fields, size_t count) {
+
+    bool result = tpm2_util_handle_from_optarg(fields[0], &entry->index,
+            TPM2_HANDLE_FLAGS_NV);
+    if (!result || !entry->index) {
+        LOG_ERR("%s:%zu: Invalid NV index, got: \"%s\"", layout->path,
+                entry->line_number, fields[0]);
+        return false;
+    }
+
+    entry->is_size_set = !!layout_field(fields[1]);
+    if (entry->is_size_set
+            && !tpm2_util_string_to_uint16(fields[1], &entry->size)) {
+        LOG_ERR("%s:%zu: Could not convert size to number, got: \"%s\"",
+                layout->path, entry->line_number, fields[1]);
+        return false;
+    }
+
+    entry->is_attributes_set = !!layout_field(fields[2]);
+    if (entry->is_attributes_set
+            && !tpm2_util_string_to_uint32(fields[2], &entry->attributes)
+            && !tpm2_attr_util_nv_strtoattr(fields[2], &entry->attributes)) {
+        LOG_ERR("%s:%zu: Could not convert NV attribute to number or keyword, "
+                "got: \"%s\"", layout->path, entry->line_number, fields[2]);
+        return false;
+    }
+
+    entry->policy_path = count > 3 ? layout_field(fields[3]) : NULL;
+    entry->auth_str = count > 4 ? layout_field(fields[4]) : NULL;
+
+    size_t i;
+    for (i = 0; i + 1 < layout->count; i++) {
+        if (layout->entries[i].index == entry->index) {
+            LOG_ERR("%s:%zu: NV index 0x%x is already listed on line %zu",
+                    layout->path, entry->line_number, entry->index,
+                    layout->entries[i].line_number);
+            return false;
+        }
+    }
+
+    return true;
+}
+
+bool tpm2_nv_layout_add(tpm2_nv_layout *layout, char *line,
+        size_t line_number) {
+
+    char *comment = strchr(line, '#');
+    if (comment) {
+        *comment = '\0';
+    }
+
+    char *fields[LAYOUT_FIELDS_MAX + 1];
+    size_t count = 0;
+    char *saveptr = NULL;
+    char *token = strtok_r(line, " \t\r\n", &saveptr);
+    while (token && count < ARRAY_LEN(fields)) {
+        fields[count++] = token;
+        token = strtok_r(NULL, " \t\r\n", &saveptr);
+    }
+
+    if (!count) {
+        free(line);
+        return true;
+    }
+
+    if (count < LAYOUT_FIELDS_MIN || count > LAYOUT_FIELDS_MAX) {
+        LOG_ERR("%s:%zu: Expected: <index> <size>|- <attributes>|- "
+                "[<policy>|- [<index-auth>|-]]", layout->path, line_number);
+        free(line);
+        return false;
+    }
+
+    tpm2_nv_layout_entry *entries = realloc(layout->entries,
+            (layout->count + 1) * sizeof(*entries));
+    if (!entries) {
+        LOG_ERR("oom");
+        free(line);
+        return false;
+    }
+    layout->entries = entries;
+
+    tpm2_nv_layout_entry *entry = &layout->entries[layout->count++];
+    memset(entry, 0, sizeof(*entry));
+    entry->line = line;
+    entry->line_number = line_number;
+
+    return layout_parse(layout, entry, fields, count);
+}
+
+bool tpm2_nv_layout_load(const char *path, tpm2_nv_layout *layout) {
+
+    layout->path = path;
+
+    FILE *f = files_fopen(path, "r");
+    if (!f) {
+        LOG_ERR("Could not open NV layout \"%s\", error: %s", path,
+                strerror(errno));
+        return false;
+    }
+
+    bool result = true;
+    size_t line_number = 0;
+    while (result) {
+        char *line = NULL;
+        size_t line_size = 0;
+        if (getline(&line, &line_size, f) == -1) {
+            free(line);
+            break;
+        }
+        line_number++;
+
+        /* takes the line */
+        result = tpm2_nv_layout_add(layout, line, line_number);
+    }
+
+    fclose(f);
+
+    return result;
+}
+
+void tpm2_nv_layout_free(tpm2_nv_layout *layout) {
+
+    size_t i;
+    for (i = 0; i < layout->count; i++) {
+        free(layout->entries[i].line);
+    }
+    free(layout->entries);
+
+    layout->entries = NULL;
+    layout->count = 0;
+}
+
+tool_rc tpm2_nv_layout_get_defined(ESYS_CONTEXT *ectx,
+        tpm2_nv_layout *layout) {
+
+    TPMS_CAPABILITY_DATA *capability_data = NULL;
+    tool_rc rc = tpm2_capability_get(ectx, TPM2_CAP_HANDLES,
+            TPM2_HT_NV_INDEX << 24, TPM2_MAX_CAP_HANDLES, &capability_data);
+    if (rc != tool_rc_success) {
+        LOG_ERR("Could not get the defined NV indices");
+        return rc;
+    }
+
+    const TPML_HANDLE *handles = &capability_data->data.handles;
+
+    size_t i;
+    for (i = 0; i < layout->count; i++) {
+        tpm2_nv_layout_entry *entry = &layout->entries[i];
+        entry->is_defined = false;
+
+        UINT32 j;
+        for (j = 0; j < handles->count && !entry->is_defined; j++) {
+            entry->is_defined = handles->handle[j] == entry->index;
+        }
+    }
+
+    free(capability_data);
+
+    return tool_rc_success;
+}
@@ -0,0 +1,90 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+#ifndef LIB_TPM2_NV_LAYOUT_H_
+#define LIB_TPM2_NV_LAYOUT_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include <tss2/tss2_esys.h>
+
+#include "tool_rc.h"
+
+/*
+ * An NV layout file lists the NV indices a TPM is to have, one per line:
+ *
+ *   <index> <size>|- <attributes>|- [<policy>|- [<index-auth>|-]]
+ *
+ * A "-" leaves the field to the defaults of tpm2_nvdefine, text after a "#"
+ * is a comment. tpm2_nvdefine defines the indices of a layout and
+ * tpm2_nvundefine undefines them, so the same file sets a TPM up and tears it
+ * down.
+ */
+typedef struct tpm2_nv_layout_entry tpm2_nv_layout_entry;
+struct tpm2_nv_layout_entry {
+    char *line;
+    size_t line_number;
+    TPMI_RH_NV_INDEX index;
+    bool is_size_set;
+    UINT16 size;
+    bool is_attributes_set;
+    TPMA_NV attributes;
+    /* NULL for "-" or when not given */
+    const char *policy_path;
+    const char *auth_str;
+    /* set by tpm2_nv_layout_get_defined() */
+    bool is_defined;
+};
+
+typedef struct tpm2_nv_layout tpm2_nv_layout;
+struct tpm2_nv_layout {
+    const char *path;
+    tpm2_nv_layout_entry *entries;
+    size_t count;
+};
+
+/**
+ * Adds a line of a layout file.
+ * @param layout
+ *  The layout to add the entry to.
+ * @param line
+ *  The line, allocated with malloc(). The layout takes it, even on an error.
+ * @param line_number
+ *  The number of the line in the file, for the messages.
+ * @return
+ *  true when the line is a valid entry, a comment or empty, false otherwise.
+ */
+bool tpm2_nv_layout_add(tpm2_nv_layout *layout, char *line,
+        size_t line_number);
+
+/**
+ * Reads a layout file. An index listed twice is an error.
+ * @param path
+ *  The path of the file.
+ * @param layout
+ *  The layout to fill, released with tpm2_nv_layout_free() even on an error.
+ * @return
+ *  true on success, false on error.
+ */
+bool tpm2_nv_layout_load(const char *path, tpm2_nv_layout *layout);
+
+/**
+ * Releases the entries of a layout.
+ * @param layout
+ *  The layout to release.
+ */
+void tpm2_nv_layout_free(tpm2_nv_layout *layout);
+
+/**
+ * Marks the entries of a layout whose index is defined on the TPM, with one
+ * GetCapability for the NV index handles.
+ * @param ectx
+ *  The ESAPI context.
+ * @param layout
+ *  The layout to mark.
+ * @return
+ *  tool_rc indicating status.
+ */
+tool_rc tpm2_nv_layout_get_defined(ESYS_CONTEXT *ectx, tpm2_nv_layout *layout);
+
+#endif /* LIB_TPM2_NV_LAYOUT_H_ */
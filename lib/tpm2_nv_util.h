@@ -8,14 +8,18 @@
 
 #include "log.h"
 #include "tpm2.h"
+#include "tpm2_arena.h"
 #include "tpm2_capability.h"
 #include "tpm2_session.h"
 #include "tpm2_auth_util.h"
 #include "tpm2_hierarchy.h"
+#include "tpm2_name_cache.h"
+#include "tpm2_pipeline.h"
 #include "tpm2_util.h"
 
 /**
- * Reads the public portion of a Non-Volatile (nv) index.
+ * Reads the public portion of a Non-Volatile (nv) index, from the name cache
+ * when TPM2TOOLS_NAME_CACHE is set and holds the index.
  * @param context
  *  The ESAPI context.
  * @param nv_index
@@ -29,6 +33,10 @@ static inline tool_rc tpm2_util_nv_read_public(ESYS_CONTEXT *context,
         TPMI_RH_NV_INDEX nv_index, TPM2B_NV_PUBLIC **nv_public) {
 
     ESYS_TR tr_object;
+    if (tpm2_name_cache_get(context, nv_index, &tr_object, nv_public)) {
+        return tpm2_close(context, &tr_object);
+    }
+
     tool_rc rc = tpm2_from_tpm_public(context, nv_index, ESYS_TR_NONE,
             ESYS_TR_NONE, ESYS_TR_NONE, &tr_object);
     if (rc != tool_rc_success) {
@@ -36,6 +44,10 @@ static inline tool_rc tpm2_util_nv_read_public(ESYS_CONTEXT *context,
     }
 
     rc = tpm2_nv_readpublic(context, tr_object, nv_public, NULL);
+    if (rc == tool_rc_success) {
+        tpm2_name_cache_put(context, nv_index, tr_object, *nv_public);
+    }
+
     tool_rc tmp_rc = tpm2_close(context, &tr_object);
     if (tmp_rc != tool_rc_success) {
         rc = tmp_rc;
@@ -66,12 +78,13 @@ static inline uint16_t tpm2_nv_util_max_allowed_nv_size(
     uint16_t max_nv_size = TPM2_MAX_NV_BUFFER_SIZE;
 
     TPMS_CAPABILITY_DATA *cap_data = 0;
-    UINT32 property = is_nvdefine_op ? TPM2_PT_FIXED : TPM2_PT_NV_BUFFER_MAX;
-    UINT32 property_count = is_nvdefine_op ? TPM2_MAX_TPM_PROPERTIES : 1;
-    tool_rc rc = tpm2_getcap(esys_context, TPM2_CAP_TPM_PROPERTIES, property,
-        property_count, 0, &cap_data);
+    UINT32 property = is_nvdefine_op ? TPM2_PT_NV_INDEX_MAX :
+        TPM2_PT_NV_BUFFER_MAX;
+    tool_rc rc = tpm2_capability_get(esys_context, TPM2_CAP_TPM_PROPERTIES,
+        property, 1, &cap_data);
+    bool is_adopted = tpm2_arena_adopt(tpm2_arena_invocation(), cap_data);
     bool is_getcap_op_fail = false;
-    if (rc != tool_rc_success) {
+    if (rc != tool_rc_success || !is_adopted) {
         is_getcap_op_fail = true;
         goto out;
     }
@@ -117,8 +130,6 @@ static inline uint16_t tpm2_nv_util_max_allowed_nv_size(
     }
 
 out:
-    free(cap_data);
-
     if (is_getcap_op_fail) {
         LOG_WARN("Cannot determine size from TPM properties."
                  "Setting max NV index size value to TPM2_MAX_NV_BUFFER_SIZE");
@@ -126,6 +137,215 @@ out:
     return max_nv_size;
 }
 
+/*
+ * What stays the same over all chunks of an NV read or write: the index is
+ * resolved and the authorization set up once per transfer, not per chunk.
+ */
+typedef struct tpm2_nv_transfer tpm2_nv_transfer;
+struct tpm2_nv_transfer {
+    ESYS_TR auth_handle;
+    ESYS_TR nv_handle;
+    ESYS_TR shandle;
+    UINT16 max_chunk_size;
+};
+
+/**
+ * Prepares a chunked transfer from or to a Non-Volatile (nv) index.
+ * @param ectx
+ *  The ESAPI context.
+ * @param nv_index
+ *  The index to transfer from or to.
+ * @param auth_hierarchy_obj
+ *  The object authorizing the transfer, its session is used for all chunks.
+ * @param transfer
+ *  The transfer to initialize, ended with tpm2_util_nv_transfer_end().
+ * @return
+ *  tool_rc indicating status.
+ */
+static inline tool_rc tpm2_util_nv_transfer_start(ESYS_CONTEXT *ectx,
+        TPMI_RH_NV_INDEX nv_index, tpm2_loaded_object *auth_hierarchy_obj,
+        tpm2_nv_transfer *transfer) {
+
+    transfer->auth_handle = auth_hierarchy_obj->tr_handle;
+    transfer->nv_handle = ESYS_TR_NONE;
+
+    UINT16 max_chunk_size = tpm2_nv_util_max_allowed_nv_size(ectx, false);
+    transfer->max_chunk_size = max_chunk_size > TPM2_MAX_NV_BUFFER_SIZE ?
+            TPM2_MAX_NV_BUFFER_SIZE : max_chunk_size;
+
+    tool_rc rc = tpm2_from_tpm_public(ectx, nv_index, ESYS_TR_NONE,
+            ESYS_TR_NONE, ESYS_TR_NONE, &transfer->nv_handle);
+    if (rc != tool_rc_success) {
+        return rc;
+    }
+
+    rc = tpm2_auth_util_get_shandle(ectx, auth_hierarchy_obj->tr_handle,
+            auth_hierarchy_obj->session, &transfer->shandle);
+    if (rc != tool_rc_success) {
+        LOG_ERR("Failed to get shandle");
+        tpm2_close(ectx, &transfer->nv_handle);
+    }
+
+    return rc;
+}
+
+/**
+ * Releases what tpm2_util_nv_transfer_start() set up.
+ * @param ectx
+ *  The ESAPI context.
+ * @param transfer
+ *  The transfer to end.
+ * @return
+ *  tool_rc indicating status.
+ */
+static inline tool_rc tpm2_util_nv_transfer_end(ESYS_CONTEXT *ectx,
+        tpm2_nv_transfer *transfer) {
+
+    return tpm2_close(ectx, &transfer->nv_handle);
+}
+
+/*
+ * A chunked NV read as a pipeline: the read of the next chunk is queued as
+ * soon as the response of the current one is in, and the current one is
+ * copied out while the TPM works on the next.
+ */
+typedef struct tpm2_nv_read_pipeline tpm2_nv_read_pipeline;
+struct tpm2_nv_read_pipeline {
+    tpm2_nv_transfer transfer;
+    UINT16 size;
+    UINT16 offset;
+    UINT16 requested;
+    UINT16 received;
+    UINT16 bytes_to_read;
+    BYTE *data;
+    TPM2B_MAX_NV_BUFFER *nv_data;
+};
+
+static inline tool_rc tpm2_util_nv_read_prepare(void *userdata,
+        bool *is_next) {
+
+    tpm2_nv_read_pipeline *read = (tpm2_nv_read_pipeline *) userdata;
+
+    *is_next = read->requested < read->size;
+
+    return tool_rc_success;
+}
+
+static inline tool_rc tpm2_util_nv_read_submit(ESYS_CONTEXT *ectx,
+        void *userdata) {
+
+    tpm2_nv_read_pipeline *read = (tpm2_nv_read_pipeline *) userdata;
+
+    UINT16 left = read->size - read->requested;
+    read->bytes_to_read = left > read->transfer.max_chunk_size ?
+            read->transfer.max_chunk_size : left;
+
+    tool_rc rc = tpm2_nv_read_async(ectx, read->transfer.auth_handle,
+            read->transfer.nv_handle, read->transfer.shandle,
+            read->bytes_to_read, read->offset + read->requested);
+    if (rc == tool_rc_success) {
+        read->requested += read->bytes_to_read;
+    }
+
+    return rc;
+}
+
+static inline tool_rc tpm2_util_nv_read_finish(ESYS_CONTEXT *ectx,
+        void *userdata) {
+
+    tpm2_nv_read_pipeline *read = (tpm2_nv_read_pipeline *) userdata;
+
+    tool_rc rc = tpm2_nv_read_finish(ectx, &read->nv_data);
+    if (rc != tool_rc_success) {
+        return rc;
+    }
+
+    if (read->nv_data->size != read->bytes_to_read) {
+        LOG_ERR("TPM returned %u bytes of NVRAM, expected %u",
+                read->nv_data->size, read->bytes_to_read);
+        free(read->nv_data);
+        read->nv_data = NULL;
+        return tool_rc_general_error;
+    }
+
+    return tool_rc_success;
+}
+
+static inline tool_rc tpm2_util_nv_read_complete(void *userdata) {
+
+    tpm2_nv_read_pipeline *read = (tpm2_nv_read_pipeline *) userdata;
+
+    memcpy(read->data + read->received, read->nv_data->buffer,
+            read->nv_data->size);
+    read->received += read->nv_data->size;
+
+    free(read->nv_data);
+    read->nv_data = NULL;
+
+    return tool_rc_success;
+}
+
+static inline void tpm2_util_nv_read_discard(void *userdata) {
+
+    tpm2_nv_read_pipeline *read = (tpm2_nv_read_pipeline *) userdata;
+
+    free(read->nv_data);
+    read->nv_data = NULL;
+}
+
+/**
+ * Reads a range of a Non-Volatile (nv) index, whose bounds the caller
+ * checked, in chunks the TPM returns.
+ * @param ectx
+ *  The ESAPI context.
+ * @param nv_index
+ *  The index to read.
+ * @param size
+ *  The number of bytes to read.
+ * @param offset
+ *  Offset (in bytes) from which to start reading.
+ * @param auth_hierarchy_obj
+ *  The object authorizing the read, its session is used for all chunks.
+ * @param data
+ *  Receives the size bytes read.
+ * @return
+ *  tool_rc indicating status.
+ */
+static inline tool_rc tpm2_util_nv_read_data(ESYS_CONTEXT *ectx,
+        TPMI_RH_NV_INDEX nv_index, UINT16 size, UINT16 offset,
+        tpm2_loaded_object *auth_hierarchy_obj, BYTE *data) {
+
+    static const tpm2_pipeline_ops ops = {
+        .prepare = tpm2_util_nv_read_prepare,
+        .submit = tpm2_util_nv_read_submit,
+        .finish = tpm2_util_nv_read_finish,
+        .complete = tpm2_util_nv_read_complete,
+        .discard = tpm2_util_nv_read_discard,
+    };
+
+    tpm2_nv_read_pipeline read = {
+        .size = size,
+        .offset = offset,
+        .data = data,
+    };
+
+    tool_rc rc = tpm2_util_nv_transfer_start(ectx, nv_index,
+            auth_hierarchy_obj, &read.transfer);
+    if (rc != tool_rc_success) {
+        return rc;
+    }
+
+    rc = tpm2_pipeline_run(ectx, &ops, &read);
+
+    tool_rc tmp_rc = tpm2_util_nv_transfer_end(ectx, &read.transfer);
+    if (rc != tool_rc_success) {
+        LOG_ERR("Failed to read NVRAM area at index 0x%X", nv_index);
+        return rc;
+    }
+
+    return tmp_rc;
+}
+
 /**
  * Reads data at Non-Volatile (nv) index.
  * @param ectx
@@ -186,13 +406,6 @@ static inline tool_rc tpm2_util_nv_read(ESYS_CONTEXT *ectx,
         goto out;
     }
 
-    if (cp_hash->size) {
-        goto tpm2_util_nv_read_collect_cp_hash;
-    }
-
-    uint16_t max_data_size = tpm2_nv_util_max_allowed_nv_size(ectx, false);
-
-tpm2_util_nv_read_collect_cp_hash:
     if (cp_hash->size) {
         TPM2B_MAX_NV_BUFFER *nv_data;
         rc = tpm2_nv_read(ectx, auth_hierarchy_obj, nv_index, size, offset,
@@ -210,41 +423,145 @@ tpm2_util_nv_read_collect_cp_hash:
         goto out;
     }
 
-    UINT16 data_offset = 0;
+    rc = tpm2_util_nv_read_data(ectx, nv_index, size, offset,
+            auth_hierarchy_obj, *data_buffer);
+    if (rc != tool_rc_success) {
+        goto out;
+    }
 
-    while (size > 0) {
+    if (bytes_written) {
+        *bytes_written = size;
+    }
 
-        UINT16 bytes_to_read = size > max_data_size ? max_data_size : size;
+out:
+    if (rc != tool_rc_success && *data_buffer != NULL) {
+        free(*data_buffer);
+        *data_buffer = NULL;
+    }
 
-        TPM2B_MAX_NV_BUFFER *nv_data;
+    return rc;
+}
 
-        rc = tpm2_nv_read(ectx, auth_hierarchy_obj, nv_index, bytes_to_read,
-            offset, &nv_data, cp_hash, parameter_hash_algorithm);
-        if (rc != tool_rc_success) {
-            LOG_ERR("Failed to read NVRAM area at index 0x%X", nv_index);
-            goto out;
+/*
+ * Fills chunk with the data from *pos on, up to a chunk, and advances *pos
+ * past it. With current, the contents the index holds, chunks without a
+ * change are skipped and the one filled is trimmed to the bytes that differ.
+ * An empty chunk means nothing is left to write.
+ */
+static inline void tpm2_util_nv_write_next_chunk(const BYTE *data,
+        const BYTE *current, UINT16 size, UINT16 max_chunk_size, UINT16 *pos,
+        TPM2B_MAX_NV_BUFFER *chunk, UINT16 *chunk_pos) {
+
+    while (*pos < size) {
+        UINT16 left = size - *pos;
+        UINT16 chunk_start = *pos;
+        UINT16 start = chunk_start;
+        UINT16 end = start + (left > max_chunk_size ? max_chunk_size : left);
+        *pos = end;
+
+        if (current) {
+            while (start < end && data[start] == current[start]) {
+                start++;
+            }
+            while (end > start && data[end - 1] == current[end - 1]) {
+                end--;
+            }
+            if (start == end) {
+                LOG_INFO("Skipping %u unchanged bytes of NV data",
+                        *pos - chunk_start);
+                continue;
+            }
         }
 
-        size -= nv_data->size;
-        offset += nv_data->size;
+        chunk->size = end - start;
+        memcpy(chunk->buffer, &data[start], chunk->size);
+        *chunk_pos = start;
+        return;
+    }
+
+    chunk->size = 0;
+}
 
-        memcpy(*data_buffer + data_offset, nv_data->buffer, nv_data->size);
-        data_offset += nv_data->size;
+/**
+ * Writes data to a Non-Volatile (nv) index in chunks the TPM accepts. While
+ * the TPM writes one chunk, the next one is prepared.
+ * @param ectx
+ *  The ESAPI context.
+ * @param nv_index
+ *  The index to write.
+ * @param auth_hierarchy_obj
+ *  The object authorizing the write, its session is used for all chunks.
+ * @param data
+ *  The data to write.
+ * @param current
+ *  The size bytes the index holds at offset, or NULL. When given, only the
+ *  bytes differing from data are written.
+ * @param size
+ *  The number of bytes to write.
+ * @param offset
+ *  Offset (in bytes) at which to start writing.
+ * @return
+ *  tool_rc indicating status.
+ */
+static inline tool_rc tpm2_util_nv_write(ESYS_CONTEXT *ectx,
+        TPMI_RH_NV_INDEX nv_index, tpm2_loaded_object *auth_hierarchy_obj,
+        const BYTE *data, const BYTE *current, UINT16 size, UINT16 offset) {
 
-        free(nv_data);
+    if (!size) {
+        return tool_rc_success;
     }
 
-    if (bytes_written) {
-        *bytes_written = data_offset;
+    tpm2_nv_transfer transfer;
+    tool_rc rc = tpm2_util_nv_transfer_start(ectx, nv_index,
+            auth_hierarchy_obj, &transfer);
+    if (rc != tool_rc_success) {
+        return rc;
     }
 
-out:
-    if (rc != tool_rc_success && *data_buffer != NULL) {
-        free(*data_buffer);
-        *data_buffer = NULL;
+    TPM2B_MAX_NV_BUFFER buffers[2];
+    TPM2B_MAX_NV_BUFFER *cur = &buffers[0];
+    TPM2B_MAX_NV_BUFFER *next = &buffers[1];
+
+    UINT16 pos = 0;
+    UINT16 cur_pos = 0;
+    UINT16 next_pos = 0;
+    tpm2_util_nv_write_next_chunk(data, current, size,
+            transfer.max_chunk_size, &pos, cur, &cur_pos);
+
+    while (cur->size > 0) {
+
+        LOG_INFO("The data(size=%d) to be written:", cur->size);
+
+        rc = tpm2_nvwrite_async(ectx, transfer.auth_handle,
+                transfer.nv_handle, transfer.shandle, cur, offset + cur_pos);
+        if (rc != tool_rc_success) {
+            break;
+        }
+
+        tpm2_util_nv_write_next_chunk(data, current, size,
+                transfer.max_chunk_size, &pos, next, &next_pos);
+
+        rc = tpm2_nvwrite_finish(ectx);
+        if (rc != tool_rc_success) {
+            break;
+        }
+
+        LOG_INFO("Success to write NV area at index 0x%x offset 0x%x.",
+                nv_index, offset + cur_pos);
+
+        TPM2B_MAX_NV_BUFFER *tmp = cur;
+        cur = next;
+        next = tmp;
+        cur_pos = next_pos;
     }
 
-    return rc;
+    tool_rc tmp_rc = tpm2_util_nv_transfer_end(ectx, &transfer);
+    if (rc != tool_rc_success) {
+        LOG_ERR("Failed to write NV area at index 0x%X", nv_index);
+        return rc;
+    }
+
+    return tmp_rc;
 }
 
 static inline bool on_arg_nv_index(int argc, char **argv,
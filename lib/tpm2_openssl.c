@@ -1,5 +1,6 @@
 /* SPDX-License-Identifier: BSD-3-Clause */
 
+#include <pthread.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -15,8 +16,10 @@
 #include "tpm2_attr_util.h"
 #include "tpm2_identity_util.h"
 #include "tpm2_openssl.h"
+#include "tpm2_pubkey_cache.h"
 #include "tpm2_errata.h"
 #include "tpm2_systemdeps.h"
+#include "tpm2_work_pool.h"
 
 /* compatibility function for OpenSSL versions < 1.1.0 */
 #if OPENSSL_VERSION_NUMBER < 0x10100000L
@@ -42,6 +45,32 @@ static int BN_bn2binpad(const BIGNUM *a, unsigned char *to, int tolen) {
 }
 #endif
 
+#if defined(LIB_TPM2_OPENSSL_OPENSSL_PRE11)
+static void openssl_init(void) {
+
+    /*
+     * Load the openssl error strings and algorithms
+     * so library routines work as expected.
+     */
+    OpenSSL_add_all_algorithms();
+    OpenSSL_add_all_ciphers();
+    ERR_load_crypto_strings();
+}
+#endif
+
+void tpm2_openssl_init(void) {
+
+    /*
+     * Since OpenSSL 1.1.0 the library initializes itself, loading its
+     * configuration, algorithms and error strings on first use. Tools that
+     * never call into OpenSSL skip that altogether.
+     */
+#if defined(LIB_TPM2_OPENSSL_OPENSSL_PRE11)
+    static pthread_once_t once = PTHREAD_ONCE_INIT;
+    pthread_once(&once, openssl_init);
+#endif
+}
+
 int tpm2_openssl_halgid_from_tpmhalg(TPMI_ALG_HASH algorithm) {
 
     switch (algorithm) {
@@ -59,21 +88,157 @@ int tpm2_openssl_halgid_from_tpmhalg(TPMI_ALG_HASH algorithm) {
     /* no return, not possible */
 }
 
+/*
+ * The message digests and ciphers are looked up once per process. With
+ * OpenSSL 3 they are fetched from the providers, a fetch per digest or per
+ * EVP_DigestInit_ex() of a legacy EVP_sha256() is a provider query each
+ * time. The fetched objects live until the process exits.
+ */
+typedef struct ossl_md ossl_md;
+struct ossl_md {
+    const char *name;
+    const EVP_MD *(*legacy)(void);
+};
+
+typedef struct ossl_cipher ossl_cipher;
+struct ossl_cipher {
+    const char *name;
+    const EVP_CIPHER *(*legacy)(void);
+};
+
+static const ossl_md hash_algs[] = {
+    [TPM2_ALG_SHA1] = { "SHA1", EVP_sha1 },
+    [TPM2_ALG_SHA256] = { "SHA256", EVP_sha256 },
+    [TPM2_ALG_SHA384] = { "SHA384", EVP_sha384 },
+    [TPM2_ALG_SHA512] = { "SHA512", EVP_sha512 },
+};
+
+/* AES in CFB mode indexed by the key size in 64 bit words */
+static const ossl_cipher aes_cfb_algs[] = {
+    [2] = { "AES-128-CFB", EVP_aes_128_cfb },
+    [3] = { "AES-192-CFB", EVP_aes_192_cfb },
+    [4] = { "AES-256-CFB", EVP_aes_256_cfb },
+};
+
+static pthread_once_t ossl_algs_once = PTHREAD_ONCE_INIT;
+static const EVP_MD *hash_mds[ARRAY_LEN(hash_algs)];
+static const EVP_CIPHER *aes_cfb_ciphers[ARRAY_LEN(aes_cfb_algs)];
+
+static void ossl_algs_init(void) {
+
+    size_t i;
+    for (i = 0; i < ARRAY_LEN(hash_algs); i++) {
+        if (!hash_algs[i].name) {
+            continue;
+        }
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+        hash_mds[i] = EVP_MD_fetch(NULL, hash_algs[i].name, NULL);
+        if (hash_mds[i]) {
+            continue;
+        }
+        /* fall back to the built in one, eg without a default provider */
+        ERR_clear_error();
+#endif
+        hash_mds[i] = hash_algs[i].legacy();
+    }
+
+    for (i = 0; i < ARRAY_LEN(aes_cfb_algs); i++) {
+        if (!aes_cfb_algs[i].name) {
+            continue;
+        }
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+        aes_cfb_ciphers[i] = EVP_CIPHER_fetch(NULL, aes_cfb_algs[i].name,
+                NULL);
+        if (aes_cfb_ciphers[i]) {
+            continue;
+        }
+        ERR_clear_error();
+#endif
+        aes_cfb_ciphers[i] = aes_cfb_algs[i].legacy();
+    }
+}
+
 const EVP_MD *tpm2_openssl_halg_from_tpmhalg(TPMI_ALG_HASH algorithm) {
 
-    switch (algorithm) {
-    case TPM2_ALG_SHA1:
-        return EVP_sha1();
-    case TPM2_ALG_SHA256:
-        return EVP_sha256();
-    case TPM2_ALG_SHA384:
-        return EVP_sha384();
-    case TPM2_ALG_SHA512:
-        return EVP_sha512();
-    default:
+    if (algorithm >= ARRAY_LEN(hash_mds)) {
         return NULL;
     }
-    /* no return, not possible */
+
+    pthread_once(&ossl_algs_once, ossl_algs_init);
+
+    return hash_mds[algorithm];
+}
+
+const EVP_CIPHER *tpm2_openssl_aes_cfb_from_key_bits(UINT16 key_bits) {
+
+    if (key_bits % 64 || key_bits / 64 >= ARRAY_LEN(aes_cfb_ciphers)) {
+        return NULL;
+    }
+
+    pthread_once(&ossl_algs_once, ossl_algs_init);
+
+    return aes_cfb_ciphers[key_bits / 64];
+}
+
+/*
+ * Digest contexts handed out by tpm2_openssl_md_ctx_get(). A context keeps
+ * its allocations, so initializing it again for the same digest allocates
+ * nothing.
+ */
+#define MD_CTX_POOL_SIZE 16
+
+static pthread_mutex_t md_ctx_pool_lock = PTHREAD_MUTEX_INITIALIZER;
+static EVP_MD_CTX *md_ctx_pool[MD_CTX_POOL_SIZE];
+static size_t md_ctx_pool_count;
+
+EVP_MD_CTX *tpm2_openssl_md_ctx_get(void) {
+
+    /* a job of a work pool uses the context of its worker */
+    tpm2_work_worker *worker = tpm2_work_worker_current();
+    if (worker) {
+        EVP_MD_CTX *mdctx = tpm2_work_worker_md_ctx_take(worker);
+        if (mdctx) {
+            return mdctx;
+        }
+    }
+
+    EVP_MD_CTX *mdctx = NULL;
+
+    pthread_mutex_lock(&md_ctx_pool_lock);
+    if (md_ctx_pool_count) {
+        mdctx = md_ctx_pool[--md_ctx_pool_count];
+    }
+    pthread_mutex_unlock(&md_ctx_pool_lock);
+
+    if (!mdctx) {
+        mdctx = EVP_MD_CTX_create();
+        if (!mdctx) {
+            LOG_ERR("%s", tpm2_openssl_get_err());
+        }
+    }
+
+    return mdctx;
+}
+
+void tpm2_openssl_md_ctx_put(EVP_MD_CTX *mdctx) {
+
+    if (!mdctx) {
+        return;
+    }
+
+    tpm2_work_worker *worker = tpm2_work_worker_current();
+    if (worker && tpm2_work_worker_md_ctx_give(worker, mdctx)) {
+        return;
+    }
+
+    pthread_mutex_lock(&md_ctx_pool_lock);
+    if (md_ctx_pool_count < ARRAY_LEN(md_ctx_pool)) {
+        md_ctx_pool[md_ctx_pool_count++] = mdctx;
+        mdctx = NULL;
+    }
+    pthread_mutex_unlock(&md_ctx_pool_lock);
+
+    EVP_MD_CTX_destroy(mdctx);
 }
 
 #if defined(LIB_TPM2_OPENSSL_OPENSSL_PRE11)
@@ -150,9 +315,8 @@ bool tpm2_openssl_hash_compute_data(TPMI_ALG_HASH halg, BYTE *buffer,
         return false;
     }
 
-    EVP_MD_CTX *mdctx = EVP_MD_CTX_create();
+    EVP_MD_CTX *mdctx = tpm2_openssl_md_ctx_get();
     if (!mdctx) {
-        LOG_ERR("%s", tpm2_openssl_get_err());
         return false;
     }
 
@@ -180,7 +344,7 @@ bool tpm2_openssl_hash_compute_data(TPMI_ALG_HASH halg, BYTE *buffer,
     result = true;
 
 out:
-    EVP_MD_CTX_destroy(mdctx);
+    tpm2_openssl_md_ctx_put(mdctx);
     return result;
 }
 
@@ -194,9 +358,8 @@ bool tpm2_openssl_pcr_extend(TPMI_ALG_HASH halg, BYTE *pcr,
         return false;
     }
 
-    EVP_MD_CTX *mdctx = EVP_MD_CTX_create();
+    EVP_MD_CTX *mdctx = tpm2_openssl_md_ctx_get();
     if (!mdctx) {
-        LOG_ERR("%s", tpm2_openssl_get_err());
         return false;
     }
 
@@ -229,7 +392,7 @@ bool tpm2_openssl_pcr_extend(TPMI_ALG_HASH halg, BYTE *pcr,
     result = true;
 
 out:
-    EVP_MD_CTX_destroy(mdctx);
+    tpm2_openssl_md_ctx_put(mdctx);
     return result;
 }
 
@@ -243,9 +406,8 @@ bool tpm2_openssl_hash_pcr_values(TPMI_ALG_HASH halg, TPML_DIGEST *digests,
         return false;
     }
 
-    EVP_MD_CTX *mdctx = EVP_MD_CTX_create();
+    EVP_MD_CTX *mdctx = tpm2_openssl_md_ctx_get();
     if (!mdctx) {
-        LOG_ERR("%s", tpm2_openssl_get_err());
         return false;
     }
 
@@ -266,7 +428,7 @@ bool tpm2_openssl_hash_pcr_values(TPMI_ALG_HASH halg, TPML_DIGEST *digests,
         }
     }
 
-    unsigned size = EVP_MD_size(EVP_sha256());
+    unsigned size = EVP_MD_size(md);
 
     rc = EVP_DigestFinal_ex(mdctx, digest->buffer, &size);
     if (!rc) {
@@ -279,7 +441,7 @@ bool tpm2_openssl_hash_pcr_values(TPMI_ALG_HASH halg, TPML_DIGEST *digests,
     result = true;
 
 out:
-    EVP_MD_CTX_destroy(mdctx);
+    tpm2_openssl_md_ctx_put(mdctx);
     return result;
 }
 
@@ -295,9 +457,8 @@ bool tpm2_openssl_hash_pcr_banks(TPMI_ALG_HASH hash_alg,
         return false;
     }
 
-    EVP_MD_CTX *mdctx = EVP_MD_CTX_create();
+    EVP_MD_CTX *mdctx = tpm2_openssl_md_ctx_get();
     if (!mdctx) {
-        LOG_ERR("%s", tpm2_openssl_get_err());
         return false;
     }
 
@@ -356,7 +517,7 @@ bool tpm2_openssl_hash_pcr_banks(TPMI_ALG_HASH hash_alg,
     result = true;
 
 out:
-    EVP_MD_CTX_destroy(mdctx);
+    tpm2_openssl_md_ctx_put(mdctx);
     return result;
 }
 
@@ -372,9 +533,8 @@ bool tpm2_openssl_hash_pcr_banks_le(TPMI_ALG_HASH hash_alg,
         return false;
     }
 
-    EVP_MD_CTX *mdctx = EVP_MD_CTX_create();
+    EVP_MD_CTX *mdctx = tpm2_openssl_md_ctx_get();
     if (!mdctx) {
-        LOG_ERR("%s", tpm2_openssl_get_err());
         return false;
     }
 
@@ -432,7 +592,7 @@ bool tpm2_openssl_hash_pcr_banks_le(TPMI_ALG_HASH hash_alg,
     result = true;
 
 out:
-    EVP_MD_CTX_destroy(mdctx);
+    tpm2_openssl_md_ctx_put(mdctx);
     return result;
 }
 
@@ -596,7 +756,7 @@ out:
 
 static bool do_file(const char *path, char **pass) {
 
-    FILE *f = fopen(path, "rb");
+    FILE *f = files_fopen(path, "rb");
     if (!f) {
         LOG_ERR("could not open file \"%s\" error: %s", path, strerror(errno));
         return false;
@@ -832,6 +992,21 @@ static TPMI_ECC_CURVE ossl_nid_to_curve(int nid) {
     return TPM2_ALG_ERROR;
 }
 
+BIO *tpm2_openssl_bio_open(const char *path, const char *mode) {
+
+    FILE *f = files_fopen(path, mode);
+    if (!f) {
+        return NULL;
+    }
+
+    BIO *bio = BIO_new_fp(f, BIO_CLOSE);
+    if (!bio) {
+        fclose(f);
+    }
+
+    return bio;
+}
+
 int tpm2_ossl_curve_to_nid(TPMI_ECC_CURVE curve) {
 
     unsigned i;
@@ -1053,10 +1228,66 @@ static bool load_private_RSA_from_key(RSA *k, TPM2B_SENSITIVE *priv) {
     return true;
 }
 
+/* applies the fields the PEM loaders set, keeping the template of the caller */
+static void public_apply(const TPM2B_PUBLIC *parsed, TPM2B_PUBLIC *pub) {
+
+    pub->publicArea.type = parsed->publicArea.type;
+    pub->publicArea.parameters = parsed->publicArea.parameters;
+    pub->publicArea.unique = parsed->publicArea.unique;
+}
+
+static bool load_public_from_pem(FILE *f, const char *path,
+        TPMI_ALG_PUBLIC alg, TPM2B_PUBLIC *pub) {
+
+    files_input input;
+    if (!files_input_open_file(&input, f)) {
+        return false;
+    }
+
+    const UINT8 *data = NULL;
+    size_t size = 0;
+    UINT8 fingerprint[TPM2_PUBKEY_CACHE_FINGERPRINT_SIZE];
+    bool result = files_input_read_all(&input, &data, &size) && size
+            && EVP_Digest(data, size, fingerprint, NULL, EVP_sha256(), NULL);
+    if (!result) {
+        LOG_ERR("Reading public PEM file \"%s\" failed", path);
+        goto out;
+    }
+
+    /* parsed onto an empty public area, the cached one suits any template */
+    TPM2B_PUBLIC parsed = { 0 };
+    if (tpm2_pubkey_cache_get(fingerprint, alg, &parsed)) {
+        public_apply(&parsed, pub);
+        goto out;
+    }
+
+    FILE *m = fmemopen((void *) data, size, "rb");
+    if (!m) {
+        LOG_ERR("Could not open public PEM file \"%s\", error: %s", path,
+                strerror(errno));
+        result = false;
+        goto out;
+    }
+
+    result = alg == TPM2_ALG_RSA ?
+            load_public_RSA_from_pem(m, path, &parsed) :
+            load_public_ECC_from_pem(m, path, &parsed);
+    fclose(m);
+    if (result) {
+        tpm2_pubkey_cache_put(fingerprint, alg, &parsed);
+        public_apply(&parsed, pub);
+    }
+
+out:
+    files_input_close(&input);
+
+    return result;
+}
+
 bool tpm2_openssl_load_public(const char *path, TPMI_ALG_PUBLIC alg,
         TPM2B_PUBLIC *pub) {
 
-    FILE *f = fopen(path, "rb");
+    FILE *f = files_fopen(path, "rb");
     if (!f) {
         LOG_ERR("Could not open file \"%s\" error: %s", path, strerror(errno));
         return false;
@@ -1066,10 +1297,8 @@ bool tpm2_openssl_load_public(const char *path, TPMI_ALG_PUBLIC alg,
 
     switch (alg) {
     case TPM2_ALG_RSA:
-        result = load_public_RSA_from_pem(f, path, pub);
-        break;
     case TPM2_ALG_ECC:
-        result = load_public_ECC_from_pem(f, path, pub);
+        result = load_public_from_pem(f, path, alg, pub);
         break;
         /* Skip AES here, as we can only load this one from a private file */
     default:
@@ -1242,7 +1471,7 @@ tpm2_openssl_load_rc tpm2_openssl_load_private(const char *path,
         const char *pass, TPMI_ALG_PUBLIC alg, TPM2B_PUBLIC *pub,
         TPM2B_SENSITIVE *priv) {
 
-    FILE *f = fopen(path, "r");
+    FILE *f = files_fopen(path, "r");
     if (!f) {
         LOG_ERR("Could not open file \"%s\", error: %s", path, strerror(errno));
         return 0;
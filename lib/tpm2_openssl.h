@@ -57,6 +57,13 @@ void EVP_ENCODE_CTX_free(EVP_ENCODE_CTX *ctx);
 typedef unsigned char *(*digester)(const unsigned char *d, size_t n,
         unsigned char *md);
 
+/**
+ * Initializes OpenSSL for the library routines, once per process. With
+ * OpenSSL 1.1.0 and later this does nothing, OpenSSL initializes itself on
+ * first use.
+ */
+void tpm2_openssl_init(void);
+
 static inline const char *tpm2_openssl_get_err(void) {
     return ERR_error_string(ERR_get_error(), NULL);
 }
@@ -79,6 +86,31 @@ int tpm2_openssl_halgid_from_tpmhalg(TPMI_ALG_HASH algorithm);
  */
 const EVP_MD *tpm2_openssl_halg_from_tpmhalg(TPMI_ALG_HASH algorithm);
 
+/**
+ * Get an openssl AES cipher in CFB mode, the mode of the symmetric
+ * algorithms of storage parents.
+ * @param key_bits
+ *  The size of the AES key.
+ * @return
+ *  The cipher or NULL for key sizes AES does not have.
+ */
+const EVP_CIPHER *tpm2_openssl_aes_cfb_from_key_bits(UINT16 key_bits);
+
+/**
+ * Get a digest context, reusing one returned with tpm2_openssl_md_ctx_put()
+ * if there is any. Initialize it with EVP_DigestInit_ex() before use.
+ * @return
+ *  The digest context or NULL on failure.
+ */
+EVP_MD_CTX *tpm2_openssl_md_ctx_get(void);
+
+/**
+ * Returns a digest context got with tpm2_openssl_md_ctx_get() for reuse.
+ * @param mdctx
+ *  The digest context, may be NULL.
+ */
+void tpm2_openssl_md_ctx_put(EVP_MD_CTX *mdctx);
+
 /**
  * Start an openssl hmac session.
  * @return
@@ -298,6 +330,18 @@ bool tpm2_openssl_load_public(const char *path, TPMI_ALG_PUBLIC alg,
  */
 EC_KEY* tpm2_openssl_get_public_ECC_from_pem(FILE *f, const char *path);
 
+/**
+ * Like BIO_new_file() for a path named by the user of a tool, see
+ * files_fopen().
+ * @param path
+ *  The path to open.
+ * @param mode
+ *  The mode of fopen(3).
+ * @return
+ *  The BIO, or NULL on error.
+ */
+BIO *tpm2_openssl_bio_open(const char *path, const char *mode);
+
 /**
  * Maps an ECC curve to an openssl nid value.
  * @param curve
@@ -1,6 +1,7 @@
 /* SPDX-License-Identifier: BSD-3-Clause */
 
 #include <errno.h>
+#include <limits.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -19,7 +20,9 @@
 
 #include "config.h"
 #include "log.h"
+#include "tpm2_device.h"
 #include "tpm2_options.h"
+#include "tpm2_trace.h"
 
 #ifndef VERSION
   #warning "VERSION Not known at compile time, not embedding..."
@@ -29,6 +32,35 @@
 #define TPM2TOOLS_ENV_TCTI      "TPM2TOOLS_TCTI"
 #define TPM2TOOLS_ENV_ENABLE_ERRATA  "TPM2TOOLS_ENABLE_ERRATA"
 
+/*
+ * Handy way to *try* and find all used options:
+ * grep -rn case\ \'[a-zA-Z]\' | awk '{print $3}' | sed s/\'//g | sed s/\://g | sort | uniq | less
+ */
+static const char common_short_opts[] = "T:h::vVQZ";
+
+/* the value of the common options with no short option, past any char */
+#define COMMON_OPT_JSON 0x100
+#define COMMON_OPT_RUNTIME_STATS 0x101
+
+static const struct option common_long_opts[] = {
+    { "tcti",          required_argument, NULL, 'T' },
+    { "help",          optional_argument, NULL, 'h' },
+    { "verbose",       no_argument,       NULL, 'V' },
+    { "quiet",         no_argument,       NULL, 'Q' },
+    { "version",       no_argument,       NULL, 'v' },
+    { "enable-errata", no_argument,       NULL, 'Z' },
+    { "json",          no_argument,       NULL, COMMON_OPT_JSON },
+    { "runtime-stats", no_argument,       NULL, COMMON_OPT_RUNTIME_STATS },
+};
+
+/* the TCTI loaded last, kept by a tool reusing a preloaded TCTI */
+static char tcti_conf[PATH_MAX];
+
+const char *tpm2_options_get_tcti(void) {
+
+    return tcti_conf;
+}
+
 tpm2_options *tpm2_options_new(const char *short_opts, size_t len,
         const struct option *long_opts, tpm2_option_handler on_opt,
         tpm2_arg_handler on_arg, uint32_t flags) {
@@ -63,6 +95,47 @@ tpm2_options *tpm2_options_new(const char *short_opts, size_t len,
     return opts;
 }
 
+tpm2_options *tpm2_options_new_ctx(const char *short_opts, size_t len,
+        const struct option *long_opts, tpm2_option_handler_ctx on_opt,
+        tpm2_arg_handler_ctx on_arg, uint32_t flags, void *tool_ctx) {
+
+    tpm2_options *opts = tpm2_options_new(short_opts, len, long_opts, NULL,
+            NULL, flags);
+    if (!opts) {
+        return NULL;
+    }
+
+    opts->callbacks.on_opt_ctx = on_opt;
+    opts->callbacks.on_arg_ctx = on_arg;
+    opts->callbacks.tool_ctx = tool_ctx;
+
+    return opts;
+}
+
+static bool has_on_opt(const tpm2_options *opts) {
+
+    return opts && (opts->callbacks.on_opt || opts->callbacks.on_opt_ctx);
+}
+
+static bool has_on_arg(const tpm2_options *opts) {
+
+    return opts && (opts->callbacks.on_arg || opts->callbacks.on_arg_ctx);
+}
+
+static bool call_on_opt(const tpm2_options *opts, char key, char *value) {
+
+    return opts->callbacks.on_opt_ctx ?
+            opts->callbacks.on_opt_ctx(opts->callbacks.tool_ctx, key, value) :
+            opts->callbacks.on_opt(key, value);
+}
+
+static bool call_on_arg(const tpm2_options *opts, int argc, char **argv) {
+
+    return opts->callbacks.on_arg_ctx ?
+            opts->callbacks.on_arg_ctx(opts->callbacks.tool_ctx, argc, argv) :
+            opts->callbacks.on_arg(argc, argv);
+}
+
 bool tpm2_options_cat(tpm2_options **dest, tpm2_options *src) {
 
     tpm2_options *d = *dest;
@@ -91,8 +164,7 @@ bool tpm2_options_cat(tpm2_options **dest, tpm2_options *src) {
 
     *dest = d = tmp;
 
-    d->callbacks.on_arg = src->callbacks.on_arg;
-    d->callbacks.on_opt = src->callbacks.on_opt;
+    d->callbacks = src->callbacks;
     d->flags = src->flags;
 
     memcpy(&d->long_opts[d->len], src->long_opts,
@@ -116,6 +188,214 @@ void tpm2_options_free(tpm2_options *opts) {
     free(opts);
 }
 
+bool tpm2_option_parser_init(tpm2_option_parser *parser, int argc,
+        char **argv, const tpm2_option_table *tables, size_t tables_len) {
+
+    memset(parser, 0, sizeof(*parser));
+
+    parser->args = calloc(argc > 0 ? argc : 1, sizeof(*parser->args));
+    if (!parser->args) {
+        LOG_ERR("oom");
+        return false;
+    }
+
+    parser->argc = argc;
+    parser->argv = argv;
+    parser->tables = tables;
+    parser->tables_len = tables_len;
+    parser->index = 1;
+
+    return true;
+}
+
+void tpm2_option_parser_free(tpm2_option_parser *parser) {
+
+    free(parser->args);
+    parser->args = NULL;
+}
+
+static const char *find_short_option(const tpm2_option_parser *parser,
+        char c) {
+
+    if (c == ':') {
+        return NULL;
+    }
+
+    size_t i;
+    for (i = 0; i < parser->tables_len; i++) {
+        const char *spec = strchr(parser->tables[i].short_opts, c);
+        if (spec) {
+            return spec;
+        }
+    }
+
+    return NULL;
+}
+
+static const struct option *find_long_option(
+        const tpm2_option_parser *parser, const char *name, size_t len) {
+
+    const struct option *match = NULL;
+    bool is_ambiguous = false;
+
+    size_t i;
+    for (i = 0; i < parser->tables_len; i++) {
+        const tpm2_option_table *table = &parser->tables[i];
+        size_t j;
+        for (j = 0; j < table->len && table->long_opts[j].name; j++) {
+            const struct option *opt = &table->long_opts[j];
+            if (strncmp(opt->name, name, len)) {
+                continue;
+            }
+
+            if (strlen(opt->name) == len) {
+                return opt;
+            }
+
+            /* an abbreviation, which has to be unique */
+            if (!match) {
+                match = opt;
+            } else if (match->has_arg != opt->has_arg
+                    || match->flag != opt->flag || match->val != opt->val) {
+                is_ambiguous = true;
+            }
+        }
+    }
+
+    if (is_ambiguous) {
+        LOG_ERR("%s: option '--%.*s' is ambiguous", parser->argv[0], (int) len,
+                name);
+        return NULL;
+    }
+
+    if (!match) {
+        LOG_ERR("%s: unrecognized option '--%.*s'", parser->argv[0], (int) len,
+                name);
+    }
+
+    return match;
+}
+
+static int parse_long_option(tpm2_option_parser *parser, char *name) {
+
+    char *value = strchr(name, '=');
+    size_t len = value ? (size_t) (value - name) : strlen(name);
+
+    const struct option *opt = find_long_option(parser, name, len);
+    if (!opt) {
+        return '?';
+    }
+
+    switch (opt->has_arg) {
+    case no_argument:
+        if (value) {
+            LOG_ERR("%s: option '--%s' doesn't allow an argument",
+                    parser->argv[0], opt->name);
+            return '?';
+        }
+        break;
+    case required_argument:
+        if (value) {
+            parser->optarg = value + 1;
+        } else if (parser->index < parser->argc) {
+            parser->optarg = parser->argv[parser->index++];
+        } else {
+            LOG_ERR("%s: option '--%s' requires an argument", parser->argv[0],
+                    opt->name);
+            return '?';
+        }
+        break;
+    default:
+        /* an optional argument has to be given as --name=value */
+        parser->optarg = value ? value + 1 : NULL;
+    }
+
+    if (opt->flag) {
+        *opt->flag = opt->val;
+        return 0;
+    }
+
+    return opt->val;
+}
+
+static int parse_short_option(tpm2_option_parser *parser) {
+
+    char c = *parser->group++;
+
+    const char *spec = find_short_option(parser, c);
+    if (!spec) {
+        LOG_ERR("%s: invalid option -- '%c'", parser->argv[0], c);
+        parser->group = NULL;
+        return '?';
+    }
+
+    if (spec[1] != ':') {
+        return c;
+    }
+
+    /* the argument is the rest of the element, ie -Tdevice */
+    char *rest = parser->group;
+    parser->group = NULL;
+    if (*rest) {
+        parser->optarg = rest;
+        return c;
+    }
+
+    /* an optional argument has to be attached to the option */
+    if (spec[2] == ':') {
+        return c;
+    }
+
+    if (parser->index >= parser->argc) {
+        LOG_ERR("%s: option requires an argument -- '%c'", parser->argv[0],
+                c);
+        return '?';
+    }
+
+    parser->optarg = parser->argv[parser->index++];
+
+    return c;
+}
+
+COMPILER_ATTR(hot)
+int tpm2_option_parser_next(tpm2_option_parser *parser) {
+
+    parser->optarg = NULL;
+
+    if (parser->group && *parser->group) {
+        return parse_short_option(parser);
+    }
+
+    while (parser->index < parser->argc) {
+        char *arg = parser->argv[parser->index++];
+
+        /* everything after "--" is an argument */
+        if (!strcmp(arg, "--")) {
+            while (parser->index < parser->argc) {
+                parser->args[parser->args_len++] =
+                        parser->argv[parser->index++];
+            }
+            break;
+        }
+
+        /* an argument, which includes "-" for stdin */
+        if (arg[0] != '-' || !arg[1]) {
+            parser->args[parser->args_len++] = arg;
+            continue;
+        }
+
+        if (arg[1] == '-') {
+            return parse_long_option(parser, &arg[2]);
+        }
+
+        parser->group = &arg[1];
+        return parse_short_option(parser);
+    }
+
+    return -1;
+}
+
+COMPILER_ATTR(cold)
 static bool execute_man(char *prog_name, bool show_errors) {
 
     pid_t pid;
@@ -175,6 +455,7 @@ static bool execute_man(char *prog_name, bool show_errors) {
     return true;
 }
 
+COMPILER_ATTR(cold)
 static void show_version(const char *name) {
     const char *tcti_default = NULL;
     TSS2_TCTI_INFO *info = NULL;
@@ -189,6 +470,7 @@ static void show_version(const char *name) {
     Tss2_TctiLdr_FreeInfo(&info);
 }
 
+COMPILER_ATTR(cold)
 void tpm2_print_usage(const char *command, struct tpm2_options *tool_opts) {
     unsigned int i;
     bool indent = true;
@@ -199,11 +481,11 @@ void tpm2_print_usage(const char *command, struct tpm2_options *tool_opts) {
 
     command_copy = strdup(command);
     printf("Usage: %s%s%s\n", basename(command_copy),
-           tool_opts->callbacks.on_opt ? " [<options>]" : "",
-           tool_opts->callbacks.on_arg ? " <arguments>" : "");
+           has_on_opt(tool_opts) ? " [<options>]" : "",
+           has_on_arg(tool_opts) ? " <arguments>" : "");
     free(command_copy);
 
-    if (tool_opts->callbacks.on_opt) {
+    if (has_on_opt(tool_opts)) {
         printf("Where <options> are:\n");
         for (i = 0; i < tool_opts->len; i++) {
             struct option *opt = &tool_opts->long_opts[i];
@@ -233,6 +515,7 @@ void tpm2_print_usage(const char *command, struct tpm2_options *tool_opts) {
     }
 }
 
+COMPILER_ATTR(hot)
 tpm2_option_code tpm2_handle_options(int argc, char **argv,
         tpm2_options *tool_opts, tpm2_option_flags *flags,
         TSS2_TCTI_CONTEXT **tcti) {
@@ -244,89 +527,78 @@ tpm2_option_code tpm2_handle_options(int argc, char **argv,
     bool manpager = true;
     bool explicit_manpager = false;
 
+    const char *tcti_conf_option = NULL;
+
     /*
-     * Handy way to *try* and find all used options:
-     * grep -rn case\ \'[a-zA-Z]\' | awk '{print $3}' | sed s/\'//g | sed s/\://g | sort | uniq | less
+     * A caller that already owns a TCTI (ie batch mode) hands it in and
+     * expects it to be reused rather than a new one being loaded.
      */
-    struct option long_options [] = {
-        { "tcti",          required_argument, NULL, 'T' },
-        { "help",          optional_argument, NULL, 'h' },
-        { "verbose",       no_argument,       NULL, 'V' },
-        { "quiet",         no_argument,       NULL, 'Q' },
-        { "version",       no_argument,       NULL, 'v' },
-        { "enable-errata", no_argument,       NULL, 'Z' },
+    bool is_tcti_preloaded = tcti && *tcti;
+
+    /* the common options are parsed ahead of the options of the tool */
+    tpm2_option_table tables[] = {
+        {
+            .short_opts = common_short_opts,
+            .long_opts = common_long_opts,
+            .len = ARRAY_LEN(common_long_opts),
+        },
+        {
+            .short_opts = tool_opts ? tool_opts->short_opts : "",
+            .long_opts = tool_opts ? tool_opts->long_opts : NULL,
+            .len = tool_opts ? tool_opts->len : 0,
+        },
     };
 
-    const char *tcti_conf_option = NULL;
-
-    /* handle any options */
-    const char* common_short_opts = "T:h::vVQZ";
-    tpm2_options *opts = tpm2_options_new(common_short_opts,
-            ARRAY_LEN(long_options), long_options, NULL, NULL, 0);
-    if (!opts) {
+    tpm2_option_parser parser;
+    result = tpm2_option_parser_init(&parser, argc, argv, tables,
+            ARRAY_LEN(tables));
+    if (!result) {
         return tpm2_option_code_err;
     }
 
-    /* Get the options from the tool */
-    if (tool_opts) {
-        result = tpm2_options_cat(&opts, tool_opts);
-        if (!result) {
-            goto out;
-        }
-    }
-
-    optind = 1;
-
     /* Parse the options, calling the tool callback if unknown */
     int c;
-    while ((c = getopt_long(argc, argv, opts->short_opts, opts->long_opts, NULL))
-            != -1) {
+    while ((c = tpm2_option_parser_next(&parser)) != -1) {
         switch (c) {
         case 'T':
-            if (opts->flags & TPM2_OPTIONS_NO_SAPI) {
+            if (tool_opts && (tool_opts->flags & TPM2_OPTIONS_NO_SAPI)) {
                 LOG_ERR("%s: tool doesn't support the TCTI option", argv[0]);
                 goto out;
             }
             /* only attempt to get options from tcti option string */
-            tcti_conf_option = optarg;
+            tcti_conf_option = parser.optarg;
             break;
         case 'h':
             show_help = true;
             /*
              * argv[0] = "tool name"
-             * argv[1] = "--help=no/man" argv[2] = 0
+             * argv[1] = "--help=no/man" or "-h=no/man"
              */
-            if (argv[optind - 1]) {
-                if (!strcmp(argv[optind - 1], "--help=no-man") ||
-                    !strcmp(argv[optind - 1], "-h=no-man") ||
-                    (argc < optind && !strcmp(argv[optind], "no-man"))) {
+            if (parser.optarg) {
+                const char *value = parser.optarg[0] == '=' ?
+                        &parser.optarg[1] : parser.optarg;
+                if (!strcmp(value, "no-man")) {
                     manpager = false;
-                    optind++;
-                /*
-                 * argv[0] = "tool name"
-                 * argv[1] = "--help" argv[2] = "no/man"
-                 */
-                } else if (!strcmp(argv[optind - 1], "--help=man") ||
-                           !strcmp(argv[optind - 1], "-h=man") ||
-                           (argc < optind && !strcmp(argv[optind], "man"))) {
+                } else if (!strcmp(value, "man")) {
                     manpager = true;
                     explicit_manpager = true;
-                    optind++;
                 } else {
-                    /*
-                     * argv[0] = "tool name"
-                     * argv[1] = "--help" argv[2] = 0
-                     */
-                    if (optind >= argc && argc == 2) {
-                        manpager = false;
-                    } else {
-                        /*
-                         * ERROR
-                         */
-                        show_help = false;
-                        LOG_ERR("Unknown help argument, got: \"%s\"", argv[optind]);
-                    }
+                    show_help = false;
+                    LOG_ERR("Unknown help argument, got: \"%s\"", value);
                 }
+            /*
+             * argv[0] = "tool name"
+             * argv[1] = "--help" argv[2] = 0
+             */
+            } else if (parser.index >= argc && argc == 2) {
+                manpager = false;
+            } else {
+                /*
+                 * ERROR
+                 */
+                show_help = false;
+                LOG_ERR("Unknown help argument, got: \"%s\"",
+                        parser.index < argc ? argv[parser.index] : "");
             }
             goto out;
             break;
@@ -344,33 +616,43 @@ tpm2_option_code tpm2_handle_options(int argc, char **argv,
         case 'Z':
             flags->enable_errata = 1;
             break;
+        case COMMON_OPT_JSON:
+            if (!tool_opts || !(tool_opts->flags & TPM2_OPTIONS_JSON)) {
+                LOG_ERR("%s: tool doesn't support the JSON output", argv[0]);
+                goto out;
+            }
+            flags->json = 1;
+            break;
+        case COMMON_OPT_RUNTIME_STATS:
+            flags->stats = 1;
+            break;
         case '?':
             goto out;
         default:
             /* NULL on_opt handler and unknown option specified is an error */
-            if (!tool_opts || !tool_opts->callbacks.on_opt) {
+            if (!has_on_opt(tool_opts)) {
                 LOG_ERR("Unknown option found: %c", c);
                 goto out;
             }
-            result = tool_opts->callbacks.on_opt(c, optarg);
+            result = call_on_opt(tool_opts, c, parser.optarg);
             if (!result) {
                 goto out;
             }
         }
     }
 
-    char **tool_args = &argv[optind];
-    int tool_argc = argc - optind;
+    char **tool_args = parser.args;
+    int tool_argc = parser.args_len;
 
     /* have args and no handler, error condition */
-    if (tool_argc && (!tool_opts || !tool_opts->callbacks.on_arg)) {
+    if (tool_argc && !has_on_arg(tool_opts)) {
         LOG_ERR("Got arguments but the tool takes no arguments");
         show_help = true;
         goto out;
     }
     /* have args and a handler to process */
-    else if (tool_argc && tool_opts->callbacks.on_arg) {
-        result = tool_opts->callbacks.on_arg(tool_argc, tool_args);
+    else if (tool_argc) {
+        result = call_on_arg(tool_opts, tool_argc, tool_args);
         if (!result) {
             goto out;
         }
@@ -382,25 +664,45 @@ tpm2_option_code tpm2_handle_options(int argc, char **argv,
         /* tool doesn't request a sapi, don't initialize one */
         if (!tool_opts || !(tool_opts->flags & TPM2_OPTIONS_NO_SAPI)) {
 
-            if (tcti_conf_option == NULL)
+            if (tcti_conf_option == NULL && !is_tcti_preloaded)
                 tcti_conf_option = tpm2_util_getenv(TPM2TOOLS_ENV_TCTI);
-            else if (!strcmp(tcti_conf_option, "none")) {
+            else if (tcti_conf_option && !strcmp(tcti_conf_option, "none")) {
                 if (!tool_opts
                         || !(tool_opts->flags & TPM2_OPTIONS_OPTIONAL_SAPI)) {
                     LOG_ERR("Requested no tcti, but tool requires TCTI.");
                     goto out;
                 }
+                if (is_tcti_preloaded) {
+                    *tcti = NULL;
+                }
                 goto none;
             }
-            rc_tcti = Tss2_TctiLdr_Initialize(tcti_conf_option, tcti);
+
+            if (is_tcti_preloaded) {
+                if (tcti_conf_option) {
+                    LOG_WARN("Ignoring tcti \"%s\", using the shared tcti",
+                            tcti_conf_option);
+                }
+                goto errata;
+            }
+
+            tpm2_trace_phase_begin(tpm2_trace_phase_tcti);
+            rc_tcti = TSS2_RC_SUCCESS;
+            if (!tpm2_device_tcti_init(tcti_conf_option, tcti)) {
+                rc_tcti = Tss2_TctiLdr_Initialize(tcti_conf_option, tcti);
+            }
+            tpm2_trace_phase_end(tpm2_trace_phase_tcti);
             if (rc_tcti != TSS2_RC_SUCCESS || !*tcti) {
                 LOG_ERR("Could not load tcti, got: \"%s\"", tcti_conf_option);
                 goto out;
             }
+            snprintf(tcti_conf, sizeof(tcti_conf), "%s",
+                    tcti_conf_option ? tcti_conf_option : "");
             /*
              * no loader requested ie --tcti=none is an error if tool
              * doesn't indicate an optional SAPI
              */
+errata:
             if (!flags->enable_errata) {
                 flags->enable_errata = !!tpm2_util_getenv(
                         TPM2TOOLS_ENV_ENABLE_ERRATA);
@@ -441,7 +743,7 @@ out:
         rc = tpm2_option_code_stop;
     }
 
-    tpm2_options_free(opts);
+    tpm2_option_parser_free(&parser);
 
     return rc;
 }
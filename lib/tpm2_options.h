@@ -13,6 +13,12 @@
 
 #define TPM2TOOLS_ENV_TCTI      "TPM2TOOLS_TCTI"
 
+/*
+ * A semicolon separated list of TCTI configurations to run a tool against
+ * concurrently, a process per target.
+ */
+#define TPM2TOOLS_ENV_TARGETS   "TPM2TOOLS_TARGETS"
+
 #define TPM2TOOLS_ENV_ENABLE_ERRATA  "TPM2TOOLS_ENABLE_ERRATA"
 
 typedef union tpm2_option_flags tpm2_option_flags;
@@ -21,6 +27,8 @@ union tpm2_option_flags {
         uint8_t verbose :1;
         uint8_t quiet :1;
         uint8_t enable_errata :1;
+        uint8_t json :1;
+        uint8_t stats :1;
     };
     uint8_t all;
 };
@@ -58,19 +66,36 @@ typedef bool (*tpm2_option_handler)(char key, char *value);
  */
 typedef bool (*tpm2_arg_handler)(int argc, char **argv);
 
+/**
+ * The option and argument handlers of a tool holding its state in a
+ * per-invocation context rather than in file statics, see
+ * tpm2_options_new_ctx(). They behave as tpm2_option_handler and
+ * tpm2_arg_handler, with the context of the invocation as the first argument.
+ */
+typedef bool (*tpm2_option_handler_ctx)(void *tool_ctx, char key, char *value);
+typedef bool (*tpm2_arg_handler_ctx)(void *tool_ctx, int argc, char **argv);
+
 /**
  * TPM2_OPTIONS_* flags change default behavior of the argument parser
  *
  * TPM2_OPTIONS_NO_SAPI:
  *  Skip SAPI initialization. Removes the "-T" common option.
+ *
+ * TPM2_OPTIONS_JSON:
+ *  The tool outputs through tpm2_writer, which takes the "--json" common
+ *  option to output JSON rather than YAML.
  */
 #define TPM2_OPTIONS_NO_SAPI 0x1
 #define TPM2_OPTIONS_OPTIONAL_SAPI 0x2
+#define TPM2_OPTIONS_JSON 0x4
 
 struct tpm2_options {
     struct {
         tpm2_option_handler on_opt;
         tpm2_arg_handler on_arg;
+        tpm2_option_handler_ctx on_opt_ctx;
+        tpm2_arg_handler_ctx on_arg_ctx;
+        void *tool_ctx;
     } callbacks;
     char *short_opts;
     size_t len;
@@ -104,6 +129,16 @@ tpm2_options *tpm2_options_new(const char *short_opts, size_t len,
         const struct option *long_opts, tpm2_option_handler on_opt,
         tpm2_arg_handler on_arg, uint32_t flags);
 
+/**
+ * As tpm2_options_new(), for the handlers of a tool with a per-invocation
+ * context.
+ * @param tool_ctx
+ *  The context handed to on_opt and on_arg, owned by the caller.
+ */
+tpm2_options *tpm2_options_new_ctx(const char *short_opts, size_t len,
+        const struct option *long_opts, tpm2_option_handler_ctx on_opt,
+        tpm2_arg_handler_ctx on_arg, uint32_t flags, void *tool_ctx);
+
 /**
  * Concatenates two tpm2_options objects, with src appended on
  * dest. The internal callbacks for tpm2_arg_handler and tpm2_option_handler
@@ -125,6 +160,70 @@ bool tpm2_options_cat(tpm2_options **dest, tpm2_options *src);
  */
 void tpm2_options_free(tpm2_options *opts);
 
+/*
+ * A table of options in the format of getopt_long(). The parser walks a
+ * list of tables, so the common options and the options of a tool are
+ * parsed without concatenating them.
+ */
+typedef struct tpm2_option_table tpm2_option_table;
+struct tpm2_option_table {
+    const char *short_opts;
+    const struct option *long_opts;
+    size_t len;
+};
+
+/*
+ * A reentrant getopt_long(), the state of a parse is kept in the parser and
+ * argv is not permuted. The arguments that are not options are collected in
+ * args, in order. Like getopt_long(), "--" ends the options and long options
+ * can be abbreviated to a unique prefix.
+ */
+typedef struct tpm2_option_parser tpm2_option_parser;
+struct tpm2_option_parser {
+    int argc;
+    char **argv;
+    const tpm2_option_table *tables;
+    size_t tables_len;
+    /* the next element of argv to parse */
+    int index;
+    /* the remaining short options of an element, ie "Q" of "-VQ" */
+    char *group;
+    /* the argument of the option last returned */
+    char *optarg;
+    char **args;
+    int args_len;
+};
+
+/**
+ * Starts parsing an argument vector.
+ * @param parser
+ *  The parser to initialize.
+ * @param argc
+ *  The number of elements of argv.
+ * @param argv
+ *  The argument vector, argv[0] being the program name.
+ * @param tables
+ *  The option tables, an option found in an earlier table takes precedence.
+ * @param tables_len
+ *  The number of tables.
+ * @return
+ *  true on success, false otherwise.
+ */
+bool tpm2_option_parser_init(tpm2_option_parser *parser, int argc,
+        char **argv, const tpm2_option_table *tables, size_t tables_len);
+
+/**
+ * Parses the next option.
+ * @param parser
+ *  The parser.
+ * @return
+ *  Like getopt_long(), the value of the option with its argument in
+ *  parser->optarg, '?' on an invalid option and -1 after the last option.
+ */
+int tpm2_option_parser_next(tpm2_option_parser *parser);
+
+void tpm2_option_parser_free(tpm2_option_parser *parser);
+
 typedef enum tpm2_option_code tpm2_option_code;
 enum tpm2_option_code {
     tpm2_option_code_continue,
@@ -144,7 +243,9 @@ enum tpm2_option_code {
  * @param flags
  *  The tpm2_option_flags to set during parsing.
  * @param tcti
- *  The tcti initialized from the tcti options.
+ *  The tcti initialized from the tcti options. If *tcti is non-NULL on entry
+ *  it is treated as an already loaded TCTI and reused, no new TCTI is loaded.
+ *  It is set to NULL if the tool runs with --tcti=none.
  * @return
  *  A tpm option code indicating if an error, further processing
  *  or an immediate exit is desired.
@@ -156,6 +257,15 @@ tpm2_option_code tpm2_handle_options(int argc, char **argv,
         tpm2_options *tool_opts, tpm2_option_flags *flags,
         TSS2_TCTI_CONTEXT **tcti);
 
+/**
+ * The configuration of the TCTI the tool talks to the TPM through, as given
+ * with --tcti or TPM2TOOLS_TCTI, so caches that outlive the tool can tell the
+ * TPMs of a host apart.
+ * @return
+ *  The configuration, an empty string for the default TCTI.
+ */
+const char *tpm2_options_get_tcti(void);
+
 /**
  * Print usage summary for a given tpm2 tool.
  *
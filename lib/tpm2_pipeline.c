@@ -0,0 +1,56 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+#include "tpm2_pipeline.h"
+
+tool_rc tpm2_pipeline_run(ESYS_CONTEXT *ectx, const tpm2_pipeline_ops *ops,
+        void *userdata) {
+
+    bool is_next = false;
+    tool_rc rc = ops->prepare(userdata, &is_next);
+
+    bool is_response = false;
+    while (rc == tool_rc_success && is_next) {
+
+        rc = ops->submit(ectx, userdata);
+        if (rc != tool_rc_success) {
+            break;
+        }
+
+        /* host work while the TPM runs the command */
+        if (is_response) {
+            is_response = false;
+            if (ops->complete) {
+                rc = ops->complete(userdata);
+            }
+        }
+
+        is_next = false;
+        if (rc == tool_rc_success) {
+            rc = ops->prepare(userdata, &is_next);
+        }
+
+        /* always collect the response, even if the host work failed */
+        tool_rc finish_rc = ops->finish(ectx, userdata);
+        is_response = finish_rc == tool_rc_success;
+        if (rc == tool_rc_success) {
+            rc = finish_rc;
+        }
+
+        /* the response may call for another command */
+        if (rc == tool_rc_success && !is_next) {
+            rc = ops->prepare(userdata, &is_next);
+        }
+    }
+
+    if (is_response) {
+        if (rc == tool_rc_success) {
+            if (ops->complete) {
+                rc = ops->complete(userdata);
+            }
+        } else if (ops->discard) {
+            ops->discard(userdata);
+        }
+    }
+
+    return rc;
+}
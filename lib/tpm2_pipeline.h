@@ -0,0 +1,65 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+#ifndef LIB_TPM2_PIPELINE_H_
+#define LIB_TPM2_PIPELINE_H_
+
+#include <stdbool.h>
+
+#include <tss2/tss2_esys.h>
+
+#include "tool_rc.h"
+
+/*
+ * Runs a series of commands through the Esys_*_Async and Esys_*_Finish pairs
+ * of ESAPI, so the host works while the TPM does. An ESAPI context only has
+ * one command in flight, so the pipeline is two deep: while the TPM runs a
+ * command, the response of the previous one is completed and the next one is
+ * prepared. The steps of a pipeline are, in the order they run per command:
+ *
+ *   prepare   Readies the next command on the host, eg reads the next chunk
+ *             of input, or says there is none. It runs while the previous
+ *             command is at the TPM, and again after its response is in if
+ *             it said there is none, as a response can call for another
+ *             command. So it has to be idempotent until the submit.
+ *   submit    Sends the prepared command with an Esys_*_Async call.
+ *   finish    Collects the response with the matching Esys_*_Finish call,
+ *             blocking in the TCTI until it is in, and keeps it for complete.
+ *             It is called for every command sent, even after an error, so
+ *             the ESAPI context is ready for the next command. It releases
+ *             what it got on an error.
+ *   complete  Consumes the response, eg writes it out, while the TPM runs the
+ *             next command. It releases the response, even on an error.
+ *             Optional.
+ *   discard   Releases a response that is not completed after an error.
+ *             Optional.
+ *
+ * The state of the pipeline, the commands and the responses, is in the
+ * userdata every step is called with.
+ */
+typedef struct tpm2_pipeline_ops tpm2_pipeline_ops;
+struct tpm2_pipeline_ops {
+    tool_rc (*prepare)(void *userdata, bool *is_next);
+    tool_rc (*submit)(ESYS_CONTEXT *ectx, void *userdata);
+    tool_rc (*finish)(ESYS_CONTEXT *ectx, void *userdata);
+    tool_rc (*complete)(void *userdata);
+    void (*discard)(void *userdata);
+};
+
+/**
+ * Runs the commands of a pipeline until prepare has no further one, or a step
+ * fails.
+ * @param ectx
+ *  The ESAPI context, without a command in flight.
+ * @param ops
+ *  The steps of the pipeline.
+ * @param userdata
+ *  The state of the pipeline passed to every step.
+ * @return
+ *  tool_rc_success when every command ran and every response was completed,
+ *  the result of the first step that failed otherwise. No command is in
+ *  flight on return.
+ */
+tool_rc tpm2_pipeline_run(ESYS_CONTEXT *ectx, const tpm2_pipeline_ops *ops,
+        void *userdata);
+
+#endif /* LIB_TPM2_PIPELINE_H_ */
@@ -4,15 +4,144 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include <tss2/tss2_mu.h>
+
 #include "files.h"
 #include "log.h"
+#include "pcr.h"
 #include "tpm2.h"
 #include "tpm2_alg_util.h"
+#include "tpm2_approved_policy.h"
 #include "tpm2_openssl.h"
 #include "tpm2_policy.h"
+#include "tpm2_ticket_cache.h"
 #include "tpm2_tool.h"
 #include "tpm2_util.h"
 
+/*
+ * The host side of a trial session started without a TPM. Every policy
+ * command extends the policy digest as TPM2 Part 3 describes for it:
+ *   policyDigest' = H(policyDigest || commandCode || arguments)
+ * The arguments are appended to the buffer marshaled, the buffer is large
+ * enough for the largest of them, the digest list of PolicyOR.
+ */
+typedef struct policy_calc policy_calc;
+struct policy_calc {
+    tpm2_session *session;
+    BYTE buffer[sizeof(TPMU_HA) + sizeof(TPM2_CC) + sizeof(TPML_DIGEST)];
+    size_t size;
+};
+
+static bool policy_calc_add(policy_calc *calc, const BYTE *data,
+        size_t size) {
+
+    if (!size) {
+        return true;
+    }
+
+    if (size > sizeof(calc->buffer) - calc->size) {
+        LOG_ERR("Policy arguments too large");
+        return false;
+    }
+
+    memcpy(&calc->buffer[calc->size], data, size);
+    calc->size += size;
+
+    return true;
+}
+
+static bool policy_calc_add_u32(policy_calc *calc, UINT32 value) {
+
+    TSS2_RC rval = Tss2_MU_UINT32_Marshal(value, calc->buffer,
+            sizeof(calc->buffer), &calc->size);
+    if (rval != TSS2_RC_SUCCESS) {
+        LOG_PERR(Tss2_MU_UINT32_Marshal, rval);
+        return false;
+    }
+
+    return true;
+}
+
+static bool policy_calc_add_u8(policy_calc *calc, UINT8 value) {
+
+    return policy_calc_add(calc, &value, sizeof(value));
+}
+
+/*
+ * Starts the next update from the current policy digest, or from all zeros
+ * for the commands that reset it, ie PolicyOR and PolicyAuthorize.
+ */
+static void policy_calc_start(policy_calc *calc, tpm2_session *session,
+        bool is_reset) {
+
+    TPM2B_DIGEST *digest = tpm2_session_get_policy_digest(session);
+    if (is_reset) {
+        memset(digest->buffer, 0, digest->size);
+    }
+
+    calc->session = session;
+    memcpy(calc->buffer, digest->buffer, digest->size);
+    calc->size = digest->size;
+}
+
+static tool_rc policy_calc_finish(policy_calc *calc) {
+
+    TPM2B_DIGEST *digest = tpm2_session_get_policy_digest(calc->session);
+    TPMI_ALG_HASH halg = tpm2_session_get_authhash(calc->session);
+
+    bool result = tpm2_openssl_hash_compute_data(halg, calc->buffer,
+            calc->size, digest);
+    if (!result) {
+        LOG_ERR("Could not compute the policy digest");
+        return tool_rc_general_error;
+    }
+
+    return tool_rc_success;
+}
+
+/* the update of a command with a single argument, or none */
+static tool_rc policy_calc_update(tpm2_session *session, TPM2_CC cc,
+        const BYTE *data, size_t size) {
+
+    policy_calc calc;
+    policy_calc_start(&calc, session, false);
+
+    bool result = policy_calc_add_u32(&calc, cc)
+            && policy_calc_add(&calc, data, size);
+
+    return result ? policy_calc_finish(&calc) : tool_rc_general_error;
+}
+
+/*
+ * PolicyUpdate() of Part 3: the name of the authorizing entity goes in with
+ * the command code, the policy reference in a second round.
+ */
+static tool_rc policy_calc_update_ref(tpm2_session *session, TPM2_CC cc,
+        bool is_reset, const TPM2B_NAME *name, const TPM2B_NONCE *policy_ref) {
+
+    policy_calc calc;
+    policy_calc_start(&calc, session, is_reset);
+
+    bool result = policy_calc_add_u32(&calc, cc)
+            && policy_calc_add(&calc, name->name, name->size);
+    tool_rc rc = result ? policy_calc_finish(&calc) : tool_rc_general_error;
+    if (rc != tool_rc_success) {
+        return rc;
+    }
+
+    policy_calc_start(&calc, session, false);
+    result = policy_calc_add(&calc, policy_ref->buffer, policy_ref->size);
+
+    return result ? policy_calc_finish(&calc) : tool_rc_general_error;
+}
+
+static tool_rc policy_calc_unsupported(const char *command) {
+
+    LOG_ERR("%s needs a TPM, it cannot be used with a trial session started "
+            "without one", command);
+    return tool_rc_general_error;
+}
+
 static bool evaluate_populate_pcr_digests(TPML_PCR_SELECTION *pcr_selections,
         const char *raw_pcrs_file, TPML_DIGEST *pcr_values) {
 
@@ -79,6 +208,77 @@ static bool evaluate_populate_pcr_digests(TPML_PCR_SELECTION *pcr_selections,
     return true;
 }
 
+static bool read_pcr_values_file(const char *raw_pcrs_file,
+        TPML_DIGEST *pcr_values) {
+
+    FILE *fp = files_fopen(raw_pcrs_file, "rb");
+    if (fp == NULL) {
+        LOG_ERR("Cannot open pcr-input-file %s", raw_pcrs_file);
+        return false;
+    }
+    // Bank hashAlg values dictates the order of the list of digests
+    unsigned i;
+    for (i = 0; i < pcr_values->count; i++) {
+        size_t sz = fread(&pcr_values->digests[i].buffer, 1,
+                pcr_values->digests[i].size, fp);
+        if (sz != pcr_values->digests[i].size) {
+            const char *msg =
+                    ferror(fp) ? strerror(errno) : "end of file reached";
+            LOG_ERR("Reading from file \"%s\" failed: %s", raw_pcrs_file,
+                    msg);
+            fclose(fp);
+            return false;
+        }
+    }
+    fclose(fp);
+
+    return true;
+}
+
+tool_rc tpm2_policy_pcr_digest_from_file(TPMI_ALG_HASH halg,
+        const char *raw_pcrs_file, TPML_PCR_SELECTION *pcr_selections,
+        TPM2B_DIGEST *pcr_digest) {
+
+    TPML_DIGEST pcr_values = { .count = 0 };
+
+    bool result = evaluate_populate_pcr_digests(pcr_selections, raw_pcrs_file,
+            &pcr_values)
+            && read_pcr_values_file(raw_pcrs_file, &pcr_values);
+    if (!result) {
+        return tool_rc_general_error;
+    }
+
+    result = tpm2_openssl_hash_pcr_values(halg, &pcr_values, pcr_digest);
+    if (!result) {
+        LOG_ERR("Could not hash pcr values");
+        return tool_rc_general_error;
+    }
+
+    return tool_rc_success;
+}
+
+static tool_rc policy_calc_pcr(tpm2_session *session,
+        const TPM2B_DIGEST *pcr_digest, const TPML_PCR_SELECTION *pcrs) {
+
+    policy_calc calc;
+    policy_calc_start(&calc, session, false);
+
+    bool result = policy_calc_add_u32(&calc, TPM2_CC_PolicyPCR);
+    if (result) {
+        TSS2_RC rval = Tss2_MU_TPML_PCR_SELECTION_Marshal(pcrs, calc.buffer,
+                sizeof(calc.buffer), &calc.size);
+        if (rval != TSS2_RC_SUCCESS) {
+            LOG_PERR(Tss2_MU_TPML_PCR_SELECTION_Marshal, rval);
+            result = false;
+        }
+    }
+
+    result = result && policy_calc_add(&calc, pcr_digest->buffer,
+            pcr_digest->size);
+
+    return result ? policy_calc_finish(&calc) : tool_rc_general_error;
+}
+
 tool_rc tpm2_policy_build_pcr(ESYS_CONTEXT *ectx, tpm2_session *policy_session,
         const char *raw_pcrs_file, TPML_PCR_SELECTION *pcr_selections,
         TPM2B_DIGEST *raw_pcr_digest) {
@@ -93,7 +293,9 @@ tool_rc tpm2_policy_build_pcr(ESYS_CONTEXT *ectx, tpm2_session *policy_session,
 
     TPM2B_DIGEST pcr_digest = TPM2B_TYPE_INIT(TPM2B_DIGEST, buffer);
     TPMI_ALG_HASH auth_hash = tpm2_session_get_authhash(policy_session);
-    ESYS_TR handle = tpm2_session_get_handle(policy_session);
+    bool is_offline = tpm2_session_is_offline(policy_session);
+    ESYS_TR handle = is_offline ?
+            ESYS_TR_NONE : tpm2_session_get_handle(policy_session);
 
     /*
      * If digest of all PCRs is directly given, handle it here.
@@ -105,10 +307,17 @@ tool_rc tpm2_policy_build_pcr(ESYS_CONTEXT *ectx, tpm2_session *policy_session,
     }
     // Call the PolicyPCR command
     if (raw_pcr_digest) {
-        return tpm2_policy_pcr(ectx, handle, ESYS_TR_NONE, ESYS_TR_NONE,
+        return is_offline ?
+            policy_calc_pcr(policy_session, raw_pcr_digest, pcr_selections) :
+            tpm2_policy_pcr(ectx, handle, ESYS_TR_NONE, ESYS_TR_NONE,
             ESYS_TR_NONE, raw_pcr_digest, pcr_selections);
     }
 
+    if (is_offline && !raw_pcrs_file) {
+        LOG_ERR("The PCR values must be given as a file without a TPM");
+        return tool_rc_general_error;
+    }
+
 
     bool result = evaluate_populate_pcr_digests(pcr_selections, raw_pcrs_file,
             &pcr_values);
@@ -118,45 +327,34 @@ tool_rc tpm2_policy_build_pcr(ESYS_CONTEXT *ectx, tpm2_session *policy_session,
 
     //If PCR input for policy is from raw pcrs file
     if (raw_pcrs_file) {
-        FILE *fp = fopen(raw_pcrs_file, "rb");
-        if (fp == NULL) {
-            LOG_ERR("Cannot open pcr-input-file %s", raw_pcrs_file);
+        result = read_pcr_values_file(raw_pcrs_file, &pcr_values);
+        if (!result) {
             return tool_rc_general_error;
         }
-        // Bank hashAlg values dictates the order of the list of digests
-        unsigned i;
-        for (i = 0; i < pcr_values.count; i++) {
-            size_t sz = fread(&pcr_values.digests[i].buffer, 1,
-                    pcr_values.digests[i].size, fp);
-            if (sz != pcr_values.digests[i].size) {
-                const char *msg =
-                        ferror(fp) ? strerror(errno) : "end of file reached";
-                LOG_ERR("Reading from file \"%s\" failed: %s", raw_pcrs_file,
-                        msg);
-                fclose(fp);
-                return tool_rc_general_error;
-            }
-        }
-        fclose(fp);
     } else {
-        UINT32 pcr_update_counter;
-        TPML_DIGEST *pcr_val = NULL;
-        // Read PCRs
-        tool_rc rc = tpm2_pcr_read(ectx, ESYS_TR_NONE, ESYS_TR_NONE,
-                ESYS_TR_NONE, pcr_selections, &pcr_update_counter,
-                NULL, &pcr_val);
+        // Read PCRs, a quote of the same PCRs may have read them already
+        tpm2_pcrs pcrs = { 0 };
+        tool_rc rc = pcr_read_pcr_values(ectx, pcr_selections, &pcrs);
         if (rc != tool_rc_success) {
+            pcr_pcrs_free(&pcrs);
             return rc;
         }
 
-        UINT32 i;
-        pcr_val->count = pcr_values.count;
-        for (i = 0; i < pcr_val->count; i++) {
-            memcpy(pcr_values.digests[i].buffer, pcr_val->digests[i].buffer,
-                    pcr_val->digests[i].size);
-            pcr_values.digests[i].size = pcr_val->digests[i].size;
+        UINT32 count = 0;
+        size_t i;
+        for (i = 0; i < pcrs.count; i++) {
+            TPML_DIGEST *pcr_val = &pcrs.pcr_values[i];
+            UINT32 j;
+            for (j = 0; j < pcr_val->count && count < pcr_values.count; j++) {
+                pcr_values.digests[count++] = pcr_val->digests[j];
+            }
+        }
+        pcr_pcrs_free(&pcrs);
+
+        if (count != pcr_values.count) {
+            LOG_ERR("TPM did not return all of the selected PCRs");
+            return tool_rc_general_error;
         }
-        free(pcr_val);
     }
 
     // Calculate hashes
@@ -166,22 +364,31 @@ tool_rc tpm2_policy_build_pcr(ESYS_CONTEXT *ectx, tpm2_session *policy_session,
         return tool_rc_general_error;
     }
 
+    if (is_offline) {
+        return policy_calc_pcr(policy_session, &pcr_digest, pcr_selections);
+    }
+
     // Call the PolicyPCR command
     return tpm2_policy_pcr(ectx, handle, ESYS_TR_NONE, ESYS_TR_NONE,
             ESYS_TR_NONE, &pcr_digest, pcr_selections);
 }
 
-tool_rc tpm2_policy_build_policyauthorize(ESYS_CONTEXT *ectx,
-        tpm2_session *policy_session, const char *policy_digest_path,
-        const char *qualifying_data,
-        const char *verifying_pubkey_name_path, const char *ticket_path) {
+/*
+ * The approved policy, policyRef and signer name of a PolicyAuthorize, of
+ * which the approved policy and policyRef are optional. Without a name file
+ * the name is left empty.
+ */
+static tool_rc policy_authorize_key_load(const char *policy_digest_path,
+        const char *qualifying_data, const char *verifying_pubkey_name_path,
+        tpm2_approved_policy_key *key) {
+
+    memset(key, 0, sizeof(*key));
 
     bool result = true;
-    TPM2B_DIGEST approved_policy = { .size = 0 };
     if (policy_digest_path) {
-        approved_policy.size = sizeof(TPMU_HA);
+        key->approved_policy.size = sizeof(TPMU_HA);
         result = files_load_bytes_from_path(policy_digest_path,
-            approved_policy.buffer, &approved_policy.size);
+            key->approved_policy.buffer, &key->approved_policy.size);
     }
     if (!result) {
         return tool_rc_general_error;
@@ -190,38 +397,60 @@ tool_rc tpm2_policy_build_policyauthorize(ESYS_CONTEXT *ectx,
     /*
      * Qualifier data is optional. If not specified default to 0
      */
-
-    TPM2B_NONCE policy_qualifier = { .size = 0 };
-
     if (qualifying_data) {
-        policy_qualifier.size = sizeof(policy_qualifier.buffer);
+        key->policy_ref.size = sizeof(key->policy_ref.buffer);
         result = tpm2_util_bin_from_hex_or_file(qualifying_data,
-                &policy_qualifier.size, policy_qualifier.buffer);
+                &key->policy_ref.size, key->policy_ref.buffer);
         if (!result) {
             return tool_rc_general_error;
         }
     }
 
+    if (!verifying_pubkey_name_path) {
+        return tool_rc_success;
+    }
+
     unsigned long file_size = 0;
     result = files_get_file_size_path(verifying_pubkey_name_path, &file_size);
     if (!result) {
         return tool_rc_general_error;
     }
 
-    if (!file_size) {
+    if (!file_size || file_size > sizeof(key->signer_name.name)) {
         LOG_ERR("Verifying public key name file \"%s\", cannot be empty",
                 verifying_pubkey_name_path);
         return tool_rc_general_error;
     }
 
-    TPM2B_NAME key_sign = { .size = (uint16_t) file_size };
-
+    key->signer_name.size = (uint16_t) file_size;
     result = files_load_bytes_from_path(verifying_pubkey_name_path,
-            key_sign.name, &key_sign.size);
-    if (!result) {
+            key->signer_name.name, &key->signer_name.size);
+
+    return result ? tool_rc_success : tool_rc_general_error;
+}
+
+tool_rc tpm2_policy_build_policyauthorize(ESYS_CONTEXT *ectx,
+        tpm2_session *policy_session, const char *policy_digest_path,
+        const char *qualifying_data,
+        const char *verifying_pubkey_name_path, const char *ticket_path) {
+
+    if (!verifying_pubkey_name_path) {
+        LOG_ERR("Must specify the name of the verifying public key");
         return tool_rc_general_error;
     }
 
+    tpm2_approved_policy_key key;
+    tool_rc rc = policy_authorize_key_load(policy_digest_path, qualifying_data,
+            verifying_pubkey_name_path, &key);
+    if (rc != tool_rc_success) {
+        return rc;
+    }
+
+    TPM2B_DIGEST approved_policy = key.approved_policy;
+    TPM2B_NONCE policy_qualifier = key.policy_ref;
+    TPM2B_NAME key_sign = key.signer_name;
+
+    bool result;
     TPMT_TK_VERIFIED check_ticket = { .tag = TPM2_ST_VERIFIED, .hierarchy =
             TPM2_RH_OWNER, .digest = { 0 } };
     result = tpm2_session_is_trial(policy_session);
@@ -233,15 +462,148 @@ tool_rc tpm2_policy_build_policyauthorize(ESYS_CONTEXT *ectx,
         }
     }
 
+    /* a trial session does not check the approved policy */
+    if (tpm2_session_is_offline(policy_session)) {
+        return policy_calc_update_ref(policy_session, TPM2_CC_PolicyAuthorize,
+                true, &key_sign, &policy_qualifier);
+    }
+
     ESYS_TR sess_handle = tpm2_session_get_handle(policy_session);
     return tpm2_policy_authorize(ectx, sess_handle, ESYS_TR_NONE, ESYS_TR_NONE,
             ESYS_TR_NONE, &approved_policy, &policy_qualifier, &key_sign,
             &check_ticket);
 }
 
+/*
+ * Verifies the signature of the signer over the approved policy and
+ * policyRef, aHash = H(approvedPolicy || policyRef), for its ticket.
+ */
+static tool_rc policy_authorize_verify(ESYS_CONTEXT *ectx,
+        tpm2_loaded_object *signer, const TPMT_SIGNATURE *signature,
+        const tpm2_approved_policy_key *key, TPMT_TK_VERIFIED *ticket) {
+
+    BYTE message[sizeof(TPMU_HA) + sizeof(key->policy_ref.buffer)];
+    memcpy(message, key->approved_policy.buffer, key->approved_policy.size);
+    memcpy(&message[key->approved_policy.size], key->policy_ref.buffer,
+            key->policy_ref.size);
+
+    TPM2B_DIGEST a_hash = { .size = 0 };
+    bool result = tpm2_openssl_hash_compute_data(
+            signature->signature.any.hashAlg,
+            message, key->approved_policy.size + key->policy_ref.size,
+            &a_hash);
+    if (!result) {
+        LOG_ERR("Could not hash the approved policy");
+        return tool_rc_general_error;
+    }
+
+    TPMT_TK_VERIFIED *validation = NULL;
+    tool_rc rc = tpm2_verifysignature(ectx, signer->tr_handle, &a_hash,
+            signature, &validation);
+    if (rc != tool_rc_success) {
+        return rc;
+    }
+
+    *ticket = *validation;
+    free(validation);
+
+    return tool_rc_success;
+}
+
+tool_rc tpm2_policy_build_policyauthorize_store(ESYS_CONTEXT *ectx,
+        tpm2_session *policy_session, const char *policy_digest_path,
+        const char *qualifying_data, const char *verifying_pubkey_name_path,
+        tpm2_loaded_object *signer, const TPMT_SIGNATURE *signature,
+        const char *store_path) {
+
+    if (tpm2_session_is_trial(policy_session)) {
+        return tpm2_policy_build_policyauthorize(ectx, policy_session,
+                policy_digest_path, qualifying_data,
+                verifying_pubkey_name_path, NULL);
+    }
+
+    tpm2_approved_policy_key key;
+    tool_rc rc = policy_authorize_key_load(policy_digest_path, qualifying_data,
+            verifying_pubkey_name_path, &key);
+    if (rc != tool_rc_success) {
+        return rc;
+    }
+
+    if (!key.signer_name.size) {
+        if (!signer) {
+            LOG_ERR("Must specify the name or the key of the signer");
+            return tool_rc_general_error;
+        }
+        TPM2B_NAME *name = NULL;
+        rc = tpm2_tr_get_name(ectx, signer->tr_handle, &name);
+        if (rc != tool_rc_success) {
+            return rc;
+        }
+        key.signer_name = *name;
+        Esys_Free(name);
+    }
+
+    /* the tickets of the store are only good for the epoch they came in */
+    TPMS_TIME_INFO *current_time = NULL;
+    rc = tpm2_readclock(ectx, &current_time);
+    if (rc != tool_rc_success) {
+        return rc;
+    }
+    TPMS_CLOCK_INFO clock_info = current_time->clockInfo;
+    Esys_Free(current_time);
+
+    TPMT_TK_VERIFIED ticket = { 0 };
+    bool is_stored = tpm2_approved_policy_get(store_path, &clock_info, &key,
+            &ticket);
+    if (!is_stored) {
+        if (!signer || !signature) {
+            LOG_ERR("No ticket for this approved policy in store \"%s\", "
+                    "the signer key and signature are needed to verify it",
+                    store_path);
+            return tool_rc_general_error;
+        }
+
+        rc = policy_authorize_verify(ectx, signer, signature, &key, &ticket);
+        if (rc != tool_rc_success) {
+            return rc;
+        }
+
+        /* a failed store costs the next run a verification, no more */
+        tpm2_approved_policy_put(store_path, &clock_info, &key, &ticket);
+    } else {
+        LOG_INFO("Using the ticket of store \"%s\"", store_path);
+    }
+
+    ESYS_TR sess_handle = tpm2_session_get_handle(policy_session);
+    rc = tpm2_policy_authorize(ectx, sess_handle, ESYS_TR_NONE, ESYS_TR_NONE,
+            ESYS_TR_NONE, &key.approved_policy, &key.policy_ref,
+            &key.signer_name, &ticket);
+    if (rc != tool_rc_success && is_stored) {
+        /* the TPM no longer takes it, eg the hierarchy proof changed */
+        tpm2_approved_policy_remove(store_path, &key);
+    }
+
+    return rc;
+}
+
 tool_rc tpm2_policy_build_policyor(ESYS_CONTEXT *ectx,
         tpm2_session *policy_session, TPML_DIGEST *policy_list) {
 
+    /* a trial session does not check the current digest is in the list */
+    if (tpm2_session_is_offline(policy_session)) {
+        policy_calc calc;
+        policy_calc_start(&calc, policy_session, true);
+
+        bool result = policy_calc_add_u32(&calc, TPM2_CC_PolicyOR);
+        UINT32 i;
+        for (i = 0; result && i < policy_list->count; i++) {
+            result = policy_calc_add(&calc, policy_list->digests[i].buffer,
+                    policy_list->digests[i].size);
+        }
+
+        return result ? policy_calc_finish(&calc) : tool_rc_general_error;
+    }
+
     ESYS_TR sess_handle = tpm2_session_get_handle(policy_session);
     return tpm2_policy_or(ectx, sess_handle, ESYS_TR_NONE, ESYS_TR_NONE,
             ESYS_TR_NONE, policy_list);
@@ -250,6 +612,11 @@ tool_rc tpm2_policy_build_policyor(ESYS_CONTEXT *ectx,
 tool_rc tpm2_policy_build_policypassword(ESYS_CONTEXT *ectx,
         tpm2_session *session) {
 
+    /* PolicyPassword extends the same digest as PolicyAuthValue */
+    if (tpm2_session_is_offline(session)) {
+        return policy_calc_update(session, TPM2_CC_PolicyAuthValue, NULL, 0);
+    }
+
     ESYS_TR policy_session_handle = tpm2_session_get_handle(session);
 
     return tpm2_policy_password(ectx, policy_session_handle, ESYS_TR_NONE,
@@ -259,6 +626,11 @@ tool_rc tpm2_policy_build_policypassword(ESYS_CONTEXT *ectx,
 tool_rc tpm2_policy_build_policynamehash(ESYS_CONTEXT *ectx,
     tpm2_session *session, const TPM2B_DIGEST *name_hash) {
 
+    if (tpm2_session_is_offline(session)) {
+        return policy_calc_update(session, TPM2_CC_PolicyNameHash,
+                name_hash->buffer, name_hash->size);
+    }
+
     ESYS_TR policy_session_handle = tpm2_session_get_handle(session);
 
     return tpm2_policy_namehash(ectx, policy_session_handle, name_hash);
@@ -267,6 +639,11 @@ tool_rc tpm2_policy_build_policynamehash(ESYS_CONTEXT *ectx,
 tool_rc tpm2_policy_build_policytemplate(ESYS_CONTEXT *ectx,
     tpm2_session *session, const TPM2B_DIGEST *template_hash) {
 
+    if (tpm2_session_is_offline(session)) {
+        return policy_calc_update(session, TPM2_CC_PolicyTemplate,
+                template_hash->buffer, template_hash->size);
+    }
+
     ESYS_TR policy_session_handle = tpm2_session_get_handle(session);
 
     return tpm2_policy_template(ectx, policy_session_handle, template_hash);
@@ -275,6 +652,11 @@ tool_rc tpm2_policy_build_policytemplate(ESYS_CONTEXT *ectx,
 tool_rc tpm2_policy_build_policycphash(ESYS_CONTEXT *ectx,
     tpm2_session *session, const TPM2B_DIGEST *cphash) {
 
+    if (tpm2_session_is_offline(session)) {
+        return policy_calc_update(session, TPM2_CC_PolicyCpHash,
+                cphash->buffer, cphash->size);
+    }
+
     ESYS_TR policy_session_handle = tpm2_session_get_handle(session);
 
     return tpm2_policy_cphash(ectx, policy_session_handle, cphash);
@@ -283,6 +665,10 @@ tool_rc tpm2_policy_build_policycphash(ESYS_CONTEXT *ectx,
 tool_rc tpm2_policy_build_policyauthvalue(ESYS_CONTEXT *ectx,
         tpm2_session *session) {
 
+    if (tpm2_session_is_offline(session)) {
+        return policy_calc_update(session, TPM2_CC_PolicyAuthValue, NULL, 0);
+    }
+
     ESYS_TR policy_session_handle = tpm2_session_get_handle(session);
 
     return tpm2_policy_authvalue(ectx, policy_session_handle, ESYS_TR_NONE,
@@ -295,6 +681,10 @@ tool_rc tpm2_policy_build_policysecret(ESYS_CONTEXT *ectx,
         TPM2B_TIMEOUT **timeout, bool is_nonce_tpm,
         const char *policy_qualifier_data, TPM2B_DIGEST *cp_hash) {
 
+    if (tpm2_session_is_offline(policy_session)) {
+        return policy_calc_unsupported("PolicySecret");
+    }
+
     /*
      * Qualifier data is optional. If not specified default to 0
      */
@@ -329,62 +719,154 @@ tpm2_policy_build_policysecret_out:
     return rc;
 }
 
-tool_rc tpm2_policy_build_policyticket(ESYS_CONTEXT *ectx,
-    tpm2_session *policy_session, char *policy_timeout_path,
-    const char *qualifier_data, char *policy_ticket_path,
-    const char *auth_name_path) {
+/*
+ * The policyRef, cpHashA and authorizing object name a ticket was issued for,
+ * all of them optional.
+ */
+static tool_rc policy_ticket_key_load(const char *qualifier_data,
+        const char *cphash_path, const char *auth_name_path,
+        tpm2_ticket_cache_key *key) {
 
-    unsigned long file_size = 0;
+    memset(key, 0, sizeof(*key));
 
-    bool result = files_get_file_size_path(policy_timeout_path, &file_size);
-    if (!result) {
-        return tool_rc_general_error;
-    }
-    TPM2B_TIMEOUT policy_timeout = { .size = (uint16_t) file_size };
-    if (policy_timeout.size) {
-        result = files_load_bytes_from_path(policy_timeout_path,
-                policy_timeout.buffer, &policy_timeout.size);
+    if (qualifier_data) {
+        key->policy_ref.size = sizeof(key->policy_ref.buffer);
+        bool result = tpm2_util_bin_from_hex_or_file(qualifier_data,
+                &key->policy_ref.size, key->policy_ref.buffer);
         if (!result) {
             return tool_rc_general_error;
         }
     }
 
-    result = files_get_file_size_path(auth_name_path, &file_size);
-    if (!result) {
-        return tool_rc_general_error;
-    }
-    TPM2B_NAME auth_name = { .size = (uint16_t) file_size };
-    if (auth_name.size) {
-        result = files_load_bytes_from_path(auth_name_path,
-                auth_name.name, &auth_name.size);
+    if (cphash_path) {
+        bool result = files_load_digest(cphash_path, &key->cp_hash);
         if (!result) {
             return tool_rc_general_error;
         }
     }
 
-    TPM2B_NONCE policyref = TPM2B_EMPTY_INIT;
-    if (qualifier_data) {
-        policyref.size = sizeof(policyref.buffer);
-        result = tpm2_util_bin_from_hex_or_file(qualifier_data, &policyref.size,
-                policyref.buffer);
+    if (auth_name_path) {
+        unsigned long file_size = 0;
+        bool result = files_get_file_size_path(auth_name_path, &file_size);
         if (!result) {
             return tool_rc_general_error;
         }
+        key->auth_name.size = (uint16_t) file_size;
+        if (key->auth_name.size) {
+            result = files_load_bytes_from_path(auth_name_path,
+                    key->auth_name.name, &key->auth_name.size);
+            if (!result) {
+                return tool_rc_general_error;
+            }
+        }
     }
 
+    return tool_rc_success;
+}
+
+tool_rc tpm2_policy_build_policyticket(ESYS_CONTEXT *ectx,
+    tpm2_session *policy_session, char *policy_timeout_path,
+    const char *qualifier_data, char *policy_ticket_path,
+    const char *auth_name_path, const char *cphash_path,
+    const char *ticket_cache_path) {
+
+    if (tpm2_session_is_offline(policy_session)) {
+        return policy_calc_unsupported("PolicyTicket");
+    }
+
+    tpm2_ticket_cache_key key;
+    tool_rc rc = policy_ticket_key_load(qualifier_data, cphash_path,
+            auth_name_path, &key);
+    if (rc != tool_rc_success) {
+        return rc;
+    }
+
+    TPM2B_TIMEOUT policy_timeout = { .size = 0 };
     TPMT_TK_AUTH ticket = { 0 };
-    result = files_load_authorization_ticket(policy_ticket_path, &ticket);
-    if (!result) {
-        LOG_ERR("Failed loading authorization ticket.");
-        return tool_rc_general_error;
+    if (ticket_cache_path) {
+        bool result = tpm2_ticket_cache_get(ticket_cache_path, &key,
+                &policy_timeout, &ticket);
+        if (!result) {
+            LOG_ERR("No unexpired ticket for this authorization in cache "
+                    "\"%s\"", ticket_cache_path);
+            return tool_rc_general_error;
+        }
+    } else {
+        unsigned long file_size = 0;
+        bool result = files_get_file_size_path(policy_timeout_path,
+                &file_size);
+        if (!result) {
+            return tool_rc_general_error;
+        }
+        policy_timeout.size = (uint16_t) file_size;
+        if (policy_timeout.size) {
+            result = files_load_bytes_from_path(policy_timeout_path,
+                    policy_timeout.buffer, &policy_timeout.size);
+            if (!result) {
+                return tool_rc_general_error;
+            }
+        }
+
+        result = files_load_authorization_ticket(policy_ticket_path, &ticket);
+        if (!result) {
+            LOG_ERR("Failed loading authorization ticket.");
+            return tool_rc_general_error;
+        }
     }
 
     ESYS_TR policy_session_handle = tpm2_session_get_handle(policy_session);
 
-    return tpm2_policy_ticket(ectx, policy_session_handle, &policy_timeout,
-        &policyref, &auth_name, &ticket);
+    rc = tpm2_policy_ticket(ectx, policy_session_handle, &policy_timeout,
+        &key.cp_hash, &key.policy_ref, &key.auth_name, &ticket);
+    if (rc != tool_rc_success && ticket_cache_path) {
+        /* the TPM no longer takes it, eg it expired early or was reset */
+        tpm2_ticket_cache_remove(ticket_cache_path, &key);
+    }
 
-    return tool_rc_success;
+    return rc;
+}
+
+tool_rc tpm2_policy_cache_ticket(ESYS_CONTEXT *ectx,
+        const char *ticket_cache_path, tpm2_loaded_object *auth_entity_obj,
+        const char *qualifier_data, const char *cphash_path,
+        INT32 expiration, const TPM2B_TIMEOUT *timeout,
+        const TPMT_TK_AUTH *ticket) {
+
+    tpm2_ticket_cache_key key;
+    tool_rc rc = policy_ticket_key_load(qualifier_data, cphash_path, NULL,
+            &key);
+    if (rc != tool_rc_success) {
+        return rc;
+    }
+
+    return tpm2_policy_cache_ticket_key(ectx, ticket_cache_path,
+            auth_entity_obj, &key.policy_ref, &key.cp_hash, expiration,
+            timeout, ticket);
+}
+
+tool_rc tpm2_policy_cache_ticket_key(ESYS_CONTEXT *ectx,
+        const char *ticket_cache_path, tpm2_loaded_object *auth_entity_obj,
+        const TPM2B_NONCE *policy_ref, const TPM2B_DIGEST *cp_hash,
+        INT32 expiration, const TPM2B_TIMEOUT *timeout,
+        const TPMT_TK_AUTH *ticket) {
+
+    tpm2_ticket_cache_key key = {
+        .policy_ref = *policy_ref,
+        .cp_hash = *cp_hash,
+    };
+
+    TPM2B_NAME *name = NULL;
+    tool_rc rc = tpm2_tr_get_name(ectx, auth_entity_obj->tr_handle, &name);
+    if (rc != tool_rc_success) {
+        return rc;
+    }
+    key.auth_name = *name;
+    Esys_Free(name);
+
+    bool result = tpm2_ticket_cache_put(ticket_cache_path, &key, expiration,
+            timeout, ticket);
+
+    return result ? tool_rc_success : tool_rc_general_error;
 }
 
 tool_rc tpm2_policy_build_policysigned(ESYS_CONTEXT *ectx,
@@ -424,6 +906,10 @@ tool_rc tpm2_policy_build_policysigned(ESYS_CONTEXT *ectx,
         }
     }
 
+    if (tpm2_session_is_offline(policy_session)) {
+        return policy_calc_unsupported("PolicySigned");
+    }
+
     ESYS_TR policy_session_handle = tpm2_session_get_handle(policy_session);
 
     TPM2B_NONCE *nonce_tpm = NULL;
@@ -492,6 +978,16 @@ tpm2_policy_build_policysigned_out:
 tool_rc tpm2_policy_get_digest(ESYS_CONTEXT *ectx, tpm2_session *session,
         TPM2B_DIGEST **policy_digest) {
 
+    if (tpm2_session_is_offline(session)) {
+        *policy_digest = malloc(sizeof(**policy_digest));
+        if (!*policy_digest) {
+            LOG_ERR("oom");
+            return tool_rc_general_error;
+        }
+        **policy_digest = *tpm2_session_get_policy_digest(session);
+        return tool_rc_success;
+    }
+
     ESYS_TR handle = tpm2_session_get_handle(session);
 
     return tpm2_policy_getdigest(ectx, handle, ESYS_TR_NONE, ESYS_TR_NONE,
@@ -501,6 +997,14 @@ tool_rc tpm2_policy_get_digest(ESYS_CONTEXT *ectx, tpm2_session *session,
 tool_rc tpm2_policy_build_policycommandcode(ESYS_CONTEXT *ectx,
         tpm2_session *session, uint32_t command_code) {
 
+    if (tpm2_session_is_offline(session)) {
+        policy_calc calc;
+        policy_calc_start(&calc, session, false);
+        bool result = policy_calc_add_u32(&calc, TPM2_CC_PolicyCommandCode)
+                && policy_calc_add_u32(&calc, command_code);
+        return result ? policy_calc_finish(&calc) : tool_rc_general_error;
+    }
+
     ESYS_TR handle = tpm2_session_get_handle(session);
 
     return tpm2_policy_command_code(ectx, handle, ESYS_TR_NONE, ESYS_TR_NONE,
@@ -510,6 +1014,11 @@ tool_rc tpm2_policy_build_policycommandcode(ESYS_CONTEXT *ectx,
 tool_rc tpm2_policy_build_policynvwritten(ESYS_CONTEXT *ectx,
         tpm2_session *session, TPMI_YES_NO written_set) {
 
+    if (tpm2_session_is_offline(session)) {
+        return policy_calc_update(session, TPM2_CC_PolicyNvWritten,
+                &written_set, sizeof(written_set));
+    }
+
     ESYS_TR handle = tpm2_session_get_handle(session);
 
     return tpm2_policy_nv_written(ectx, handle, ESYS_TR_NONE, ESYS_TR_NONE,
@@ -519,6 +1028,11 @@ tool_rc tpm2_policy_build_policynvwritten(ESYS_CONTEXT *ectx,
 tool_rc tpm2_policy_build_policylocality(ESYS_CONTEXT *ectx,
         tpm2_session *session, TPMA_LOCALITY locality) {
 
+    if (tpm2_session_is_offline(session)) {
+        return policy_calc_update(session, TPM2_CC_PolicyLocality, &locality,
+                sizeof(locality));
+    }
+
     ESYS_TR handle = tpm2_session_get_handle(session);
 
     return tpm2_policy_locality(ectx, handle, ESYS_TR_NONE, ESYS_TR_NONE,
@@ -553,6 +1067,20 @@ tool_rc tpm2_policy_build_policyduplicationselect(ESYS_CONTEXT *ectx,
         return tool_rc_general_error;
     }
 
+    /* the object name only goes in if it is part of the policy */
+    if (tpm2_session_is_offline(session)) {
+        policy_calc calc;
+        policy_calc_start(&calc, session, false);
+        bool result = policy_calc_add_u32(&calc,
+                TPM2_CC_PolicyDuplicationSelect)
+                && (!is_include_obj
+                        || policy_calc_add(&calc, obj_name.name, obj_name.size))
+                && policy_calc_add(&calc, new_parent_name.name,
+                        new_parent_name.size)
+                && policy_calc_add_u8(&calc, is_include_obj);
+        return result ? policy_calc_finish(&calc) : tool_rc_general_error;
+    }
+
     ESYS_TR handle = tpm2_session_get_handle(session);
 
     return tpm2_policy_duplication_select(ectx, handle, ESYS_TR_NONE,
@@ -568,6 +1096,12 @@ static bool tpm2_policy_populate_digest_list(char *buf,
         return false;
     }
 
+    if (policy_list->count == ARRAY_LEN(policy_list->digests)) {
+        LOG_ERR("A PolicyOR takes at most %zu policy digests, see --tree",
+                ARRAY_LEN(policy_list->digests));
+        return false;
+    }
+
     unsigned long file_size;
     bool retval = files_get_file_size_path(buf, &file_size);
     if (!retval) {
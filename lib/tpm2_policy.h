@@ -30,6 +30,24 @@ tool_rc tpm2_policy_build_pcr(ESYS_CONTEXT *context,
         tpm2_session *policy_session, const char *raw_pcrs_file,
         TPML_PCR_SELECTION *pcr_selections, TPM2B_DIGEST *raw_pcr_digest);
 
+/**
+ * Computes the digest of the PCR values saved to a file, the pcrDigest
+ * argument of PolicyPCR, without a TPM.
+ * @param halg
+ *  The hash algorithm of the policy.
+ * @param raw_pcrs_file
+ *  A file output from tpm2_pcrread -o option.
+ * @param pcr_selections
+ *  The pcr selections the file was read with.
+ * @param pcr_digest
+ *  The digest of the PCR values.
+ * @return
+ *  tool_rc indicating status.
+ */
+tool_rc tpm2_policy_pcr_digest_from_file(TPMI_ALG_HASH halg,
+        const char *raw_pcrs_file, TPML_PCR_SELECTION *pcr_selections,
+        TPM2B_DIGEST *pcr_digest);
+
 /**
  * Enables a signing authority to authorize policies
  * @param ectx
@@ -53,6 +71,38 @@ tool_rc tpm2_policy_build_policyauthorize(ESYS_CONTEXT *ectx,
         const char *policy_qualifier,
         const char *verifying_pubkey_name_path, const char *ticket_path);
 
+/**
+ * Like tpm2_policy_build_policyauthorize(), with the verification ticket of
+ * an approved-policy store. A ticket stored for the approved policy,
+ * policyRef and signer in the current reset and restart epoch of the TPM
+ * skips the VerifySignature, otherwise the signature is verified and its
+ * ticket stored for the next authorizations. A trial session needs no ticket.
+ * @param ectx
+ *   The Enhanced system api context
+ * @param policy_session
+ *   The policy session that has the policy digest to be authorized
+ * @param policy_digest_path
+ *   The approved policy digest file
+ * @param qualifying_data
+ *   The policy qualifier, a path to a file or a hex string, optional.
+ * @param verifying_pubkey_name_path
+ *   The name of the signer key, optional with the signer.
+ * @param signer
+ *   The loaded signer key, optional when the ticket is stored.
+ * @param signature
+ *   The signature of the approved policy and qualifier, optional when the
+ *   ticket is stored.
+ * @param store_path
+ *   The approved-policy store.
+ * @return
+ *   tool_rc indicating status.
+ */
+tool_rc tpm2_policy_build_policyauthorize_store(ESYS_CONTEXT *ectx,
+        tpm2_session *policy_session, const char *policy_digest_path,
+        const char *qualifying_data, const char *verifying_pubkey_name_path,
+        tpm2_loaded_object *signer, const TPMT_SIGNATURE *signature,
+        const char *store_path);
+
 /**
  * Compounds policies in an OR fashion
  *
@@ -214,13 +264,61 @@ tool_rc tpm2_policy_build_policysigned(ESYS_CONTEXT *ectx,
  *  The file containing the auth ticket
  * @param auth_name_file
  *  The auth name file containing the name of the auth object
+ * @param cphash_path
+ *  The file containing the cpHashA the ticket was issued for, optional.
+ * @param ticket_cache_path
+ *  The ticket cache to take the timeout and ticket from instead of their
+ *  files, optional. A ticket the TPM does not accept is dropped from it.
  *
  * @return     { description_of_the_return_value }
  */
 tool_rc tpm2_policy_build_policyticket(ESYS_CONTEXT *ectx,
     tpm2_session *policy_session, char *policy_timeout_path,
     const char *qualifier_data_path, char *policy_ticket_path,
-    const char *auth_name_file);
+    const char *auth_name_file, const char *cphash_path,
+    const char *ticket_cache_path);
+
+/**
+ * Caches the ticket of a PolicySigned or PolicySecret assertion, for
+ * tpm2_policy_build_policyticket() to satisfy the same authorization later.
+ * @param ectx
+ *  The Enhanced system api (ESAPI) context
+ * @param ticket_cache_path
+ *  The ticket cache.
+ * @param auth_entity_obj
+ *  The key that verified the signature or the object whose secret was used.
+ * @param qualifier_data
+ *  The policyRef of the assertion, optional.
+ * @param cphash_path
+ *  The file containing the cpHashA of the assertion, optional.
+ * @param expiration
+ *  The expiration of the assertion.
+ * @param timeout
+ *  The timeout the assertion returned.
+ * @param ticket
+ *  The ticket the assertion returned.
+ * @return
+ *  tool_rc indicating status.
+ */
+tool_rc tpm2_policy_cache_ticket(ESYS_CONTEXT *ectx,
+        const char *ticket_cache_path, tpm2_loaded_object *auth_entity_obj,
+        const char *qualifier_data, const char *cphash_path,
+        INT32 expiration, const TPM2B_TIMEOUT *timeout,
+        const TPMT_TK_AUTH *ticket);
+
+/**
+ * Like tpm2_policy_cache_ticket(), with the policyRef and cpHashA of the
+ * assertion rather than the files holding them, ie of a streamed assertion.
+ * @param policy_ref
+ *  The policyRef of the assertion, empty for none.
+ * @param cp_hash
+ *  The cpHashA of the assertion, empty for none.
+ */
+tool_rc tpm2_policy_cache_ticket_key(ESYS_CONTEXT *ectx,
+        const char *ticket_cache_path, tpm2_loaded_object *auth_entity_obj,
+        const TPM2B_NONCE *policy_ref, const TPM2B_DIGEST *cp_hash,
+        INT32 expiration, const TPM2B_TIMEOUT *timeout,
+        const TPMT_TK_AUTH *ticket);
 
 /**
  * Parses the policy digest algorithm for the list of policies specified
@@ -0,0 +1,386 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "files.h"
+#include "log.h"
+#include "tpm2_alg_util.h"
+#include "tpm2_hex.h"
+#include "tpm2_openssl.h"
+#include "tpm2_policy.h"
+#include "tpm2_policy_or_tree.h"
+#include "tpm2_util.h"
+
+static size_t level_count(const tpm2_policy_or_tree *tree, size_t level) {
+
+    return tree->levels[level + 1] - tree->levels[level];
+}
+
+/* the number of PolicyORs grouping a level of count nodes */
+static size_t group_count(size_t count) {
+
+    return (count + TPM2_POLICY_OR_TREE_ARITY - 1) / TPM2_POLICY_OR_TREE_ARITY;
+}
+
+/* the first node of a group, the groups of a level differ by one at most */
+static size_t group_start(size_t count, size_t groups, size_t group) {
+
+    return group * count / groups;
+}
+
+static size_t group_of(size_t count, size_t groups, size_t node) {
+
+    return ((node + 1) * groups - 1) / count;
+}
+
+/*
+ * The PolicyOR of a group, computed as the TPM does: the digest is reset
+ * before it is extended with the command code and the digests of the group.
+ */
+static bool group_digest(TPMI_ALG_HASH halg, const TPM2B_DIGEST *digests,
+        size_t count, TPM2B_DIGEST *digest) {
+
+    UINT16 hash_size = tpm2_alg_util_get_hash_size(halg);
+
+    BYTE buffer[sizeof(TPMU_HA) + sizeof(UINT32)
+            + TPM2_POLICY_OR_TREE_ARITY * sizeof(TPMU_HA)];
+    memset(buffer, 0, hash_size);
+    size_t offset = hash_size;
+
+    UINT32 cc = tpm2_util_hton_32(TPM2_CC_PolicyOR);
+    memcpy(&buffer[offset], &cc, sizeof(cc));
+    offset += sizeof(cc);
+
+    size_t i;
+    for (i = 0; i < count; i++) {
+        memcpy(&buffer[offset], digests[i].buffer, hash_size);
+        offset += hash_size;
+    }
+
+    return tpm2_openssl_hash_compute_data(halg, buffer, offset, digest);
+}
+
+bool tpm2_policy_or_tree_build(TPMI_ALG_HASH halg, const TPM2B_DIGEST *leaves,
+        size_t count, tpm2_policy_or_tree *tree) {
+
+    memset(tree, 0, sizeof(*tree));
+    tree->halg = halg;
+
+    UINT16 hash_size = tpm2_alg_util_get_hash_size(halg);
+    if (!hash_size) {
+        LOG_ERR("Invalid policy digest algorithm");
+        return false;
+    }
+
+    if (count < 2 || count > TPM2_POLICY_OR_TREE_LEAVES_MAX) {
+        LOG_ERR("Expected 2 to %u policy digests, got %zu",
+                TPM2_POLICY_OR_TREE_LEAVES_MAX, count);
+        return false;
+    }
+
+    size_t i;
+    for (i = 0; i < count; i++) {
+        if (leaves[i].size != hash_size) {
+            LOG_ERR("Policy digest %zu is of %u bytes, expected %u", i,
+                    leaves[i].size, hash_size);
+            return false;
+        }
+    }
+
+    /* every level is at most an eighth of the one below, rounded up */
+    size_t total = 0;
+    size_t n = count;
+    do {
+        total += n;
+        n = n > 1 ? group_count(n) : 0;
+    } while (n);
+
+    tree->nodes = calloc(total, sizeof(*tree->nodes));
+    if (!tree->nodes) {
+        LOG_ERR("oom");
+        return false;
+    }
+
+    memcpy(tree->nodes, leaves, count * sizeof(*leaves));
+    tree->levels[1] = count;
+
+    while (level_count(tree, tree->depth) > 1) {
+        size_t below = tree->levels[tree->depth];
+        size_t nodes = level_count(tree, tree->depth);
+        size_t groups = group_count(nodes);
+        size_t next = tree->levels[tree->depth + 1];
+
+        size_t g;
+        for (g = 0; g < groups; g++) {
+            size_t start = group_start(nodes, groups, g);
+            size_t end = group_start(nodes, groups, g + 1);
+            bool result = group_digest(halg, &tree->nodes[below + start],
+                    end - start, &tree->nodes[next + g]);
+            if (!result) {
+                LOG_ERR("Could not compute the PolicyOR digest");
+                tpm2_policy_or_tree_free(tree);
+                return false;
+            }
+        }
+
+        tree->depth++;
+        tree->levels[tree->depth + 1] = next + groups;
+    }
+
+    return true;
+}
+
+void tpm2_policy_or_tree_free(tpm2_policy_or_tree *tree) {
+
+    free(tree->nodes);
+    memset(tree, 0, sizeof(*tree));
+}
+
+const TPM2B_DIGEST *tpm2_policy_or_tree_root(const tpm2_policy_or_tree *tree) {
+
+    return &tree->nodes[tree->levels[tree->depth]];
+}
+
+bool tpm2_policy_or_tree_find(const tpm2_policy_or_tree *tree,
+        const TPM2B_DIGEST *digest, size_t *leaf) {
+
+    size_t i;
+    for (i = 0; i < tpm2_policy_or_tree_count(tree); i++) {
+        const TPM2B_DIGEST *d = &tree->nodes[i];
+        if (d->size == digest->size
+                && !memcmp(d->buffer, digest->buffer, d->size)) {
+            *leaf = i;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+void tpm2_policy_or_tree_path(const tpm2_policy_or_tree *tree, size_t leaf,
+        size_t path[TPM2_POLICY_OR_TREE_DEPTH_MAX]) {
+
+    size_t node = leaf;
+    size_t level;
+    for (level = 0; level < tree->depth; level++) {
+        size_t nodes = level_count(tree, level);
+        size_t groups = group_count(nodes);
+        size_t group = group_of(nodes, groups, node);
+
+        path[level] = node - group_start(nodes, groups, group);
+        node = group;
+    }
+}
+
+tool_rc tpm2_policy_or_tree_satisfy(ESYS_CONTEXT *ectx, tpm2_session *session,
+        const tpm2_policy_or_tree *tree, size_t leaf) {
+
+    size_t node = leaf;
+    size_t level;
+    for (level = 0; level < tree->depth; level++) {
+        size_t nodes = level_count(tree, level);
+        size_t groups = group_count(nodes);
+        size_t group = group_of(nodes, groups, node);
+        size_t start = group_start(nodes, groups, group);
+        size_t end = group_start(nodes, groups, group + 1);
+
+        TPML_DIGEST branches = { .count = end - start };
+        memcpy(branches.digests, &tree->nodes[tree->levels[level] + start],
+                branches.count * sizeof(branches.digests[0]));
+
+        tool_rc rc = tpm2_policy_build_policyor(ectx, session, &branches);
+        if (rc != tool_rc_success) {
+            LOG_ERR("Could not satisfy the PolicyOR of level %zu", level);
+            return rc;
+        }
+
+        node = group;
+    }
+
+    return tool_rc_success;
+}
+
+/* a growing array of leaves for the parsers */
+typedef struct leaves leaves;
+struct leaves {
+    TPM2B_DIGEST *digests;
+    size_t count;
+    size_t capacity;
+};
+
+static TPM2B_DIGEST *leaves_next(leaves *l) {
+
+    if (l->count == TPM2_POLICY_OR_TREE_LEAVES_MAX) {
+        LOG_ERR("More than %u policy digests",
+                TPM2_POLICY_OR_TREE_LEAVES_MAX);
+        return NULL;
+    }
+
+    if (l->count == l->capacity) {
+        size_t capacity = l->capacity ? 2 * l->capacity : 64;
+        TPM2B_DIGEST *digests = realloc(l->digests,
+                capacity * sizeof(*digests));
+        if (!digests) {
+            LOG_ERR("oom");
+            return NULL;
+        }
+        l->digests = digests;
+        l->capacity = capacity;
+    }
+
+    TPM2B_DIGEST *digest = &l->digests[l->count++];
+    memset(digest, 0, sizeof(*digest));
+
+    return digest;
+}
+
+bool tpm2_policy_or_tree_from_list(char *str, tpm2_policy_or_tree *tree) {
+
+    memset(tree, 0, sizeof(*tree));
+
+    char *saveptr = NULL;
+    char *alg = strtok_r(str, ":", &saveptr);
+    char *files = strtok_r(NULL, "", &saveptr);
+    if (!alg || !files) {
+        LOG_ERR("Expected a policy list, ie. sha256:policy1,policy2");
+        return false;
+    }
+
+    TPMI_ALG_HASH halg = tpm2_alg_util_from_optarg(alg,
+            tpm2_alg_util_flags_hash);
+    if (halg == TPM2_ALG_ERROR) {
+        LOG_ERR("Invalid/ Unspecified policy digest algorithm.");
+        return false;
+    }
+    UINT16 hash_size = tpm2_alg_util_get_hash_size(halg);
+
+    bool result = false;
+    leaves l = { 0 };
+    char *file;
+    for (file = strtok_r(files, ",", &saveptr); file;
+            file = strtok_r(NULL, ",", &saveptr)) {
+        TPM2B_DIGEST *digest = leaves_next(&l);
+        if (!digest) {
+            goto out;
+        }
+
+        unsigned long file_size = 0;
+        if (!files_get_file_size_path(file, &file_size)
+                || file_size != hash_size) {
+            LOG_ERR("Policy digest \"%s\" should be of %u bytes", file,
+                    hash_size);
+            goto out;
+        }
+
+        digest->size = hash_size;
+        if (!files_load_bytes_from_path(file, digest->buffer, &digest->size)) {
+            goto out;
+        }
+    }
+
+    result = tpm2_policy_or_tree_build(halg, l.digests, l.count, tree);
+
+out:
+    free(l.digests);
+
+    return result;
+}
+
+bool tpm2_policy_or_tree_save(const tpm2_policy_or_tree *tree,
+        const char *path) {
+
+    FILE *f = files_fopen(path, "w");
+    if (!f) {
+        LOG_ERR("Could not open file \"%s\" error: \"%s\"", path,
+                strerror(errno));
+        return false;
+    }
+
+    bool result = fprintf(f, "%s\n",
+            tpm2_alg_util_algtostr(tree->halg, tpm2_alg_util_flags_hash)) > 0;
+
+    size_t i;
+    for (i = 0; result && i < tpm2_policy_or_tree_count(tree); i++) {
+        result = tpm2_hex_fprint(f, tree->nodes[i].buffer,
+                tree->nodes[i].size, false) && fputc('\n', f) != EOF;
+    }
+
+    if (fclose(f) || !result) {
+        LOG_ERR("Could not write policy tree \"%s\"", path);
+        return false;
+    }
+
+    return true;
+}
+
+bool tpm2_policy_or_tree_load(const char *path, tpm2_policy_or_tree *tree) {
+
+    memset(tree, 0, sizeof(*tree));
+
+    FILE *f = files_fopen(path, "r");
+    if (!f) {
+        LOG_ERR("Could not open file \"%s\" error: \"%s\"", path,
+                strerror(errno));
+        return false;
+    }
+
+    bool result = false;
+    TPMI_ALG_HASH halg = TPM2_ALG_ERROR;
+    UINT16 hash_size = 0;
+    leaves l = { 0 };
+    char *line = NULL;
+    size_t line_size = 0;
+    size_t line_number = 0;
+    ssize_t len;
+    while ((len = getline(&line, &line_size, f)) != -1) {
+        line_number++;
+
+        while (len && (line[len - 1] == '\n' || line[len - 1] == '\r')) {
+            line[--len] = '\0';
+        }
+
+        if (!len) {
+            continue;
+        }
+
+        if (halg == TPM2_ALG_ERROR) {
+            halg = tpm2_alg_util_from_optarg(line, tpm2_alg_util_flags_hash);
+            hash_size = tpm2_alg_util_get_hash_size(halg);
+            if (!hash_size) {
+                LOG_ERR("%s:%zu: Invalid policy digest algorithm \"%s\"",
+                        path, line_number, line);
+                goto out;
+            }
+            continue;
+        }
+
+        if ((size_t) len != 2 * hash_size) {
+            LOG_ERR("%s:%zu: Expected a digest of %u bytes", path,
+                    line_number, hash_size);
+            goto out;
+        }
+
+        TPM2B_DIGEST *digest = leaves_next(&l);
+        if (!digest) {
+            goto out;
+        }
+
+        if (!tpm2_hex_decode(line, len, digest->buffer)) {
+            LOG_ERR("%s:%zu: Invalid hex digest", path, line_number);
+            goto out;
+        }
+        digest->size = hash_size;
+    }
+
+    result = tpm2_policy_or_tree_build(halg, l.digests, l.count, tree);
+
+out:
+    free(line);
+    free(l.digests);
+    fclose(f);
+
+    return result;
+}
@@ -0,0 +1,165 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+#ifndef LIB_TPM2_POLICY_OR_TREE_H_
+#define LIB_TPM2_POLICY_OR_TREE_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include <tss2/tss2_esys.h>
+
+#include "tool_rc.h"
+#include "tpm2_session.h"
+
+/* a PolicyOR takes at most the 8 digests of a TPML_DIGEST */
+#define TPM2_POLICY_OR_TREE_ARITY 8
+
+/* 8^6 branches, more than any allowlist of PCR states */
+#define TPM2_POLICY_OR_TREE_LEAVES_MAX 262144
+
+#define TPM2_POLICY_OR_TREE_DEPTH_MAX 6
+
+/*
+ * A balanced tree of PolicyOR over any number of branch digests, the leaves.
+ * Each level groups the nodes of the level below into as few PolicyORs of at
+ * most 8 digests as it takes, of sizes that differ by at most one, up to the
+ * root, the policy digest of the whole tree. A leaf is satisfied by a
+ * PolicyOR per level, with the digests of its group and then those of the
+ * group of each of its ancestors.
+ *
+ * A tree file holds the name of the hash algorithm on its first line and the
+ * hex digest of a leaf per line after it, the tree is built again from the
+ * leaves when it is loaded.
+ */
+typedef struct tpm2_policy_or_tree tpm2_policy_or_tree;
+struct tpm2_policy_or_tree {
+    TPMI_ALG_HASH halg;
+    /* the nodes of all the levels, from the leaves up to the root */
+    TPM2B_DIGEST *nodes;
+    /* the index of the first node of each level, then the node count */
+    size_t levels[TPM2_POLICY_OR_TREE_DEPTH_MAX + 2];
+    /* the number of PolicyOR levels */
+    size_t depth;
+};
+
+/**
+ * Builds a tree from its leaves, computing the PolicyOR digests offline.
+ * @param halg
+ *  The hash algorithm of the policy.
+ * @param leaves
+ *  The branch digests, at least two, all of the size of the algorithm.
+ * @param count
+ *  The number of leaves, up to TPM2_POLICY_OR_TREE_LEAVES_MAX.
+ * @param tree
+ *  The tree to fill, released with tpm2_policy_or_tree_free().
+ * @return
+ *  true on success, false on error.
+ */
+bool tpm2_policy_or_tree_build(TPMI_ALG_HASH halg, const TPM2B_DIGEST *leaves,
+        size_t count, tpm2_policy_or_tree *tree);
+
+/**
+ * Builds a tree from a policy list of tpm2_policyor, ie.
+ * "sha256:policy1,policy2", of any number of digest files.
+ * @param str
+ *  The policy list, tokenized in place.
+ * @param tree
+ *  The tree to fill, released with tpm2_policy_or_tree_free().
+ * @return
+ *  true on success, false on error.
+ */
+bool tpm2_policy_or_tree_from_list(char *str, tpm2_policy_or_tree *tree);
+
+/**
+ * Saves the leaves of a tree to a tree file.
+ * @param tree
+ *  The tree.
+ * @param path
+ *  The path of the file.
+ * @return
+ *  true on success, false on error.
+ */
+bool tpm2_policy_or_tree_save(const tpm2_policy_or_tree *tree,
+        const char *path);
+
+/**
+ * Loads a tree file and builds its tree.
+ * @param path
+ *  The path of the file.
+ * @param tree
+ *  The tree to fill, released with tpm2_policy_or_tree_free().
+ * @return
+ *  true on success, false on error.
+ */
+bool tpm2_policy_or_tree_load(const char *path, tpm2_policy_or_tree *tree);
+
+/**
+ * Releases the nodes of a tree.
+ * @param tree
+ *  The tree.
+ */
+void tpm2_policy_or_tree_free(tpm2_policy_or_tree *tree);
+
+/**
+ * @param tree
+ *  The tree.
+ * @return
+ *  The number of leaves.
+ */
+static inline size_t tpm2_policy_or_tree_count(const tpm2_policy_or_tree *tree) {
+    return tree->levels[1];
+}
+
+/**
+ * @param tree
+ *  The tree.
+ * @return
+ *  The root digest, the policy the tree authorizes.
+ */
+const TPM2B_DIGEST *tpm2_policy_or_tree_root(const tpm2_policy_or_tree *tree);
+
+/**
+ * Finds the leaf of a digest.
+ * @param tree
+ *  The tree.
+ * @param digest
+ *  The digest, ie. the current digest of a policy session.
+ * @param leaf
+ *  Receives the index of the first leaf of the digest.
+ * @return
+ *  true when found, false otherwise.
+ */
+bool tpm2_policy_or_tree_find(const tpm2_policy_or_tree *tree,
+        const TPM2B_DIGEST *digest, size_t *leaf);
+
+/**
+ * Gets the path of a leaf, the position of the leaf and then of each of its
+ * ancestors in the digests of their PolicyOR.
+ * @param tree
+ *  The tree.
+ * @param leaf
+ *  The index of the leaf.
+ * @param path
+ *  Receives a position per level, tree->depth of them.
+ */
+void tpm2_policy_or_tree_path(const tpm2_policy_or_tree *tree, size_t leaf,
+        size_t path[TPM2_POLICY_OR_TREE_DEPTH_MAX]);
+
+/**
+ * Satisfies the tree for a leaf whose policy the session satisfies, with a
+ * PolicyOR per level.
+ * @param ectx
+ *  The Enhanced system api context.
+ * @param session
+ *  The policy session, whose digest is the leaf.
+ * @param tree
+ *  The tree.
+ * @param leaf
+ *  The index of the leaf.
+ * @return
+ *  tool_rc indicating status.
+ */
+tool_rc tpm2_policy_or_tree_satisfy(ESYS_CONTEXT *ectx, tpm2_session *session,
+        const tpm2_policy_or_tree *tree, size_t leaf);
+
+#endif /* LIB_TPM2_POLICY_OR_TREE_H_ */
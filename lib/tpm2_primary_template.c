@@ -0,0 +1,135 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <tss2/tss2_mu.h>
+
+#include "files.h"
+#include "log.h"
+#include "tpm2_openssl.h"
+#include "tpm2_primary_template.h"
+
+#define PRIMARY_TEMPLATE_VERSION 1
+
+static bool template_marshal(const TPM2B_PUBLIC *public,
+        UINT8 buffer[sizeof(TPM2B_PUBLIC)], size_t *size) {
+
+    *size = 0;
+    TSS2_RC rval = Tss2_MU_TPM2B_PUBLIC_Marshal(public, buffer,
+            sizeof(TPM2B_PUBLIC), size);
+    if (rval != TSS2_RC_SUCCESS) {
+        LOG_PERR(Tss2_MU_TPM2B_PUBLIC_Marshal, rval);
+        return false;
+    }
+
+    return true;
+}
+
+static bool template_hash(UINT8 *buffer, size_t size, TPM2B_DIGEST *digest) {
+
+    return tpm2_openssl_hash_compute_data(TPM2_ALG_SHA256, buffer, size,
+            digest);
+}
+
+bool tpm2_primary_template_digest(const TPM2B_PUBLIC *public,
+        TPM2B_DIGEST *digest) {
+
+    UINT8 buffer[sizeof(TPM2B_PUBLIC)];
+    size_t size = 0;
+
+    return template_marshal(public, buffer, &size)
+            && template_hash(buffer, size, digest);
+}
+
+bool tpm2_primary_template_save(const char *path, const TPM2B_PUBLIC *public,
+        TPM2B_DIGEST *digest) {
+
+    UINT8 buffer[sizeof(TPM2B_PUBLIC)];
+    size_t size = 0;
+    TPM2B_DIGEST tmp = { 0 };
+    digest = digest ? digest : &tmp;
+    bool result = template_marshal(public, buffer, &size)
+            && template_hash(buffer, size, digest);
+    if (!result) {
+        return false;
+    }
+
+    FILE *f = files_fopen(path, "wb");
+    if (!f) {
+        LOG_ERR("Could not open template file \"%s\", error: %s", path,
+                strerror(errno));
+        return false;
+    }
+
+    result = files_write_header(f, PRIMARY_TEMPLATE_VERSION)
+            && files_write_16(f, size)
+            && files_write_bytes(f, buffer, size)
+            && files_write_16(f, digest->size)
+            && files_write_bytes(f, digest->buffer, digest->size);
+
+    result = !fclose(f) && result;
+    if (!result) {
+        LOG_ERR("Could not write template file \"%s\"", path);
+    }
+
+    return result;
+}
+
+bool tpm2_primary_template_load(const char *path, TPM2B_PUBLIC *public,
+        TPM2B_DIGEST *digest) {
+
+    FILE *f = files_fopen(path, "rb");
+    if (!f) {
+        LOG_ERR("Could not open template file \"%s\", error: %s", path,
+                strerror(errno));
+        return false;
+    }
+
+    UINT8 buffer[sizeof(TPM2B_PUBLIC)];
+    UINT32 version = 0;
+    UINT16 size = 0;
+    TPM2B_DIGEST saved = { 0 };
+    bool result = files_read_header(f, &version)
+            && version == PRIMARY_TEMPLATE_VERSION
+            && files_read_16(f, &size)
+            && size <= sizeof(buffer)
+            && files_read_bytes(f, buffer, size)
+            && files_read_16(f, &saved.size)
+            && saved.size <= sizeof(saved.buffer)
+            && files_read_bytes(f, saved.buffer, saved.size);
+
+    fclose(f);
+
+    if (!result) {
+        LOG_ERR("Template file \"%s\" is not a primary template", path);
+        return false;
+    }
+
+    TPM2B_DIGEST computed = { 0 };
+    result = template_hash(buffer, size, &computed);
+    if (!result) {
+        return false;
+    }
+
+    if (computed.size != saved.size
+            || memcmp(computed.buffer, saved.buffer, saved.size)) {
+        LOG_ERR("Template file \"%s\" does not match its digest", path);
+        return false;
+    }
+
+    size_t offset = 0;
+    TSS2_RC rval = Tss2_MU_TPM2B_PUBLIC_Unmarshal(buffer, size, &offset,
+            public);
+    if (rval != TSS2_RC_SUCCESS || offset != size) {
+        LOG_ERR("Template file \"%s\" holds no valid TPM2B_PUBLIC", path);
+        return false;
+    }
+
+    if (digest) {
+        *digest = computed;
+    }
+
+    return true;
+}
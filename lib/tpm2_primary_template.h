@@ -0,0 +1,67 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+#ifndef LIB_TPM2_PRIMARY_TEMPLATE_H_
+#define LIB_TPM2_PRIMARY_TEMPLATE_H_
+
+#include <stdbool.h>
+
+#include <tss2/tss2_tpm2_types.h>
+
+/*
+ * A primary template is the TPM2B_PUBLIC that goes into CreatePrimary, with
+ * everything tpm2_createprimary and tpm2_createek resolve on every run
+ * already in place: the algorithm, attribute and policy options, the unique
+ * data file and, for an EK, the template and nonce NV indices. A tool given a
+ * saved template skips all of that and the NV reads.
+ *
+ * The digest of a template is the SHA256 of the marshaled TPM2B_PUBLIC and
+ * names the template, ie in the primary cache.
+ *
+ * The file is laid out as, all numbers big endian:
+ *   the header of files_write_header()
+ *   U16 size, then the marshaled TPM2B_PUBLIC
+ *   U16 size, then the digest
+ */
+
+/**
+ * Computes the digest of a template.
+ * @param public
+ *  The template.
+ * @param digest
+ *  Receives the digest.
+ * @return
+ *  true on success, false otherwise.
+ */
+bool tpm2_primary_template_digest(const TPM2B_PUBLIC *public,
+        TPM2B_DIGEST *digest);
+
+/**
+ * Saves a template and its digest.
+ * @param path
+ *  The file to save to.
+ * @param public
+ *  The template.
+ * @param digest
+ *  Receives the digest of the template, or NULL.
+ * @return
+ *  true on success, false otherwise.
+ */
+bool tpm2_primary_template_save(const char *path, const TPM2B_PUBLIC *public,
+        TPM2B_DIGEST *digest);
+
+/**
+ * Loads a template saved with tpm2_primary_template_save(), checking it
+ * against its digest.
+ * @param path
+ *  The file to load from.
+ * @param public
+ *  Receives the template.
+ * @param digest
+ *  Receives the digest of the template, or NULL.
+ * @return
+ *  true on success, false otherwise.
+ */
+bool tpm2_primary_template_load(const char *path, TPM2B_PUBLIC *public,
+        TPM2B_DIGEST *digest);
+
+#endif /* LIB_TPM2_PRIMARY_TEMPLATE_H_ */
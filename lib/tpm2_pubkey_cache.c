@@ -0,0 +1,220 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+#include <errno.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <sys/stat.h>
+
+#include <tss2/tss2_mu.h>
+
+#include "files.h"
+#include "log.h"
+#include "tpm2_pubkey_cache.h"
+#include "tpm2_util.h"
+
+#define PUBKEY_CACHE_VERSION 1
+
+typedef struct pubkey_cache_entry pubkey_cache_entry;
+struct pubkey_cache_entry {
+    UINT8 fingerprint[TPM2_PUBKEY_CACHE_FINGERPRINT_SIZE];
+    TPMI_ALG_PUBLIC alg;
+    TPM2B_PUBLIC parsed;
+};
+
+/* the keys parsed by this process */
+static struct {
+    pubkey_cache_entry *entries;
+    size_t count;
+    size_t capacity;
+} cache;
+
+static bool entry_path(const char *dir,
+        const UINT8 fingerprint[TPM2_PUBKEY_CACHE_FINGERPRINT_SIZE],
+        TPMI_ALG_PUBLIC alg, char path[PATH_MAX]) {
+
+    char hex[2 * TPM2_PUBKEY_CACHE_FINGERPRINT_SIZE + 1];
+    size_t i;
+    for (i = 0; i < TPM2_PUBKEY_CACHE_FINGERPRINT_SIZE; i++) {
+        snprintf(&hex[2 * i], 3, "%02x", fingerprint[i]);
+    }
+
+    int len = snprintf(path, PATH_MAX, "%s/%s-%04x", dir, hex, alg);
+
+    return len > 0 && len < PATH_MAX;
+}
+
+static const char *cache_dir(void) {
+
+    const char *dir = tpm2_util_getenv(TPM2TOOLS_ENV_PUBKEY_CACHE);
+
+    return dir && dir[0] ? dir : NULL;
+}
+
+bool tpm2_pubkey_cache_read(const char *dir,
+        const UINT8 fingerprint[TPM2_PUBKEY_CACHE_FINGERPRINT_SIZE],
+        TPMI_ALG_PUBLIC alg, TPM2B_PUBLIC *parsed) {
+
+    char path[PATH_MAX];
+    if (!entry_path(dir, fingerprint, alg, path)) {
+        return false;
+    }
+
+    FILE *f = fopen(path, "rb");
+    if (!f) {
+        return false;
+    }
+
+    UINT32 version = 0;
+    UINT16 saved_alg = 0;
+    UINT16 size = 0;
+    UINT8 buffer[sizeof(TPM2B_PUBLIC)];
+    bool result = files_read_header(f, &version)
+            && version == PUBKEY_CACHE_VERSION
+            && files_read_16(f, &saved_alg)
+            && saved_alg == alg
+            && files_read_16(f, &size)
+            && size <= sizeof(buffer)
+            && files_read_bytes(f, buffer, size);
+
+    fclose(f);
+
+    /* a damaged entry is a miss, the key is parsed and written again */
+    TPM2B_PUBLIC tmp = { 0 };
+    size_t offset = 0;
+    if (!result
+            || Tss2_MU_TPM2B_PUBLIC_Unmarshal(buffer, size, &offset, &tmp)
+                    != TSS2_RC_SUCCESS
+            || offset != size || tmp.publicArea.type != alg) {
+        return false;
+    }
+
+    *parsed = tmp;
+
+    return true;
+}
+
+bool tpm2_pubkey_cache_write(const char *dir,
+        const UINT8 fingerprint[TPM2_PUBKEY_CACHE_FINGERPRINT_SIZE],
+        TPMI_ALG_PUBLIC alg, const TPM2B_PUBLIC *parsed) {
+
+    UINT8 buffer[sizeof(TPM2B_PUBLIC)];
+    size_t size = 0;
+    TSS2_RC rc = Tss2_MU_TPM2B_PUBLIC_Marshal(parsed, buffer, sizeof(buffer),
+            &size);
+    if (rc != TSS2_RC_SUCCESS) {
+        LOG_WARN("Could not marshal the public key to cache");
+        return false;
+    }
+
+    if (mkdir(dir, 0700) && errno != EEXIST) {
+        LOG_WARN("Could not create public key cache \"%s\", error: %s", dir,
+                strerror(errno));
+        return false;
+    }
+
+    char path[PATH_MAX];
+    if (!entry_path(dir, fingerprint, alg, path)) {
+        return false;
+    }
+
+    files_atomic atomic;
+    FILE *f = files_atomic_open(&atomic, path);
+    if (!f) {
+        return false;
+    }
+
+    bool result = files_write_header(f, PUBKEY_CACHE_VERSION)
+            && files_write_16(f, alg)
+            && files_write_16(f, size)
+            && files_write_bytes(f, buffer, size);
+
+    if (!files_atomic_close(&atomic, f, result)) {
+        LOG_WARN("Could not write public key cache entry \"%s\"", path);
+        return false;
+    }
+
+    return true;
+}
+
+static pubkey_cache_entry *cache_find(
+        const UINT8 fingerprint[TPM2_PUBKEY_CACHE_FINGERPRINT_SIZE],
+        TPMI_ALG_PUBLIC alg) {
+
+    size_t i;
+    for (i = 0; i < cache.count; i++) {
+        pubkey_cache_entry *e = &cache.entries[i];
+        if (e->alg == alg && !memcmp(e->fingerprint, fingerprint,
+                sizeof(e->fingerprint))) {
+            return e;
+        }
+    }
+
+    return NULL;
+}
+
+static void cache_add(
+        const UINT8 fingerprint[TPM2_PUBKEY_CACHE_FINGERPRINT_SIZE],
+        TPMI_ALG_PUBLIC alg, const TPM2B_PUBLIC *parsed) {
+
+    pubkey_cache_entry *e = cache_find(fingerprint, alg);
+    if (!e) {
+        if (cache.count == cache.capacity) {
+            size_t capacity = cache.capacity ? 2 * cache.capacity : 8;
+            pubkey_cache_entry *tmp = realloc(cache.entries,
+                    capacity * sizeof(*tmp));
+            if (!tmp) {
+                /* not caching is no error, the key is parsed again */
+                return;
+            }
+            cache.entries = tmp;
+            cache.capacity = capacity;
+        }
+        e = &cache.entries[cache.count++];
+        memcpy(e->fingerprint, fingerprint, sizeof(e->fingerprint));
+        e->alg = alg;
+    }
+
+    e->parsed = *parsed;
+}
+
+bool tpm2_pubkey_cache_get(
+        const UINT8 fingerprint[TPM2_PUBKEY_CACHE_FINGERPRINT_SIZE],
+        TPMI_ALG_PUBLIC alg, TPM2B_PUBLIC *parsed) {
+
+    const pubkey_cache_entry *e = cache_find(fingerprint, alg);
+    if (e) {
+        *parsed = e->parsed;
+        return true;
+    }
+
+    const char *dir = cache_dir();
+    if (!dir || !tpm2_pubkey_cache_read(dir, fingerprint, alg, parsed)) {
+        return false;
+    }
+
+    cache_add(fingerprint, alg, parsed);
+
+    return true;
+}
+
+void tpm2_pubkey_cache_put(
+        const UINT8 fingerprint[TPM2_PUBKEY_CACHE_FINGERPRINT_SIZE],
+        TPMI_ALG_PUBLIC alg, const TPM2B_PUBLIC *parsed) {
+
+    cache_add(fingerprint, alg, parsed);
+
+    const char *dir = cache_dir();
+    if (dir) {
+        tpm2_pubkey_cache_write(dir, fingerprint, alg, parsed);
+    }
+}
+
+void tpm2_pubkey_cache_free(void) {
+
+    free(cache.entries);
+    memset(&cache, 0, sizeof(cache));
+}
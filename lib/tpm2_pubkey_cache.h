@@ -0,0 +1,105 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+#ifndef LIB_TPM2_PUBKEY_CACHE_H_
+#define LIB_TPM2_PUBKEY_CACHE_H_
+
+#include <stdbool.h>
+
+#include <tss2/tss2_tpm2_types.h>
+
+/*
+ * Environment variable naming a directory to cache the parsed public PEM keys
+ * in across tool invocations.
+ */
+#define TPM2TOOLS_ENV_PUBKEY_CACHE "TPM2TOOLS_PUBKEY_CACHE"
+
+/* the SHA256 of the PEM file */
+#define TPM2_PUBKEY_CACHE_FINGERPRINT_SIZE 32
+
+/*
+ * tpm2_openssl_load_public() parses the same verifier and EK public keys over
+ * and over. The public area it makes of a PEM file, with the type, the
+ * parameters and the unique field of the key, is kept under the fingerprint
+ * of the file and the algorithm asked for, so a file is parsed once per
+ * process, ie by tpm2_batch and tpm2_serve, and once for good with the
+ * directory cache. A changed file has another fingerprint, so an entry never
+ * goes stale.
+ *
+ * An entry of the directory is named after the hex fingerprint and the
+ * algorithm, and is laid out as, all numbers big endian:
+ *   the header of files_write_header()
+ *   U16 algorithm
+ *   U16 size, then the marshaled TPM2B_PUBLIC
+ */
+
+/**
+ * Reads the entry of a key from a cache directory.
+ * @param dir
+ *  The cache directory.
+ * @param fingerprint
+ *  The fingerprint of the PEM file.
+ * @param alg
+ *  The algorithm of the key.
+ * @param parsed
+ *  Receives the public area parsed from the file.
+ * @return
+ *  True if there is a valid entry for the key, false otherwise.
+ */
+bool tpm2_pubkey_cache_read(const char *dir,
+        const UINT8 fingerprint[TPM2_PUBKEY_CACHE_FINGERPRINT_SIZE],
+        TPMI_ALG_PUBLIC alg, TPM2B_PUBLIC *parsed);
+
+/**
+ * Writes the entry of a key to a cache directory, creating the directory if
+ * needed.
+ * @param dir
+ *  The cache directory.
+ * @param fingerprint
+ *  The fingerprint of the PEM file.
+ * @param alg
+ *  The algorithm of the key.
+ * @param parsed
+ *  The public area parsed from the file.
+ * @return
+ *  True on success, false on error.
+ */
+bool tpm2_pubkey_cache_write(const char *dir,
+        const UINT8 fingerprint[TPM2_PUBKEY_CACHE_FINGERPRINT_SIZE],
+        TPMI_ALG_PUBLIC alg, const TPM2B_PUBLIC *parsed);
+
+/**
+ * Looks up a key in the cache of the process, then in the directory named by
+ * TPM2TOOLS_PUBKEY_CACHE.
+ * @param fingerprint
+ *  The fingerprint of the PEM file.
+ * @param alg
+ *  The algorithm of the key.
+ * @param parsed
+ *  Receives the public area parsed from the file.
+ * @return
+ *  True on a cache hit, false on a miss.
+ */
+bool tpm2_pubkey_cache_get(
+        const UINT8 fingerprint[TPM2_PUBKEY_CACHE_FINGERPRINT_SIZE],
+        TPMI_ALG_PUBLIC alg, TPM2B_PUBLIC *parsed);
+
+/**
+ * Adds a key to the cache of the process, and to the directory named by
+ * TPM2TOOLS_PUBKEY_CACHE if any.
+ * @param fingerprint
+ *  The fingerprint of the PEM file.
+ * @param alg
+ *  The algorithm of the key.
+ * @param parsed
+ *  The public area parsed from the file.
+ */
+void tpm2_pubkey_cache_put(
+        const UINT8 fingerprint[TPM2_PUBKEY_CACHE_FINGERPRINT_SIZE],
+        TPMI_ALG_PUBLIC alg, const TPM2B_PUBLIC *parsed);
+
+/**
+ * Drops the keys cached by the process.
+ */
+void tpm2_pubkey_cache_free(void);
+
+#endif /* LIB_TPM2_PUBKEY_CACHE_H_ */
@@ -0,0 +1,127 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <tss2/tss2_mu.h>
+
+#include "log.h"
+#include "tpm2_quote_bundle.h"
+
+bool tpm2_quote_bundle_write(const char *path, const TPM2B_ATTEST *quoted,
+        const TPMT_SIGNATURE *signature, const TPML_PCR_SELECTION *pcr_select,
+        const tpm2_pcrs *pcrs, const UINT8 *eventlog, size_t eventlog_size) {
+
+    UINT8 sig[sizeof(TPMT_SIGNATURE)];
+    size_t sig_size = 0;
+    TSS2_RC rc = Tss2_MU_TPMT_SIGNATURE_Marshal(signature, sig, sizeof(sig),
+            &sig_size);
+    if (rc != TSS2_RC_SUCCESS) {
+        LOG_ERR("Error serializing the signature");
+        return false;
+    }
+
+    tpm2_ctx_archive_member members[4] = {
+        {
+            .name = TPM2_QUOTE_BUNDLE_MESSAGE,
+            .data = quoted->attestationData,
+            .size = quoted->size,
+        },
+        {
+            .name = TPM2_QUOTE_BUNDLE_SIGNATURE,
+            .data = sig,
+            .size = sig_size,
+        },
+    };
+    UINT32 count = 2;
+
+    char *pcr_data = NULL;
+    size_t pcr_size = 0;
+    if (pcr_select) {
+        FILE *f = open_memstream(&pcr_data, &pcr_size);
+        if (!f) {
+            LOG_ERR("oom");
+            return false;
+        }
+
+        bool result = pcr_bundle_write(pcr_select, pcrs, f);
+        if (fclose(f) || !result) {
+            LOG_ERR("Error serializing the PCR values");
+            free(pcr_data);
+            return false;
+        }
+
+        members[count++] = (tpm2_ctx_archive_member) {
+            .name = TPM2_QUOTE_BUNDLE_PCRS,
+            .data = (const UINT8 *) pcr_data,
+            .size = pcr_size,
+        };
+    }
+
+    if (eventlog) {
+        members[count++] = (tpm2_ctx_archive_member) {
+            .name = TPM2_QUOTE_BUNDLE_EVENTLOG,
+            .data = eventlog,
+            .size = eventlog_size,
+        };
+    }
+
+    bool result = tpm2_ctx_archive_write(path, members, count);
+    free(pcr_data);
+
+    return result;
+}
+
+bool tpm2_quote_bundle_open(tpm2_quote_bundle *bundle, const char *path) {
+
+    memset(bundle, 0, sizeof(*bundle));
+
+    if (!tpm2_ctx_archive_open(&bundle->archive, path)) {
+        return false;
+    }
+
+    const UINT8 *sig;
+    size_t sig_size;
+    bool result = tpm2_ctx_archive_find(&bundle->archive,
+            TPM2_QUOTE_BUNDLE_MESSAGE, &bundle->message, &bundle->message_size)
+            && tpm2_ctx_archive_find(&bundle->archive,
+                    TPM2_QUOTE_BUNDLE_SIGNATURE, &sig, &sig_size);
+    if (!result || !bundle->message_size
+            || bundle->message_size > sizeof(TPMS_ATTEST)) {
+        LOG_ERR("\"%s\" is no quote bundle, expected a message and a "
+                "signature", path);
+        goto error;
+    }
+
+    size_t offset = 0;
+    TSS2_RC rc = Tss2_MU_TPMT_SIGNATURE_Unmarshal(sig, sig_size, &offset,
+            &bundle->signature);
+    if (rc != TSS2_RC_SUCCESS || offset != sig_size) {
+        LOG_ERR("The signature of the quote bundle \"%s\" is malformed",
+                path);
+        goto error;
+    }
+
+    /* the optional members */
+    if (!tpm2_ctx_archive_find(&bundle->archive, TPM2_QUOTE_BUNDLE_PCRS,
+            &bundle->pcrs, &bundle->pcrs_size)) {
+        bundle->pcrs = NULL;
+    }
+    if (!tpm2_ctx_archive_find(&bundle->archive, TPM2_QUOTE_BUNDLE_EVENTLOG,
+            &bundle->eventlog, &bundle->eventlog_size)) {
+        bundle->eventlog = NULL;
+    }
+
+    return true;
+
+error:
+    tpm2_quote_bundle_close(bundle);
+    return false;
+}
+
+void tpm2_quote_bundle_close(tpm2_quote_bundle *bundle) {
+
+    tpm2_ctx_archive_close(&bundle->archive);
+    memset(bundle, 0, sizeof(*bundle));
+}
@@ -0,0 +1,84 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+#ifndef LIB_TPM2_QUOTE_BUNDLE_H_
+#define LIB_TPM2_QUOTE_BUNDLE_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include <tss2/tss2_tpm2_types.h>
+
+#include "pcr.h"
+#include "tpm2_ctx_archive.h"
+
+/*
+ * A quote bundle carries everything a verifier needs of a quote in one file,
+ * in place of the message, signature, PCR and event log files. It is a
+ * context archive, cf. tpm2_ctx_archive.h, so it is length prefixed and
+ * indexed, and is mapped and read in place. Its members are:
+ *   message    the TPMS_ATTEST of the quote as returned by the TPM
+ *   signature  the TSS marshaled TPMT_SIGNATURE
+ *   pcrs       optional, the quoted PCR values as a PCR bundle, cf. pcr.h
+ *   eventlog   optional, the binary event log of the quoted PCRs
+ */
+#define TPM2_QUOTE_BUNDLE_MESSAGE "message"
+#define TPM2_QUOTE_BUNDLE_SIGNATURE "signature"
+#define TPM2_QUOTE_BUNDLE_PCRS "pcrs"
+#define TPM2_QUOTE_BUNDLE_EVENTLOG "eventlog"
+
+typedef struct tpm2_quote_bundle tpm2_quote_bundle;
+struct tpm2_quote_bundle {
+    tpm2_ctx_archive archive;
+    const UINT8 *message;
+    size_t message_size;
+    TPMT_SIGNATURE signature;
+    /* NULL if not in the bundle */
+    const UINT8 *pcrs;
+    size_t pcrs_size;
+    const UINT8 *eventlog;
+    size_t eventlog_size;
+};
+
+/**
+ * Writes a quote bundle, replacing the file atomically.
+ * @param path
+ *  The path of the bundle.
+ * @param quoted
+ *  The quote.
+ * @param signature
+ *  The signature of the quote.
+ * @param pcr_select
+ *  The quoted PCRs, NULL to leave out the PCR values.
+ * @param pcrs
+ *  The values of the quoted PCRs, in selection order.
+ * @param eventlog
+ *  The event log, NULL to leave it out.
+ * @param eventlog_size
+ *  The size of the event log.
+ * @return
+ *  True on success, false otherwise.
+ */
+bool tpm2_quote_bundle_write(const char *path, const TPM2B_ATTEST *quoted,
+        const TPMT_SIGNATURE *signature, const TPML_PCR_SELECTION *pcr_select,
+        const tpm2_pcrs *pcrs, const UINT8 *eventlog, size_t eventlog_size);
+
+/**
+ * Maps a quote bundle and finds its members. The message, PCR values and
+ * event log point into the mapping until the bundle is closed.
+ * @param bundle
+ *  The bundle to initialize.
+ * @param path
+ *  The path of the bundle.
+ * @return
+ *  True on success, false if the file is no valid quote bundle.
+ */
+bool tpm2_quote_bundle_open(tpm2_quote_bundle *bundle, const char *path);
+
+/**
+ * Unmaps a quote bundle.
+ * @param bundle
+ *  The bundle opened with tpm2_quote_bundle_open().
+ */
+void tpm2_quote_bundle_close(tpm2_quote_bundle *bundle);
+
+#endif /* LIB_TPM2_QUOTE_BUNDLE_H_ */
@@ -0,0 +1,127 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+#include <errno.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "log.h"
+#include "tpm2.h"
+#include "tpm2_pipeline.h"
+#include "tpm2_random.h"
+#include "tpm2_util.h"
+
+typedef struct stir_pipeline stir_pipeline;
+struct stir_pipeline {
+    int fd;
+    UINT64 max;
+    UINT64 read;
+    UINT64 *stirred;
+    bool is_end;
+    /* a chunk read but not sent yet */
+    bool is_ready;
+    TPM2B_SENSITIVE_DATA chunk;
+    UINT16 sent;
+};
+
+/*
+ * Fills a chunk as far as the input goes, so a slow writer of a FIFO does not
+ * cost a command for every few bytes.
+ */
+static tool_rc stir_prepare(void *userdata, bool *is_next) {
+
+    stir_pipeline *stir = (stir_pipeline *) userdata;
+
+    if (stir->is_ready || stir->is_end) {
+        *is_next = stir->is_ready;
+        return tool_rc_success;
+    }
+
+    size_t size = sizeof(stir->chunk.buffer);
+    if (stir->max && stir->max - stir->read < size) {
+        size = stir->max - stir->read;
+    }
+
+    stir->chunk.size = 0;
+    while (stir->chunk.size < size) {
+        ssize_t got = read(stir->fd, &stir->chunk.buffer[stir->chunk.size],
+                size - stir->chunk.size);
+        if (got < 0 && errno == EINTR) {
+            continue;
+        }
+
+        if (got < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            stir->is_end = true;
+            break;
+        }
+
+        if (got < 0) {
+            LOG_ERR("Could not read the bytes to stir, error: %s",
+                    strerror(errno));
+            return tool_rc_general_error;
+        }
+
+        if (!got) {
+            stir->is_end = true;
+            break;
+        }
+
+        stir->chunk.size += got;
+    }
+
+    stir->read += stir->chunk.size;
+    if (stir->max && stir->read == stir->max) {
+        stir->is_end = true;
+    }
+
+    stir->is_ready = stir->chunk.size > 0;
+    *is_next = stir->is_ready;
+
+    return tool_rc_success;
+}
+
+static tool_rc stir_submit(ESYS_CONTEXT *ectx, void *userdata) {
+
+    stir_pipeline *stir = (stir_pipeline *) userdata;
+
+    /* ESAPI marshals the chunk, so the next one can be read into it */
+    tool_rc rc = tpm2_stirrandom_async(ectx, &stir->chunk);
+    if (rc == tool_rc_success) {
+        stir->sent = stir->chunk.size;
+        stir->is_ready = false;
+    }
+
+    return rc;
+}
+
+static tool_rc stir_finish(ESYS_CONTEXT *ectx, void *userdata) {
+
+    stir_pipeline *stir = (stir_pipeline *) userdata;
+
+    tool_rc rc = tpm2_stirrandom_finish(ectx);
+    if (rc == tool_rc_success) {
+        *stir->stirred += stir->sent;
+    }
+
+    return rc;
+}
+
+tool_rc tpm2_random_stir_fd(ESYS_CONTEXT *ectx, int fd, UINT64 max,
+        UINT64 *stirred) {
+
+    static const tpm2_pipeline_ops ops = {
+        .prepare = stir_prepare,
+        .submit = stir_submit,
+        .finish = stir_finish,
+    };
+
+    *stirred = 0;
+
+    stir_pipeline stir = {
+        .fd = fd,
+        .max = max,
+        .stirred = stirred,
+    };
+
+    return tpm2_pipeline_run(ectx, &ops, &stir);
+}
@@ -0,0 +1,30 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+#ifndef LIB_TPM2_RANDOM_H_
+#define LIB_TPM2_RANDOM_H_
+
+#include <tss2/tss2_esys.h>
+
+#include "tool_rc.h"
+
+/**
+ * Stirs the bytes read from a file descriptor into the random number
+ * generator of the TPM. The bytes go in StirRandom commands of the 128 bytes
+ * a TPM2B_SENSITIVE_DATA holds, and the next chunk is read while the TPM
+ * mixes in the last one.
+ * @param ectx
+ *  The ESAPI context.
+ * @param fd
+ *  The file descriptor, read until the end of the file, or of the bytes
+ *  available for one opened with O_NONBLOCK.
+ * @param max
+ *  The most bytes to stir, 0 for no bound.
+ * @param stirred
+ *  Receives the number of bytes stirred, also on a failure.
+ * @return
+ *  tool_rc indicating status.
+ */
+tool_rc tpm2_random_stir_fd(ESYS_CONTEXT *ectx, int fd, UINT64 max,
+        UINT64 *stirred);
+
+#endif /* LIB_TPM2_RANDOM_H_ */
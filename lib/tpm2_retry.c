@@ -0,0 +1,206 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "log.h"
+#include "tpm2_retry.h"
+#include "tpm2_util.h"
+
+/* the tag and size fields precede the response code in a response */
+#define RETRY_RC_OFFSET 6
+
+typedef struct retry_tcti retry_tcti;
+struct retry_tcti {
+    TSS2_TCTI_CONTEXT_COMMON_V2 common;
+    TSS2_TCTI_CONTEXT *inner;
+    UINT32 retry_max;
+    /* the last command sent, to send it again */
+    uint8_t *command;
+    size_t command_size;
+    size_t command_capacity;
+    UINT32 retries;
+};
+
+static bool is_retryable(const uint8_t *response, size_t size) {
+
+    if (size < RETRY_RC_OFFSET + sizeof(TSS2_RC)) {
+        return false;
+    }
+
+    const uint8_t *p = &response[RETRY_RC_OFFSET];
+    TSS2_RC rc = (TSS2_RC) p[0] << 24 | p[1] << 16 | p[2] << 8 | p[3];
+
+    /* a resource manager may pass on the warnings of the TPM in its layer */
+    TSS2_RC layer = rc & TSS2_RC_LAYER_MASK;
+    if (layer != TSS2_TPM_RC_LAYER && layer != TSS2_RESMGR_TPM_RC_LAYER) {
+        return false;
+    }
+
+    rc &= ~TSS2_RC_LAYER_MASK;
+
+    return rc == TPM2_RC_RETRY || rc == TPM2_RC_YIELDED
+            || rc == TPM2_RC_TESTING;
+}
+
+static void backoff(UINT32 retry) {
+
+    unsigned long delay_ms = TPM2_RETRY_DELAY_MS;
+    while (retry-- && delay_ms < TPM2_RETRY_DELAY_MAX_MS) {
+        delay_ms *= 2;
+    }
+
+    if (delay_ms > TPM2_RETRY_DELAY_MAX_MS) {
+        delay_ms = TPM2_RETRY_DELAY_MAX_MS;
+    }
+
+    struct timespec ts = {
+        .tv_sec = delay_ms / 1000,
+        .tv_nsec = (delay_ms % 1000) * 1000000,
+    };
+
+    while (nanosleep(&ts, &ts) && errno == EINTR);
+}
+
+static TSS2_RC retry_tcti_transmit(TSS2_TCTI_CONTEXT *tcti_context,
+        size_t size, const uint8_t *command) {
+
+    retry_tcti *tcti = (retry_tcti *) tcti_context;
+
+    if (size > tcti->command_capacity) {
+        uint8_t *buf = realloc(tcti->command, size);
+        if (!buf) {
+            LOG_ERR("oom");
+            return TSS2_TCTI_RC_MEMORY;
+        }
+        tcti->command = buf;
+        tcti->command_capacity = size;
+    }
+
+    memcpy(tcti->command, command, size);
+    tcti->command_size = size;
+    tcti->retries = 0;
+
+    return Tss2_Tcti_Transmit(tcti->inner, size, command);
+}
+
+static TSS2_RC retry_tcti_receive(TSS2_TCTI_CONTEXT *tcti_context,
+        size_t *size, uint8_t *response, int32_t timeout) {
+
+    retry_tcti *tcti = (retry_tcti *) tcti_context;
+
+    size_t response_capacity = *size;
+    TSS2_RC rval = Tss2_Tcti_Receive(tcti->inner, size, response, timeout);
+
+    /* a NULL response only queries the size */
+    while (rval == TSS2_RC_SUCCESS && response
+            && tcti->retries < tcti->retry_max
+            && is_retryable(response, *size)) {
+
+        LOG_INFO("TPM is busy, resending command, attempt %u of %u",
+                tcti->retries + 1, tcti->retry_max);
+
+        backoff(tcti->retries++);
+
+        rval = Tss2_Tcti_Transmit(tcti->inner, tcti->command_size,
+                tcti->command);
+        if (rval != TSS2_RC_SUCCESS) {
+            return rval;
+        }
+
+        /* with a timeout, the caller picks up the response of the resend */
+        *size = response_capacity;
+        rval = Tss2_Tcti_Receive(tcti->inner, size, response, timeout);
+    }
+
+    return rval;
+}
+
+static TSS2_RC retry_tcti_cancel(TSS2_TCTI_CONTEXT *tcti_context) {
+
+    retry_tcti *tcti = (retry_tcti *) tcti_context;
+
+    return Tss2_Tcti_Cancel(tcti->inner);
+}
+
+static TSS2_RC retry_tcti_get_poll_handles(TSS2_TCTI_CONTEXT *tcti_context,
+        TSS2_TCTI_POLL_HANDLE *handles, size_t *num_handles) {
+
+    retry_tcti *tcti = (retry_tcti *) tcti_context;
+
+    return Tss2_Tcti_GetPollHandles(tcti->inner, handles, num_handles);
+}
+
+static TSS2_RC retry_tcti_set_locality(TSS2_TCTI_CONTEXT *tcti_context,
+        uint8_t locality) {
+
+    retry_tcti *tcti = (retry_tcti *) tcti_context;
+
+    return Tss2_Tcti_SetLocality(tcti->inner, locality);
+}
+
+static TSS2_RC retry_tcti_make_sticky(TSS2_TCTI_CONTEXT *tcti_context,
+        TPM2_HANDLE *handle, uint8_t sticky) {
+
+    retry_tcti *tcti = (retry_tcti *) tcti_context;
+
+    return Tss2_Tcti_MakeSticky(tcti->inner, handle, sticky);
+}
+
+TSS2_TCTI_CONTEXT *tpm2_retry_tcti_wrap(TSS2_TCTI_CONTEXT *tcti) {
+
+    if (!tcti) {
+        return tcti;
+    }
+
+    UINT32 retry_max = TPM2_RETRY_MAX_DEFAULT;
+    const char *value = tpm2_util_getenv(TPM2TOOLS_ENV_RETRY_MAX);
+    if (value && !tpm2_util_string_to_uint32(value, &retry_max)) {
+        LOG_WARN("Ignoring invalid %s \"%s\"", TPM2TOOLS_ENV_RETRY_MAX,
+                value);
+        retry_max = TPM2_RETRY_MAX_DEFAULT;
+    }
+
+    if (!retry_max) {
+        return tcti;
+    }
+
+    retry_tcti *wrapper = calloc(1, sizeof(*wrapper));
+    if (!wrapper) {
+        LOG_WARN("oom, not resending busy TPM commands");
+        return tcti;
+    }
+
+    /*
+     * The wrapped TCTI stays owned by the caller, who finalizes it after
+     * unwrapping, so there is no finalize to forward.
+     */
+    wrapper->common.v1.magic = TSS2_TCTI_MAGIC(tcti);
+    wrapper->common.v1.version = 2;
+    wrapper->common.v1.transmit = retry_tcti_transmit;
+    wrapper->common.v1.receive = retry_tcti_receive;
+    wrapper->common.v1.cancel = retry_tcti_cancel;
+    wrapper->common.v1.getPollHandles = retry_tcti_get_poll_handles;
+    wrapper->common.v1.setLocality = retry_tcti_set_locality;
+    wrapper->common.makeSticky = retry_tcti_make_sticky;
+    wrapper->inner = tcti;
+    wrapper->retry_max = retry_max;
+
+    return (TSS2_TCTI_CONTEXT *) wrapper;
+}
+
+TSS2_TCTI_CONTEXT *tpm2_retry_tcti_unwrap(TSS2_TCTI_CONTEXT *tcti) {
+
+    if (!tcti || TSS2_TCTI_TRANSMIT(tcti) != retry_tcti_transmit) {
+        return tcti;
+    }
+
+    retry_tcti *wrapper = (retry_tcti *) tcti;
+    TSS2_TCTI_CONTEXT *inner = wrapper->inner;
+    free(wrapper->command);
+    free(wrapper);
+
+    return inner;
+}
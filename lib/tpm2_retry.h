@@ -0,0 +1,44 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+#ifndef LIB_TPM2_RETRY_H_
+#define LIB_TPM2_RETRY_H_
+
+#include <tss2/tss2_tcti.h>
+
+/*
+ * Environment variable with the number of times a command is resent after
+ * the TPM answered with TPM2_RC_RETRY, TPM2_RC_YIELDED or TPM2_RC_TESTING.
+ * 0 disables resending.
+ */
+#define TPM2TOOLS_ENV_RETRY_MAX "TPM2TOOLS_RETRY_MAX"
+
+#define TPM2_RETRY_MAX_DEFAULT 8
+
+/* the first wait, doubled on every retry up to TPM2_RETRY_DELAY_MAX_MS */
+#define TPM2_RETRY_DELAY_MS 20
+#define TPM2_RETRY_DELAY_MAX_MS 1000
+
+/**
+ * Wraps a TCTI to resend commands the TPM could not run yet, waiting with an
+ * exponential backoff between the attempts. The warnings are only returned
+ * to ESAPI when the retries are used up.
+ *
+ * A command answered with one of these warnings was not executed, so sending
+ * the same command again is safe, including its sessions.
+ * @param tcti
+ *  The TCTI to wrap.
+ * @return
+ *  The TCTI to hand to ESAPI, tcti itself when retries are disabled.
+ */
+TSS2_TCTI_CONTEXT *tpm2_retry_tcti_wrap(TSS2_TCTI_CONTEXT *tcti);
+
+/**
+ * Releases a TCTI returned by tpm2_retry_tcti_wrap().
+ * @param tcti
+ *  A TCTI returned by tpm2_retry_tcti_wrap().
+ * @return
+ *  The wrapped TCTI, which is still to be finalized by the caller.
+ */
+TSS2_TCTI_CONTEXT *tpm2_retry_tcti_unwrap(TSS2_TCTI_CONTEXT *tcti);
+
+#endif /* LIB_TPM2_RETRY_H_ */
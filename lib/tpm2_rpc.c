@@ -0,0 +1,642 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+#include "log.h"
+#include "tpm2_rpc.h"
+
+#define TPM2_RPC_MAGIC 0x54505333 /* "TPS3" */
+
+#define TPM2_RPC_ARGC_MAX 1024
+#define TPM2_RPC_ARG_LEN_MAX (64 * 1024)
+
+/* what the daemon sends the client once the request is received */
+#define TPM2_RPC_MSG_OPEN 1
+#define TPM2_RPC_MSG_CONNECT 2
+#define TPM2_RPC_MSG_STATUS 3
+
+/* the flags of the paths a client opens for the daemon */
+#define TPM2_RPC_OPEN_FLAGS (O_ACCMODE | O_CREAT | O_EXCL | O_TRUNC \
+        | O_APPEND | O_DIRECTORY | O_NOFOLLOW | O_NONBLOCK | O_PATH)
+
+/* the connection to the client of the request a tool runs for, if any */
+static int rpc_client = -1;
+/* the worker threads of a tool take turns asking the client */
+static pthread_mutex_t rpc_client_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static bool write_all(int fd, const void *buf, size_t len) {
+
+    const uint8_t *p = buf;
+    while (len) {
+        ssize_t done = write(fd, p, len);
+        if (done < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            LOG_ERR("Could not write to socket, error: %s", strerror(errno));
+            return false;
+        }
+        p += done;
+        len -= done;
+    }
+
+    return true;
+}
+
+static bool read_all(int fd, void *buf, size_t len) {
+
+    uint8_t *p = buf;
+    while (len) {
+        ssize_t done = read(fd, p, len);
+        if (done < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            LOG_ERR("Could not read from socket, error: %s", strerror(errno));
+            return false;
+        }
+        if (!done) {
+            LOG_ERR("Connection closed by peer");
+            return false;
+        }
+        p += done;
+        len -= done;
+    }
+
+    return true;
+}
+
+static bool write_u32(int fd, uint32_t value) {
+
+    return write_all(fd, &value, sizeof(value));
+}
+
+static bool read_u32(int fd, uint32_t *value) {
+
+    return read_all(fd, value, sizeof(*value));
+}
+
+/*
+ * The daemon and its clients run as the same user: a daemon serving another
+ * user would run tools with its own rights for it, and a client of another
+ * user's daemon would open its files for it.
+ */
+static bool is_peer_trusted(int sock) {
+
+    struct ucred cred;
+    socklen_t len = sizeof(cred);
+    if (getsockopt(sock, SOL_SOCKET, SO_PEERCRED, &cred, &len)) {
+        LOG_ERR("Could not get the credentials of the peer, error: %s",
+                strerror(errno));
+        return false;
+    }
+
+    if (cred.uid != geteuid()) {
+        LOG_ERR("Refusing peer of user %u, expected user %u",
+                (unsigned) cred.uid, (unsigned) geteuid());
+        return false;
+    }
+
+    return true;
+}
+
+static bool set_sockaddr(struct sockaddr_un *addr, const char *path) {
+
+    memset(addr, 0, sizeof(*addr));
+    addr->sun_family = AF_UNIX;
+
+    size_t len = strlen(path);
+    if (len >= sizeof(addr->sun_path)) {
+        LOG_ERR("Socket path \"%s\" is too long, got: %zu, max: %zu", path,
+                len, sizeof(addr->sun_path) - 1);
+        return false;
+    }
+
+    memcpy(addr->sun_path, path, len);
+
+    return true;
+}
+
+int tpm2_rpc_listen(const char *path) {
+
+    struct sockaddr_un addr;
+    bool result = set_sockaddr(&addr, path);
+    if (!result) {
+        return -1;
+    }
+
+    int sock = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (sock < 0) {
+        LOG_ERR("Could not create socket, error: %s", strerror(errno));
+        return -1;
+    }
+
+    /* only remove a stale socket, never a regular file */
+    struct stat st;
+    if (!lstat(path, &st) && S_ISSOCK(st.st_mode)) {
+        unlink(path);
+    }
+
+    /* no other user can connect, not even until the chmod below */
+    mode_t old_umask = umask(0177);
+    int rc = bind(sock, (struct sockaddr *) &addr, sizeof(addr));
+    umask(old_umask);
+    if (rc) {
+        LOG_ERR("Could not bind socket \"%s\", error: %s", path,
+                strerror(errno));
+        close(sock);
+        return -1;
+    }
+
+    rc = chmod(path, 0600);
+    if (rc) {
+        LOG_ERR("Could not change the mode of socket \"%s\", error: %s",
+                path, strerror(errno));
+        close(sock);
+        unlink(path);
+        return -1;
+    }
+
+    rc = listen(sock, SOMAXCONN);
+    if (rc) {
+        LOG_ERR("Could not listen on socket \"%s\", error: %s", path,
+                strerror(errno));
+        close(sock);
+        unlink(path);
+        return -1;
+    }
+
+    return sock;
+}
+
+static int client_open(uint32_t type, const char *path, int flags,
+        mode_t mode);
+
+int tpm2_rpc_connect(const char *path) {
+
+    /* the socket of a tool run by the daemon is the one of its client */
+    if (rpc_client >= 0) {
+        int sock = client_open(TPM2_RPC_MSG_CONNECT, path, 0, 0);
+        if (sock < 0) {
+            LOG_ERR("Could not connect to \"%s\", error: %s", path,
+                    strerror(errno));
+        }
+        return sock;
+    }
+
+    struct sockaddr_un addr;
+    bool result = set_sockaddr(&addr, path);
+    if (!result) {
+        return -1;
+    }
+
+    int sock = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (sock < 0) {
+        LOG_ERR("Could not create socket, error: %s", strerror(errno));
+        return -1;
+    }
+
+    int rc = connect(sock, (struct sockaddr *) &addr, sizeof(addr));
+    if (rc) {
+        LOG_ERR("Could not connect to \"%s\", error: %s", path,
+                strerror(errno));
+        close(sock);
+        return -1;
+    }
+
+    return sock;
+}
+
+static bool send_fds(int sock, const int *fds, size_t count, uint32_t magic) {
+
+    union {
+        char buf[CMSG_SPACE(sizeof(int) * TPM2_RPC_FD_COUNT)];
+        struct cmsghdr align;
+    } control;
+    memset(&control, 0, sizeof(control));
+
+    /* the descriptors ride along with the magic */
+    struct iovec iov = {
+        .iov_base = &magic,
+        .iov_len = sizeof(magic),
+    };
+
+    struct msghdr msg = {
+        .msg_iov = &iov,
+        .msg_iovlen = 1,
+        .msg_control = control.buf,
+        .msg_controllen = CMSG_SPACE(sizeof(int) * count),
+    };
+
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int) * count);
+    memcpy(CMSG_DATA(cmsg), fds, sizeof(int) * count);
+
+    ssize_t done;
+    do {
+        done = sendmsg(sock, &msg, 0);
+    } while (done < 0 && errno == EINTR);
+
+    if (done != sizeof(magic)) {
+        LOG_ERR("Could not send descriptors, error: %s", strerror(errno));
+        return false;
+    }
+
+    return true;
+}
+
+static bool recv_fds(int sock, int *fds, size_t count, uint32_t *magic) {
+
+    union {
+        char buf[CMSG_SPACE(sizeof(int) * TPM2_RPC_FD_COUNT)];
+        struct cmsghdr align;
+    } control;
+    memset(&control, 0, sizeof(control));
+
+    struct iovec iov = {
+        .iov_base = magic,
+        .iov_len = sizeof(*magic),
+    };
+
+    struct msghdr msg = {
+        .msg_iov = &iov,
+        .msg_iovlen = 1,
+        .msg_control = control.buf,
+        .msg_controllen = sizeof(control.buf),
+    };
+
+    ssize_t done;
+    do {
+        done = recvmsg(sock, &msg, MSG_CMSG_CLOEXEC);
+    } while (done < 0 && errno == EINTR);
+
+    if (done != sizeof(*magic)) {
+        LOG_ERR("Could not receive descriptors, error: %s",
+                done < 0 ? strerror(errno) : "short message");
+        return false;
+    }
+
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    if (!cmsg || cmsg->cmsg_level != SOL_SOCKET
+            || cmsg->cmsg_type != SCM_RIGHTS
+            || cmsg->cmsg_len != CMSG_LEN(sizeof(int) * count)) {
+        LOG_ERR("Expected %zu descriptors with the message", count);
+        /* close anything that came along */
+        if (cmsg && cmsg->cmsg_level == SOL_SOCKET
+                && cmsg->cmsg_type == SCM_RIGHTS) {
+            size_t count = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+            int *received = (int *) CMSG_DATA(cmsg);
+            size_t i;
+            for (i = 0; i < count; i++) {
+                close(received[i]);
+            }
+        }
+        return false;
+    }
+
+    memcpy(fds, CMSG_DATA(cmsg), sizeof(int) * count);
+
+    if (msg.msg_flags & MSG_CTRUNC) {
+        LOG_ERR("Descriptors were truncated");
+        size_t i;
+        for (i = 0; i < count; i++) {
+            close(fds[i]);
+        }
+        return false;
+    }
+
+    return true;
+}
+
+bool tpm2_rpc_send_request(int sock, int argc, char **argv) {
+
+    if (argc < 1 || argc > TPM2_RPC_ARGC_MAX) {
+        LOG_ERR("Expected between 1 and %d arguments, got: %d",
+                TPM2_RPC_ARGC_MAX, argc);
+        return false;
+    }
+
+    int fds[TPM2_RPC_FD_COUNT] = {
+        STDIN_FILENO, STDOUT_FILENO, STDERR_FILENO
+    };
+
+    bool result = send_fds(sock, fds, TPM2_RPC_FD_COUNT, TPM2_RPC_MAGIC);
+    if (!result) {
+        return false;
+    }
+
+    result = write_u32(sock, argc);
+    if (!result) {
+        return false;
+    }
+
+    int i;
+    for (i = 0; i < argc; i++) {
+        size_t len = strlen(argv[i]);
+        if (len > TPM2_RPC_ARG_LEN_MAX) {
+            LOG_ERR("Argument %d is too long, got: %zu, max: %d", i, len,
+                    TPM2_RPC_ARG_LEN_MAX);
+            return false;
+        }
+
+        result = write_u32(sock, len) && write_all(sock, argv[i], len);
+        if (!result) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+bool tpm2_rpc_recv_request(int sock, tpm2_rpc_request *request) {
+
+    memset(request, 0, sizeof(*request));
+    unsigned i;
+    for (i = 0; i < TPM2_RPC_FD_COUNT; i++) {
+        request->fds[i] = -1;
+    }
+
+    bool result = is_peer_trusted(sock);
+    if (!result) {
+        return false;
+    }
+
+    uint32_t magic = 0;
+    result = recv_fds(sock, request->fds, TPM2_RPC_FD_COUNT, &magic);
+    if (!result) {
+        return false;
+    }
+
+    if (magic != TPM2_RPC_MAGIC) {
+        LOG_ERR("Unexpected request magic, got: 0x%x, expected: 0x%x",
+                magic, TPM2_RPC_MAGIC);
+        goto error;
+    }
+
+    uint32_t argc = 0;
+    result = read_u32(sock, &argc);
+    if (!result) {
+        goto error;
+    }
+
+    if (argc < 1 || argc > TPM2_RPC_ARGC_MAX) {
+        LOG_ERR("Expected between 1 and %d arguments, got: %u",
+                TPM2_RPC_ARGC_MAX, argc);
+        goto error;
+    }
+
+    /* NULL terminated like the argv of main() */
+    request->argv = calloc(argc + 1, sizeof(char *));
+    if (!request->argv) {
+        LOG_ERR("oom");
+        goto error;
+    }
+
+    for (i = 0; i < argc; i++) {
+        uint32_t len = 0;
+        result = read_u32(sock, &len);
+        if (!result) {
+            goto error;
+        }
+
+        if (len > TPM2_RPC_ARG_LEN_MAX) {
+            LOG_ERR("Argument %u is too long, got: %u, max: %d", i, len,
+                    TPM2_RPC_ARG_LEN_MAX);
+            goto error;
+        }
+
+        request->argv[i] = calloc(1, len + 1);
+        if (!request->argv[i]) {
+            LOG_ERR("oom");
+            goto error;
+        }
+        request->argc++;
+
+        result = read_all(sock, request->argv[i], len);
+        if (!result) {
+            goto error;
+        }
+    }
+
+    return true;
+
+error:
+    tpm2_rpc_request_free(request);
+    return false;
+}
+
+void tpm2_rpc_request_free(tpm2_rpc_request *request) {
+
+    int i;
+    for (i = 0; i < request->argc; i++) {
+        free(request->argv[i]);
+    }
+    free(request->argv);
+    request->argv = NULL;
+    request->argc = 0;
+
+    for (i = 0; i < TPM2_RPC_FD_COUNT; i++) {
+        if (request->fds[i] >= 0) {
+            close(request->fds[i]);
+            request->fds[i] = -1;
+        }
+    }
+}
+
+bool tpm2_rpc_send_status(int sock, tool_rc rc) {
+
+    return write_u32(sock, TPM2_RPC_MSG_STATUS) && write_u32(sock, rc);
+}
+
+void tpm2_rpc_set_client(int sock) {
+
+    rpc_client = sock;
+}
+
+static int client_request(uint32_t type, const char *path, size_t len,
+        int flags, mode_t mode) {
+
+    bool result = write_u32(rpc_client, type)
+            && write_u32(rpc_client, flags)
+            && write_u32(rpc_client, mode)
+            && write_u32(rpc_client, len)
+            && write_all(rpc_client, path, len);
+    if (!result) {
+        errno = EIO;
+        return -1;
+    }
+
+    /* an error comes alone, a descriptor along with a 0 */
+    uint32_t error = 0;
+    result = read_u32(rpc_client, &error);
+    if (!result) {
+        errno = EIO;
+        return -1;
+    }
+
+    if (error) {
+        errno = error;
+        return -1;
+    }
+
+    int fd = -1;
+    result = recv_fds(rpc_client, &fd, 1, &error);
+    if (!result) {
+        errno = EIO;
+        return -1;
+    }
+
+    return fd;
+}
+
+/* asks the client to open or connect to a path and pass the descriptor */
+static int client_open(uint32_t type, const char *path, int flags,
+        mode_t mode) {
+
+    size_t len = strlen(path);
+    if (len > TPM2_RPC_ARG_LEN_MAX) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+
+    pthread_mutex_lock(&rpc_client_lock);
+    int fd = client_request(type, path, len, flags, mode);
+    int error = errno;
+    pthread_mutex_unlock(&rpc_client_lock);
+
+    errno = error;
+
+    return fd;
+}
+
+int tpm2_rpc_open(const char *path, int flags, mode_t mode) {
+
+    if (rpc_client < 0) {
+        return open(path, flags | O_CLOEXEC, mode);
+    }
+
+    return client_open(TPM2_RPC_MSG_OPEN, path, flags, mode);
+}
+
+/* opens a path for the daemon with the rights of the client */
+static bool serve_open(int sock, uint32_t type) {
+
+    uint32_t flags = 0;
+    uint32_t mode = 0;
+    uint32_t len = 0;
+    bool result = read_u32(sock, &flags)
+            && read_u32(sock, &mode)
+            && read_u32(sock, &len);
+    if (!result) {
+        return false;
+    }
+
+    if (len > TPM2_RPC_ARG_LEN_MAX) {
+        LOG_ERR("Path is too long, got: %u, max: %d", len,
+                TPM2_RPC_ARG_LEN_MAX);
+        return false;
+    }
+
+    char *path = calloc(1, len + 1);
+    if (!path) {
+        LOG_ERR("oom");
+        return false;
+    }
+
+    result = read_all(sock, path, len);
+    if (!result) {
+        free(path);
+        return false;
+    }
+
+    int fd = -1;
+    if (strlen(path) != len) {
+        errno = EINVAL;
+    } else if (type == TPM2_RPC_MSG_CONNECT) {
+        fd = tpm2_rpc_connect(path);
+    } else {
+        fd = open(path, (flags & TPM2_RPC_OPEN_FLAGS) | O_CLOEXEC,
+                mode & 0777);
+    }
+    free(path);
+
+    if (fd < 0) {
+        return write_u32(sock, errno ? errno : EIO);
+    }
+
+    result = write_u32(sock, 0) && send_fds(sock, &fd, 1, 0);
+    close(fd);
+
+    return result;
+}
+
+bool tpm2_rpc_recv_status(int sock, tool_rc *rc) {
+
+    for (;;) {
+        uint32_t type = 0;
+        bool result = read_u32(sock, &type);
+        if (!result) {
+            return false;
+        }
+
+        if (type == TPM2_RPC_MSG_OPEN || type == TPM2_RPC_MSG_CONNECT) {
+            result = serve_open(sock, type);
+            if (!result) {
+                return false;
+            }
+            continue;
+        }
+
+        if (type != TPM2_RPC_MSG_STATUS) {
+            LOG_ERR("Unexpected message from daemon, got: %u", type);
+            return false;
+        }
+
+        uint32_t value = 0;
+        result = read_u32(sock, &value);
+        if (!result) {
+            return false;
+        }
+
+        *rc = (tool_rc) value;
+
+        return true;
+    }
+}
+
+tool_rc tpm2_rpc_forward(const char *path, int argc, char **argv) {
+
+    int sock = tpm2_rpc_connect(path);
+    if (sock < 0) {
+        return tool_rc_tcti_error;
+    }
+
+    tool_rc rc = tool_rc_tcti_error;
+    bool result = is_peer_trusted(sock)
+            && tpm2_rpc_send_request(sock, argc, argv);
+    if (!result) {
+        goto out;
+    }
+
+    result = tpm2_rpc_recv_status(sock, &rc);
+    if (!result) {
+        LOG_ERR("No status from daemon at \"%s\"", path);
+        rc = tool_rc_tcti_error;
+    }
+
+out:
+    close(sock);
+    return rc;
+}
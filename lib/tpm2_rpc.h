@@ -0,0 +1,146 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+#ifndef LIB_TPM2_RPC_H_
+#define LIB_TPM2_RPC_H_
+
+#include <stdbool.h>
+
+#include <sys/types.h>
+
+#include "tool_rc.h"
+
+/*
+ * Environment variable naming the UNIX socket of a tpm2_serve daemon. When
+ * set, tool invocations are forwarded to the daemon rather than run locally.
+ */
+#define TPM2TOOLS_ENV_SERVE_SOCKET "TPM2TOOLS_SERVE_SOCKET"
+
+/*
+ * The descriptors passed along with a request: stdin, stdout and stderr of
+ * the client, in that order. Any other file is opened by the client, see
+ * tpm2_rpc_open().
+ */
+#define TPM2_RPC_FD_COUNT 3
+
+typedef struct tpm2_rpc_request tpm2_rpc_request;
+struct tpm2_rpc_request {
+    int argc;
+    char **argv;
+    int fds[TPM2_RPC_FD_COUNT];
+};
+
+/**
+ * Creates a listening UNIX stream socket bound to path, with mode 0600. A
+ * stale socket file at path is removed first.
+ * @param path
+ *  The path of the socket.
+ * @return
+ *  The listening socket or -1 on error.
+ */
+int tpm2_rpc_listen(const char *path);
+
+/**
+ * Connects to a daemon listening on the UNIX socket at path. A tool run for a
+ * client, see tpm2_rpc_set_client(), gets the socket from the client.
+ * @param path
+ *  The path of the socket.
+ * @return
+ *  The connected socket or -1 on error.
+ */
+int tpm2_rpc_connect(const char *path);
+
+/**
+ * Sends a tool invocation along with the callers stdin, stdout and stderr.
+ * @param sock
+ *  The connected socket.
+ * @param argc
+ *  The number of arguments.
+ * @param argv
+ *  The tool name followed by its options and arguments.
+ * @return
+ *  true on success, false otherwise.
+ */
+bool tpm2_rpc_send_request(int sock, int argc, char **argv);
+
+/**
+ * Receives a tool invocation sent by tpm2_rpc_send_request(). The request of
+ * a peer running as another user is refused.
+ * @param sock
+ *  The connected socket.
+ * @param request
+ *  The request, valid on success and must be released with
+ *  tpm2_rpc_request_free().
+ * @return
+ *  true on success, false otherwise.
+ */
+bool tpm2_rpc_recv_request(int sock, tpm2_rpc_request *request);
+
+/**
+ * Releases the arguments and closes the descriptors of a request.
+ * @param request
+ *  The request to release.
+ */
+void tpm2_rpc_request_free(tpm2_rpc_request *request);
+
+/**
+ * Sends the status of a finished tool invocation.
+ * @param sock
+ *  The connected socket.
+ * @param rc
+ *  The status of the tool.
+ * @return
+ *  true on success, false otherwise.
+ */
+bool tpm2_rpc_send_status(int sock, tool_rc rc);
+
+/**
+ * Waits for the status of a tool invocation, opening the files the tool asks
+ * for with tpm2_rpc_open() in the meantime.
+ * @param sock
+ *  The connected socket.
+ * @param rc
+ *  The status of the tool, valid on success.
+ * @return
+ *  true on success, false otherwise.
+ */
+bool tpm2_rpc_recv_status(int sock, tool_rc *rc);
+
+/**
+ * Sets the connection of the client a tool runs for, the files of the tool
+ * are then opened by the client.
+ * @param sock
+ *  The connection of the client, or -1 for the tool to open its files.
+ */
+void tpm2_rpc_set_client(int sock);
+
+/**
+ * Opens a path named by the user of a tool. If the tool runs for a client,
+ * the client opens it relative to its working directory and with its rights,
+ * and passes the descriptor back, so the daemon never opens it itself.
+ * @param path
+ *  The path to open.
+ * @param flags
+ *  The flags of open(2), O_CLOEXEC is implied.
+ * @param mode
+ *  The mode of a created file.
+ * @return
+ *  The descriptor, or -1 with errno set on error.
+ */
+int tpm2_rpc_open(const char *path, int flags, mode_t mode);
+
+/**
+ * Forwards a tool invocation to the daemon at path and waits for it to
+ * finish. A daemon running as another user is refused.
+ * @param path
+ *  The path of the daemon socket.
+ * @param argc
+ *  The number of arguments.
+ * @param argv
+ *  The tool name followed by its options and arguments.
+ * @return
+ *  The status of the remote tool, or tool_rc_tcti_error if the daemon could
+ *  not be reached.
+ */
+tool_rc tpm2_rpc_forward(const char *path, int argc, char **argv);
+
+#endif /* LIB_TPM2_RPC_H_ */
@@ -0,0 +1,232 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+#include <string.h>
+
+#include "log.h"
+#include "tpm2_sched.h"
+#include "tpm2_util.h"
+
+static const char *class_names[tpm2_sched_class_max] = {
+    [tpm2_sched_class_interactive] = "interactive",
+    [tpm2_sched_class_normal]      = "normal",
+    [tpm2_sched_class_background]  = "background",
+};
+
+/* the tools generating a key in the TPM */
+static const char *long_tools[] = {
+    "create",
+    "createak",
+    "createek",
+    "createloaded",
+    "createprimary",
+};
+
+void tpm2_sched_init(tpm2_sched *s) {
+
+    memset(s, 0, sizeof(*s));
+}
+
+void tpm2_sched_set_max_long(tpm2_sched *s, UINT32 max_long) {
+
+    s->max_long = max_long;
+}
+
+static bool add_rule(tpm2_sched *s, const char *tool, size_t len,
+        tpm2_sched_class sched_class) {
+
+    if (!len || len >= TPM2_SCHED_TOOL_MAX) {
+        LOG_ERR("Invalid tool name \"%.*s\"", (int) len, tool);
+        return false;
+    }
+
+    /* the later rule of a tool replaces the earlier one */
+    size_t i;
+    for (i = 0; i < s->rule_count; i++) {
+        if (strlen(s->rules[i].tool) == len
+                && !strncmp(s->rules[i].tool, tool, len)) {
+            s->rules[i].sched_class = sched_class;
+            return true;
+        }
+    }
+
+    if (s->rule_count == TPM2_SCHED_RULES_MAX) {
+        LOG_ERR("Too many tools with a priority, at most %u",
+                TPM2_SCHED_RULES_MAX);
+        return false;
+    }
+
+    tpm2_sched_rule *rule = &s->rules[s->rule_count++];
+    memcpy(rule->tool, tool, len);
+    rule->tool[len] = '\0';
+    rule->sched_class = sched_class;
+
+    return true;
+}
+
+bool tpm2_sched_add_rules(tpm2_sched *s, const char *spec) {
+
+    const char *tools = strchr(spec, ':');
+    if (!tools) {
+        LOG_ERR("Expected a class and tools, ie \"interactive:unseal\", got:"
+                " \"%s\"", spec);
+        return false;
+    }
+
+    size_t len = tools - spec;
+    tpm2_sched_class sched_class;
+    for (sched_class = 0; sched_class < tpm2_sched_class_max; sched_class++) {
+        if (strlen(class_names[sched_class]) == len
+                && !strncmp(class_names[sched_class], spec, len)) {
+            break;
+        }
+    }
+
+    if (sched_class == tpm2_sched_class_max) {
+        LOG_ERR("Unknown priority class \"%.*s\", expected interactive, normal"
+                " or background", (int) len, spec);
+        return false;
+    }
+
+    tools++;
+    for (;;) {
+        const char *end = strchr(tools, ',');
+        len = end ? (size_t) (end - tools) : strlen(tools);
+        bool result = add_rule(s, tools, len, sched_class);
+        if (!result) {
+            return false;
+        }
+
+        if (!end) {
+            return true;
+        }
+        tools = end + 1;
+    }
+}
+
+/* like the tool lookup, the name without its directory and "tpm2_" prefix */
+static const char *tool_name(const char *argv0, const char *argv1) {
+
+    const char *name = strrchr(argv0, '/');
+    name = name ? name + 1 : argv0;
+    if (!strncmp(name, "tpm2_", 5)) {
+        name += 5;
+    }
+
+    if (!strcmp(name, "tpm2") && argv1) {
+        return tool_name(argv1, NULL);
+    }
+
+    return name;
+}
+
+tpm2_sched_class tpm2_sched_classify(const tpm2_sched *s, const char *argv0,
+        const char *argv1) {
+
+    const char *name = tool_name(argv0, argv1);
+
+    size_t i;
+    for (i = 0; i < s->rule_count; i++) {
+        if (!strcmp(s->rules[i].tool, name)) {
+            return s->rules[i].sched_class;
+        }
+    }
+
+    return tpm2_sched_class_normal;
+}
+
+static bool is_long(const char *argv0, const char *argv1) {
+
+    const char *name = tool_name(argv0, argv1);
+
+    size_t i;
+    for (i = 0; i < ARRAY_LEN(long_tools); i++) {
+        if (!strcmp(long_tools[i], name)) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+bool tpm2_sched_push(tpm2_sched *s, const char *argv0, const char *argv1,
+        void *data) {
+
+    if (tpm2_sched_is_full(s)) {
+        return false;
+    }
+
+    tpm2_sched_entry *e = &s->queue[s->count++];
+    e->data = data;
+    e->sched_class = tpm2_sched_classify(s, argv0, argv1);
+    e->is_long = is_long(argv0, argv1);
+    e->seq = s->seq++;
+
+    LOG_INFO("Queued \"%s\" as %s%s", tool_name(argv0, argv1),
+            class_names[e->sched_class], e->is_long ? ", long running" : "");
+
+    return true;
+}
+
+/* true if a runs before b */
+static bool entry_before(const tpm2_sched_entry *a, const tpm2_sched_entry *b) {
+
+    if (a->sched_class != b->sched_class) {
+        return a->sched_class < b->sched_class;
+    }
+
+    return a->seq < b->seq;
+}
+
+void *tpm2_sched_pop(tpm2_sched *s) {
+
+    if (!s->count) {
+        return NULL;
+    }
+
+    /* past the cap any other request goes first */
+    bool is_capped = s->max_long && s->long_run >= s->max_long;
+
+    size_t best = s->count;
+    size_t i;
+    for (i = 0; i < s->count; i++) {
+        const tpm2_sched_entry *e = &s->queue[i];
+        if (is_capped && e->is_long) {
+            continue;
+        }
+        if (best == s->count || entry_before(e, &s->queue[best])) {
+            best = i;
+        }
+    }
+
+    /* only long running requests are waiting */
+    if (best == s->count) {
+        for (i = 0; i < s->count; i++) {
+            if (best == s->count || entry_before(&s->queue[i],
+                    &s->queue[best])) {
+                best = i;
+            }
+        }
+    }
+
+    tpm2_sched_entry e = s->queue[best];
+    s->queue[best] = s->queue[--s->count];
+
+    s->long_run = e.is_long ? s->long_run + 1 : 0;
+
+    return e.data;
+}
+
+bool tpm2_sched_is_full(const tpm2_sched *s) {
+
+    return s->count == TPM2_SCHED_QUEUE_MAX;
+}
+
+size_t tpm2_sched_count(const tpm2_sched *s) {
+
+    return s->count;
+}
+
+void *tpm2_sched_get(const tpm2_sched *s, size_t index) {
+
+    return s->queue[index].data;
+}
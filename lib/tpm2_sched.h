@@ -0,0 +1,156 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+#ifndef LIB_TPM2_SCHED_H_
+#define LIB_TPM2_SCHED_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include <tss2/tss2_tpm2_types.h>
+
+/*
+ * The request scheduler of tpm2_serve. The daemon runs one request at a time
+ * on its TPM connection, so the requests waiting for the TPM are queued and
+ * the next one to run is picked by the priority class of its tool, first
+ * come first served within a class.
+ *
+ * Key generation is long running, and a cap on the long running commands run
+ * in a row lets a waiting request of any class go first once it is reached,
+ * so a burst of key generations doesn't hold up the other requests.
+ */
+typedef enum tpm2_sched_class tpm2_sched_class;
+enum tpm2_sched_class {
+    tpm2_sched_class_interactive,
+    tpm2_sched_class_normal,
+    tpm2_sched_class_background,
+    tpm2_sched_class_max,
+};
+
+#define TPM2_SCHED_QUEUE_MAX 64
+#define TPM2_SCHED_RULES_MAX 64
+#define TPM2_SCHED_TOOL_MAX 32
+
+typedef struct tpm2_sched_rule tpm2_sched_rule;
+struct tpm2_sched_rule {
+    char tool[TPM2_SCHED_TOOL_MAX];
+    tpm2_sched_class sched_class;
+};
+
+typedef struct tpm2_sched_entry tpm2_sched_entry;
+struct tpm2_sched_entry {
+    void *data;
+    tpm2_sched_class sched_class;
+    bool is_long;
+    UINT64 seq;
+};
+
+typedef struct tpm2_sched tpm2_sched;
+struct tpm2_sched {
+    tpm2_sched_rule rules[TPM2_SCHED_RULES_MAX];
+    size_t rule_count;
+    /* the long running commands run in a row at most, 0 for no cap */
+    UINT32 max_long;
+    UINT32 long_run;
+    tpm2_sched_entry queue[TPM2_SCHED_QUEUE_MAX];
+    size_t count;
+    UINT64 seq;
+};
+
+/**
+ * Starts a scheduler with every tool in the normal class and no cap.
+ * @param s
+ *  The scheduler.
+ */
+void tpm2_sched_init(tpm2_sched *s);
+
+/**
+ * Adds the rules of a priority option, a class and the tools in it, ie
+ * "interactive:unseal,sign". Tools are named without the "tpm2_" prefix and
+ * the later rule of a tool wins.
+ * @param s
+ *  The scheduler.
+ * @param spec
+ *  The option value.
+ * @return
+ *  true on success, false if the value is malformed.
+ */
+bool tpm2_sched_add_rules(tpm2_sched *s, const char *spec);
+
+/**
+ * Sets the cap on the long running commands run in a row.
+ * @param s
+ *  The scheduler.
+ * @param max_long
+ *  The cap, 0 for none.
+ */
+void tpm2_sched_set_max_long(tpm2_sched *s, UINT32 max_long);
+
+/**
+ * Gets the class of a tool.
+ * @param s
+ *  The scheduler.
+ * @param argv0
+ *  The tool as invoked, ie "tpm2_unseal", "unseal" or a path to it.
+ * @param argv1
+ *  The argument after it, the tool when argv0 is "tpm2", may be NULL.
+ * @return
+ *  The class.
+ */
+tpm2_sched_class tpm2_sched_classify(const tpm2_sched *s, const char *argv0,
+        const char *argv1);
+
+/**
+ * Queues a request.
+ * @param s
+ *  The scheduler.
+ * @param argv0
+ *  The tool as invoked.
+ * @param argv1
+ *  The argument after it, may be NULL.
+ * @param data
+ *  The request, returned by tpm2_sched_pop().
+ * @return
+ *  true on success, false if the queue is full.
+ */
+bool tpm2_sched_push(tpm2_sched *s, const char *argv0, const char *argv1,
+        void *data);
+
+/**
+ * Dequeues the request to run next.
+ * @param s
+ *  The scheduler.
+ * @return
+ *  The request, NULL if the queue is empty.
+ */
+void *tpm2_sched_pop(tpm2_sched *s);
+
+/**
+ * Tells whether the queue is full.
+ * @param s
+ *  The scheduler.
+ * @return
+ *  true if no more requests can be queued.
+ */
+bool tpm2_sched_is_full(const tpm2_sched *s);
+
+/**
+ * Gets the number of queued requests.
+ * @param s
+ *  The scheduler.
+ * @return
+ *  The number of requests.
+ */
+size_t tpm2_sched_count(const tpm2_sched *s);
+
+/**
+ * Gets a queued request, in no particular order.
+ * @param s
+ *  The scheduler.
+ * @param index
+ *  The index of the request, less than tpm2_sched_count().
+ * @return
+ *  The request.
+ */
+void *tpm2_sched_get(const tpm2_sched *s, size_t index);
+
+#endif /* LIB_TPM2_SCHED_H_ */
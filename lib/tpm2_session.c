@@ -1,15 +1,28 @@
 /* SPDX-License-Identifier: BSD-3-Clause */
 
+#include <dirent.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
+
+#include <sys/stat.h>
+
+#include <openssl/evp.h>
 
 #include "files.h"
 #include "log.h"
 #include "tpm2.h"
+#include "tpm2_alg_util.h"
+#include "tpm2_hex.h"
+#include "tpm2_name_cache.h"
 #include "tpm2_session.h"
+#include "tpm2_util.h"
 
 struct tpm2_session_data {
     ESYS_TR key;
@@ -35,9 +48,34 @@ struct tpm2_session {
         char *path;
         ESYS_CONTEXT *ectx;
         bool is_final;
+        /* where the session goes back to on close, NULL if not pooled */
+        char *pool_path;
+        /*
+         * a restored session file positioned at the saved context, which is
+         * loaded into the TPM on first use, NULL once loaded
+         */
+        FILE *context_file;
+        /*
+         * the lock of the restored session file, held until it is written
+         * back so tools running in parallel take turns with a session, -1
+         * if not locked
+         */
+        int lock_fd;
+        /*
+         * a trial session without a TPM, the policy digest is computed on
+         * the host
+         */
+        bool is_offline;
+        TPM2B_DIGEST policy_digest;
     } internal;
 };
 
+/*
+ * The directory idle HMAC sessions are saved to by tpm2_session_close() and
+ * picked up from by tpm2_session_open(), NULL while the pool is disabled.
+ */
+static char *session_pool_dir;
+
 tpm2_session_data *tpm2_session_data_new(TPM2_SE type) {
     tpm2_session_data * d = calloc(1, sizeof(tpm2_session_data));
     if (d) {
@@ -98,7 +136,50 @@ TPMI_ALG_HASH tpm2_session_get_authhash(tpm2_session *session) {
     return session->input->auth_hash;
 }
 
+/*
+ * Loads the context of a restored session into the TPM. Until then the
+ * session file is untouched and the TPM state is left as is.
+ */
+static tool_rc session_load(tpm2_session *s) {
+
+    if (!s->internal.context_file) {
+        return tool_rc_success;
+    }
+
+    ESYS_TR handle = ESYS_TR_NONE;
+    tool_rc rc = files_load_tpm_context_from_file(s->internal.ectx, &handle,
+            s->internal.context_file);
+    fclose(s->internal.context_file);
+    s->internal.context_file = NULL;
+    if (rc != tool_rc_success) {
+        LOG_ERR("Could not load session context");
+        return rc;
+    }
+
+    s->output.session_handle = handle;
+
+    /* hack this in here, should be done when starting the session */
+    TPMA_SESSION attrs = 0;
+    rc = tpm2_sess_get_attributes(s->internal.ectx, handle, &attrs);
+    UNUSED(rc);
+
+    LOG_INFO("Restored session: ESYS_TR(0x%x) attrs(0x%x)", handle, attrs);
+
+    return tool_rc_success;
+}
+
 ESYS_TR tpm2_session_get_handle(tpm2_session *session) {
+
+    if (session->internal.is_offline) {
+        LOG_ERR("A trial session started without a TPM cannot be used with "
+                "the TPM");
+        return ESYS_TR_NONE;
+    }
+
+    /* a session that fails to load has no handle, which ESAPI rejects */
+    tool_rc rc = session_load(session);
+    UNUSED(rc);
+
     return session->output.session_handle;
 }
 
@@ -106,6 +187,35 @@ TPM2_SE tpm2_session_get_type(tpm2_session *session) {
     return session->input->session_type;
 }
 
+bool tpm2_session_is_offline(tpm2_session *session) {
+    return session->internal.is_offline;
+}
+
+TPM2B_DIGEST *tpm2_session_get_policy_digest(tpm2_session *session) {
+    return session->internal.is_offline ?
+            &session->internal.policy_digest : NULL;
+}
+
+/*
+ * A trial session starts with a policy digest of all zeros, as long as the
+ * digest of its auth hash.
+ */
+static bool offline_session_reset(tpm2_session *session) {
+
+    UINT16 size = tpm2_alg_util_get_hash_size(session->input->auth_hash);
+    if (!size) {
+        LOG_ERR("Unsupported policy digest algorithm 0x%x",
+                session->input->auth_hash);
+        return false;
+    }
+
+    memset(&session->internal.policy_digest, 0,
+            sizeof(session->internal.policy_digest));
+    session->internal.policy_digest.size = size;
+
+    return true;
+}
+
 const TPM2B_AUTH *tpm2_session_get_auth_value(tpm2_session *session) {
     return &session->input->auth_data;
 }
@@ -123,7 +233,18 @@ static tool_rc start_auth_session(tpm2_session *session) {
             session->input->nonce_caller.size > 0 ?
                     &session->input->nonce_caller : NULL;
 
-    tool_rc rc = tpm2_start_auth_session(session->internal.ectx, d->key,
+    /* a salt encrypted to a key of a wrong name would leak */
+    tool_rc rc = tpm2_name_cache_confirm(session->internal.ectx, d->key);
+    if (rc != tool_rc_success) {
+        return rc;
+    }
+
+    rc = tpm2_name_cache_confirm(session->internal.ectx, d->bind);
+    if (rc != tool_rc_success) {
+        return rc;
+    }
+
+    rc = tpm2_start_auth_session(session->internal.ectx, d->key,
             d->bind, nonce, d->session_type, &d->symmetric, d->auth_hash,
             &session->output.session_handle);
     if (rc != tool_rc_success) {
@@ -153,32 +274,198 @@ static void tpm2_session_free(tpm2_session **session) {
         if (s->internal.path) {
             free(s->internal.path);
         }
+        free(s->internal.pool_path);
+        if (s->internal.context_file) {
+            fclose(s->internal.context_file);
+        }
+        files_unlock(s->internal.lock_fd);
         free(s);
         *session = NULL;
     }
 }
 
-tool_rc tpm2_session_open(ESYS_CONTEXT *context, tpm2_session_data *data,
-        tpm2_session **session) {
+static bool pool_hash_name(ESYS_CONTEXT *ectx, EVP_MD_CTX *md, ESYS_TR handle) {
+
+    TPM2B_NAME *name = NULL;
+    if (handle != ESYS_TR_NONE) {
+        tool_rc rc = tpm2_tr_get_name(ectx, handle, &name);
+        if (rc != tool_rc_success) {
+            return false;
+        }
+    }
+
+    UINT16 size = name ? name->size : 0;
+    int rc = EVP_DigestUpdate(md, &size, sizeof(size));
+    if (rc && name) {
+        rc = EVP_DigestUpdate(md, name->name, name->size);
+    }
+
+    free(name);
+
+    return rc == 1;
+}
+
+/*
+ * Sessions are interchangeable when they agree in type, salt key, bind
+ * entity, symmetric algorithm and auth hash, so the pool file is named by a
+ * digest of those. Only HMAC sessions without a caller chosen nonce and not
+ * persisted to a session file by the user are pooled. Returns NULL for
+ * sessions that are not pooled.
+ */
+static char *pool_get_path(tpm2_session *s) {
+
+    tpm2_session_data *d = s->input;
+    if (!session_pool_dir || d->session_type != TPM2_SE_HMAC
+            || d->nonce_caller.size || s->internal.path) {
+        return NULL;
+    }
+
+    EVP_MD_CTX *md = EVP_MD_CTX_new();
+    if (!md) {
+        LOG_WARN("oom, not pooling the session");
+        return NULL;
+    }
+
+    unsigned char digest[EVP_MAX_MD_SIZE];
+    unsigned digest_len = 0;
+    bool result = EVP_DigestInit_ex(md, EVP_sha256(), NULL) == 1
+            && EVP_DigestUpdate(md, &d->session_type,
+                    sizeof(d->session_type)) == 1
+            && EVP_DigestUpdate(md, &d->symmetric, sizeof(d->symmetric)) == 1
+            && EVP_DigestUpdate(md, &d->auth_hash, sizeof(d->auth_hash)) == 1
+            && pool_hash_name(s->internal.ectx, md, d->key)
+            && pool_hash_name(s->internal.ectx, md, d->bind)
+            && EVP_DigestFinal_ex(md, digest, &digest_len) == 1;
+    EVP_MD_CTX_free(md);
+    if (!result) {
+        LOG_WARN("Could not compute the session pool key, not pooling the "
+                "session");
+        return NULL;
+    }
+
+    size_t len = strlen(session_pool_dir) + 1 + digest_len * 2 + 1;
+    char *path = malloc(len);
+    if (!path) {
+        LOG_WARN("oom, not pooling the session");
+        return NULL;
+    }
+
+    int offset = snprintf(path, len, "%s/", session_pool_dir);
+    tpm2_hex_encode(digest, digest_len, &path[offset], false);
+
+    return path;
+}
+
+/*
+ * Loads an idle session from the pool. The pool file is removed either way,
+ * a session context can only be loaded once.
+ */
+static bool pool_take(tpm2_session *s) {
+
+    FILE *f = fopen(s->internal.pool_path, "rb");
+    if (!f) {
+        return false;
+    }
+
+    ESYS_TR handle = ESYS_TR_NONE;
+    tool_rc rc = files_load_tpm_context_from_file(s->internal.ectx, &handle,
+            f);
+    fclose(f);
+    unlink(s->internal.pool_path);
+    if (rc != tool_rc_success) {
+        LOG_WARN("Could not load pooled session, starting a new one");
+        return false;
+    }
+
+    /* the attributes are whatever the last user left them at */
+    rc = tpm2_sess_set_attributes(s->internal.ectx, handle,
+            TPMA_SESSION_CONTINUESESSION | s->input->attrs, 0xff);
+    if (rc != tool_rc_success) {
+        rc = tpm2_flush_context(s->internal.ectx, handle);
+        UNUSED(rc);
+        return false;
+    }
+
+    s->output.session_handle = handle;
+    LOG_INFO("Reusing pooled session: ESYS_TR(0x%x)", handle);
+
+    return true;
+}
+
+/*
+ * Saves a session to the pool instead of flushing it. Returns false if the
+ * pool already holds an equivalent session or the session could not be saved.
+ */
+static bool pool_put(tpm2_session *s) {
+
+    int fd = open(s->internal.pool_path, O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC,
+            S_IRUSR | S_IWUSR);
+    if (fd < 0) {
+        return false;
+    }
+
+    FILE *f = fdopen(fd, "wb");
+    if (!f) {
+        close(fd);
+        unlink(s->internal.pool_path);
+        return false;
+    }
+
+    tool_rc rc = files_save_tpm_context_to_file(s->internal.ectx,
+            s->output.session_handle, f);
+    fclose(f);
+    if (rc != tool_rc_success) {
+        unlink(s->internal.pool_path);
+        return false;
+    }
+
+    return true;
+}
+
+static tpm2_session *session_new(ESYS_CONTEXT *context,
+        tpm2_session_data *data) {
 
     tpm2_session *s = calloc(1, sizeof(tpm2_session));
     if (!s) {
         free(data);
         LOG_ERR("oom");
-        return tool_rc_general_error;
+        return NULL;
     }
 
+    s->input = data;
+    s->internal.ectx = context;
+    s->internal.lock_fd = -1;
+
     if (data->path) {
         s->internal.path = strdup(data->path);
         if (!s->internal.path) {
             LOG_ERR("oom");
             tpm2_session_free(&s);
-            return tool_rc_general_error;
+            return NULL;
         }
     }
 
-    s->input = data;
-    s->internal.ectx = context;
+    return s;
+}
+
+tool_rc tpm2_session_open(ESYS_CONTEXT *context, tpm2_session_data *data,
+        tpm2_session **session) {
+
+    tpm2_session *s = session_new(context, data);
+    if (!s) {
+        return tool_rc_general_error;
+    }
+
+    if (!context && data->session_type == TPM2_SE_TRIAL) {
+        s->output.session_handle = ESYS_TR_NONE;
+        s->internal.is_offline = true;
+        if (!offline_session_reset(s)) {
+            tpm2_session_free(&s);
+            return tool_rc_general_error;
+        }
+        *session = s;
+        return tool_rc_success;
+    }
 
     if (!context) {
         s->output.session_handle = ESYS_TR_PASSWORD;
@@ -186,10 +473,15 @@ tool_rc tpm2_session_open(ESYS_CONTEXT *context, tpm2_session_data *data,
         return tool_rc_success;
     }
 
-    tool_rc rc = start_auth_session(s);
-    if (rc != tool_rc_success) {
-        tpm2_session_free(&s);
-        return rc;
+    s->internal.pool_path = pool_get_path(s);
+
+    bool is_reused = s->internal.pool_path && pool_take(s);
+    if (!is_reused) {
+        tool_rc rc = start_auth_session(s);
+        if (rc != tool_rc_success) {
+            tpm2_session_free(&s);
+            return rc;
+        }
     }
 
     *session = s;
@@ -203,6 +495,12 @@ tool_rc tpm2_session_open(ESYS_CONTEXT *context, tpm2_session_data *data,
  */
 #define SESSION_VERSION 2
 
+/*
+ * A trial session started without a TPM, followed by the policy digest
+ * instead of a saved context.
+ */
+#define SESSION_VERSION_OFFLINE 3
+
 /*
  * Checks that two types are equal in size.
  *
@@ -220,6 +518,372 @@ COMPILE_ASSERT_SIZE(ESYS_TR, UINT32);
 COMPILE_ASSERT_SIZE(TPMI_ALG_HASH, UINT16);
 COMPILE_ASSERT_SIZE(TPM2_SE, UINT8);
 
+/*
+ * Writes a session file: the header, the session type and auth hash, then the
+ * saved context of the session.
+ */
+static tool_rc session_file_write(ESYS_CONTEXT *ectx, FILE *session_file,
+        TPM2_SE session_type, TPMI_ALG_HASH hash, ESYS_TR handle) {
+
+    bool result = files_write_header(session_file, SESSION_VERSION);
+    if (!result) {
+        LOG_ERR("Could not write context file header");
+        return tool_rc_general_error;
+    }
+
+    // UINT8 session type:
+    result = files_write_bytes(session_file, &session_type,
+            sizeof(session_type));
+    if (!result) {
+        LOG_ERR("Could not write session type");
+        return tool_rc_general_error;
+    }
+
+    // UINT16 - auth hash digest
+    result = files_write_16(session_file, hash);
+    if (!result) {
+        LOG_ERR("Could not write auth hash");
+        return tool_rc_general_error;
+    }
+
+    /*
+     * Save session context at end of tpm2_session. With tabrmd support it
+     * can be reloaded under certain circumstances.
+     */
+    LOG_INFO("Saved session: ESYS_TR(0x%x)", handle);
+    tool_rc rc = files_save_tpm_context_to_file(ectx, handle, session_file);
+    if (rc != tool_rc_success) {
+        LOG_ERR("Could not write session context");
+    }
+
+    return rc;
+}
+
+/*
+ * While the pool is enabled, the sessions of the session files of the user
+ * stay loaded in the TPM from one tool to the next instead of being saved and
+ * loaded again, so an encrypted session costs its parameter encryption and
+ * nothing more per command. As the tools run in processes of their own, the
+ * ESYS_TR of such a live session is serialized into an entry of the pool
+ * directory. The entry is named after the device and inode of the session
+ * file rather than its path, which is relative to the working directory of a
+ * client of tpm2_serve, not of the tool, and holds:
+ *   the header of files_write_header()
+ *   U64 device, U64 inode of the session file
+ *   U16 size, then the path of the session file, for the messages
+ *   U8 session type, U16 auth hash
+ *   U32 size, then the serialized ESYS_TR
+ * The session files are only written when the pool is freed, through the
+ * descriptors tpm2_session_pool_adopt() got from the clients. A few sessions
+ * only are kept loaded, the others are saved as usual, so the tools still
+ * find TPM memory for the sessions of their own.
+ */
+#define SESSION_LIVE_PREFIX "live-"
+#define SESSION_LIVE_MAX 2
+#define SESSION_LIVE_TR_MAX 4096
+
+typedef struct live_entry live_entry;
+struct live_entry {
+    UINT64 dev;
+    UINT64 ino;
+    char path[PATH_MAX];
+    TPM2_SE type;
+    TPMI_ALG_HASH hash;
+    UINT8 tr[SESSION_LIVE_TR_MAX];
+    UINT32 tr_size;
+};
+
+/* the session files of the live sessions, to write when the pool is freed */
+static struct {
+    char live_path[PATH_MAX];
+    int fd;
+} live_files[SESSION_LIVE_MAX];
+static size_t live_file_count;
+
+static bool live_get_path(const char *path, struct stat *st,
+        char live_path[PATH_MAX]) {
+
+    if (!files_stat(path, st)) {
+        return false;
+    }
+
+    int len = snprintf(live_path, PATH_MAX,
+            "%s/" SESSION_LIVE_PREFIX "%jx-%jx", session_pool_dir,
+            (uintmax_t) st->st_dev, (uintmax_t) st->st_ino);
+
+    return len >= 0 && len < PATH_MAX;
+}
+
+static size_t live_count(void) {
+
+    size_t count = 0;
+    DIR *dir = opendir(session_pool_dir);
+    if (dir) {
+        struct dirent *entry;
+        while ((entry = readdir(dir))) {
+            count += !strncmp(entry->d_name, SESSION_LIVE_PREFIX,
+                    sizeof(SESSION_LIVE_PREFIX) - 1);
+        }
+        closedir(dir);
+    }
+
+    return count;
+}
+
+/* reads a live session entry, and removes it unless only peeking */
+static bool live_read(const char *live_path, live_entry *e, bool is_remove) {
+
+    FILE *f = fopen(live_path, "rb");
+    if (!f) {
+        return false;
+    }
+
+    UINT32 version = 0;
+    UINT16 path_size = 0;
+    bool result = files_read_header(f, &version)
+            && version == SESSION_VERSION
+            && files_read_64(f, &e->dev)
+            && files_read_64(f, &e->ino)
+            && files_read_16(f, &path_size)
+            && path_size < PATH_MAX
+            && files_read_bytes(f, (UINT8 *) e->path, path_size)
+            && files_read_bytes(f, &e->type, sizeof(e->type))
+            && files_read_16(f, &e->hash)
+            && files_read_32(f, &e->tr_size)
+            && e->tr_size <= SESSION_LIVE_TR_MAX
+            && files_read_bytes(f, e->tr, e->tr_size);
+    fclose(f);
+    if (is_remove) {
+        unlink(live_path);
+    }
+
+    e->path[result ? path_size : 0] = '\0';
+
+    return result;
+}
+
+/*
+ * Restores the live session of a session file, NULL if it has none. Takes
+ * path on success.
+ */
+static tpm2_session *live_take(ESYS_CONTEXT *ectx, char *path,
+        bool is_final) {
+
+    struct stat st;
+    char live_path[PATH_MAX];
+    if (!live_get_path(path, &st, live_path)) {
+        return NULL;
+    }
+
+    static live_entry e;
+    if (!live_read(live_path, &e, true)) {
+        return NULL;
+    }
+
+    if (e.dev != (UINT64) st.st_dev || e.ino != (UINT64) st.st_ino) {
+        LOG_WARN("Live session of \"%s\" is for \"%s\", dropping it",
+                path, e.path);
+        return NULL;
+    }
+
+    ESYS_TR handle = ESYS_TR_NONE;
+    TSS2_RC rval = Esys_TR_Deserialize(ectx, e.tr, e.tr_size, &handle);
+    if (rval != TSS2_RC_SUCCESS) {
+        LOG_PERR(Esys_TR_Deserialize, rval);
+        return NULL;
+    }
+
+    tpm2_session_data *d = tpm2_session_data_new(e.type);
+    tpm2_session *s = d ? session_new(ectx, d) : NULL;
+    if (!s) {
+        LOG_ERR("oom");
+        tool_rc rc = tpm2_flush_context(ectx, handle);
+        UNUSED(rc);
+        return NULL;
+    }
+
+    tpm2_session_set_authhash(d, e.hash);
+    s->output.session_handle = handle;
+    s->internal.path = path;
+    s->internal.is_final = is_final;
+
+    LOG_INFO("Restored live session: ESYS_TR(0x%x)", handle);
+
+    return s;
+}
+
+/* keeps a session loaded instead of saving it, false if it is not kept */
+static bool live_put(tpm2_session *s) {
+
+    struct stat st;
+    char live_path[PATH_MAX];
+    if (!session_pool_dir || live_count() >= SESSION_LIVE_MAX
+            || !live_get_path(s->internal.path, &st, live_path)) {
+        return false;
+    }
+
+    UINT8 *tr = NULL;
+    size_t tr_size = 0;
+    TSS2_RC rval = Esys_TR_Serialize(s->internal.ectx,
+            s->output.session_handle, &tr, &tr_size);
+    if (rval != TSS2_RC_SUCCESS || tr_size > SESSION_LIVE_TR_MAX) {
+        free(tr);
+        return false;
+    }
+
+    files_atomic atomic;
+    FILE *f = files_atomic_open(&atomic, live_path);
+    if (!f) {
+        free(tr);
+        return false;
+    }
+
+    TPM2_SE type = s->input->session_type;
+    const char *path = s->internal.path;
+    size_t path_size = strlen(path);
+    bool result = files_write_header(f, SESSION_VERSION)
+            && files_write_64(f, st.st_dev)
+            && files_write_64(f, st.st_ino)
+            && files_write_16(f, path_size)
+            && files_write_bytes(f, (UINT8 *) path, path_size)
+            && files_write_bytes(f, &type, sizeof(type))
+            && files_write_16(f, tpm2_session_get_authhash(s))
+            && files_write_32(f, tr_size)
+            && files_write_bytes(f, tr, tr_size);
+    free(tr);
+
+    if (!files_atomic_close(&atomic, f, result)) {
+        return false;
+    }
+
+    LOG_INFO("Kept session alive: ESYS_TR(0x%x)", s->output.session_handle);
+
+    return true;
+}
+
+/* takes the descriptor of the session file of a live entry, -1 if none */
+static int live_file_take(const char *live_path) {
+
+    size_t i;
+    for (i = 0; i < live_file_count; i++) {
+        if (!strcmp(live_files[i].live_path, live_path)) {
+            int fd = live_files[i].fd;
+            live_files[i] = live_files[--live_file_count];
+            return fd;
+        }
+    }
+
+    return -1;
+}
+
+/* writes the session file of a live session, once the pool is freed */
+static void live_release(ESYS_CONTEXT *ectx, const char *live_path) {
+
+    static live_entry e;
+    int fd = live_file_take(live_path);
+    if (!live_read(live_path, &e, true) || !ectx) {
+        if (fd >= 0) {
+            close(fd);
+        }
+        return;
+    }
+
+    ESYS_TR handle = ESYS_TR_NONE;
+    TSS2_RC rval = Esys_TR_Deserialize(ectx, e.tr, e.tr_size, &handle);
+    if (rval != TSS2_RC_SUCCESS) {
+        LOG_PERR(Esys_TR_Deserialize, rval);
+        if (fd >= 0) {
+            close(fd);
+        }
+        return;
+    }
+
+    /* written in place, no other tool reads the file while its session lives */
+    struct stat st;
+    FILE *f = fd >= 0 && !fstat(fd, &st) && (UINT64) st.st_dev == e.dev
+            && (UINT64) st.st_ino == e.ino && !ftruncate(fd, 0) ?
+            fdopen(fd, "wb") : NULL;
+    if (!f) {
+        LOG_WARN("Could not write the session file \"%s\", flushing its "
+                "session", e.path);
+        if (fd >= 0) {
+            close(fd);
+        }
+        tool_rc rc = tpm2_flush_context(ectx, handle);
+        UNUSED(rc);
+        return;
+    }
+
+    tool_rc rc = session_file_write(ectx, f, e.type, e.hash, handle);
+    if (fclose(f) || rc != tool_rc_success) {
+        LOG_ERR("Could not write the session file \"%s\"", e.path);
+    }
+}
+
+void tpm2_session_pool_adopt(void) {
+
+    if (!session_pool_dir) {
+        return;
+    }
+
+    /* the sessions that are no longer live, ie flushed by the last tool */
+    size_t i = 0;
+    while (i < live_file_count) {
+        if (access(live_files[i].live_path, F_OK)) {
+            close(live_files[i].fd);
+            live_files[i] = live_files[--live_file_count];
+            continue;
+        }
+        i++;
+    }
+
+    DIR *dir = opendir(session_pool_dir);
+    if (!dir) {
+        return;
+    }
+
+    struct dirent *entry;
+    while ((entry = readdir(dir)) && live_file_count < SESSION_LIVE_MAX) {
+        if (strncmp(entry->d_name, SESSION_LIVE_PREFIX,
+                sizeof(SESSION_LIVE_PREFIX) - 1)) {
+            continue;
+        }
+
+        char live_path[PATH_MAX];
+        snprintf(live_path, sizeof(live_path), "%s/%s", session_pool_dir,
+                entry->d_name);
+        for (i = 0; i < live_file_count; i++) {
+            if (!strcmp(live_files[i].live_path, live_path)) {
+                break;
+            }
+        }
+
+        static live_entry e;
+        if (i < live_file_count || !live_read(live_path, &e, false)) {
+            continue;
+        }
+
+        /* the path is the one of the client of the tool that kept it */
+        struct stat st;
+        int fd = files_open(e.path, O_RDWR, 0);
+        if (fd < 0 || fstat(fd, &st) || (UINT64) st.st_dev != e.dev
+                || (UINT64) st.st_ino != e.ino) {
+            LOG_WARN("Could not open the session file \"%s\", its session is "
+                    "flushed when the pool is freed", e.path);
+            if (fd >= 0) {
+                close(fd);
+            }
+            continue;
+        }
+
+        snprintf(live_files[live_file_count].live_path, PATH_MAX, "%s",
+                live_path);
+        live_files[live_file_count].fd = fd;
+        live_file_count++;
+    }
+    closedir(dir);
+}
+
 tool_rc tpm2_session_restore(ESYS_CONTEXT *ctx, const char *path, bool is_final,
         tpm2_session **session) {
 
@@ -236,10 +900,27 @@ tool_rc tpm2_session_restore(ESYS_CONTEXT *ctx, const char *path, bool is_final,
         return tool_rc_general_error;
     }
 
-    FILE *f = fopen(dup_path, "rb");
+    /* a session kept alive by the pool has no current session file */
+    if (session_pool_dir && ctx) {
+        s = live_take(ctx, dup_path, is_final);
+        if (s) {
+            *session = s;
+            return tool_rc_success;
+        }
+    }
+
+    /* another tool using the session is done once it wrote the file back */
+    int lock_fd = files_lock(dup_path);
+    if (lock_fd < 0) {
+        free(dup_path);
+        return tool_rc_general_error;
+    }
+
+    FILE *f = files_fopen(dup_path, "rb");
     if (!f) {
         LOG_ERR("Could not open path \"%s\", due to error: \"%s\"", dup_path,
                 strerror(errno));
+        files_unlock(lock_fd);
         free(dup_path);
         return tool_rc_general_error;
     }
@@ -261,14 +942,6 @@ tool_rc tpm2_session_restore(ESYS_CONTEXT *ctx, const char *path, bool is_final,
         goto out;
     }
 
-    ESYS_TR handle;
-    tool_rc tmp_rc = files_load_tpm_context_from_file(ctx, &handle, f);
-    if (tmp_rc != tool_rc_success) {
-        rc = tmp_rc;
-        LOG_ERR("Could not load session context");
-        goto out;
-    }
-
     tpm2_session_data *d = tpm2_session_data_new(type);
     if (!d) {
         LOG_ERR("oom");
@@ -277,33 +950,48 @@ tool_rc tpm2_session_restore(ESYS_CONTEXT *ctx, const char *path, bool is_final,
 
     tpm2_session_set_authhash(d, auth_hash);
 
-    tmp_rc = tpm2_session_open(NULL, d, &s);
-    if (tmp_rc != tool_rc_success) {
-        rc = tmp_rc;
-        LOG_ERR("oom new session object");
+    s = session_new(ctx, d);
+    if (!s) {
         goto out;
     }
 
-    s->output.session_handle = handle;
-    s->internal.path = dup_path;
-    s->internal.ectx = ctx;
-    dup_path = NULL;
-
-    TPMA_SESSION attrs = 0;
-
-    if (ctx) {
+    if (result && version == SESSION_VERSION_OFFLINE) {
+        TPM2B_DIGEST *digest = &s->internal.policy_digest;
+        result = files_read_16(f, &digest->size);
+        if (!result || digest->size > sizeof(digest->buffer)
+                || !files_read_bytes(f, digest->buffer, digest->size)) {
+            LOG_ERR("Could not read policy digest");
+            tpm2_session_free(&s);
+            goto out;
+        }
 
-        /* hack this in here, should be done when starting the session */
-        tmp_rc = tpm2_sess_get_attributes(ctx, handle, &attrs);
-        UNUSED(tmp_rc);
+        s->output.session_handle = ESYS_TR_NONE;
+        s->internal.path = dup_path;
+        s->internal.is_offline = true;
+        s->internal.lock_fd = lock_fd;
+        lock_fd = -1;
+        dup_path = NULL;
+        *session = s;
+        rc = tool_rc_success;
+        goto out;
     }
 
+    /*
+     * The saved context is only loaded when the session handle is first
+     * needed, a tool that never gets that far leaves the TPM and the session
+     * file as they are.
+     */
+    s->output.session_handle = ESYS_TR_NONE;
+    s->internal.path = dup_path;
+    s->internal.context_file = f;
     s->internal.is_final = is_final;
+    s->internal.lock_fd = lock_fd;
+    lock_fd = -1;
+    dup_path = NULL;
+    f = NULL;
 
     *session = s;
 
-    LOG_INFO("Restored session: ESYS_TR(0x%x) attrs(0x%x)", handle, attrs);
-
     rc = tool_rc_success;
 
 out:
@@ -311,6 +999,7 @@ out:
     if (f) {
         fclose(f);
     }
+    files_unlock(lock_fd);
 
     return rc;
 }
@@ -323,6 +1012,35 @@ tool_rc tpm2_session_get_noncetpm(ESYS_CONTEXT *ectx, tpm2_session *s,
     return tpm2_sess_get_noncetpm(ectx, session_handle, nonce_tpm);
 }
 
+/*
+ * Writes a trial session started without a TPM: the session type and auth
+ * hash as for any session, then the policy digest.
+ */
+static tool_rc offline_session_save(tpm2_session *session) {
+
+    const char *path = session->internal.path;
+    files_atomic atomic;
+    FILE *f = files_atomic_fopen(&atomic, path);
+    if (!f) {
+        return tool_rc_general_error;
+    }
+
+    TPM2_SE session_type = session->input->session_type;
+    const TPM2B_DIGEST *digest = &session->internal.policy_digest;
+    bool result = files_write_header(f, SESSION_VERSION_OFFLINE)
+            && files_write_bytes(f, &session_type, sizeof(session_type))
+            && files_write_16(f, session->input->auth_hash)
+            && files_write_16(f, digest->size)
+            && files_write_bytes(f, (UINT8 *) digest->buffer, digest->size);
+    result = files_atomic_close(&atomic, f, result);
+    if (!result) {
+        LOG_ERR("Could not write session file \"%s\"", path);
+        return tool_rc_general_error;
+    }
+
+    return tool_rc_success;
+}
+
 tool_rc tpm2_session_close(tpm2_session **s) {
 
     if (!*s) {
@@ -340,69 +1058,72 @@ tool_rc tpm2_session_close(tpm2_session **s) {
         goto out2;
     }
 
-    const char *path = session->internal.path;
-    FILE *session_file = path ? fopen(path, "w+b") : NULL;
-    if (path && !session_file) {
-        LOG_ERR("Could not open path \"%s\", due to error: \"%s\"", path,
-                strerror(errno));
-        rc = tool_rc_general_error;
-        goto out;
+    /* there is nothing to flush without a TPM */
+    if (session->internal.is_offline) {
+        if (session->internal.path && !session->internal.is_final) {
+            rc = offline_session_save(session);
+        }
+        goto out2;
     }
 
-    bool flush = path ? session->internal.is_final : true;
-    if (flush) {
-        rc = tpm2_flush_context(session->internal.ectx,
-                session->output.session_handle);
-        /* done, use rc to indicate status */
-        goto out;
+    /*
+     * A restored session that was never loaded did not change, its file
+     * still holds the current context. Only a final close has to load it to
+     * flush it.
+     */
+    if (session->internal.context_file) {
+        if (!session->internal.is_final) {
+            LOG_INFO("Session unused, keeping session file");
+            goto out2;
+        }
+
+        rc = session_load(session);
+        if (rc != tool_rc_success) {
+            goto out2;
+        }
+    }
+
+    const char *path = session->internal.path;
+    if (path && !session->internal.is_final && live_put(session)) {
+        goto out2;
     }
 
     /*
-     * Now write the session_type, handle and auth hash data to disk
+     * The session file is replaced atomically, a tool restoring it in
+     * parallel waits for the lock and then reads the new file.
      */
-    bool result = files_write_header(session_file, SESSION_VERSION);
-    if (!result) {
-        LOG_ERR("Could not write context file header");
+    files_atomic atomic;
+    FILE *session_file = path ? files_atomic_fopen(&atomic, path) : NULL;
+    if (path && !session_file) {
         rc = tool_rc_general_error;
         goto out;
     }
 
-    // UINT8 session type:
-    TPM2_SE session_type = session->input->session_type;
-    result = files_write_bytes(session_file, &session_type,
-            sizeof(session_type));
-    if (!result) {
-        LOG_ERR("Could not write session type");
-        rc = tool_rc_general_error;
+    if (session->internal.pool_path && pool_put(session)) {
         goto out;
     }
 
-    // UINT16 - auth hash digest
-    TPMI_ALG_HASH hash = tpm2_session_get_authhash(session);
-    result = files_write_16(session_file, hash);
-    if (!result) {
-        LOG_ERR("Could not write auth hash");
-        rc = tool_rc_general_error;
+    bool flush = path ? session->internal.is_final : true;
+    if (flush) {
+        rc = tpm2_flush_context(session->internal.ectx,
+                session->output.session_handle);
+        /* done, use rc to indicate status */
         goto out;
     }
 
     /*
-     * Save session context at end of tpm2_session. With tabrmd support it
-     * can be reloaded under certain circumstances.
+     * Now write the session_type, handle and auth hash data to disk
      */
-
-    ESYS_TR handle = tpm2_session_get_handle(session);
-    LOG_INFO("Saved session: ESYS_TR(0x%x)", handle);
-    rc = files_save_tpm_context_to_file(session->internal.ectx, handle,
-    session_file);
-    if (rc != tool_rc_success) {
-        LOG_ERR("Could not write session context");
-        /* done, free session resources and use rc to indicate status */
-    }
+    rc = session_file_write(session->internal.ectx, session_file,
+            session->input->session_type, tpm2_session_get_authhash(session),
+            tpm2_session_get_handle(session));
 
 out:
-    if (session_file) {
-        fclose(session_file);
+    if (session_file
+            && !files_atomic_close(&atomic, session_file,
+                    rc == tool_rc_success)
+            && rc == tool_rc_success) {
+        rc = tool_rc_general_error;
     }
 out2:
     tpm2_session_free(s);
@@ -412,8 +1133,74 @@ out2:
 
 tool_rc tpm2_session_restart(ESYS_CONTEXT *context, tpm2_session *s) {
 
+    if (s->internal.is_offline) {
+        return offline_session_reset(s) ?
+                tool_rc_success : tool_rc_general_error;
+    }
+
     ESYS_TR handle = tpm2_session_get_handle(s);
 
     return tpm2_policy_restart(context, handle, ESYS_TR_NONE, ESYS_TR_NONE,
             ESYS_TR_NONE);
 }
+
+tool_rc tpm2_session_pool_init(void) {
+
+    if (session_pool_dir) {
+        return tool_rc_success;
+    }
+
+    session_pool_dir = files_temp_dir_create("tpm2-sessions", "session pool");
+    if (!session_pool_dir) {
+        return tool_rc_general_error;
+    }
+
+    return tool_rc_success;
+}
+
+void tpm2_session_pool_free(ESYS_CONTEXT *ectx) {
+
+    if (!session_pool_dir) {
+        return;
+    }
+
+    DIR *dir = opendir(session_pool_dir);
+    if (dir) {
+        struct dirent *entry;
+        while ((entry = readdir(dir))) {
+            if (entry->d_name[0] == '.') {
+                continue;
+            }
+
+            char path[PATH_MAX];
+            snprintf(path, sizeof(path), "%s/%s", session_pool_dir,
+                    entry->d_name);
+
+            if (!strncmp(entry->d_name, SESSION_LIVE_PREFIX,
+                    sizeof(SESSION_LIVE_PREFIX) - 1)) {
+                live_release(ectx, path);
+                continue;
+            }
+
+            ESYS_TR handle = ESYS_TR_NONE;
+            tool_rc rc = ectx ?
+                    files_load_tpm_context_from_path(ectx, &handle, path) :
+                    tool_rc_general_error;
+            if (rc == tool_rc_success) {
+                rc = tpm2_flush_context(ectx, handle);
+                UNUSED(rc);
+            }
+
+            unlink(path);
+        }
+        closedir(dir);
+    }
+
+    while (live_file_count) {
+        close(live_files[--live_file_count].fd);
+    }
+
+    rmdir(session_pool_dir);
+    free(session_pool_dir);
+    session_pool_dir = NULL;
+}
@@ -120,7 +120,8 @@ TPMI_ALG_HASH tpm2_session_get_authhash(tpm2_session *session);
  * @param session
  *  The session started with tpm2_session_new().
  * @return
- *  The session handle.
+ *  The session handle, ESYS_TR_NONE if a restored session could not be
+ *  loaded.
  */
 ESYS_TR tpm2_session_get_handle(tpm2_session *session);
 
@@ -144,8 +145,33 @@ static inline bool tpm2_session_is_trial(tpm2_session *session) {
     return tpm2_session_get_type(session) == TPM2_SE_TRIAL;
 }
 
+/**
+ * True if a session is a trial session started without a TPM.
+ * @param session
+ *  The session to check.
+ * @return
+ *  True if the policy digest of the session is computed on the host, false
+ *  otherwise.
+ */
+bool tpm2_session_is_offline(tpm2_session *session);
+
+/**
+ * Retrieves the policy digest of a trial session started without a TPM, which
+ * the tpm2_policy_build_*() routines extend on the host.
+ * @param session
+ *  The session to get the policy digest of.
+ * @return
+ *  The policy digest, NULL if the session is not offline.
+ */
+TPM2B_DIGEST *tpm2_session_get_policy_digest(tpm2_session *session);
+
 /**
  * Starts a session with the tpm via StartAuthSession().
+ *
+ * Without a context, a TPM2_SE_TRIAL session is started on the host, its
+ * policy digest is computed by the tpm2_policy_build_*() routines and it is
+ * saved to and restored from a session file like a TPM session. Other
+ * session types yield a password session.
  * @param context
  *  The Enhanced System API (ESAPI) context.
  * @param data
@@ -179,7 +205,9 @@ tool_rc tpm2_session_open(ESYS_CONTEXT *context, tpm2_session_data *data,
 tool_rc tpm2_session_close(tpm2_session **session);
 
 /**
- * Restores a session saved with tpm2_session_save().
+ * Restores a session saved with tpm2_session_save(). The saved context is
+ * loaded into the TPM by the first tpm2_session_get_handle(), a session that
+ * is closed without being used leaves its file unchanged.
  * @param context
  *  The Enhanced System API (ESAPI) context
  * @param path
@@ -212,4 +240,32 @@ void tpm2_session_set_auth_value(tpm2_session *session, TPM2B_AUTH *auth_value);
 
 const TPM2B_AUTH *tpm2_session_get_auth_value(tpm2_session *session);
 
+/**
+ * Enables the session pool for the tools run from now on, ie by tpm2_batch
+ * and tpm2_serve. tpm2_session_close() then saves HMAC sessions started by
+ * tpm2_session_open() to a private directory instead of flushing them, and
+ * tpm2_session_open() loads an equivalent saved session instead of starting a
+ * new one. Sessions are equivalent if they agree in type, salt key, bind
+ * entity, symmetric algorithm and auth hash. Sessions given a nonce by the
+ * caller or saved to a session file are never pooled.
+ * @return
+ *  tool_rc indicating status.
+ */
+tool_rc tpm2_session_pool_init(void);
+
+/**
+ * Opens the session files of the sessions a tool kept loaded, for the pool
+ * to write them when it is freed. Called once a tool is done, while its
+ * client still waits for it, so the files are opened by the client of a tool
+ * of tpm2_serve, see files_open().
+ */
+void tpm2_session_pool_adopt(void);
+
+/**
+ * Flushes the sessions left in the pool and disables it.
+ * @param ectx
+ *  The Enhanced System API (ESAPI) context the pooled sessions belong to.
+ */
+void tpm2_session_pool_free(ESYS_CONTEXT *ectx);
+
 #endif /* SRC_TPM2_SESSION_H_ */
@@ -0,0 +1,406 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+#include <errno.h>
+#include <inttypes.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <sys/resource.h>
+
+#include "log.h"
+#include "tpm2_cc_util.h"
+#include "tpm2_stats.h"
+#include "tpm2_util.h"
+
+/* more than the TPM 2.0 specification defines commands */
+#define STATS_COMMANDS_MAX 256
+
+/* the tag and size fields precede the command code in a command */
+#define STATS_CC_OFFSET 6
+
+/*
+ * glibc supports replacing malloc, the replacement forwards to the allocator
+ * of glibc. The address sanitizer replaces it itself.
+ */
+#if defined(__GLIBC__) && !defined(__SANITIZE_ADDRESS__)
+#define STATS_HEAP 1
+#include <malloc.h>
+#endif
+
+typedef struct stats_command stats_command;
+struct stats_command {
+    TPM2_CC cc;
+    unsigned count;
+};
+
+static struct {
+    uint64_t start_ns;
+    struct rusage start_usage;
+    uint64_t bytes_sent;
+    uint64_t bytes_received;
+    uint64_t tcti_ns;
+    stats_command commands[STATS_COMMANDS_MAX];
+    size_t command_count;
+    uint64_t file_read;
+    uint64_t file_written;
+} stats;
+
+static uint64_t now_ns(void) {
+
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+#ifdef STATS_HEAP
+
+/* the in use bytes go below 0 for blocks allocated before the reset */
+static struct {
+    uint64_t count;
+    uint64_t bytes;
+    int64_t in_use;
+    int64_t peak;
+} heap;
+
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t nmemb, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+extern void *__libc_memalign(size_t alignment, size_t size);
+extern void *__libc_valloc(size_t size);
+extern void *__libc_pvalloc(size_t size);
+extern void __libc_free(void *ptr);
+
+static void *heap_added(void *ptr) {
+
+    if (!ptr) {
+        return NULL;
+    }
+
+    size_t size = malloc_usable_size(ptr);
+    __atomic_add_fetch(&heap.count, 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&heap.bytes, size, __ATOMIC_RELAXED);
+    int64_t in_use = __atomic_add_fetch(&heap.in_use, size, __ATOMIC_RELAXED);
+    /* racy, but the tools allocate from one thread */
+    if (in_use > heap.peak) {
+        heap.peak = in_use;
+    }
+
+    return ptr;
+}
+
+static void heap_removed(size_t size) {
+
+    __atomic_sub_fetch(&heap.in_use, size, __ATOMIC_RELAXED);
+}
+
+void *malloc(size_t size) {
+
+    return heap_added(__libc_malloc(size));
+}
+
+void *calloc(size_t nmemb, size_t size) {
+
+    return heap_added(__libc_calloc(nmemb, size));
+}
+
+void *realloc(void *ptr, size_t size) {
+
+    size_t old_size = ptr ? malloc_usable_size(ptr) : 0;
+    void *p = __libc_realloc(ptr, size);
+
+    /* a failed realloc keeps the block, a realloc to 0 frees it */
+    if (p || (ptr && !size)) {
+        heap_removed(old_size);
+    }
+
+    return heap_added(p);
+}
+
+void *reallocarray(void *ptr, size_t nmemb, size_t size) {
+
+    if (size && nmemb > SIZE_MAX / size) {
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    return realloc(ptr, nmemb * size);
+}
+
+void free(void *ptr) {
+
+    if (ptr) {
+        heap_removed(malloc_usable_size(ptr));
+    }
+
+    __libc_free(ptr);
+}
+
+void *memalign(size_t alignment, size_t size) {
+
+    return heap_added(__libc_memalign(alignment, size));
+}
+
+void *aligned_alloc(size_t alignment, size_t size) {
+
+    return heap_added(__libc_memalign(alignment, size));
+}
+
+int posix_memalign(void **memptr, size_t alignment, size_t size) {
+
+    if (!alignment || (alignment & (alignment - 1))
+            || alignment % sizeof(void *)) {
+        return EINVAL;
+    }
+
+    void *p = heap_added(__libc_memalign(alignment, size));
+    if (!p) {
+        return ENOMEM;
+    }
+
+    *memptr = p;
+
+    return 0;
+}
+
+void *valloc(size_t size) {
+
+    return heap_added(__libc_valloc(size));
+}
+
+void *pvalloc(size_t size) {
+
+    return heap_added(__libc_pvalloc(size));
+}
+
+#endif
+
+void tpm2_stats_init(void) {
+
+    memset(&stats, 0, sizeof(stats));
+    stats.start_ns = now_ns();
+    getrusage(RUSAGE_SELF, &stats.start_usage);
+
+#ifdef STATS_HEAP
+    heap.count = 0;
+    heap.bytes = 0;
+    heap.peak = heap.in_use;
+#endif
+}
+
+void tpm2_stats_file_read(size_t size) {
+
+    stats.file_read += size;
+}
+
+void tpm2_stats_file_written(size_t size) {
+
+    stats.file_written += size;
+}
+
+static void record_command(TPM2_CC cc) {
+
+    size_t i;
+    for (i = 0; i < stats.command_count; i++) {
+        if (stats.commands[i].cc == cc) {
+            stats.commands[i].count++;
+            return;
+        }
+    }
+
+    if (stats.command_count < STATS_COMMANDS_MAX) {
+        stats.commands[stats.command_count].cc = cc;
+        stats.commands[stats.command_count].count = 1;
+        stats.command_count++;
+    }
+}
+
+/*
+ * A TCTI forwarding to the one loaded for the tool, which counts the bytes
+ * through it and the time spent in it.
+ */
+typedef struct stats_tcti stats_tcti;
+struct stats_tcti {
+    TSS2_TCTI_CONTEXT_COMMON_V2 common;
+    TSS2_TCTI_CONTEXT *inner;
+};
+
+static TSS2_RC stats_tcti_transmit(TSS2_TCTI_CONTEXT *tcti_context,
+        size_t size, const uint8_t *command) {
+
+    stats_tcti *tcti = (stats_tcti *) tcti_context;
+
+    uint64_t start = now_ns();
+    TSS2_RC rval = Tss2_Tcti_Transmit(tcti->inner, size, command);
+    stats.tcti_ns += now_ns() - start;
+
+    if (rval == TSS2_RC_SUCCESS) {
+        stats.bytes_sent += size;
+        if (size >= STATS_CC_OFFSET + sizeof(TPM2_CC)) {
+            const uint8_t *p = &command[STATS_CC_OFFSET];
+            record_command((TPM2_CC) p[0] << 24 | p[1] << 16 | p[2] << 8
+                    | p[3]);
+        }
+    }
+
+    return rval;
+}
+
+static TSS2_RC stats_tcti_receive(TSS2_TCTI_CONTEXT *tcti_context,
+        size_t *size, uint8_t *response, int32_t timeout) {
+
+    stats_tcti *tcti = (stats_tcti *) tcti_context;
+
+    uint64_t start = now_ns();
+    TSS2_RC rval = Tss2_Tcti_Receive(tcti->inner, size, response, timeout);
+    stats.tcti_ns += now_ns() - start;
+
+    /* a NULL response only queries the size */
+    if (rval == TSS2_RC_SUCCESS && response) {
+        stats.bytes_received += *size;
+    }
+
+    return rval;
+}
+
+static TSS2_RC stats_tcti_cancel(TSS2_TCTI_CONTEXT *tcti_context) {
+
+    stats_tcti *tcti = (stats_tcti *) tcti_context;
+
+    return Tss2_Tcti_Cancel(tcti->inner);
+}
+
+static TSS2_RC stats_tcti_get_poll_handles(TSS2_TCTI_CONTEXT *tcti_context,
+        TSS2_TCTI_POLL_HANDLE *handles, size_t *num_handles) {
+
+    stats_tcti *tcti = (stats_tcti *) tcti_context;
+
+    return Tss2_Tcti_GetPollHandles(tcti->inner, handles, num_handles);
+}
+
+static TSS2_RC stats_tcti_set_locality(TSS2_TCTI_CONTEXT *tcti_context,
+        uint8_t locality) {
+
+    stats_tcti *tcti = (stats_tcti *) tcti_context;
+
+    return Tss2_Tcti_SetLocality(tcti->inner, locality);
+}
+
+static TSS2_RC stats_tcti_make_sticky(TSS2_TCTI_CONTEXT *tcti_context,
+        TPM2_HANDLE *handle, uint8_t sticky) {
+
+    stats_tcti *tcti = (stats_tcti *) tcti_context;
+
+    return Tss2_Tcti_MakeSticky(tcti->inner, handle, sticky);
+}
+
+TSS2_TCTI_CONTEXT *tpm2_stats_tcti_wrap(TSS2_TCTI_CONTEXT *tcti) {
+
+    if (!tcti) {
+        return tcti;
+    }
+
+    stats_tcti *wrapper = calloc(1, sizeof(*wrapper));
+    if (!wrapper) {
+        LOG_WARN("oom, not counting TPM commands");
+        return tcti;
+    }
+
+    /*
+     * The wrapped TCTI stays owned by the caller, who finalizes it after
+     * unwrapping, so there is no finalize to forward.
+     */
+    wrapper->common.v1.magic = TSS2_TCTI_MAGIC(tcti);
+    wrapper->common.v1.version = 2;
+    wrapper->common.v1.transmit = stats_tcti_transmit;
+    wrapper->common.v1.receive = stats_tcti_receive;
+    wrapper->common.v1.cancel = stats_tcti_cancel;
+    wrapper->common.v1.getPollHandles = stats_tcti_get_poll_handles;
+    wrapper->common.v1.setLocality = stats_tcti_set_locality;
+    wrapper->common.makeSticky = stats_tcti_make_sticky;
+    wrapper->inner = tcti;
+
+    return (TSS2_TCTI_CONTEXT *) wrapper;
+}
+
+TSS2_TCTI_CONTEXT *tpm2_stats_tcti_unwrap(TSS2_TCTI_CONTEXT *tcti) {
+
+    if (!tcti || TSS2_TCTI_TRANSMIT(tcti) != stats_tcti_transmit) {
+        return tcti;
+    }
+
+    stats_tcti *wrapper = (stats_tcti *) tcti;
+    TSS2_TCTI_CONTEXT *inner = wrapper->inner;
+    free(wrapper);
+
+    return inner;
+}
+
+static uint64_t timeval_us(const struct timeval *end,
+        const struct timeval *start) {
+
+    return (uint64_t) (end->tv_sec - start->tv_sec) * 1000000
+            + end->tv_usec - start->tv_usec;
+}
+
+void tpm2_stats_summary(const char *tool_name) {
+
+    uint64_t total_ns = now_ns() - stats.start_ns;
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+
+    FILE *f = stderr;
+    const char *path = tpm2_util_getenv(TPM2TOOLS_ENV_STATS_FILE);
+    if (path && path[0]) {
+        f = fopen(path, "a");
+        if (!f) {
+            LOG_WARN("Could not open stats file \"%s\", error: %s", path,
+                    strerror(errno));
+            return;
+        }
+    }
+
+    /* a sequence entry, so a file appended to by many tools stays valid */
+    fprintf(f, "- tool: %s\n", tool_name);
+    fprintf(f, "  wall-us: %" PRIu64 "\n", total_ns / 1000);
+    fprintf(f, "  cpu:\n");
+    fprintf(f, "    user-us: %" PRIu64 "\n",
+            timeval_us(&usage.ru_utime, &stats.start_usage.ru_utime));
+    fprintf(f, "    system-us: %" PRIu64 "\n",
+            timeval_us(&usage.ru_stime, &stats.start_usage.ru_stime));
+
+    fprintf(f, "  tpm:\n");
+    fprintf(f, "    bytes-sent: %" PRIu64 "\n", stats.bytes_sent);
+    fprintf(f, "    bytes-received: %" PRIu64 "\n", stats.bytes_received);
+    fprintf(f, "    tcti-us: %" PRIu64 "\n", stats.tcti_ns / 1000);
+    fprintf(f, "    commands:%s\n", stats.command_count ? "" : " []");
+    size_t i;
+    for (i = 0; i < stats.command_count; i++) {
+        const stats_command *command = &stats.commands[i];
+        const char *name = tpm2_cc_util_to_str(command->cc);
+        fprintf(f, "      - name: %s\n", name ? name : "unknown");
+        fprintf(f, "        code: 0x%" PRIx32 "\n", command->cc);
+        fprintf(f, "        count: %u\n", command->count);
+    }
+
+#ifdef STATS_HEAP
+    fprintf(f, "  heap:\n");
+    fprintf(f, "    allocations: %" PRIu64 "\n", heap.count);
+    fprintf(f, "    bytes: %" PRIu64 "\n", heap.bytes);
+    fprintf(f, "    peak-bytes: %" PRIi64 "\n",
+            heap.peak > 0 ? heap.peak : 0);
+#endif
+
+    fprintf(f, "  files:\n");
+    fprintf(f, "    bytes-read: %" PRIu64 "\n", stats.file_read);
+    fprintf(f, "    bytes-written: %" PRIu64 "\n", stats.file_written);
+
+    if (f != stderr) {
+        fclose(f);
+    } else {
+        fflush(f);
+    }
+}
@@ -0,0 +1,78 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+#ifndef LIB_TPM2_STATS_H_
+#define LIB_TPM2_STATS_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include <tss2/tss2_tcti.h>
+
+/*
+ * Environment variable naming a file the statistics of --runtime-stats are
+ * appended to instead of being written to stderr.
+ */
+#define TPM2TOOLS_ENV_STATS_FILE "TPM2TOOLS_STATS_FILE"
+
+/*
+ * The runtime statistics of a tool invocation, output at its end with the
+ * --runtime-stats common option, to tell which subsystem a regression is in
+ * without an external profiler:
+ *   - the wall time and the user and system CPU time of the process.
+ *   - the TPM commands by code, the bytes sent and received and the wall time
+ *     spent in the TCTI, ie waiting for the TPM.
+ *   - the heap allocations, the bytes allocated and the peak of the bytes in
+ *     use, counted by replacing malloc and friends on glibc.
+ *   - the bytes read and written through lib/files.c.
+ *
+ * The counters, but the TPM ones, run all the time, so the option parsing is
+ * accounted too. The TPM counters need the TCTI wrapper, which is only put in
+ * place with the option.
+ */
+
+/**
+ * Resets the counters, called once per tool invocation.
+ */
+void tpm2_stats_init(void);
+
+/**
+ * Accounts bytes read from a file.
+ * @param size
+ *  The number of bytes read.
+ */
+void tpm2_stats_file_read(size_t size);
+
+/**
+ * Accounts bytes written to a file.
+ * @param size
+ *  The number of bytes written.
+ */
+void tpm2_stats_file_written(size_t size);
+
+/**
+ * Wraps a TCTI to count the TPM traffic through it.
+ * @param tcti
+ *  The TCTI to wrap.
+ * @return
+ *  The TCTI to hand to ESAPI.
+ */
+TSS2_TCTI_CONTEXT *tpm2_stats_tcti_wrap(TSS2_TCTI_CONTEXT *tcti);
+
+/**
+ * Releases a TCTI returned by tpm2_stats_tcti_wrap().
+ * @param tcti
+ *  A TCTI returned by tpm2_stats_tcti_wrap().
+ * @return
+ *  The wrapped TCTI, which is still to be finalized by the caller.
+ */
+TSS2_TCTI_CONTEXT *tpm2_stats_tcti_unwrap(TSS2_TCTI_CONTEXT *tcti);
+
+/**
+ * Writes the statistics since tpm2_stats_init() as YAML to stderr or the file
+ * named by TPM2TOOLS_STATS_FILE.
+ * @param tool_name
+ *  The name of the tool.
+ */
+void tpm2_stats_summary(const char *tool_name);
+
+#endif /* LIB_TPM2_STATS_H_ */
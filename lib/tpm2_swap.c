@@ -0,0 +1,650 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "log.h"
+#include "tpm2_swap.h"
+#include "tpm2_util.h"
+
+/* a command and a response start with a tag, a size and a code */
+#define SWAP_HEADER_SIZE 10
+#define SWAP_CODE_OFFSET 6
+
+/* the handle area follows the header */
+#define SWAP_HANDLE_SIZE sizeof(TPM2_HANDLE)
+
+/* big enough for the saved context of any object */
+#define SWAP_BUFFER_SIZE 8192
+
+#define SWAP_HANDLE_LAST 0x80ffffff
+
+typedef struct swap_object swap_object;
+struct swap_object {
+    TPM2_HANDLE handle;
+    /* the handle of the TPM, 0 while swapped out */
+    TPM2_HANDLE tpm_handle;
+    /* the marshaled TPMS_CONTEXT while swapped out */
+    uint8_t *context;
+    size_t context_size;
+    UINT64 last_use;
+};
+
+typedef struct swap_tcti swap_tcti;
+struct swap_tcti {
+    TSS2_TCTI_CONTEXT_COMMON_V2 common;
+    TSS2_TCTI_CONTEXT *inner;
+    /* the TPMA_CC of every command of the TPM, read with the first command */
+    TPMA_CC *commands;
+    size_t command_count;
+    bool is_commands_read;
+    bool is_disabled;
+    swap_object *objects;
+    size_t object_count;
+    size_t object_capacity;
+    TPM2_HANDLE next_handle;
+    UINT64 clock;
+    /* the command in flight, translated, to send it again */
+    uint8_t *command;
+    size_t command_size;
+    size_t command_capacity;
+    /* the objects used since are those of the command in flight */
+    UINT64 command_clock;
+    bool is_rhandle;
+    /* the object the command in flight flushes, or the sequence it ends */
+    TPM2_HANDLE released;
+    /* the command in flight flushes a swapped out object, and is not sent */
+    bool is_answered;
+};
+
+static UINT32 get_u32(const uint8_t *p) {
+
+    return (UINT32) p[0] << 24 | p[1] << 16 | p[2] << 8 | p[3];
+}
+
+static void put_u32(uint8_t *p, UINT32 value) {
+
+    p[0] = value >> 24;
+    p[1] = value >> 16;
+    p[2] = value >> 8;
+    p[3] = value;
+}
+
+/* the header of a command or response without sessions */
+static void put_header(uint8_t *p, size_t size, UINT32 code) {
+
+    p[0] = TPM2_ST_NO_SESSIONS >> 8;
+    p[1] = TPM2_ST_NO_SESSIONS & 0xff;
+    put_u32(&p[2], size);
+    put_u32(&p[SWAP_CODE_OFFSET], code);
+}
+
+static TSS2_RC response_rc(const uint8_t *response, size_t size) {
+
+    return size < SWAP_HEADER_SIZE ? TSS2_TCTI_RC_MALFORMED_RESPONSE :
+            get_u32(&response[SWAP_CODE_OFFSET]);
+}
+
+static bool is_object_memory(const uint8_t *response, size_t size) {
+
+    TSS2_RC rc = response_rc(response, size);
+
+    /* a resource manager may pass on the warnings of the TPM in its layer */
+    TSS2_RC layer = rc & TSS2_RC_LAYER_MASK;
+    if (layer != TSS2_TPM_RC_LAYER && layer != TSS2_RESMGR_TPM_RC_LAYER) {
+        return false;
+    }
+
+    return (rc & ~TSS2_RC_LAYER_MASK) == TPM2_RC_OBJECT_MEMORY;
+}
+
+/* runs a command of the wrapper, in between those of the caller */
+static TSS2_RC swap_execute(swap_tcti *tcti, const uint8_t *command,
+        size_t command_size, uint8_t *response, size_t *size) {
+
+    TSS2_RC rval = Tss2_Tcti_Transmit(tcti->inner, command_size, command);
+    if (rval != TSS2_RC_SUCCESS) {
+        return rval;
+    }
+
+    return Tss2_Tcti_Receive(tcti->inner, size, response,
+            TSS2_TCTI_TIMEOUT_BLOCK);
+}
+
+/* runs a command with a single handle, in the handle area or as parameter */
+static TSS2_RC swap_execute_handle(swap_tcti *tcti, TPM2_CC cc,
+        TPM2_HANDLE handle, uint8_t *response, size_t *size) {
+
+    uint8_t command[SWAP_HEADER_SIZE + SWAP_HANDLE_SIZE];
+    put_header(command, sizeof(command), cc);
+    put_u32(&command[SWAP_HEADER_SIZE], handle);
+
+    TSS2_RC rval = swap_execute(tcti, command, sizeof(command), response,
+            size);
+
+    return rval != TSS2_RC_SUCCESS ? rval : response_rc(response, *size);
+}
+
+static bool swap_read_commands(swap_tcti *tcti) {
+
+    TPM2_CC property = TPM2_CC_FIRST;
+    UINT8 is_more = 1;
+    while (is_more) {
+
+        uint8_t command[SWAP_HEADER_SIZE + 3 * sizeof(UINT32)];
+        put_header(command, sizeof(command), TPM2_CC_GetCapability);
+        put_u32(&command[SWAP_HEADER_SIZE], TPM2_CAP_COMMANDS);
+        put_u32(&command[SWAP_HEADER_SIZE + 4], property);
+        put_u32(&command[SWAP_HEADER_SIZE + 8], TPM2_MAX_CAP_CC);
+
+        uint8_t response[SWAP_BUFFER_SIZE];
+        size_t size = sizeof(response);
+        TSS2_RC rval = swap_execute(tcti, command, sizeof(command), response,
+                &size);
+        if (rval != TSS2_RC_SUCCESS
+                || response_rc(response, size) != TPM2_RC_SUCCESS) {
+            return false;
+        }
+
+        /* moreData, then the capability and the count of the TPML_CCA */
+        const size_t list_offset = SWAP_HEADER_SIZE + 1 + 2 * sizeof(UINT32);
+        if (size < list_offset) {
+            return false;
+        }
+
+        is_more = response[SWAP_HEADER_SIZE];
+        UINT32 count = get_u32(&response[list_offset - sizeof(UINT32)]);
+        if (count > TPM2_MAX_CAP_CC
+                || size < list_offset + count * sizeof(TPMA_CC)) {
+            return false;
+        }
+
+        if (!count) {
+            break;
+        }
+
+        TPMA_CC *commands = realloc(tcti->commands,
+                (tcti->command_count + count) * sizeof(*commands));
+        if (!commands) {
+            LOG_ERR("oom");
+            return false;
+        }
+        tcti->commands = commands;
+
+        UINT32 i;
+        for (i = 0; i < count; i++) {
+            commands[tcti->command_count++] =
+                    get_u32(&response[list_offset + i * sizeof(TPMA_CC)]);
+        }
+
+        TPMA_CC last = commands[tcti->command_count - 1];
+        property = (last & (TPMA_CC_COMMANDINDEX_MASK | TPMA_CC_V)) + 1;
+    }
+
+    return true;
+}
+
+static bool swap_command_find(swap_tcti *tcti, TPM2_CC cc,
+        TPMA_CC *attributes) {
+
+    size_t i;
+    for (i = 0; i < tcti->command_count; i++) {
+        TPMA_CC a = tcti->commands[i];
+        if ((a & (TPMA_CC_COMMANDINDEX_MASK | TPMA_CC_V)) == cc) {
+            *attributes = a;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+static swap_object *swap_object_find(swap_tcti *tcti, TPM2_HANDLE handle) {
+
+    if (handle >> TPM2_HR_SHIFT != TPM2_HT_TRANSIENT) {
+        return NULL;
+    }
+
+    size_t i;
+    for (i = 0; i < tcti->object_count; i++) {
+        if (tcti->objects[i].handle == handle) {
+            return &tcti->objects[i];
+        }
+    }
+
+    return NULL;
+}
+
+/* moves the last object into its place, so pointers to objects go stale */
+static void swap_object_remove(swap_tcti *tcti, swap_object *object) {
+
+    free(object->context);
+    *object = tcti->objects[--tcti->object_count];
+}
+
+/*
+ * The TPM only hands out the handle of an object again once it is flushed,
+ * so an object still holding it was flushed by someone else.
+ */
+static void swap_object_forget(swap_tcti *tcti, TPM2_HANDLE tpm_handle) {
+
+    size_t i = 0;
+    while (i < tcti->object_count) {
+        if (tcti->objects[i].tpm_handle == tpm_handle) {
+            swap_object_remove(tcti, &tcti->objects[i]);
+        } else {
+            i++;
+        }
+    }
+}
+
+static swap_object *swap_object_add(swap_tcti *tcti, TPM2_HANDLE tpm_handle) {
+
+    swap_object_forget(tcti, tpm_handle);
+
+    if (tcti->object_count > SWAP_HANDLE_LAST - TPM2_SWAP_HANDLE_FIRST) {
+        LOG_WARN("Out of handles for swapped transient objects");
+        return NULL;
+    }
+
+    if (tcti->object_count == tcti->object_capacity) {
+        size_t capacity = tcti->object_capacity ?
+                tcti->object_capacity * 2 : 8;
+        swap_object *objects = realloc(tcti->objects,
+                capacity * sizeof(*objects));
+        if (!objects) {
+            LOG_ERR("oom");
+            return NULL;
+        }
+        tcti->objects = objects;
+        tcti->object_capacity = capacity;
+    }
+
+    TPM2_HANDLE handle = tcti->next_handle;
+    while (swap_object_find(tcti, handle)) {
+        handle = handle == SWAP_HANDLE_LAST ? TPM2_SWAP_HANDLE_FIRST :
+                handle + 1;
+    }
+    tcti->next_handle = handle == SWAP_HANDLE_LAST ? TPM2_SWAP_HANDLE_FIRST :
+            handle + 1;
+
+    swap_object *object = &tcti->objects[tcti->object_count++];
+    memset(object, 0, sizeof(*object));
+    object->handle = handle;
+    object->tpm_handle = tpm_handle;
+    object->last_use = ++tcti->clock;
+
+    return object;
+}
+
+/* saves and flushes the least recently used object the command does not use */
+static bool swap_out(swap_tcti *tcti) {
+
+    swap_object *lru = NULL;
+    size_t i;
+    for (i = 0; i < tcti->object_count; i++) {
+        swap_object *object = &tcti->objects[i];
+        if (object->tpm_handle && object->last_use < tcti->command_clock
+                && (!lru || object->last_use < lru->last_use)) {
+            lru = object;
+        }
+    }
+
+    if (!lru) {
+        return false;
+    }
+
+    uint8_t response[SWAP_BUFFER_SIZE];
+    size_t size = sizeof(response);
+    TSS2_RC rval = swap_execute_handle(tcti, TPM2_CC_ContextSave,
+            lru->tpm_handle, response, &size);
+    if (rval != TSS2_RC_SUCCESS) {
+        LOG_WARN("Could not save transient object 0x%x, 0x%x", lru->handle,
+                rval);
+        return false;
+    }
+
+    size_t context_size = size - SWAP_HEADER_SIZE;
+    uint8_t *context = malloc(context_size);
+    if (!context) {
+        LOG_ERR("oom");
+        return false;
+    }
+    memcpy(context, &response[SWAP_HEADER_SIZE], context_size);
+
+    size = sizeof(response);
+    rval = swap_execute_handle(tcti, TPM2_CC_FlushContext, lru->tpm_handle,
+            response, &size);
+    if (rval != TSS2_RC_SUCCESS) {
+        LOG_WARN("Could not flush transient object 0x%x, 0x%x", lru->handle,
+                rval);
+        free(context);
+        return false;
+    }
+
+    LOG_INFO("Swapped out transient object 0x%x", lru->handle);
+
+    lru->tpm_handle = 0;
+    lru->context = context;
+    lru->context_size = context_size;
+
+    return true;
+}
+
+/* loads an object back if swapped out, marking it as used by the command */
+static swap_object *swap_in(swap_tcti *tcti, TPM2_HANDLE handle) {
+
+    swap_object *object = swap_object_find(tcti, handle);
+    object->last_use = ++tcti->clock;
+    if (object->tpm_handle) {
+        return object;
+    }
+
+    uint8_t command[SWAP_BUFFER_SIZE];
+    size_t command_size = SWAP_HEADER_SIZE + object->context_size;
+    put_header(command, command_size, TPM2_CC_ContextLoad);
+    memcpy(&command[SWAP_HEADER_SIZE], object->context, object->context_size);
+
+    uint8_t response[SWAP_HEADER_SIZE + SWAP_HANDLE_SIZE];
+    size_t size;
+    TSS2_RC rval;
+    do {
+        size = sizeof(response);
+        rval = swap_execute(tcti, command, command_size, response, &size);
+    } while (rval == TSS2_RC_SUCCESS && is_object_memory(response, size)
+            && swap_out(tcti));
+
+    if (rval == TSS2_RC_SUCCESS) {
+        rval = response_rc(response, size);
+    }
+
+    if (rval != TSS2_RC_SUCCESS || size < sizeof(response)) {
+        LOG_ERR("Could not load back transient object 0x%x, 0x%x", handle,
+                rval);
+        return NULL;
+    }
+
+    TPM2_HANDLE tpm_handle = get_u32(&response[SWAP_HEADER_SIZE]);
+    swap_object_forget(tcti, tpm_handle);
+
+    object = swap_object_find(tcti, handle);
+    object->tpm_handle = tpm_handle;
+    free(object->context);
+    object->context = NULL;
+    object->context_size = 0;
+
+    return object;
+}
+
+/* replaces the handles of the objects used by the command with the TPMs */
+static TSS2_RC swap_translate(swap_tcti *tcti) {
+
+    uint8_t *command = tcti->command;
+    TPM2_CC cc = get_u32(&command[SWAP_CODE_OFFSET]);
+
+    /* the handle FlushContext flushes is its parameter */
+    if (cc == TPM2_CC_FlushContext) {
+        if (tcti->command_size < SWAP_HEADER_SIZE + SWAP_HANDLE_SIZE) {
+            return TSS2_RC_SUCCESS;
+        }
+
+        uint8_t *p = &command[SWAP_HEADER_SIZE];
+        swap_object *object = swap_object_find(tcti, get_u32(p));
+        if (!object) {
+            return TSS2_RC_SUCCESS;
+        }
+
+        tcti->released = object->handle;
+        if (object->tpm_handle) {
+            put_u32(p, object->tpm_handle);
+        } else {
+            tcti->is_answered = true;
+        }
+
+        return TSS2_RC_SUCCESS;
+    }
+
+    TPMA_CC attributes;
+    if (!swap_command_find(tcti, cc, &attributes)) {
+        return TSS2_RC_SUCCESS;
+    }
+
+    UINT32 count = (attributes & TPMA_CC_CHANDLES_MASK)
+            >> TPMA_CC_CHANDLES_SHIFT;
+    if (tcti->command_size < SWAP_HEADER_SIZE + count * SWAP_HANDLE_SIZE) {
+        return TSS2_RC_SUCCESS;
+    }
+
+    tcti->is_rhandle = attributes & TPMA_CC_RHANDLE;
+
+    UINT32 i;
+    for (i = 0; i < count; i++) {
+        uint8_t *p = &command[SWAP_HEADER_SIZE + i * SWAP_HANDLE_SIZE];
+        TPM2_HANDLE handle = get_u32(p);
+        if (!swap_object_find(tcti, handle)) {
+            continue;
+        }
+
+        swap_object *object = swap_in(tcti, handle);
+        if (!object) {
+            return TSS2_TCTI_RC_GENERAL_FAILURE;
+        }
+
+        put_u32(p, object->tpm_handle);
+
+        /* the TPM flushes a sequence object once it is completed */
+        if ((cc == TPM2_CC_SequenceComplete && i == 0)
+                || (cc == TPM2_CC_EventSequenceComplete && i == 1)) {
+            tcti->released = handle;
+        }
+    }
+
+    return TSS2_RC_SUCCESS;
+}
+
+static TSS2_RC swap_tcti_transmit(TSS2_TCTI_CONTEXT *tcti_context,
+        size_t size, const uint8_t *command) {
+
+    swap_tcti *tcti = (swap_tcti *) tcti_context;
+
+    if (size > tcti->command_capacity) {
+        uint8_t *buf = realloc(tcti->command, size);
+        if (!buf) {
+            LOG_ERR("oom");
+            return TSS2_TCTI_RC_MEMORY;
+        }
+        tcti->command = buf;
+        tcti->command_capacity = size;
+    }
+
+    memcpy(tcti->command, command, size);
+    tcti->command_size = size;
+    tcti->command_clock = ++tcti->clock;
+    tcti->is_rhandle = false;
+    tcti->released = 0;
+    tcti->is_answered = false;
+
+    if (!tcti->is_commands_read) {
+        tcti->is_commands_read = true;
+        tcti->is_disabled = !swap_read_commands(tcti);
+        if (tcti->is_disabled) {
+            LOG_WARN("Could not read the commands of the TPM, not swapping "
+                    "transient objects");
+        }
+    }
+
+    if (!tcti->is_disabled && size >= SWAP_HEADER_SIZE) {
+        TSS2_RC rval = swap_translate(tcti);
+        if (rval != TSS2_RC_SUCCESS || tcti->is_answered) {
+            return rval;
+        }
+    }
+
+    return Tss2_Tcti_Transmit(tcti->inner, tcti->command_size, tcti->command);
+}
+
+static void swap_release(swap_tcti *tcti) {
+
+    swap_object *object = swap_object_find(tcti, tcti->released);
+    if (object) {
+        swap_object_remove(tcti, object);
+    }
+    tcti->released = 0;
+}
+
+static TSS2_RC swap_tcti_receive(TSS2_TCTI_CONTEXT *tcti_context,
+        size_t *size, uint8_t *response, int32_t timeout) {
+
+    swap_tcti *tcti = (swap_tcti *) tcti_context;
+
+    /* a NULL response only queries the size */
+    if (tcti->is_answered) {
+        if (response && *size < SWAP_HEADER_SIZE) {
+            return TSS2_TCTI_RC_INSUFFICIENT_BUFFER;
+        }
+        *size = SWAP_HEADER_SIZE;
+        if (response) {
+            put_header(response, SWAP_HEADER_SIZE, TPM2_RC_SUCCESS);
+            tcti->is_answered = false;
+            swap_release(tcti);
+        }
+        return TSS2_RC_SUCCESS;
+    }
+
+    size_t response_capacity = *size;
+    TSS2_RC rval = Tss2_Tcti_Receive(tcti->inner, size, response, timeout);
+    if (rval != TSS2_RC_SUCCESS || !response || tcti->is_disabled) {
+        return rval;
+    }
+
+    /* the TPM did not run the command, so it is safe to send it again */
+    while (is_object_memory(response, *size) && swap_out(tcti)) {
+
+        rval = Tss2_Tcti_Transmit(tcti->inner, tcti->command_size,
+                tcti->command);
+        if (rval != TSS2_RC_SUCCESS) {
+            return rval;
+        }
+
+        /* with a timeout, the caller picks up the response of the resend */
+        *size = response_capacity;
+        rval = Tss2_Tcti_Receive(tcti->inner, size, response, timeout);
+        if (rval != TSS2_RC_SUCCESS) {
+            return rval;
+        }
+    }
+
+    if (response_rc(response, *size) != TPM2_RC_SUCCESS) {
+        return rval;
+    }
+
+    swap_release(tcti);
+
+    if (tcti->is_rhandle && *size >= SWAP_HEADER_SIZE + SWAP_HANDLE_SIZE) {
+        uint8_t *p = &response[SWAP_HEADER_SIZE];
+        TPM2_HANDLE tpm_handle = get_u32(p);
+        if (tpm_handle >> TPM2_HR_SHIFT == TPM2_HT_TRANSIENT) {
+            swap_object *object = swap_object_add(tcti, tpm_handle);
+            if (object) {
+                put_u32(p, object->handle);
+            }
+        }
+        tcti->is_rhandle = false;
+    }
+
+    return rval;
+}
+
+static TSS2_RC swap_tcti_cancel(TSS2_TCTI_CONTEXT *tcti_context) {
+
+    swap_tcti *tcti = (swap_tcti *) tcti_context;
+
+    return Tss2_Tcti_Cancel(tcti->inner);
+}
+
+static TSS2_RC swap_tcti_get_poll_handles(TSS2_TCTI_CONTEXT *tcti_context,
+        TSS2_TCTI_POLL_HANDLE *handles, size_t *num_handles) {
+
+    swap_tcti *tcti = (swap_tcti *) tcti_context;
+
+    return Tss2_Tcti_GetPollHandles(tcti->inner, handles, num_handles);
+}
+
+static TSS2_RC swap_tcti_set_locality(TSS2_TCTI_CONTEXT *tcti_context,
+        uint8_t locality) {
+
+    swap_tcti *tcti = (swap_tcti *) tcti_context;
+
+    return Tss2_Tcti_SetLocality(tcti->inner, locality);
+}
+
+static TSS2_RC swap_tcti_make_sticky(TSS2_TCTI_CONTEXT *tcti_context,
+        TPM2_HANDLE *handle, uint8_t sticky) {
+
+    swap_tcti *tcti = (swap_tcti *) tcti_context;
+
+    return Tss2_Tcti_MakeSticky(tcti->inner, handle, sticky);
+}
+
+TSS2_TCTI_CONTEXT *tpm2_swap_tcti_wrap(TSS2_TCTI_CONTEXT *tcti) {
+
+    if (!tcti) {
+        return tcti;
+    }
+
+    const char *value = tpm2_util_getenv(TPM2TOOLS_ENV_OBJECT_SWAP);
+    if (!value || !strcmp(value, "0")) {
+        return tcti;
+    }
+
+    if (strcmp(value, "1")) {
+        LOG_WARN("Ignoring invalid %s \"%s\"", TPM2TOOLS_ENV_OBJECT_SWAP,
+                value);
+        return tcti;
+    }
+
+    swap_tcti *wrapper = calloc(1, sizeof(*wrapper));
+    if (!wrapper) {
+        LOG_WARN("oom, not swapping transient objects");
+        return tcti;
+    }
+
+    /*
+     * The wrapped TCTI stays owned by the caller, who finalizes it after
+     * unwrapping, so there is no finalize to forward.
+     */
+    wrapper->common.v1.magic = TSS2_TCTI_MAGIC(tcti);
+    wrapper->common.v1.version = 2;
+    wrapper->common.v1.transmit = swap_tcti_transmit;
+    wrapper->common.v1.receive = swap_tcti_receive;
+    wrapper->common.v1.cancel = swap_tcti_cancel;
+    wrapper->common.v1.getPollHandles = swap_tcti_get_poll_handles;
+    wrapper->common.v1.setLocality = swap_tcti_set_locality;
+    wrapper->common.makeSticky = swap_tcti_make_sticky;
+    wrapper->inner = tcti;
+    wrapper->next_handle = TPM2_SWAP_HANDLE_FIRST;
+
+    return (TSS2_TCTI_CONTEXT *) wrapper;
+}
+
+TSS2_TCTI_CONTEXT *tpm2_swap_tcti_unwrap(TSS2_TCTI_CONTEXT *tcti) {
+
+    if (!tcti || TSS2_TCTI_TRANSMIT(tcti) != swap_tcti_transmit) {
+        return tcti;
+    }
+
+    swap_tcti *wrapper = (swap_tcti *) tcti;
+    TSS2_TCTI_CONTEXT *inner = wrapper->inner;
+
+    size_t i;
+    for (i = 0; i < wrapper->object_count; i++) {
+        free(wrapper->objects[i].context);
+    }
+    free(wrapper->objects);
+    free(wrapper->commands);
+    free(wrapper->command);
+    free(wrapper);
+
+    return inner;
+}
@@ -0,0 +1,53 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+#ifndef LIB_TPM2_SWAP_H_
+#define LIB_TPM2_SWAP_H_
+
+#include <tss2/tss2_tcti.h>
+
+/*
+ * Environment variable turning the swapping of transient objects on with a
+ * value of 1, for TPMs used without a resource manager.
+ */
+#define TPM2TOOLS_ENV_OBJECT_SWAP "TPM2TOOLS_OBJECT_SWAP"
+
+/* the handles handed out for the swapped objects, in the transient range */
+#define TPM2_SWAP_HANDLE_FIRST 0x80ff0000
+
+/**
+ * Wraps a TCTI to virtualize the transient object slots of the TPM, like a
+ * resource manager does, so a tool can use more objects than the TPM has
+ * slots for, or a TPM with its slots taken by others.
+ *
+ * Every object a command loads, like CreatePrimary, Load, ContextLoad or
+ * HashSequenceStart, gets a handle of its own, from TPM2_SWAP_HANDLE_FIRST
+ * up, which is translated to the handle of the TPM in the handle area of
+ * every command and in the FlushContext parameter. When the TPM answers with
+ * TPM2_RC_OBJECT_MEMORY, the least recently used object the command does not
+ * use is saved with ContextSave and flushed, and the command is sent again.
+ * The saved objects are loaded back with ContextLoad when a command uses them
+ * next. The handles of the commands are learned from the TPMA_CC attributes
+ * the TPM reports, read once with GetCapability.
+ *
+ * Objects loaded before, and the handles in the parameters of other commands
+ * or in responses like GetCapability, are left alone. The objects swapped out
+ * when the TCTI is unwrapped are lost, like on a resource manager when the
+ * connection closes.
+ * @param tcti
+ *  The TCTI to wrap.
+ * @return
+ *  The TCTI to hand to ESAPI, tcti itself when swapping is off.
+ */
+TSS2_TCTI_CONTEXT *tpm2_swap_tcti_wrap(TSS2_TCTI_CONTEXT *tcti);
+
+/**
+ * Releases a TCTI returned by tpm2_swap_tcti_wrap(). The objects still
+ * loaded stay loaded.
+ * @param tcti
+ *  A TCTI returned by tpm2_swap_tcti_wrap().
+ * @return
+ *  The wrapped TCTI, which is still to be finalized by the caller.
+ */
+TSS2_TCTI_CONTEXT *tpm2_swap_tcti_unwrap(TSS2_TCTI_CONTEXT *tcti);
+
+#endif /* LIB_TPM2_SWAP_H_ */
@@ -0,0 +1,296 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+#include <errno.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <tss2/tss2_mu.h>
+
+#include "files.h"
+#include "log.h"
+#include "tpm2_ticket_cache.h"
+#include "tpm2_util.h"
+
+#define TICKET_CACHE_VERSION 1
+
+/* the cache is read whole, so keep it from growing without bounds */
+#define TICKET_CACHE_MAX 1024
+
+typedef struct ticket_cache_entry ticket_cache_entry;
+struct ticket_cache_entry {
+    tpm2_ticket_cache_key key;
+    /* seconds since the epoch when the ticket expires */
+    UINT64 expiry;
+    TPM2B_TIMEOUT timeout;
+    TPMT_TK_AUTH ticket;
+};
+
+typedef struct ticket_cache ticket_cache;
+struct ticket_cache {
+    char boot_id[TPM2_UTIL_BOOT_ID_LEN];
+    UINT32 count;
+    ticket_cache_entry entries[TICKET_CACHE_MAX];
+};
+
+static bool read_2b(FILE *f, UINT8 *buffer, size_t max, UINT16 *size) {
+
+    return files_read_16(f, size) && *size <= max
+            && files_read_bytes(f, buffer, *size);
+}
+
+static bool write_2b(FILE *f, const UINT8 *buffer, UINT16 size) {
+
+    return files_write_16(f, size)
+            && files_write_bytes(f, (UINT8 *) buffer, size);
+}
+
+static bool read_entry(FILE *f, ticket_cache_entry *e) {
+
+    tpm2_ticket_cache_key *k = &e->key;
+    UINT8 ticket[sizeof(TPMT_TK_AUTH)];
+    UINT16 ticket_size = 0;
+    bool result = read_2b(f, k->policy_ref.buffer, sizeof(k->policy_ref.buffer),
+                    &k->policy_ref.size)
+            && read_2b(f, k->cp_hash.buffer, sizeof(k->cp_hash.buffer),
+                    &k->cp_hash.size)
+            && read_2b(f, k->auth_name.name, sizeof(k->auth_name.name),
+                    &k->auth_name.size)
+            && files_read_64(f, &e->expiry)
+            && read_2b(f, e->timeout.buffer, sizeof(e->timeout.buffer),
+                    &e->timeout.size)
+            && read_2b(f, ticket, sizeof(ticket), &ticket_size);
+    if (!result) {
+        return false;
+    }
+
+    size_t offset = 0;
+    TSS2_RC rval = Tss2_MU_TPMT_TK_AUTH_Unmarshal(ticket, ticket_size,
+            &offset, &e->ticket);
+
+    return rval == TSS2_RC_SUCCESS;
+}
+
+static bool write_entry(FILE *f, const ticket_cache_entry *e) {
+
+    const tpm2_ticket_cache_key *k = &e->key;
+    UINT8 ticket[sizeof(TPMT_TK_AUTH)];
+    size_t offset = 0;
+    TSS2_RC rval = Tss2_MU_TPMT_TK_AUTH_Marshal(&e->ticket, ticket,
+            sizeof(ticket), &offset);
+    if (rval != TSS2_RC_SUCCESS) {
+        LOG_PERR(Tss2_MU_TPMT_TK_AUTH_Marshal, rval);
+        return false;
+    }
+
+    return write_2b(f, k->policy_ref.buffer, k->policy_ref.size)
+            && write_2b(f, k->cp_hash.buffer, k->cp_hash.size)
+            && write_2b(f, k->auth_name.name, k->auth_name.size)
+            && files_write_64(f, e->expiry)
+            && write_2b(f, e->timeout.buffer, e->timeout.size)
+            && write_2b(f, ticket, offset);
+}
+
+static bool key_equal(const tpm2_ticket_cache_key *a,
+        const tpm2_ticket_cache_key *b) {
+
+    return a->policy_ref.size == b->policy_ref.size
+            && !memcmp(a->policy_ref.buffer, b->policy_ref.buffer,
+                    a->policy_ref.size)
+            && a->cp_hash.size == b->cp_hash.size
+            && !memcmp(a->cp_hash.buffer, b->cp_hash.buffer, a->cp_hash.size)
+            && a->auth_name.size == b->auth_name.size
+            && !memcmp(a->auth_name.name, b->auth_name.name,
+                    a->auth_name.size);
+}
+
+/*
+ * Reads the entries of the cache that are still valid. A missing cache, one
+ * of an earlier boot or a damaged one holds no entries.
+ */
+static bool cache_load(const char *path, ticket_cache *cache) {
+
+    cache->count = 0;
+    bool result = tpm2_util_get_boot_id(cache->boot_id);
+    if (!result) {
+        LOG_ERR("Could not read the boot id, not using the ticket cache");
+        return false;
+    }
+
+    FILE *f = files_fopen(path, "rb");
+    if (!f) {
+        if (errno != ENOENT) {
+            LOG_WARN("Could not open ticket cache \"%s\", error: %s", path,
+                    strerror(errno));
+        }
+        return true;
+    }
+
+    UINT32 version = 0;
+    char saved_boot_id[TPM2_UTIL_BOOT_ID_LEN];
+    UINT32 count = 0;
+    result = files_read_header(f, &version)
+            && version == TICKET_CACHE_VERSION
+            && files_read_bytes(f, (UINT8 *) saved_boot_id,
+                    sizeof(saved_boot_id))
+            && !memcmp(saved_boot_id, cache->boot_id, sizeof(saved_boot_id))
+            && files_read_32(f, &count)
+            && count <= ARRAY_LEN(cache->entries);
+
+    UINT64 now = time(NULL);
+    UINT32 i;
+    for (i = 0; result && i < count; i++) {
+        ticket_cache_entry *e = &cache->entries[cache->count];
+        result = read_entry(f, e);
+        if (result && e->expiry > now) {
+            cache->count++;
+        }
+    }
+
+    fclose(f);
+
+    if (!result) {
+        LOG_INFO("Ticket cache \"%s\" is stale, dropping it", path);
+        cache->count = 0;
+    }
+
+    return true;
+}
+
+static bool cache_save(const char *path, const ticket_cache *cache) {
+
+    files_atomic atomic;
+    FILE *f = files_atomic_fopen(&atomic, path);
+    if (!f) {
+        return false;
+    }
+
+    bool result = files_write_header(f, TICKET_CACHE_VERSION)
+            && files_write_bytes(f, (UINT8 *) cache->boot_id,
+                    sizeof(cache->boot_id))
+            && files_write_32(f, cache->count);
+
+    UINT32 i;
+    for (i = 0; result && i < cache->count; i++) {
+        result = write_entry(f, &cache->entries[i]);
+    }
+
+    if (!files_atomic_close(&atomic, f, result)) {
+        LOG_ERR("Could not write ticket cache \"%s\"", path);
+        return false;
+    }
+
+    return true;
+}
+
+/* drops the entry of a key, returning whether there was one */
+static bool cache_drop(ticket_cache *cache, const tpm2_ticket_cache_key *key) {
+
+    UINT32 i;
+    for (i = 0; i < cache->count; i++) {
+        if (key_equal(&cache->entries[i].key, key)) {
+            cache->count--;
+            memmove(&cache->entries[i], &cache->entries[i + 1],
+                    (cache->count - i) * sizeof(cache->entries[0]));
+            return true;
+        }
+    }
+
+    return false;
+}
+
+bool tpm2_ticket_cache_put(const char *path, const tpm2_ticket_cache_key *key,
+        INT32 expiration, const TPM2B_TIMEOUT *timeout,
+        const TPMT_TK_AUTH *ticket) {
+
+    if (expiration >= 0 || !ticket->digest.size) {
+        LOG_ERR("Only an authorization with a negative expiration produces "
+                "a ticket to cache");
+        return false;
+    }
+
+    ticket_cache *cache = malloc(sizeof(*cache));
+    if (!cache) {
+        LOG_ERR("oom");
+        return false;
+    }
+
+    bool result = cache_load(path, cache);
+    if (!result) {
+        goto out;
+    }
+
+    cache_drop(cache, key);
+
+    /* make room by dropping the entry that expires first */
+    if (cache->count == ARRAY_LEN(cache->entries)) {
+        UINT32 i, first = 0;
+        for (i = 1; i < cache->count; i++) {
+            if (cache->entries[i].expiry < cache->entries[first].expiry) {
+                first = i;
+            }
+        }
+        cache_drop(cache, &cache->entries[first].key);
+    }
+
+    ticket_cache_entry *e = &cache->entries[cache->count++];
+    e->key = *key;
+    e->expiry = (UINT64) time(NULL) - (INT64) expiration;
+    e->timeout = *timeout;
+    e->ticket = *ticket;
+
+    result = cache_save(path, cache);
+
+out:
+    free(cache);
+
+    return result;
+}
+
+bool tpm2_ticket_cache_get(const char *path, const tpm2_ticket_cache_key *key,
+        TPM2B_TIMEOUT *timeout, TPMT_TK_AUTH *ticket) {
+
+    ticket_cache *cache = malloc(sizeof(*cache));
+    if (!cache) {
+        LOG_ERR("oom");
+        return false;
+    }
+
+    bool result = cache_load(path, cache);
+
+    UINT32 i;
+    for (i = 0; result && i < cache->count; i++) {
+        if (key_equal(&cache->entries[i].key, key)) {
+            *timeout = cache->entries[i].timeout;
+            *ticket = cache->entries[i].ticket;
+            break;
+        }
+    }
+
+    result = result && i < cache->count;
+    free(cache);
+
+    return result;
+}
+
+bool tpm2_ticket_cache_remove(const char *path,
+        const tpm2_ticket_cache_key *key) {
+
+    ticket_cache *cache = malloc(sizeof(*cache));
+    if (!cache) {
+        LOG_ERR("oom");
+        return false;
+    }
+
+    bool result = cache_load(path, cache);
+    if (result && cache_drop(cache, key)) {
+        result = cache_save(path, cache);
+    }
+
+    free(cache);
+
+    return result;
+}
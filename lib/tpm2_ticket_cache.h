@@ -0,0 +1,78 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+#ifndef LIB_TPM2_TICKET_CACHE_H_
+#define LIB_TPM2_TICKET_CACHE_H_
+
+#include <stdbool.h>
+
+#include <tss2/tss2_tpm2_types.h>
+
+/*
+ * A ticket cache keeps the authorization tickets of PolicySigned and
+ * PolicySecret in a file, so that a later policy session can satisfy the same
+ * authorization with PolicyTicket instead of a new signature or secret.
+ *
+ * The TPM only accepts a ticket for the policyRef, cpHashA and authorizing
+ * object it was issued for, so these are the key of an entry. Every entry
+ * expires when its ticket does, counted from when it was cached, and the
+ * whole cache with the boot it was written in, as a TPM Reset invalidates the
+ * tickets. As the cache does not identify the TPM, use a separate file for
+ * every TPM.
+ */
+typedef struct tpm2_ticket_cache_key tpm2_ticket_cache_key;
+struct tpm2_ticket_cache_key {
+    TPM2B_NONCE policy_ref;
+    TPM2B_DIGEST cp_hash;
+    TPM2B_NAME auth_name;
+};
+
+/**
+ * Adds a ticket to the cache, replacing the one cached under the same key and
+ * dropping the expired ones.
+ * @param path
+ *  The path of the cache file, which is created if needed.
+ * @param key
+ *  The policyRef, cpHashA and authorizing object name the ticket is for.
+ * @param expiration
+ *  The expiration the ticket was requested with, in seconds. Only a negative
+ *  expiration produces a ticket.
+ * @param timeout
+ *  The timeout the TPM returned with the ticket.
+ * @param ticket
+ *  The ticket.
+ * @return
+ *  True on success, false on error.
+ */
+bool tpm2_ticket_cache_put(const char *path, const tpm2_ticket_cache_key *key,
+        INT32 expiration, const TPM2B_TIMEOUT *timeout,
+        const TPMT_TK_AUTH *ticket);
+
+/**
+ * Looks up the ticket cached under a key.
+ * @param path
+ *  The path of the cache file.
+ * @param key
+ *  The policyRef, cpHashA and authorizing object name to look up.
+ * @param timeout
+ *  Receives the timeout of the ticket.
+ * @param ticket
+ *  Receives the ticket.
+ * @return
+ *  True if an unexpired ticket is cached under the key, false otherwise.
+ */
+bool tpm2_ticket_cache_get(const char *path, const tpm2_ticket_cache_key *key,
+        TPM2B_TIMEOUT *timeout, TPMT_TK_AUTH *ticket);
+
+/**
+ * Drops the ticket cached under a key, ie one the TPM did not accept.
+ * @param path
+ *  The path of the cache file.
+ * @param key
+ *  The key of the ticket.
+ * @return
+ *  True on success, false if the cache could not be written.
+ */
+bool tpm2_ticket_cache_remove(const char *path,
+        const tpm2_ticket_cache_key *key);
+
+#endif /* LIB_TPM2_TICKET_CACHE_H_ */
@@ -1,3 +1,31 @@
 #include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "tpm2_tool_output.h"
+
+/* large enough to turn the YAML of big event logs into few writes */
+#define OUTPUT_BUFFER_SIZE (64 * 1024)
 
 bool output_enabled = true;
+
+static char output_buffer[OUTPUT_BUFFER_SIZE];
+
+void tpm2_tool_output_init(void) {
+
+    const char *unbuffered = getenv(TPM2TOOLS_ENV_UNBUFFERED_OUTPUT);
+    if (unbuffered && unbuffered[0]) {
+        setvbuf(stdout, NULL, _IONBF, 0);
+        return;
+    }
+
+    /* keep output on a terminal in step with what is logged to stderr */
+    int mode = isatty(STDOUT_FILENO) ? _IOLBF : _IOFBF;
+    setvbuf(stdout, output_buffer, mode, sizeof(output_buffer));
+}
+
+void tpm2_tool_output_flush(void) {
+
+    fflush(stdout);
+}
@@ -5,6 +5,26 @@
 
 extern bool output_enabled;
 
+/*
+ * Environment variable that keeps stdout unbuffered, for callers that need
+ * every fragment of output written as soon as it is formatted.
+ */
+#define TPM2TOOLS_ENV_UNBUFFERED_OUTPUT "TPM2TOOLS_UNBUFFERED_OUTPUT"
+
+/**
+ * Sets up the buffering of stdout. Output to a terminal is line buffered,
+ * output to pipes and files is collected in a large buffer that is written
+ * when full and when the tool exits. With TPM2TOOLS_UNBUFFERED_OUTPUT set,
+ * stdout stays unbuffered. Must be called before anything is output.
+ */
+void tpm2_tool_output_init(void);
+
+/**
+ * Writes out the buffered output, ie before handing stdout to another process
+ * or waiting for input that depends on it.
+ */
+void tpm2_tool_output_flush(void);
+
 /**
  * Output is enabled by default. This wrapper prevents code that
  * must disable output from accessing the global 'output_enabled'
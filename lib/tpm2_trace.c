@@ -0,0 +1,377 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+#include <errno.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/resource.h>
+
+#include "log.h"
+#include "tpm2_cc_util.h"
+#include "tpm2_trace.h"
+#include "tpm2_util.h"
+
+/* more than the TPM 2.0 specification defines commands */
+#define TRACE_COMMANDS_MAX 256
+#define TRACE_PHASE_DEPTH 4
+
+/* the tag and size fields precede the command code in a command */
+#define TRACE_CC_OFFSET 6
+
+/* and the response code in a response */
+#define TRACE_RC_OFFSET 6
+
+typedef struct trace_command trace_command;
+struct trace_command {
+    TPM2_CC cc;
+    unsigned count;
+    uint64_t total_ns;
+    uint64_t max_ns;
+};
+
+typedef struct trace_frame trace_frame;
+struct trace_frame {
+    tpm2_trace_phase phase;
+    uint64_t since_ns;
+    uint64_t since_faults;
+};
+
+static struct {
+    bool is_timing;
+    bool is_logging;
+    uint64_t start_ns;
+    uint64_t phase_ns[tpm2_trace_phase_max];
+    uint64_t phase_faults[tpm2_trace_phase_max];
+    trace_frame stack[TRACE_PHASE_DEPTH];
+    unsigned depth;
+    trace_command commands[TRACE_COMMANDS_MAX];
+    size_t command_count;
+} trace;
+
+static const char *phase_names[tpm2_trace_phase_max] = {
+    [tpm2_trace_phase_options] = "options",
+    [tpm2_trace_phase_tcti] = "tcti",
+    [tpm2_trace_phase_esys] = "esys",
+    [tpm2_trace_phase_openssl] = "openssl",
+    [tpm2_trace_phase_onrun] = "onrun",
+    [tpm2_trace_phase_onstop] = "onstop",
+};
+
+static uint64_t now_ns(void) {
+
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/* the minor and major page faults of the process so far */
+static void get_faults(uint64_t *minor, uint64_t *major) {
+
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage)) {
+        *minor = *major = 0;
+        return;
+    }
+
+    *minor = usage.ru_minflt;
+    *major = usage.ru_majflt;
+}
+
+static uint64_t now_faults(void) {
+
+    uint64_t minor, major;
+    get_faults(&minor, &major);
+
+    return minor + major;
+}
+
+static bool is_traced(const char *what) {
+
+    const char *value = tpm2_util_getenv(TPM2TOOLS_ENV_TRACE);
+    if (!value) {
+        return false;
+    }
+
+    size_t len = strlen(what);
+    while (*value) {
+        size_t token_len = strcspn(value, ",");
+        if (token_len == len && !strncmp(value, what, len)) {
+            return true;
+        }
+        value += token_len;
+        value += *value == ',';
+    }
+
+    return false;
+}
+
+void tpm2_trace_init(void) {
+
+    memset(&trace, 0, sizeof(trace));
+    trace.is_timing = is_traced("timing");
+    trace.is_logging = is_traced("commands");
+    trace.start_ns = now_ns();
+}
+
+void tpm2_trace_phase_begin(tpm2_trace_phase phase) {
+
+    if (!trace.is_timing || trace.depth == TRACE_PHASE_DEPTH) {
+        return;
+    }
+
+    uint64_t now = now_ns();
+    uint64_t faults = now_faults();
+    if (trace.depth) {
+        trace_frame *outer = &trace.stack[trace.depth - 1];
+        trace.phase_ns[outer->phase] += now - outer->since_ns;
+        trace.phase_faults[outer->phase] += faults - outer->since_faults;
+    }
+
+    trace.stack[trace.depth].phase = phase;
+    trace.stack[trace.depth].since_ns = now;
+    trace.stack[trace.depth].since_faults = faults;
+    trace.depth++;
+}
+
+void tpm2_trace_phase_end(tpm2_trace_phase phase) {
+
+    if (!trace.is_timing || !trace.depth
+            || trace.stack[trace.depth - 1].phase != phase) {
+        return;
+    }
+
+    uint64_t now = now_ns();
+    uint64_t faults = now_faults();
+    trace.depth--;
+    trace.phase_ns[phase] += now - trace.stack[trace.depth].since_ns;
+    trace.phase_faults[phase] += faults - trace.stack[trace.depth].since_faults;
+
+    /* the outer phase resumes */
+    if (trace.depth) {
+        trace.stack[trace.depth - 1].since_ns = now;
+        trace.stack[trace.depth - 1].since_faults = faults;
+    }
+}
+
+static void record_command(TPM2_CC cc, uint64_t elapsed_ns) {
+
+    trace_command *command = NULL;
+    size_t i;
+    for (i = 0; i < trace.command_count; i++) {
+        if (trace.commands[i].cc == cc) {
+            command = &trace.commands[i];
+            break;
+        }
+    }
+
+    if (!command) {
+        if (trace.command_count == TRACE_COMMANDS_MAX) {
+            return;
+        }
+        command = &trace.commands[trace.command_count++];
+        command->cc = cc;
+    }
+
+    command->count++;
+    command->total_ns += elapsed_ns;
+    if (elapsed_ns > command->max_ns) {
+        command->max_ns = elapsed_ns;
+    }
+}
+
+/*
+ * A TCTI forwarding to the one loaded for the tool, which takes the time from
+ * handing a command to the TPM until the response is back.
+ */
+typedef struct trace_tcti trace_tcti;
+struct trace_tcti {
+    TSS2_TCTI_CONTEXT_COMMON_V2 common;
+    TSS2_TCTI_CONTEXT *inner;
+    bool is_in_flight;
+    TPM2_CC cc;
+    uint64_t sent_ns;
+};
+
+static TSS2_RC trace_tcti_transmit(TSS2_TCTI_CONTEXT *tcti_context,
+        size_t size, const uint8_t *command) {
+
+    trace_tcti *tcti = (trace_tcti *) tcti_context;
+
+    TSS2_RC rval = Tss2_Tcti_Transmit(tcti->inner, size, command);
+    if (rval != TSS2_RC_SUCCESS) {
+        return rval;
+    }
+
+    tcti->is_in_flight = size >= TRACE_CC_OFFSET + sizeof(TPM2_CC);
+    if (tcti->is_in_flight) {
+        const uint8_t *p = &command[TRACE_CC_OFFSET];
+        tcti->cc = (TPM2_CC) p[0] << 24 | p[1] << 16 | p[2] << 8 | p[3];
+        tcti->sent_ns = now_ns();
+    }
+
+    return rval;
+}
+
+static TSS2_RC trace_tcti_receive(TSS2_TCTI_CONTEXT *tcti_context,
+        size_t *size, uint8_t *response, int32_t timeout) {
+
+    trace_tcti *tcti = (trace_tcti *) tcti_context;
+
+    TSS2_RC rval = Tss2_Tcti_Receive(tcti->inner, size, response, timeout);
+
+    /* a NULL response only queries the size, the command is still running */
+    if (tcti->is_in_flight && response && rval != TSS2_TCTI_RC_TRY_AGAIN) {
+        tcti->is_in_flight = false;
+        if (rval == TSS2_RC_SUCCESS) {
+            uint64_t elapsed_ns = now_ns() - tcti->sent_ns;
+            if (trace.is_timing) {
+                record_command(tcti->cc, elapsed_ns);
+            }
+            if (trace.is_logging && *size >= TRACE_RC_OFFSET + sizeof(TSS2_RC)) {
+                const uint8_t *p = &response[TRACE_RC_OFFSET];
+                TSS2_RC rc = (TSS2_RC) p[0] << 24 | p[1] << 16 | p[2] << 8
+                        | p[3];
+                const char *name = tpm2_cc_util_to_str(tcti->cc);
+                LOG_COMMAND(tcti->cc, rc, elapsed_ns / 1000, "%s",
+                        name ? name : "unknown");
+            }
+        }
+    }
+
+    return rval;
+}
+
+static TSS2_RC trace_tcti_cancel(TSS2_TCTI_CONTEXT *tcti_context) {
+
+    trace_tcti *tcti = (trace_tcti *) tcti_context;
+    tcti->is_in_flight = false;
+
+    return Tss2_Tcti_Cancel(tcti->inner);
+}
+
+static TSS2_RC trace_tcti_get_poll_handles(TSS2_TCTI_CONTEXT *tcti_context,
+        TSS2_TCTI_POLL_HANDLE *handles, size_t *num_handles) {
+
+    trace_tcti *tcti = (trace_tcti *) tcti_context;
+
+    return Tss2_Tcti_GetPollHandles(tcti->inner, handles, num_handles);
+}
+
+static TSS2_RC trace_tcti_set_locality(TSS2_TCTI_CONTEXT *tcti_context,
+        uint8_t locality) {
+
+    trace_tcti *tcti = (trace_tcti *) tcti_context;
+
+    return Tss2_Tcti_SetLocality(tcti->inner, locality);
+}
+
+static TSS2_RC trace_tcti_make_sticky(TSS2_TCTI_CONTEXT *tcti_context,
+        TPM2_HANDLE *handle, uint8_t sticky) {
+
+    trace_tcti *tcti = (trace_tcti *) tcti_context;
+
+    return Tss2_Tcti_MakeSticky(tcti->inner, handle, sticky);
+}
+
+TSS2_TCTI_CONTEXT *tpm2_trace_tcti_wrap(TSS2_TCTI_CONTEXT *tcti) {
+
+    if ((!trace.is_timing && !trace.is_logging) || !tcti) {
+        return tcti;
+    }
+
+    trace_tcti *wrapper = calloc(1, sizeof(*wrapper));
+    if (!wrapper) {
+        LOG_WARN("oom, not timing TPM commands");
+        return tcti;
+    }
+
+    /*
+     * The wrapped TCTI stays owned by the caller, who finalizes it after
+     * unwrapping, so there is no finalize to forward.
+     */
+    wrapper->common.v1.magic = TSS2_TCTI_MAGIC(tcti);
+    wrapper->common.v1.version = 2;
+    wrapper->common.v1.transmit = trace_tcti_transmit;
+    wrapper->common.v1.receive = trace_tcti_receive;
+    wrapper->common.v1.cancel = trace_tcti_cancel;
+    wrapper->common.v1.getPollHandles = trace_tcti_get_poll_handles;
+    wrapper->common.v1.setLocality = trace_tcti_set_locality;
+    wrapper->common.makeSticky = trace_tcti_make_sticky;
+    wrapper->inner = tcti;
+
+    return (TSS2_TCTI_CONTEXT *) wrapper;
+}
+
+TSS2_TCTI_CONTEXT *tpm2_trace_tcti_unwrap(TSS2_TCTI_CONTEXT *tcti) {
+
+    if (!tcti || TSS2_TCTI_TRANSMIT(tcti) != trace_tcti_transmit) {
+        return tcti;
+    }
+
+    trace_tcti *wrapper = (trace_tcti *) tcti;
+    TSS2_TCTI_CONTEXT *inner = wrapper->inner;
+    free(wrapper);
+
+    return inner;
+}
+
+void tpm2_trace_summary(const char *tool_name) {
+
+    if (!trace.is_timing) {
+        return;
+    }
+
+    uint64_t total_ns = now_ns() - trace.start_ns;
+
+    /* the page faults since the exec, a measure of the pages touched */
+    uint64_t minor_faults, major_faults;
+    get_faults(&minor_faults, &major_faults);
+
+    FILE *f = stderr;
+    const char *path = tpm2_util_getenv(TPM2TOOLS_ENV_TRACE_FILE);
+    if (path && path[0]) {
+        f = fopen(path, "a");
+        if (!f) {
+            LOG_WARN("Could not open trace file \"%s\", error: %s", path,
+                    strerror(errno));
+            return;
+        }
+    }
+
+    /* a sequence entry, so a file appended to by many tools stays valid */
+    fprintf(f, "- tool: %s\n", tool_name);
+    fprintf(f, "  total-us: %" PRIu64 "\n", total_ns / 1000);
+    fprintf(f, "  minor-faults: %" PRIu64 "\n", minor_faults);
+    fprintf(f, "  major-faults: %" PRIu64 "\n", major_faults);
+    fprintf(f, "  phases:\n");
+    unsigned i;
+    for (i = 0; i < tpm2_trace_phase_max; i++) {
+        fprintf(f, "    %s-us: %" PRIu64 "\n", phase_names[i],
+                trace.phase_ns[i] / 1000);
+    }
+    for (i = 0; i < tpm2_trace_phase_max; i++) {
+        fprintf(f, "    %s-faults: %" PRIu64 "\n", phase_names[i],
+                trace.phase_faults[i]);
+    }
+
+    fprintf(f, "  commands:%s\n", trace.command_count ? "" : " []");
+    size_t j;
+    for (j = 0; j < trace.command_count; j++) {
+        const trace_command *command = &trace.commands[j];
+        const char *name = tpm2_cc_util_to_str(command->cc);
+        fprintf(f, "    - name: %s\n", name ? name : "unknown");
+        fprintf(f, "      code: 0x%" PRIx32 "\n", command->cc);
+        fprintf(f, "      count: %u\n", command->count);
+        fprintf(f, "      total-us: %" PRIu64 "\n", command->total_ns / 1000);
+        fprintf(f, "      max-us: %" PRIu64 "\n", command->max_ns / 1000);
+    }
+
+    if (f != stderr) {
+        fclose(f);
+    } else {
+        fflush(f);
+    }
+}
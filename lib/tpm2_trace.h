@@ -0,0 +1,83 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+#ifndef LIB_TPM2_TRACE_H_
+#define LIB_TPM2_TRACE_H_
+
+#include <stdbool.h>
+
+#include <tss2/tss2_tcti.h>
+
+/*
+ * Environment variable selecting what to trace, a comma separated list.
+ * "timing" records the wall time of the tool phases and of every TPM command.
+ * "commands" logs every TPM command with its response code and latency at
+ * the verbose level.
+ */
+#define TPM2TOOLS_ENV_TRACE "TPM2TOOLS_TRACE"
+
+/*
+ * Environment variable naming a file the trace summary is appended to instead
+ * of being written to stderr.
+ */
+#define TPM2TOOLS_ENV_TRACE_FILE "TPM2TOOLS_TRACE_FILE"
+
+typedef enum tpm2_trace_phase tpm2_trace_phase;
+enum tpm2_trace_phase {
+    tpm2_trace_phase_options,
+    tpm2_trace_phase_tcti,
+    tpm2_trace_phase_esys,
+    tpm2_trace_phase_openssl,
+    tpm2_trace_phase_onrun,
+    tpm2_trace_phase_onstop,
+    tpm2_trace_phase_max
+};
+
+/**
+ * Resets the recorded times and enables tracing as requested by the
+ * TPM2TOOLS_TRACE environment variable. Called once per tool invocation.
+ */
+void tpm2_trace_init(void);
+
+/**
+ * Starts timing a tool phase. Phases nest, time spent in a nested phase is
+ * only accounted to the nested phase.
+ * @param phase
+ *  The phase that starts.
+ */
+void tpm2_trace_phase_begin(tpm2_trace_phase phase);
+
+/**
+ * Stops timing the phase started last with tpm2_trace_phase_begin().
+ * @param phase
+ *  The phase that ends.
+ */
+void tpm2_trace_phase_end(tpm2_trace_phase phase);
+
+/**
+ * Wraps a TCTI to time the TPM commands sent through it. Without timing or
+ * command logging enabled the TCTI is returned as is.
+ * @param tcti
+ *  The TCTI to wrap.
+ * @return
+ *  The TCTI to hand to ESAPI.
+ */
+TSS2_TCTI_CONTEXT *tpm2_trace_tcti_wrap(TSS2_TCTI_CONTEXT *tcti);
+
+/**
+ * Releases a TCTI returned by tpm2_trace_tcti_wrap().
+ * @param tcti
+ *  A TCTI returned by tpm2_trace_tcti_wrap().
+ * @return
+ *  The wrapped TCTI, which is still to be finalized by the caller.
+ */
+TSS2_TCTI_CONTEXT *tpm2_trace_tcti_unwrap(TSS2_TCTI_CONTEXT *tcti);
+
+/**
+ * Writes the recorded times as YAML to stderr or the file named by
+ * TPM2TOOLS_TRACE_FILE. Does nothing without timing enabled.
+ * @param tool_name
+ *  The name of the traced tool.
+ */
+void tpm2_trace_summary(const char *tool_name);
+
+#endif /* LIB_TPM2_TRACE_H_ */
@@ -0,0 +1,471 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <sys/stat.h>
+
+#include "files.h"
+#include "log.h"
+#include "tpm2_alg_util.h"
+#include "tpm2_openssl.h"
+#include "tpm2_tree_hash.h"
+#include "tpm2_util.h"
+#include "tpm2_work_pool.h"
+
+#define TREE_HASH_VERSION 1
+
+/* the prefixes keeping a leaf from being taken for an inner node */
+#define TREE_HASH_LEAF 0x00
+#define TREE_HASH_NODE 0x01
+
+/* a worker holds a chunk in memory */
+#define TREE_HASH_CHUNK_MAX (64 * 1024 * 1024)
+
+/* the chunks of a file the workers of a pool take turns hashing */
+typedef struct tree_jobs tree_jobs;
+struct tree_jobs {
+    int fd;
+    const EVP_MD *md;
+    UINT32 chunk_size;
+    UINT64 length;
+    size_t digest_size;
+    size_t first;
+    size_t count;
+    /* count digests */
+    BYTE *digests;
+    /* the chunk buffer of every worker, allocated by its first chunk */
+    BYTE **buffers;
+    /* the error of the first chunk that failed, set atomically */
+    int error;
+};
+
+static bool chunk_read(int fd, BYTE *buffer, size_t size, UINT64 offset) {
+
+    size_t done = 0;
+    while (done < size) {
+        ssize_t len = pread(fd, &buffer[done], size - done, offset + done);
+        if (len < 0 && errno == EINTR) {
+            continue;
+        }
+        if (len <= 0) {
+            /* a file truncated while hashing is an error too */
+            if (!len) {
+                errno = EIO;
+            }
+            return false;
+        }
+        done += len;
+    }
+
+    return true;
+}
+
+static bool chunk_hash(tree_jobs *jobs, EVP_MD_CTX *mdctx, BYTE *buffer,
+        size_t index) {
+
+    size_t chunk = jobs->first + index;
+    UINT64 offset = (UINT64) chunk * jobs->chunk_size;
+    size_t size = jobs->length - offset < jobs->chunk_size ?
+            jobs->length - offset : jobs->chunk_size;
+
+    if (!chunk_read(jobs->fd, buffer, size, offset)) {
+        return false;
+    }
+
+    static const BYTE prefix = TREE_HASH_LEAF;
+    errno = EINVAL;
+
+    return EVP_DigestInit_ex(mdctx, jobs->md, NULL)
+            && EVP_DigestUpdate(mdctx, &prefix, sizeof(prefix))
+            && EVP_DigestUpdate(mdctx, buffer, size)
+            && EVP_DigestFinal_ex(mdctx,
+                    &jobs->digests[index * jobs->digest_size], NULL);
+}
+
+static bool jobs_work(tpm2_work_worker *worker, size_t index,
+        void *userdata) {
+
+    tree_jobs *jobs = (tree_jobs *) userdata;
+    BYTE **buffer = &jobs->buffers[tpm2_work_worker_index(worker)];
+
+    if (!*buffer) {
+        *buffer = malloc(jobs->chunk_size);
+    }
+
+    /* the digest context of the worker */
+    EVP_MD_CTX *mdctx = tpm2_openssl_md_ctx_get();
+
+    int error = ENOMEM;
+    if (*buffer && mdctx) {
+        error = chunk_hash(jobs, mdctx, *buffer, index) ? 0 : errno;
+    }
+
+    tpm2_openssl_md_ctx_put(mdctx);
+
+    if (error) {
+        int none = 0;
+        __atomic_compare_exchange_n(&jobs->error, &none, error, false,
+                __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+    }
+
+    return !error;
+}
+
+/* a failed chunk stops the pool, the digests are of no use anymore */
+static bool jobs_deliver(size_t index, bool result, void *userdata) {
+
+    UNUSED(index);
+    UNUSED(userdata);
+
+    return result;
+}
+
+/*
+ * The chunks are independent of each other, so they are hashed on a work
+ * pool, each worker reusing its chunk buffer and digest context.
+ */
+static bool jobs_run(tree_jobs *jobs, UINT32 threads) {
+
+    UINT32 workers = tpm2_work_pool_workers(threads, jobs->count);
+
+    jobs->digests = malloc(jobs->count * jobs->digest_size);
+    jobs->buffers = calloc(workers, sizeof(*jobs->buffers));
+    if (!jobs->digests || !jobs->buffers) {
+        LOG_ERR("oom");
+        free(jobs->digests);
+        jobs->digests = NULL;
+        free(jobs->buffers);
+        jobs->buffers = NULL;
+        return false;
+    }
+
+    bool result = tpm2_work_pool_run(jobs->count, threads, jobs_work,
+            jobs_deliver, jobs);
+
+    UINT32 i;
+    for (i = 0; i < workers; i++) {
+        free(jobs->buffers[i]);
+    }
+    free(jobs->buffers);
+    jobs->buffers = NULL;
+
+    if (!result) {
+        if (jobs->error) {
+            LOG_ERR("Could not hash the chunks, error: %s",
+                    strerror(jobs->error));
+        }
+        free(jobs->digests);
+        jobs->digests = NULL;
+        return false;
+    }
+
+    return true;
+}
+
+static size_t chunk_count(UINT64 length, UINT32 chunk_size) {
+
+    return length ? (length - 1) / chunk_size + 1 : 1;
+}
+
+static bool tree_check(TPMI_ALG_HASH halg, UINT32 chunk_size,
+        const EVP_MD **md) {
+
+    *md = tpm2_openssl_halg_from_tpmhalg(halg);
+    if (!*md) {
+        LOG_ERR("Hash algorithm 0x%x is not supported on the host", halg);
+        return false;
+    }
+
+    if (!chunk_size || chunk_size > TREE_HASH_CHUNK_MAX) {
+        LOG_ERR("The chunk size has to be between 1 and %u bytes, got: %u",
+                TREE_HASH_CHUNK_MAX, chunk_size);
+        return false;
+    }
+
+    return true;
+}
+
+static int file_open(const char *path, UINT64 *length) {
+
+    int fd = files_open(path, O_RDONLY, 0);
+    if (fd < 0) {
+        LOG_ERR("Could not open file \"%s\", error: %s", path,
+                strerror(errno));
+        return -1;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) || !S_ISREG(st.st_mode)) {
+        LOG_ERR("Expected a regular file to tree hash, got: \"%s\"", path);
+        close(fd);
+        return -1;
+    }
+
+    *length = st.st_size;
+
+    return fd;
+}
+
+bool tpm2_tree_hash_file(const char *path, TPMI_ALG_HASH halg,
+        UINT32 chunk_size, UINT32 jobs, tpm2_tree_hash *tree) {
+
+    tree_jobs tj = { .chunk_size = chunk_size };
+    if (!tree_check(halg, chunk_size, &tj.md)) {
+        return false;
+    }
+
+    tj.fd = file_open(path, &tj.length);
+    if (tj.fd < 0) {
+        return false;
+    }
+
+    tj.digest_size = tpm2_alg_util_get_hash_size(halg);
+    tj.count = chunk_count(tj.length, chunk_size);
+    bool result = jobs_run(&tj, jobs);
+    close(tj.fd);
+    if (!result) {
+        return false;
+    }
+
+    tree->halg = halg;
+    tree->chunk_size = chunk_size;
+    tree->length = tj.length;
+    tree->chunk_count = tj.count;
+    tree->chunks = tj.digests;
+
+    return true;
+}
+
+bool tpm2_tree_hash_check(const char *path, const tpm2_tree_hash *tree,
+        UINT64 offset, UINT64 length, UINT32 jobs) {
+
+    tree_jobs tj = { .chunk_size = tree->chunk_size };
+    if (!tree_check(tree->halg, tree->chunk_size, &tj.md)) {
+        return false;
+    }
+
+    if (offset > tree->length || length > tree->length - offset) {
+        LOG_ERR("The range is past the %"PRIu64" bytes of the tree",
+                tree->length);
+        return false;
+    }
+
+    if (!length) {
+        length = tree->length - offset;
+    }
+
+    tj.fd = file_open(path, &tj.length);
+    if (tj.fd < 0) {
+        return false;
+    }
+
+    bool result = false;
+    if (tj.length != tree->length) {
+        LOG_ERR("File \"%s\" has %"PRIu64" bytes, the tree has %"PRIu64,
+                path, tj.length, tree->length);
+        goto out;
+    }
+
+    /* an empty range still has the chunk it starts in */
+    tj.digest_size = tpm2_alg_util_get_hash_size(tree->halg);
+    tj.first = offset / tree->chunk_size;
+    size_t last = length ? (offset + length - 1) / tree->chunk_size :
+            tj.first;
+    if (last >= tree->chunk_count) {
+        last = tree->chunk_count - 1;
+    }
+    tj.count = last - tj.first + 1;
+    if (!jobs_run(&tj, jobs)) {
+        goto out;
+    }
+
+    size_t i;
+    for (i = 0; i < tj.count; i++) {
+        size_t chunk = tj.first + i;
+        if (memcmp(&tj.digests[i * tj.digest_size],
+                &tree->chunks[chunk * tj.digest_size], tj.digest_size)) {
+            UINT64 start = (UINT64) chunk * tree->chunk_size;
+            UINT64 size = tree->length - start < tree->chunk_size ?
+                    tree->length - start : tree->chunk_size;
+            LOG_ERR("Chunk %zu, %"PRIu64" bytes at %"PRIu64", of \"%s\" "
+                    "does not match the tree", chunk, size, start, path);
+            goto out;
+        }
+    }
+
+    result = true;
+
+out:
+    free(tj.digests);
+    close(tj.fd);
+
+    return result;
+}
+
+static bool node_hash(EVP_MD_CTX *mdctx, const EVP_MD *md, const BYTE *left,
+        const BYTE *right, size_t size, BYTE *node) {
+
+    static const BYTE prefix = TREE_HASH_NODE;
+
+    return EVP_DigestInit_ex(mdctx, md, NULL)
+            && EVP_DigestUpdate(mdctx, &prefix, sizeof(prefix))
+            && EVP_DigestUpdate(mdctx, left, size)
+            && EVP_DigestUpdate(mdctx, right, size)
+            && EVP_DigestFinal_ex(mdctx, node, NULL);
+}
+
+bool tpm2_tree_hash_root(const tpm2_tree_hash *tree, TPM2B_DIGEST *root) {
+
+    const EVP_MD *md;
+    if (!tree_check(tree->halg, tree->chunk_size, &md)) {
+        return false;
+    }
+
+    size_t size = tpm2_alg_util_get_hash_size(tree->halg);
+    BYTE *nodes = malloc(tree->chunk_count * size);
+    EVP_MD_CTX *mdctx = tpm2_openssl_md_ctx_get();
+    bool result = nodes && mdctx;
+    if (!nodes) {
+        LOG_ERR("oom");
+    }
+
+    /* each level is computed in place of the one below */
+    size_t count = tree->chunk_count;
+    if (result) {
+        memcpy(nodes, tree->chunks, count * size);
+    }
+    while (result && count > 1) {
+        size_t i;
+        for (i = 0; result && i + 1 < count; i += 2) {
+            result = node_hash(mdctx, md, &nodes[i * size],
+                    &nodes[(i + 1) * size], size, &nodes[i / 2 * size]);
+        }
+        if (count % 2) {
+            memmove(&nodes[count / 2 * size], &nodes[(count - 1) * size],
+                    size);
+        }
+        count = (count + 1) / 2;
+    }
+
+    if (result) {
+        root->size = size;
+        memcpy(root->buffer, nodes, size);
+    } else if (nodes && mdctx) {
+        LOG_ERR("%s", tpm2_openssl_get_err());
+    }
+
+    tpm2_openssl_md_ctx_put(mdctx);
+    free(nodes);
+
+    return result;
+}
+
+bool tpm2_tree_hash_signed_data(const tpm2_tree_hash *tree,
+        TPM2B_MAX_BUFFER *data) {
+
+    TPM2B_DIGEST root = { 0 };
+    if (!tpm2_tree_hash_root(tree, &root)) {
+        return false;
+    }
+
+    BYTE *p = data->buffer;
+    memcpy(p, root.buffer, root.size);
+    p += root.size;
+
+    UINT32 chunk_size = tree->chunk_size;
+    int i;
+    for (i = 3; i >= 0; i--) {
+        *p++ = chunk_size >> (i * 8);
+    }
+
+    UINT64 length = tree->length;
+    for (i = 7; i >= 0; i--) {
+        *p++ = length >> (i * 8);
+    }
+
+    data->size = p - data->buffer;
+
+    return true;
+}
+
+bool tpm2_tree_hash_save(const char *path, const tpm2_tree_hash *tree) {
+
+    FILE *f = files_fopen(path, "wb");
+    if (!f) {
+        LOG_ERR("Could not open tree manifest \"%s\", error: %s", path,
+                strerror(errno));
+        return false;
+    }
+
+    size_t size = tpm2_alg_util_get_hash_size(tree->halg);
+    bool result = files_write_header(f, TREE_HASH_VERSION)
+            && files_write_16(f, tree->halg)
+            && files_write_32(f, tree->chunk_size)
+            && files_write_64(f, tree->length)
+            && files_write_bytes(f, tree->chunks, tree->chunk_count * size);
+
+    result = !fclose(f) && result;
+    if (!result) {
+        LOG_ERR("Could not write tree manifest \"%s\"", path);
+    }
+
+    return result;
+}
+
+bool tpm2_tree_hash_load(const char *path, tpm2_tree_hash *tree) {
+
+    FILE *f = files_fopen(path, "rb");
+    if (!f) {
+        LOG_ERR("Could not open tree manifest \"%s\", error: %s", path,
+                strerror(errno));
+        return false;
+    }
+
+    memset(tree, 0, sizeof(*tree));
+    UINT32 version = 0;
+    const EVP_MD *md = NULL;
+    bool result = files_read_header(f, &version)
+            && version == TREE_HASH_VERSION
+            && files_read_16(f, &tree->halg)
+            && files_read_32(f, &tree->chunk_size)
+            && files_read_64(f, &tree->length)
+            && tree_check(tree->halg, tree->chunk_size, &md);
+    if (!result) {
+        goto out;
+    }
+
+    size_t size = tpm2_alg_util_get_hash_size(tree->halg);
+    tree->chunk_count = chunk_count(tree->length, tree->chunk_size);
+    tree->chunks = malloc(tree->chunk_count * size);
+    if (!tree->chunks) {
+        LOG_ERR("oom");
+        result = false;
+        goto out;
+    }
+
+    result = files_read_bytes(f, tree->chunks, tree->chunk_count * size)
+            && fgetc(f) == EOF;
+
+out:
+    fclose(f);
+
+    if (!result) {
+        LOG_ERR("File \"%s\" is not a tree manifest", path);
+        tpm2_tree_hash_free(tree);
+    }
+
+    return result;
+}
+
+void tpm2_tree_hash_free(tpm2_tree_hash *tree) {
+
+    free(tree->chunks);
+    tree->chunks = NULL;
+    tree->chunk_count = 0;
+}
@@ -0,0 +1,130 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+#ifndef LIB_TPM2_TREE_HASH_H_
+#define LIB_TPM2_TREE_HASH_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include <tss2/tss2_tpm2_types.h>
+
+/*
+ * A tree hash splits a file into chunks of a fixed size, hashed in parallel,
+ * and combines the digests of the chunks into a Merkle root, so hashing a
+ * large file is not bound to one core and a range of it is checked without
+ * reading the rest.
+ *
+ * The leaves are H(0x00 || chunk), an inner node is H(0x01 || left || right)
+ * and a node without a sibling moves up a level unchanged. An empty file has
+ * one empty chunk. What gets signed is the digest of:
+ *   the root, U32 chunk size, U64 file length, all numbers big endian
+ *
+ * The manifest of a tree keeps the digests of all chunks and is laid out as,
+ * all numbers big endian:
+ *   the header of files_write_header()
+ *   U16 hash algorithm
+ *   U32 chunk size
+ *   U64 file length
+ *   the digests of the chunks, in file order
+ */
+
+typedef struct tpm2_tree_hash tpm2_tree_hash;
+struct tpm2_tree_hash {
+    TPMI_ALG_HASH halg;
+    UINT32 chunk_size;
+    UINT64 length;
+    size_t chunk_count;
+    /* chunk_count digests of the size of halg */
+    BYTE *chunks;
+};
+
+/**
+ * Hashes the chunks of a file.
+ * @param path
+ *  The file to hash, which has to be a regular file to read it in parallel.
+ * @param halg
+ *  The hash algorithm.
+ * @param chunk_size
+ *  The size of the chunks, not 0.
+ * @param jobs
+ *  The number of threads hashing the chunks, 0 for one per CPU.
+ * @param tree
+ *  Receives the tree, to be released with tpm2_tree_hash_free().
+ * @return
+ *  true on success, false otherwise.
+ */
+bool tpm2_tree_hash_file(const char *path, TPMI_ALG_HASH halg,
+        UINT32 chunk_size, UINT32 jobs, tpm2_tree_hash *tree);
+
+/**
+ * Checks the chunks of a file covering a range against a tree.
+ * @param path
+ *  The file to check.
+ * @param tree
+ *  The tree of the file, ie from tpm2_tree_hash_load().
+ * @param offset
+ *  The first byte of the range.
+ * @param length
+ *  The size of the range, 0 for up to the end of the file.
+ * @param jobs
+ *  The number of threads hashing the chunks, 0 for one per CPU.
+ * @return
+ *  true if the chunks match, false otherwise.
+ */
+bool tpm2_tree_hash_check(const char *path, const tpm2_tree_hash *tree,
+        UINT64 offset, UINT64 length, UINT32 jobs);
+
+/**
+ * Computes the Merkle root of a tree.
+ * @param tree
+ *  The tree.
+ * @param root
+ *  Receives the root.
+ * @return
+ *  true on success, false otherwise.
+ */
+bool tpm2_tree_hash_root(const tpm2_tree_hash *tree, TPM2B_DIGEST *root);
+
+/**
+ * Gets the data the digest to sign is computed over, the root, the chunk
+ * size and the file length.
+ * @param tree
+ *  The tree.
+ * @param data
+ *  Receives the data.
+ * @return
+ *  true on success, false otherwise.
+ */
+bool tpm2_tree_hash_signed_data(const tpm2_tree_hash *tree,
+        TPM2B_MAX_BUFFER *data);
+
+/**
+ * Saves the manifest of a tree.
+ * @param path
+ *  The file to save to.
+ * @param tree
+ *  The tree.
+ * @return
+ *  true on success, false otherwise.
+ */
+bool tpm2_tree_hash_save(const char *path, const tpm2_tree_hash *tree);
+
+/**
+ * Loads the manifest of a tree saved with tpm2_tree_hash_save().
+ * @param path
+ *  The file to load from.
+ * @param tree
+ *  Receives the tree, to be released with tpm2_tree_hash_free().
+ * @return
+ *  true on success, false otherwise.
+ */
+bool tpm2_tree_hash_load(const char *path, tpm2_tree_hash *tree);
+
+/**
+ * Releases the chunk digests of a tree.
+ * @param tree
+ *  The tree.
+ */
+void tpm2_tree_hash_free(tpm2_tree_hash *tree);
+
+#endif /* LIB_TPM2_TREE_HASH_H_ */
@@ -2,6 +2,7 @@
 
 #include <ctype.h>
 #include <dlfcn.h>
+#include <errno.h>
 #include <inttypes.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -14,10 +15,12 @@
 #include "tpm2_alg_util.h"
 #include "tpm2_attr_util.h"
 #include "tpm2_convert.h"
+#include "tpm2_hex.h"
 #include "tpm2_openssl.h"
 #include "tpm2_session.h"
 #include "tpm2_tool.h"
 #include "tpm2_util.h"
+#include "tpm2_writer.h"
 
 // verify that the quote digest equals the digest we calculated
 bool tpm2_util_verify_digests(TPM2B_DIGEST *quoteDigest,
@@ -182,29 +185,24 @@ bool tpm2_util_string_to_int32(const char *str, int32_t *value) {
 
 int tpm2_util_hex_to_byte_structure(const char *input_string, UINT16 *byte_length,
         BYTE *byte_buffer) {
-    int str_length; //if the input_string likes "1a2b...", no prefix "0x"
-    int i = 0;
+    size_t str_length; //if the input_string likes "1a2b...", no prefix "0x"
     if (input_string == NULL || byte_length == NULL || byte_buffer == NULL)
         return -1;
     str_length = strlen(input_string);
     if (str_length % 2)
         return -2;
-    for (i = 0; i < str_length; i++) {
-        if (!isxdigit(input_string[i]))
-            return -3;
-    }
 
-    if (*byte_length < str_length / 2)
+    /* a string too long for the buffer is only validated */
+    bool is_fitting = str_length / 2 <= *byte_length;
+    if (!tpm2_hex_decode(input_string, str_length,
+            is_fitting ? byte_buffer : NULL))
+        return -3;
+
+    if (!is_fitting)
         return -4;
 
     *byte_length = str_length / 2;
 
-    for (i = 0; i < *byte_length; i++) {
-        char tmp_str[4] = { 0 };
-        tmp_str[0] = input_string[i * 2];
-        tmp_str[1] = input_string[i * 2 + 1];
-        byte_buffer[i] = strtol(tmp_str, NULL, 16);
-    }
     return 0;
 }
 
@@ -212,7 +210,7 @@ bool tpm2_util_bin_from_hex_or_file(const char *input, UINT16 *len, BYTE *buffer
 
     bool result = false;
 
-    FILE *f = fopen(input, "rb");
+    FILE *f = files_fopen(input, "rb");
     if (!f) {
         result = tpm2_util_hex_to_byte_structure(input, len, buffer) == 0;
         goto out;
@@ -231,19 +229,12 @@ out:
 
 void tpm2_util_hexdump2(FILE *f, const BYTE *data, size_t len) {
 
-    size_t i;
-    for (i = 0; i < len; i++) {
-        fprintf(f, "%02x", data[i]);
-    }
+    tpm2_hex_fprint(f, data, len, false);
 }
 
 void tpm2_util_hexdump(const BYTE *data, size_t len) {
 
-    if (!output_enabled) {
-        return;
-    }
-
-    tpm2_util_hexdump2(stdout, data, len);
+    tpm2_hex_print(data, len, false);
 }
 
 bool tpm2_util_is_big_endian(void) {
@@ -380,161 +371,127 @@ void print_yaml_indent(size_t indent_count) {
     }
 }
 
-void tpm2_util_tpma_object_to_yaml(TPMA_OBJECT obj, char *indent) {
-
-    if (!indent) {
-        indent = "";
-    }
+void tpm2_util_tpma_object_to_yaml(TPMA_OBJECT obj) {
 
     char *attrs = tpm2_attr_util_obj_attrtostr(obj);
-    tpm2_tool_output("%sattributes:\n", indent);
-    tpm2_tool_output("%s  value: %s\n", indent, attrs);
-    tpm2_tool_output("%s  raw: 0x%x\n", indent, obj);
+    tpm2_writer_map_start("attributes");
+    tpm2_writer_string("value", "%s", attrs);
+    tpm2_writer_number("raw", "0x%x", obj);
+    tpm2_writer_end();
     free(attrs);
 }
 
-static void print_alg_raw(const char *name, TPM2_ALG_ID alg, const char *indent) {
+static void print_alg_raw(const char *name, TPM2_ALG_ID alg) {
 
-    tpm2_tool_output("%s%s:\n", indent, name);
-    tpm2_tool_output("%s  value: %s\n", indent,
+    tpm2_writer_map_start(name);
+    tpm2_writer_string("value", "%s",
             tpm2_alg_util_algtostr(alg, tpm2_alg_util_flags_any));
-    tpm2_tool_output("%s  raw: 0x%x\n", indent, alg);
+    tpm2_writer_number("raw", "0x%x", alg);
+    tpm2_writer_end();
 }
 
-static void print_scheme_common(TPMI_ALG_RSA_SCHEME scheme, const char *indent) {
-    print_alg_raw("scheme", scheme, indent);
+static void print_scheme_common(TPMI_ALG_RSA_SCHEME scheme) {
+    print_alg_raw("scheme", scheme);
 }
 
-static void print_sym(TPMT_SYM_DEF_OBJECT *sym, const char *indent) {
+static void print_sym(TPMT_SYM_DEF_OBJECT *sym) {
 
-    print_alg_raw("sym-alg", sym->algorithm, indent);
-    print_alg_raw("sym-mode", sym->mode.sym, indent);
-    tpm2_tool_output("%ssym-keybits: %u\n", indent, sym->keyBits.sym);
+    print_alg_raw("sym-alg", sym->algorithm);
+    print_alg_raw("sym-mode", sym->mode.sym);
+    tpm2_writer_number("sym-keybits", "%u", sym->keyBits.sym);
 }
 
-static void print_rsa_scheme(TPMT_RSA_SCHEME *scheme, const char *indent) {
+static void print_rsa_scheme(TPMT_RSA_SCHEME *scheme) {
 
-    print_scheme_common(scheme->scheme, indent);
+    print_scheme_common(scheme->scheme);
 
     /*
      * everything is a union on a hash algorithm except for RSAES which
      * has nothing. So on RSAES skip the hash algorithm printing
      */
     if (scheme->scheme != TPM2_ALG_RSAES) {
-        print_alg_raw("scheme-halg", scheme->details.oaep.hashAlg, indent);
+        print_alg_raw("scheme-halg", scheme->details.oaep.hashAlg);
     }
 }
 
-static void print_ecc_scheme(TPMT_ECC_SCHEME *scheme, const char *indent) {
+static void print_ecc_scheme(TPMT_ECC_SCHEME *scheme) {
 
-    print_scheme_common(scheme->scheme, indent);
+    print_scheme_common(scheme->scheme);
 
     /*
      * everything but ecdaa uses only hash alg
      * in a union, so we only need to do things differently
      * for ecdaa.
      */
-    print_alg_raw("scheme-halg", scheme->details.oaep.hashAlg, indent);
+    print_alg_raw("scheme-halg", scheme->details.oaep.hashAlg);
 
     if (scheme->scheme == TPM2_ALG_ECDAA) {
-        tpm2_tool_output("%sscheme-count: %u\n", indent,
-                scheme->details.ecdaa.count);
+        tpm2_writer_number("scheme-count", "%u", scheme->details.ecdaa.count);
     }
 }
 
-static void print_kdf_scheme(TPMT_KDF_SCHEME *kdf, const char *indent) {
+static void print_kdf_scheme(TPMT_KDF_SCHEME *kdf) {
 
-    print_alg_raw("kdfa-alg", kdf->scheme, indent);
+    print_alg_raw("kdfa-alg", kdf->scheme);
 
     /*
      * The hash algorithm for the KDFA is in a union, just grab one of them.
      */
-    print_alg_raw("kdfa-halg", kdf->details.mgf1.hashAlg, indent);
+    print_alg_raw("kdfa-halg", kdf->details.mgf1.hashAlg);
 }
 
-void tpm2_util_tpmt_public_to_yaml(TPMT_PUBLIC *public, char *indent) {
+void tpm2_util_tpmt_public_to_yaml(TPMT_PUBLIC *public) {
 
-    if (!indent) {
-        indent = "";
-    }
-
-    tpm2_tool_output("%sname-alg:\n", indent);
-    tpm2_tool_output("%s  value: %s\n", indent,
-            tpm2_alg_util_algtostr(public->nameAlg,
-                    tpm2_alg_util_flags_any));
-    tpm2_tool_output("%s  raw: 0x%x\n", indent, public->nameAlg);
+    print_alg_raw("name-alg", public->nameAlg);
 
-    tpm2_util_tpma_object_to_yaml(public->objectAttributes, indent);
+    tpm2_util_tpma_object_to_yaml(public->objectAttributes);
 
-    tpm2_tool_output("%stype:\n", indent);
-    tpm2_tool_output("%s  value: %s\n", indent,
-            tpm2_alg_util_algtostr(public->type,
-                    tpm2_alg_util_flags_any));
-    tpm2_tool_output("%s  raw: 0x%x\n", indent, public->type);
+    print_alg_raw("type", public->type);
 
     switch (public->type) {
     case TPM2_ALG_SYMCIPHER: {
         TPMS_SYMCIPHER_PARMS *s = &public->parameters.symDetail;
-        print_sym(&s->sym, indent);
+        print_sym(&s->sym);
     }
         break;
     case TPM2_ALG_KEYEDHASH: {
         TPMS_KEYEDHASH_PARMS *k = &public->parameters.keyedHashDetail;
-        tpm2_tool_output("%salgorithm: \n", indent);
-        tpm2_tool_output("%s  value: %s\n", indent,
-                tpm2_alg_util_algtostr(k->scheme.scheme,
-                        tpm2_alg_util_flags_any));
-        tpm2_tool_output("%s  raw: 0x%x\n", indent, k->scheme.scheme);
+        print_alg_raw("algorithm", k->scheme.scheme);
 
         if (k->scheme.scheme == TPM2_ALG_HMAC) {
-            tpm2_tool_output("%shash-alg:\n", indent);
-            tpm2_tool_output("%s  value: %s\n", indent,
-                    tpm2_alg_util_algtostr(k->scheme.details.hmac.hashAlg,
-                            tpm2_alg_util_flags_any));
-            tpm2_tool_output("%s  raw: 0x%x\n", indent,
-                    k->scheme.details.hmac.hashAlg);
+            print_alg_raw("hash-alg", k->scheme.details.hmac.hashAlg);
         } else if (k->scheme.scheme == TPM2_ALG_XOR) {
-            tpm2_tool_output("%shash-alg:\n", indent);
-            tpm2_tool_output("%s  value: %s\n", indent,
-                    tpm2_alg_util_algtostr(
-                            k->scheme.details.exclusiveOr.hashAlg,
-                            tpm2_alg_util_flags_any));
-            tpm2_tool_output("%s  raw: 0x%x\n", indent,
-                    k->scheme.details.exclusiveOr.hashAlg);
-
-            tpm2_tool_output("%skdfa-alg:\n", indent);
-            tpm2_tool_output("%s  value: %s\n", indent,
-                    tpm2_alg_util_algtostr(k->scheme.details.exclusiveOr.kdf,
-                            tpm2_alg_util_flags_any));
-            tpm2_tool_output("%s  raw: 0x%x\n", indent,
-                    k->scheme.details.exclusiveOr.kdf);
+            print_alg_raw("hash-alg", k->scheme.details.exclusiveOr.hashAlg);
+            print_alg_raw("kdfa-alg", k->scheme.details.exclusiveOr.kdf);
         }
 
     }
         break;
     case TPM2_ALG_RSA: {
         TPMS_RSA_PARMS *r = &public->parameters.rsaDetail;
-        tpm2_tool_output("%sexponent: %u\n", indent, r->exponent ? r->exponent : 65537);
-        tpm2_tool_output("%sbits: %u\n", indent, r->keyBits);
+        tpm2_writer_number("exponent", "%u",
+                r->exponent ? r->exponent : 65537);
+        tpm2_writer_number("bits", "%u", r->keyBits);
 
-        print_rsa_scheme(&r->scheme, indent);
+        print_rsa_scheme(&r->scheme);
 
-        print_sym(&r->symmetric, indent);
+        print_sym(&r->symmetric);
     }
         break;
     case TPM2_ALG_ECC: {
         TPMS_ECC_PARMS *e = &public->parameters.eccDetail;
 
-        tpm2_tool_output("%scurve-id:\n", indent);
-        tpm2_tool_output("%s  value: %s\n", indent,
+        tpm2_writer_map_start("curve-id");
+        tpm2_writer_string("value", "%s",
                 tpm2_alg_util_ecc_to_str(e->curveID));
-        tpm2_tool_output("%s  raw: 0x%x\n", indent, e->curveID);
+        tpm2_writer_number("raw", "0x%x", e->curveID);
+        tpm2_writer_end();
 
-        print_kdf_scheme(&e->kdf, indent);
+        print_kdf_scheme(&e->kdf);
 
-        print_ecc_scheme(&e->scheme, indent);
+        print_ecc_scheme(&e->scheme);
 
-        print_sym(&e->symmetric, indent);
+        print_sym(&e->symmetric);
     }
         break;
     }
@@ -546,22 +503,20 @@ void tpm2_util_tpmt_public_to_yaml(TPMT_PUBLIC *public, char *indent) {
     UINT16 i;
     /* if no keydata len will be 0 and it wont print */
     for (i = 0; i < keydata.len; i++) {
-        tpm2_tool_output("%s%s: ", indent, keydata.entries[i].name);
-        tpm2_util_print_tpm2b(keydata.entries[i].value);
-        tpm2_tool_output("%s\n", indent);
+        TPM2B *value = keydata.entries[i].value;
+        tpm2_writer_hex(keydata.entries[i].name, NULL, value->buffer,
+                value->size, false);
     }
 
     if (public->authPolicy.size) {
-        tpm2_tool_output("%sauthorization policy: ", indent);
-        tpm2_util_hexdump(public->authPolicy.buffer,
-            public->authPolicy.size);
-        tpm2_tool_output("%s\n", indent);
+        tpm2_writer_hex("authorization policy", NULL,
+                public->authPolicy.buffer, public->authPolicy.size, false);
     }
 }
 
-void tpm2_util_public_to_yaml(TPM2B_PUBLIC *public, char *indent) {
+void tpm2_util_public_to_yaml(TPM2B_PUBLIC *public) {
 
-    tpm2_util_tpmt_public_to_yaml(&public->publicArea, indent);
+    tpm2_util_tpmt_public_to_yaml(&public->publicArea);
 }
 
 bool tpm2_util_calc_unique(TPMI_ALG_HASH name_alg,
@@ -623,6 +578,19 @@ char *tpm2_util_getenv(const char *name) {
     return getenv(name);
 }
 
+bool tpm2_util_get_boot_id(char boot_id[TPM2_UTIL_BOOT_ID_LEN]) {
+
+    FILE *f = fopen("/proc/sys/kernel/random/boot_id", "r");
+    if (!f) {
+        return false;
+    }
+
+    size_t len = fread(boot_id, 1, TPM2_UTIL_BOOT_ID_LEN, f);
+    fclose(f);
+
+    return len == TPM2_UTIL_BOOT_ID_LEN;
+}
+
 /**
  * Parses a hierarchy value from an option argument.
  * @param value
@@ -874,7 +842,7 @@ bool tpm2_util_get_label(const char *value, TPM2B_DATA *label) {
         return true;
     }
 
-    FILE *f = fopen(value, "rb");
+    FILE *f = files_fopen(value, "rb");
     if (f) {
         /* set size one smaller for NUL byte */
         label->size = sizeof(label->buffer) - 1;
@@ -944,9 +912,8 @@ bool tpm2_calq_qname(TPM2B_NAME *pqname,
 
     const EVP_MD *md = tpm2_openssl_halg_from_tpmhalg(halg);
 
-    EVP_MD_CTX *mdctx = EVP_MD_CTX_create();
+    EVP_MD_CTX *mdctx = tpm2_openssl_md_ctx_get();
     if (!mdctx) {
-        LOG_ERR("%s", tpm2_openssl_get_err());
         return false;
     }
 
@@ -988,7 +955,7 @@ bool tpm2_calq_qname(TPM2B_NAME *pqname,
     result = true;
 
 out:
-    EVP_MD_CTX_destroy(mdctx);
+    tpm2_openssl_md_ctx_put(mdctx);
     return result;
 }
 
@@ -1018,6 +985,195 @@ bool tpm2_safe_read_from_stdin(int length, char *data) {
     return true;
 }
 
+bool tpm2_util_split_args(char *line, int *argc, char ***argv) {
+
+    size_t max_args = 8;
+    char **args = calloc(max_args + 1, sizeof(*args));
+    if (!args) {
+        LOG_ERR("oom");
+        return false;
+    }
+
+    int count = 0;
+    char *r = line;
+    char *w = line;
+    while (*r) {
+
+        /* skip leading whitespace */
+        while (isspace((unsigned char )*r)) {
+            r++;
+        }
+
+        /* end of line or start of a comment */
+        if (*r == '\0' || *r == '#') {
+            break;
+        }
+
+        if ((size_t) count == max_args) {
+            max_args *= 2;
+            char **tmp = realloc(args, (max_args + 1) * sizeof(*args));
+            if (!tmp) {
+                LOG_ERR("oom");
+                free(args);
+                return false;
+            }
+            args = tmp;
+        }
+
+        /* unquote and unescape the token in place */
+        args[count++] = w;
+        char quote = '\0';
+        while (*r) {
+            if (quote) {
+                if (*r == quote) {
+                    quote = '\0';
+                    r++;
+                } else if (quote == '"' && *r == '\\' && r[1]) {
+                    r++;
+                    *w++ = *r++;
+                } else {
+                    *w++ = *r++;
+                }
+            } else if (isspace((unsigned char )*r)) {
+                r++;
+                break;
+            } else if (*r == '"' || *r == '\'') {
+                quote = *r++;
+            } else if (*r == '\\' && r[1]) {
+                r++;
+                *w++ = *r++;
+            } else {
+                *w++ = *r++;
+            }
+        }
+
+        if (quote) {
+            LOG_ERR("Unterminated quote in: \"%s\"", args[0]);
+            free(args);
+            return false;
+        }
+
+        *w++ = '\0';
+    }
+
+    args[count] = NULL;
+    *argc = count;
+    *argv = args;
+
+    return true;
+}
+
+bool tpm2_util_array_grow(void **array, size_t *capacity, size_t count,
+        size_t size) {
+
+    if (count < *capacity) {
+        return true;
+    }
+
+    size_t new_capacity = *capacity ? *capacity * 2 : 16;
+    if (new_capacity <= count || new_capacity > SIZE_MAX / size) {
+        LOG_ERR("oom");
+        return false;
+    }
+
+    void *tmp = realloc(*array, new_capacity * size);
+    if (!tmp) {
+        LOG_ERR("oom");
+        return false;
+    }
+
+    *array = tmp;
+    *capacity = new_capacity;
+
+    return true;
+}
+
+bool tpm2_util_manifest_read(const char *path, size_t min_fields,
+        size_t max_fields, const char *usage, void **entries, size_t *count,
+        size_t size, tpm2_util_manifest_line_fn line_fn, void *userdata) {
+
+    if (max_fields > TPM2_UTIL_MANIFEST_FIELDS_MAX) {
+        LOG_ERR("Manifest lines have at most %u fields",
+                TPM2_UTIL_MANIFEST_FIELDS_MAX);
+        return false;
+    }
+
+    FILE *f = files_fopen(path, "r");
+    if (!f) {
+        LOG_ERR("Could not open manifest \"%s\", error: %s", path,
+                strerror(errno));
+        return false;
+    }
+
+    /* the entries may have been appended to before */
+    size_t capacity = entries ? *count : 0;
+    bool result = true;
+    size_t line_number = 0;
+    while (result) {
+        char *line = NULL;
+        size_t line_size = 0;
+        if (getline(&line, &line_size, f) == -1) {
+            free(line);
+            break;
+        }
+        line_number++;
+
+        char *comment = strchr(line, '#');
+        if (comment) {
+            *comment = '\0';
+        }
+
+        /* one more than allowed, to tell too many */
+        char *fields[TPM2_UTIL_MANIFEST_FIELDS_MAX + 1];
+        size_t field_count = 0;
+        char *saveptr = NULL;
+        char *token = strtok_r(line, " \t\r\n", &saveptr);
+        while (token && field_count <= max_fields) {
+            fields[field_count++] = token;
+            token = strtok_r(NULL, " \t\r\n", &saveptr);
+        }
+
+        if (!field_count) {
+            free(line);
+            continue;
+        }
+
+        if (field_count < min_fields || field_count > max_fields) {
+            LOG_ERR("%s:%zu: Expected: %s", path, line_number, usage);
+            free(line);
+            result = false;
+            break;
+        }
+
+        void *entry = NULL;
+        if (entries) {
+            result = tpm2_util_array_grow(entries, &capacity, *count, size);
+            if (!result) {
+                free(line);
+                break;
+            }
+
+            entry = (BYTE *) *entries + *count * size;
+            memset(entry, 0, size);
+            (*count)++;
+        }
+
+        /* takes the line */
+        result = line_fn(entry, line, fields, field_count, line_number,
+                userdata);
+    }
+
+    if (result && ferror(f)) {
+        LOG_ERR("Error reading manifest \"%s\", error: %s", path,
+                strerror(errno));
+        result = false;
+    }
+
+    fclose(f);
+
+    return result;
+}
+
 bool tpm2_pem_encoded_key_to_fingerprint(const char *pem_encoded_key,
     char *fingerprint) {
 
@@ -1102,6 +1258,11 @@ tool_rc tpm2_util_aux_sessions_setup(ESYS_CONTEXT *ectx, uint8_t session_cnt,
             }
             session_handle[session_idx] =
                 tpm2_session_get_handle(session[session_idx]);
+            if (session_handle[session_idx] == ESYS_TR_NONE) {
+                LOG_ERR("Could not load aux-session #%s",
+                session_path[session_idx]);
+                return tool_rc_general_error;
+            }
         }
     }
 
@@ -324,24 +324,21 @@ UINT32 tpm2_util_pop_count(UINT32 data);
 void print_yaml_indent(size_t indent_count);
 
 /**
- * Convert a TPM2B_PUBLIC into a yaml format and output if not quiet.
+ * Outputs a TPM2B_PUBLIC through tpm2_writer, in YAML or JSON, if not quiet.
+ * The fields are entries of the current map.
  * @param public
- *  The TPM2B_PUBLIC to output in YAML format.
- * @param indent
- *  The level of indentation, can be NULL
+ *  The TPM2B_PUBLIC to output.
  */
-void tpm2_util_public_to_yaml(TPM2B_PUBLIC *public, char *indent);
+void tpm2_util_public_to_yaml(TPM2B_PUBLIC *public);
 
-void tpm2_util_tpmt_public_to_yaml(TPMT_PUBLIC *public, char *indent);
+void tpm2_util_tpmt_public_to_yaml(TPMT_PUBLIC *public);
 
 /**
- * Convert a TPMA_OBJECT to a yaml format and output if not quiet.
+ * Outputs a TPMA_OBJECT through tpm2_writer, in YAML or JSON, if not quiet.
  * @param obj
  *  The TPMA_OBJECT attributes to print.
- * @param indent
- *  The level of indentation, can be NULL
  */
-void tpm2_util_tpma_object_to_yaml(TPMA_OBJECT obj, char *indent);
+void tpm2_util_tpma_object_to_yaml(TPMA_OBJECT obj);
 
 /**
  * Calculates the unique public field. The unique public field is the digest, based on name algorithm
@@ -387,6 +384,19 @@ ESYS_TR tpm2_tpmi_hierarchy_to_esys_tr(TPMI_RH_PROVISION inh);
 
 char *tpm2_util_getenv(const char *name);
 
+/* the length of the UUID in /proc/sys/kernel/random/boot_id */
+#define TPM2_UTIL_BOOT_ID_LEN 36
+
+/**
+ * Reads the id of the current boot, which changes with every reboot, for
+ * files that are only valid in the boot they were written in.
+ * @param boot_id
+ *  Receives the boot id, not NUL terminated.
+ * @return
+ *  True on success, false if the boot id is not available.
+ */
+bool tpm2_util_get_boot_id(char boot_id[TPM2_UTIL_BOOT_ID_LEN]);
+
 typedef enum tpm2_handle_flags tpm2_handle_flags;
 enum tpm2_handle_flags {
     TPM2_HANDLE_FLAGS_NONE = 0,
@@ -469,6 +479,99 @@ bool tpm2_calq_qname(TPM2B_NAME *pqname,
 bool tpm2_safe_read_from_stdin(int length, char *data);
 
 
+/**
+ * Splits a command line into arguments in place, honoring single and double
+ * quotes and backslash escapes the way a shell would. Everything after an
+ * unquoted '#' at the start of a token is treated as a comment.
+ *
+ * @param line
+ *  The line to split, it is modified in place.
+ * @param argc
+ *  The number of arguments found, valid on success.
+ * @param argv
+ *  A NULL terminated array of arguments pointing into line, valid on success.
+ *  The caller must free the array, but not the arguments.
+ * @return
+ *  True on success, false otherwise.
+ */
+bool tpm2_util_split_args(char *line, int *argc, char ***argv);
+
+/**
+ * Makes room for one more element at the end of an array, doubling its
+ * capacity when full, so appending n elements costs O(n).
+ *
+ * @param array
+ *  The array to grow, updated on success.
+ * @param capacity
+ *  The number of elements the array has room for, updated on success.
+ * @param count
+ *  The number of elements in the array.
+ * @param size
+ *  The size of an element.
+ * @return
+ *  True on success, false on oom.
+ */
+bool tpm2_util_array_grow(void **array, size_t *capacity, size_t count,
+        size_t size);
+
+/* the most fields a manifest line has */
+#define TPM2_UTIL_MANIFEST_FIELDS_MAX 8
+
+/**
+ * Receives a line of a manifest for the entry it describes.
+ *
+ * @param entry
+ *  The entry, zeroed and appended to the entries, counted whatever the
+ *  callback returns so that freeing the entries frees what it stored. NULL
+ *  when the lines are not kept.
+ * @param line
+ *  The line, taken by the callback, the fields point into it.
+ * @param fields
+ *  The fields of the line.
+ * @param count
+ *  The number of fields, within the range given to tpm2_util_manifest_read().
+ * @param line_number
+ *  The number of the line in the manifest, from 1.
+ * @param userdata
+ *  The userdata given to tpm2_util_manifest_read().
+ * @return
+ *  True to read the next line, false to fail.
+ */
+typedef bool (*tpm2_util_manifest_line_fn)(void *entry, char *line,
+        char **fields, size_t count, size_t line_number, void *userdata);
+
+/**
+ * Reads the manifest of a bulk mode, one entry per line of whitespace separated
+ * fields. Empty lines and everything after a '#' are skipped. The manifest is
+ * opened with files_fopen().
+ *
+ * @param path
+ *  The manifest.
+ * @param min_fields
+ *  The fewest fields of a line.
+ * @param max_fields
+ *  The most fields of a line, up to TPM2_UTIL_MANIFEST_FIELDS_MAX.
+ * @param usage
+ *  The fields of a line, as logged for one outside of the range.
+ * @param entries
+ *  The array of entries to append to, grown as by tpm2_util_array_grow(), or
+ *  NULL to handle each line as it is read.
+ * @param count
+ *  The number of entries, updated as they are appended, unused without
+ *  entries.
+ * @param size
+ *  The size of an entry, unused without entries.
+ * @param line_fn
+ *  Called for every line with fields.
+ * @param userdata
+ *  Passed to line_fn.
+ * @return
+ *  True on success, false on error. The entries appended are kept either way.
+ */
+bool tpm2_util_manifest_read(const char *path, size_t min_fields,
+        size_t max_fields, const char *usage, void **entries, size_t *count,
+        size_t size, tpm2_util_manifest_line_fn line_fn, void *userdata);
+
 /**
  * Converts a PEM-encoded public key to its sha256 representation (fingerprint).
  * The resulting Base64-encoded fingerprint format is based on the SSH:
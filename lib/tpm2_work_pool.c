@@ -0,0 +1,285 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "log.h"
+#include "tpm2_work_pool.h"
+
+typedef struct work_slot work_slot;
+struct work_slot {
+    /* the number of the job plus one, once its result is in */
+    size_t ready;
+    bool result;
+};
+
+typedef struct work_pool work_pool;
+struct work_pool {
+    size_t count;
+    work_slot *slots;
+    size_t slot_count;
+    tpm2_work_fn work;
+    void *userdata;
+    /* changed atomically, without the lock */
+    size_t next;
+    size_t delivered;
+    bool is_stopped;
+    UINT32 sleepers;
+    /* only taken to sleep and to wake the sleepers */
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+};
+
+struct tpm2_work_worker {
+    work_pool *pool;
+    UINT32 index;
+    EVP_MD_CTX *md_ctx;
+    bool is_md_ctx_taken;
+    EVP_CIPHER_CTX *cipher_ctx;
+};
+
+/* the worker of the job the thread runs */
+static __thread tpm2_work_worker *current_worker;
+
+typedef bool (*pool_condition)(work_pool *pool, size_t index);
+
+/*
+ * The state is changed before the sleepers are counted and counted before it
+ * is checked, both sequentially consistent, so either the waker sees the
+ * sleeper or the sleeper sees the change. A sleeper holds the lock from its
+ * check until it waits, so a wakeup never falls in between.
+ */
+static void pool_wake(work_pool *pool) {
+
+    if (!__atomic_load_n(&pool->sleepers, __ATOMIC_SEQ_CST)) {
+        return;
+    }
+
+    pthread_mutex_lock(&pool->lock);
+    pthread_cond_broadcast(&pool->cond);
+    pthread_mutex_unlock(&pool->lock);
+}
+
+static void pool_wait(work_pool *pool, pool_condition condition,
+        size_t index) {
+
+    pthread_mutex_lock(&pool->lock);
+    __atomic_add_fetch(&pool->sleepers, 1, __ATOMIC_SEQ_CST);
+    while (!condition(pool, index)) {
+        pthread_cond_wait(&pool->cond, &pool->lock);
+    }
+    __atomic_sub_fetch(&pool->sleepers, 1, __ATOMIC_SEQ_CST);
+    pthread_mutex_unlock(&pool->lock);
+}
+
+static bool pool_is_ready(work_pool *pool, size_t index) {
+
+    const work_slot *slot = &pool->slots[index % pool->slot_count];
+
+    return __atomic_load_n(&slot->ready, __ATOMIC_SEQ_CST) == index + 1;
+}
+
+/* the slot of a job is free once the job a ring earlier was delivered */
+static bool pool_has_room(work_pool *pool, size_t index) {
+
+    return index < __atomic_load_n(&pool->delivered, __ATOMIC_SEQ_CST)
+            + pool->slot_count
+            || __atomic_load_n(&pool->is_stopped, __ATOMIC_SEQ_CST);
+}
+
+static void *worker_run(void *arg) {
+
+    tpm2_work_worker *worker = (tpm2_work_worker *) arg;
+    work_pool *pool = worker->pool;
+
+    current_worker = worker;
+
+    while (true) {
+        size_t index = __atomic_fetch_add(&pool->next, 1, __ATOMIC_RELAXED);
+        if (index >= pool->count) {
+            break;
+        }
+
+        if (!pool_has_room(pool, index)) {
+            pool_wait(pool, pool_has_room, index);
+        }
+
+        if (__atomic_load_n(&pool->is_stopped, __ATOMIC_SEQ_CST)) {
+            break;
+        }
+
+        work_slot *slot = &pool->slots[index % pool->slot_count];
+        slot->result = pool->work(worker, index, pool->userdata);
+        __atomic_store_n(&slot->ready, index + 1, __ATOMIC_SEQ_CST);
+
+        pool_wake(pool);
+    }
+
+    current_worker = NULL;
+
+    return NULL;
+}
+
+UINT32 tpm2_work_pool_workers(UINT32 jobs, size_t count) {
+
+    if (!jobs) {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        jobs = cpus > 0 ? cpus : 1;
+    }
+
+    return jobs < count ? jobs : count;
+}
+
+bool tpm2_work_pool_run(size_t count, UINT32 jobs, tpm2_work_fn work,
+        tpm2_work_deliver_fn deliver, void *userdata) {
+
+    if (!count) {
+        return true;
+    }
+
+    UINT32 worker_count = tpm2_work_pool_workers(jobs, count);
+
+    work_pool pool = {
+        .count = count,
+        .slot_count = worker_count * TPM2_WORK_POOL_SLOTS_PER_WORKER,
+        .work = work,
+        .userdata = userdata,
+    };
+
+    bool result = false;
+    tpm2_work_worker *workers = calloc(worker_count, sizeof(*workers));
+    pthread_t *threads = calloc(worker_count, sizeof(*threads));
+    pool.slots = calloc(pool.slot_count, sizeof(*pool.slots));
+    if (!workers || !threads || !pool.slots) {
+        LOG_ERR("oom");
+        goto out;
+    }
+
+    pthread_mutex_init(&pool.lock, NULL);
+    pthread_cond_init(&pool.cond, NULL);
+
+    /* a pool run by a job runs on its thread, the outer pool fills the CPUs */
+    tpm2_work_worker *caller = current_worker;
+
+    UINT32 started = 0;
+    UINT32 i;
+    for (i = 0; !caller && i < worker_count; i++) {
+        workers[i].pool = &pool;
+        workers[i].index = i;
+        int err = pthread_create(&threads[started], NULL, worker_run,
+                &workers[i]);
+        if (err) {
+            LOG_WARN("Could not start worker thread, error: %s",
+                    strerror(err));
+            break;
+        }
+        started++;
+    }
+
+    result = true;
+    size_t index;
+    for (index = 0; result && index < count; index++) {
+        bool job_result;
+        if (!started) {
+            /* without any thread, the jobs run before their delivery */
+            current_worker = &workers[0];
+            job_result = work(&workers[0], index, userdata);
+            current_worker = caller;
+        } else {
+            if (!pool_is_ready(&pool, index)) {
+                pool_wait(&pool, pool_is_ready, index);
+            }
+            job_result = pool.slots[index % pool.slot_count].result;
+        }
+
+        result = deliver(index, job_result, userdata);
+
+        __atomic_store_n(&pool.delivered, index + 1, __ATOMIC_SEQ_CST);
+        pool_wake(&pool);
+    }
+
+    if (!result) {
+        __atomic_store_n(&pool.is_stopped, true, __ATOMIC_SEQ_CST);
+        pool_wake(&pool);
+    }
+
+    for (i = 0; i < started; i++) {
+        pthread_join(threads[i], NULL);
+    }
+
+    pthread_cond_destroy(&pool.cond);
+    pthread_mutex_destroy(&pool.lock);
+
+    for (i = 0; i < worker_count; i++) {
+        EVP_MD_CTX_free(workers[i].md_ctx);
+        EVP_CIPHER_CTX_free(workers[i].cipher_ctx);
+    }
+
+out:
+    free(pool.slots);
+    free(threads);
+    free(workers);
+
+    return result;
+}
+
+UINT32 tpm2_work_worker_index(const tpm2_work_worker *worker) {
+
+    return worker->index;
+}
+
+tpm2_work_worker *tpm2_work_worker_current(void) {
+
+    return current_worker;
+}
+
+EVP_MD_CTX *tpm2_work_worker_md_ctx_take(tpm2_work_worker *worker) {
+
+    /* a job that hashes two things at once gets another context for one */
+    if (worker->is_md_ctx_taken) {
+        return NULL;
+    }
+
+    if (worker->md_ctx) {
+        EVP_MD_CTX_reset(worker->md_ctx);
+    } else {
+        worker->md_ctx = EVP_MD_CTX_new();
+        if (!worker->md_ctx) {
+            LOG_ERR("oom");
+            return NULL;
+        }
+    }
+
+    worker->is_md_ctx_taken = true;
+
+    return worker->md_ctx;
+}
+
+bool tpm2_work_worker_md_ctx_give(tpm2_work_worker *worker,
+        EVP_MD_CTX *mdctx) {
+
+    if (!worker->md_ctx || mdctx != worker->md_ctx) {
+        return false;
+    }
+
+    worker->is_md_ctx_taken = false;
+
+    return true;
+}
+
+EVP_CIPHER_CTX *tpm2_work_worker_cipher_ctx(tpm2_work_worker *worker) {
+
+    if (worker->cipher_ctx) {
+        EVP_CIPHER_CTX_reset(worker->cipher_ctx);
+        return worker->cipher_ctx;
+    }
+
+    worker->cipher_ctx = EVP_CIPHER_CTX_new();
+    if (!worker->cipher_ctx) {
+        LOG_ERR("oom");
+    }
+
+    return worker->cipher_ctx;
+}
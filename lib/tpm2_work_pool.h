@@ -0,0 +1,146 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+#ifndef LIB_TPM2_WORK_POOL_H_
+#define LIB_TPM2_WORK_POOL_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include <openssl/evp.h>
+
+#include <tss2/tss2_tpm2_types.h>
+
+/*
+ * A work pool runs the independent host side jobs of a bulk mode, ie the
+ * verification of the quotes of a manifest, on a pool of threads, while the
+ * calling thread gets the results one after the other in job order, so it
+ * can print them or send them to the TPM as soon as they are known.
+ *
+ * The jobs are numbered 0 to count - 1. A worker claims the next job with an
+ * atomic increment, so no lock is taken between jobs, and publishes its
+ * result into a bounded ring of slots. A worker does not run ahead of the
+ * delivery by more than the ring holds, so the memory of the results that
+ * wait for delivery is bounded however many jobs there are. A thread only
+ * sleeps on the lock of the pool when the job it waits for is not done yet,
+ * or when the ring is full.
+ *
+ * Every worker keeps an OpenSSL digest and cipher context that its jobs
+ * reuse, so a job does not allocate and free one per hash or encryption.
+ * tpm2_openssl_md_ctx_get() hands out the digest context of the worker of the
+ * calling thread, so the hashes of the lib take it without any lock.
+ */
+
+/* the slots of the ring per worker */
+#define TPM2_WORK_POOL_SLOTS_PER_WORKER 4
+
+typedef struct tpm2_work_worker tpm2_work_worker;
+
+/**
+ * Runs one job on a worker.
+ * @param worker
+ *  The worker running the job, for its index and its OpenSSL contexts.
+ * @param index
+ *  The number of the job.
+ * @param userdata
+ *  The userdata given to tpm2_work_pool_run().
+ * @return
+ *  The result of the job, passed on to the delivery.
+ */
+typedef bool (*tpm2_work_fn)(tpm2_work_worker *worker, size_t index,
+        void *userdata);
+
+/**
+ * Gets the result of one job, on the calling thread and in job order.
+ * @param index
+ *  The number of the job.
+ * @param result
+ *  The result of the job.
+ * @param userdata
+ *  The userdata given to tpm2_work_pool_run().
+ * @return
+ *  True to go on, false to stop the pool, ie on an output error.
+ */
+typedef bool (*tpm2_work_deliver_fn)(size_t index, bool result,
+        void *userdata);
+
+/**
+ * The number of workers a pool runs.
+ * @param jobs
+ *  The number of threads asked for, 0 for the number of online CPUs.
+ * @param count
+ *  The number of jobs.
+ * @return
+ *  The number of workers, at most count, so per worker state can be
+ *  allocated before tpm2_work_pool_run().
+ */
+UINT32 tpm2_work_pool_workers(UINT32 jobs, size_t count);
+
+/**
+ * Runs jobs on a pool of threads and delivers their results in job order.
+ * Without any thread, and when called from a job of another pool, the jobs
+ * are run on the calling thread.
+ * @param count
+ *  The number of jobs.
+ * @param jobs
+ *  The number of threads, 0 for the number of online CPUs.
+ * @param work
+ *  Runs a job, on any worker thread.
+ * @param deliver
+ *  Gets the result of a job, on the calling thread.
+ * @param userdata
+ *  Passed to work and deliver.
+ * @return
+ *  True when every result was delivered, false when the delivery stopped the
+ *  pool or the pool could not be set up.
+ */
+bool tpm2_work_pool_run(size_t count, UINT32 jobs, tpm2_work_fn work,
+        tpm2_work_deliver_fn deliver, void *userdata);
+
+/**
+ * The index of a worker, below tpm2_work_pool_workers(), for the per worker
+ * state of the caller.
+ * @param worker
+ *  The worker.
+ * @return
+ *  The index of the worker.
+ */
+UINT32 tpm2_work_worker_index(const tpm2_work_worker *worker);
+
+/**
+ * The worker running the job of the calling thread.
+ * @return
+ *  The worker or NULL outside of a job.
+ */
+tpm2_work_worker *tpm2_work_worker_current(void);
+
+/**
+ * Takes the digest context of a worker, for EVP_DigestInit_ex().
+ * @param worker
+ *  The worker.
+ * @return
+ *  The context, owned by the worker, NULL when it is taken already or on oom.
+ */
+EVP_MD_CTX *tpm2_work_worker_md_ctx_take(tpm2_work_worker *worker);
+
+/**
+ * Gives back a digest context got with tpm2_work_worker_md_ctx_take().
+ * @param worker
+ *  The worker.
+ * @param mdctx
+ *  The digest context.
+ * @return
+ *  True when mdctx is the context of the worker, false for any other one.
+ */
+bool tpm2_work_worker_md_ctx_give(tpm2_work_worker *worker,
+        EVP_MD_CTX *mdctx);
+
+/**
+ * The cipher context of a worker, reset for EVP_CipherInit_ex().
+ * @param worker
+ *  The worker.
+ * @return
+ *  The context, owned by the worker, NULL on oom.
+ */
+EVP_CIPHER_CTX *tpm2_work_worker_cipher_ctx(tpm2_work_worker *worker);
+
+#endif /* LIB_TPM2_WORK_POOL_H_ */
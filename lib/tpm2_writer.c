@@ -0,0 +1,446 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+#include <inttypes.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "log.h"
+#include "tpm2_hex.h"
+#include "tpm2_tool_output.h"
+#include "tpm2_writer.h"
+
+/* deeper than anything the tools output */
+#define WRITER_DEPTH_MAX 16
+
+/* the scalars of the tools are short, the buffer grows for longer ones */
+#define WRITER_BUFFER_SIZE 256
+
+typedef enum writer_kind writer_kind;
+enum writer_kind {
+    writer_kind_document,
+    writer_kind_map,
+    writer_kind_list,
+    writer_kind_flow,
+};
+
+typedef struct writer_level writer_level;
+struct writer_level {
+    writer_kind kind;
+    /* the YAML column of the entries */
+    size_t column;
+    /* the YAML column of the scalars relative to the keys, 0 for none */
+    size_t align;
+    size_t count;
+    /* the first entry of a list item follows the "- " of the item */
+    bool is_item;
+    /* the newline after the key of a map or list, written with an entry */
+    bool is_pending;
+};
+
+static struct {
+    tpm2_writer_format format;
+    writer_level levels[WRITER_DEPTH_MAX];
+    size_t depth;
+    /* the containers started past WRITER_DEPTH_MAX, which are dropped */
+    size_t overflow;
+    char *buffer;
+    size_t buffer_size;
+} writer;
+
+static void writer_put(const char *data, size_t len) {
+
+    if (output_enabled && len) {
+        fwrite(data, 1, len, stdout);
+    }
+}
+
+static void writer_puts(const char *s) {
+
+    writer_put(s, strlen(s));
+}
+
+static void writer_spaces(size_t count) {
+
+    static const char spaces[] = "                                ";
+
+    while (count) {
+        size_t len = count < sizeof(spaces) - 1 ? count : sizeof(spaces) - 1;
+        writer_put(spaces, len);
+        count -= len;
+    }
+}
+
+static void writer_json_string(const char *s, size_t len) {
+
+    writer_put("\"", 1);
+
+    size_t start = 0;
+    size_t i;
+    for (i = 0; i < len; i++) {
+        unsigned char c = s[i];
+        if (c != '"' && c != '\\' && c >= 0x20) {
+            continue;
+        }
+
+        writer_put(&s[start], i - start);
+        start = i + 1;
+
+        char escape[7];
+        switch (c) {
+        case '"':
+        case '\\':
+            snprintf(escape, sizeof(escape), "\\%c", c);
+            break;
+        case '\n':
+            snprintf(escape, sizeof(escape), "\\n");
+            break;
+        case '\r':
+            snprintf(escape, sizeof(escape), "\\r");
+            break;
+        case '\t':
+            snprintf(escape, sizeof(escape), "\\t");
+            break;
+        default:
+            snprintf(escape, sizeof(escape), "\\u%04x", c);
+        }
+        writer_puts(escape);
+    }
+    writer_put(&s[start], len - start);
+
+    writer_put("\"", 1);
+}
+
+static bool writer_reserve(size_t size) {
+
+    if (size <= writer.buffer_size) {
+        return true;
+    }
+
+    size_t buffer_size = writer.buffer_size ?
+            writer.buffer_size : WRITER_BUFFER_SIZE;
+    while (buffer_size < size) {
+        buffer_size *= 2;
+    }
+
+    char *buffer = realloc(writer.buffer, buffer_size);
+    if (!buffer) {
+        LOG_ERR("oom");
+        return false;
+    }
+
+    writer.buffer = buffer;
+    writer.buffer_size = buffer_size;
+
+    return true;
+}
+
+static writer_level *writer_top(void) {
+
+    return &writer.levels[writer.depth];
+}
+
+static void writer_push(writer_kind kind, size_t column, bool is_item,
+        bool is_pending) {
+
+    if (writer.overflow || writer.depth + 1 == WRITER_DEPTH_MAX) {
+        LOG_ERR("Output nested more than %u levels deep", WRITER_DEPTH_MAX);
+        writer.overflow++;
+        return;
+    }
+
+    if (writer.format == tpm2_writer_format_json) {
+        writer_put(kind == writer_kind_map ? "{" : "[", 1);
+    }
+
+    writer_level *level = &writer.levels[++writer.depth];
+    memset(level, 0, sizeof(*level));
+    level->kind = kind;
+    level->column = column;
+    level->is_item = is_item;
+    level->is_pending = is_pending;
+}
+
+/*
+ * Starts an entry of the current container, up to where its value goes:
+ * the separator and key in JSON, the indentation, the dash of a list item
+ * and the key in YAML.
+ */
+static writer_level *writer_begin(const char *key, bool is_scalar) {
+
+    writer_level *top = writer_top();
+    if (top->kind == writer_kind_document) {
+        top->count++;
+        writer_push(writer_kind_map, 0, false, false);
+        top = writer_top();
+    }
+
+    bool is_first = !top->count++;
+
+    if (writer.format == tpm2_writer_format_json) {
+        if (!is_first) {
+            writer_put(",", 1);
+        }
+        if (top->kind == writer_kind_map) {
+            /* the spaces aligning the YAML are no part of the key */
+            size_t len = strlen(key ? key : "");
+            while (len && key[len - 1] == ' ') {
+                len--;
+            }
+            writer_json_string(key ? key : "", len);
+            writer_put(":", 1);
+        }
+        return top;
+    }
+
+    if (top->is_pending) {
+        writer_put("\n", 1);
+        top->is_pending = false;
+    }
+
+    switch (top->kind) {
+    case writer_kind_map:
+        if (top->is_item && is_first) {
+            writer_spaces(top->column - 2);
+            writer_put("- ", 2);
+        } else {
+            writer_spaces(top->column);
+        }
+        writer_puts(key ? key : "");
+        writer_put(":", 1);
+        break;
+    case writer_kind_list:
+        /* the dash of a map or list item comes with its first entry */
+        if (is_scalar) {
+            writer_spaces(top->column);
+            writer_put("- ", 2);
+        }
+        break;
+    case writer_kind_flow:
+        writer_puts(is_first ? " " : ", ");
+        break;
+    default:
+        break;
+    }
+
+    return top;
+}
+
+static void writer_container_start(const char *key, writer_kind kind) {
+
+    if (writer.overflow) {
+        writer.overflow++;
+        return;
+    }
+
+    writer_level *top = writer_top();
+
+    /* the top level itself */
+    if (top->kind == writer_kind_document && !key
+            && kind != writer_kind_flow) {
+        top->count++;
+        writer_push(kind, kind == writer_kind_map ? 2 : 0, false, false);
+        return;
+    }
+
+    top = writer_begin(key, kind == writer_kind_flow);
+
+    if (writer.format == tpm2_writer_format_json) {
+        writer_push(kind, 0, false, false);
+        return;
+    }
+
+    switch (top->kind) {
+    case writer_kind_map:
+        if (kind == writer_kind_flow) {
+            writer_put(" [", 2);
+        }
+        writer_push(kind, top->column + 2, false, kind != writer_kind_flow);
+        break;
+    case writer_kind_list:
+        if (kind == writer_kind_flow) {
+            writer_put("[", 1);
+        }
+        writer_push(kind, top->column + 2, kind != writer_kind_flow, false);
+        break;
+    default:
+        /* no containers in a flow list */
+        writer_push(kind, top->column, false, false);
+        break;
+    }
+}
+
+void tpm2_writer_set_format(tpm2_writer_format format) {
+
+    writer.format = format;
+}
+
+tpm2_writer_format tpm2_writer_get_format(void) {
+
+    return writer.format;
+}
+
+void tpm2_writer_map_start(const char *key) {
+
+    writer_container_start(key, writer_kind_map);
+}
+
+void tpm2_writer_list_start(const char *key) {
+
+    writer_container_start(key, writer_kind_list);
+}
+
+void tpm2_writer_flow_start(const char *key) {
+
+    writer_container_start(key, writer_kind_flow);
+}
+
+void tpm2_writer_end(void) {
+
+    if (writer.overflow) {
+        writer.overflow--;
+        return;
+    }
+
+    if (!writer.depth) {
+        return;
+    }
+
+    writer_level *top = writer_top();
+
+    if (writer.format == tpm2_writer_format_json) {
+        writer_put(top->kind == writer_kind_map ? "}" : "]", 1);
+    } else if (top->kind == writer_kind_flow) {
+        writer_puts(" ]\n");
+    } else if (top->is_pending) {
+        writer_puts(top->kind == writer_kind_map ? " {}\n" : " []\n");
+    } else if (top->is_item && !top->count) {
+        writer_spaces(top->column - 2);
+        writer_puts(top->kind == writer_kind_map ? "- {}\n" : "- []\n");
+    }
+
+    writer.depth--;
+}
+
+void tpm2_writer_align(size_t column) {
+
+    writer_top()->align = column;
+}
+
+static void writer_scalar(const char *key, tpm2_writer_type type,
+        const char *text, size_t len) {
+
+    if (writer.overflow) {
+        return;
+    }
+
+    writer_level *top = writer_begin(key, true);
+
+    if (writer.format == tpm2_writer_format_json) {
+        switch (type) {
+        case tpm2_writer_type_number:
+            if (len > 2 && text[0] == '0' && (text[1] == 'x' || text[1] == 'X')) {
+                char number[24];
+                snprintf(number, sizeof(number), "%" PRIu64,
+                        (uint64_t) strtoull(text, NULL, 16));
+                writer_puts(number);
+            } else {
+                writer_put(text, len);
+            }
+            break;
+        case tpm2_writer_type_bool: {
+            bool is_false = !len || !strcmp(text, "0") || !strcmp(text, "no")
+                    || !strcmp(text, "false");
+            writer_puts(is_false ? "false" : "true");
+        }
+            break;
+        default:
+            writer_json_string(text, len);
+        }
+        return;
+    }
+
+    if (top->kind == writer_kind_map) {
+        size_t key_len = strlen(key ? key : "") + 1;
+        writer_spaces(top->align > key_len ? top->align - key_len : 1);
+    }
+
+    if (type == tpm2_writer_type_quoted) {
+        writer_put("\"", 1);
+        writer_put(text, len);
+        writer_put("\"", 1);
+    } else {
+        writer_put(text, len);
+    }
+
+    if (top->kind != writer_kind_flow) {
+        writer_put("\n", 1);
+    }
+}
+
+void tpm2_writer_value(const char *key, tpm2_writer_type type,
+        const char *fmt, ...) {
+
+    va_list ap;
+    va_start(ap, fmt);
+    va_list copy;
+    va_copy(copy, ap);
+
+    int len = vsnprintf(writer.buffer, writer.buffer_size, fmt, ap);
+    if (len >= 0 && (size_t) len >= writer.buffer_size) {
+        len = writer_reserve(len + 1) ?
+                vsnprintf(writer.buffer, writer.buffer_size, fmt, copy) : -1;
+    }
+
+    va_end(copy);
+    va_end(ap);
+
+    if (len < 0) {
+        LOG_ERR("Could not format output value");
+        return;
+    }
+
+    writer_scalar(key, type, writer.buffer ? writer.buffer : "", len);
+}
+
+void tpm2_writer_hex(const char *key, const char *prefix, const BYTE *data,
+        size_t len, bool is_upper) {
+
+    size_t prefix_len = prefix ? strlen(prefix) : 0;
+    if (!writer_reserve(prefix_len + TPM2_HEX_SIZE(len))) {
+        return;
+    }
+
+    if (prefix_len) {
+        memcpy(writer.buffer, prefix, prefix_len);
+    }
+    size_t hex_len = tpm2_hex_encode(data, len, &writer.buffer[prefix_len],
+            is_upper);
+
+    writer_scalar(key, tpm2_writer_type_string, writer.buffer,
+            prefix_len + hex_len);
+}
+
+void tpm2_writer_document_start(void) {
+
+    tpm2_writer_document_end();
+
+    if (writer.format == tpm2_writer_format_yaml) {
+        writer_puts("---\n");
+    }
+}
+
+void tpm2_writer_document_end(void) {
+
+    while (writer.overflow || writer.depth) {
+        tpm2_writer_end();
+    }
+
+    writer_level *document = &writer.levels[0];
+    if (writer.format == tpm2_writer_format_json && document->count) {
+        writer_put("\n", 1);
+    }
+
+    memset(document, 0, sizeof(*document));
+}
@@ -0,0 +1,153 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+#ifndef LIB_TPM2_WRITER_H_
+#define LIB_TPM2_WRITER_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include <tss2/tss2_tpm2_types.h>
+
+/*
+ * A streaming writer of the structured output of the tools, as YAML or as
+ * compact JSON. The output is a tree of maps, lists and flow lists, ie the
+ * "[ 0, 1 ]" of a PCR selection, with scalars for leaves, written to stdout
+ * as it is built and respecting the -Q option. The YAML is what the tools
+ * have always output, the JSON is a single line per document.
+ *
+ * The entries of the top level need no container of their own, the first one
+ * with a key opens the top level map. A list started with no key at the top
+ * level is the top level itself, as is a map started with no key, whose
+ * entries are indented in YAML.
+ */
+typedef enum tpm2_writer_format tpm2_writer_format;
+enum tpm2_writer_format {
+    tpm2_writer_format_yaml,
+    tpm2_writer_format_json,
+};
+
+/*
+ * How a scalar written as text maps to JSON. The YAML is the text as is,
+ * but for quoted strings, which are put in double quotes.
+ */
+typedef enum tpm2_writer_type tpm2_writer_type;
+enum tpm2_writer_type {
+    /* a JSON string */
+    tpm2_writer_type_string,
+    /* a JSON string, in double quotes in YAML */
+    tpm2_writer_type_quoted,
+    /* a JSON number, a "0x" prefixed hex number is converted to decimal */
+    tpm2_writer_type_number,
+    /* false for "0", "no", "false" and "", true otherwise */
+    tpm2_writer_type_bool,
+};
+
+/**
+ * Selects the format of the output, YAML unless the --json option is given.
+ * @param format
+ *  The format.
+ */
+void tpm2_writer_set_format(tpm2_writer_format format);
+
+/**
+ * @return
+ *  The format of the output.
+ */
+tpm2_writer_format tpm2_writer_get_format(void);
+
+/**
+ * Starts a map.
+ * @param key
+ *  The key of the map in the containing map, NULL for an item of a list or
+ *  the top level map.
+ */
+void tpm2_writer_map_start(const char *key);
+
+/**
+ * Starts a list, each item on a line of its own in YAML.
+ * @param key
+ *  The key of the list in the containing map, NULL for an item of a list or
+ *  the top level list.
+ */
+void tpm2_writer_list_start(const char *key);
+
+/**
+ * Starts a list of scalars written on the line of its key in YAML.
+ * @param key
+ *  The key of the list in the containing map, NULL for an item of a list.
+ */
+void tpm2_writer_flow_start(const char *key);
+
+/**
+ * Ends the last map or list started. An empty one is "{}" or "[]" in YAML
+ * as well.
+ */
+void tpm2_writer_end(void);
+
+/**
+ * Aligns the scalars of the current map written from now on to a column in
+ * YAML, ie the column of the longest key and its colon plus one.
+ * @param column
+ *  The column relative to the keys, 0 for a single space after the colon.
+ */
+void tpm2_writer_align(size_t column);
+
+/**
+ * Writes a scalar. The text is formatted into a buffer kept for the next
+ * scalars.
+ * @param key
+ *  The key in the containing map, which may end in spaces that align the
+ *  colons in YAML and are left out of the JSON, NULL for an item of a list.
+ * @param type
+ *  How the text maps to JSON.
+ * @param fmt
+ *  The format of the text, ala printf.
+ * @param ...
+ *  The varargs, just like printf.
+ */
+void tpm2_writer_value(const char *key, tpm2_writer_type type,
+        const char *fmt, ...) __attribute__((format(printf, 3, 4)));
+
+#define tpm2_writer_string(key, fmt, ...) \
+    tpm2_writer_value(key, tpm2_writer_type_string, fmt, ##__VA_ARGS__)
+
+#define tpm2_writer_quoted(key, fmt, ...) \
+    tpm2_writer_value(key, tpm2_writer_type_quoted, fmt, ##__VA_ARGS__)
+
+#define tpm2_writer_number(key, fmt, ...) \
+    tpm2_writer_value(key, tpm2_writer_type_number, fmt, ##__VA_ARGS__)
+
+/* a flag, "1" or "0" in YAML */
+#define tpm2_writer_flag(key, value) \
+    tpm2_writer_value(key, tpm2_writer_type_bool, "%s", (value) ? "1" : "0")
+
+/**
+ * Writes bytes as a hex string scalar, encoded into the buffer of the
+ * scalars.
+ * @param key
+ *  The key, as for tpm2_writer_value().
+ * @param prefix
+ *  Written ahead of the digits, ie "0x", or NULL.
+ * @param data
+ *  The bytes.
+ * @param len
+ *  The number of bytes.
+ * @param is_upper
+ *  True for upper case digits, false for lower case ones.
+ */
+void tpm2_writer_hex(const char *key, const char *prefix, const BYTE *data,
+        size_t len, bool is_upper);
+
+/**
+ * Starts a new document, after a "---" line in YAML and as a line of its own
+ * in JSON.
+ */
+void tpm2_writer_document_start(void);
+
+/**
+ * Ends the maps and lists still open and the document, called when a tool is
+ * done.
+ */
+void tpm2_writer_document_end(void);
+
+#endif /* LIB_TPM2_WRITER_H_ */
@@ -0,0 +1,497 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+#include <limits.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <setjmp.h>
+#include <cmocka.h>
+
+#include "pcr.h"
+#include "tpm2_alg_util.h"
+#include "tpm2_eventlog.h"
+#include "tpm2_eventlog_yaml.h"
+#include "tpm2_kdfa.h"
+#include "tpm2_openssl.h"
+#include "tpm2_util.h"
+
+/*
+ * Microbenchmarks of the library code the tools spend their time in, see
+ * test/benchmark/README.md. Every benchmark checks its result once, so a
+ * broken build fails instead of reporting the time of an error path, and
+ * then runs the code in a loop. The results are written as YAML to the
+ * original standard output, the output of the YAML emitters goes to
+ * /dev/null.
+ */
+
+#define BENCH_ITERATIONS_DEFAULT 1000
+
+/* the synthetic event log repeats the events of a fixture up to this size */
+#define BENCH_EVENTLOG_SIZE (4 * 1024 * 1024)
+
+static const char *fixtures = "test/integration/fixtures";
+static unsigned iterations = BENCH_ITERATIONS_DEFAULT;
+static FILE *report;
+
+typedef struct bench bench;
+struct bench {
+    const char *name;
+    unsigned iterations;
+    size_t bytes;
+    struct timespec start;
+};
+
+static void bench_start(bench *b, const char *name, unsigned n, size_t bytes) {
+
+    b->name = name;
+    b->iterations = n ? n : 1;
+    b->bytes = bytes;
+    clock_gettime(CLOCK_MONOTONIC, &b->start);
+}
+
+static void bench_stop(bench *b) {
+
+    struct timespec end;
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    double ns = (end.tv_sec - b->start.tv_sec) * 1e9
+            + (end.tv_nsec - b->start.tv_nsec);
+    double ns_per_op = ns / b->iterations;
+
+    fprintf(report, "- name: %s\n", b->name);
+    fprintf(report, "  iterations: %u\n", b->iterations);
+    fprintf(report, "  ns-per-op: %.1f\n", ns_per_op);
+    if (b->bytes) {
+        fprintf(report, "  mib-per-s: %.2f\n",
+                b->bytes / ns_per_op * 1e9 / (1024 * 1024));
+    }
+    fflush(report);
+}
+
+typedef struct fixture fixture;
+struct fixture {
+    BYTE *data;
+    size_t size;
+};
+
+static void fixture_load(const char *name, fixture *f) {
+
+    char path[PATH_MAX];
+    int len = snprintf(path, sizeof(path), "%s/%s", fixtures, name);
+    assert_true(len > 0 && (size_t) len < sizeof(path));
+
+    FILE *file = fopen(path, "rb");
+    if (!file) {
+        fail_msg("Could not open fixture \"%s\"", path);
+    }
+
+    assert_int_equal(fseek(file, 0, SEEK_END), 0);
+    long size = ftell(file);
+    assert_true(size > 0);
+    rewind(file);
+
+    f->data = malloc(size);
+    assert_non_null(f->data);
+    f->size = fread(f->data, 1, size, file);
+    fclose(file);
+    assert_int_equal(f->size, size);
+}
+
+static void fixture_free(fixture *f) {
+
+    free(f->data);
+    f->data = NULL;
+    f->size = 0;
+}
+
+/* a log of the events of the fixture repeated up to BENCH_EVENTLOG_SIZE */
+static void eventlog_synthesize(const fixture *f, fixture *large) {
+
+    TCG_EVENT_HEADER2 *next = NULL;
+    assert_true(specid_event((TCG_EVENT const *) f->data, f->size, &next));
+
+    size_t header_size = (BYTE *) next - f->data;
+    size_t events_size = f->size - header_size;
+    assert_true(events_size > 0);
+
+    size_t count = (BENCH_EVENTLOG_SIZE - header_size) / events_size;
+    large->size = header_size + count * events_size;
+    large->data = malloc(large->size);
+    assert_non_null(large->data);
+
+    memcpy(large->data, f->data, header_size);
+    size_t i;
+    for (i = 0; i < count; i++) {
+        memcpy(&large->data[header_size + i * events_size],
+                &f->data[header_size], events_size);
+    }
+}
+
+static void bench_parse_eventlog_one(const char *name, const fixture *f,
+        unsigned n) {
+
+    tpm2_eventlog_context ctx = { 0 };
+    assert_true(parse_eventlog(&ctx, f->data, f->size));
+
+    bench b;
+    bench_start(&b, name, n, f->size);
+    unsigned i;
+    for (i = 0; i < b.iterations; i++) {
+        memset(&ctx, 0, sizeof(ctx));
+        parse_eventlog(&ctx, f->data, f->size);
+    }
+    bench_stop(&b);
+}
+
+static void bench_parse_eventlog(void **state) {
+    UNUSED(state);
+
+    static const char *logs[] = {
+        "event-arch-linux.bin",
+        "event-gce-ubuntu-2104-log.bin",
+        "specid-vendordata.bin",
+    };
+
+    fixture f;
+    size_t i;
+    for (i = 0; i < ARRAY_LEN(logs); i++) {
+        char name[64];
+        snprintf(name, sizeof(name), "parse_eventlog/%s", logs[i]);
+
+        fixture_load(logs[i], &f);
+        bench_parse_eventlog_one(name, &f, iterations);
+        fixture_free(&f);
+    }
+
+    fixture large;
+    fixture_load("event-arch-linux.bin", &f);
+    eventlog_synthesize(&f, &large);
+    bench_parse_eventlog_one("parse_eventlog/synthetic-4mib", &large,
+            iterations / 100);
+    fixture_free(&large);
+    fixture_free(&f);
+}
+
+static void bench_yaml_eventlog_one(const char *name, const fixture *f,
+        unsigned n) {
+
+    assert_true(yaml_eventlog(f->data, f->size, 2));
+
+    bench b;
+    bench_start(&b, name, n, f->size);
+    unsigned i;
+    for (i = 0; i < b.iterations; i++) {
+        yaml_eventlog(f->data, f->size, 2);
+    }
+    fflush(stdout);
+    bench_stop(&b);
+}
+
+static void bench_yaml_eventlog(void **state) {
+    UNUSED(state);
+
+    static const char *logs[] = {
+        "event-arch-linux.bin",
+        "event-gce-ubuntu-2104-log.bin",
+        "event-uefivar.bin",
+    };
+
+    fixture f;
+    size_t i;
+    for (i = 0; i < ARRAY_LEN(logs); i++) {
+        char name[64];
+        snprintf(name, sizeof(name), "yaml_eventlog/%s", logs[i]);
+
+        fixture_load(logs[i], &f);
+        bench_yaml_eventlog_one(name, &f, iterations / 10);
+        fixture_free(&f);
+    }
+
+    fixture large;
+    fixture_load("event-arch-linux.bin", &f);
+    eventlog_synthesize(&f, &large);
+    bench_yaml_eventlog_one("yaml_eventlog/synthetic-4mib", &large,
+            iterations / 1000);
+    fixture_free(&large);
+    fixture_free(&f);
+}
+
+static void bench_pcr_parse_selections(void **state) {
+    UNUSED(state);
+
+    static const struct {
+        const char *name;
+        const char *arg;
+    } selections[] = {
+        { "pcr_parse_selections/short", "sha256:0,1,2,3" },
+        { "pcr_parse_selections/banks", "sha1:all+sha256:all+sha384:all" },
+        { "pcr_parse_selections/long",
+            "sha1:0,1,2,3,4,5,6,7,8,9,10,11,12,13,14,15,16,17,18,19,20,21,22,23"
+            "+sha256:0,1,2,3,4,5,6,7,8,9,10,11,12,13,14,15,16,17,18,19,20,21,"
+            "22,23+sha384:0,1,2,3,4,5,6,7,8,9,10,11,12,13,14,15,16,17,18,19,"
+            "20,21,22,23+sha512:0,1,2,3,4,5,6,7,8,9,10,11,12,13,14,15,16,17,"
+            "18,19,20,21,22,23" },
+    };
+
+    size_t i;
+    for (i = 0; i < ARRAY_LEN(selections); i++) {
+        TPML_PCR_SELECTION pcr_selections;
+        assert_true(pcr_parse_selections(selections[i].arg, &pcr_selections));
+
+        bench b;
+        bench_start(&b, selections[i].name, iterations * 100, 0);
+        unsigned j;
+        for (j = 0; j < b.iterations; j++) {
+            pcr_parse_selections(selections[i].arg, &pcr_selections);
+        }
+        bench_stop(&b);
+    }
+}
+
+static void bench_tpm2_alg_util_handle_ext_alg(void **state) {
+    UNUSED(state);
+
+    static const struct {
+        const char *name;
+        const char *spec;
+    } specs[] = {
+        { "tpm2_alg_util_handle_ext_alg/rsa", "rsa2048:aes128cfb" },
+        { "tpm2_alg_util_handle_ext_alg/rsa-scheme", "rsa2048:rsassa-sha256" },
+        { "tpm2_alg_util_handle_ext_alg/ecc", "ecc256:ecdsa-sha256:aes256cfb" },
+        { "tpm2_alg_util_handle_ext_alg/symcipher", "aes256cfb" },
+    };
+
+    size_t i;
+    for (i = 0; i < ARRAY_LEN(specs); i++) {
+        TPM2B_PUBLIC public = { 0 };
+        assert_true(tpm2_alg_util_handle_ext_alg(specs[i].spec, &public));
+
+        bench b;
+        bench_start(&b, specs[i].name, iterations * 100, 0);
+        unsigned j;
+        for (j = 0; j < b.iterations; j++) {
+            memset(&public, 0, sizeof(public));
+            tpm2_alg_util_handle_ext_alg(specs[i].spec, &public);
+        }
+        bench_stop(&b);
+    }
+}
+
+static void bench_tpm2_util_hex_to_byte_structure(void **state) {
+    UNUSED(state);
+
+    static const size_t sizes[] = {
+        TPM2_SHA256_DIGEST_SIZE,
+        TPM2_MAX_DIGEST_BUFFER,
+    };
+
+    size_t i;
+    for (i = 0; i < ARRAY_LEN(sizes); i++) {
+        char hex[2 * TPM2_MAX_DIGEST_BUFFER + 1];
+        size_t j;
+        for (j = 0; j < sizes[i]; j++) {
+            snprintf(&hex[2 * j], 3, "%02x", (unsigned) ((j * 37) & 0xff));
+        }
+
+        TPM2B_MAX_BUFFER buffer;
+        buffer.size = sizeof(buffer.buffer);
+        assert_int_equal(tpm2_util_hex_to_byte_structure(hex, &buffer.size,
+                buffer.buffer), 0);
+        assert_int_equal(buffer.size, sizes[i]);
+        assert_int_equal(buffer.buffer[1], 37);
+
+        char name[64];
+        snprintf(name, sizeof(name), "tpm2_util_hex_to_byte_structure/%zu",
+                sizes[i]);
+
+        bench b;
+        bench_start(&b, name, iterations * 10, sizes[i]);
+        for (j = 0; j < b.iterations; j++) {
+            buffer.size = sizeof(buffer.buffer);
+            tpm2_util_hex_to_byte_structure(hex, &buffer.size, buffer.buffer);
+        }
+        bench_stop(&b);
+    }
+}
+
+/* the PCR values of a quote of all PCRs of the selected banks */
+static void pcrs_init(const TPML_PCR_SELECTION *pcr_select, tpm2_pcrs *pcrs) {
+
+    memset(pcrs, 0, sizeof(*pcrs));
+
+    TPML_DIGEST *values = NULL;
+    UINT32 i;
+    for (i = 0; i < pcr_select->count; i++) {
+        UINT16 size = tpm2_alg_util_get_hash_size(
+                pcr_select->pcrSelections[i].hash);
+        unsigned pcr_id;
+        for (pcr_id = 0;
+                pcr_id < pcr_select->pcrSelections[i].sizeofSelect * 8u;
+                pcr_id++) {
+            if (!tpm2_util_is_pcr_select_bit_set(&pcr_select->pcrSelections[i],
+                    pcr_id)) {
+                continue;
+            }
+
+            if (!values || values->count == ARRAY_LEN(values->digests)) {
+                values = pcr_pcrs_append(pcrs);
+                assert_non_null(values);
+            }
+
+            TPM2B_DIGEST *digest = &values->digests[values->count++];
+            digest->size = size;
+            memset(digest->buffer, pcr_id, size);
+        }
+    }
+}
+
+static void bench_tpm2_openssl_hash_pcr_banks(void **state) {
+    UNUSED(state);
+
+    static const struct {
+        const char *name;
+        const char *arg;
+    } selections[] = {
+        { "tpm2_openssl_hash_pcr_banks/sha256", "sha256:0,1,2,3,4,5,6,7" },
+        { "tpm2_openssl_hash_pcr_banks/all-banks",
+            "sha1:all+sha256:all+sha384:all+sha512:all" },
+    };
+
+    size_t i;
+    for (i = 0; i < ARRAY_LEN(selections); i++) {
+        TPML_PCR_SELECTION pcr_select;
+        assert_true(pcr_parse_selections(selections[i].arg, &pcr_select));
+
+        tpm2_pcrs pcrs;
+        pcrs_init(&pcr_select, &pcrs);
+
+        TPM2B_DIGEST digest = { .size = sizeof(digest.buffer) };
+        assert_true(tpm2_openssl_hash_pcr_banks(TPM2_ALG_SHA256, &pcr_select,
+                &pcrs, &digest));
+        assert_int_equal(digest.size, TPM2_SHA256_DIGEST_SIZE);
+
+        bench b;
+        bench_start(&b, selections[i].name, iterations * 10, 0);
+        unsigned j;
+        for (j = 0; j < b.iterations; j++) {
+            tpm2_openssl_hash_pcr_banks(TPM2_ALG_SHA256, &pcr_select, &pcrs,
+                    &digest);
+        }
+        bench_stop(&b);
+
+        pcr_pcrs_free(&pcrs);
+    }
+}
+
+static void bench_tpm2_kdfa(void **state) {
+    UNUSED(state);
+
+    TPM2B_DIGEST key = { .size = TPM2_SHA256_DIGEST_SIZE };
+    memset(key.buffer, 0x5a, key.size);
+    TPM2B_DIGEST context_u = { .size = TPM2_SHA256_DIGEST_SIZE };
+    memset(context_u.buffer, 0x11, context_u.size);
+    TPM2B_DIGEST context_v = { .size = TPM2_SHA256_DIGEST_SIZE };
+    memset(context_v.buffer, 0x22, context_v.size);
+
+    static const UINT16 bits[] = { 256, 8 * TPM2_MAX_DIGEST_BUFFER };
+
+    tpm2_kdfa_ctx *ctx = tpm2_kdfa_ctx_new();
+    assert_non_null(ctx);
+    assert_int_equal(tpm2_kdfa_ctx_init(ctx, TPM2_ALG_SHA256, (TPM2B *) &key),
+            TPM2_RC_SUCCESS);
+
+    size_t i;
+    for (i = 0; i < ARRAY_LEN(bits); i++) {
+        TPM2B_MAX_BUFFER result;
+        TSS2_RC rval = tpm2_kdfa(TPM2_ALG_SHA256, (TPM2B *) &key, "STORAGE",
+                (TPM2B *) &context_u, (TPM2B *) &context_v, bits[i], &result);
+        assert_int_equal(rval, TPM2_RC_SUCCESS);
+        assert_int_equal(result.size, bits[i] / 8);
+
+        char name[64];
+        snprintf(name, sizeof(name), "tpm2_kdfa/%u", bits[i]);
+
+        bench b;
+        bench_start(&b, name, iterations * 10, bits[i] / 8);
+        unsigned j;
+        for (j = 0; j < b.iterations; j++) {
+            tpm2_kdfa(TPM2_ALG_SHA256, (TPM2B *) &key, "STORAGE",
+                    (TPM2B *) &context_u, (TPM2B *) &context_v, bits[i],
+                    &result);
+        }
+        bench_stop(&b);
+
+        /* the keyed context skips the HMAC key setup of every derivation */
+        snprintf(name, sizeof(name), "tpm2_kdfa_ctx_derive/%u", bits[i]);
+
+        bench_start(&b, name, iterations * 10, bits[i] / 8);
+        for (j = 0; j < b.iterations; j++) {
+            tpm2_kdfa_ctx_derive(ctx, "STORAGE", (TPM2B *) &context_u,
+                    (TPM2B *) &context_v, bits[i], &result);
+        }
+        bench_stop(&b);
+    }
+
+    tpm2_kdfa_ctx_free(ctx);
+}
+
+static void usage(const char *argv0) {
+
+    fprintf(stderr, "Usage: %s [-n iterations] [fixtures directory]\n",
+            argv0);
+}
+
+int main(int argc, char *argv[]) {
+
+    int opt;
+    while ((opt = getopt(argc, argv, "n:")) != -1) {
+        switch (opt) {
+        case 'n':
+            if (!tpm2_util_string_to_uint32(optarg, &iterations)
+                    || !iterations) {
+                usage(argv[0]);
+                return 1;
+            }
+            break;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    if (optind < argc) {
+        fixtures = argv[optind++];
+    }
+
+    if (optind != argc) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    /* keep the results apart from what the YAML emitters write */
+    report = fdopen(dup(STDOUT_FILENO), "w");
+    if (!report || !freopen("/dev/null", "w", stdout)) {
+        perror("Could not redirect the standard output");
+        return 1;
+    }
+
+    const struct CMUnitTest tests[] = {
+        cmocka_unit_test(bench_parse_eventlog),
+        cmocka_unit_test(bench_yaml_eventlog),
+        cmocka_unit_test(bench_pcr_parse_selections),
+        cmocka_unit_test(bench_tpm2_alg_util_handle_ext_alg),
+        cmocka_unit_test(bench_tpm2_util_hex_to_byte_structure),
+        cmocka_unit_test(bench_tpm2_openssl_hash_pcr_banks),
+        cmocka_unit_test(bench_tpm2_kdfa),
+    };
+
+    int rc = cmocka_run_group_tests(tests, NULL, NULL);
+    fclose(report);
+
+    return rc;
+}
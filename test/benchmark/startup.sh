@@ -0,0 +1,216 @@
+#!/usr/bin/env bash
+# SPDX-License-Identifier: BSD-3-Clause
+#
+# Measures the cold start latency of the tpm2 multi-call binary. Every tool
+# runs as a new process, so the numbers include loading the executable, the
+# TCTI and ESAPI and initializing OpenSSL, which dominates the runtime of
+# shell driven provisioning.
+#
+# The per phase times and page faults come from TPM2TOOLS_TRACE=timing, the
+# wall time of each invocation is measured around the exec. The page faults
+# count the pages of the executable and libraries an invocation touches, the
+# measure of a layout built with --enable-startup-layout. The results are written as JSON
+# with the median, minimum and maximum of every time over the iterations.
+# Given a baseline from an earlier run, the script fails when the median
+# wall time of any tool regressed by more than the allowed percentage.
+#
+# The TPM behind a TCTI other than none must be running and started up
+# already, eg with `tpm2 startup -c`.
+
+set -e
+
+usage() {
+    cat <<EOF
+Usage: $0 [-n ITERATIONS] [-o RESULTS] [-b BASELINE] [-r PERCENT] [TCTI...]
+
+  -n  Invocations of every tool, defaults to 20.
+  -o  The JSON file to write the results to, defaults to stdout.
+  -b  A JSON file of an earlier run to compare the results with.
+  -r  The allowed regression of the median wall time in percent, defaults
+      to 20.
+
+  TCTI is given like to **-T**, eg none, mssim or device:/dev/tpmrm0 and
+  defaults to none. The tpm2 executable is taken from \$TPM2 or the PATH.
+EOF
+}
+
+iterations=20
+results=
+baseline=
+regression=20
+
+while getopts "n:o:b:r:h" opt; do
+    case $opt in
+    n) iterations=$OPTARG;;
+    o) results=$OPTARG;;
+    b) baseline=$OPTARG;;
+    r) regression=$OPTARG;;
+    h) usage; exit 0;;
+    *) usage >&2; exit 1;;
+    esac
+done
+shift $((OPTIND - 1))
+
+tctis=("$@")
+if [ ${#tctis[@]} -eq 0 ]; then
+    tctis=(none)
+fi
+
+tpm2=${TPM2:-tpm2}
+if ! command -v "$tpm2" > /dev/null; then
+    echo "$tpm2 not found, set \$TPM2 to the tpm2 executable" >&2
+    exit 1
+fi
+
+tmp=$(mktemp -d)
+trap 'rm -rf "$tmp"' EXIT
+
+# the tools started the most, each with the arguments it runs with
+offline_tools=(
+    "rc_decode 0x9a2"
+)
+
+tpm_tools=(
+    "getrandom -o /dev/null 8"
+    "pcrread sha256:0"
+    "readclock"
+)
+
+now_ns() {
+    date +%s%N
+}
+
+# writes "<tcti> <tool> <wall-us>" lines next to the trace of every run
+run_tool() {
+    local tcti=$1
+    local tool=$2
+    shift 2
+
+    local start
+    local end
+    start=$(now_ns)
+    TPM2TOOLS_TRACE=timing TPM2TOOLS_TRACE_FILE="$tmp/trace.yaml" \
+        "$tpm2" "$tool" -T "$tcti" "$@" > /dev/null
+    end=$(now_ns)
+
+    echo "$tcti $tool $(((end - start) / 1000))" >> "$tmp/runs.txt"
+}
+
+for tcti in "${tctis[@]}"; do
+    if [ "$tcti" = "none" ]; then
+        tools=("${offline_tools[@]}")
+    else
+        tools=("${tpm_tools[@]}")
+    fi
+
+    for line in "${tools[@]}"; do
+        read -r -a args <<< "$line"
+        # one untimed run, so the executable and libraries are cached
+        TPM2TOOLS_TRACE= "$tpm2" "${args[0]}" -T "$tcti" "${args[@]:1}" \
+            > /dev/null
+        for ((i = 0; i < iterations; i++)); do
+            run_tool "$tcti" "${args[@]}"
+        done
+    done
+done
+
+${PYTHON:-python3} - "$tmp/runs.txt" "$tmp/trace.yaml" "$iterations" \
+    "${results:--}" "$baseline" "$regression" <<'EOF'
+import json
+import statistics
+import sys
+
+runs_path, trace_path, iterations, results_path, baseline_path, regression = \
+    sys.argv[1:]
+
+# the trace entries are in run order, like the lines of the runs file
+traces = []
+with open(trace_path) as f:
+    for line in f:
+        key, _, value = line.strip().lstrip("- ").partition(": ")
+        if line.startswith("- tool:"):
+            traces.append({"phases": {}})
+        elif line.startswith("  total-us:"):
+            traces[-1]["total-us"] = int(value)
+        elif line.startswith("  minor-faults:") \
+                or line.startswith("  major-faults:"):
+            traces[-1][key] = int(value)
+        elif line.startswith("    ") and key.endswith(("-us", "-faults")) \
+                and not line.startswith("      "):
+            traces[-1]["phases"][key] = int(value)
+
+samples = {}
+with open(runs_path) as f:
+    for line, trace in zip(f, traces):
+        tcti, tool, wall = line.split()
+        sample = samples.setdefault((tcti, tool), {})
+        sample.setdefault("wall-us", []).append(int(wall))
+        sample.setdefault("total-us", []).append(trace["total-us"])
+        for faults in ("minor-faults", "major-faults"):
+            if faults in trace:
+                sample.setdefault(faults, []).append(trace[faults])
+        for phase, value in trace["phases"].items():
+            sample.setdefault(phase, []).append(value)
+
+def summary(values):
+    return {
+        "median": statistics.median(values),
+        "min": min(values),
+        "max": max(values),
+    }
+
+report = {
+    "version": 1,
+    "iterations": int(iterations),
+    "results": [
+        {
+            "tcti": tcti,
+            "tool": tool,
+            "times": {name: summary(values) for name, values in times.items()},
+        }
+        for (tcti, tool), times in sorted(samples.items())
+    ],
+}
+
+if results_path == "-":
+    json.dump(report, sys.stdout, indent=2)
+    print()
+else:
+    with open(results_path, "w") as f:
+        json.dump(report, f, indent=2)
+        f.write("\n")
+
+if not baseline_path:
+    sys.exit(0)
+
+with open(baseline_path) as f:
+    baseline_results = json.load(f)["results"]
+    previous = {
+        (r["tcti"], r["tool"]): r["times"]["wall-us"]["median"]
+        for r in baseline_results
+    }
+    previous_faults = {
+        (r["tcti"], r["tool"]): r["times"]["minor-faults"]["median"]
+        for r in baseline_results if "minor-faults" in r["times"]
+    }
+
+failed = False
+for r in report["results"]:
+    key = (r["tcti"], r["tool"])
+    if key not in previous:
+        continue
+    # the page faults inform, ie on a layout change, but do not fail
+    if key in previous_faults and "minor-faults" in r["times"]:
+        print("%s with %s: %.0f minor faults, baseline %.0f" %
+              (r["tool"], r["tcti"], r["times"]["minor-faults"]["median"],
+               previous_faults[key]), file=sys.stderr)
+
+    median = r["times"]["wall-us"]["median"]
+    limit = previous[key] * (1 + float(regression) / 100)
+    if median > limit:
+        print("REGRESSION: %s with %s: %.0fus, baseline %.0fus" %
+              (r["tool"], r["tcti"], median, previous[key]), file=sys.stderr)
+        failed = True
+
+sys.exit(1 if failed else 0)
+EOF
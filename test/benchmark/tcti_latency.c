@@ -0,0 +1,568 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+/*
+ * A TCTI module for the benchmarks, loaded by name like any other TCTI, ie
+ * TPM2TOOLS_TCTI="latency:<config>". It forwards the commands to a child
+ * TCTI, normally the simulator, and holds the responses back until the
+ * latency of the command code in a profile has passed since the command was
+ * sent. The profile is made of the latencies recorded with
+ * TPM2TOOLS_CAPTURE_FILE against a real TPM, so the pipelining and batching
+ * of the tools can be timed against the latencies of a discrete TPM with the
+ * run to run noise of the simulator only.
+ *
+ * The config is a comma separated list of:
+ *   ring=FILE       a capture ring, every command code gets the median of its
+ *                   recorded latencies.
+ *   cc=CODE:USEC    the latency of one command code, over the ring.
+ *   default=USEC    the latency of the command codes without one, 0 if unset.
+ *   scale=PERCENT   scales all latencies, 100 if unset.
+ *   child=TCTI      the TCTI to forward to, with its own config, this has to
+ *                   be the last entry.
+ *
+ * A command the child takes longer for than the profile keeps the time of
+ * the child. The poll handles are the ones of the child, so they may signal
+ * a response before it is released.
+ */
+
+#include <errno.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <tss2/tss2_tcti.h>
+#include <tss2/tss2_tctildr.h>
+
+#define LATENCY_TCTI_MAGIC 0x6c6174656e637954ULL
+
+#define LATENCY_TCTI_PREFIX "latency TCTI: "
+
+/* the header of a TPM command or response and the largest one */
+#define LATENCY_HEADER_SIZE 10
+#define LATENCY_MAX_SIZE 4096
+
+/* the tag and size fields precede the command code */
+#define LATENCY_CODE_OFFSET 6
+
+/* the layout of the capture ring, see lib/tpm2_capture.h */
+#define RING_MAGIC "TPM2CAPT"
+#define RING_VERSION 1
+#define RING_HEADER_SIZE 32
+#define RING_RECORD_HEADER_SIZE 40
+#define RING_ENTRIES_MAX 65536
+
+typedef struct latency_entry latency_entry;
+struct latency_entry {
+    TPM2_CC cc;
+    uint64_t latency_ns;
+};
+
+typedef struct latency_tcti latency_tcti;
+struct latency_tcti {
+    TSS2_TCTI_CONTEXT_COMMON_V2 common;
+    TSS2_TCTI_CONTEXT *child;
+    /* one entry per command code, sorted by code */
+    latency_entry *profile;
+    size_t profile_count;
+    uint64_t default_ns;
+    bool is_in_flight;
+    bool is_response;
+    struct timespec deadline;
+    size_t response_size;
+    uint8_t response[LATENCY_MAX_SIZE];
+};
+
+static UINT32 get_u32(const uint8_t *p) {
+
+    return (UINT32) p[0] << 24 | p[1] << 16 | p[2] << 8 | p[3];
+}
+
+static uint64_t get_u64(const uint8_t *p) {
+
+    return (uint64_t) get_u32(p) << 32 | get_u32(&p[4]);
+}
+
+static int entry_compare(const void *a, const void *b) {
+
+    const latency_entry *x = a;
+    const latency_entry *y = b;
+
+    if (x->cc != y->cc) {
+        return x->cc < y->cc ? -1 : 1;
+    }
+    if (x->latency_ns != y->latency_ns) {
+        return x->latency_ns < y->latency_ns ? -1 : 1;
+    }
+
+    return 0;
+}
+
+static latency_entry *profile_find(latency_tcti *tcti, TPM2_CC cc) {
+
+    latency_entry key = { .cc = cc };
+
+    size_t lo = 0;
+    size_t hi = tcti->profile_count;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (tcti->profile[mid].cc < key.cc) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+
+    return lo < tcti->profile_count && tcti->profile[lo].cc == cc ?
+            &tcti->profile[lo] : NULL;
+}
+
+static bool profile_set(latency_tcti *tcti, TPM2_CC cc, uint64_t latency_ns) {
+
+    latency_entry *entry = profile_find(tcti, cc);
+    if (entry) {
+        entry->latency_ns = latency_ns;
+        return true;
+    }
+
+    latency_entry *tmp = realloc(tcti->profile,
+            (tcti->profile_count + 1) * sizeof(*tmp));
+    if (!tmp) {
+        fprintf(stderr, LATENCY_TCTI_PREFIX "oom\n");
+        return false;
+    }
+    tcti->profile = tmp;
+    tcti->profile[tcti->profile_count++] =
+            (latency_entry) { .cc = cc, .latency_ns = latency_ns };
+
+    qsort(tcti->profile, tcti->profile_count, sizeof(*tcti->profile),
+            entry_compare);
+
+    return true;
+}
+
+/*
+ * The records of a ring that got a response from the TPM, sorted by command
+ * code and latency, so the median of a code is in the middle of its run.
+ */
+static bool profile_load_ring(latency_tcti *tcti, const char *path) {
+
+    FILE *f = fopen(path, "rb");
+    if (!f) {
+        fprintf(stderr, LATENCY_TCTI_PREFIX "could not open \"%s\": %s\n",
+                path, strerror(errno));
+        return false;
+    }
+
+    bool result = false;
+    latency_entry *records = NULL;
+
+    uint8_t header[RING_HEADER_SIZE];
+    if (fread(header, sizeof(header), 1, f) != 1
+            || memcmp(header, RING_MAGIC, strlen(RING_MAGIC))
+            || get_u32(&header[8]) != RING_VERSION) {
+        fprintf(stderr, LATENCY_TCTI_PREFIX "\"%s\" is not a capture ring\n",
+                path);
+        goto out;
+    }
+
+    UINT32 entries = get_u32(&header[12]);
+    UINT32 slot_size = get_u32(&header[16]);
+    uint64_t end = get_u64(&header[24]);
+    if (!entries || entries > RING_ENTRIES_MAX
+            || slot_size < RING_RECORD_HEADER_SIZE) {
+        fprintf(stderr, LATENCY_TCTI_PREFIX "\"%s\" is damaged\n", path);
+        goto out;
+    }
+
+    records = calloc(entries, sizeof(*records));
+    if (!records) {
+        fprintf(stderr, LATENCY_TCTI_PREFIX "oom\n");
+        goto out;
+    }
+
+    size_t count = 0;
+    uint64_t seq;
+    for (seq = end > entries ? end - entries : 0; seq < end; seq++) {
+        long offset = RING_HEADER_SIZE + (long) (seq % entries) * slot_size;
+        uint8_t record[RING_RECORD_HEADER_SIZE];
+        if (fseek(f, offset, SEEK_SET)
+                || fread(record, sizeof(record), 1, f) != 1) {
+            fprintf(stderr, LATENCY_TCTI_PREFIX "\"%s\" is truncated\n", path);
+            goto out;
+        }
+
+        /* without a response size the TCTI of the recording failed */
+        if (get_u64(&record[0]) != seq || !get_u32(&record[36])) {
+            continue;
+        }
+
+        records[count++] = (latency_entry) {
+            .cc = get_u32(&record[24]),
+            .latency_ns = get_u64(&record[16]),
+        };
+    }
+
+    qsort(records, count, sizeof(*records), entry_compare);
+
+    size_t first = 0;
+    while (first < count) {
+        size_t last = first;
+        while (last + 1 < count && records[last + 1].cc == records[first].cc) {
+            last++;
+        }
+
+        const latency_entry *median = &records[first + (last - first) / 2];
+        if (!profile_set(tcti, median->cc, median->latency_ns)) {
+            goto out;
+        }
+
+        first = last + 1;
+    }
+
+    result = true;
+
+out:
+    free(records);
+    fclose(f);
+
+    return result;
+}
+
+static bool parse_u64(const char *value, uint64_t *result) {
+
+    char *end = NULL;
+    errno = 0;
+    unsigned long long v = strtoull(value, &end, 0);
+    if (errno || end == value || *end || value[0] == '-') {
+        return false;
+    }
+
+    *result = v;
+
+    return true;
+}
+
+/*
+ * Applies the config up to the child, which is returned. The command code
+ * overrides are applied after the ring, wherever they are listed.
+ */
+static bool config_parse(latency_tcti *tcti, char *config,
+        const char **child) {
+
+    *child = NULL;
+
+    const char *ring = NULL;
+    uint64_t scale = 100;
+    char *overrides[64];
+    size_t override_count = 0;
+
+    char *entry = config;
+    while (entry && *entry) {
+        if (!strncmp(entry, "child=", strlen("child="))) {
+            *child = entry + strlen("child=");
+            break;
+        }
+
+        char *next = strchr(entry, ',');
+        if (next) {
+            *next++ = '\0';
+        }
+
+        char *value = strchr(entry, '=');
+        if (!value) {
+            fprintf(stderr, LATENCY_TCTI_PREFIX "expected key=value, got "
+                    "\"%s\"\n", entry);
+            return false;
+        }
+        *value++ = '\0';
+
+        uint64_t number;
+        if (!strcmp(entry, "ring")) {
+            ring = value;
+        } else if (!strcmp(entry, "cc")) {
+            if (override_count == sizeof(overrides) / sizeof(overrides[0])) {
+                fprintf(stderr, LATENCY_TCTI_PREFIX "too many cc entries\n");
+                return false;
+            }
+            overrides[override_count++] = value;
+        } else if (!strcmp(entry, "default") && parse_u64(value, &number)) {
+            tcti->default_ns = number * 1000;
+        } else if (!strcmp(entry, "scale") && parse_u64(value, &number)) {
+            scale = number;
+        } else {
+            fprintf(stderr, LATENCY_TCTI_PREFIX "invalid config entry "
+                    "\"%s=%s\"\n", entry, value);
+            return false;
+        }
+
+        entry = next;
+    }
+
+    if (ring && !profile_load_ring(tcti, ring)) {
+        return false;
+    }
+
+    size_t i;
+    for (i = 0; i < override_count; i++) {
+        char *latency = strchr(overrides[i], ':');
+        uint64_t cc;
+        uint64_t usec;
+        if (!latency) {
+            fprintf(stderr, LATENCY_TCTI_PREFIX "expected cc=CODE:USEC, got "
+                    "\"%s\"\n", overrides[i]);
+            return false;
+        }
+        *latency++ = '\0';
+        if (!parse_u64(overrides[i], &cc) || cc > UINT32_MAX
+                || !parse_u64(latency, &usec)) {
+            fprintf(stderr, LATENCY_TCTI_PREFIX "invalid cc entry \"%s:%s\"\n",
+                    overrides[i], latency);
+            return false;
+        }
+        if (!profile_set(tcti, (TPM2_CC) cc, usec * 1000)) {
+            return false;
+        }
+    }
+
+    tcti->default_ns = tcti->default_ns * scale / 100;
+    for (i = 0; i < tcti->profile_count; i++) {
+        tcti->profile[i].latency_ns = tcti->profile[i].latency_ns * scale / 100;
+    }
+
+    return true;
+}
+
+static void timespec_add_ns(struct timespec *ts, uint64_t ns) {
+
+    ns += ts->tv_nsec;
+    ts->tv_sec += ns / 1000000000;
+    ts->tv_nsec = ns % 1000000000;
+}
+
+static int64_t timespec_until_ns(const struct timespec *ts) {
+
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (int64_t) (ts->tv_sec - now.tv_sec) * 1000000000
+            + (ts->tv_nsec - now.tv_nsec);
+}
+
+static void sleep_until(const struct timespec *ts) {
+
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, ts, NULL) == EINTR);
+}
+
+static TSS2_RC latency_tcti_transmit(TSS2_TCTI_CONTEXT *tcti_context,
+        size_t size, const uint8_t *command) {
+
+    latency_tcti *tcti = (latency_tcti *) tcti_context;
+
+    if (tcti->is_in_flight) {
+        return TSS2_TCTI_RC_BAD_SEQUENCE;
+    }
+
+    if (!command || size < LATENCY_HEADER_SIZE) {
+        return TSS2_TCTI_RC_BAD_VALUE;
+    }
+
+    /* the latency runs from the send, like the one a capture recorded */
+    clock_gettime(CLOCK_MONOTONIC, &tcti->deadline);
+
+    TSS2_RC rval = Tss2_Tcti_Transmit(tcti->child, size, command);
+    if (rval != TSS2_RC_SUCCESS) {
+        return rval;
+    }
+
+    latency_entry *entry = profile_find(tcti,
+            get_u32(&command[LATENCY_CODE_OFFSET]));
+    timespec_add_ns(&tcti->deadline,
+            entry ? entry->latency_ns : tcti->default_ns);
+
+    tcti->is_in_flight = true;
+    tcti->is_response = false;
+
+    return TSS2_RC_SUCCESS;
+}
+
+static TSS2_RC latency_tcti_receive(TSS2_TCTI_CONTEXT *tcti_context,
+        size_t *size, uint8_t *response, int32_t timeout) {
+
+    latency_tcti *tcti = (latency_tcti *) tcti_context;
+
+    if (!tcti->is_in_flight) {
+        return TSS2_TCTI_RC_BAD_SEQUENCE;
+    }
+
+    if (!size) {
+        return TSS2_TCTI_RC_BAD_REFERENCE;
+    }
+
+    if (!tcti->is_response) {
+        size_t response_size = sizeof(tcti->response);
+        TSS2_RC rval = Tss2_Tcti_Receive(tcti->child, &response_size,
+                tcti->response, timeout);
+        if (rval == TSS2_TCTI_RC_TRY_AGAIN) {
+            return rval;
+        }
+        if (rval != TSS2_RC_SUCCESS) {
+            tcti->is_in_flight = false;
+            return rval;
+        }
+        tcti->response_size = response_size;
+        tcti->is_response = true;
+    }
+
+    /* a poll with a timeout sees the command still running */
+    int64_t remaining_ns = timespec_until_ns(&tcti->deadline);
+    if (remaining_ns > 0) {
+        if (timeout != TSS2_TCTI_TIMEOUT_BLOCK
+                && (int64_t) timeout * 1000000 < remaining_ns) {
+            struct timespec until;
+            clock_gettime(CLOCK_MONOTONIC, &until);
+            timespec_add_ns(&until, (uint64_t) timeout * 1000000);
+            sleep_until(&until);
+            return TSS2_TCTI_RC_TRY_AGAIN;
+        }
+        sleep_until(&tcti->deadline);
+    }
+
+    /* a NULL response only queries the size */
+    if (!response) {
+        *size = tcti->response_size;
+        return TSS2_RC_SUCCESS;
+    }
+
+    if (*size < tcti->response_size) {
+        *size = tcti->response_size;
+        return TSS2_TCTI_RC_INSUFFICIENT_BUFFER;
+    }
+
+    memcpy(response, tcti->response, tcti->response_size);
+    *size = tcti->response_size;
+    tcti->is_in_flight = false;
+    tcti->is_response = false;
+
+    return TSS2_RC_SUCCESS;
+}
+
+static TSS2_RC latency_tcti_cancel(TSS2_TCTI_CONTEXT *tcti_context) {
+
+    latency_tcti *tcti = (latency_tcti *) tcti_context;
+    tcti->is_in_flight = false;
+    tcti->is_response = false;
+
+    return Tss2_Tcti_Cancel(tcti->child);
+}
+
+static TSS2_RC latency_tcti_get_poll_handles(TSS2_TCTI_CONTEXT *tcti_context,
+        TSS2_TCTI_POLL_HANDLE *handles, size_t *num_handles) {
+
+    latency_tcti *tcti = (latency_tcti *) tcti_context;
+
+    return Tss2_Tcti_GetPollHandles(tcti->child, handles, num_handles);
+}
+
+static TSS2_RC latency_tcti_set_locality(TSS2_TCTI_CONTEXT *tcti_context,
+        uint8_t locality) {
+
+    latency_tcti *tcti = (latency_tcti *) tcti_context;
+
+    return Tss2_Tcti_SetLocality(tcti->child, locality);
+}
+
+static TSS2_RC latency_tcti_make_sticky(TSS2_TCTI_CONTEXT *tcti_context,
+        TPM2_HANDLE *handle, uint8_t sticky) {
+
+    latency_tcti *tcti = (latency_tcti *) tcti_context;
+
+    return Tss2_Tcti_MakeSticky(tcti->child, handle, sticky);
+}
+
+static void latency_tcti_finalize(TSS2_TCTI_CONTEXT *tcti_context) {
+
+    latency_tcti *tcti = (latency_tcti *) tcti_context;
+
+    Tss2_TctiLdr_Finalize(&tcti->child);
+    free(tcti->profile);
+    tcti->profile = NULL;
+    tcti->profile_count = 0;
+}
+
+static TSS2_RC latency_tcti_init(TSS2_TCTI_CONTEXT *tcti_context,
+        size_t *size, const char *config) {
+
+    if (!size) {
+        return TSS2_TCTI_RC_BAD_VALUE;
+    }
+
+    if (!tcti_context) {
+        *size = sizeof(latency_tcti);
+        return TSS2_RC_SUCCESS;
+    }
+
+    if (*size < sizeof(latency_tcti)) {
+        return TSS2_TCTI_RC_INSUFFICIENT_BUFFER;
+    }
+
+    latency_tcti *tcti = (latency_tcti *) tcti_context;
+    memset(tcti, 0, sizeof(*tcti));
+
+    char *copy = strdup(config ? config : "");
+    if (!copy) {
+        fprintf(stderr, LATENCY_TCTI_PREFIX "oom\n");
+        return TSS2_TCTI_RC_MEMORY;
+    }
+
+    const char *child = NULL;
+    bool result = config_parse(tcti, copy, &child);
+    if (!result) {
+        free(copy);
+        free(tcti->profile);
+        return TSS2_TCTI_RC_BAD_VALUE;
+    }
+
+    if (!child || !child[0]) {
+        fprintf(stderr, LATENCY_TCTI_PREFIX "expected a child=TCTI entry\n");
+        free(copy);
+        free(tcti->profile);
+        return TSS2_TCTI_RC_BAD_VALUE;
+    }
+
+    TSS2_RC rval = Tss2_TctiLdr_Initialize(child, &tcti->child);
+    free(copy);
+    if (rval != TSS2_RC_SUCCESS) {
+        fprintf(stderr, LATENCY_TCTI_PREFIX "could not load the child TCTI, "
+                "rc 0x%" PRIx32 "\n", rval);
+        free(tcti->profile);
+        return rval;
+    }
+
+    tcti->common.v1.magic = LATENCY_TCTI_MAGIC;
+    tcti->common.v1.version = 2;
+    tcti->common.v1.transmit = latency_tcti_transmit;
+    tcti->common.v1.receive = latency_tcti_receive;
+    tcti->common.v1.finalize = latency_tcti_finalize;
+    tcti->common.v1.cancel = latency_tcti_cancel;
+    tcti->common.v1.getPollHandles = latency_tcti_get_poll_handles;
+    tcti->common.v1.setLocality = latency_tcti_set_locality;
+    tcti->common.makeSticky = latency_tcti_make_sticky;
+
+    return TSS2_RC_SUCCESS;
+}
+
+static const TSS2_TCTI_INFO latency_tcti_info = {
+    .version = 2,
+    .name = "tcti-latency",
+    .description = "Forwards to a child TCTI with the latencies of a profile.",
+    .config_help = "ring=FILE,cc=CODE:USEC,default=USEC,scale=PERCENT,"
+            "child=TCTI",
+    .init = latency_tcti_init,
+};
+
+const TSS2_TCTI_INFO *Tss2_Tcti_Info(void) {
+
+    return &latency_tcti_info;
+}
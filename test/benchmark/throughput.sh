@@ -0,0 +1,329 @@
+#!/usr/bin/env bash
+# SPDX-License-Identifier: BSD-3-Clause
+#
+# Measures the throughput and latency of the tools against a TPM simulator,
+# started like for the integration tests by test/integration/helpers.sh, ie
+# from $TPM2_SIM and, if set, $TPM2_ABRMD. Every operation runs in three
+# modes:
+#   process  a new tpm2 process per invocation, as shell scripts run them.
+#   serve    forwarded to a tpm2 serve daemon with TPM2TOOLS_SERVE_SOCKET.
+#   batch    all invocations as the lines of a single tpm2 batch.
+#
+# The process and serve modes time every invocation and report the p50 and
+# p99 latency with the operations per second, the batch mode only times the
+# whole batch and reports the operations per second and the mean latency.
+# The results are written as JSON. Given a baseline from an earlier run, the
+# script fails when the operations per second of any operation in any mode
+# dropped by more than the allowed percentage.
+#
+# Given a latency profile, the operations are timed through the latency TCTI
+# of tcti_latency.c, which holds every response of the simulator back for the
+# latency the profile has for the command code.
+
+usage() {
+    cat <<EOF
+Usage: $0 [-n ITERATIONS] [-o RESULTS] [-b BASELINE] [-r PERCENT] [-m MODES]
+          [-p PROFILE]
+
+  -n  Invocations of every operation in every mode, defaults to 50.
+  -o  The JSON file to write the results to, defaults to stdout.
+  -b  A JSON file of an earlier run to compare the results with.
+  -r  The allowed drop of the operations per second in percent, defaults
+      to 20.
+  -m  A comma separated list of the modes to run, defaults to
+      process,serve,batch.
+  -p  The config of the latency TCTI without the child, ie
+      "ring=tpm.ring,default=500", libtss2-tcti-latency.so is taken from
+      the library path.
+
+  The tpm2 executable and the integration test helpers are taken from the
+  PATH, the simulator from \$TPM2_SIM.
+EOF
+}
+
+iterations=50
+results=
+baseline=
+regression=20
+modes=process,serve,batch
+profile=
+
+while getopts "n:o:b:r:m:p:h" opt; do
+    case $opt in
+    n) iterations=$OPTARG;;
+    o) results=$OPTARG;;
+    b) baseline=$OPTARG;;
+    r) regression=$OPTARG;;
+    m) modes=$OPTARG;;
+    p) profile=$OPTARG;;
+    h) usage; exit 0;;
+    *) usage >&2; exit 1;;
+    esac
+done
+shift $((OPTIND - 1))
+
+# start_up changes into a directory of its own
+if [ -n "$results" ]; then
+    results=$(realpath "$results")
+fi
+if [ -n "$baseline" ]; then
+    baseline=$(realpath "$baseline")
+fi
+# the ring of a profile is opened from the directory of start_up
+if [[ "$profile" =~ (^|,)ring=([^,]*) ]]; then
+    ring=${BASH_REMATCH[2]}
+    profile=${profile/ring=$ring/ring=$(realpath "$ring")}
+fi
+
+source "$(dirname "$0")/../integration/helpers.sh"
+
+nv_index=0x1500016
+sock=
+serve_pid=
+
+cleanup() {
+    unset TPM2TOOLS_SERVE_SOCKET
+    if [ -n "$serve_pid" ]; then
+        kill -TERM $serve_pid 2>/dev/null
+        wait $serve_pid 2>/dev/null
+        serve_pid=""
+    fi
+
+    shut_down > /dev/null
+}
+trap cleanup EXIT
+
+# helpers.sh reports its progress on stdout, which may be the results
+start_up >&2
+
+# every operation as "name|the timed tool line|an untimed cleanup line"
+ops=(
+    "sign|sign -c key.ctx -g sha256 -o sig.out small.dat|"
+    "quote|quote -c key.ctx -l sha256:0,1 -m quote.msg -s quote.sig|"
+    "unseal|unseal -c seal.ctx -o unseal.out|"
+    "hash-small|hash -g sha256 -o hash.out small.dat|"
+    "hash-large|hash -g sha256 -o hash.out large.dat|"
+    "nvwrite|nvwrite $nv_index -C o -i small.dat|"
+    "nvread|nvread $nv_index -C o -s 64 -o nv.out|"
+    "getrandom|getrandom -o random.out 32|"
+    "createprimary|createprimary -C o -G ecc -c bench.ctx|flushcontext -t"
+    "policy|createpolicy --policy-pcr -l sha256:0,1 -L policy.out|"
+)
+
+setup() {
+    head -c 64 /dev/urandom > small.dat
+    head -c 1048576 /dev/urandom > large.dat
+    echo "sealed secret" > secret.dat
+
+    tpm2 createprimary -Q -C o -G ecc -c prim.ctx
+    tpm2 create -Q -C prim.ctx -G ecc -u key.pub -r key.priv
+    tpm2 load -Q -C prim.ctx -u key.pub -r key.priv -c key.ctx
+    tpm2 create -Q -C prim.ctx -i secret.dat -u seal.pub -r seal.priv
+    tpm2 load -Q -C prim.ctx -u seal.pub -r seal.priv -c seal.ctx
+    tpm2 flushcontext -t
+
+    tpm2 nvdefine -Q $nv_index -C o -s 64 -a "ownerread|ownerwrite"
+    tpm2 nvwrite -Q $nv_index -C o -i small.dat
+}
+
+now_ns() {
+    date +%s%N
+}
+
+# writes "<mode> <op> <us>" lines, one per timed invocation
+time_invocations() {
+    local mode=$1
+    local name=$2
+    local -a line
+    local -a after
+    read -r -a line <<< "$3"
+    read -r -a after <<< "$4"
+
+    # one untimed run, so the executable and libraries are cached
+    tpm2 "${line[@]}" > /dev/null
+    if [ ${#after[@]} -ne 0 ]; then
+        tpm2 "${after[@]}" > /dev/null
+    fi
+
+    local i
+    local start
+    local end
+    for ((i = 0; i < iterations; i++)); do
+        start=$(now_ns)
+        tpm2 "${line[@]}" > /dev/null
+        end=$(now_ns)
+        echo "$mode $name $(((end - start) / 1000))" >> runs.txt
+
+        if [ ${#after[@]} -ne 0 ]; then
+            tpm2 "${after[@]}" > /dev/null
+        fi
+    done
+}
+
+# writes a "batch <op> <us> <iterations>" line for the whole batch
+time_batch() {
+    local name=$1
+
+    local i
+    rm -f bench.batch
+    for ((i = 0; i < iterations; i++)); do
+        echo "$2" >> bench.batch
+        if [ -n "$3" ]; then
+            echo "$3" >> bench.batch
+        fi
+    done
+
+    local start
+    local end
+    start=$(now_ns)
+    tpm2 batch bench.batch > /dev/null
+    end=$(now_ns)
+    echo "batch $name $(((end - start) / 1000)) $iterations" >> runs.txt
+}
+
+start_serve() {
+    sock="$PWD/bench.sock"
+    tpm2 serve "$sock" &
+    serve_pid=$!
+
+    local i
+    for i in $(seq 1 50); do
+        if [ -S "$sock" ]; then
+            break
+        fi
+        sleep 0.1
+    done
+    test -S "$sock"
+}
+
+stop_serve() {
+    kill -TERM $serve_pid
+    wait $serve_pid 2>/dev/null || true
+    serve_pid=""
+}
+
+setup >&2
+
+# the setup above runs at the speed of the simulator
+if [ -n "$profile" ]; then
+    export TPM2TOOLS_TCTI="latency:$profile,child=$TPM2TOOLS_TCTI"
+fi
+
+rm -f runs.txt
+IFS=, read -r -a mode_list <<< "$modes"
+for mode in "${mode_list[@]}"; do
+    case $mode in
+    process) ;;
+    serve)
+        start_serve
+        export TPM2TOOLS_SERVE_SOCKET="$sock"
+        ;;
+    batch) ;;
+    *) echo "Unknown mode $mode" >&2; usage >&2; exit 1;;
+    esac
+
+    for op in "${ops[@]}"; do
+        IFS='|' read -r name line after <<< "$op"
+        if [ "$mode" = "batch" ]; then
+            time_batch "$name" "$line" "$after"
+        else
+            time_invocations "$mode" "$name" "$line" "$after"
+        fi
+    done
+
+    if [ "$mode" = "serve" ]; then
+        unset TPM2TOOLS_SERVE_SOCKET
+        stop_serve
+    fi
+done
+
+tpm2 nvundefine -Q $nv_index -C o
+
+${PYTHON:-python3} - runs.txt "$iterations" "${results:--}" "$baseline" \
+    "$regression" "$TPM2TOOLS_TCTI" <<'EOF'
+import json
+import math
+import statistics
+import sys
+
+runs_path, iterations, results_path, baseline_path, regression, tcti = \
+    sys.argv[1:]
+
+samples = {}
+batches = {}
+with open(runs_path) as f:
+    for line in f:
+        fields = line.split()
+        if fields[0] == "batch":
+            batches[(fields[0], fields[1])] = (int(fields[2]), int(fields[3]))
+        else:
+            samples.setdefault((fields[0], fields[1]), []).append(
+                int(fields[2]))
+
+def percentile(values, p):
+    ordered = sorted(values)
+    return ordered[max(0, math.ceil(p / 100 * len(ordered)) - 1)]
+
+results = []
+for (mode, op), values in samples.items():
+    results.append({
+        "mode": mode,
+        "op": op,
+        "ops-per-sec": round(len(values) * 1e6 / sum(values), 2),
+        "latency-us": {
+            "p50": percentile(values, 50),
+            "p99": percentile(values, 99),
+            "mean": round(statistics.mean(values)),
+            "min": min(values),
+            "max": max(values),
+        },
+    })
+
+for (mode, op), (total, count) in batches.items():
+    results.append({
+        "mode": mode,
+        "op": op,
+        "ops-per-sec": round(count * 1e6 / total, 2),
+        "latency-us": {
+            "mean": round(total / count),
+        },
+    })
+
+report = {
+    "version": 1,
+    "iterations": int(iterations),
+    "tcti": tcti,
+    "results": sorted(results, key=lambda r: (r["mode"], r["op"])),
+}
+
+if results_path == "-":
+    json.dump(report, sys.stdout, indent=2)
+    print()
+else:
+    with open(results_path, "w") as f:
+        json.dump(report, f, indent=2)
+        f.write("\n")
+
+if not baseline_path:
+    sys.exit(0)
+
+with open(baseline_path) as f:
+    previous = {
+        (r["mode"], r["op"]): r["ops-per-sec"]
+        for r in json.load(f)["results"]
+    }
+
+failed = False
+for r in report["results"]:
+    key = (r["mode"], r["op"])
+    if key not in previous:
+        continue
+    limit = previous[key] * (1 - float(regression) / 100)
+    if r["ops-per-sec"] < limit:
+        print("REGRESSION: %s in %s mode: %.2f/s, baseline %.2f/s" %
+              (r["op"], r["mode"], r["ops-per-sec"], previous[key]),
+              file=sys.stderr)
+        failed = True
+
+sys.exit(1 if failed else 0)
+EOF
@@ -0,0 +1,60 @@
+
+set -e
+source helpers.sh
+
+start_up
+
+CRYPTO_PROFILE="RSA"
+setup_fapi $CRYPTO_PROFILE
+
+PATH=${abs_builddir}/tools/fapi:$PATH
+
+function cleanup {
+    tss2 delete --path=/
+    shut_down
+}
+
+trap cleanup EXIT
+
+KEY_PATH=HS/SRK/myBatchKey
+RANDOM_FILE="$TEMP_DIR/random.file"
+BATCH_FILE="$TEMP_DIR/batch.in"
+LIST_FILE="$TEMP_DIR/list.file"
+LOG_FILE="$TEMP_DIR/batch.log"
+
+tss2 provision
+
+cat > $BATCH_FILE <<EOT
+# a comment and an empty line
+
+getrandom --numBytes=16 --data=$RANDOM_FILE --force
+tss2 createkey --path=$KEY_PATH --type="noDa, sign" --authValue=""
+list --searchPath=HS/SRK --pathList=$LIST_FILE --force
+EOT
+
+tss2 batch $BATCH_FILE
+
+test $(stat -c %s $RANDOM_FILE) -eq 16
+grep -q myBatchKey $LIST_FILE
+
+# stops at the first failure
+rm -f $RANDOM_FILE
+printf "nosuchtool\ngetrandom --numBytes=4 --data=%s\n" $RANDOM_FILE \
+    > $BATCH_FILE
+if tss2 batch $BATCH_FILE 2> $LOG_FILE; then
+    echo "Expected the batch to fail"
+    exit 1
+fi
+grep -q "Line 1" $LOG_FILE
+test ! -e $RANDOM_FILE
+
+# keeps going, from stdin, but still fails
+if tss2 batch --keepGoing < $BATCH_FILE 2> $LOG_FILE; then
+    echo "Expected the batch to fail"
+    exit 1
+fi
+test $(stat -c %s $RANDOM_FILE) -eq 4
+
+tss2 delete --path=$KEY_PATH
+
+exit 0
@@ -196,6 +196,33 @@ if [ "`cat $DECRYPTED_FILE`" != "`cat $PLAIN_TEXT`" ]; then
   exit 1
 fi
 
+# Bulk encrypt/decrypt a directory
+mkdir -p $TEMP_DIR/plain
+for i in 1 2 3; do
+    echo -n "Secret $i" > $TEMP_DIR/plain/secret$i
+done
+tss2 encrypt --keyPath=$KEY_PATH --plainText=$TEMP_DIR/plain \
+    --cipherText=$TEMP_DIR/encrypted --bulk --force
+tss2 decrypt --keyPath=$KEY_PATH --cipherText=$TEMP_DIR/encrypted \
+    --plainText=$TEMP_DIR/decrypted --bulk --force
+diff -r $TEMP_DIR/plain $TEMP_DIR/decrypted
+
+# Bulk encrypt/decrypt a framed stream through stdin and stdout
+printf '\x00\x00\x00\x03one\x00\x00\x00\x03two' > $TEMP_DIR/frames.in
+tss2 encrypt --keyPath=$KEY_PATH --plainText=- --cipherText=- --bulk \
+    < $TEMP_DIR/frames.in | \
+tss2 decrypt --keyPath=$KEY_PATH --cipherText=- --plainText=- --bulk \
+    > $TEMP_DIR/frames.out
+cmp $TEMP_DIR/frames.in $TEMP_DIR/frames.out
+
+# A truncated frame fails
+printf '\x00\x00\x00\x09one' | \
+if tss2 encrypt --keyPath=$KEY_PATH --plainText=- --cipherText=- --bulk \
+    > /dev/null 2> $LOG_FILE; then
+    echo "Expected a truncated frame to fail"
+    exit 1
+fi
+
 echo "tss2 decrypt with EMPTY_FILE" # Expected to fail
 expect <<EOF
 spawn sh -c "tss2 decrypt --keyPath=$KEY_PATH --cipherText=$EMPTY_FILE \
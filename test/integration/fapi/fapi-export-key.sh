@@ -60,6 +60,28 @@ tss2 createkey --path=$KEY_PATH --type="noDa, exportable, decrypt" \
 tss2 exportkey --pathOfKeyToDuplicate=$KEY_PATH \
     --pathToPublicKeyOfNewParent="ext/$LOADED_KEY" --exportedData=$EXPORTED_KEY
 
+# The public keys of all the keys below the SRK in one archive
+ARCHIVE_FILE=$TEMP_DIR/exported.archive
+tss2 exportkey --pathOfKeyToDuplicate=HS/SRK --archive=$ARCHIVE_FILE
+ctx_archive_get $ARCHIVE_FILE > $TEMP_DIR/names
+test `grep -c "HS/SRK/my" $TEMP_DIR/names` -eq 2
+NAME=`grep "myParent" $TEMP_DIR/names`
+ctx_archive_get $ARCHIVE_FILE $NAME > $TEMP_DIR/archived_parent
+tss2 exportkey --pathOfKeyToDuplicate=$KEY_PATH_PARENT \
+    --exportedData=$EXPORTED_PARENT_KEY --force
+cmp $TEMP_DIR/archived_parent $EXPORTED_PARENT_KEY
+
+expect <<EOF
+# Try with both an archive and exportedData
+spawn tss2 exportkey --pathOfKeyToDuplicate=HS/SRK --archive=$ARCHIVE_FILE \
+    --exportedData=$EXPORTED_KEY --force
+set ret [wait]
+if {[lindex \$ret 2] || [lindex \$ret 3] != 1} {
+    Command has not failed as expected\n"
+    exit 1
+}
+EOF
+
 expect <<EOF
 # Try with missing exportedData
 spawn tss2 exportkey --pathOfKeyToDuplicate=$KEY_PATH \
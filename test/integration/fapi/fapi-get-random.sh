@@ -54,4 +54,31 @@ tss2 getrandom --numBytes=4 --data=$OUTPUT_FILE --force
 
 tss2 getrandom --numBytes=4 --hex --data=$OUTPUT_FILE --force
 
+# a bulk request is streamed in pieces
+tss2 getrandom --bulk --numBytes=10000 --data=$OUTPUT_FILE --force
+if [ "$(stat -c %s $OUTPUT_FILE)" != 10000 ]; then
+    echo "Expected 10000 bulk random bytes"
+    exit 1
+fi
+
+tss2 getrandom --bulk --hex --numBytes=5000 --data=$OUTPUT_FILE --force
+if [ "$(stat -c %s $OUTPUT_FILE)" != 10000 ]; then
+    echo "Expected 5000 hex encoded bulk random bytes"
+    exit 1
+fi
+
+# an endless stream ends with its reader
+FIFO="$TEMP_DIR/random.fifo"
+rm -f $FIFO
+mkfifo $FIFO
+tss2 getrandom --bulk --data=$FIFO --force &
+pid=$!
+head -c 20000 $FIFO > $OUTPUT_FILE
+wait $pid
+if [ "$(stat -c %s $OUTPUT_FILE)" != 20000 ]; then
+    echo "Expected 20000 streamed random bytes"
+    exit 1
+fi
+rm -f $FIFO
+
 exit 0
@@ -31,6 +31,46 @@ tss2 createkey --path=$KEY_PATH --policyPath=$POLICY_PCR --type="noDa, sign" \
 tss2 gettpmblobs --path=$KEY_PATH --tpm2bPublic=$PUBLIC_KEY_FILE \
     --tpm2bPrivate=$PRIVATE_KEY_FILE --policy=$POLICY_FILE --force
 
+# The blobs of all the keys in one archive
+ARCHIVE_FILE=$TEMP_DIR/blobs.archive
+tss2 createkey --path=HS/SRK/myRSADecrypt --type="noDa, decrypt" \
+    --authValue=""
+tss2 gettpmblobs --path=/ --archive=$ARCHIVE_FILE
+ctx_archive_get $ARCHIVE_FILE > $TEMP_DIR/names
+test `grep -c "myRSA" $TEMP_DIR/names` -eq 6
+# the primaries are skipped
+if grep -q "SRK.pub" $TEMP_DIR/names; then
+    echo "The archive holds the SRK"
+    exit 1
+fi
+NAME=`grep "myRSASign.pub" $TEMP_DIR/names`
+ctx_archive_get $ARCHIVE_FILE $NAME > $TEMP_DIR/archived_pub
+cmp $TEMP_DIR/archived_pub $PUBLIC_KEY_FILE
+NAME=`grep "myRSASign.policy" $TEMP_DIR/names`
+ctx_archive_get $ARCHIVE_FILE $NAME > $TEMP_DIR/archived_policy
+cmp $TEMP_DIR/archived_policy $POLICY_FILE
+
+expect <<EOF
+# Try to overwrite the archive without --force
+spawn tss2 gettpmblobs --path=/ --archive=$ARCHIVE_FILE
+set ret [wait]
+if {[lindex \$ret 2] || [lindex \$ret 3] != 1} {
+    Command has not failed as expected\n"
+    exit 1
+}
+EOF
+
+expect <<EOF
+# Try with both an archive and a single blob
+spawn tss2 gettpmblobs --path=/ --archive=$ARCHIVE_FILE --force \
+    --tpm2bPublic=$PUBLIC_KEY_FILE
+set ret [wait]
+if {[lindex \$ret 2] || [lindex \$ret 3] != 1} {
+    Command has not failed as expected\n"
+    exit 1
+}
+EOF
+
 expect <<EOF
 # Try with missing path
 spawn tss2 gettpmblobs --tpm2bPublic=$PUBLIC_KEY_FILE \
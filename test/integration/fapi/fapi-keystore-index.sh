@@ -0,0 +1,69 @@
+
+set -e
+source helpers.sh
+
+start_up
+
+CRYPTO_PROFILE="RSA"
+setup_fapi $CRYPTO_PROFILE
+
+function cleanup {
+    tss2 delete --path=/
+    shut_down
+}
+
+trap cleanup EXIT
+
+KEY_PATH=HS/SRK/myIndexedKey
+INDEX_FILE=$TEMP_DIR/fapi.index
+LIST_FILE=$TEMP_DIR/list.file
+INDEXED_LIST_FILE=$TEMP_DIR/indexed_list.file
+DESCRIPTION_FILE=$TEMP_DIR/description.file
+APP_DATA_FILE=$TEMP_DIR/app_data.file
+APP_DATA_SET=$TEMP_DIR/app_data_set.file
+
+tss2 provision
+
+tss2 createkey --path=$KEY_PATH --type="noDa, sign" --authValue=""
+tss2 setdescription --path=$KEY_PATH --description="first description"
+echo -n "app data" > $APP_DATA_SET
+tss2 setappdata --path=$KEY_PATH --appData=$APP_DATA_SET
+
+tss2 list --pathList=$LIST_FILE --force
+
+# An index of a keystore changed within the last seconds is not saved
+export TPM2TOOLS_FAPI_INDEX=$INDEX_FILE
+tss2 list --pathList=$INDEXED_LIST_FILE --force
+test ! -e $INDEX_FILE
+cmp $LIST_FILE $INDEXED_LIST_FILE
+
+sleep 3
+tss2 list --pathList=$INDEXED_LIST_FILE --force
+test -s $INDEX_FILE
+cmp $LIST_FILE $INDEXED_LIST_FILE
+
+# Answered from the saved index
+tss2 list --searchPath=HS/SRK --pathList=$INDEXED_LIST_FILE --force
+grep -q myIndexedKey $INDEXED_LIST_FILE
+
+tss2 getdescription --path=$KEY_PATH --description=$DESCRIPTION_FILE --force
+test "$(< $DESCRIPTION_FILE)" = "first description"
+
+tss2 getappdata --path=$KEY_PATH --appData=$APP_DATA_FILE --force
+cmp $APP_DATA_SET $APP_DATA_FILE
+
+# Changing the keystore invalidates the index
+tss2 setdescription --path=$KEY_PATH --description="second description"
+tss2 getdescription --path=$KEY_PATH --description=$DESCRIPTION_FILE --force
+test "$(< $DESCRIPTION_FILE)" = "second description"
+
+tss2 delete --path=$KEY_PATH
+if tss2 getdescription --path=$KEY_PATH --description=$DESCRIPTION_FILE \
+    --force; then
+    echo "Expected the deleted key to be gone from the index"
+    exit 1
+fi
+
+unset TPM2TOOLS_FAPI_INDEX
+
+exit 0
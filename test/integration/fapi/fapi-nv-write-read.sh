@@ -60,6 +60,37 @@ if [ `cat $DATA_READ_FILE` !=  `cat $DATA_WRITE_FILE` ]; then
   exit 99
 fi
 
+# Bulk write and read of many NV paths, from and to directories
+NV_PATH2=/nv/Owner/myNVwrite2
+NV_LIST=$TEMP_DIR/nv.list
+BULK_IN=$TEMP_DIR/bulk_in
+BULK_OUT=$TEMP_DIR/bulk_out
+tss2 createnv --path=$NV_PATH2 --type="noDa" --size=20 --authValue=""
+printf "$NV_PATH\n# a comment\n\n$NV_PATH2\n" > $NV_LIST
+mkdir -p $BULK_IN $BULK_OUT
+echo "first bulk data" > $BULK_IN/nv_Owner_myNVwrite
+echo "second bulk data" > $BULK_IN/nv_Owner_myNVwrite2
+
+tss2 nvwrite --nvPath=$NV_LIST --data=$BULK_IN --bulk
+tss2 nvread --nvPath=$NV_LIST --data=$BULK_OUT --bulk
+for f in nv_Owner_myNVwrite nv_Owner_myNVwrite2; do
+    # the indices are padded with zeros to their size
+    cmp -n `stat -c %s $BULK_IN/$f` $BULK_IN/$f $BULK_OUT/$f
+    test `stat -c %s $BULK_OUT/$f` -eq 20
+done
+
+# and as framed streams, in the order of the list
+tss2 nvread --nvPath=$NV_LIST --data=$TEMP_DIR/bulk.stream --bulk
+tss2 nvwrite --nvPath=- --data=$TEMP_DIR/bulk.stream --bulk <<EOF
+$NV_PATH2
+$NV_PATH
+EOF
+tss2 nvread --nvPath=$NV_PATH2 --data=$DATA_READ_FILE --force
+cmp $DATA_READ_FILE $BULK_OUT/nv_Owner_myNVwrite
+
+tss2 delete --path=$NV_PATH2
+rm -rf $BULK_IN $BULK_OUT $TEMP_DIR/bulk.stream $NV_LIST
+
 tss2 delete --path=$NV_PATH
 
 tss2 createnv --path=$NV_PATH --type="noDa" --size=20 --authValue=$PW
@@ -201,4 +201,44 @@ if {[lindex \$ret 2] || [lindex \$ret 3] != 1} {
 }
 EOF
 
+# Extend a list of measurements over one FAPI context
+PCR_LIST=$TEMP_DIR/pcr.list
+cat > $PCR_LIST <<EOF
+# pcr data logData
+23 $PCR_EVENT_DATA $PCR_LOG_FILE_WRITE
+
+16 $PCR_EVENT_DATA
+23 $PCR_EVENT_DATA $PCR_LOG_FILE_WRITE
+EOF
+tss2 pcrextend --data=$PCR_LIST --bulk
+tss2 pcrread --pcrIndex=23 --pcrLog=$PCR_LOG_FILE_READ --force
+python << pyscript
+import json
+import sys
+
+with open("$PCR_LOG_FILE_READ") as f:
+    log = json.load(f)
+sys.exit(len(log) != 2)
+pyscript
+
+expect <<EOF
+# Try with a malformed record, nothing is extended
+spawn sh -c "echo '23' | tss2 pcrextend --bulk"
+set ret [wait]
+if {[lindex \$ret 2] || [lindex \$ret 3] != 1} {
+    Command has not failed as expected\n"
+    exit 1
+}
+EOF
+
+expect <<EOF
+# Try with --pcr and --bulk
+spawn tss2 pcrextend --pcr=23 --data=$PCR_LIST --bulk
+set ret [wait]
+if {[lindex \$ret 2] || [lindex \$ret 3] != 1} {
+    Command has not failed as expected\n"
+    exit 1
+}
+EOF
+
 exit 0
@@ -17,7 +17,13 @@ function cleanup {
 
 trap cleanup EXIT
 
-tss2 provision
+tss2 provision --timing > $TEMP_DIR/timing.yaml
+grep -q "tpm-us:" $TEMP_DIR/timing.yaml
+
+# a provisioned keystore is left alone by --resume
+tss2 provision --resume --timing > $TEMP_DIR/timing.yaml
+test `yaml_get_kv $TEMP_DIR/timing.yaml "provision" "resumed"` = complete
+grep -q "start-us: 0$" $TEMP_DIR/timing.yaml
 
 PROFILE_NAME=$( tss2 list --searchPath=/ --pathList=- | cut -d "/" -f2 )
 
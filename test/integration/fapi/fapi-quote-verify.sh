@@ -542,4 +542,42 @@ tss2 verifyquote --publicKeyPath="ext/myNewParent" \
     --quoteInfo=$QUOTE_INFO \
     --signature=$SIGNATURE_FILE
 
+# Verify many quotes from a manifest
+MANIFEST=$TEMP_DIR/quotes.manifest
+RESULTS=$TEMP_DIR/results.yaml
+rm -f $MANIFEST
+for i in 1 2 3 4; do
+    echo "ext/myNewParent $QUOTE_INFO $SIGNATURE_FILE $PCR_LOG # quote $i" \
+        >> $MANIFEST
+done
+echo "ext/myNewParent $QUOTE_INFO $SIGNATURE_FILE" >> $MANIFEST
+tss2 verifyquote --manifest=$MANIFEST --jobs=2 > $RESULTS
+test $(grep -c "verified: true" $RESULTS) -eq 5
+
+# A quote failing to verify fails the manifest, the others still verify
+echo "ext/abc $QUOTE_INFO $SIGNATURE_FILE" >> $MANIFEST
+if tss2 verifyquote --manifest=$MANIFEST > $RESULTS 2> $LOG_FILE; then
+    echo "Expected the manifest to fail"
+    exit 1
+fi
+test $(grep -c "verified: true" $RESULTS) -eq 5
+grep -q "line: 6" $RESULTS
+
+# Take many quotes with different nonces from a manifest and verify them
+QUOTES=$TEMP_DIR/quotes.take
+rm -f $MANIFEST $QUOTES
+for i in 1 2 3; do
+    printf "nonce $i" > $TEMP_DIR/nonce.$i
+    echo "$TEMP_DIR/nonce.$i $QUOTE_INFO.$i $SIGNATURE_FILE.$i $PCR_LOG.$i" \
+        >> $QUOTES
+    echo "ext/myNewParent $QUOTE_INFO.$i $SIGNATURE_FILE.$i $PCR_LOG.$i "\
+"$TEMP_DIR/nonce.$i" >> $MANIFEST
+done
+tss2 quote --keyPath=$KEY_PATH --pcrList="11, 12, 13, 14, 15, 16" \
+    --manifest=$QUOTES --force > $RESULTS
+test $(grep -c "quoted: true" $RESULTS) -eq 3
+cmp $PCR_LOG.1 $PCR_LOG.3
+tss2 verifyquote --manifest=$MANIFEST > $RESULTS
+test $(grep -c "verified: true" $RESULTS) -eq 3
+
 exit 0
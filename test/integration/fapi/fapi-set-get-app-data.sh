@@ -73,4 +73,26 @@ EOF
 # Try with missing appData
 tss2 getappdata --path=$KEY_PATH
 
+# Set the appdata of a list of objects from a directory, the last of a path
+BULK_LIST=$TEMP_DIR/objects.list
+BULK_DIR=$TEMP_DIR/appdata_dir
+mkdir -p $BULK_DIR
+printf "$KEY_PATH\n# a comment\n$KEY_PATH\n" > $BULK_LIST
+echo -n "bulk" > $BULK_DIR/HS_SRK_myRSACrypt
+tss2 setappdata --path=$BULK_LIST --appData=$BULK_DIR --bulk
+tss2 getappdata --path=$KEY_PATH --appData=$APP_DATA_FILE --force
+if [ "$(< $APP_DATA_FILE)" != "bulk" ]; then
+  echo "Bulk appdata not set"
+  exit 99
+fi
+
+# and from a framed stream, of which the last frame of the path is kept
+printf "\x00\x00\x00\x03one\x00\x00\x00\x03two" | \
+    tss2 setappdata --path=$BULK_LIST --appData=- --bulk
+tss2 getappdata --path=$KEY_PATH --appData=$APP_DATA_FILE --force
+if [ "$(< $APP_DATA_FILE)" != "two" ]; then
+  echo "Bulk appdata not set from the stream"
+  exit 99
+fi
+
 exit 0
@@ -72,4 +72,25 @@ if {[lindex \$ret 2] || [lindex \$ret 3] != 1} {
 }
 EOF
 
+# Set the descriptions of a list of objects from a directory
+BULK_LIST=$TEMP_DIR/objects.list
+BULK_DIR=$TEMP_DIR/descriptions_dir
+mkdir -p $BULK_DIR
+echo "$KEY_PATH" > $BULK_LIST
+echo "bulk description" > $BULK_DIR/HS_SRK_myRSACrypt
+tss2 setdescription --path=$BULK_LIST --description=$BULK_DIR --bulk
+tss2 getdescription --path=$KEY_PATH --description=$DESCRIPTION_FILE --force
+if [ "$(< $DESCRIPTION_FILE)" != "bulk description" ]; then
+  echo "Bulk description not set"
+  exit 99
+fi
+
+# Setting the same description again leaves it as it is
+tss2 setdescription --path=$BULK_LIST --description=$BULK_DIR --bulk
+tss2 getdescription --path=$KEY_PATH --description=$DESCRIPTION_FILE --force
+if [ "$(< $DESCRIPTION_FILE)" != "bulk description" ]; then
+  echo "Bulk description changed"
+  exit 99
+fi
+
 exit 0
@@ -131,6 +131,20 @@ tss2 sign --keyPath=$KEY_PATH --digest=$DIGEST_FILE \
     --signature=$SIGNATURE_FILE --publicKey=$PUBLIC_KEY_FILE --force
 fi
 
+# Sign a directory of digests in bulk
+mkdir -p $TEMP_DIR/digests
+for i in 1 2 3; do
+    echo -n "0123456789012345678$i" > $TEMP_DIR/digests/digest$i
+done
+tss2 sign --keyPath=$KEY_PATH --digest=$TEMP_DIR/digests \
+    --signature=$TEMP_DIR/signatures --publicKey=$PUBLIC_KEY_FILE --bulk \
+    --force
+for i in 1 2 3; do
+    tss2 verifysignature --keyPath=$KEY_PATH \
+        --digest=$TEMP_DIR/digests/digest$i \
+        --signature=$TEMP_DIR/signatures/digest$i
+done
+
 # Try without public key
 if [ "$CRYPTO_PROFILE" = "RSA" ]; then
 tss2 sign --keyPath=$KEY_PATH --padding="RSA_PSS" --digest=$DIGEST_FILE \
@@ -329,4 +343,24 @@ if {[lindex \$ret 2] || [lindex \$ret 3] != 1} {
 }
 EOF
 
+# Verify many signatures from a manifest
+MANIFEST=$TEMP_DIR/signatures.manifest
+RESULTS=$TEMP_DIR/results.yaml
+rm -f $MANIFEST
+for i in 1 2 3 4; do
+    echo "$PUB_KEY_DIR/$IMPORTED_KEY_NAME $DIGEST_FILE $SIGNATURE_FILE" \
+        >> $MANIFEST
+done
+tss2 verifysignature --manifest=$MANIFEST --jobs=2 > $RESULTS
+test $(grep -c "verified: true" $RESULTS) -eq 4
+
+# A signature failing to verify fails the manifest, the others still verify
+echo "$PUB_KEY_DIR/$IMPORTED_KEY_NAME $EMPTY_FILE $SIGNATURE_FILE" >> $MANIFEST
+if tss2 verifysignature --manifest=$MANIFEST > $RESULTS 2> $LOG_FILE; then
+    echo "Expected the manifest to fail"
+    exit 1
+fi
+test $(grep -c "verified: true" $RESULTS) -eq 4
+grep -q "line: 5" $RESULTS
+
 exit 0
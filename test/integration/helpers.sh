@@ -220,6 +220,33 @@ with open("$1") as f:
 pyscript
 }
 
+#
+# Given a context archive as argument 1, prints the context named by
+# argument 2, or the names of all the contexts without argument 2.
+#
+function ctx_archive_get() {
+
+python << pyscript
+from __future__ import print_function
+
+import struct
+import sys
+
+with open("$1", "rb") as f:
+    d = f.read()
+count = struct.unpack(">I", d[8:12])[0]
+for i in range(count):
+    no, ns, do, ds = struct.unpack(">IIII", d[12 + 16 * i:28 + 16 * i])
+    name = d[no:no + ns].decode()
+    if not "$2":
+        print(name)
+    elif name == "$2":
+        getattr(sys.stdout, "buffer", sys.stdout).write(d[do:do + ds])
+        sys.exit(0)
+sys.exit(1 if "$2" else 0)
+pyscript
+}
+
 function recreate_info() {
     echo
     echo "--- To recreate this test run the following: ---"
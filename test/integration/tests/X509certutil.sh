@@ -45,6 +45,31 @@ if [ $? -ne 0 ]; then
 fi
 rm $outfile
 
+# Generate many certs from a manifest, the options being the defaults
+cat > certs.csv <<EOF
+# outcert, days, subject, issuer
+cert1.der,10,C=US;CN=cname1
+cert2.der,-,C=US;CN=cname2,C=US;CN=issuer2
+
+cert3.der
+EOF
+tpm2 certifyX509certutil --manifest=certs.csv -i "C=US;CN=issuer"
+for i in 1 2 3; do
+    openssl asn1parse -in cert$i.der -inform DER > cert$i.txt || exit 1
+done
+grep -q "cname1" cert1.txt && grep -q ":issuer$" cert1.txt || exit 1
+grep -q "cname2" cert2.txt && grep -q "issuer2" cert2.txt || exit 1
+grep -q "example" cert3.txt || exit 1
+rm -f cert1.der cert2.der cert3.der cert1.txt cert2.txt cert3.txt
+
+# a manifest line without supported subject fields fails
+echo "cert1.der,10,B=USA" > certs.csv
+if tpm2 certifyX509certutil --manifest=certs.csv &>/dev/null; then
+    echo "Expected a manifest with an invalid subject to fail."
+    exit 1
+fi
+rm -f certs.csv cert1.der
+
 # Negative tests
 # generate cert in non-existing path
 if tpm2 certifyX509certutil -o /non/existing/path/$outfile &>/dev/null; then
@@ -20,7 +20,8 @@ cleanup() {
     rm -f $file_pcr_value $file_policy $file_session_file $file_private_key \
     $file_public_key $file_verifying_key_public $file_verifying_key_name \
     $file_verifying_key_ctx $file_policyref $file_authorized_policy_1 \
-    $file_authorized_policy_2
+    $file_authorized_policy_2 owner_key_ctx owner_key_name signed.data \
+    policy.signature approved.store session_policy
 
     tpm2 flushcontext $file_session_file 2>/dev/null || true
 
@@ -73,4 +74,31 @@ $file_authorized_policy_2 $file_verifying_key_name
 
 diff $file_authorized_policy_1 $file_authorized_policy_2
 
+# Test the approved-policy store, the NULL hierarchy produces no ticket
+tpm2 loadexternal -G rsa -C o -u $file_public_key -c owner_key_ctx \
+-n owner_key_name
+generate_policy_authorize $file_policy $file_policyref \
+$file_authorized_policy_1 owner_key_name
+
+cat $file_policy $file_policyref > signed.data
+openssl dgst -sha256 -sign $file_private_key -out policy.signature signed.data
+
+satisfy_policy_authorize () {
+    tpm2 startauthsession -Q -S $file_session_file --policy-session
+    tpm2 policypcr -Q -S $file_session_file -l ${alg_pcr_policy}:${pcr_ids}
+    tpm2 policyauthorize -Q -S $file_session_file -L session_policy \
+    -i $file_policy -q $file_policyref --ticket-cache approved.store "$@"
+    tpm2 flushcontext $file_session_file
+    rm $file_session_file
+    diff session_policy $file_authorized_policy_1
+}
+
+# the first authorization verifies the signature and stores its ticket
+satisfy_policy_authorize -n owner_key_name -c owner_key_ctx \
+-s policy.signature -f rsassa -g sha256
+test -s approved.store
+
+# the next ones need neither the signer key nor the signature
+satisfy_policy_authorize -n owner_key_name
+
 exit 0
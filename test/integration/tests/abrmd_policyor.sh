@@ -15,7 +15,8 @@ cleanup() {
     rm -f $policy_1 $policy_2 $policy_init $test_vector $policyor_cc \
     $session_ctx $policy_digest $concatenated \
     set1.pcr0.policy set2.pcr0.policy prim.ctx sealkey.priv sealkey.pub \
-    sealkey.ctx policyOR
+    sealkey.ctx policyOR policy.tree tree.yaml leaf.*.policy \
+    list.tree list.yaml digest.list
 
     tpm2 flushcontext $session_ctx 2>/dev/null || true
 
@@ -91,4 +92,42 @@ echo $unsealed
 tpm2 flushcontext session.ctx
 rm session.ctx
 
+# Test case to compound more than 8 policies in a tree
+leaves=set1.pcr0.policy
+for i in `seq 1 20`; do
+    dd if=/dev/urandom of=leaf.$i.policy bs=1 count=32 2>/dev/null
+    leaves="$leaves,leaf.$i.policy"
+done
+leaves="$leaves,set2.pcr0.policy"
+
+trap - ERR
+tpm2 policyor -S $session_ctx -L policyOR sha256:$leaves 2>/dev/null
+if [ $? -eq 0 ]; then
+    echo "Expected more than 8 policies to fail without --tree"
+    exit 1
+fi
+trap onerror ERR
+
+tpm2 policyor --tree=policy.tree -L policyOR sha256:$leaves > tree.yaml
+test "$(yaml_get_kv tree.yaml depth)" -eq 2
+
+# The same tree from a digest list on stdin
+for f in ${leaves//,/ }; do
+    echo "sha256=$(xxd -p -c 64 $f) # $f"
+done > digest.list
+tpm2 policyor --tree=list.tree --digest-list=- < digest.list > list.yaml
+test "$(yaml_get_kv list.yaml root)" == "$(yaml_get_kv tree.yaml root)"
+
+tpm2 create -g sha256 -u sealkey.pub -r sealkey.priv -L policyOR -C prim.ctx \
+-i- <<< "secretpass"
+tpm2 load -C prim.ctx -c sealkey.ctx -u sealkey.pub -r sealkey.priv
+
+tpm2 startauthsession -S session.ctx --policy-session
+tpm2 policypcr -S session.ctx -l sha1:23
+tpm2 policyor -S session.ctx --tree=policy.tree
+unsealed=`tpm2 unseal -p session:session.ctx -c sealkey.ctx`
+test "$unsealed" == "secretpass"
+tpm2 flushcontext session.ctx
+rm session.ctx
+
 exit 0
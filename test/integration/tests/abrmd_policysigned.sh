@@ -5,7 +5,7 @@ source helpers.sh
 cleanup() {
     rm -f session.ctx secret.dat private.pem public.pem signature.dat \
     signing_key.ctx policy.signed prim.ctx sealing_key.priv sealing_key.pub \
-    unsealed.dat qual.dat to_sign.bin
+    unsealed.dat qual.dat to_sign.bin stream.yaml
 
     tpm2 flushcontext $session_ctx 2>/dev/null || true
 
@@ -102,6 +102,25 @@ tpm2 flushcontext session.ctx
 diff secret.dat unsealed.dat
 rm -f unsealed.dat
 
+#
+# Test a stream of signed authorizations bound to the nonceTPM
+#
+tpm2 startauthsession -S session.ctx --policy-session
+echo "nonce" | tpm2 policysigned -S session.ctx -c signing_key.ctx \
+--stream=- > stream.yaml
+grep -q "nonce-tpm: " stream.yaml
+tpm2 policysigned -S session.ctx -c signing_key.ctx -x --raw-data to_sign.bin
+openssl dgst -sha256 -sign private.pem -out signature.dat to_sign.bin
+### The TPMT_SIGNATURE of RSASSA with SHA256 and the 2048 bit signature
+sig="0014000b0100$(xxd -p -c 256 signature.dat)"
+printf "# one authorization\nsign 0 $sig - -\n" | \
+tpm2 policysigned -S session.ctx -c signing_key.ctx -x --stream=- > stream.yaml
+grep -q "authorized: true" stream.yaml
+tpm2 unseal -p session:session.ctx -c sealing_key.ctx -o unsealed.dat
+tpm2 flushcontext session.ctx
+diff secret.dat unsealed.dat
+rm -f unsealed.dat
+
 #
 # Test with cpHashA with ECDSA signature
 #
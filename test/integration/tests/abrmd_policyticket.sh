@@ -5,7 +5,8 @@ source helpers.sh
 cleanup() {
     rm -f session.ctx secret.dat private.pem public.pem signature.dat \
     signing_key.ctx policy.signed prim.ctx sealing_key.priv sealing_key.pub \
-    unsealed.dat qual.dat time.out tic.ket authobj.name to_sign.bin
+    unsealed.dat qual.dat time.out tic.ket authobj.name to_sign.bin \
+    tickets.cache
 
     tpm2 flushcontext session.ctx 2>/dev/null || true
 
@@ -95,4 +96,34 @@ tpm2 flushcontext session.ctx
 
 diff secret.dat unsealed.dat
 
+rm -f unsealed.dat
+
+#
+# Test with a ticket cache, nothing is cached yet
+#
+tpm2 startauthsession -S session.ctx --policy-session
+trap - ERR
+tpm2 policyticket -S session.ctx -n authobj.name --ticket-cache tickets.cache
+if [ $? -eq 0 ]; then
+    echo "policyticket should fail without a cached ticket"
+    exit 1
+fi
+trap onerror ERR
+
+tpm2 policysecret -S session.ctx -c o -t -500 --ticket-cache tickets.cache
+tpm2 unseal -p"session:session.ctx" -c sealing_key.ctx -o unsealed.dat
+tpm2 flushcontext session.ctx
+diff secret.dat unsealed.dat
+
+# Every later session is satisfied from the cache
+for i in 1 2; do
+    rm -f unsealed.dat
+    tpm2 startauthsession -S session.ctx --policy-session
+    tpm2 policyticket -S session.ctx -n authobj.name \
+    --ticket-cache tickets.cache
+    tpm2 unseal -p"session:session.ctx" -c sealing_key.ctx -o unsealed.dat
+    tpm2 flushcontext session.ctx
+    diff secret.dat unsealed.dat
+done
+
 exit 0
@@ -4,7 +4,8 @@ source helpers.sh
 
 cleanup() {
     rm -f secret.data ek.pub ak.pub ak.name mkcred.out actcred.out ak.out \
-    ak.ctx session.ctx
+    ak.ctx session.ctx secret2.data mkcred2.out actcred2.out manifest.txt \
+    manifest.yaml
 
     # Evict persistent handles, we want them to always succeed and never trip
     # the onerror trap.
@@ -44,6 +45,55 @@ tpm2 flushcontext session.ctx
 
 diff actcred.out secret.data
 
+# Activate several credentials with the policy session reused
+echo 87654321 > secret2.data
+tpm2 makecredential -Q -u ek.pem -s secret2.data -n $loaded_key_name \
+-o mkcred2.out -G rsa
+rm -f actcred.out
+
+cat > manifest.txt <<EOF
+# blob certinfo
+mkcred.out actcred.out
+mkcred2.out actcred2.out
+EOF
+
+tpm2 startauthsession --policy-session -S session.ctx
+tpm2 policysecret -S session.ctx -c e
+tpm2 activatecredential -c ak.ctx -C 0x81010009 -p akpass \
+-P"session:session.ctx" --manifest manifest.txt > manifest.yaml
+tpm2 flushcontext session.ctx
+
+diff actcred.out secret.data
+diff actcred2.out secret2.data
+test "$(grep -c 'activated: true' manifest.yaml)" -eq 2
+
+# A line that fails does not stop the others
+echo "missing.out actcred.out" > manifest.txt
+echo "mkcred2.out actcred2.out" >> manifest.txt
+rm -f actcred2.out
+tpm2 startauthsession --policy-session -S session.ctx
+tpm2 policysecret -S session.ctx -c e
+trap - ERR
+tpm2 activatecredential -c ak.ctx -C 0x81010009 -p akpass \
+-P"session:session.ctx" --manifest manifest.txt > manifest.yaml
+if [ $? -eq 0 ]; then
+    echo "Expected a failed line to fail the tool"
+    exit 1
+fi
+trap onerror ERR
+tpm2 flushcontext session.ctx
+diff actcred2.out secret2.data
+
+# The manifest names the outputs
+trap - ERR
+tpm2 activatecredential -c ak.ctx -C 0x81010009 -i mkcred.out \
+--manifest manifest.txt 2>/dev/null
+if [ $? -eq 0 ]; then
+    echo "Expected --manifest with -i to fail"
+    exit 1
+fi
+trap onerror ERR
+
 # Capture the yaml output and verify that its the same as the name output
 loaded_key_name_yaml=`python << pyscript
 from __future__ import print_function
@@ -0,0 +1,128 @@
+# SPDX-License-Identifier: BSD-3-Clause
+
+source helpers.sh
+
+cleanup() {
+    rm -f batch.in random.out prim.ctx key.pub key.priv key.ctx msg.dat \
+    sig.rssa pcr.out batch.log pcr.policy ecc.ctx enc.ctx
+
+    if [ "$1" != "no-shut-down" ]; then
+        shut_down
+    fi
+}
+trap cleanup EXIT
+
+start_up
+
+cleanup "no-shut-down"
+
+echo "message to sign" > msg.dat
+
+cat > batch.in << EOF
+# comments and blank lines are skipped
+
+getrandom -o random.out 16
+tpm2 createprimary -Q -C o -c prim.ctx
+create -Q -C prim.ctx -G rsa -u key.pub -r key.priv
+load -Q -C prim.ctx -u key.pub -r key.priv -c key.ctx
+sign -c key.ctx -g sha256 -o sig.rssa "msg.dat"
+verifysignature -c key.ctx -g sha256 -m msg.dat -s sig.rssa
+EOF
+
+tpm2 batch batch.in
+
+test -s sig.rssa
+s=`ls -l random.out | awk {'print $5'}`
+test $s -eq 16
+
+# the HMAC session of one line is reused by the next equivalent one
+line="sign -V -c key.ctx -g sha256 -o sig.rssa msg.dat"
+printf "%s\n%s\n" "$line" "$line" | tpm2 batch 2> batch.log
+grep -q "Reusing pooled session" batch.log
+
+# the key loaded by one line stays loaded for the next one
+grep -q "Using cached object" batch.log
+
+# a modified context file is loaded again
+printf "%s\n%s\n%s\n%s\n" "$line" "$line" \
+"load -Q -C prim.ctx -u key.pub -r key.priv -c key.ctx" "$line" | \
+tpm2 batch 2> batch.log
+test $(grep -c "Using cached object" batch.log) -eq 1
+
+# an object flushed by a tool is loaded again, not used through its handle
+printf "%s\n%s\n%s\n" "$line" "flushcontext -t" "$line" | \
+tpm2 batch 2> batch.log
+! grep -q "Using cached object: " batch.log
+test -s sig.rssa
+
+# the PCRs read by one line are reused by the next one until they change
+pcrs="pcrread -Q sha256:0,1"
+policy="createpolicy -V --policy-pcr -l sha256:0,1 -L pcr.policy"
+printf "%s\n%s\n" "$pcrs" "$policy" | tpm2 batch 2> batch.log
+grep -q "Using the PCR values cached" batch.log
+test -s pcr.policy
+
+printf "%s\n%s\n%s\n" "$pcrs" "pcrextend 1:sha256=$(printf '%064d' 1)" \
+"$policy" | tpm2 batch 2> batch.log
+! grep -q "Using the PCR values cached" batch.log
+
+# a session saved by the user stays loaded and is saved when the batch exits
+cat > batch.in << EOF
+createprimary -Q -C o -G ecc -c ecc.ctx
+startauthsession -V --hmac-session --tpmkey-context ecc.ctx -S enc.ctx
+sessionconfig enc.ctx --enable-encrypt --enable-decrypt
+getrandom -V -S enc.ctx -o random.out 16
+getrandom -V -S enc.ctx -o random.out 16
+EOF
+tpm2 batch batch.in 2> batch.log
+grep -q "Salting the session with ECDH" batch.log
+test $(grep -c "Restored live session" batch.log) -eq 3
+test -s enc.ctx
+tpm2 getrandom -S enc.ctx -o random.out 16
+tpm2 flushcontext enc.ctx
+
+# commands from stdin
+echo "pcrread -o pcr.out sha256:0" | tpm2 batch
+test -s pcr.out
+
+# outputs passed as references, no context file is written
+rm -f sig.rssa
+cat > batch.in << EOF
+createprimary -Q -C o -c @prim
+create -Q -C @prim -G rsa -u @key.pub -r @key.priv
+load -Q -C @prim -u @key.pub -r @key.priv -c @key
+sign -c @key -g sha256 -o sig.rssa "msg.dat"
+readpublic -c @key -o key.pub
+EOF
+tpm2 batch batch.in
+test -s sig.rssa
+test ! -e @prim -a ! -e @key -a ! -e @key.pub
+tpm2 loadexternal -Q -C n -u key.pub -c enc.ctx
+tpm2 verifysignature -c enc.ctx -g sha256 -m msg.dat -s sig.rssa
+
+# negative tests
+trap - ERR
+
+# the batch stops at the first failure
+rm -f random.out
+printf "unknowntool\ngetrandom -o random.out 16\n" | tpm2 batch &> /dev/null
+if [ $? -eq 0 ] || [ -f random.out ]; then
+    echo "tpm2 batch should stop at the first failing line"
+    exit 1
+fi
+
+# unless asked to keep going, but still report the failure
+printf "unknowntool\ngetrandom -o random.out 16\n" | tpm2 batch -k &> /dev/null
+if [ $? -eq 0 ] || [ ! -f random.out ]; then
+    echo "tpm2 batch --keep-going should run all lines"
+    exit 1
+fi
+
+# unterminated quotes are an error
+echo "getrandom -o 'random.out 16" | tpm2 batch &> /dev/null
+if [ $? -eq 0 ]; then
+    echo "tpm2 batch should fail on unterminated quotes"
+    exit 1
+fi
+
+exit 0
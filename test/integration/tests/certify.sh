@@ -4,7 +4,8 @@ source helpers.sh
 
 cleanup() {
     rm -f primary.ctx certify.ctx certify.pub certify.priv certify.name \
-    attest.out sig.out &>/dev/null
+    attest.out sig.out manifest.txt certify.yaml primary.attest primary.sig \
+    key.attest key.sig &>/dev/null
 
     if [ "$1" != "no-shut-down" ]; then
         shut_down
@@ -27,4 +28,24 @@ tpm2 load -Q -C primary.ctx -u certify.pub -r certify.priv -n certify.name \
 
 tpm2 certify -Q -c primary.ctx -C certify.ctx -g sha256 -o attest.out -s sig.out
 
+# Several certifications with one signing key load
+cat > manifest.txt <<END
+# object qualification attestation signature
+primary.ctx - primary.attest primary.sig
+
+certify.ctx a1b2c3d4 key.attest key.sig
+END
+
+tpm2 certify -C certify.ctx -g sha256 --manifest=manifest.txt > certify.yaml
+test $(grep -c "certified: true" certify.yaml) -eq 2
+xxd -p key.attest | tr -d '\n' | grep a1b2c3d4
+
+trap - ERR
+
+tpm2 certify -Q -c primary.ctx -C certify.ctx --manifest=manifest.txt
+if [ $? -eq 0 ]; then
+    echo "Expected --manifest and -c to conflict" 1>&2
+    exit 1
+fi
+
 exit 0
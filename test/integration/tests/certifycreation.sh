@@ -5,7 +5,8 @@ source helpers.sh
 cleanup() {
     rm -f  primary.ctx creation.data creation.digest creation.ticket rsa.pub \
     rsa.priv signature.bin attestation.bin sslpub.pem qual.dat sec_key.pub \
-    sec_key.priv sec_key.ctx
+    sec_key.priv sec_key.ctx keys.txt certify.txt key?.pub key?.priv \
+    key?.ctx key?.dig key?.ticket key?.attest key?.sig certify.yaml
 
     if [ "$1" != "no-shut-down" ]; then
         shut_down
@@ -60,4 +61,29 @@ tpm2 certifycreation -C signing_key.ctx -c sec_key.ctx -d creation.digest \
 openssl dgst -verify sslpub.pem -keyform pem -sha256 -signature signature.bin \
 attestation.bin
 
+#
+# Test certifying the keys of a create manifest
+#
+cat > keys.txt <<EOF
+rsa - - key1.pub key1.priv key1.ctx key1.dig key1.ticket
+ecc - - key2.pub key2.priv - key2.dig key2.ticket
+EOF
+tpm2 create -C primary.ctx --manifest=keys.txt > /dev/null
+
+tpm2 load -C primary.ctx -u key2.pub -r key2.priv -c key2.ctx -Q
+
+cat > certify.txt <<EOF
+# object hash ticket attestation signature
+key1.ctx key1.dig key1.ticket key1.attest key1.sig
+key2.ctx key2.dig key2.ticket key2.attest key2.sig
+EOF
+tpm2 certifycreation -C signing_key.ctx -g sha256 -f plain -s rsassa \
+--manifest=certify.txt > certify.yaml
+test "$(grep -c 'certified: true' certify.yaml)" -eq 2
+
+for i in 1 2; do
+  openssl dgst -verify sslpub.pem -keyform pem -sha256 -signature key$i.sig \
+  key$i.attest
+done
+
 exit 0
@@ -3,7 +3,9 @@
 source helpers.sh
 
 cleanup() {
-    rm key.ctx key.pub key.priv primary.ctx
+    rm -f key.ctx key.pub key.priv primary.ctx manifest.txt manifest.yaml \
+        key[123].ctx key[123].pub key[123].priv key[123].new.priv \
+        key[123].check.priv
 
     shut_down
 }
@@ -51,5 +53,39 @@ tpm2 nvdefine   $NVIndex -C o -s 32 -a "authread|authwrite" -L policy.nvchange
 tpm2 startauthsession --policy-session -S session.ctx
 tpm2 policycommandcode -S session.ctx -L policy.nvchange TPM2_CC_NV_ChangeAuth
 tpm2 changeauth -p session:session.ctx -c $NVIndex newindexauth
+tpm2 flushcontext session.ctx
+
+# Test rotating the auths of many objects and the owner with a manifest
+rm -f manifest.txt
+for i in 1 2 3; do
+  tpm2 create -Q -C primary.ctx -p old$i -u key$i.pub -r key$i.priv
+  tpm2 load -Q -C primary.ctx -u key$i.pub -r key$i.priv -c key$i.ctx
+  echo "key$i.ctx primary.ctx old$i new$i key$i.new.priv" >> manifest.txt
+done
+echo "o - - newowner # the owner hierarchy" >> manifest.txt
+
+tpm2 changeauth --manifest=manifest.txt > manifest.yaml
+test "$(grep -c 'changed: true' manifest.yaml)" -eq 4
+
+for i in 1 2 3; do
+  tpm2 load -Q -C primary.ctx -u key$i.pub -r key$i.new.priv -c key$i.ctx
+  tpm2 changeauth -Q -C primary.ctx -p new$i -c key$i.ctx -r key$i.check.priv \
+    check
+done
+tpm2 changeauth -c o -p newowner
+
+# a wrong old auth fails its line only
+echo "key1.ctx primary.ctx wrong new1 key1.new.priv" > manifest.txt
+echo "o - - newowner" >> manifest.txt
+trap - ERR
+tpm2 changeauth --manifest=manifest.txt > manifest.yaml
+if [ $? -eq 0 ]; then
+  echo "A manifest with a failing line must fail"
+  exit 1
+fi
+trap onerror ERR
+test "$(grep -c 'changed: true' manifest.yaml)" -eq 1
+test "$(grep -c 'changed: false' manifest.yaml)" -eq 1
+tpm2 changeauth -c o -p newowner
 
 exit 0
@@ -21,7 +21,10 @@ output_quotepcr=quotepcr.out
 cleanup() {
   rm -f $output_ek_pub_pem $output_ak_pub_pem $output_ak_pub_name \
   $output_quote $output_quotesig $output_quotepcr rand.out $ak_ctx \
-  pcr.bin
+  pcr.bin nonce2.bin quote2.bin quote2.sig quote2.pcr quotes.manifest \
+  results.yaml golden.states golden.yaml pcr.bundle measurements.txt \
+  measurements.bin quote3.bin quote3.sig ca.key ca.crt int.key int.csr \
+  int.crt ca.bundle ak.crt ak.cache quote.bundle
 
   tpm2 pcrreset 16
   tpm2 evictcontrol -C o -c $handle_ek 2>/dev/null || true
@@ -90,4 +93,166 @@ tpm2 pcrread sha256:15,16,22 -o pcr.bin
 tpm2 checkquote -u ecc.ak.tpmt -m quote.bin -s quote.sig -g sha256 -q nonce.bin \
 -f pcr.bin -l sha256:15,16,22
 
+# Verify with the PCR values as a bundle, smaller than the serialized ones
+tpm2 pcrread sha256:15,16,22 -F bundle -o pcr.bundle
+test $(stat -c %s pcr.bundle) -lt $(stat -c %s quote.pcr)
+
+tpm2 checkquote -u ecc.ak.tpmt -m quote.bin -s quote.sig -g sha256 -q nonce.bin \
+-f pcr.bundle
+
+# Verify many quotes of two AKs from a manifest
+tpm2 getrandom -o nonce2.bin 20
+tpm2 quote -c ecc.ak -l sha256:15,16,22 -q nonce2.bin -m quote2.bin \
+-s quote2.sig -o quote2.pcr -g sha256
+
+cat > quotes.manifest <<EOF
+# public key, message, signature, pcrs and qualification
+$output_ak_pub_pem $output_quote $output_quotesig $output_quotepcr $loaded_randomness
+ecc.ak.pem quote.bin quote.sig quote.pcr nonce.bin
+
+ecc.ak.tss quote2.bin quote2.sig - nonce2.bin
+EOF
+
+tpm2 checkquote --manifest quotes.manifest -g sha256 --jobs 2 > results.yaml
+
+# prints the line and result of every quote
+results() {
+
+python << pyscript
+from __future__ import print_function
+
+import yaml
+
+with open("results.yaml") as f:
+    y = yaml.safe_load(f)
+    print(' '.join('%d:%s' % (r['line'], r['verified']) for r in y))
+pyscript
+}
+
+test "$(results)" = "2:True 3:True 5:True"
+
+# a quote missing its qualification fails, but not the others
+echo "ecc.ak.pem quote2.bin quote2.sig quote2.pcr" >> quotes.manifest
+
+trap - ERR
+tpm2 checkquote --manifest quotes.manifest -g sha256 > results.yaml
+if [ $? -eq 0 ]; then
+  echo "checkquote passed a manifest with a bad quote"
+  exit 1
+fi
+trap onerror ERR
+
+test "$(results)" = "2:True 3:True 5:True 6:False"
+
+# Verify PCR digests against golden states instead of PCR values
+digest=$(tpm2 print -t TPMS_ATTEST quote.bin | awk '/pcrDigest/ { print $2 }')
+cat > golden.states <<EOF
+# name, pcr selection and pcr digest
+other sha256:0 0000000000000000000000000000000000000000000000000000000000000000
+base sha256:15,16,22 $digest
+EOF
+
+tpm2 checkquote -u ecc.ak.pem -m quote.bin -s quote.sig -g sha256 -q nonce.bin \
+--golden golden.states > golden.yaml
+test "$(yaml_get_kv golden.yaml "golden")" = "base"
+
+tpm2 checkquote --manifest quotes.manifest -g sha256 --golden golden.states \
+> results.yaml || true
+test "$(results)" = "2:True 3:True 5:True 6:False"
+
+# a digest that is not golden needs the PCR values
+echo "other sha256:15,16 $digest" > golden.states
+trap - ERR
+tpm2 checkquote -u ecc.ak.pem -m quote.bin -s quote.sig -g sha256 -q nonce.bin \
+--golden golden.states
+if [ $? -eq 0 ]; then
+  echo "checkquote accepted a quote without golden state or PCR values"
+  exit 1
+fi
+trap onerror ERR
+
+tpm2 checkquote -u ecc.ak.pem -m quote.bin -s quote.sig -g sha256 -q nonce.bin \
+-f quote.pcr --golden golden.states
+
+# Verify the PCR digest against the replay of an event log, without PCR file
+tpm2 pcrreset 16
+cat > measurements.txt <<EOF
+16:sha256=$(echo -n measured | openssl dgst -sha256 -r | cut -d' ' -f1) 0xd
+EOF
+tpm2 pcrextend --manifest=measurements.txt --eventlog=measurements.bin
+tpm2 quote -c $handle_ak -l sha256:16 -q $loaded_randomness -m quote3.bin \
+-s quote3.sig -g $digestAlg -p "$akpw"
+tpm2 checkquote -u $output_ak_pub_pem -m quote3.bin -s quote3.sig \
+-e measurements.bin -g $digestAlg -q $loaded_randomness
+
+# a log that does not replay to the quoted PCRs
+tpm2 pcrextend --manifest=measurements.txt --eventlog=measurements.bin
+trap - ERR
+tpm2 checkquote -u $output_ak_pub_pem -m quote3.bin -s quote3.sig \
+-e measurements.bin -g $digestAlg -q $loaded_randomness
+if [ $? -eq 0 ]; then
+  echo "checkquote accepted an event log not matching the quote"
+  exit 1
+fi
+trap onerror ERR
+
+# AK certificates are verified to the CA once and cached
+if openssl x509 -help 2>&1 | grep -q -- '-force_pubkey' \
+    && openssl x509 -help 2>&1 | grep -q -- '-new'; then
+  openssl req -x509 -newkey rsa:2048 -nodes -keyout ca.key -out ca.crt \
+    -subj "/CN=root" -days 1 \
+    -addext basicConstraints=critical,CA:TRUE 2>/dev/null
+  openssl req -newkey rsa:2048 -nodes -keyout int.key -out int.csr \
+    -subj "/CN=intermediate" 2>/dev/null
+  openssl x509 -req -in int.csr -CA ca.crt -CAkey ca.key -days 1 \
+    -extfile <(echo basicConstraints=critical,CA:TRUE) -out int.crt \
+    2>/dev/null
+  cat ca.crt int.crt > ca.bundle
+  openssl x509 -new -force_pubkey $output_ak_pub_pem -subj "/CN=ak" \
+    -CA int.crt -CAkey int.key -days 1 -out ak.crt 2>/dev/null
+
+  echo "ak.crt $output_quote $output_quotesig $output_quotepcr $loaded_randomness" \
+    > quotes.manifest
+  rm -f ak.cache
+  tpm2 checkquote --manifest quotes.manifest -g sha256 --ak-ca ca.bundle \
+    --ak-cache ak.cache > results.yaml
+  test "$(results)" = "1:True"
+  grep -q '^SHA256:' ak.cache
+  tpm2 checkquote --manifest quotes.manifest -g sha256 --ak-ca ca.bundle \
+    --ak-cache ak.cache -V 2>&1 >/dev/null | grep -q "is cached as SHA256:"
+
+  # without its intermediate CA the certificate does not verify
+  trap - ERR
+  tpm2 checkquote --manifest quotes.manifest -g sha256 --ak-ca ca.crt \
+    > results.yaml
+  if [ $? -eq 0 ]; then
+    echo "checkquote accepted an AK certificate without its intermediate"
+    exit 1
+  fi
+  trap onerror ERR
+fi
+
+# a quote bundle carries the message, signature and PCR values in one file
+tpm2 quote -c ecc.ak -l sha256:15,16,22 -q nonce.bin -g sha256 \
+--bundle quote.bundle
+tpm2 checkquote -u ecc.ak.pem -g sha256 -q nonce.bin --bundle quote.bundle
+
+trap - ERR
+tpm2 checkquote -u ecc.ak.pem -g sha256 -q nonce.bin --bundle quote.bundle \
+-m quote.bin
+if [ $? -eq 0 ]; then
+  echo "checkquote accepted --bundle with --message"
+  exit 1
+fi
+trap onerror ERR
+
+# the manifest replaces the single quote options
+trap - ERR
+tpm2 checkquote --manifest quotes.manifest -u ecc.ak.pem
+if [ $? -eq 0 ]; then
+  echo "checkquote accepted --manifest with --public"
+  exit 1
+fi
+trap onerror ERR
+
 exit 0
@@ -7,6 +7,8 @@ cleanup() {
 
     tpm2 clear
 
+    rm -f cp.online.bin cp.offline.bin
+
     shut_down
 }
 trap cleanup EXIT
@@ -21,4 +23,20 @@ trap onerror ERR
 tpm2 clearcontrol
 tpm2 clear
 
+# The cpHash of a hierarchy command does not need a TPM
+tpm2 clearcontrol -C l s --cphash cp.online.bin
+tpm2 clearcontrol -C l s --cphash cp.offline.bin --tcti=none
+cmp cp.online.bin cp.offline.bin
+
+tpm2 clear --cphash cp.online.bin
+tpm2 clear --cphash cp.offline.bin --tcti=none
+cmp cp.online.bin cp.offline.bin
+
+trap - ERR
+tpm2 clear --tcti=none
+if [ $? -eq 0 ]; then
+    echo "Expected tpm2 clear without a TPM and --cphash to fail"
+    exit 1
+fi
+
 exit 0
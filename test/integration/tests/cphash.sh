@@ -0,0 +1,86 @@
+# SPDX-License-Identifier: BSD-3-Clause
+
+source helpers.sh
+
+nv_test_index=0x1500016
+
+cleanup() {
+    tpm2 nvundefine -Q $nv_test_index -C o 2>/dev/null || true
+
+    rm -f nv.dat nv.cphash nv_offset.cphash evict.cphash owner.cphash \
+    prim.ctx manifest cphash.yaml nv.yaml
+
+    if [ "$1" != "no-shut-down" ]; then
+        shut_down
+    fi
+}
+trap cleanup EXIT
+
+start_up
+
+cleanup "no-shut-down"
+
+tpm2 clear -Q
+
+# the cpHash of line n of the manifest
+cphash_of() {
+    grep "cphash:" cphash.yaml | sed -n "$1p" | awk '{print $2}'
+}
+
+hex() {
+    xxd -p "$1" | tr -d '\n'
+}
+
+echo -n "cphash data" > nv.dat
+
+tpm2 nvdefine -Q $nv_test_index -C o -s 32 -a "ownerread|ownerwrite"
+tpm2 createprimary -Q -C o -c prim.ctx
+
+tpm2 nvwrite $nv_test_index -C o -i nv.dat --cphash nv.cphash
+tpm2 nvwrite $nv_test_index -C o -i nv.dat --offset 8 \
+    --cphash nv_offset.cphash
+tpm2 evictcontrol -C o -c prim.ctx 0x81010005 --cphash evict.cphash
+
+cat > manifest << EOF
+# the names of the NV index and the primary key are read from the TPM
+nvwrite o $nv_test_index nv.dat
+nvwrite o $nv_test_index nv.dat 8
+evictcontrol o prim.ctx 0x81010005
+EOF
+
+tpm2 cphash manifest > cphash.yaml
+yaml_verify cphash.yaml
+
+test "$(cphash_of 1)" = "$(hex nv.cphash)"
+test "$(cphash_of 2)" = "$(hex nv_offset.cphash)"
+test "$(cphash_of 3)" = "$(hex evict.cphash)"
+
+# Without a TPM the names are given
+tpm2 nvreadpublic > nv.yaml
+name=$(yaml_get_kv nv.yaml "$nv_test_index" "name")
+
+echo "nvwrite o name:$name nv.dat 8" | tpm2 cphash --tcti=none > cphash.yaml
+test "$(cphash_of 1)" = "$(hex nv_offset.cphash)"
+
+tpm2 changeauth -c o newpass --cphash owner.cphash
+echo "hierarchychangeauth o newpass" | tpm2 cphash --tcti=none > cphash.yaml
+test "$(cphash_of 1)" = "$(hex owner.cphash)"
+
+# The name of an NV index is not known without a TPM
+trap - ERR
+echo "nvwrite o $nv_test_index nv.dat" | tpm2 cphash --tcti=none
+if [ $? -eq 0 ]; then
+    echo "Expected the NV index name lookup without a TPM to fail"
+    exit 1
+fi
+
+# -k continues after a failing line
+printf "unknown o\nhierarchychangeauth o newpass\n" | \
+    tpm2 cphash -k --tcti=none > cphash.yaml
+if [ $? -eq 0 ]; then
+    echo "Expected the unknown command to fail"
+    exit 1
+fi
+test "$(cphash_of 1)" = "$(hex owner.cphash)" || exit 1
+
+exit 0
@@ -119,4 +119,28 @@ tpm2 flushcontext enc_session.ctx
 tpm2_create -C primary.ctx -u obj.pub -r obj.priv -f pem -o obj.pem
 openssl rsa -noout -text -inform PEM -in obj.pem -pubin
 
+# Test several keys with one load of the parent
+cat > keys.txt <<END
+# key-algorithm attributes key-auth public private key-context
+rsa2048 - - rsa1.pub rsa1.priv
+rsa2048 - str:apple rsa2.pub rsa2.priv rsa2.ctx
+
+ecc256 sign|fixedtpm|fixedparent|userwithauth - ecc.pub ecc.priv
+END
+
+tpm2 create -C prim.ctx --manifest=keys.txt > keys.yaml
+test $(grep -c "created: true" keys.yaml) -eq 3
+tpm2 load -Q -C prim.ctx -u rsa1.pub -r rsa1.priv -c rsa1.ctx
+tpm2 sign -Q -c rsa2.ctx -p apple -g sha256 -o sig.bin keys.txt
+
+trap - ERR
+
+tpm2 create -Q -C prim.ctx -G rsa --manifest=keys.txt
+if [ $? -eq 0 ]; then
+    echo "Expected --manifest and -G to conflict" 1>&2
+    exit 1
+fi
+
+rm -f keys.txt keys.yaml rsa1.* rsa2.* ecc.pub ecc.priv sig.bin
+
 exit 0
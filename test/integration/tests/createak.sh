@@ -3,7 +3,8 @@
 source helpers.sh
 
 cleanup() {
-    rm -f ek.pub ak.pub ak.name ak.name ak.log
+    rm -f ek.pub ak.pub ak.name ak.name ak.log pool.yaml ak.qname ak.qname2
+    rm -rf ak_pool
 
     # Evict persistent handles, we want them to always succeed and never trip
     # the onerror trap.
@@ -39,6 +40,36 @@ tpm2 evictcontrol -c ak.ctx > ak.log
 phandle=`yaml_get_kv ak.log "persistent-handle"`
 tpm2 evictcontrol -Q -C o -c $phandle
 
+# Pre-generated AKs are handed out once each
+mkdir -p ak_pool
+tpm2 createak -C 0x8101000b -G rsa -g sha256 -s rsassa --pool=ak_pool \
+--fill-pool=2 > pool.yaml
+test "$(yaml_get_kv pool.yaml pool created)" -eq 2
+
+# the pool is only topped up
+tpm2 createak -C 0x8101000b -G rsa -g sha256 -s rsassa --pool=ak_pool \
+--fill-pool=2 > pool.yaml
+test "$(yaml_get_kv pool.yaml pool created)" -eq 0
+
+tpm2 createak -Q -C 0x8101000b -G rsa -g sha256 -s rsassa --pool=ak_pool \
+--from-pool -c ak.ctx -u ak.pub -q ak.qname
+tpm2 readpublic -c ak.ctx -q ak.qname2
+diff ak.qname ak.qname2
+test $(ls ak_pool | grep -c "\.priv$") -eq 1
+
+# AKs of another template stay in the pool
+tpm2 createak -Q -C 0x8101000b -G ecc -g sha256 -s ecdsa --pool=ak_pool \
+--from-pool -c ak.ctx
+test $(ls ak_pool | grep -c "\.priv$") -eq 1
+
+tpm2 createak -Q -C 0x8101000b -G rsa -g sha256 -s rsassa --pool=ak_pool \
+--from-pool -c ak.ctx
+test $(ls ak_pool | grep -c "\.priv$") -eq 0
+
+# an empty pool falls back to creating the AK
+tpm2 createak -Q -C 0x8101000b -G rsa -g sha256 -s rsassa --pool=ak_pool \
+--from-pool -c ak.ctx
+
 # Test tpm2 createak with endorsement password
 cleanup "no-shut-down"
 tpm2 changeauth -c e endauth
@@ -51,6 +51,15 @@ tpm2 nvwrite -Q $ek_nonce_index -C o -i ek.nonce
 
 tpm2 createek -t -G rsa -u ek.pub -c ek.ctx
 
+# the saved template has the NV template and nonce in place
+tpm2 createek -t -G rsa --save-template=ek.tmpl > ek.log
+grep -q "template-digest:" ek.log
+tpm2 nvundefine -Q $ek_template_index -C o
+tpm2 nvundefine -Q $ek_nonce_index -C o
+tpm2 createek --load-template=ek.tmpl -u ek.loaded.pub -c ek.ctx
+cmp ek.pub ek.loaded.pub
+rm -f ek.tmpl ek.loaded.pub
+
 cleanup "no-shut-down"
 
 exit 0
@@ -5,7 +5,8 @@ source helpers.sh
 ###this script use for test the implementation tpm2 createpolicy
 
 cleanup() {
-    rm -f pcr.in policy.out
+    rm -f pcr.in policy.out session.ctx offline.policy tpm.policy pcr.b \
+          policy.tree tree.policy branch-a.policy branch-b.policy
 
     if [ "$1" != "no-shut-down" ]; then
       shut_down
@@ -43,6 +44,72 @@ do
         echo "Expected: ${expected_policy_digest[${halg}]}"
         exit 1
     fi
+
+    # The same digest computed on the host
+    tpm2 createpolicy -T none --policy-pcr -l $halg:0 -f pcr.in -L policy.out
+
+    if [ $(xxd -p policy.out | tr -d '\n' ) != \
+    "${expected_policy_digest[${halg}]}" ]; then
+        echo "Failure: Creating Policy Digest without a TPM"
+        echo "Got: $(xxd -p policy.out | tr -d '\n')"
+        exit 1
+    fi
 done
 
+# A policy chain in a trial session without a TPM matches the TPM one
+head -c 31 /dev/zero > pcr.in
+echo -n -e '\x03' >> pcr.in
+
+tpm2 startauthsession -T none -S session.ctx
+tpm2 policypcr -T none -S session.ctx -l sha256:0 -f pcr.in
+tpm2 policycommandcode -T none -S session.ctx TPM2_CC_Unseal
+tpm2 policyauthvalue -T none -S session.ctx -L offline.policy
+
+tpm2 startauthsession -S session.ctx
+tpm2 policypcr -S session.ctx -l sha256:0 -f pcr.in
+tpm2 policycommandcode -S session.ctx TPM2_CC_Unseal
+tpm2 policyauthvalue -S session.ctx -L tpm.policy
+tpm2 flushcontext session.ctx
+
+cmp offline.policy tpm.policy
+
+# A policy tree builds the same digests as the tools one by one
+head -c 32 /dev/zero > pcr.b
+
+cat > policy.tree <<EOF
+# two boot configurations
+policy branch-a
+    pcr sha256:0 pcr.in
+policy branch-b
+    pcr sha256:0 pcr.b   # a second file
+policy unseal
+    or branch-a branch-b
+    commandcode TPM2_CC_Unseal
+EOF
+
+tpm2 createpolicy -T none --policy-tree policy.tree -L tree.policy
+
+tpm2 startauthsession -S session.ctx
+tpm2 policypcr -S session.ctx -l sha256:0 -f pcr.in -L branch-a.policy
+tpm2 flushcontext session.ctx
+tpm2 startauthsession -S session.ctx
+tpm2 policypcr -S session.ctx -l sha256:0 -f pcr.b -L branch-b.policy
+tpm2 flushcontext session.ctx
+tpm2 startauthsession -S session.ctx
+tpm2 policyor -S session.ctx -l sha256:branch-a.policy,branch-b.policy
+tpm2 policycommandcode -S session.ctx TPM2_CC_Unseal -L tpm.policy
+tpm2 flushcontext session.ctx
+
+cmp tree.policy tpm.policy
+
+# Policies that need a TPM are refused
+tpm2 startauthsession -T none -S session.ctx
+trap - ERR
+tpm2 policypcr -T none -S session.ctx -l sha256:0
+if [ $? -eq 0 ]; then
+    echo "Expected policypcr to need the PCR values without a TPM"
+    exit 1
+fi
+trap onerror ERR
+
 exit 0
@@ -110,6 +110,64 @@ tpm2 createprimary -Q
 AFTER=$(tpm2 getcap handles-loaded-session; tpm2 getcap handles-saved-session)
 test "${BEFORE}" = "${AFTER}"
 
+# Test that the primary cache loads the key it created before
+mkdir -p -m 700 primary.cache
+TPM2TOOLS_PRIMARY_CACHE=primary.cache tpm2 createprimary -C o -c cached1.ctx \
+-p cachepass > cached1.yaml
+test $(ls primary.cache | wc -l) -eq 1
+
+TPM2TOOLS_PRIMARY_CACHE=primary.cache tpm2 createprimary -V -C o \
+-c cached2.ctx -p cachepass > cached2.yaml 2> cached2.log
+grep -q "Loaded primary key" cached2.log
+cmp cached1.yaml cached2.yaml
+tpm2 readpublic -c cached1.ctx -n cached1.name > /dev/null
+tpm2 readpublic -c cached2.ctx -n cached2.name > /dev/null
+cmp cached1.name cached2.name
+
+# another key auth is another key
+TPM2TOOLS_PRIMARY_CACHE=primary.cache tpm2 createprimary -C o -c cached3.ctx \
+> /dev/null
+test $(ls primary.cache | wc -l) -eq 2
+tpm2 flushcontext -t
+
+# a directory other users can access is not used
+chmod 755 primary.cache
+TPM2TOOLS_PRIMARY_CACHE=primary.cache tpm2 createprimary -C o -c cached3.ctx \
+> /dev/null 2> cached3.log
+grep -q "Ignoring primary cache" cached3.log
+tpm2 flushcontext -t
+rm -rf primary.cache cached1.* cached2.* cached3.*
+
+# Test that a saved template creates the same key and hits the cache
+tpm2 createprimary -C o -G ecc -p cachepass --save-template=primary.tmpl \
+> template.yaml
+grep -q "template-digest:" template.yaml
+tpm2 createprimary -C o -G ecc -p cachepass -c built.ctx > built.yaml
+tpm2 createprimary -C o -p cachepass --load-template=primary.tmpl \
+-c loaded.ctx > loaded.yaml
+cmp built.yaml loaded.yaml
+tpm2 flushcontext -t
+
+# the template options do not go with a saved template
+trap - ERR
+tpm2 createprimary -C o -G rsa --load-template=primary.tmpl -c loaded.ctx
+if [ $? -eq 0 ]; then
+    echo "--load-template must not take -G"
+    exit 1
+fi
+trap onerror ERR
+
+mkdir -p -m 700 primary.cache
+TPM2TOOLS_PRIMARY_CACHE=primary.cache tpm2 createprimary -C o -p cachepass \
+--load-template=primary.tmpl -c cached1.ctx > /dev/null
+TPM2TOOLS_PRIMARY_CACHE=primary.cache tpm2 createprimary -V -C o \
+-p cachepass --load-template=primary.tmpl -c cached2.ctx > /dev/null \
+2> cached2.log
+grep -q "Loaded primary key" cached2.log
+tpm2 flushcontext -t
+rm -rf primary.cache primary.tmpl template.yaml built.* loaded.* cached1.* \
+cached2.*
+
 # Test pem key
 tpm2 createprimary -f pem -o public.pem
 openssl rsa -noout -text -inform PEM -in public.pem -pubin
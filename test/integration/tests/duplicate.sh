@@ -6,7 +6,9 @@ cleanup() {
     rm -f primary.ctx new_parent.prv new_parent.pub new_parent.ctx policy.dat \
     session.dat key.prv key.pub key.ctx duppriv.bin dupseed.dat key2.prv \
     key2.pub key2.ctx sym_key_in.bin cleartext.txt secret.bin decrypted.txt \
-    primary.pub rsa-priv.pem rsa.pub rsa.priv rsa.dpriv rsa.seed rsa-pub.pem rsa.sig
+    primary.pub rsa-priv.pem rsa.pub rsa.priv rsa.dpriv rsa.seed rsa-pub.pem rsa.sig \
+    key3.prv key3.pub key3.ctx new_parent_loaded.ctx dup.manifest dups.archive \
+    dup.yaml key3.iprv
 
     if [ "$1" != "no-shut-down" ]; then
           shut_down
@@ -84,6 +86,27 @@ tpm2 duplicate -Q -C new_parent.ctx -c key.ctx -G aes -o sym_key_out.bin \
 -p "session:session.dat" -r dupprv.bin -s dupseed.dat
 end_duplication_session
 
+## Many keys to one new parent, with one session and one archive
+tpm2 create -Q -C primary.ctx -g sha256 -G rsa -r key3.prv -u key3.pub \
+-L policy.dat -a "sensitivedataorigin|sign|decrypt"
+tpm2 load -Q -C primary.ctx -r key3.prv -u key3.pub -c key3.ctx
+tpm2 load -Q -C primary.ctx -r new_parent.prv -u new_parent.pub \
+-c new_parent_loaded.ctx
+cat > dup.manifest <<EOF
+key.ctx   key   # the first key
+key3.ctx  key3
+EOF
+start_duplication_session
+tpm2 duplicate -C new_parent_loaded.ctx -G null -p "session:session.dat" \
+--manifest dup.manifest --archive dups.archive > dup.yaml
+end_duplication_session
+test $(grep -c "duplicated: true" dup.yaml) -eq 2
+
+# the archive members are imported as files
+tpm2 import -C new_parent_loaded.ctx -G null -u "dups.archive#key3.pub" \
+-i "dups.archive#key3.priv" -s "dups.archive#key3.seed" -r key3.iprv
+tpm2 flushcontext -t
+
 ## Repeat the tests with a key that requires encrypted duplication
 tpm2 create -Q -C primary.ctx -g sha256 -G rsa -r key2.prv -u key2.pub \
 -L policy.dat -a "sensitivedataorigin|sign|decrypt|encryptedduplication"
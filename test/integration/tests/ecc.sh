@@ -3,7 +3,9 @@
 source helpers.sh
 
 cleanup() {
-    rm -f pass1_ecc.q pass2_ecc.q ecc.ctr
+    rm -f pass1_ecc.q pass2_ecc.q ecc.ctr ecc.pool commit.pool pool.yaml \
+    pool1.q pool1.ctr pool2.q pool2.ctr K2.bin L2.bin E2.bin commit2.ctr \
+    msg.dat sig.ecdaa batch.z1 batch.z2 batch.q
 
     if [ "$1" != "no-shut-down" ]; then
         shut_down
@@ -52,6 +54,15 @@ tpm2 ecdhzgen -u ecc256ecdh.pub -o ecdhZgen.dat -c ecdh_key.ctx
 
 diff ecdhZgen.dat ecc256ecdh.priv
 
+## Check that a batch recovers the Z points of several peers in order
+tpm2 ecdhkeygen -u ecc256ecdh2.pub -o ecc256ecdh2.priv -c ecdh_key.ctx
+
+cat ecc256ecdh.pub ecc256ecdh2.pub ecc256ecdh.pub | \
+tpm2 ecdhzgen --batch -o ecdhZgen.batch -c ecdh_key.ctx
+
+diff ecdhZgen.batch <(cat ecc256ecdh.priv ecc256ecdh2.priv ecc256ecdh.priv)
+rm -f ecc256ecdh2.pub ecc256ecdh2.priv ecdhZgen.batch
+
 # TPM2_ZGen_2Phase
 ## Check if output Z points are generated using separate commit count values
 tpm2 zgen2phase -c ecdh_key.ctx --static-public ecc256ecdh.pub \
@@ -76,4 +87,58 @@ diff pass2.z2 pass3.z2
 
 trap onerror ERR
 
+# Pools of precomputed commits
+## Check that the counters of an ephemeral pool are taken in order, once
+tpm2 ecephemeral --pool ecc.pool --fill 2 ecc256 > pool.yaml
+test "$(yaml_get_kv pool.yaml entries)" == 2
+
+tpm2 ecephemeral --pool ecc.pool -u pool1.q -t pool1.ctr
+tpm2 ecephemeral -T none --pool ecc.pool -u pool2.q -t pool2.ctr
+pool1_ctr=$((0x$(xxd -p pool1.ctr)))
+test $((0x$(xxd -p pool2.ctr))) -eq $((pool1_ctr + 1))
+
+trap - ERR
+tpm2 ecephemeral --pool ecc.pool -u pool1.q -t pool1.ctr
+if [ $? -eq 0 ]; then
+    echo "Taking from an empty pool should fail"
+    exit 1
+fi
+trap onerror ERR
+
+## Check that a pooled counter is usable for TPM2_ZGen_2Phase
+tpm2 zgen2phase -c ecdh_key.ctx --static-public ecc256ecdh.pub \
+--ephemeral-public pool1.q -t $pool1_ctr --output-Z1 pass4.z1 \
+--output-Z2 pass4.z2
+diff pass1.z1 pass4.z1
+
+## Check that a batch pairs the peers with the pooled counters in order
+tpm2 ecephemeral --pool ecc.pool --fill 2 ecc256 > pool.yaml
+cat ecc256ecdh.pub pass1_ecc.q ecc256ecdh.pub pass2_ecc.q | \
+tpm2 zgen2phase -c ecdh_key.ctx --batch --pool ecc.pool \
+--output-Z1 batch.z1 --output-Z2 batch.z2 --output-ephemeral batch.q
+diff batch.z1 <(cat pass1.z1 pass1.z1)
+test $(stat -c %s batch.z2) -eq $(( $(stat -c %s pass1.z2) * 2 ))
+test $(stat -c %s batch.q) -eq $(( $(stat -c %s pool1.q) * 2 ))
+
+trap - ERR
+cat ecc256ecdh.pub pass1_ecc.q | \
+tpm2 zgen2phase -c ecdh_key.ctx --batch --pool ecc.pool \
+--output-Z1 batch.z1 --output-Z2 batch.z2
+if [ $? -eq 0 ]; then
+    echo "A batch should fail on an empty pool"
+    exit 1
+fi
+trap onerror ERR
+
+## Check that a pooled commit is usable for an ECDAA signature
+tpm2 commit --pool commit.pool --fill 2 -c commit_key.ctx > pool.yaml
+test "$(yaml_get_kv pool.yaml entries)" == 2
+
+tpm2 commit -T none --pool commit.pool -t commit2.ctr --eccpoint-K K2.bin \
+--eccpoint-L L2.bin -u E2.bin
+
+echo "message" > msg.dat
+tpm2 sign -c commit_key.ctx -g sha256 -s ecdaa \
+--commit-index $((0x$(xxd -p commit2.ctr))) -o sig.ecdaa msg.dat
+
 exit 0
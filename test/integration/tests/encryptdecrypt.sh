@@ -7,7 +7,8 @@ cleanup() {
   decrypt2.out encrypt.out encrypt2.out secret.dat secret2.dat \
   iv.dat iv2.dat key128.ctx plain.dec128.tpm plain.dec256.tpm plain.enc128.tpm \
   plain.enc256.tpm sym128.key key256.ctx plain.dec128.ssl plain.dec256.ssl \
-  plain.enc128.ssl plain.enc256.ssl plain.txt sym256.key
+  plain.enc128.ssl plain.enc256.ssl plain.txt sym256.key large.dat \
+  large.enc.ssl large.enc.tpm large.dec.tpm
 
   if [ "$1" != "no-shut-down" ]; then
       shut_down
@@ -217,4 +218,27 @@ openssl enc -d -in plain.enc256.tpm -out plain.dec256.ssl -aes-256-cfb -iv 0 \
 
 diff plain.dec256.ssl plain.txt
 
+## Stream inputs beyond 64KiB, chaining the IV across chunks
+
+dd if=/dev/urandom bs=1 count=5 status=none of=large.dat
+dd if=/dev/urandom bs=1M count=3 status=none >> large.dat
+
+openssl enc -in large.dat -out large.enc.ssl -K `xxd -c 128 -p sym128.key` \
+-aes-128-cbc -iv 0
+
+cat large.dat | tpm2 encryptdecrypt -Q -c key128.ctx -e -G cbc \
+-o large.enc.tpm
+
+cmp large.enc.ssl large.enc.tpm
+
+tpm2 encryptdecrypt -Q -c key128.ctx -e -G cbc -d -o large.dec.tpm \
+large.enc.ssl
+
+cmp large.dat large.dec.tpm
+
+cat large.dat | tpm2 encryptdecrypt -Q -c key128.ctx -G cfb | \
+tpm2 encryptdecrypt -Q -c key128.ctx -G cfb -d > large.dec.tpm
+
+cmp large.dat large.dec.tpm
+
 exit 0
@@ -42,4 +42,132 @@ expect_pass tpm2 eventlog ${srcdir}/test/integration/fixtures/event-postcode.bin
 expect_pass tpm2 eventlog --eventlog-version=2 ${srcdir}/test/integration/fixtures/event-arch-linux.bin
 expect_pass tpm2 eventlog --eventlog-version=2 ${srcdir}/test/integration/fixtures/event-gce-ubuntu-2104-log.bin
 
+# Replaying from a checkpoint ends in the same PCR values as a full replay
+log=${srcdir}/test/integration/fixtures/event-gce-ubuntu-2104-log.bin
+rm -f eventlog.checkpoint
+tpm2 eventlog --eventlog-version=2 $log | sed -n '/^pcrs:/,$p' > pcrs.full
+tpm2 eventlog --eventlog-version=2 --checkpoint eventlog.checkpoint $log \
+    | sed -n '/^pcrs:/,$p' > pcrs.first
+tpm2 eventlog --eventlog-version=2 --checkpoint eventlog.checkpoint $log \
+    | sed -n '/^pcrs:/,$p' > pcrs.resumed
+cmp pcrs.full pcrs.first || exit 1
+cmp pcrs.full pcrs.resumed || exit 1
+
+# A log that does not continue the checkpoint is replayed from the start
+other=${srcdir}/test/integration/fixtures/event-arch-linux.bin
+tpm2 eventlog --eventlog-version=2 $other | sed -n '/^pcrs:/,$p' > pcrs.full
+tpm2 eventlog --eventlog-version=2 --checkpoint eventlog.checkpoint $other \
+    | sed -n '/^pcrs:/,$p' > pcrs.other
+cmp pcrs.full pcrs.other || exit 1
+
+# Filtering by PCR replays those PCRs as a full replay does
+tpm2 eventlog --eventlog-version=2 $log | sed -n '/^  sha256:/,/^  [a-z]/p' \
+    | grep -E '^    (4 |7 )' > pcrs.full
+tpm2 eventlog --eventlog-version=2 --pcrs=4,7 $log \
+    | sed -n '/^  sha256:/,/^  [a-z]/p' | grep -E '^    [0-9]' > pcrs.filtered
+cmp pcrs.full pcrs.filtered || exit 1
+
+# The index is reused, and a single event is output
+rm -f eventlog.index
+tpm2 eventlog --index=eventlog.index $log > /dev/null
+test -s eventlog.index || exit 1
+tpm2 eventlog --index=eventlog.index --event=3 $log > event.yaml
+test "$(grep -c 'EventNum:' event.yaml)" -eq 1 || exit 1
+grep -q 'EventNum: 3' event.yaml || exit 1
+
+# The JSON output has the events and PCR values of the YAML output
+tpm2 eventlog --format=json $log > eventlog.json
+python3 -c "import json,sys; d=json.load(open('eventlog.json')); \
+    assert len(d['events']) > 1; assert d['pcrs']" || exit 1
+tpm2 eventlog --format=tlv --pcrs=4 $log > eventlog.tlv
+test -s eventlog.tlv || exit 1
+expect_fail tpm2 eventlog --format=xml $log
+
+# A replay only outputs the PCR values of the full output
+tpm2 eventlog $log | sed -n '/^pcrs:/,$p' | grep -E '^    [0-9]' \
+    | tr -d ' ' | tr 'A-F' 'a-f' > pcrs.full
+tpm2 eventlog --replay-only $log | grep -E '^    [0-9]' | tr -d ' ' \
+    | tr 'A-F' 'a-f' > pcrs.replayed
+cmp pcrs.full pcrs.replayed || exit 1
+expect_fail tpm2 eventlog --replay-only --format=json $log
+
+# An appraisal knows the digests the log itself lists, but one
+tpm2 eventlog $log | grep 'Digest: ' | sed 's/.*"\(.*\)"/\1/' | sort -u \
+    > reference.txt
+tpm2 eventlog --reference=reference.txt $log > appraisal.yaml
+grep -q '^unknown: \[\]' appraisal.yaml || exit 1
+sed -i '$d' reference.txt
+expect_fail tpm2 eventlog --reference=reference.txt $log
+expect_fail tpm2 eventlog --reference=reference.txt --replay-only $log
+
+# Many logs are replayed in one run, as each one is on its own
+tpm2 eventlog --json --replay-only $log > pcrs.single
+tpm2 eventlog --json $log $other > pcrs.batch
+python3 -c "import json; s=json.load(open('pcrs.single')); \
+    b=json.load(open('pcrs.batch')); assert len(b) == 2; \
+    assert b[0]['path'].endswith('event-gce-ubuntu-2104-log.bin'); \
+    assert b[0]['verdict'] == 'pass'; assert b[0]['pcrs'] == s['pcrs']" \
+    || exit 1
+rm -rf eventlogs
+mkdir eventlogs
+cp $log eventlogs/a.bin
+cp ${srcdir}/test/integration/fixtures/event-bad.bin eventlogs/b.bin
+expect_fail tpm2 eventlog eventlogs
+tpm2 eventlog eventlogs | grep -q 'verdict: invalid' || exit 1
+expect_fail tpm2 eventlog --checkpoint=eventlog.checkpoint $log $other
+
+expect_fail tpm2 eventlog --event=100000 $log
+expect_fail tpm2 eventlog --pcrs=4 --checkpoint eventlog.checkpoint $log
+expect_fail tpm2 eventlog --pcrs=32 $log
+
+# An IMA list replays to PCR 10, incrementally from a checkpoint
+cat > ima.py <<'EOF'
+import hashlib, struct, sys
+le = lambda x: struct.pack('<I', x)
+count, path = int(sys.argv[1]), sys.argv[2]
+ascii, pcr = b'', bytes(20)
+for i in range(count):
+    name = b'/usr/bin/file %d' % i
+    digest = hashlib.sha256(name).digest()
+    dng = b'sha256:\0' + digest
+    data = le(len(dng)) + dng + le(len(name) + 1) + name + b'\0'
+    th = hashlib.sha1(data).digest()
+    pcr = hashlib.sha1(pcr + th).digest()
+    ascii += b'10 %s ima-ng sha256:%s %s\n' % (th.hex().encode(),
+        digest.hex().encode(), name)
+open(path, 'wb').write(ascii)
+print('10:0x' + pcr.hex().upper())
+EOF
+python ima.py 3 ima.first > ima.pcr.first
+python ima.py 5 ima.log > ima.pcr
+tpm2 eventlog --ima --replay-only ima.log | grep -E '^    [0-9]' \
+    | tr -d ' ' > ima.replayed
+cmp ima.pcr ima.replayed || exit 1
+rm -f ima.checkpoint
+tpm2 eventlog --ima --replay-only --checkpoint=ima.checkpoint ima.first \
+    | grep -E '^    [0-9]' | tr -d ' ' > ima.replayed
+cmp ima.pcr.first ima.replayed || exit 1
+tpm2 eventlog --ima --checkpoint=ima.checkpoint ima.log > ima.yaml
+grep -q 'EventNum: 3' ima.yaml || exit 1
+grep -q 'EventNum: 0' ima.yaml && exit 1
+sed -n '/^pcrs:/,$p' ima.yaml | grep -E '^    [0-9]' | tr -d ' ' \
+    > ima.replayed
+cmp ima.pcr ima.replayed || exit 1
+expect_fail tpm2 eventlog --ima=sha256 ima.log
+expect_fail tpm2 eventlog --ima --pcrs=10 ima.log
+
+# the appraisal of an IMA list looks up the file digests
+grep -o 'sha256:[0-9a-f]*' ima.log | cut -d: -f2 > ima.reference
+tpm2 eventlog --ima --reference=ima.reference ima.log > appraisal.yaml
+grep -q '^unknown: \[\]' appraisal.yaml || exit 1
+sed -i '$d' ima.reference
+expect_fail tpm2 eventlog --ima --reference=ima.reference ima.log
+rm -f ima.py ima.first ima.log ima.pcr ima.pcr.first ima.replayed \
+    ima.checkpoint ima.yaml ima.reference
+
+rm -f eventlog.checkpoint pcrs.full pcrs.first pcrs.resumed pcrs.other \
+    pcrs.filtered eventlog.index event.yaml eventlog.json eventlog.tlv \
+    pcrs.replayed reference.txt appraisal.yaml pcrs.single pcrs.batch
+rm -rf eventlogs
+
 exit $?
@@ -4,7 +4,10 @@ source helpers.sh
 
 cleanup() {
   rm -f primary.ctx decrypt.ctx key.pub key.priv key.name decrypt.out \
-        encrypt.out secret.dat key.dat evict.log primary.ctx key.ctx
+        encrypt.out secret.dat key.dat evict.log primary.ctx key.ctx \
+        key2.pub key2.priv key2.name key2.dat cached.name \
+        manifest.txt manifest.yaml key[123].ctx key2.handle
+  rm -rf names
 
   if [ "$1" != "no-shut-down" ]; then
       shut_down
@@ -49,4 +52,55 @@ tpm2 evictcontrol -C p -c key.ctx > evict.log
 phandle=$(yaml_get_kv evict.log persistent-handle)
 tpm2 evictcontrol -C p -c $phandle
 
+# the name cache answers lookups of a persistent handle until it is evicted
+export TPM2TOOLS_NAME_CACHE=names
+tpm2 evictcontrol -Q -C o -c key.dat 0x81010003
+tpm2 readpublic -Q -c 0x81010003 -n cached.name
+test -s names/81010003
+tpm2 readpublic -Q -c 0x81010003 -n cached.name
+cmp cached.name key.name
+
+tpm2 evictcontrol -Q -C o -c 0x81010003
+test ! -e names/81010003
+
+# another object at the same handle is not mistaken for the evicted one
+tpm2 createprimary -Q -C o -c primary.ctx
+tpm2 create -Q -g sha256 -G aes -u key2.pub -r key2.priv -C primary.ctx
+tpm2 load -Q -C primary.ctx -u key2.pub -r key2.priv -n key2.name \
+    -c key2.dat
+tpm2 evictcontrol -Q -C o -c key2.dat 0x81010003
+tpm2 readpublic -Q -c 0x81010003 -n cached.name
+cmp cached.name key2.name
+tpm2 evictcontrol -Q -C o -c 0x81010003
+unset TPM2TOOLS_NAME_CACHE
+
+# a manifest persists many objects at named and vacant handles
+tpm2 createprimary -Q -C o -c primary.ctx
+for i in 1 2 3; do
+  tpm2 create -Q -C primary.ctx -c key$i.ctx
+done
+
+cat > manifest.txt <<END
+key1.ctx 0x81010010 # at a named handle
+key2.ctx - key2.handle
+key3.ctx
+END
+tpm2 evictcontrol -C o --manifest=manifest.txt > manifest.yaml
+test "$(grep -c 'action: persisted' manifest.yaml)" -eq 3
+tpm2 readpublic -Q -c 0x81010010
+tpm2 readpublic -Q -c key2.handle
+
+# and evicts them again, a bad line fails the tool but not the others
+grep -o '0x81[0-9a-f]*' manifest.yaml > manifest.txt
+echo "0x81010011" >> manifest.txt
+trap - ERR
+tpm2 evictcontrol -C o --manifest=manifest.txt > manifest.yaml
+if [ $? -eq 0 ]; then
+  echo "A manifest with a failing line must fail"
+  exit 1
+fi
+trap onerror ERR
+test "$(grep -c 'action: evicted' manifest.yaml)" -eq 3
+test "$(grep -c 'action: failed' manifest.yaml)" -eq 1
+
 exit 0
@@ -5,7 +5,7 @@ source helpers.sh
 start_up
 
 cleanup() {
-    rm -f saved_session.ctx
+    rm -f saved_session.ctx primary.ctx
 
     if [ "$1" != "no-shut-down" ]; then
           shut_down
@@ -32,6 +32,20 @@ tpm2 flushcontext -Q -t
 tpm2 createpolicy -Q --policy-session --policy-pcr -l sha256:0
 tpm2 flushcontext -Q -l
 
+# Test for flushing everything at once
+tpm2 createprimary -Q -C o -g sha256 -G rsa -c primary.ctx
+tpm2 startauthsession -S saved_session.ctx
+tpm2 flushcontext -Q --all
+test -z "$(tpm2 getcap handles-transient)"
+
+trap - ERR
+
+tpm2 flushcontext -t --all
+if [ $? -eq 0 ]; then
+    echo "--all must not combine with -t"
+    exit 1
+fi
+
 cleanup "no-shut-down"
 
 exit 0
@@ -39,9 +39,45 @@ for c in $caplist; do
     yaml_verify $out
 done;
 
+# all groups in one document, matching the groups queried one by one
+tpm2 getcap all > $out
+python << pyscript
+import yaml
+
+with open("$out") as f:
+    groups = yaml.safe_load(f)
+
+assert(sorted(groups) == sorted(c for c in "$caplist".split() if c != "all"))
+assert("TPM2_PT_FAMILY_INDICATOR" in groups["properties-fixed"])
+assert("TPM2_PT_PERMANENT" in groups["properties-variable"])
+pyscript
+tpm2 getcap properties-fixed > fixed.yaml
+python -c "import yaml,sys; a=yaml.safe_load(open('$out'))['properties-fixed']; b=yaml.safe_load(open('fixed.yaml')); sys.exit(a != b)"
+rm -f fixed.yaml
+
+# and fills the capability cache
+rm -f capcache.bin
+TPM2TOOLS_CAPABILITY_CACHE=capcache.bin tpm2 getcap all > /dev/null
+test -s capcache.bin
+rm -f capcache.bin
+
+# the JSON has the keys and values of the YAML
+tpm2 getcap properties-fixed > fixed.yaml
+tpm2 getcap --json properties-fixed > fixed.json
+python -c "import json,yaml,sys; a=json.load(open('fixed.json')); b=yaml.safe_load(open('fixed.yaml')); sys.exit(a.keys() != b.keys() or a['TPM2_PT_LEVEL'] != b['TPM2_PT_LEVEL'])"
+tpm2 getcap --json all | python -m json.tool > /dev/null
+tpm2 pcrread --json sha256:0,1 | python -m json.tool > /dev/null
+rm -f fixed.yaml fixed.json
+
 # negative tests
 trap - ERR
 
+# only the tools with structured output take --json
+if tpm2 getrandom --json 8 2>/dev/null; then
+  echo "Expected \"tpm2 getrandom --json\" to fail."
+  exit 1
+fi
+
 # Regression test, ensure that getcap -c never accepts prefix matches
 tpm2 getcap -Q --capability="comma" 2>/dev/null
 if [ $? -eq -1 ]; then
@@ -8,7 +8,10 @@ source helpers.sh
 
 cleanup() {
     rm -f test_rsa_ek.pub rsa_ek_cert.bin stdout_rsa_ek_cert.bin \
-          test_ecc_ek.pub ecc_ek_cert.bin stdout_ecc_ek_cert.bin
+          test_ecc_ek.pub ecc_ek_cert.bin stdout_ecc_ek_cert.bin \
+          both_rsa_ek_cert.bin both_ecc_ek_cert.bin manifest.txt \
+          manifest_*_ek_cert.bin retrieved.yaml cached_*_ek_cert.bin
+    rm -rf ek_cert_cache
 
     shut_down
 }
@@ -77,6 +80,74 @@ tpm2 readpublic -c ecc_key.ctx -f pem -o test_ecc_ek.pem
 openssl x509 -pubkey -in ecc_ek_cert.bin -noout -out test_ek.pem
 diff test_ecc_ek.pem test_ek.pem
 
+# Both certificates in one invocation match the single ones
+tpm2 getekcertificate -u test_rsa_ek.pub -u test_ecc_ek.pub -x -X \
+-o both_rsa_ek_cert.bin -o both_ecc_ek_cert.bin
+
+cmp rsa_ek_cert.bin both_rsa_ek_cert.bin
+cmp ecc_ek_cert.bin both_ecc_ek_cert.bin
+
+# Many certificates through a manifest, without a TPM
+cat > manifest.txt <<EOF
+test_rsa_ek.pub manifest_rsa_ek_cert.bin
+# the ECC EK
+test_ecc_ek.pub manifest_ecc_ek_cert.bin
+
+test_rsa_ek.pub manifest_rsa2_ek_cert.bin
+EOF
+
+tpm2 getekcertificate -T none -X --manifest=manifest.txt --jobs=2 \
+> retrieved.yaml
+test $(grep -c "retrieved: true" retrieved.yaml) -eq 3
+
+cmp rsa_ek_cert.bin manifest_rsa_ek_cert.bin
+cmp ecc_ek_cert.bin manifest_ecc_ek_cert.bin
+cmp rsa_ek_cert.bin manifest_rsa2_ek_cert.bin
+
+# Certificates are cached and later used without the server
+mkdir -p ek_cert_cache
+tpm2 getekcertificate -u test_rsa_ek.pub -x -X -o rsa_ek_cert.bin \
+--cache=ek_cert_cache
+test $(ls ek_cert_cache | wc -l) -eq 1
+
+tpm2 getekcertificate -T none -u test_rsa_ek.pub -o cached_rsa_ek_cert.bin \
+--cache=ek_cert_cache --cache-only
+cmp rsa_ek_cert.bin cached_rsa_ek_cert.bin
+
+tpm2 getekcertificate -T none --manifest=manifest.txt --cache=ek_cert_cache \
+--cache-ttl=3600 > retrieved.yaml
+test $(ls ek_cert_cache | wc -l) -eq 2
+cmp ecc_ek_cert.bin manifest_ecc_ek_cert.bin
+
+trap - ERR
+
+rm -rf ek_cert_cache
+mkdir -p ek_cert_cache
+tpm2 getekcertificate -T none -u test_ecc_ek.pub -o cached_ecc_ek_cert.bin \
+--cache=ek_cert_cache --cache-only
+if [ $? -eq 0 ]; then
+    echo "Expected a miss with --cache-only to fail" 1>&2
+    exit 1
+fi
+
+trap onerror ERR
+
+# Entries are keyed by the server too
+tpm2 getekcertificate -X -x -u test_ecc_ek.pub -o ecc_ek_cert.bin \
+--cache=ek_cert_cache
+test $(ls ek_cert_cache | wc -l) -eq 1
+
+trap - ERR
+
+tpm2 getekcertificate -T none -u test_ecc_ek.pub -o cached_ecc_ek_cert.bin \
+--cache=ek_cert_cache --cache-only https://ekcert.example.invalid/
+if [ $? -eq 0 ]; then
+    echo "Expected a cached certificate of another server to miss" 1>&2
+    exit 1
+fi
+
+trap onerror ERR
+
 # Retrieve EK certificates from NV indices
 RSA_EK_CERT_NV_INDEX=0x01C00002
 ECC_EK_CERT_NV_INDEX=0x01C0000A
@@ -2,8 +2,17 @@
 
 source helpers.sh
 
+feed_pid=""
+
 cleanup() {
-    rm -f random.out
+    unset TPM2TOOLS_CAPABILITY_CACHE
+    if [ -n "$feed_pid" ]; then
+        kill -TERM $feed_pid 2>/dev/null
+        wait $feed_pid 2>/dev/null
+        feed_pid=""
+    fi
+
+    rm -f random.out cap.cache bulk.yaml feed.fifo
 
     if [ "$1" != "no-shut-down" ]; then
         shut_down
@@ -32,6 +41,15 @@ tpm2 getrandom -Q --hex 4 > random.out
 s=`ls -l random.out | awk {'print $5'}`
 test $s -eq 0
 
+# the max digest size is served from the capability cache once it is filled
+export TPM2TOOLS_CAPABILITY_CACHE="$PWD/cap.cache"
+tpm2 getrandom -o random.out 32
+test -s cap.cache
+tpm2 getrandom -o random.out 32
+s=`ls -l random.out | awk {'print $5'}`
+test $s -eq 32
+unset TPM2TOOLS_CAPABILITY_CACHE
+
 # test if multiple sessions can be specified
 tpm2 createprimary -C o -c prim.ctx -Q
 tpm2 startauthsession -S audit_session.ctx --audit-session
@@ -39,6 +57,33 @@ tpm2 startauthsession -S enc_session.ctx --hmac-session --tpmkey-context prim.ct
 tpm2 sessionconfig enc_session.ctx --enable-encrypt
 tpm2 getrandom 8 -S enc_session.ctx -S audit_session.ctx
 
+# bulk requests are split into max digest sized pieces
+tpm2 getrandom --bulk -o random.out 100000 > bulk.yaml
+s=`ls -l random.out | awk {'print $5'}`
+test $s -eq 100000
+test "$(yaml_get_kv bulk.yaml "bytes")" = "100000"
+
+tpm2 getrandom --bulk --hex 1000 > random.out
+s=`ls -l random.out | awk {'print $5'}`
+test $s -eq 2000
+
+# with the sessions used for every piece
+tpm2 getrandom --bulk 5000 -S enc_session.ctx -S audit_session.ctx \
+    > random.out
+s=`ls -l random.out | awk {'print $5'}`
+test $s -eq 5000
+
+# feed a FIFO with one ESAPI context, refilling every second until stopped
+mkfifo feed.fifo
+tpm2 getrandom --feed feed.fifo --interval 1 32 &
+feed_pid=$!
+head -c 64 feed.fifo > random.out
+s=`ls -l random.out | awk {'print $5'}`
+test $s -eq 64
+kill -TERM $feed_pid
+wait $feed_pid
+feed_pid=""
+
 # negative tests
 trap - ERR
 
@@ -49,6 +94,19 @@ if [ $? -eq 0 ]; then
     exit 1
 fi
 
+# no parameter hashes for the many commands of a bulk request
+tpm2 getrandom --bulk 100 --cphash cp.hash &> /dev/null
+if [ $? -eq 0 ]; then
+    echo "tpm2 getrandom should fail with --bulk and --cphash"
+    exit 1
+fi
+
+tpm2 getrandom --feed feed.fifo --bulk 100 &> /dev/null
+if [ $? -eq 0 ]; then
+    echo "tpm2 getrandom should fail with --feed and --bulk"
+    exit 1
+fi
+
 # verify that tpm2 getrandom requires a TCTI
 ./tools/tpm2 getrandom -T none &> /dev/null
 if [ $? -eq 0 ]; then
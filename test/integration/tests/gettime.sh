@@ -3,7 +3,7 @@
 source helpers.sh
 
 cleanup() {
-	rm -f attest.sig attest.data
+	rm -f attest.sig attest.data attest.sig.* attest.data.* watch.yaml
 }
 trap cleanup EXIT
 
@@ -17,4 +17,12 @@ tpm2 load -C primary.ctx -u rsa.pub -r rsa.priv -c rsa.ctx
 
 tpm2 gettime -c rsa.ctx -o attest.sig --attestation attest.data
 
+# the first sample and every second poll are signed
+tpm2 gettime -c rsa.ctx -o attest.sig --attestation attest.data \
+    --watch 1 --polls 2 --attest-polls 2 > watch.yaml
+test -f attest.sig.0 -a -f attest.data.0
+test -f attest.sig.2 -a -f attest.data.2
+test ! -f attest.sig.1
+test "$(grep -c '^poll:' watch.yaml)" -eq 2
+
 exit 0
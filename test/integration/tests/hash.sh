@@ -72,4 +72,50 @@ if [ "$tpm_hash_val" != "$sha1sum_val" ]; then
   exit 1
 fi
 
+# The same multi block input hashed by the TPM when a ticket is requested
+tpm_hash_val=`tpm2 hash --hex -t $ticket_file $hash_in_file`
+if [ "$tpm_hash_val" != "$sha1sum_val" ]; then
+  echo "Expected tpm and sha1sum to produce same hashes with a ticket"
+  echo "Got:"
+  echo "  tpm2 hash: $tpm_hash_val"
+  echo "  sha1sum:   $sha1sum_val"
+  exit 1
+fi
+
+# Many files give a sha256sum line per file
+mkdir -p hash_files
+for i in 1 2 3; do
+  dd if=/dev/urandom of=hash_files/$i bs=$((i * 1000)) count=1 2>/dev/null
+done
+tpm2 hash -g sha256 hash_files/1 hash_files/2 hash_files/3 > hash_files.out
+sha256sum hash_files/1 hash_files/2 hash_files/3 > hash_files.expected
+cmp hash_files.out hash_files.expected
+
+# The same with a NUL separated list on stdin
+printf 'hash_files/1\0hash_files/2\0hash_files/3\0' | \
+  tpm2 hash -g sha256 --files0-from=- -o hash_files.out
+cmp hash_files.out hash_files.expected
+
+# A missing file is skipped and fails the tool
+trap - ERR
+tpm2 hash -g sha256 hash_files/1 hash_files/missing hash_files/3 \
+  > hash_files.out
+if [ $? -eq 0 ]; then
+  echo "Expected tpm2 hash to fail for a missing file"
+  exit 1
+fi
+trap onerror ERR
+test "$(wc -l < hash_files.out)" -eq 2
+
+# No ticket for many files
+trap - ERR
+tpm2 hash -t $ticket_file hash_files/1 hash_files/2
+if [ $? -eq 0 ]; then
+  echo "Expected tpm2 hash to refuse a ticket for many files"
+  exit 1
+fi
+trap onerror ERR
+
+rm -rf hash_files hash_files.out hash_files.expected
+
 exit 0
@@ -100,4 +100,19 @@ if [ -n "$stdout" ]; then
     exit 1
 fi
 
+# many files give a line per file, matching the HMAC of each alone
+head -c 100 /dev/urandom > hmac1.in
+head -c 5000 /dev/urandom > hmac2.in
+tpm2 hmac -c $file_hmac_key_ctx hmac1.in hmac2.in > hmac_files.out
+for f in hmac1.in hmac2.in; do
+    expected="$(tpm2 hmac -c $file_hmac_key_ctx --hex $f)  $f"
+    grep -qx "$expected" hmac_files.out
+done
+
+printf 'hmac1.in\0hmac2.in' | \
+    tpm2 hmac -c $file_hmac_key_ctx --files0-from=- > hmac_files0.out
+cmp hmac_files.out hmac_files0.out
+
+rm -f hmac1.in hmac2.in hmac_files.out hmac_files0.out
+
 exit 0
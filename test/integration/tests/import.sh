@@ -9,7 +9,8 @@ cleanup() {
     public.pem plain.rsa.enc plain.rsa.dec public.pem data.in.raw \
     data.in.digest data.out.signed ticket.out ecc.pub ecc.priv ecc.name \
     ecc.ctx private.ecc.pem public.ecc.pem passfile aes.key policy.dat \
-    aes.priv aes.pub
+    aes.priv aes.pub manifest.txt manifest.yaml bulk*.pem bulk*.pub \
+    bulk*.priv bulk*.ctx
 
     if [ "$1" != "no-shut-down" ]; then
           shut_down
@@ -231,4 +232,52 @@ run_rsa_import_passin_test "parent.ctx" "private.pem" "stdin" "passfile"
 
 run_aes_policy_import_test "parent.ctx"
 
+#
+# Test importing the keys of a manifest
+#
+
+openssl genrsa -out bulk1.pem 2048
+openssl genrsa -out bulk2.pem 2048
+openssl ecparam -name prime256v1 -genkey -noout -out bulk3.pem
+
+cat > manifest.txt <<EOF
+# input public private [key-algorithm]
+bulk1.pem bulk1.pub bulk1.priv
+bulk2.pem bulk2.pub bulk2.priv rsa
+
+bulk3.pem bulk3.pub bulk3.priv ecc
+EOF
+
+tpm2 import -C parent.ctx -G rsa --manifest manifest.txt --jobs 2 \
+> manifest.yaml
+
+for i in 1 2 3; do
+    tpm2 load -Q -C parent.ctx -u bulk$i.pub -r bulk$i.priv -c bulk$i.ctx
+done
+
+test "$(grep -c 'imported: true' manifest.yaml)" -eq 3
+
+# a key failing to import fails the tool, but not the other keys
+rm bulk1.pub bulk1.priv
+echo "missing.pem bulk4.pub bulk4.priv rsa" >> manifest.txt
+trap - ERR
+tpm2 import -C parent.ctx -G rsa --manifest manifest.txt > manifest.yaml
+if [ $? -eq 0 ]; then
+    echo "tpm2 import should fail on the missing key"
+    exit 1
+fi
+trap onerror ERR
+test "$(grep -c 'imported: true' manifest.yaml)" -eq 3
+test -f bulk1.priv
+
+# --jobs requires --manifest
+trap - ERR
+tpm2 import -C parent.ctx -G rsa -i bulk1.pem -u bulk1.pub -r bulk1.priv \
+--jobs 2
+if [ $? -eq 0 ]; then
+    echo "--jobs without --manifest should fail"
+    exit 1
+fi
+trap onerror ERR
+
 exit 0
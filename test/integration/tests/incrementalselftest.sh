@@ -68,4 +68,11 @@ tpm2 incrementalselftest ${eccmethods} | grep -q "complete"
 # Check testing of RSA methods
 tpm2 incrementalselftest ${rsamethods} | grep -q "complete"
 
+# The algorithms of key specifications are tested, and a tested TPM has
+# nothing left to schedule
+tpm2 incrementalselftest ecc256:ecdsa-sha256 rsa2048:rsassa:aes128cfb \
+    | grep -q "complete"
+tpm2 selftest --fulltest
+tpm2 incrementalselftest --schedule ecc256:ecdsa-sha256 | grep -q "complete"
+
 exit 0
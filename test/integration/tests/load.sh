@@ -26,7 +26,7 @@ Handle_ek_load=0x81010017
 cleanup() {
 
   rm -f $file_load_key_pub $file_load_key_priv $file_load_key_name \
-  $file_load_key_ctx
+  $file_load_key_ctx keys.ctx
 
   tpm2 evictcontrol -Q -Co -c $Handle_parent 2>/dev/null || true
 
@@ -67,4 +67,70 @@ tpm2 create -Q -C $Handle_parent -g $alg_create_obj -G $alg_create_key \
 tpm2 load -Q -C $Handle_parent -u $file_load_key_pub -r $file_load_key_priv \
 -n $file_load_key_name -c $file_load_key_ctx
 
+#####archive test
+
+cleanup "no-shut-down"
+
+tpm2 createprimary -Q -C e -g $alg_primary_obj -G $alg_primary_key \
+-c keys.ctx#primary
+
+tpm2 create -Q -g $alg_create_obj -G $alg_create_key -u $file_load_key_pub \
+-r $file_load_key_priv -C keys.ctx#primary
+
+tpm2 load -Q -C keys.ctx#primary -u $file_load_key_pub \
+-r $file_load_key_priv -n $file_load_key_name -c keys.ctx#key
+
+tpm2 flushcontext -t
+
+# both contexts live in the one archive, the key replaced on a second save
+tpm2 load -Q -C keys.ctx#primary -u $file_load_key_pub \
+-r $file_load_key_priv -c keys.ctx#key
+
+tpm2 hmac -c keys.ctx#key -o /dev/null <<< "data"
+
+#####manifest test
+
+cleanup "no-shut-down"
+
+tpm2 createprimary -Q -C e -g $alg_primary_obj -G $alg_primary_key \
+-c $file_primary_key_ctx
+
+rm -f manifest.txt
+for i in 1 2 3; do
+  tpm2 create -Q -g $alg_create_obj -G $alg_create_key -u key$i.pub \
+  -r key$i.priv -C $file_primary_key_ctx
+  echo "key$i.pub key$i.priv key$i.ctx # key $i" >> manifest.txt
+done
+
+tpm2 load -C $file_primary_key_ctx --manifest=manifest.txt > manifest.yaml
+test "$(grep -c 'loaded: true' manifest.yaml)" -eq 3
+
+# the objects were flushed, their contexts load again
+tpm2 flushcontext -t
+for i in 1 2 3; do
+  tpm2 readpublic -Q -c key$i.ctx
+done
+
+# a bad line fails the tool, the others are still loaded
+echo "missing.pub missing.priv missing.ctx" >> manifest.txt
+trap - ERR
+tpm2 load -C $file_primary_key_ctx --manifest=manifest.txt > manifest.yaml
+if [ $? -eq 0 ]; then
+  echo "A manifest with a failing line must fail"
+  exit 1
+fi
+trap onerror ERR
+test "$(grep -c 'loaded: true' manifest.yaml)" -eq 3
+test "$(grep -c 'loaded: false' manifest.yaml)" -eq 1
+
+rm -f manifest.txt manifest.yaml key[123].pub key[123].priv key[123].ctx
+
+trap - ERR
+
+tpm2 hmac -c keys.ctx#missing -o /dev/null <<< "data"
+if [ $? -eq 0 ]; then
+  echo "A context missing in the archive must not load"
+  exit 1
+fi
+
 exit 0
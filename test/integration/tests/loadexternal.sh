@@ -25,6 +25,7 @@ cleanup() {
   plain.txt plain.rsa.dec key.ctx public.ecc.pem private.ecc.pem \
   data.in.digest data.out.signed ticket.out name.bin stdout.yaml passfile \
   private.pem
+  rm -rf pubkey.cache
 
   if [ $(ina "$@" "keep_handle") -ne 0 ]; then
     tpm2 evictcontrol -Q -Co -c $Handle_parent 2>/dev/null || true
@@ -103,6 +104,18 @@ run_rsa_test() {
 
     diff plain.txt plain.rsa.dec
 
+    # the second load of the public key is answered from the cache
+    mkdir -p pubkey.cache
+    TPM2TOOLS_PUBKEY_CACHE=pubkey.cache \
+        tpm2 loadexternal -G rsa -C n -p foo -u public.pem -c key.ctx
+    test "$(ls pubkey.cache | wc -l)" -eq 1
+    TPM2TOOLS_PUBKEY_CACHE=pubkey.cache \
+        tpm2 loadexternal -G rsa -C n -p foo -u public.pem -c key.ctx
+    tpm2 rsaencrypt -c key.ctx plain.txt -o plain.rsa.enc
+    openssl rsautl -decrypt -inkey private.pem -in plain.rsa.enc \
+    -out plain.rsa.dec
+    diff plain.txt plain.rsa.dec
+
     cleanup "no-shut-down"
 }
 
@@ -17,7 +17,9 @@ output_mkcredential=mkcredential.out
 
 cleanup() {
     rm -f $output_ek_pub $output_ak_pub $output_ak_pub_name \
-    $output_mkcredential $file_input_data output_ak grep.txt $ak_ctx
+    $output_mkcredential $file_input_data output_ak grep.txt $ak_ctx \
+    ek.pem manifest.txt manifest.yaml mkcred1.out mkcred2.out mkcred3.out \
+    session.ctx actcred.out
 
     tpm2 evictcontrol -Q -Co -c $handle_ek 2>/dev/null || true
 
@@ -55,4 +57,55 @@ tpm2 readpublic -c $handle_ek -o ek.pem -f pem -Q
 tpm2 makecredential -T none -Q -u ek.pem -G rsa -s $file_input_data \
 -n $Loadkeyname -o $output_mkcredential
 
+# many credentials for the same EK, without a TPM
+cat > manifest.txt <<EOF
+# public name secret credential
+ek.pem $Loadkeyname $file_input_data mkcred1.out
+
+ek.pem $Loadkeyname $file_input_data mkcred2.out   # same EK
+EOF
+
+tpm2 makecredential -T none -G rsa --manifest manifest.txt --jobs 2 \
+> manifest.yaml
+
+yaml_verify manifest.yaml
+test "$(grep -c 'made: true' manifest.yaml)" -eq 2
+test -s mkcred1.out
+test -s mkcred2.out
+
+# the secret is encrypted with a fresh seed for each credential
+if cmp -s mkcred1.out mkcred2.out; then
+    echo "credentials of a manifest are not distinct"
+    exit 1
+fi
+
+# the credentials activate with the TPM
+tpm2 startauthsession --policy-session -S session.ctx
+tpm2 policysecret -S session.ctx -c e
+tpm2 activatecredential -Q -c $ak_ctx -C $handle_ek -i mkcred1.out \
+-o actcred.out -P "session:session.ctx"
+tpm2 flushcontext session.ctx
+cmp actcred.out $file_input_data
+
+# a missing secret fails its entry only
+echo "ek.pem $Loadkeyname missing.data mkcred3.out" >> manifest.txt
+trap - ERR
+tpm2 makecredential -T none -G rsa --manifest manifest.txt > manifest.yaml
+if [ $? -eq 0 ]; then
+    echo "expected a manifest with a missing secret to fail"
+    exit 1
+fi
+trap onerror ERR
+test "$(grep -c 'made: true' manifest.yaml)" -eq 2
+test "$(grep -c 'made: false' manifest.yaml)" -eq 1
+
+# --manifest is offline only
+trap - ERR
+tpm2 makecredential -G rsa --manifest manifest.txt 2>/dev/null
+if [ $? -eq 0 ]; then
+    echo "expected --manifest with a TPM to fail"
+    exit 1
+fi
+trap onerror ERR
+
 exit 0
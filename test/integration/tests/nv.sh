@@ -19,9 +19,13 @@ cleanup() {
   tpm2 nvundefine -Q   $nv_test_index -C o 2>/dev/null || true
   tpm2 nvundefine -Q   0x1500016 -C o 2>/dev/null || true
   tpm2 nvundefine -Q   0x1500015 -C o -P owner 2>/dev/null || true
+  for i in 0x1500020 0x1500021 0x1500022; do
+    tpm2 nvundefine -Q $i -C o -P owner 2>/dev/null || true
+  done
 
   rm -f policy.bin test.bin nv.test_w $large_file_name $large_file_read_name \
-  nv.readlock foo.dat cmp.dat $file_pcr_value $file_policy nv.out cap.out yaml.out
+  nv.readlock foo.dat cmp.dat $file_pcr_value $file_policy nv.out cap.out yaml.out \
+  records.bin layout.txt layout.yaml
 
   if [ "$1" != "no-shut-down" ]; then
      shut_down
@@ -139,10 +143,41 @@ tpm2 nvread   $nv_test_index -C o > $large_file_read_name
 
 cmp -s $large_file_read_name $large_file_name
 
+# a read starting off a chunk boundary spans as many chunks
+tpm2 nvread $nv_test_index -C o --offset 1 -s $(($large_file_size - 1)) \
+> $large_file_read_name
+
+tail -c +2 $large_file_name | cmp -s $large_file_read_name -
+
+# a differential write changes only what differs
+cp $large_file_name $large_file_read_name
+printf 'xyz' | dd of=$large_file_read_name bs=1 seek=7 conv=notrunc \
+2>/dev/null
+tpm2 nvwrite -Q $nv_test_index -C o -i $large_file_read_name --diff
+tpm2 nvread $nv_test_index -C o | cmp -s $large_file_read_name -
+
+# and nothing when nothing differs
+tpm2 nvwrite -Q $nv_test_index -C o -i $large_file_read_name --diff
+tpm2 nvread $nv_test_index -C o | cmp -s $large_file_read_name -
+
+# many ranges, overlapping and out of order, in one read
+tpm2 nvread $nv_test_index -C o --range=100:50:range.1 --range=0:10:range.2 \
+--range=120:200:range.3 --range=1000:8 > range.4
+cmp -s range.1 <(tail -c +101 $large_file_read_name | head -c 50)
+cmp -s range.2 <(head -c 10 $large_file_read_name)
+cmp -s range.3 <(tail -c +121 $large_file_read_name | head -c 200)
+cmp -s range.4 <(tail -c +1001 $large_file_read_name | head -c 8)
+rm -f range.1 range.2 range.3 range.4
+
 # test per-index readpublic
 tpm2 nvreadpublic "$nv_test_index" > nv.out
 yaml_get_kv nv.out "$nv_test_index" > /dev/null
 
+# the data of all indices the owner can read comes with their public areas
+tpm2 nvreadpublic --data > nv.out
+data=$(yaml_get_kv nv.out "$nv_test_index" "data")
+test "$data" == "$(xxd -p $large_file_read_name | tr -d '\n')"
+
 tpm2 nvundefine -Q   $nv_test_index -C o
 
 #
@@ -286,6 +321,19 @@ if [ "$check" != "$expected" ]; then
 	exit 1
 fi
 
+# Test extending with a stream of records, checked with one read
+printf '\x00\x03bar\x00\x03baz' > records.bin
+tpm2 nvextend -C o -P "owner" --batch -i records.bin $nv_test_index > yaml.out
+
+v1=$( (echo -n $expected | xxd -r -p; printf bar) | \
+openssl dgst -sha256 -binary | xxd -p -c 64)
+v2=$( (echo -n $v1 | xxd -r -p; printf baz) | \
+openssl dgst -sha256 -binary | xxd -p -c 64)
+
+test "$(yaml_get_kv yaml.out records)" == 2
+test "$(yaml_get_kv yaml.out digest)" == "$v2"
+test "$(yaml_get_kv yaml.out verified)" == true
+
 # Test nvextend and nvdefine with aux sessions
 tpm2 clear
 
@@ -309,4 +357,39 @@ if [ "$check" != "$expected" ]; then
 	exit 1
 fi
 
+# Test defining and undefining the indices of a layout
+cat > layout.txt <<EOF
+# index     size attributes
+0x1500020   32   ownerread|ownerwrite
+0x1500021   8    nt=counter|ownerread|ownerwrite
+0x1500022   -    -                    -   indexauth
+EOF
+
+tpm2 nvdefine -C o -P owner --layout layout.txt > layout.yaml
+test "$(grep -c 'action: defined' layout.yaml)" -eq 3
+tpm2 nvreadpublic 0x1500020 | grep -q "size: 32"
+echo "foo" | tpm2 nvwrite -C o -P owner -i- 0x1500020
+
+# written indices that match their lines are left alone
+tpm2 nvdefine -C o -P owner --layout layout.txt > layout.yaml
+test "$(grep -c 'action: unchanged' layout.yaml)" -eq 3
+
+# an index defined differently fails its line, the others are applied
+tpm2 nvundefine -C o -P owner 0x1500021
+sed -i 's/^0x1500020   32/0x1500020   64/' layout.txt
+trap - ERR
+tpm2 nvdefine -C o -P owner --layout layout.txt > layout.yaml
+if [ $? -eq 0 ]; then
+  echo "nvdefine should fail on an index defined differently"
+  exit 1
+fi
+trap onerror ERR
+grep -q "action: conflict" layout.yaml
+test "$(grep -c 'action: defined' layout.yaml)" -eq 1
+
+tpm2 nvundefine -C o -P owner --layout layout.txt > layout.yaml
+test "$(grep -c 'action: undefined' layout.yaml)" -eq 3
+tpm2 nvundefine -C o -P owner --layout layout.txt > layout.yaml
+test "$(grep -c 'action: absent' layout.yaml)" -eq 3
+
 exit 0
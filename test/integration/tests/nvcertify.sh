@@ -51,4 +51,23 @@ attestation.bin
 #
 xxd -p attestation.bin | tr -d '\n' | grep `xxd -p qual.dat | tr -d '\n'`
 
+#
+# Test several certifications with one signing key load
+#
+cat > manifest.txt <<END
+1 qual.dat nv1.attest nv1.sig
+1 - nv2.attest nv2.sig 16 8
+END
+
+tpm2 nvcertify -C signing_key.ctx -g sha256 -f plain -s rsassa --size 32 \
+--manifest=manifest.txt > nvcertify.yaml
+test $(grep -c "certified: true" nvcertify.yaml) -eq 2
+
+openssl dgst -verify sslpub.pem -keyform pem -sha256 -signature nv1.sig \
+nv1.attest
+openssl dgst -verify sslpub.pem -keyform pem -sha256 -signature nv2.sig \
+nv2.attest
+
+rm -f manifest.txt nvcertify.yaml nv1.* nv2.*
+
 exit 0
@@ -15,7 +15,7 @@ cleanup() {
   tpm2 nvundefine -Q   0x1500015 -C o -P owner 2>/dev/null || true
 
   rm -f policy.bin test.bin nv.readlock foo.dat $file_pcr_value $file_policy \
-        nv.out cap.out
+        nv.out cap.out batch.yaml
 
   if [ "$1" != "no-shut-down" ]; then
      shut_down
@@ -136,6 +136,31 @@ tpm2 nvread -Q   0x1500015 -C 0x1500015 -P "index"
 tpm2 nvincrement -Q   0x1500015 -C o -P "owner"
 tpm2 nvread -Q   0x1500015 -C o -P "owner"
 
+# Batch the increments of a stream of events, one per line
+a=0x$(tpm2 nvread 0x1500015 -P "index" -s 8 | xxd -p)
+
+printf '\n\n0x1500015\n' | \
+tpm2 nvincrement 0x1500015 -P "index" --batch > batch.yaml
+
+b=0x$(tpm2 nvread 0x1500015 -P "index" -s 8 | xxd -p)
+if [ $(($a+3)) -ne $(($b)) ]; then
+ echo "Failed to batch increment: $(($a)) -> $(($b))."
+ exit 1
+fi
+grep -q "increments: 3" batch.yaml
+
+# Coalesced, the events of an interval are one increment
+printf '\n\n\n' | \
+tpm2 nvincrement 0x1500015 -C o -P "owner" --batch --coalesce --interval 5 \
+> batch.yaml
+
+c=0x$(tpm2 nvread 0x1500015 -P "index" -s 8 | xxd -p)
+if [ $(($b+1)) -ne $(($c)) ]; then
+ echo "Failed to coalesce increments: $(($b)) -> $(($c))."
+ exit 1
+fi
+grep -q "events: 3" batch.yaml
+
 # Check a bad password fails
 trap - ERR
 tpm2 nvincrement -Q   0x1500015 -C 0x1500015 -P "wrong" 2>/dev/null
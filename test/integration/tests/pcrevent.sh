@@ -9,7 +9,7 @@ hash_in_file=hash.in
 yaml_out_file=pcr_list.yaml
 
 cleanup() {
-  rm -f $hash_in_file $hash_out_file $yaml_out_file
+  rm -f $hash_in_file $hash_out_file $yaml_out_file host.out host.yaml
 
   shut_down
 }
@@ -61,6 +61,22 @@ if [ "$new_pcr_value" == "$old_pcr_value" ]; then
   exit 1;
 fi
 
+# Hashing on the host gives the digests of the TPM and extends the same
+dd if=/dev/urandom of=$hash_in_file count=1 bs=3000000 2> /dev/null
+tpm2 pcrevent $hash_in_file > $hash_out_file
+tpm2 pcrevent --host-hash $hash_in_file > host.out
+diff $hash_out_file host.out
+cat $hash_in_file | tpm2 pcrevent --host-hash > host.out
+diff $hash_out_file host.out
+
+tpm2 pcrreset 16
+tpm2 pcrevent -Q 16 $hash_in_file
+tpm2 pcrread sha1:16+sha256:16 > $yaml_out_file
+tpm2 pcrreset 16
+tpm2 pcrevent -Q --host-hash 16 $hash_in_file
+tpm2 pcrread sha1:16+sha256:16 > host.yaml
+diff $yaml_out_file host.yaml
+
 # verify that specifying -P without -i fails
 trap - ERR
 
@@ -46,4 +46,40 @@ else
     true
 fi
 
+# Extend from a manifest and log the extensions
+sha256=${alg_hashes["sha256"]}
+cat > manifest.txt << EOF
+# boot measurements
+10:sha256=$sha256 0xd first measurement
+
+11:$digests
+10:sha256=$sha256 0x5
+EOF
+
+tpm2 pcrextend --manifest=manifest.txt
+cat manifest.txt | tpm2 pcrextend --manifest=-
+
+# the event log takes the algorithms of the first line, the second does not
+# match them
+if tpm2 pcrextend --manifest=manifest.txt --eventlog=measurements.bin; then
+    echo "tpm2 pcrextend logged digests not in the SpecID event!"
+    exit 1
+fi
+
+sed -i '/^11:/d' manifest.txt
+rm -f measurements.bin
+tpm2 pcrextend --manifest=manifest.txt --eventlog=measurements.bin
+tpm2 pcrextend --manifest=manifest.txt --eventlog=measurements.bin
+tpm2 eventlog measurements.bin > measurements.yaml
+test $(grep -c "PCRIndex: 10" measurements.yaml) -eq 4
+grep -q "first measurement" measurements.yaml
+
+# digest specifications exclude a manifest
+if tpm2 pcrextend --manifest=manifest.txt 8:$digests; then
+    echo "tpm2 pcrextend took both a manifest and specifications!"
+    exit 1
+fi
+
+rm -f manifest.txt measurements.bin measurements.yaml
+
 exit 0
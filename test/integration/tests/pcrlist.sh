@@ -26,4 +26,19 @@ test -e pcrs.out
 
 tpm2 pcrread -Q
 
+# Watch PCR 10 while it is extended, only the change is reported
+tpm2 pcrread --watch=1 --polls=4 sha256:10,11 > watch.yaml &
+watch_pid=$!
+sleep 2
+tpm2 pcrextend 10:sha256=6ea40aa7267bb71251c1de1c3605a3df759b86b22fa9f62aa298d4197cd88a38
+wait $watch_pid
+
+test $(grep -c "^---" watch.yaml) -eq 2
+grep -A3 "changed:" watch.yaml | grep -q "^    10"
+if grep -A3 "changed:" watch.yaml | grep -q "^    11"; then
+    echo "Expected only PCR 10 to be reported as changed"
+    exit 1
+fi
+rm -f watch.yaml
+
 exit 0
@@ -3,6 +3,8 @@
 source helpers.sh
 
 cleanup() {
+    rm -f expected.yaml read.yaml
+
     if [ "$1" != "no-shut-down" ]; then
           shut_down
     fi
@@ -19,6 +21,28 @@ tpm2 pcrreset 23
 # Reset more than one resettable PCR
 tpm2 pcrreset 16 23
 
+# Reset and re-measure, the expected values are those read back
+app=$(echo -n app | openssl dgst -sha256 -r | cut -d' ' -f1)
+dbg=$(echo -n dbg | openssl dgst -sha256 -r | cut -d' ' -f1)
+tpm2 pcrreset --expected -e 23:sha256=$app -e 23:sha256=$dbg 23 \
+    > expected.yaml
+tpm2 pcrread sha256:23 > read.yaml
+diff expected.yaml read.yaml
+
+reset=$(printf '0%.0s' $(seq 64))
+first=$(echo $reset$app | xxd -r -p | openssl dgst -sha256 -r | cut -d' ' -f1)
+second=$(echo $first$dbg | xxd -r -p | openssl dgst -sha256 -r | cut -d' ' -f1)
+test "$(yaml_get_kv expected.yaml sha256 23)" == "0x${second^^}"
+
+# A PCR extended must be reset
+trap - ERR
+tpm2 pcrreset -e 16:sha256=$app 23
+if [ $? -eq 0 ]; then
+  echo "Expected extending a PCR that is not reset to fail"
+  exit 1
+fi
+trap onerror ERR
+
 trap - ERR
 
 # Get PCR_Reset bad locality error
@@ -15,6 +15,7 @@ cleanup() {
     rm -f $ak_name_file $ak_pubkey_file \
           $quote_file $print_file $ak_ctx \
           tpmt_public.ak
+    rm -rf print_dir
 
     if [ "$1" != "no-shut-down" ]; then
        shut_down
@@ -84,13 +85,63 @@ with open("$print_file") as fd:
     print("OK")
 pyscript
 
+# the type is detected from the content of a file
+tpm2 print $quote_file | grep -q "^magic: ff544347$"
+tpm2 print $ak_pubkey_file > $print_file
+yaml_verify $print_file
+
+# many files and directories print as a stream of YAML documents
+mkdir -p print_dir/sub
+cp $quote_file print_dir/
+cp $ak_pubkey_file print_dir/sub/
+cp tpmt_public.ak print_dir/sub/
+tpm2 print print_dir $ak_ctx > $print_file
+python << pyscript
+import yaml
+
+with open("$print_file") as fd:
+    docs = list(yaml.safe_load_all(fd))
+
+types = [(d["file"], d["type"]) for d in docs]
+assert(types == [
+    ("print_dir/quote.bin", "TPMS_ATTEST"),
+    ("print_dir/sub/ak.pub", "TPM2B_PUBLIC"),
+    ("print_dir/sub/tpmt_public.ak", "TPMT_PUBLIC"),
+    ("$ak_ctx", "TPMS_CONTEXT"),
+])
+pyscript
+
+# the names of public areas are computed without the TPM, one line per file
+ak_name=$(xxd -p -c 256 $ak_name_file)
+tpm2 print --name $ak_pubkey_file > $print_file
+test "$(cat $print_file)" == "$ak_name  $ak_pubkey_file"
+tpm2 print --name print_dir/sub > $print_file
+test "$(cut -d' ' -f1 $print_file | sort -u)" == "$ak_name"
+test "$(wc -l < $print_file)" -eq 2
+tpm2 print --name -t TPMT_PUBLIC < tpmt_public.ak | grep -q "^$ak_name  -$"
+
 # negative testing
 trap - ERR
 
-tpm2 print $quote_file
+tpm2 print --name $quote_file
+if [ $? -eq 0 ]; then
+  echo "Expected tpm2 print --name of an attestation to fail"
+  exit 1
+fi
+
+tpm2 print < $quote_file
+if [ $? -eq 0 ]; then
+  echo "Expected tpm2 print of stdin without -t to fail"
+  exit 1
+fi
+
+# a file of unknown type fails the batch, but the others are still printed
+echo "garbage" > print_dir/garbage
+tpm2 print print_dir > $print_file
 if [ $? -eq 0 ]; then
-  echo "Expected tpm2 print without -t to fail"
+  echo "Expected tpm2 print of an unknown file to fail"
   exit 1
 fi
+grep -q "^type: TPMS_ATTEST$" $print_file
 
 exit 0
@@ -99,4 +99,35 @@ tpm2 createak -C ek.ctx -c ak.ctx -G ecc -g sha256 -s ecdsa
 tpm2 getrandom -o nonce.bin 20
 tpm2 quote -c ak.ctx -l sha256:15,16,22 -q nonce.bin -m quote.bin -s quote.sig -o quote.pcr -g sha256
 
+# Several quotes with one AK load, whose PCR reads overlap
+tpm2 readpublic -Q -c ak.ctx -f pem -o ak.pem
+tpm2 getrandom -o nonce2.bin 20
+cat > manifest.txt <<END
+# pcr-list qualification message signature pcr
+sha256:15,16,22 nonce.bin quote1.bin quote1.sig quote1.pcr
+sha256:16+sha1:16,17 nonce2.bin quote2.bin quote2.sig quote2.pcr
+
+sha256:0 - quote3.bin quote3.sig
+END
+
+tpm2 quote -c ak.ctx -g sha256 --manifest=manifest.txt > quotes.yaml
+test $(grep -c "quoted: true" quotes.yaml) -eq 3
+
+tpm2 checkquote -Q -u ak.pem -m quote1.bin -s quote1.sig -f quote1.pcr \
+-g sha256 -q nonce.bin
+tpm2 checkquote -Q -u ak.pem -m quote2.bin -s quote2.sig -f quote2.pcr \
+-g sha256 -q nonce2.bin
+tpm2 checkquote -Q -u ak.pem -m quote3.bin -s quote3.sig -g sha256
+
+trap - ERR
+
+tpm2 quote -Q -c ak.ctx -l sha256:0 --manifest=manifest.txt
+if [ $? -eq 0 ]; then
+    echo "Expected --manifest and -l to conflict" 1>&2
+    exit 1
+fi
+trap onerror ERR
+
+rm -f ak.pem nonce2.bin manifest.txt quotes.yaml quote1.* quote2.* quote3.*
+
 exit 0
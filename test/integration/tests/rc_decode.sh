@@ -65,6 +65,22 @@ for key in "${!codes[@]}"; do
     fi
 done
 
+# decoding a stream matches decoding a code at a time, repeats hit the cache
+printf '0x1d5\n\n  0x922 \n0x1d5\n' > rcs.txt
+tpm2 rc_decode - < rcs.txt > stream.txt
+{ tpm2 rc_decode 0x1d5; tpm2 rc_decode 0x922; tpm2 rc_decode 0x1d5; } \
+    > single.txt
+if ! cmp -s stream.txt single.txt; then
+    echo "Decoding a stream of codes differs from decoding them one by one"
+    fail=1
+fi
+
+if printf '0x1d5\nnot-a-code\n' | tpm2 rc_decode - &>/dev/null; then
+    echo "Expected a stream with an invalid code to fail."
+    fail=1
+fi
+rm -f rcs.txt stream.txt single.txt
+
 #
 # Negative tests
 #
@@ -3,7 +3,7 @@
 source helpers.sh
 
 cleanup() {
-	rm -f clock.yaml
+	rm -f clock.yaml watch.yaml
 }
 trap cleanup EXIT
 
@@ -18,4 +18,17 @@ yaml_get_kv clock.yaml clock_info reset_count
 yaml_get_kv clock.yaml clock_info restart_count
 yaml_get_kv clock.yaml clock_info safe
 
+# a steady clock outputs the first sample only
+tpm2 readclock --watch 1 --polls 2 > watch.yaml
+test "$(grep -c '^poll:' watch.yaml)" -eq 1
+yaml_get_kv watch.yaml clock_info clock
+
+trap - ERR
+tpm2 readclock --polls 1 2>/dev/null
+if [ $? -eq 0 ]; then
+	echo "--polls without --watch should fail"
+	exit 1
+fi
+trap onerror ERR
+
 exit 0
@@ -17,12 +17,16 @@ file_readpub_key_ctx=ctx_load_out_"$alg_primary_obj"_"$alg_primary_key"-\
 file_readpub_output=readpub_"$file_readpub_key_ctx"
 
 Handle_readpub=0x81010014
+Handle_readpub_rsa=0x81010015
 
 cleanup() {
     rm -f $file_primary_key_ctx $file_readpub_key_pub $file_readpub_key_priv \
     $file_readpub_key_name $file_readpub_key_ctx $file_readpub_output
 
     tpm2 evictcontrol -Q -C o -c $Handle_readpub 2>/dev/null || true
+    tpm2 evictcontrol -Q -C o -c $Handle_readpub_rsa 2>/dev/null || true
+
+    rm -rf bulk
 
     if [ "$1" != "no-shut-down" ]; then
        shut_down
@@ -52,4 +56,42 @@ tpm2 evictcontrol -Q -C o -c $file_readpub_key_ctx $Handle_readpub
 rm -f $file_readpub_output
 tpm2 readpublic -Q -c $Handle_readpub -o $file_readpub_output
 
+# bulk export, every format from a single read of the public area
+tpm2 evictcontrol -Q -C o -c $file_primary_key_ctx $Handle_readpub_rsa
+mkdir bulk
+
+tpm2 readpublic -f pem,der,ssh -o bulk $Handle_readpub_rsa \
+$file_primary_key_ctx > bulk/out.yaml
+test $(grep -c "object:" bulk/out.yaml) -eq 2
+
+openssl pkey -pubin -inform DER -in bulk/$Handle_readpub_rsa.der \
+-out bulk/from_der.pem
+cmp bulk/$Handle_readpub_rsa.pem bulk/from_der.pem
+cmp bulk/$Handle_readpub_rsa.pem bulk/$file_primary_key_ctx.pem
+grep -q "^ssh-rsa " bulk/$Handle_readpub_rsa.ssh
+
+tpm2 readpublic -Q --persistent -f tss -o bulk
+test -s bulk/$Handle_readpub.tss
+test -s bulk/$Handle_readpub_rsa.tss
+
+# negative tests
+trap - ERR
+
+# an HMAC key has no PEM form, the others are still exported
+rm -f bulk/$Handle_readpub_rsa.pem
+tpm2 readpublic -Q -f pem -o bulk $Handle_readpub $Handle_readpub_rsa \
+2>/dev/null
+if [ $? -eq 0 ]; then
+    echo "tpm2 readpublic should fail for an HMAC key in PEM format"
+    exit 1
+fi
+test -s bulk/$Handle_readpub_rsa.pem || exit 1
+
+# several formats need the bulk mode
+tpm2 readpublic -Q -c $Handle_readpub_rsa -f pem,der -o bulk/key 2>/dev/null
+if [ $? -eq 0 ]; then
+    echo "tpm2 readpublic should fail for several formats of one object"
+    exit 1
+fi
+
 exit 0
@@ -21,7 +21,8 @@ cleanup() {
     rm -f $file_input_data $file_primary_key_ctx $file_rsaencrypt_key_pub \
     $file_rsaencrypt_key_priv $file_rsaencrypt_key_ctx \
     $file_rsaencrypt_key_name $file_output_data $file_rsa_en_output_data \
-    $file_rsa_de_output_data $file_rsadecrypt_key_ctx label.dat
+    $file_rsa_de_output_data $file_rsadecrypt_key_ctx label.dat key.pem \
+    msgs.rec msgs.enc msgs.dec
 
     if [ "$1" != "no-shut-down" ]; then
         shut_down
@@ -96,5 +97,50 @@ tpm2 rsaencrypt -Q -c $file_rsaencrypt_key_ctx -o $file_rsa_en_output_data \
 tpm2 rsadecrypt -Q -c $file_rsadecrypt_key_ctx -p foo -o \
 $file_rsa_de_output_data -s oaep-sha1 $file_rsa_en_output_data
 
+# Encrypt on the host, decrypt in the TPM
+tpm2 readpublic -Q -c $file_rsadecrypt_key_ctx -f pem -o key.pem
+for scheme in rsaes oaep oaep-sha1 null; do
+    for key in key.pem $file_rsaencrypt_key_pub; do
+        tpm2 rsaencrypt -Q -T none -u $key -s $scheme -l mylabel \
+        -o $file_rsa_en_output_data $file_input_data
+        tpm2 rsadecrypt -Q -c $file_rsadecrypt_key_ctx -p foo -s $scheme \
+        -l mylabel -o $file_rsa_de_output_data $file_rsa_en_output_data
+        if [ "$scheme" != "null" ]; then
+            cmp $file_input_data $file_rsa_de_output_data
+        fi
+    done
+done
+
+# Batches of records, a 16 bit big endian size and the bytes
+printf '\x00\x03one\x00\x05three\x00\x00\x00\x04four' > msgs.rec
+
+tpm2 rsaencrypt -Q -c $file_rsaencrypt_key_ctx -s oaep --batch -o msgs.enc \
+msgs.rec
+tpm2 rsadecrypt -Q -c $file_rsadecrypt_key_ctx -p foo -s oaep --batch \
+-o msgs.dec msgs.enc
+cmp msgs.rec msgs.dec
+
+cat msgs.rec | tpm2 rsaencrypt -Q -T none -u key.pem -s oaep --batch \
+-o msgs.enc
+tpm2 rsadecrypt -Q -c $file_rsadecrypt_key_ctx -p foo -s oaep --batch \
+-o msgs.dec < msgs.enc
+cmp msgs.rec msgs.dec
+
+trap - ERR
+
+# a truncated record fails the batch
+printf '\x00\x08one' > msgs.rec
+tpm2 rsaencrypt -Q -c $file_rsaencrypt_key_ctx --batch -o msgs.enc msgs.rec
+if [ $? -eq 0 ]; then
+    echo "Expected a truncated record to fail" 1>&2
+    exit 1
+fi
+
+tpm2 rsadecrypt -Q -c $file_rsadecrypt_key_ctx -p foo --batch msgs.enc
+if [ $? -eq 0 ]; then
+    echo "Expected a batch without output file to fail" 1>&2
+    exit 1
+fi
+trap onerror ERR
 
 exit 0
@@ -54,4 +54,18 @@ cat $file_input_data | tpm2 rsaencrypt -c $file_rsaencrypt_key_ctx > /dev/null
  tpm2 rsaencrypt -c $file_rsaencrypt_key_ctx -o $file_rsa_en_output_data \
  -s oaep < $file_input_data
 
+# Test encryption on the host, without a TPM
+tpm2 rsaencrypt -Q -T none -u $file_rsaencrypt_key_pub -s oaep \
+-o $file_rsa_en_output_data $file_input_data
+
+trap - ERR
+
+tpm2 rsaencrypt -Q -T none -c $file_rsaencrypt_key_ctx \
+-o $file_rsa_en_output_data $file_input_data
+if [ $? -eq 0 ]; then
+    echo "Expected a key context to require the TPM" 1>&2
+    exit 1
+fi
+trap onerror ERR
+
 exit 0
@@ -0,0 +1,42 @@
+# SPDX-License-Identifier: BSD-3-Clause
+
+source helpers.sh
+
+cleanup() {
+    unset TPM2TOOLS_STATS_FILE
+    rm -f random.out stats.yaml stats.err
+
+    if [ "$1" != "no-shut-down" ]; then
+        shut_down
+    fi
+}
+trap cleanup EXIT
+
+start_up
+
+cleanup "no-shut-down"
+
+# without the option nothing is output
+tpm2 getrandom -o random.out 8 2> stats.err
+test ! -s stats.err
+
+# the statistics go to stderr
+tpm2 getrandom --runtime-stats -o random.out 8 2> stats.yaml
+yaml_verify stats.yaml
+grep -q "^- tool: getrandom$" stats.yaml
+grep -q "user-us:" stats.yaml
+grep -q "name: TPM2_CC_GetRandom$" stats.yaml
+grep -q "bytes-written: 8$" stats.yaml
+grep -q "bytes-sent: [1-9]" stats.yaml
+
+# and are appended to the stats file, one sequence entry per invocation
+export TPM2TOOLS_STATS_FILE="$PWD/stats.yaml"
+rm -f stats.yaml
+tpm2 getrandom --runtime-stats -o random.out 8
+tpm2 pcrread --runtime-stats sha256:0,1 > /dev/null
+yaml_verify stats.yaml
+test "$(grep -c "^- tool:" stats.yaml)" -eq 2
+grep -q "^- tool: pcrread$" stats.yaml
+grep -q "name: TPM2_CC_PCR_Read$" stats.yaml
+
+exit 0
@@ -21,4 +21,40 @@ cat ${TPM2_COMMAND_FILE} | tpm2 send -o /dev/null
 # check -o out and argument file input
 tpm2 send -o /dev/null "${TPM2_COMMAND_FILE}"
 
+# replay a stream of commands with latency statistics
+cat ${TPM2_COMMAND_FILE} ${TPM2_COMMAND_FILE} ${TPM2_COMMAND_FILE} \
+    > commands.bin
+tpm2 send --stats --timeout=10000 -o responses.bin commands.bin > stats.yaml
+yaml_get_kv stats.yaml "commands" | grep -q "^3$"
+test $(grep -c "name: TPM2_CC_GetCapability" stats.yaml) -eq 1
+test $(stat -c %s responses.bin) -gt 0
+
+# the statistics need stdout to themselves
+trap - ERR
+tpm2 send --stats commands.bin > /dev/null
+if [ $? -eq 0 ]; then
+    echo "Expected --stats without -o to fail"
+    exit 1
+fi
+trap onerror ERR
+
+# capture the commands of the tools into a ring of two and replay it
+rm -f capture.ring
+TPM2TOOLS_CAPTURE_FILE=capture.ring TPM2TOOLS_CAPTURE_ENTRIES=2 \
+    tpm2 send -o /dev/null commands.bin
+tpm2 send --capture --stats -o /dev/null capture.ring > stats.yaml
+yaml_get_kv stats.yaml "commands" | grep -q "^2$"
+grep -q "name: TPM2_CC_GetCapability" stats.yaml
+
+# a command stream is not a ring file
+trap - ERR
+tpm2 send --capture -o /dev/null commands.bin
+if [ $? -eq 0 ]; then
+    echo "Expected --capture of a command stream to fail"
+    exit 1
+fi
+trap onerror ERR
+
+rm -f commands.bin responses.bin stats.yaml capture.ring
+
 exit 0
@@ -0,0 +1,136 @@
+# SPDX-License-Identifier: BSD-3-Clause
+
+source helpers.sh
+
+sock="$PWD/serve.sock"
+serve_pid=""
+
+cleanup() {
+    unset TPM2TOOLS_SERVE_SOCKET
+    if [ -n "$serve_pid" ]; then
+        kill -TERM $serve_pid 2>/dev/null
+        wait $serve_pid 2>/dev/null
+        serve_pid=""
+    fi
+
+    rm -f random.out prim.ctx key.pub key.priv key.ctx msg.dat sig.rssa \
+    pcr.out serve.sock
+    rm -rf sub
+
+    if [ "$1" != "no-shut-down" ]; then
+        shut_down
+    fi
+}
+trap cleanup EXIT
+
+start_up
+
+cleanup "no-shut-down"
+
+tpm2 serve "$sock" &
+serve_pid=$!
+
+# wait for the daemon to come up
+for i in $(seq 1 50); do
+    if [ -S "$sock" ]; then
+        break
+    fi
+    sleep 0.1
+done
+test -S "$sock"
+
+# only the user of the daemon can connect
+test `stat -c %a "$sock"` = "600"
+
+export TPM2TOOLS_SERVE_SOCKET="$sock"
+
+echo "message to sign" > msg.dat
+
+tpm2 getrandom -o random.out 16
+s=`ls -l random.out | awk {'print $5'}`
+test $s -eq 16
+
+tpm2 createprimary -Q -C o -c prim.ctx
+tpm2 create -Q -C prim.ctx -G rsa -u key.pub -r key.priv
+tpm2 load -Q -C prim.ctx -u key.pub -r key.priv -c key.ctx
+tpm2 sign -c key.ctx -g sha256 -o sig.rssa msg.dat
+tpm2 verifysignature -c key.ctx -g sha256 -m msg.dat -s sig.rssa
+
+# stdout of the client is the one used by the remote tool
+tpm2 pcrread sha256:0 > pcr.out
+grep -q "sha256" pcr.out
+
+# stdin of the client is the one used by the remote tool
+echo "data" | tpm2 hash -g sha256 -o /dev/null
+
+# relative paths are opened by the client, in its working directory
+mkdir sub
+(cd sub && tpm2 getrandom -o random.out 8)
+test `stat -c %s sub/random.out` -eq 8
+
+# negative tests
+trap - ERR
+
+# the exit status of the remote tool is returned
+tpm2 getrandom &> /dev/null
+if [ $? -eq 0 ]; then
+    echo "tpm2 getrandom without a size should fail over the socket"
+    exit 1
+fi
+
+# an unreachable daemon is a tcti error
+TPM2TOOLS_SERVE_SOCKET="$PWD/missing.sock" tpm2 getrandom 8 &> /dev/null
+if [ $? -ne 4 ]; then
+    echo "an unreachable daemon should fail with a tcti error"
+    exit 1
+fi
+
+# the daemon removes the socket on exit
+unset TPM2TOOLS_SERVE_SOCKET
+kill -TERM $serve_pid
+wait $serve_pid
+serve_pid=""
+if [ -e "$sock" ]; then
+    echo "tpm2 serve should remove the socket on exit"
+    exit 1
+fi
+
+# an unknown priority class is rejected
+tpm2 serve --priority urgent:unseal "$sock" &> /dev/null
+if [ $? -eq 0 ]; then
+    echo "tpm2 serve should reject an unknown priority class"
+    exit 1
+fi
+
+trap onerror ERR
+
+# requests made in parallel are all served, whatever their class
+tpm2 serve --priority interactive:getrandom --priority background:pcrread \
+    --max-long 1 "$sock" &
+serve_pid=$!
+for i in $(seq 1 50); do
+    if [ -S "$sock" ]; then
+        break
+    fi
+    sleep 0.1
+done
+test -S "$sock"
+
+export TPM2TOOLS_SERVE_SOCKET="$sock"
+pids=""
+tpm2 createprimary -Q -C o -c prim.ctx & pids="$pids $!"
+tpm2 pcrread sha256:0 > pcr.out & pids="$pids $!"
+tpm2 getrandom -o random.out 16 & pids="$pids $!"
+for pid in $pids; do
+    wait $pid
+done
+grep -q "sha256" pcr.out
+test `stat -c %s random.out` -eq 16
+tpm2 flushcontext prim.ctx
+
+unset TPM2TOOLS_SERVE_SOCKET
+kill -TERM $serve_pid
+wait $serve_pid
+serve_pid=""
+
+exit 0
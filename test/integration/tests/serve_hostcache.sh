@@ -0,0 +1,95 @@
+# SPDX-License-Identifier: BSD-3-Clause
+
+source helpers.sh
+
+sock="$PWD/serve_hostcache.sock"
+serve_pid=""
+handle=0x81010021
+
+cleanup() {
+    unset TPM2TOOLS_SERVE_SOCKET
+    if [ -n "$serve_pid" ]; then
+        kill -TERM $serve_pid 2>/dev/null
+        wait $serve_pid 2>/dev/null
+        serve_pid=""
+    fi
+
+    tpm2 evictcontrol -Q -C o -c $handle 2>/dev/null || true
+    unset TPM2TOOLS_HOST_CACHE
+
+    rm -f serve_hostcache.sock host.cache prim.ctx pcr.1 pcr.2 pcr.3 \
+    pub.1 pub.2
+
+    if [ "$1" != "no-shut-down" ]; then
+        shut_down
+    fi
+}
+trap cleanup EXIT
+
+start_up
+
+cleanup "no-shut-down"
+
+tpm2 createprimary -Q -C o -c prim.ctx
+tpm2 evictcontrol -Q -C o -c prim.ctx $handle
+
+export TPM2TOOLS_HOST_CACHE="$PWD/host.cache"
+
+# a tool outside of tpm2_serve does not create the cache
+tpm2 pcrread sha256:16 > pcr.1
+test ! -e host.cache
+
+tpm2 serve "$sock" &
+serve_pid=$!
+
+for i in $(seq 1 50); do
+    if [ -S "$sock" ]; then
+        break
+    fi
+    sleep 0.1
+done
+test -S "$sock"
+
+# the tools run by the daemon fill the cache, only the daemon writes it
+TPM2TOOLS_SERVE_SOCKET="$sock" tpm2 pcrread sha256:16 > pcr.2
+test -s host.cache
+test "$(stat -c %a host.cache)" = 644
+cmp pcr.1 pcr.2
+
+# other tools answer from it
+tpm2 pcrread sha256:16 > pcr.2
+cmp pcr.1 pcr.2
+
+# the public areas are always read from the TPM
+TPM2TOOLS_SERVE_SOCKET="$sock" tpm2 readpublic -c $handle > pub.1
+tpm2 readpublic -c $handle > pub.2
+cmp pub.1 pub.2
+
+# an extension changes the update counter, the cached values are not used
+tpm2 pcrextend 16:sha256=\
+e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca495991b7852b855
+tpm2 pcrread sha256:16 > pcr.3
+if cmp -s pcr.1 pcr.3; then
+    echo "The PCR values of the host cache were used after an extension"
+    exit 1
+fi
+tpm2 pcrreset 16
+
+# an evict by a tool outside of the daemon is seen at once
+tpm2 evictcontrol -Q -C o -c $handle
+if tpm2 readpublic -c $handle > pub.2 2>/dev/null; then
+    echo "The public area of an evicted object came from the host cache"
+    exit 1
+fi
+
+# a cache other users could write is not used
+chmod 666 host.cache
+tpm2 pcrread sha256:16 2>&1 >/dev/null | grep -q "other users could write"
+chmod 644 host.cache
+
+unset TPM2TOOLS_SERVE_SOCKET
+kill -TERM $serve_pid
+wait $serve_pid
+serve_pid=""
+
+exit 0
@@ -0,0 +1,97 @@
+# SPDX-License-Identifier: BSD-3-Clause
+
+source helpers.sh
+
+sock="$PWD/serve_nvbits.sock"
+serve_pid=""
+nv_test_index=0x1500018
+
+cleanup() {
+    unset TPM2TOOLS_SERVE_SOCKET
+    if [ -n "$serve_pid" ]; then
+        kill -TERM $serve_pid 2>/dev/null
+        wait $serve_pid 2>/dev/null
+        serve_pid=""
+    fi
+
+    tpm2 nvundefine -Q -C o $nv_test_index 2>/dev/null || true
+
+    rm -f serve_nvbits.sock
+
+    if [ "$1" != "no-shut-down" ]; then
+        shut_down
+    fi
+}
+trap cleanup EXIT
+
+start_up
+
+cleanup "no-shut-down"
+
+tpm2 nvdefine -C o -a "nt=bits|ownerread|ownerwrite" $nv_test_index
+
+# a long interval, the bits are set when the daemon exits
+tpm2 serve --nv-bits-interval=3600 "$sock" &
+serve_pid=$!
+
+for i in $(seq 1 50); do
+    if [ -S "$sock" ]; then
+        break
+    fi
+    sleep 0.1
+done
+test -S "$sock"
+
+export TPM2TOOLS_SERVE_SOCKET="$sock"
+
+read_bits() {
+    tpm2 nvread -C o $@ $nv_test_index | xxd -p | sed s/'^0*'/0x/
+}
+
+# the shadow starts from the value of the index
+tpm2 nvsetbits -C o -i 0x1 $nv_test_index
+check=$(read_bits --shadow)
+test "$check" == "0x1"
+
+# the first deferred request checks the authorization with the TPM
+tpm2 nvsetbits -C o -i 0x10 --defer $nv_test_index
+check=$(read_bits)
+test "$check" == "0x11"
+
+# later ones merge and show in the shadow, but not yet in the index
+tpm2 nvsetbits -C o -i 0x100 --defer $nv_test_index
+tpm2 nvsetbits -C o -i 0x200 --defer $nv_test_index
+check=$(read_bits --shadow)
+test "$check" == "0x311"
+check=$(read_bits)
+test "$check" == "0x11"
+
+# a wrong password is not queued
+if tpm2 nvsetbits -C o -P wrong -i 0x400 --defer $nv_test_index \
+    2>/dev/null; then
+    echo "tpm2 nvsetbits --defer should fail with a wrong password"
+    exit 1
+fi
+check=$(read_bits --shadow)
+test "$check" == "0x311"
+
+# the daemon sets the pending bits on exit
+unset TPM2TOOLS_SERVE_SOCKET
+kill -TERM $serve_pid
+wait $serve_pid
+serve_pid=""
+
+check=$(read_bits)
+test "$check" == "0x311"
+
+# negative tests
+trap - ERR
+
+# without the queue of the daemon there is nothing to defer to
+tpm2 nvsetbits -C o -i 0x1000 --defer $nv_test_index 2>/dev/null
+if [ $? -eq 0 ]; then
+    echo "tpm2 nvsetbits --defer should fail without tpm2 serve"
+    exit 1
+fi
+
+exit 0
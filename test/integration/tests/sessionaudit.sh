@@ -385,6 +385,50 @@ diff \
 <( cat zero.bin cphash.bin rphash.bin | openssl dgst -sha256 -binary ) \
 <( tail -c 32 att.data )
 
+#
+# Get and verify the audit digests of several sessions in a bundle
+#
+tpm2 clear -Q
+
+tpm2 createprimary -Q -C e -g sha256 -G rsa -c prim.ctx
+
+tpm2 create -Q -C prim.ctx -c signing_key.ctx -u signing_key.pub \
+-r signing_key.priv
+
+tpm2 readpublic -Q -c signing_key.ctx -f pem -o signing_key.pem
+
+tpm2 startauthsession -S session1.ctx --audit-session
+tpm2 startauthsession -S session2.ctx --audit-session
+
+tpm2 getrandom 8 -S session1.ctx --cphash cp.hash --rphash rp.hash
+tpm2 getrandom 8 -S session2.ctx
+
+tpm2 getsessionauditdigest -c signing_key.ctx -q 1a2b3c4d -S session1.ctx \
+-S session2.ctx --bundle=audit.yaml --verify=signing_key.pem
+
+test $(grep -c "verified: true" audit.yaml) -eq 2
+
+dd if=cp.hash skip=2 bs=1 count=32 status=none of=cphash.bin
+dd if=rp.hash skip=2 bs=1 count=32 status=none of=rphash.bin
+
+test "$(grep -m1 "audit-digest" audit.yaml | awk '{print $2}')" = \
+"$(cat zero.bin cphash.bin rphash.bin | openssl dgst -sha256 -binary | \
+xxd -p -c 32)"
+
+tpm2 flushcontext session1.ctx
+tpm2 flushcontext session2.ctx
+
+trap - ERR
+
+tpm2 getsessionauditdigest -c signing_key.ctx -S session1.ctx -S session2.ctx \
+-m att.data -s att.sig
+if [ $? -eq 0 ]; then
+    echo "Expected several sessions without --bundle to fail" 1>&2
+    exit 1
+fi
+
+rm -f signing_key.pem session1.ctx session2.ctx audit.yaml
+
 #
 # End
 #
@@ -282,6 +282,114 @@ tpm2 commit -c key.ctx -t commit.ctr --eccpoint-K K.bin --eccpoint-L L.bin -u E.
 tpm2 sign -c key.ctx -g sha256 -o test.sig test.rnd -s ecdaa --commit-index 1
 tpm2 sign -c key.ctx -g sha256 -o test.sig test.rnd -s ecdaa
 
+# Test batch signing of a manifest and of a digest stream
+cleanup "no-shut-down"
+
+tpm2 createprimary -Q -C o -c $file_primary_key_ctx
+tpm2 create -Q -C $file_primary_key_ctx -G rsa2048 -u $file_signing_key_pub \
+-r $file_signing_key_priv
+tpm2 load -Q -C $file_primary_key_ctx -u $file_signing_key_pub \
+-r $file_signing_key_priv -c $file_signing_key_ctx
+tpm2 readpublic -Q -c $file_signing_key_ctx --format=pem \
+-o $file_signing_key_pub_pem
+
+rm -f manifest.txt digests.bin
+echo "# digest signature" > manifest.txt
+for i in 1 2 3 4 5; do
+    head -c 100 /dev/urandom > batch$i.dat
+    openssl dgst -sha256 -binary batch$i.dat > batch$i.digest
+    cat batch$i.digest >> digests.bin
+    echo "batch$i.digest batch$i.sig" >> manifest.txt
+done
+echo "" >> manifest.txt
+
+tpm2 sign -c $file_signing_key_ctx -g sha256 -f plain \
+--manifest=manifest.txt > batch.yaml
+test $(grep -c "signed: true" batch.yaml) -eq 5
+for i in 1 2 3 4 5; do
+    openssl dgst -verify $file_signing_key_pub_pem -keyform pem -sha256 \
+    -signature batch$i.sig batch$i.dat
+done
+
+# RSASSA signatures are deterministic and of the size of the key
+tpm2 sign -Q -c $file_signing_key_ctx -g sha256 -f plain --batch \
+-o signatures.bin digests.bin
+cat batch1.sig batch2.sig batch3.sig batch4.sig batch5.sig | \
+cmp - signatures.bin
+
+cat digests.bin | tpm2 sign -Q -c $file_signing_key_ctx -g sha256 --batch \
+-o signatures.tss
+test $(stat -c %s signatures.tss) -gt $(stat -c %s signatures.bin)
+
+trap - ERR
+
+# a missing digest fails the manifest, but the others are signed
+rm -f batch1.sig batch3.sig
+echo "missing.digest missing.sig" >> manifest.txt
+echo "batch3.digest batch3.sig" >> manifest.txt
+tpm2 sign -c $file_signing_key_ctx -g sha256 --manifest=manifest.txt \
+> batch.yaml
+if [ $? -eq 0 ] || [ ! -f batch1.sig ] || [ ! -f batch3.sig ]; then
+    echo "Expected the manifest to fail but sign the other digests" 1>&2
+    exit 1
+fi
+
+# digest streams must not have trailing bytes
+head -c 7 /dev/urandom >> digests.bin
+tpm2 sign -Q -c $file_signing_key_ctx -g sha256 --batch -o signatures.bin \
+digests.bin
+if [ $? -eq 0 ]; then
+    echo "Expected trailing bytes of a digest stream to fail" 1>&2
+    exit 1
+fi
+
+tpm2 sign -Q -c $file_signing_key_ctx -g sha256 --batch -o signatures.bin \
+--cphash cp.hash digests.bin
+if [ $? -eq 0 ]; then
+    echo "Expected batch signing with cpHash to fail" 1>&2
+    exit 1
+fi
+trap onerror ERR
+
+rm -f manifest.txt digests.bin batch.yaml signatures.bin signatures.tss \
+      batch*.dat batch*.digest batch*.sig missing.sig
+
+# Sign a file by a tree hash and check it, whole and by range
+head -c 300000 /dev/urandom > large.bin
+tpm2 sign -Q -c $file_signing_key_ctx -g sha256 --tree-hash=65536 \
+-o large.sig large.bin
+test -f large.sig.tree
+
+tpm2 verifysignature -Q -c $file_signing_key_ctx -m large.bin -s large.sig \
+--tree=large.sig.tree
+tpm2 verifysignature -Q -c $file_signing_key_ctx -m large.bin -s large.sig \
+--tree=large.sig.tree --range=70000:1000 --jobs=2
+
+# damage the last chunk
+printf 'x' | dd of=large.bin bs=1 seek=299999 conv=notrunc status=none
+
+trap - ERR
+tpm2 verifysignature -Q -c $file_signing_key_ctx -m large.bin -s large.sig \
+--tree=large.sig.tree
+if [ $? -eq 0 ]; then
+    echo "Expected a damaged chunk to fail the tree" 1>&2
+    exit 1
+fi
+
+tpm2 sign -Q -c $file_signing_key_ctx -g sha256 --tree-hash=65536 -d \
+-o large.sig large.bin
+if [ $? -eq 0 ]; then
+    echo "Expected a tree hash of a digest to fail" 1>&2
+    exit 1
+fi
+trap onerror ERR
+
+# the chunks before the damage still check
+tpm2 verifysignature -Q -c $file_signing_key_ctx -m large.bin -s large.sig \
+--tree=large.sig.tree --range=0:262144
+
+rm -f large.bin large.sig large.sig.tree
+
 # Test that invalid password returns the proper code
 cleanup "no-shut-down"
 
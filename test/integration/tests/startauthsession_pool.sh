@@ -0,0 +1,85 @@
+# SPDX-License-Identifier: BSD-3-Clause
+
+source helpers.sh
+
+cleanup() {
+    rm -f session.ctx pool.yaml prim.ctx
+    rm -rf session_pool
+
+    if [ "$1" != "no-shut-down" ]; then
+        shut_down
+    fi
+}
+trap cleanup EXIT
+
+start_up
+
+cleanup "no-shut-down"
+
+mkdir -p session_pool
+
+# Pre-started sessions are handed out once each
+tpm2 startauthsession --policy-session -g sha256 --pool=session_pool \
+--fill-pool=2 > pool.yaml
+test "$(yaml_get_kv pool.yaml pool created)" -eq 2
+
+# the pool is only topped up
+tpm2 startauthsession --policy-session -g sha256 --pool=session_pool \
+--fill-pool=2 > pool.yaml
+test "$(yaml_get_kv pool.yaml pool created)" -eq 0
+test "$(yaml_get_kv pool.yaml pool candidates)" -eq 2
+
+tpm2 startauthsession --policy-session -g sha256 --pool=session_pool \
+--from-pool -S session.ctx
+test $(ls session_pool | grep -c "\.ctx$") -eq 1
+tpm2 policyauthvalue -S session.ctx
+tpm2 flushcontext session.ctx
+
+# sessions of another configuration stay in the pool
+tpm2 startauthsession --hmac-session -g sha256 --pool=session_pool \
+--from-pool -S session.ctx
+test $(ls session_pool | grep -c "\.ctx$") -eq 1
+tpm2 flushcontext session.ctx
+
+tpm2 startauthsession --policy-session -g sha256 --pool=session_pool \
+--from-pool -S session.ctx
+test $(ls session_pool | grep -c "\.ctx$") -eq 0
+tpm2 flushcontext session.ctx
+
+# an empty pool falls back to starting the session
+tpm2 startauthsession --policy-session -g sha256 --pool=session_pool \
+--from-pool -S session.ctx
+tpm2 flushcontext session.ctx
+
+# salted sessions are kept apart by their tpmkey
+tpm2 createprimary -Q -C o -G ecc -c prim.ctx
+tpm2 startauthsession --hmac-session --tpmkey-context prim.ctx \
+--pool=session_pool --fill-pool=1 > pool.yaml
+test "$(yaml_get_kv pool.yaml pool created)" -eq 1
+tpm2 startauthsession --hmac-session --pool=session_pool --from-pool \
+-S session.ctx
+test $(ls session_pool | grep -c "\.ctx$") -eq 1
+tpm2 flushcontext session.ctx
+tpm2 startauthsession --hmac-session --tpmkey-context prim.ctx \
+--pool=session_pool --from-pool -S session.ctx
+test $(ls session_pool | grep -c "\.ctx$") -eq 0
+tpm2 flushcontext session.ctx
+tpm2 flushcontext prim.ctx
+
+# negative tests
+trap - ERR
+
+tpm2 startauthsession --policy-session --fill-pool=1 &> /dev/null
+if [ $? -eq 0 ]; then
+    echo "--fill-pool without --pool should fail"
+    exit 1
+fi
+
+tpm2 startauthsession --policy-session --pool=session_pool --fill-pool=1 \
+-S session.ctx &> /dev/null
+if [ $? -eq 0 ]; then
+    echo "--fill-pool with -S should fail"
+    exit 1
+fi
+
+exit 0
@@ -43,4 +43,17 @@ else
     true
 fi
 
+# Stream any number of bytes, in commands of 128 bytes
+tpm2 stirrandom --stream "${bigfile}" -V 2>&1 1>/dev/null | \
+grep -q "Submitted 256 bytes to TPM"
+
+head -c 1000 /dev/urandom | tpm2 stirrandom --stream -V 2>&1 1>/dev/null | \
+grep -q "Submitted 1000 bytes to TPM"
+
+# An empty stream is an error
+if tpm2 stirrandom --stream < /dev/null; then
+    echo "tpm2 stirrandom didn't fail on an empty stream"
+    exit 1
+fi
+
 exit 0
@@ -0,0 +1,50 @@
+# SPDX-License-Identifier: BSD-3-Clause
+
+source helpers.sh
+
+cleanup() {
+    unset TPM2TOOLS_TARGETS
+    rm -f targets.yaml
+
+    if [ "$1" != "no-shut-down" ]; then
+        shut_down
+    fi
+}
+trap cleanup EXIT
+
+start_up
+
+cleanup "no-shut-down"
+
+# the same TPM twice stands in for many TPMs
+TPM2TOOLS_TARGETS="$TPM2TOOLS_TCTI;$TPM2TOOLS_TCTI" \
+    tpm2 getcap properties-fixed > targets.yaml
+yaml_verify targets.yaml
+
+python << pyscript
+import yaml
+
+with open("targets.yaml") as fd:
+    targets = yaml.safe_load(fd)
+
+assert(len(targets) == 2)
+for target in targets:
+    assert(target["target"] == "$TPM2TOOLS_TCTI")
+    assert(target["rc"] == 0)
+    assert("TPM2_PT_FAMILY_INDICATOR" in target["output"])
+pyscript
+
+# a failing target fails the tool, the others still report
+trap - ERR
+TPM2TOOLS_TARGETS="$TPM2TOOLS_TCTI;mssim:port=1" \
+    tpm2 getcap properties-fixed > targets.yaml
+if [ $? -eq 0 ]; then
+    echo "Expected an unreachable target to fail"
+    exit 1
+fi
+trap onerror ERR
+
+test "$(grep -c "^- target:" targets.yaml)" -eq 2
+grep -q "TPM2_PT_FAMILY_INDICATOR" targets.yaml
+
+exit 0
@@ -62,6 +62,15 @@ else
     true
 fi
 
+# The verdicts come from the capability cache the second time
+rm -f capcache.bin
+TPM2TOOLS_CAPABILITY_CACHE=capcache.bin tpm2 testparms rsa2048
+TPM2TOOLS_CAPABILITY_CACHE=capcache.bin tpm2 testparms rsa2048
+TPM2TOOLS_CAPABILITY_CACHE=capcache.bin tpm2 geteccparameters ecc256 -o p1.bin
+TPM2TOOLS_CAPABILITY_CACHE=capcache.bin tpm2 geteccparameters ecc256 -o p2.bin
+cmp p1.bin p2.bin
+rm -f capcache.bin p1.bin p2.bin
+
 # Attempt to specify a suite that is not supported (error from TPM)
 if tpm2 getcap ecc-curves | grep -q TPM2_ECC_NIST_P521; then
     if tpm2 testparms "ecc521:ecdsa:camellia" &>/dev/null; then
@@ -0,0 +1,45 @@
+# SPDX-License-Identifier: BSD-3-Clause
+
+source helpers.sh
+
+cleanup() {
+    unset TPM2TOOLS_TRACE TPM2TOOLS_TRACE_FILE
+    rm -f random.out trace.yaml trace.err
+
+    if [ "$1" != "no-shut-down" ]; then
+        shut_down
+    fi
+}
+trap cleanup EXIT
+
+start_up
+
+cleanup "no-shut-down"
+
+# without TPM2TOOLS_TRACE nothing is traced
+tpm2 getrandom -o random.out 8 2> trace.err
+test ! -s trace.err
+
+# the summary goes to stderr
+TPM2TOOLS_TRACE=timing tpm2 getrandom -o random.out 8 2> trace.yaml
+yaml_verify trace.yaml
+grep -q "^- tool: getrandom$" trace.yaml
+grep -q "onrun-us:" trace.yaml
+grep -q "esys-us:" trace.yaml
+grep -q "openssl-us:" trace.yaml
+grep -q "^  minor-faults: [0-9]*$" trace.yaml
+grep -q "tcti-faults:" trace.yaml
+grep -q "name: TPM2_CC_GetRandom$" trace.yaml
+
+# and is appended to the trace file, one sequence entry per invocation
+export TPM2TOOLS_TRACE=timing
+export TPM2TOOLS_TRACE_FILE="$PWD/trace.yaml"
+rm -f trace.yaml
+tpm2 getrandom -o random.out 8
+tpm2 pcrread sha256:0,1 > /dev/null
+yaml_verify trace.yaml
+test "$(grep -c "^- tool:" trace.yaml)" -eq 2
+grep -q "^- tool: pcrread$" trace.yaml
+grep -q "name: TPM2_CC_PCR_Read$" trace.yaml
+
+exit 0
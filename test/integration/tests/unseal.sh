@@ -142,6 +142,83 @@ if [ $? != 3 ]; then
   exit 1
 fi
 
+# Test unsealing a manifest of objects sealed to the same PCR policy
+trap onerror ERR
+
+tpm2 pcrread -Q -o $file_pcr_value $pcr_specification
+
+tpm2 createpolicy -Q --policy-pcr -l $pcr_specification -f $file_pcr_value \
+-L $file_policy
+
+for i in 1 2 3; do
+  echo "secret$i" | tpm2 create -Q -C $file_primary_key_ctx -L $file_policy \
+  -a 'fixedtpm|fixedparent' -u seal$i.pub -r seal$i.priv -i-
+done
+
+cat > manifest.txt <<EOF
+# public private auth output
+seal1.pub seal1.priv - seal1.out
+seal2.pub seal2.priv - seal2.out
+seal3.pub seal3.priv pcr:$pcr_specification=$file_pcr_value seal3.out
+EOF
+
+tpm2 unseal -C $file_primary_key_ctx --manifest manifest.txt \
+-p pcr:$pcr_specification > unseal.yaml
+
+for i in 1 2 3; do
+  test "$(cat seal$i.out)" == "secret$i"
+done
+test "$(grep -c 'unsealed: true' unseal.yaml)" == 3
+
+# A line that fails does not stop the others
+tpm2 load -Q -C $file_primary_key_ctx -u seal1.pub -r seal1.priv -c seal1.ctx
+
+cat > manifest.txt <<EOF
+seal1.ctx wrongpass seal1.out
+seal1.ctx - seal2.out
+EOF
+
+trap - ERR
+
+rm -f seal2.out
+tpm2 unseal --manifest manifest.txt -p pcr:$pcr_specification > unseal.yaml \
+2> /dev/null
+if [ $? == 0 ]; then
+  echo "tpm2 unseal didn't fail with a wrong auth in the manifest!"
+  exit 1
+fi
+
+trap onerror ERR
+
+test "$(cat seal2.out)" == "secret1"
+grep -q 'unsealed: false' unseal.yaml
+
+# Test resealing the objects of a manifest to a new PCR policy
+tpm2 pcrextend 23:sha256=\
+e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca495991b7852b855
+tpm2 createpolicy -Q --policy-pcr -l sha256:23 -L new.policy
+
+cat > manifest.txt <<EOF
+seal1.pub seal1.priv - new.policy new1.pub new1.priv
+seal2.pub seal2.priv - new.policy new2.pub new2.priv
+EOF
+
+tpm2 unseal -C $file_primary_key_ctx --manifest manifest.txt --reseal \
+-p pcr:$pcr_specification > unseal.yaml
+test "$(grep -c 'resealed: true' unseal.yaml)" == 2
+
+for i in 1 2; do
+  tpm2 load -Q -C $file_primary_key_ctx -u new$i.pub -r new$i.priv \
+  -c new$i.ctx
+  test "$(tpm2 unseal -c new$i.ctx -p pcr:sha256:23)" == "secret$i"
+  tpm2 flushcontext new$i.ctx
+done
+
+tpm2 pcrreset 23
+
+rm -f seal?.pub seal?.priv seal?.out seal1.ctx manifest.txt unseal.yaml \
+new?.pub new?.priv new?.ctx new.policy
+
 # Test unsealing with encrypted sessions
 trap onerror ERR
 
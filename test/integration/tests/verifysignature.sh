@@ -68,4 +68,51 @@ tpm2 loadexternal -Q -C n -u $file_signing_key_pub -c $file_signing_key_ctx
 tpm2 verifysignature -Q -c $file_signing_key_ctx -g $alg_hash \
 -m $file_input_data -s $file_output_data -t $file_verify_tk_data
 
+# Verify on the host with the public key, without a TPM
+tpm2 verifysignature -Q -T none -u $file_signing_key_pub -g $alg_hash \
+-m $file_input_data -s $file_output_data
+
+tpm2 verifysignature -Q -T none -u $file_signing_key_pub \
+-d $file_input_data_hash -s $file_output_data
+
+# RSAPSS signatures in plain format, verified in parallel
+tpm2 readpublic -Q -c $file_signing_key_ctx -f pem -o key.pem
+rm -f manifest.txt
+for i in 1 2 3 4 5 6; do
+    head -c 100 /dev/urandom > msg$i.dat
+    tpm2 sign -Q -c $file_signing_key_ctx -g $alg_hash -s rsapss -f plain \
+    -o msg$i.sig msg$i.dat
+    if [ $((i % 2)) -eq 0 ]; then
+        echo "key.pem msg$i.dat msg$i.sig" >> manifest.txt
+    else
+        echo "$file_signing_key_pub msg$i.dat msg$i.sig # tss public" \
+        >> manifest.txt
+    fi
+done
+
+tpm2 verifysignature -T none -f rsapss -g $alg_hash --manifest=manifest.txt \
+--jobs=3 > verified.yaml
+test $(grep -c "verified: true" verified.yaml) -eq 6
+
+trap - ERR
+
+# a tampered message fails, the others are still verified
+echo "tampered" >> msg3.dat
+tpm2 verifysignature -T none -f rsapss -g $alg_hash --manifest=manifest.txt \
+> verified.yaml
+if [ $? -eq 0 ] || [ $(grep -c "verified: true" verified.yaml) -ne 5 ]; then
+    echo "Expected only the tampered message to fail" 1>&2
+    exit 1
+fi
+
+tpm2 verifysignature -Q -u $file_signing_key_pub -g $alg_hash \
+-m $file_input_data -s $file_output_data -t $file_verify_tk_data
+if [ $? -eq 0 ]; then
+    echo "Expected a ticket to require the TPM" 1>&2
+    exit 1
+fi
+trap onerror ERR
+
+rm -f key.pem manifest.txt verified.yaml msg*.dat msg*.sig
+
 exit 0
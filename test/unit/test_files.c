@@ -1,10 +1,15 @@
 /* SPDX-License-Identifier: BSD-3-Clause */
 
 #include <errno.h>
+#include <fcntl.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
+
+#include <sys/file.h>
+#include <sys/stat.h>
 
 #include <setjmp.h>
 #include <cmocka.h>
@@ -126,6 +131,79 @@ static void test_file_read_write_0_bytes(void **state) {
     assert_true(res);
 }
 
+static void test_file_read_write_records(void **state) {
+
+    FILE *f = test_file_from_state(state)->file;
+
+    UINT8 first[] = { 0x01, 0x02, 0x03 };
+    UINT8 second[300];
+    memset(second, 0xCC, sizeof(second));
+
+    assert_true(files_write_record(f, first, sizeof(first)));
+    assert_true(files_write_record(f, second, 0));
+    assert_true(files_write_record(f, second, sizeof(second)));
+
+    rewind(f);
+
+    /* the size leads each record in big endian */
+    UINT8 header[2];
+    assert_true(files_read_bytes(f, header, sizeof(header)));
+    assert_int_equal(header[0], 0);
+    assert_int_equal(header[1], sizeof(first));
+
+    rewind(f);
+
+    UINT8 found[512];
+    bool is_end = true;
+    UINT16 size = sizeof(found);
+    assert_true(files_read_record(f, found, &size, &is_end));
+    assert_false(is_end);
+    assert_int_equal(size, sizeof(first));
+    assert_memory_equal(found, first, sizeof(first));
+
+    size = sizeof(found);
+    assert_true(files_read_record(f, found, &size, &is_end));
+    assert_false(is_end);
+    assert_int_equal(size, 0);
+
+    size = sizeof(found);
+    assert_true(files_read_record(f, found, &size, &is_end));
+    assert_false(is_end);
+    assert_int_equal(size, sizeof(second));
+    assert_memory_equal(found, second, sizeof(second));
+
+    size = sizeof(found);
+    assert_true(files_read_record(f, found, &size, &is_end));
+    assert_true(is_end);
+}
+
+static void test_file_read_record_bad(void **state) {
+
+    FILE *f = test_file_from_state(state)->file;
+
+    UINT8 data[8] = { 0 };
+    assert_true(files_write_record(f, data, sizeof(data)));
+    /* a truncated size */
+    assert_true(files_write_bytes(f, data, 1));
+
+    rewind(f);
+
+    /* larger than the buffer */
+    bool is_end = false;
+    UINT16 size = sizeof(data) - 1;
+    assert_false(files_read_record(f, data, &size, &is_end));
+
+    rewind(f);
+
+    size = sizeof(data);
+    assert_true(files_read_record(f, data, &size, &is_end));
+    assert_false(is_end);
+
+    size = sizeof(data);
+    assert_false(files_read_record(f, data, &size, &is_end));
+    assert_false(is_end);
+}
+
 static void test_file_read_write_header(void **state) {
 
     FILE *f = test_file_from_state(state)->file;
@@ -238,6 +316,277 @@ static void test_file_exists_bad_args(void **state) {
     assert_false(res);
 }
 
+static void test_file_input_mapped(void **state) {
+
+    test_file *tf = test_file_from_state(state);
+
+    UINT8 data[4096];
+    size_t i;
+    for (i = 0; i < sizeof(data); i++) {
+        data[i] = i & 0xFF;
+    }
+
+    bool res = files_write_bytes(tf->file, data, sizeof(data));
+    assert_true(res);
+    fflush(tf->file);
+
+    /* start past the first byte to check the offset is honored */
+    int rc = fseek(tf->file, 1, SEEK_SET);
+    assert_int_equal(rc, 0);
+
+    files_input input;
+    res = files_input_open_file(&input, tf->file);
+    assert_true(res);
+    assert_non_null(input.map);
+
+    const UINT8 *chunk;
+    size_t size;
+    res = files_input_next(&input, 1000, &chunk, &size);
+    assert_true(res);
+    assert_int_equal(size, 1000);
+    assert_memory_equal(chunk, &data[1], size);
+    assert_false(files_input_at_end(&input));
+
+    res = files_input_next(&input, sizeof(data), &chunk, &size);
+    assert_true(res);
+    assert_int_equal(size, sizeof(data) - 1001);
+    assert_memory_equal(chunk, &data[1001], size);
+    assert_true(files_input_at_end(&input));
+
+    res = files_input_next(&input, sizeof(data), &chunk, &size);
+    assert_true(res);
+    assert_int_equal(size, 0);
+
+    files_input_close(&input);
+
+    /* the borrowed stream is left where the input stopped */
+    assert_int_equal(ftell(tf->file), sizeof(data));
+}
+
+static void test_file_input_empty(void **state) {
+
+    test_file *tf = test_file_from_state(state);
+
+    files_input input;
+    bool res = files_input_open_file(&input, tf->file);
+    assert_true(res);
+    assert_null(input.map);
+
+    const UINT8 *chunk;
+    size_t size = 1;
+    res = files_input_next(&input, 16, &chunk, &size);
+    assert_true(res);
+    assert_int_equal(size, 0);
+    assert_true(files_input_at_end(&input));
+
+    files_input_close(&input);
+}
+
+static void test_file_input_read_all_stream(void **state) {
+
+    (void) state;
+
+    /* a pipe can't be mapped and has no size, like securityfs files */
+    int fds[2];
+    int rc = pipe(fds);
+    assert_return_code(rc, errno);
+
+    UINT8 data[40000];
+    size_t i;
+    for (i = 0; i < sizeof(data); i++) {
+        data[i] = (i * 7) & 0xFF;
+    }
+
+    ssize_t written = write(fds[1], data, sizeof(data));
+    assert_int_equal(written, sizeof(data));
+    close(fds[1]);
+
+    FILE *f = fdopen(fds[0], "rb");
+    assert_non_null(f);
+
+    files_input input;
+    bool res = files_input_open_file(&input, f);
+    assert_true(res);
+    assert_null(input.map);
+
+    const UINT8 *all;
+    size_t size;
+    res = files_input_read_all(&input, &all, &size);
+    assert_true(res);
+    assert_int_equal(size, sizeof(data));
+    assert_memory_equal(all, data, size);
+
+    files_input_close(&input);
+    fclose(f);
+}
+
+static void test_file_input_read_stream(void **state) {
+
+    (void) state;
+
+    int fds[2];
+    int rc = pipe(fds);
+    assert_return_code(rc, errno);
+
+    UINT8 data[3000];
+    size_t i;
+    for (i = 0; i < sizeof(data); i++) {
+        data[i] = (i * 3) & 0xFF;
+    }
+
+    ssize_t written = write(fds[1], data, sizeof(data));
+    assert_int_equal(written, sizeof(data));
+    close(fds[1]);
+
+    FILE *f = fdopen(fds[0], "rb");
+    assert_non_null(f);
+
+    files_input input;
+    bool res = files_input_open_file(&input, f);
+    assert_true(res);
+    assert_null(input.map);
+
+    /* the chunks go straight into the buffer of the caller */
+    TPM2B_MAX_BUFFER chunk;
+    size_t size;
+    res = files_input_read(&input, chunk.buffer, 1024, &size);
+    assert_true(res);
+    assert_int_equal(size, 1024);
+    assert_memory_equal(chunk.buffer, data, size);
+    assert_null(input.buffer);
+
+    res = files_input_read(&input, chunk.buffer, 2048, &size);
+    assert_true(res);
+    assert_int_equal(size, sizeof(data) - 1024);
+    assert_memory_equal(chunk.buffer, &data[1024], size);
+
+    res = files_input_read(&input, chunk.buffer, 1024, &size);
+    assert_true(res);
+    assert_int_equal(size, 0);
+
+    files_input_close(&input);
+    fclose(f);
+}
+
+static void test_file_input_bad_path(void **state) {
+
+    (void) state;
+
+    files_input input;
+    bool res = files_input_open(&input, "this_should_be_a_bad_path");
+    assert_false(res);
+}
+
+static void file_check_content(const char *path, const char *expected) {
+
+    char buf[32] = { 0 };
+    FILE *f = fopen(path, "rb");
+    assert_non_null(f);
+    size_t size = fread(buf, 1, sizeof(buf) - 1, f);
+    fclose(f);
+
+    assert_int_equal(size, strlen(expected));
+    assert_string_equal(buf, expected);
+}
+
+static void test_file_atomic(void **state) {
+
+    test_file *tf = test_file_from_state(state);
+
+    fputs("old", tf->file);
+    fflush(tf->file);
+
+    /* dropped, the file stays as it was */
+    files_atomic atomic;
+    FILE *f = files_atomic_open(&atomic, tf->path);
+    assert_non_null(f);
+    fputs("partial", f);
+    assert_false(files_atomic_close(&atomic, f, false));
+    file_check_content(tf->path, "old");
+    assert_int_equal(access(atomic.tmp_path, F_OK), -1);
+
+    f = files_atomic_open(&atomic, tf->path);
+    assert_non_null(f);
+    fputs("new", f);
+    assert_true(files_atomic_close(&atomic, f, true));
+    file_check_content(tf->path, "new");
+    assert_int_equal(access(atomic.tmp_path, F_OK), -1);
+
+    /* a reader of the old file still sees the old file */
+    rewind(tf->file);
+    char buf[4] = { 0 };
+    assert_int_equal(fread(buf, 1, 3, tf->file), 3);
+    assert_string_equal(buf, "old");
+}
+
+static void test_file_atomic_in_place(void **state) {
+
+    (void) state;
+
+    /* a device cannot be renamed over, it is written as it is */
+    files_atomic atomic;
+    FILE *f = files_atomic_open(&atomic, "/dev/null");
+    assert_non_null(f);
+    assert_true(atomic.is_in_place);
+    fputs("new", f);
+    assert_true(files_atomic_close(&atomic, f, true));
+
+    char tmp_path[PATH_MAX];
+    snprintf(tmp_path, sizeof(tmp_path), "/dev/null.%ld", (long) getpid());
+    assert_int_equal(access(tmp_path, F_OK), -1);
+}
+
+static void test_file_lock(void **state) {
+
+    test_file *tf = test_file_from_state(state);
+
+    int fd = files_lock(tf->path);
+    assert_true(fd >= 0);
+
+    /* reentrant within the tool */
+    assert_int_equal(files_lock(tf->path), fd);
+
+    /* held against everybody else */
+    int other = open(tf->path, O_RDONLY);
+    assert_true(other >= 0);
+    assert_int_equal(flock(other, LOCK_EX | LOCK_NB), -1);
+
+    files_unlock(fd);
+    assert_int_equal(flock(other, LOCK_EX | LOCK_NB), -1);
+
+    files_unlock(fd);
+    assert_int_equal(flock(other, LOCK_EX | LOCK_NB), 0);
+    close(other);
+}
+
+static void test_file_lock_replaced(void **state) {
+
+    test_file *tf = test_file_from_state(state);
+
+    int fd = files_lock(tf->path);
+    assert_true(fd >= 0);
+
+    files_atomic atomic;
+    FILE *f = files_atomic_open(&atomic, tf->path);
+    assert_non_null(f);
+    assert_true(files_atomic_close(&atomic, f, true));
+
+    /* the lock of the replaced file is not the lock of the new one */
+    int new_fd = files_lock(tf->path);
+    assert_true(new_fd >= 0);
+    assert_int_not_equal(new_fd, fd);
+
+    files_unlock(new_fd);
+    files_unlock(fd);
+}
+
+static void test_file_lock_bad_path(void **state) {
+
+    (void) state;
+
+    assert_int_equal(files_lock("this_should_be_a_bad_path"), -1);
+}
+
 /* link required symbol, but tpm2_tool.c declares it AND main, which
  * we have a main below for cmocka tests.
  */
@@ -260,6 +609,10 @@ int main(int argc, char* argv[]) {
                 test_setup, test_teardown),
         cmocka_unit_test_setup_teardown(test_file_read_write_header,
                         test_setup, test_teardown),
+        cmocka_unit_test_setup_teardown(test_file_read_write_records,
+                test_setup, test_teardown),
+        cmocka_unit_test_setup_teardown(test_file_read_record_bad,
+                test_setup, test_teardown),
 
         cmocka_unit_test_setup_teardown(test_file_read_write_bad_params_16,
                 test_setup, test_teardown),
@@ -279,6 +632,27 @@ int main(int argc, char* argv[]) {
                 test_setup, test_teardown),
         cmocka_unit_test_setup_teardown(test_file_exists_bad_args,
                 test_setup, test_teardown),
+
+        cmocka_unit_test_setup_teardown(test_file_input_mapped,
+                test_setup, test_teardown),
+        cmocka_unit_test_setup_teardown(test_file_input_empty,
+                test_setup, test_teardown),
+        cmocka_unit_test_setup_teardown(test_file_input_read_all_stream,
+                test_setup, test_teardown),
+        cmocka_unit_test_setup_teardown(test_file_input_read_stream,
+                test_setup, test_teardown),
+        cmocka_unit_test_setup_teardown(test_file_input_bad_path,
+                test_setup, test_teardown),
+
+        cmocka_unit_test(test_file_atomic_in_place),
+        cmocka_unit_test_setup_teardown(test_file_atomic,
+                test_setup, test_teardown),
+        cmocka_unit_test_setup_teardown(test_file_lock,
+                test_setup, test_teardown),
+        cmocka_unit_test_setup_teardown(test_file_lock_replaced,
+                test_setup, test_teardown),
+        cmocka_unit_test_setup_teardown(test_file_lock_bad_path,
+                test_setup, test_teardown),
     };
 
     return cmocka_run_group_tests(tests, NULL, NULL);
@@ -0,0 +1,182 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <setjmp.h>
+#include <cmocka.h>
+
+#include "log.h"
+#include "tpm2_util.h"
+
+typedef struct test_log_state test_log_state;
+struct test_log_state {
+    FILE *captured;
+    int saved_stderr;
+};
+
+/* redirects stderr, which the log writes to, to a temporary file */
+static int test_setup(void **state) {
+
+    static test_log_state s;
+
+    fflush(stderr);
+    s.saved_stderr = dup(STDERR_FILENO);
+    s.captured = tmpfile();
+    if (s.saved_stderr < 0 || !s.captured
+            || dup2(fileno(s.captured), STDERR_FILENO) < 0) {
+        return -1;
+    }
+
+    *state = &s;
+
+    return 0;
+}
+
+static int test_teardown(void **state) {
+
+    test_log_state *s = *state;
+
+    log_flush();
+    fflush(stderr);
+    dup2(s->saved_stderr, STDERR_FILENO);
+    close(s->saved_stderr);
+    fclose(s->captured);
+
+    unsetenv(TPM2TOOLS_ENV_LOG_FORMAT);
+    unsetenv(TPM2TOOLS_ENV_LOG_BUFFERED);
+    log_init();
+    log_set_level(log_level_warning);
+
+    return 0;
+}
+
+static const char *captured(test_log_state *s) {
+
+    static char buffer[1024];
+
+    fflush(stderr);
+    rewind(s->captured);
+    size_t size = fread(buffer, 1, sizeof(buffer) - 1, s->captured);
+    buffer[size] = '\0';
+
+    return buffer;
+}
+
+static int evaluated;
+
+static int count_evaluation(void) {
+
+    return ++evaluated;
+}
+
+static void test_log_level_gate(void **state) {
+
+    test_log_state *s = *state;
+
+    evaluated = 0;
+    LOG_INFO("not printed %d", count_evaluation());
+    assert_int_equal(evaluated, 0);
+    assert_string_equal(captured(s), "");
+
+    LOG_WARN("printed %d", count_evaluation());
+    assert_int_equal(evaluated, 1);
+    assert_string_equal(captured(s), "WARN: printed 1\n");
+}
+
+static void test_log_json(void **state) {
+
+    test_log_state *s = *state;
+
+    setenv(TPM2TOOLS_ENV_LOG_FORMAT, "json", 1);
+    log_init();
+    log_set_level(log_level_verbose);
+
+    _log(log_level_error, "a.c", 7, "quote \" and\nnewline");
+    LOG_COMMAND(0x17b, 0x922, 540, "TPM2_CC_GetRandom");
+
+    const char *out = captured(s);
+    const char *expected_error =
+            "{\"level\":\"ERROR\",\"file\":\"a.c\",\"line\":7,"
+            "\"msg\":\"quote \\\" and\\nnewline\"}\n";
+    assert_memory_equal(out, expected_error, strlen(expected_error));
+    assert_non_null(strstr(out,
+            "\"cc\":379,\"rc\":2338,\"latency_us\":540,"
+            "\"msg\":\"TPM2_CC_GetRandom\"}\n"));
+}
+
+static void test_log_kv(void **state) {
+
+    test_log_state *s = *state;
+
+    setenv(TPM2TOOLS_ENV_LOG_FORMAT, "kv", 1);
+    log_init();
+
+    _log(log_level_warning, "b.c", 3, "value %d", 42);
+
+    assert_string_equal(captured(s),
+            "level=WARN file=b.c line=3 msg=\"value 42\"\n");
+}
+
+static void test_log_buffered(void **state) {
+
+    test_log_state *s = *state;
+
+    setenv(TPM2TOOLS_ENV_LOG_BUFFERED, "1", 1);
+    log_init();
+
+    LOG_WARN("held");
+    assert_string_equal(captured(s), "");
+
+    /* an error writes what is buffered along with it */
+    LOG_ERR("failed");
+    assert_string_equal(captured(s), "WARN: held\nERROR: failed\n");
+
+    LOG_WARN("flushed");
+    log_flush();
+    assert_string_equal(captured(s),
+            "WARN: held\nERROR: failed\nWARN: flushed\n");
+}
+
+static void test_log_long_message(void **state) {
+
+    test_log_state *s = *state;
+
+    char message[2048];
+    memset(message, 'x', sizeof(message) - 1);
+    message[sizeof(message) - 1] = '\0';
+
+    LOG_WARN("%s", message);
+
+    const char *out = captured(s);
+    assert_memory_equal(out, "WARN: xxxx", 10);
+}
+
+/* link required symbol, but tpm2_tool.c declares it AND main, which
+ * we have a main below for cmocka tests.
+ */
+bool output_enabled = true;
+
+int main(int argc, char *argv[]) {
+    UNUSED(argc);
+    UNUSED(argv);
+
+    const struct CMUnitTest tests[] = {
+        cmocka_unit_test_setup_teardown(test_log_level_gate, test_setup,
+                test_teardown),
+        cmocka_unit_test_setup_teardown(test_log_json, test_setup,
+                test_teardown),
+        cmocka_unit_test_setup_teardown(test_log_kv, test_setup,
+                test_teardown),
+        cmocka_unit_test_setup_teardown(test_log_buffered, test_setup,
+                test_teardown),
+        cmocka_unit_test_setup_teardown(test_log_long_message, test_setup,
+                test_teardown),
+    };
+
+    return cmocka_run_group_tests(tests, NULL, NULL);
+}
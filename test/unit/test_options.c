@@ -229,6 +229,178 @@ static void test_invalid_tcti_no_errata(void **state) {
     assert_int_equal(oc, tpm2_option_code_err);
 }
 
+static const struct option parser_long_opts[] = {
+    { "key-context", required_argument, NULL, 'c' },
+    { "key-algorithm", required_argument, NULL, 'G' },
+    { "verbose", no_argument, NULL, 'V' },
+    { "help", optional_argument, NULL, 'h' },
+    { "cphash", required_argument, NULL, 0 },
+};
+
+static const tpm2_option_table parser_tables[] = {
+    { .short_opts = "Vh::", .long_opts = &parser_long_opts[2], .len = 2 },
+    { .short_opts = "c:G:", .long_opts = parser_long_opts, .len = 2 },
+    { .short_opts = "", .long_opts = &parser_long_opts[4], .len = 1 },
+};
+
+static void test_option_parser(void **state) {
+    UNUSED(state);
+
+    char *argv[] = {
+        "program",
+        "-Vckey.ctx",     // a group with an attached argument
+        "first",
+        "--key-alg=rsa",  // an abbreviation
+        "-",
+        "--cphash",       // a separate argument of a long option
+        "cp.bin",
+        "-hno-man",
+        "--",
+        "-V",
+    };
+
+    tpm2_option_parser parser;
+    bool result = tpm2_option_parser_init(&parser, ARRAY_LEN(argv), argv,
+            parser_tables, ARRAY_LEN(parser_tables));
+    assert_true(result);
+
+    assert_int_equal(tpm2_option_parser_next(&parser), 'V');
+    assert_int_equal(tpm2_option_parser_next(&parser), 'c');
+    assert_string_equal(parser.optarg, "key.ctx");
+    assert_int_equal(tpm2_option_parser_next(&parser), 'G');
+    assert_string_equal(parser.optarg, "rsa");
+    assert_int_equal(tpm2_option_parser_next(&parser), 0);
+    assert_string_equal(parser.optarg, "cp.bin");
+    assert_int_equal(tpm2_option_parser_next(&parser), 'h');
+    assert_string_equal(parser.optarg, "no-man");
+    assert_int_equal(tpm2_option_parser_next(&parser), -1);
+
+    /* the arguments keep their order, "--" ends the options */
+    assert_int_equal(parser.args_len, 3);
+    assert_string_equal(parser.args[0], "first");
+    assert_string_equal(parser.args[1], "-");
+    assert_string_equal(parser.args[2], "-V");
+
+    tpm2_option_parser_free(&parser);
+}
+
+static void test_option_parser_errors(void **state) {
+    UNUSED(state);
+
+    char *argv[] = {
+        "program",
+        "--key",          // ambiguous
+        "-x",             // unknown
+        "--verbose=yes",  // takes no argument
+        "-c",             // misses its argument
+    };
+
+    tpm2_option_parser parser;
+    bool result = tpm2_option_parser_init(&parser, ARRAY_LEN(argv), argv,
+            parser_tables, ARRAY_LEN(parser_tables));
+    assert_true(result);
+
+    assert_int_equal(tpm2_option_parser_next(&parser), '?');
+    assert_int_equal(tpm2_option_parser_next(&parser), '?');
+    assert_int_equal(tpm2_option_parser_next(&parser), '?');
+    assert_int_equal(tpm2_option_parser_next(&parser), '?');
+    assert_int_equal(tpm2_option_parser_next(&parser), -1);
+    assert_int_equal(parser.args_len, 0);
+
+    tpm2_option_parser_free(&parser);
+}
+
+static void test_option_parser_reentrant(void **state) {
+    UNUSED(state);
+
+    char *argv1[] = { "one", "-c", "a.ctx", "arg1" };
+    char *argv2[] = { "two", "--key-context", "b.ctx", "arg2" };
+
+    tpm2_option_parser parser1;
+    tpm2_option_parser parser2;
+    assert_true(tpm2_option_parser_init(&parser1, ARRAY_LEN(argv1), argv1,
+            parser_tables, ARRAY_LEN(parser_tables)));
+    assert_true(tpm2_option_parser_init(&parser2, ARRAY_LEN(argv2), argv2,
+            parser_tables, ARRAY_LEN(parser_tables)));
+
+    /* interleaved parses do not disturb each other */
+    assert_int_equal(tpm2_option_parser_next(&parser1), 'c');
+    assert_int_equal(tpm2_option_parser_next(&parser2), 'c');
+    assert_string_equal(parser1.optarg, "a.ctx");
+    assert_string_equal(parser2.optarg, "b.ctx");
+    assert_int_equal(tpm2_option_parser_next(&parser2), -1);
+    assert_int_equal(tpm2_option_parser_next(&parser1), -1);
+
+    assert_int_equal(parser1.args_len, 1);
+    assert_string_equal(parser1.args[0], "arg1");
+    assert_int_equal(parser2.args_len, 1);
+    assert_string_equal(parser2.args[0], "arg2");
+
+    tpm2_option_parser_free(&parser1);
+    tpm2_option_parser_free(&parser2);
+}
+
+typedef struct test_tool_ctx test_tool_ctx;
+struct test_tool_ctx {
+    const char *ctx_path;
+    const char *arg;
+};
+
+static bool test_on_opt_ctx(void *tool_ctx, char key, char *value) {
+
+    test_tool_ctx *ctx = tool_ctx;
+    assert_int_equal(key, 'c');
+    ctx->ctx_path = value;
+
+    return true;
+}
+
+static bool test_on_arg_ctx(void *tool_ctx, int argc, char **argv) {
+
+    test_tool_ctx *ctx = tool_ctx;
+    assert_int_equal(argc, 1);
+    ctx->arg = argv[0];
+
+    return true;
+}
+
+static void test_options_ctx(void **state) {
+    UNUSED(state);
+
+    const struct option topts[] = {
+        { "key-context", required_argument, NULL, 'c' },
+    };
+
+    char *argv1[] = { "program", "-c", "a.ctx", "arg1" };
+    char *argv2[] = { "program", "--key-context", "b.ctx", "arg2" };
+
+    test_tool_ctx ctx1 = { 0 };
+    test_tool_ctx ctx2 = { 0 };
+    tpm2_options *opts1 = tpm2_options_new_ctx("c:", ARRAY_LEN(topts), topts,
+            test_on_opt_ctx, test_on_arg_ctx, TPM2_OPTIONS_NO_SAPI, &ctx1);
+    tpm2_options *opts2 = tpm2_options_new_ctx("c:", ARRAY_LEN(topts), topts,
+            test_on_opt_ctx, test_on_arg_ctx, TPM2_OPTIONS_NO_SAPI, &ctx2);
+    assert_non_null(opts1);
+    assert_non_null(opts2);
+
+    /* every invocation parses into its own context */
+    tpm2_option_flags flags = { .all = 0 };
+    TSS2_TCTI_CONTEXT *tcti = NULL;
+    tpm2_option_code oc = tpm2_handle_options(ARRAY_LEN(argv1), argv1, opts1,
+            &flags, &tcti);
+    assert_int_equal(oc, tpm2_option_code_continue);
+    oc = tpm2_handle_options(ARRAY_LEN(argv2), argv2, opts2, &flags, &tcti);
+    assert_int_equal(oc, tpm2_option_code_continue);
+
+    assert_string_equal(ctx1.ctx_path, "a.ctx");
+    assert_string_equal(ctx1.arg, "arg1");
+    assert_string_equal(ctx2.ctx_path, "b.ctx");
+    assert_string_equal(ctx2.arg, "arg2");
+
+    tpm2_options_free(opts1);
+    tpm2_options_free(opts2);
+}
+
 /*
  * link required symbol, but tpm2_tool.c declares it AND main, which
  * we have a main below for cmocka tests.
@@ -246,6 +418,10 @@ int main(int argc, char *argv[]) {
             cmocka_unit_test(test_tcti_long_option_no_equals_no_errata),
             cmocka_unit_test(test_tcti_long_option_with_equals_no_errata),
             cmocka_unit_test(test_invalid_tcti_no_errata),
+            cmocka_unit_test(test_option_parser),
+            cmocka_unit_test(test_option_parser_errors),
+            cmocka_unit_test(test_option_parser_reentrant),
+            cmocka_unit_test(test_options_ctx),
     };
 
     return cmocka_run_group_tests(tests, NULL, NULL);
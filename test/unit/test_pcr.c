@@ -3,6 +3,9 @@
 #include <stdarg.h>
 #include <stdbool.h>
 #include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
 
 #include <setjmp.h>
 #include <cmocka.h>
@@ -68,6 +71,276 @@ static void test_pcr_alg_nice_names(void **state) {
             sizeof(raw_pcr_selections_sha3_256));
 }
 
+static void test_pcr_pcrs_append(void **state) {
+
+    (void) state;
+
+    tpm2_pcrs pcrs = { 0 };
+
+    /* more lists than the first allocation holds */
+    size_t i;
+    for (i = 0; i < 3 * TPM2_MAX_PCRS; i++) {
+        TPML_DIGEST *digests = pcr_pcrs_append(&pcrs);
+        assert_non_null(digests);
+        assert_int_equal(digests->count, 0);
+        digests->count = 1;
+        digests->digests[0].size = i;
+    }
+
+    assert_int_equal(pcrs.count, 3 * TPM2_MAX_PCRS);
+    for (i = 0; i < pcrs.count; i++) {
+        assert_int_equal(pcrs.pcr_values[i].digests[0].size, i);
+    }
+
+    pcr_pcrs_free(&pcrs);
+    assert_null(pcrs.pcr_values);
+    assert_int_equal(pcrs.count, 0);
+}
+
+static void test_pcr_merge_select(void **state) {
+
+    (void) state;
+
+    TPML_PCR_SELECTION a = TPML_PCR_SELECTION_EMPTY_INIT;
+    TPML_PCR_SELECTION b = TPML_PCR_SELECTION_EMPTY_INIT;
+    assert_true(pcr_parse_selections("sha256:0,1+sha1:2", &a));
+    assert_true(pcr_parse_selections("sha256:1,16", &b));
+
+    TPML_PCR_SELECTION merged = TPML_PCR_SELECTION_EMPTY_INIT;
+    assert_true(pcr_merge_selections(&merged, &a));
+    assert_true(pcr_merge_selections(&merged, &b));
+
+    TPML_PCR_SELECTION expected = TPML_PCR_SELECTION_EMPTY_INIT;
+    assert_true(pcr_parse_selections("sha256:0,1,16+sha1:2", &expected));
+    assert_int_equal(merged.count, expected.count);
+    assert_memory_equal(merged.pcrSelections, expected.pcrSelections,
+            expected.count * sizeof(expected.pcrSelections[0]));
+
+    /* the values of the merged selection, each sized after its position */
+    tpm2_pcrs pcrs = { 0 };
+    TPML_DIGEST *digests = pcr_pcrs_append(&pcrs);
+    assert_non_null(digests);
+    digests->count = 2;
+    digests->digests[0].size = 10;
+    digests->digests[1].size = 11;
+    digests = pcr_pcrs_append(&pcrs);
+    assert_non_null(digests);
+    digests->count = 2;
+    digests->digests[0].size = 12;
+    digests->digests[1].size = 13;
+
+    tpm2_pcrs subset = { 0 };
+    assert_true(pcr_select_pcr_values(&merged, &pcrs, &b, &subset));
+    assert_int_equal(subset.count, 1);
+    assert_int_equal(subset.pcr_values[0].count, 2);
+    assert_int_equal(subset.pcr_values[0].digests[0].size, 11);
+    assert_int_equal(subset.pcr_values[0].digests[1].size, 12);
+
+    assert_true(pcr_select_pcr_values(&merged, &pcrs, &a, &subset));
+    assert_int_equal(subset.count, 1);
+    assert_int_equal(subset.pcr_values[0].count, 3);
+    assert_int_equal(subset.pcr_values[0].digests[0].size, 10);
+    assert_int_equal(subset.pcr_values[0].digests[1].size, 11);
+    assert_int_equal(subset.pcr_values[0].digests[2].size, 13);
+
+    /* PCRs that were not read */
+    TPML_PCR_SELECTION other = TPML_PCR_SELECTION_EMPTY_INIT;
+    assert_true(pcr_parse_selections("sha256:2", &other));
+    assert_false(pcr_select_pcr_values(&merged, &pcrs, &other, &subset));
+
+    pcr_pcrs_free(&subset);
+    pcr_pcrs_free(&pcrs);
+}
+
+static void test_pcr_bitset(void **state) {
+
+    (void) state;
+
+    TPML_PCR_SELECTION sel = TPML_PCR_SELECTION_EMPTY_INIT;
+    assert_true(pcr_parse_selections("sha256:0,7,8,23", &sel));
+    assert_int_equal(sel.count, 1);
+    assert_int_equal(sel.pcrSelections[0].sizeofSelect, 3);
+
+    pcr_bitset bits = pcr_bitset_from_select(&sel.pcrSelections[0]);
+    assert_int_equal(bits, 0x800181);
+    assert_int_equal(pcr_bitset_count(bits), 4);
+
+    /* the PCRs come in ascending order */
+    unsigned expected[] = { 0, 7, 8, 23 };
+    unsigned pcr = 0;
+    size_t i = 0;
+    while (pcr_bitset_next(&bits, &pcr)) {
+        assert_true(i < ARRAY_LEN(expected));
+        assert_int_equal(pcr, expected[i++]);
+    }
+    assert_int_equal(i, ARRAY_LEN(expected));
+    assert_int_equal(bits, 0);
+
+    /* only the bytes of the selection are written */
+    TPMS_PCR_SELECTION out = { .sizeofSelect = 2, .pcrSelect = { 0xff, 0xff,
+            0xff } };
+    pcr_bitset_to_select(0x800181, &out);
+    assert_int_equal(out.pcrSelect[0], 0x81);
+    assert_int_equal(out.pcrSelect[1], 0x01);
+    assert_int_equal(out.pcrSelect[2], 0xff);
+}
+
+static void test_pcr_print_changed_values(void **state) {
+
+    (void) state;
+
+    /* PCRs 0, 2 and 17 of sha1 and 17 of sha256, in lists of 2 digests */
+    TPML_PCR_SELECTION pcr_select = {
+        .count = 2,
+        .pcrSelections = {
+            { .hash = TPM2_ALG_SHA1, .sizeofSelect = 3,
+              .pcrSelect = { 0x05, 0x00, 0x02 } },
+            { .hash = TPM2_ALG_SHA256, .sizeofSelect = 3,
+              .pcrSelect = { 0x00, 0x00, 0x02 } },
+        },
+    };
+
+    tpm2_pcrs old_pcrs = { 0 };
+    tpm2_pcrs pcrs = { 0 };
+    size_t i;
+    for (i = 0; i < 2; i++) {
+        TPML_DIGEST *old = pcr_pcrs_append(&old_pcrs);
+        TPML_DIGEST *cur = pcr_pcrs_append(&pcrs);
+        assert_non_null(old);
+        assert_non_null(cur);
+        old->count = cur->count = 2;
+        UINT32 j;
+        for (j = 0; j < 2; j++) {
+            old->digests[j].size = cur->digests[j].size = 4;
+        }
+    }
+
+    size_t changed = 1;
+    assert_true(pcr_print_changed_values(&pcr_select, &old_pcrs, &pcrs,
+            &changed));
+    assert_int_equal(changed, 0);
+
+    /* sha1 PCR 2 and sha256 PCR 17 */
+    pcrs.pcr_values[0].digests[1].buffer[0] = 1;
+    pcrs.pcr_values[1].digests[1].buffer[3] = 1;
+    assert_true(pcr_print_changed_values(&pcr_select, &old_pcrs, &pcrs,
+            &changed));
+    assert_int_equal(changed, 2);
+
+    /* values that do not match the selection */
+    pcrs.count = 1;
+    assert_false(pcr_print_changed_values(&pcr_select, &old_pcrs, &pcrs,
+            &changed));
+
+    pcr_pcrs_free(&old_pcrs);
+    pcr_pcrs_free(&pcrs);
+}
+
+static void test_pcr_bundle(void **state) {
+    UNUSED(state);
+
+    TPML_PCR_SELECTION pcr_select;
+    assert_true(pcr_parse_selections("sha1:0,1+sha256:0,1,2,3,4,5,6,7,8",
+            &pcr_select));
+
+    /* the sha256 values span two digest lists */
+    tpm2_pcrs pcrs = { 0 };
+    TPML_DIGEST *values = pcr_pcrs_append(&pcrs);
+    assert_non_null(values);
+    UINT32 i;
+    for (i = 0; i < 8; i++) {
+        values->digests[i].size = i < 2 ? 20 : 32;
+        memset(values->digests[i].buffer, i, values->digests[i].size);
+    }
+    values->count = 8;
+    values = pcr_pcrs_append(&pcrs);
+    assert_non_null(values);
+    for (i = 0; i < 3; i++) {
+        values->digests[i].size = 32;
+        memset(values->digests[i].buffer, 8 + i, 32);
+    }
+    values->count = 3;
+
+    FILE *f = tmpfile();
+    assert_non_null(f);
+    assert_true(pcr_bundle_write(&pcr_select, &pcrs, f));
+
+    /* only the selected digests, each with its size */
+    long size = ftell(f);
+    assert_int_equal(size, 4 + 2 + 1 + 2 * (2 + 1 + 3) + 2 * (2 + 20)
+            + 9 * (2 + 32));
+
+    rewind(f);
+    assert_true(pcr_bundle_is_bundle(f));
+    assert_int_equal(ftell(f), 0);
+
+    /* a digest at a time, with the PCR it belongs to */
+    pcr_bundle_reader reader;
+    assert_true(pcr_bundle_reader_init(&reader, f));
+    TPMI_ALG_HASH hash;
+    unsigned pcr_id;
+    TPM2B_DIGEST digest;
+    bool is_end;
+    assert_true(pcr_bundle_reader_next(&reader, &hash, &pcr_id, &digest,
+            &is_end));
+    assert_false(is_end);
+    assert_int_equal(hash, TPM2_ALG_SHA1);
+    assert_int_equal(pcr_id, 0);
+    for (i = 1; i < 11; i++) {
+        assert_true(pcr_bundle_reader_next(&reader, &hash, &pcr_id, &digest,
+                &is_end));
+        assert_false(is_end);
+        assert_int_equal(digest.buffer[0], i);
+    }
+    assert_int_equal(hash, TPM2_ALG_SHA256);
+    assert_int_equal(pcr_id, 8);
+    assert_true(pcr_bundle_reader_next(&reader, &hash, &pcr_id, &digest,
+            &is_end));
+    assert_true(is_end);
+
+    rewind(f);
+    TPML_PCR_SELECTION read_select;
+    tpm2_pcrs read_pcrs = { 0 };
+    assert_true(pcr_bundle_read(f, &read_select, &read_pcrs));
+    assert_int_equal(read_select.count, 2);
+    assert_int_equal(read_select.pcrSelections[1].hash, TPM2_ALG_SHA256);
+    assert_memory_equal(read_select.pcrSelections[1].pcrSelect,
+            pcr_select.pcrSelections[1].pcrSelect,
+            pcr_select.pcrSelections[1].sizeofSelect);
+    assert_int_equal(read_pcrs.count, 2);
+    assert_int_equal(read_pcrs.pcr_values[0].count, 8);
+    assert_int_equal(read_pcrs.pcr_values[1].count, 3);
+    assert_int_equal(read_pcrs.pcr_values[1].digests[2].size, 32);
+    assert_int_equal(read_pcrs.pcr_values[1].digests[2].buffer[31], 10);
+
+    /* a truncated bundle is malformed */
+    fclose(f);
+    f = tmpfile();
+    assert_non_null(f);
+    assert_true(pcr_bundle_write(&pcr_select, &pcrs, f));
+    assert_int_equal(fflush(f), 0);
+    assert_int_equal(ftruncate(fileno(f), size - 1), 0);
+    rewind(f);
+    assert_false(pcr_bundle_read(f, &read_select, &read_pcrs));
+
+    /* as are values that do not match the selection */
+    fclose(f);
+    f = tmpfile();
+    assert_non_null(f);
+    pcrs.count = 1;
+    assert_false(pcr_bundle_write(&pcr_select, &pcrs, f));
+
+    /* the serialized format is not a bundle */
+    rewind(f);
+    assert_true(pcr_fwrite_serialized(&pcr_select, &read_pcrs, f));
+    rewind(f);
+    assert_false(pcr_bundle_is_bundle(f));
+
+    fclose(f);
+    pcr_pcrs_free(&read_pcrs);
+    pcr_pcrs_free(&pcrs);
+}
+
 /* link required symbol, but tpm2_tool.c declares it AND main, which
  * we have a main below for cmocka tests.
  */
@@ -78,7 +351,12 @@ int main(int argc, char* argv[]) {
     (void) argv;
 
     const struct CMUnitTest tests[] = {
-        cmocka_unit_test(test_pcr_alg_nice_names)
+        cmocka_unit_test(test_pcr_alg_nice_names),
+        cmocka_unit_test(test_pcr_pcrs_append),
+        cmocka_unit_test(test_pcr_merge_select),
+        cmocka_unit_test(test_pcr_bitset),
+        cmocka_unit_test(test_pcr_print_changed_values),
+        cmocka_unit_test(test_pcr_bundle)
     };
 
     return cmocka_run_group_tests(tests, NULL, NULL);
@@ -112,6 +112,41 @@ static void test_tpm2_alg_util_sha1_test(void **state) {
     assert_true(sha1_pass);
 }
 
+static void test_tpm2_alg_util_all_ids(void **state) {
+
+    (void) state;
+
+    /* every algorithm found by ID is found by its name, in either table */
+    unsigned count = 0;
+    UINT32 id;
+    for (id = 0; id <= UINT16_MAX; id++) {
+        const char *name = tpm2_alg_util_algtostr(id, tpm2_alg_util_flags_any);
+        if (!name) {
+            assert_int_equal(tpm2_alg_util_algtoflags(id),
+                    tpm2_alg_util_flags_none);
+            continue;
+        }
+
+        assert_int_equal(tpm2_alg_util_strtoalg(name, tpm2_alg_util_flags_any),
+                id);
+        assert_int_not_equal(tpm2_alg_util_algtoflags(id),
+                tpm2_alg_util_flags_none);
+        count++;
+    }
+
+    assert_int_equal(count, 39);
+
+    /* names match as a whole and only with the given flags */
+    assert_int_equal(tpm2_alg_util_strtoalg("sha", tpm2_alg_util_flags_any),
+            TPM2_ALG_ERROR);
+    assert_int_equal(tpm2_alg_util_strtoalg("sha2566", tpm2_alg_util_flags_any),
+            TPM2_ALG_ERROR);
+    assert_int_equal(tpm2_alg_util_strtoalg("sha256", tpm2_alg_util_flags_mode),
+            TPM2_ALG_ERROR);
+    assert_null(tpm2_alg_util_algtostr(TPM2_ALG_SHA256,
+            tpm2_alg_util_flags_mode));
+}
+
 /* Test the digest specification language */
 
 #define HASH_SHA1    "f1d2d2f924e986ac86fdf7b36c94bcdf32beec15"
@@ -300,6 +335,48 @@ static void test_pcr_parse_digest_list_bad_alg(void **state) {
     assert_false(res);
 }
 
+static void test_tpm2_alg_util_digest_next(void **state) {
+    (void) state;
+
+    /* the text is neither NUL terminated nor modified */
+    static const char list[] = "# an allowlist\n"
+            "sha1="HASH_SHA1",\tsha256=0x"HASH_SHA256" # trailing\n"
+            "0x4="HASH_SHA1"\n\n sha2";
+    const char *cursor = list;
+    const char *end = list + sizeof(list) - 1 - strlen(" sha2");
+
+    TPMT_HA ha;
+    TPMT_HA *digest = &ha;
+    assert_int_equal(tpm2_alg_util_digest_next(&cursor, end, digest), 1);
+    test_digest_sha1(digest);
+    assert_int_equal(tpm2_alg_util_digest_next(&cursor, end, digest), 1);
+    test_digest_sha256(digest);
+    assert_int_equal(tpm2_alg_util_digest_next(&cursor, end, digest), 1);
+    test_digest_sha1(digest);
+    assert_int_equal(tpm2_alg_util_digest_next(&cursor, end, digest), 0);
+    assert_ptr_equal(cursor, end);
+
+    /* a prefix of an algorithm name is no algorithm */
+    static const char *bad[] = {
+        "sha2="HASH_SHA256,
+        "sha2560="HASH_SHA256,
+        "rsa="HASH_SHA1,
+        "sha1",
+        "sha1=",
+        "sha1="HASH_SHA1"0",
+        "sha1="HASH_SHA1"00",
+        "sha256="HASH_SHA1,
+        "sha1=g1d2d2f924e986ac86fdf7b36c94bcdf32beec15",
+    };
+
+    size_t i;
+    for (i = 0; i < ARRAY_LEN(bad); i++) {
+        cursor = bad[i];
+        end = bad[i] + strlen(bad[i]);
+        assert_int_equal(tpm2_alg_util_digest_next(&cursor, end, digest), -1);
+    }
+}
+
 static void test_tpm2_alg_util_get_hash_size(void **state) {
     (void) state;
 
@@ -1118,6 +1195,76 @@ static void test_extended_camellia192cbc(void **state) {
     assert_int_equal(s->algorithm, TPM2_ALG_CAMELLIA);
 }
 
+static void assert_algs(const TPML_ALG *algs, const TPM2_ALG_ID *expected,
+        UINT32 count) {
+
+    assert_int_equal(algs->count, count);
+
+    UINT32 i;
+    for (i = 0; i < count; i++) {
+        assert_int_equal(algs->algorithms[i], expected[i]);
+    }
+}
+
+static void test_public_algs_ecc(void **state) {
+    UNUSED(state);
+
+    TPM2B_PUBLIC pub = { 0 };
+    bool res = tpm2_alg_util_handle_ext_alg("ecc384:ecdaa4-sha256", &pub);
+    assert_true(res);
+
+    TPML_ALG algs = { 0 };
+    res = tpm2_alg_util_public_algs(&pub, &algs);
+    assert_true(res);
+
+    const TPM2_ALG_ID expected[] = {
+        TPM2_ALG_ECC, TPM2_ALG_ECDAA, TPM2_ALG_SHA256
+    };
+    assert_algs(&algs, expected, ARRAY_LEN(expected));
+}
+
+static void test_public_algs_rsa_symmetric(void **state) {
+    UNUSED(state);
+
+    TPM2B_PUBLIC pub = { 0 };
+    bool res = tpm2_alg_util_handle_ext_alg("rsa2048:rsassa-sha384:aes128cfb",
+            &pub);
+    assert_true(res);
+    pub.publicArea.nameAlg = TPM2_ALG_SHA256;
+
+    TPML_ALG algs = { 0 };
+    res = tpm2_alg_util_public_algs(&pub, &algs);
+    assert_true(res);
+
+    const TPM2_ALG_ID expected[] = {
+        TPM2_ALG_RSA, TPM2_ALG_SHA256, TPM2_ALG_AES, TPM2_ALG_CFB,
+        TPM2_ALG_RSASSA, TPM2_ALG_SHA384
+    };
+    assert_algs(&algs, expected, ARRAY_LEN(expected));
+
+    /* algorithms already listed are not added again */
+    res = tpm2_alg_util_public_algs(&pub, &algs);
+    assert_true(res);
+    assert_algs(&algs, expected, ARRAY_LEN(expected));
+}
+
+static void test_public_algs_keyedhash(void **state) {
+    UNUSED(state);
+
+    TPM2B_PUBLIC pub = { 0 };
+    bool res = tpm2_alg_util_handle_ext_alg("hmac:sha384", &pub);
+    assert_true(res);
+
+    TPML_ALG algs = { 0 };
+    res = tpm2_alg_util_public_algs(&pub, &algs);
+    assert_true(res);
+
+    const TPM2_ALG_ID expected[] = {
+        TPM2_ALG_KEYEDHASH, TPM2_ALG_HMAC, TPM2_ALG_SHA384
+    };
+    assert_algs(&algs, expected, ARRAY_LEN(expected));
+}
+
 static void test_extended_alg_bad(void **state) {
     UNUSED(state);
 
@@ -1184,6 +1331,7 @@ int main(int argc, char* argv[]) {
     const struct CMUnitTest tests[] = {
         single_item_test_get(rsa),
         cmocka_unit_test(test_tpm2_alg_util_sha1_test),
+        cmocka_unit_test(test_tpm2_alg_util_all_ids),
         single_item_test_get(hmac),
         single_item_test_get(aes),
         single_item_test_get(mgf1),
@@ -1227,6 +1375,7 @@ int main(int argc, char* argv[]) {
         cmocka_unit_test(test_pcr_parse_digest_list_compound),
         cmocka_unit_test(test_pcr_parse_digest_list_bad),
         cmocka_unit_test(test_pcr_parse_digest_list_bad_alg),
+        cmocka_unit_test(test_tpm2_alg_util_digest_next),
         cmocka_unit_test(test_tpm2_alg_util_get_hash_size),
         cmocka_unit_test(test_tpm2_alg_util_flags_sig),
         cmocka_unit_test(test_tpm2_alg_util_flags_enc_scheme),
@@ -1267,6 +1416,9 @@ int main(int argc, char* argv[]) {
         cmocka_unit_test(test_extended_rsa_camellia256cbc),
         cmocka_unit_test(test_extended_camellia192cbc),
         cmocka_unit_test(test_extended_alg_bad),
+        cmocka_unit_test(test_public_algs_ecc),
+        cmocka_unit_test(test_public_algs_rsa_symmetric),
+        cmocka_unit_test(test_public_algs_keyedhash),
     };
 
     return cmocka_run_group_tests(tests, NULL, NULL);
@@ -0,0 +1,227 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+#include <limits.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <setjmp.h>
+#include <cmocka.h>
+
+#include "tpm2_approved_policy.h"
+#include "tpm2_util.h"
+
+typedef struct test_store test_store;
+struct test_store {
+    char path[PATH_MAX];
+    TPMS_CLOCK_INFO clock_info;
+};
+
+static int test_setup(void **state) {
+
+    test_store *t = calloc(1, sizeof(*t));
+    assert_non_null(t);
+
+    strcpy(t->path, "/tmp/test_tpm2_approved_policy.XXXXXX");
+    int fd = mkstemp(t->path);
+    assert_true(fd >= 0);
+    close(fd);
+    /* the store is created by the first put */
+    unlink(t->path);
+
+    t->clock_info.resetCount = 3;
+    t->clock_info.restartCount = 7;
+
+    *state = t;
+
+    return 0;
+}
+
+static int test_teardown(void **state) {
+
+    test_store *t = (test_store *) *state;
+    unlink(t->path);
+    free(t);
+
+    return 0;
+}
+
+static void key_init(tpm2_approved_policy_key *key, UINT8 policy) {
+
+    memset(key, 0, sizeof(*key));
+    key->approved_policy.size = 32;
+    memset(key->approved_policy.buffer, policy, 32);
+    key->policy_ref.size = 4;
+    memcpy(key->policy_ref.buffer, "ref0", 4);
+    key->signer_name.size = 34;
+    memset(key->signer_name.name, 0xcc, 34);
+}
+
+static void ticket_init(TPMT_TK_VERIFIED *ticket, UINT8 value) {
+
+    memset(ticket, 0, sizeof(*ticket));
+    ticket->tag = TPM2_ST_VERIFIED;
+    ticket->hierarchy = TPM2_RH_OWNER;
+    ticket->digest.size = 32;
+    memset(ticket->digest.buffer, value, 32);
+}
+
+static void test_approved_policy_put_get(void **state) {
+
+    test_store *t = (test_store *) *state;
+
+    tpm2_approved_policy_key key;
+    key_init(&key, 0xaa);
+    TPMT_TK_VERIFIED ticket;
+    ticket_init(&ticket, 0x11);
+
+    assert_true(tpm2_approved_policy_put(t->path, &t->clock_info, &key,
+            &ticket));
+
+    TPMT_TK_VERIFIED got = { 0 };
+    assert_true(tpm2_approved_policy_get(t->path, &t->clock_info, &key, &got));
+    assert_int_equal(got.tag, TPM2_ST_VERIFIED);
+    assert_int_equal(got.hierarchy, TPM2_RH_OWNER);
+    assert_int_equal(got.digest.size, 32);
+    assert_memory_equal(got.digest.buffer, ticket.digest.buffer, 32);
+
+    /* another policyRef of the same approved policy */
+    key.policy_ref.buffer[3] = '1';
+    assert_false(tpm2_approved_policy_get(t->path, &t->clock_info, &key,
+            &got));
+}
+
+static void test_approved_policy_epoch(void **state) {
+
+    test_store *t = (test_store *) *state;
+
+    tpm2_approved_policy_key key;
+    key_init(&key, 0xaa);
+    TPMT_TK_VERIFIED ticket;
+    ticket_init(&ticket, 0x11);
+
+    assert_true(tpm2_approved_policy_put(t->path, &t->clock_info, &key,
+            &ticket));
+
+    /* a TPM Restart empties the store */
+    TPMS_CLOCK_INFO restarted = t->clock_info;
+    restarted.restartCount++;
+    assert_false(tpm2_approved_policy_get(t->path, &restarted, &key,
+            &ticket));
+
+    /* and the put of the new epoch drops the tickets of the old one */
+    tpm2_approved_policy_key other;
+    key_init(&other, 0xbb);
+    assert_true(tpm2_approved_policy_put(t->path, &restarted, &other,
+            &ticket));
+    assert_true(tpm2_approved_policy_get(t->path, &restarted, &other,
+            &ticket));
+    assert_false(tpm2_approved_policy_get(t->path, &t->clock_info, &other,
+            &ticket));
+    assert_false(tpm2_approved_policy_get(t->path, &restarted, &key,
+            &ticket));
+}
+
+static void test_approved_policy_replace_remove(void **state) {
+
+    test_store *t = (test_store *) *state;
+
+    tpm2_approved_policy_key key_a, key_b;
+    key_init(&key_a, 0xaa);
+    key_init(&key_b, 0xbb);
+    TPMT_TK_VERIFIED ticket;
+
+    ticket_init(&ticket, 0x11);
+    assert_true(tpm2_approved_policy_put(t->path, &t->clock_info, &key_a,
+            &ticket));
+    ticket_init(&ticket, 0x22);
+    assert_true(tpm2_approved_policy_put(t->path, &t->clock_info, &key_b,
+            &ticket));
+    ticket_init(&ticket, 0x33);
+    assert_true(tpm2_approved_policy_put(t->path, &t->clock_info, &key_a,
+            &ticket));
+
+    /* the newer ticket replaced the first one */
+    TPMT_TK_VERIFIED got = { 0 };
+    assert_true(tpm2_approved_policy_get(t->path, &t->clock_info, &key_a,
+            &got));
+    assert_int_equal(got.digest.buffer[0], 0x33);
+
+    assert_true(tpm2_approved_policy_remove(t->path, &key_a));
+    assert_false(tpm2_approved_policy_get(t->path, &t->clock_info, &key_a,
+            &got));
+
+    /* the other entry stays */
+    assert_true(tpm2_approved_policy_get(t->path, &t->clock_info, &key_b,
+            &got));
+    assert_int_equal(got.digest.buffer[0], 0x22);
+}
+
+static void test_approved_policy_null_ticket(void **state) {
+
+    test_store *t = (test_store *) *state;
+
+    tpm2_approved_policy_key key;
+    key_init(&key, 0xaa);
+    TPMT_TK_VERIFIED ticket;
+    ticket_init(&ticket, 0x11);
+
+    /* the NULL hierarchy produces no ticket PolicyAuthorize takes */
+    ticket.hierarchy = TPM2_RH_NULL;
+    ticket.digest.size = 0;
+    assert_false(tpm2_approved_policy_put(t->path, &t->clock_info, &key,
+            &ticket));
+    assert_false(tpm2_approved_policy_get(t->path, &t->clock_info, &key,
+            &ticket));
+}
+
+static void test_approved_policy_damaged(void **state) {
+
+    test_store *t = (test_store *) *state;
+
+    FILE *f = fopen(t->path, "wb");
+    assert_non_null(f);
+    fputs("not an approved-policy store", f);
+    fclose(f);
+
+    tpm2_approved_policy_key key;
+    key_init(&key, 0xaa);
+    TPMT_TK_VERIFIED ticket;
+    assert_false(tpm2_approved_policy_get(t->path, &t->clock_info, &key,
+            &ticket));
+
+    /* a damaged store is replaced by the next put */
+    ticket_init(&ticket, 0x11);
+    assert_true(tpm2_approved_policy_put(t->path, &t->clock_info, &key,
+            &ticket));
+    assert_true(tpm2_approved_policy_get(t->path, &t->clock_info, &key,
+            &ticket));
+}
+
+/* link required symbol, but tpm2_tool.c declares it AND main, which
+ * we have a main below for cmocka tests.
+ */
+bool output_enabled = true;
+
+int main(int argc, char *argv[]) {
+    UNUSED(argc);
+    UNUSED(argv);
+
+    const struct CMUnitTest tests[] = {
+        cmocka_unit_test_setup_teardown(test_approved_policy_put_get,
+                test_setup, test_teardown),
+        cmocka_unit_test_setup_teardown(test_approved_policy_epoch,
+                test_setup, test_teardown),
+        cmocka_unit_test_setup_teardown(test_approved_policy_replace_remove,
+                test_setup, test_teardown),
+        cmocka_unit_test_setup_teardown(test_approved_policy_null_ticket,
+                test_setup, test_teardown),
+        cmocka_unit_test_setup_teardown(test_approved_policy_damaged,
+                test_setup, test_teardown),
+    };
+
+    return cmocka_run_group_tests(tests, NULL, NULL);
+}
@@ -326,6 +326,23 @@ static void test_tpm2_attr_util_obj_strtoattr_token_unknown(void **state) {
     assert_false(res);
 }
 
+static void test_tpm2_attr_util_obj_strtoattr_prefix(void **state) {
+    (void) state;
+
+    TPMA_OBJECT objattrs = 0;
+
+    /* a prefix matches the first attribute, in bit order, it starts */
+    char arg[] = "fixed|user";
+    bool res = tpm2_attr_util_obj_strtoattr(arg, &objattrs);
+    assert_true(res);
+    assert_int_equal(objattrs,
+            TPMA_OBJECT_FIXEDTPM | TPMA_OBJECT_USERWITHAUTH);
+
+    char arg1[] = "signs";
+    res = tpm2_attr_util_obj_strtoattr(arg1, &objattrs);
+    assert_false(res);
+}
+
 static void test_tpm2_attr_util_obj_from_optarg_good(void **state) {
     (void) state;
 
@@ -452,6 +469,8 @@ int main(int argc, char* argv[]) {
             /* compound good */
             cmocka_unit_test(test_tpm2_attr_util_obj_strtoattr_multiple_good),
 
+            cmocka_unit_test(test_tpm2_attr_util_obj_strtoattr_prefix),
+
             /* negative tests */
             cmocka_unit_test(test_tpm2_attr_util_obj_strtoattr_token_unknown),
 
@@ -162,6 +162,38 @@ static void test_tpm2_auth_util_from_optarg_file(void **state) {
     assert_memory_equal(auth->buffer, mocked_file_data, strlen(mocked_file_data));
 
     tpm2_session_close(&session);
+    tpm2_auth_util_cache_clear();
+}
+
+static void test_tpm2_auth_util_from_optarg_file_cached(void **state) {
+    UNUSED(state);
+
+    tpm2_session *session;
+
+    /* the file is opened for the first auth only */
+    will_return(__wrap_fopen, &mocked_file_stream);
+
+    will_return(__wrap_fread, (size_t) strlen(mocked_file_data));
+    will_return(__wrap_ftell, (long) strlen(mocked_file_data));
+    will_return(__wrap_ftell, (long) strlen(mocked_file_data));
+
+    unsigned i;
+    for (i = 0; i < 2; i++) {
+        tool_rc rc = tpm2_auth_util_from_optarg(NULL,
+                "file:test_tpm2_auth_util_foobar", &session, true);
+        assert_int_equal(rc, tool_rc_success);
+
+        const TPM2B_AUTH *auth = tpm2_session_get_auth_value(session);
+
+        assert_int_equal(auth->size, strlen(mocked_file_data));
+        assert_memory_equal(auth->buffer, mocked_file_data,
+                strlen(mocked_file_data));
+
+        tpm2_session_close(&session);
+    }
+
+    tpm2_auth_util_cache_clear();
+    assert_null(auth_file_cache_get("test_tpm2_auth_util_foobar"));
 }
 
 #define PCR_SPECIFICATION "sha256:0,1,2,3+sha1:0,1,2,3"
@@ -380,6 +412,7 @@ int main(int argc, char* argv[]) {
             cmocka_unit_test_setup_teardown(test_tpm2_auth_util_get_pw_shandle,
                                             setup, teardown),
             cmocka_unit_test(test_tpm2_auth_util_from_optarg_file),
+            cmocka_unit_test(test_tpm2_auth_util_from_optarg_file_cached),
 
             cmocka_unit_test(test_parse_pcr_no_raw_file),
             cmocka_unit_test(test_parse_pcr_with_raw_file),
@@ -0,0 +1,170 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <setjmp.h>
+#include <cmocka.h>
+
+#include "tpm2_capture.h"
+#include "tpm2_util.h"
+
+#define COMMAND_SIZE 12
+#define RESPONSE_SIZE 10
+
+typedef struct test_tcti test_tcti;
+struct test_tcti {
+    TSS2_TCTI_CONTEXT_COMMON_V2 common;
+    unsigned transmitted;
+};
+
+static TSS2_RC test_tcti_transmit(TSS2_TCTI_CONTEXT *tcti_context,
+        size_t size, const uint8_t *command) {
+
+    test_tcti *tcti = (test_tcti *) tcti_context;
+
+    assert_int_equal(size, COMMAND_SIZE);
+    UNUSED(command);
+    tcti->transmitted++;
+
+    return TSS2_RC_SUCCESS;
+}
+
+/* answers with the response code queued by the test */
+static TSS2_RC test_tcti_receive(TSS2_TCTI_CONTEXT *tcti_context,
+        size_t *size, uint8_t *response, int32_t timeout) {
+
+    UNUSED(tcti_context);
+    UNUSED(timeout);
+
+    assert_true(*size >= RESPONSE_SIZE);
+
+    TSS2_RC rc = (TSS2_RC) mock();
+    uint8_t header[RESPONSE_SIZE] = {
+        0x80, 0x01, 0x00, 0x00, 0x00, RESPONSE_SIZE,
+        rc >> 24, rc >> 16, rc >> 8, rc
+    };
+
+    memcpy(response, header, sizeof(header));
+    *size = sizeof(header);
+
+    return TSS2_RC_SUCCESS;
+}
+
+static void test_tcti_init(test_tcti *tcti) {
+
+    memset(tcti, 0, sizeof(*tcti));
+    tcti->common.v1.version = 2;
+    tcti->common.v1.transmit = test_tcti_transmit;
+    tcti->common.v1.receive = test_tcti_receive;
+}
+
+static void send_command(TSS2_TCTI_CONTEXT *tcti, uint8_t tag) {
+
+    /* TPM2_CC_GetRandom with the tag as the number of bytes */
+    const uint8_t command[COMMAND_SIZE] = {
+        0x80, 0x01, 0x00, 0x00, 0x00, COMMAND_SIZE, 0x00, 0x00, 0x01, 0x7b,
+        0x00, tag
+    };
+
+    TSS2_RC rval = Tss2_Tcti_Transmit(tcti, sizeof(command), command);
+    assert_int_equal(rval, TSS2_RC_SUCCESS);
+
+    uint8_t response[64];
+    size_t size = sizeof(response);
+    rval = Tss2_Tcti_Receive(tcti, &size, response, TSS2_TCTI_TIMEOUT_BLOCK);
+    assert_int_equal(rval, TSS2_RC_SUCCESS);
+}
+
+static void test_tpm2_capture_ring(void **state) {
+    UNUSED(state);
+
+    char path[] = "/tmp/test_tpm2_capture_XXXXXX";
+    int fd = mkstemp(path);
+    assert_true(fd >= 0);
+    close(fd);
+
+    setenv(TPM2TOOLS_ENV_CAPTURE_FILE, path, 1);
+    setenv(TPM2TOOLS_ENV_CAPTURE_ENTRIES, "2", 1);
+
+    test_tcti inner;
+    test_tcti_init(&inner);
+
+    TSS2_TCTI_CONTEXT *tcti = tpm2_capture_tcti_wrap(
+            (TSS2_TCTI_CONTEXT *) &inner);
+    assert_ptr_not_equal(tcti, &inner);
+
+    will_return(test_tcti_receive, TPM2_RC_SUCCESS);
+    will_return(test_tcti_receive, TPM2_RC_BAD_AUTH);
+    will_return(test_tcti_receive, TPM2_RC_SUCCESS);
+
+    /* the ring holds two records, the first command is overwritten */
+    send_command(tcti, 1);
+    send_command(tcti, 2);
+    send_command(tcti, 3);
+    assert_int_equal(inner.transmitted, 3);
+
+    assert_ptr_equal(tpm2_capture_tcti_unwrap(tcti), &inner);
+
+    FILE *f = fopen(path, "rb");
+    assert_non_null(f);
+
+    tpm2_capture_reader reader;
+    bool result = tpm2_capture_reader_init(&reader, f);
+    assert_true(result);
+    assert_int_equal(reader.entries, 2);
+
+    static tpm2_capture_record record;
+    assert_int_equal(tpm2_capture_reader_next(&reader, &record), 1);
+    assert_int_equal(record.seq, 1);
+    assert_int_equal(record.cc, TPM2_CC_GetRandom);
+    assert_int_equal(record.rc, TPM2_RC_BAD_AUTH);
+    assert_int_equal(record.command_size, COMMAND_SIZE);
+    assert_int_equal(record.response_size, RESPONSE_SIZE);
+    assert_int_equal(record.command[11], 2);
+
+    assert_int_equal(tpm2_capture_reader_next(&reader, &record), 1);
+    assert_int_equal(record.seq, 2);
+    assert_int_equal(record.rc, TPM2_RC_SUCCESS);
+    assert_int_equal(record.command[11], 3);
+
+    assert_int_equal(tpm2_capture_reader_next(&reader, &record), 0);
+
+    fclose(f);
+    unlink(path);
+}
+
+static void test_tpm2_capture_disabled(void **state) {
+    UNUSED(state);
+
+    unsetenv(TPM2TOOLS_ENV_CAPTURE_FILE);
+
+    test_tcti inner;
+    test_tcti_init(&inner);
+
+    TSS2_TCTI_CONTEXT *tcti = tpm2_capture_tcti_wrap(
+            (TSS2_TCTI_CONTEXT *) &inner);
+    assert_ptr_equal(tcti, &inner);
+    assert_ptr_equal(tpm2_capture_tcti_unwrap(tcti), &inner);
+}
+
+/* link required symbol, but tpm2_tool.c declares it AND main, which
+ * we have a main below for cmocka tests.
+ */
+bool output_enabled = true;
+
+int main(int argc, char *argv[]) {
+    UNUSED(argc);
+    UNUSED(argv);
+
+    const struct CMUnitTest tests[] = {
+        cmocka_unit_test(test_tpm2_capture_ring),
+        cmocka_unit_test(test_tpm2_capture_disabled),
+    };
+
+    return cmocka_run_group_tests(tests, NULL, NULL);
+}
@@ -0,0 +1,145 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <setjmp.h>
+#include <cmocka.h>
+
+#include "tpm2_clock_monitor.h"
+#include "tpm2_util.h"
+
+/* the host time of the first sample */
+#define HOST_START 1700000000000ULL
+
+static TPMS_TIME_INFO sample_init(UINT64 time, UINT64 clock) {
+
+    TPMS_TIME_INFO info = {
+        .time = time,
+        .clockInfo = {
+            .clock = clock,
+            .resetCount = 2,
+            .restartCount = 5,
+            .safe = TPM2_YES,
+        },
+    };
+
+    return info;
+}
+
+static void test_clock_monitor_steady(void **state) {
+    UNUSED(state);
+
+    tpm2_clock_monitor m;
+    tpm2_clock_monitor_init(&m, 100);
+
+    TPMS_TIME_INFO info = sample_init(5000, 90000);
+    assert_int_equal(tpm2_clock_monitor_sample(&m, &info, HOST_START), 0);
+
+    /* a second later, a little fast */
+    info = sample_init(6010, 91010);
+    assert_int_equal(tpm2_clock_monitor_sample(&m, &info, HOST_START + 1000),
+            0);
+    assert_int_equal(m.delta_time, 1010);
+    assert_int_equal(m.delta_clock, 1010);
+    assert_int_equal(m.delta_host, 1000);
+    assert_int_equal(m.drift, 10);
+
+    /* the drift adds up from the first sample */
+    info = sample_init(7060, 92060);
+    assert_int_equal(tpm2_clock_monitor_sample(&m, &info, HOST_START + 2000),
+            0);
+    assert_int_equal(m.drift, 60);
+}
+
+static void test_clock_monitor_drift(void **state) {
+    UNUSED(state);
+
+    tpm2_clock_monitor m;
+    tpm2_clock_monitor_init(&m, 100);
+
+    TPMS_TIME_INFO info = sample_init(5000, 90000);
+    tpm2_clock_monitor_sample(&m, &info, HOST_START);
+
+    /* the host stepped its time forward by 10s */
+    info = sample_init(6000, 91000);
+    assert_int_equal(tpm2_clock_monitor_sample(&m, &info, HOST_START + 11000),
+            tpm2_clock_anomaly_drift);
+    assert_int_equal(m.drift, -10000);
+
+    /* reported once, the monitor starts over from the anomaly */
+    info = sample_init(7000, 92000);
+    assert_int_equal(tpm2_clock_monitor_sample(&m, &info, HOST_START + 12000),
+            0);
+    assert_int_equal(m.drift, 0);
+}
+
+static void test_clock_monitor_restart_reset(void **state) {
+    UNUSED(state);
+
+    tpm2_clock_monitor m;
+    tpm2_clock_monitor_init(&m, 100);
+
+    TPMS_TIME_INFO info = sample_init(5000, 90000);
+    tpm2_clock_monitor_sample(&m, &info, HOST_START);
+
+    info = sample_init(6000, 91000);
+    info.clockInfo.restartCount++;
+    assert_int_equal(tpm2_clock_monitor_sample(&m, &info, HOST_START + 1000),
+            tpm2_clock_anomaly_restart);
+
+    /* a TPM Reset starts time over, 2s of the host went by while off */
+    info = sample_init(10, 91010);
+    info.clockInfo.resetCount++;
+    info.clockInfo.restartCount = 0;
+    UINT32 anomalies = tpm2_clock_monitor_sample(&m, &info, HOST_START + 3000);
+    assert_int_equal(anomalies, tpm2_clock_anomaly_reset
+            | tpm2_clock_anomaly_restart | tpm2_clock_anomaly_drift);
+    assert_int_equal(m.delta_time, -5990);
+    assert_int_equal(m.drift, -1990);
+}
+
+static void test_clock_monitor_backwards_unsafe(void **state) {
+    UNUSED(state);
+
+    tpm2_clock_monitor m;
+    tpm2_clock_monitor_init(&m, 100);
+
+    TPMS_TIME_INFO info = sample_init(5000, 90000);
+    tpm2_clock_monitor_sample(&m, &info, HOST_START);
+
+    /* the last clock was not saved to NV */
+    info = sample_init(6000, 89950);
+    info.clockInfo.safe = TPM2_NO;
+    assert_int_equal(tpm2_clock_monitor_sample(&m, &info, HOST_START + 1000),
+            tpm2_clock_anomaly_backwards | tpm2_clock_anomaly_unsafe
+            | tpm2_clock_anomaly_drift);
+
+    /* staying unsafe is no new anomaly */
+    info = sample_init(7000, 90950);
+    info.clockInfo.safe = TPM2_NO;
+    assert_int_equal(tpm2_clock_monitor_sample(&m, &info, HOST_START + 2000),
+            0);
+}
+
+/* link required symbol, but tpm2_tool.c declares it AND main, which
+ * we have a main below for cmocka tests.
+ */
+bool output_enabled = true;
+
+int main(int argc, char *argv[]) {
+    UNUSED(argc);
+    UNUSED(argv);
+
+    const struct CMUnitTest tests[] = {
+        cmocka_unit_test(test_clock_monitor_steady),
+        cmocka_unit_test(test_clock_monitor_drift),
+        cmocka_unit_test(test_clock_monitor_restart_reset),
+        cmocka_unit_test(test_clock_monitor_backwards_unsafe),
+    };
+
+    return cmocka_run_group_tests(tests, NULL, NULL);
+}
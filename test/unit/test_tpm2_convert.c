@@ -0,0 +1,220 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <setjmp.h>
+#include <cmocka.h>
+
+#include "tpm2_convert.h"
+#include "tpm2_util.h"
+
+typedef struct test_sink test_sink;
+struct test_sink {
+    char data[4096];
+    size_t len;
+    unsigned calls;
+};
+
+static bool test_sink_write(const void *data, size_t len, void *userdata) {
+
+    test_sink *sink = (test_sink *) userdata;
+    assert_true(sink->len + len <= sizeof(sink->data));
+
+    memcpy(&sink->data[sink->len], data, len);
+    sink->len += len;
+    sink->calls++;
+
+    return true;
+}
+
+static void encode_chunked(tpm2_base64_flags flags, const BYTE *data,
+        size_t len, size_t chunk, test_sink *sink) {
+
+    memset(sink, 0, sizeof(*sink));
+
+    tpm2_base64_stream stream;
+    tpm2_base64_stream_init(&stream, flags, test_sink_write, sink);
+
+    size_t i;
+    for (i = 0; i < len; i += chunk) {
+        size_t n = len - i < chunk ? len - i : chunk;
+        assert_true(tpm2_base64_encode_update(&stream, &data[i], n));
+    }
+    assert_true(tpm2_base64_encode_final(&stream));
+}
+
+static bool decode_chunked(tpm2_base64_flags flags, const char *base64,
+        size_t len, size_t chunk, test_sink *sink) {
+
+    memset(sink, 0, sizeof(*sink));
+
+    tpm2_base64_stream stream;
+    tpm2_base64_stream_init(&stream, flags, test_sink_write, sink);
+
+    size_t i;
+    for (i = 0; i < len; i += chunk) {
+        size_t n = len - i < chunk ? len - i : chunk;
+        if (!tpm2_base64_decode_update(&stream, &base64[i], n)) {
+            return false;
+        }
+    }
+
+    return tpm2_base64_decode_final(&stream);
+}
+
+static void test_tpm2_base64_rfc4648(void **state) {
+    UNUSED(state);
+
+    static const struct {
+        const char *data;
+        const char *base64;
+    } vectors[] = {
+        { "", "" },
+        { "f", "Zg==" },
+        { "fo", "Zm8=" },
+        { "foo", "Zm9v" },
+        { "foob", "Zm9vYg==" },
+        { "fooba", "Zm9vYmE=" },
+        { "foobar", "Zm9vYmFy" },
+    };
+
+    size_t i;
+    for (i = 0; i < ARRAY_LEN(vectors); i++) {
+        size_t len = strlen(vectors[i].data);
+
+        test_sink sink;
+        encode_chunked(tpm2_base64_flags_none, (const BYTE *) vectors[i].data,
+                len, 1, &sink);
+        assert_int_equal(sink.len, strlen(vectors[i].base64));
+        assert_memory_equal(sink.data, vectors[i].base64, sink.len);
+
+        assert_true(decode_chunked(tpm2_base64_flags_none, vectors[i].base64,
+                strlen(vectors[i].base64), 3, &sink));
+        assert_int_equal(sink.len, len);
+        assert_memory_equal(sink.data, vectors[i].data, len);
+    }
+}
+
+static void test_tpm2_base64_url(void **state) {
+    UNUSED(state);
+
+    const BYTE data[] = { 0xfb, 0xff, 0xbf, 0xfe };
+
+    test_sink sink;
+    encode_chunked(tpm2_base64_flags_none, data, sizeof(data), 2, &sink);
+    assert_int_equal(sink.len, 8);
+    assert_memory_equal(sink.data, "+/+//g==", 8);
+
+    encode_chunked(tpm2_base64_flags_url | tpm2_base64_flags_no_pad, data,
+            sizeof(data), 2, &sink);
+    assert_int_equal(sink.len, 6);
+    assert_memory_equal(sink.data, "-_-__g", 6);
+
+    /* padding is optional when decoding */
+    assert_true(decode_chunked(tpm2_base64_flags_url, "-_-__g", 6, 4, &sink));
+    assert_int_equal(sink.len, sizeof(data));
+    assert_memory_equal(sink.data, data, sizeof(data));
+
+    /* the alphabets do not mix */
+    assert_false(decode_chunked(tpm2_base64_flags_url, "+/+//g==", 8, 8,
+            &sink));
+    assert_false(decode_chunked(tpm2_base64_flags_none, "-_-__g", 6, 6,
+            &sink));
+}
+
+static void test_tpm2_base64_lines(void **state) {
+    UNUSED(state);
+
+    /* 3 lines of 64 characters and a partial one */
+    BYTE data[3 * 48 + 10];
+    size_t i;
+    for (i = 0; i < sizeof(data); i++) {
+        data[i] = i * 13;
+    }
+
+    test_sink sink;
+    encode_chunked(tpm2_base64_flags_lines, data, sizeof(data), 100, &sink);
+    assert_int_equal(sink.len, 3 * 65 + 16 + 1);
+    assert_int_equal(sink.data[64], '\n');
+    assert_int_equal(sink.data[129], '\n');
+    assert_int_equal(sink.data[194], '\n');
+    assert_int_equal(sink.data[sink.len - 1], '\n');
+
+    /* the whole buffer codec produces the same lines */
+    char base64[1024];
+    assert_true(tpm2_base64_encode(data, sizeof(data), base64));
+    assert_int_equal(strlen(base64), sink.len);
+    assert_memory_equal(base64, sink.data, sink.len);
+
+    /* line breaks and whitespace are skipped when decoding */
+    char copy[sizeof(sink.data)];
+    size_t len = sink.len;
+    memcpy(copy, sink.data, len);
+    assert_true(decode_chunked(tpm2_base64_flags_none, copy, len, 7, &sink));
+    assert_int_equal(sink.len, sizeof(data));
+    assert_memory_equal(sink.data, data, sizeof(data));
+
+    BYTE decoded[1024];
+    size_t decoded_len = 0;
+    assert_true(tpm2_base64_decode(base64, decoded, &decoded_len));
+    assert_int_equal(decoded_len, sizeof(data));
+    assert_memory_equal(decoded, data, sizeof(data));
+}
+
+static void test_tpm2_base64_chunks(void **state) {
+    UNUSED(state);
+
+    /* large enough for the output to reach the sink in several chunks */
+    BYTE data[2000];
+    size_t i;
+    for (i = 0; i < sizeof(data); i++) {
+        data[i] = i * 31 + 7;
+    }
+
+    test_sink one;
+    encode_chunked(tpm2_base64_flags_none, data, sizeof(data), sizeof(data),
+            &one);
+    assert_true(one.calls > 1);
+
+    test_sink many;
+    encode_chunked(tpm2_base64_flags_none, data, sizeof(data), 5, &many);
+    assert_int_equal(one.len, many.len);
+    assert_memory_equal(one.data, many.data, one.len);
+}
+
+static void test_tpm2_base64_invalid(void **state) {
+    UNUSED(state);
+
+    test_sink sink;
+    assert_false(decode_chunked(tpm2_base64_flags_none, "Z", 1, 1, &sink));
+    assert_false(decode_chunked(tpm2_base64_flags_none, "Zg=", 3, 3, &sink));
+    assert_false(decode_chunked(tpm2_base64_flags_none, "Zg===", 5, 5,
+            &sink));
+    assert_false(decode_chunked(tpm2_base64_flags_none, "Zg==Zg==", 8, 8,
+            &sink));
+    assert_false(decode_chunked(tpm2_base64_flags_none, "Zm9*", 4, 4,
+            &sink));
+}
+
+/* link required symbol, but tpm2_tool.c declares it AND main, which
+ * we have a main below for cmocka tests.
+ */
+bool output_enabled = true;
+
+int main(int argc, char *argv[]) {
+    UNUSED(argc);
+    UNUSED(argv);
+
+    const struct CMUnitTest tests[] = {
+        cmocka_unit_test(test_tpm2_base64_rfc4648),
+        cmocka_unit_test(test_tpm2_base64_url),
+        cmocka_unit_test(test_tpm2_base64_lines),
+        cmocka_unit_test(test_tpm2_base64_chunks),
+        cmocka_unit_test(test_tpm2_base64_invalid),
+    };
+
+    return cmocka_run_group_tests(tests, NULL, NULL);
+}
@@ -0,0 +1,112 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <setjmp.h>
+#include <cmocka.h>
+
+#include "tpm2_cphash.h"
+#include "tpm2_util.h"
+
+static void assert_digest(const TPM2B_DIGEST *digest, const char *hex) {
+
+    char str[sizeof(digest->buffer) * 2 + 1] = { 0 };
+    UINT16 i;
+    for (i = 0; i < digest->size; i++) {
+        snprintf(&str[i * 2], 3, "%02x", digest->buffer[i]);
+    }
+
+    assert_string_equal(str, hex);
+}
+
+static void test_tpm2_cphash_clearcontrol(void **state) {
+    UNUSED(state);
+
+    /* H(TPM2_CC_ClearControl || TPM2_RH_PLATFORM || disableClear) */
+    tpm2_cphash c;
+    tpm2_cphash_init(&c, TPM2_CC_ClearControl);
+    assert_true(tpm2_cphash_add_handle(&c, TPM2_RH_PLATFORM));
+    assert_true(tpm2_cphash_add(&c, UINT8, 1));
+
+    TPM2B_DIGEST cp_hash = { .size = 0 };
+    tool_rc rc = tpm2_cphash_compute(&c, TPM2_ALG_SHA256, &cp_hash);
+    assert_int_equal(rc, tool_rc_success);
+    assert_digest(&cp_hash,
+        "bd4ce2084656d4cab50291200cefd6a457bcef2fa7d0f7cfa7da17666bf06a9a");
+}
+
+static void test_tpm2_cphash_clear_sha1(void **state) {
+    UNUSED(state);
+
+    tpm2_cphash c;
+    tpm2_cphash_init(&c, TPM2_CC_Clear);
+    assert_true(tpm2_cphash_add_handle(&c, TPM2_RH_LOCKOUT));
+
+    TPM2B_DIGEST cp_hash = { .size = 0 };
+    tool_rc rc = tpm2_cphash_compute(&c, TPM2_ALG_SHA1, &cp_hash);
+    assert_int_equal(rc, tool_rc_success);
+    assert_digest(&cp_hash, "451e59d711313c81af343d634079ece9b6620fb3");
+}
+
+static void test_tpm2_cphash_rphash(void **state) {
+    UNUSED(state);
+
+    TPM2B_DIGEST rp_hash = { .size = 0 };
+    tool_rc rc = tpm2_cphash_compute_rphash(TPM2_RC_SUCCESS,
+        TPM2_CC_ClearControl, NULL, 0, TPM2_ALG_SHA256, &rp_hash);
+    assert_int_equal(rc, tool_rc_success);
+    assert_digest(&rp_hash,
+        "ee8d3332b8994823603b21b4ce70d4c71ea16781f43429a2ae6c10357546f6e1");
+}
+
+static void test_tpm2_cphash_errors(void **state) {
+    UNUSED(state);
+
+    /* the name of an object is not its handle */
+    tpm2_cphash c;
+    tpm2_cphash_init(&c, TPM2_CC_Clear);
+    assert_false(tpm2_cphash_add_handle(&c, TPM2_TRANSIENT_FIRST));
+
+    TPM2B_DIGEST cp_hash = { .size = 0 };
+    tool_rc rc = tpm2_cphash_compute(&c, TPM2_ALG_SHA256, &cp_hash);
+    assert_int_equal(rc, tool_rc_general_error);
+
+    /* no command takes more than three handles */
+    tpm2_cphash_init(&c, TPM2_CC_Clear);
+    unsigned i;
+    for (i = 0; i < TPM2_CPHASH_NAMES_MAX; i++) {
+        assert_true(tpm2_cphash_add_handle(&c, TPM2_RH_OWNER));
+    }
+    assert_false(tpm2_cphash_add_handle(&c, TPM2_RH_OWNER));
+
+    /* the parameters do not fit a command */
+    UINT8 parameters[TPM2_MAX_SIZE + 1] = { 0 };
+    tpm2_cphash_init(&c, TPM2_CC_Clear);
+    assert_false(tpm2_cphash_add_parameters(&c, parameters,
+        sizeof(parameters)));
+    rc = tpm2_cphash_compute(&c, TPM2_ALG_SHA256, &cp_hash);
+    assert_int_equal(rc, tool_rc_general_error);
+}
+
+/* link required symbol, but tpm2_tool.c declares it AND main, which
+ * we have a main below for cmocka tests.
+ */
+bool output_enabled = true;
+
+int main(int argc, char *argv[]) {
+    UNUSED(argc);
+    UNUSED(argv);
+
+    const struct CMUnitTest tests[] = {
+        cmocka_unit_test(test_tpm2_cphash_clearcontrol),
+        cmocka_unit_test(test_tpm2_cphash_clear_sha1),
+        cmocka_unit_test(test_tpm2_cphash_rphash),
+        cmocka_unit_test(test_tpm2_cphash_errors),
+    };
+
+    return cmocka_run_group_tests(tests, NULL, NULL);
+}
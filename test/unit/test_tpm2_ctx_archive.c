@@ -0,0 +1,242 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <setjmp.h>
+#include <cmocka.h>
+
+#include "tpm2_ctx_archive.h"
+#include "tpm2_util.h"
+
+typedef struct test_archive test_archive;
+struct test_archive {
+    char path[PATH_MAX];
+};
+
+static int test_setup(void **state) {
+
+    test_archive *t = calloc(1, sizeof(*t));
+    assert_non_null(t);
+
+    strcpy(t->path, "/tmp/test_tpm2_ctx_archive.XXXXXX");
+    int fd = mkstemp(t->path);
+    assert_true(fd >= 0);
+    close(fd);
+    /* the archive is created by the first store */
+    unlink(t->path);
+
+    *state = t;
+
+    return 0;
+}
+
+static int test_teardown(void **state) {
+
+    test_archive *t = (test_archive *) *state;
+    unlink(t->path);
+    free(t);
+
+    return 0;
+}
+
+static void assert_member(const char *path, const char *name,
+        const char *expected) {
+
+    tpm2_ctx_archive archive;
+    bool result = tpm2_ctx_archive_open(&archive, path);
+    assert_true(result);
+
+    const UINT8 *data = NULL;
+    size_t size = 0;
+    result = tpm2_ctx_archive_find(&archive, name, &data, &size);
+    assert_true(result);
+    assert_int_equal(size, strlen(expected));
+    assert_memory_equal(data, expected, size);
+
+    tpm2_ctx_archive_close(&archive);
+}
+
+static void test_tpm2_ctx_archive_split(void **state) {
+
+    test_archive *t = (test_archive *) *state;
+
+    char archive_path[PATH_MAX];
+    const char *name = NULL;
+    bool result = tpm2_ctx_archive_split("keys.ctx#signing", archive_path,
+            &name);
+    assert_true(result);
+    assert_string_equal(archive_path, "keys.ctx");
+    assert_string_equal(name, "signing");
+
+    /* the name follows the last separator */
+    result = tpm2_ctx_archive_split("a#b.ctx#c", archive_path, &name);
+    assert_true(result);
+    assert_string_equal(archive_path, "a#b.ctx");
+    assert_string_equal(name, "c");
+
+    assert_false(tpm2_ctx_archive_split("keys.ctx", archive_path, &name));
+    assert_false(tpm2_ctx_archive_split("#signing", archive_path, &name));
+    assert_false(tpm2_ctx_archive_split("keys.ctx#", archive_path, &name));
+
+    /* an existing file is never split */
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s#name", t->path);
+    FILE *f = fopen(path, "wb");
+    assert_non_null(f);
+    fclose(f);
+
+    result = tpm2_ctx_archive_split(path, archive_path, &name);
+    unlink(path);
+    assert_false(result);
+}
+
+static void test_tpm2_ctx_archive_store_find(void **state) {
+
+    test_archive *t = (test_archive *) *state;
+
+    bool result = tpm2_ctx_archive_store(t->path, "primary",
+            (const UINT8 *) "first", 5);
+    assert_true(result);
+
+    result = tpm2_ctx_archive_store(t->path, "key", (const UINT8 *) "second",
+            6);
+    assert_true(result);
+
+    assert_member(t->path, "primary", "first");
+    assert_member(t->path, "key", "second");
+
+    tpm2_ctx_archive archive;
+    result = tpm2_ctx_archive_open(&archive, t->path);
+    assert_true(result);
+    assert_int_equal(archive.count, 2);
+
+    const UINT8 *data = NULL;
+    size_t size = 0;
+    assert_false(tpm2_ctx_archive_find(&archive, "missing", &data, &size));
+    assert_false(tpm2_ctx_archive_find(&archive, "ke", &data, &size));
+    assert_false(tpm2_ctx_archive_find(&archive, "keys", &data, &size));
+
+    tpm2_ctx_archive_close(&archive);
+}
+
+static void test_tpm2_ctx_archive_replace(void **state) {
+
+    test_archive *t = (test_archive *) *state;
+
+    bool result = tpm2_ctx_archive_store(t->path, "a", (const UINT8 *) "1", 1);
+    assert_true(result);
+    result = tpm2_ctx_archive_store(t->path, "b", (const UINT8 *) "22", 2);
+    assert_true(result);
+    result = tpm2_ctx_archive_store(t->path, "a", (const UINT8 *) "333", 3);
+    assert_true(result);
+
+    assert_member(t->path, "a", "333");
+    assert_member(t->path, "b", "22");
+
+    tpm2_ctx_archive archive;
+    result = tpm2_ctx_archive_open(&archive, t->path);
+    assert_true(result);
+    assert_int_equal(archive.count, 2);
+    tpm2_ctx_archive_close(&archive);
+}
+
+static void test_tpm2_ctx_archive_write(void **state) {
+
+    test_archive *t = (test_archive *) *state;
+
+    bool result = tpm2_ctx_archive_store(t->path, "old", (const UINT8 *) "0",
+            1);
+    assert_true(result);
+
+    const tpm2_ctx_archive_member members[] = {
+        { "/HS/SRK/key.pub", (const UINT8 *) "public", 6 },
+        { "/HS/SRK/key.priv", (const UINT8 *) "private", 7 },
+        { "/HS/SRK/key.policy", (const UINT8 *) "", 0 },
+    };
+    result = tpm2_ctx_archive_write(t->path, members, ARRAY_LEN(members));
+    assert_true(result);
+
+    assert_member(t->path, "/HS/SRK/key.pub", "public");
+    assert_member(t->path, "/HS/SRK/key.priv", "private");
+    assert_member(t->path, "/HS/SRK/key.policy", "");
+
+    /* the contexts held before are dropped */
+    tpm2_ctx_archive archive;
+    result = tpm2_ctx_archive_open(&archive, t->path);
+    assert_true(result);
+    assert_int_equal(archive.count, 3);
+    tpm2_ctx_archive_close(&archive);
+
+    const tpm2_ctx_archive_member twice[] = {
+        { "a", (const UINT8 *) "1", 1 },
+        { "a", (const UINT8 *) "2", 1 },
+    };
+    assert_false(tpm2_ctx_archive_write(t->path, twice, ARRAY_LEN(twice)));
+    assert_member(t->path, "/HS/SRK/key.pub", "public");
+}
+
+static void test_tpm2_ctx_archive_bad_magic(void **state) {
+
+    test_archive *t = (test_archive *) *state;
+
+    FILE *f = fopen(t->path, "wb");
+    assert_non_null(f);
+    bool result = files_write_32(f, 0xBADCC0DE) && files_write_32(f, 1)
+            && files_write_32(f, 0);
+    fclose(f);
+    assert_true(result);
+
+    tpm2_ctx_archive archive;
+    assert_false(tpm2_ctx_archive_open(&archive, t->path));
+
+    /* a store never clobbers a file that is no archive */
+    assert_false(tpm2_ctx_archive_store(t->path, "a", (const UINT8 *) "1", 1));
+}
+
+static void test_tpm2_ctx_archive_truncated(void **state) {
+
+    test_archive *t = (test_archive *) *state;
+
+    /* claims more index entries than the file holds */
+    FILE *f = fopen(t->path, "wb");
+    assert_non_null(f);
+    bool result = files_write_32(f, 0xBADCA7C0) && files_write_32(f, 1)
+            && files_write_32(f, 1000);
+    fclose(f);
+    assert_true(result);
+
+    tpm2_ctx_archive archive;
+    assert_false(tpm2_ctx_archive_open(&archive, t->path));
+}
+
+/* link required symbol, but tpm2_tool.c declares it AND main, which
+ * we have a main below for cmocka tests.
+ */
+bool output_enabled = true;
+
+int main(int argc, char *argv[]) {
+    UNUSED(argc);
+    UNUSED(argv);
+
+    const struct CMUnitTest tests[] = {
+        cmocka_unit_test_setup_teardown(test_tpm2_ctx_archive_split,
+                test_setup, test_teardown),
+        cmocka_unit_test_setup_teardown(test_tpm2_ctx_archive_store_find,
+                test_setup, test_teardown),
+        cmocka_unit_test_setup_teardown(test_tpm2_ctx_archive_replace,
+                test_setup, test_teardown),
+        cmocka_unit_test_setup_teardown(test_tpm2_ctx_archive_write,
+                test_setup, test_teardown),
+        cmocka_unit_test_setup_teardown(test_tpm2_ctx_archive_bad_magic,
+                test_setup, test_teardown),
+        cmocka_unit_test_setup_teardown(test_tpm2_ctx_archive_truncated,
+                test_setup, test_teardown),
+    };
+
+    return cmocka_run_group_tests(tests, NULL, NULL);
+}
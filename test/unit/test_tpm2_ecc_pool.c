@@ -0,0 +1,226 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+#include <limits.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <setjmp.h>
+#include <cmocka.h>
+
+#include "tpm2_ecc_pool.h"
+#include "tpm2_util.h"
+
+typedef struct test_pool test_pool;
+struct test_pool {
+    char path[PATH_MAX];
+};
+
+static int test_setup(void **state) {
+
+    test_pool *t = calloc(1, sizeof(*t));
+    assert_non_null(t);
+
+    strcpy(t->path, "/tmp/test_tpm2_ecc_pool.XXXXXX");
+    int fd = mkstemp(t->path);
+    assert_true(fd >= 0);
+    close(fd);
+    /* the pool is created by the first fill */
+    unlink(t->path);
+
+    *state = t;
+
+    return 0;
+}
+
+static int test_teardown(void **state) {
+
+    test_pool *t = (test_pool *) *state;
+    unlink(t->path);
+    free(t);
+
+    return 0;
+}
+
+static const TPM2B_NAME curve_p256 = {
+    .size = 2,
+    .name = { 0x00, 0x03 },
+};
+
+static void entry_init(tpm2_ecc_pool_entry *entry, UINT16 counter) {
+
+    memset(entry, 0, sizeof(*entry));
+    entry->counter = counter;
+
+    size_t i;
+    for (i = 0; i < TPM2_ECC_POOL_POINTS_MAX; i++) {
+        TPMS_ECC_POINT *point = &entry->points[i].point;
+        point->x.size = 32;
+        memset(point->x.buffer, counter + i, 32);
+        point->y.size = 32;
+        memset(point->y.buffer, ~(counter + i), 32);
+        entry->points[i].size = sizeof(UINT16) * 2 + 64;
+    }
+}
+
+static void assert_entry(const tpm2_ecc_pool_entry *entry, UINT16 counter,
+        size_t points) {
+
+    tpm2_ecc_pool_entry expected;
+    entry_init(&expected, counter);
+
+    assert_int_equal(entry->counter, counter);
+
+    size_t i;
+    for (i = 0; i < points; i++) {
+        const TPMS_ECC_POINT *point = &entry->points[i].point;
+        assert_int_equal(point->x.size, 32);
+        assert_memory_equal(point->x.buffer,
+                expected.points[i].point.x.buffer, 32);
+        assert_int_equal(point->y.size, 32);
+        assert_memory_equal(point->y.buffer,
+                expected.points[i].point.y.buffer, 32);
+    }
+}
+
+static void test_ecc_pool_fifo(void **state) {
+
+    test_pool *t = (test_pool *) *state;
+
+    tpm2_ecc_pool_entry entries[2];
+    entry_init(&entries[0], 4);
+    entry_init(&entries[1], 5);
+
+    size_t remaining = 0;
+    bool result = tpm2_ecc_pool_add(t->path, TPM2_CC_EC_Ephemeral,
+            &curve_p256, entries, 2, &remaining);
+    assert_true(result);
+    assert_int_equal(remaining, 2);
+
+    tpm2_ecc_pool_entry entry;
+    result = tpm2_ecc_pool_take(t->path, TPM2_CC_EC_Ephemeral, &curve_p256,
+            &entry, &remaining);
+    assert_true(result);
+    assert_entry(&entry, 4, 1);
+    assert_int_equal(remaining, 1);
+
+    result = tpm2_ecc_pool_take(t->path, TPM2_CC_EC_Ephemeral, NULL, &entry,
+            &remaining);
+    assert_true(result);
+    assert_entry(&entry, 5, 1);
+    assert_int_equal(remaining, 0);
+
+    /* every entry is taken once */
+    result = tpm2_ecc_pool_take(t->path, TPM2_CC_EC_Ephemeral, NULL, &entry,
+            &remaining);
+    assert_false(result);
+}
+
+static void test_ecc_pool_refill(void **state) {
+
+    test_pool *t = (test_pool *) *state;
+
+    tpm2_ecc_pool_entry entries[2];
+    entry_init(&entries[0], 1);
+    entry_init(&entries[1], 2);
+
+    size_t remaining = 0;
+    assert_true(tpm2_ecc_pool_add(t->path, TPM2_CC_Commit, &curve_p256,
+            entries, 2, &remaining));
+
+    tpm2_ecc_pool_entry entry;
+    assert_true(tpm2_ecc_pool_take(t->path, TPM2_CC_Commit, NULL, &entry,
+            &remaining));
+    assert_entry(&entry, 1, 3);
+
+    /* the entries left are taken before the new ones */
+    entry_init(&entries[0], 3);
+    assert_true(tpm2_ecc_pool_add(t->path, TPM2_CC_Commit, &curve_p256,
+            entries, 1, &remaining));
+    assert_int_equal(remaining, 2);
+
+    assert_true(tpm2_ecc_pool_take(t->path, TPM2_CC_Commit, NULL, &entry,
+            &remaining));
+    assert_entry(&entry, 2, 3);
+    assert_true(tpm2_ecc_pool_take(t->path, TPM2_CC_Commit, NULL, &entry,
+            &remaining));
+    assert_entry(&entry, 3, 3);
+    assert_int_equal(remaining, 0);
+
+    /* a pool with nothing left starts over */
+    entry_init(&entries[0], 9);
+    assert_true(tpm2_ecc_pool_add(t->path, TPM2_CC_Commit, &curve_p256,
+            entries, 1, &remaining));
+    assert_int_equal(remaining, 1);
+    assert_true(tpm2_ecc_pool_take(t->path, TPM2_CC_Commit, NULL, &entry,
+            &remaining));
+    assert_entry(&entry, 9, 3);
+}
+
+static void test_ecc_pool_mismatch(void **state) {
+
+    test_pool *t = (test_pool *) *state;
+
+    tpm2_ecc_pool_entry entries[1];
+    entry_init(&entries[0], 1);
+
+    size_t remaining = 0;
+    assert_true(tpm2_ecc_pool_add(t->path, TPM2_CC_EC_Ephemeral, &curve_p256,
+            entries, 1, &remaining));
+
+    /* another command */
+    tpm2_ecc_pool_entry entry;
+    assert_false(tpm2_ecc_pool_take(t->path, TPM2_CC_Commit, NULL, &entry,
+            &remaining));
+    assert_false(tpm2_ecc_pool_add(t->path, TPM2_CC_Commit, &curve_p256,
+            entries, 1, &remaining));
+
+    /* another curve */
+    TPM2B_NAME curve_p384 = { .size = 2, .name = { 0x00, 0x04 } };
+    assert_false(tpm2_ecc_pool_take(t->path, TPM2_CC_EC_Ephemeral,
+            &curve_p384, &entry, &remaining));
+    assert_false(tpm2_ecc_pool_add(t->path, TPM2_CC_EC_Ephemeral,
+            &curve_p384, entries, 1, &remaining));
+
+    /* the entry is still there */
+    assert_true(tpm2_ecc_pool_take(t->path, TPM2_CC_EC_Ephemeral,
+            &curve_p256, &entry, &remaining));
+    assert_entry(&entry, 1, 1);
+}
+
+static void test_ecc_pool_missing(void **state) {
+
+    test_pool *t = (test_pool *) *state;
+
+    tpm2_ecc_pool_entry entry;
+    size_t remaining = 0;
+    bool result = tpm2_ecc_pool_take(t->path, TPM2_CC_EC_Ephemeral, NULL,
+            &entry, &remaining);
+    assert_false(result);
+}
+
+/* link required symbol, but tpm2_tool.c declares it AND main, which
+ * we have a main below for cmocka tests.
+ */
+bool output_enabled = true;
+
+int main(int argc, char *argv[]) {
+    UNUSED(argc);
+    UNUSED(argv);
+
+    const struct CMUnitTest tests[] = {
+        cmocka_unit_test_setup_teardown(test_ecc_pool_fifo,
+                test_setup, test_teardown),
+        cmocka_unit_test_setup_teardown(test_ecc_pool_refill,
+                test_setup, test_teardown),
+        cmocka_unit_test_setup_teardown(test_ecc_pool_mismatch,
+                test_setup, test_teardown),
+        cmocka_unit_test_setup_teardown(test_ecc_pool_missing,
+                test_setup, test_teardown),
+    };
+
+    return cmocka_run_group_tests(tests, NULL, NULL);
+}
@@ -1,8 +1,11 @@
 /* SPDX-License-Identifier: BSD-3-Clause */
 
+#include <endian.h>
 #include <stdbool.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 
 #include <setjmp.h>
 #include <cmocka.h>
@@ -10,6 +13,9 @@
 #include <tss2/tss2_tpm2_types.h>
 
 #include "tpm2_eventlog.h"
+#include "tpm2_hex.h"
+#include "tpm2_openssl.h"
+#include "tpm2_util.h"
 
 #define TCG_DIGEST2_SHA1_SIZE (sizeof(TCG_DIGEST2) + TPM2_SHA_DIGEST_SIZE)
 #define TCG_DIGEST2_SHA256_SIZE (sizeof(TCG_DIGEST2) + TPM2_SHA256_DIGEST_SIZE)
@@ -550,6 +556,689 @@ static void test_specid_event(void **state) {
 
     assert_true(specid_event(event, sizeof(buf), &next));
 }
+static void test_parse_eventlog_resume(void **state) {
+
+    (void)state;
+    char buf[2 * (sizeof(TCG_EVENT) + 4)] = { 0, };
+    size_t i;
+    for (i = 0; i < 2; i++) {
+        TCG_EVENT *event = (TCG_EVENT*)(buf + i * (sizeof(TCG_EVENT) + 4));
+        event->pcrIndex = 0;
+        event->eventType = EV_POST_CODE;
+        memset(event->digest, i + 1, sizeof(event->digest));
+        event->eventDataSize = 4;
+    }
+
+    tpm2_eventlog_context full = { 0 };
+    assert_true(parse_eventlog(&full, (BYTE*)buf, sizeof(buf)));
+    assert_int_equal(full.event_count, 2);
+
+    /* replay the first event, then resume with the grown log */
+    tpm2_eventlog_context ctx = { 0 };
+    assert_true(parse_eventlog(&ctx, (BYTE*)buf, sizeof(buf) / 2));
+    assert_int_equal(ctx.event_count, 1);
+    assert_true(parse_eventlog(&ctx, (BYTE*)buf, sizeof(buf)));
+    assert_int_equal(ctx.event_count, 2);
+    assert_int_equal(ctx.log_offset, sizeof(buf));
+    assert_memory_equal(ctx.sha1_pcrs, full.sha1_pcrs, sizeof(ctx.sha1_pcrs));
+}
+static void test_parse_eventlog_sha1_replay(void **state) {
+
+    (void)state;
+    char buf[3 * (sizeof(TCG_EVENT) + 4)] = { 0, };
+    size_t i;
+    for (i = 0; i < 3; i++) {
+        TCG_EVENT *event = (TCG_EVENT*)(buf + i * (sizeof(TCG_EVENT) + 4));
+        event->pcrIndex = i == 1 ? 7 : 0;
+        event->eventType = EV_POST_CODE;
+        memset(event->digest, i + 1, sizeof(event->digest));
+        event->eventDataSize = 4;
+    }
+
+    tpm2_eventlog_context full = { 0 };
+    assert_true(parse_eventlog(&full, (BYTE*)buf, sizeof(buf)));
+
+    /* a replay only takes the fast path, to the same PCRs and position */
+    tpm2_eventlog_context ctx = { .skip_body = true };
+    assert_true(parse_eventlog(&ctx, (BYTE*)buf, sizeof(buf)));
+    assert_true(ctx.is_sha1_log);
+    assert_int_equal(ctx.event_count, full.event_count);
+    assert_int_equal(ctx.log_offset, sizeof(buf));
+    assert_int_equal(ctx.sha1_used, full.sha1_used);
+    assert_int_equal(ctx.sha1_used, (1 << 0) | (1 << 7));
+    assert_memory_equal(ctx.sha1_pcrs, full.sha1_pcrs, sizeof(ctx.sha1_pcrs));
+
+    /* an event of a PCR out of range is an error */
+    TCG_EVENT *last = (TCG_EVENT*)(buf + 2 * (sizeof(TCG_EVENT) + 4));
+    last->pcrIndex = TPM2_MAX_PCRS;
+    tpm2_eventlog_context bad = { .skip_body = true };
+    assert_false(parse_eventlog(&bad, (BYTE*)buf, sizeof(buf)));
+    tpm2_eventlog_context bad_full = { 0 };
+    assert_false(parse_eventlog(&bad_full, (BYTE*)buf, sizeof(buf)));
+
+    /* as is a truncated event */
+    last->pcrIndex = 0;
+    tpm2_eventlog_context truncated = { .skip_body = true };
+    assert_false(parse_eventlog(&truncated, (BYTE*)buf, sizeof(buf) - 1));
+}
+static void test_checkpoint_matches(void **state) {
+
+    (void)state;
+    char buf[2 * (sizeof(TCG_EVENT) + 4)] = { 0, };
+    size_t i;
+    for (i = 0; i < 2; i++) {
+        TCG_EVENT *event = (TCG_EVENT*)(buf + i * (sizeof(TCG_EVENT) + 4));
+        event->eventType = EV_POST_CODE;
+        event->eventDataSize = 4;
+    }
+
+    tpm2_eventlog_context ctx = { 0 };
+    assert_true(parse_eventlog(&ctx, (BYTE*)buf, sizeof(buf) / 2));
+
+    TPM2B_DIGEST digest = { .size = 0 };
+    assert_true(tpm2_openssl_hash_compute_data(TPM2_ALG_SHA256, (BYTE*)buf,
+            sizeof(buf) / 2, &digest));
+    memcpy(ctx.last_event_digest, digest.buffer, digest.size);
+
+    assert_true(tpm2_eventlog_checkpoint_matches(&ctx, (BYTE*)buf,
+            sizeof(buf)));
+
+    /* a log that was rewritten does not continue the checkpoint */
+    buf[0] = 1;
+    assert_false(tpm2_eventlog_checkpoint_matches(&ctx, (BYTE*)buf,
+            sizeof(buf)));
+
+    tpm2_eventlog_checkpoint_reset(&ctx);
+    assert_int_equal(ctx.log_offset, 0);
+    assert_int_equal(ctx.sha1_used, 0);
+}
+#define VERIFY_EVENTS 40
+#define VERIFY_EVENT_SIZE (sizeof(TCG_EVENT_HEADER2) + TCG_DIGEST2_SHA256_SIZE + \
+        sizeof(TCG_EVENT2) + 4)
+#define VERIFY_SPECID_SIZE (sizeof(TCG_EVENT) + sizeof(TCG_SPECID_EVENT) + \
+        sizeof(TCG_SPECID_ALG) + sizeof(TCG_VENDOR_INFO))
+
+/* a sha256 log of separator events, the payload of some not matching */
+static BYTE *verify_log_new(size_t *size) {
+
+    *size = VERIFY_SPECID_SIZE + VERIFY_EVENTS * VERIFY_EVENT_SIZE;
+    BYTE *buf = calloc(1, *size);
+    assert_non_null(buf);
+
+    TCG_EVENT *specid = (TCG_EVENT*)buf;
+    specid->eventType = EV_NO_ACTION;
+    specid->eventDataSize = VERIFY_SPECID_SIZE - sizeof(TCG_EVENT);
+    TCG_SPECID_EVENT *event_specid = (TCG_SPECID_EVENT*)specid->event;
+    event_specid->numberOfAlgorithms = 1;
+    event_specid->digestSizes[0].algorithmId = TPM2_ALG_SHA256;
+    event_specid->digestSizes[0].digestSize = TPM2_SHA256_DIGEST_SIZE;
+
+    size_t i;
+    for (i = 0; i < VERIFY_EVENTS; i++) {
+        TCG_EVENT_HEADER2 *eventhdr = (TCG_EVENT_HEADER2*)(buf +
+                VERIFY_SPECID_SIZE + i * VERIFY_EVENT_SIZE);
+        eventhdr->PCRIndex = i % 8;
+        eventhdr->EventType = EV_SEPARATOR;
+        eventhdr->DigestCount = 1;
+
+        TCG_DIGEST2 *digest = eventhdr->Digests;
+        digest->AlgorithmId = TPM2_ALG_SHA256;
+        TCG_EVENT2 *event = (TCG_EVENT2*)((uintptr_t)digest +
+                TCG_DIGEST2_SHA256_SIZE);
+        event->EventSize = 4;
+
+        TPM2B_DIGEST calc = { .size = 0 };
+        assert_true(tpm2_openssl_hash_compute_data(TPM2_ALG_SHA256,
+                event->Event, event->EventSize, &calc));
+        memcpy(digest->Digest, calc.buffer, TPM2_SHA256_DIGEST_SIZE);
+
+        if (i == 7 || i == 31) {
+            event->Event[0] = 0xff;
+        }
+    }
+
+    return buf;
+}
+static void test_parse_eventlog_verify(void **state) {
+
+    (void)state;
+    size_t size = 0;
+    BYTE *buf = verify_log_new(&size);
+
+    /* verified on a pool of threads */
+    size_t count = 0;
+    tpm2_eventlog_context ctx = { .data = &count };
+    assert_true(parse_eventlog(&ctx, buf, size));
+    assert_int_equal(ctx.event_count, VERIFY_EVENTS + 1);
+    assert_int_equal(ctx.verify_failures, 2);
+
+    /* verified inline while walking */
+    tpm2_eventlog_context inline_ctx = { .data = &count };
+    assert_true(foreach_event2(&inline_ctx,
+            (TCG_EVENT_HEADER2*)(buf + VERIFY_SPECID_SIZE),
+            size - VERIFY_SPECID_SIZE));
+    assert_int_equal(inline_ctx.verify_failures, 2);
+
+    /* the PCRs do not depend on the verification */
+    tpm2_eventlog_context plain = { 0 };
+    assert_true(parse_eventlog(&plain, buf, size));
+    assert_int_equal(plain.verify_failures, 0);
+    assert_memory_equal(plain.sha256_pcrs, ctx.sha256_pcrs,
+            sizeof(ctx.sha256_pcrs));
+
+    free(buf);
+}
+static void test_eventlog_index(void **state) {
+
+    (void)state;
+    size_t size = 0;
+    BYTE *buf = verify_log_new(&size);
+
+    /* indexing resumes at the end of the events indexed before */
+    tpm2_eventlog_index index = { 0 };
+    assert_true(tpm2_eventlog_index_build(&index, buf,
+            VERIFY_SPECID_SIZE + 10 * VERIFY_EVENT_SIZE));
+    assert_int_equal(index.count, 11);
+    assert_true(tpm2_eventlog_index_build(&index, buf, size));
+    assert_int_equal(index.count, VERIFY_EVENTS + 1);
+    assert_int_equal(index.log_offset, size);
+    assert_false(index.is_sha1_log);
+
+    assert_int_equal(index.entries[0].type, EV_NO_ACTION);
+    assert_int_equal(index.entries[0].size, VERIFY_SPECID_SIZE);
+    assert_int_equal(index.entries[12].offset,
+            VERIFY_SPECID_SIZE + 11 * VERIFY_EVENT_SIZE);
+    assert_int_equal(index.entries[12].pcr_index, 11 % 8);
+    assert_int_equal(index.entries[12].type, EV_SEPARATOR);
+
+    tpm2_eventlog_context full = { 0 };
+    assert_true(parse_eventlog(&full, buf, size));
+
+    /* only the events of PCR 7 */
+    tpm2_eventlog_filter filter = { .pcrs = 1 << 7 };
+    tpm2_eventlog_context ctx = { 0 };
+    assert_true(parse_eventlog_index(&ctx, buf, size, &index, &filter));
+    assert_int_equal(ctx.sha256_used, 1 << 7);
+    assert_memory_equal(ctx.sha256_pcrs[7], full.sha256_pcrs[7],
+            sizeof(ctx.sha256_pcrs[7]));
+    assert_int_equal(ctx.log_offset, 0);
+
+    /* a single event, the counter set to its number */
+    size_t count = 0;
+    filter = (tpm2_eventlog_filter){ .is_event = true, .event = 8 };
+    tpm2_eventlog_context one = { .data = &count };
+    assert_true(parse_eventlog_index(&one, buf, size, &index, &filter));
+    assert_int_equal(count, 8);
+    assert_int_equal(one.sha256_used, 1 << 7);
+    assert_int_equal(one.verify_failures, 1);
+
+    filter.event = VERIFY_EVENTS + 1;
+    assert_false(parse_eventlog_index(&one, buf, size, &index, &filter));
+
+    tpm2_eventlog_index_free(&index);
+    free(buf);
+}
+static void test_eventlog_index_save_load(void **state) {
+
+    (void)state;
+    size_t size = 0;
+    BYTE *buf = verify_log_new(&size);
+
+    tpm2_eventlog_index index = { 0 };
+    assert_true(tpm2_eventlog_index_build(&index, buf, size));
+
+    char path[] = "/tmp/test_tpm2_eventlog_index.XXXXXX";
+    int fd = mkstemp(path);
+    assert_true(fd >= 0);
+    close(fd);
+    assert_true(tpm2_eventlog_index_save(&index, buf, path));
+
+    tpm2_eventlog_index loaded = { 0 };
+    assert_true(tpm2_eventlog_index_load(&loaded, path));
+
+    /* a count the file cannot hold is malformed, after magic, version, kind */
+    tpm2_eventlog_index bogus = { 0 };
+    FILE *f = fopen(path, "r+b");
+    assert_non_null(f);
+    assert_int_equal(fseek(f, 3 * sizeof(uint32_t), SEEK_SET), 0);
+    BYTE count[sizeof(uint64_t)] = { 0x00, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+            0xff };
+    assert_int_equal(fwrite(count, 1, sizeof(count), f), sizeof(count));
+    fclose(f);
+    assert_false(tpm2_eventlog_index_load(&bogus, path));
+    assert_null(bogus.entries);
+    unlink(path);
+
+    assert_int_equal(loaded.count, index.count);
+    assert_int_equal(loaded.log_offset, index.log_offset);
+    size_t i;
+    for (i = 0; i < index.count; i++) {
+        assert_int_equal(loaded.entries[i].offset, index.entries[i].offset);
+        assert_int_equal(loaded.entries[i].size, index.entries[i].size);
+        assert_int_equal(loaded.entries[i].pcr_index,
+                index.entries[i].pcr_index);
+        assert_int_equal(loaded.entries[i].type, index.entries[i].type);
+    }
+    assert_true(tpm2_eventlog_index_matches(&loaded, buf, size));
+
+    /* a log that was rewritten does not continue the index */
+    buf[size - 1] ^= 1;
+    assert_false(tpm2_eventlog_index_matches(&loaded, buf, size));
+    assert_false(tpm2_eventlog_index_matches(&loaded, buf, size - 1));
+
+    tpm2_eventlog_index_free(&loaded);
+    tpm2_eventlog_index_free(&index);
+    free(buf);
+}
+static void test_parse_eventlog_scratch(void **state) {
+
+    (void)state;
+    size_t size = 0;
+    BYTE *buf = verify_log_new(&size);
+
+    tpm2_eventlog_context full = { 0 };
+    assert_true(parse_eventlog(&full, buf, size));
+
+    /* a context and its scratch replay log after log the same */
+    tpm2_eventlog_scratch *scratch = tpm2_eventlog_scratch_new();
+    assert_non_null(scratch);
+    tpm2_eventlog_context ctx = { .scratch = scratch };
+
+    int i;
+    for (i = 0; i < 2; i++) {
+        tpm2_eventlog_context_reset(&ctx);
+        assert_ptr_equal(ctx.scratch, scratch);
+        assert_true(parse_eventlog(&ctx, buf, size));
+        assert_int_equal(ctx.event_count, full.event_count);
+        assert_int_equal(ctx.verify_failures, 0);
+        assert_memory_equal(ctx.sha256_pcrs, full.sha256_pcrs,
+                sizeof(ctx.sha256_pcrs));
+    }
+
+    tpm2_eventlog_scratch_free(scratch);
+    free(buf);
+}
+static void test_parse_eventlog_replay_only(void **state) {
+
+    (void)state;
+    size_t size = 0;
+    BYTE *buf = verify_log_new(&size);
+
+    tpm2_eventlog_context full = { 0 };
+    assert_true(parse_eventlog(&full, buf, size));
+
+    /* the payloads are not verified, the PCRs are the same */
+    tpm2_eventlog_context ctx = { .skip_body = true };
+    assert_true(parse_eventlog(&ctx, buf, size));
+    assert_int_equal(ctx.verify_failures, 0);
+    assert_int_equal(ctx.sha256_used, full.sha256_used);
+    assert_memory_equal(ctx.sha256_pcrs, full.sha256_pcrs,
+            sizeof(ctx.sha256_pcrs));
+
+    TPML_PCR_SELECTION pcr_select;
+    tpm2_pcrs pcrs = { 0 };
+    assert_true(tpm2_eventlog_replayed_pcrs(&ctx, &pcr_select, &pcrs));
+    assert_int_equal(pcr_select.count, 1);
+    assert_int_equal(pcr_select.pcrSelections[0].hash, TPM2_ALG_SHA256);
+    assert_int_equal(pcr_select.pcrSelections[0].sizeofSelect, 3);
+    assert_int_equal(pcr_select.pcrSelections[0].pcrSelect[0], 0xff);
+    assert_int_equal(pcr_select.pcrSelections[0].pcrSelect[1], 0);
+
+    /* PCRs 0 to 7, in digest lists of 8 */
+    assert_int_equal(pcrs.count, 1);
+    assert_int_equal(pcrs.pcr_values[0].count, 8);
+    assert_int_equal(pcrs.pcr_values[0].digests[7].size,
+            TPM2_SHA256_DIGEST_SIZE);
+    assert_memory_equal(pcrs.pcr_values[0].digests[7].buffer,
+            ctx.sha256_pcrs[7], TPM2_SHA256_DIGEST_SIZE);
+
+    pcr_pcrs_free(&pcrs);
+    free(buf);
+}
+
+#define PLAN_HEX_11 "1111111111111111111111111111111111111111111111111111111111111111"
+#define PLAN_HEX_22 "2222222222222222222222222222222222222222222222222222222222222222"
+#define PLAN_HEX_22_SHA1 "2222222222222222222222222222222222222222"
+
+static void plan_write(char *path, const char *text) {
+
+    strcpy(path, "/tmp/test_tpm2_eventlog_plan.XXXXXX");
+    int fd = mkstemp(path);
+    assert_true(fd >= 0);
+    assert_int_equal(write(fd, text, strlen(text)), strlen(text));
+    close(fd);
+}
+
+static void test_parse_eventlog_predict(void **state) {
+
+    (void)state;
+    size_t size = 0;
+    BYTE *buf = verify_log_new(&size);
+
+    /* every event of the log measures the same 4 zero bytes */
+    BYTE zeros[4] = { 0 };
+    TPM2B_DIGEST measured = { .size = 0 };
+    assert_true(tpm2_openssl_hash_compute_data(TPM2_ALG_SHA256, zeros,
+            sizeof(zeros), &measured));
+    char from[2 * TPM2_SHA256_DIGEST_SIZE + 1];
+    tpm2_hex_encode(measured.buffer, measured.size, from, false);
+    from[sizeof(from) - 1] = '\0';
+
+    BYTE to[TPM2_SHA256_DIGEST_SIZE];
+    memset(to, 0x11, sizeof(to));
+    BYTE appended[TPM2_SHA256_DIGEST_SIZE];
+    memset(appended, 0x22, sizeof(appended));
+
+    char text[512];
+    snprintf(text, sizeof(text),
+            "# a new boot loader\n"
+            "replace 3 sha256=%s sha256=0x%s\n"
+            "\n"
+            "append 9 sha256=%s  # a kernel command line\n",
+            from, PLAN_HEX_11, PLAN_HEX_22);
+    char path[64];
+    plan_write(path, text);
+
+    tpm2_eventlog_plan *plan = NULL;
+    assert_true(tpm2_eventlog_plan_load(&plan, path));
+    unlink(path);
+
+    tpm2_eventlog_context full = { 0 };
+    assert_true(parse_eventlog(&full, buf, size));
+
+    tpm2_eventlog_context ctx = { .skip_body = true, .plan = plan };
+    assert_true(parse_eventlog(&ctx, buf, size));
+    assert_int_equal(ctx.sha256_used, full.sha256_used | (1 << 9));
+
+    /* the PCRs the plan does not touch are those of the log */
+    assert_memory_equal(ctx.sha256_pcrs[2], full.sha256_pcrs[2],
+            TPM2_SHA256_DIGEST_SIZE);
+
+    BYTE expected[TPM2_SHA256_DIGEST_SIZE] = { 0 };
+    size_t i;
+    for (i = 0; i < VERIFY_EVENTS / 8; i++) {
+        assert_true(tpm2_openssl_pcr_extend(TPM2_ALG_SHA256, expected, to,
+                sizeof(to)));
+    }
+    assert_memory_equal(ctx.sha256_pcrs[3], expected, sizeof(expected));
+
+    memset(expected, 0, sizeof(expected));
+    assert_true(tpm2_openssl_pcr_extend(TPM2_ALG_SHA256, expected, appended,
+            sizeof(appended)));
+    assert_memory_equal(ctx.sha256_pcrs[9], expected, sizeof(expected));
+    tpm2_eventlog_plan_free(plan);
+
+    /* a replacement of a measurement the log does not have */
+    plan_write(path, "replace 3 sha256=" PLAN_HEX_22 " sha256=" PLAN_HEX_11
+            "\n");
+    assert_true(tpm2_eventlog_plan_load(&plan, path));
+    unlink(path);
+    tpm2_eventlog_context unmatched = { .skip_body = true, .plan = plan };
+    assert_false(parse_eventlog(&unmatched, buf, size));
+    tpm2_eventlog_plan_free(plan);
+
+    /* replacements of two algorithms or statements the plan does not know */
+    plan_write(path, "replace 3 sha1=" PLAN_HEX_22_SHA1 " sha256="
+            PLAN_HEX_11 "\n");
+    assert_false(tpm2_eventlog_plan_load(&plan, path));
+    assert_null(plan);
+    unlink(path);
+    plan_write(path, "extend 3 sha256=" PLAN_HEX_11 "\n");
+    assert_false(tpm2_eventlog_plan_load(&plan, path));
+    unlink(path);
+
+    free(buf);
+}
+
+static bool test_unknown_digest_cb(size_t eventnum, unsigned pcr_index,
+        TPMI_ALG_HASH alg, BYTE const *digest, size_t size, void *data) {
+
+    (void)digest;
+    (void)data;
+    assert_int_equal(alg, TPM2_ALG_SHA256);
+    assert_int_equal(size, TPM2_SHA256_DIGEST_SIZE);
+    assert_int_equal(pcr_index, (eventnum - 1) % 8);
+
+    return true;
+}
+
+static void test_eventlog_reference(void **state) {
+
+    (void)state;
+
+    /* unsorted, with comments and blank lines */
+    static const char text[] =
+        "# vendor allowlist\n"
+        "ff00\n"
+        "\n"
+        "  0a0b0c0d  # short\n"
+        "df3f619804a92fdb4057192dc43dd748ea778adc52bc498ce80524c014b81119\r\n"
+        "00";
+    tpm2_eventlog_reference ref = { 0 };
+    assert_true(tpm2_eventlog_reference_parse(&ref, text, sizeof(text) - 1));
+    assert_int_equal(ref.count, 4);
+    assert_int_equal(ref.digests[0].size, 1);
+    assert_int_equal(ref.digests[1].size, 2);
+    assert_int_equal(ref.digests[2].size, 4);
+
+    BYTE const short_digest[] = { 0x0a, 0x0b, 0x0c, 0x0d };
+    assert_true(tpm2_eventlog_reference_contains(&ref, short_digest,
+            sizeof(short_digest)));
+    assert_false(tpm2_eventlog_reference_contains(&ref, short_digest, 2));
+
+    /* every event of the log measures the same 4 zero bytes */
+    size_t size = 0;
+    BYTE *buf = verify_log_new(&size);
+    tpm2_eventlog_context ctx = {
+        .skip_body = true,
+        .reference = &ref,
+        .unknown_digest_cb = test_unknown_digest_cb,
+    };
+    assert_true(parse_eventlog(&ctx, buf, size));
+    assert_int_equal(ctx.unknown_digests, 0);
+    tpm2_eventlog_reference_free(&ref);
+
+    assert_true(tpm2_eventlog_reference_parse(&ref, "ff00", 4));
+    tpm2_eventlog_context unknown = {
+        .skip_body = true,
+        .reference = &ref,
+        .unknown_digest_cb = test_unknown_digest_cb,
+    };
+    assert_true(parse_eventlog(&unknown, buf, size));
+    assert_int_equal(unknown.unknown_digests, VERIFY_EVENTS);
+
+    /* not a hex digest */
+    assert_false(tpm2_eventlog_reference_parse(&ref, "abc\n", 4));
+    assert_false(tpm2_eventlog_reference_parse(&ref, "xy\n", 3));
+
+    tpm2_eventlog_reference_free(&ref);
+    free(buf);
+}
+static void test_eventlog_write(void **state) {
+
+    (void)state;
+    size_t size = 0;
+    BYTE *buf = verify_log_new(&size);
+
+    FILE *f = tmpfile();
+    assert_non_null(f);
+
+    TPMI_ALG_HASH alg = TPM2_ALG_SHA256;
+    assert_true(tpm2_eventlog_write_specid(f, &alg, 1));
+    long specid_size = ftell(f);
+    assert_int_equal(specid_size, VERIFY_SPECID_SIZE);
+
+    /* the same events as the log built in memory */
+    size_t i;
+    for (i = 0; i < VERIFY_EVENTS; i++) {
+        TCG_EVENT_HEADER2 *eventhdr = (TCG_EVENT_HEADER2*)(buf +
+                VERIFY_SPECID_SIZE + i * VERIFY_EVENT_SIZE);
+        TCG_DIGEST2 *digest = eventhdr->Digests;
+        TCG_EVENT2 *event = (TCG_EVENT2*)((uintptr_t)digest +
+                TCG_DIGEST2_SHA256_SIZE);
+
+        TPML_DIGEST_VALUES digests = { .count = 1 };
+        digests.digests[0].hashAlg = TPM2_ALG_SHA256;
+        memcpy(digests.digests[0].digest.sha256, digest->Digest,
+                TPM2_SHA256_DIGEST_SIZE);
+        assert_true(tpm2_eventlog_write_event2(f, eventhdr->PCRIndex,
+                eventhdr->EventType, &digests, event->Event,
+                event->EventSize));
+    }
+
+    long written_size = ftell(f);
+    assert_int_equal(written_size, size);
+
+    BYTE *written = malloc(size);
+    assert_non_null(written);
+    rewind(f);
+    assert_int_equal(fread(written, size, 1, f), 1);
+    assert_memory_equal(written + VERIFY_SPECID_SIZE, buf + VERIFY_SPECID_SIZE,
+            size - VERIFY_SPECID_SIZE);
+
+    TPMI_ALG_HASH algs[TPM2_NUM_PCR_BANKS];
+    UINT32 count = 0;
+    rewind(f);
+    assert_true(tpm2_eventlog_read_specid(f, algs, &count));
+    assert_int_equal(count, 1);
+    assert_int_equal(algs[0], TPM2_ALG_SHA256);
+    fclose(f);
+
+    tpm2_eventlog_context expected = { 0 };
+    assert_true(parse_eventlog(&expected, buf, size));
+    tpm2_eventlog_context ctx = { 0 };
+    assert_true(parse_eventlog(&ctx, written, size));
+    assert_int_equal(ctx.verify_failures, 2);
+    assert_int_equal(ctx.sha256_used, expected.sha256_used);
+    assert_memory_equal(ctx.sha256_pcrs, expected.sha256_pcrs,
+            sizeof(ctx.sha256_pcrs));
+
+    free(written);
+    free(buf);
+}
+/* an ima-ng entry and a violation, the template digests are arbitrary */
+#define IMA_TEMPLATE_HASH "0102030405060708090a0b0c0d0e0f1011121314"
+#define IMA_FILE_HASH \
+    "df3f619804a92fdb4057192dc43dd748ea778adc52bc498ce80524c014b81119"
+#define IMA_ZEROS "0000000000000000000000000000000000000000"
+
+static const char ima_ascii_list[] =
+    "10 " IMA_TEMPLATE_HASH " ima-ng sha256:" IMA_FILE_HASH " /usr/bin/a b\n"
+    "10 " IMA_ZEROS " ima-ng sha256:" IMA_FILE_HASH " /tmp/violation\n";
+
+static BYTE *ima_binary_entry(BYTE *p, BYTE const *template_hash,
+        char const *name) {
+
+    BYTE file_hash[TPM2_SHA256_DIGEST_SIZE];
+    assert_true(tpm2_hex_decode(IMA_FILE_HASH, strlen(IMA_FILE_HASH),
+            file_hash));
+
+    UINT32 name_size = strlen(name) + 1;
+    UINT32 dng_size = sizeof("sha256:") + sizeof(file_hash);
+    UINT32 values[] = {
+        10, 6, 4 + dng_size + 4 + name_size, dng_size, name_size
+    };
+    size_t i;
+    for (i = 0; i < ARRAY_LEN(values); i++) {
+        values[i] = htole32(values[i]);
+    }
+
+    memcpy(p, &values[0], 4);
+    memcpy(p + 4, template_hash, TPM2_SHA1_DIGEST_SIZE);
+    p += 4 + TPM2_SHA1_DIGEST_SIZE;
+    memcpy(p, &values[1], 4);
+    memcpy(p + 4, "ima-ng", 6);
+    memcpy(p + 10, &values[2], 4);
+    memcpy(p + 14, &values[3], 4);
+    memcpy(p + 18, "sha256:", sizeof("sha256:"));
+    p += 18 + sizeof("sha256:");
+    memcpy(p, file_hash, sizeof(file_hash));
+    p += sizeof(file_hash);
+    memcpy(p, &values[4], 4);
+    memcpy(p + 4, name, name_size);
+
+    return p + 4 + name_size;
+}
+
+static bool test_ima_event_cb(size_t eventnum,
+        tpm2_eventlog_ima_event const *event, void *data) {
+
+    (void)data;
+    assert_int_equal(event->pcr_index, 10);
+    assert_int_equal(event->file_alg, TPM2_ALG_SHA256);
+    assert_int_equal(event->file_digest.size, TPM2_SHA256_DIGEST_SIZE);
+    assert_int_equal(event->is_violation, eventnum == 1);
+
+    char const *name = eventnum ? "/tmp/violation" : "/usr/bin/a b";
+    assert_int_equal(event->file_name_size, strlen(name));
+    assert_memory_equal(event->file_name, name, strlen(name));
+
+    return true;
+}
+
+static void test_parse_ima_log(void **state) {
+
+    (void)state;
+
+    /* a violation is extended with ones */
+    BYTE expected[TPM2_SHA1_DIGEST_SIZE] = { 0 };
+    BYTE template_hash[TPM2_SHA1_DIGEST_SIZE];
+    BYTE ones[TPM2_SHA1_DIGEST_SIZE];
+    memset(ones, 0xff, sizeof(ones));
+    assert_true(tpm2_hex_decode(IMA_TEMPLATE_HASH,
+            strlen(IMA_TEMPLATE_HASH), template_hash));
+    assert_true(tpm2_openssl_pcr_extend(TPM2_ALG_SHA1, expected,
+            template_hash, sizeof(template_hash)));
+    assert_true(tpm2_openssl_pcr_extend(TPM2_ALG_SHA1, expected, ones,
+            sizeof(ones)));
+
+    tpm2_eventlog_context ascii = { .ima_event_cb = test_ima_event_cb };
+    assert_true(parse_ima_log(&ascii, (BYTE const *)ima_ascii_list,
+            sizeof(ima_ascii_list) - 1, TPM2_ALG_NULL));
+    assert_int_equal(ascii.event_count, 2);
+    assert_int_equal(ascii.sha1_used, 1 << 10);
+    assert_memory_equal(ascii.sha1_pcrs[10], expected, sizeof(expected));
+
+    BYTE binary[512];
+    BYTE zeros[TPM2_SHA1_DIGEST_SIZE] = { 0 };
+    BYTE *end = ima_binary_entry(binary, template_hash, "/usr/bin/a b");
+    size_t first_size = end - binary;
+    end = ima_binary_entry(end, zeros, "/tmp/violation");
+    size_t size = end - binary;
+
+    tpm2_eventlog_context ctx = { .ima_event_cb = test_ima_event_cb };
+    assert_true(parse_ima_log(&ctx, binary, size, TPM2_ALG_SHA1));
+    assert_int_equal(ctx.event_count, 2);
+    assert_memory_equal(ctx.sha1_pcrs[10], expected, sizeof(expected));
+
+    /* resumed after the first entry, ie from a checkpoint */
+    tpm2_eventlog_context resumed = { 0 };
+    assert_true(parse_ima_log(&resumed, binary, first_size, TPM2_ALG_SHA1));
+    assert_int_equal(resumed.event_count, 1);
+    assert_true(parse_ima_log(&resumed, binary, size, TPM2_ALG_SHA1));
+    assert_int_equal(resumed.event_count, 2);
+    assert_memory_equal(resumed.sha1_pcrs[10], expected, sizeof(expected));
+
+    /* the appraisal leaves the violation out */
+    tpm2_eventlog_reference ref = { 0 };
+    assert_true(tpm2_eventlog_reference_parse(&ref, "ff00", 4));
+    tpm2_eventlog_context unknown = { .reference = &ref };
+    assert_true(parse_ima_log(&unknown, binary, size, TPM2_ALG_SHA1));
+    assert_int_equal(unknown.unknown_digests, 1);
+    tpm2_eventlog_reference_free(&ref);
+
+    /* a truncated entry, a template hash of another bank */
+    tpm2_eventlog_context truncated = { 0 };
+    assert_false(parse_ima_log(&truncated, binary, size - 1, TPM2_ALG_SHA1));
+    tpm2_eventlog_context bank = { 0 };
+    assert_false(parse_ima_log(&bank, (BYTE const *)ima_ascii_list,
+            sizeof(ima_ascii_list) - 1, TPM2_ALG_SHA256));
+
+    /* a checkpoint of a TCG log is not one of an IMA list */
+    tpm2_eventlog_context other = { .log_offset = 1 };
+    assert_false(parse_ima_log(&other, binary, size, TPM2_ALG_SHA1));
+}
+
 int main(void) {
 
     const struct CMUnitTest tests[] = {
@@ -587,6 +1276,18 @@ int main(void) {
         cmocka_unit_test(test_specid_event_nosizeforvendorstruct),
         cmocka_unit_test(test_specid_event_nosizeforvendordata),
         cmocka_unit_test(test_specid_event),
+        cmocka_unit_test(test_parse_eventlog_resume),
+        cmocka_unit_test(test_checkpoint_matches),
+        cmocka_unit_test(test_parse_eventlog_verify),
+        cmocka_unit_test(test_eventlog_index),
+        cmocka_unit_test(test_eventlog_index_save_load),
+        cmocka_unit_test(test_parse_eventlog_scratch),
+        cmocka_unit_test(test_parse_eventlog_sha1_replay),
+        cmocka_unit_test(test_parse_eventlog_replay_only),
+        cmocka_unit_test(test_parse_eventlog_predict),
+        cmocka_unit_test(test_eventlog_reference),
+        cmocka_unit_test(test_eventlog_write),
+        cmocka_unit_test(test_parse_ima_log),
     };
 
     return cmocka_run_group_tests(tests, NULL, NULL);
@@ -0,0 +1,162 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <setjmp.h>
+#include <cmocka.h>
+
+#include <tss2/tss2_tpm2_types.h>
+
+#include "tpm2_eventlog.h"
+#include "tpm2_eventlog_emit.h"
+#include "tpm2_util.h"
+
+#define TEST_SPECID_SIZE (sizeof(TCG_EVENT) + sizeof(TCG_SPECID_EVENT) + \
+        sizeof(TCG_SPECID_ALG) + sizeof(TCG_VENDOR_INFO))
+#define TEST_EVENT_SIZE (sizeof(TCG_EVENT_HEADER2) + sizeof(TCG_DIGEST2) + \
+        TPM2_SHA256_DIGEST_SIZE + sizeof(TCG_EVENT2) + 2)
+
+/* a sha256 log of the SpecID event and one post code event */
+static void test_log_init(BYTE buf[TEST_SPECID_SIZE + TEST_EVENT_SIZE]) {
+
+    memset(buf, 0, TEST_SPECID_SIZE + TEST_EVENT_SIZE);
+
+    TCG_EVENT *specid = (TCG_EVENT*)buf;
+    specid->eventType = EV_NO_ACTION;
+    specid->eventDataSize = TEST_SPECID_SIZE - sizeof(TCG_EVENT);
+    TCG_SPECID_EVENT *event_specid = (TCG_SPECID_EVENT*)specid->event;
+    event_specid->numberOfAlgorithms = 1;
+    event_specid->digestSizes[0].algorithmId = TPM2_ALG_SHA256;
+    event_specid->digestSizes[0].digestSize = TPM2_SHA256_DIGEST_SIZE;
+
+    TCG_EVENT_HEADER2 *eventhdr = (TCG_EVENT_HEADER2*)&buf[TEST_SPECID_SIZE];
+    eventhdr->PCRIndex = 3;
+    eventhdr->EventType = EV_POST_CODE;
+    eventhdr->DigestCount = 1;
+    eventhdr->Digests[0].AlgorithmId = TPM2_ALG_SHA256;
+    memset(eventhdr->Digests[0].Digest, 0xab, TPM2_SHA256_DIGEST_SIZE);
+
+    TCG_EVENT2 *event = (TCG_EVENT2*)((uintptr_t)eventhdr->Digests[0].Digest +
+            TPM2_SHA256_DIGEST_SIZE);
+    event->EventSize = 2;
+    event->Event[0] = 0x12;
+    event->Event[1] = 0x34;
+}
+
+static size_t test_emit(tpm2_eventlog_format format, BYTE const *log,
+        size_t size, char **out) {
+
+    size_t out_size = 0;
+    FILE *f = open_memstream(out, &out_size);
+    assert_non_null(f);
+
+    tpm2_eventlog_context ctx = { 0 };
+    tpm2_eventlog_emitter emitter;
+    tpm2_eventlog_emitter_init(&emitter, format, f, &ctx);
+    assert_true(tpm2_eventlog_emitter_begin(&emitter));
+    assert_true(parse_eventlog(&ctx, log, size));
+    assert_true(tpm2_eventlog_emitter_end(&emitter, &ctx));
+    assert_int_equal(emitter.count, 2);
+    tpm2_eventlog_emitter_free(&emitter);
+
+    fclose(f);
+
+    return out_size;
+}
+
+static void test_tpm2_eventlog_emit_json(void **state) {
+    UNUSED(state);
+
+    BYTE log[TEST_SPECID_SIZE + TEST_EVENT_SIZE];
+    test_log_init(log);
+
+    char *out = NULL;
+    test_emit(tpm2_eventlog_format_json, log, sizeof(log), &out);
+
+    assert_non_null(strstr(out, "{\"events\":[\n{\"EventNum\":0,"
+            "\"PCRIndex\":0,\"EventType\":\"EV_NO_ACTION\""));
+    assert_non_null(strstr(out, ",\n{\"EventNum\":1,\"PCRIndex\":3,"
+            "\"EventType\":\"EV_POST_CODE\",\"Digests\":[{\"AlgorithmId\":"
+            "\"sha256\",\"Digest\":\"abababab"));
+    assert_non_null(strstr(out, "],\"EventSize\":2,\"Event\":\"1234\"}"));
+    assert_non_null(strstr(out, "\n],\"pcrs\":{\"sha256\":{\"3\":\""));
+    assert_int_equal(out[strlen(out) - 1], '\n');
+
+    free(out);
+}
+
+static uint32_t test_be32(BYTE const *p) {
+
+    return (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 |
+            (uint32_t)p[2] << 8 | p[3];
+}
+
+static void test_tpm2_eventlog_emit_tlv(void **state) {
+    UNUSED(state);
+
+    BYTE log[TEST_SPECID_SIZE + TEST_EVENT_SIZE];
+    test_log_init(log);
+
+    char *out = NULL;
+    size_t size = test_emit(tpm2_eventlog_format_tlv, log, sizeof(log), &out);
+    BYTE const *p = (BYTE const *)out;
+    BYTE const *end = p + size;
+
+    /* the version record */
+    assert_int_equal(p[0], TPM2_EVENTLOG_TLV_TAG_VERSION);
+    assert_int_equal(test_be32(&p[1]), 4);
+    assert_int_equal(test_be32(&p[5]), TPM2_EVENTLOG_TLV_VERSION);
+    p += 9;
+
+    /* the SpecID event, then the post code event */
+    assert_int_equal(p[0], TPM2_EVENTLOG_TLV_TAG_EVENT);
+    p += 5 + test_be32(&p[1]);
+
+    assert_int_equal(p[0], TPM2_EVENTLOG_TLV_TAG_EVENT);
+    uint32_t len = test_be32(&p[1]);
+    assert_int_equal(len, 16 + 4 + TPM2_SHA256_DIGEST_SIZE + 4 + 2);
+    BYTE const *value = &p[5];
+    assert_int_equal(test_be32(&value[0]), 1);
+    assert_int_equal(test_be32(&value[4]), 3);
+    assert_int_equal(test_be32(&value[8]), EV_POST_CODE);
+    assert_int_equal(test_be32(&value[12]), 1);
+    assert_int_equal(value[16] << 8 | value[17], TPM2_ALG_SHA256);
+    assert_int_equal(value[18] << 8 | value[19], TPM2_SHA256_DIGEST_SIZE);
+    assert_int_equal(value[20], 0xab);
+    assert_int_equal(test_be32(&value[20 + TPM2_SHA256_DIGEST_SIZE]), 2);
+    assert_int_equal(value[len - 1], 0x34);
+    p += 5 + len;
+
+    /* the replayed PCR and the end */
+    assert_int_equal(p[0], TPM2_EVENTLOG_TLV_TAG_PCR);
+    assert_int_equal(test_be32(&p[1]), 3 + TPM2_SHA256_DIGEST_SIZE);
+    assert_int_equal(p[7], 3);
+    p += 5 + 3 + TPM2_SHA256_DIGEST_SIZE;
+
+    assert_int_equal(p[0], TPM2_EVENTLOG_TLV_TAG_END);
+    assert_int_equal(test_be32(&p[1]), 0);
+    assert_ptr_equal(p + 5, end);
+
+    free(out);
+}
+
+/* link required symbol, but tpm2_tool.c declares it AND main, which
+ * we have a main below for cmocka tests.
+ */
+bool output_enabled = true;
+
+int main(int argc, char *argv[]) {
+    UNUSED(argc);
+    UNUSED(argv);
+
+    const struct CMUnitTest tests[] = {
+        cmocka_unit_test(test_tpm2_eventlog_emit_json),
+        cmocka_unit_test(test_tpm2_eventlog_emit_tlv),
+    };
+
+    return cmocka_run_group_tests(tests, NULL, NULL);
+}
@@ -82,6 +82,49 @@ static void test_yaml_event2data_version2(void **state) {
     event->EventSize = 6;
     assert_true(yaml_event2data(event, EV_PREBOOT_CERT, 2));
 }
+static void test_yaml_event2data_callback_scratch(void **state) {
+
+    (void)state;
+    static const char name[] = "BootOrder";
+    const size_t name_len = sizeof(name) - 1;
+    const size_t var_size = sizeof(UEFI_VARIABLE_DATA) +
+        name_len * sizeof(UTF16_CHAR) + 2 * sizeof(UINT16);
+    uint8_t buf [sizeof(TCG_EVENT2) + 128] = { 0, };
+    TCG_EVENT2 *event = (TCG_EVENT2*)buf;
+    UEFI_VARIABLE_DATA *var = (UEFI_VARIABLE_DATA*)event->Event;
+
+    event->EventSize = var_size;
+    var->UnicodeNameLength = name_len;
+    var->VariableDataLength = 2 * sizeof(UINT16);
+    for (size_t i = 0; i < name_len; i++) {
+        var->UnicodeName[i].c = name[i];
+    }
+
+    yaml_eventlog_state yaml_state = { 0 };
+    assert_true(yaml_event2data_callback(event, EV_EFI_VARIABLE_BOOT,
+            &yaml_state, 2));
+    assert_non_null(yaml_state.scratch.name.data);
+    assert_string_equal(yaml_state.scratch.name.data, name);
+
+    /* the buffers are reused for the next event, not reallocated */
+    char *data = yaml_state.scratch.name.data;
+    size_t size = yaml_state.scratch.name.size;
+    assert_true(yaml_event2data_callback(event, EV_EFI_VARIABLE_BOOT,
+            &yaml_state, 2));
+    assert_ptr_equal(yaml_state.scratch.name.data, data);
+    assert_int_equal(yaml_state.scratch.name.size, size);
+
+    /* and the hex strings of the other variables */
+    event->EventSize = var_size;
+    assert_true(yaml_event2data_callback(event, EV_EFI_VARIABLE_DRIVER_CONFIG,
+            &yaml_state, 2));
+    assert_non_null(yaml_state.scratch.text.data);
+    assert_string_equal(yaml_state.scratch.text.data, "00000000");
+
+    yaml_scratch_free(&yaml_state.scratch);
+    assert_null(yaml_state.scratch.name.data);
+    assert_null(yaml_state.scratch.text.data);
+}
 static void test_yaml_event2hdr_callback(void **state){
 
     (void)state;
@@ -148,6 +191,7 @@ int main(void) {
         cmocka_unit_test(test_yaml_digest2_callback),
         cmocka_unit_test(test_yaml_event2data_version1),
         cmocka_unit_test(test_yaml_event2data_version2),
+        cmocka_unit_test(test_yaml_event2data_callback_scratch),
         cmocka_unit_test(test_yaml_eventlog),
     };
 
@@ -0,0 +1,128 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <setjmp.h>
+#include <cmocka.h>
+
+#include "tpm2_hex.h"
+#include "tpm2_util.h"
+
+static void test_tpm2_hex_encode(void **state) {
+    UNUSED(state);
+
+    const BYTE data[] = { 0x00, 0x01, 0x7f, 0x80, 0xab, 0xff };
+
+    char hex[TPM2_HEX_SIZE(sizeof(data))];
+    size_t len = tpm2_hex_encode(data, sizeof(data), hex, false);
+    assert_int_equal(len, 2 * sizeof(data));
+    assert_string_equal(hex, "00017f80abff");
+
+    len = tpm2_hex_encode(data, sizeof(data), hex, true);
+    assert_int_equal(len, 2 * sizeof(data));
+    assert_string_equal(hex, "00017F80ABFF");
+
+    len = tpm2_hex_encode(data, 0, hex, false);
+    assert_int_equal(len, 0);
+    assert_string_equal(hex, "");
+}
+
+static void test_tpm2_hex_encode_every_byte(void **state) {
+    UNUSED(state);
+
+    BYTE data[256];
+    unsigned i;
+    for (i = 0; i < sizeof(data); i++) {
+        data[i] = i;
+    }
+
+    char *hex = tpm2_hex_encode_alloc(data, sizeof(data), false);
+    assert_non_null(hex);
+    assert_int_equal(strlen(hex), 2 * sizeof(data));
+
+    for (i = 0; i < sizeof(data); i++) {
+        char expected[3];
+        snprintf(expected, sizeof(expected), "%02x", i);
+        assert_memory_equal(&hex[2 * i], expected, 2);
+    }
+
+    BYTE decoded[sizeof(data)];
+    assert_true(tpm2_hex_decode(hex, strlen(hex), decoded));
+    assert_memory_equal(decoded, data, sizeof(data));
+
+    free(hex);
+}
+
+static void test_tpm2_hex_decode(void **state) {
+    UNUSED(state);
+
+    BYTE data[4] = { 0 };
+    assert_true(tpm2_hex_decode("0aF09b", 6, data));
+    assert_int_equal(data[0], 0x0a);
+    assert_int_equal(data[1], 0xf0);
+    assert_int_equal(data[2], 0x9b);
+
+    /* only the given length is decoded */
+    assert_true(tpm2_hex_decode("ffzz", 2, data));
+    assert_int_equal(data[0], 0xff);
+
+    /* validating only */
+    assert_true(tpm2_hex_decode("abcd", 4, NULL));
+
+    assert_false(tpm2_hex_decode("abc", 3, data));
+    assert_false(tpm2_hex_decode("0g", 2, data));
+    assert_false(tpm2_hex_decode("g0", 2, data));
+    assert_false(tpm2_hex_decode("0x12", 4, data));
+    assert_false(tpm2_hex_decode("12 4", 4, data));
+    assert_false(tpm2_hex_decode("\xff" "0", 2, data));
+}
+
+static void test_tpm2_hex_fprint(void **state) {
+    UNUSED(state);
+
+    /* more than the chunk the bytes are encoded in */
+    BYTE data[1000];
+    unsigned i;
+    for (i = 0; i < sizeof(data); i++) {
+        data[i] = i * 7;
+    }
+
+    char *expected = tpm2_hex_encode_alloc(data, sizeof(data), true);
+    assert_non_null(expected);
+
+    char *out = NULL;
+    size_t out_size = 0;
+    FILE *f = open_memstream(&out, &out_size);
+    assert_non_null(f);
+    assert_true(tpm2_hex_fprint(f, data, sizeof(data), true));
+    fclose(f);
+
+    assert_int_equal(out_size, strlen(expected));
+    assert_memory_equal(out, expected, out_size);
+
+    free(out);
+    free(expected);
+}
+
+/* link required symbol, but tpm2_tool.c declares it AND main, which
+ * we have a main below for cmocka tests.
+ */
+bool output_enabled = true;
+
+int main(int argc, char *argv[]) {
+    UNUSED(argc);
+    UNUSED(argv);
+
+    const struct CMUnitTest tests[] = {
+        cmocka_unit_test(test_tpm2_hex_encode),
+        cmocka_unit_test(test_tpm2_hex_encode_every_byte),
+        cmocka_unit_test(test_tpm2_hex_decode),
+        cmocka_unit_test(test_tpm2_hex_fprint),
+    };
+
+    return cmocka_run_group_tests(tests, NULL, NULL);
+}
@@ -0,0 +1,237 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+#include <limits.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#include <setjmp.h>
+#include <cmocka.h>
+
+#include "tpm2_host_cache.h"
+#include "tpm2_util.h"
+
+static char path[PATH_MAX];
+
+static const tpm2_capability_identity identity = {
+    .properties = { 0x49424d00, 0x53572020 },
+};
+
+static int test_group_setup(void **state) {
+    UNUSED(state);
+
+    snprintf(path, sizeof(path), "/tmp/test_tpm2_host_cache.%ld",
+            (long) getpid());
+    unlink(path);
+    setenv(TPM2TOOLS_ENV_HOST_CACHE, path, 1);
+    tpm2_host_cache_set_identity(&identity);
+
+    return 0;
+}
+
+static int test_group_teardown(void **state) {
+    UNUSED(state);
+
+    unlink(path);
+
+    return 0;
+}
+
+static void test_host_cache_reader(void **state) {
+    UNUSED(state);
+
+    /* a reader does not create the cache */
+    UINT8 key[] = { 1, 2, 3 };
+    UINT8 value[TPM2_HOST_CACHE_VALUE_MAX];
+    size_t value_size;
+    bool result = tpm2_host_cache_get(tpm2_host_cache_kind_capability, key,
+            sizeof(key), value, &value_size, NULL);
+    assert_false(result);
+    assert_int_equal(access(path, F_OK), -1);
+
+    tpm2_host_cache_put(tpm2_host_cache_kind_capability, key, sizeof(key),
+            key, sizeof(key), 0, tpm2_host_cache_generation());
+    assert_int_equal(access(path, F_OK), -1);
+}
+
+static void test_host_cache_put_get(void **state) {
+    UNUSED(state);
+
+    tpm2_host_cache_enable_writes();
+
+    UINT8 key[] = { 1, 2, 3 };
+    UINT8 data[100];
+    memset(data, 0xa5, sizeof(data));
+    tpm2_host_cache_put(tpm2_host_cache_kind_pcrs, key, sizeof(key), data,
+            sizeof(data), 42, tpm2_host_cache_generation());
+
+    UINT8 value[TPM2_HOST_CACHE_VALUE_MAX];
+    size_t value_size = 0;
+    UINT32 tag = 0;
+    bool result = tpm2_host_cache_get(tpm2_host_cache_kind_pcrs, key,
+            sizeof(key), value, &value_size, &tag);
+    assert_true(result);
+    assert_int_equal(value_size, sizeof(data));
+    assert_memory_equal(value, data, sizeof(data));
+    assert_int_equal(tag, 42);
+
+    /* only the writer may change the cache */
+    struct stat st;
+    assert_int_equal(stat(path, &st), 0);
+    assert_int_equal(st.st_mode & 0777, 0644);
+
+    /* the kind is part of the key */
+    result = tpm2_host_cache_get(tpm2_host_cache_kind_capability, key,
+            sizeof(key), value, &value_size, NULL);
+    assert_false(result);
+
+    /* a forked tool maps the cache anew and sees the entry */
+    pid_t pid = fork();
+    assert_true(pid >= 0);
+    if (!pid) {
+        result = tpm2_host_cache_get(tpm2_host_cache_kind_pcrs, key,
+                sizeof(key), value, &value_size, &tag);
+        _exit(result && tag == 42 ? 0 : 1);
+    }
+
+    int status;
+    assert_int_equal(waitpid(pid, &status, 0), pid);
+    assert_true(WIFEXITED(status));
+    assert_int_equal(WEXITSTATUS(status), 0);
+}
+
+static void test_host_cache_identity(void **state) {
+    UNUSED(state);
+
+    UINT8 key[] = { 1, 2, 3 };
+    UINT8 value[TPM2_HOST_CACHE_VALUE_MAX];
+    size_t value_size;
+
+    /* the entries of another TPM are not used */
+    tpm2_capability_identity other = identity;
+    other.tcti[0] = 1;
+    tpm2_host_cache_set_identity(&other);
+    bool result = tpm2_host_cache_get(tpm2_host_cache_kind_pcrs, key,
+            sizeof(key), value, &value_size, NULL);
+    assert_false(result);
+
+    tpm2_host_cache_set_identity(&identity);
+    result = tpm2_host_cache_get(tpm2_host_cache_kind_pcrs, key, sizeof(key),
+            value, &value_size, NULL);
+    assert_true(result);
+
+    /* nor a file others could have written */
+    assert_int_equal(chmod(path, 0666), 0);
+    pid_t pid = fork();
+    assert_true(pid >= 0);
+    if (!pid) {
+        result = tpm2_host_cache_get(tpm2_host_cache_kind_pcrs, key,
+                sizeof(key), value, &value_size, NULL);
+        _exit(result ? 1 : 0);
+    }
+
+    int status;
+    assert_int_equal(waitpid(pid, &status, 0), pid);
+    assert_int_equal(chmod(path, 0644), 0);
+    assert_true(WIFEXITED(status));
+    assert_int_equal(WEXITSTATUS(status), 0);
+}
+
+static void test_host_cache_replace(void **state) {
+    UNUSED(state);
+
+    /* more entries than slots push out the oldest */
+    UINT32 i;
+    for (i = 0; i < 100; i++) {
+        tpm2_host_cache_put(tpm2_host_cache_kind_capability, (UINT8 *) &i,
+                sizeof(i), (UINT8 *) &i, sizeof(i), i,
+                tpm2_host_cache_generation());
+    }
+
+    UINT8 value[TPM2_HOST_CACHE_VALUE_MAX];
+    size_t value_size;
+    UINT32 tag;
+    UINT32 first = 0;
+    bool result = tpm2_host_cache_get(tpm2_host_cache_kind_capability,
+            (UINT8 *) &first, sizeof(first), value, &value_size, &tag);
+    assert_false(result);
+
+    UINT32 last = 99;
+    result = tpm2_host_cache_get(tpm2_host_cache_kind_capability,
+            (UINT8 *) &last, sizeof(last), value, &value_size, &tag);
+    assert_true(result);
+    assert_int_equal(tag, 99);
+
+    /* an entry of the key is replaced */
+    UINT8 data[] = { 7 };
+    tpm2_host_cache_put(tpm2_host_cache_kind_capability, (UINT8 *) &last,
+            sizeof(last), data, sizeof(data), 7, tpm2_host_cache_generation());
+    result = tpm2_host_cache_get(tpm2_host_cache_kind_capability,
+            (UINT8 *) &last, sizeof(last), value, &value_size, &tag);
+    assert_true(result);
+    assert_int_equal(value_size, 1);
+    assert_int_equal(value[0], 7);
+    assert_int_equal(tag, 7);
+}
+
+static void test_host_cache_invalidate(void **state) {
+    UNUSED(state);
+
+    UINT8 key[] = { 4, 5, 6 };
+    UINT32 generation = tpm2_host_cache_generation();
+    tpm2_host_cache_put(tpm2_host_cache_kind_capability, key, sizeof(key), key,
+            sizeof(key), 0, generation);
+
+    tpm2_host_cache_invalidate();
+
+    UINT8 value[TPM2_HOST_CACHE_VALUE_MAX];
+    size_t value_size;
+    bool result = tpm2_host_cache_get(tpm2_host_cache_kind_capability, key,
+            sizeof(key), value, &value_size, NULL);
+    assert_false(result);
+
+    /* an answer read before the invalidation is not kept */
+    tpm2_host_cache_put(tpm2_host_cache_kind_capability, key, sizeof(key), key,
+            sizeof(key), 0, generation);
+    result = tpm2_host_cache_get(tpm2_host_cache_kind_capability, key,
+            sizeof(key), value, &value_size, NULL);
+    assert_false(result);
+
+    /* nor one read while the tool ran */
+    generation = tpm2_host_cache_generation();
+    tpm2_host_cache_finish();
+    tpm2_host_cache_put(tpm2_host_cache_kind_capability, key, sizeof(key), key,
+            sizeof(key), 0, generation);
+    result = tpm2_host_cache_get(tpm2_host_cache_kind_capability, key,
+            sizeof(key), value, &value_size, NULL);
+    assert_false(result);
+
+    tpm2_host_cache_put(tpm2_host_cache_kind_capability, key, sizeof(key), key,
+            sizeof(key), 0, tpm2_host_cache_generation());
+    result = tpm2_host_cache_get(tpm2_host_cache_kind_capability, key,
+            sizeof(key), value, &value_size, NULL);
+    assert_true(result);
+}
+
+int main(int argc, char *argv[]) {
+    UNUSED(argc);
+    UNUSED(argv);
+
+    /* the tests share the cache of the process and run in order */
+    const struct CMUnitTest tests[] = {
+        cmocka_unit_test(test_host_cache_reader),
+        cmocka_unit_test(test_host_cache_put_get),
+        cmocka_unit_test(test_host_cache_identity),
+        cmocka_unit_test(test_host_cache_replace),
+        cmocka_unit_test(test_host_cache_invalidate),
+    };
+
+    return cmocka_run_group_tests(tests, test_group_setup,
+            test_group_teardown);
+}
@@ -0,0 +1,210 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <setjmp.h>
+#include <cmocka.h>
+
+#include "tpm2_identity_util.h"
+#include "tpm2_util.h"
+
+#define JOB_COUNT 16
+
+typedef struct test_key test_key;
+struct test_key {
+    TPM2B_PUBLIC public;
+    TPM2B_SENSITIVE sensitive;
+    TPM2B_DATA enc_sensitive_key;
+};
+
+static void test_parent_init(TPM2B_PUBLIC *parent, UINT16 key_bits) {
+
+    memset(parent, 0, sizeof(*parent));
+    parent->publicArea.type = TPM2_ALG_RSA;
+    parent->publicArea.nameAlg = TPM2_ALG_SHA256;
+    parent->publicArea.parameters.rsaDetail.symmetric.algorithm = TPM2_ALG_AES;
+    parent->publicArea.parameters.rsaDetail.symmetric.keyBits.aes = key_bits;
+    parent->publicArea.parameters.rsaDetail.symmetric.mode.aes = TPM2_ALG_CFB;
+    parent->publicArea.parameters.rsaDetail.keyBits = 2048;
+}
+
+/* a keyed hash object with deterministic, per key contents */
+static void test_key_init(test_key *key, unsigned i, bool is_inner) {
+
+    memset(key, 0, sizeof(*key));
+
+    TPMT_PUBLIC *pub = &key->public.publicArea;
+    pub->type = TPM2_ALG_KEYEDHASH;
+    pub->nameAlg = TPM2_ALG_SHA256;
+    pub->objectAttributes = TPMA_OBJECT_USERWITHAUTH;
+    pub->parameters.keyedHashDetail.scheme.scheme = TPM2_ALG_NULL;
+    pub->unique.keyedHash.size = 32;
+    memset(pub->unique.keyedHash.buffer, i, 32);
+
+    TPMT_SENSITIVE *sens = &key->sensitive.sensitiveArea;
+    sens->sensitiveType = TPM2_ALG_KEYEDHASH;
+    sens->seedValue.size = 32;
+    memset(sens->seedValue.buffer, 0x80 + i, 32);
+    sens->sensitive.bits.size = 16;
+    memset(sens->sensitive.bits.buffer, 0x40 + i, 16);
+
+    if (is_inner) {
+        key->enc_sensitive_key.size = 16;
+        memset(key->enc_sensitive_key.buffer, 0xc0 + i, 16);
+    }
+}
+
+static void test_job_init(tpm2_identity_util_wrap_job *job, TPM2B_PUBLIC *parent,
+        test_key *key, bool is_inner) {
+
+    memset(job, 0, sizeof(*job));
+    job->parent_pub = parent;
+    job->public = &key->public;
+    job->sensitive = &key->sensitive;
+    job->enc_sensitive_key = is_inner ? &key->enc_sensitive_key : NULL;
+}
+
+static void test_wrap_batch(bool is_inner) {
+
+    TPM2B_PUBLIC parents[2];
+    test_parent_init(&parents[0], 128);
+    test_parent_init(&parents[1], 256);
+
+    test_key keys[JOB_COUNT];
+    tpm2_identity_util_wrap_job batch[JOB_COUNT];
+    tpm2_identity_util_wrap_job single[JOB_COUNT];
+
+    unsigned i;
+    for (i = 0; i < JOB_COUNT; i++) {
+        test_key_init(&keys[i], i, is_inner);
+        test_job_init(&batch[i], &parents[i % 2], &keys[i], is_inner);
+        test_job_init(&single[i], &parents[i % 2], &keys[i], is_inner);
+    }
+
+    bool result = tpm2_identity_util_wrap_batch(batch, JOB_COUNT, 4);
+    assert_true(result);
+
+    tpm2_identity_util_wrapper *wrapper = tpm2_identity_util_wrapper_new();
+    assert_non_null(wrapper);
+
+    for (i = 0; i < JOB_COUNT; i++) {
+        /* the wrapper is reused, except for every third key */
+        result = tpm2_identity_util_wrap(i % 3 ? wrapper : NULL, &single[i]);
+        assert_true(result);
+        assert_true(batch[i].result);
+
+        /* the size of the outer HMAC, a SHA256 digest, leads the duplicate */
+        assert_true(batch[i].duplicate.size > 2 + 32);
+        assert_int_equal(batch[i].duplicate.buffer[0], 0);
+        assert_int_equal(batch[i].duplicate.buffer[1], 32);
+
+        assert_int_equal(batch[i].duplicate.size, single[i].duplicate.size);
+        assert_memory_equal(batch[i].duplicate.buffer,
+                single[i].duplicate.buffer, single[i].duplicate.size);
+
+        if (i) {
+            assert_memory_not_equal(batch[i].duplicate.buffer,
+                    batch[i - 1].duplicate.buffer, 2 + 32);
+        }
+    }
+
+    tpm2_identity_util_wrapper_free(wrapper);
+}
+
+static void test_tpm2_identity_util_wrap_batch_outer(void **state) {
+    UNUSED(state);
+
+    test_wrap_batch(false);
+}
+
+static void test_tpm2_identity_util_wrap_batch_inner(void **state) {
+    UNUSED(state);
+
+    test_wrap_batch(true);
+}
+
+static void test_tpm2_identity_util_wrap_batch_failure(void **state) {
+    UNUSED(state);
+
+    TPM2B_PUBLIC parent;
+    test_parent_init(&parent, 128);
+
+    /* no AES-192 CFB wrapping for parents */
+    TPM2B_PUBLIC bad_parent;
+    test_parent_init(&bad_parent, 192);
+
+    test_key keys[3];
+    tpm2_identity_util_wrap_job jobs[3];
+    unsigned i;
+    for (i = 0; i < ARRAY_LEN(jobs); i++) {
+        test_key_init(&keys[i], i, false);
+        test_job_init(&jobs[i], i == 1 ? &bad_parent : &parent, &keys[i],
+                false);
+    }
+
+    bool result = tpm2_identity_util_wrap_batch(jobs, ARRAY_LEN(jobs), 0);
+    assert_false(result);
+    assert_true(jobs[0].result);
+    assert_false(jobs[1].result);
+    assert_true(jobs[2].result);
+
+    assert_true(tpm2_identity_util_wrap_batch(jobs, 0, 0));
+}
+
+static void test_tpm2_identity_util_name_batch(void **state) {
+    UNUSED(state);
+
+    tpm2_identity_util_name_job jobs[JOB_COUNT];
+    unsigned i;
+    for (i = 0; i < JOB_COUNT; i++) {
+        test_key key;
+        test_key_init(&key, i, false);
+        jobs[i].public = key.public;
+    }
+
+    /* no name for an unknown name algorithm */
+    jobs[3].public.publicArea.nameAlg = TPM2_ALG_NULL;
+
+    bool result = tpm2_identity_util_name_batch(jobs, JOB_COUNT, 4);
+    assert_false(result);
+
+    /* the same names as computed one at a time */
+    for (i = 0; i < JOB_COUNT; i++) {
+        if (i == 3) {
+            assert_false(jobs[i].result);
+            continue;
+        }
+
+        assert_true(jobs[i].result);
+
+        TPM2B_NAME name = { .size = sizeof(name.name) };
+        assert_true(tpm2_identity_create_name(&jobs[i].public, &name));
+        assert_int_equal(jobs[i].name.size, name.size);
+        assert_memory_equal(jobs[i].name.name, name.name, name.size);
+        assert_int_equal(jobs[i].name.size, 2 + 32);
+    }
+
+    assert_true(tpm2_identity_util_name_batch(jobs, 0, 0));
+}
+
+/* link required symbol, but tpm2_tool.c declares it AND main, which
+ * we have a main below for cmocka tests.
+ */
+bool output_enabled = true;
+
+int main(int argc, char *argv[]) {
+    UNUSED(argc);
+    UNUSED(argv);
+
+    const struct CMUnitTest tests[] = {
+        cmocka_unit_test(test_tpm2_identity_util_wrap_batch_outer),
+        cmocka_unit_test(test_tpm2_identity_util_wrap_batch_inner),
+        cmocka_unit_test(test_tpm2_identity_util_wrap_batch_failure),
+        cmocka_unit_test(test_tpm2_identity_util_name_batch),
+    };
+
+    return cmocka_run_group_tests(tests, NULL, NULL);
+}
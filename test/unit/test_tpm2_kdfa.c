@@ -0,0 +1,113 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <setjmp.h>
+#include <cmocka.h>
+
+#include "tpm2_hex.h"
+#include "tpm2_kdfa.h"
+#include "tpm2_util.h"
+
+static TPM2B_DIGEST key = {
+    .size = 20,
+    .buffer = "0123456789abcdefghij",
+};
+
+static TPM2B_DIGEST context_u = {
+    .size = 3,
+    .buffer = "abc",
+};
+
+static TPM2B_DIGEST context_v = TPM2B_EMPTY_INIT;
+
+static void assert_key(TPM2B_MAX_BUFFER *result, const char *expected) {
+
+    size_t len = strlen(expected);
+    BYTE bytes[len / 2];
+    assert_true(tpm2_hex_decode(expected, len, bytes));
+
+    assert_int_equal(result->size, len / 2);
+    assert_memory_equal(result->buffer, bytes, len / 2);
+}
+
+static void test_tpm2_kdfa_blocks(void **state) {
+    UNUSED(state);
+
+    /* more bits than one SHA1 HMAC holds take several counter values */
+    static const char *expected[] = {
+        "e6a535f19b7ec2520f53d0871ba33595",
+        "29e87b58e24f175c829d92a5aaab4d554fe8c15be81251894c2e4d6e6ddced9b",
+        "c4359d16efaa4fe92e50bbe8b3588c8e989d8b3be75efa7ff2f27fbbb29210d3"
+        "af667f98642e2ae1b2196182c367153c",
+        "07db0f3e27fee7d7722abfaa6493738ee3d433edc63eea959fc70370d5d2fd1e"
+        "06cf920d1b8e9dd3d3bfa6ef071226b39e376154452fc99be1f460f8f7288a43",
+    };
+
+    tpm2_kdfa_ctx *ctx = tpm2_kdfa_ctx_new();
+    assert_non_null(ctx);
+
+    TSS2_RC rval = tpm2_kdfa_ctx_init(ctx, TPM2_ALG_SHA1, (TPM2B *) &key);
+    assert_int_equal(rval, TPM2_RC_SUCCESS);
+
+    /* the keyed context derives any number of keys */
+    size_t i;
+    for (i = 0; i < ARRAY_LEN(expected); i++) {
+        TPM2B_MAX_BUFFER result;
+        rval = tpm2_kdfa_ctx_derive(ctx, "STORAGE", (TPM2B *) &context_u,
+                (TPM2B *) &context_v, (i + 1) * 128, &result);
+        assert_int_equal(rval, TPM2_RC_SUCCESS);
+        assert_key(&result, expected[i]);
+    }
+
+    tpm2_kdfa_ctx_free(ctx);
+}
+
+static void test_tpm2_kdfa_single(void **state) {
+    UNUSED(state);
+
+    TPM2B_MAX_BUFFER result;
+    TSS2_RC rval = tpm2_kdfa(TPM2_ALG_SHA256, (TPM2B *) &key, "INTEGRITY",
+            (TPM2B *) &context_v, (TPM2B *) &context_v, 256, &result);
+    assert_int_equal(rval, TPM2_RC_SUCCESS);
+    assert_key(&result,
+            "15bebbaf3ec500a3bd45ff192c17fabf5070ae7ef22fe0fb887f940693916389");
+}
+
+static void test_tpm2_kdfa_errors(void **state) {
+    UNUSED(state);
+
+    tpm2_kdfa_ctx *ctx = tpm2_kdfa_ctx_new();
+    assert_non_null(ctx);
+
+    TPM2B_MAX_BUFFER result;
+    TSS2_RC rval = tpm2_kdfa_ctx_derive(ctx, "STORAGE", (TPM2B *) &context_u,
+            (TPM2B *) &context_v, 128, &result);
+    assert_int_not_equal(rval, TPM2_RC_SUCCESS);
+
+    rval = tpm2_kdfa_ctx_init(ctx, TPM2_ALG_NULL, (TPM2B *) &key);
+    assert_int_equal(rval, TPM2_RC_HASH);
+
+    tpm2_kdfa_ctx_free(ctx);
+}
+
+/* link required symbol, but tpm2_tool.c declares it AND main, which
+ * we have a main below for cmocka tests.
+ */
+bool output_enabled = true;
+
+int main(int argc, char *argv[]) {
+    UNUSED(argc);
+    UNUSED(argv);
+
+    const struct CMUnitTest tests[] = {
+        cmocka_unit_test(test_tpm2_kdfa_blocks),
+        cmocka_unit_test(test_tpm2_kdfa_single),
+        cmocka_unit_test(test_tpm2_kdfa_errors),
+    };
+
+    return cmocka_run_group_tests(tests, NULL, NULL);
+}
@@ -0,0 +1,302 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+#include <limits.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <sys/stat.h>
+
+#include <setjmp.h>
+#include <cmocka.h>
+
+#include "tpm2_name_cache.h"
+#include "tpm2_util.h"
+
+typedef struct test_cache test_cache;
+struct test_cache {
+    char dir[PATH_MAX];
+};
+
+static const tpm2_capability_identity identity = {
+    .properties = { 0x49424d00, 0x53572020 },
+};
+
+static int test_setup(void **state) {
+
+    test_cache *t = calloc(1, sizeof(*t));
+    assert_non_null(t);
+
+    strcpy(t->dir, "/tmp/test_tpm2_name_cache.XXXXXX");
+    assert_non_null(mkdtemp(t->dir));
+    /* the directory is created by the first write */
+    rmdir(t->dir);
+
+    tpm2_name_cache_set_identity(&identity);
+
+    *state = t;
+
+    return 0;
+}
+
+static int test_teardown(void **state) {
+
+    test_cache *t = (test_cache *) *state;
+    tpm2_name_cache_remove_type(t->dir, TPM2_HT_PERSISTENT);
+    tpm2_name_cache_remove_type(t->dir, TPM2_HT_NV_INDEX);
+    rmdir(t->dir);
+    free(t);
+
+    return 0;
+}
+
+static void nv_public_init(TPM2B_NV_PUBLIC *nv_public, TPM2_HANDLE handle) {
+
+    memset(nv_public, 0, sizeof(*nv_public));
+    nv_public->nvPublic.nvIndex = handle;
+    nv_public->nvPublic.nameAlg = TPM2_ALG_SHA256;
+    nv_public->nvPublic.attributes = TPMA_NV_OWNERWRITE | TPMA_NV_OWNERREAD
+            | TPMA_NV_WRITTEN;
+    nv_public->nvPublic.dataSize = 32;
+    /* the size of the marshaled TPMS_NV_PUBLIC without authPolicy */
+    nv_public->size = 14;
+}
+
+static void test_name_cache_object(void **state) {
+
+    test_cache *t = (test_cache *) *state;
+
+    UINT8 tr[64];
+    memset(tr, 0x5a, sizeof(tr));
+    bool result = tpm2_name_cache_write(t->dir, 0x81000001, tr, sizeof(tr),
+            NULL);
+    assert_true(result);
+
+    UINT8 got[TPM2_NAME_CACHE_TR_MAX];
+    size_t got_size = 0;
+    TPM2B_NV_PUBLIC nv_public = { .size = 1 };
+    result = tpm2_name_cache_read(t->dir, 0x81000001, got, &got_size,
+            &nv_public);
+    assert_true(result);
+    assert_int_equal(got_size, sizeof(tr));
+    assert_memory_equal(got, tr, sizeof(tr));
+    assert_int_equal(nv_public.size, 0);
+
+    /* another handle */
+    result = tpm2_name_cache_read(t->dir, 0x81000002, got, &got_size,
+            &nv_public);
+    assert_false(result);
+}
+
+static void test_name_cache_nv_index(void **state) {
+
+    test_cache *t = (test_cache *) *state;
+
+    UINT8 tr[32];
+    memset(tr, 0xa5, sizeof(tr));
+    TPM2B_NV_PUBLIC nv_public;
+    nv_public_init(&nv_public, 0x01000001);
+    bool result = tpm2_name_cache_write(t->dir, 0x01000001, tr, sizeof(tr),
+            &nv_public);
+    assert_true(result);
+
+    UINT8 got[TPM2_NAME_CACHE_TR_MAX];
+    size_t got_size = 0;
+    TPM2B_NV_PUBLIC got_public = { 0 };
+    result = tpm2_name_cache_read(t->dir, 0x01000001, got, &got_size,
+            &got_public);
+    assert_true(result);
+    assert_int_equal(got_size, sizeof(tr));
+    assert_memory_equal(got, tr, sizeof(tr));
+    assert_int_equal(got_public.nvPublic.nvIndex, 0x01000001);
+    assert_int_equal(got_public.nvPublic.attributes,
+            nv_public.nvPublic.attributes);
+    assert_int_equal(got_public.nvPublic.dataSize, 32);
+}
+
+static void test_name_cache_remove(void **state) {
+
+    test_cache *t = (test_cache *) *state;
+
+    UINT8 tr[16] = { 0 };
+    TPM2B_NV_PUBLIC nv_public;
+    nv_public_init(&nv_public, 0x01000001);
+    assert_true(tpm2_name_cache_write(t->dir, 0x81000001, tr, sizeof(tr),
+            NULL));
+    assert_true(tpm2_name_cache_write(t->dir, 0x81000002, tr, sizeof(tr),
+            NULL));
+    assert_true(tpm2_name_cache_write(t->dir, 0x01000001, tr, sizeof(tr),
+            &nv_public));
+
+    UINT8 got[TPM2_NAME_CACHE_TR_MAX];
+    size_t got_size = 0;
+    TPM2B_NV_PUBLIC got_public;
+
+    tpm2_name_cache_remove(t->dir, 0x81000001);
+    assert_false(tpm2_name_cache_read(t->dir, 0x81000001, got, &got_size,
+            &got_public));
+    assert_true(tpm2_name_cache_read(t->dir, 0x81000002, got, &got_size,
+            &got_public));
+
+    /* dropping the indices keeps the objects */
+    tpm2_name_cache_remove_type(t->dir, TPM2_HT_NV_INDEX);
+    assert_false(tpm2_name_cache_read(t->dir, 0x01000001, got, &got_size,
+            &got_public));
+    assert_true(tpm2_name_cache_read(t->dir, 0x81000002, got, &got_size,
+            &got_public));
+
+    /* removing a missing entry is fine */
+    tpm2_name_cache_remove(t->dir, 0x81000001);
+}
+
+static void test_name_cache_damaged(void **state) {
+
+    test_cache *t = (test_cache *) *state;
+
+    UINT8 tr[16] = { 0 };
+    assert_true(tpm2_name_cache_write(t->dir, 0x81000001, tr, sizeof(tr),
+            NULL));
+
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s/81000001", t->dir);
+    FILE *f = fopen(path, "wb");
+    assert_non_null(f);
+    fputs("not a name cache entry", f);
+    fclose(f);
+
+    UINT8 got[TPM2_NAME_CACHE_TR_MAX];
+    size_t got_size = 0;
+    TPM2B_NV_PUBLIC got_public;
+    bool result = tpm2_name_cache_read(t->dir, 0x81000001, got, &got_size,
+            &got_public);
+    assert_false(result);
+
+    /* the damaged entry is dropped */
+    assert_int_equal(access(path, F_OK), -1);
+}
+
+static void test_name_cache_identity(void **state) {
+
+    test_cache *t = (test_cache *) *state;
+
+    UINT8 tr[16] = { 0 };
+    assert_true(tpm2_name_cache_write(t->dir, 0x81000001, tr, sizeof(tr),
+            NULL));
+
+    /* the entries of another TPM are not used */
+    tpm2_capability_identity other = identity;
+    other.properties[0] ^= 1;
+    tpm2_name_cache_set_identity(&other);
+
+    UINT8 got[TPM2_NAME_CACHE_TR_MAX];
+    size_t got_size = 0;
+    TPM2B_NV_PUBLIC got_public;
+    assert_false(tpm2_name_cache_read(t->dir, 0x81000001, got, &got_size,
+            &got_public));
+
+    tpm2_name_cache_set_identity(&identity);
+}
+
+static void test_name_cache_private(void **state) {
+
+    test_cache *t = (test_cache *) *state;
+
+    /* the first write creates the directory for this user only */
+    UINT8 tr[16] = { 0 };
+    assert_true(tpm2_name_cache_write(t->dir, 0x81000001, tr, sizeof(tr),
+            NULL));
+    struct stat st;
+    assert_int_equal(stat(t->dir, &st), 0);
+    assert_int_equal(st.st_mode & 0777, 0700);
+
+    /* a directory others can access is not used */
+    char dir[PATH_MAX];
+    strcpy(dir, "/tmp/test_tpm2_name_cache.XXXXXX");
+    assert_non_null(mkdtemp(dir));
+    assert_int_equal(chmod(dir, 0755), 0);
+
+    assert_false(tpm2_name_cache_write(dir, 0x81000001, tr, sizeof(tr),
+            NULL));
+
+    UINT8 got[TPM2_NAME_CACHE_TR_MAX];
+    size_t got_size = 0;
+    TPM2B_NV_PUBLIC got_public;
+    assert_false(tpm2_name_cache_read(dir, 0x81000001, got, &got_size,
+            &got_public));
+    assert_int_equal(rmdir(dir), 0);
+}
+
+static void test_name_cache_snapshot(void **state) {
+
+    test_cache *t = (test_cache *) *state;
+
+    UINT8 tr[16];
+    memset(tr, 0x3c, sizeof(tr));
+    TPM2B_NV_PUBLIC nv_public;
+    nv_public_init(&nv_public, 0x01000001);
+    assert_true(tpm2_name_cache_write(t->dir, 0x81000001, tr, sizeof(tr),
+            NULL));
+    assert_true(tpm2_name_cache_write(t->dir, 0x01000001, tr, sizeof(tr),
+            &nv_public));
+    assert_true(tpm2_name_cache_snapshot_write(t->dir));
+
+    /* the snapshot answers without the entries */
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s/01000001", t->dir);
+    assert_int_equal(unlink(path), 0);
+
+    UINT8 got[TPM2_NAME_CACHE_TR_MAX];
+    size_t got_size = 0;
+    TPM2B_NV_PUBLIC got_public = { 0 };
+    assert_true(tpm2_name_cache_snapshot_read(t->dir, 0x01000001, got,
+            &got_size, &got_public));
+    assert_int_equal(got_size, sizeof(tr));
+    assert_memory_equal(got, tr, sizeof(tr));
+    assert_int_equal(got_public.nvPublic.nvIndex, 0x01000001);
+
+    assert_true(tpm2_name_cache_snapshot_read(t->dir, 0x81000001, got,
+            &got_size, &got_public));
+    assert_int_equal(got_public.size, 0);
+
+    assert_false(tpm2_name_cache_snapshot_read(t->dir, 0x81000002, got,
+            &got_size, &got_public));
+
+    /* dropping an entry drops the snapshot */
+    tpm2_name_cache_remove(t->dir, 0x81000001);
+    assert_false(tpm2_name_cache_snapshot_read(t->dir, 0x01000001, got,
+            &got_size, &got_public));
+    snprintf(path, sizeof(path), "%s/snapshot", t->dir);
+    assert_int_equal(access(path, F_OK), -1);
+}
+
+/* link required symbol, but tpm2_tool.c declares it AND main, which
+ * we have a main below for cmocka tests.
+ */
+bool output_enabled = true;
+
+int main(int argc, char *argv[]) {
+    UNUSED(argc);
+    UNUSED(argv);
+
+    const struct CMUnitTest tests[] = {
+        cmocka_unit_test_setup_teardown(test_name_cache_object,
+                test_setup, test_teardown),
+        cmocka_unit_test_setup_teardown(test_name_cache_nv_index,
+                test_setup, test_teardown),
+        cmocka_unit_test_setup_teardown(test_name_cache_remove,
+                test_setup, test_teardown),
+        cmocka_unit_test_setup_teardown(test_name_cache_damaged,
+                test_setup, test_teardown),
+        cmocka_unit_test_setup_teardown(test_name_cache_identity,
+                test_setup, test_teardown),
+        cmocka_unit_test_setup_teardown(test_name_cache_private,
+                test_setup, test_teardown),
+        cmocka_unit_test_setup_teardown(test_name_cache_snapshot,
+                test_setup, test_teardown),
+    };
+
+    return cmocka_run_group_tests(tests, NULL, NULL);
+}
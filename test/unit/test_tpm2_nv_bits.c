@@ -0,0 +1,144 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdlib.h>
+
+#include <setjmp.h>
+#include <cmocka.h>
+
+#include "tpm2_nv_bits.h"
+#include "tpm2_util.h"
+
+#define NV_INDEX 0x01500018
+
+static int test_setup(void **state) {
+    UNUSED(state);
+
+    assert_int_equal(tpm2_nv_bits_init(), tool_rc_success);
+
+    return 0;
+}
+
+static int test_teardown(void **state) {
+    UNUSED(state);
+
+    /* nothing is pending, so there is no NV_SetBits to send */
+    tpm2_nv_bits_drop(NV_INDEX);
+    tpm2_nv_bits_drop(NV_INDEX + 1);
+    tpm2_nv_bits_free(NULL);
+    assert_false(tpm2_nv_bits_is_enabled());
+
+    return 0;
+}
+
+static void test_nv_bits_merge(void **state) {
+    UNUSED(state);
+
+    /* an authorization the TPM did not accept yet is not queued */
+    bool is_queued = true;
+    assert_true(tpm2_nv_bits_add(NV_INDEX, TPM2_RH_OWNER, "str:owner", 0x1,
+            &is_queued));
+    assert_false(is_queued);
+
+    assert_true(tpm2_nv_bits_verified(NV_INDEX, TPM2_RH_OWNER, "str:owner"));
+    assert_true(tpm2_nv_bits_add(NV_INDEX, TPM2_RH_OWNER, "str:owner", 0x1,
+            &is_queued));
+    assert_true(is_queued);
+    assert_true(tpm2_nv_bits_add(NV_INDEX, TPM2_RH_OWNER, "str:owner", 0x10,
+            &is_queued));
+    assert_true(is_queued);
+
+    /* nor is another one, which does not replace the accepted one */
+    assert_true(tpm2_nv_bits_add(NV_INDEX, TPM2_RH_OWNER, "str:wrong", 0x20,
+            &is_queued));
+    assert_false(is_queued);
+    assert_true(tpm2_nv_bits_add(NV_INDEX, TPM2_RH_PLATFORM, "str:owner", 0x20,
+            &is_queued));
+    assert_false(is_queued);
+
+    /* pending bits alone are not the value of the index */
+    UINT64 value = 0;
+    assert_false(tpm2_nv_bits_read(NV_INDEX, &value));
+
+    /* the value read from the TPM sees the deferred bits */
+    value = 0x100;
+    assert_true(tpm2_nv_bits_shadow(NV_INDEX, &value));
+    assert_int_equal(value, 0x111);
+
+    value = 0;
+    assert_true(tpm2_nv_bits_read(NV_INDEX, &value));
+    assert_int_equal(value, 0x111);
+
+    /* the indices are kept apart */
+    assert_false(tpm2_nv_bits_read(NV_INDEX + 1, &value));
+    assert_true(tpm2_nv_bits_add(NV_INDEX + 1, TPM2_RH_OWNER, "str:owner",
+            0x1, &is_queued));
+    assert_false(is_queued);
+}
+
+static void test_nv_bits_set(void **state) {
+    UNUSED(state);
+
+    /* without a shadow there is nothing to keep in line */
+    assert_true(tpm2_nv_bits_set(NV_INDEX, 0x2));
+    UINT64 value = 0;
+    assert_false(tpm2_nv_bits_read(NV_INDEX, &value));
+
+    value = 0x1;
+    assert_true(tpm2_nv_bits_shadow(NV_INDEX, &value));
+    assert_true(tpm2_nv_bits_set(NV_INDEX, 0x4));
+
+    assert_true(tpm2_nv_bits_read(NV_INDEX, &value));
+    assert_int_equal(value, 0x5);
+}
+
+static void test_nv_bits_drop(void **state) {
+    UNUSED(state);
+
+    UINT64 value = 0x8;
+    assert_true(tpm2_nv_bits_shadow(NV_INDEX + 1, &value));
+    assert_true(tpm2_nv_bits_read(NV_INDEX + 1, &value));
+
+    tpm2_nv_bits_drop(NV_INDEX + 1);
+    assert_false(tpm2_nv_bits_read(NV_INDEX + 1, &value));
+}
+
+static void test_nv_bits_disabled(void **state) {
+    UNUSED(state);
+
+    assert_false(tpm2_nv_bits_is_enabled());
+    bool is_queued = true;
+    assert_false(tpm2_nv_bits_add(NV_INDEX, TPM2_RH_OWNER, NULL, 0x1,
+            &is_queued));
+    assert_false(is_queued);
+
+    UINT64 value = 0x1;
+    assert_false(tpm2_nv_bits_read(NV_INDEX, &value));
+    /* the tools work as without the daemon */
+    assert_true(tpm2_nv_bits_set(NV_INDEX, 0x1));
+    assert_true(tpm2_nv_bits_shadow(NV_INDEX, &value));
+    assert_int_equal(value, 0x1);
+}
+
+/* link required symbol, but tpm2_tool.c declares it AND main, which
+ * we have a main below for cmocka tests.
+ */
+bool output_enabled = true;
+
+int main(int argc, char *argv[]) {
+    UNUSED(argc);
+    UNUSED(argv);
+
+    const struct CMUnitTest tests[] = {
+        cmocka_unit_test_setup_teardown(test_nv_bits_merge,
+                test_setup, test_teardown),
+        cmocka_unit_test_setup_teardown(test_nv_bits_set,
+                test_setup, test_teardown),
+        cmocka_unit_test_setup_teardown(test_nv_bits_drop,
+                test_setup, test_teardown),
+        cmocka_unit_test(test_nv_bits_disabled),
+    };
+
+    return cmocka_run_group_tests(tests, NULL, NULL);
+}
@@ -0,0 +1,102 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <setjmp.h>
+#include <cmocka.h>
+
+#include "tpm2_nv_layout.h"
+#include "tpm2_util.h"
+
+static bool add(tpm2_nv_layout *layout, const char *line, size_t line_number) {
+
+    char *copy = strdup(line);
+    assert_non_null(copy);
+
+    return tpm2_nv_layout_add(layout, copy, line_number);
+}
+
+static void test_tpm2_nv_layout_entries(void **state) {
+    UNUSED(state);
+
+    tpm2_nv_layout layout = { .path = "test" };
+
+    assert_true(add(&layout, "# a comment\n", 1));
+    assert_true(add(&layout, "   \n", 2));
+    assert_true(add(&layout, "0x1500016 32 ownerread|ownerwrite\n", 3));
+    assert_true(add(&layout, "0x1500017 - 0x2000A policy.dat pass # pin\n", 4));
+    assert_true(add(&layout, "0x1500018 - - -\n", 5));
+    assert_int_equal(layout.count, 3);
+
+    tpm2_nv_layout_entry *entry = &layout.entries[0];
+    assert_int_equal(entry->line_number, 3);
+    assert_int_equal(entry->index, 0x1500016);
+    assert_true(entry->is_size_set);
+    assert_int_equal(entry->size, 32);
+    assert_true(entry->is_attributes_set);
+    assert_int_equal(entry->attributes,
+            TPMA_NV_OWNERREAD | TPMA_NV_OWNERWRITE);
+    assert_null(entry->policy_path);
+    assert_null(entry->auth_str);
+
+    entry = &layout.entries[1];
+    assert_false(entry->is_size_set);
+    assert_true(entry->is_attributes_set);
+    assert_int_equal(entry->attributes, 0x2000A);
+    assert_string_equal(entry->policy_path, "policy.dat");
+    assert_string_equal(entry->auth_str, "pass");
+
+    entry = &layout.entries[2];
+    assert_false(entry->is_size_set);
+    assert_false(entry->is_attributes_set);
+    assert_null(entry->policy_path);
+
+    tpm2_nv_layout_free(&layout);
+    assert_int_equal(layout.count, 0);
+}
+
+static void test_tpm2_nv_layout_bad_lines(void **state) {
+    UNUSED(state);
+
+    tpm2_nv_layout layout = { .path = "test" };
+
+    assert_false(add(&layout, "0x1500016 32\n", 1));
+    assert_false(add(&layout, "0x1500016 32 ownerread - - extra\n", 2));
+    assert_false(add(&layout, "0x81000000 32 ownerread\n", 3));
+    assert_false(add(&layout, "0x1500016 big ownerread\n", 4));
+    assert_false(add(&layout, "0x1500016 32 notanattribute\n", 5));
+
+    tpm2_nv_layout_free(&layout);
+}
+
+static void test_tpm2_nv_layout_duplicate(void **state) {
+    UNUSED(state);
+
+    tpm2_nv_layout layout = { .path = "test" };
+
+    assert_true(add(&layout, "0x1500016 32 ownerread\n", 1));
+    assert_false(add(&layout, "0x1500016 8 ownerread\n", 2));
+
+    tpm2_nv_layout_free(&layout);
+}
+
+/* link required symbol, but tpm2_tool.c declares it AND main, which
+ * we have a main below for cmocka tests.
+ */
+bool output_enabled = true;
+
+int main(int argc, char *argv[]) {
+    UNUSED(argc);
+    UNUSED(argv);
+
+    const struct CMUnitTest tests[] = {
+        cmocka_unit_test(test_tpm2_nv_layout_entries),
+        cmocka_unit_test(test_tpm2_nv_layout_bad_lines),
+        cmocka_unit_test(test_tpm2_nv_layout_duplicate),
+    };
+
+    return cmocka_run_group_tests(tests, NULL, NULL);
+}
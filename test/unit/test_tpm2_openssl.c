@@ -0,0 +1,146 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <setjmp.h>
+#include <cmocka.h>
+
+#include "tpm2_openssl.h"
+#include "tpm2_util.h"
+
+static void test_tpm2_openssl_halg_from_tpmhalg(void **state) {
+    UNUSED(state);
+
+    static const struct {
+        TPMI_ALG_HASH halg;
+        int size;
+    } algs[] = {
+        { TPM2_ALG_SHA1, TPM2_SHA1_DIGEST_SIZE },
+        { TPM2_ALG_SHA256, TPM2_SHA256_DIGEST_SIZE },
+        { TPM2_ALG_SHA384, TPM2_SHA384_DIGEST_SIZE },
+        { TPM2_ALG_SHA512, TPM2_SHA512_DIGEST_SIZE },
+    };
+
+    size_t i;
+    for (i = 0; i < ARRAY_LEN(algs); i++) {
+        const EVP_MD *md = tpm2_openssl_halg_from_tpmhalg(algs[i].halg);
+        assert_non_null(md);
+        assert_int_equal(EVP_MD_size(md), algs[i].size);
+
+        /* looked up once */
+        assert_ptr_equal(md, tpm2_openssl_halg_from_tpmhalg(algs[i].halg));
+    }
+
+    assert_null(tpm2_openssl_halg_from_tpmhalg(TPM2_ALG_NULL));
+    assert_null(tpm2_openssl_halg_from_tpmhalg(TPM2_ALG_SM3_256));
+    assert_null(tpm2_openssl_halg_from_tpmhalg(TPM2_ALG_ERROR));
+}
+
+static void test_tpm2_openssl_aes_cfb_from_key_bits(void **state) {
+    UNUSED(state);
+
+    UINT16 key_bits[] = { 128, 192, 256 };
+    size_t i;
+    for (i = 0; i < ARRAY_LEN(key_bits); i++) {
+        const EVP_CIPHER *cipher = tpm2_openssl_aes_cfb_from_key_bits(
+                key_bits[i]);
+        assert_non_null(cipher);
+        assert_int_equal(EVP_CIPHER_key_length(cipher), key_bits[i] / 8);
+    }
+
+    assert_null(tpm2_openssl_aes_cfb_from_key_bits(0));
+    assert_null(tpm2_openssl_aes_cfb_from_key_bits(64));
+    assert_null(tpm2_openssl_aes_cfb_from_key_bits(100));
+    assert_null(tpm2_openssl_aes_cfb_from_key_bits(512));
+}
+
+static void test_tpm2_openssl_md_ctx_pool(void **state) {
+    UNUSED(state);
+
+    EVP_MD_CTX *first = tpm2_openssl_md_ctx_get();
+    assert_non_null(first);
+    tpm2_openssl_md_ctx_put(first);
+
+    /* the context is reused */
+    EVP_MD_CTX *second = tpm2_openssl_md_ctx_get();
+    assert_ptr_equal(first, second);
+
+    EVP_MD_CTX *third = tpm2_openssl_md_ctx_get();
+    assert_non_null(third);
+    assert_ptr_not_equal(second, third);
+
+    tpm2_openssl_md_ctx_put(second);
+    tpm2_openssl_md_ctx_put(third);
+    tpm2_openssl_md_ctx_put(NULL);
+}
+
+static void test_tpm2_openssl_pcr_extend(void **state) {
+    UNUSED(state);
+
+    TPM2B_DIGEST digest = TPM2B_EMPTY_INIT;
+    bool result = tpm2_openssl_hash_compute_data(TPM2_ALG_SHA256,
+            (BYTE *) "abc", 3, &digest);
+    assert_true(result);
+    assert_int_equal(digest.size, TPM2_SHA256_DIGEST_SIZE);
+
+    BYTE pcr[TPM2_SHA256_DIGEST_SIZE] = { 0 };
+    result = tpm2_openssl_pcr_extend(TPM2_ALG_SHA256, pcr, digest.buffer,
+            digest.size);
+    assert_true(result);
+
+    static const BYTE expected[] = {
+        0x58, 0x9f, 0x9f, 0xfe, 0xd4, 0xc4, 0x77, 0x96, 0x6b, 0xfb, 0x8d,
+        0x41, 0xf3, 0x78, 0x95, 0xb0, 0x8c, 0x69, 0x04, 0x7d, 0xf8, 0xf9,
+        0x11, 0xd6, 0xf3, 0xb5, 0x7f, 0xbe, 0x08, 0xfa, 0xee, 0x8d
+    };
+    assert_memory_equal(pcr, expected, sizeof(expected));
+
+    assert_false(tpm2_openssl_pcr_extend(TPM2_ALG_NULL, pcr, digest.buffer,
+            digest.size));
+}
+
+static void test_tpm2_openssl_hash_pcr_values(void **state) {
+    UNUSED(state);
+
+    TPML_DIGEST digests = { .count = 2 };
+    digests.digests[0].size = TPM2_SHA1_DIGEST_SIZE;
+    memset(digests.digests[0].buffer, 1, TPM2_SHA1_DIGEST_SIZE);
+    digests.digests[1].size = TPM2_SHA1_DIGEST_SIZE;
+    memset(digests.digests[1].buffer, 2, TPM2_SHA1_DIGEST_SIZE);
+
+    /* the digest has the size of the algorithm, not of SHA256 */
+    TPM2B_DIGEST digest = TPM2B_EMPTY_INIT;
+    bool result = tpm2_openssl_hash_pcr_values(TPM2_ALG_SHA1, &digests,
+            &digest);
+    assert_true(result);
+
+    static const BYTE expected[] = {
+        0xb2, 0x68, 0x45, 0x96, 0x3c, 0x2b, 0x15, 0xcb, 0x3a, 0x2f, 0x97,
+        0xba, 0x8e, 0x86, 0x5c, 0x50, 0x8a, 0xb2, 0x56, 0x9b
+    };
+    assert_int_equal(digest.size, sizeof(expected));
+    assert_memory_equal(digest.buffer, expected, sizeof(expected));
+}
+
+/* link required symbol, but tpm2_tool.c declares it AND main, which
+ * we have a main below for cmocka tests.
+ */
+bool output_enabled = true;
+
+int main(int argc, char *argv[]) {
+    UNUSED(argc);
+    UNUSED(argv);
+
+    const struct CMUnitTest tests[] = {
+        cmocka_unit_test(test_tpm2_openssl_halg_from_tpmhalg),
+        cmocka_unit_test(test_tpm2_openssl_aes_cfb_from_key_bits),
+        cmocka_unit_test(test_tpm2_openssl_md_ctx_pool),
+        cmocka_unit_test(test_tpm2_openssl_pcr_extend),
+        cmocka_unit_test(test_tpm2_openssl_hash_pcr_values),
+    };
+
+    return cmocka_run_group_tests(tests, NULL, NULL);
+}
@@ -0,0 +1,215 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <setjmp.h>
+#include <cmocka.h>
+
+#include "tpm2_pipeline.h"
+#include "tpm2_util.h"
+
+/*
+ * A pipeline of count commands that records the order its steps run in, a
+ * letter per step and the number of the command it is for.
+ */
+typedef struct test_pipeline test_pipeline;
+struct test_pipeline {
+    unsigned count;
+    unsigned prepared;
+    unsigned sent;
+    unsigned finished;
+    unsigned completed;
+    bool is_response;
+    /* the step and command to fail at, 0 for none */
+    char fail_step;
+    unsigned fail_at;
+    /* a command whose response calls for one more */
+    unsigned extend_at;
+    unsigned discarded;
+    char log[256];
+};
+
+static void log_step(test_pipeline *t, char step, unsigned command) {
+
+    size_t len = strlen(t->log);
+    snprintf(&t->log[len], sizeof(t->log) - len, "%c%u ", step, command);
+}
+
+static tool_rc step_rc(test_pipeline *t, char step, unsigned command) {
+
+    log_step(t, step, command);
+
+    return t->fail_step == step && t->fail_at == command ?
+            tool_rc_general_error : tool_rc_success;
+}
+
+static tool_rc test_prepare(void *userdata, bool *is_next) {
+
+    test_pipeline *t = (test_pipeline *) userdata;
+
+    *is_next = t->prepared < t->count;
+    if (!*is_next || t->prepared > t->sent) {
+        return tool_rc_success;
+    }
+
+    t->prepared++;
+
+    return step_rc(t, 'p', t->prepared);
+}
+
+static tool_rc test_submit(ESYS_CONTEXT *ectx, void *userdata) {
+
+    UNUSED(ectx);
+
+    test_pipeline *t = (test_pipeline *) userdata;
+    assert_int_equal(t->sent, t->finished);
+
+    t->sent++;
+
+    return step_rc(t, 's', t->sent);
+}
+
+static tool_rc test_finish(ESYS_CONTEXT *ectx, void *userdata) {
+
+    UNUSED(ectx);
+
+    test_pipeline *t = (test_pipeline *) userdata;
+    assert_int_equal(t->finished + 1, t->sent);
+    assert_false(t->is_response);
+
+    t->finished++;
+    if (t->finished == t->extend_at) {
+        t->count++;
+    }
+
+    tool_rc rc = step_rc(t, 'f', t->finished);
+    t->is_response = rc == tool_rc_success;
+
+    return rc;
+}
+
+static tool_rc test_complete(void *userdata) {
+
+    test_pipeline *t = (test_pipeline *) userdata;
+    assert_true(t->is_response);
+
+    t->is_response = false;
+    t->completed++;
+
+    return step_rc(t, 'c', t->completed);
+}
+
+static void test_discard(void *userdata) {
+
+    test_pipeline *t = (test_pipeline *) userdata;
+    assert_true(t->is_response);
+
+    t->is_response = false;
+    t->discarded++;
+}
+
+static const tpm2_pipeline_ops test_ops = {
+    .prepare = test_prepare,
+    .submit = test_submit,
+    .finish = test_finish,
+    .complete = test_complete,
+    .discard = test_discard,
+};
+
+static void test_pipeline_order(void **state) {
+    UNUSED(state);
+
+    test_pipeline t = { .count = 3 };
+    tool_rc rc = tpm2_pipeline_run(NULL, &test_ops, &t);
+    assert_int_equal(rc, tool_rc_success);
+
+    /* the next command is sent before the last response is completed */
+    assert_string_equal(t.log, "p1 s1 p2 f1 s2 c1 p3 f2 s3 c2 f3 c3 ");
+    assert_false(t.is_response);
+}
+
+static void test_pipeline_empty(void **state) {
+    UNUSED(state);
+
+    test_pipeline t = { .count = 0 };
+    tool_rc rc = tpm2_pipeline_run(NULL, &test_ops, &t);
+    assert_int_equal(rc, tool_rc_success);
+    assert_string_equal(t.log, "");
+}
+
+static void test_pipeline_response_extends(void **state) {
+    UNUSED(state);
+
+    /* the response of the last command calls for another one */
+    test_pipeline t = { .count = 2, .extend_at = 2 };
+    tool_rc rc = tpm2_pipeline_run(NULL, &test_ops, &t);
+    assert_int_equal(rc, tool_rc_success);
+    assert_string_equal(t.log, "p1 s1 p2 f1 s2 c1 f2 p3 s3 c2 f3 c3 ");
+}
+
+static void test_pipeline_prepare_fails(void **state) {
+    UNUSED(state);
+
+    /* the command in flight is still collected, its response discarded */
+    test_pipeline t = { .count = 3, .fail_step = 'p', .fail_at = 2 };
+    tool_rc rc = tpm2_pipeline_run(NULL, &test_ops, &t);
+    assert_int_equal(rc, tool_rc_general_error);
+    assert_string_equal(t.log, "p1 s1 p2 f1 ");
+    assert_int_equal(t.discarded, 1);
+    assert_false(t.is_response);
+}
+
+static void test_pipeline_complete_fails(void **state) {
+    UNUSED(state);
+
+    test_pipeline t = { .count = 3, .fail_step = 'c', .fail_at = 1 };
+    tool_rc rc = tpm2_pipeline_run(NULL, &test_ops, &t);
+    assert_int_equal(rc, tool_rc_general_error);
+    assert_string_equal(t.log, "p1 s1 p2 f1 s2 c1 f2 ");
+    assert_int_equal(t.discarded, 1);
+}
+
+static void test_pipeline_finish_fails(void **state) {
+    UNUSED(state);
+
+    test_pipeline t = { .count = 3, .fail_step = 'f', .fail_at = 2 };
+    tool_rc rc = tpm2_pipeline_run(NULL, &test_ops, &t);
+    assert_int_equal(rc, tool_rc_general_error);
+    assert_string_equal(t.log, "p1 s1 p2 f1 s2 c1 p3 f2 ");
+    assert_int_equal(t.discarded, 0);
+}
+
+static void test_pipeline_submit_fails(void **state) {
+    UNUSED(state);
+
+    test_pipeline t = { .count = 3, .fail_step = 's', .fail_at = 2 };
+    tool_rc rc = tpm2_pipeline_run(NULL, &test_ops, &t);
+    assert_int_equal(rc, tool_rc_general_error);
+    assert_string_equal(t.log, "p1 s1 p2 f1 s2 ");
+    assert_int_equal(t.discarded, 1);
+}
+
+/* link required symbol, but tpm2_tool.c declares it AND main, which
+ * we have a main below for cmocka tests.
+ */
+bool output_enabled = true;
+
+int main(int argc, char *argv[]) {
+    UNUSED(argc);
+    UNUSED(argv);
+
+    const struct CMUnitTest tests[] = {
+        cmocka_unit_test(test_pipeline_order),
+        cmocka_unit_test(test_pipeline_empty),
+        cmocka_unit_test(test_pipeline_response_extends),
+        cmocka_unit_test(test_pipeline_prepare_fails),
+        cmocka_unit_test(test_pipeline_complete_fails),
+        cmocka_unit_test(test_pipeline_finish_fails),
+        cmocka_unit_test(test_pipeline_submit_fails),
+    };
+
+    return cmocka_run_group_tests(tests, NULL, NULL);
+}
@@ -120,6 +120,49 @@ TSS2_RC __wrap_Esys_PolicyGetDigest(ESYS_CONTEXT *esysContext,
     return TPM2_RC_SUCCESS;
 }
 
+/* The update counter returned by any PCR read */
+static UINT32 pcr_update_counter;
+
+/* The number of reads that selected PCRs */
+static unsigned pcr_reads;
+
+/* The selection of the PCR read in flight */
+static TPML_PCR_SELECTION pcr_read_selection;
+
+/*
+ * Any PCR read returns all the selected PCRs with pcr_value, the reads that
+ * select none only the update counter.
+ */
+static TSS2_RC pcr_read_values(const TPML_PCR_SELECTION *pcrSelectionIn,
+        UINT32 *pcrUpdateCounter, TPML_PCR_SELECTION **pcrSelectionOut,
+        TPML_DIGEST **pcrValues) {
+
+    *pcrSelectionOut = malloc(sizeof(TPML_PCR_SELECTION));
+    *pcrValues = calloc(1, sizeof(TPML_DIGEST));
+    if (*pcrSelectionOut == NULL || *pcrValues == NULL) {
+        free(*pcrSelectionOut);
+        free(*pcrValues);
+        return TPM2_RC_FAILURE;
+    }
+
+    **pcrSelectionOut = *pcrSelectionIn;
+    *pcrUpdateCounter = pcr_update_counter;
+
+    UINT32 i;
+    for (i = 0; i < pcrSelectionIn->count; i++) {
+        const TPMS_PCR_SELECTION *sel = &pcrSelectionIn->pcrSelections[i];
+        UINT8 j;
+        for (j = 0; j < sel->sizeofSelect; j++) {
+            UINT8 k;
+            for (k = tpm2_util_pop_count(sel->pcrSelect[j]); k > 0; k--) {
+                (*pcrValues)->digests[(*pcrValues)->count++] = pcr_value;
+            }
+        }
+    }
+
+    return TPM2_RC_SUCCESS;
+}
+
 TSS2_RC __wrap_Esys_PCR_Read(ESYS_CONTEXT *esysContext, ESYS_TR shandle1,
         ESYS_TR shandle2, ESYS_TR shandle3,
         const TPML_PCR_SELECTION *pcrSelectionIn, UINT32 *pcrUpdateCounter,
@@ -129,26 +172,64 @@ TSS2_RC __wrap_Esys_PCR_Read(ESYS_CONTEXT *esysContext, ESYS_TR shandle1,
     UNUSED(shandle1);
     UNUSED(shandle2);
     UNUSED(shandle3);
-    UNUSED(pcrSelectionIn);
-    UNUSED(pcrUpdateCounter);
-    UNUSED(pcrSelectionOut);
 
-    *pcrValues = calloc(1, sizeof(TPML_DIGEST));
-    if (*pcrValues == NULL) {
+    return pcr_read_values(pcrSelectionIn, pcrUpdateCounter, pcrSelectionOut,
+            pcrValues);
+}
+
+TSS2_RC __wrap_Esys_PCR_Read_Async(ESYS_CONTEXT *esysContext, ESYS_TR shandle1,
+        ESYS_TR shandle2, ESYS_TR shandle3,
+        const TPML_PCR_SELECTION *pcrSelectionIn) {
+
+    UNUSED(esysContext);
+    UNUSED(shandle1);
+    UNUSED(shandle2);
+    UNUSED(shandle3);
+
+    pcr_read_selection = *pcrSelectionIn;
+    pcr_reads++;
+
+    return TPM2_RC_SUCCESS;
+}
+
+TSS2_RC __wrap_Esys_PCR_Read_Finish(ESYS_CONTEXT *esysContext,
+        UINT32 *pcrUpdateCounter, TPML_PCR_SELECTION **pcrSelectionOut,
+        TPML_DIGEST **pcrValues) {
+
+    UNUSED(esysContext);
+
+    return pcr_read_values(&pcr_read_selection, pcrUpdateCounter,
+            pcrSelectionOut, pcrValues);
+}
+
+/* PCR 16 does not change the update counter */
+TSS2_RC __wrap_Esys_GetCapability(ESYS_CONTEXT *esysContext, ESYS_TR shandle1,
+        ESYS_TR shandle2, ESYS_TR shandle3, TPM2_CAP capability,
+        UINT32 property, UINT32 propertyCount, TPMI_YES_NO *moreData,
+        TPMS_CAPABILITY_DATA **capabilityData) {
+
+    UNUSED(esysContext);
+    UNUSED(shandle1);
+    UNUSED(shandle2);
+    UNUSED(shandle3);
+    UNUSED(propertyCount);
+
+    assert_int_equal(capability, TPM2_CAP_PCR_PROPERTIES);
+    assert_int_equal(property, TPM2_PT_PCR_NO_INCREMENT);
+
+    *capabilityData = calloc(1, sizeof(TPMS_CAPABILITY_DATA));
+    if (*capabilityData == NULL) {
         return TPM2_RC_FAILURE;
     }
 
-    UINT32 i;
-    /* NOTE: magic number of 4... The prior (SAPI) implementation had a
-     * semi-populated pcrValues with an appropriate count value set.
-     * This ESAPI call allocates the pcrValues out-value and thus we don't have
-     * an appropriate count number at call time, therefore we hard-code the
-     * expected value for the *one* call we're currently making in this unit
-     * test.
-     */
-    for (i = 0; i < 4; i++) {
-        (*pcrValues)->digests[i] = pcr_value;
-    }
+    (*capabilityData)->capability = capability;
+    TPML_TAGGED_PCR_PROPERTY *properties =
+            &(*capabilityData)->data.pcrProperties;
+    properties->count = 1;
+    properties->pcrProperty[0].tag = TPM2_PT_PCR_NO_INCREMENT;
+    properties->pcrProperty[0].sizeofSelect = 3;
+    properties->pcrProperty[0].pcrSelect[2] = 0x01;
+    *moreData = TPM2_NO;
 
     return TPM2_RC_SUCCESS;
 }
@@ -190,6 +271,63 @@ static void test_tpm2_policy_build_pcr_good(void **state) {
     assert_null(s);
 }
 
+static void build_pcr(tpm2_session *s, const char *spec) {
+
+    TPML_PCR_SELECTION pcr_selections;
+    bool res = pcr_parse_selections(spec, &pcr_selections);
+    assert_true(res);
+
+    tool_rc rc = tpm2_policy_build_pcr(ESAPI_CONTEXT, s, NULL, &pcr_selections,
+            NULL);
+    assert_int_equal(rc, tool_rc_success);
+}
+
+static void test_tpm2_policy_build_pcr_cached(void **state) {
+    UNUSED(state);
+
+    tool_rc rc = pcr_cache_init();
+    assert_int_equal(rc, tool_rc_success);
+
+    tpm2_session_data *d = tpm2_session_data_new(TPM2_SE_POLICY);
+    assert_non_null(d);
+
+    tpm2_session *s = NULL;
+    rc = tpm2_session_open(ESAPI_CONTEXT, d, &s);
+    assert_int_equal(rc, tool_rc_success);
+
+    /* the second policy reuses the PCRs read for the first */
+    pcr_reads = 0;
+    build_pcr(s, PCR_SEL_SPEC);
+    build_pcr(s, PCR_SEL_SPEC);
+    assert_int_equal(pcr_reads, 1);
+
+    /* as does one of fewer PCRs */
+    build_pcr(s, "sha256:1,2");
+    assert_int_equal(pcr_reads, 1);
+
+    TPM2B_DIGEST *policy_digest;
+    build_pcr(s, PCR_SEL_SPEC);
+    rc = tpm2_policy_get_digest(ESAPI_CONTEXT, s, &policy_digest);
+    assert_int_equal(rc, tool_rc_success);
+    assert_int_equal(policy_digest->size, expected_policy_digest.size);
+    assert_memory_equal(policy_digest->buffer, expected_policy_digest.buffer,
+            expected_policy_digest.size);
+    assert_int_equal(pcr_reads, 1);
+
+    /* an extension reads them anew */
+    pcr_update_counter++;
+    build_pcr(s, PCR_SEL_SPEC);
+    assert_int_equal(pcr_reads, 2);
+
+    /* a PCR that does not change the counter is read every time */
+    build_pcr(s, "sha256:16");
+    build_pcr(s, "sha256:16");
+    assert_int_equal(pcr_reads, 4);
+
+    tpm2_session_close(&s);
+    pcr_cache_free();
+}
+
 static test_file *test_file_new(void) {
 
     test_file *tf = malloc(sizeof(test_file));
@@ -353,6 +491,92 @@ static void test_tpm2_policy_build_pcr_file_bad_size(void **state) {
     assert_int_equal(trc, tool_rc_general_error);
 }
 
+static void test_tpm2_policy_build_pcr_offline_good(void **state) {
+
+    test_file *tf = test_file_from_state(state);
+    assert_non_null(tf);
+
+    TPML_PCR_SELECTION pcr_selections;
+    bool res = pcr_parse_selections("sha256:0", &pcr_selections);
+    assert_true(res);
+
+    /* PCR 0 extended with 3, as in the createpolicy integration test */
+    BYTE pcr[32] = { [31] = 0x03 };
+    size_t num = fwrite(pcr, sizeof(pcr), 1, tf->file);
+    assert_int_equal(num, 1);
+
+    int rc = fflush(tf->file);
+    assert_int_equal(rc, 0);
+
+    tpm2_session_data *d = tpm2_session_data_new(TPM2_SE_TRIAL);
+    assert_non_null(d);
+
+    /* without a context, the digest is computed on the host */
+    tpm2_session *s = NULL;
+    tool_rc trc = tpm2_session_open(NULL, d, &s);
+    assert_int_equal(trc, tool_rc_success);
+    assert_true(tpm2_session_is_offline(s));
+
+    trc = tpm2_policy_build_pcr(NULL, s, tf->path, &pcr_selections, NULL);
+    assert_int_equal(trc, tool_rc_success);
+
+    TPM2B_DIGEST *policy_digest;
+    trc = tpm2_policy_get_digest(NULL, s, &policy_digest);
+    assert_int_equal(trc, tool_rc_success);
+
+    const BYTE expected[] = {
+        0x33, 0xe3, 0x6e, 0x78, 0x6c, 0x87, 0x86, 0x32, 0x49, 0x42,
+        0x17, 0xc3, 0xf4, 0x90, 0xe7, 0x4c, 0xa0, 0xa3, 0xa1, 0x22,
+        0xa8, 0xa4, 0xf3, 0xc5, 0x30, 0x25, 0x00, 0xdf, 0x3b, 0x32,
+        0xb3, 0xb8
+    };
+
+    assert_int_equal(policy_digest->size, sizeof(expected));
+    assert_memory_equal(policy_digest->buffer, expected, sizeof(expected));
+    free(policy_digest);
+
+    tpm2_session_close(&s);
+    assert_null(s);
+}
+
+static void test_tpm2_policy_build_policyauthvalue_offline(void **state) {
+    UNUSED(state);
+
+    tpm2_session_data *d = tpm2_session_data_new(TPM2_SE_TRIAL);
+    assert_non_null(d);
+
+    tpm2_session *s = NULL;
+    tool_rc rc = tpm2_session_open(NULL, d, &s);
+    assert_int_equal(rc, tool_rc_success);
+
+    rc = tpm2_policy_build_policyauthvalue(NULL, s);
+    assert_int_equal(rc, tool_rc_success);
+
+    /* the well known digest of a lone PolicyAuthValue */
+    const BYTE expected[] = {
+        0x8f, 0xcd, 0x21, 0x69, 0xab, 0x92, 0x69, 0x4e, 0x0c, 0x63,
+        0x3f, 0x1a, 0xb7, 0x72, 0x84, 0x2b, 0x82, 0x41, 0xbb, 0xc2,
+        0x02, 0x88, 0x98, 0x1f, 0xc7, 0xac, 0x1e, 0xdd, 0xc1, 0xfd,
+        0xdb, 0x0e
+    };
+
+    TPM2B_DIGEST *digest = tpm2_session_get_policy_digest(s);
+    assert_non_null(digest);
+    assert_int_equal(digest->size, sizeof(expected));
+    assert_memory_equal(digest->buffer, expected, sizeof(expected));
+
+    /* a restart goes back to all zeros */
+    rc = tpm2_session_restart(NULL, s);
+    assert_int_equal(rc, tool_rc_success);
+
+    const BYTE zeros[sizeof(expected)] = { 0 };
+    assert_int_equal(digest->size, sizeof(zeros));
+    assert_memory_equal(digest->buffer, zeros, sizeof(zeros));
+
+    tpm2_session_close(&s);
+    assert_null(s);
+}
+
 /* link required symbol, but tpm2_tool.c declares it AND main, which
  * we have a main below for cmocka tests.
  */
@@ -364,10 +588,14 @@ int main(int argc, char *argv[]) {
 
     const struct CMUnitTest tests[] = {
         cmocka_unit_test(test_tpm2_policy_build_pcr_good),
+        cmocka_unit_test(test_tpm2_policy_build_pcr_cached),
         cmocka_unit_test_setup_teardown(test_tpm2_policy_build_pcr_file_good,
                 test_setup, test_teardown),
         cmocka_unit_test_setup_teardown(test_tpm2_policy_build_pcr_file_bad_size,
-                test_setup, test_teardown)
+                test_setup, test_teardown),
+        cmocka_unit_test_setup_teardown(test_tpm2_policy_build_pcr_offline_good,
+                test_setup, test_teardown),
+        cmocka_unit_test(test_tpm2_policy_build_policyauthvalue_offline),
     };
 
     return cmocka_run_group_tests(tests, NULL, NULL);
@@ -0,0 +1,174 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <setjmp.h>
+#include <cmocka.h>
+
+#include "tpm2_openssl.h"
+#include "tpm2_policy_or_tree.h"
+#include "tpm2_util.h"
+
+#define LEAVES 20
+
+static void leaves_fill(TPM2B_DIGEST *leaves, size_t count) {
+
+    size_t i;
+    for (i = 0; i < count; i++) {
+        leaves[i].size = TPM2_SHA256_DIGEST_SIZE;
+        memset(leaves[i].buffer, (int) i + 1, leaves[i].size);
+    }
+}
+
+/* the PolicyOR of digests, from a zero digest */
+static void policy_or(const TPM2B_DIGEST *digests, size_t count,
+        TPM2B_DIGEST *digest) {
+
+    BYTE buffer[TPM2_SHA256_DIGEST_SIZE + 4
+            + TPM2_POLICY_OR_TREE_ARITY * TPM2_SHA256_DIGEST_SIZE] = { 0 };
+    size_t offset = TPM2_SHA256_DIGEST_SIZE;
+    const BYTE cc[] = { 0x00, 0x00, 0x01, 0x71 };
+    memcpy(&buffer[offset], cc, sizeof(cc));
+    offset += sizeof(cc);
+
+    size_t i;
+    for (i = 0; i < count; i++) {
+        memcpy(&buffer[offset], digests[i].buffer, digests[i].size);
+        offset += digests[i].size;
+    }
+
+    assert_true(tpm2_openssl_hash_compute_data(TPM2_ALG_SHA256, buffer,
+            offset, digest));
+}
+
+static void test_tpm2_policy_or_tree_build(void **state) {
+    UNUSED(state);
+
+    TPM2B_DIGEST leaves[LEAVES];
+    leaves_fill(leaves, LEAVES);
+
+    tpm2_policy_or_tree tree;
+    assert_true(tpm2_policy_or_tree_build(TPM2_ALG_SHA256, leaves, LEAVES,
+            &tree));
+    assert_int_equal(tpm2_policy_or_tree_count(&tree), LEAVES);
+
+    /* 20 leaves in PolicyORs of 6, 7 and 7 digests, under the root */
+    assert_int_equal(tree.depth, 2);
+
+    TPM2B_DIGEST groups[3];
+    policy_or(&leaves[0], 6, &groups[0]);
+    policy_or(&leaves[6], 7, &groups[1]);
+    policy_or(&leaves[13], 7, &groups[2]);
+
+    TPM2B_DIGEST root;
+    policy_or(groups, 3, &root);
+
+    const TPM2B_DIGEST *tree_root = tpm2_policy_or_tree_root(&tree);
+    assert_int_equal(tree_root->size, root.size);
+    assert_memory_equal(tree_root->buffer, root.buffer, root.size);
+
+    size_t leaf = 0;
+    assert_true(tpm2_policy_or_tree_find(&tree, &leaves[19], &leaf));
+    assert_int_equal(leaf, 19);
+
+    size_t path[TPM2_POLICY_OR_TREE_DEPTH_MAX];
+    tpm2_policy_or_tree_path(&tree, leaf, path);
+    assert_int_equal(path[0], 6);
+    assert_int_equal(path[1], 2);
+
+    tpm2_policy_or_tree_path(&tree, 6, path);
+    assert_int_equal(path[0], 0);
+    assert_int_equal(path[1], 1);
+
+    TPM2B_DIGEST other = { .size = TPM2_SHA256_DIGEST_SIZE };
+    assert_false(tpm2_policy_or_tree_find(&tree, &other, &leaf));
+
+    tpm2_policy_or_tree_free(&tree);
+}
+
+static void test_tpm2_policy_or_tree_single_level(void **state) {
+    UNUSED(state);
+
+    TPM2B_DIGEST leaves[TPM2_POLICY_OR_TREE_ARITY];
+    leaves_fill(leaves, ARRAY_LEN(leaves));
+
+    /* up to 8 digests, the tree is the PolicyOR of tpm2_policyor */
+    tpm2_policy_or_tree tree;
+    assert_true(tpm2_policy_or_tree_build(TPM2_ALG_SHA256, leaves,
+            ARRAY_LEN(leaves), &tree));
+    assert_int_equal(tree.depth, 1);
+
+    TPM2B_DIGEST root;
+    policy_or(leaves, ARRAY_LEN(leaves), &root);
+    assert_memory_equal(tpm2_policy_or_tree_root(&tree)->buffer, root.buffer,
+            root.size);
+
+    tpm2_policy_or_tree_free(&tree);
+}
+
+static void test_tpm2_policy_or_tree_bad_leaves(void **state) {
+    UNUSED(state);
+
+    TPM2B_DIGEST leaves[2];
+    leaves_fill(leaves, ARRAY_LEN(leaves));
+
+    tpm2_policy_or_tree tree;
+    assert_false(tpm2_policy_or_tree_build(TPM2_ALG_SHA256, leaves, 1, &tree));
+
+    leaves[1].size = TPM2_SHA1_DIGEST_SIZE;
+    assert_false(tpm2_policy_or_tree_build(TPM2_ALG_SHA256, leaves, 2, &tree));
+}
+
+static void test_tpm2_policy_or_tree_save_load(void **state) {
+    UNUSED(state);
+
+    TPM2B_DIGEST leaves[LEAVES];
+    leaves_fill(leaves, LEAVES);
+
+    tpm2_policy_or_tree tree;
+    assert_true(tpm2_policy_or_tree_build(TPM2_ALG_SHA256, leaves, LEAVES,
+            &tree));
+
+    char path[] = "/tmp/test_tpm2_policy_or_tree.XXXXXX";
+    int fd = mkstemp(path);
+    assert_true(fd >= 0);
+    close(fd);
+
+    assert_true(tpm2_policy_or_tree_save(&tree, path));
+
+    tpm2_policy_or_tree loaded;
+    assert_true(tpm2_policy_or_tree_load(path, &loaded));
+    unlink(path);
+
+    assert_int_equal(loaded.halg, TPM2_ALG_SHA256);
+    assert_int_equal(tpm2_policy_or_tree_count(&loaded), LEAVES);
+    assert_int_equal(loaded.depth, tree.depth);
+    assert_memory_equal(tpm2_policy_or_tree_root(&loaded)->buffer,
+            tpm2_policy_or_tree_root(&tree)->buffer, TPM2_SHA256_DIGEST_SIZE);
+
+    tpm2_policy_or_tree_free(&loaded);
+    tpm2_policy_or_tree_free(&tree);
+}
+
+/* link required symbol, but tpm2_tool.c declares it AND main, which
+ * we have a main below for cmocka tests.
+ */
+bool output_enabled = true;
+
+int main(int argc, char *argv[]) {
+    UNUSED(argc);
+    UNUSED(argv);
+
+    const struct CMUnitTest tests[] = {
+        cmocka_unit_test(test_tpm2_policy_or_tree_build),
+        cmocka_unit_test(test_tpm2_policy_or_tree_single_level),
+        cmocka_unit_test(test_tpm2_policy_or_tree_bad_leaves),
+        cmocka_unit_test(test_tpm2_policy_or_tree_save_load),
+    };
+
+    return cmocka_run_group_tests(tests, NULL, NULL);
+}
@@ -0,0 +1,145 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+#include <limits.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <setjmp.h>
+#include <cmocka.h>
+
+#include "tpm2_primary_template.h"
+#include "tpm2_util.h"
+
+typedef struct test_template test_template;
+struct test_template {
+    char path[PATH_MAX];
+    TPM2B_PUBLIC public;
+};
+
+static int test_setup(void **state) {
+
+    test_template *t = calloc(1, sizeof(*t));
+    assert_non_null(t);
+
+    strcpy(t->path, "/tmp/test_tpm2_primary_template.XXXXXX");
+    int fd = mkstemp(t->path);
+    assert_true(fd >= 0);
+    close(fd);
+
+    TPMT_PUBLIC *p = &t->public.publicArea;
+    p->type = TPM2_ALG_ECC;
+    p->nameAlg = TPM2_ALG_SHA256;
+    p->objectAttributes = TPMA_OBJECT_RESTRICTED | TPMA_OBJECT_DECRYPT
+            | TPMA_OBJECT_FIXEDTPM | TPMA_OBJECT_FIXEDPARENT;
+    p->parameters.eccDetail.symmetric.algorithm = TPM2_ALG_AES;
+    p->parameters.eccDetail.symmetric.keyBits.aes = 128;
+    p->parameters.eccDetail.symmetric.mode.aes = TPM2_ALG_CFB;
+    p->parameters.eccDetail.scheme.scheme = TPM2_ALG_NULL;
+    p->parameters.eccDetail.curveID = TPM2_ECC_NIST_P256;
+    p->parameters.eccDetail.kdf.scheme = TPM2_ALG_NULL;
+    /* the EK nonce */
+    p->unique.ecc.x.size = 32;
+    memset(p->unique.ecc.x.buffer, 0x5a, 32);
+    p->unique.ecc.y.size = 32;
+
+    *state = t;
+
+    return 0;
+}
+
+static int test_teardown(void **state) {
+
+    test_template *t = (test_template *) *state;
+    unlink(t->path);
+    free(t);
+
+    return 0;
+}
+
+static void test_primary_template_save_load(void **state) {
+
+    test_template *t = (test_template *) *state;
+
+    TPM2B_DIGEST saved = { 0 };
+    assert_true(tpm2_primary_template_save(t->path, &t->public, &saved));
+    assert_int_equal(saved.size, 32);
+
+    TPM2B_PUBLIC public = { 0 };
+    TPM2B_DIGEST loaded = { 0 };
+    assert_true(tpm2_primary_template_load(t->path, &public, &loaded));
+    assert_int_equal(public.publicArea.type, TPM2_ALG_ECC);
+    assert_int_equal(public.publicArea.unique.ecc.x.size, 32);
+    assert_memory_equal(public.publicArea.unique.ecc.x.buffer,
+            t->public.publicArea.unique.ecc.x.buffer, 32);
+    assert_int_equal(loaded.size, saved.size);
+    assert_memory_equal(loaded.buffer, saved.buffer, saved.size);
+}
+
+static void test_primary_template_digest(void **state) {
+
+    test_template *t = (test_template *) *state;
+
+    TPM2B_DIGEST saved = { 0 };
+    assert_true(tpm2_primary_template_save(t->path, &t->public, &saved));
+
+    TPM2B_DIGEST digest = { 0 };
+    assert_true(tpm2_primary_template_digest(&t->public, &digest));
+    assert_int_equal(digest.size, saved.size);
+    assert_memory_equal(digest.buffer, saved.buffer, saved.size);
+
+    /* another nonce is another template */
+    t->public.publicArea.unique.ecc.x.buffer[0] ^= 1;
+    assert_true(tpm2_primary_template_digest(&t->public, &digest));
+    assert_memory_not_equal(digest.buffer, saved.buffer, saved.size);
+}
+
+static void test_primary_template_damaged(void **state) {
+
+    test_template *t = (test_template *) *state;
+
+    assert_true(tpm2_primary_template_save(t->path, &t->public, NULL));
+
+    /* flip a byte of the template, past the header and size */
+    FILE *f = fopen(t->path, "r+b");
+    assert_non_null(f);
+    assert_int_equal(fseek(f, 12, SEEK_SET), 0);
+    int c = fgetc(f);
+    assert_int_equal(fseek(f, 12, SEEK_SET), 0);
+    fputc(c ^ 0xff, f);
+    fclose(f);
+
+    TPM2B_PUBLIC public = { 0 };
+    assert_false(tpm2_primary_template_load(t->path, &public, NULL));
+
+    f = fopen(t->path, "wb");
+    assert_non_null(f);
+    fputs("not a template", f);
+    fclose(f);
+
+    assert_false(tpm2_primary_template_load(t->path, &public, NULL));
+}
+
+/* link required symbol, but tpm2_tool.c declares it AND main, which
+ * we have a main below for cmocka tests.
+ */
+bool output_enabled = true;
+
+int main(int argc, char *argv[]) {
+    UNUSED(argc);
+    UNUSED(argv);
+
+    const struct CMUnitTest tests[] = {
+        cmocka_unit_test_setup_teardown(test_primary_template_save_load,
+                test_setup, test_teardown),
+        cmocka_unit_test_setup_teardown(test_primary_template_digest,
+                test_setup, test_teardown),
+        cmocka_unit_test_setup_teardown(test_primary_template_damaged,
+                test_setup, test_teardown),
+    };
+
+    return cmocka_run_group_tests(tests, NULL, NULL);
+}
@@ -0,0 +1,197 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+#include <dirent.h>
+#include <limits.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <setjmp.h>
+#include <cmocka.h>
+
+#include "tpm2_pubkey_cache.h"
+#include "tpm2_util.h"
+
+typedef struct test_cache test_cache;
+struct test_cache {
+    char dir[PATH_MAX];
+    UINT8 fingerprint[TPM2_PUBKEY_CACHE_FINGERPRINT_SIZE];
+    TPM2B_PUBLIC parsed;
+};
+
+static int test_setup(void **state) {
+
+    test_cache *t = calloc(1, sizeof(*t));
+    assert_non_null(t);
+
+    strcpy(t->dir, "/tmp/test_tpm2_pubkey_cache.XXXXXX");
+    assert_non_null(mkdtemp(t->dir));
+    /* the directory is created by the first write */
+    rmdir(t->dir);
+
+    memset(t->fingerprint, 0xf1, sizeof(t->fingerprint));
+
+    TPMT_PUBLIC *p = &t->parsed.publicArea;
+    p->type = TPM2_ALG_ECC;
+    p->nameAlg = TPM2_ALG_SHA256;
+    p->parameters.eccDetail.symmetric.algorithm = TPM2_ALG_NULL;
+    p->parameters.eccDetail.scheme.scheme = TPM2_ALG_NULL;
+    p->parameters.eccDetail.curveID = TPM2_ECC_NIST_P256;
+    p->parameters.eccDetail.kdf.scheme = TPM2_ALG_NULL;
+    p->unique.ecc.x.size = 32;
+    memset(p->unique.ecc.x.buffer, 0xaa, 32);
+    p->unique.ecc.y.size = 32;
+    memset(p->unique.ecc.y.buffer, 0xbb, 32);
+
+    *state = t;
+
+    return 0;
+}
+
+static int test_teardown(void **state) {
+
+    test_cache *t = (test_cache *) *state;
+
+    DIR *dir = opendir(t->dir);
+    if (dir) {
+        struct dirent *entry;
+        while ((entry = readdir(dir))) {
+            if (entry->d_name[0] != '.') {
+                char path[PATH_MAX];
+                snprintf(path, sizeof(path), "%s/%s", t->dir, entry->d_name);
+                unlink(path);
+            }
+        }
+        closedir(dir);
+    }
+    rmdir(t->dir);
+
+    unsetenv(TPM2TOOLS_ENV_PUBKEY_CACHE);
+    tpm2_pubkey_cache_free();
+    free(t);
+
+    return 0;
+}
+
+static void assert_parsed_equal(const TPM2B_PUBLIC *got,
+        const TPM2B_PUBLIC *expected) {
+
+    const TPMT_PUBLIC *g = &got->publicArea;
+    const TPMT_PUBLIC *e = &expected->publicArea;
+    assert_int_equal(g->type, e->type);
+    assert_int_equal(g->parameters.eccDetail.curveID,
+            e->parameters.eccDetail.curveID);
+    assert_int_equal(g->unique.ecc.x.size, e->unique.ecc.x.size);
+    assert_memory_equal(g->unique.ecc.x.buffer, e->unique.ecc.x.buffer,
+            e->unique.ecc.x.size);
+    assert_int_equal(g->unique.ecc.y.size, e->unique.ecc.y.size);
+    assert_memory_equal(g->unique.ecc.y.buffer, e->unique.ecc.y.buffer,
+            e->unique.ecc.y.size);
+}
+
+static void test_pubkey_cache_read_write(void **state) {
+
+    test_cache *t = (test_cache *) *state;
+
+    TPM2B_PUBLIC got = { 0 };
+    assert_false(tpm2_pubkey_cache_read(t->dir, t->fingerprint, TPM2_ALG_ECC,
+            &got));
+
+    assert_true(tpm2_pubkey_cache_write(t->dir, t->fingerprint, TPM2_ALG_ECC,
+            &t->parsed));
+    assert_true(tpm2_pubkey_cache_read(t->dir, t->fingerprint, TPM2_ALG_ECC,
+            &got));
+    assert_parsed_equal(&got, &t->parsed);
+
+    /* the same file asked for as another algorithm */
+    assert_false(tpm2_pubkey_cache_read(t->dir, t->fingerprint, TPM2_ALG_RSA,
+            &got));
+
+    /* another file */
+    UINT8 other[TPM2_PUBKEY_CACHE_FINGERPRINT_SIZE];
+    memset(other, 0xf2, sizeof(other));
+    assert_false(tpm2_pubkey_cache_read(t->dir, other, TPM2_ALG_ECC, &got));
+}
+
+static void test_pubkey_cache_damaged(void **state) {
+
+    test_cache *t = (test_cache *) *state;
+
+    assert_true(tpm2_pubkey_cache_write(t->dir, t->fingerprint, TPM2_ALG_ECC,
+            &t->parsed));
+
+    DIR *dir = opendir(t->dir);
+    assert_non_null(dir);
+    struct dirent *entry;
+    char path[PATH_MAX] = { 0 };
+    while ((entry = readdir(dir))) {
+        if (entry->d_name[0] != '.') {
+            snprintf(path, sizeof(path), "%s/%s", t->dir, entry->d_name);
+        }
+    }
+    closedir(dir);
+    assert_true(path[0]);
+
+    /* cut the marshaled public area short */
+    assert_int_equal(truncate(path, 20), 0);
+
+    TPM2B_PUBLIC got = { 0 };
+    assert_false(tpm2_pubkey_cache_read(t->dir, t->fingerprint, TPM2_ALG_ECC,
+            &got));
+}
+
+static void test_pubkey_cache_process(void **state) {
+
+    test_cache *t = (test_cache *) *state;
+
+    /* without the directory the keys are only kept by the process */
+    TPM2B_PUBLIC got = { 0 };
+    assert_false(tpm2_pubkey_cache_get(t->fingerprint, TPM2_ALG_ECC, &got));
+    tpm2_pubkey_cache_put(t->fingerprint, TPM2_ALG_ECC, &t->parsed);
+    assert_true(tpm2_pubkey_cache_get(t->fingerprint, TPM2_ALG_ECC, &got));
+    assert_parsed_equal(&got, &t->parsed);
+    assert_false(tpm2_pubkey_cache_get(t->fingerprint, TPM2_ALG_RSA, &got));
+
+    tpm2_pubkey_cache_free();
+    assert_false(tpm2_pubkey_cache_get(t->fingerprint, TPM2_ALG_ECC, &got));
+}
+
+static void test_pubkey_cache_dir(void **state) {
+
+    test_cache *t = (test_cache *) *state;
+
+    assert_int_equal(setenv(TPM2TOOLS_ENV_PUBKEY_CACHE, t->dir, 1), 0);
+    tpm2_pubkey_cache_put(t->fingerprint, TPM2_ALG_ECC, &t->parsed);
+
+    /* a later process finds the key in the directory */
+    tpm2_pubkey_cache_free();
+    TPM2B_PUBLIC got = { 0 };
+    assert_true(tpm2_pubkey_cache_get(t->fingerprint, TPM2_ALG_ECC, &got));
+    assert_parsed_equal(&got, &t->parsed);
+}
+
+/* link required symbol, but tpm2_tool.c declares it AND main, which
+ * we have a main below for cmocka tests.
+ */
+bool output_enabled = true;
+
+int main(int argc, char *argv[]) {
+    UNUSED(argc);
+    UNUSED(argv);
+
+    const struct CMUnitTest tests[] = {
+        cmocka_unit_test_setup_teardown(test_pubkey_cache_read_write,
+                test_setup, test_teardown),
+        cmocka_unit_test_setup_teardown(test_pubkey_cache_damaged,
+                test_setup, test_teardown),
+        cmocka_unit_test_setup_teardown(test_pubkey_cache_process,
+                test_setup, test_teardown),
+        cmocka_unit_test_setup_teardown(test_pubkey_cache_dir,
+                test_setup, test_teardown),
+    };
+
+    return cmocka_run_group_tests(tests, NULL, NULL);
+}
@@ -0,0 +1,197 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+#include <limits.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <setjmp.h>
+#include <cmocka.h>
+
+#include "tpm2_quote_bundle.h"
+#include "tpm2_util.h"
+
+typedef struct test_bundle test_bundle;
+struct test_bundle {
+    char path[PATH_MAX];
+    TPM2B_ATTEST quoted;
+    TPMT_SIGNATURE signature;
+};
+
+static int test_setup(void **state) {
+
+    test_bundle *t = calloc(1, sizeof(*t));
+    assert_non_null(t);
+
+    strcpy(t->path, "/tmp/test_tpm2_quote_bundle.XXXXXX");
+    int fd = mkstemp(t->path);
+    assert_true(fd >= 0);
+    close(fd);
+
+    t->quoted.size = 64;
+    memset(t->quoted.attestationData, 0x5a, t->quoted.size);
+
+    t->signature.sigAlg = TPM2_ALG_RSASSA;
+    t->signature.signature.rsassa.hash = TPM2_ALG_SHA256;
+    t->signature.signature.rsassa.sig.size = 256;
+    memset(t->signature.signature.rsassa.sig.buffer, 0xa5, 256);
+
+    *state = t;
+
+    return 0;
+}
+
+static int test_teardown(void **state) {
+
+    test_bundle *t = (test_bundle *) *state;
+    unlink(t->path);
+    free(t);
+
+    return 0;
+}
+
+static void test_tpm2_quote_bundle_round_trip(void **state) {
+
+    test_bundle *t = (test_bundle *) *state;
+
+    TPML_PCR_SELECTION pcr_select;
+    assert_true(pcr_parse_selections("sha256:0,1", &pcr_select));
+
+    tpm2_pcrs pcrs = { 0 };
+    TPML_DIGEST *values = pcr_pcrs_append(&pcrs);
+    assert_non_null(values);
+    UINT32 i;
+    for (i = 0; i < 2; i++) {
+        values->digests[i].size = 32;
+        memset(values->digests[i].buffer, i + 1, 32);
+    }
+    values->count = 2;
+
+    const UINT8 eventlog[] = { 1, 2, 3, 4, 5 };
+    bool result = tpm2_quote_bundle_write(t->path, &t->quoted, &t->signature,
+            &pcr_select, &pcrs, eventlog, sizeof(eventlog));
+    pcr_pcrs_free(&pcrs);
+    assert_true(result);
+
+    tpm2_quote_bundle bundle;
+    result = tpm2_quote_bundle_open(&bundle, t->path);
+    assert_true(result);
+
+    assert_int_equal(bundle.message_size, t->quoted.size);
+    assert_memory_equal(bundle.message, t->quoted.attestationData,
+            t->quoted.size);
+    assert_memory_equal(&bundle.signature, &t->signature,
+            sizeof(t->signature));
+    assert_non_null(bundle.eventlog);
+    assert_int_equal(bundle.eventlog_size, sizeof(eventlog));
+    assert_memory_equal(bundle.eventlog, eventlog, sizeof(eventlog));
+
+    /* the PCR values read as a PCR bundle */
+    assert_non_null(bundle.pcrs);
+    FILE *f = fmemopen((void *) bundle.pcrs, bundle.pcrs_size, "rb");
+    assert_non_null(f);
+    TPML_PCR_SELECTION read_select;
+    tpm2_pcrs read_pcrs = { 0 };
+    result = pcr_bundle_read(f, &read_select, &read_pcrs);
+    fclose(f);
+    assert_true(result);
+    assert_int_equal(read_select.count, 1);
+    assert_int_equal(read_select.pcrSelections[0].hash, TPM2_ALG_SHA256);
+    assert_int_equal(read_pcrs.count, 1);
+    assert_int_equal(read_pcrs.pcr_values[0].count, 2);
+    assert_int_equal(read_pcrs.pcr_values[0].digests[1].buffer[31], 2);
+    pcr_pcrs_free(&read_pcrs);
+
+    tpm2_quote_bundle_close(&bundle);
+}
+
+static void test_tpm2_quote_bundle_optional(void **state) {
+
+    test_bundle *t = (test_bundle *) *state;
+
+    bool result = tpm2_quote_bundle_write(t->path, &t->quoted, &t->signature,
+            NULL, NULL, NULL, 0);
+    assert_true(result);
+
+    tpm2_quote_bundle bundle;
+    result = tpm2_quote_bundle_open(&bundle, t->path);
+    assert_true(result);
+    assert_int_equal(bundle.message_size, t->quoted.size);
+    assert_null(bundle.pcrs);
+    assert_null(bundle.eventlog);
+
+    tpm2_quote_bundle_close(&bundle);
+}
+
+static void test_tpm2_quote_bundle_no_signature(void **state) {
+
+    test_bundle *t = (test_bundle *) *state;
+
+    /* a context archive without the members of a quote */
+    const UINT8 data[] = { 1, 2, 3 };
+    tpm2_ctx_archive_member members[] = {
+        {
+            .name = TPM2_QUOTE_BUNDLE_MESSAGE,
+            .data = data,
+            .size = sizeof(data),
+        },
+    };
+    bool result = tpm2_ctx_archive_write(t->path, members,
+            ARRAY_LEN(members));
+    assert_true(result);
+
+    tpm2_quote_bundle bundle;
+    assert_false(tpm2_quote_bundle_open(&bundle, t->path));
+}
+
+static void test_tpm2_quote_bundle_bad_signature(void **state) {
+
+    test_bundle *t = (test_bundle *) *state;
+
+    /* a signature member with trailing bytes */
+    const UINT8 sig[] = { 0x00, 0x10, 0xff, 0xff, 0xff };
+    tpm2_ctx_archive_member members[] = {
+        {
+            .name = TPM2_QUOTE_BUNDLE_MESSAGE,
+            .data = t->quoted.attestationData,
+            .size = t->quoted.size,
+        },
+        {
+            .name = TPM2_QUOTE_BUNDLE_SIGNATURE,
+            .data = sig,
+            .size = sizeof(sig),
+        },
+    };
+    bool result = tpm2_ctx_archive_write(t->path, members,
+            ARRAY_LEN(members));
+    assert_true(result);
+
+    tpm2_quote_bundle bundle;
+    assert_false(tpm2_quote_bundle_open(&bundle, t->path));
+}
+
+/* link required symbol, but tpm2_tool.c declares it AND main, which
+ * we have a main below for cmocka tests.
+ */
+bool output_enabled = true;
+
+int main(int argc, char *argv[]) {
+    UNUSED(argc);
+    UNUSED(argv);
+
+    const struct CMUnitTest tests[] = {
+        cmocka_unit_test_setup_teardown(test_tpm2_quote_bundle_round_trip,
+                test_setup, test_teardown),
+        cmocka_unit_test_setup_teardown(test_tpm2_quote_bundle_optional,
+                test_setup, test_teardown),
+        cmocka_unit_test_setup_teardown(test_tpm2_quote_bundle_no_signature,
+                test_setup, test_teardown),
+        cmocka_unit_test_setup_teardown(test_tpm2_quote_bundle_bad_signature,
+                test_setup, test_teardown),
+    };
+
+    return cmocka_run_group_tests(tests, NULL, NULL);
+}
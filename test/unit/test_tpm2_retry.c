@@ -0,0 +1,183 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <setjmp.h>
+#include <cmocka.h>
+
+#include "tpm2_retry.h"
+#include "tpm2_util.h"
+
+#define RESPONSE_SIZE 10
+
+typedef struct test_tcti test_tcti;
+struct test_tcti {
+    TSS2_TCTI_CONTEXT_COMMON_V2 common;
+    unsigned transmitted;
+    uint8_t command[RESPONSE_SIZE];
+};
+
+static TSS2_RC test_tcti_transmit(TSS2_TCTI_CONTEXT *tcti_context,
+        size_t size, const uint8_t *command) {
+
+    test_tcti *tcti = (test_tcti *) tcti_context;
+
+    assert_int_equal(size, sizeof(tcti->command));
+    memcpy(tcti->command, command, size);
+    tcti->transmitted++;
+
+    return TSS2_RC_SUCCESS;
+}
+
+/* answers with the response code queued by the test */
+static TSS2_RC test_tcti_receive(TSS2_TCTI_CONTEXT *tcti_context,
+        size_t *size, uint8_t *response, int32_t timeout) {
+
+    UNUSED(tcti_context);
+    UNUSED(timeout);
+
+    assert_true(*size >= RESPONSE_SIZE);
+
+    TSS2_RC rc = (TSS2_RC) mock();
+    uint8_t header[RESPONSE_SIZE] = {
+        0x80, 0x01, 0x00, 0x00, 0x00, RESPONSE_SIZE,
+        rc >> 24, rc >> 16, rc >> 8, rc
+    };
+
+    memcpy(response, header, sizeof(header));
+    *size = sizeof(header);
+
+    return TSS2_RC_SUCCESS;
+}
+
+static void test_tcti_init(test_tcti *tcti) {
+
+    memset(tcti, 0, sizeof(*tcti));
+    tcti->common.v1.version = 2;
+    tcti->common.v1.transmit = test_tcti_transmit;
+    tcti->common.v1.receive = test_tcti_receive;
+}
+
+static TSS2_RC send_command(TSS2_TCTI_CONTEXT *tcti) {
+
+    const uint8_t command[RESPONSE_SIZE] = {
+        0x80, 0x01, 0x00, 0x00, 0x00, RESPONSE_SIZE, 0x00, 0x00, 0x01, 0x7b
+    };
+
+    TSS2_RC rval = Tss2_Tcti_Transmit(tcti, sizeof(command), command);
+    assert_int_equal(rval, TSS2_RC_SUCCESS);
+
+    uint8_t response[64];
+    size_t size = sizeof(response);
+    rval = Tss2_Tcti_Receive(tcti, &size, response, TSS2_TCTI_TIMEOUT_BLOCK);
+    assert_int_equal(rval, TSS2_RC_SUCCESS);
+    assert_int_equal(size, RESPONSE_SIZE);
+
+    return (TSS2_RC) response[6] << 24 | response[7] << 16 | response[8] << 8
+            | response[9];
+}
+
+static void test_tpm2_retry_resends_busy(void **state) {
+    UNUSED(state);
+
+    setenv(TPM2TOOLS_ENV_RETRY_MAX, "3", 1);
+
+    test_tcti inner;
+    test_tcti_init(&inner);
+
+    TSS2_TCTI_CONTEXT *tcti = tpm2_retry_tcti_wrap(
+            (TSS2_TCTI_CONTEXT *) &inner);
+    assert_ptr_not_equal(tcti, &inner);
+
+    will_return(test_tcti_receive, TPM2_RC_RETRY);
+    will_return(test_tcti_receive, TPM2_RC_YIELDED);
+    will_return(test_tcti_receive, TPM2_RC_SUCCESS);
+
+    TSS2_RC rc = send_command(tcti);
+    assert_int_equal(rc, TPM2_RC_SUCCESS);
+    assert_int_equal(inner.transmitted, 3);
+    assert_int_equal(inner.command[9], 0x7b);
+
+    assert_ptr_equal(tpm2_retry_tcti_unwrap(tcti), &inner);
+}
+
+static void test_tpm2_retry_gives_up(void **state) {
+    UNUSED(state);
+
+    setenv(TPM2TOOLS_ENV_RETRY_MAX, "2", 1);
+
+    test_tcti inner;
+    test_tcti_init(&inner);
+
+    TSS2_TCTI_CONTEXT *tcti = tpm2_retry_tcti_wrap(
+            (TSS2_TCTI_CONTEXT *) &inner);
+
+    will_return_count(test_tcti_receive, TPM2_RC_TESTING, 3);
+
+    TSS2_RC rc = send_command(tcti);
+    assert_int_equal(rc, TPM2_RC_TESTING);
+    assert_int_equal(inner.transmitted, 3);
+
+    tpm2_retry_tcti_unwrap(tcti);
+}
+
+static void test_tpm2_retry_passes_errors(void **state) {
+    UNUSED(state);
+
+    setenv(TPM2TOOLS_ENV_RETRY_MAX, "2", 1);
+
+    test_tcti inner;
+    test_tcti_init(&inner);
+
+    TSS2_TCTI_CONTEXT *tcti = tpm2_retry_tcti_wrap(
+            (TSS2_TCTI_CONTEXT *) &inner);
+
+    /* only the busy warnings are retried, not other warnings or errors */
+    will_return(test_tcti_receive, TPM2_RC_LOCKOUT);
+    TSS2_RC rc = send_command(tcti);
+    assert_int_equal(rc, TPM2_RC_LOCKOUT);
+
+    will_return(test_tcti_receive, TPM2_RC_BAD_AUTH);
+    rc = send_command(tcti);
+    assert_int_equal(rc, TPM2_RC_BAD_AUTH);
+
+    assert_int_equal(inner.transmitted, 2);
+
+    tpm2_retry_tcti_unwrap(tcti);
+}
+
+static void test_tpm2_retry_disabled(void **state) {
+    UNUSED(state);
+
+    setenv(TPM2TOOLS_ENV_RETRY_MAX, "0", 1);
+
+    test_tcti inner;
+    test_tcti_init(&inner);
+
+    TSS2_TCTI_CONTEXT *tcti = tpm2_retry_tcti_wrap(
+            (TSS2_TCTI_CONTEXT *) &inner);
+    assert_ptr_equal(tcti, &inner);
+    assert_ptr_equal(tpm2_retry_tcti_unwrap(tcti), &inner);
+}
+
+/* link required symbol, but tpm2_tool.c declares it AND main, which
+ * we have a main below for cmocka tests.
+ */
+bool output_enabled = true;
+
+int main(int argc, char *argv[]) {
+    UNUSED(argc);
+    UNUSED(argv);
+
+    const struct CMUnitTest tests[] = {
+        cmocka_unit_test(test_tpm2_retry_resends_busy),
+        cmocka_unit_test(test_tpm2_retry_gives_up),
+        cmocka_unit_test(test_tpm2_retry_passes_errors),
+        cmocka_unit_test(test_tpm2_retry_disabled),
+    };
+
+    return cmocka_run_group_tests(tests, NULL, NULL);
+}
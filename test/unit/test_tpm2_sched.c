@@ -0,0 +1,153 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdlib.h>
+
+#include <setjmp.h>
+#include <cmocka.h>
+
+#include "tpm2_sched.h"
+#include "tpm2_util.h"
+
+static void test_sched_fifo(void **state) {
+    UNUSED(state);
+
+    tpm2_sched s;
+    tpm2_sched_init(&s);
+
+    int a, b, c;
+    assert_true(tpm2_sched_push(&s, "tpm2_getrandom", NULL, &a));
+    assert_true(tpm2_sched_push(&s, "/usr/bin/tpm2_unseal", NULL, &b));
+    assert_true(tpm2_sched_push(&s, "tpm2", "sign", &c));
+    assert_int_equal(tpm2_sched_count(&s), 3);
+
+    /* without rules every tool is normal, the order is kept */
+    assert_ptr_equal(tpm2_sched_pop(&s), &a);
+    assert_ptr_equal(tpm2_sched_pop(&s), &b);
+    assert_ptr_equal(tpm2_sched_pop(&s), &c);
+    assert_null(tpm2_sched_pop(&s));
+}
+
+static void test_sched_classes(void **state) {
+    UNUSED(state);
+
+    tpm2_sched s;
+    tpm2_sched_init(&s);
+
+    assert_true(tpm2_sched_add_rules(&s, "interactive:unseal,sign"));
+    assert_true(tpm2_sched_add_rules(&s, "background:getrandom,pcrread"));
+
+    assert_int_equal(tpm2_sched_classify(&s, "tpm2_unseal", NULL),
+            tpm2_sched_class_interactive);
+    assert_int_equal(tpm2_sched_classify(&s, "tpm2", "tpm2_sign"),
+            tpm2_sched_class_interactive);
+    assert_int_equal(tpm2_sched_classify(&s, "pcrread", NULL),
+            tpm2_sched_class_background);
+    assert_int_equal(tpm2_sched_classify(&s, "tpm2_quote", NULL),
+            tpm2_sched_class_normal);
+
+    int random1, quote, random2, unseal, sign;
+    assert_true(tpm2_sched_push(&s, "tpm2_getrandom", NULL, &random1));
+    assert_true(tpm2_sched_push(&s, "tpm2_quote", NULL, &quote));
+    assert_true(tpm2_sched_push(&s, "tpm2_getrandom", NULL, &random2));
+    assert_true(tpm2_sched_push(&s, "tpm2_unseal", NULL, &unseal));
+    assert_true(tpm2_sched_push(&s, "tpm2_sign", NULL, &sign));
+
+    assert_ptr_equal(tpm2_sched_pop(&s), &unseal);
+    assert_ptr_equal(tpm2_sched_pop(&s), &sign);
+    assert_ptr_equal(tpm2_sched_pop(&s), &quote);
+    assert_ptr_equal(tpm2_sched_pop(&s), &random1);
+    assert_ptr_equal(tpm2_sched_pop(&s), &random2);
+}
+
+static void test_sched_rule_replaced(void **state) {
+    UNUSED(state);
+
+    tpm2_sched s;
+    tpm2_sched_init(&s);
+
+    assert_true(tpm2_sched_add_rules(&s, "background:nvwrite"));
+    assert_true(tpm2_sched_add_rules(&s, "interactive:nvwrite"));
+    assert_int_equal(tpm2_sched_classify(&s, "tpm2_nvwrite", NULL),
+            tpm2_sched_class_interactive);
+}
+
+static void test_sched_bad_rules(void **state) {
+    UNUSED(state);
+
+    tpm2_sched s;
+    tpm2_sched_init(&s);
+
+    assert_false(tpm2_sched_add_rules(&s, "unseal"));
+    assert_false(tpm2_sched_add_rules(&s, "urgent:unseal"));
+    assert_false(tpm2_sched_add_rules(&s, "interactive:"));
+    assert_false(tpm2_sched_add_rules(&s, "interactive:unseal,,sign"));
+}
+
+static void test_sched_max_long(void **state) {
+    UNUSED(state);
+
+    tpm2_sched s;
+    tpm2_sched_init(&s);
+    tpm2_sched_set_max_long(&s, 2);
+    assert_true(tpm2_sched_add_rules(&s, "background:getrandom"));
+
+    int create1, create2, create3, create4, random;
+    assert_true(tpm2_sched_push(&s, "tpm2_createprimary", NULL, &create1));
+    assert_true(tpm2_sched_push(&s, "tpm2_create", NULL, &create2));
+    assert_true(tpm2_sched_push(&s, "tpm2_createloaded", NULL, &create3));
+    assert_true(tpm2_sched_push(&s, "tpm2", "createak", &create4));
+    assert_true(tpm2_sched_push(&s, "tpm2_getrandom", NULL, &random));
+
+    /* past the cap the background request goes first */
+    assert_ptr_equal(tpm2_sched_pop(&s), &create1);
+    assert_ptr_equal(tpm2_sched_pop(&s), &create2);
+    assert_ptr_equal(tpm2_sched_pop(&s), &random);
+    assert_ptr_equal(tpm2_sched_pop(&s), &create3);
+    assert_ptr_equal(tpm2_sched_pop(&s), &create4);
+
+    /* with only long running requests waiting they run anyway */
+    assert_true(tpm2_sched_push(&s, "tpm2_create", NULL, &create1));
+    assert_ptr_equal(tpm2_sched_pop(&s), &create1);
+}
+
+static void test_sched_full(void **state) {
+    UNUSED(state);
+
+    tpm2_sched s;
+    tpm2_sched_init(&s);
+
+    int data;
+    size_t i;
+    for (i = 0; i < TPM2_SCHED_QUEUE_MAX; i++) {
+        assert_true(tpm2_sched_push(&s, "tpm2_getrandom", NULL, &data));
+    }
+
+    assert_true(tpm2_sched_is_full(&s));
+    assert_false(tpm2_sched_push(&s, "tpm2_getrandom", NULL, &data));
+
+    assert_ptr_equal(tpm2_sched_pop(&s), &data);
+    assert_false(tpm2_sched_is_full(&s));
+}
+
+/* link required symbol, but tpm2_tool.c declares it AND main, which
+ * we have a main below for cmocka tests.
+ */
+bool output_enabled = true;
+
+int main(int argc, char *argv[]) {
+    UNUSED(argc);
+    UNUSED(argv);
+
+    const struct CMUnitTest tests[] = {
+        cmocka_unit_test(test_sched_fifo),
+        cmocka_unit_test(test_sched_classes),
+        cmocka_unit_test(test_sched_rule_replaced),
+        cmocka_unit_test(test_sched_bad_rules),
+        cmocka_unit_test(test_sched_max_long),
+        cmocka_unit_test(test_sched_full),
+    };
+
+    return cmocka_run_group_tests(tests, NULL, NULL);
+}
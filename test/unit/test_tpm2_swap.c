@@ -0,0 +1,329 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <setjmp.h>
+#include <cmocka.h>
+
+#include "tpm2_swap.h"
+#include "tpm2_util.h"
+
+#define TEST_SLOTS 2
+#define TEST_HANDLE_FIRST 0x80000000
+
+/*
+ * A TPM with TEST_SLOTS transient slots. LoadExternal loads an object of the
+ * U32 id in its parameter, ReadPublic answers with the id of an object, and a
+ * saved context is the id.
+ */
+typedef struct test_tpm test_tpm;
+struct test_tpm {
+    TSS2_TCTI_CONTEXT_COMMON_V2 common;
+    /* the id of the object in every slot, 0 for a free slot */
+    UINT32 slots[TEST_SLOTS];
+    uint8_t response[64];
+    size_t response_size;
+    unsigned saved;
+    unsigned loaded;
+    unsigned flushed;
+    unsigned transmitted;
+};
+
+static UINT32 get_u32(const uint8_t *p) {
+
+    return (UINT32) p[0] << 24 | p[1] << 16 | p[2] << 8 | p[3];
+}
+
+static void put_u32(uint8_t *p, UINT32 value) {
+
+    p[0] = value >> 24;
+    p[1] = value >> 16;
+    p[2] = value >> 8;
+    p[3] = value;
+}
+
+static void test_tpm_respond(test_tpm *tpm, TSS2_RC rc,
+        const UINT32 *values, size_t count) {
+
+    size_t size = 10 + count * sizeof(UINT32);
+    uint8_t *p = tpm->response;
+    p[0] = 0x80;
+    p[1] = 0x01;
+    put_u32(&p[2], size);
+    put_u32(&p[6], rc);
+
+    size_t i;
+    for (i = 0; i < count; i++) {
+        put_u32(&p[10 + i * sizeof(UINT32)], values[i]);
+    }
+
+    tpm->response_size = size;
+}
+
+static bool test_tpm_slot(test_tpm *tpm, TPM2_HANDLE handle, size_t *slot) {
+
+    *slot = handle - TEST_HANDLE_FIRST;
+
+    return handle >= TEST_HANDLE_FIRST && *slot < TEST_SLOTS
+            && tpm->slots[*slot];
+}
+
+static bool test_tpm_load(test_tpm *tpm, UINT32 id) {
+
+    size_t i;
+    for (i = 0; i < TEST_SLOTS; i++) {
+        if (!tpm->slots[i]) {
+            tpm->slots[i] = id;
+            UINT32 handle = TEST_HANDLE_FIRST + i;
+            test_tpm_respond(tpm, TPM2_RC_SUCCESS, &handle, 1);
+            return true;
+        }
+    }
+
+    test_tpm_respond(tpm, TPM2_RC_OBJECT_MEMORY, NULL, 0);
+
+    return false;
+}
+
+static TSS2_RC test_tpm_transmit(TSS2_TCTI_CONTEXT *tcti_context,
+        size_t size, const uint8_t *command) {
+
+    test_tpm *tpm = (test_tpm *) tcti_context;
+
+    assert_true(size >= 10);
+    TPM2_CC cc = get_u32(&command[6]);
+    UINT32 value = size >= 14 ? get_u32(&command[10]) : 0;
+    size_t slot;
+
+    tpm->transmitted++;
+
+    switch (cc) {
+    case TPM2_CC_GetCapability: {
+        /* moreData, the capability, then the TPML_CCA */
+        const UINT32 capability[] = {
+            TPM2_CAP_COMMANDS,
+            5,
+            TPM2_CC_LoadExternal | TPMA_CC_RHANDLE,
+            TPM2_CC_ReadPublic | 1 << TPMA_CC_CHANDLES_SHIFT,
+            TPM2_CC_ContextSave | 1 << TPMA_CC_CHANDLES_SHIFT,
+            TPM2_CC_ContextLoad | TPMA_CC_RHANDLE,
+            TPM2_CC_FlushContext,
+        };
+        assert_int_equal(value, TPM2_CAP_COMMANDS);
+        test_tpm_respond(tpm, TPM2_RC_SUCCESS, NULL, 0);
+        tpm->response[10] = 0;
+        size_t i;
+        for (i = 0; i < ARRAY_LEN(capability); i++) {
+            put_u32(&tpm->response[11 + i * sizeof(UINT32)], capability[i]);
+        }
+        tpm->response_size = 11 + sizeof(capability);
+        put_u32(&tpm->response[2], tpm->response_size);
+    }
+        break;
+    case TPM2_CC_LoadExternal:
+        test_tpm_load(tpm, value);
+        break;
+    case TPM2_CC_ContextLoad:
+        if (test_tpm_load(tpm, value)) {
+            tpm->loaded++;
+        }
+        break;
+    case TPM2_CC_ReadPublic:
+        if (test_tpm_slot(tpm, value, &slot)) {
+            test_tpm_respond(tpm, TPM2_RC_SUCCESS, &tpm->slots[slot], 1);
+        } else {
+            test_tpm_respond(tpm, TPM2_RC_HANDLE | TPM2_RC_1, NULL, 0);
+        }
+        break;
+    case TPM2_CC_ContextSave:
+        assert_true(test_tpm_slot(tpm, value, &slot));
+        tpm->saved++;
+        test_tpm_respond(tpm, TPM2_RC_SUCCESS, &tpm->slots[slot], 1);
+        break;
+    case TPM2_CC_FlushContext:
+        assert_true(test_tpm_slot(tpm, value, &slot));
+        tpm->slots[slot] = 0;
+        tpm->flushed++;
+        test_tpm_respond(tpm, TPM2_RC_SUCCESS, NULL, 0);
+        break;
+    default:
+        fail_msg("unexpected command 0x%x", cc);
+    }
+
+    return TSS2_RC_SUCCESS;
+}
+
+static TSS2_RC test_tpm_receive(TSS2_TCTI_CONTEXT *tcti_context,
+        size_t *size, uint8_t *response, int32_t timeout) {
+
+    UNUSED(timeout);
+
+    test_tpm *tpm = (test_tpm *) tcti_context;
+
+    assert_non_null(response);
+    assert_true(*size >= tpm->response_size);
+    memcpy(response, tpm->response, tpm->response_size);
+    *size = tpm->response_size;
+
+    return TSS2_RC_SUCCESS;
+}
+
+static void test_tpm_init(test_tpm *tpm) {
+
+    memset(tpm, 0, sizeof(*tpm));
+    tpm->common.v1.version = 2;
+    tpm->common.v1.transmit = test_tpm_transmit;
+    tpm->common.v1.receive = test_tpm_receive;
+}
+
+/* sends a command with a single handle or parameter, returns the rc */
+static TSS2_RC send_command(TSS2_TCTI_CONTEXT *tcti, TPM2_CC cc,
+        UINT32 value, UINT32 *result) {
+
+    uint8_t command[14] = { 0x80, 0x01 };
+    put_u32(&command[2], sizeof(command));
+    put_u32(&command[6], cc);
+    put_u32(&command[10], value);
+
+    TSS2_RC rval = Tss2_Tcti_Transmit(tcti, sizeof(command), command);
+    assert_int_equal(rval, TSS2_RC_SUCCESS);
+
+    uint8_t response[64];
+    size_t size = sizeof(response);
+    rval = Tss2_Tcti_Receive(tcti, &size, response, TSS2_TCTI_TIMEOUT_BLOCK);
+    assert_int_equal(rval, TSS2_RC_SUCCESS);
+    assert_true(size >= 10);
+
+    if (result && size >= 14) {
+        *result = get_u32(&response[10]);
+    }
+
+    return get_u32(&response[6]);
+}
+
+static TPM2_HANDLE load(TSS2_TCTI_CONTEXT *tcti, UINT32 id) {
+
+    TPM2_HANDLE handle = 0;
+    TSS2_RC rc = send_command(tcti, TPM2_CC_LoadExternal, id, &handle);
+    assert_int_equal(rc, TPM2_RC_SUCCESS);
+    assert_true(handle >= TPM2_SWAP_HANDLE_FIRST);
+
+    return handle;
+}
+
+static UINT32 read_public(TSS2_TCTI_CONTEXT *tcti, TPM2_HANDLE handle) {
+
+    UINT32 id = 0;
+    TSS2_RC rc = send_command(tcti, TPM2_CC_ReadPublic, handle, &id);
+    assert_int_equal(rc, TPM2_RC_SUCCESS);
+
+    return id;
+}
+
+static void test_tpm2_swap_off(void **state) {
+    UNUSED(state);
+
+    unsetenv(TPM2TOOLS_ENV_OBJECT_SWAP);
+
+    test_tpm tpm;
+    test_tpm_init(&tpm);
+
+    TSS2_TCTI_CONTEXT *tcti = tpm2_swap_tcti_wrap((TSS2_TCTI_CONTEXT *) &tpm);
+    assert_ptr_equal(tcti, &tpm);
+}
+
+static void test_tpm2_swap_more_objects_than_slots(void **state) {
+    UNUSED(state);
+
+    setenv(TPM2TOOLS_ENV_OBJECT_SWAP, "1", 1);
+
+    test_tpm tpm;
+    test_tpm_init(&tpm);
+
+    TSS2_TCTI_CONTEXT *tcti = tpm2_swap_tcti_wrap((TSS2_TCTI_CONTEXT *) &tpm);
+    assert_ptr_not_equal(tcti, &tpm);
+
+    TPM2_HANDLE a = load(tcti, 11);
+    TPM2_HANDLE b = load(tcti, 12);
+    assert_int_equal(tpm.saved, 0);
+
+    /* the third object swaps out the least recently used one */
+    TPM2_HANDLE c = load(tcti, 13);
+    assert_int_not_equal(a, b);
+    assert_int_not_equal(b, c);
+    assert_int_equal(tpm.saved, 1);
+    assert_int_equal(tpm.flushed, 1);
+
+    /* a is loaded back in place of b */
+    assert_int_equal(read_public(tcti, a), 11);
+    assert_int_equal(tpm.loaded, 1);
+    assert_int_equal(tpm.saved, 2);
+    assert_int_equal(read_public(tcti, c), 13);
+    assert_int_equal(read_public(tcti, b), 12);
+    assert_int_equal(tpm.loaded, 2);
+    assert_int_equal(tpm.saved, 3);
+
+    /* b and c are loaded, using them does not swap */
+    assert_int_equal(read_public(tcti, c), 13);
+    assert_int_equal(tpm.saved, 3);
+
+    assert_ptr_equal(tpm2_swap_tcti_unwrap(tcti), &tpm);
+}
+
+static void test_tpm2_swap_flush(void **state) {
+    UNUSED(state);
+
+    setenv(TPM2TOOLS_ENV_OBJECT_SWAP, "1", 1);
+
+    test_tpm tpm;
+    test_tpm_init(&tpm);
+
+    TSS2_TCTI_CONTEXT *tcti = tpm2_swap_tcti_wrap((TSS2_TCTI_CONTEXT *) &tpm);
+
+    TPM2_HANDLE a = load(tcti, 11);
+    TPM2_HANDLE b = load(tcti, 12);
+    TPM2_HANDLE c = load(tcti, 13);
+
+    /* a swapped out object is just dropped */
+    unsigned transmitted = tpm.transmitted;
+    TSS2_RC rc = send_command(tcti, TPM2_CC_FlushContext, a, NULL);
+    assert_int_equal(rc, TPM2_RC_SUCCESS);
+    assert_int_equal(tpm.transmitted, transmitted);
+
+    /* a loaded one is flushed by the TPM */
+    rc = send_command(tcti, TPM2_CC_FlushContext, b, NULL);
+    assert_int_equal(rc, TPM2_RC_SUCCESS);
+    assert_int_equal(tpm.flushed, 2);
+    assert_int_equal(tpm.slots[0] + tpm.slots[1], 13);
+
+    /* the flushed handles are gone, the freed slot is used without a swap */
+    rc = send_command(tcti, TPM2_CC_ReadPublic, a, NULL);
+    assert_int_equal(rc, TPM2_RC_HANDLE | TPM2_RC_1);
+    TPM2_HANDLE d = load(tcti, 14);
+    assert_int_equal(tpm.saved, 1);
+    assert_int_equal(read_public(tcti, d), 14);
+    assert_int_equal(read_public(tcti, c), 13);
+
+    assert_ptr_equal(tpm2_swap_tcti_unwrap(tcti), &tpm);
+}
+
+/* link required symbol, but tpm2_tool.c declares it AND main, which
+ * we have a main below for cmocka tests.
+ */
+bool output_enabled = true;
+
+int main(int argc, char *argv[]) {
+    UNUSED(argc);
+    UNUSED(argv);
+
+    const struct CMUnitTest tests[] = {
+        cmocka_unit_test(test_tpm2_swap_off),
+        cmocka_unit_test(test_tpm2_swap_more_objects_than_slots),
+        cmocka_unit_test(test_tpm2_swap_flush),
+    };
+
+    return cmocka_run_group_tests(tests, NULL, NULL);
+}
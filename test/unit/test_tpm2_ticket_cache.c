@@ -0,0 +1,222 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+#include <limits.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <setjmp.h>
+#include <cmocka.h>
+
+#include "tpm2_ticket_cache.h"
+#include "tpm2_util.h"
+
+typedef struct test_cache test_cache;
+struct test_cache {
+    char path[PATH_MAX];
+};
+
+static int test_setup(void **state) {
+
+    test_cache *t = calloc(1, sizeof(*t));
+    assert_non_null(t);
+
+    strcpy(t->path, "/tmp/test_tpm2_ticket_cache.XXXXXX");
+    int fd = mkstemp(t->path);
+    assert_true(fd >= 0);
+    close(fd);
+    /* the cache is created by the first put */
+    unlink(t->path);
+
+    *state = t;
+
+    return 0;
+}
+
+static int test_teardown(void **state) {
+
+    test_cache *t = (test_cache *) *state;
+    unlink(t->path);
+    free(t);
+
+    return 0;
+}
+
+static void key_init(tpm2_ticket_cache_key *key, UINT8 name) {
+
+    memset(key, 0, sizeof(*key));
+    key->policy_ref.size = 4;
+    memcpy(key->policy_ref.buffer, "ref0", 4);
+    key->auth_name.size = 4;
+    memset(key->auth_name.name, name, 4);
+}
+
+static void ticket_init(TPMT_TK_AUTH *ticket, TPM2B_TIMEOUT *timeout,
+        UINT8 value) {
+
+    memset(ticket, 0, sizeof(*ticket));
+    ticket->tag = TPM2_ST_AUTH_SECRET;
+    ticket->hierarchy = TPM2_RH_OWNER;
+    ticket->digest.size = 32;
+    memset(ticket->digest.buffer, value, 32);
+
+    timeout->size = 8;
+    memset(timeout->buffer, value, 8);
+}
+
+static void test_ticket_cache_put_get(void **state) {
+
+    test_cache *t = (test_cache *) *state;
+
+    tpm2_ticket_cache_key key;
+    key_init(&key, 0xaa);
+    TPMT_TK_AUTH ticket;
+    TPM2B_TIMEOUT timeout;
+    ticket_init(&ticket, &timeout, 0x11);
+
+    bool result = tpm2_ticket_cache_put(t->path, &key, -500, &timeout,
+            &ticket);
+    assert_true(result);
+
+    TPMT_TK_AUTH got_ticket = { 0 };
+    TPM2B_TIMEOUT got_timeout = { 0 };
+    result = tpm2_ticket_cache_get(t->path, &key, &got_timeout, &got_ticket);
+    assert_true(result);
+    assert_int_equal(got_ticket.tag, TPM2_ST_AUTH_SECRET);
+    assert_int_equal(got_ticket.hierarchy, TPM2_RH_OWNER);
+    assert_int_equal(got_ticket.digest.size, 32);
+    assert_memory_equal(got_ticket.digest.buffer, ticket.digest.buffer, 32);
+    assert_int_equal(got_timeout.size, 8);
+    assert_memory_equal(got_timeout.buffer, timeout.buffer, 8);
+}
+
+static void test_ticket_cache_key_mismatch(void **state) {
+
+    test_cache *t = (test_cache *) *state;
+
+    tpm2_ticket_cache_key key;
+    key_init(&key, 0xaa);
+    TPMT_TK_AUTH ticket;
+    TPM2B_TIMEOUT timeout;
+    ticket_init(&ticket, &timeout, 0x11);
+
+    bool result = tpm2_ticket_cache_put(t->path, &key, -500, &timeout,
+            &ticket);
+    assert_true(result);
+
+    /* another object */
+    tpm2_ticket_cache_key other;
+    key_init(&other, 0xbb);
+    result = tpm2_ticket_cache_get(t->path, &other, &timeout, &ticket);
+    assert_false(result);
+
+    /* the same object, bound to a cpHash */
+    key_init(&other, 0xaa);
+    other.cp_hash.size = 32;
+    result = tpm2_ticket_cache_get(t->path, &other, &timeout, &ticket);
+    assert_false(result);
+}
+
+static void test_ticket_cache_replace_remove(void **state) {
+
+    test_cache *t = (test_cache *) *state;
+
+    tpm2_ticket_cache_key key_a, key_b;
+    key_init(&key_a, 0xaa);
+    key_init(&key_b, 0xbb);
+    TPMT_TK_AUTH ticket;
+    TPM2B_TIMEOUT timeout;
+
+    ticket_init(&ticket, &timeout, 0x11);
+    assert_true(tpm2_ticket_cache_put(t->path, &key_a, -500, &timeout,
+            &ticket));
+    ticket_init(&ticket, &timeout, 0x22);
+    assert_true(tpm2_ticket_cache_put(t->path, &key_b, -500, &timeout,
+            &ticket));
+    ticket_init(&ticket, &timeout, 0x33);
+    assert_true(tpm2_ticket_cache_put(t->path, &key_a, -500, &timeout,
+            &ticket));
+
+    /* the newer ticket replaced the first one */
+    TPMT_TK_AUTH got = { 0 };
+    assert_true(tpm2_ticket_cache_get(t->path, &key_a, &timeout, &got));
+    assert_int_equal(got.digest.buffer[0], 0x33);
+
+    assert_true(tpm2_ticket_cache_remove(t->path, &key_a));
+    assert_false(tpm2_ticket_cache_get(t->path, &key_a, &timeout, &got));
+
+    /* the other entry stays */
+    assert_true(tpm2_ticket_cache_get(t->path, &key_b, &timeout, &got));
+    assert_int_equal(got.digest.buffer[0], 0x22);
+}
+
+static void test_ticket_cache_no_ticket(void **state) {
+
+    test_cache *t = (test_cache *) *state;
+
+    tpm2_ticket_cache_key key;
+    key_init(&key, 0xaa);
+    TPMT_TK_AUTH ticket;
+    TPM2B_TIMEOUT timeout;
+    ticket_init(&ticket, &timeout, 0x11);
+
+    /* only a negative expiration produces a ticket */
+    bool result = tpm2_ticket_cache_put(t->path, &key, 500, &timeout,
+            &ticket);
+    assert_false(result);
+
+    result = tpm2_ticket_cache_get(t->path, &key, &timeout, &ticket);
+    assert_false(result);
+}
+
+static void test_ticket_cache_damaged(void **state) {
+
+    test_cache *t = (test_cache *) *state;
+
+    FILE *f = fopen(t->path, "wb");
+    assert_non_null(f);
+    fputs("not a ticket cache", f);
+    fclose(f);
+
+    tpm2_ticket_cache_key key;
+    key_init(&key, 0xaa);
+    TPMT_TK_AUTH ticket;
+    TPM2B_TIMEOUT timeout;
+    bool result = tpm2_ticket_cache_get(t->path, &key, &timeout, &ticket);
+    assert_false(result);
+
+    /* a damaged cache is replaced by the next put */
+    ticket_init(&ticket, &timeout, 0x11);
+    result = tpm2_ticket_cache_put(t->path, &key, -500, &timeout, &ticket);
+    assert_true(result);
+    result = tpm2_ticket_cache_get(t->path, &key, &timeout, &ticket);
+    assert_true(result);
+}
+
+/* link required symbol, but tpm2_tool.c declares it AND main, which
+ * we have a main below for cmocka tests.
+ */
+bool output_enabled = true;
+
+int main(int argc, char *argv[]) {
+    UNUSED(argc);
+    UNUSED(argv);
+
+    const struct CMUnitTest tests[] = {
+        cmocka_unit_test_setup_teardown(test_ticket_cache_put_get,
+                test_setup, test_teardown),
+        cmocka_unit_test_setup_teardown(test_ticket_cache_key_mismatch,
+                test_setup, test_teardown),
+        cmocka_unit_test_setup_teardown(test_ticket_cache_replace_remove,
+                test_setup, test_teardown),
+        cmocka_unit_test_setup_teardown(test_ticket_cache_no_ticket,
+                test_setup, test_teardown),
+        cmocka_unit_test_setup_teardown(test_ticket_cache_damaged,
+                test_setup, test_teardown),
+    };
+
+    return cmocka_run_group_tests(tests, NULL, NULL);
+}
@@ -0,0 +1,205 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+#include <limits.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <setjmp.h>
+#include <cmocka.h>
+
+#include "tpm2_tree_hash.h"
+#include "tpm2_util.h"
+
+#define TEST_CHUNK_SIZE 64
+/* five chunks, the last one short */
+#define TEST_FILE_SIZE (4 * TEST_CHUNK_SIZE + 10)
+
+typedef struct test_tree test_tree;
+struct test_tree {
+    char data_path[PATH_MAX];
+    char tree_path[PATH_MAX];
+};
+
+static void temp_path(char *path, const char *name) {
+
+    snprintf(path, PATH_MAX, "/tmp/test_tpm2_tree_hash.%s.XXXXXX", name);
+    int fd = mkstemp(path);
+    assert_true(fd >= 0);
+    close(fd);
+}
+
+static void write_data(const char *path, size_t size) {
+
+    FILE *f = fopen(path, "wb");
+    assert_non_null(f);
+    size_t i;
+    for (i = 0; i < size; i++) {
+        fputc(i & 0xff, f);
+    }
+    fclose(f);
+}
+
+static void flip_byte(const char *path, long offset) {
+
+    FILE *f = fopen(path, "r+b");
+    assert_non_null(f);
+    assert_int_equal(fseek(f, offset, SEEK_SET), 0);
+    int c = fgetc(f);
+    assert_int_equal(fseek(f, offset, SEEK_SET), 0);
+    fputc(c ^ 0xff, f);
+    fclose(f);
+}
+
+static int test_setup(void **state) {
+
+    test_tree *t = calloc(1, sizeof(*t));
+    assert_non_null(t);
+
+    temp_path(t->data_path, "data");
+    temp_path(t->tree_path, "tree");
+    write_data(t->data_path, TEST_FILE_SIZE);
+
+    *state = t;
+
+    return 0;
+}
+
+static int test_teardown(void **state) {
+
+    test_tree *t = (test_tree *) *state;
+    unlink(t->data_path);
+    unlink(t->tree_path);
+    free(t);
+
+    return 0;
+}
+
+static void test_tree_hash_empty(void **state) {
+
+    test_tree *t = (test_tree *) *state;
+    write_data(t->data_path, 0);
+
+    /* SHA256(0x00), the leaf of the one empty chunk */
+    static const BYTE expected[] = {
+        0x6e, 0x34, 0x0b, 0x9c, 0xff, 0xb3, 0x7a, 0x98,
+        0x9c, 0xa5, 0x44, 0xe6, 0xbb, 0x78, 0x0a, 0x2c,
+        0x78, 0x90, 0x1d, 0x3f, 0xb3, 0x37, 0x38, 0x76,
+        0x85, 0x11, 0xa3, 0x06, 0x17, 0xaf, 0xa0, 0x1d,
+    };
+
+    tpm2_tree_hash tree = { 0 };
+    assert_true(tpm2_tree_hash_file(t->data_path, TPM2_ALG_SHA256,
+            TEST_CHUNK_SIZE, 1, &tree));
+    assert_int_equal(tree.chunk_count, 1);
+
+    TPM2B_DIGEST root = { 0 };
+    assert_true(tpm2_tree_hash_root(&tree, &root));
+    assert_int_equal(root.size, sizeof(expected));
+    assert_memory_equal(root.buffer, expected, sizeof(expected));
+
+    tpm2_tree_hash_free(&tree);
+}
+
+static void test_tree_hash_jobs(void **state) {
+
+    test_tree *t = (test_tree *) *state;
+
+    /* the root does not depend on how many threads hashed the chunks */
+    tpm2_tree_hash serial = { 0 };
+    tpm2_tree_hash parallel = { 0 };
+    assert_true(tpm2_tree_hash_file(t->data_path, TPM2_ALG_SHA256,
+            TEST_CHUNK_SIZE, 1, &serial));
+    assert_true(tpm2_tree_hash_file(t->data_path, TPM2_ALG_SHA256,
+            TEST_CHUNK_SIZE, 4, &parallel));
+    assert_int_equal(serial.chunk_count, 5);
+    assert_int_equal(serial.length, TEST_FILE_SIZE);
+    assert_memory_equal(serial.chunks, parallel.chunks, 5 * 32);
+
+    TPM2B_MAX_BUFFER data = { 0 };
+    assert_true(tpm2_tree_hash_signed_data(&serial, &data));
+    /* the root, U32 chunk size and U64 length */
+    assert_int_equal(data.size, 32 + 4 + 8);
+    assert_int_equal(data.buffer[32 + 3], TEST_CHUNK_SIZE);
+    assert_int_equal(data.buffer[32 + 4 + 7], TEST_FILE_SIZE & 0xff);
+
+    tpm2_tree_hash_free(&serial);
+    tpm2_tree_hash_free(&parallel);
+}
+
+static void test_tree_hash_save_load(void **state) {
+
+    test_tree *t = (test_tree *) *state;
+
+    tpm2_tree_hash tree = { 0 };
+    assert_true(tpm2_tree_hash_file(t->data_path, TPM2_ALG_SHA256,
+            TEST_CHUNK_SIZE, 0, &tree));
+    assert_true(tpm2_tree_hash_save(t->tree_path, &tree));
+
+    tpm2_tree_hash loaded = { 0 };
+    assert_true(tpm2_tree_hash_load(t->tree_path, &loaded));
+    assert_int_equal(loaded.halg, TPM2_ALG_SHA256);
+    assert_int_equal(loaded.chunk_size, TEST_CHUNK_SIZE);
+    assert_int_equal(loaded.length, TEST_FILE_SIZE);
+    assert_int_equal(loaded.chunk_count, tree.chunk_count);
+    assert_memory_equal(loaded.chunks, tree.chunks, tree.chunk_count * 32);
+
+    tpm2_tree_hash_free(&tree);
+    tpm2_tree_hash_free(&loaded);
+
+    /* a truncated manifest misses chunks */
+    assert_int_equal(truncate(t->tree_path, 40), 0);
+    assert_false(tpm2_tree_hash_load(t->tree_path, &loaded));
+}
+
+static void test_tree_hash_check_range(void **state) {
+
+    test_tree *t = (test_tree *) *state;
+
+    tpm2_tree_hash tree = { 0 };
+    assert_true(tpm2_tree_hash_file(t->data_path, TPM2_ALG_SHA256,
+            TEST_CHUNK_SIZE, 0, &tree));
+    assert_true(tpm2_tree_hash_check(t->data_path, &tree, 0, 0, 0));
+
+    /* a damaged second chunk fails the ranges covering it only */
+    flip_byte(t->data_path, TEST_CHUNK_SIZE + 1);
+    assert_false(tpm2_tree_hash_check(t->data_path, &tree, 0, 0, 0));
+    assert_false(tpm2_tree_hash_check(t->data_path, &tree,
+            TEST_CHUNK_SIZE - 1, 2, 0));
+    assert_true(tpm2_tree_hash_check(t->data_path, &tree, 0,
+            TEST_CHUNK_SIZE, 0));
+    assert_true(tpm2_tree_hash_check(t->data_path, &tree,
+            2 * TEST_CHUNK_SIZE, 0, 0));
+
+    /* past the end */
+    assert_false(tpm2_tree_hash_check(t->data_path, &tree,
+            TEST_FILE_SIZE, 1, 0));
+
+    tpm2_tree_hash_free(&tree);
+}
+
+/* link required symbol, but tpm2_tool.c declares it AND main, which
+ * we have a main below for cmocka tests.
+ */
+bool output_enabled = true;
+
+int main(int argc, char *argv[]) {
+    UNUSED(argc);
+    UNUSED(argv);
+
+    const struct CMUnitTest tests[] = {
+        cmocka_unit_test_setup_teardown(test_tree_hash_empty,
+                test_setup, test_teardown),
+        cmocka_unit_test_setup_teardown(test_tree_hash_jobs,
+                test_setup, test_teardown),
+        cmocka_unit_test_setup_teardown(test_tree_hash_save_load,
+                test_setup, test_teardown),
+        cmocka_unit_test_setup_teardown(test_tree_hash_check_range,
+                test_setup, test_teardown),
+    };
+
+    return cmocka_run_group_tests(tests, NULL, NULL);
+}
@@ -2,6 +2,9 @@
 
 #include <stdbool.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
 
 #include <setjmp.h>
 #include <cmocka.h>
@@ -168,6 +171,172 @@ static void test_tpm2_util_handle_from_optarg_nv_invalid_offset(void **state) {
     assert_false(result);
 }
 
+static void test_tpm2_util_split_args(void **state) {
+    (void) state;
+
+    char line[] = "pcrread  sha256:0 -o 'a b.bin' \"x\\\"y\" c\\ d # comment\n";
+
+    int argc = 0;
+    char **argv = NULL;
+    bool result = tpm2_util_split_args(line, &argc, &argv);
+    assert_true(result);
+    assert_int_equal(argc, 6);
+    assert_string_equal(argv[0], "pcrread");
+    assert_string_equal(argv[1], "sha256:0");
+    assert_string_equal(argv[2], "-o");
+    assert_string_equal(argv[3], "a b.bin");
+    assert_string_equal(argv[4], "x\"y");
+    assert_string_equal(argv[5], "c d");
+    assert_null(argv[6]);
+    free(argv);
+}
+
+static void test_tpm2_util_split_args_empty(void **state) {
+    (void) state;
+
+    char line[] = "   # only a comment\n";
+
+    int argc = -1;
+    char **argv = NULL;
+    bool result = tpm2_util_split_args(line, &argc, &argv);
+    assert_true(result);
+    assert_int_equal(argc, 0);
+    assert_null(argv[0]);
+    free(argv);
+}
+
+static void test_tpm2_util_split_args_unterminated(void **state) {
+    (void) state;
+
+    char line[] = "getrandom -o 'random.out 16";
+
+    int argc = 0;
+    char **argv = NULL;
+    bool result = tpm2_util_split_args(line, &argc, &argv);
+    assert_false(result);
+}
+
+typedef struct manifest_test_entry manifest_test_entry;
+struct manifest_test_entry {
+    char *line;
+    size_t line_number;
+    const char *first;
+    size_t count;
+};
+
+static bool manifest_test_add(void *e, char *line, char **fields,
+        size_t count, size_t line_number, void *userdata) {
+
+    size_t *lines = (size_t *) userdata;
+    (*lines)++;
+
+    if (!e) {
+        free(line);
+        return true;
+    }
+
+    manifest_test_entry *entry = (manifest_test_entry *) e;
+    entry->line = line;
+    entry->line_number = line_number;
+    entry->first = fields[0];
+    entry->count = count;
+
+    return true;
+}
+
+#define MANIFEST_TEST_PATH "/tmp/test_tpm2_util_manifest.XXXXXX"
+
+static void manifest_test_write(char *path, const char *content) {
+
+    int fd = mkstemp(path);
+    assert_true(fd >= 0);
+    FILE *f = fdopen(fd, "w");
+    assert_non_null(f);
+    fputs(content, f);
+    fclose(f);
+}
+
+static void manifest_test_free(manifest_test_entry *entries, size_t count) {
+
+    size_t i;
+    for (i = 0; i < count; i++) {
+        free(entries[i].line);
+    }
+    free(entries);
+}
+
+static void test_tpm2_util_manifest_read(void **state) {
+    (void) state;
+
+    /* more lines than the first capacity, so the entries grow */
+    char content[4096] = "# a comment\n\n   \t\n";
+    size_t i;
+    for (i = 0; i < 40; i++) {
+        char line[64];
+        snprintf(line, sizeof(line), "key%zu.pub  key%zu.priv%s # note\n", i,
+                i, i % 2 ? " extra" : "");
+        strcat(content, line);
+    }
+    char path[] = MANIFEST_TEST_PATH;
+    manifest_test_write(path, content);
+
+    manifest_test_entry *entries = NULL;
+    size_t count = 0;
+    size_t lines = 0;
+    bool result = tpm2_util_manifest_read(path, 2, 3, "<public> <private>",
+            (void **) &entries, &count, sizeof(*entries), manifest_test_add,
+            &lines);
+    assert_true(result);
+    assert_int_equal(count, 40);
+    assert_int_equal(lines, 40);
+    assert_int_equal(entries[0].line_number, 4);
+    assert_string_equal(entries[0].first, "key0.pub");
+    assert_int_equal(entries[0].count, 2);
+    assert_string_equal(entries[39].first, "key39.pub");
+    assert_int_equal(entries[39].count, 3);
+    manifest_test_free(entries, count);
+
+    /* without entries, each line is handled as it is read */
+    lines = 0;
+    result = tpm2_util_manifest_read(path, 2, 3, "<public> <private>", NULL,
+            NULL, 0, manifest_test_add, &lines);
+    assert_true(result);
+    assert_int_equal(lines, 40);
+
+    unlink(path);
+}
+
+static void test_tpm2_util_manifest_read_fields(void **state) {
+    (void) state;
+
+    /* the entries before a bad line are kept */
+    char path[] = MANIFEST_TEST_PATH;
+    manifest_test_write(path, "a b\na b c d\n");
+
+    manifest_test_entry *entries = NULL;
+    size_t count = 0;
+    size_t lines = 0;
+    bool result = tpm2_util_manifest_read(path, 2, 3, "<public> <private>",
+            (void **) &entries, &count, sizeof(*entries), manifest_test_add,
+            &lines);
+    assert_false(result);
+    assert_int_equal(count, 1);
+    manifest_test_free(entries, count);
+    unlink(path);
+
+    char short_path[] = MANIFEST_TEST_PATH;
+    manifest_test_write(short_path, "a\n");
+    entries = NULL;
+    count = 0;
+    result = tpm2_util_manifest_read(short_path, 2, 3, "<public> <private>",
+            (void **) &entries, &count, sizeof(*entries), manifest_test_add,
+            &lines);
+    assert_false(result);
+    assert_int_equal(count, 0);
+    free(entries);
+    unlink(short_path);
+}
+
 /* link required symbol, but tpm2_tool.c declares it AND main, which
  * we have a main below for cmocka tests.
  */
@@ -187,6 +356,11 @@ int main(int argc, char* argv[]) {
         cmocka_unit_test(test_tpm2_util_handle_from_optarg_valid_ids_enabled),
         cmocka_unit_test(test_tpm2_util_handle_from_optarg_nv_valid_range),
         cmocka_unit_test(test_tpm2_util_handle_from_optarg_nv_invalid_offset),
+        cmocka_unit_test(test_tpm2_util_split_args),
+        cmocka_unit_test(test_tpm2_util_split_args_empty),
+        cmocka_unit_test(test_tpm2_util_split_args_unterminated),
+        cmocka_unit_test(test_tpm2_util_manifest_read),
+        cmocka_unit_test(test_tpm2_util_manifest_read_fields),
     };
 
     return cmocka_run_group_tests(tests, NULL, NULL);
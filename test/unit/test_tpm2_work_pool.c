@@ -0,0 +1,231 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <setjmp.h>
+#include <cmocka.h>
+
+#include "tpm2_openssl.h"
+#include "tpm2_util.h"
+#include "tpm2_work_pool.h"
+
+#define TEST_JOBS 4
+#define TEST_COUNT 200
+
+typedef struct test_pool test_pool;
+struct test_pool {
+    size_t delivered;
+    size_t stop_after;
+    bool is_out_of_order;
+    UINT32 max_worker;
+    TPM2B_DIGEST digests[TEST_COUNT];
+};
+
+static bool test_work(tpm2_work_worker *worker, size_t index,
+        void *userdata) {
+
+    test_pool *t = (test_pool *) userdata;
+
+    UINT32 i = tpm2_work_worker_index(worker);
+    if (i > __atomic_load_n(&t->max_worker, __ATOMIC_RELAXED)) {
+        __atomic_store_n(&t->max_worker, i, __ATOMIC_RELAXED);
+    }
+
+    /* the later jobs finish first */
+    usleep((TEST_COUNT - index) % 7 * 100);
+
+    BYTE data[sizeof(index)];
+    memcpy(data, &index, sizeof(index));
+
+    return tpm2_openssl_hash_compute_data(TPM2_ALG_SHA256, data, sizeof(data),
+            &t->digests[index]) && index % 3;
+}
+
+static bool test_deliver(size_t index, bool result, void *userdata) {
+
+    test_pool *t = (test_pool *) userdata;
+
+    if (index != t->delivered || result != !!(index % 3)) {
+        t->is_out_of_order = true;
+    }
+    t->delivered++;
+
+    return !t->stop_after || t->delivered < t->stop_after;
+}
+
+static void test_tpm2_work_pool_ordered(void **state) {
+    UNUSED(state);
+
+    test_pool *t = calloc(1, sizeof(*t));
+    assert_non_null(t);
+
+    bool result = tpm2_work_pool_run(TEST_COUNT, TEST_JOBS, test_work,
+            test_deliver, t);
+    assert_true(result);
+    assert_int_equal(t->delivered, TEST_COUNT);
+    assert_false(t->is_out_of_order);
+    assert_true(t->max_worker < TEST_JOBS);
+
+    /* the digests of the workers are those of the calling thread */
+    size_t i;
+    for (i = 0; i < TEST_COUNT; i++) {
+        BYTE data[sizeof(i)];
+        memcpy(data, &i, sizeof(i));
+        TPM2B_DIGEST digest;
+        assert_true(tpm2_openssl_hash_compute_data(TPM2_ALG_SHA256, data,
+                sizeof(data), &digest));
+        assert_int_equal(t->digests[i].size, digest.size);
+        assert_memory_equal(t->digests[i].buffer, digest.buffer, digest.size);
+    }
+
+    free(t);
+}
+
+static void test_tpm2_work_pool_stop(void **state) {
+    UNUSED(state);
+
+    test_pool *t = calloc(1, sizeof(*t));
+    assert_non_null(t);
+    t->stop_after = 10;
+
+    bool result = tpm2_work_pool_run(TEST_COUNT, TEST_JOBS, test_work,
+            test_deliver, t);
+    assert_false(result);
+    assert_int_equal(t->delivered, 10);
+    assert_false(t->is_out_of_order);
+
+    free(t);
+}
+
+static void test_tpm2_work_pool_empty(void **state) {
+    UNUSED(state);
+
+    assert_true(tpm2_work_pool_run(0, TEST_JOBS, test_work, test_deliver,
+            NULL));
+}
+
+static void test_tpm2_work_pool_workers(void **state) {
+    UNUSED(state);
+
+    assert_int_equal(tpm2_work_pool_workers(8, 3), 3);
+    assert_int_equal(tpm2_work_pool_workers(2, 100), 2);
+    assert_int_equal(tpm2_work_pool_workers(0, 1), 1);
+    assert_true(tpm2_work_pool_workers(0, 100) >= 1);
+}
+
+static bool test_md_ctx_work(tpm2_work_worker *worker, size_t index,
+        void *userdata) {
+    UNUSED(index);
+    UNUSED(userdata);
+
+    if (tpm2_work_worker_current() != worker) {
+        return false;
+    }
+
+    /* a second context while the one of the worker is taken is another one */
+    EVP_MD_CTX *first = tpm2_openssl_md_ctx_get();
+    EVP_MD_CTX *second = tpm2_openssl_md_ctx_get();
+    bool result = first && second && first != second;
+    tpm2_openssl_md_ctx_put(second);
+    tpm2_openssl_md_ctx_put(first);
+
+    /* the context of the worker is reused by the next job */
+    EVP_MD_CTX *again = tpm2_work_worker_md_ctx_take(worker);
+    result = result && again == first;
+    return tpm2_work_worker_md_ctx_give(worker, again) && result;
+}
+
+static bool test_md_ctx_deliver(size_t index, bool result, void *userdata) {
+    UNUSED(index);
+
+    bool *is_failed = (bool *) userdata;
+    *is_failed = *is_failed || !result;
+
+    return true;
+}
+
+static void test_tpm2_work_pool_md_ctx(void **state) {
+    UNUSED(state);
+
+    assert_null(tpm2_work_worker_current());
+
+    bool is_failed = false;
+    bool result = tpm2_work_pool_run(16, TEST_JOBS, test_md_ctx_work,
+            test_md_ctx_deliver, &is_failed);
+    assert_true(result);
+    assert_false(is_failed);
+}
+
+static bool test_nested_work(tpm2_work_worker *worker, size_t index,
+        void *userdata) {
+    UNUSED(index);
+
+    /* the inner jobs run on the thread of the outer one */
+    pthread_t *outer = (pthread_t *) userdata;
+    return tpm2_work_worker_current() == worker
+            && pthread_equal(*outer, pthread_self());
+}
+
+static bool test_nested_deliver(size_t index, bool result, void *userdata) {
+    UNUSED(index);
+    UNUSED(userdata);
+
+    return result;
+}
+
+static bool test_nested_outer_work(tpm2_work_worker *worker, size_t index,
+        void *userdata) {
+    UNUSED(index);
+    UNUSED(userdata);
+
+    EVP_MD_CTX *mdctx = tpm2_openssl_md_ctx_get();
+
+    pthread_t outer = pthread_self();
+    bool result = tpm2_work_pool_run(8, TEST_JOBS, test_nested_work,
+            test_nested_deliver, &outer);
+
+    /* the outer worker is current again and gets its context back */
+    result = result && tpm2_work_worker_current() == worker;
+    tpm2_openssl_md_ctx_put(mdctx);
+    EVP_MD_CTX *again = tpm2_work_worker_md_ctx_take(worker);
+    result = result && again == mdctx;
+
+    return tpm2_work_worker_md_ctx_give(worker, again) && result;
+}
+
+static void test_tpm2_work_pool_nested(void **state) {
+    UNUSED(state);
+
+    bool is_failed = false;
+    bool result = tpm2_work_pool_run(16, TEST_JOBS, test_nested_outer_work,
+            test_md_ctx_deliver, &is_failed);
+    assert_true(result);
+    assert_false(is_failed);
+    assert_null(tpm2_work_worker_current());
+}
+
+/* link required symbol, but tpm2_tool.c declares it AND main, which
+ * we have a main below for cmocka tests.
+ */
+bool output_enabled = true;
+
+int main(int argc, char *argv[]) {
+    UNUSED(argc);
+    UNUSED(argv);
+
+    const struct CMUnitTest tests[] = {
+        cmocka_unit_test(test_tpm2_work_pool_ordered),
+        cmocka_unit_test(test_tpm2_work_pool_stop),
+        cmocka_unit_test(test_tpm2_work_pool_empty),
+        cmocka_unit_test(test_tpm2_work_pool_workers),
+        cmocka_unit_test(test_tpm2_work_pool_md_ctx),
+        cmocka_unit_test(test_tpm2_work_pool_nested),
+    };
+
+    return cmocka_run_group_tests(tests, NULL, NULL);
+}
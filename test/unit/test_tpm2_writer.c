@@ -0,0 +1,204 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <setjmp.h>
+#include <cmocka.h>
+
+#include "tpm2_tool_output.h"
+#include "tpm2_util.h"
+#include "tpm2_writer.h"
+
+typedef struct capture capture;
+struct capture {
+    FILE *f;
+    int saved;
+};
+
+/* collects what is written to stdout in a temporary file */
+static void capture_start(capture *c) {
+
+    fflush(stdout);
+    c->f = tmpfile();
+    assert_non_null(c->f);
+    c->saved = dup(STDOUT_FILENO);
+    assert_true(c->saved >= 0);
+    assert_true(dup2(fileno(c->f), STDOUT_FILENO) >= 0);
+}
+
+static void capture_end(capture *c, const char *expected) {
+
+    fflush(stdout);
+    assert_true(dup2(c->saved, STDOUT_FILENO) >= 0);
+    close(c->saved);
+
+    char out[1024] = { 0 };
+    rewind(c->f);
+    size_t len = fread(out, 1, sizeof(out) - 1, c->f);
+    fclose(c->f);
+
+    assert_int_equal(len, strlen(expected));
+    assert_string_equal(out, expected);
+}
+
+/* a bit of everything the tools output */
+static void write_document(void) {
+
+    tpm2_writer_number("value", "0x%X", 0x25);
+    tpm2_writer_map_start("TPM2_PT_MANUFACTURER");
+    tpm2_writer_align(8);
+    tpm2_writer_number("raw", "0x%X", 0x49424d00);
+    tpm2_writer_quoted("value", "%s", "IBM");
+    tpm2_writer_flag("nv", false);
+    tpm2_writer_end();
+    tpm2_writer_list_start("selected-pcrs");
+    tpm2_writer_map_start(NULL);
+    tpm2_writer_flow_start("sha1");
+    tpm2_writer_number(NULL, "%u", 0);
+    tpm2_writer_number(NULL, "%u", 7);
+    tpm2_writer_end();
+    tpm2_writer_end();
+    tpm2_writer_map_start(NULL);
+    tpm2_writer_flow_start("sha256");
+    tpm2_writer_end();
+    tpm2_writer_end();
+    tpm2_writer_end();
+    tpm2_writer_map_start("pcrs");
+    tpm2_writer_map_start("sha256");
+    const BYTE digest[] = { 0xab, 0x01 };
+    tpm2_writer_hex("0 ", "0x", digest, sizeof(digest), true);
+    tpm2_writer_end();
+    tpm2_writer_end();
+    tpm2_writer_list_start("unknown");
+    tpm2_writer_end();
+    tpm2_writer_string("name", "a \"b\"\n");
+    tpm2_writer_document_end();
+}
+
+static void test_tpm2_writer_yaml(void **state) {
+    UNUSED(state);
+
+    tpm2_writer_set_format(tpm2_writer_format_yaml);
+
+    capture c;
+    capture_start(&c);
+    write_document();
+    capture_end(&c,
+            "value: 0x25\n"
+            "TPM2_PT_MANUFACTURER:\n"
+            "  raw:    0x49424D00\n"
+            "  value:  \"IBM\"\n"
+            "  nv:     0\n"
+            "selected-pcrs:\n"
+            "  - sha1: [ 0, 7 ]\n"
+            "  - sha256: [ ]\n"
+            "pcrs:\n"
+            "  sha256:\n"
+            "    0 : 0xAB01\n"
+            "unknown: []\n"
+            "name: a \"b\"\n\n");
+}
+
+static void test_tpm2_writer_json(void **state) {
+    UNUSED(state);
+
+    tpm2_writer_set_format(tpm2_writer_format_json);
+
+    capture c;
+    capture_start(&c);
+    write_document();
+    capture_end(&c,
+            "{\"value\":37,"
+            "\"TPM2_PT_MANUFACTURER\":{\"raw\":1229081856,\"value\":\"IBM\","
+            "\"nv\":false},"
+            "\"selected-pcrs\":[{\"sha1\":[0,7]},{\"sha256\":[]}],"
+            "\"pcrs\":{\"sha256\":{\"0\":\"0xAB01\"}},"
+            "\"unknown\":[],"
+            "\"name\":\"a \\\"b\\\"\\n\"}\n");
+
+    tpm2_writer_set_format(tpm2_writer_format_yaml);
+}
+
+static void test_tpm2_writer_top_level(void **state) {
+    UNUSED(state);
+
+    /* a list of maps, in two YAML documents */
+    tpm2_writer_set_format(tpm2_writer_format_yaml);
+
+    capture c;
+    capture_start(&c);
+    tpm2_writer_list_start(NULL);
+    tpm2_writer_map_start(NULL);
+    tpm2_writer_number("line", "%u", 1);
+    tpm2_writer_string("action", "defined");
+    tpm2_writer_end();
+    tpm2_writer_number(NULL, "0x%X", 0x81000000);
+    tpm2_writer_document_start();
+    tpm2_writer_map_start(NULL);
+    tpm2_writer_map_start("sha1");
+    tpm2_writer_end();
+    tpm2_writer_document_end();
+    capture_end(&c,
+            "- line: 1\n"
+            "  action: defined\n"
+            "- 0x81000000\n"
+            "---\n"
+            "  sha1: {}\n");
+
+    /* one line per JSON document, nothing for an empty one */
+    tpm2_writer_set_format(tpm2_writer_format_json);
+
+    capture_start(&c);
+    tpm2_writer_list_start(NULL);
+    tpm2_writer_map_start(NULL);
+    tpm2_writer_number("line", "%u", 1);
+    tpm2_writer_end();
+    tpm2_writer_number(NULL, "0x%X", 0x81000000);
+    tpm2_writer_document_start();
+    tpm2_writer_document_start();
+    tpm2_writer_map_start(NULL);
+    tpm2_writer_end();
+    tpm2_writer_document_end();
+    capture_end(&c,
+            "[{\"line\":1},2164260864]\n"
+            "{}\n");
+
+    tpm2_writer_set_format(tpm2_writer_format_yaml);
+}
+
+static void test_tpm2_writer_quiet(void **state) {
+    UNUSED(state);
+
+    output_enabled = false;
+
+    capture c;
+    capture_start(&c);
+    write_document();
+    capture_end(&c, "");
+
+    output_enabled = true;
+}
+
+/* link required symbol, but tpm2_tool.c declares it AND main, which
+ * we have a main below for cmocka tests.
+ */
+bool output_enabled = true;
+
+int main(int argc, char *argv[]) {
+    UNUSED(argc);
+    UNUSED(argv);
+
+    const struct CMUnitTest tests[] = {
+        cmocka_unit_test(test_tpm2_writer_yaml),
+        cmocka_unit_test(test_tpm2_writer_json),
+        cmocka_unit_test(test_tpm2_writer_top_level),
+        cmocka_unit_test(test_tpm2_writer_quiet),
+    };
+
+    return cmocka_run_group_tests(tests, NULL, NULL);
+}
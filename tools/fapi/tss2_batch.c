@@ -0,0 +1,166 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include "tools/fapi/tss2_template.h"
+
+/* Context struct used to store passed commandline parameters */
+static struct cxt {
+    char const *input_path;
+    bool        keep_going;
+} ctx;
+
+/*
+ * Each command runs in a forked child that inherits the already initialized
+ * FAPI context. This gives every tool pristine static state, as if it was
+ * started as a new process, without paying for loading the FAPI
+ * configuration, the TCTI and the ESAPI context for every command.
+ */
+static int run_command (FAPI_CONTEXT *fctx, int argc, char **argv) {
+
+    /* flush anything pending so the child doesn't emit it twice */
+    fflush (stdout);
+    fflush (stderr);
+
+    pid_t pid = fork ();
+    if (pid < 0) {
+        LOG_ERR ("Could not fork process to run \"%s\", error: %s\n", argv[0],
+            strerror (errno));
+        return 1;
+    }
+
+    if (pid == 0) {
+        int ret = tss2_tool_dispatch (argc, argv, fctx);
+        fflush (stdout);
+        fflush (stderr);
+        /*
+         * Skip the atexit handlers, the FAPI context and its TCTI are still
+         * in use by the parent.
+         */
+        _exit (ret);
+    }
+
+    int status;
+    if (waitpid (pid, &status, 0) == -1) {
+        LOG_ERR ("Waiting for \"%s\" failed, error: %s\n", argv[0],
+            strerror (errno));
+        return 1;
+    }
+
+    if (!WIFEXITED (status)) {
+        LOG_ERR ("\"%s\" terminated abnormally\n", argv[0]);
+        return 1;
+    }
+
+    return WEXITSTATUS (status);
+}
+
+static int run_batch (FAPI_CONTEXT *fctx, FILE *input) {
+
+    int ret = 0;
+    char *line = NULL;
+    size_t line_size = 0;
+    size_t lineno = 0;
+
+    while (getline (&line, &line_size, input) != -1) {
+        lineno++;
+
+        int argc = 0;
+        char **argv = NULL;
+        if (!tpm2_util_split_args (line, &argc, &argv)) {
+            LOG_ERR ("Could not parse line %zu\n", lineno);
+            ret = 1;
+            break;
+        }
+
+        /* blank line or comment */
+        if (!argc) {
+            free (argv);
+            continue;
+        }
+
+        int tmp_ret = run_command (fctx, argc, argv);
+        if (tmp_ret) {
+            LOG_ERR ("Line %zu: \"%s\" failed with: %d\n", lineno, argv[0],
+                tmp_ret);
+            ret = 1;
+        }
+        free (argv);
+
+        if (ret && !ctx.keep_going) {
+            break;
+        }
+    }
+
+    if (ferror (input)) {
+        LOG_ERR ("Error reading batch input, error: %s\n", strerror (errno));
+        ret = 1;
+    }
+
+    free (line);
+
+    return ret;
+}
+
+/* Parse commandline parameters */
+static bool on_option (char key, char *value) {
+    (void) value;
+
+    switch (key) {
+    case 'k':
+        ctx.keep_going = true;
+        break;
+    }
+    return true;
+}
+
+static bool on_args (int argc, char **argv) {
+
+    if (argc > 1) {
+        fprintf (stderr, "Expected at most one batch file, got: %d\n", argc);
+        return false;
+    }
+
+    ctx.input_path = argv[0];
+    return true;
+}
+
+/* Define possible commandline parameters */
+static bool tss2_tool_onstart (tpm2_options **opts) {
+    struct option topts[] = {
+        {"keepGoing", no_argument, NULL, 'k'}
+    };
+    return (*opts = tpm2_options_new ("k", ARRAY_LEN(topts), topts,
+                                      on_option, on_args, 0)) != NULL;
+}
+
+/* Execute specific tool */
+static int tss2_tool_onrun (FAPI_CONTEXT *fctx) {
+
+    FILE *input = stdin;
+    if (ctx.input_path && strcmp (ctx.input_path, "-")) {
+        input = fopen (ctx.input_path, "rb");
+        if (!input) {
+            LOG_ERR ("Could not open batch file \"%s\", error: %s\n",
+                ctx.input_path, strerror (errno));
+            return 1;
+        }
+    }
+
+    int ret = run_batch (fctx, input);
+
+    if (input != stdin) {
+        fclose (input);
+    }
+
+    return ret;
+}
+
+TSS2_TOOL_REGISTER("batch", tss2_tool_onstart, tss2_tool_onrun, NULL)
@@ -11,6 +11,7 @@ static struct cxt {
     char const *plainText;
     char const *cipherText;
     bool        overwrite;
+    bool        bulk;
 } ctx;
 
 /* Parse command line parameters */
@@ -28,6 +29,9 @@ static bool on_option(char key, char *value) {
     case 'p':
         ctx.keyPath = value;
         break;
+    case 'b':
+        ctx.bulk = true;
+        break;
     }
     return true;
 }
@@ -39,11 +43,25 @@ static bool tss2_tool_onstart(tpm2_options **opts) {
         {"cipherText", required_argument, NULL, 'i'},
         {"force"      , no_argument      , NULL, 'f'},
         {"plainText"     , required_argument, NULL, 'o'},
+        {"bulk"       , no_argument      , NULL, 'b'},
     };
-    return (*opts = tpm2_options_new ("i:fo:p:", ARRAY_LEN(topts), topts,
+    return (*opts = tpm2_options_new ("bi:fo:p:", ARRAY_LEN(topts), topts,
                                       on_option, NULL, 0)) != NULL;
 }
 
+/* Decrypt one ciphertext with the key */
+static int decrypt_one (FAPI_CONTEXT *fctx, uint8_t const *cipherText,
+    size_t cipherTextSize, uint8_t **plainText, size_t *plainTextSize) {
+
+    TSS2_RC r = Fapi_Decrypt (fctx, ctx.keyPath, cipherText, cipherTextSize,
+        plainText, plainTextSize);
+    if (r != TSS2_RC_SUCCESS) {
+        LOG_PERR ("Fapi_Decrypt", r);
+        return 1;
+    }
+    return 0;
+}
+
 /* Execute specific tool */
 static int tss2_tool_onrun (FAPI_CONTEXT *fctx) {
     /* Check availability of required parameters */
@@ -60,6 +78,12 @@ static int tss2_tool_onrun (FAPI_CONTEXT *fctx) {
         return -1;
     }
 
+    /* Decrypt every ciphertext of a directory or framed stream */
+    if (ctx.bulk) {
+        return tss2_bulk_run (fctx, ctx.cipherText, ctx.plainText,
+            ctx.overwrite, decrypt_one);
+    }
+
     /* Read ciphertext file */
     uint8_t* cipherText;
     size_t cipherTextSize;
@@ -72,11 +96,10 @@ static int tss2_tool_onrun (FAPI_CONTEXT *fctx) {
     /* Execute FAPI command with passed arguments */
     uint8_t *plainText;
     size_t plainTextSize;
-    r = Fapi_Decrypt (fctx, ctx.keyPath, cipherText, cipherTextSize,
-        &plainText, &plainTextSize);
-    if (r != TSS2_RC_SUCCESS) {
+    r = decrypt_one (fctx, cipherText, cipherTextSize, &plainText,
+        &plainTextSize);
+    if (r) {
         free(cipherText);
-        LOG_PERR ("Fapi_Decrypt", r);
         return 1;
     }
     free(cipherText);
@@ -11,6 +11,7 @@ static struct cxt {
     char const *plainText;
     char const *cipherText;
     bool        overwrite;
+    bool        bulk;
 } ctx;
 
 /* Parse commandline parameters */
@@ -28,6 +29,9 @@ static bool on_option(char key, char *value) {
     case 'i':
         ctx.plainText = value;
         break;
+    case 'b':
+        ctx.bulk = true;
+        break;
     }
     return true;
 }
@@ -39,11 +43,25 @@ static bool tss2_tool_onstart(tpm2_options **opts) {
         {"plainText",   required_argument, NULL, 'i'},
         {"cipherText",  required_argument, NULL, 'o'},
         {"force",       no_argument      , NULL, 'f'},
+        {"bulk",        no_argument      , NULL, 'b'},
     };
-    return (*opts = tpm2_options_new ("fo:p:i:", ARRAY_LEN(topts), topts,
+    return (*opts = tpm2_options_new ("bfo:p:i:", ARRAY_LEN(topts), topts,
                                       on_option, NULL, 0)) != NULL;
 }
 
+/* Encrypt one plaintext with the key */
+static int encrypt_one (FAPI_CONTEXT *fctx, uint8_t const *plainText,
+    size_t plainTextSize, uint8_t **cipherText, size_t *cipherTextSize) {
+
+    TSS2_RC r = Fapi_Encrypt (fctx, ctx.keyPath, plainText, plainTextSize,
+        cipherText, cipherTextSize);
+    if (r != TSS2_RC_SUCCESS) {
+        LOG_PERR ("Fapi_Encrypt", r);
+        return 1;
+    }
+    return 0;
+}
+
 /* Execute specific tool */
 static int tss2_tool_onrun (FAPI_CONTEXT *fctx) {
     /* Check availability of required parameters */
@@ -60,6 +78,12 @@ static int tss2_tool_onrun (FAPI_CONTEXT *fctx) {
         return -1;
     }
 
+    /* Encrypt every plaintext of a directory or framed stream */
+    if (ctx.bulk) {
+        return tss2_bulk_run (fctx, ctx.plainText, ctx.cipherText,
+            ctx.overwrite, encrypt_one);
+    }
+
     /* Read plaintext file */
     uint8_t *plainText;
     size_t plainTextSize;
@@ -72,10 +96,9 @@ static int tss2_tool_onrun (FAPI_CONTEXT *fctx) {
     /* Execute FAPI command with passed arguments */
     uint8_t *cipherText;
     size_t cipherTextSize;
-    r = Fapi_Encrypt (fctx, ctx.keyPath, plainText, plainTextSize,
-        &cipherText, &cipherTextSize);
-    if (r != TSS2_RC_SUCCESS) {
-        LOG_PERR ("Fapi_Encrypt", r);
+    r = encrypt_one (fctx, plainText, plainTextSize, &cipherText,
+        &cipherTextSize);
+    if (r) {
         free (plainText);
         return 1;
     }
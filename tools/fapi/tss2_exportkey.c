@@ -11,6 +11,7 @@ static struct cxt {
     char const *pathOfKeyToDuplicate;
     char const *pathToPublicKeyOfNewParent;
     char const *exportedData;
+    char const *archive;
     bool        overwrite;
 } ctx;
 
@@ -29,6 +30,9 @@ static bool on_option(char key, char *value) {
     case 'p':
         ctx.pathOfKeyToDuplicate = value;
         break;
+    case 'a':
+        ctx.archive = value;
+        break;
     }
     return true;
 }
@@ -39,14 +43,74 @@ static bool tss2_tool_onstart(tpm2_options **opts) {
         {"pathToPublicKeyOfNewParent",  required_argument, NULL, 'e'},
         {"force",                       no_argument      , NULL, 'f'},
         {"exportedData",                required_argument, NULL, 'o'},
-        {"pathOfKeyToDuplicate",        required_argument, NULL, 'p'}
+        {"pathOfKeyToDuplicate",        required_argument, NULL, 'p'},
+        {"archive",                     required_argument, NULL, 'a'}
     };
-    return (*opts = tpm2_options_new ("fe:o:p:", ARRAY_LEN(topts), topts,
+    return (*opts = tpm2_options_new ("fe:o:p:a:", ARRAY_LEN(topts), topts,
                                       on_option, NULL, 0)) != NULL;
 }
 
+/*
+ * Exports every key below the path into one archive, each under its path,
+ * listing the keystore once and keeping the FAPI context of the tool
+ * throughout.
+ */
+static int exportkey_archive (FAPI_CONTEXT *fctx) {
+
+    char **paths;
+    size_t count;
+    if (tss2_bulk_keys_list (fctx, ctx.pathOfKeyToDuplicate ?
+        ctx.pathOfKeyToDuplicate : "/", &paths, &count)) {
+        return 1;
+    }
+
+    tpm2_ctx_archive_member *members = calloc (count ? count : 1,
+        sizeof(*members));
+    if (!members) {
+        fprintf (stderr, "calloc(3) failed: %m\n");
+        tss2_bulk_paths_free (paths, count);
+        return 1;
+    }
+
+    int ret = 1;
+    for (size_t i = 0; i < count; i++) {
+        char *exportedData;
+        TSS2_RC r = Fapi_ExportKey (fctx, paths[i],
+            ctx.pathToPublicKeyOfNewParent, &exportedData);
+        if (r != TSS2_RC_SUCCESS) {
+            LOG_PERR ("Fapi_ExportKey", r);
+            fprintf (stderr, "%s failed\n", paths[i]);
+            goto out;
+        }
+        members[i].name = paths[i];
+        members[i].data = (uint8_t *)exportedData;
+        members[i].size = strlen (exportedData);
+    }
+
+    ret = tss2_bulk_archive_write (ctx.archive, ctx.overwrite, members,
+        count);
+
+out:
+    for (size_t i = 0; i < count; i++) {
+        Fapi_Free ((uint8_t *)members[i].data);
+    }
+    free (members);
+    tss2_bulk_paths_free (paths, count);
+
+    return ret;
+}
+
 /* Execute specific tool */
 static int tss2_tool_onrun (FAPI_CONTEXT *fctx) {
+    if (ctx.archive) {
+        if (ctx.exportedData) {
+            fprintf (stderr, "--archive holds the exported data, it cannot "\
+            "be combined with --exportedData\n");
+            return -1;
+        }
+        return exportkey_archive (fctx);
+    }
+
     /* Check availability of required parameters */
     if (!ctx.exportedData) {
         fprintf (stderr, "exported data missing, use --output\n");
@@ -5,6 +5,7 @@
 #include <string.h>
 #include <unistd.h>
 
+#include "tools/fapi/tss2_index.h"
 #include "tools/fapi/tss2_template.h"
 
 /* Context struct used to store passed commandline parameters */
@@ -54,11 +55,21 @@ static int tss2_tool_onrun (FAPI_CONTEXT *fctx) {
     uint8_t *appData;
     size_t appDataSize;
 
+    TSS2_RC r;
+
+    /* Answer from the keystore index, if enabled and up to date */
+    tss2_index *index = tss2_index_load (fctx);
+    bool is_indexed = index &&
+        tss2_index_get_appdata (index, ctx.path, &appData, &appDataSize);
+    tss2_index_free (index);
+
     /* Execute FAPI command with passed arguments */
-    TSS2_RC r = Fapi_GetAppData (fctx, ctx.path, &appData, &appDataSize);
-    if (r != TSS2_RC_SUCCESS) {
-        LOG_PERR ("Fapi_GetAppData", r);
-        return 1;
+    if (!is_indexed) {
+        r = Fapi_GetAppData (fctx, ctx.path, &appData, &appDataSize);
+        if (r != TSS2_RC_SUCCESS) {
+            LOG_PERR ("Fapi_GetAppData", r);
+            return 1;
+        }
     }
 
     /* Write returned data to file(s) */
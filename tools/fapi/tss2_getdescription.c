@@ -4,6 +4,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#include "tools/fapi/tss2_index.h"
 #include "tools/fapi/tss2_template.h"
 
 /* Context struct used to store passed command line parameters */
@@ -54,10 +55,20 @@ static int tss2_tool_onrun (FAPI_CONTEXT *fctx) {
 
     /* Execute FAPI command with passed arguments */
     char *description;
-    TSS2_RC r = Fapi_GetDescription (fctx, ctx.path, &description);
-    if (r != TSS2_RC_SUCCESS) {
-        LOG_PERR ("Fapi_GetDescription", r);
-        return 1;
+    TSS2_RC r;
+
+    /* Answer from the keystore index, if enabled and up to date */
+    tss2_index *index = tss2_index_load (fctx);
+    bool is_indexed = index &&
+        tss2_index_get_description (index, ctx.path, &description);
+    tss2_index_free (index);
+
+    if (!is_indexed) {
+        r = Fapi_GetDescription (fctx, ctx.path, &description);
+        if (r != TSS2_RC_SUCCESS) {
+            LOG_PERR ("Fapi_GetDescription", r);
+            return 1;
+        }
     }
 
     /* Write returned data to file(s) */
@@ -1,18 +1,31 @@
 /* SPDX-License-Identifier: BSD-3-Clause */
 
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 
+#include "lib/tpm2_hex.h"
 #include "tools/fapi/tss2_template.h"
 
+/*
+ * The bytes of a Fapi_GetRandom call of --bulk. FAPI splits them in requests
+ * of the digest size of the TPM, so a piece amortizes the FAPI call and is
+ * still written out soon after it was generated.
+ */
+#define BULK_PIECE_SIZE 4096
+
 /* Context struct used to store passed commandline parameters */
 static struct cxt {
     size_t  numBytes;
     char   *filename;
     bool    overwrite;
     bool    hex;
+    bool    bulk;
 } ctx;
 
 /* Parse commandline parameters */
@@ -39,6 +52,9 @@ static bool on_option(char key, char *value) {
     case 0:
         ctx.hex = true;
         break;
+    case 1:
+        ctx.bulk = true;
+        break;
     }
     return true;
 }
@@ -50,12 +66,103 @@ static bool tss2_tool_onstart(tpm2_options **opts) {
         {"force"    , no_argument      , NULL, 'f'},
         /* output file */
         {"data"   , required_argument, NULL, 'o'},
-        {"hex",          no_argument,       NULL,  0}
+        {"hex",          no_argument,       NULL,  0},
+        {"bulk",         no_argument,       NULL,  1}
     };
     return (*opts = tpm2_options_new ("fn:o:", ARRAY_LEN(topts), topts,
                                       on_option, NULL, 0)) != NULL;
 }
 
+/* Writes all of a piece, false with errno EPIPE when the reader went away */
+static bool bulk_write (int fd, const void *data, size_t size) {
+    const uint8_t *p = data;
+    while (size) {
+        ssize_t written = write (fd, p, size);
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        p += written;
+        size -= written;
+    }
+    return true;
+}
+
+/*
+ * Streams the random bytes to the output as they are generated, a piece at a
+ * time on the one FAPI context, numBytes of them or, without --numBytes,
+ * until the reader of the output, ie of a FIFO, goes away.
+ */
+static int bulk_run (FAPI_CONTEXT *fctx) {
+    int fd = STDOUT_FILENO;
+    if (strcmp (ctx.filename, "-")) {
+        int oflags = O_CREAT | O_WRONLY | O_TRUNC;
+        if (!ctx.overwrite) {
+            oflags |= O_EXCL;
+        }
+        /* opening a FIFO waits for its reader */
+        fd = open (ctx.filename, oflags, S_IWUSR | S_IRUSR);
+        if (fd == -1) {
+            fprintf (stderr, "open(2) %s failed: %m\n", ctx.filename);
+            return 1;
+        }
+    }
+
+    /* a reader going away is the end of an endless stream, not a signal */
+    signal (SIGPIPE, SIG_IGN);
+
+    char *hex = NULL;
+    if (ctx.hex) {
+        hex = malloc (TPM2_HEX_SIZE(BULK_PIECE_SIZE));
+        if (!hex) {
+            LOG_ERR ("malloc(2) failed: %m\n");
+            goto error;
+        }
+    }
+
+    size_t remaining = ctx.numBytes;
+    while (!ctx.numBytes || remaining) {
+        size_t size = ctx.numBytes && remaining < BULK_PIECE_SIZE ?
+            remaining : BULK_PIECE_SIZE;
+
+        uint8_t *data;
+        TSS2_RC r = Fapi_GetRandom (fctx, size, &data);
+        if (r != TSS2_RC_SUCCESS) {
+            LOG_PERR ("Fapi_GetRandom", r);
+            goto error;
+        }
+
+        bool result = hex ?
+            bulk_write (fd, hex, tpm2_hex_encode (data, size, hex, false)) :
+            bulk_write (fd, data, size);
+        Fapi_Free (data);
+        if (!result) {
+            if (errno == EPIPE && !ctx.numBytes) {
+                break;
+            }
+            fprintf (stderr, "write(2) %s failed: %m\n", ctx.filename);
+            goto error;
+        }
+
+        remaining -= ctx.numBytes ? size : 0;
+    }
+
+    free (hex);
+    if (fd != STDOUT_FILENO) {
+        close (fd);
+    }
+    return 0;
+
+error:
+    free (hex);
+    if (fd != STDOUT_FILENO) {
+        close (fd);
+    }
+    return 1;
+}
+
 /* Execute specific tool */
 static int tss2_tool_onrun (FAPI_CONTEXT *fctx) {
     /* Check availability of required parameters */
@@ -63,6 +170,9 @@ static int tss2_tool_onrun (FAPI_CONTEXT *fctx) {
         fprintf (stderr, "No filename for data was provided, use --data\n");
         return -1;
     }
+    if (ctx.bulk) {
+        return bulk_run (fctx);
+    }
     if (!ctx.numBytes) {
         fprintf (stderr, "No amount of bytes was provided, use --numBytes\n");
         return -1;
@@ -12,6 +12,7 @@ static struct cxt {
     char const *tpm2bPublic;
     char const *tpm2bPrivate;
     char const *policy;
+    char const *archive;
     bool        overwrite;
 } ctx;
 
@@ -33,6 +34,9 @@ static bool on_option(char key, char *value) {
     case 'l':
         ctx.policy = value;
         break;
+    case 'a':
+        ctx.archive = value;
+        break;
     }
     return true;
 }
@@ -45,13 +49,97 @@ static bool tss2_tool_onstart(tpm2_options **opts) {
         {"tpm2bPublic"    , required_argument, NULL, 'u'},
         {"tpm2bPrivate"    , required_argument, NULL, 'r'},
         {"policy"    , required_argument, NULL, 'l'},
+        {"archive"    , required_argument, NULL, 'a'},
     };
-    return (*opts = tpm2_options_new ("fp:u:r:l", ARRAY_LEN(topts), topts,
+    return (*opts = tpm2_options_new ("fp:u:r:la:", ARRAY_LEN(topts), topts,
                                       on_option, NULL, 0)) != NULL;
 }
 
+/* the names of the blobs of a key in the archive */
+static char const *blob_suffixes[] = { ".pub", ".priv", ".policy" };
+
+/*
+ * Exports the blobs of every key below the path into one archive, listing
+ * the keystore once and keeping the FAPI context of the tool throughout.
+ */
+static int gettpmblobs_archive (FAPI_CONTEXT *fctx) {
+
+    char **paths;
+    size_t count;
+    if (tss2_bulk_keys_list (fctx, ctx.path ? ctx.path : "/", &paths,
+        &count)) {
+        return 1;
+    }
+
+    size_t members_count = count * ARRAY_LEN(blob_suffixes);
+    tpm2_ctx_archive_member *members = calloc (members_count ? members_count
+        : 1, sizeof(*members));
+    if (!members) {
+        fprintf (stderr, "calloc(3) failed: %m\n");
+        tss2_bulk_paths_free (paths, count);
+        return 1;
+    }
+
+    int ret = 1;
+    for (size_t i = 0; i < count; i++) {
+        uint8_t *tpm2bPublic;
+        size_t  tpm2bPublicSize;
+        uint8_t *tpm2bPrivate;
+        size_t  tpm2bPrivateSize;
+        char *policy;
+        TSS2_RC r = Fapi_GetTpmBlobs (fctx, paths[i], &tpm2bPublic,
+            &tpm2bPublicSize, &tpm2bPrivate, &tpm2bPrivateSize, &policy);
+        if (r != TSS2_RC_SUCCESS) {
+            LOG_PERR ("Fapi_GetTpmBlobs", r);
+            fprintf (stderr, "%s failed\n", paths[i]);
+            goto out;
+        }
+
+        tpm2_ctx_archive_member *m = &members[i * ARRAY_LEN(blob_suffixes)];
+        m[0].data = tpm2bPublic;
+        m[0].size = tpm2bPublicSize;
+        m[1].data = tpm2bPrivate;
+        m[1].size = tpm2bPrivateSize;
+        m[2].data = (uint8_t *)policy;
+        m[2].size = policy ? strlen (policy) : 0;
+
+        for (size_t j = 0; j < ARRAY_LEN(blob_suffixes); j++) {
+            size_t len = strlen (paths[i]) + strlen (blob_suffixes[j]) + 1;
+            char *name = malloc (len);
+            if (!name) {
+                fprintf (stderr, "malloc(3) failed: %m\n");
+                goto out;
+            }
+            snprintf (name, len, "%s%s", paths[i], blob_suffixes[j]);
+            m[j].name = name;
+        }
+    }
+
+    ret = tss2_bulk_archive_write (ctx.archive, ctx.overwrite, members,
+        members_count);
+
+out:
+    for (size_t i = 0; i < members_count; i++) {
+        free ((char *)members[i].name);
+        Fapi_Free ((uint8_t *)members[i].data);
+    }
+    free (members);
+    tss2_bulk_paths_free (paths, count);
+
+    return ret;
+}
+
 /* Execute specific tool */
 static int tss2_tool_onrun (FAPI_CONTEXT *fctx) {
+    if (ctx.archive) {
+        if (ctx.tpm2bPublic || ctx.tpm2bPrivate || ctx.policy) {
+            fprintf (stderr, "--archive holds all of the blobs, it cannot be "\
+            "combined with --tpm2bPublic, --tpm2bPrivate and --policy\n");
+            return -1;
+        }
+        return gettpmblobs_archive (fctx);
+    }
+
     /* Check availability of required parameters */
     if (!ctx.path) {
         fprintf (stderr, "path missing, use --path\n");
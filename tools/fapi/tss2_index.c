@@ -0,0 +1,585 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+#include <errno.h>
+#include <ftw.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "tools/fapi/tss2_index.h"
+#include "tools/fapi/tss2_template.h"
+
+/* the FAPI falls back to it too, if TSS2_FAPICONF is not set */
+#define TSS2_INDEX_DEFAULT_CONFIG "/etc/tpm2-tss/fapi-config.json"
+
+/*
+ * Changes to the keystore within this many seconds of stamping it may not
+ * show in the modification times of file systems with coarse timestamps, an
+ * index of such a keystore is used but not saved.
+ */
+#define TSS2_INDEX_RACY_SECONDS 2
+
+/* bounds a corrupted index can't allocate beyond */
+#define TSS2_INDEX_MAX_ENTRIES (1024 * 1024)
+#define TSS2_INDEX_MAX_FIELD (16 * 1024 * 1024)
+
+#define TSS2_INDEX_HAS_DESCRIPTION 0x01
+#define TSS2_INDEX_HAS_APPDATA     0x02
+
+static const char tss2_index_magic[8] = "TSS2INDX";
+
+typedef struct {
+    uint64_t mtime; /* the newest modification, in nanoseconds */
+    uint64_t count;
+    uint64_t size;
+} tss2_index_stamp;
+
+typedef struct {
+    char    *path;
+    char    *description;
+    uint8_t *appData;
+    size_t   appDataSize;
+    uint8_t  flags;
+} tss2_index_entry;
+
+struct tss2_index {
+    tss2_index_stamp  stamp;
+    size_t            count;
+    tss2_index_entry *entries;
+    /* the number of distinct profiles the objects are stored under */
+    size_t            profiles;
+};
+
+/* nftw() takes no user data */
+static tss2_index_stamp *walk_stamp;
+
+static int stamp_add (const char *path, const struct stat *st, int flag,
+    struct FTW *ftw) {
+    (void) path;
+    (void) flag;
+    (void) ftw;
+
+    uint64_t mtime = (uint64_t)st->st_mtim.tv_sec * 1000000000 +
+        (uint64_t)st->st_mtim.tv_nsec;
+    if (mtime > walk_stamp->mtime) {
+        walk_stamp->mtime = mtime;
+    }
+    walk_stamp->count++;
+    walk_stamp->size += (uint64_t)st->st_size;
+    return 0;
+}
+
+/*
+ * Returns the string value of key in the flat JSON of the FAPI config, enough
+ * for the directories, which are plain strings.
+ */
+static char *config_get_string (char const *json, char const *key) {
+
+    size_t key_len = strlen (key);
+    char const *p = json;
+    while ((p = strchr (p, '"'))) {
+        p++;
+        if (strncmp (p, key, key_len) || p[key_len] != '"') {
+            continue;
+        }
+        p += key_len + 1;
+        while (*p == ' ' || *p == '\t' || *p == '\n' || *p == '\r') p++;
+        if (*p++ != ':') {
+            continue;
+        }
+        while (*p == ' ' || *p == '\t' || *p == '\n' || *p == '\r') p++;
+        if (*p++ != '"') {
+            return NULL;
+        }
+
+        char *value = malloc (strlen (p) + 1);
+        if (!value) {
+            return NULL;
+        }
+        char *w = value;
+        while (*p && *p != '"') {
+            if (*p == '\\' && p[1]) {
+                p++;
+            }
+            *w++ = *p++;
+        }
+        *w = '\0';
+        return value;
+    }
+    return NULL;
+}
+
+/* like the FAPI, expands a leading ~ of a keystore directory to $HOME */
+static char *config_expand_home (char *dir) {
+
+    char const *home = getenv ("HOME");
+    if (!dir || dir[0] != '~' || !home) {
+        return dir;
+    }
+
+    char *expanded;
+    if (asprintf (&expanded, "%s%s", home, &dir[1]) < 0) {
+        expanded = NULL;
+    }
+    free (dir);
+    return expanded;
+}
+
+/*
+ * Stamps the FAPI configuration and the keystore directories it names, a
+ * missing directory counts as empty.
+ */
+static bool stamp_keystore (tss2_index_stamp *stamp) {
+
+    memset (stamp, 0, sizeof(*stamp));
+
+    char const *config = getenv ("TSS2_FAPICONF");
+    if (!config) {
+        config = TSS2_INDEX_DEFAULT_CONFIG;
+    }
+
+    char *json;
+    if (open_read_and_close (config, (void**)&json, NULL)) {
+        return false;
+    }
+
+    bool result = true;
+    char const *keys[] = { "user_dir", "system_dir" };
+    for (size_t i = 0; i < ARRAY_LEN(keys) && result; i++) {
+        char *dir = config_expand_home (config_get_string (json, keys[i]));
+        if (!dir) {
+            fprintf (stderr, "No %s in the FAPI config %s\n", keys[i],
+                config);
+            result = false;
+            break;
+        }
+
+        walk_stamp = stamp;
+        if (nftw (dir, stamp_add, 16, FTW_PHYS) && errno != ENOENT) {
+            fprintf (stderr, "Walking %s failed: %m\n", dir);
+            result = false;
+        }
+        free (dir);
+    }
+    free (json);
+
+    /* the configuration decides where the objects are */
+    struct stat st;
+    if (result && !stat (config, &st)) {
+        walk_stamp = stamp;
+        stamp_add (config, &st, FTW_F, NULL);
+    }
+
+    return result;
+}
+
+static void index_free_entries (tss2_index *index) {
+
+    for (size_t i = 0; i < index->count; i++) {
+        free (index->entries[i].path);
+        free (index->entries[i].description);
+        free (index->entries[i].appData);
+    }
+    free (index->entries);
+    index->entries = NULL;
+    index->count = 0;
+}
+
+void tss2_index_free (tss2_index *index) {
+
+    if (index) {
+        index_free_entries (index);
+        free (index);
+    }
+}
+
+static bool write_u32 (FILE *f, uint32_t v) {
+    uint8_t b[4] = {
+        (uint8_t)(v >> 24), (uint8_t)(v >> 16), (uint8_t)(v >> 8), (uint8_t)v
+    };
+    return fwrite (b, 1, sizeof(b), f) == sizeof(b);
+}
+
+static bool write_u64 (FILE *f, uint64_t v) {
+    return write_u32 (f, (uint32_t)(v >> 32)) && write_u32 (f, (uint32_t)v);
+}
+
+static bool write_field (FILE *f, void const *data, size_t size) {
+    return write_u32 (f, (uint32_t)size) &&
+        (!size || fwrite (data, 1, size, f) == size);
+}
+
+static bool read_u32 (FILE *f, uint32_t *v) {
+    uint8_t b[4];
+    if (fread (b, 1, sizeof(b), f) != sizeof(b)) {
+        return false;
+    }
+    *v = (uint32_t)b[0] << 24 | (uint32_t)b[1] << 16 | (uint32_t)b[2] << 8 |
+        b[3];
+    return true;
+}
+
+static bool read_u64 (FILE *f, uint64_t *v) {
+    uint32_t hi, lo;
+    if (!read_u32 (f, &hi) || !read_u32 (f, &lo)) {
+        return false;
+    }
+    *v = (uint64_t)hi << 32 | lo;
+    return true;
+}
+
+/* reads a field, NUL terminated so strings can be used in place */
+static bool read_field (FILE *f, void **data, size_t *size) {
+    uint32_t len;
+    if (!read_u32 (f, &len) || len > TSS2_INDEX_MAX_FIELD) {
+        return false;
+    }
+    uint8_t *d = malloc (len + 1);
+    if (!d) {
+        return false;
+    }
+    if (len && fread (d, 1, len, f) != len) {
+        free (d);
+        return false;
+    }
+    d[len] = '\0';
+    *data = d;
+    if (size) {
+        *size = len;
+    }
+    return true;
+}
+
+static bool index_save (tss2_index const *index, char const *path) {
+
+    char *tmp;
+    if (asprintf (&tmp, "%s.%d", path, (int)getpid ()) < 0) {
+        return false;
+    }
+
+    FILE *f = fopen (tmp, "wb");
+    if (!f) {
+        fprintf (stderr, "Could not save the keystore index %s: %m\n", path);
+        free (tmp);
+        return false;
+    }
+
+    bool result = fwrite (tss2_index_magic, 1, sizeof(tss2_index_magic), f)
+            == sizeof(tss2_index_magic) &&
+        write_u32 (f, TSS2_INDEX_VERSION) &&
+        write_u64 (f, index->stamp.mtime) &&
+        write_u64 (f, index->stamp.count) &&
+        write_u64 (f, index->stamp.size) &&
+        write_u32 (f, (uint32_t)index->count);
+    for (size_t i = 0; i < index->count && result; i++) {
+        tss2_index_entry const *e = &index->entries[i];
+        result = fwrite (&e->flags, 1, 1, f) == 1 &&
+            write_field (f, e->path, strlen (e->path));
+        if (result && (e->flags & TSS2_INDEX_HAS_DESCRIPTION)) {
+            result = write_field (f, e->description,
+                strlen (e->description));
+        }
+        if (result && (e->flags & TSS2_INDEX_HAS_APPDATA)) {
+            result = write_field (f, e->appData, e->appDataSize);
+        }
+    }
+
+    if (fclose (f)) {
+        result = false;
+    }
+    if (result && rename (tmp, path)) {
+        result = false;
+    }
+    if (!result) {
+        fprintf (stderr, "Could not save the keystore index %s\n", path);
+        unlink (tmp);
+    }
+    free (tmp);
+
+    return result;
+}
+
+/* loads the index at path, if it is of the keystore as stamped */
+static bool index_read (tss2_index *index, char const *path,
+    tss2_index_stamp const *stamp) {
+
+    FILE *f = fopen (path, "rb");
+    if (!f) {
+        return false;
+    }
+
+    char magic[sizeof(tss2_index_magic)];
+    uint32_t version, count;
+    tss2_index_stamp saved;
+    bool result = fread (magic, 1, sizeof(magic), f) == sizeof(magic) &&
+        !memcmp (magic, tss2_index_magic, sizeof(magic)) &&
+        read_u32 (f, &version) && version == TSS2_INDEX_VERSION &&
+        read_u64 (f, &saved.mtime) && read_u64 (f, &saved.count) &&
+        read_u64 (f, &saved.size) &&
+        saved.mtime == stamp->mtime && saved.count == stamp->count &&
+        saved.size == stamp->size &&
+        read_u32 (f, &count) && count <= TSS2_INDEX_MAX_ENTRIES;
+    if (result) {
+        index->entries = calloc (count ? count : 1, sizeof(*index->entries));
+        result = index->entries != NULL;
+    }
+
+    for (uint32_t i = 0; i < count && result; i++) {
+        tss2_index_entry *e = &index->entries[index->count++];
+        result = fread (&e->flags, 1, 1, f) == 1 &&
+            read_field (f, (void**)&e->path, NULL);
+        if (result && (e->flags & TSS2_INDEX_HAS_DESCRIPTION)) {
+            result = read_field (f, (void**)&e->description, NULL);
+        }
+        if (result && (e->flags & TSS2_INDEX_HAS_APPDATA)) {
+            result = read_field (f, (void**)&e->appData, &e->appDataSize);
+        }
+    }
+
+    fclose (f);
+    if (!result) {
+        index_free_entries (index);
+    }
+    return result;
+}
+
+/* indexes every object of the keystore through the FAPI */
+static bool index_build (tss2_index *index, FAPI_CONTEXT *fctx) {
+
+    char *pathList;
+    TSS2_RC r = Fapi_List (fctx, "", &pathList);
+    if (r != TSS2_RC_SUCCESS) {
+        return false;
+    }
+
+    size_t count = 1;
+    for (char const *p = pathList; *p; p++) {
+        count += *p == ':';
+    }
+    index->entries = calloc (count, sizeof(*index->entries));
+    if (!index->entries) {
+        Fapi_Free (pathList);
+        return false;
+    }
+
+    char *saveptr;
+    for (char *path = strtok_r (pathList, ":", &saveptr); path;
+        path = strtok_r (NULL, ":", &saveptr)) {
+        tss2_index_entry *e = &index->entries[index->count];
+        e->path = strdup (path);
+        if (!e->path) {
+            Fapi_Free (pathList);
+            index_free_entries (index);
+            return false;
+        }
+        index->count++;
+
+        /* objects without one are answered by the FAPI itself */
+        if (Fapi_GetDescription (fctx, path, &e->description)
+                == TSS2_RC_SUCCESS && e->description) {
+            e->flags |= TSS2_INDEX_HAS_DESCRIPTION;
+        }
+        if (Fapi_GetAppData (fctx, path, &e->appData, &e->appDataSize)
+                == TSS2_RC_SUCCESS) {
+            e->flags |= TSS2_INDEX_HAS_APPDATA;
+        }
+    }
+    Fapi_Free (pathList);
+
+    return true;
+}
+
+/* whether the first component of a path names a cryptographic profile */
+static bool path_has_profile (char const *path) {
+
+    while (*path == '/') path++;
+    return !strncmp (path, "P_", 2);
+}
+
+/*
+ * The path relative to the profile, without leading slashes, as objects can
+ * be addressed with or without the profile.
+ */
+static char const *path_skip_profile (char const *path) {
+
+    while (*path == '/') path++;
+    if (!strncmp (path, "P_", 2)) {
+        char const *slash = strchr (path, '/');
+        path = slash ? slash + 1 : path + strlen (path);
+    }
+    return path;
+}
+
+/* whether the object at path is below or at searchPath */
+static bool path_matches (char const *path, char const *searchPath,
+    bool is_prefix) {
+
+    if (path_has_profile (searchPath)) {
+        while (*path == '/') path++;
+        while (*searchPath == '/') searchPath++;
+    } else {
+        path = path_skip_profile (path);
+        while (*searchPath == '/') searchPath++;
+    }
+
+    size_t len = strlen (searchPath);
+    while (len && searchPath[len - 1] == '/') len--;
+
+    if (strncmp (path, searchPath, len)) {
+        return false;
+    }
+    return path[len] == '\0' || (is_prefix && (!len || path[len] == '/'));
+}
+
+static void index_count_profiles (tss2_index *index) {
+
+    index->profiles = 0;
+    for (size_t i = 0; i < index->count; i++) {
+        char const *p = index->entries[i].path;
+        if (!path_has_profile (p)) {
+            continue;
+        }
+        while (*p == '/') p++;
+        size_t len = strcspn (p, "/");
+
+        bool is_new = true;
+        for (size_t j = 0; j < i && is_new; j++) {
+            char const *q = index->entries[j].path;
+            while (*q == '/') q++;
+            is_new = !path_has_profile (q) || strcspn (q, "/") != len ||
+                strncmp (p, q, len);
+        }
+        index->profiles += is_new;
+    }
+}
+
+/*
+ * Without a profile in the path the FAPI picks the default one, which only
+ * the FAPI knows if objects of several profiles are stored.
+ */
+static bool index_can_resolve (tss2_index const *index, char const *path) {
+    return index->profiles <= 1 || path_has_profile (path);
+}
+
+tss2_index *tss2_index_load (FAPI_CONTEXT *fctx) {
+
+    char const *index_path = getenv (TSS2_INDEX_ENV);
+    if (!index_path || !index_path[0]) {
+        return NULL;
+    }
+
+    tss2_index *index = calloc (1, sizeof(*index));
+    if (!index) {
+        return NULL;
+    }
+
+    if (!stamp_keystore (&index->stamp)) {
+        free (index);
+        return NULL;
+    }
+
+    if (!index_read (index, index_path, &index->stamp)) {
+        if (!index_build (index, fctx)) {
+            free (index);
+            return NULL;
+        }
+
+        uint64_t now = (uint64_t)time (NULL) * 1000000000;
+        if (index->stamp.mtime + (uint64_t)TSS2_INDEX_RACY_SECONDS *
+                1000000000 < now) {
+            index_save (index, index_path);
+        }
+    }
+
+    index_count_profiles (index);
+    return index;
+}
+
+static tss2_index_entry *index_find (tss2_index *index, char const *path) {
+
+    if (!index_can_resolve (index, path)) {
+        return NULL;
+    }
+
+    for (size_t i = 0; i < index->count; i++) {
+        if (path_matches (index->entries[i].path, path, false)) {
+            return &index->entries[i];
+        }
+    }
+    return NULL;
+}
+
+bool tss2_index_list (tss2_index *index, char const *searchPath,
+    char **pathList) {
+
+    if (!index_can_resolve (index, searchPath)) {
+        return false;
+    }
+
+    size_t size = 1;
+    for (size_t i = 0; i < index->count; i++) {
+        if (path_matches (index->entries[i].path, searchPath, true)) {
+            size += strlen (index->entries[i].path) + 1;
+        }
+    }
+    /* an unknown path, let the FAPI report it */
+    if (size == 1) {
+        return false;
+    }
+
+    char *list = malloc (size);
+    if (!list) {
+        return false;
+    }
+    char *w = list;
+    for (size_t i = 0; i < index->count; i++) {
+        char const *path = index->entries[i].path;
+        if (path_matches (path, searchPath, true)) {
+            if (w != list) {
+                *w++ = ':';
+            }
+            size_t len = strlen (path);
+            memcpy (w, path, len);
+            w += len;
+        }
+    }
+    *w = '\0';
+
+    *pathList = list;
+    return true;
+}
+
+bool tss2_index_get_description (tss2_index *index, char const *path,
+    char **description) {
+
+    tss2_index_entry *e = index_find (index, path);
+    if (!e || !(e->flags & TSS2_INDEX_HAS_DESCRIPTION)) {
+        return false;
+    }
+
+    *description = strdup (e->description);
+    return *description != NULL;
+}
+
+bool tss2_index_get_appdata (tss2_index *index, char const *path,
+    uint8_t **appData, size_t *appDataSize) {
+
+    tss2_index_entry *e = index_find (index, path);
+    if (!e || !(e->flags & TSS2_INDEX_HAS_APPDATA)) {
+        return false;
+    }
+
+    *appData = NULL;
+    *appDataSize = e->appDataSize;
+    if (e->appData && e->appDataSize) {
+        *appData = malloc (e->appDataSize);
+        if (!*appData) {
+            return false;
+        }
+        memcpy (*appData, e->appData, e->appDataSize);
+    }
+    return true;
+}
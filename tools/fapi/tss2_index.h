@@ -0,0 +1,69 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+#ifndef TSS2_INDEX_H
+#define TSS2_INDEX_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <tss2/tss2_fapi.h>
+
+/*
+ * An index of the FAPI keystore, holding the path, description and appdata
+ * of every object, so that listing and looking up many objects does not
+ * have the FAPI walk the keystore and parse the JSON of every object again.
+ *
+ * The index is opt-in, it is kept in the file named by the environment
+ * variable below. It is stamped with the modification times, sizes and
+ * number of the files of the keystore directories and the FAPI
+ * configuration, and rebuilt when the stamp of the keystore changed.
+ */
+#define TSS2_INDEX_ENV "TPM2TOOLS_FAPI_INDEX"
+
+#define TSS2_INDEX_VERSION 1
+
+typedef struct tss2_index tss2_index;
+
+/**
+ * Loads the keystore index, rebuilding it with the FAPI if it is stale.
+ * @param fctx
+ *  The fapi api context to rebuild the index with.
+ * @return
+ *  The index, or NULL if the index is not enabled or not available, in which
+ *  case the tools query the FAPI directly.
+ */
+tss2_index *tss2_index_load(FAPI_CONTEXT *fctx);
+
+/**
+ * Like Fapi_List() from the index.
+ * @param index
+ *  The keystore index.
+ * @param searchPath
+ *  The path to list the objects below, "" for all.
+ * @param pathList
+ *  The colon separated paths, released with Fapi_Free.
+ * @return
+ *  True if the index holds objects below searchPath.
+ */
+bool tss2_index_list(tss2_index *index, char const *searchPath,
+    char **pathList);
+
+/**
+ * Like Fapi_GetDescription() from the index.
+ * @return
+ *  True if the index holds the description of the object at path.
+ */
+bool tss2_index_get_description(tss2_index *index, char const *path,
+    char **description);
+
+/**
+ * Like Fapi_GetAppData() from the index.
+ * @return
+ *  True if the index holds the appdata of the object at path.
+ */
+bool tss2_index_get_appdata(tss2_index *index, char const *path,
+    uint8_t **appData, size_t *appDataSize);
+
+void tss2_index_free(tss2_index *index);
+
+#endif /* TSS2_INDEX_H */
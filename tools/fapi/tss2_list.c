@@ -4,6 +4,7 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include "tools/fapi/tss2_index.h"
 #include "tools/fapi/tss2_template.h"
 
 /* Context struct used to store passed command line parameters */
@@ -42,14 +43,22 @@ static bool tss2_tool_onstart(tpm2_options **opts) {
 
 /* Execute specific tool */
 static int tss2_tool_onrun (FAPI_CONTEXT *fctx) {
-    (void) fctx;
-    /* Execute FAPI command with passed arguments */
+    char const *searchPath = ctx.searchPath ? ctx.searchPath : "";
     char *pathList = NULL;
-    TSS2_RC r = Fapi_List(fctx,
-        ctx.searchPath ? ctx.searchPath : "", &pathList);
-    if (r != TSS2_RC_SUCCESS) {
-        LOG_PERR ("Fapi_List", r);
-        return 1;
+    TSS2_RC r;
+
+    /* Answer from the keystore index, if enabled and up to date */
+    tss2_index *index = tss2_index_load (fctx);
+    bool is_indexed = index && tss2_index_list (index, searchPath, &pathList);
+    tss2_index_free (index);
+
+    /* Execute FAPI command with passed arguments */
+    if (!is_indexed) {
+        r = Fapi_List(fctx, searchPath, &pathList);
+        if (r != TSS2_RC_SUCCESS) {
+            LOG_PERR ("Fapi_List", r);
+            return 1;
+        }
     }
 
     /* Write returned data to file(s) */
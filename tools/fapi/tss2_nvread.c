@@ -13,6 +13,7 @@ static struct cxt {
     char const *data;
     char const *logData;
     bool        overwrite;
+    bool        bulk;
 } ctx;
 
 /* Parse command line parameters */
@@ -30,6 +31,9 @@ static bool on_option(char key, char *value) {
     case 'l':
         ctx.logData = value;
         break;
+    case 'b':
+        ctx.bulk = true;
+        break;
     }
     return true;
 }
@@ -40,12 +44,92 @@ static bool tss2_tool_onstart(tpm2_options **opts) {
         {"nvPath"  , required_argument, NULL, 'p'},
         {"force" , no_argument      , NULL, 'f'},
         {"data", required_argument, NULL, 'o'},
-        {"logData", required_argument, NULL, 'l'}
+        {"logData", required_argument, NULL, 'l'},
+        {"bulk", no_argument, NULL, 'b'},
     };
-    return (*opts = tpm2_options_new ("fo:p:l:", ARRAY_LEN(topts), topts,
+    return (*opts = tpm2_options_new ("bfo:p:l:", ARRAY_LEN(topts), topts,
                                       on_option, NULL, 0)) != NULL;
 }
 
+/*
+ * Reads every NV path of the list over the one FAPI context. While the TPM
+ * and the keystore work on one index, the data of the one before is written,
+ * so the file I/O of the host overlaps the read.
+ */
+static int nvread_bulk (FAPI_CONTEXT *fctx) {
+
+    char **paths;
+    size_t count;
+    if (tss2_bulk_paths_read (ctx.nvPath, &paths, &count)) {
+        return 1;
+    }
+
+    tss2_bulk_files files;
+    if (tss2_bulk_files_open (&files, ctx.data, true, ctx.overwrite)) {
+        tss2_bulk_paths_free (paths, count);
+        return 1;
+    }
+
+    int ret = 1;
+    uint8_t *prev = NULL;
+    size_t prev_len = 0;
+    for (size_t i = 0; i < count; i++) {
+        TSS2_RC r = Fapi_NvRead_Async (fctx, paths[i]);
+        if (r != TSS2_RC_SUCCESS) {
+            LOG_PERR ("Fapi_NvRead_Async", r);
+            fprintf (stderr, "%s failed\n", paths[i]);
+            goto out;
+        }
+
+        bool is_prev_written = !i;
+        int prev_ret = 0;
+        uint8_t *data = NULL;
+        size_t data_len = 0;
+        do {
+            if (!is_prev_written) {
+                prev_ret = tss2_bulk_files_write (&files, paths[i - 1], prev,
+                    prev_len);
+                is_prev_written = true;
+            } else {
+                tss2_poll (fctx);
+            }
+            r = Fapi_NvRead_Finish (fctx, &data, &data_len, NULL);
+        } while (tss2_is_try_again (r));
+
+        Fapi_Free (prev);
+        prev = NULL;
+
+        if (r != TSS2_RC_SUCCESS) {
+            LOG_PERR ("Fapi_NvRead_Finish", r);
+            fprintf (stderr, "%s failed\n", paths[i]);
+            goto out;
+        }
+
+        prev = data;
+        prev_len = data_len;
+
+        if (prev_ret) {
+            goto out;
+        }
+    }
+
+    if (count && tss2_bulk_files_write (&files, paths[count - 1], prev,
+            prev_len)) {
+        goto out;
+    }
+
+    ret = 0;
+
+out:
+    Fapi_Free (prev);
+    if (tss2_bulk_files_close (&files)) {
+        ret = 1;
+    }
+    tss2_bulk_paths_free (paths, count);
+
+    return ret;
+}
+
 /* Execute specific tool */
 static int tss2_tool_onrun (FAPI_CONTEXT *fctx) {
     /* Check availability of required parameters */
@@ -68,6 +152,15 @@ static int tss2_tool_onrun (FAPI_CONTEXT *fctx) {
         return -1;
     }
 
+    /* Read every NV path of a list to a directory or framed stream */
+    if (ctx.bulk) {
+        if (ctx.logData) {
+            fprintf (stderr, "--logData cannot be given with --bulk\n");
+            return -1;
+        }
+        return nvread_bulk (fctx);
+    }
+
     /* Execute FAPI command with passed arguments */
     uint8_t *data;
     size_t data_len;
@@ -10,6 +10,7 @@
 static struct cxt {
     char   const *nvPath;
     char   const *data;
+    bool          bulk;
 } ctx;
 
 /* Parse command line parameters */
@@ -21,6 +22,9 @@ static bool on_option(char key, char *value) {
     case 'p':
         ctx.nvPath = value;
         break;
+    case 'b':
+        ctx.bulk = true;
+        break;
     }
     return true;
 }
@@ -29,12 +33,87 @@ static bool on_option(char key, char *value) {
 static bool tss2_tool_onstart(tpm2_options **opts) {
     struct option topts[] = {
         {"data"  , required_argument, NULL, 'i'},
-        {"nvPath"  , required_argument, NULL, 'p'}
+        {"nvPath"  , required_argument, NULL, 'p'},
+        {"bulk"    , no_argument      , NULL, 'b'},
     };
-    return (*opts = tpm2_options_new ("i:p:", ARRAY_LEN(topts), topts,
+    return (*opts = tpm2_options_new ("bi:p:", ARRAY_LEN(topts), topts,
                                       on_option, NULL, 0)) != NULL;
 }
 
+/*
+ * Writes every NV path of the list over the one FAPI context. While the TPM
+ * and the keystore work on one index, the data of the next one is read, so
+ * the file I/O of the host overlaps the write.
+ */
+static int nvwrite_bulk (FAPI_CONTEXT *fctx) {
+
+    char **paths;
+    size_t count;
+    if (tss2_bulk_paths_read (ctx.nvPath, &paths, &count)) {
+        return 1;
+    }
+
+    tss2_bulk_files files;
+    if (tss2_bulk_files_open (&files, ctx.data, false, false)) {
+        tss2_bulk_paths_free (paths, count);
+        return 1;
+    }
+
+    int ret = 1;
+    uint8_t *data = NULL;
+    size_t data_len = 0;
+    if (count && tss2_bulk_files_read (&files, paths[0], &data, &data_len)) {
+        goto out;
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        TSS2_RC r = Fapi_NvWrite_Async (fctx, paths[i], data, data_len);
+        if (r != TSS2_RC_SUCCESS) {
+            LOG_PERR ("Fapi_NvWrite_Async", r);
+            fprintf (stderr, "%s failed\n", paths[i]);
+            goto out;
+        }
+
+        uint8_t *next = NULL;
+        size_t next_len = 0;
+        bool is_next_read = i + 1 == count;
+        int next_ret = 0;
+        do {
+            if (!is_next_read) {
+                next_ret = tss2_bulk_files_read (&files, paths[i + 1], &next,
+                    &next_len);
+                is_next_read = true;
+            } else {
+                tss2_poll (fctx);
+            }
+            r = Fapi_NvWrite_Finish (fctx);
+        } while (tss2_is_try_again (r));
+
+        free (data);
+        data = next;
+        data_len = next_len;
+
+        if (r != TSS2_RC_SUCCESS) {
+            LOG_PERR ("Fapi_NvWrite_Finish", r);
+            fprintf (stderr, "%s failed\n", paths[i]);
+            goto out;
+        }
+
+        if (next_ret) {
+            goto out;
+        }
+    }
+
+    ret = 0;
+
+out:
+    free (data);
+    tss2_bulk_files_close (&files);
+    tss2_bulk_paths_free (paths, count);
+
+    return ret;
+}
+
 /* Execute specific tool */
 static int tss2_tool_onrun (FAPI_CONTEXT *fctx) {
     /* Check availability of required parameters */
@@ -47,6 +126,11 @@ static int tss2_tool_onrun (FAPI_CONTEXT *fctx) {
         return -1;
     }
 
+    /* Write every NV path of a list from a directory or framed stream */
+    if (ctx.bulk) {
+        return nvwrite_bulk (fctx);
+    }
+
     /* Read data file */
     uint8_t *data;
     size_t data_len;
@@ -11,6 +11,7 @@ static struct cxt {
     uint32_t        pcr;
     char     const *data;
     char     const *logData;
+    bool            bulk;
 } ctx;
 
 /* Parse command line parameters */
@@ -29,6 +30,9 @@ static bool on_option(char key, char *value) {
     case 'l':
         ctx.logData = value;
         break;
+    case 'b':
+        ctx.bulk = true;
+        break;
     }
     return true;
 }
@@ -38,14 +42,167 @@ static bool tss2_tool_onstart(tpm2_options **opts) {
     struct option topts[] = {
         {"pcr"       , required_argument, NULL, 'x'},
         {"data", required_argument, NULL, 'i'},
-        {"logData", required_argument, NULL, 'l'}
+        {"logData", required_argument, NULL, 'l'},
+        {"bulk", no_argument, NULL, 'b'}
     };
-    return (*opts = tpm2_options_new ("x:i:l", ARRAY_LEN(topts), topts,
+    return (*opts = tpm2_options_new ("x:i:lb", ARRAY_LEN(topts), topts,
                                       on_option, NULL, 0)) != NULL;
 }
 
+/* A measurement of a bulk extend, a line of the list */
+struct pcrextend_record {
+    uint32_t pcr;
+    char const *data;
+    char const *logData;
+};
+
+/* splits the lines "<pcr> <data file> [<log data file>]" of the list */
+static int pcrextend_parse (char **lines, size_t count,
+    struct pcrextend_record *records) {
+
+    for (size_t i = 0; i < count; i++) {
+        char *saveptr;
+        char *pcr = strtok_r (lines[i], " \t", &saveptr);
+        char *data = strtok_r (NULL, " \t", &saveptr);
+        char *logData = strtok_r (NULL, " \t", &saveptr);
+        if (!data || strtok_r (NULL, " \t", &saveptr)) {
+            fprintf (stderr, "Record %zu is no <pcr> <data> [<logData>]\n",
+                i + 1);
+            return 1;
+        }
+        if (!tpm2_util_string_to_uint32 (pcr, &records[i].pcr)) {
+            fprintf (stderr, "%s cannot be converted to an integer or is"\
+                "larger than 2**32 - 1\n", pcr);
+            return 1;
+        }
+        if (!strcmp (data, "-") || (logData && !strcmp (logData, "-"))) {
+            fprintf (stderr, "Record %zu reads from - (standard input), "\
+                "which holds the list\n", i + 1);
+            return 1;
+        }
+        records[i].data = data;
+        records[i].logData = logData;
+    }
+
+    return 0;
+}
+
+static int pcrextend_read (struct pcrextend_record const *record,
+    uint8_t **data, size_t *size, char **logData) {
+
+    *data = NULL;
+    *logData = NULL;
+    if (open_read_and_close (record->data, (void**)data, size)) {
+        return 1;
+    }
+    if (record->logData && open_read_and_close (record->logData,
+        (void**)logData, 0)) {
+        free (*data);
+        *data = NULL;
+        return 1;
+    }
+
+    return 0;
+}
+
+/*
+ * Extends the measurements of a list over the one FAPI context. The whole
+ * list is parsed before the first extend, so a malformed one extends
+ * nothing. While the TPM and the PCR log work on one measurement, the files
+ * of the next one are read.
+ */
+static int pcrextend_bulk (FAPI_CONTEXT *fctx) {
+
+    char **lines;
+    size_t count;
+    if (tss2_bulk_paths_read (ctx.data, &lines, &count)) {
+        return 1;
+    }
+
+    int ret = 1;
+    uint8_t *data = NULL;
+    size_t data_size = 0;
+    char *logData = NULL;
+    struct pcrextend_record *records = calloc (count ? count : 1,
+        sizeof(*records));
+    if (!records) {
+        fprintf (stderr, "calloc(3) failed: %m\n");
+        goto out;
+    }
+    if (pcrextend_parse (lines, count, records)) {
+        goto out;
+    }
+
+    if (count && pcrextend_read (&records[0], &data, &data_size, &logData)) {
+        goto out;
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        TSS2_RC r = Fapi_PcrExtend_Async (fctx, records[i].pcr, data,
+            data_size, logData);
+        if (r != TSS2_RC_SUCCESS) {
+            LOG_PERR ("Fapi_PcrExtend_Async", r);
+            fprintf (stderr, "Record %zu failed\n", i + 1);
+            goto out;
+        }
+
+        uint8_t *next = NULL;
+        size_t next_size = 0;
+        char *next_logData = NULL;
+        bool is_next_read = i + 1 == count;
+        int next_ret = 0;
+        do {
+            if (!is_next_read) {
+                next_ret = pcrextend_read (&records[i + 1], &next, &next_size,
+                    &next_logData);
+                is_next_read = true;
+            } else {
+                tss2_poll (fctx);
+            }
+            r = Fapi_PcrExtend_Finish (fctx);
+        } while (tss2_is_try_again (r));
+
+        free (data);
+        free (logData);
+        data = next;
+        data_size = next_size;
+        logData = next_logData;
+
+        if (r != TSS2_RC_SUCCESS) {
+            LOG_PERR ("Fapi_PcrExtend_Finish", r);
+            fprintf (stderr, "Record %zu failed\n", i + 1);
+            goto out;
+        }
+
+        if (next_ret) {
+            goto out;
+        }
+    }
+
+    ret = 0;
+
+out:
+    free (data);
+    free (logData);
+    free (records);
+    tss2_bulk_paths_free (lines, count);
+
+    return ret;
+}
+
 /* Execute specific tool */
 static int tss2_tool_onrun (FAPI_CONTEXT *fctx) {
+    /* Extend every measurement of a list */
+    if (ctx.bulk) {
+        if (ctx.pcr || ctx.logData) {
+            fprintf (stderr, "The records of the list name the PCRs and "\
+                "the log data, --pcr and --logData cannot be given with "\
+                "--bulk\n");
+            return -1;
+        }
+        return pcrextend_bulk (fctx);
+    }
+
     /* Check availability of required parameters */
     if (!ctx.pcr) {
         fprintf (stderr, "No pcr provided, use --pcr\n");
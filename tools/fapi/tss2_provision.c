@@ -1,6 +1,11 @@
 /* SPDX-License-Identifier: BSD-3-Clause */
 
+#include <inttypes.h>
+#include <limits.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
 #include "tools/fapi/tss2_template.h"
 
 /* Context struct used to store passed commandline parameters */
@@ -8,8 +13,62 @@ static struct cxt {
     char *authValueEh;
     char *authValueSh;
     char *authValueLockout;
+    bool  resume;
+    bool  timing;
 } ctx;
 
+/* The phases of the provisioning, timed with --timing */
+enum provision_phase {
+    provision_phase_check,
+    provision_phase_cleanup,
+    provision_phase_start,
+    provision_phase_host,
+    provision_phase_tpm,
+    provision_phase_max
+};
+
+static char const *phase_names[provision_phase_max] = {
+    "check",
+    "cleanup",
+    "start",
+    "host",
+    "tpm",
+};
+
+static struct {
+    uint64_t phase_ns[provision_phase_max];
+    uint64_t start_ns;
+    uint64_t polls;
+} timing;
+
+/* What --resume found in the keystore */
+enum provision_state {
+    provision_state_none,
+    provision_state_partial,
+    provision_state_complete,
+};
+
+static char const *state_names[] = {
+    "none",
+    "partial",
+    "complete",
+};
+
+static uint64_t now_ns (void) {
+
+    struct timespec ts;
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + (uint64_t)ts.tv_nsec;
+}
+
+/* accounts the time since *since to a phase and restarts *since */
+static void phase_account (enum provision_phase phase, uint64_t *since) {
+
+    uint64_t now = now_ns ();
+    timing.phase_ns[phase] += now - *since;
+    *since = now;
+}
+
 /* Parse commandline parameters */
 static bool on_option(char key, char *value) {
     switch (key) {
@@ -22,6 +81,12 @@ static bool on_option(char key, char *value) {
     case 'L':
         ctx.authValueLockout = value;
         break;
+    case 'r':
+        ctx.resume = true;
+        break;
+    case 't':
+        ctx.timing = true;
+        break;
     }
     return true;
 }
@@ -32,23 +97,187 @@ static bool tss2_tool_onstart(tpm2_options **opts) {
         {"authValueEh",         required_argument, NULL, 'E'},
         {"authValueSh",         required_argument, NULL, 'S'},
         {"authValueLockout",    required_argument, NULL, 'L'},
+        {"resume",              no_argument,       NULL, 'r'},
+        {"timing",              no_argument,       NULL, 't'},
     };
-    return (*opts = tpm2_options_new ("E:S:L",
+    return (*opts = tpm2_options_new ("E:S:Lrt",
         ARRAY_LEN(topts), topts, on_option, NULL, 0)) != NULL;
 }
 
-/* Execute specific tool */
-static int tss2_tool_onrun (FAPI_CONTEXT *fctx) {
+/* the profiles of a keystore checked with --resume */
+#define PROVISION_PROFILES_MAX 16
 
-    /* Execute FAPI command with passed arguments */
-    TSS2_RC r = Fapi_Provision (fctx, ctx.authValueEh, ctx.authValueSh,
+struct provision_profile {
+    char path[PATH_MAX];
+    bool has_srk;
+    bool has_ek;
+};
+
+/*
+ * Tells from the keystore whether a provisioning, possibly interrupted, took
+ * place. It is complete once a profile holds both the SRK and the EK. An
+ * interrupted one leaves the objects of the profiles written so far.
+ */
+static int provision_check (FAPI_CONTEXT *fctx, enum provision_state *state,
+    struct provision_profile *profiles, size_t *count) {
+
+    *state = provision_state_none;
+    *count = 0;
+
+    char *pathList = NULL;
+    TSS2_RC r = Fapi_List (fctx, "/", &pathList);
+    if (r != TSS2_RC_SUCCESS) {
+        /* nothing provisioned yet, there is no keystore to list */
+        return 0;
+    }
+
+    char *saveptr;
+    for (char *path = strtok_r (pathList, ":", &saveptr); path;
+        path = strtok_r (NULL, ":", &saveptr)) {
+        /* the objects of a profile are below /P_<profile> */
+        if (strncmp (path, "/P_", 3)) {
+            continue;
+        }
+        char const *object = strchr (path + 1, '/');
+        size_t len = object ? (size_t)(object - path) : strlen (path);
+        if (len >= PATH_MAX) {
+            continue;
+        }
+
+        size_t i;
+        for (i = 0; i < *count; i++) {
+            if (strlen (profiles[i].path) == len
+                    && !strncmp (profiles[i].path, path, len)) {
+                break;
+            }
+        }
+        if (i == *count) {
+            if (*count == PROVISION_PROFILES_MAX) {
+                fprintf (stderr, "Too many profiles in the keystore\n");
+                Fapi_Free (pathList);
+                return 1;
+            }
+            memcpy (profiles[i].path, path, len);
+            profiles[i].path[len] = '\0';
+            profiles[i].has_srk = profiles[i].has_ek = false;
+            (*count)++;
+        }
+
+        if (object) {
+            profiles[i].has_srk |= !strcmp (object, "/HS/SRK");
+            profiles[i].has_ek |= !strcmp (object, "/HE/EK");
+        }
+        if (profiles[i].has_srk && profiles[i].has_ek) {
+            *state = provision_state_complete;
+        } else if (*state == provision_state_none) {
+            *state = provision_state_partial;
+        }
+    }
+    Fapi_Free (pathList);
+
+    return 0;
+}
+
+/*
+ * Removes what an interrupted provisioning left in the keystore, the SRK it
+ * made persistent included, so Fapi_Provision runs again. The NV indices
+ * live outside the profiles and are kept.
+ */
+static int provision_cleanup (FAPI_CONTEXT *fctx,
+    struct provision_profile const *profiles, size_t count) {
+
+    for (size_t i = 0; i < count; i++) {
+        TSS2_RC r = Fapi_Delete (fctx, profiles[i].path);
+        if (r != TSS2_RC_SUCCESS) {
+            LOG_PERR ("Fapi_Delete", r);
+            fprintf (stderr, "Could not remove %s of the partial "
+                "provisioning\n", profiles[i].path);
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+/*
+ * Runs Fapi_Provision through its asynchronous interface. The time spent in
+ * Fapi_Provision_Finish, the keystore writes and the retrieval of the EK
+ * certificate, is accounted to the host, the time spent waiting for the
+ * responses of the TPM to the TPM.
+ */
+static int provision_run (FAPI_CONTEXT *fctx) {
+
+    uint64_t since = now_ns ();
+    TSS2_RC r = Fapi_Provision_Async (fctx, ctx.authValueEh, ctx.authValueSh,
         ctx.authValueLockout);
-    if (r != TSS2_RC_SUCCESS){
-        LOG_PERR ("Fapi_Provision", r);
+    phase_account (provision_phase_start, &since);
+    if (r != TSS2_RC_SUCCESS) {
+        LOG_PERR ("Fapi_Provision_Async", r);
+        return 1;
+    }
+
+    for (;;) {
+        r = Fapi_Provision_Finish (fctx);
+        phase_account (provision_phase_host, &since);
+        if (!tss2_is_try_again (r)) {
+            break;
+        }
+        tss2_poll (fctx);
+        phase_account (provision_phase_tpm, &since);
+        timing.polls++;
+    }
+    if (r != TSS2_RC_SUCCESS) {
+        LOG_PERR ("Fapi_Provision_Finish", r);
         return 1;
     }
 
     return 0;
 }
 
+static void provision_print_timing (enum provision_state state) {
+
+    printf ("provision:\n");
+    if (ctx.resume) {
+        printf ("  resumed: %s\n", state_names[state]);
+    }
+    printf ("  total-us: %" PRIu64 "\n", (now_ns () - timing.start_ns) / 1000);
+    printf ("  phases:\n");
+    for (size_t i = 0; i < provision_phase_max; i++) {
+        printf ("    %s-us: %" PRIu64 "\n", phase_names[i],
+            timing.phase_ns[i] / 1000);
+    }
+    printf ("  polls: %" PRIu64 "\n", timing.polls);
+}
+
+/* Execute specific tool */
+static int tss2_tool_onrun (FAPI_CONTEXT *fctx) {
+
+    timing.start_ns = now_ns ();
+    uint64_t since = timing.start_ns;
+
+    enum provision_state state = provision_state_none;
+    int ret = 0;
+    if (ctx.resume) {
+        struct provision_profile profiles[PROVISION_PROFILES_MAX];
+        size_t count;
+        ret = provision_check (fctx, &state, profiles, &count);
+        phase_account (provision_phase_check, &since);
+        if (!ret && state == provision_state_partial) {
+            ret = provision_cleanup (fctx, profiles, count);
+            phase_account (provision_phase_cleanup, &since);
+        }
+    }
+
+    /* Execute FAPI command with passed arguments */
+    if (!ret && state != provision_state_complete) {
+        ret = provision_run (fctx);
+    }
+
+    if (!ret && ctx.timing) {
+        provision_print_timing (state);
+    }
+
+    return ret;
+}
+
 TSS2_TOOL_REGISTER("provision", tss2_tool_onstart, tss2_tool_onrun, NULL)
@@ -16,9 +16,23 @@ static struct cxt {
     char const *pcrLog;
     char const *signature;
     char const *certificate;
+    char const *manifest;
     bool        overwrite;
 } ctx;
 
+/* <qualifyingData> <quoteInfo> <signature> [<pcrLog> [<certificate>]] */
+#define MANIFEST_FIELDS 5
+
+/*
+ * The PCR log of a quote of the manifest, along with the PCR digest of that
+ * quote. FAPI serializes the whole log for every quote that asks for it, the
+ * following quotes of the same PCR values reuse this one.
+ */
+static struct {
+    char *pcrLog;
+    char *pcrDigest;
+} manifest_log;
+
 /**
  * Split the comma separated input, parse each token as number,
  * put the numbers in the array output.  Allocate memory for
@@ -83,6 +97,9 @@ static bool on_option(char key, char *value) {
     case 'c':
         ctx.certificate = value;
         break;
+    case 'M':
+        ctx.manifest = value;
+        break;
     }
     return true;
 }
@@ -97,12 +114,162 @@ static bool tss2_tool_onstart(tpm2_options **opts) {
         {"signature"      , required_argument, NULL, 'o'},
         {"pcrLog"        , required_argument, NULL, 'l'},
         {"certificate"    , required_argument, NULL, 'c'},
+        {"manifest"       , required_argument, NULL, 'M'},
         {"force"          , no_argument      , NULL, 'f'}
     };
-    return (*opts = tpm2_options_new ("x:Q:l:fp:q:o:c:", ARRAY_LEN(topts),
+    return (*opts = tpm2_options_new ("x:Q:l:fp:q:o:c:M:", ARRAY_LEN(topts),
         topts, on_option, NULL, 0)) != NULL;
 }
 
+/*
+ * The pcrDigest of the attestation of a quote info, which tells if two
+ * quotes are of the same PCR values. NULL if not found.
+ */
+static char *quote_pcr_digest (char const *quoteInfo) {
+
+    char const *key = "\"pcrDigest\"";
+    char const *p = strstr (quoteInfo, key);
+    if (!p) {
+        return NULL;
+    }
+
+    p += strlen (key);
+    p += strspn (p, " \t\r\n");
+    if (*p++ != ':') {
+        return NULL;
+    }
+    p += strspn (p, " \t\r\n");
+    if (*p++ != '"') {
+        return NULL;
+    }
+
+    char const *end = strchr (p, '"');
+    return end ? strndup (p, end - p) : NULL;
+}
+
+/* Take one quote of the manifest and write its outputs */
+static bool manifest_quote (FAPI_CONTEXT *fctx, char **fields, size_t count) {
+
+    char const *pcrLogPath = count > 3 && strcmp (fields[3], "-") ?
+        fields[3] : NULL;
+    char const *certificatePath = count > 4 && strcmp (fields[4], "-") ?
+        fields[4] : NULL;
+
+    uint8_t *qualifyingData = NULL;
+    size_t qualifyingDataSize = 0;
+    if (strcmp (fields[0], "-") && open_read_and_close (fields[0],
+            (void**)&qualifyingData, &qualifyingDataSize)) {
+        return false;
+    }
+
+    bool result = false;
+    bool wantLog = pcrLogPath && !manifest_log.pcrLog;
+    char *quoteInfo = NULL, *pcrLog = NULL, *certificate = NULL;
+    uint8_t *signature = NULL;
+    size_t signatureSize = 0;
+    while (true) {
+        TSS2_RC r = Fapi_Quote (fctx, ctx.pcrList, ctx.pcrListSize,
+            ctx.keyPath, NULL, qualifyingData, qualifyingDataSize, &quoteInfo,
+            &signature, &signatureSize, wantLog ? &pcrLog : NULL,
+            certificatePath ? &certificate : NULL);
+        if (r != TSS2_RC_SUCCESS) {
+            LOG_PERR ("Fapi_Quote", r);
+            goto out;
+        }
+
+        char *pcrDigest = quote_pcr_digest (quoteInfo);
+        if (wantLog) {
+            Fapi_Free (manifest_log.pcrLog);
+            free (manifest_log.pcrDigest);
+            manifest_log.pcrLog = pcrLog;
+            manifest_log.pcrDigest = pcrDigest;
+            pcrLog = NULL;
+            break;
+        }
+
+        bool isSame = pcrDigest && manifest_log.pcrDigest &&
+            !strcmp (pcrDigest, manifest_log.pcrDigest);
+        free (pcrDigest);
+        if (!pcrLogPath || isSame) {
+            break;
+        }
+
+        /* The PCRs changed since the log was taken, quote again with a log */
+        Fapi_Free (quoteInfo);
+        Fapi_Free (signature);
+        Fapi_Free (certificate);
+        quoteInfo = NULL;
+        signature = NULL;
+        certificate = NULL;
+        wantLog = true;
+    }
+
+    if (open_write_and_close (fields[1], ctx.overwrite, quoteInfo,
+            strlen(quoteInfo)) ||
+        open_write_and_close (fields[2], ctx.overwrite, signature,
+            signatureSize) ||
+        (pcrLogPath && open_write_and_close (pcrLogPath, ctx.overwrite,
+            manifest_log.pcrLog, strlen(manifest_log.pcrLog))) ||
+        (certificatePath && certificate && open_write_and_close (
+            certificatePath, ctx.overwrite, certificate,
+            strlen(certificate)))) {
+        goto out;
+    }
+    result = true;
+
+out:
+    free (qualifyingData);
+    Fapi_Free (quoteInfo);
+    Fapi_Free (signature);
+    Fapi_Free (certificate);
+    return result;
+}
+
+typedef struct {
+    FAPI_CONTEXT *fctx;
+    int           ret;
+} manifest_run_state;
+
+/* Takes the line */
+static bool manifest_line (void *e, char *line, char **fields, size_t count,
+    size_t lineNumber, void *userdata) {
+
+    UNUSED (e);
+
+    manifest_run_state *state = (manifest_run_state *) userdata;
+
+    bool isQuoted = manifest_quote (state->fctx, fields, count);
+    printf ("- line: %zu\n", lineNumber);
+    printf ("  quoteInfo: %s\n", fields[1]);
+    printf ("  quoted: %s\n", isQuoted ? "true" : "false");
+    fflush (stdout);
+    if (!isQuoted) {
+        state->ret = 1;
+    }
+
+    free (line);
+    return true;
+}
+
+/*
+ * Take the quotes of the manifest, one per line, with the PCRs and key of
+ * the options. Any quote that fails fails the tool, the others are still
+ * taken.
+ */
+static int manifest_run (FAPI_CONTEXT *fctx) {
+
+    manifest_run_state state = { .fctx = fctx };
+    if (!tpm2_util_manifest_read (ctx.manifest, 3, MANIFEST_FIELDS,
+            "<qualifyingData> <quoteInfo> <signature> [<pcrLog> "\
+            "[<certificate>]]", NULL, NULL, 0, manifest_line, &state)) {
+        state.ret = 1;
+    }
+
+    Fapi_Free (manifest_log.pcrLog);
+    free (manifest_log.pcrDigest);
+    return state.ret;
+}
+
 /* Execute specific tool */
 static int tss2_tool_onrun (FAPI_CONTEXT *fctx) {
     /* Check availability of required parameters */
@@ -115,6 +282,18 @@ static int tss2_tool_onrun (FAPI_CONTEXT *fctx) {
         free (ctx.pcrList);
         return -1;
     }
+    if (ctx.manifest) {
+        if (ctx.qualifyingData || ctx.quoteInfo || ctx.signature ||
+            ctx.pcrLog || ctx.certificate) {
+            fprintf (stderr, "--manifest names the inputs and outputs of "\
+                "every quote, they cannot be given as options\n");
+            free (ctx.pcrList);
+            return -1;
+        }
+        int ret = manifest_run (fctx);
+        free (ctx.pcrList);
+        return ret;
+    }
     if (!ctx.quoteInfo) {
         fprintf (stderr, "No quoteInfo provided, use --quoteInfo\n");
         free (ctx.pcrList);
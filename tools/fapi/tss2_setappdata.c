@@ -5,12 +5,14 @@
 #include <string.h>
 #include <unistd.h>
 
+#include "tools/fapi/tss2_index.h"
 #include "tools/fapi/tss2_template.h"
 
 /* Context struct used to store passed commandline parameters */
 static struct cxt {
     char const *appData;
     char    const *path;
+    bool        bulk;
 } ctx;
 
 /* Parse commandline parameters */
@@ -22,6 +24,9 @@ static bool on_option(char key, char *value) {
     case 'p':
         ctx.path = value;
         break;
+    case 'b':
+        ctx.bulk = true;
+        break;
     }
     return true;
 }
@@ -31,11 +36,71 @@ static bool tss2_tool_onstart(tpm2_options **opts) {
     struct option topts[] = {
         {"appData", required_argument, NULL, 'i'},
         {"path", required_argument, NULL, 'p'},
+        {"bulk", no_argument      , NULL, 'b'},
     };
-    return (*opts = tpm2_options_new ("i:p:", ARRAY_LEN(topts), topts,
+    return (*opts = tpm2_options_new ("bi:p:", ARRAY_LEN(topts), topts,
                                       on_option, NULL, 0)) != NULL;
 }
 
+/* Whether the object at path already holds the appdata of the update */
+static bool appdata_is_set (FAPI_CONTEXT *fctx, tss2_index *index,
+    tss2_bulk_update const *u) {
+
+    uint8_t *appData = NULL;
+    size_t appDataSize = 0;
+    bool is_known = index &&
+        tss2_index_get_appdata (index, u->path, &appData, &appDataSize);
+    if (!is_known) {
+        is_known = Fapi_GetAppData (fctx, u->path, &appData,
+            &appDataSize) == TSS2_RC_SUCCESS;
+    }
+
+    bool is_set = is_known && appDataSize == u->size &&
+        (!u->size || !memcmp (appData, u->data, u->size));
+    Fapi_Free (appData);
+
+    return is_set;
+}
+
+/*
+ * Sets the appdata of every path of the list over the one FAPI context. The
+ * FAPI rewrites and syncs the keystore file of an object for every change,
+ * so an object already holding its appdata, as told by the keystore index
+ * if enabled, is not written again. Stops at the first path failing.
+ */
+static int setappdata_bulk (FAPI_CONTEXT *fctx) {
+
+    tss2_bulk_update *updates;
+    size_t count;
+    if (tss2_bulk_updates_read (ctx.path, ctx.appData, &updates, &count)) {
+        return 1;
+    }
+
+    tss2_index *index = tss2_index_load (fctx);
+
+    int ret = 0;
+    for (size_t i = 0; i < count; i++) {
+        tss2_bulk_update const *u = &updates[i];
+        if (appdata_is_set (fctx, index, u)) {
+            continue;
+        }
+
+        TSS2_RC r = Fapi_SetAppData (fctx, u->path, u->size ? u->data : NULL,
+            u->size);
+        if (r != TSS2_RC_SUCCESS) {
+            LOG_PERR ("Fapi_SetAppData", r);
+            fprintf (stderr, "%s failed\n", u->path);
+            ret = 1;
+            break;
+        }
+    }
+
+    tss2_index_free (index);
+    tss2_bulk_updates_free (updates, count);
+
+    return ret;
+}
+
 /* Execute specific tool */
 static int tss2_tool_onrun (FAPI_CONTEXT *fctx) {
     /* Check availability of required parameters */
@@ -44,6 +109,11 @@ static int tss2_tool_onrun (FAPI_CONTEXT *fctx) {
         return -1;
     }
 
+    /* Set the appdata of every path of a list from a directory or stream */
+    if (ctx.bulk) {
+        return setappdata_bulk (fctx);
+    }
+
     /* Read appData from file */
     TSS2_RC r;
     uint8_t* appData = NULL;
@@ -1,20 +1,25 @@
 /* SPDX-License-Identifier: BSD-3-Clause */
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include "tools/fapi/tss2_index.h"
 #include "tools/fapi/tss2_template.h"
 
 /* Context struct used to store passed command line parameters */
 static struct cxt {
     char const *path;
     char const *description;
+    bool        bulk;
 } ctx;
 
+#define DESCRIPTION_MAX 1023
+
 /* Parse command line parameters */
 static bool on_option(char key, char *value) {
     switch (key) {
     case 'i':
-        if (value && strlen (value) > 1023) {
+        if (value && strlen (value) > DESCRIPTION_MAX) {
             fprintf (stderr, "The description can be at most 1023 octets\n");
             return false;
         }
@@ -23,6 +28,9 @@ static bool on_option(char key, char *value) {
     case 'p':
         ctx.path = value;
         break;
+    case 'b':
+        ctx.bulk = true;
+        break;
     }
     return true;
 }
@@ -31,12 +39,93 @@ static bool on_option(char key, char *value) {
 static bool tss2_tool_onstart(tpm2_options **opts) {
     struct option topts[] = {
         {"description", required_argument, NULL, 'i'},
-        {"path"       , required_argument, NULL, 'p'}
+        {"path"       , required_argument, NULL, 'p'},
+        {"bulk"       , no_argument      , NULL, 'b'}
     };
-    return (*opts = tpm2_options_new ("i:p:", ARRAY_LEN(topts), topts,
+    return (*opts = tpm2_options_new ("bi:p:", ARRAY_LEN(topts), topts,
                                       on_option, NULL, 0)) != NULL;
 }
 
+/* Whether the object at path already holds the description */
+static bool description_is_set (FAPI_CONTEXT *fctx, tss2_index *index,
+    char const *path, char const *description) {
+
+    char *current = NULL;
+    bool is_known = index &&
+        tss2_index_get_description (index, path, &current);
+    if (!is_known) {
+        is_known = Fapi_GetDescription (fctx, path, &current)
+            == TSS2_RC_SUCCESS;
+    }
+
+    bool is_set = is_known && !strcmp (current ? current : "",
+        description ? description : "");
+    Fapi_Free (current);
+
+    return is_set;
+}
+
+/*
+ * Sets the description of every path of the list over the one FAPI context,
+ * the text of its file or frame without the trailing newlines. The FAPI
+ * rewrites and syncs the keystore file of an object for every change, so an
+ * object already holding its description, as told by the keystore index if
+ * enabled, is not written again. Stops at the first path failing.
+ */
+static int setdescription_bulk (FAPI_CONTEXT *fctx) {
+
+    tss2_bulk_update *updates;
+    size_t count;
+    if (tss2_bulk_updates_read (ctx.path, ctx.description, &updates,
+            &count)) {
+        return 1;
+    }
+
+    tss2_index *index = tss2_index_load (fctx);
+
+    int ret = 0;
+    for (size_t i = 0; i < count; i++) {
+        tss2_bulk_update const *u = &updates[i];
+
+        size_t size = u->size;
+        while (size && (u->data[size - 1] == '\n' ||
+            u->data[size - 1] == '\r')) {
+            size--;
+        }
+        if (size > DESCRIPTION_MAX || memchr (u->data, '\0', size)) {
+            fprintf (stderr, "The description of %s must be text of at most "\
+                "%d octets\n", u->path, DESCRIPTION_MAX);
+            ret = 1;
+            break;
+        }
+
+        char *description = size ? strndup ((char const *) u->data, size) :
+            NULL;
+        if (size && !description) {
+            fprintf (stderr, "strndup(3) failed: %m\n");
+            ret = 1;
+            break;
+        }
+
+        TSS2_RC r = TSS2_RC_SUCCESS;
+        if (!description_is_set (fctx, index, u->path, description)) {
+            r = Fapi_SetDescription (fctx, u->path, description);
+        }
+        free (description);
+        if (r != TSS2_RC_SUCCESS) {
+            LOG_PERR ("Fapi_SetDescription", r);
+            fprintf (stderr, "%s failed\n", u->path);
+            ret = 1;
+            break;
+        }
+    }
+
+    tss2_index_free (index);
+    tss2_bulk_updates_free (updates, count);
+
+    return ret;
+}
+
 /* Execute specific tool */
 static int tss2_tool_onrun (FAPI_CONTEXT *fctx) {
     /* Check availability of required parameters */
@@ -45,6 +134,18 @@ static int tss2_tool_onrun (FAPI_CONTEXT *fctx) {
         return -1;
     }
 
+    /*
+     * Set the description of every path of a list from a directory or
+     * framed stream, named by --description
+     */
+    if (ctx.bulk) {
+        if (!ctx.description) {
+            fprintf (stderr, "No descriptions provided, use --description\n");
+            return -1;
+        }
+        return setdescription_bulk (fctx);
+    }
+
     /* Execute FAPI command with passed arguments */
     TSS2_RC r = Fapi_SetDescription (fctx, ctx.path, ctx.description);
     if (r != TSS2_RC_SUCCESS){
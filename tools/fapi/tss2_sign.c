@@ -16,6 +16,10 @@ static struct cxt {
     char const *certificate;
     bool        overwrite;
     char const *padding;
+    bool        bulk;
+    /* of the first signature in bulk mode, the same for all of them */
+    char       *bulkPublicKey;
+    char       *bulkCertificate;
 } ctx;
 
 /* Parse command line parameters */
@@ -42,6 +46,9 @@ static bool on_option(char key, char *value) {
     case 's':
         ctx.padding = value;
         break;
+    case 'b':
+        ctx.bulk = true;
+        break;
     }
     return true;
 }
@@ -56,12 +63,58 @@ static bool tss2_tool_onstart(tpm2_options **opts) {
         {"publicKey",   required_argument, NULL, 'k'},
         {"force",       no_argument      , NULL, 'f'},
         {"certificate", required_argument, NULL, 'c'},
-
+        {"bulk",        no_argument      , NULL, 'b'},
     };
-    return (*opts = tpm2_options_new ("c:d:fp:k:o:s:", ARRAY_LEN(topts), topts,
+    return (*opts = tpm2_options_new ("bc:d:fp:k:o:s:", ARRAY_LEN(topts), topts,
                                       on_option, NULL, 0)) != NULL;
 }
 
+/* Sign one digest of a bulk operation with the key */
+static int sign_one (FAPI_CONTEXT *fctx, uint8_t const *digest,
+    size_t digestSize, uint8_t **signature, size_t *signatureSize) {
+
+    char *publicKey, *certificate = NULL;
+    TSS2_RC r = Fapi_Sign (fctx, ctx.keyPath, ctx.padding, digest,
+        digestSize, signature, signatureSize, &publicKey, &certificate);
+    if (r != TSS2_RC_SUCCESS) {
+        LOG_PERR ("Fapi_Sign", r);
+        return 1;
+    }
+
+    if (!ctx.bulkPublicKey) {
+        ctx.bulkPublicKey = publicKey;
+    } else {
+        Fapi_Free (publicKey);
+    }
+    if (!ctx.bulkCertificate) {
+        ctx.bulkCertificate = certificate;
+    } else {
+        Fapi_Free (certificate);
+    }
+    return 0;
+}
+
+/* Sign every digest of a directory or framed stream */
+static int sign_bulk (FAPI_CONTEXT *fctx) {
+
+    int ret = tss2_bulk_run (fctx, ctx.digest, ctx.signature, ctx.overwrite,
+        sign_one);
+
+    if (!ret && ctx.certificate && ctx.bulkCertificate &&
+        strlen(ctx.bulkCertificate)) {
+        ret = open_write_and_close (ctx.certificate, ctx.overwrite,
+            ctx.bulkCertificate, strlen(ctx.bulkCertificate));
+    }
+    if (!ret && ctx.publicKey && ctx.bulkPublicKey) {
+        ret = open_write_and_close (ctx.publicKey, ctx.overwrite,
+            ctx.bulkPublicKey, strlen(ctx.bulkPublicKey));
+    }
+
+    Fapi_Free (ctx.bulkCertificate);
+    Fapi_Free (ctx.bulkPublicKey);
+    return ret;
+}
+
 /* Execute specific tool */
 static int tss2_tool_onrun (FAPI_CONTEXT *fctx) {
 
@@ -90,6 +143,10 @@ static int tss2_tool_onrun (FAPI_CONTEXT *fctx) {
         return -1;
     }
 
+    if (ctx.bulk) {
+        return sign_bulk (fctx);
+    }
+
     /* Read data needed to create signature */
     uint8_t *digest, *signature;
     size_t digestSize, signatureSize;
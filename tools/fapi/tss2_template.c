@@ -1,7 +1,10 @@
 /* SPDX-License-Identifier: BSD-3-Clause */
 
+#include <dirent.h>
 #include <fcntl.h>
 #include <libgen.h>
+#include <limits.h>
+#include <poll.h>
 #include <signal.h>
 #include <stdbool.h>
 #include <stdio.h>
@@ -37,6 +40,7 @@ static void signal_termio_restore(__attribute__((unused)) int signumber) {
 }
 
 /* adapted from lib/tpm2_options.c for tss2 */
+__attribute__((cold))
 static bool execute_man(char *prog_name, bool show_errors) {
     pid_t pid;
     int status;
@@ -76,51 +80,58 @@ static bool execute_man(char *prog_name, bool show_errors) {
 }
 
 /* adapted from lib/tpm2_options.c for tss2 */
+__attribute__((hot))
 static tpm2_option_code tss2_handle_options (
     int            argc,
     char         **argv,
     tpm2_options **tool_opts) {
     tpm2_option_code rc = tpm2_option_code_err;
     bool show_help = false, manpager = true, explicit_manpager = false;
-    struct option long_options [] = {
+    static const struct option long_options [] = {
        {"help"   , optional_argument, NULL, 'h'},
        {"version", no_argument, NULL, 'v'}
     };
-    tpm2_options *opts = tpm2_options_new("h::v",
-            ARRAY_LEN(long_options), long_options, NULL, NULL, 0);
-    if (!opts) {
-        return tpm2_option_code_err;
-    }
     /* Get the options from the tool */
     if (!*tool_opts || !(*tool_opts)->callbacks.on_opt) {
         fprintf (stderr, "Unknown option found\n");
-        goto out;
+        return tpm2_option_code_err;
+    }
+    /* the options of the tool are parsed ahead of the common options */
+    tpm2_option_table tables[] = {
+        {
+            .short_opts = (*tool_opts)->short_opts,
+            .long_opts = (*tool_opts)->long_opts,
+            .len = (*tool_opts)->len,
+        },
+        {
+            .short_opts = "h::v",
+            .long_opts = long_options,
+            .len = ARRAY_LEN(long_options),
+        },
+    };
+    tpm2_option_parser parser;
+    if (!tpm2_option_parser_init (&parser, argc, argv, tables,
+        ARRAY_LEN(tables))) {
+        return tpm2_option_code_err;
     }
-    tpm2_option_handler on_opt = (*tool_opts)->callbacks.on_opt;
-    tpm2_arg_handler on_arg = (*tool_opts)->callbacks.on_arg;
-    if (!tpm2_options_cat (tool_opts, opts))
-        goto out;
-    (*tool_opts)->callbacks.on_opt = on_opt;
-    (*tool_opts)->callbacks.on_arg = on_arg;
     /* Parse the options, calling the tool callback if unknown */
     int c;
-    while ((c = getopt_long (argc, argv, (*tool_opts)->short_opts,
-        (*tool_opts)->long_opts, NULL)) != -1) {
+    while ((c = tpm2_option_parser_next (&parser)) != -1) {
         switch (c) {
         case 'h':
             show_help = true;
-            if (argv[optind]) {
-                if (!strcmp(argv[optind], "man")) {
+            if (parser.index < argc) {
+                if (!strcmp(argv[parser.index], "man")) {
                     manpager = true;
                     explicit_manpager = true;
-                    optind++;
-                } else if (!strcmp(argv[optind], "no-man")) {
+                    parser.index++;
+                } else if (!strcmp(argv[parser.index], "no-man")) {
                     manpager = false;
-                    optind++;
+                    parser.index++;
                 } else {
                     show_help=false;
                     fprintf (stderr, "Unknown help argument, got: \"%s\"\n",
-                        argv[optind]);
+                        argv[parser.index]);
                 }
             }
             goto out;
@@ -142,13 +153,13 @@ static tpm2_option_code tss2_handle_options (
         case '?':
             goto out;
         default:
-            if (!(*tool_opts)->callbacks.on_opt(c, optarg))
+            if (!(*tool_opts)->callbacks.on_opt(c, parser.optarg))
                 goto out;
         }
     }
 
-    char **tool_args = &argv[optind];
-    int tool_argc = argc - optind;
+    char **tool_args = parser.args;
+    int tool_argc = parser.args_len;
 
     /* have args and no handler, error condition */
     if (tool_argc && !(*tool_opts)->callbacks.on_arg) {
@@ -183,7 +194,7 @@ out:
         }
         rc = tpm2_option_code_stop;
     }
-    tpm2_options_free (opts);
+    tpm2_option_parser_free (&parser);
 
     return rc;
 }
@@ -406,6 +417,7 @@ TSS2_RC branch_callback(
     }
 }
 
+__attribute__((hot))
 static FAPI_CONTEXT* ctx_init(char const * uri) {
     FAPI_CONTEXT* ret;
     const unsigned int rval = Fapi_Initialize(&ret, uri);
@@ -413,6 +425,28 @@ static FAPI_CONTEXT* ctx_init(char const * uri) {
         LOG_PERR("Fapi_Initialize", rval);
         return NULL;
     }
+
+    TSS2_RC r = Fapi_SetAuthCB (ret, auth_callback, NULL);
+    if (r != TSS2_RC_SUCCESS) {
+        fprintf (stderr, "Fapi_SetAuthCB returned %u\n", r);
+        Fapi_Finalize (&ret);
+        return NULL;
+    }
+
+    r = Fapi_SetSignCB (ret, sign_callback, NULL);
+    if (r != TSS2_RC_SUCCESS) {
+        fprintf (stderr, "Fapi_SetSignCB returned %u\n", r);
+        Fapi_Finalize (&ret);
+        return NULL;
+    }
+
+    r = Fapi_SetBranchCB (ret, branch_callback, NULL);
+    if (r != TSS2_RC_SUCCESS) {
+        fprintf (stderr, "Fapi_SetBranchCB returned %u\n", r);
+        Fapi_Finalize (&ret);
+        return NULL;
+    }
+
     return ret;
 }
 
@@ -484,25 +518,13 @@ static const tss2_tool *tss2_tool_lookup(int *argc, char ***argv)
 }
 
 /*
- * This program is a template for TPM2 tools that use the FAPI. It does
- * nothing more than parsing command line options that allow the caller to
- * specify which FAPI function to call.
+ * Parses the options of a tool and runs it, against shared_fctx if given and
+ * otherwise against a FAPI context of its own, initialized once the options
+ * are known to be good.
  */
-int main(int argc, char *argv[]) {
+static int tss2_tool_run(const tss2_tool *tool, int argc, char *argv[],
+    FAPI_CONTEXT *shared_fctx) {
 
-    /* get rid of:
-     *   other write + read + execute (7)
-     */
-    umask(0007);
-
-    const tss2_tool * const tool = tss2_tool_lookup(&argc, &argv);
-    if (!tool) {
-        LOG_ERR("%s: unknown tool. Available tss2 commands:\n", argv[0]);
-        for(unsigned i = 0 ; i < tool_count ; i++) {
-            fprintf(stderr, "%s\n", tools[i]->name);
-        }
-        return EXIT_FAILURE;
-    }
     tpm2_options *tool_opts = NULL;
     if (tool->onstart && !tool->onstart (&tool_opts)) {
         fprintf (stderr,"error retrieving tool options\n");
@@ -517,31 +539,10 @@ int main(int argc, char *argv[]) {
         goto free_opts;
     }
 
-    FAPI_CONTEXT *fctx = ctx_init (NULL);
+    FAPI_CONTEXT *fctx = shared_fctx ? shared_fctx : ctx_init (NULL);
     if (!fctx)
         goto free_opts;
 
-    TSS2_RC r = Fapi_SetAuthCB (fctx, auth_callback, NULL);
-    if (r != TSS2_RC_SUCCESS) {
-        fprintf (stderr, "Fapi_SetAuthCB returned %u\n", r);
-        Fapi_Finalize (&fctx);
-        goto free_opts;
-    }
-
-    r = Fapi_SetSignCB (fctx, sign_callback, NULL);
-    if (r != TSS2_RC_SUCCESS) {
-        fprintf (stderr, "Fapi_SetSignCB returned %u\n", r);
-        Fapi_Finalize (&fctx);
-        goto free_opts;
-    }
-
-    r = Fapi_SetBranchCB (fctx, branch_callback, NULL);
-    if (r != TSS2_RC_SUCCESS) {
-        fprintf (stderr, "Fapi_SetBranchCB returned %u\n", r);
-        Fapi_Finalize (&fctx);
-        goto free_opts;
-    }
-
     /*
      * Call the specific tool, all tools implement this function instead of
      * 'main'.
@@ -559,14 +560,60 @@ int main(int argc, char *argv[]) {
         tool->onexit();
     }
 
-    /*
-     * Cleanup contexts & memory allocated for the modified argument vector
-     * passed to execute_tool.
-     */
-    Fapi_Finalize (&fctx);
+    /* a shared context belongs to the dispatching tool */
+    if (fctx != shared_fctx) {
+        Fapi_Finalize (&fctx);
+    }
 free_opts:
     if (tool_opts)
         tpm2_options_free (tool_opts);
+
+    return ret;
+}
+
+int tss2_tool_dispatch(int argc, char *argv[], FAPI_CONTEXT *shared_fctx) {
+
+    if (argc < 1) {
+        LOG_ERR("Expected a tool name\n");
+        return 1;
+    }
+
+    const tss2_tool * const tool = tss2_tool_lookup(&argc, &argv);
+    if (!tool) {
+        LOG_ERR("%s: unknown tool\n", argv[0]);
+        return 1;
+    }
+
+    return tss2_tool_run(tool, argc, argv, shared_fctx);
+}
+
+/*
+ * This program is a template for TPM2 tools that use the FAPI. It does
+ * nothing more than parsing command line options that allow the caller to
+ * specify which FAPI function to call.
+ */
+__attribute__((hot))
+int main(int argc, char *argv[]) {
+
+    /* get rid of:
+     *   other write + read + execute (7)
+     */
+    umask(0007);
+
+    const tss2_tool * const tool = tss2_tool_lookup(&argc, &argv);
+    if (!tool) {
+        LOG_ERR("%s: unknown tool. Available tss2 commands:\n", argv[0]);
+        for(unsigned i = 0 ; i < tool_count ; i++) {
+            fprintf(stderr, "%s\n", tools[i]->name);
+        }
+        return EXIT_FAILURE;
+    }
+
+    int ret = tss2_tool_run(tool, argc, argv, NULL);
+
+    /*
+     * Cleanup memory allocated by the callbacks.
+     */
     free (password);
     if (ret == 0){
         free (input_signature);
@@ -684,6 +731,581 @@ int open_read_and_close (const char *path, void **input, size_t *size) {
     return 0;
 }
 
+/* reads one frame of a bulk stream, sets *is_end on a clean end of stream */
+static int bulk_read_frame (FILE *input, uint8_t **data, size_t *size,
+    bool *is_end) {
+
+    uint8_t prefix[4];
+    size_t n = fread (prefix, 1, sizeof(prefix), input);
+    *is_end = !n && feof (input);
+    if (*is_end) {
+        return 0;
+    }
+    if (n != sizeof(prefix)) {
+        fprintf (stderr, "Truncated frame length\n");
+        return 1;
+    }
+
+    *size = (size_t)prefix[0] << 24 | (size_t)prefix[1] << 16 |
+        (size_t)prefix[2] << 8 | prefix[3];
+    if (*size > TSS2_BULK_FRAME_MAX) {
+        fprintf (stderr, "Frame of %zu bytes exceeds the maximum of %u\n",
+            *size, TSS2_BULK_FRAME_MAX);
+        return 1;
+    }
+
+    *data = malloc (*size + 1);
+    if (!*data) {
+        fprintf (stderr, "malloc(2) failed: %m\n");
+        return 1;
+    }
+    if (fread (*data, 1, *size, input) != *size) {
+        fprintf (stderr, "Truncated frame, expected %zu bytes\n", *size);
+        free (*data);
+        return 1;
+    }
+
+    return 0;
+}
+
+static int bulk_write_frame (FILE *output, uint8_t const *data, size_t size) {
+
+    uint8_t prefix[4] = {
+        (uint8_t)(size >> 24), (uint8_t)(size >> 16), (uint8_t)(size >> 8),
+        (uint8_t)size
+    };
+    if (fwrite (prefix, 1, sizeof(prefix), output) != sizeof(prefix) ||
+        fwrite (data, 1, size, output) != size) {
+        fprintf (stderr, "Writing a frame failed: %m\n");
+        return 1;
+    }
+    return 0;
+}
+
+static int bulk_run_stream (FAPI_CONTEXT *fctx, char const *input_path,
+    char const *output_path, bool overwrite, tss2_bulk_op op) {
+
+    FILE *input = stdin;
+    if (input_path && strcmp (input_path, "-")) {
+        input = fopen (input_path, "rb");
+        if (!input) {
+            fprintf (stderr, "Opening %s failed: %m\n", input_path);
+            return 1;
+        }
+    }
+
+    int ret = 1;
+    FILE *output = stdout;
+    if (output_path && strcmp (output_path, "-")) {
+        output = fopen (output_path, overwrite ? "wb" : "wbx");
+        if (!output) {
+            fprintf (stderr, "Opening %s failed: %m\n", output_path);
+            goto close_input;
+        }
+    }
+
+    for (size_t i = 0; ; i++) {
+        uint8_t *in, *out;
+        size_t in_size, out_size;
+        bool is_end;
+        if (bulk_read_frame (input, &in, &in_size, &is_end)) {
+            fprintf (stderr, "Reading frame %zu failed\n", i);
+            goto close_output;
+        }
+        if (is_end) {
+            break;
+        }
+
+        int r = op (fctx, in, in_size, &out, &out_size);
+        free (in);
+        if (r) {
+            fprintf (stderr, "Frame %zu failed\n", i);
+            goto close_output;
+        }
+
+        r = bulk_write_frame (output, out, out_size);
+        Fapi_Free (out);
+        if (r) {
+            goto close_output;
+        }
+    }
+
+    ret = 0;
+
+close_output:
+    if (output != stdout) {
+        if (fclose (output)) {
+            fprintf (stderr, "Closing %s failed: %m\n", output_path);
+            ret = 1;
+        }
+    } else if (fflush (stdout)) {
+        fprintf (stderr, "Writing to stdout failed: %m\n");
+        ret = 1;
+    }
+close_input:
+    if (input != stdin) {
+        fclose (input);
+    }
+    return ret;
+}
+
+/* skips hidden files as well as . and .. */
+static int bulk_is_visible (const struct dirent *entry) {
+    return entry->d_name[0] != '.';
+}
+
+static int bulk_run_directory (FAPI_CONTEXT *fctx, char const *input_dir,
+    char const *output_dir, bool overwrite, tss2_bulk_op op) {
+
+    if (!output_dir || !strcmp (output_dir, "-")) {
+        fprintf (stderr, "The output of a bulk input directory has to be a "\
+            "directory\n");
+        return 1;
+    }
+    if (mkdir (output_dir, S_IRWXU) && errno != EEXIST) {
+        fprintf (stderr, "mkdir(2) %s failed: %m\n", output_dir);
+        return 1;
+    }
+
+    /* sorted, so the inputs are processed in a predictable order */
+    struct dirent **entries;
+    int count = scandir (input_dir, &entries, bulk_is_visible,
+        alphasort);
+    if (count < 0) {
+        fprintf (stderr, "scandir(3) %s failed: %m\n", input_dir);
+        return 1;
+    }
+
+    int ret = 0;
+    for (int i = 0; i < count && !ret; i++) {
+        char in_path[PATH_MAX], out_path[PATH_MAX];
+        if (snprintf (in_path, sizeof(in_path), "%s/%s", input_dir,
+                entries[i]->d_name) >= (int)sizeof(in_path) ||
+            snprintf (out_path, sizeof(out_path), "%s/%s", output_dir,
+                entries[i]->d_name) >= (int)sizeof(out_path)) {
+            fprintf (stderr, "Path of %s too long\n", entries[i]->d_name);
+            ret = 1;
+            break;
+        }
+
+        /* skip what is not a file, like a subdirectory */
+        struct stat st;
+        if (stat (in_path, &st) || !S_ISREG (st.st_mode)) {
+            continue;
+        }
+
+        uint8_t *in, *out;
+        size_t in_size, out_size;
+        if (open_read_and_close (in_path, (void**)&in, &in_size)) {
+            ret = 1;
+            break;
+        }
+
+        ret = op (fctx, in, in_size, &out, &out_size);
+        free (in);
+        if (ret) {
+            fprintf (stderr, "%s failed\n", in_path);
+            break;
+        }
+
+        ret = open_write_and_close (out_path, overwrite, out, out_size);
+        Fapi_Free (out);
+    }
+
+    for (int i = 0; i < count; i++) {
+        free (entries[i]);
+    }
+    free (entries);
+
+    return ret;
+}
+
+int tss2_bulk_run (FAPI_CONTEXT *fctx, char const *input, char const *output,
+    bool overwrite, tss2_bulk_op op) {
+
+    struct stat st;
+    if (input && strcmp (input, "-") && !stat (input, &st)
+        && S_ISDIR (st.st_mode)) {
+        return bulk_run_directory (fctx, input, output, overwrite, op);
+    }
+
+    return bulk_run_stream (fctx, input, output, overwrite, op);
+}
+
+int tss2_bulk_files_open (tss2_bulk_files *files, char const *path,
+    bool is_output, bool overwrite) {
+
+    memset (files, 0, sizeof(*files));
+    files->overwrite = overwrite;
+
+    struct stat st;
+    if (path && strcmp (path, "-") && !stat (path, &st)
+        && S_ISDIR (st.st_mode)) {
+        files->dir = path;
+        return 0;
+    }
+
+    files->stream = is_output ? stdout : stdin;
+    files->stream_path = path;
+    if (path && strcmp (path, "-")) {
+        files->stream = fopen (path, is_output ?
+            (overwrite ? "wb" : "wbx") : "rb");
+        if (!files->stream) {
+            fprintf (stderr, "Opening %s failed: %m\n", path);
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+/* the file of a path in a bulk directory, ie nv_Owner_myNV for /nv/Owner/myNV */
+static int bulk_file_path (tss2_bulk_files *files, char const *fapi_path,
+    char path[PATH_MAX]) {
+
+    while (*fapi_path == '/') {
+        fapi_path++;
+    }
+
+    int len = snprintf (path, PATH_MAX, "%s/%s", files->dir, fapi_path);
+    if (len < 0 || len >= PATH_MAX) {
+        fprintf (stderr, "Path of %s too long\n", fapi_path);
+        return 1;
+    }
+
+    for (char *c = &path[strlen (files->dir) + 1]; *c; c++) {
+        if (*c == '/') {
+            *c = '_';
+        }
+    }
+
+    return 0;
+}
+
+int tss2_bulk_files_read (tss2_bulk_files *files, char const *fapi_path,
+    uint8_t **data, size_t *size) {
+
+    if (files->dir) {
+        char path[PATH_MAX];
+        return bulk_file_path (files, fapi_path, path)
+            || open_read_and_close (path, (void**)data, size);
+    }
+
+    bool is_end;
+    int r = bulk_read_frame (files->stream, data, size, &is_end);
+    if (!r && is_end) {
+        fprintf (stderr, "No data left for %s\n", fapi_path);
+        return 1;
+    }
+
+    return r;
+}
+
+int tss2_bulk_files_write (tss2_bulk_files *files, char const *fapi_path,
+    uint8_t const *data, size_t size) {
+
+    if (files->dir) {
+        char path[PATH_MAX];
+        return bulk_file_path (files, fapi_path, path)
+            || open_write_and_close (path, files->overwrite, data, size);
+    }
+
+    return bulk_write_frame (files->stream, data, size);
+}
+
+int tss2_bulk_files_close (tss2_bulk_files *files) {
+
+    int ret = 0;
+    if (files->stream == stdout) {
+        if (fflush (stdout)) {
+            fprintf (stderr, "Writing to stdout failed: %m\n");
+            ret = 1;
+        }
+    } else if (files->stream && files->stream != stdin) {
+        if (fclose (files->stream)) {
+            fprintf (stderr, "Closing %s failed: %m\n", files->stream_path);
+            ret = 1;
+        }
+    }
+
+    memset (files, 0, sizeof(*files));
+
+    return ret;
+}
+
+int tss2_bulk_paths_read (char const *list, char ***paths, size_t *count) {
+
+    FILE *input = stdin;
+    if (list && strcmp (list, "-")) {
+        input = fopen (list, "rb");
+        if (!input) {
+            fprintf (stderr, "Opening %s failed: %m\n", list);
+            return 1;
+        }
+    }
+
+    int ret = 1;
+    char *line = NULL;
+    size_t line_size = 0;
+    size_t capacity = 0;
+    *paths = NULL;
+    *count = 0;
+    while (getline (&line, &line_size, input) != -1) {
+        char *start = line;
+        while (*start == ' ' || *start == '\t') {
+            start++;
+        }
+        char *end = start + strlen (start);
+        while (end > start && (end[-1] == '\n' || end[-1] == '\r'
+            || end[-1] == ' ' || end[-1] == '\t')) {
+            *--end = '\0';
+        }
+
+        /* blank line or comment */
+        if (!*start || *start == '#') {
+            continue;
+        }
+
+        if (*count == capacity) {
+            capacity = capacity ? 2 * capacity : 16;
+            char **tmp = realloc (*paths, capacity * sizeof(**paths));
+            if (!tmp) {
+                fprintf (stderr, "realloc(3) failed: %m\n");
+                goto out;
+            }
+            *paths = tmp;
+        }
+
+        (*paths)[*count] = strdup (start);
+        if (!(*paths)[*count]) {
+            fprintf (stderr, "strdup(3) failed: %m\n");
+            goto out;
+        }
+        (*count)++;
+    }
+
+    if (ferror (input)) {
+        fprintf (stderr, "Reading %s failed: %m\n", list ? list : "stdin");
+        goto out;
+    }
+
+    ret = 0;
+
+out:
+    if (ret) {
+        tss2_bulk_paths_free (*paths, *count);
+        *paths = NULL;
+        *count = 0;
+    }
+    free (line);
+    if (input != stdin) {
+        fclose (input);
+    }
+
+    return ret;
+}
+
+void tss2_bulk_paths_free (char **paths, size_t count) {
+
+    for (size_t i = 0; i < count; i++) {
+        free (paths[i]);
+    }
+    free (paths);
+}
+
+/* by path, the updates of a path in the order they were listed */
+static int bulk_update_compare (const void *a, const void *b) {
+
+    tss2_bulk_update const *ua = a, *ub = b;
+    int r = strcmp (ua->path, ub->path);
+    if (r) {
+        return r;
+    }
+
+    return ua->order < ub->order ? -1 : ua->order > ub->order;
+}
+
+int tss2_bulk_updates_read (char const *list, char const *data,
+    tss2_bulk_update **updates, size_t *count) {
+
+    char **paths;
+    size_t path_count;
+    if (tss2_bulk_paths_read (list, &paths, &path_count)) {
+        return 1;
+    }
+
+    tss2_bulk_files files;
+    if (tss2_bulk_files_open (&files, data, false, false)) {
+        tss2_bulk_paths_free (paths, path_count);
+        return 1;
+    }
+
+    int ret = 1;
+    *count = 0;
+    *updates = calloc (path_count ? path_count : 1, sizeof(**updates));
+    if (!*updates) {
+        fprintf (stderr, "calloc(3) failed: %m\n");
+        goto out;
+    }
+
+    for (size_t i = 0; i < path_count; i++) {
+        tss2_bulk_update *u = &(*updates)[i];
+        u->path = paths[i];
+        u->order = i;
+        paths[i] = NULL;
+        (*count)++;
+        if (tss2_bulk_files_read (&files, u->path, &u->data, &u->size)) {
+            goto out;
+        }
+    }
+
+    qsort (*updates, *count, sizeof(**updates), bulk_update_compare);
+
+    /* of a path listed more than once the last update is kept */
+    size_t kept = 0;
+    for (size_t i = 0; i < *count; i++) {
+        tss2_bulk_update *u = &(*updates)[i];
+        if (i + 1 < *count && !strcmp (u->path, u[1].path)) {
+            free (u->path);
+            free (u->data);
+            continue;
+        }
+        (*updates)[kept++] = *u;
+    }
+    *count = kept;
+
+    ret = 0;
+
+out:
+    if (ret && *updates) {
+        tss2_bulk_updates_free (*updates, *count);
+        *updates = NULL;
+        *count = 0;
+    }
+    tss2_bulk_files_close (&files);
+    tss2_bulk_paths_free (paths, path_count);
+
+    return ret;
+}
+
+void tss2_bulk_updates_free (tss2_bulk_update *updates, size_t count) {
+
+    for (size_t i = 0; i < count; i++) {
+        free (updates[i].path);
+        free (updates[i].data);
+    }
+    free (updates);
+}
+
+/* whether a path names a key below a hierarchy, which is no primary */
+static bool bulk_is_key (char const *path) {
+
+    /* the cryptographic profile, if any, comes first */
+    if (!strncmp (path, "/P_", 3)) {
+        path = strchr (path + 1, '/');
+        if (!path) {
+            return false;
+        }
+    }
+
+    if (strncmp (path, "/H", 2) || !path[2] || !strchr ("SENP", path[2])
+        || path[3] != '/') {
+        return false;
+    }
+
+    /* the primary below the hierarchy, then the key below it */
+    char const *primary = path + 4;
+    char const *key = strchr (primary, '/');
+    return key && key > primary && key[1];
+}
+
+int tss2_bulk_keys_list (FAPI_CONTEXT *fctx, char const *search_path,
+    char ***paths, size_t *count) {
+
+    *paths = NULL;
+    *count = 0;
+
+    char *pathList;
+    TSS2_RC r = Fapi_List (fctx, search_path, &pathList);
+    if (r != TSS2_RC_SUCCESS) {
+        LOG_PERR ("Fapi_List", r);
+        return 1;
+    }
+
+    size_t capacity = 1;
+    for (char const *p = pathList; *p; p++) {
+        capacity += *p == ':';
+    }
+    *paths = calloc (capacity, sizeof(**paths));
+    if (!*paths) {
+        fprintf (stderr, "calloc(3) failed: %m\n");
+        Fapi_Free (pathList);
+        return 1;
+    }
+
+    char *saveptr;
+    for (char *path = strtok_r (pathList, ":", &saveptr); path;
+        path = strtok_r (NULL, ":", &saveptr)) {
+        if (!bulk_is_key (path)) {
+            continue;
+        }
+        (*paths)[*count] = strdup (path);
+        if (!(*paths)[*count]) {
+            fprintf (stderr, "strdup(3) failed: %m\n");
+            Fapi_Free (pathList);
+            tss2_bulk_paths_free (*paths, *count);
+            *paths = NULL;
+            *count = 0;
+            return 1;
+        }
+        (*count)++;
+    }
+    Fapi_Free (pathList);
+
+    return 0;
+}
+
+int tss2_bulk_archive_write (char const *path, bool overwrite,
+    tpm2_ctx_archive_member const *members, size_t count) {
+
+    struct stat st;
+    if (!overwrite && !stat (path, &st)) {
+        fprintf (stderr, "%s already exists, use --force to overwrite it\n",
+            path);
+        return 1;
+    }
+
+    if (count > UINT32_MAX) {
+        fprintf (stderr, "Too many exports for one archive\n");
+        return 1;
+    }
+
+    return !tpm2_ctx_archive_write (path, members, count);
+}
+
+bool tss2_is_try_again (TSS2_RC rc) {
+
+    return (rc & ~TSS2_RC_LAYER_MASK) == TSS2_BASE_RC_TRY_AGAIN;
+}
+
+void tss2_poll (FAPI_CONTEXT *fctx) {
+
+    FAPI_POLL_HANDLE *handles = NULL;
+    size_t count = 0;
+    TSS2_RC r = Fapi_GetPollHandles (fctx, &handles, &count);
+    if (r != TSS2_RC_SUCCESS) {
+        /* nothing to wait for, the operation does host side work next */
+        return;
+    }
+
+    /* bounded, in case the TCTI never signals its handles */
+    if (poll (handles, count, 1000) < 0 && errno != EINTR) {
+        fprintf (stderr, "poll(2) failed: %m\n");
+    }
+
+    Fapi_Free (handles);
+}
+
 char* ask_for_password() {
 #ifdef FAPI_3_0
     const char *pw;
@@ -726,10 +1348,12 @@ error:
     return NULL;
 }
 
+__attribute__((cold))
 void LOG_PERR(const char *func, TSS2_RC rc) {
     fprintf (stderr, "%s(0x%X) - %s\n", func, rc, Tss2_RC_Decode(rc));
 }
 
+__attribute__((cold))
 void LOG_ERR(const char *format, ...) {
    va_list arg;
    va_start (arg, format);
@@ -5,6 +5,7 @@
 #include <stdbool.h>
 #include <tss2/tss2_fapi.h>
 
+#include "lib/tpm2_ctx_archive.h"
 #include "lib/tpm2_options.h"
 #include "lib/tpm2_util.h"
 
@@ -12,7 +13,7 @@
 
 /**
  * An optional interface for tools to specify what options they support.
- * They are concatenated with main's options and passed to getopt_long.
+ * They are parsed ahead of main's options by tpm2_option_parser_next().
  * @param opts
  *  The callee can choose to set *opts to a tpm_options pointer allocated
  *  via tpm2_options_new(). Setting *opts to NULL is not an error, and
@@ -49,6 +50,23 @@ typedef struct {
 
 void tss2_tool_register(const tss2_tool * tool);
 
+/**
+ * Looks up the tool named by argv[0] and runs it against an already
+ * initialized FAPI context. Used by modes that dispatch many tool
+ * invocations from a single process, like batch mode.
+ * @param argc
+ *  The number of args in argv, including the tool name.
+ * @param argv
+ *  The tool name followed by its options and arguments.
+ * @param shared_fctx
+ *  The FAPI context to run the tool against, never finalized by the
+ *  dispatched tool.
+ * @return
+ *  0 on success
+ *  1 on failure
+ */
+int tss2_tool_dispatch(int argc, char *argv[], FAPI_CONTEXT *shared_fctx);
+
 #define TSS2_TOOL_REGISTER(tool_name,tool_onstart,tool_onrun,tool_onexit) \
 	static const tss2_tool tool = { \
 		.name		= tool_name, \
@@ -65,6 +83,237 @@ void tss2_tool_register(const tss2_tool * tool);
 	}
 
 
+/**
+ * The operation of a tool in bulk mode, run for every input against the same
+ * FAPI context.
+ * @param fctx
+ *  The fapi api context.
+ * @param input
+ *  The input to run the operation on.
+ * @param input_size
+ *  The size of input.
+ * @param output
+ *  The output of the operation, released with Fapi_Free by the caller.
+ * @param output_size
+ *  The size of output.
+ * @return
+ *  0 on success
+ *  1 on failure
+ */
+typedef int (*tss2_bulk_op)(FAPI_CONTEXT *fctx, uint8_t const *input,
+    size_t input_size, uint8_t **output, size_t *output_size);
+
+/* the largest input or output of a framed bulk stream */
+#define TSS2_BULK_FRAME_MAX (1024 * 1024)
+
+/**
+ * Runs op on every input of a bulk operation. If input names a directory,
+ * op runs on each file in it, in order of their names, and the output of
+ * each is written to the file of the same name in the output directory,
+ * created if it does not exist. Otherwise input and output name framed
+ * streams, - for stdin and stdout, in which each input and output is
+ * preceded by its size as a 32 bit big endian integer. Stops at the first
+ * input that fails.
+ * @param fctx
+ *  The fapi api context.
+ * @param input
+ *  The input directory or stream.
+ * @param output
+ *  The output directory or stream.
+ * @param overwrite
+ *  Whether existing output files may be overwritten.
+ * @param op
+ *  The operation to run.
+ * @return
+ *  0 on success
+ *  1 on failure
+ */
+int tss2_bulk_run(FAPI_CONTEXT *fctx, char const *input, char const *output,
+    bool overwrite, tss2_bulk_op op);
+
+/*
+ * The data of the FAPI paths of a bulk operation over many objects, like NV
+ * indices. Either a directory with a file per path, named after the path
+ * without its leading "/" and with the other "/" replaced by "_", or a framed
+ * stream with the data of the paths in the order they are processed.
+ */
+typedef struct tss2_bulk_files tss2_bulk_files;
+struct tss2_bulk_files {
+    char const *dir;
+    FILE *stream;
+    char const *stream_path;
+    bool overwrite;
+};
+
+/**
+ * Opens the data of a bulk operation over many paths, a directory if path
+ * names one and a framed stream otherwise, - for stdin or stdout.
+ * @param files
+ *  The files to initialize.
+ * @param path
+ *  The directory or stream.
+ * @param is_output
+ *  Whether the data is written rather than read.
+ * @param overwrite
+ *  Whether existing output files may be overwritten.
+ * @return
+ *  0 on success
+ *  1 on failure
+ */
+int tss2_bulk_files_open(tss2_bulk_files *files, char const *path,
+    bool is_output, bool overwrite);
+
+/**
+ * Reads the data of the next path.
+ * @param files
+ *  The files to read from.
+ * @param fapi_path
+ *  The path the data is for.
+ * @param data
+ *  The data, released with free by the caller.
+ * @param size
+ *  The size of data.
+ * @return
+ *  0 on success
+ *  1 on failure
+ */
+int tss2_bulk_files_read(tss2_bulk_files *files, char const *fapi_path,
+    uint8_t **data, size_t *size);
+
+/**
+ * Writes the data of the next path.
+ * @param files
+ *  The files to write to.
+ * @param fapi_path
+ *  The path the data is for.
+ * @param data
+ *  The data.
+ * @param size
+ *  The size of data.
+ * @return
+ *  0 on success
+ *  1 on failure
+ */
+int tss2_bulk_files_write(tss2_bulk_files *files, char const *fapi_path,
+    uint8_t const *data, size_t size);
+
+/**
+ * Closes the data of a bulk operation.
+ * @param files
+ *  The files to close.
+ * @return
+ *  0 on success
+ *  1 if a buffered output could not be written
+ */
+int tss2_bulk_files_close(tss2_bulk_files *files);
+
+/**
+ * Reads a list of FAPI paths, one per line, skipping blank lines and lines
+ * starting with #.
+ * @param list
+ *  The file of the list, - for stdin.
+ * @param paths
+ *  The paths, released with tss2_bulk_paths_free by the caller.
+ * @param count
+ *  The number of paths.
+ * @return
+ *  0 on success
+ *  1 on failure
+ */
+int tss2_bulk_paths_read(char const *list, char ***paths, size_t *count);
+
+void tss2_bulk_paths_free(char **paths, size_t count);
+
+/* The data to set on the object of a path in a bulk metadata update */
+typedef struct tss2_bulk_update tss2_bulk_update;
+struct tss2_bulk_update {
+    char *path;
+    uint8_t *data;
+    size_t size;
+    /* the position of the path in the list */
+    size_t order;
+};
+
+/**
+ * Reads the updates of a bulk operation setting the metadata of many objects,
+ * ie the appdata or description. The paths are read from the list as with
+ * tss2_bulk_paths_read and the data of each path as with
+ * tss2_bulk_files_read. The updates are sorted by path, so the objects of a
+ * keystore directory are written together, and of a path listed more than
+ * once only the last update is kept.
+ * @param list
+ *  The file of the list, - for stdin.
+ * @param data
+ *  The directory or framed stream of the data.
+ * @param updates
+ *  The updates, released with tss2_bulk_updates_free by the caller.
+ * @param count
+ *  The number of updates.
+ * @return
+ *  0 on success
+ *  1 on failure
+ */
+int tss2_bulk_updates_read(char const *list, char const *data,
+    tss2_bulk_update **updates, size_t *count);
+
+void tss2_bulk_updates_free(tss2_bulk_update *updates, size_t count);
+
+/**
+ * Lists the keys below a FAPI path with one Fapi_List, for the exports of
+ * many keys. The primaries, ie the SRK and the EK, are derived from the
+ * seeds of the TPM rather than kept, and the NV indices, policies and
+ * external keys are no keys of a hierarchy, so all of them are skipped.
+ * @param fctx
+ *  The fapi api context.
+ * @param search_path
+ *  The path to list the keys below.
+ * @param paths
+ *  The paths of the keys, released with tss2_bulk_paths_free by the caller.
+ * @param count
+ *  The number of keys.
+ * @return
+ *  0 on success
+ *  1 on failure
+ */
+int tss2_bulk_keys_list(FAPI_CONTEXT *fctx, char const *search_path,
+    char ***paths, size_t *count);
+
+/**
+ * Writes the exports of many keys to a single context archive, cf.
+ * lib/tpm2_ctx_archive.h, each under a name made of the path of its key.
+ * @param path
+ *  The file of the archive.
+ * @param overwrite
+ *  Whether an existing file may be replaced.
+ * @param members
+ *  The exports.
+ * @param count
+ *  The number of exports.
+ * @return
+ *  0 on success
+ *  1 on failure
+ */
+int tss2_bulk_archive_write(char const *path, bool overwrite,
+    tpm2_ctx_archive_member const *members, size_t count);
+
+/**
+ * Tells whether an _Finish call has to be repeated.
+ * @param rc
+ *  The return code of the _Finish call.
+ * @return
+ *  true if the operation did not complete yet.
+ */
+bool tss2_is_try_again(TSS2_RC rc);
+
+/**
+ * Waits for the TPM or keystore I/O of the pending asynchronous operation
+ * to progress, to be called before repeating an _Finish. Returns right away
+ * when the operation has no I/O to wait for.
+ * @param fctx
+ *  The fapi api context.
+ */
+void tss2_poll(FAPI_CONTEXT *fctx);
+
 TSS2_RC policy_auth_callback(FAPI_CONTEXT*, char const*, char**, void*);
 int open_write_and_close(const char *path, bool overwrite, const void* output, size_t output_len);
 int open_read_and_close(const char *path, void **input, size_t *size);
@@ -4,6 +4,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include "tools/fapi/tss2_template.h"
+#include "lib/tpm2_work_pool.h"
 
 /* Context struct used to store passed command line parameters */
 static struct cxt {
@@ -12,8 +13,13 @@ static struct cxt {
     char const *quoteInfo;
     char const *signature;
     char const *pcrLog;
+    char const *manifest;
+    uint32_t    jobs;
 } ctx;
 
+/* <publicKeyPath> <quoteInfo> <signature> [<pcrLog> [<qualifyingData>]] */
+#define MANIFEST_FIELDS 5
+
 /* Parse command line parameters */
 static bool on_option(char key, char *value) {
     switch (key) {
@@ -32,6 +38,16 @@ static bool on_option(char key, char *value) {
     case 'i':
         ctx.signature = value;
         break;
+    case 'M':
+        ctx.manifest = value;
+        break;
+    case 'j':
+        if (!tpm2_util_string_to_uint32 (value, &ctx.jobs) || !ctx.jobs) {
+            fprintf (stderr, "%s cannot be converted to a positive "\
+                "integer\n", value);
+            return false;
+        }
+        break;
     }
     return true;
 }
@@ -43,14 +59,203 @@ static bool tss2_tool_onstart(tpm2_options **opts) {
         {"qualifyingData",  required_argument, NULL, 'Q'},
         {"quoteInfo",       required_argument, NULL, 'q'},
         {"signature",       required_argument, NULL, 'i'},
-        {"pcrLog",          required_argument, NULL, 'l'}
+        {"pcrLog",          required_argument, NULL, 'l'},
+        {"manifest",        required_argument, NULL, 'M'},
+        {"jobs",            required_argument, NULL, 'j'}
     };
-    return (*opts = tpm2_options_new ("k:Q:q:i:l:", ARRAY_LEN(topts), topts,
+    return (*opts = tpm2_options_new ("k:Q:q:i:l:M:j:", ARRAY_LEN(topts), topts,
                                       on_option, NULL, 0)) != NULL;
 }
 
+/*
+ * A quote of a manifest. The fields point into the manifest line, the
+ * optional ones are NULL if not given or given as -.
+ */
+typedef struct {
+    char       *line;
+    size_t      lineNumber;
+    char const *publicKeyPath;
+    char const *quoteInfo;
+    char const *signature;
+    char const *pcrLog;
+    char const *qualifyingData;
+} manifest_quote;
+
+typedef struct {
+    manifest_quote *quotes;
+    size_t          count;
+} manifest;
+
+/* Read the files of a quote and verify it */
+static bool manifest_quote_verify (FAPI_CONTEXT *fctx,
+    manifest_quote const *quote) {
+
+    bool result = false;
+    uint8_t *qualifyingData = NULL, *signature = NULL;
+    size_t qualifyingDataSize = 0, signatureSize = 0;
+    char *quoteInfo = NULL, *pcrLog = NULL;
+
+    if ((quote->qualifyingData && open_read_and_close (quote->qualifyingData,
+            (void**)&qualifyingData, &qualifyingDataSize)) ||
+        open_read_and_close (quote->signature, (void**)&signature,
+            &signatureSize) ||
+        open_read_and_close (quote->quoteInfo, (void**)&quoteInfo, NULL) ||
+        (quote->pcrLog && open_read_and_close (quote->pcrLog,
+            (void**)&pcrLog, NULL))) {
+        goto out;
+    }
+
+    TSS2_RC r = Fapi_VerifyQuote (fctx, quote->publicKeyPath, qualifyingData,
+        qualifyingDataSize, quoteInfo, signature, signatureSize, pcrLog);
+    if (r != TSS2_RC_SUCCESS) {
+        fprintf (stderr, "%s:%zu: ", ctx.manifest, quote->lineNumber);
+        LOG_PERR ("Fapi_VerifyQuote", r);
+        goto out;
+    }
+    result = true;
+
+out:
+    free (qualifyingData);
+    free (signature);
+    free (quoteInfo);
+    free (pcrLog);
+    return result;
+}
+
+/* Takes the line */
+static bool manifest_add (void *e, char *line, char **fields, size_t count,
+    size_t lineNumber, void *userdata) {
+
+    UNUSED (userdata);
+
+    manifest_quote *quote = (manifest_quote *) e;
+    quote->line = line;
+    quote->lineNumber = lineNumber;
+    quote->publicKeyPath = fields[0];
+    quote->quoteInfo = fields[1];
+    quote->signature = fields[2];
+    if (count > 3 && strcmp (fields[3], "-")) {
+        quote->pcrLog = fields[3];
+    }
+    if (count > 4 && strcmp (fields[4], "-")) {
+        quote->qualifyingData = fields[4];
+    }
+
+    return true;
+}
+
+static bool manifest_load (manifest *m) {
+
+    return tpm2_util_manifest_read (ctx.manifest, 3, MANIFEST_FIELDS,
+        "<publicKeyPath> <quoteInfo> <signature> [<pcrLog> "\
+        "[<qualifyingData>]]", (void **) &m->quotes, &m->count,
+        sizeof(*m->quotes), manifest_add, NULL);
+}
+
+static void manifest_free (manifest *m) {
+
+    for (size_t i = 0; i < m->count; i++) {
+        free (m->quotes[i].line);
+    }
+    free (m->quotes);
+}
+
+typedef struct {
+    manifest       *m;
+    /* the FAPI context of every worker */
+    FAPI_CONTEXT  **contexts;
+    int             ret;
+} manifest_run_state;
+
+static bool manifest_work (tpm2_work_worker *worker, size_t index,
+    void *userdata) {
+
+    manifest_run_state *state = (manifest_run_state *) userdata;
+
+    return manifest_quote_verify (
+        state->contexts[tpm2_work_worker_index (worker)],
+        &state->m->quotes[index]);
+}
+
+static bool manifest_deliver (size_t index, bool result, void *userdata) {
+
+    manifest_run_state *state = (manifest_run_state *) userdata;
+    manifest_quote const *quote = &state->m->quotes[index];
+
+    printf ("- line: %zu\n", quote->lineNumber);
+    printf ("  quoteInfo: %s\n", quote->quoteInfo);
+    printf ("  verified: %s\n", result ? "true" : "false");
+    fflush (stdout);
+    if (!result) {
+        state->ret = 1;
+    }
+    return true;
+}
+
+/*
+ * The quotes are independent of each other, so they are verified on a work
+ * pool while the calling thread prints the results in manifest order. A FAPI
+ * context must not be used by several threads at once, so every worker gets
+ * one of its own, the first one the context of the tool. The pool only runs
+ * as many workers as got a context to initialize.
+ */
+static int manifest_run (FAPI_CONTEXT *fctx) {
+
+    manifest m = { 0 };
+    manifest_run_state state = { .m = &m, .ret = 1 };
+    uint32_t ready = 0;
+
+    if (!manifest_load (&m)) {
+        goto out;
+    }
+
+    uint32_t workers = tpm2_work_pool_workers (ctx.jobs, m.count);
+    state.contexts = calloc (workers ? workers : 1, sizeof(*state.contexts));
+    if (!state.contexts) {
+        fprintf (stderr, "calloc(3) failed: %m\n");
+        goto out;
+    }
+
+    state.contexts[ready++] = fctx;
+    for (; ready < workers; ready++) {
+        TSS2_RC r = Fapi_Initialize (&state.contexts[ready], NULL);
+        if (r != TSS2_RC_SUCCESS) {
+            LOG_PERR ("Fapi_Initialize", r);
+            break;
+        }
+    }
+
+    state.ret = 0;
+    if (!tpm2_work_pool_run (m.count, ready, manifest_work,
+        manifest_deliver, &state)) {
+        state.ret = 1;
+    }
+
+out:
+    for (uint32_t i = 1; i < ready; i++) {
+        Fapi_Finalize (&state.contexts[i]);
+    }
+    free (state.contexts);
+    manifest_free (&m);
+    return state.ret;
+}
+
 /* Execute specific tool */
 static int tss2_tool_onrun (FAPI_CONTEXT *fctx) {
+    if (ctx.manifest) {
+        if (ctx.publicKeyPath || ctx.qualifyingData || ctx.quoteInfo ||
+            ctx.signature || ctx.pcrLog) {
+            fprintf (stderr, "--manifest names the inputs of every quote, "\
+                "they cannot be given as options\n");
+            return -1;
+        }
+        return manifest_run (fctx);
+    }
+    if (ctx.jobs) {
+        fprintf (stderr, "--jobs requires --manifest\n");
+        return -1;
+    }
+
     /* Check availability of required parameters */
     if (!ctx.quoteInfo) {
         fprintf (stderr, "quote info parameter not provided, use "\
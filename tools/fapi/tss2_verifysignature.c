@@ -5,14 +5,20 @@
 #include <string.h>
 
 #include "tools/fapi/tss2_template.h"
+#include "lib/tpm2_work_pool.h"
 
 /* Context struct used to store passed commandline parameters */
 static struct cxt {
     char const *digest;
     char const *publicKeyPath;
     char const *signature;
+    char const *manifest;
+    uint32_t    jobs;
 } ctx;
 
+/* <publicKeyPath> <digest> <signature> */
+#define MANIFEST_FIELDS 3
+
 /* Parse command line parameters */
 static bool on_option(char key, char *value) {
     switch (key) {
@@ -25,6 +31,16 @@ static bool on_option(char key, char *value) {
     case 'i':
         ctx.signature = value;
         break;
+    case 'M':
+        ctx.manifest = value;
+        break;
+    case 'j':
+        if (!tpm2_util_string_to_uint32 (value, &ctx.jobs) || !ctx.jobs) {
+            fprintf (stderr, "%s cannot be converted to a positive "\
+                "integer\n", value);
+            return false;
+        }
+        break;
     }
     return true;
 }
@@ -34,14 +50,184 @@ static bool tss2_tool_onstart(tpm2_options **opts) {
     struct option topts[] = {
         {"keyPath",     required_argument, NULL, 'p'},
         {"digest",      required_argument, NULL, 'd'},
-        {"signature",   required_argument, NULL, 'i'}
+        {"signature",   required_argument, NULL, 'i'},
+        {"manifest",    required_argument, NULL, 'M'},
+        {"jobs",        required_argument, NULL, 'j'}
     };
-    return (*opts = tpm2_options_new ("d:p:i:", ARRAY_LEN(topts), topts,
+    return (*opts = tpm2_options_new ("d:p:i:M:j:", ARRAY_LEN(topts), topts,
                                       on_option, NULL, 0)) != NULL;
 }
 
+/* A signature of a manifest, the fields point into the manifest line */
+typedef struct {
+    char       *line;
+    size_t      lineNumber;
+    char const *publicKeyPath;
+    char const *digest;
+    char const *signature;
+} manifest_signature;
+
+typedef struct {
+    manifest_signature *signatures;
+    size_t              count;
+} manifest;
+
+/* Read the files of a signature and verify it */
+static bool manifest_signature_verify (FAPI_CONTEXT *fctx,
+    manifest_signature const *sig) {
+
+    bool result = false;
+    uint8_t *digest = NULL, *signature = NULL;
+    size_t digestSize = 0, signatureSize = 0;
+
+    if (open_read_and_close (sig->digest, (void**)&digest, &digestSize) ||
+        open_read_and_close (sig->signature, (void**)&signature,
+            &signatureSize)) {
+        goto out;
+    }
+
+    TSS2_RC r = Fapi_VerifySignature (fctx, sig->publicKeyPath, digest,
+        digestSize, signature, signatureSize);
+    if (r != TSS2_RC_SUCCESS) {
+        fprintf (stderr, "%s:%zu: ", ctx.manifest, sig->lineNumber);
+        LOG_PERR ("Fapi_VerifySignature", r);
+        goto out;
+    }
+    result = true;
+
+out:
+    free (digest);
+    free (signature);
+    return result;
+}
+
+/* Takes the line */
+static bool manifest_add (void *e, char *line, char **fields, size_t count,
+    size_t lineNumber, void *userdata) {
+
+    UNUSED (count);
+    UNUSED (userdata);
+
+    manifest_signature *sig = (manifest_signature *) e;
+    sig->line = line;
+    sig->lineNumber = lineNumber;
+    sig->publicKeyPath = fields[0];
+    sig->digest = fields[1];
+    sig->signature = fields[2];
+
+    return true;
+}
+
+static bool manifest_load (manifest *m) {
+
+    return tpm2_util_manifest_read (ctx.manifest, MANIFEST_FIELDS,
+        MANIFEST_FIELDS, "<publicKeyPath> <digest> <signature>",
+        (void **) &m->signatures, &m->count, sizeof(*m->signatures),
+        manifest_add, NULL);
+}
+
+static void manifest_free (manifest *m) {
+
+    for (size_t i = 0; i < m->count; i++) {
+        free (m->signatures[i].line);
+    }
+    free (m->signatures);
+}
+
+typedef struct {
+    manifest       *m;
+    /* the FAPI context of every worker */
+    FAPI_CONTEXT  **contexts;
+    int             ret;
+} manifest_run_state;
+
+static bool manifest_work (tpm2_work_worker *worker, size_t index,
+    void *userdata) {
+
+    manifest_run_state *state = (manifest_run_state *) userdata;
+
+    return manifest_signature_verify (
+        state->contexts[tpm2_work_worker_index (worker)],
+        &state->m->signatures[index]);
+}
+
+static bool manifest_deliver (size_t index, bool result, void *userdata) {
+
+    manifest_run_state *state = (manifest_run_state *) userdata;
+    manifest_signature const *sig = &state->m->signatures[index];
+
+    printf ("- line: %zu\n", sig->lineNumber);
+    printf ("  signature: %s\n", sig->signature);
+    printf ("  verified: %s\n", result ? "true" : "false");
+    fflush (stdout);
+    if (!result) {
+        state->ret = 1;
+    }
+    return true;
+}
+
+/*
+ * Verify the signatures of the manifest on a work pool while the calling
+ * thread prints the results in manifest order. Every worker gets a FAPI
+ * context of its own, see tss2_verifyquote. The verification runs on the
+ * host with the public keys of the keystore.
+ */
+static int manifest_run (FAPI_CONTEXT *fctx) {
+
+    manifest m = { 0 };
+    manifest_run_state state = { .m = &m, .ret = 1 };
+    uint32_t ready = 0;
+
+    if (!manifest_load (&m)) {
+        goto out;
+    }
+
+    uint32_t workers = tpm2_work_pool_workers (ctx.jobs, m.count);
+    state.contexts = calloc (workers ? workers : 1, sizeof(*state.contexts));
+    if (!state.contexts) {
+        fprintf (stderr, "calloc(3) failed: %m\n");
+        goto out;
+    }
+
+    state.contexts[ready++] = fctx;
+    for (; ready < workers; ready++) {
+        TSS2_RC r = Fapi_Initialize (&state.contexts[ready], NULL);
+        if (r != TSS2_RC_SUCCESS) {
+            LOG_PERR ("Fapi_Initialize", r);
+            break;
+        }
+    }
+
+    state.ret = 0;
+    if (!tpm2_work_pool_run (m.count, ready, manifest_work,
+        manifest_deliver, &state)) {
+        state.ret = 1;
+    }
+
+out:
+    for (uint32_t i = 1; i < ready; i++) {
+        Fapi_Finalize (&state.contexts[i]);
+    }
+    free (state.contexts);
+    manifest_free (&m);
+    return state.ret;
+}
+
 /* Execute specific tool */
 static int tss2_tool_onrun (FAPI_CONTEXT *fctx) {
+    if (ctx.manifest) {
+        if (ctx.publicKeyPath || ctx.digest || ctx.signature) {
+            fprintf (stderr, "--manifest names the inputs of every "\
+                "signature, they cannot be given as options\n");
+            return -1;
+        }
+        return manifest_run (fctx);
+    }
+    if (ctx.jobs) {
+        fprintf (stderr, "--jobs requires --manifest\n");
+        return -1;
+    }
+
     /* Check availability of required parameters */
     if (!ctx.publicKeyPath) {
         fprintf (stderr, "public key path parameter not provided, use " \
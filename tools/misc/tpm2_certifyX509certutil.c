@@ -1,17 +1,15 @@
 /* SPDX-License-Identifier: BSD-3-Clause */
 
-#include <fcntl.h>
+#include <errno.h>
 #include <stdbool.h>
+#include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
-#include <sys/types.h>
-#include <sys/stat.h>
-#include <unistd.h>
 
 #include <openssl/x509.h>
 #include <openssl/x509v3.h>
-#include <openssl/bio.h>
 
+#include "files.h"
 #include "log.h"
 #include "tpm2_tool.h"
 
@@ -20,8 +18,13 @@ struct tpm_gen_partial_cert {
     const char *valid_str;
     const char *subject;
     const char *issuer;
+    /* a manifest of certificates, the options are the defaults of its lines */
+    const char *manifest_path;
 };
 
+/* output file, days, subject and issuer */
+#define MANIFEST_FIELDS 4
+
 #define CERT_FILE "partial_cert.der"
 #define VALID_DAYS "3560"
 #define SUBJ "C=US;O=CA org;OU=CA unit;CN=example"
@@ -49,6 +52,9 @@ static bool on_option(char key, char *value) {
     case 'i':
         ctx.issuer = value;
         break;
+    case 0:
+        ctx.manifest_path = value;
+        break;
     }
 
     return true;
@@ -60,7 +66,8 @@ static bool tpm2_tool_onstart(tpm2_options **opts) {
       { "outcert", optional_argument, NULL, 'o' },
       { "days",    optional_argument, NULL, 'd' },
       { "subject", optional_argument, NULL, 's' },
-      { "issuer", optional_argument, NULL, 'i' }
+      { "issuer", optional_argument, NULL, 'i' },
+      { "manifest", required_argument, NULL,  0  },
     };
 
     *opts = tpm2_options_new("o:d:s:i:", ARRAY_LEN(topts), topts, on_option,
@@ -95,78 +102,28 @@ static struct name_fields names[] = {
       .def = "CA Unit" },
 };
 
-static tool_rc fixup_cert(const char *cert) {
-
-    int fd = open(cert, O_RDONLY);
-    if (fd < 0) {
-        LOG_ERR("open failed");
-        return tool_rc_general_error;
-    }
-
-    struct stat fs;
-    int ret = fstat(fd, &fs);
-    if (ret < 0) {
-        close(fd);
-        return tool_rc_general_error;
-    }
-
-    ssize_t size = fs.st_size;
-    if (size < 100 || size > 255) {
-        LOG_ERR("Wrong cert size %zd", size);
-        close(fd);
-        return tool_rc_general_error; /* there is something wrong with this cert */
-    }
+/*
+ * The partial certificate is the TBS of the certificate, without the
+ * signature. The DER of the certificate is cut down to it in place.
+ */
+static bool fixup_cert(UINT8 *buf, size_t *size) {
 
-    char* buf = calloc(1, size);
-    if (!buf) {
-        LOG_ERR("Alloc failed");
-        close(fd);
-        return tool_rc_general_error;
-    }
-
-    tool_rc rc = tool_rc_success;
-    ret = read(fd, buf, size);
-    close(fd);
-    if (ret != size) {
-        LOG_ERR("read failed");
-        rc = tool_rc_general_error;
-        goto out;
-    }
-
-    fd = open(cert, O_WRONLY | O_TRUNC);
-    if (fd < 0) {
-        LOG_ERR("second open failed");
-        rc = tool_rc_general_error;
-        goto out;
+    if (*size < 100 || *size > 255) {
+        LOG_ERR("Wrong cert size %zu", *size);
+        return false; /* there is something wrong with this cert */
     }
 
     /* We need to skip one wrapping sequence (8 bytes) and one
      * sequence with one empty byte field at the end (5 bytes).
      * Fix the size here */
-    buf[2] = size - 16;
-
-    /* Write the external sequence with the fixed size */
-    ret = write(fd, buf, 3);
-    if (ret != 3) {
-        LOG_ERR("write failed");
-        rc = tool_rc_general_error;
-        close(fd);
-        goto out;
-    }
+    buf[2] = *size - 16;
 
-    /* skip the wrapping sequence the write the rest
-     * without the 5 bytes at the end */
-    ret = write(fd, buf + 11, size - 16);
-    close(fd);
-    if (ret != size - 16) {
-        LOG_ERR("second write failed");
-        rc = tool_rc_general_error;
-    }
-
-out:
-    free(buf);
+    /* keep the external sequence with the fixed size, then the rest
+     * without the wrapping sequence and the 5 bytes at the end */
+    memmove(buf + 3, buf + 11, *size - 16);
+    *size -= 13;
 
-    return rc;
+    return true;
 }
 
 static int populate_fields(X509_NAME *name, const char *opt) {
@@ -219,120 +176,255 @@ static int populate_fields(X509_NAME *name, const char *opt) {
     return fields_added;
 }
 
-static tool_rc generate_partial_X509() {
+/*
+ * The OpenSSL objects of a partial certificate, created once and updated for
+ * every certificate generated, so a manifest of thousands of them does not
+ * rebuild the certificate, its extension and its ASN.1 names and times each
+ * time.
+ */
+typedef struct partial_cert_gen partial_cert_gen;
+struct partial_cert_gen {
+    X509 *cert;
+    X509_NAME *issuer;
+    X509_NAME *subject;
+    ASN1_TIME *not_before;
+    ASN1_TIME *not_after;
+    UINT8 der[256];
+};
+
+static void gen_free(partial_cert_gen *gen) {
+
+    X509_free(gen->cert);
+    X509_NAME_free(gen->issuer);
+    X509_NAME_free(gen->subject);
+    ASN1_TIME_free(gen->not_before);
+    ASN1_TIME_free(gen->not_after);
+}
+
+static bool gen_init(partial_cert_gen *gen) {
 
-    BIO *cert_out = BIO_new_file(ctx.out_path, "wb");
-    if (!cert_out) {
-        LOG_ERR("Can not create file %s", ctx.out_path);
-        return -1;
+    gen->cert = X509_new();
+    gen->issuer = X509_NAME_new();
+    gen->subject = X509_NAME_new();
+    gen->not_before = ASN1_TIME_new();
+    gen->not_after = ASN1_TIME_new();
+    if (!gen->cert || !gen->issuer || !gen->subject || !gen->not_before
+            || !gen->not_after) {
+        LOG_ERR("Alloc failed");
+        return false;
     }
 
-    X509_EXTENSION *extv3 = NULL;
-    X509 *cert = X509_new();
-    if (!cert) {
-        LOG_ERR("X509_new");
-        goto out_err;
+    X509_EXTENSION *extv3 = X509V3_EXT_conf_nid(NULL, NULL, NID_key_usage,
+    "critical,digitalSignature,keyCertSign,cRLSign");
+    if (!extv3) {
+        LOG_ERR("X509V3_EXT_conf_nid");
+        return false;
     }
 
-    X509_NAME *issuer = X509_get_issuer_name(cert);
-    if (!issuer) {
-        LOG_ERR("X509_get_issuer_name");
-        goto out_err;
+    int ret = X509_add_ext(gen->cert, extv3, -1); // add required v3 extention: key usage
+    X509_EXTENSION_free(extv3);
+    if (ret != 1) {
+        LOG_ERR("X509_add_ext");
+        return false;
     }
 
-    int fields_added = populate_fields(issuer, ctx.issuer);
+    return true;
+}
+
+/* drops the fields of the previous certificate */
+static void name_clear(X509_NAME *name) {
+
+    while (X509_NAME_entry_count(name) > 0) {
+        X509_NAME_ENTRY_free(X509_NAME_delete_entry(name, 0));
+    }
+}
+
+static tool_rc generate_partial_X509(partial_cert_gen *gen,
+        const struct tpm_gen_partial_cert *entry) {
+
+    name_clear(gen->issuer);
+    int fields_added = populate_fields(gen->issuer, entry->issuer);
     if (fields_added <= 0) {
         LOG_ERR("Could not parse any issuer fields");
-        goto out_err;
+        return tool_rc_general_error;
     } else {
         LOG_INFO("Added %d issuer fields", fields_added);
     }
 
-    int ret = X509_set_issuer_name(cert, issuer); // add issuer
+    /* the setters copy the names and times into the certificate */
+    int ret = X509_set_issuer_name(gen->cert, gen->issuer); // add issuer
     if (ret != 1) {
         LOG_ERR("X509_set_issuer_name");
-        goto out_err;
+        return tool_rc_general_error;
     }
 
     unsigned int valid_days;
-    if (!tpm2_util_string_to_uint32(ctx.valid_str, &valid_days)) {
+    if (!tpm2_util_string_to_uint32(entry->valid_str, &valid_days)) {
         LOG_ERR("string_to_uint32");
-        goto out_err;
+        return tool_rc_general_error;
     }
 
-    X509_gmtime_adj(X509_get_notBefore(cert), 0); // add valid not before
-    X509_gmtime_adj(X509_get_notAfter(cert), valid_days * 86400); // add valid not after
-
-    X509_NAME *subject = X509_get_subject_name(cert);
-    if (!subject) {
-        LOG_ERR("X509_get_subject_name");
-        goto out_err;
+    if (!X509_gmtime_adj(gen->not_before, 0) // add valid not before
+            || !X509_gmtime_adj(gen->not_after, valid_days * 86400) // add valid not after
+            || X509_set_notBefore(gen->cert, gen->not_before) != 1
+            || X509_set_notAfter(gen->cert, gen->not_after) != 1) {
+        LOG_ERR("X509_set_notBefore");
+        return tool_rc_general_error;
     }
 
-    fields_added = populate_fields(subject, ctx.subject);
+    name_clear(gen->subject);
+    fields_added = populate_fields(gen->subject, entry->subject);
     if (fields_added <= 0) {
         LOG_ERR("Could not parse any subject fields");
-        goto out_err;
+        return tool_rc_general_error;
     } else {
         LOG_INFO("Added %d subject fields", fields_added);
     }
 
-    ret = X509_set_subject_name(cert, subject);  // add subject
+    ret = X509_set_subject_name(gen->cert, gen->subject);  // add subject
     if (ret != 1) {
-        LOG_ERR("X509_NAME_add_entry_by_txt");
-        goto out_err;
+        LOG_ERR("X509_set_subject_name");
+        return tool_rc_general_error;
     }
 
-    extv3 = X509V3_EXT_conf_nid(NULL, NULL, NID_key_usage,
-    "critical,digitalSignature,keyCertSign,cRLSign");
-    if (!extv3) {
-        LOG_ERR("X509V3_EXT_conf_nid");
-        goto out_err;
+    int len = i2d_X509(gen->cert, NULL); // encode cert in DER format
+    if (len <= 0 || (size_t) len > sizeof(gen->der)) {
+        LOG_ERR("Wrong cert size %d", len);
+        return tool_rc_general_error;
     }
 
-    ret = X509_add_ext(cert, extv3, -1); // add required v3 extention: key usage
-    if (ret != 1) {
-        LOG_ERR("X509_add_ext");
-        goto out_err;
+    UINT8 *der = gen->der;
+    if (i2d_X509(gen->cert, &der) != len) {
+        LOG_ERR("i2d_X509");
+        return tool_rc_general_error;
     }
 
-    ret = i2d_X509_bio(cert_out, cert); // print cert in DER format
-    if (ret != 1) {
-        LOG_ERR("i2d_X509_bio");
-        goto out_err;
+    size_t size = len;
+    if (!fixup_cert(gen->der, &size)) {
+        LOG_ERR("fixup_cert");
+        return tool_rc_general_error;
     }
 
-    X509_EXTENSION_free(extv3);
-    X509_free(cert);
-    BIO_free_all(cert_out);
-
-    ret = fixup_cert(ctx.out_path);
-    if (ret) {
-        LOG_ERR("fixup_cert");
+    if (!files_save_bytes_to_file(entry->out_path, gen->der, size)) {
+        LOG_ERR("Can not create file %s", entry->out_path);
         return tool_rc_general_error;
     }
 
     return tool_rc_success;
+}
 
-out_err:
-    BIO_free_all(cert_out);
-    if (cert) {
-        X509_free(cert);
+static char *field_trim(char *field) {
+
+    while (*field == ' ' || *field == '\t') {
+        field++;
     }
-    if (extv3) {
-        X509_EXTENSION_free(extv3);
+
+    char *end = field + strlen(field);
+    while (end > field && strchr(" \t\r\n", end[-1])) {
+        *--end = '\0';
     }
 
-    return tool_rc_general_error;
+    return field;
 }
 
+/*
+ * A line of the manifest is the output file, the days, the subject and the
+ * issuer of a certificate, separated by commas. An empty or - field takes the
+ * value of its option.
+ */
+static tool_rc manifest_entry(partial_cert_gen *gen, char *line,
+        size_t line_number) {
+
+    char *comment = strchr(line, '#');
+    if (comment) {
+        *comment = '\0';
+    }
+
+    char *fields[MANIFEST_FIELDS + 1];
+    size_t count = 0;
+    char *next = line;
+    while (next && count < ARRAY_LEN(fields)) {
+        char *field = next;
+        next = strchr(next, ',');
+        if (next) {
+            *next++ = '\0';
+        }
+        fields[count++] = field_trim(field);
+    }
+
+    if (count == 1 && !fields[0][0]) {
+        return tool_rc_success;
+    }
+
+    if (count > MANIFEST_FIELDS || !fields[0][0] || !strcmp(fields[0], "-")) {
+        LOG_ERR("%s:%zu: Expected: <outcert>[,<days>[,<subject>[,<issuer>]]]",
+                ctx.manifest_path, line_number);
+        return tool_rc_general_error;
+    }
+
+    struct tpm_gen_partial_cert entry = ctx;
+    const char **values[MANIFEST_FIELDS] = {
+        &entry.out_path, &entry.valid_str, &entry.subject, &entry.issuer
+    };
+
+    size_t i;
+    for (i = 0; i < count; i++) {
+        if (fields[i][0] && strcmp(fields[i], "-")) {
+            *values[i] = fields[i];
+        }
+    }
+
+    tool_rc rc = generate_partial_X509(gen, &entry);
+    if (rc != tool_rc_success) {
+        LOG_ERR("%s:%zu: Could not generate \"%s\"", ctx.manifest_path,
+                line_number, entry.out_path);
+    }
+
+    return rc;
+}
+
+static tool_rc manifest_run(partial_cert_gen *gen) {
+
+    FILE *f = files_fopen(ctx.manifest_path, "r");
+    if (!f) {
+        LOG_ERR("Could not open manifest \"%s\", error: %s",
+                ctx.manifest_path, strerror(errno));
+        return tool_rc_general_error;
+    }
+
+    tool_rc rc = tool_rc_success;
+    size_t line_number = 0;
+    char *line = NULL;
+    size_t line_size = 0;
+    while (rc == tool_rc_success && getline(&line, &line_size, f) != -1) {
+        line_number++;
+        rc = manifest_entry(gen, line, line_number);
+    }
+
+    free(line);
+    fclose(f);
+
+    return rc;
+}
 
 static tool_rc tpm2_tool_onrun(ESYS_CONTEXT *ectx, tpm2_option_flags flags) {
 
     UNUSED(flags);
     UNUSED(ectx);
 
-    return generate_partial_X509();
+    partial_cert_gen gen = { 0 };
+    tool_rc rc = tool_rc_general_error;
+    if (!gen_init(&gen)) {
+        goto out;
+    }
+
+    rc = ctx.manifest_path ? manifest_run(&gen) :
+            generate_partial_X509(&gen, &ctx);
+
+out:
+    gen_free(&gen);
+
+    return rc;
 }
 
 TPM2_TOOL_REGISTER("certifyX509certutil", tpm2_tool_onstart, tpm2_tool_onrun, NULL, NULL)
@@ -1,5 +1,6 @@
 /* SPDX-License-Identifier: BSD-3-Clause */
 
+#include <errno.h>
 #include <inttypes.h>
 #include <stdbool.h>
 #include <stdio.h>
@@ -12,13 +13,30 @@
 #include "files.h"
 #include "log.h"
 #include "object.h"
+#include "tpm2_ak_cert.h"
 #include "tpm2_alg_util.h"
 #include "tpm2_convert.h"
 #include "tpm2_openssl.h"
 #include "tpm2_options.h"
+#include "tpm2_quote_bundle.h"
 #include "tpm2_systemdeps.h"
 #include "tpm2_tool.h"
 #include "tpm2_eventlog.h"
+#include "tpm2_util.h"
+#include "tpm2_work_pool.h"
+
+/* public key, message, signature, PCRs and qualification of a quote */
+#define MANIFEST_FIELDS 5
+
+/* name, PCR selection and PCR digest of a golden state */
+#define GOLDEN_FIELDS 3
+
+typedef struct golden_state golden_state;
+struct golden_state {
+    char *name;
+    TPML_PCR_SELECTION selection;
+    TPM2B_DIGEST digest;
+};
 
 typedef struct tpm2_verifysig_ctx tpm2_verifysig_ctx;
 struct tpm2_verifysig_ctx {
@@ -46,22 +64,39 @@ struct tpm2_verifysig_ctx {
     char *eventlog_path;
     tpm2_loaded_object key_context_object;
     const char *pcr_selection_string;
+    /* a quote of a manifest, which prints its result and nothing else */
+    bool is_bulk;
+    const char *manifest_path;
+    UINT32 jobs;
+    /* the known good PCR states, shared by all quotes */
+    const char *golden_path;
+    golden_state *golden;
+    size_t golden_count;
+    const golden_state *golden_match;
+    /* the <public> of the manifest lines are AK certificates */
+    const char *ak_ca_path;
+    const char *ak_cache_path;
+    UINT32 ak_cache_ttl;
+    tpm2_ak_cert_verifier *ak_verifier;
+    /* the quote, signature, PCRs and event log of one mapped file */
+    const char *bundle_path;
+    tpm2_quote_bundle *bundle;
 };
 
 static tpm2_verifysig_ctx ctx = {
         .halg = TPM2_ALG_SHA256,
         .msg_hash = TPM2B_TYPE_INIT(TPM2B_DIGEST, buffer),
         .pcr_hash = TPM2B_TYPE_INIT(TPM2B_DIGEST, buffer),
+        .ak_cache_ttl = TPM2_AK_CERT_CACHE_TTL_DEFAULT,
 };
 
-static bool verify(void) {
+static bool verify(tpm2_verifysig_ctx *c, EVP_PKEY *cached_pkey) {
 
     bool result = false;
 
-    /* read the public key */
-    EVP_PKEY *pkey = NULL;
-    bool ret = tpm2_public_load_pkey(ctx.pubkey_file_path, &pkey);
-    if (!ret) {
+    /* read the public key, unless the caller already did */
+    EVP_PKEY *pkey = cached_pkey;
+    if (!pkey && !tpm2_public_load_pkey(c->pubkey_file_path, &pkey)) {
         return false;
     }
 
@@ -74,7 +109,7 @@ static bool verify(void) {
     /* get the digest alg */
     /* TODO SPlit loading on plain vs tss format to detect the hash alg */
     /* If its a plain sig we need -g */
-    const EVP_MD *md = tpm2_openssl_halg_from_tpmhalg(ctx.halg);
+    const EVP_MD *md = tpm2_openssl_halg_from_tpmhalg(c->halg);
     // TODO error handling
 
     int rc = EVP_PKEY_verify_init(pkey_ctx);
@@ -90,14 +125,16 @@ static bool verify(void) {
     }
 
     /* TODO dump actual signature */
-    tpm2_tool_output("sig: ");
-    tpm2_util_hexdump(ctx.signature.buffer, ctx.signature.size);
-    tpm2_tool_output("\n");
+    if (!c->is_bulk) {
+        tpm2_tool_output("sig: ");
+        tpm2_util_hexdump(c->signature.buffer, c->signature.size);
+        tpm2_tool_output("\n");
+    }
 
     // Verify the signature matches message digest
 
-    rc = EVP_PKEY_verify(pkey_ctx, ctx.signature.buffer, ctx.signature.size,
-            ctx.msg_hash.buffer, ctx.msg_hash.size);
+    rc = EVP_PKEY_verify(pkey_ctx, c->signature.buffer, c->signature.size,
+            c->msg_hash.buffer, c->msg_hash.size);
     if (rc != 1) {
         if (rc == 0) {
             LOG_ERR("Error validating signed message with public key provided");
@@ -108,32 +145,53 @@ static bool verify(void) {
     }
 
     // Ensure nonce is the same as given
-    if (ctx.attest.extraData.size != ctx.extra_data.size ||
-        memcmp(ctx.attest.extraData.buffer, ctx.extra_data.buffer,
-        ctx.extra_data.size) != 0) {
+    if (c->attest.extraData.size != c->extra_data.size ||
+        memcmp(c->attest.extraData.buffer, c->extra_data.buffer,
+        c->extra_data.size) != 0) {
         LOG_ERR("Error validating nonce from quote");
         goto err;
     }
 
     // Also ensure digest from quote matches PCR digest
-    if (ctx.flags.pcr) {
-        if (!tpm2_util_verify_digests(&ctx.attest.attested.quote.pcrDigest,
-                &ctx.pcr_hash)) {
+    if (c->golden_match) {
+        /* init() found the signed PCR digest among the golden states */
+    } else if (c->flags.pcr || c->flags.eventlog) {
+        if (!tpm2_util_verify_digests(&c->attest.attested.quote.pcrDigest,
+                &c->pcr_hash)) {
             LOG_ERR("Error validating PCR composite against signed message");
             goto err;
         }
+    } else if (c->golden_path) {
+        LOG_ERR("PCR composite of the quote matches no golden state");
+        goto err;
     }
 
     result = true;
 
 err:
 
-    EVP_PKEY_free(pkey);
+    if (pkey != cached_pkey) {
+        EVP_PKEY_free(pkey);
+    }
     EVP_PKEY_CTX_free(pkey_ctx);
 
     return result;
 }
 
+static TPM2B_ATTEST *message_from_data(const UINT8 *data, size_t size) {
+
+    TPM2B_ATTEST *msg = (TPM2B_ATTEST *) calloc(1, sizeof(TPM2B_ATTEST) + size);
+    if (!msg) {
+        LOG_ERR("OOM");
+        return NULL;
+    }
+
+    msg->size = size;
+    memcpy(msg->attestationData, data, size);
+
+    return msg;
+}
+
 static TPM2B_ATTEST *message_from_file(const char *msg_file_path) {
 
     unsigned long size;
@@ -163,10 +221,10 @@ static TPM2B_ATTEST *message_from_file(const char *msg_file_path) {
     return msg;
 }
 
-static bool parse_selection_data_from_selection_string(FILE *pcr_input,
-    TPML_PCR_SELECTION *pcr_select, tpm2_pcrs *pcrs) {
+static bool parse_selection_data_from_selection_string(tpm2_verifysig_ctx *c,
+    FILE *pcr_input, TPML_PCR_SELECTION *pcr_select, tpm2_pcrs *pcrs) {
 
-    bool result = pcr_parse_selections(ctx.pcr_selection_string, pcr_select);
+    bool result = pcr_parse_selections(c->pcr_selection_string, pcr_select);
     if (!result) {
         LOG_ERR("Could not parse PCR selections");
         return false;
@@ -186,20 +244,12 @@ static bool parse_selection_data_from_selection_string(FILE *pcr_input,
     unsigned j = 0;
     unsigned read_size = 0;
     size_t read_count = 0;
-    unsigned digest_list_count = 0;
-    memset(pcrs, 0, sizeof(tpm2_pcrs));
+    TPML_DIGEST *digests = NULL;
+    pcrs->count = 0;
     /*
      * Iterate through all the PCR banks selected.
      */
     for (i = 0; i < pcr_select->count; i++) {
-        /*
-         * Ensure all the digests across banks can fit in tpm2_pcrs.
-         */
-        if (digest_list_count >= TPM2_MAX_PCRS - 1) {
-            LOG_ERR("Maximum count for allowed digest lists reached.");
-            return false;
-        }
-
         /*
          * Digest size of PCR bank selected in this iteration.
          */
@@ -214,40 +264,32 @@ static bool parse_selection_data_from_selection_string(FILE *pcr_input,
              */
             if ((pcr_select->pcrSelections[i].pcrSelect[j / 8] & 1 << (j % 8))
             != 0) {
+                /*
+                 * Ensure we populate the digest in a new list if we
+                 * exhausted the digest count in the current TPML_DIGEST
+                 * instance.
+                 */
+                if (!digests || digests->count == ARRAY_LEN(digests->digests)) {
+                    digests = pcr_pcrs_append(pcrs);
+                    if (!digests) {
+                        return false;
+                    }
+                }
+
                 /*
                  * Read the digest at a selected PCR index.
                  */
-                pcrs->pcr_values[digest_list_count].digests[pcrs->pcr_values[
-                    digest_list_count].count].size = read_size;
-                read_count = fread(pcrs->pcr_values[digest_list_count].digests[
-                    pcrs->pcr_values[digest_list_count].count].buffer,
-                    read_size, 1, pcr_input);
+                TPM2B_DIGEST *digest = &digests->digests[digests->count];
+                digest->size = read_size;
+                read_count = fread(digest->buffer, read_size, 1, pcr_input);
                 if (read_count != 1) {
                     LOG_ERR("Failed to read PCR digests from file");
                     return false;
                 }
-                /*
-                 * Ensure we don't overrun the allowed digest count in a
-                 * TPML_DIGEST.
-                 */
-                if (pcrs->pcr_values[digest_list_count].count == 7) {
-                    digest_list_count++;
-                } else {
-                    /*
-                     * Ensure we populate the digest in a new list if we
-                     * exhausted the digest count in the current TPML_DIGEST
-                     * instance.
-                     */
-                    pcrs->pcr_values[digest_list_count].count++;
-                }
+                digests->count++;
             }
         }
     }
-    /*
-     * Update the count of total TPML_DIGEST consumed to accomodate all the
-     * selected PCR indices across all the banks.
-     */
-    pcrs->count = digest_list_count + 1;
 
     return true;
 }
@@ -262,32 +304,100 @@ static bool parse_selection_data_from_file(FILE *pcr_input,
     }
 
     // Import PCR digests to pcr outfile
-    if (fread(&pcrs->count, sizeof(UINT32), 1, pcr_input) != 1) {
+    UINT32 count = 0;
+    if (fread(&count, sizeof(UINT32), 1, pcr_input) != 1) {
         LOG_ERR("Failed to read PCR digests header from file");
         return false;
     }
 
-    if (le64toh(pcrs->count) > ARRAY_LEN(pcrs->pcr_values)) {
-        LOG_ERR("Malformed PCR file, pcr count cannot be greater than %zu, got: %" PRIu64 " ",
-                ARRAY_LEN(pcrs->pcr_values), le64toh((UINT64)pcrs->count));
+    /* every digest list holds at least one of the PCRs of all banks */
+    if (le32toh(count) > TPM2_NUM_PCR_BANKS * TPM2_MAX_PCRS) {
+        LOG_ERR("Malformed PCR file, pcr count cannot be greater than %u, got: %" PRIu32 " ",
+                TPM2_NUM_PCR_BANKS * TPM2_MAX_PCRS, le32toh(count));
         return false;
     }
 
+    pcrs->count = 0;
     size_t j;
-    for (j = 0; j < le64toh(pcrs->count); j++) {
-        if (fread(&pcrs->pcr_values[j], sizeof(TPML_DIGEST), 1, pcr_input)
-                != 1) {
+    for (j = 0; j < le32toh(count); j++) {
+        TPML_DIGEST *digests = pcr_pcrs_append(pcrs);
+        if (!digests) {
+            return false;
+        }
+
+        if (fread(digests, sizeof(TPML_DIGEST), 1, pcr_input) != 1) {
             LOG_ERR("Failed to read PCR digest from file");
             return false;
         }
     }
 
+    /* the count stays in file byte order like the digest lists */
+    pcrs->count = htole64(pcrs->count);
+
+    return true;
+}
+
+/*
+ * Reads a PCR bundle, and converts it to the byte order of the serialized
+ * format the rest of the verification expects.
+ */
+static bool parse_bundle_from_file(FILE *pcr_input,
+    TPML_PCR_SELECTION *pcr_select, tpm2_pcrs *pcrs) {
+
+    bool result = pcr_bundle_read(pcr_input, pcr_select, pcrs);
+    if (!result) {
+        return false;
+    }
+
+    UINT32 i;
+    for (i = 0; i < pcr_select->count; i++) {
+        TPMS_PCR_SELECTION *p = &pcr_select->pcrSelections[i];
+        p->hash = htole16(p->hash);
+    }
+    pcr_select->count = htole32(pcr_select->count);
+
+    size_t j;
+    for (j = 0; j < pcrs->count; j++) {
+        TPML_DIGEST *digests = &pcrs->pcr_values[j];
+        for (i = 0; i < digests->count; i++) {
+            digests->digests[i].size = htole16(digests->digests[i].size);
+        }
+        digests->count = htole32(digests->count);
+    }
+    pcrs->count = htole64(pcrs->count);
+
     return true;
 }
 
-static bool pcrs_from_file(const char *pcr_file_path,
+/* the PCR bundle of a quote bundle, read in place */
+static bool pcrs_from_bundle(const tpm2_quote_bundle *bundle,
+        TPML_PCR_SELECTION *pcr_select, tpm2_pcrs *pcrs) {
+
+    FILE *pcr_input = fmemopen((void *) bundle->pcrs, bundle->pcrs_size,
+            "rb");
+    if (!pcr_input) {
+        LOG_ERR("Could not read the PCRs of the bundle, error: \"%s\"",
+                strerror(errno));
+        return false;
+    }
+
+    bool result = parse_bundle_from_file(pcr_input, pcr_select, pcrs);
+    fclose(pcr_input);
+    if (!result) {
+        LOG_ERR("The PCRs of the bundle \"%s\" are malformed",
+                ctx.bundle_path);
+    }
+
+    return result;
+}
+
+static bool pcrs_from_file(tpm2_verifysig_ctx *c, const char *pcr_file_path,
         TPML_PCR_SELECTION *pcr_select, tpm2_pcrs *pcrs) {
 
+    if (c->bundle) {
+        return pcrs_from_bundle(c->bundle, pcr_select, pcrs);
+    }
+
     bool result = false;
     unsigned long size;
 
@@ -300,20 +410,22 @@ static bool pcrs_from_file(const char *pcr_file_path,
         return false;
     }
 
-    FILE *pcr_input = fopen(pcr_file_path, "rb");
+    FILE *pcr_input = files_fopen(pcr_file_path, "rb");
     if (!pcr_input) {
         LOG_ERR("Could not open PCRs input file \"%s\" error: \"%s\"",
                 pcr_file_path, strerror(errno));
         goto out;
     }
 
-    if (!ctx.pcr_selection_string) {
-        result = parse_selection_data_from_file(pcr_input, pcr_select, pcrs);
+    if (!c->pcr_selection_string) {
+        result = pcr_bundle_is_bundle(pcr_input) ?
+                parse_bundle_from_file(pcr_input, pcr_select, pcrs) :
+                parse_selection_data_from_file(pcr_input, pcr_select, pcrs);
         if (!result) {
             goto out;
         }
     } else {
-        result = parse_selection_data_from_selection_string(pcr_input,
+        result = parse_selection_data_from_selection_string(c, pcr_input,
             pcr_select, pcrs);
         if (!result) {
             goto out;
@@ -360,26 +472,203 @@ static bool eventlog_from_file(tpm2_eventlog_context *evctx, const char *file_pa
     return rc;
 }
 
-static tool_rc init(void) {
+/* the event log of a bundle is parsed in the mapping, without a copy */
+static bool eventlog_load(tpm2_verifysig_ctx *c,
+        tpm2_eventlog_context *evctx) {
 
-    /* check flags for mismatches */
-    if (!(ctx.pubkey_file_path && ctx.flags.sig && ctx.flags.msg)) {
-        LOG_ERR(
-                "--pubkey (-u), --msg (-m) and --sig (-s) are required");
-        return tool_rc_option_error;
+    if (c->bundle) {
+        return parse_eventlog(evctx, c->bundle->eventlog,
+                c->bundle->eventlog_size);
     }
-    if (ctx.flags.eventlog && !ctx.flags.pcr) {
-        LOG_ERR("PCR file is required to validate eventlog");
-        return tool_rc_option_error;
+
+    return eventlog_from_file(evctx, c->eventlog_path);
+}
+
+/* the replayed value of a PCR of a bank, NULL for a bank of another size */
+static const uint8_t *eventlog_pcr(const tpm2_eventlog_context *evctx,
+        TPMI_ALG_HASH halg, UINT16 size, unsigned pcr_id) {
+
+    if (halg == TPM2_ALG_SHA1 && size == TPM2_SHA1_DIGEST_SIZE) {
+        return evctx->sha1_pcrs[pcr_id];
+    } else if (halg == TPM2_ALG_SHA256 && size == TPM2_SHA256_DIGEST_SIZE) {
+        return evctx->sha256_pcrs[pcr_id];
+    } else if (halg == TPM2_ALG_SHA384 && size == TPM2_SHA384_DIGEST_SIZE) {
+        return evctx->sha384_pcrs[pcr_id];
+    } else if (halg == TPM2_ALG_SHA512 && size == TPM2_SHA512_DIGEST_SIZE) {
+        return evctx->sha512_pcrs[pcr_id];
+    } else if (halg == TPM2_ALG_SM3_256 && size == TPM2_SM3_256_DIGEST_SIZE) {
+        return evctx->sm3_256_pcrs[pcr_id];
     }
 
+    return NULL;
+}
+
+/*
+ * The PCR values of the selection of the quote, straight from the replay of
+ * the event log, so the PCR digest is checked without a PCR file.
+ */
+static bool pcrs_from_eventlog(tpm2_verifysig_ctx *c,
+        TPML_PCR_SELECTION *pcr_select, tpm2_pcrs *pcrs) {
+
+    tpm2_eventlog_context *evctx = calloc(1, sizeof(*evctx));
+    if (!evctx) {
+        LOG_ERR("oom");
+        return false;
+    }
+
+    bool result = eventlog_load(c, evctx);
+    if (!result) {
+        LOG_ERR("Failed to process eventlog");
+        goto out;
+    }
+
+    *pcr_select = c->attest.attested.quote.pcrSelect;
+    if (pcr_select->count > TPM2_NUM_PCR_BANKS) {
+        LOG_ERR("The quote selects %u banks, more than the %u supported",
+                pcr_select->count, TPM2_NUM_PCR_BANKS);
+        result = false;
+        goto out;
+    }
+
+    TPML_DIGEST *digests = NULL;
+    UINT32 i;
+    for (i = 0; i < pcr_select->count; i++) {
+        const TPMS_PCR_SELECTION *sel = &pcr_select->pcrSelections[i];
+        UINT16 size = tpm2_alg_util_get_hash_size(sel->hash);
+
+        pcr_bitset bits = pcr_bitset_from_select(sel);
+        unsigned pcr_id;
+        while (pcr_bitset_next(&bits, &pcr_id)) {
+            const uint8_t *value = eventlog_pcr(evctx, sel->hash, size,
+                    pcr_id);
+            if (!value) {
+                LOG_ERR("The eventlog can not replay PCR bank 0x%x",
+                        sel->hash);
+                result = false;
+                goto out;
+            }
+
+            if (!digests || digests->count == ARRAY_LEN(digests->digests)) {
+                digests = pcr_pcrs_append(pcrs);
+                if (!digests) {
+                    result = false;
+                    goto out;
+                }
+            }
+
+            TPM2B_DIGEST *digest = &digests->digests[digests->count++];
+            digest->size = size;
+            memcpy(digest->buffer, value, size);
+        }
+    }
+
+out:
+    free(evctx);
+
+    return result;
+}
+
+static bool golden_selection_equal(const TPML_PCR_SELECTION *a,
+        const TPML_PCR_SELECTION *b) {
+
+    if (a->count != b->count) {
+        return false;
+    }
+
+    /* the selections may differ in size and still select the same PCRs */
+    UINT32 i;
+    for (i = 0; i < a->count; i++) {
+        const TPMS_PCR_SELECTION *x = &a->pcrSelections[i];
+        const TPMS_PCR_SELECTION *y = &b->pcrSelections[i];
+        if (x->hash != y->hash) {
+            return false;
+        }
+
+        UINT8 j;
+        for (j = 0; j < sizeof(x->pcrSelect); j++) {
+            BYTE xs = j < x->sizeofSelect ? x->pcrSelect[j] : 0;
+            BYTE ys = j < y->sizeofSelect ? y->pcrSelect[j] : 0;
+            if (xs != ys) {
+                return false;
+            }
+        }
+    }
+
+    return true;
+}
+
+static const golden_state *golden_find(tpm2_verifysig_ctx *c) {
+
+    const TPMS_QUOTE_INFO *quote = &c->attest.attested.quote;
+
+    size_t i;
+    for (i = 0; i < c->golden_count; i++) {
+        const golden_state *state = &c->golden[i];
+        if (state->digest.size == quote->pcrDigest.size
+                && !memcmp(state->digest.buffer, quote->pcrDigest.buffer,
+                        quote->pcrDigest.size)
+                && golden_selection_equal(&state->selection,
+                        &quote->pcrSelect)) {
+            return state;
+        }
+    }
+
+    return NULL;
+}
+
+static bool golden_add(void *e, char *line, char **fields, size_t count,
+        size_t line_number, void *userdata) {
+
+    UNUSED(count);
+    UNUSED(userdata);
+
+    golden_state *state = (golden_state *) e;
+    bool result = pcr_parse_selections(fields[1], &state->selection);
+    if (!result) {
+        LOG_ERR("%s:%zu: Invalid PCR selection \"%s\"", ctx.golden_path,
+                line_number, fields[1]);
+        goto out;
+    }
+
+    state->digest.size = sizeof(state->digest.buffer);
+    result = !tpm2_util_hex_to_byte_structure(fields[2], &state->digest.size,
+            state->digest.buffer);
+    if (!result) {
+        LOG_ERR("%s:%zu: Invalid PCR digest \"%s\"", ctx.golden_path,
+                line_number, fields[2]);
+        goto out;
+    }
+
+    state->name = strdup(fields[0]);
+    result = state->name != NULL;
+    if (!result) {
+        LOG_ERR("oom");
+    }
+
+out:
+    free(line);
+
+    return result;
+}
+
+static bool golden_load(void) {
+
+    return tpm2_util_manifest_read(ctx.golden_path, GOLDEN_FIELDS,
+            GOLDEN_FIELDS, "<name> <pcr-list> <digest>",
+            (void **) &ctx.golden, &ctx.golden_count, sizeof(*ctx.golden),
+            golden_add, NULL);
+}
+
+static tool_rc init(tpm2_verifysig_ctx *c) {
+
     TPM2B_ATTEST *msg = NULL;
     TPML_PCR_SELECTION pcr_select;
     tpm2_pcrs *pcrs;
     tpm2_pcrs temp_pcrs = {};
     tool_rc return_value = tool_rc_general_error;
 
-    msg = message_from_file(ctx.msg_file_path);
+    msg = c->bundle ? message_from_data(c->bundle->message,
+            c->bundle->message_size) : message_from_file(c->msg_file_path);
     if (!msg) {
         /* message_from_file() logs specific error no need to here */
         return tool_rc_general_error;
@@ -395,27 +684,30 @@ static tool_rc init(void) {
      * specifies the hash alg, or we're guessing, we should use the right one.
      */
     TPMI_ALG_HASH expected_halg = TPM2_ALG_ERROR;
-    bool res = tpm2_convert_sig_load_plain(ctx.sig_file_path,
-            &ctx.signature, &expected_halg);
+    bool res = c->bundle ?
+            tpm2_convert_sig_to_plain(&c->bundle->signature, &c->signature,
+                    &expected_halg) :
+            tpm2_convert_sig_load_plain(c->sig_file_path, &c->signature,
+                    &expected_halg);
     if (!res) {
         goto err;
     }
 
     if (expected_halg != TPM2_ALG_NULL) {
-        if (ctx.halg != expected_halg) {
-            if (ctx.flags.hlg) {
-                const char *got_str = tpm2_alg_util_algtostr(ctx.halg, tpm2_alg_util_flags_any);
+        if (c->halg != expected_halg) {
+            if (c->flags.hlg) {
+                const char *got_str = tpm2_alg_util_algtostr(c->halg, tpm2_alg_util_flags_any);
                 const char *expected_str = tpm2_alg_util_algtostr(expected_halg, tpm2_alg_util_flags_any);
                 LOG_WARN("User specified hash algorithm of \"%s\", does not match"
                         "expected hash algorithm of \"%s\", using: \"%s\"",
                         got_str, expected_str, expected_str);
             }
-            ctx.halg = expected_halg;
+            c->halg = expected_halg;
         }
     }
 
     /* If no digest is specified, compute it */
-    if (!ctx.flags.msg) {
+    if (!c->flags.msg) {
         /*
          * This is a redundant check since main() checks this case, but we'll add it here to silence any
          * complainers.
@@ -425,8 +717,20 @@ static tool_rc init(void) {
         goto err;
     }
 
-    if (ctx.flags.pcr) {
-        if (pcrs_from_file(ctx.pcr_file_path, &pcr_select, &temp_pcrs)) {
+    tool_rc tmp_rc = files_tpm2b_attest_to_tpms_attest(msg, &c->attest);
+    if (tmp_rc != tool_rc_success) {
+        return_value = tmp_rc;
+        goto err;
+    }
+
+    /* a golden state is known good, its PCR values need no hashing */
+    c->golden_match = golden_find(c);
+    if (c->golden_match && !c->is_bulk) {
+        tpm2_tool_output("golden: %s\n", c->golden_match->name);
+    }
+
+    if (c->flags.pcr && !c->golden_match) {
+        if (pcrs_from_file(c, c->pcr_file_path, &pcr_select, &temp_pcrs)) {
             /* pcrs_from_file() logs specific error no need to here */
             pcrs = &temp_pcrs;
         } else {
@@ -441,19 +745,36 @@ static tool_rc init(void) {
             if (le16toh(pcr_select.pcrSelections[i].hash) == TPM2_ALG_ERROR)
             goto err;
 
-        if (!tpm2_openssl_hash_pcr_banks_le(ctx.halg, &pcr_select, pcrs,
-                &ctx.pcr_hash)) {
+        if (!tpm2_openssl_hash_pcr_banks_le(c->halg, &pcr_select, pcrs,
+                &c->pcr_hash)) {
             LOG_ERR("Failed to hash PCR values related to quote!");
             goto err;
         }
-        if (!pcr_print_pcr_struct_le(&pcr_select, pcrs)) {
+        if (!c->is_bulk && !pcr_print_pcr_struct_le(&pcr_select, pcrs)) {
             LOG_ERR("Failed to print PCR values related to quote!");
             goto err;
         }
     }
 
-    if (ctx.flags.eventlog && ctx.flags.pcr) {
-        if (pcrs_from_file(ctx.pcr_file_path, &pcr_select, &temp_pcrs)) {
+    /* without a PCR file, the replayed event log gives the PCR values */
+    if (c->flags.eventlog && !c->flags.pcr && !c->golden_match) {
+        if (!pcrs_from_eventlog(c, &pcr_select, &temp_pcrs)) {
+            goto err;
+        }
+
+        if (!tpm2_openssl_hash_pcr_banks(c->halg, &pcr_select, &temp_pcrs,
+                &c->pcr_hash)) {
+            LOG_ERR("Failed to hash PCR values related to quote!");
+            goto err;
+        }
+        if (!c->is_bulk && !pcr_print_pcr_struct(&pcr_select, &temp_pcrs)) {
+            LOG_ERR("Failed to print PCR values related to quote!");
+            goto err;
+        }
+    }
+
+    if (c->flags.eventlog && c->flags.pcr) {
+        if (pcrs_from_file(c, c->pcr_file_path, &pcr_select, &temp_pcrs)) {
             /* pcrs_from_file() logs specific error no need to here */
             pcrs = &temp_pcrs;
         } else {
@@ -464,7 +785,7 @@ static tool_rc init(void) {
             goto err;
 
         tpm2_eventlog_context eventlog_ctx = { 0 };
-        bool rc = eventlog_from_file(&eventlog_ctx, ctx.eventlog_path);
+        bool rc = eventlog_load(c, &eventlog_ctx);
         if (!rc) {
             LOG_ERR("Failed to process eventlog");
             goto err;
@@ -492,19 +813,9 @@ static tool_rc init(void) {
                 // Compare this digest to the computed value from the eventlog
                 const TPM2B_DIGEST *pcr = &pcrs->pcr_values[vi].digests[di];
                 const uint8_t *pcr_q = pcr->buffer;
-                const uint8_t *pcr_e = NULL;
-
-                if (sel->hash == TPM2_ALG_SHA1 && pcr->size == TPM2_SHA1_DIGEST_SIZE) {
-                    pcr_e = eventlog_ctx.sha1_pcrs[pcr_id];
-                } else if (sel->hash == TPM2_ALG_SHA256 && pcr->size == TPM2_SHA256_DIGEST_SIZE) {
-                    pcr_e = eventlog_ctx.sha256_pcrs[pcr_id];
-                } else if (sel->hash == TPM2_ALG_SHA384 && pcr->size == TPM2_SHA384_DIGEST_SIZE) {
-                    pcr_e = eventlog_ctx.sha384_pcrs[pcr_id];
-                } else if (sel->hash == TPM2_ALG_SHA512 && pcr->size == TPM2_SHA512_DIGEST_SIZE) {
-                    pcr_e = eventlog_ctx.sha512_pcrs[pcr_id];
-                } else if (sel->hash == TPM2_ALG_SM3_256 && pcr->size == TPM2_SM3_256_DIGEST_SIZE) {
-                    pcr_e = eventlog_ctx.sm3_256_pcrs[pcr_id];
-                } else {
+                const uint8_t *pcr_e = eventlog_pcr(&eventlog_ctx, sel->hash,
+                        pcr->size, pcr_id);
+                if (!pcr_e) {
                     LOG_WARN("PCR%u unsupported algorithm/size %u/%u", pcr_id, sel->hash, pcr->size);
                     eventlog_fail = 1;
                 }
@@ -531,15 +842,9 @@ static tool_rc init(void) {
         }
     }
 
-    tool_rc tmp_rc = files_tpm2b_attest_to_tpms_attest(msg, &ctx.attest);
-    if (tmp_rc != tool_rc_success) {
-        return_value = tmp_rc;
-        goto err;
-    }
-
     // Figure out the digest for this message
-    res = tpm2_openssl_hash_compute_data(ctx.halg, msg->attestationData,
-            msg->size, &ctx.msg_hash);
+    res = tpm2_openssl_hash_compute_data(c->halg, msg->attestationData,
+            msg->size, &c->msg_hash);
     if (!res) {
         LOG_ERR("Compute message hash failed!");
         goto err;
@@ -549,10 +854,258 @@ static tool_rc init(void) {
 
 err:
     free(msg);
+    pcr_pcrs_free(&temp_pcrs);
 
     return return_value;
 }
 
+/*
+ * A quote of a manifest. The paths point into the manifest line, the public
+ * key is shared with every other quote of the same AK.
+ */
+typedef struct manifest_ak manifest_ak;
+struct manifest_ak {
+    char *path;
+    EVP_PKEY *pkey;
+};
+
+typedef struct manifest_quote manifest_quote;
+struct manifest_quote {
+    char *line;
+    size_t line_number;
+    const char *msg_file_path;
+    const char *sig_file_path;
+    const char *pcr_file_path;
+    TPM2B_DATA extra_data;
+    size_t ak;
+    bool is_verified;
+    const golden_state *golden;
+};
+
+typedef struct manifest manifest;
+struct manifest {
+    manifest_quote *quotes;
+    size_t count;
+    manifest_ak *aks;
+    size_t ak_count;
+    size_t ak_capacity;
+};
+
+static manifest_ak *manifest_ak_get(manifest *m, const char *path,
+        size_t line_number) {
+
+    size_t i;
+    for (i = 0; i < m->ak_count; i++) {
+        if (!strcmp(m->aks[i].path, path)) {
+            return &m->aks[i];
+        }
+    }
+
+    if (!tpm2_util_array_grow((void **) &m->aks, &m->ak_capacity,
+            m->ak_count, sizeof(*m->aks))) {
+        return NULL;
+    }
+
+    manifest_ak *ak = &m->aks[m->ak_count];
+    ak->path = strdup(path);
+    if (!ak->path) {
+        LOG_ERR("oom");
+        return NULL;
+    }
+
+    /* a key that does not load fails its quotes, not the manifest */
+    ak->pkey = NULL;
+    if (ctx.ak_verifier) {
+        if (!tpm2_ak_cert_verifier_get_pkey(ctx.ak_verifier, path,
+                &ak->pkey)) {
+            LOG_ERR("%s:%zu: Could not verify AK certificate \"%s\"",
+                    ctx.manifest_path, line_number, path);
+            ak->pkey = NULL;
+        }
+    } else if (!tpm2_public_load_pkey(path, &ak->pkey)) {
+        LOG_ERR("%s:%zu: Could not load public key \"%s\"",
+                ctx.manifest_path, line_number, path);
+    }
+    m->ak_count++;
+
+    return ak;
+}
+
+static bool manifest_add(void *e, char *line, char **fields, size_t count,
+        size_t line_number, void *userdata) {
+
+    manifest *m = (manifest *) userdata;
+    manifest_quote *quote = (manifest_quote *) e;
+    quote->line = line;
+    quote->line_number = line_number;
+    quote->msg_file_path = fields[1];
+    quote->sig_file_path = fields[2];
+
+    if (count > 3 && strcmp(fields[3], "-")) {
+        quote->pcr_file_path = fields[3];
+    }
+
+    if (count > 4 && strcmp(fields[4], "-")) {
+        quote->extra_data.size = sizeof(quote->extra_data.buffer);
+        if (!tpm2_util_bin_from_hex_or_file(fields[4],
+                &quote->extra_data.size, quote->extra_data.buffer)) {
+            LOG_ERR("%s:%zu: Invalid qualification \"%s\"",
+                    ctx.manifest_path, line_number, fields[4]);
+            return false;
+        }
+    }
+
+    manifest_ak *ak = manifest_ak_get(m, fields[0], line_number);
+    if (!ak) {
+        return false;
+    }
+    quote->ak = ak - m->aks;
+
+    return true;
+}
+
+static bool manifest_load(manifest *m) {
+
+    return tpm2_util_manifest_read(ctx.manifest_path, 3, MANIFEST_FIELDS,
+            "<public> <message> <signature> [<pcr> [<qualification>]]",
+            (void **) &m->quotes, &m->count, sizeof(*m->quotes),
+            manifest_add, m);
+}
+
+static void manifest_free(manifest *m) {
+
+    size_t i;
+    for (i = 0; i < m->count; i++) {
+        free(m->quotes[i].line);
+    }
+    free(m->quotes);
+
+    for (i = 0; i < m->ak_count; i++) {
+        free(m->aks[i].path);
+        EVP_PKEY_free(m->aks[i].pkey);
+    }
+    free(m->aks);
+}
+
+static bool manifest_quote_verify(manifest *m, manifest_quote *quote,
+        tpm2_verifysig_ctx *c) {
+
+    manifest_ak *ak = &m->aks[quote->ak];
+    if (!ak->pkey) {
+        return false;
+    }
+
+    /* the options given on the command line apply to every quote */
+    *c = ctx;
+    c->is_bulk = true;
+    c->pubkey_file_path = ak->path;
+    c->msg_file_path = (char *) quote->msg_file_path;
+    c->sig_file_path = (char *) quote->sig_file_path;
+    c->pcr_file_path = (char *) quote->pcr_file_path;
+    c->flags.msg = 1;
+    c->flags.sig = 1;
+    c->flags.pcr = quote->pcr_file_path != NULL;
+    c->extra_data = quote->extra_data;
+
+    return init(c) == tool_rc_success && verify(c, ak->pkey);
+}
+
+/* a quote is verified in place, which is too large for a stack */
+typedef struct manifest_run_state manifest_run_state;
+struct manifest_run_state {
+    manifest *m;
+    tpm2_verifysig_ctx *contexts;
+    tool_rc rc;
+};
+
+static bool manifest_work(tpm2_work_worker *worker, size_t index,
+        void *userdata) {
+
+    manifest_run_state *state = (manifest_run_state *) userdata;
+    manifest_quote *quote = &state->m->quotes[index];
+    tpm2_verifysig_ctx *c =
+            &state->contexts[tpm2_work_worker_index(worker)];
+
+    quote->is_verified = manifest_quote_verify(state->m, quote, c);
+    quote->golden = quote->is_verified ? c->golden_match : NULL;
+
+    return quote->is_verified;
+}
+
+static bool manifest_deliver(size_t index, bool result, void *userdata) {
+
+    manifest_run_state *state = (manifest_run_state *) userdata;
+    manifest_quote *quote = &state->m->quotes[index];
+
+    tpm2_tool_output("- line: %zu\n", quote->line_number);
+    tpm2_tool_output("  message: %s\n", quote->msg_file_path);
+    tpm2_tool_output("  verified: %s\n", result ? "true" : "false");
+    if (quote->golden) {
+        tpm2_tool_output("  golden: %s\n", quote->golden->name);
+    }
+    tpm2_tool_output_flush();
+
+    if (!result) {
+        state->rc = tool_rc_general_error;
+    }
+
+    return true;
+}
+
+/*
+ * The quotes are independent of each other, so they are verified on a work
+ * pool, while the calling thread prints the results in manifest order as
+ * soon as they are known.
+ */
+static tool_rc manifest_run(void) {
+
+    manifest m = { 0 };
+    manifest_run_state state = {
+        .m = &m,
+        .rc = tool_rc_general_error,
+    };
+
+    /* the AKs are loaded with the manifest, each certificate once */
+    if (ctx.ak_ca_path) {
+        ctx.ak_verifier = tpm2_ak_cert_verifier_new(ctx.ak_ca_path,
+                ctx.ak_cache_path, ctx.ak_cache_ttl);
+        if (!ctx.ak_verifier) {
+            return tool_rc_general_error;
+        }
+    }
+
+    bool is_loaded = manifest_load(&m);
+    tpm2_ak_cert_verifier_free(ctx.ak_verifier);
+    ctx.ak_verifier = NULL;
+    if (!is_loaded) {
+        goto out;
+    }
+
+    if (!m.count) {
+        state.rc = tool_rc_success;
+        goto out;
+    }
+
+    UINT32 workers = tpm2_work_pool_workers(ctx.jobs, m.count);
+    state.contexts = calloc(workers, sizeof(*state.contexts));
+    if (!state.contexts) {
+        LOG_ERR("oom");
+        goto out;
+    }
+
+    state.rc = tool_rc_success;
+    if (!tpm2_work_pool_run(m.count, ctx.jobs, manifest_work,
+            manifest_deliver, &state)) {
+        state.rc = tool_rc_general_error;
+    }
+
+out:
+    free(state.contexts);
+    manifest_free(&m);
+
+    return state.rc;
+}
+
 static bool on_option(char key, char *value) {
 
     switch (key) {
@@ -596,6 +1149,33 @@ static bool on_option(char key, char *value) {
     case 'l':
         ctx.pcr_selection_string = value;
         break;
+    case 0:
+        ctx.manifest_path = value;
+        break;
+    case 1:
+        if (!tpm2_util_string_to_uint32(value, &ctx.jobs) || !ctx.jobs) {
+            LOG_ERR("Invalid number of jobs, got: \"%s\"", value);
+            return false;
+        }
+        break;
+    case 2:
+        ctx.golden_path = value;
+        break;
+    case 3:
+        ctx.ak_ca_path = value;
+        break;
+    case 4:
+        ctx.ak_cache_path = value;
+        break;
+    case 5:
+        if (!tpm2_util_string_to_uint32(value, &ctx.ak_cache_ttl)) {
+            LOG_ERR("Invalid cache TTL in seconds, got: \"%s\"", value);
+            return false;
+        }
+        break;
+    case 6:
+        ctx.bundle_path = value;
+        break;
         /* no default */
     }
 
@@ -614,6 +1194,13 @@ static bool tpm2_tool_onstart(tpm2_options **opts) {
             { "pcr-list",           required_argument, NULL, 'l' },
             { "public",             required_argument, NULL, 'u' },
             { "qualification",      required_argument, NULL, 'q' },
+            { "manifest",           required_argument, NULL,  0  },
+            { "jobs",               required_argument, NULL,  1  },
+            { "golden",             required_argument, NULL,  2  },
+            { "ak-ca",              required_argument, NULL,  3  },
+            { "ak-cache",           required_argument, NULL,  4  },
+            { "ak-cache-ttl",       required_argument, NULL,  5  },
+            { "bundle",             required_argument, NULL,  6  },
     };
 
 
@@ -628,13 +1215,71 @@ static tool_rc tpm2_tool_onrun(ESYS_CONTEXT *ectx, tpm2_option_flags flags) {
     UNUSED(ectx);
     UNUSED(flags);
 
+    if (ctx.golden_path && !golden_load()) {
+        return tool_rc_general_error;
+    }
+
+    if (ctx.manifest_path) {
+        if (ctx.pubkey_file_path || ctx.flags.msg || ctx.flags.sig
+                || ctx.flags.pcr || ctx.flags.eventlog
+                || ctx.extra_data.size || ctx.bundle_path) {
+            LOG_ERR("--manifest replaces --public (-u), --message (-m), "
+                    "--signature (-s), --pcr (-f), --eventlog (-e), "
+                    "--qualification (-q) and --bundle");
+            return tool_rc_option_error;
+        }
+
+        if (ctx.ak_cache_path && !ctx.ak_ca_path) {
+            LOG_ERR("--ak-cache requires --ak-ca");
+            return tool_rc_option_error;
+        }
+
+        return manifest_run();
+    }
+
+    static tpm2_quote_bundle bundle;
+    if (ctx.bundle_path) {
+        if (ctx.flags.msg || ctx.flags.sig || ctx.flags.pcr
+                || ctx.flags.eventlog || ctx.pcr_selection_string) {
+            LOG_ERR("--bundle replaces --message (-m), --signature (-s), "
+                    "--pcr (-f), --pcr-list (-l) and --eventlog (-e)");
+            return tool_rc_option_error;
+        }
+
+        if (!tpm2_quote_bundle_open(&bundle, ctx.bundle_path)) {
+            return tool_rc_general_error;
+        }
+        ctx.bundle = &bundle;
+
+        /* the members of the bundle stand in for the files */
+        ctx.flags.msg = 1;
+        ctx.flags.sig = 1;
+        ctx.flags.pcr = bundle.pcrs != NULL;
+        ctx.flags.eventlog = bundle.eventlog != NULL;
+    }
+
+    /* check flags for mismatches */
+    if (!(ctx.pubkey_file_path && ctx.flags.sig && ctx.flags.msg)) {
+        LOG_ERR(
+                "--pubkey (-u), --msg (-m) and --sig (-s) are required");
+        return tool_rc_option_error;
+    }
+    if (ctx.jobs) {
+        LOG_ERR("--jobs requires --manifest");
+        return tool_rc_option_error;
+    }
+    if (ctx.ak_ca_path || ctx.ak_cache_path) {
+        LOG_ERR("--ak-ca and --ak-cache require --manifest");
+        return tool_rc_option_error;
+    }
+
     /* initialize and process */
-    tool_rc rc = init();
+    tool_rc rc = init(&ctx);
     if (rc != tool_rc_success) {
         return rc;
     }
 
-    bool res = verify();
+    bool res = verify(&ctx, NULL);
     if (!res) {
         LOG_ERR("Verify signature failed!");
         return tool_rc_general_error;
@@ -643,5 +1288,20 @@ static tool_rc tpm2_tool_onrun(ESYS_CONTEXT *ectx, tpm2_option_flags flags) {
     return tool_rc_success;
 }
 
+static void tpm2_tool_onexit(void) {
+
+    if (ctx.bundle) {
+        tpm2_quote_bundle_close(ctx.bundle);
+        ctx.bundle = NULL;
+    }
+
+    size_t i;
+    for (i = 0; i < ctx.golden_count; i++) {
+        free(ctx.golden[i].name);
+    }
+    free(ctx.golden);
+}
+
 // Register this tool with tpm2_tool.c
-TPM2_TOOL_REGISTER("checkquote", tpm2_tool_onstart, tpm2_tool_onrun, NULL, NULL)
+TPM2_TOOL_REGISTER("checkquote", tpm2_tool_onstart, tpm2_tool_onrun, NULL,
+        tpm2_tool_onexit)
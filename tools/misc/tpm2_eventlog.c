@@ -1,33 +1,113 @@
 /* SPDX-License-Identifier: BSD-3-Clause */
+#include <dirent.h>
 #include <errno.h>
 #include <inttypes.h>
+#include <limits.h>
 #include <stdbool.h>
 #include <stdlib.h>
 #include <string.h>
 
+#include <sys/stat.h>
+
 #include "files.h"
 #include "log.h"
+#include "pcr.h"
 #include "efi_event.h"
+#include "tpm2_alg_util.h"
 #include "tpm2_eventlog.h"
+#include "tpm2_eventlog_emit.h"
 #include "tpm2_eventlog_yaml.h"
+#include "tpm2_hex.h"
+#include "tpm2_openssl.h"
+#include "tpm2_policy.h"
 #include "tpm2_tool.h"
 
-#define CHUNK_SIZE 16384
-
 static char *filename = NULL;
 
+/* more than one log, or a directory of them, are replayed in batches */
+static char **paths = NULL;
+
+static int path_count = 0;
+
+/* the logs read before they are replayed at once */
+#define EVENTLOG_BATCH_MAX 256
+
+static struct {
+    tpm2_eventlog_batch_job *jobs;
+    size_t count;
+    tpm2_eventlog_reference reference;
+    tpm2_eventlog_plan *plan;
+    bool is_failed;
+} batch;
+
 /* Set the default YAML version */
 static uint32_t eventlog_version = 1;
 
+static const char *checkpoint_path = NULL;
+
+static const char *index_path = NULL;
+
+static tpm2_eventlog_filter filter;
+
+static tpm2_eventlog_format format = tpm2_eventlog_format_yaml;
+
+static bool is_format_set = false;
+
+static bool is_replay_only = false;
+
+static const char *reference_path = NULL;
+
+/* the log is an IMA runtime measurement list of template hash ima_alg */
+static bool is_ima = false;
+
+static TPMI_ALG_HASH ima_alg = TPM2_ALG_NULL;
+
+/* the planned measurements of a future boot the PCRs are predicted with */
+static const char *plan_path = NULL;
+
+/* the PCRs of a PolicyPCR computed from the replayed or predicted values */
+static struct {
+    bool is_set;
+    TPML_PCR_SELECTION pcr_select;
+    TPMI_ALG_HASH halg;
+    const char *output_path;
+} policy = {
+    .halg = TPM2_ALG_SHA256,
+};
+
+static bool parse_pcr_list(char *value) {
+
+    char *saveptr = NULL;
+    char *token;
+    for (token = strtok_r(value, ",", &saveptr); token;
+            token = strtok_r(NULL, ",", &saveptr)) {
+        uint32_t pcr;
+        if (!tpm2_util_string_to_uint32(token, &pcr) || pcr >= TPM2_MAX_PCRS) {
+            LOG_ERR("Invalid PCR index, got: \"%s\"", token);
+            return false;
+        }
+        filter.pcrs |= UINT32_C(1) << pcr;
+    }
+
+    if (!filter.pcrs) {
+        LOG_ERR("Expected a list of PCR indices");
+        return false;
+    }
+
+    return true;
+}
+
 static bool on_positional(int argc, char **argv) {
 
-    if (argc != 1) {
-        LOG_ERR("Expected one file name as a positional parameter. Got: %d",
+    if (argc < 1) {
+        LOG_ERR("Expected file names as positional parameters. Got: %d",
                 argc);
         return false;
     }
 
     filename = argv[0];
+    paths = argv;
+    path_count = argc;
 
     return true;
 }
@@ -48,6 +128,75 @@ static bool on_option(char key, char *value) {
         }
         eventlog_version = version;
         break;
+    case 1:
+        checkpoint_path = value;
+        break;
+    case 2:
+        index_path = value;
+        break;
+    case 3:
+        return parse_pcr_list(value);
+    case 4: {
+        uint32_t event;
+        if (!tpm2_util_string_to_uint32(value, &event)) {
+            LOG_ERR("Invalid event number, got: \"%s\"", value);
+            return false;
+        }
+        filter.is_event = true;
+        filter.event = event;
+    }
+        break;
+    case 5:
+        if (!strcmp(value, "yaml")) {
+            format = tpm2_eventlog_format_yaml;
+        } else if (!strcmp(value, "json")) {
+            format = tpm2_eventlog_format_json;
+        } else if (!strcmp(value, "tlv")) {
+            format = tpm2_eventlog_format_tlv;
+        } else {
+            LOG_ERR("Unknown output format, got: \"%s\"", value);
+            return false;
+        }
+        is_format_set = true;
+        break;
+    case 6:
+        is_replay_only = true;
+        break;
+    case 7:
+        reference_path = value;
+        break;
+    case 8:
+        is_ima = true;
+        if (value) {
+            ima_alg = tpm2_alg_util_from_optarg(value,
+                    tpm2_alg_util_flags_hash);
+            if (ima_alg == TPM2_ALG_ERROR) {
+                LOG_ERR("Invalid IMA template hash algorithm, got: \"%s\"",
+                        value);
+                return false;
+            }
+        }
+        break;
+    case 9:
+        plan_path = value;
+        break;
+    case 10:
+        if (!pcr_parse_selections(value, &policy.pcr_select)) {
+            return false;
+        }
+        policy.is_set = true;
+        break;
+    case 'g':
+        policy.halg = tpm2_alg_util_from_optarg(value,
+                tpm2_alg_util_flags_hash);
+        if (policy.halg == TPM2_ALG_ERROR) {
+            LOG_ERR("Invalid policy hash algorithm, got: \"%s\"", value);
+            return false;
+        }
+        break;
+    case 'o':
+        policy.output_path = value;
+        break;
     }
     return true;
 }
@@ -56,17 +205,494 @@ static bool tpm2_tool_onstart(tpm2_options **opts) {
 
     static struct option topts[] = {
          { "eventlog-version",         required_argument, NULL, 0 },
+         { "checkpoint",               required_argument, NULL, 1 },
+         { "index",                    required_argument, NULL, 2 },
+         { "pcrs",                     required_argument, NULL, 3 },
+         { "event",                    required_argument, NULL, 4 },
+         { "format",                   required_argument, NULL, 5 },
+         { "replay-only",              no_argument,       NULL, 6 },
+         { "reference",                required_argument, NULL, 7 },
+         { "ima",                      optional_argument, NULL, 8 },
+         { "predict",                  required_argument, NULL, 9 },
+         { "policy",                   required_argument, NULL, 10 },
+         { "hash-algorithm",           required_argument, NULL, 'g' },
+         { "output",                   required_argument, NULL, 'o' },
     };
 
-    *opts = tpm2_options_new("y:", ARRAY_LEN(topts), topts, on_option,
-                             on_positional, TPM2_OPTIONS_NO_SAPI);
+    *opts = tpm2_options_new("y:g:o:", ARRAY_LEN(topts), topts, on_option,
+                             on_positional,
+                             TPM2_OPTIONS_NO_SAPI | TPM2_OPTIONS_JSON);
 
     return *opts != NULL;
 }
 
+/*
+ * The index saved at index_path is reused when the log continues it, and only
+ * the events appended since are indexed.
+ */
+static bool build_index(tpm2_eventlog_index *index, const UINT8 *eventlog,
+        size_t size) {
+
+    if (index_path && files_does_file_exist(index_path)) {
+        bool ret = tpm2_eventlog_index_load(index, index_path);
+        if (!ret) {
+            return false;
+        }
+
+        if (!tpm2_eventlog_index_matches(index, eventlog, size)) {
+            LOG_WARN("Event log does not continue index \"%s\", "
+                    "indexing it from the start", index_path);
+            tpm2_eventlog_index_free(index);
+        }
+    }
+
+    size_t count = index->count;
+    bool ret = tpm2_eventlog_index_build(index, eventlog, size);
+    if (!ret) {
+        return false;
+    }
+
+    if (index_path && (!count || count != index->count)) {
+        return tpm2_eventlog_index_save(index, eventlog, index_path);
+    }
+
+    return true;
+}
+
+/* resumes ctx from the checkpoint at checkpoint_path, if it continues */
+static bool checkpoint_resume(tpm2_eventlog_context *ctx,
+        const UINT8 *eventlog, size_t size) {
+
+    if (!checkpoint_path || !files_does_file_exist(checkpoint_path)) {
+        return true;
+    }
+
+    bool ret = tpm2_eventlog_checkpoint_load(ctx, checkpoint_path);
+    if (!ret) {
+        return false;
+    }
+
+    if (!tpm2_eventlog_checkpoint_matches(ctx, eventlog, size)) {
+        LOG_WARN("Event log does not continue checkpoint \"%s\", "
+                "replaying it from the start", checkpoint_path);
+        tpm2_eventlog_checkpoint_reset(ctx);
+    }
+
+    return true;
+}
+
+/*
+ * The PolicyPCR digest of the replayed values of the PCRs of the policy,
+ * computed on the host like tpm2_createpolicy does from a PCR values file,
+ * which the values are saved to when output_path is set.
+ */
+static bool policy_digest(const TPML_PCR_SELECTION *pcr_select,
+        const tpm2_pcrs *pcrs, const char *output_path,
+        TPM2B_DIGEST **digest) {
+
+    tpm2_pcrs values = { 0 };
+    bool result = pcr_select_pcr_values(pcr_select, pcrs, &policy.pcr_select,
+            &values);
+    if (!result) {
+        LOG_ERR("The PCRs of the policy are not all extended by the log");
+        goto out;
+    }
+
+    if (output_path) {
+        FILE *f = files_fopen(output_path, "wb");
+        if (!f) {
+            LOG_ERR("Could not open file \"%s\", error: %s", output_path,
+                    strerror(errno));
+            result = false;
+            goto out;
+        }
+        result = pcr_fwrite_values(&policy.pcr_select, &values, f);
+        result = !fclose(f) && result;
+        if (!result) {
+            LOG_ERR("Could not write the PCR values to \"%s\"", output_path);
+            goto out;
+        }
+    }
+
+    TPML_DIGEST digests = { .count = 0 };
+    size_t i;
+    for (i = 0; i < values.count; i++) {
+        UINT32 j;
+        for (j = 0; j < values.pcr_values[i].count; j++) {
+            if (digests.count == ARRAY_LEN(digests.digests)) {
+                LOG_ERR("Number of PCR is limited to %zu",
+                        ARRAY_LEN(digests.digests));
+                result = false;
+                goto out;
+            }
+            digests.digests[digests.count++] = values.pcr_values[i].digests[j];
+        }
+    }
+
+    TPM2B_DIGEST pcr_digest = TPM2B_TYPE_INIT(TPM2B_DIGEST, buffer);
+    result = tpm2_openssl_hash_pcr_values(policy.halg, &digests, &pcr_digest);
+    if (!result) {
+        LOG_ERR("Could not hash pcr values");
+        goto out;
+    }
+
+    tpm2_session_data *session_data = tpm2_session_data_new(TPM2_SE_TRIAL);
+    if (!session_data) {
+        LOG_ERR("oom");
+        result = false;
+        goto out;
+    }
+    tpm2_session_set_authhash(session_data, policy.halg);
+
+    /* without an ESAPI context, the digest is computed on the host */
+    tpm2_session *session = NULL;
+    tool_rc rc = tpm2_session_open(NULL, session_data, &session);
+    if (rc == tool_rc_success) {
+        rc = tpm2_policy_build_pcr(NULL, session, NULL, &policy.pcr_select,
+                &pcr_digest);
+    }
+    if (rc == tool_rc_success) {
+        rc = tpm2_policy_get_digest(NULL, session, digest);
+    }
+    tool_rc tmp_rc = tpm2_session_close(&session);
+    result = rc == tool_rc_success && tmp_rc == tool_rc_success;
+
+out:
+    pcr_pcrs_free(&values);
+
+    return result;
+}
+
+static bool print_policy(const TPML_PCR_SELECTION *pcr_select,
+        const tpm2_pcrs *pcrs, const char *output_path) {
+
+    TPM2B_DIGEST *digest = NULL;
+    bool result = policy_digest(pcr_select, pcrs, output_path, &digest);
+    if (result) {
+        tpm2_writer_hex("pcr-policy", NULL, digest->buffer, digest->size,
+                false);
+    }
+    free(digest);
+
+    return result;
+}
+
+/*
+ * Replays the PCRs without decoding or outputting the events, and outputs
+ * them like tpm2_pcrread does. With a plan, the PCRs are predicted, the
+ * replay extending the planned measurements.
+ */
+static bool replay_only(const UINT8 *eventlog, size_t size,
+        tpm2_eventlog_index const *index, bool is_filtered) {
+
+    tpm2_eventlog_context ctx = {
+        .skip_body = true,
+        .plan = batch.plan,
+    };
+
+    bool ret = checkpoint_resume(&ctx, eventlog, size);
+    if (ret && is_ima) {
+        ret = parse_ima_log(&ctx, eventlog, size, ima_alg);
+    } else if (ret) {
+        ret = is_filtered ?
+                parse_eventlog_index(&ctx, eventlog, size, index, &filter) :
+                parse_eventlog(&ctx, eventlog, size);
+    }
+    if (!ret) {
+        return false;
+    }
+
+    if (checkpoint_path) {
+        ret = tpm2_eventlog_checkpoint_save(&ctx, eventlog, checkpoint_path);
+        if (!ret) {
+            return false;
+        }
+    }
+
+    TPML_PCR_SELECTION pcr_select;
+    tpm2_pcrs pcrs = { 0 };
+    ret = tpm2_eventlog_replayed_pcrs(&ctx, &pcr_select, &pcrs)
+            && pcr_print_pcr_struct(&pcr_select, &pcrs)
+            && (!policy.is_set || print_policy(&pcr_select, &pcrs,
+                    policy.output_path));
+    pcr_pcrs_free(&pcrs);
+
+    return ret;
+}
+
+static bool on_unknown_digest(size_t eventnum, unsigned pcr_index,
+        TPMI_ALG_HASH alg, BYTE const *digest, size_t size, void *data) {
+
+    UNUSED(data);
+
+    char hex[TPM2_HEX_SIZE(sizeof(TPMU_HA))];
+    if (size > sizeof(TPMU_HA)) {
+        LOG_ERR("Digest of event %zu is too large, got: %zu", eventnum, size);
+        return false;
+    }
+    tpm2_hex_encode(digest, size, hex, false);
+
+    tpm2_writer_map_start(NULL);
+    tpm2_writer_number("EventNum", "%zu", eventnum);
+    tpm2_writer_number("PCRIndex", "%u", pcr_index);
+    tpm2_writer_string("AlgorithmId", "%s",
+            tpm2_alg_util_algtostr(alg, tpm2_alg_util_flags_hash));
+    tpm2_writer_quoted("Digest", "%s", hex);
+    tpm2_writer_end();
+
+    return true;
+}
+
+/*
+ * Appraises the digests of the events against the reference database while
+ * walking the log, like a replay only, and outputs the digests it does not
+ * know. As with a replay only, a checkpoint limits it to the events appended
+ * since.
+ */
+static bool appraise(const UINT8 *eventlog, size_t size, bool *is_known) {
+
+    tpm2_eventlog_reference reference = { 0 };
+    if (!tpm2_eventlog_reference_load(&reference, reference_path)) {
+        return false;
+    }
+
+    tpm2_eventlog_context ctx = {
+        .skip_body = true,
+        .reference = &reference,
+        .unknown_digest_cb = on_unknown_digest,
+    };
+
+    tpm2_writer_list_start("unknown");
+    bool ret = checkpoint_resume(&ctx, eventlog, size)
+            && (is_ima ? parse_ima_log(&ctx, eventlog, size, ima_alg) :
+                parse_eventlog(&ctx, eventlog, size))
+            && (!checkpoint_path || tpm2_eventlog_checkpoint_save(&ctx,
+                    eventlog, checkpoint_path));
+    tpm2_writer_end();
+    tpm2_eventlog_reference_free(&reference);
+    if (!ret) {
+        return false;
+    }
+
+    if (ctx.unknown_digests) {
+        LOG_ERR("%zu digests of the event log are not in the reference "
+                "database \"%s\"", ctx.unknown_digests, reference_path);
+    }
+    *is_known = !ctx.unknown_digests;
+
+    return true;
+}
+
+static bool on_ima_event(size_t eventnum,
+        tpm2_eventlog_ima_event const *event, void *data) {
+
+    UNUSED(data);
+
+    tpm2_writer_map_start(NULL);
+    tpm2_writer_number("EventNum", "%zu", eventnum);
+    tpm2_writer_number("PCRIndex", "%"PRIu32, event->pcr_index);
+    tpm2_writer_hex("TemplateHash", NULL, event->template_digest.buffer,
+            event->template_digest.size, false);
+    tpm2_writer_string("TemplateName", "%.*s",
+            (int) event->template_name_size, event->template_name);
+    if (event->file_alg != TPM2_ALG_NULL) {
+        tpm2_writer_string("FileAlgorithmId", "%s",
+                tpm2_alg_util_algtostr(event->file_alg,
+                        tpm2_alg_util_flags_hash));
+        tpm2_writer_hex("FileDigest", NULL, event->file_digest.buffer,
+                event->file_digest.size, false);
+    }
+    if (event->file_name) {
+        tpm2_writer_quoted("FileName", "%.*s", (int) event->file_name_size,
+                event->file_name);
+    }
+    if (event->is_violation) {
+        tpm2_writer_flag("Violation", true);
+    }
+    tpm2_writer_end();
+
+    return true;
+}
+
+/*
+ * Outputs the entries of an IMA list, or those appended since the checkpoint,
+ * and the PCR values they are replayed to.
+ */
+static bool ima_list(const UINT8 *eventlog, size_t size) {
+
+    tpm2_eventlog_context ctx = { .ima_event_cb = on_ima_event };
+
+    tpm2_writer_list_start("events");
+    bool ret = checkpoint_resume(&ctx, eventlog, size)
+            && parse_ima_log(&ctx, eventlog, size, ima_alg)
+            && (!checkpoint_path || tpm2_eventlog_checkpoint_save(&ctx,
+                    eventlog, checkpoint_path));
+    tpm2_writer_end();
+    if (!ret) {
+        return false;
+    }
+
+    TPML_PCR_SELECTION pcr_select;
+    tpm2_pcrs pcrs = { 0 };
+    ret = tpm2_eventlog_replayed_pcrs(&ctx, &pcr_select, &pcrs)
+            && pcr_print_pcr_struct(&pcr_select, &pcrs);
+    pcr_pcrs_free(&pcrs);
+
+    return ret;
+}
+
+/*
+ * Writes the replayed PCRs and the verdict of every log of the batch, in the
+ * order they were given, and starts the next batch.
+ */
+static void batch_flush(void) {
+
+    bool is_reference = reference_path != NULL;
+    tpm2_eventlog_batch(batch.jobs, batch.count,
+            is_reference ? &batch.reference : NULL, batch.plan, 0);
+
+    size_t i;
+    for (i = 0; i < batch.count; i++) {
+        tpm2_eventlog_batch_job *job = &batch.jobs[i];
+
+        const char *verdict = "pass";
+        if (!job->result) {
+            verdict = "invalid";
+        } else if (job->unknown_digests) {
+            verdict = "unknown";
+        }
+        if (strcmp(verdict, "pass")) {
+            batch.is_failed = true;
+        }
+
+        tpm2_writer_map_start(NULL);
+        tpm2_writer_string("path", "%s", job->path);
+        tpm2_writer_string("verdict", "%s", verdict);
+        if (job->result) {
+            if (is_reference) {
+                tpm2_writer_number("unknown-digests", "%zu",
+                        job->unknown_digests);
+            }
+            pcr_print_pcr_struct(&job->pcr_select, &job->pcrs);
+            if (policy.is_set && !print_policy(&job->pcr_select, &job->pcrs,
+                    NULL)) {
+                batch.is_failed = true;
+            }
+        }
+        tpm2_writer_end();
+
+        pcr_pcrs_free(&job->pcrs);
+        free((char *) job->path);
+        memset(job, 0, sizeof(*job));
+    }
+
+    batch.count = 0;
+}
+
+static bool batch_add(const char *path) {
+
+    char *copy = strdup(path);
+    if (!copy) {
+        LOG_ERR("oom");
+        return false;
+    }
+
+    batch.jobs[batch.count++].path = copy;
+    if (batch.count == EVENTLOG_BATCH_MAX) {
+        batch_flush();
+    }
+
+    return true;
+}
+
+static int is_visible(const struct dirent *entry) {
+
+    return entry->d_name[0] != '.';
+}
+
+static bool is_dir(const char *path) {
+
+    struct stat st;
+    return files_stat(path, &st) && S_ISDIR(st.st_mode);
+}
+
+/* the logs of a directory, in name order, but not those of subdirectories */
+static bool batch_add_dir(const char *path) {
+
+    struct dirent **entries;
+    int count = scandir(path, &entries, is_visible, alphasort);
+    if (count < 0) {
+        LOG_ERR("Could not list directory %s, error: %s", path,
+                strerror(errno));
+        return false;
+    }
+
+    bool result = true;
+    int i;
+    for (i = 0; i < count; i++) {
+        char child[PATH_MAX];
+        int len = snprintf(child, sizeof(child), "%s/%s", path,
+                entries[i]->d_name);
+        if (len < 0 || (size_t) len >= sizeof(child)) {
+            LOG_ERR("Path too long: %s/%s", path, entries[i]->d_name);
+            batch.is_failed = true;
+        } else if (!is_dir(child) && !batch_add(child)) {
+            result = false;
+        }
+        free(entries[i]);
+    }
+    free(entries);
+
+    return result;
+}
+
+/*
+ * Replays many logs in one process, ie at a verifier, on all the processors,
+ * and outputs a list of the replayed PCRs and the verdict of each one.
+ */
+static tool_rc replay_batch(void) {
+
+    if (checkpoint_path || index_path || filter.pcrs || filter.is_event
+            || policy.output_path
+            || (is_format_set && format != tpm2_eventlog_format_json)) {
+        LOG_ERR("Many logs are only replayed, cannot checkpoint, index, "
+                "filter, save PCR values or set a format");
+        return tool_rc_option_error;
+    }
+
+    if (reference_path && !tpm2_eventlog_reference_load(&batch.reference,
+            reference_path)) {
+        return tool_rc_general_error;
+    }
+
+    batch.jobs = calloc(EVENTLOG_BATCH_MAX, sizeof(*batch.jobs));
+    if (!batch.jobs) {
+        LOG_ERR("oom");
+        tpm2_eventlog_reference_free(&batch.reference);
+        return tool_rc_general_error;
+    }
+
+    /* the logs of all the batches are one JSON list */
+    tpm2_writer_list_start(NULL);
+
+    bool ret = true;
+    int i;
+    for (i = 0; ret && i < path_count; i++) {
+        ret = is_dir(paths[i]) ?
+                batch_add_dir(paths[i]) : batch_add(paths[i]);
+    }
+    batch_flush();
+
+    tpm2_writer_end();
+
+    free(batch.jobs);
+    tpm2_eventlog_reference_free(&batch.reference);
+
+    return ret && !batch.is_failed ? tool_rc_success : tool_rc_general_error;
+}
+
 static tool_rc tpm2_tool_onrun(ESYS_CONTEXT *ectx, tpm2_option_flags flags) {
 
-    UNUSED(flags);
     UNUSED(ectx);
 
     if (filename == NULL) {
@@ -74,49 +700,134 @@ static tool_rc tpm2_tool_onrun(ESYS_CONTEXT *ectx, tpm2_option_flags flags) {
         return tool_rc_option_error;
     }
 
-    /* Read the file in chunks.  Usually the file will reside in
-       securityfs, and those files do not have a public file size */
-    tool_rc rc = tool_rc_success;
-    FILE *fileptr = fopen(filename, "rb");
-    if (!fileptr) {
+    bool is_filtered = filter.pcrs || filter.is_event;
+    if (is_ima && (path_count > 1 || is_dir(filename) || index_path
+            || is_filtered || is_format_set)) {
+        LOG_ERR("An IMA list is replayed on its own, cannot index, filter "
+                "or set a format");
+        return tool_rc_option_error;
+    }
+
+    bool is_predicted = plan_path != NULL;
+    if (is_predicted && (is_ima || checkpoint_path || index_path
+            || is_filtered || reference_path || is_format_set)) {
+        LOG_ERR("A prediction replays whole logs, cannot read an IMA list, "
+                "checkpoint, index, filter, appraise or set a format");
+        return tool_rc_option_error;
+    }
+
+    if (policy.output_path && !policy.is_set) {
+        LOG_ERR("Expected the PCRs of the values to save with --policy");
+        return tool_rc_option_error;
+    }
+
+    if (is_predicted && !tpm2_eventlog_plan_load(&batch.plan, plan_path)) {
         return tool_rc_general_error;
     }
 
-    /* Reserve the buffer for the first chunk */
-    UINT8 *eventlog = calloc(1, CHUNK_SIZE);
-    if (eventlog == NULL){
-        LOG_ERR("failed to allocate %d bytes: %s", CHUNK_SIZE, strerror(errno));
+    /* the values of the PCRs of a policy are only known from a replay */
+    if (is_predicted || policy.is_set) {
+        is_replay_only = true;
+    }
+
+    if (path_count > 1 || is_dir(filename)) {
+        return replay_batch();
+    }
+
+    if (is_filtered && checkpoint_path) {
+        LOG_ERR("Cannot filter the events of an incremental replay");
+        return tool_rc_option_error;
+    }
+
+    if (is_replay_only && is_format_set) {
+        LOG_ERR("A replay only outputs the PCR values, cannot set a format");
+        return tool_rc_option_error;
+    }
+
+    if (reference_path && (is_filtered || is_replay_only || is_format_set)) {
+        LOG_ERR("An appraisal only outputs the unknown digests of the whole "
+                "log, cannot filter, replay or set a format");
+        return tool_rc_option_error;
+    }
+
+    if (flags.json) {
+        if (is_format_set && format != tpm2_eventlog_format_json) {
+            LOG_ERR("Cannot specify --json with another --format");
+            return tool_rc_option_error;
+        }
+        format = tpm2_eventlog_format_json;
+    }
+
+    tpm2_eventlog_index index = { 0 };
+
+    /*
+     * Copies of the log are mapped in place. Usually the file will reside
+     * in securityfs, and those files do not have a public file size, so
+     * they are read into a buffer that grows as needed.
+     */
+    files_input input;
+    bool ret = files_input_open(&input, filename);
+    if (!ret) {
         return tool_rc_general_error;
     }
 
-    unsigned long size = 0;
-    bool is_file_read = false;
-    do {
-        is_file_read = files_read_bytes_chunk(fileptr, eventlog, CHUNK_SIZE, &size);
-        UINT8 *eventlog_tmp = realloc(eventlog, size + CHUNK_SIZE);
-        if (!eventlog_tmp){
-            LOG_ERR("failed to allocate %lu bytes: %s", size + CHUNK_SIZE, strerror(errno));
-            rc = tool_rc_general_error;
+    tool_rc rc = tool_rc_general_error;
+    const UINT8 *eventlog;
+    size_t size;
+    ret = files_input_read_all(&input, &eventlog, &size);
+    if (!ret) {
+        goto out;
+    }
+
+    if (index_path || is_filtered) {
+        ret = build_index(&index, eventlog, size);
+        if (!ret) {
             goto out;
         }
-        eventlog = eventlog_tmp;
-    } while (is_file_read);
-    fclose(fileptr);
+    }
 
     /* Parse eventlog data */
-    bool ret = yaml_eventlog(eventlog, size, eventlog_version);
+    bool is_known = true;
+    if (reference_path) {
+        ret = appraise(eventlog, size, &is_known);
+    } else if (is_ima && !is_replay_only) {
+        ret = ima_list(eventlog, size);
+    } else if (is_replay_only) {
+        ret = replay_only(eventlog, size, &index, is_filtered);
+    } else if (format != tpm2_eventlog_format_yaml) {
+        ret = is_filtered ?
+                tpm2_eventlog_emit_index(eventlog, size, format, &index,
+                        &filter) :
+                tpm2_eventlog_emit_checkpoint(eventlog, size, format,
+                        checkpoint_path);
+    } else {
+        ret = is_filtered ?
+                yaml_eventlog_index(eventlog, size, eventlog_version, &index,
+                        &filter) :
+                yaml_eventlog_checkpoint(eventlog, size, eventlog_version,
+                        checkpoint_path);
+    }
     if (!ret) {
         LOG_ERR("failed to parse tpm2 eventlog");
-        rc = tool_rc_general_error;
+        goto out;
     }
 
+    rc = is_known ? tool_rc_success : tool_rc_general_error;
+
 out:
-    if (eventlog) {
-        free(eventlog);
-    }
+    tpm2_eventlog_index_free(&index);
+    files_input_close(&input);
 
     return rc;
 }
 
+static tool_rc tpm2_tool_onstop(ESYS_CONTEXT *ectx) {
+    UNUSED(ectx);
+    tpm2_eventlog_plan_free(batch.plan);
+    batch.plan = NULL;
+    return tool_rc_success;
+}
+
 // Register this tool with tpm2_tool.c
-TPM2_TOOL_REGISTER("eventlog", tpm2_tool_onstart, tpm2_tool_onrun, NULL, NULL)
+TPM2_TOOL_REGISTER("eventlog", tpm2_tool_onstart, tpm2_tool_onrun,
+        tpm2_tool_onstop, NULL)
@@ -1,66 +1,84 @@
 /* SPDX-License-Identifier: BSD-3-Clause */
 
+#include <dirent.h>
+#include <errno.h>
 #include <inttypes.h>
+#include <limits.h>
 #include <stdbool.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
+#include <sys/stat.h>
+
 #include "files.h"
 #include "log.h"
 #include "tpm2_alg_util.h"
 #include "tpm2_convert.h"
+#include "tpm2_identity_util.h"
 #include "tpm2_tool.h"
 #include "tpm2_util.h"
 
 typedef bool (*print_fn)(FILE *f);
 
+/* the public areas read before their names are computed at once */
+#define NAME_BATCH_MAX 1024
+
 #define FLAG_FMT (1 << 0)
 
+typedef struct print_handler print_handler;
+struct print_handler {
+    const char *name;
+    unsigned flags;
+    print_fn fn;
+};
+
 typedef struct tpm2_print_ctx tpm2_print_ctx;
 struct tpm2_print_ctx {
     struct {
         const char *path;
-        print_fn handler;
+        const print_handler *handler;
     } file;
+    char **paths;
+    int path_count;
+    bool is_batch;
     bool format_set;
     tpm2_convert_pubkey_fmt format;
+    bool is_name;
+    struct {
+        tpm2_identity_util_name_job *jobs;
+        char **paths;
+        size_t count;
+    } names;
 };
 
 static tpm2_print_ctx ctx = {
         .format = pubkey_format_tss
 };
 
-static void print_clock_info(TPMS_CLOCK_INFO *clock_info, size_t indent_count) {
-
-    print_yaml_indent(indent_count);
-    tpm2_tool_output("clock: %"PRIu64"\n", clock_info->clock);
+static void print_clock_info(TPMS_CLOCK_INFO *clock_info) {
 
-    print_yaml_indent(indent_count);
-    tpm2_tool_output("resetCount: %"PRIu32"\n", clock_info->resetCount);
-
-    print_yaml_indent(indent_count);
-    tpm2_tool_output("restartCount: %"PRIu32"\n", clock_info->restartCount);
-
-    print_yaml_indent(indent_count);
-    tpm2_tool_output("safe: %u\n", clock_info->safe);
+    tpm2_writer_map_start("clockInfo");
+    tpm2_writer_number("clock", "%"PRIu64, clock_info->clock);
+    tpm2_writer_number("resetCount", "%"PRIu32, clock_info->resetCount);
+    tpm2_writer_number("restartCount", "%"PRIu32, clock_info->restartCount);
+    tpm2_writer_number("safe", "%u", clock_info->safe);
+    tpm2_writer_end();
 }
 
-static bool print_TPMS_QUOTE_INFO(TPMS_QUOTE_INFO *info, size_t indent_count) {
-
-    print_yaml_indent(indent_count);
-    tpm2_tool_output("pcrSelect:\n");
+static bool print_TPMS_QUOTE_INFO(TPMS_QUOTE_INFO *info) {
 
-    print_yaml_indent(indent_count + 1);
-    tpm2_tool_output("count: %"PRIu32"\n", info->pcrSelect.count);
-
-    print_yaml_indent(indent_count + 1);
-    tpm2_tool_output("pcrSelections:\n");
+    tpm2_writer_map_start("pcrSelect");
+    tpm2_writer_number("count", "%"PRIu32, info->pcrSelect.count);
+    tpm2_writer_map_start("pcrSelections");
 
     // read TPML_PCR_SELECTION array (of size count)
+    bool result = true;
     UINT32 i;
     for (i = 0; i < info->pcrSelect.count; ++i) {
-        print_yaml_indent(indent_count + 2);
-        tpm2_tool_output("%"PRIu32":\n", i);
+        char key[16];
+        snprintf(key, sizeof(key), "%"PRIu32, i);
+        tpm2_writer_map_start(key);
 
         // print hash type (TPMI_ALG_HASH)
         const char* const hash_name = tpm2_alg_util_algtostr(
@@ -68,30 +86,32 @@ static bool print_TPMS_QUOTE_INFO(TPMS_QUOTE_INFO *info, size_t indent_count) {
                 tpm2_alg_util_flags_hash);
         if (!hash_name) {
             LOG_ERR("Invalid hash type in quote");
-            return false;
+            result = false;
+            break;
         }
-        print_yaml_indent(indent_count + 3);
-        tpm2_tool_output("hash: %"PRIu16" (%s)\n",
+        tpm2_writer_string("hash", "%"PRIu16" (%s)",
                 info->pcrSelect.pcrSelections[i].hash,
                 hash_name);
 
-        print_yaml_indent(indent_count + 3);
-        tpm2_tool_output("sizeofSelect: %"PRIu8"\n",
+        tpm2_writer_number("sizeofSelect", "%"PRIu8,
                 info->pcrSelect.pcrSelections[i].sizeofSelect);
 
         // print PCR selection in hex
-        print_yaml_indent(indent_count + 3);
-        tpm2_tool_output("pcrSelect: ");
-        tpm2_util_hexdump((BYTE *)&info->pcrSelect.pcrSelections[i].pcrSelect,
-                info->pcrSelect.pcrSelections[i].sizeofSelect);
-        tpm2_tool_output("\n");
+        tpm2_writer_hex("pcrSelect", NULL,
+                info->pcrSelect.pcrSelections[i].pcrSelect,
+                info->pcrSelect.pcrSelections[i].sizeofSelect, false);
+        tpm2_writer_end();
+    }
+
+    tpm2_writer_end();
+    tpm2_writer_end();
+    if (!result) {
+        return false;
     }
 
     // print digest in hex (a TPM2B object)
-    print_yaml_indent(indent_count);
-    tpm2_tool_output("pcrDigest: ");
-    tpm2_util_print_tpm2b(&info->pcrDigest);
-    tpm2_tool_output("\n");
+    tpm2_writer_hex("pcrDigest", NULL, info->pcrDigest.buffer,
+            info->pcrDigest.size, false);
 
     return true;
 }
@@ -105,12 +125,10 @@ static bool print_TPMS_ATTEST(FILE* fd) {
         return false;
     }
 
-    tpm2_tool_output("magic: ");
     /* dump these in TPM endianess (big-endian) */
     typeof(attest.magic) be_magic = tpm2_util_hton_32(attest.magic);
-    tpm2_util_hexdump((const UINT8*) &be_magic,
-            sizeof(attest.magic));
-    tpm2_tool_output("\n");
+    tpm2_writer_hex("magic", NULL, (const UINT8*) &be_magic,
+            sizeof(attest.magic), false);
 
     // check magic
     if (attest.magic != TPM2_GENERATED_VALUE) {
@@ -119,36 +137,31 @@ static bool print_TPMS_ATTEST(FILE* fd) {
         return false;
     }
 
-    tpm2_tool_output("type: ");
     /* dump these in TPM endianess (big-endian) */
     typeof(attest.type) be_type = tpm2_util_hton_16(attest.type);
-    tpm2_util_hexdump((const UINT8*) &be_type,
-            sizeof(attest.type));
-    tpm2_tool_output("\n");
+    tpm2_writer_hex("type", NULL, (const UINT8*) &be_type,
+            sizeof(attest.type), false);
 
-    tpm2_tool_output("qualifiedSigner: ");
-    tpm2_util_print_tpm2b(&attest.qualifiedSigner);
-    tpm2_tool_output("\n");
+    tpm2_writer_hex("qualifiedSigner", NULL, attest.qualifiedSigner.name,
+            attest.qualifiedSigner.size, false);
 
-    tpm2_tool_output("extraData: ");
-    tpm2_util_print_tpm2b(&attest.extraData);
-    tpm2_tool_output("\n");
+    tpm2_writer_hex("extraData", NULL, attest.extraData.buffer,
+            attest.extraData.size, false);
 
-    tpm2_tool_output("clockInfo:\n");
-    print_clock_info(&attest.clockInfo, 1);
+    print_clock_info(&attest.clockInfo);
 
-    tpm2_tool_output("firmwareVersion: ");
-    tpm2_util_hexdump((BYTE *)&attest.firmwareVersion,
-            sizeof(attest.firmwareVersion));
-    tpm2_tool_output("\n");
+    tpm2_writer_hex("firmwareVersion", NULL, (BYTE *)&attest.firmwareVersion,
+            sizeof(attest.firmwareVersion), false);
 
     switch (attest.type) {
-    case TPM2_ST_ATTEST_QUOTE:
-        tpm2_tool_output("attested:\n");
-        print_yaml_indent(1);
-        tpm2_tool_output("quote:\n");
-        return print_TPMS_QUOTE_INFO(&attest.attested.quote, 2);
-        break;
+    case TPM2_ST_ATTEST_QUOTE: {
+        tpm2_writer_map_start("attested");
+        tpm2_writer_map_start("quote");
+        bool result = print_TPMS_QUOTE_INFO(&attest.attested.quote);
+        tpm2_writer_end();
+        tpm2_writer_end();
+        return result;
+    }
 
     default:
         LOG_ERR("Cannot print unsupported type 0x%" PRIx16, attest.type);
@@ -226,7 +239,7 @@ static bool print_TPMS_CONTEXT(FILE *fstream) {
     }
 
     print_context:
-    tpm2_tool_output("version: %d\n", version);
+    tpm2_writer_number("version", "%d", version);
     const char *hierarchy;
     switch (context.hierarchy) {
     case TPM2_RH_OWNER:
@@ -243,12 +256,13 @@ static bool print_TPMS_CONTEXT(FILE *fstream) {
         hierarchy = "null";
         break;
     }
-    tpm2_tool_output("hierarchy: %s\n", hierarchy);
-    tpm2_tool_output("handle: 0x%X (%u)\n", context.savedHandle,
+    tpm2_writer_string("hierarchy", "%s", hierarchy);
+    tpm2_writer_string("handle", "0x%X (%u)", context.savedHandle,
             context.savedHandle);
-    tpm2_tool_output("sequence: %"PRIu64"\n", context.sequence);
-    tpm2_tool_output("contextBlob: \n");
-    tpm2_tool_output("\tsize: %d\n", context.contextBlob.size);
+    tpm2_writer_number("sequence", "%"PRIu64, context.sequence);
+    tpm2_writer_map_start("contextBlob");
+    tpm2_writer_number("size", "%d", context.contextBlob.size);
+    tpm2_writer_end();
     result = true;
 
 out:
@@ -270,7 +284,7 @@ static bool print_TPMT_PUBLIC(FILE *fstream) {
         return tpm2_convert_pubkey_save(&tpm2b_public, ctx.format, NULL);
     }
 
-    tpm2_util_tpmt_public_to_yaml(&public, NULL);
+    tpm2_util_tpmt_public_to_yaml(&public);
 
     return true;
 }
@@ -287,7 +301,7 @@ static bool print_TPM2B_PUBLIC(FILE *fstream) {
         return tpm2_convert_pubkey_save(&public, ctx.format, NULL);
     }
 
-    tpm2_util_public_to_yaml(&public, NULL);
+    tpm2_util_public_to_yaml(&public);
 
     return true;
 }
@@ -295,38 +309,308 @@ static bool print_TPM2B_PUBLIC(FILE *fstream) {
 #define ADD_HANDLER(type) { .name = #type, .flags = 0, .fn = print_##type }
 #define ADD_HANDLER_FMT(type) { .name = #type, .flags = FLAG_FMT, .fn = print_##type }
 
+static const print_handler handlers[] = {
+    ADD_HANDLER(TPMS_ATTEST),
+    ADD_HANDLER(TPMS_CONTEXT),
+    ADD_HANDLER_FMT(TPM2B_PUBLIC),
+    ADD_HANDLER_FMT(TPMT_PUBLIC)
+};
+
+static const print_handler *lookup_handler(const char *name) {
+
+    size_t i;
+    for (i=0; i < ARRAY_LEN(handlers); i++) {
+        if (!strcmp(name, handlers[i].name)) {
+            return &handlers[i];
+        }
+    }
+
+    return NULL;
+}
 
 static bool handle_type(const char *name) {
 
-    static const struct {
-        const char *name;
-        unsigned flags;
-        print_fn fn;
-    } handlers[] = {
-        ADD_HANDLER(TPMS_ATTEST),
-        ADD_HANDLER(TPMS_CONTEXT),
-        ADD_HANDLER_FMT(TPM2B_PUBLIC),
-        ADD_HANDLER_FMT(TPMT_PUBLIC)
-    };
+    const print_handler *handler = lookup_handler(name);
+    if (!handler) {
+        LOG_ERR("Unknown file type, got: \"%s\"", name);
+        return false;
+    }
+
+    if (ctx.format_set && !(handler->flags & FLAG_FMT)) {
+        LOG_ERR("Cannot specify --format/-f with handler for type \"%s\"", name);
+        return false;
+    }
+
+    ctx.file.handler = handler;
+    return true;
+}
+
+static bool is_public_type(UINT16 type) {
+
+    return type == TPM2_ALG_RSA || type == TPM2_ALG_ECC
+            || type == TPM2_ALG_KEYEDHASH || type == TPM2_ALG_SYMCIPHER;
+}
+
+/*
+ * Guesses the type from the leading bytes: the magic of the tools context
+ * files, the TPM2_GENERATED_VALUE of attestations and the object type of
+ * public areas, which in a TPM2B_PUBLIC follows a size covering the file.
+ */
+static const print_handler *detect_type(FILE *f, const UINT8 *data,
+        size_t size) {
+
+    if (files_is_tpm_context_file(f)) {
+        return lookup_handler("TPMS_CONTEXT");
+    }
+
+    if (size < sizeof(UINT32)) {
+        return NULL;
+    }
+
+    UINT32 magic = (UINT32) data[0] << 24 | data[1] << 16 | data[2] << 8
+            | data[3];
+    if (magic == TPM2_GENERATED_VALUE) {
+        return lookup_handler("TPMS_ATTEST");
+    }
+
+    UINT16 first = data[0] << 8 | data[1];
+    UINT16 second = data[2] << 8 | data[3];
+    if (first == size - sizeof(UINT16) && is_public_type(second)) {
+        return lookup_handler("TPM2B_PUBLIC");
+    }
+
+    if (is_public_type(first)) {
+        return lookup_handler("TPMT_PUBLIC");
+    }
+
+    return NULL;
+}
+
+typedef struct print_input print_input;
+struct print_input {
+    files_input input;
+    FILE *f;
+    const print_handler *handler;
+};
+
+/*
+ * The file is mapped once and parsed through a memory stream, with no copy
+ * of the data, and only read into a buffer when it can't be mapped, ie stdin.
+ */
+static bool print_input_open(const char *path, print_input *in) {
+
+    bool result = files_input_open(&in->input, path);
+    if (!result) {
+        return false;
+    }
+
+    const UINT8 *data;
+    size_t size;
+    result = files_input_read_all(&in->input, &data, &size);
+    if (!result) {
+        goto out;
+    }
+
+    LOG_INFO("Read %zu bytes from file %s", size, path ? path : "stdin");
+
+    if (!size) {
+        LOG_ERR("No data in file %s", path ? path : "stdin");
+        result = false;
+        goto out;
+    }
+
+    in->f = fmemopen((void *) data, size, "rb");
+    if (!in->f) {
+        LOG_ERR("Could not open memory stream, error: %s", strerror(errno));
+        result = false;
+        goto out;
+    }
+
+    in->handler = ctx.file.handler;
+    if (!in->handler) {
+        in->handler = detect_type(in->f, data, size);
+        if (!in->handler) {
+            LOG_ERR("Could not detect the type of file %s, specify -t/--type",
+                    path ? path : "stdin");
+            result = false;
+            goto close;
+        }
+
+        if (ctx.format_set && !(in->handler->flags & FLAG_FMT)) {
+            LOG_ERR("Cannot specify --format/-f with file %s of type \"%s\"",
+                    path, in->handler->name);
+            result = false;
+            goto close;
+        }
+    }
+
+    ctx.file.path = path;
+
+    return true;
+
+close:
+    fclose(in->f);
+out:
+    files_input_close(&in->input);
+
+    return result;
+}
+
+static void print_input_close(print_input *in) {
+
+    fclose(in->f);
+    files_input_close(&in->input);
+}
+
+static bool print_file(const char *path) {
+
+    print_input in;
+    bool result = print_input_open(path, &in);
+    if (!result) {
+        return false;
+    }
+
+    /* a YAML document, or a JSON line, per file */
+    if (ctx.is_batch) {
+        tpm2_writer_document_start();
+        tpm2_writer_string("file", "%s", path);
+        tpm2_writer_string("type", "%s", in.handler->name);
+    }
+
+    result = in.handler->fn(in.f);
+
+    print_input_close(&in);
 
+    return result;
+}
+
+/*
+ * Writes a "name  path" line per public area read so far, in the order the
+ * files were listed, like sha256sum does for digests. The JSON is a list of
+ * the names and paths instead.
+ */
+static bool print_names(void) {
+
+    tpm2_identity_util_name_batch(ctx.names.jobs, ctx.names.count, 0);
+
+    bool is_json = tpm2_writer_get_format() == tpm2_writer_format_json;
+    bool result = true;
     size_t i;
-    for (i=0; i < ARRAY_LEN(handlers); i++) {
+    for (i = 0; i < ctx.names.count; i++) {
+        const char *path = ctx.names.paths[i] ? ctx.names.paths[i] : "-";
+        tpm2_identity_util_name_job *job = &ctx.names.jobs[i];
+        if (!job->result) {
+            LOG_ERR("Could not compute the name of file %s", path);
+            result = false;
+        } else if (is_json) {
+            tpm2_writer_map_start(NULL);
+            tpm2_writer_hex("name", NULL, job->name.name, job->name.size,
+                    false);
+            tpm2_writer_string("path", "%s", path);
+            tpm2_writer_end();
+        } else {
+            tpm2_util_hexdump(job->name.name, job->name.size);
+            tpm2_tool_output("  %s\n", path);
+        }
+        free(ctx.names.paths[i]);
+    }
+    tpm2_tool_output_flush();
 
-        if (!strcmp(name, handlers[i].name)) {
+    ctx.names.count = 0;
+
+    return result;
+}
+
+static bool name_file(const char *path) {
+
+    print_input in;
+    bool result = print_input_open(path, &in);
+    if (!result) {
+        return false;
+    }
+
+    tpm2_identity_util_name_job *job = &ctx.names.jobs[ctx.names.count];
+    memset(job, 0, sizeof(*job));
+
+    if (in.handler->fn == print_TPM2B_PUBLIC) {
+        result = files_load_public_file(in.f, path, &job->public);
+    } else if (in.handler->fn == print_TPMT_PUBLIC) {
+        result = files_load_template_file(in.f, path, &job->public.publicArea);
+    } else {
+        LOG_ERR("Cannot compute the name of file %s of type \"%s\"",
+                path ? path : "stdin", in.handler->name);
+        result = false;
+    }
 
-            if (ctx.format_set && !(handlers[i].flags & FLAG_FMT)) {
-                LOG_ERR("Cannot specify --format/-f with handler for type \"%s\"", name);
-                return false;
-            }
+    print_input_close(&in);
 
-            ctx.file.handler = handlers[i].fn;
-            return true;
+    if (!result) {
+        return false;
+    }
+
+    char *copy = NULL;
+    if (path) {
+        copy = strdup(path);
+        if (!copy) {
+            LOG_ERR("oom");
+            return false;
         }
     }
 
-    LOG_ERR("Unknown file type, got: \"%s\"", name);
+    ctx.names.paths[ctx.names.count++] = copy;
 
-    return false;
+    /* the names are computed a batch at a time, hashing on all the cores */
+    return ctx.names.count < NAME_BATCH_MAX ? true : print_names();
+}
+
+typedef bool (*path_fn)(const char *path);
+
+static bool print_path(const char *path, path_fn fn);
+
+static int is_visible(const struct dirent *entry) {
+
+    return entry->d_name[0] != '.';
+}
+
+static bool print_dir(const char *path, path_fn fn) {
+
+    struct dirent **entries;
+    int count = scandir(path, &entries, is_visible, alphasort);
+    if (count < 0) {
+        LOG_ERR("Could not list directory %s, error: %s", path,
+                strerror(errno));
+        return false;
+    }
+
+    /* report every file that could not be printed, not only the first */
+    bool result = true;
+    int i;
+    for (i = 0; i < count; i++) {
+        char child[PATH_MAX];
+        int len = snprintf(child, sizeof(child), "%s/%s", path,
+                entries[i]->d_name);
+        if (len < 0 || (size_t) len >= sizeof(child)) {
+            LOG_ERR("Path too long: %s/%s", path, entries[i]->d_name);
+            result = false;
+        } else if (!print_path(child, fn)) {
+            result = false;
+        }
+        free(entries[i]);
+    }
+    free(entries);
+
+    return result;
+}
+
+static bool is_dir(const char *path) {
+
+    struct stat st;
+    return files_stat(path, &st) && S_ISDIR(st.st_mode);
+}
+
+static bool print_path(const char *path, path_fn fn) {
+
+    return is_dir(path) ? print_dir(path, fn) : fn(path);
 }
 
 static bool on_option(char key, char *value) {
@@ -343,6 +627,9 @@ static bool on_option(char key, char *value) {
         }
         ctx.format_set = true;
         break;
+    case 0:
+        ctx.is_name = true;
+        break;
     default:
         LOG_ERR("Invalid option %c", key);
         return false;
@@ -353,12 +640,8 @@ static bool on_option(char key, char *value) {
 
 static bool on_arg(int argc, char *argv[]) {
 
-    if (argc != 1) {
-        LOG_ERR("Expected single file path argument");
-        return false;
-    }
-
-    ctx.file.path = argv[0];
+    ctx.paths = argv;
+    ctx.path_count = argc;
 
     return true;
 }
@@ -367,48 +650,104 @@ static bool tpm2_tool_onstart(tpm2_options **opts) {
     static const struct option topts[] = {
         { "type",   required_argument, NULL, 't' },
         { "format", required_argument, NULL, 'f' },
+        { "name",   no_argument,       NULL,  0  },
     };
 
     *opts = tpm2_options_new("t:f:", ARRAY_LEN(topts), topts, on_option, on_arg,
-            TPM2_OPTIONS_NO_SAPI);
+            TPM2_OPTIONS_NO_SAPI | TPM2_OPTIONS_JSON);
 
     return *opts != NULL;
 }
 
+/*
+ * Computes the names of the public areas in the files, a batch at a time so
+ * any number of files is streamed with bounded memory.
+ */
+static tool_rc print_all_names(void) {
+
+    if (ctx.format_set) {
+        LOG_ERR("Cannot specify --format/-f with --name");
+        return tool_rc_option_error;
+    }
+
+    if (!ctx.path_count && !ctx.file.handler) {
+        LOG_ERR("Must specify -t/--type when reading from stdin");
+        return tool_rc_general_error;
+    }
+
+    ctx.names.jobs = calloc(NAME_BATCH_MAX, sizeof(*ctx.names.jobs));
+    ctx.names.paths = calloc(NAME_BATCH_MAX, sizeof(*ctx.names.paths));
+    if (!ctx.names.jobs || !ctx.names.paths) {
+        LOG_ERR("oom");
+        free(ctx.names.jobs);
+        free(ctx.names.paths);
+        return tool_rc_general_error;
+    }
+
+    /* the names of all the batches are one JSON list */
+    tpm2_writer_list_start(NULL);
+
+    /* carry on past a broken file, like for printing */
+    bool res = true;
+    if (!ctx.path_count) {
+        res = name_file(NULL);
+    }
+
+    int i;
+    for (i = 0; i < ctx.path_count; i++) {
+        if (!print_path(ctx.paths[i], name_file)) {
+            res = false;
+        }
+    }
+
+    if (!print_names()) {
+        res = false;
+    }
+
+    tpm2_writer_end();
+
+    free(ctx.names.jobs);
+    free(ctx.names.paths);
+
+    return res ? tool_rc_success : tool_rc_general_error;
+}
+
 static tool_rc tpm2_tool_onrun(ESYS_CONTEXT *ectx, tpm2_option_flags flags) {
     UNUSED(ectx);
-    UNUSED(flags);
-
-    FILE* fd = stdin;
-
-    if (!ctx.file.handler) {
-        /*
-         * TODO: This could be automated by each
-         * type having an interrogation function. If it passes,
-         * then use the associated handler. For now, make -t
-         * mandatory.
-         */
-        LOG_ERR("Must specify -t/--type");
-        return tool_rc_general_error;
+
+    /* a public key format is not YAML either */
+    if (flags.json && ctx.format_set) {
+        LOG_ERR("Cannot specify --json with --format/-f");
+        return tool_rc_option_error;
+    }
+
+    if (ctx.is_name) {
+        return print_all_names();
     }
 
-    if (ctx.file.path) {
-        LOG_INFO("Reading from file %s", ctx.file.path);
-        fd = fopen(ctx.file.path, "rb");
-        if (!fd) {
-            LOG_ERR("Could not open file %s", ctx.file.path);
+    if (!ctx.path_count) {
+        /* stdin is parsed as is, with nothing to pick the type from */
+        if (!ctx.file.handler) {
+            LOG_ERR("Must specify -t/--type when reading from stdin");
             return tool_rc_general_error;
         }
-    } else {
-        LOG_INFO("Reading from stdin");
-    }
 
-    bool res = ctx.file.handler(fd);
+        return print_file(NULL) ? tool_rc_success : tool_rc_general_error;
+    }
 
-    LOG_INFO("Read %ld bytes from file %s", ftell(fd), ctx.file.path);
+    ctx.is_batch = ctx.path_count > 1 || is_dir(ctx.paths[0]);
+    if (ctx.is_batch && ctx.format_set) {
+        LOG_ERR("Cannot specify --format/-f with many files");
+        return tool_rc_option_error;
+    }
 
-    if (fd != stdin) {
-        fclose(fd);
+    /* carry on past a broken file, audits want to know about all of them */
+    bool res = true;
+    int i;
+    for (i = 0; i < ctx.path_count; i++) {
+        if (!print_path(ctx.paths[i], print_file)) {
+            res = false;
+        }
     }
 
     return res ? tool_rc_success : tool_rc_general_error;
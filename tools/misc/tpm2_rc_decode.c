@@ -1,6 +1,11 @@
 /* SPDX-License-Identifier: BSD-3-Clause */
 
+#include <ctype.h>
+#include <errno.h>
 #include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 
 #include <tss2/tss2_rc.h>
 
@@ -9,9 +14,26 @@
 
 #define TPM2_RC_MAX 0xffffffff
 
+/*
+ * A trace holds few distinct codes, so a small open addressing table caches
+ * them all. Once it is full the other codes are decoded every time.
+ */
+#define RC_CACHE_SIZE 1024
+#define RC_CACHE_MAX (RC_CACHE_SIZE / 4 * 3)
+
+typedef struct rc_cache_entry rc_cache_entry;
+struct rc_cache_entry {
+    TSS2_RC rc;
+    char *decoded;
+};
+
 typedef struct tpm2_rc_ctx tpm2_rc_ctx;
 struct tpm2_rc_ctx {
     TSS2_RC rc;
+    bool is_stream;
+    /* allocated for the first code of a stream */
+    rc_cache_entry *cache;
+    size_t cache_count;
 };
 
 static tpm2_rc_ctx ctx;
@@ -33,10 +55,110 @@ static bool str_to_tpm_rc(const char *rc_str, TSS2_RC *rc) {
     return true;
 }
 
+static const char *decode_cached(TSS2_RC rc) {
+
+    if (!ctx.cache) {
+        ctx.cache = calloc(RC_CACHE_SIZE, sizeof(*ctx.cache));
+        if (!ctx.cache) {
+            return Tss2_RC_Decode(rc);
+        }
+    }
+
+    /* Fibonacci hashing spreads the mostly low bits set in RCs */
+    size_t i = (UINT32) (rc * 2654435769u) % RC_CACHE_SIZE;
+    while (ctx.cache[i].decoded) {
+        if (ctx.cache[i].rc == rc) {
+            return ctx.cache[i].decoded;
+        }
+        i = (i + 1) % RC_CACHE_SIZE;
+    }
+
+    /* the decoded string is overwritten by the next Tss2_RC_Decode() */
+    const char *decoded = Tss2_RC_Decode(rc);
+    if (ctx.cache_count == RC_CACHE_MAX) {
+        return decoded;
+    }
+
+    char *copy = strdup(decoded);
+    if (!copy) {
+        return decoded;
+    }
+
+    ctx.cache[i].rc = rc;
+    ctx.cache[i].decoded = copy;
+    ctx.cache_count++;
+
+    return copy;
+}
+
+static bool line_to_tpm_rc(char *line, TSS2_RC *rc) {
+
+    errno = 0;
+    char *end_ptr = NULL;
+    uintmax_t rc_read = strtoumax(line, &end_ptr, 0);
+    if (errno || end_ptr == line || rc_read > TPM2_RC_MAX) {
+        return false;
+    }
+
+    while (isspace((unsigned char) *end_ptr)) {
+        end_ptr++;
+    }
+
+    *rc = rc_read;
+
+    return *end_ptr == '\0';
+}
+
+static tool_rc decode_stream(FILE *input) {
+
+    tool_rc rc = tool_rc_success;
+    char *line = NULL;
+    size_t line_size = 0;
+    size_t lineno = 0;
+
+    while (getline(&line, &line_size, input) != -1) {
+        lineno++;
+
+        char *p = line;
+        while (isspace((unsigned char) *p)) {
+            p++;
+        }
+
+        if (!*p) {
+            continue;
+        }
+
+        TSS2_RC code;
+        if (!line_to_tpm_rc(p, &code)) {
+            LOG_ERR("Line %zu: invalid TSS2_RC", lineno);
+            rc = tool_rc_general_error;
+            break;
+        }
+
+        tpm2_tool_output("%s\n", decode_cached(code));
+    }
+
+    if (ferror(input)) {
+        LOG_ERR("Error reading response codes: %s", strerror(errno));
+        rc = tool_rc_general_error;
+    }
+
+    free(line);
+
+    return rc;
+}
+
 static bool on_arg(int argc, char **argv) {
 
     if (argc != 1) {
         LOG_ERR("Expected 1 rc code, got: %d", argc);
+        return false;
+    }
+
+    /* decode a code per line of stdin */
+    if (!strcmp(argv[0], "-")) {
+        ctx.is_stream = true;
+        return true;
     }
 
     return str_to_tpm_rc(argv[0], &ctx.rc);
@@ -54,11 +176,25 @@ static tool_rc tpm2_tool_onrun(ESYS_CONTEXT *ectx, tpm2_option_flags flags) {
     UNUSED(flags);
     UNUSED(ectx);
 
+    if (ctx.is_stream) {
+        return decode_stream(stdin);
+    }
+
     const char *e = Tss2_RC_Decode(ctx.rc);
     tpm2_tool_output("%s\n", e);
 
     return tool_rc_success;
 }
 
+static void tpm2_tool_onexit(void) {
+
+    size_t i;
+    for (i = 0; ctx.cache && i < RC_CACHE_SIZE; i++) {
+        free(ctx.cache[i].decoded);
+    }
+    free(ctx.cache);
+}
+
 // Register this tool with tpm2_tool.c
-TPM2_TOOL_REGISTER("rc_decode", tpm2_tool_onstart, tpm2_tool_onrun, NULL, NULL)
+TPM2_TOOL_REGISTER("rc_decode", tpm2_tool_onstart, tpm2_tool_onrun, NULL,
+        tpm2_tool_onexit)
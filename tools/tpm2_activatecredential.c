@@ -10,6 +10,8 @@
 #include "files.h"
 #include "log.h"
 #include "tpm2.h"
+#include "tpm2_auth_util.h"
+#include "tpm2_policy.h"
 #include "tpm2_tool.h"
 
 typedef struct tpm_activatecred_ctx tpm_activatecred_ctx;
@@ -36,6 +38,16 @@ struct tpm_activatecred_ctx {
     bool is_credential_blob_specified;
     TPM2B_ENCRYPTED_SECRET secret;
 
+    /*
+     * Manifest of credentials, activated with the keys loaded once
+     */
+    const char *manifest_path;
+    struct {
+        const char *auth_str;
+        tpm2_loaded_object object;
+        bool is_loaded;
+    } endorsement;
+
     /*
      * Outputs
      */
@@ -120,13 +132,14 @@ static tool_rc process_output(ESYS_CONTEXT *ectx) {
     return is_file_op_success ? tool_rc_success : tool_rc_general_error;
 }
 
-static bool read_cert_secret(void) {
+static bool read_cert_secret(const char *path, TPM2B_ID_OBJECT *blob,
+        TPM2B_ENCRYPTED_SECRET *secret) {
 
     bool result = false;
-    FILE *fp = fopen(ctx.credential_blob_path, "rb");
+    FILE *fp = files_fopen(path, "rb");
     if (!fp) {
         LOG_ERR("Could not open file \"%s\" error: \"%s\"",
-        ctx.credential_blob_path, strerror(errno));
+        path, strerror(errno));
         return false;
     }
 
@@ -142,25 +155,27 @@ static bool read_cert_secret(void) {
         goto out;
     }
 
-    result = files_read_16(fp, &ctx.credential_blob.size);
-    if (!result) {
+    result = files_read_16(fp, &blob->size);
+    if (!result || blob->size > sizeof(blob->credential)) {
         LOG_ERR("Could not read credential size");
+        result = false;
         goto out;
     }
 
-    result = files_read_bytes(fp, ctx.credential_blob.credential, ctx.credential_blob.size);
+    result = files_read_bytes(fp, blob->credential, blob->size);
     if (!result) {
         LOG_ERR("Could not read credential data");
         goto out;
     }
 
-    result = files_read_16(fp, &ctx.secret.size);
-    if (!result) {
+    result = files_read_16(fp, &secret->size);
+    if (!result || secret->size > sizeof(secret->secret)) {
         LOG_ERR("Could not read secret size");
+        result = false;
         goto out;
     }
 
-    result = files_read_bytes(fp, ctx.secret.secret, ctx.secret.size);
+    result = files_read_bytes(fp, secret->secret, secret->size);
     if (!result) {
         LOG_ERR("Could not write secret data");
         goto out;
@@ -214,7 +229,14 @@ static tool_rc process_inputs(ESYS_CONTEXT *ectx) {
     /*
      * 3. Command specific initializations
      */
-    rc = read_cert_secret() ? tool_rc_success : tool_rc_general_error;
+    if (ctx.manifest_path) {
+        /* the credentials are read line by line */
+        ctx.is_command_dispatch = true;
+        return tool_rc_success;
+    }
+
+    rc = read_cert_secret(ctx.credential_blob_path, &ctx.credential_blob,
+            &ctx.secret) ? tool_rc_success : tool_rc_general_error;
     if (rc != tool_rc_success) {
         return rc;
     }
@@ -253,6 +275,27 @@ static tool_rc process_inputs(ESYS_CONTEXT *ectx) {
 
 static tool_rc check_options(void) {
 
+    if (ctx.manifest_path) {
+        if (!ctx.credentialed_key.ctx_path || !ctx.credential_key.ctx_path) {
+            LOG_ERR("Expected options c and C.");
+            return tool_rc_option_error;
+        }
+
+        if (ctx.is_credential_blob_specified || ctx.output_file
+                || ctx.cp_hash_path || ctx.rp_hash_path) {
+            LOG_ERR("The manifest names the credentials and outputs, cannot "
+                    "specify -i, -o, --cphash or --rphash");
+            return tool_rc_option_error;
+        }
+
+        return tool_rc_success;
+    }
+
+    if (ctx.endorsement.auth_str) {
+        LOG_ERR("--eh-auth requires --manifest");
+        return tool_rc_option_error;
+    }
+
     if ((!ctx.credentialed_key.ctx_path) && (!ctx.credential_key.ctx_path)
         && !ctx.is_credential_blob_specified && !ctx.output_file) {
         LOG_ERR("Expected options c and C and i and o.");
@@ -262,6 +305,129 @@ static tool_rc check_options(void) {
     return tool_rc_success;
 }
 
+static bool is_session_auth(const char *auth_str) {
+
+    return auth_str && !strncmp(auth_str, "session:", strlen("session:"));
+}
+
+/*
+ * Every ActivateCredential resets the policy of a policy session, so before
+ * the next credential the EK policy, the PolicySecret of the endorsement
+ * hierarchy of the default EK templates, is satisfied again in the same
+ * session rather than starting a new one.
+ */
+static tool_rc credential_key_restart(ESYS_CONTEXT *ectx) {
+
+    tpm2_session *session = ctx.credential_key.object.session;
+    if (!is_session_auth(ctx.credential_key.auth_str)) {
+        return tpm2_auth_util_restart(ectx, ctx.credential_key.auth_str,
+                session);
+    }
+
+    if (!ctx.endorsement.is_loaded) {
+        tool_rc rc = tpm2_util_object_load_auth(ectx, "e",
+                ctx.endorsement.auth_str, &ctx.endorsement.object, false,
+                TPM2_HANDLE_FLAGS_E);
+        if (rc != tool_rc_success) {
+            return rc;
+        }
+        ctx.endorsement.is_loaded = true;
+    }
+
+    tool_rc rc = tpm2_session_restart(ectx, session);
+    if (rc != tool_rc_success) {
+        return rc;
+    }
+
+    return tpm2_policy_build_policysecret(ectx, session,
+            &ctx.endorsement.object, 0, NULL, NULL, false, NULL, NULL);
+}
+
+static bool manifest_activate_one(ESYS_CONTEXT *ectx, const char *blob_path,
+        const char *out_path, bool is_first) {
+
+    if (!read_cert_secret(blob_path, &ctx.credential_blob, &ctx.secret)) {
+        return false;
+    }
+
+    /* the session given with -P is satisfied for the first credential */
+    if (!is_first && credential_key_restart(ectx) != tool_rc_success) {
+        return false;
+    }
+
+    ctx.cert_info_data = NULL;
+    tool_rc rc = activate_credential_and_output(ectx);
+    if (rc != tool_rc_success) {
+        return false;
+    }
+
+    bool result = files_save_bytes_to_file(out_path,
+            ctx.cert_info_data->buffer, ctx.cert_info_data->size);
+    free(ctx.cert_info_data);
+    ctx.cert_info_data = NULL;
+
+    return result;
+}
+
+/*
+ * Activates the credentials of a manifest, a "<credential-blob>
+ * <certinfo-data>" line per credential, with the EK and AK loaded once and the
+ * EK policy session reused.
+ */
+typedef struct manifest_run_state manifest_run_state;
+struct manifest_run_state {
+    ESYS_CONTEXT *ectx;
+    bool is_first;
+    tool_rc rc;
+};
+
+static bool manifest_line(void *entry, char *line, char **fields,
+        size_t count, size_t line_number, void *userdata) {
+
+    UNUSED(entry);
+    UNUSED(count);
+
+    manifest_run_state *state = (manifest_run_state *) userdata;
+    const char *blob_path = fields[0];
+    const char *out_path = fields[1];
+
+    /* a failed credential does not stop the others */
+    bool is_activated = manifest_activate_one(state->ectx, blob_path,
+            out_path, state->is_first);
+    state->is_first = false;
+
+    tpm2_tool_output("- line: %zu\n", line_number);
+    tpm2_tool_output("  credential-blob: %s\n", blob_path);
+    tpm2_tool_output("  activated: %s\n",
+            is_activated ? "true" : "false");
+    tpm2_tool_output_flush();
+
+    if (!is_activated) {
+        LOG_ERR("%s:%zu: Could not activate credential \"%s\"",
+                ctx.manifest_path, line_number, blob_path);
+        state->rc = tool_rc_general_error;
+    }
+
+    free(line);
+
+    return true;
+}
+
+static tool_rc manifest_run(ESYS_CONTEXT *ectx) {
+
+    manifest_run_state state = {
+        .ectx = ectx,
+        .is_first = true,
+        .rc = tool_rc_success,
+    };
+
+    bool result = tpm2_util_manifest_read(ctx.manifest_path, 2, 2,
+            "<credential-blob> <certinfo-data>", NULL, NULL, 0,
+            manifest_line, &state);
+
+    return result ? state.rc : tool_rc_general_error;
+}
+
 static bool on_option(char key, char *value) {
 
     switch (key) {
@@ -291,6 +457,12 @@ static bool on_option(char key, char *value) {
     case 1:
         ctx.rp_hash_path = value;
         break;
+    case 2:
+        ctx.manifest_path = value;
+        break;
+    case 3:
+        ctx.endorsement.auth_str = value;
+        break;
     case 'S':
         ctx.aux_session_path[ctx.aux_session_cnt] = value;
         if (ctx.aux_session_cnt < MAX_AUX_SESSIONS) {
@@ -317,6 +489,8 @@ static bool tpm2_tool_onstart(tpm2_options **opts) {
          {"cphash",                  required_argument, NULL,  0 },
          {"rphash",                  required_argument, NULL,  1 },
          {"session",                required_argument, NULL, 'S' },
+         {"manifest",                required_argument, NULL,  2 },
+         {"eh-auth",                 required_argument, NULL,  3 },
     };
 
     *opts = tpm2_options_new("c:C:p:P:i:o:S:", ARRAY_LEN(topts), topts, on_option,
@@ -346,6 +520,10 @@ static tool_rc tpm2_tool_onrun(ESYS_CONTEXT *ectx, tpm2_option_flags flags) {
         return rc;
     }
 
+    if (ctx.manifest_path) {
+        return manifest_run(ectx);
+    }
+
     /*
      * 3. TPM2_CC_<command> call
      */
@@ -382,6 +560,13 @@ static tool_rc tpm2_tool_onstop(ESYS_CONTEXT *ectx) {
         rc = tmp_rc;
     }
 
+    if (ctx.endorsement.is_loaded) {
+        tmp_rc = tpm2_session_close(&ctx.endorsement.object.session);
+        if (tmp_rc != tool_rc_success) {
+            rc = tmp_rc;
+        }
+    }
+
     /*
      * 3. Close auxiliary sessions
      */
@@ -0,0 +1,203 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include "files.h"
+#include "log.h"
+#include "object.h"
+#include "pcr.h"
+#include "tpm2_name_cache.h"
+#include "tpm2_session.h"
+#include "tpm2_tool.h"
+
+typedef struct tpm2_batch_ctx tpm2_batch_ctx;
+struct tpm2_batch_ctx {
+    const char *input_path;
+    bool keep_going;
+};
+
+static tpm2_batch_ctx ctx;
+
+/*
+ * Each command runs in a forked child that inherits the already initialized
+ * TCTI and ESAPI context. This gives every tool pristine static state, as if
+ * it was started as a new process, without paying for TCTI loading, ESAPI
+ * and OpenSSL initialization or exec.
+ */
+static tool_rc run_command(ESYS_CONTEXT *ectx, int argc, char **argv) {
+
+    /* flush anything pending so the child doesn't emit it twice */
+    tpm2_tool_output_flush();
+    log_flush();
+    fflush(stderr);
+
+    pid_t pid = fork();
+    if (pid < 0) {
+        LOG_ERR("Could not fork process to run \"%s\", error: %s", argv[0],
+                strerror(errno));
+        return tool_rc_general_error;
+    }
+
+    if (pid == 0) {
+        tool_rc rc = tpm2_tool_dispatch(argc, argv, ectx);
+        tpm2_tool_output_flush();
+        fflush(stderr);
+        /*
+         * Skip the atexit handlers, they would finalize the TCTI which is
+         * still in use by the parent.
+         */
+        _exit(rc);
+    }
+
+    int status;
+    if (waitpid(pid, &status, 0) == -1) {
+        LOG_ERR("Waiting for \"%s\" failed, error: %s", argv[0],
+                strerror(errno));
+        return tool_rc_general_error;
+    }
+
+    /* the session files of the sessions the command kept loaded */
+    tpm2_session_pool_adopt();
+
+    if (!WIFEXITED(status)) {
+        LOG_ERR("\"%s\" terminated abnormally", argv[0]);
+        return tool_rc_general_error;
+    }
+
+    return (tool_rc) WEXITSTATUS(status);
+}
+
+static tool_rc run_batch(ESYS_CONTEXT *ectx, FILE *input) {
+
+    tool_rc rc = tool_rc_success;
+    char *line = NULL;
+    size_t line_size = 0;
+    size_t lineno = 0;
+
+    while (getline(&line, &line_size, input) != -1) {
+        lineno++;
+
+        int argc = 0;
+        char **argv = NULL;
+        bool result = tpm2_util_split_args(line, &argc, &argv);
+        if (!result) {
+            LOG_ERR("Could not parse line %zu", lineno);
+            rc = tool_rc_general_error;
+            break;
+        }
+
+        /* blank line or comment */
+        if (!argc) {
+            free(argv);
+            continue;
+        }
+
+        tool_rc tmp_rc = run_command(ectx, argc, argv);
+        if (tmp_rc != tool_rc_success) {
+            LOG_ERR("Line %zu: \"%s\" failed with: %d", lineno, argv[0],
+                    tmp_rc);
+            if (rc == tool_rc_success) {
+                rc = tmp_rc;
+            }
+        }
+        free(argv);
+
+        if (rc != tool_rc_success && !ctx.keep_going) {
+            break;
+        }
+    }
+
+    if (ferror(input)) {
+        LOG_ERR("Error reading batch input, error: %s", strerror(errno));
+        rc = tool_rc_general_error;
+    }
+
+    free(line);
+
+    return rc;
+}
+
+static bool on_option(char key, char *value) {
+
+    UNUSED(value);
+
+    switch (key) {
+    case 'k':
+        ctx.keep_going = true;
+        break;
+        /* no default */
+    }
+
+    return true;
+}
+
+static bool on_args(int argc, char **argv) {
+
+    if (argc > 1) {
+        LOG_ERR("Expected at most one batch file, got: %d", argc);
+        return false;
+    }
+
+    ctx.input_path = argv[0];
+
+    return true;
+}
+
+static bool tpm2_tool_onstart(tpm2_options **opts) {
+
+    static struct option topts[] = {
+        { "keep-going", no_argument, NULL, 'k' },
+    };
+
+    *opts = tpm2_options_new("k", ARRAY_LEN(topts), topts, on_option, on_args,
+            0);
+
+    return *opts != NULL;
+}
+
+static tool_rc tpm2_tool_onrun(ESYS_CONTEXT *ectx, tpm2_option_flags flags) {
+
+    UNUSED(flags);
+
+    FILE *input = stdin;
+    if (ctx.input_path && strcmp(ctx.input_path, "-")) {
+        input = files_fopen(ctx.input_path, "rb");
+        if (!input) {
+            LOG_ERR("Could not open batch file \"%s\", error: %s",
+                    ctx.input_path, strerror(errno));
+            return tool_rc_general_error;
+        }
+    }
+
+    tool_rc rc = tpm2_session_pool_init();
+    if (rc == tool_rc_success) {
+        rc = tpm2_object_cache_init();
+        if (rc == tool_rc_success) {
+            rc = pcr_cache_init();
+            if (rc == tool_rc_success) {
+                rc = run_batch(ectx, input);
+                pcr_cache_free();
+            }
+            tpm2_object_cache_free(ectx);
+        }
+        tpm2_session_pool_free(ectx);
+    }
+
+    tpm2_name_cache_save_snapshot(ectx);
+
+    if (input != stdin) {
+        fclose(input);
+    }
+
+    return rc;
+}
+
+// Register this tool with tpm2_tool.c
+TPM2_TOOL_REGISTER("batch", tpm2_tool_onstart, tpm2_tool_onrun, NULL, NULL)
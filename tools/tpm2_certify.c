@@ -1,6 +1,7 @@
 /* SPDX-License-Identifier: BSD-3-Clause */
 
 #include <stdlib.h>
+#include <string.h>
 
 #include "files.h"
 #include "log.h"
@@ -13,6 +14,8 @@
 typedef struct tpm_certify_ctx tpm_certify_ctx;
 #define MAX_AUX_SESSIONS 1 // two sessions provided by auth interface
 #define MAX_SESSIONS 3
+/* certified object, qualification, attestation and signature */
+#define MANIFEST_FIELDS 4
 struct tpm_certify_ctx {
     /*
      * Inputs
@@ -53,6 +56,8 @@ struct tpm_certify_ctx {
     bool is_command_dispatch;
     TPMI_ALG_HASH parameter_hash_algorithm;
 
+    const char *manifest_path;
+
     /*
      * Aux sessions
      */
@@ -68,12 +73,14 @@ static tpm_certify_ctx ctx = {
     .parameter_hash_algorithm = TPM2_ALG_ERROR,
 };
 
+static const TPM2B_DATA default_qualifying_data = {
+    .size = 4,
+    .buffer = { 0x00, 0xff, 0x55,0xaa },
+};
+
 static tool_rc certify(ESYS_CONTEXT *ectx) {
 
-    TPM2B_DATA qualifying_data = {
-        .size = 4,
-        .buffer = { 0x00, 0xff, 0x55,0xaa },
-    };
+    TPM2B_DATA qualifying_data = default_qualifying_data;
 
     /*
      * 1. TPM2_CC_<command> OR Retrieve cpHash
@@ -258,8 +265,226 @@ static tool_rc process_inputs(ESYS_CONTEXT *ectx) {
     return rc;
 }
 
+/*
+ * A certification of a manifest. The paths point into the manifest line.
+ */
+typedef struct manifest_entry manifest_entry;
+struct manifest_entry {
+    char *line;
+    size_t line_number;
+    const char *object_path;
+    TPM2B_DATA qualifying_data;
+    const char *attest_path;
+    const char *sig_path;
+};
+
+typedef struct manifest manifest;
+struct manifest {
+    manifest_entry *entries;
+    size_t count;
+};
+
+/* the object of an entry, loaded while the TPM certifies it */
+typedef struct certify_job certify_job;
+struct certify_job {
+    tpm2_loaded_object object;
+    bool is_sent;
+};
+
+static bool manifest_add(void *e, char *line, char **fields, size_t count,
+        size_t line_number, void *userdata) {
+
+    UNUSED(count);
+    UNUSED(userdata);
+
+    manifest_entry *entry = (manifest_entry *) e;
+    entry->line = line;
+    entry->line_number = line_number;
+    entry->object_path = fields[0];
+    entry->attest_path = fields[2];
+    entry->sig_path = fields[3];
+
+    /* the qualification of a single certification without one */
+    entry->qualifying_data = default_qualifying_data;
+    if (strcmp(fields[1], "-")) {
+        entry->qualifying_data.size = sizeof(entry->qualifying_data.buffer);
+        if (!tpm2_util_bin_from_hex_or_file(fields[1],
+                &entry->qualifying_data.size,
+                entry->qualifying_data.buffer)) {
+            LOG_ERR("%s:%zu: Invalid qualification \"%s\"",
+                    ctx.manifest_path, line_number, fields[1]);
+            return false;
+        }
+    }
+
+    return true;
+}
+
+static bool manifest_load(manifest *m) {
+
+    return tpm2_util_manifest_read(ctx.manifest_path, MANIFEST_FIELDS,
+            MANIFEST_FIELDS,
+            "<object> <qualification> <attestation> <signature>",
+            (void **) &m->entries, &m->count, sizeof(*m->entries),
+            manifest_add, NULL);
+}
+
+static void manifest_free(manifest *m) {
+
+    size_t i;
+    for (i = 0; i < m->count; i++) {
+        free(m->entries[i].line);
+    }
+    free(m->entries);
+}
+
+/*
+ * Loads the object of the entry and sends its certification. Every object is
+ * authorized with the certified key auth, which is restricted to a password,
+ * as a policy session would need satisfying again for each one.
+ */
+static void manifest_send(ESYS_CONTEXT *ectx, manifest_entry *entry,
+        certify_job *job) {
+
+    memset(job, 0, sizeof(*job));
+    job->object.tr_handle = ESYS_TR_NONE;
+
+    tool_rc rc = tpm2_util_object_load_auth(ectx, entry->object_path,
+            ctx.certified_key.auth_str, &job->object, true,
+            TPM2_HANDLE_ALL_W_NV);
+    if (rc != tool_rc_success) {
+        LOG_ERR("%s:%zu: Could not load object \"%s\"", ctx.manifest_path,
+                entry->line_number, entry->object_path);
+        return;
+    }
+
+    job->is_sent = tpm2_certify_async(ectx, &job->object,
+            &ctx.signing_key.object, &entry->qualifying_data, &ctx.scheme,
+            ctx.aux_session_handle[0]) == tool_rc_success;
+}
+
+static void manifest_release(ESYS_CONTEXT *ectx, certify_job *job) {
+
+    tpm2_session_close(&job->object.session);
+    tpm2_util_object_unload(ectx, &job->object);
+}
+
+/*
+ * Certifies every object of the manifest with the loaded signing key. An
+ * object is released as soon as it is certified and the next one is sent
+ * before the outputs of the previous one are written, so the TPM neither
+ * runs out of object slots nor waits on the file system.
+ */
+static tool_rc manifest_certify_all(ESYS_CONTEXT *ectx, manifest *m) {
+
+    certify_job jobs[2];
+    certify_job *cur = &jobs[0];
+    certify_job *next = &jobs[1];
+
+    manifest_send(ectx, &m->entries[0], cur);
+
+    tool_rc rc = tool_rc_success;
+    size_t i;
+    for (i = 0; i < m->count; i++) {
+        manifest_entry *entry = &m->entries[i];
+
+        TPM2B_ATTEST *certify_info = NULL;
+        TPMT_SIGNATURE *signature = NULL;
+        bool is_certified = cur->is_sent && tpm2_certify_finish(ectx,
+                &certify_info, &signature) == tool_rc_success;
+        manifest_release(ectx, cur);
+
+        if (i + 1 < m->count) {
+            manifest_send(ectx, &m->entries[i + 1], next);
+        }
+
+        if (is_certified) {
+            is_certified = files_save_bytes_to_file(entry->attest_path,
+                    certify_info->attestationData, certify_info->size)
+                && tpm2_convert_sig_save(signature, ctx.sig_fmt,
+                    entry->sig_path);
+        }
+        free(certify_info);
+        free(signature);
+
+        tpm2_tool_output("- line: %zu\n", entry->line_number);
+        tpm2_tool_output("  attestation: %s\n", entry->attest_path);
+        tpm2_tool_output("  certified: %s\n",
+                is_certified ? "true" : "false");
+        tpm2_tool_output_flush();
+
+        if (!is_certified) {
+            rc = tool_rc_general_error;
+        }
+
+        certify_job *tmp = cur;
+        cur = next;
+        next = tmp;
+    }
+
+    return rc;
+}
+
+static tool_rc manifest_run(ESYS_CONTEXT *ectx) {
+
+    tool_rc rc = tpm2_util_object_load_auth(ectx, ctx.signing_key.ctx_path,
+        ctx.signing_key.auth_str, &ctx.signing_key.object, false,
+        TPM2_HANDLE_ALL_W_NV);
+    if (rc != tool_rc_success) {
+        return rc;
+    }
+
+    if (ctx.signing_key.object.session && tpm2_session_get_type(
+            ctx.signing_key.object.session) == TPM2_SE_POLICY) {
+        LOG_ERR("A manifest cannot satisfy a policy session for every "
+                "certification");
+        return tool_rc_option_error;
+    }
+
+    rc = tpm2_util_aux_sessions_setup(ectx, ctx.aux_session_cnt,
+        ctx.aux_session_path, ctx.aux_session_handle, ctx.aux_session);
+    if (rc != tool_rc_success) {
+        return rc;
+    }
+
+    rc = set_scheme(ectx, ctx.signing_key.object.tr_handle, ctx.halg,
+        &ctx.scheme);
+    if (rc != tool_rc_success) {
+        LOG_ERR("No suitable signing scheme!");
+        return rc;
+    }
+
+    manifest m = { 0 };
+    if (!manifest_load(&m)) {
+        rc = tool_rc_general_error;
+    } else if (m.count) {
+        rc = manifest_certify_all(ectx, &m);
+    }
+
+    manifest_free(&m);
+
+    return rc;
+}
+
 static tool_rc check_options(void) {
 
+    if (ctx.manifest_path) {
+        if (!ctx.signing_key.ctx_path) {
+            LOG_ERR("Must specify the signing key.");
+            return tool_rc_option_error;
+        }
+
+        if (ctx.certified_key.ctx_path || ctx.file_path.attest
+                || ctx.file_path.sig || ctx.cp_hash_path
+                || ctx.rp_hash_path) {
+            LOG_ERR("The manifest names the objects and outputs, cannot "
+                    "specify -c, -o, -s, --cphash or --rphash");
+            return tool_rc_option_error;
+        }
+
+        return tool_rc_success;
+    }
+
     if ((!ctx.certified_key.ctx_path) && (!ctx.signing_key.ctx_path)) {
         LOG_ERR("Must specify the object to be certified and the signing key.");
         return tool_rc_option_error;
@@ -308,6 +533,9 @@ static bool on_option(char key, char *value) {
     case 1:
         ctx.rp_hash_path = value;
         break;
+    case 2:
+        ctx.manifest_path = value;
+        break;
     case 'f':
         ctx.sig_fmt = tpm2_convert_sig_fmt_from_optarg(value);
         if (ctx.sig_fmt == signature_format_err) {
@@ -342,6 +570,7 @@ static bool tpm2_tool_onstart(tpm2_options **opts) {
       { "cphash",               required_argument, NULL,  0  },
       { "rphash",               required_argument, NULL,  1  },
       { "session",              required_argument, NULL, 'S' },
+      { "manifest",             required_argument, NULL,  2  },
     };
 
     *opts = tpm2_options_new("P:p:g:o:s:c:C:f:S:", ARRAY_LEN(topts), topts,
@@ -362,6 +591,10 @@ static tool_rc tpm2_tool_onrun(ESYS_CONTEXT *ectx, tpm2_option_flags flags) {
         return rc;
     }
 
+    if (ctx.manifest_path) {
+        return manifest_run(ectx);
+    }
+
     /*
      * 2. Process inputs
      */
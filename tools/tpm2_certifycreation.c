@@ -3,6 +3,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdbool.h>
+#include <string.h>
 
 #include "files.h"
 #include "log.h"
@@ -14,6 +15,7 @@
 
 #define MAX_AUX_SESSIONS 2 // one session provided by auth interface
 #define MAX_SESSIONS 3
+#define MANIFEST_FIELDS 5
 typedef struct tpm_certifycreation_ctx tpm_certifycreation_ctx;
 struct tpm_certifycreation_ctx {
     /*
@@ -70,6 +72,11 @@ struct tpm_certifycreation_ctx {
     tpm2_session *aux_session[MAX_AUX_SESSIONS];
     const char *aux_session_path[MAX_AUX_SESSIONS];
     ESYS_TR aux_session_handle[MAX_AUX_SESSIONS];
+
+    /*
+     * Manifest
+     */
+    const char *manifest_path;
 };
 
 static tpm_certifycreation_ctx ctx = {
@@ -247,8 +254,162 @@ static tool_rc process_inputs(ESYS_CONTEXT *ectx) {
     return rc;
 }
 
+/*
+ * Certifies the creation of the object of a manifest line, which is loaded
+ * for the certification only.
+ */
+static bool manifest_certify(ESYS_CONTEXT *ectx, char **fields) {
+
+    const char *object_path = fields[0];
+    const char *attest_path = fields[3];
+    const char *sig_path = fields[4];
+
+    TPM2B_DIGEST creation_hash = { .size = 0 };
+    TPMT_TK_CREATION creation_ticket = { 0 };
+    bool result = files_load_digest(fields[1], &creation_hash)
+            && files_load_creation_ticket(fields[2], &creation_ticket);
+    if (!result) {
+        return false;
+    }
+
+    tpm2_loaded_object object = { .tr_handle = ESYS_TR_NONE };
+    tool_rc rc = tpm2_util_object_load(ectx, object_path, &object,
+        TPM2_HANDLES_FLAGS_TRANSIENT|TPM2_HANDLES_FLAGS_PERSISTENT);
+    if (rc != tool_rc_success) {
+        return false;
+    }
+
+    TPM2B_DIGEST cp_hash = { .size = 0 };
+    TPM2B_DIGEST rp_hash = { .size = 0 };
+    TPM2B_ATTEST *certify_info = NULL;
+    TPMT_SIGNATURE *signature = NULL;
+    rc = tpm2_certifycreation(ectx, &ctx.signing_key.object, &object,
+        &creation_hash, &ctx.in_scheme, &creation_ticket, &certify_info,
+        &signature, &ctx.policy_qualifier, &cp_hash, &rp_hash,
+        TPM2_ALG_ERROR, ctx.aux_session_handle[0], ctx.aux_session_handle[1]);
+
+    result = rc == tool_rc_success
+        && files_save_bytes_to_file(attest_path,
+            certify_info->attestationData, certify_info->size)
+        && tpm2_convert_sig_save(signature, ctx.sig_format, sig_path);
+
+    Esys_Free(certify_info);
+    Esys_Free(signature);
+
+    return tpm2_util_object_unload(ectx, &object) == tool_rc_success
+        && result;
+}
+
+typedef struct manifest_run_state manifest_run_state;
+struct manifest_run_state {
+    ESYS_CONTEXT *ectx;
+    tool_rc rc;
+};
+
+static bool manifest_line(void *entry, char *line, char **fields,
+        size_t count, size_t line_number, void *userdata) {
+
+    UNUSED(entry);
+    UNUSED(count);
+
+    manifest_run_state *state = (manifest_run_state *) userdata;
+
+    bool is_certified = manifest_certify(state->ectx, fields);
+
+    tpm2_tool_output("- line: %zu\n", line_number);
+    tpm2_tool_output("  attestation: %s\n", fields[3]);
+    tpm2_tool_output("  certified: %s\n", is_certified ? "true" : "false");
+    tpm2_tool_output_flush();
+
+    if (!is_certified) {
+        state->rc = tool_rc_general_error;
+    }
+
+    free(line);
+
+    return true;
+}
+
+/*
+ * Certifies the creation of every object of the manifest with one load and
+ * authorization of the signing key and one signature scheme.
+ */
+static tool_rc manifest_run(ESYS_CONTEXT *ectx) {
+
+    tool_rc rc = tpm2_util_object_load_auth(ectx, ctx.signing_key.ctx_path,
+        ctx.signing_key.auth_str, &ctx.signing_key.object, false,
+        TPM2_HANDLES_FLAGS_TRANSIENT|TPM2_HANDLES_FLAGS_PERSISTENT);
+    if (rc != tool_rc_success) {
+        LOG_ERR("Invalid signing key/ authorization.");
+        return rc;
+    }
+
+    if (ctx.signing_key.object.session && tpm2_session_get_type(
+            ctx.signing_key.object.session) == TPM2_SE_POLICY) {
+        LOG_ERR("A manifest cannot satisfy a policy session for every "
+                "certification");
+        return tool_rc_option_error;
+    }
+
+    rc = tpm2_util_aux_sessions_setup(ectx, ctx.aux_session_cnt,
+        ctx.aux_session_path, ctx.aux_session_handle, ctx.aux_session);
+    if (rc != tool_rc_success) {
+        return rc;
+    }
+
+    rc = tpm2_alg_util_get_signature_scheme(ectx,
+        ctx.signing_key.object.tr_handle, &ctx.halg, ctx.sig_scheme,
+        &ctx.in_scheme);
+    if (rc != tool_rc_success) {
+        LOG_ERR("bad signature scheme for key type!");
+        return rc;
+    }
+
+    if (ctx.policy_qualifier_data) {
+        ctx.policy_qualifier.size = sizeof(ctx.policy_qualifier.buffer);
+        bool result = tpm2_util_bin_from_hex_or_file(
+            ctx.policy_qualifier_data, &ctx.policy_qualifier.size,
+            ctx.policy_qualifier.buffer);
+        if (!result) {
+            LOG_ERR("Could not load qualifier data");
+            return tool_rc_general_error;
+        }
+    }
+
+    manifest_run_state state = {
+        .ectx = ectx,
+        .rc = tool_rc_success,
+    };
+
+    bool result = tpm2_util_manifest_read(ctx.manifest_path, MANIFEST_FIELDS,
+            MANIFEST_FIELDS,
+            "<object> <creation-hash> <ticket> <attestation> <signature>",
+            NULL, NULL, 0, manifest_line, &state);
+
+    return result ? state.rc : tool_rc_general_error;
+}
+
 static bool check_options(void) {
 
+    if (ctx.manifest_path) {
+        if (ctx.certified_key.ctx_path || ctx.creation_hash_path
+                || ctx.creation_ticket_path || ctx.signature_path
+                || ctx.certify_info_path || ctx.cp_hash_path
+                || ctx.rp_hash_path) {
+            LOG_ERR("The manifest names the objects and outputs, cannot "
+                    "specify -c, -d, -t, -o, --attestation, --cphash or "
+                    "--rphash");
+            return false;
+        }
+
+        if (!ctx.signing_key.ctx_path) {
+            LOG_ERR("Must specify the signing key '-C'.");
+            return false;
+        }
+
+        return true;
+    }
+
     if (ctx.cp_hash_path && !ctx.rp_hash_path &&
         (ctx.certify_info_path || ctx.signature_path)) {
         LOG_ERR("Cannot generate outputs when calculating cpHash.");
@@ -354,6 +515,9 @@ static bool on_option(char key, char *value) {
     case 2:
         ctx.rp_hash_path = value;
         break;
+    case 3:
+        ctx.manifest_path = value;
+        break;
     case 'q':
         ctx.policy_qualifier_data = value;
         break;
@@ -390,6 +554,7 @@ static bool tpm2_tool_onstart(tpm2_options **opts) {
       { "cphash",               required_argument, NULL,  1  },
       { "rphash",               required_argument, NULL,  2  },
       { "session",              required_argument, NULL, 'S' },
+      { "manifest",             required_argument, NULL,  3  },
     };
 
     *opts = tpm2_options_new("C:P:c:d:t:g:s:f:o:q:S:", ARRAY_LEN(topts), topts,
@@ -410,6 +575,10 @@ static tool_rc tpm2_tool_onrun(ESYS_CONTEXT *ectx, tpm2_option_flags flags) {
         return tool_rc_option_error;
     }
 
+    if (ctx.manifest_path) {
+        return manifest_run(ectx);
+    }
+
    /*
      * 2. Process inputs
      */
@@ -1,6 +1,7 @@
 /* SPDX-License-Identifier: BSD-3-Clause */
 
 #include <stdlib.h>
+#include <string.h>
 
 #include "files.h"
 #include "log.h"
@@ -12,6 +13,8 @@
 typedef struct changeauth_ctx changeauth_ctx;
 #define MAX_SESSIONS 3
 #define MAX_AUX_SESSIONS 2 // It's possible that parent auth may not be needed
+#define MANIFEST_FIELDS_MIN 4
+#define MANIFEST_FIELDS_MAX 5
 struct changeauth_ctx {
     /*
      * Inputs
@@ -53,6 +56,8 @@ struct changeauth_ctx {
     tpm2_session *aux_session[MAX_AUX_SESSIONS];
     const char *aux_session_path[MAX_AUX_SESSIONS];
     ESYS_TR aux_session_handle[MAX_AUX_SESSIONS];
+
+    const char *manifest_path;
 };
 
 static changeauth_ctx ctx = {
@@ -61,6 +66,33 @@ static changeauth_ctx ctx = {
     .aux_session_handle[1] = ESYS_TR_NONE,
 };
 
+typedef struct manifest_entry manifest_entry;
+struct manifest_entry {
+    char *line;
+    size_t line_number;
+    const char *ctx_path;
+    /* NULL for "-", for objects without a parent */
+    const char *parent_path;
+    const char *auth_current;
+    const char *auth_new;
+    const char *out_path;
+};
+
+/* the parents are loaded once, for all the objects under them */
+typedef struct manifest_parent manifest_parent;
+struct manifest_parent {
+    const char *path;
+    tpm2_loaded_object obj;
+};
+
+typedef struct manifest manifest;
+struct manifest {
+    manifest_entry *entries;
+    size_t count;
+    manifest_parent *parents;
+    size_t parent_count;
+};
+
 static tool_rc hierarchy_change_auth(ESYS_CONTEXT *ectx) {
 
     return tpm2_hierarchy_change_auth(ectx, &ctx.object.obj, ctx.new_auth,
@@ -308,6 +340,9 @@ static bool on_option(char key, char *value) {
     case 1:
         ctx.rp_hash_path = value;
         break;
+    case 2:
+        ctx.manifest_path = value;
+        break;
     case 'S':
         ctx.aux_session_path[ctx.aux_session_cnt] = value;
         if (ctx.aux_session_cnt < MAX_AUX_SESSIONS) {
@@ -333,6 +368,7 @@ static bool tpm2_tool_onstart(tpm2_options **opts) {
         { "cphash",         required_argument, NULL,  0  },
         { "rphash",         required_argument, NULL,  1  },
         { "session",        required_argument, NULL, 'S' },
+        { "manifest",       required_argument, NULL,  2  },
     };
     *opts = tpm2_options_new("p:c:C:r:S:", ARRAY_LEN(topts), topts,
                              on_option, on_arg, 0);
@@ -340,10 +376,228 @@ static bool tpm2_tool_onstart(tpm2_options **opts) {
     return *opts != NULL;
 }
 
+/* "-" stands for an empty or absent field */
+static const char *manifest_field(const char *field) {
+
+    return strcmp(field, "-") ? field : NULL;
+}
+
+static bool manifest_add(void *e, char *line, char **fields, size_t count,
+        size_t line_number, void *userdata) {
+
+    UNUSED(userdata);
+
+    manifest_entry *entry = (manifest_entry *) e;
+    entry->line = line;
+    entry->line_number = line_number;
+    entry->ctx_path = fields[0];
+    entry->parent_path = manifest_field(fields[1]);
+    entry->auth_current = manifest_field(fields[2]);
+    entry->auth_new = manifest_field(fields[3]);
+    entry->out_path = count == MANIFEST_FIELDS_MAX ? fields[4] : NULL;
+
+    return true;
+}
+
+static bool manifest_load(manifest *m) {
+
+    return tpm2_util_manifest_read(ctx.manifest_path, MANIFEST_FIELDS_MIN,
+            MANIFEST_FIELDS_MAX,
+            "<object> <parent>|- <old-auth>|- <new-auth>|- [<private>]",
+            (void **) &m->entries, &m->count, sizeof(*m->entries),
+            manifest_add, NULL);
+}
+
+static tool_rc manifest_free(ESYS_CONTEXT *ectx, manifest *m) {
+
+    tool_rc rc = tool_rc_success;
+    size_t i;
+    for (i = 0; i < m->parent_count; i++) {
+        tool_rc tmp_rc = tpm2_util_object_unload(ectx, &m->parents[i].obj);
+        if (tmp_rc != tool_rc_success) {
+            rc = tmp_rc;
+        }
+    }
+    free(m->parents);
+
+    for (i = 0; i < m->count; i++) {
+        free(m->entries[i].line);
+    }
+    free(m->entries);
+
+    return rc;
+}
+
+static tpm2_loaded_object *manifest_parent_get(ESYS_CONTEXT *ectx,
+        manifest *m, const char *path) {
+
+    size_t i;
+    for (i = 0; i < m->parent_count; i++) {
+        if (!strcmp(m->parents[i].path, path)) {
+            return &m->parents[i].obj;
+        }
+    }
+
+    manifest_parent *parents = realloc(m->parents,
+            (m->parent_count + 1) * sizeof(*parents));
+    if (!parents) {
+        LOG_ERR("oom");
+        return NULL;
+    }
+    m->parents = parents;
+
+    manifest_parent *parent = &m->parents[m->parent_count];
+    memset(parent, 0, sizeof(*parent));
+    parent->path = path;
+
+    tool_rc rc = tpm2_util_object_load(ectx, path, &parent->obj,
+            TPM2_HANDLE_ALL_W_NV);
+    if (rc != tool_rc_success) {
+        return NULL;
+    }
+    m->parent_count++;
+
+    return &parent->obj;
+}
+
+static bool manifest_change_one(ESYS_CONTEXT *ectx, manifest *m,
+        manifest_entry *entry) {
+
+    tpm2_session *new_session = NULL;
+    tool_rc rc = tpm2_auth_util_from_optarg(ectx, entry->auth_new,
+            &new_session, true);
+    if (rc != tool_rc_success) {
+        return false;
+    }
+    const TPM2B_AUTH *new_auth = tpm2_session_get_auth_value(new_session);
+
+    bool result = false;
+    tpm2_loaded_object object = { 0 };
+    rc = tpm2_util_object_load_auth(ectx, entry->ctx_path,
+            entry->auth_current, &object, false, TPM2_HANDLE_ALL_W_NV);
+    if (rc != tool_rc_success) {
+        goto out_new;
+    }
+
+    if (object.tr_handle == ESYS_TR_RH_NULL) {
+        LOG_ERR("Cannot change the null hierarchy authorization");
+        goto out;
+    }
+
+    /* no parameter hashes are calculated for the entries */
+    TPM2B_DIGEST cp_hash = { 0 };
+    TPM2B_DIGEST rp_hash = { 0 };
+
+    if (object_needs_parent(&object)) {
+        if (!entry->parent_path || !entry->out_path) {
+            LOG_ERR("An object needs a parent and a private output");
+            goto out;
+        }
+
+        tpm2_loaded_object *parent = manifest_parent_get(ectx, m,
+                entry->parent_path);
+        if (!parent) {
+            goto out;
+        }
+
+        TPM2B_PRIVATE *out_private = NULL;
+        rc = tpm2_object_change_auth(ectx, parent, &object, new_auth,
+                &out_private, &cp_hash, &rp_hash, TPM2_ALG_ERROR,
+                ctx.aux_session_handle[0], ctx.aux_session_handle[1]);
+        if (rc == tool_rc_success) {
+            result = files_save_private(out_private, entry->out_path);
+        }
+        free(out_private);
+        goto out;
+    }
+
+    UINT8 tag = (object.handle & TPM2_HR_RANGE_MASK) >> TPM2_HR_SHIFT;
+    switch (tag) {
+    case TPM2_HT_NV_INDEX:
+        rc = tpm2_nv_change_auth(ectx, &object, new_auth, &cp_hash, &rp_hash,
+                TPM2_ALG_ERROR, ctx.aux_session_handle[0],
+                ctx.aux_session_handle[1]);
+        break;
+    case TPM2_HT_PERMANENT:
+        rc = tpm2_hierarchy_change_auth(ectx, &object, new_auth, &cp_hash,
+                &rp_hash, TPM2_ALG_ERROR, ctx.aux_session_handle[0],
+                ctx.aux_session_handle[1]);
+        break;
+    default:
+        LOG_ERR("Unsupported object type, got: 0x%x", tag);
+        rc = tool_rc_general_error;
+    }
+    result = rc == tool_rc_success;
+
+out:
+    /* a loaded context is flushed, the auth change is in the new private */
+    rc = tpm2_util_object_unload(ectx, &object);
+    result &= rc == tool_rc_success;
+    rc = tpm2_session_close(&object.session);
+    result &= rc == tool_rc_success;
+out_new:
+    tpm2_session_close(&new_session);
+
+    return result;
+}
+
+static tool_rc manifest_run(ESYS_CONTEXT *ectx) {
+
+    if (ctx.object.ctx || ctx.parent.ctx || ctx.object.auth_current
+            || ctx.object.auth_new || ctx.object.out_path || ctx.cp_hash_path
+            || ctx.rp_hash_path) {
+        LOG_ERR("The manifest names the objects, auths and outputs, cannot "
+                "specify -c, -C, -p, -r, a new auth, --cphash or --rphash");
+        return tool_rc_option_error;
+    }
+
+    /* the auxiliary sessions are shared by all the entries */
+    tool_rc rc = tpm2_util_aux_sessions_setup(ectx, ctx.aux_session_cnt,
+        ctx.aux_session_path, ctx.aux_session_handle, ctx.aux_session);
+    if (rc != tool_rc_success) {
+        return rc;
+    }
+
+    manifest m = { 0 };
+    if (!manifest_load(&m)) {
+        manifest_free(ectx, &m);
+        return tool_rc_general_error;
+    }
+
+    size_t i;
+    for (i = 0; i < m.count; i++) {
+        manifest_entry *entry = &m.entries[i];
+
+        bool is_changed = manifest_change_one(ectx, &m, entry);
+
+        tpm2_tool_output("- line: %zu\n", entry->line_number);
+        tpm2_tool_output("  object: %s\n", entry->ctx_path);
+        tpm2_tool_output("  changed: %s\n", is_changed ? "true" : "false");
+        tpm2_tool_output_flush();
+
+        if (!is_changed) {
+            LOG_ERR("%s:%zu: Could not change the auth of \"%s\"",
+                    ctx.manifest_path, entry->line_number, entry->ctx_path);
+            rc = tool_rc_general_error;
+        }
+    }
+
+    tool_rc tmp_rc = manifest_free(ectx, &m);
+    if (tmp_rc != tool_rc_success) {
+        rc = tmp_rc;
+    }
+
+    return rc;
+}
+
 static tool_rc tpm2_tool_onrun(ESYS_CONTEXT *ectx, tpm2_option_flags flags) {
 
     UNUSED(flags);
 
+    if (ctx.manifest_path) {
+        return manifest_run(ectx);
+    }
+
     /*
      * 1. Process options
      */
@@ -59,7 +59,7 @@ static bool tpm2_tool_onstart(tpm2_options **opts) {
     };
 
     *opts = tpm2_options_new("c:", ARRAY_LEN(topts), topts, on_option, on_arg,
-            0);
+            TPM2_OPTIONS_OPTIONAL_SAPI);
 
     return *opts != NULL;
 }
@@ -68,8 +68,14 @@ static tool_rc tpm2_tool_onrun(ESYS_CONTEXT *ectx, tpm2_option_flags flags) {
 
     UNUSED(flags);
 
+    /* the cpHash of a hierarchy is computed without a TPM with --tcti=none */
+    if (!ectx && !ctx.cp_hash_path) {
+        LOG_ERR("A TPM is only optional with --cphash");
+        return tool_rc_option_error;
+    }
+
     tool_rc rc = tpm2_util_object_load_auth(ectx, ctx.auth_hierarchy.ctx_path,
-            ctx.auth_hierarchy.auth_str, &ctx.auth_hierarchy.object, false,
+            ctx.auth_hierarchy.auth_str, &ctx.auth_hierarchy.object, !ectx,
             TPM2_HANDLE_FLAGS_L | TPM2_HANDLE_FLAGS_P);
     if (rc != tool_rc_success) {
         LOG_ERR("Invalid lockout authorization");
@@ -1,4 +1,5 @@
 /* SPDX-License-Identifier: BSD-3-Clause */
+#include <stdlib.h>
 #include <string.h>
 
 #include "files.h"
@@ -7,6 +8,7 @@
 #include "tpm2.h"
 #include "tpm2_tool.h"
 #include "tpm2_auth_util.h"
+#include "tpm2_ecc_pool.h"
 #include "tpm2_options.h"
 
 typedef struct tpm_ecephemeral_ctx tpm_ecephemeral_ctx;
@@ -35,6 +37,10 @@ struct tpm_ecephemeral_ctx {
     TPM2B_ECC_POINT *E;
 
     uint16_t counter;
+
+    /* runs Commit ahead of time with fill, takes from the pool without */
+    const char *pool_path;
+    UINT32 fill;
 };
 
 static tpm_ecephemeral_ctx ctx;
@@ -66,6 +72,16 @@ static bool on_option(char key, char *value) {
         case 't':
             ctx.commit_counter_path = value;
             break;
+        case 4:
+            ctx.pool_path = value;
+            break;
+        case 5:
+            if (!tpm2_util_string_to_uint32(value, &ctx.fill) || !ctx.fill) {
+                LOG_ERR("Invalid number of entries to fill, got: \"%s\"",
+                        value);
+                return false;
+            }
+            break;
     };
 
     return true;
@@ -96,17 +112,37 @@ static bool tpm2_tool_onstart(tpm2_options **opts) {
       { "eccpoint-L",  required_argument, NULL,  3  },
       { "public",      required_argument, NULL, 'u' },
       { "counter",     required_argument, NULL, 't' },
+      { "pool",        required_argument, NULL,  4  },
+      { "fill",        required_argument, NULL,  5  },
     };
 
+    /* taking from a pool does not need a TPM */
     *opts = tpm2_options_new("p:c:t:u:", ARRAY_LEN(topts), topts,
-            on_option, on_args, 0);
+            on_option, on_args, TPM2_OPTIONS_OPTIONAL_SAPI);
 
     return *opts != NULL;
 }
 
-static tool_rc check_options(void) {
+static tool_rc check_options(ESYS_CONTEXT *ectx) {
+
+    if (ctx.fill && !ctx.pool_path) {
+        LOG_ERR("Specify the pool to fill with --pool");
+        return tool_rc_option_error;
+    }
 
-    if (!ctx.signing_key.ctx_path) {
+    if (!ectx && (!ctx.pool_path || ctx.fill || ctx.signing_key.ctx_path)) {
+        LOG_ERR("A TPM is only optional when taking from a pool");
+        return tool_rc_option_error;
+    }
+
+    if (ctx.fill && (ctx.eccpoint_K_data_path || ctx.eccpoint_L_data_path
+            || ctx.eccpoint_E_data_path || ctx.commit_counter_path)) {
+        LOG_ERR("Filling a pool saves no ECC points or commit counter");
+        return tool_rc_option_error;
+    }
+
+    /* the entries of a pool are for the key it was filled for */
+    if (!ctx.signing_key.ctx_path && (!ctx.pool_path || ctx.fill)) {
         LOG_ERR("Specify a signing key");
         return tool_rc_option_error;
     }
@@ -168,7 +204,7 @@ static tool_rc process_outputs(void) {
         return tool_rc_general_error;
     }
 
-    FILE *fp = fopen(ctx.commit_counter_path, "wb");
+    FILE *fp = files_fopen(ctx.commit_counter_path, "wb");
     result = files_write_16(fp, ctx.counter);
     fclose(fp);
     if (!result) {
@@ -179,22 +215,132 @@ static tool_rc process_outputs(void) {
     return tool_rc_success;
 }
 
+/* the entries of a key are told apart from the ones of others by its name */
+static tool_rc pool_owner(ESYS_CONTEXT *ectx, TPM2B_NAME *owner) {
+
+    TPM2B_NAME *name = NULL;
+    tool_rc rc = tpm2_tr_get_name(ectx, ctx.signing_key.object.tr_handle,
+            &name);
+    if (rc != tool_rc_success) {
+        return rc;
+    }
+
+    *owner = *name;
+    Esys_Free(name);
+
+    return tool_rc_success;
+}
+
+/*
+ * Every entry is a counter of the TPM, so the ones produced before a failure
+ * are kept in the pool rather than lost.
+ */
+static tool_rc pool_fill(ESYS_CONTEXT *ectx) {
+
+    if (ctx.signing_key.object.session &&
+            tpm2_session_get_type(ctx.signing_key.object.session)
+                == TPM2_SE_POLICY) {
+        LOG_ERR("A policy session cannot authorize the commits of a pool");
+        return tool_rc_option_error;
+    }
+
+    TPM2B_NAME owner = { .size = 0 };
+    tool_rc rc = pool_owner(ectx, &owner);
+    if (rc != tool_rc_success) {
+        return rc;
+    }
+
+    tpm2_ecc_pool_entry *entries = calloc(ctx.fill, sizeof(*entries));
+    if (!entries) {
+        LOG_ERR("oom");
+        return tool_rc_general_error;
+    }
+
+    UINT32 count;
+    for (count = 0; count < ctx.fill; count++) {
+        TPM2B_ECC_POINT *K = NULL, *L = NULL, *E = NULL;
+        rc = tpm2_commit(ectx, &ctx.signing_key.object, &ctx.P1, &ctx.s2,
+                &ctx.y2, &K, &L, &E, &entries[count].counter);
+        if (rc != tool_rc_success) {
+            break;
+        }
+        entries[count].points[0] = *K;
+        entries[count].points[1] = *L;
+        entries[count].points[2] = *E;
+        Esys_Free(K);
+        Esys_Free(L);
+        Esys_Free(E);
+    }
+
+    size_t remaining = 0;
+    bool result = !count || tpm2_ecc_pool_add(ctx.pool_path, TPM2_CC_Commit,
+            &owner, entries, count, &remaining);
+    free(entries);
+    if (!result) {
+        return tool_rc_general_error;
+    }
+
+    if (count) {
+        tpm2_tool_output("entries: %zu\n", remaining);
+    }
+
+    return rc;
+}
+
+static tool_rc pool_take(ESYS_CONTEXT *ectx) {
+
+    TPM2B_NAME owner = { .size = 0 };
+    if (ctx.signing_key.ctx_path) {
+        tool_rc rc = pool_owner(ectx, &owner);
+        if (rc != tool_rc_success) {
+            return rc;
+        }
+    }
+
+    tpm2_ecc_pool_entry entry;
+    size_t remaining = 0;
+    bool result = tpm2_ecc_pool_take(ctx.pool_path, TPM2_CC_Commit,
+            ctx.signing_key.ctx_path ? &owner : NULL, &entry, &remaining);
+    if (!result) {
+        return tool_rc_general_error;
+    }
+
+    if (!remaining) {
+        LOG_WARN("Took the last entry of pool \"%s\"", ctx.pool_path);
+    }
+
+    ctx.counter = entry.counter;
+    ctx.K = &entry.points[0];
+    ctx.L = &entry.points[1];
+    ctx.E = &entry.points[2];
+
+    return process_outputs();
+}
+
 static tool_rc tpm2_tool_onrun(ESYS_CONTEXT *ectx, tpm2_option_flags flags) {
 
     UNUSED(flags);
 
     // Check input options and arguments
-    tool_rc rc = check_options();
+    tool_rc rc = check_options(ectx);
     if (rc != tool_rc_success) {
         return rc;
     }
 
+    if (ctx.pool_path && !ctx.signing_key.ctx_path) {
+        return pool_take(ectx);
+    }
+
     // Process inputs
     rc = process_inputs(ectx);
     if (rc != tool_rc_success) {
         return rc;
     }
 
+    if (ctx.pool_path) {
+        return ctx.fill ? pool_fill(ectx) : pool_take(ectx);
+    }
+
     // ESAPI call
     rc = tpm2_commit(ectx, &ctx.signing_key.object, &ctx.P1, &ctx.s2, &ctx.y2,
         &ctx.K, &ctx.L, &ctx.E, &ctx.counter);
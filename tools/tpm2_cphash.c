@@ -0,0 +1,401 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "files.h"
+#include "log.h"
+#include "object.h"
+#include "tpm2.h"
+#include "tpm2_alg_util.h"
+#include "tpm2_auth_util.h"
+#include "tpm2_cphash.h"
+#include "tpm2_tool.h"
+
+#define NAME_PREFIX "name:"
+#define NAME_PREFIX_LEN (sizeof(NAME_PREFIX) - 1)
+
+typedef struct cphash_name cphash_name;
+struct cphash_name {
+    char *key;
+    TPM2B_NAME name;
+};
+
+typedef struct cphash_ctx cphash_ctx;
+struct cphash_ctx {
+    const char *manifest_path;
+    TPMI_ALG_HASH halg;
+    bool keep_going;
+
+    /* the names of the handles of the manifest, looked up once */
+    cphash_name *names;
+    size_t names_count;
+};
+
+static cphash_ctx ctx = {
+    .halg = TPM2_ALG_SHA256,
+};
+
+static tool_rc lookup_name(ESYS_CONTEXT *ectx, const char *handle,
+        TPM2B_NAME *name) {
+
+    /* the name of the entity is given */
+    if (!strncmp(handle, NAME_PREFIX, NAME_PREFIX_LEN)) {
+        name->size = sizeof(name->name);
+        int rc = tpm2_util_hex_to_byte_structure(handle + NAME_PREFIX_LEN,
+                &name->size, name->name);
+        if (rc) {
+            LOG_ERR("Could not convert name \"%s\"", handle);
+            return tool_rc_general_error;
+        }
+        return tool_rc_success;
+    }
+
+    /* hierarchies are their own name, context files are not */
+    FILE *f = files_fopen(handle, "rb");
+    if (f) {
+        fclose(f);
+    } else {
+        TPMI_RH_PROVISION value;
+        bool result = tpm2_util_handle_from_optarg(handle, &value,
+                TPM2_HANDLE_ALL_W_NV);
+        if (!result) {
+            return tool_rc_general_error;
+        }
+
+        if (tpm2_cphash_handle_name(value, name)) {
+            return tool_rc_success;
+        }
+    }
+
+    /* objects and NV indices are named by their public area */
+    if (!ectx) {
+        LOG_ERR("The name of \"%s\" is read from the TPM, specify it as "
+                "\"" NAME_PREFIX "<hex>\" without a TPM", handle);
+        return tool_rc_general_error;
+    }
+
+    tpm2_loaded_object object = { 0 };
+    tool_rc rc = tpm2_util_object_load(ectx, handle, &object,
+            TPM2_HANDLE_ALL_W_NV);
+    if (rc != tool_rc_success) {
+        return rc;
+    }
+
+    TPM2B_NAME *tpm_name = NULL;
+    rc = tpm2_tr_get_name(ectx, object.tr_handle, &tpm_name);
+    if (rc != tool_rc_success) {
+        return rc;
+    }
+
+    *name = *tpm_name;
+    Esys_Free(tpm_name);
+
+    return tool_rc_success;
+}
+
+static tool_rc add_name(ESYS_CONTEXT *ectx, tpm2_cphash *c,
+        const char *handle) {
+
+    size_t i;
+    for (i = 0; i < ctx.names_count; i++) {
+        if (!strcmp(ctx.names[i].key, handle)) {
+            return tpm2_cphash_add_name(c, &ctx.names[i].name) ?
+                    tool_rc_success : tool_rc_general_error;
+        }
+    }
+
+    TPM2B_NAME name = { .size = 0 };
+    tool_rc rc = lookup_name(ectx, handle, &name);
+    if (rc != tool_rc_success) {
+        return rc;
+    }
+
+    cphash_name *names = realloc(ctx.names,
+            (ctx.names_count + 1) * sizeof(*names));
+    char *key = strdup(handle);
+    if (names) {
+        ctx.names = names;
+    }
+    if (!names || !key) {
+        LOG_ERR("oom");
+        free(key);
+        return tool_rc_general_error;
+    }
+
+    ctx.names[ctx.names_count].key = key;
+    ctx.names[ctx.names_count].name = name;
+    ctx.names_count++;
+
+    return tpm2_cphash_add_name(c, &name) ?
+            tool_rc_success : tool_rc_general_error;
+}
+
+static bool add_auth(tpm2_cphash *c, const char *auth) {
+
+    tpm2_session *session = NULL;
+    tool_rc rc = tpm2_auth_util_from_optarg(NULL, auth, &session, true);
+    if (rc != tool_rc_success) {
+        return false;
+    }
+
+    TPM2B_AUTH new_auth = *tpm2_session_get_auth_value(session);
+    tpm2_session_close(&session);
+
+    return tpm2_cphash_add(c, TPM2B_AUTH, &new_auth);
+}
+
+/* TPM2_NV_Write: data, offset */
+static bool marshal_nvwrite(tpm2_cphash *c, int argc, char **argv) {
+
+    TPM2B_MAX_NV_BUFFER data = { .size = sizeof(data.buffer) };
+    bool result = files_load_bytes_from_path(argv[0], data.buffer, &data.size);
+    if (!result) {
+        return false;
+    }
+
+    UINT16 offset = 0;
+    if (argc > 1 && !tpm2_util_string_to_uint16(argv[1], &offset)) {
+        LOG_ERR("Invalid offset, got: \"%s\"", argv[1]);
+        return false;
+    }
+
+    return tpm2_cphash_add(c, TPM2B_MAX_NV_BUFFER, &data)
+            && tpm2_cphash_add(c, UINT16, offset);
+}
+
+/* TPM2_EvictControl: persistentHandle */
+static bool marshal_evictcontrol(tpm2_cphash *c, int argc, char **argv) {
+
+    UNUSED(argc);
+
+    TPMI_DH_PERSISTENT persistent_handle;
+    bool result = tpm2_util_string_to_uint32(argv[0], &persistent_handle);
+    if (!result) {
+        LOG_ERR("Invalid persistent handle, got: \"%s\"", argv[0]);
+        return false;
+    }
+
+    return tpm2_cphash_add(c, TPM2_HANDLE, persistent_handle);
+}
+
+/* TPM2_ObjectChangeAuth and TPM2_HierarchyChangeAuth: newAuth */
+static bool marshal_changeauth(tpm2_cphash *c, int argc, char **argv) {
+
+    UNUSED(argc);
+
+    return add_auth(c, argv[0]);
+}
+
+typedef struct cphash_command cphash_command;
+struct cphash_command {
+    const char *name;
+    TPM2_CC cc;
+    int handles;
+    int min_parameters;
+    int max_parameters;
+    bool (*marshal)(tpm2_cphash *c, int argc, char **argv);
+};
+
+static const cphash_command commands[] = {
+    { "nvwrite",             TPM2_CC_NV_Write,            2, 1, 2,
+      marshal_nvwrite },
+    { "evictcontrol",        TPM2_CC_EvictControl,        2, 1, 1,
+      marshal_evictcontrol },
+    { "changeauth",          TPM2_CC_ObjectChangeAuth,    2, 1, 1,
+      marshal_changeauth },
+    { "hierarchychangeauth", TPM2_CC_HierarchyChangeAuth, 1, 1, 1,
+      marshal_changeauth },
+};
+
+static const cphash_command *lookup_command(const char *name) {
+
+    size_t i;
+    for (i = 0; i < ARRAY_LEN(commands); i++) {
+        if (!strcmp(commands[i].name, name)) {
+            return &commands[i];
+        }
+    }
+
+    return NULL;
+}
+
+static tool_rc process_entry(ESYS_CONTEXT *ectx, int argc, char **argv) {
+
+    const cphash_command *command = lookup_command(argv[0]);
+    if (!command) {
+        LOG_ERR("Unknown command \"%s\"", argv[0]);
+        return tool_rc_general_error;
+    }
+
+    int parameters = argc - 1 - command->handles;
+    if (parameters < command->min_parameters
+            || parameters > command->max_parameters) {
+        LOG_ERR("\"%s\" expects %d handles and %d to %d parameters",
+                command->name, command->handles, command->min_parameters,
+                command->max_parameters);
+        return tool_rc_general_error;
+    }
+
+    tpm2_cphash c;
+    tpm2_cphash_init(&c, command->cc);
+
+    int i;
+    for (i = 1; i <= command->handles; i++) {
+        tool_rc rc = add_name(ectx, &c, argv[i]);
+        if (rc != tool_rc_success) {
+            return rc;
+        }
+    }
+
+    bool result = command->marshal(&c, parameters, &argv[i]);
+    if (!result) {
+        return tool_rc_general_error;
+    }
+
+    TPM2B_DIGEST cp_hash = { .size = 0 };
+    tool_rc rc = tpm2_cphash_compute(&c, ctx.halg, &cp_hash);
+    if (rc != tool_rc_success) {
+        return rc;
+    }
+
+    tpm2_tool_output("  cphash: ");
+    tpm2_util_hexdump(cp_hash.buffer, cp_hash.size);
+    tpm2_tool_output("\n");
+
+    return tool_rc_success;
+}
+
+static tool_rc process_manifest(ESYS_CONTEXT *ectx, FILE *input) {
+
+    tool_rc rc = tool_rc_success;
+    char *line = NULL;
+    size_t line_size = 0;
+    size_t lineno = 0;
+
+    while (getline(&line, &line_size, input) != -1) {
+        lineno++;
+
+        int argc = 0;
+        char **argv = NULL;
+        bool result = tpm2_util_split_args(line, &argc, &argv);
+        if (!result) {
+            LOG_ERR("Could not parse line %zu", lineno);
+            rc = tool_rc_general_error;
+            break;
+        }
+
+        /* blank line or comment */
+        if (!argc) {
+            free(argv);
+            continue;
+        }
+
+        tpm2_tool_output("- line: %zu\n", lineno);
+        tpm2_tool_output("  command: %s\n", argv[0]);
+
+        tool_rc tmp_rc = process_entry(ectx, argc, argv);
+        if (tmp_rc != tool_rc_success) {
+            LOG_ERR("Line %zu: no cpHash for \"%s\"", lineno, argv[0]);
+            tpm2_tool_output("  error: %d\n", tmp_rc);
+            if (rc == tool_rc_success) {
+                rc = tmp_rc;
+            }
+        }
+        free(argv);
+
+        if (rc != tool_rc_success && !ctx.keep_going) {
+            break;
+        }
+    }
+
+    if (ferror(input)) {
+        LOG_ERR("Error reading manifest, error: %s", strerror(errno));
+        rc = tool_rc_general_error;
+    }
+
+    free(line);
+
+    return rc;
+}
+
+static bool on_option(char key, char *value) {
+
+    switch (key) {
+    case 'g':
+        ctx.halg = tpm2_alg_util_from_optarg(value, tpm2_alg_util_flags_hash);
+        if (ctx.halg == TPM2_ALG_ERROR) {
+            LOG_ERR("Invalid hash algorithm, got \"%s\"", value);
+            return false;
+        }
+        break;
+    case 'k':
+        ctx.keep_going = true;
+        break;
+    }
+
+    return true;
+}
+
+static bool on_arg(int argc, char **argv) {
+
+    if (argc > 1) {
+        LOG_ERR("Specify a single manifest file");
+        return false;
+    }
+
+    ctx.manifest_path = strcmp(argv[0], "-") ? argv[0] : NULL;
+
+    return true;
+}
+
+static bool tpm2_tool_onstart(tpm2_options **opts) {
+
+    const struct option topts[] = {
+        { "hash-algorithm", required_argument, NULL, 'g' },
+        { "keep-going",     no_argument,       NULL, 'k' },
+    };
+
+    *opts = tpm2_options_new("g:k", ARRAY_LEN(topts), topts, on_option,
+            on_arg, TPM2_OPTIONS_OPTIONAL_SAPI);
+
+    return *opts != NULL;
+}
+
+static tool_rc tpm2_tool_onrun(ESYS_CONTEXT *ectx, tpm2_option_flags flags) {
+
+    UNUSED(flags);
+
+    FILE *input = stdin;
+    if (ctx.manifest_path) {
+        input = files_fopen(ctx.manifest_path, "r");
+        if (!input) {
+            LOG_ERR("Could not open manifest \"%s\", error: %s",
+                    ctx.manifest_path, strerror(errno));
+            return tool_rc_general_error;
+        }
+    }
+
+    tool_rc rc = process_manifest(ectx, input);
+
+    if (input != stdin) {
+        fclose(input);
+    }
+
+    return rc;
+}
+
+static void tpm2_tool_onexit(void) {
+
+    size_t i;
+    for (i = 0; i < ctx.names_count; i++) {
+        free(ctx.names[i].key);
+    }
+    free(ctx.names);
+}
+
+// Register this tool with tpm2_tool.c
+TPM2_TOOL_REGISTER("cphash", tpm2_tool_onstart, tpm2_tool_onrun, NULL,
+        tpm2_tool_onexit)
@@ -1,5 +1,6 @@
 /* SPDX-License-Identifier: BSD-3-Clause */
 
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
@@ -11,11 +12,23 @@
 #include "tpm2_tool.h"
 #include "tpm2_alg_util.h"
 #include "tpm2_auth_util.h"
+#include "tpm2_capability.h"
 #include "tpm2_options.h"
 
 typedef struct tpm_create_ctx tpm_create_ctx;
 #define MAX_AUX_SESSIONS 2
 #define MAX_SESSIONS 3
+/* key algorithm, attributes, key auth, public, private and key context */
+#define MANIFEST_FIELDS_MIN 5
+#define MANIFEST_FIELDS_MAX 8
+
+/* a template of a manifest, parsed once for all the keys sharing it */
+typedef struct create_template create_template;
+struct create_template {
+    char *spec;
+    TPM2B_PUBLIC in_public;
+};
+
 struct tpm_create_ctx {
         /*
          * Inputs
@@ -85,6 +98,10 @@ struct tpm_create_ctx {
     char *output_path;
     bool format_set;
     tpm2_convert_pubkey_fmt format;
+
+    const char *manifest_path;
+    create_template *templates;
+    size_t templates_count;
 };
 
 #define DEFAULT_KEY_ALG "rsa2048"
@@ -170,20 +187,21 @@ static tool_rc create(ESYS_CONTEXT *ectx) {
     |TPMA_OBJECT_FIXEDPARENT|TPMA_OBJECT_SENSITIVEDATAORIGIN \
     |TPMA_OBJECT_USERWITHAUTH
 
-static void setup_attributes(TPMA_OBJECT *attrs) {
+static void setup_attributes(const char *alg, const char *object_attrs,
+        const char *auth_str, TPMA_OBJECT *attrs) {
 
-    if (ctx.object.is_sealing_input_specified && !ctx.object.attrs) {
+    if (ctx.object.is_sealing_input_specified && !object_attrs) {
         *attrs &= ~TPMA_OBJECT_SIGN_ENCRYPT;
         *attrs &= ~TPMA_OBJECT_DECRYPT;
         *attrs &= ~TPMA_OBJECT_SENSITIVEDATAORIGIN;
     }
 
-    if (!ctx.object.is_sealing_input_specified && !ctx.object.attrs &&
-        !strncmp("hmac", ctx.object.alg, 4)) {
+    if (!ctx.object.is_sealing_input_specified && !object_attrs &&
+        !strncmp("hmac", alg, 4)) {
         *attrs &= ~TPMA_OBJECT_DECRYPT;
     }
 
-    if (!ctx.object.attrs && ctx.object.policy && !ctx.object.auth_str) {
+    if (!object_attrs && ctx.object.policy && !auth_str) {
         *attrs &= ~TPMA_OBJECT_USERWITHAUTH;
     }
 }
@@ -275,7 +293,7 @@ create_out:
     }
 
     /* Common- TPM2_CC_Create/ TPM2_CC_CreateLoaded outputs*/
-    tpm2_util_public_to_yaml(ctx.object.out_public, NULL);
+    tpm2_util_public_to_yaml(ctx.object.out_public);
 
     if (ctx.object.public_path) {
         is_file_op_success = files_save_public(ctx.object.out_public,
@@ -365,7 +383,8 @@ static tool_rc process_inputs(ESYS_CONTEXT *ectx) {
 
     /* Setup attributes */
     TPMA_OBJECT attrs = DEFAULT_ATTRS;
-    setup_attributes(&attrs);
+    setup_attributes(ctx.object.alg, ctx.object.attrs, ctx.object.auth_str,
+        &attrs);
 
     /* Initialize object */
     rc = tpm2_alg_util_public_init(ctx.object.alg, ctx.object.name_alg,
@@ -420,6 +439,306 @@ static tool_rc process_inputs(ESYS_CONTEXT *ectx) {
     return rc;
 }
 
+/*
+ * Gets the template of a key algorithm and attributes of the manifest. The
+ * parsed templates are kept by their spec, so the keys sharing one do not
+ * parse the algorithm and attributes again, and a new one is tested with
+ * TestParms, which the capability cache also answers.
+ */
+static const TPM2B_PUBLIC *manifest_template(ESYS_CONTEXT *ectx, char *alg,
+        char *attrs, const char *auth_str) {
+
+    /* whether the key has an auth can change the default attributes */
+    char spec[256];
+    int len = snprintf(spec, sizeof(spec), "%s %s %s", alg,
+            attrs ? attrs : "-", auth_str ? "auth" : "-");
+    if (len < 0 || (size_t) len >= sizeof(spec)) {
+        LOG_ERR("Key algorithm and attributes too long, got: \"%s %s\"",
+                alg, attrs ? attrs : "-");
+        return NULL;
+    }
+
+    size_t i;
+    for (i = 0; i < ctx.templates_count; i++) {
+        if (!strcmp(ctx.templates[i].spec, spec)) {
+            return &ctx.templates[i].in_public;
+        }
+    }
+
+    TPMA_OBJECT default_attrs = DEFAULT_ATTRS;
+    setup_attributes(alg, attrs, auth_str, &default_attrs);
+
+    TPM2B_PUBLIC in_public = { 0 };
+    tool_rc rc = tpm2_alg_util_public_init(alg, ctx.object.name_alg,
+        attrs, ctx.object.policy, default_attrs, &in_public);
+    if (rc != tool_rc_success) {
+        return NULL;
+    }
+
+    TPMT_PUBLIC_PARMS parms = {
+        .type = in_public.publicArea.type,
+        .parameters = in_public.publicArea.parameters,
+    };
+    rc = tpm2_capability_test_parms(ectx, &parms);
+    if (rc != tool_rc_success) {
+        return NULL;
+    }
+
+    create_template *templates = realloc(ctx.templates,
+            (ctx.templates_count + 1) * sizeof(*templates));
+    char *key = strdup(spec);
+    if (templates) {
+        ctx.templates = templates;
+    }
+    if (!templates || !key) {
+        LOG_ERR("oom");
+        free(key);
+        return NULL;
+    }
+
+    create_template *t = &ctx.templates[ctx.templates_count++];
+    t->spec = key;
+    t->in_public = in_public;
+
+    return &t->in_public;
+}
+
+/*
+ * Creates the key of a manifest line, with TPM2_CreateLoaded when its context
+ * is saved, which is flushed then, so the keys do not fill the TPM. A key
+ * with creation outputs to save, ie for tpm2_certifycreation, is created with
+ * TPM2_Create and loaded for its context after.
+ */
+static bool manifest_create(ESYS_CONTEXT *ectx, size_t line_number,
+        char **fields, size_t count) {
+
+    char *attrs = strcmp(fields[1], "-") ? fields[1] : NULL;
+    const char *auth_str = strcmp(fields[2], "-") ? fields[2] : NULL;
+    const char *public_path = fields[3];
+    const char *private_path = fields[4];
+    const char *key_ctx_path = count > 5 && strcmp(fields[5], "-") ?
+            fields[5] : NULL;
+    const char *creation_hash_path = count > 7 ? fields[6] : NULL;
+    const char *creation_ticket_path = count > 7 ? fields[7] : NULL;
+
+    const TPM2B_PUBLIC *in_public = manifest_template(ectx, fields[0], attrs,
+            auth_str);
+    if (!in_public) {
+        LOG_ERR("%s:%zu: Invalid key template \"%s %s\"", ctx.manifest_path,
+                line_number, fields[0], fields[1]);
+        return false;
+    }
+
+    TPM2B_SENSITIVE_CREATE sensitive = { 0 };
+    if (auth_str) {
+        tpm2_session *tmp;
+        tool_rc rc = tpm2_auth_util_from_optarg(NULL, auth_str, &tmp, true);
+        if (rc != tool_rc_success) {
+            LOG_ERR("%s:%zu: Invalid key authorization", ctx.manifest_path,
+                    line_number);
+            return false;
+        }
+        sensitive.sensitive.userAuth = *tpm2_session_get_auth_value(tmp);
+        tpm2_session_close(&tmp);
+    }
+
+    TPM2B_DIGEST cp_hash = { .size = 0 };
+    TPM2B_DIGEST rp_hash = { .size = 0 };
+    TPM2B_PRIVATE *out_private = NULL;
+    TPM2B_PUBLIC *out_public = NULL;
+    ESYS_TR object_handle = ESYS_TR_NONE;
+    tool_rc rc;
+    if (key_ctx_path && !creation_hash_path) {
+        size_t offset = 0;
+        TPM2B_TEMPLATE template = { .size = 0 };
+        rc = tpm2_mu_tpmt_public_marshal(&in_public->publicArea,
+                &template.buffer[0], sizeof(TPMT_PUBLIC), &offset);
+        if (rc == tool_rc_success) {
+            template.size = offset;
+            rc = tpm2_create_loaded(ectx, &ctx.parent.object, &sensitive,
+                &template, &object_handle, &out_private, &out_public,
+                &cp_hash, &rp_hash, TPM2_ALG_ERROR, ctx.aux_session_handle[0],
+                ctx.aux_session_handle[1]);
+        }
+    } else {
+        TPM2B_CREATION_DATA *creation_data = NULL;
+        TPM2B_DIGEST *creation_hash = NULL;
+        TPMT_TK_CREATION *creation_ticket = NULL;
+        rc = tpm2_create(ectx, &ctx.parent.object, &sensitive, in_public,
+            &ctx.object.outside_info, &ctx.object.creation_pcr, &out_private,
+            &out_public, &creation_data, &creation_hash, &creation_ticket,
+            &cp_hash, &rp_hash, TPM2_ALG_ERROR, ctx.aux_session_handle[0],
+            ctx.aux_session_handle[1]);
+        if (rc == tool_rc_success && creation_hash_path) {
+            bool is_saved = files_save_digest(creation_hash,
+                    creation_hash_path)
+                && files_save_creation_ticket(creation_ticket,
+                    creation_ticket_path);
+            rc = is_saved ? tool_rc_success : tool_rc_general_error;
+        }
+        if (rc == tool_rc_success && key_ctx_path) {
+            rc = tpm2_load(ectx, &ctx.parent.object, out_private, out_public,
+                &object_handle, NULL);
+        }
+        free(creation_data);
+        free(creation_hash);
+        free(creation_ticket);
+    }
+
+    bool result = rc == tool_rc_success
+        && files_save_public(out_public, public_path)
+        && files_save_private(out_private, private_path);
+
+    if (object_handle != ESYS_TR_NONE) {
+        result = result && files_save_tpm_context_to_path(ectx,
+            object_handle, key_ctx_path) == tool_rc_success;
+        /* a reference keeps the object loaded */
+        bool is_ref = result && tpm2_object_is_ref(key_ctx_path);
+        result = (is_ref
+                || tpm2_flush_context(ectx, object_handle) == tool_rc_success)
+            && result;
+    }
+
+    free(out_private);
+    free(out_public);
+
+    return result;
+}
+
+/* a line of a manifest, the fields point into it */
+typedef struct manifest_entry manifest_entry;
+struct manifest_entry {
+    char *line;
+    size_t line_number;
+    char *fields[MANIFEST_FIELDS_MAX];
+    size_t count;
+};
+
+typedef struct manifest manifest;
+struct manifest {
+    manifest_entry *entries;
+    size_t count;
+};
+
+#define MANIFEST_USAGE "<key-algorithm> <attributes> <key-auth> <public> " \
+        "<private> [<key-context> [<creation-hash> <creation-ticket>]]"
+
+static bool manifest_add(void *e, char *line, char **fields, size_t count,
+        size_t line_number, void *userdata) {
+
+    UNUSED(userdata);
+
+    manifest_entry *entry = (manifest_entry *) e;
+    entry->line = line;
+    entry->line_number = line_number;
+    memcpy(entry->fields, fields, count * sizeof(*fields));
+    entry->count = count;
+
+    /* the creation hash and ticket go together */
+    if (count == MANIFEST_FIELDS_MAX - 1) {
+        LOG_ERR("%s:%zu: Expected: " MANIFEST_USAGE, ctx.manifest_path,
+                line_number);
+        return false;
+    }
+
+    return true;
+}
+
+static void manifest_free(manifest *m) {
+
+    size_t i;
+    for (i = 0; i < m->count; i++) {
+        free(m->entries[i].line);
+    }
+    free(m->entries);
+}
+
+/*
+ * Parses and tests the template of every line before any key is created, so
+ * a template the TPM does not support fails the manifest up front rather than
+ * after the keys of the lines before it.
+ */
+static tool_rc manifest_check_all(ESYS_CONTEXT *ectx, manifest *m) {
+
+    size_t i;
+    for (i = 0; i < m->count; i++) {
+        manifest_entry *entry = &m->entries[i];
+        char **fields = entry->fields;
+        char *attrs = strcmp(fields[1], "-") ? fields[1] : NULL;
+        const char *auth_str = strcmp(fields[2], "-") ? fields[2] : NULL;
+        if (!manifest_template(ectx, fields[0], attrs, auth_str)) {
+            LOG_ERR("%s:%zu: Invalid key template \"%s %s\"",
+                    ctx.manifest_path, entry->line_number, fields[0],
+                    fields[1]);
+            return tool_rc_unsupported;
+        }
+    }
+
+    return tool_rc_success;
+}
+
+static tool_rc manifest_create_all(ESYS_CONTEXT *ectx, manifest *m) {
+
+    tool_rc rc = tool_rc_success;
+    size_t i;
+    for (i = 0; i < m->count; i++) {
+        manifest_entry *entry = &m->entries[i];
+        bool is_created = manifest_create(ectx, entry->line_number,
+                entry->fields, entry->count);
+
+        tpm2_tool_output("- line: %zu\n", entry->line_number);
+        tpm2_tool_output("  public: %s\n", entry->fields[3]);
+        tpm2_tool_output("  created: %s\n", is_created ? "true" : "false");
+        tpm2_tool_output_flush();
+
+        if (!is_created) {
+            rc = tool_rc_general_error;
+        }
+    }
+
+    return rc;
+}
+
+static tool_rc manifest_run(ESYS_CONTEXT *ectx) {
+
+    tool_rc rc = tpm2_util_object_load_auth(ectx, ctx.parent.ctx_path,
+        ctx.parent.auth_str, &ctx.parent.object, false, TPM2_HANDLE_ALL_W_NV);
+    if (rc != tool_rc_success) {
+        return rc;
+    }
+
+    if (ctx.parent.object.session && tpm2_session_get_type(
+            ctx.parent.object.session) == TPM2_SE_POLICY) {
+        LOG_ERR("A manifest cannot satisfy a policy session for every key");
+        return tool_rc_option_error;
+    }
+
+    rc = tpm2_util_aux_sessions_setup(ectx, ctx.aux_session_cnt,
+        ctx.aux_session_path, ctx.aux_session_handle, ctx.aux_session);
+    if (rc != tool_rc_success) {
+        return rc;
+    }
+
+    if (ctx.object.outside_info_data
+            && !load_outside_info(&ctx.object.outside_info)) {
+        return tool_rc_general_error;
+    }
+
+    /* read whole, so a manifest from a pipe is checked up front too */
+    manifest m = { 0 };
+    rc = tpm2_util_manifest_read(ctx.manifest_path, MANIFEST_FIELDS_MIN,
+            MANIFEST_FIELDS_MAX, MANIFEST_USAGE, (void **) &m.entries,
+            &m.count, sizeof(*m.entries), manifest_add, NULL) ?
+            manifest_check_all(ectx, &m) : tool_rc_general_error;
+    if (rc == tool_rc_success) {
+        rc = manifest_create_all(ectx, &m);
+    }
+
+    manifest_free(&m);
+
+    return rc;
+}
+
 static tool_rc check_options(void) {
 
     if (!ctx.parent.ctx_path) {
@@ -427,6 +746,24 @@ static tool_rc check_options(void) {
         return tool_rc_option_error;
     }
 
+    if (ctx.manifest_path) {
+        if (ctx.object.is_object_alg_specified || ctx.object.attrs
+                || ctx.object.is_sealing_input_specified
+                || ctx.object.auth_str || ctx.object.public_path
+                || ctx.object.private_path || ctx.object.ctx_path
+                || ctx.object.creation_data_file
+                || ctx.object.template_data_path
+                || ctx.object.creation_ticket_file
+                || ctx.object.creation_hash_file || ctx.cp_hash_path
+                || ctx.rp_hash_path || ctx.output_path) {
+            LOG_ERR("The manifest names the keys and outputs, only -C, -P, "
+                    "-g, -L, -q, -l and -S can be given with it");
+            return tool_rc_option_error;
+        }
+
+        return tool_rc_success;
+    }
+
     if (ctx.object.is_sealing_input_specified && ctx.object.is_object_alg_specified) {
         LOG_ERR("Cannot specify -G and -i together.");
         return tool_rc_option_error;
@@ -547,6 +884,9 @@ static bool on_option(char key, char *value) {
     case 'o':
         ctx.output_path = value;
         break;
+    case 4:
+        ctx.manifest_path = value;
+        break;
         /* no default */
     };
 
@@ -578,6 +918,7 @@ static bool tpm2_tool_onstart(tpm2_options **opts) {
       { "session",        required_argument, NULL, 'S' },
       { "format",         required_argument, NULL, 'f' },
       { "output",         required_argument, NULL, 'o' },
+      { "manifest",       required_argument, NULL,  4  },
     };
 
     *opts = tpm2_options_new("P:p:g:G:a:i:L:u:r:C:c:t:d:q:l:S:o:f:",
@@ -598,6 +939,10 @@ static tool_rc tpm2_tool_onrun(ESYS_CONTEXT *ectx, tpm2_option_flags flags) {
         return rc;
     }
 
+    if (ctx.manifest_path) {
+        return manifest_run(ectx);
+    }
+
     /*
      * 2. Process inputs
      */
@@ -653,6 +998,15 @@ static tool_rc tpm2_tool_onstop(ESYS_CONTEXT *ectx) {
     return rc;
 }
 
+static void tpm2_tool_onexit(void) {
+
+    size_t i;
+    for (i = 0; i < ctx.templates_count; i++) {
+        free(ctx.templates[i].spec);
+    }
+    free(ctx.templates);
+}
+
 // Register this tool with tpm2_tool.c
 TPM2_TOOL_REGISTER("create", tpm2_tool_onstart, tpm2_tool_onrun,
-tpm2_tool_onstop, NULL)
+tpm2_tool_onstop, tpm2_tool_onexit)
@@ -1,7 +1,15 @@
 /* SPDX-License-Identifier: BSD-3-Clause */
 
+#include <dirent.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <limits.h>
 #include <stdbool.h>
+#include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
 
 #include "files.h"
 #include "log.h"
@@ -38,6 +46,12 @@ struct createak_context {
         } out;
         char *auth_str;
     } ak;
+    struct {
+        const char *dir;
+        /* the number of candidates to top the pool up to */
+        UINT32 fill;
+        bool is_pop;
+    } pool;
     struct {
         UINT8 f :1;
     } flags;
@@ -186,20 +200,8 @@ static bool set_key_algorithm(TPM2B_PUBLIC *in_public) {
     return true;
 }
 
-static tool_rc create_ak(ESYS_CONTEXT *ectx) {
-
-    tool_rc rc = tool_rc_general_error;
-
-    TPML_PCR_SELECTION creation_pcr = { .count = 0 };
-    TPM2B_DATA outside_info = TPM2B_EMPTY_INIT;
-    TPM2B_PUBLIC *out_public;
-    TPM2B_PRIVATE *out_private;
-    TPM2B_PUBLIC in_public = TPM2B_EMPTY_INIT;
-
-    bool result = set_key_algorithm(&in_public);
-    if (!result) {
-        return tool_rc_general_error;
-    }
+/* a policy session satisfying the endorsement auth the EK is bound to */
+static tool_rc start_ek_session(ESYS_CONTEXT *ectx, tpm2_session **session) {
 
     tpm2_session_data *data = tpm2_session_data_new(TPM2_SE_POLICY);
     if (!data) {
@@ -207,23 +209,22 @@ static tool_rc create_ak(ESYS_CONTEXT *ectx) {
         return tool_rc_general_error;
     }
 
-    tpm2_session *session = NULL;
-    tool_rc tmp_rc = tpm2_session_open(ectx, data, &session);
-    if (tmp_rc != tool_rc_success) {
+    tool_rc rc = tpm2_session_open(ectx, data, session);
+    if (rc != tool_rc_success) {
         LOG_ERR("Could not start tpm session");
-        return tmp_rc;
+        return rc;
     }
 
     LOG_INFO("tpm_session_start_auth_with_params succ");
 
-    ESYS_TR sess_handle = tpm2_session_get_handle(session);
+    ESYS_TR sess_handle = tpm2_session_get_handle(*session);
 
     ESYS_TR shandle = ESYS_TR_NONE;
-    tmp_rc = tpm2_auth_util_get_shandle(ectx, ESYS_TR_RH_ENDORSEMENT,
+    rc = tpm2_auth_util_get_shandle(ectx, ESYS_TR_RH_ENDORSEMENT,
             ctx.ek.session, &shandle);
-    if (tmp_rc != tool_rc_success) {
-        rc = tmp_rc;
-        goto out_session;
+    if (rc != tool_rc_success) {
+        tpm2_session_close(session);
+        return rc;
     }
 
     TPM2_RC rval = Esys_PolicySecret(ectx, ESYS_TR_RH_ENDORSEMENT, sess_handle,
@@ -231,65 +232,65 @@ static tool_rc create_ak(ESYS_CONTEXT *ectx) {
             NULL, NULL, NULL, 0, NULL, NULL);
     if (rval != TPM2_RC_SUCCESS) {
         LOG_PERR(Esys_PolicySecret, rval);
-        goto out_session;
+        tpm2_session_close(session);
+        return tool_rc_from_tpm(rval);
     }
 
     LOG_INFO("Esys_PolicySecret success");
 
-    TPM2B_CREATION_DATA *creation_data = NULL;
-    rval = Esys_Create(ectx, ctx.ek.ek_ctx.tr_handle, sess_handle, ESYS_TR_NONE,
-            ESYS_TR_NONE, &ctx.ak.in.in_sensitive, &in_public, &outside_info,
-            &creation_pcr, &out_private, &out_public, &creation_data, NULL, NULL);
-    if (rval != TPM2_RC_SUCCESS) {
-        LOG_PERR(Esys_Create, rval);
-        goto out;
-    }
-    LOG_INFO("Esys_Create success");
+    return tool_rc_success;
+}
 
-    rc = tpm2_session_close(&session);
+/* the slow part, generating the key in the TPM */
+static tool_rc create_ak_object(ESYS_CONTEXT *ectx, TPM2B_PUBLIC *in_public,
+        TPM2B_PRIVATE **out_private, TPM2B_PUBLIC **out_public,
+        TPM2B_CREATION_DATA **creation_data) {
+
+    TPML_PCR_SELECTION creation_pcr = { .count = 0 };
+    TPM2B_DATA outside_info = TPM2B_EMPTY_INIT;
+
+    tpm2_session *session = NULL;
+    tool_rc rc = start_ek_session(ectx, &session);
     if (rc != tool_rc_success) {
-        goto out;
+        return rc;
     }
 
-    data = tpm2_session_data_new(TPM2_SE_POLICY);
-    if (!data) {
-        LOG_ERR("oom");
-        goto out;
-    }
+    ESYS_TR sess_handle = tpm2_session_get_handle(session);
 
-    tmp_rc = tpm2_session_open(ectx, data, &session);
-    if (tmp_rc != tool_rc_success) {
-        LOG_ERR("Could not start tpm session");
-        rc = tmp_rc;
-        goto out;
+    TPM2_RC rval = Esys_Create(ectx, ctx.ek.ek_ctx.tr_handle, sess_handle,
+            ESYS_TR_NONE, ESYS_TR_NONE, &ctx.ak.in.in_sensitive, in_public,
+            &outside_info, &creation_pcr, out_private, out_public,
+            creation_data, NULL, NULL);
+    if (rval != TPM2_RC_SUCCESS) {
+        LOG_PERR(Esys_Create, rval);
+        tpm2_session_close(&session);
+        return tool_rc_from_tpm(rval);
     }
+    LOG_INFO("Esys_Create success");
 
-    LOG_INFO("tpm_session_start_auth_with_params succ");
+    return tpm2_session_close(&session);
+}
 
-    sess_handle = tpm2_session_get_handle(session);
+/* loads a created AK under the EK and saves the requested outputs */
+static tool_rc load_ak(ESYS_CONTEXT *ectx, TPM2B_PRIVATE *out_private,
+        TPM2B_PUBLIC *out_public, TPM2B_CREATION_DATA *creation_data) {
 
-    tmp_rc = tpm2_auth_util_get_shandle(ectx, sess_handle, ctx.ek.session,
-            &shandle);
-    if (tmp_rc != tool_rc_success) {
-        rc = tmp_rc;
-        goto out;
+    tpm2_session *session = NULL;
+    tool_rc rc = start_ek_session(ectx, &session);
+    if (rc != tool_rc_success) {
+        return rc;
     }
 
-    rval = Esys_PolicySecret(ectx, ESYS_TR_RH_ENDORSEMENT, sess_handle, shandle,
-            ESYS_TR_NONE, ESYS_TR_NONE, NULL, NULL, NULL, 0, NULL, NULL);
-    if (rval != TPM2_RC_SUCCESS) {
-        LOG_PERR(Esys_PolicySecret, rval);
-        goto out;
-    }
-    LOG_INFO("Esys_PolicySecret success");
+    ESYS_TR sess_handle = tpm2_session_get_handle(session);
 
     ESYS_TR loaded_sha1_key_handle;
-    rval = Esys_Load(ectx, ctx.ek.ek_ctx.tr_handle, sess_handle, ESYS_TR_NONE,
-            ESYS_TR_NONE, out_private, out_public, &loaded_sha1_key_handle);
+    TPM2_RC rval = Esys_Load(ectx, ctx.ek.ek_ctx.tr_handle, sess_handle,
+            ESYS_TR_NONE, ESYS_TR_NONE, out_private, out_public,
+            &loaded_sha1_key_handle);
     if (rval != TPM2_RC_SUCCESS) {
         LOG_PERR(Esys_Load, rval);
         rc = tool_rc_from_tpm(rval);
-        goto out;
+        goto out_session;
     }
 
     // Load the TPM2 handle so that we can print it
@@ -298,22 +299,22 @@ static tool_rc create_ak(ESYS_CONTEXT *ectx) {
     if (rval != TPM2_RC_SUCCESS) {
         LOG_PERR(Esys_TR_GetName, rval);
         rc = tool_rc_from_tpm(rval);
-        goto nameout;
+        goto out_session;
     }
 
     rc = tpm2_session_close(&session);
     if (rc != tool_rc_success) {
-        goto out;
+        goto nameout;
     }
 
     /* generation qualified name */
     TPM2B_NAME *p_qname = &creation_data->creationData.parentQualifiedName;
     TPM2B_NAME qname = { 0 };
     rc = tpm2_calq_qname(p_qname,
-            in_public.publicArea.nameAlg, key_name, &qname) ?
+            out_public->publicArea.nameAlg, key_name, &qname) ?
                     tool_rc_success : tool_rc_general_error;
     if (rc != tool_rc_success) {
-        goto out;
+        goto nameout;
     }
 
     /* Output in YAML format */
@@ -324,7 +325,10 @@ static tool_rc create_ak(ESYS_CONTEXT *ectx) {
     tpm2_util_print_tpm2b(&qname);
     tpm2_tool_output("\n");
 
+    rc = tool_rc_general_error;
+
     // write name to ak.name file
+    bool result;
     if (ctx.ak.out.name_file) {
         result = files_save_bytes_to_file(ctx.ak.out.name_file, key_name->name,
                 key_name->size);
@@ -347,8 +351,8 @@ static tool_rc create_ak(ESYS_CONTEXT *ectx) {
 
     // If the AK isn't persisted we always save a context file of the
     // transient AK handle for future tool interactions.
-    tmp_rc = files_save_tpm_context_to_path(ectx, loaded_sha1_key_handle,
-            ctx.ak.out.ctx_file);
+    tool_rc tmp_rc = files_save_tpm_context_to_path(ectx,
+            loaded_sha1_key_handle, ctx.ak.out.ctx_file);
     if (tmp_rc != tool_rc_success) {
         rc = tmp_rc;
         LOG_ERR("Error saving tpm context for handle");
@@ -374,16 +378,301 @@ static tool_rc create_ak(ESYS_CONTEXT *ectx) {
 
 nameout:
     free(key_name);
-out:
+out_session:
+    tpm2_session_close(&session);
+
+    return rc;
+}
+
+static tool_rc create_ak(ESYS_CONTEXT *ectx) {
+
+    TPM2B_PUBLIC in_public = TPM2B_EMPTY_INIT;
+    bool result = set_key_algorithm(&in_public);
+    if (!result) {
+        return tool_rc_general_error;
+    }
+
+    TPM2B_PUBLIC *out_public = NULL;
+    TPM2B_PRIVATE *out_private = NULL;
+    TPM2B_CREATION_DATA *creation_data = NULL;
+    tool_rc rc = create_ak_object(ectx, &in_public, &out_private, &out_public,
+            &creation_data);
+    if (rc == tool_rc_success) {
+        rc = load_ak(ectx, out_private, out_public, creation_data);
+    }
+
     free(out_public);
     free(out_private);
     Esys_Free(creation_data);
-out_session:
-    tpm2_session_close(&session);
 
     return rc;
 }
 
+/*
+ * Candidates of the pool are named after the template they were created
+ * with, as "<type>-<hash>-<scheme>-<id>", so a pool may hold AKs of several
+ * templates. A candidate is complete once its private portion is in place.
+ */
+static bool pool_template_name(TPM2B_PUBLIC *in_public, char *name,
+        size_t size) {
+
+    TPMT_PUBLIC *pub = &in_public->publicArea;
+
+    TPM2_ALG_ID scheme;
+    switch (pub->type) {
+    case TPM2_ALG_RSA:
+        scheme = pub->parameters.rsaDetail.scheme.scheme;
+        break;
+    case TPM2_ALG_ECC:
+        scheme = pub->parameters.eccDetail.scheme.scheme;
+        break;
+    default:
+        scheme = pub->parameters.keyedHashDetail.scheme.scheme;
+    }
+
+    const char *type_str = tpm2_alg_util_algtostr(pub->type,
+            tpm2_alg_util_flags_any);
+    const char *hash_str = tpm2_alg_util_algtostr(ctx.ak.in.alg.digest,
+            tpm2_alg_util_flags_hash);
+    const char *scheme_str = tpm2_alg_util_algtostr(scheme,
+            tpm2_alg_util_flags_any);
+    if (!type_str || !hash_str || !scheme_str) {
+        LOG_ERR("Unknown algorithm in the AK template");
+        return false;
+    }
+
+    int len = snprintf(name, size, "%s-%s-%s-", type_str, hash_str,
+            scheme_str);
+
+    return len > 0 && (size_t) len < size;
+}
+
+static bool pool_is_candidate(const char *template, const char *file_name) {
+
+    size_t len = strlen(file_name);
+
+    return !strncmp(file_name, template, strlen(template))
+            && len > strlen(".priv")
+            && !strcmp(&file_name[len - strlen(".priv")], ".priv");
+}
+
+static bool pool_count(const char *template, UINT32 *count) {
+
+    DIR *dir = files_opendir(ctx.pool.dir);
+    if (!dir) {
+        LOG_ERR("Could not open AK pool \"%s\", error: %s", ctx.pool.dir,
+                strerror(errno));
+        return false;
+    }
+
+    *count = 0;
+    struct dirent *entry;
+    while ((entry = readdir(dir))) {
+        if (pool_is_candidate(template, entry->d_name)) {
+            (*count)++;
+        }
+    }
+    closedir(dir);
+
+    return true;
+}
+
+/* saves a candidate, its private portion last so it is never seen partial */
+static bool pool_save(const char *template, UINT32 index,
+        TPM2B_PRIVATE *out_private, TPM2B_PUBLIC *out_public,
+        TPM2B_CREATION_DATA *creation_data) {
+
+    char base[PATH_MAX];
+    int len = snprintf(base, sizeof(base), "%s/%s%lld-%ld-%u", ctx.pool.dir,
+            template, (long long) time(NULL), (long) getpid(), index);
+    if (len < 0 || (size_t) len + sizeof(".priv.tmp") > sizeof(base)) {
+        LOG_ERR("AK pool path too long");
+        return false;
+    }
+
+    char pub_path[PATH_MAX];
+    char cd_path[PATH_MAX];
+    char priv_path[PATH_MAX];
+    char tmp_path[PATH_MAX];
+    snprintf(pub_path, sizeof(pub_path), "%s.pub", base);
+    snprintf(cd_path, sizeof(cd_path), "%s.cd", base);
+    snprintf(priv_path, sizeof(priv_path), "%s.priv", base);
+    snprintf(tmp_path, sizeof(tmp_path), "%s.priv.tmp", base);
+
+    bool result = files_save_public(out_public, pub_path)
+            && files_save_creation_data(creation_data, cd_path)
+            && files_save_private(out_private, tmp_path);
+    if (result && !files_rename(tmp_path, priv_path)) {
+        LOG_ERR("Could not add \"%s\" to the AK pool, error: %s", priv_path,
+                strerror(errno));
+        result = false;
+    }
+
+    if (!result) {
+        files_unlink(tmp_path);
+        files_unlink(cd_path);
+        files_unlink(pub_path);
+    }
+
+    return result;
+}
+
+static tool_rc pool_fill(ESYS_CONTEXT *ectx) {
+
+    TPM2B_PUBLIC in_public = TPM2B_EMPTY_INIT;
+    bool result = set_key_algorithm(&in_public);
+    if (!result) {
+        return tool_rc_general_error;
+    }
+
+    char template[64];
+    result = pool_template_name(&in_public, template, sizeof(template));
+    if (!result) {
+        return tool_rc_general_error;
+    }
+
+    UINT32 count = 0;
+    result = pool_count(template, &count);
+    if (!result) {
+        return tool_rc_general_error;
+    }
+
+    tool_rc rc = tool_rc_success;
+    UINT32 created = 0;
+    while (count + created < ctx.pool.fill) {
+        TPM2B_PUBLIC *out_public = NULL;
+        TPM2B_PRIVATE *out_private = NULL;
+        TPM2B_CREATION_DATA *creation_data = NULL;
+        rc = create_ak_object(ectx, &in_public, &out_private, &out_public,
+                &creation_data);
+        if (rc == tool_rc_success) {
+            rc = pool_save(template, created, out_private, out_public,
+                    creation_data) ? tool_rc_success : tool_rc_general_error;
+        }
+
+        free(out_public);
+        free(out_private);
+        Esys_Free(creation_data);
+
+        if (rc != tool_rc_success) {
+            break;
+        }
+        created++;
+    }
+
+    tpm2_tool_output("pool:\n");
+    tpm2_tool_output("  template: %.*s\n", (int) strlen(template) - 1,
+            template);
+    tpm2_tool_output("  candidates: %"PRIu32"\n", count + created);
+    tpm2_tool_output("  created: %"PRIu32"\n", created);
+
+    return rc;
+}
+
+/*
+ * Takes a candidate of the template created under the EK out of the pool.
+ * Renaming the private portion claims it, so concurrent enrollments never
+ * share an AK.
+ */
+static bool pool_pop(ESYS_CONTEXT *ectx, const char *template,
+        TPM2B_PRIVATE *out_private, TPM2B_PUBLIC *out_public,
+        TPM2B_CREATION_DATA *creation_data) {
+
+    TPM2B_NAME *ek_name = NULL;
+    tool_rc rc = tpm2_tr_get_name(ectx, ctx.ek.ek_ctx.tr_handle, &ek_name);
+    if (rc != tool_rc_success) {
+        return false;
+    }
+
+    DIR *dir = files_opendir(ctx.pool.dir);
+    if (!dir) {
+        LOG_ERR("Could not open AK pool \"%s\", error: %s", ctx.pool.dir,
+                strerror(errno));
+        Esys_Free(ek_name);
+        return false;
+    }
+
+    bool is_found = false;
+    struct dirent *entry;
+    while (!is_found && (entry = readdir(dir))) {
+        if (!pool_is_candidate(template, entry->d_name)) {
+            continue;
+        }
+
+        char base[PATH_MAX];
+        int len = snprintf(base, sizeof(base), "%s/%.*s", ctx.pool.dir,
+                (int) (strlen(entry->d_name) - strlen(".priv")),
+                entry->d_name);
+        if (len < 0 || (size_t) len + sizeof(".claimed") > sizeof(base)) {
+            continue;
+        }
+
+        char pub_path[PATH_MAX];
+        char cd_path[PATH_MAX];
+        char priv_path[PATH_MAX];
+        char claimed_path[PATH_MAX];
+        snprintf(pub_path, sizeof(pub_path), "%s.pub", base);
+        snprintf(cd_path, sizeof(cd_path), "%s.cd", base);
+        snprintf(priv_path, sizeof(priv_path), "%s.priv", base);
+        snprintf(claimed_path, sizeof(claimed_path), "%s.claimed", base);
+
+        /* candidates of another EK stay for it */
+        if (!files_load_creation_data(cd_path, creation_data)
+                || creation_data->creationData.parentName.size != ek_name->size
+                || memcmp(creation_data->creationData.parentName.name,
+                        ek_name->name, ek_name->size)) {
+            continue;
+        }
+
+        if (!files_rename(priv_path, claimed_path)) {
+            /* taken by another enrollment */
+            continue;
+        }
+
+        is_found = files_load_private(claimed_path, out_private)
+                && files_load_public(pub_path, out_public);
+
+        files_unlink(claimed_path);
+        files_unlink(cd_path);
+        files_unlink(pub_path);
+
+        if (is_found) {
+            LOG_INFO("Using AK \"%s\" from the pool", base);
+        }
+    }
+    closedir(dir);
+    Esys_Free(ek_name);
+
+    return is_found;
+}
+
+static tool_rc create_ak_from_pool(ESYS_CONTEXT *ectx) {
+
+    TPM2B_PUBLIC in_public = TPM2B_EMPTY_INIT;
+    bool result = set_key_algorithm(&in_public);
+    if (!result) {
+        return tool_rc_general_error;
+    }
+
+    char template[64];
+    result = pool_template_name(&in_public, template, sizeof(template));
+    if (!result) {
+        return tool_rc_general_error;
+    }
+
+    TPM2B_PUBLIC out_public = TPM2B_EMPTY_INIT;
+    TPM2B_PRIVATE out_private = TPM2B_EMPTY_INIT;
+    TPM2B_CREATION_DATA creation_data = { 0 };
+    result = pool_pop(ectx, template, &out_private, &out_public,
+            &creation_data);
+    if (!result) {
+        LOG_WARN("No AK left in the pool \"%s\", creating one", ctx.pool.dir);
+        return create_ak(ectx);
+    }
+
+    return load_ak(ectx, &out_private, &out_public, &creation_data);
+}
+
 static bool on_option(char key, char *value) {
 
     switch (key) {
@@ -442,6 +731,20 @@ static bool on_option(char key, char *value) {
     case 'q':
         ctx.ak.out.qname_file = value;
         break;
+    case 0:
+        ctx.pool.dir = value;
+        break;
+    case 1:
+        if (!tpm2_util_string_to_uint32(value, &ctx.pool.fill)
+                || !ctx.pool.fill) {
+            LOG_ERR("Invalid number of AKs to fill the pool with, got: \"%s\"",
+                    value);
+            return false;
+        }
+        break;
+    case 2:
+        ctx.pool.is_pop = true;
+        break;
     }
 
     return true;
@@ -462,6 +765,9 @@ static bool tpm2_tool_onstart(tpm2_options **opts) {
         { "public",            required_argument, NULL, 'u' },
         { "private",           required_argument, NULL, 'r' },
         { "ak-qualified-name", required_argument, NULL, 'q' },
+        { "pool",              required_argument, NULL,  0  },
+        { "fill-pool",         required_argument, NULL,  1  },
+        { "from-pool",         no_argument,       NULL,  2  },
     };
 
     *opts = tpm2_options_new("P:p:C:c:n:G:g:s:f:u:r:q:", ARRAY_LEN(topts), topts,
@@ -479,7 +785,31 @@ static tool_rc tpm2_tool_onrun(ESYS_CONTEXT *ectx, tpm2_option_flags flags) {
         return tool_rc_option_error;
     }
 
-    if (!ctx.ak.out.ctx_file) {
+    if ((ctx.pool.fill || ctx.pool.is_pop) && !ctx.pool.dir) {
+        LOG_ERR("Specify the AK pool directory with --pool");
+        return tool_rc_option_error;
+    }
+
+    if (ctx.pool.fill && ctx.pool.is_pop) {
+        LOG_ERR("Specify either --fill-pool or --from-pool, not both");
+        return tool_rc_option_error;
+    }
+
+    bool is_output = ctx.ak.out.ctx_file || ctx.ak.out.pub_file
+            || ctx.ak.out.name_file || ctx.ak.out.priv_file
+            || ctx.ak.out.qname_file;
+    if (ctx.pool.fill && is_output) {
+        LOG_ERR("Filling the AK pool outputs no AK, got -c, -u, -n, -r or -q");
+        return tool_rc_option_error;
+    }
+
+    /* the auth is part of the sensitive portion, fixed at creation */
+    if (ctx.pool.is_pop && ctx.ak.auth_str) {
+        LOG_ERR("AKs from the pool have the auth given when filling it, got -p");
+        return tool_rc_option_error;
+    }
+
+    if (!ctx.ak.out.ctx_file && !ctx.pool.fill) {
         LOG_ERR("Expected option -c");
         return tool_rc_option_error;
     }
@@ -518,7 +848,11 @@ static tool_rc tpm2_tool_onrun(ESYS_CONTEXT *ectx, tpm2_option_flags flags) {
 
     tpm2_session_close(&tmp);
 
-    return create_ak(ectx);
+    if (ctx.pool.fill) {
+        return pool_fill(ectx);
+    }
+
+    return ctx.pool.is_pop ? create_ak_from_pool(ectx) : create_ak(ectx);
 }
 
 // Register this tool with tpm2_tool.c
@@ -11,6 +11,7 @@
 #include "tpm2_convert.h"
 #include "tpm2_ctx_mgmt.h"
 #include "tpm2_nv_util.h"
+#include "tpm2_primary_template.h"
 #include "tpm2_tool.h"
 
 #define RSA_EK_NONCE_NV_INDEX 0x01c00003
@@ -41,10 +42,13 @@ struct createek_context {
 
     tpm2_hierarchy_pdata objdata;
     char *out_file_path;
+    char *load_template_path;
+    char *save_template_path;
     tpm2_convert_pubkey_fmt format;
     struct {
         UINT8 f :1;
         UINT8 t :1;
+        UINT8 G :1;
     } flags;
 
     bool find_persistent_handle;
@@ -179,9 +183,32 @@ static tool_rc set_ek_template(ESYS_CONTEXT *ectx, TPM2B_PUBLIC *input_public) {
     return rc;
 }
 
+static tool_rc save_template(void) {
+
+    TPM2B_DIGEST digest = { 0 };
+    bool result = tpm2_primary_template_save(ctx.save_template_path,
+            &ctx.objdata.in.public, &digest);
+    if (!result) {
+        return tool_rc_general_error;
+    }
+
+    tpm2_tool_output("template-digest: ");
+    tpm2_util_hexdump(digest.buffer, digest.size);
+    tpm2_tool_output("\n");
+
+    return tool_rc_success;
+}
+
 static tool_rc create_ek_handle(ESYS_CONTEXT *ectx) {
 
-    if (ctx.flags.t) {
+    /* a saved template has the EK template and nonce of the NV in place */
+    if (ctx.load_template_path) {
+        bool result = tpm2_primary_template_load(ctx.load_template_path,
+                &ctx.objdata.in.public, NULL);
+        if (!result) {
+            return tool_rc_general_error;
+        }
+    } else if (ctx.flags.t) {
         tool_rc rc = set_ek_template(ectx, &ctx.objdata.in.public);
         if (rc != tool_rc_success) {
             return rc;
@@ -193,6 +220,10 @@ static tool_rc create_ek_handle(ESYS_CONTEXT *ectx) {
         }
     }
 
+    if (ctx.save_template_path) {
+        return save_template();
+    }
+
     tool_rc rc = tpm2_hierarchy_create_primary(ectx,
         ctx.auth_endorse_hierarchy.object.session, &ctx.objdata, NULL);
     if (rc != tool_rc_success) {
@@ -253,6 +284,7 @@ static bool on_option(char key, char *value) {
             return false;
         }
         ctx.objdata.in.public.publicArea.type = type;
+        ctx.flags.G = true;
     }
         break;
     case 'u':
@@ -275,6 +307,12 @@ static bool on_option(char key, char *value) {
     case 't':
         ctx.flags.t = true;
         break;
+    case 0:
+        ctx.load_template_path = value;
+        break;
+    case 1:
+        ctx.save_template_path = value;
+        break;
     }
 
     return true;
@@ -290,6 +328,8 @@ static bool tpm2_tool_onstart(tpm2_options **opts) {
         { "format",               required_argument, NULL, 'f' },
         { "ek-context",           required_argument, NULL, 'c' },
         { "template",             no_argument,       NULL, 't' },
+        { "load-template",        required_argument, NULL,  0  },
+        { "save-template",        required_argument, NULL,  1  },
     };
 
     *opts = tpm2_options_new("P:w:G:u:f:c:t", ARRAY_LEN(topts), topts,
@@ -348,13 +388,28 @@ static tool_rc tpm2_tool_onrun(ESYS_CONTEXT *ectx, tpm2_option_flags flags) {
         return tool_rc_option_error;
     }
 
-    if (!ctx.auth_ek.ctx_path) {
+    if (ctx.load_template_path && (ctx.flags.G || ctx.flags.t
+            || ctx.save_template_path)) {
+        LOG_ERR("Cannot specify -G, -t or --save-template with "
+                "--load-template");
+        return tool_rc_option_error;
+    }
+
+    /* saving a template only compiles it, no EK is created */
+    if (ctx.save_template_path && (ctx.auth_ek.ctx_path || ctx.out_file_path)) {
+        LOG_ERR("Cannot specify -c or -u with --save-template");
+        return tool_rc_option_error;
+    }
+
+    if (!ctx.auth_ek.ctx_path && !ctx.save_template_path) {
         LOG_ERR("Expected option -c");
         return tool_rc_option_error;
     }
 
     bool ret;
-    if (!strcmp(ctx.auth_ek.ctx_path, "-")) {
+    if (!ctx.auth_ek.ctx_path) {
+        /* only the template is saved */
+    } else if (!strcmp(ctx.auth_ek.ctx_path, "-")) {
         /* If user passes a handle of '-' we try and find a vacant slot for
          * to use and tell them what it is.
          */
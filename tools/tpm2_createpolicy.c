@@ -1,14 +1,19 @@
 /* SPDX-License-Identifier: BSD-3-Clause */
 
+#include <errno.h>
 #include <stdbool.h>
+#include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "files.h"
 #include "log.h"
 #include "pcr.h"
 #include "tpm2_alg_util.h"
+#include "tpm2_cc_util.h"
 #include "tpm2_policy.h"
 #include "tpm2_tool.h"
+#include "tpm2_util.h"
 
 //Records the type of policy and if one is selected
 typedef struct {
@@ -35,10 +40,35 @@ struct tpm2_pcr_policy_options {
     TPML_PCR_SELECTION pcr_selections; // records user pcr selection per setlist
 };
 
+/* a policy of a policy tree file, named to be referred to by PolicyOR */
+typedef struct policy_tree_entry policy_tree_entry;
+struct policy_tree_entry {
+    char *name;
+    TPM2B_DIGEST digest;
+};
+
+/* the pcrDigest of a PCR selection and PCR values file used before */
+typedef struct policy_tree_pcrs policy_tree_pcrs;
+struct policy_tree_pcrs {
+    char *selection;
+    char *path;
+    TPM2B_DIGEST digest;
+};
+
+typedef struct policy_tree policy_tree;
+struct policy_tree {
+    const char *path;
+    policy_tree_entry *policies;
+    size_t policy_count;
+    policy_tree_pcrs *pcrs;
+    size_t pcrs_count;
+};
+
 typedef struct create_policy_ctx create_policy_ctx;
 struct create_policy_ctx {
     tpm2_common_policy_options common_policy_options;
     tpm2_pcr_policy_options pcr_policy_options;
+    policy_tree tree;
 };
 
 #define TPM2_COMMON_POLICY_INIT { \
@@ -96,6 +126,384 @@ static tool_rc parse_policy_type_specific_command(ESYS_CONTEXT *ectx) {
             pctx.common_policy_options.policy_file);
 }
 
+/* the statement with the most arguments, a PolicyOR of eight branches */
+#define POLICY_TREE_ARGS_MAX 9
+
+static const policy_tree_entry *policy_tree_find(const char *name) {
+
+    size_t i;
+    for (i = 0; i < pctx.tree.policy_count; i++) {
+        if (!strcmp(pctx.tree.policies[i].name, name)) {
+            return &pctx.tree.policies[i];
+        }
+    }
+
+    return NULL;
+}
+
+/*
+ * The digest of the PCR values is computed once for every selection and
+ * file, the branches of a policy usually share them.
+ */
+static tool_rc policy_tree_pcr_digest(const char *selection, const char *path,
+        TPML_PCR_SELECTION *pcr_selections, TPM2B_DIGEST **digest) {
+
+    size_t i;
+    for (i = 0; i < pctx.tree.pcrs_count; i++) {
+        policy_tree_pcrs *p = &pctx.tree.pcrs[i];
+        if (!strcmp(p->selection, selection) && !strcmp(p->path, path)) {
+            *digest = &p->digest;
+            return tool_rc_success;
+        }
+    }
+
+    policy_tree_pcrs *pcrs = realloc(pctx.tree.pcrs,
+            (pctx.tree.pcrs_count + 1) * sizeof(*pcrs));
+    if (!pcrs) {
+        LOG_ERR("oom");
+        return tool_rc_general_error;
+    }
+    pctx.tree.pcrs = pcrs;
+
+    policy_tree_pcrs *p = &pcrs[pctx.tree.pcrs_count];
+    memset(p, 0, sizeof(*p));
+    p->digest.size = sizeof(p->digest.buffer);
+
+    tool_rc rc = tpm2_policy_pcr_digest_from_file(
+            pctx.common_policy_options.policy_digest_hash_alg, path,
+            pcr_selections, &p->digest);
+    if (rc != tool_rc_success) {
+        return rc;
+    }
+
+    p->selection = strdup(selection);
+    p->path = strdup(path);
+    if (!p->selection || !p->path) {
+        free(p->selection);
+        free(p->path);
+        LOG_ERR("oom");
+        return tool_rc_general_error;
+    }
+
+    pctx.tree.pcrs_count++;
+    *digest = &p->digest;
+
+    return tool_rc_success;
+}
+
+static tool_rc policy_tree_statement(tpm2_session *session, int argc,
+        char **argv) {
+
+    const char *statement = argv[0];
+
+    if (!strcmp(statement, "pcr")) {
+        if (argc != 3) {
+            LOG_ERR("Expected: pcr <pcr-list> <pcr-file>");
+            return tool_rc_general_error;
+        }
+
+        TPML_PCR_SELECTION pcr_selections;
+        if (!pcr_parse_selections(argv[1], &pcr_selections)) {
+            return tool_rc_general_error;
+        }
+
+        TPM2B_DIGEST *pcr_digest = NULL;
+        tool_rc rc = policy_tree_pcr_digest(argv[1], argv[2], &pcr_selections,
+                &pcr_digest);
+        if (rc != tool_rc_success) {
+            return rc;
+        }
+
+        return tpm2_policy_build_pcr(NULL, session, NULL, &pcr_selections,
+                pcr_digest);
+    }
+
+    if (!strcmp(statement, "or")) {
+        if (argc < 3 || (size_t) argc > POLICY_TREE_ARGS_MAX) {
+            LOG_ERR("Expected: or <policy> <policy> ..., of 2 to %d policies",
+                    POLICY_TREE_ARGS_MAX - 1);
+            return tool_rc_general_error;
+        }
+
+        TPML_DIGEST policy_list = { .count = 0 };
+        int i;
+        for (i = 1; i < argc; i++) {
+            const policy_tree_entry *branch = policy_tree_find(argv[i]);
+            if (!branch) {
+                LOG_ERR("Unknown policy \"%s\", policies must be defined "
+                        "before they are used", argv[i]);
+                return tool_rc_general_error;
+            }
+            policy_list.digests[policy_list.count++] = branch->digest;
+        }
+
+        return tpm2_policy_build_policyor(NULL, session, &policy_list);
+    }
+
+    if (!strcmp(statement, "authorize")) {
+        if (argc != 2 && argc != 3) {
+            LOG_ERR("Expected: authorize <key-name-file> [<qualification>]");
+            return tool_rc_general_error;
+        }
+
+        return tpm2_policy_build_policyauthorize(NULL, session, NULL,
+                argc == 3 ? argv[2] : NULL, argv[1], NULL);
+    }
+
+    if (!strcmp(statement, "authvalue") || !strcmp(statement, "password")) {
+        if (argc != 1) {
+            LOG_ERR("Expected: %s", statement);
+            return tool_rc_general_error;
+        }
+
+        return statement[0] == 'a' ?
+                tpm2_policy_build_policyauthvalue(NULL, session) :
+                tpm2_policy_build_policypassword(NULL, session);
+    }
+
+    if (!strcmp(statement, "commandcode")) {
+        TPM2_CC cc;
+        if (argc != 2 || !tpm2_cc_util_from_str(argv[1], &cc)) {
+            LOG_ERR("Expected: commandcode <command-code>");
+            return tool_rc_general_error;
+        }
+
+        return tpm2_policy_build_policycommandcode(NULL, session, cc);
+    }
+
+    if (!strcmp(statement, "locality")) {
+        TPMA_LOCALITY locality;
+        if (argc != 2 || !tpm2_util_string_to_uint8(argv[1], &locality)) {
+            LOG_ERR("Expected: locality <locality>");
+            return tool_rc_general_error;
+        }
+
+        return tpm2_policy_build_policylocality(NULL, session, locality);
+    }
+
+    if (!strcmp(statement, "nvwritten")) {
+        bool is_set = argc == 2 && !strcmp(argv[1], "s");
+        if (argc != 2 || (!is_set && strcmp(argv[1], "c"))) {
+            LOG_ERR("Expected: nvwritten s|c");
+            return tool_rc_general_error;
+        }
+
+        return tpm2_policy_build_policynvwritten(NULL, session,
+                is_set ? TPM2_YES : TPM2_NO);
+    }
+
+    bool is_cphash = !strcmp(statement, "cphash");
+    bool is_namehash = !strcmp(statement, "namehash");
+    if (is_cphash || is_namehash || !strcmp(statement, "template")) {
+        TPM2B_DIGEST digest = { .size = 0 };
+        if (argc != 2) {
+            LOG_ERR("Expected: %s <digest-file>", statement);
+            return tool_rc_general_error;
+        }
+
+        if (!files_load_digest(argv[1], &digest)) {
+            return tool_rc_general_error;
+        }
+
+        if (is_cphash) {
+            return tpm2_policy_build_policycphash(NULL, session, &digest);
+        }
+
+        return is_namehash ?
+                tpm2_policy_build_policynamehash(NULL, session, &digest) :
+                tpm2_policy_build_policytemplate(NULL, session, &digest);
+    }
+
+    LOG_ERR("Unknown policy statement \"%s\"", statement);
+    return tool_rc_general_error;
+}
+
+/* records the digest of the policy just built under its name */
+static tool_rc policy_tree_finish(tpm2_session **session, char *name) {
+
+    TPM2B_DIGEST *digest = NULL;
+    tool_rc rc = tpm2_policy_get_digest(NULL, *session, &digest);
+    tool_rc tmp_rc = tpm2_session_close(session);
+    if (rc != tool_rc_success || tmp_rc != tool_rc_success) {
+        free(name);
+        free(digest);
+        return rc != tool_rc_success ? rc : tmp_rc;
+    }
+
+    policy_tree_entry *policies = realloc(pctx.tree.policies,
+            (pctx.tree.policy_count + 1) * sizeof(*policies));
+    if (!policies) {
+        LOG_ERR("oom");
+        free(name);
+        free(digest);
+        return tool_rc_general_error;
+    }
+    pctx.tree.policies = policies;
+
+    policy_tree_entry *entry = &policies[pctx.tree.policy_count++];
+    entry->name = name;
+    entry->digest = *digest;
+    free(digest);
+
+    tpm2_tool_output("%s: ", entry->name);
+    tpm2_util_hexdump(entry->digest.buffer, entry->digest.size);
+    tpm2_tool_output("\n");
+
+    return tool_rc_success;
+}
+
+static tool_rc policy_tree_start(tpm2_session **session, const char *name) {
+
+    if (policy_tree_find(name)) {
+        LOG_ERR("Policy \"%s\" is defined twice", name);
+        return tool_rc_general_error;
+    }
+
+    tpm2_session_data *session_data = tpm2_session_data_new(TPM2_SE_TRIAL);
+    if (!session_data) {
+        LOG_ERR("oom");
+        return tool_rc_general_error;
+    }
+
+    tpm2_session_set_authhash(session_data,
+            pctx.common_policy_options.policy_digest_hash_alg);
+
+    /* without an ESAPI context, the digest is computed on the host */
+    return tpm2_session_open(NULL, session_data, session);
+}
+
+static tool_rc policy_tree_build(FILE *f) {
+
+    tool_rc rc = tool_rc_success;
+    tpm2_session *session = NULL;
+    char *name = NULL;
+    char *line = NULL;
+    size_t line_size = 0;
+    size_t line_number = 0;
+
+    while (rc == tool_rc_success && getline(&line, &line_size, f) != -1) {
+        line_number++;
+
+        char *comment = strchr(line, '#');
+        if (comment) {
+            *comment = '\0';
+        }
+
+        char *argv[POLICY_TREE_ARGS_MAX + 1];
+        int argc = 0;
+        char *saveptr = NULL;
+        char *token = strtok_r(line, " \t\r\n", &saveptr);
+        while (token && (size_t) argc < ARRAY_LEN(argv)) {
+            argv[argc++] = token;
+            token = strtok_r(NULL, " \t\r\n", &saveptr);
+        }
+
+        if (!argc) {
+            continue;
+        }
+
+        if ((size_t) argc == ARRAY_LEN(argv)) {
+            LOG_ERR("%s:%zu: Too many arguments", pctx.tree.path,
+                    line_number);
+            rc = tool_rc_general_error;
+            break;
+        }
+
+        if (!strcmp(argv[0], "policy")) {
+            if (argc != 2) {
+                LOG_ERR("%s:%zu: Expected: policy <name>", pctx.tree.path,
+                        line_number);
+                rc = tool_rc_general_error;
+                break;
+            }
+
+            if (session) {
+                rc = policy_tree_finish(&session, name);
+                name = NULL;
+                if (rc != tool_rc_success) {
+                    break;
+                }
+            }
+
+            name = strdup(argv[1]);
+            if (!name) {
+                LOG_ERR("oom");
+                rc = tool_rc_general_error;
+                break;
+            }
+
+            rc = policy_tree_start(&session, name);
+            if (rc != tool_rc_success) {
+                LOG_ERR("%s:%zu: Could not start policy \"%s\"",
+                        pctx.tree.path, line_number, name);
+            }
+            continue;
+        }
+
+        if (!session) {
+            LOG_ERR("%s:%zu: Expected a policy <name> line first",
+                    pctx.tree.path, line_number);
+            rc = tool_rc_general_error;
+            break;
+        }
+
+        rc = policy_tree_statement(session, argc, argv);
+        if (rc != tool_rc_success) {
+            LOG_ERR("%s:%zu: Could not build policy \"%s\"", pctx.tree.path,
+                    line_number, name);
+        }
+    }
+
+    free(line);
+
+    if (rc != tool_rc_success) {
+        free(name);
+        tool_rc tmp_rc = tpm2_session_close(&session);
+        UNUSED(tmp_rc);
+        return rc;
+    }
+
+    if (!session) {
+        LOG_ERR("No policy found in \"%s\"", pctx.tree.path);
+        return tool_rc_general_error;
+    }
+
+    return policy_tree_finish(&session, name);
+}
+
+/*
+ * Builds all policies of a policy tree file in this one process, the last
+ * one is the root saved with -L.
+ */
+static tool_rc policy_tree_create(void) {
+
+    FILE *f = files_fopen(pctx.tree.path, "r");
+    if (!f) {
+        LOG_ERR("Could not open policy tree file \"%s\", error: %s",
+                pctx.tree.path, strerror(errno));
+        return tool_rc_general_error;
+    }
+
+    tool_rc rc = policy_tree_build(f);
+    fclose(f);
+    if (rc != tool_rc_success) {
+        return rc;
+    }
+
+    const policy_tree_entry *root =
+            &pctx.tree.policies[pctx.tree.policy_count - 1];
+    bool result = files_save_bytes_to_file(
+            pctx.common_policy_options.policy_file,
+            (UINT8 *) root->digest.buffer, root->digest.size);
+    if (!result) {
+        LOG_ERR("Failed to save policy digest into file \"%s\"",
+                pctx.common_policy_options.policy_file);
+        return tool_rc_general_error;
+    }
+
+    return tool_rc_success;
+}
+
 static bool on_option(char key, char *value) {
 
     switch (key) {
@@ -127,6 +535,9 @@ static bool on_option(char key, char *value) {
     case 1:
         pctx.common_policy_options.policy_session_type = TPM2_SE_POLICY;
         break;
+    case 2:
+        pctx.tree.path = value;
+        break;
     }
 
     return true;
@@ -141,10 +552,11 @@ static bool tpm2_tool_onstart(tpm2_options **opts) {
         { "pcr",                 required_argument, NULL, 'f' },
         { "policy-pcr",          no_argument,       NULL,  0  },
         { "policy-session",      no_argument,       NULL,  1  },
+        { "policy-tree",         required_argument, NULL,  2  },
     };
 
     *opts = tpm2_options_new("L:g:l:f:", ARRAY_LEN(topts), topts, on_option,
-    NULL, 0);
+    NULL, TPM2_OPTIONS_OPTIONAL_SAPI);
 
     return *opts != NULL;
 }
@@ -161,12 +573,40 @@ static tool_rc tpm2_tool_onrun(ESYS_CONTEXT *ectx, tpm2_option_flags flags) {
         return tool_rc_option_error;
     }
 
+    if (pctx.tree.path) {
+        if (pctx.common_policy_options.policy_session_type != TPM2_SE_TRIAL
+                || pctx.common_policy_options.policy_type.policy_pcr) {
+            LOG_ERR("A policy tree cannot be combined with --policy-session or "
+                    "--policy-pcr");
+            return tool_rc_option_error;
+        }
+        return policy_tree_create();
+    }
+
+    if (!ectx && pctx.common_policy_options.policy_session_type
+            != TPM2_SE_TRIAL) {
+        LOG_ERR("A policy session needs a TPM, specify a TCTI");
+        return tool_rc_option_error;
+    }
+
     return parse_policy_type_specific_command(ectx);
 }
 
 static void tpm2_tool_onexit(void) {
 
     free(pctx.common_policy_options.policy_digest);
+
+    size_t i;
+    for (i = 0; i < pctx.tree.policy_count; i++) {
+        free(pctx.tree.policies[i].name);
+    }
+    free(pctx.tree.policies);
+
+    for (i = 0; i < pctx.tree.pcrs_count; i++) {
+        free(pctx.tree.pcrs[i].selection);
+        free(pctx.tree.pcrs[i].path);
+    }
+    free(pctx.tree.pcrs);
 }
 
 // Register this tool with tpm2_tool.c
@@ -1,16 +1,29 @@
 /* SPDX-License-Identifier: BSD-3-Clause */
 
+#include <errno.h>
+#include <limits.h>
+#include <stdio.h>
 #include <string.h>
+#include <unistd.h>
+
+#include <sys/stat.h>
+
+#include <tss2/tss2_mu.h>
 
 #include "files.h"
 #include "log.h"
 #include "pcr.h"
+#include "tpm2.h"
 #include "tpm2_tool.h"
 #include "tpm2_alg_util.h"
 #include "tpm2_auth_util.h"
 #include "tpm2_convert.h"
+#include "tpm2_hex.h"
 #include "tpm2_hierarchy.h"
+#include "tpm2_openssl.h"
 #include "tpm2_options.h"
+#include "tpm2_primary_template.h"
+#include "tpm2_util.h"
 
 #define DEFAULT_ATTRS \
      TPMA_OBJECT_RESTRICTED|TPMA_OBJECT_DECRYPT \
@@ -19,6 +32,14 @@
 
 #define DEFAULT_PRIMARY_KEY_ALG "rsa2048:null:aes128cfb"
 
+/*
+ * Environment variable naming a directory to keep the contexts of created
+ * primary keys in, so creating the same primary key again loads it instead.
+ */
+#define TPM2TOOLS_ENV_PRIMARY_CACHE "TPM2TOOLS_PRIMARY_CACHE"
+
+#define PRIMARY_CACHE_VERSION 2
+
 typedef struct tpm_createprimary_ctx tpm_createprimary_ctx;
 struct tpm_createprimary_ctx {
     struct {
@@ -35,7 +56,11 @@ struct tpm_createprimary_ctx {
     char *creation_hash_file;
     char *outside_info_data;
     char *template_data_path;
+    char *load_template_path;
+    char *save_template_path;
+    TPM2B_DIGEST template_digest;
 
+    bool is_alg_set;
     char *alg;
     char *halg;
     char *attrs;
@@ -46,6 +71,13 @@ struct tpm_createprimary_ctx {
     char *output_path;
     bool format_set;
     tpm2_convert_pubkey_fmt format;
+
+    struct {
+        char path[PATH_MAX];
+        /* a transient object only survives while these stay the same */
+        UINT32 reset_count;
+        UINT32 restart_count;
+    } cache;
 };
 
 static tpm_createprimary_ctx ctx = {
@@ -84,6 +116,7 @@ static bool on_option(char key, char *value) {
         break;
     case 'G':
         ctx.alg = value;
+        ctx.is_alg_set = true;
         break;
     case 'c':
         ctx.context_file = value;
@@ -131,6 +164,12 @@ static bool on_option(char key, char *value) {
     case 'o':
         ctx.output_path = value;
         break;
+    case 3:
+        ctx.load_template_path = value;
+        break;
+    case 4:
+        ctx.save_template_path = value;
+        break;
         /* no default */
     }
 
@@ -158,6 +197,8 @@ static bool tpm2_tool_onstart(tpm2_options **opts) {
         { "cphash",         required_argument, NULL,  2  },
         { "format",         required_argument, NULL, 'f' },
         { "output",         required_argument, NULL, 'o' },
+        { "load-template",  required_argument, NULL,  3  },
+        { "save-template",  required_argument, NULL,  4  },
     };
 
     *opts = tpm2_options_new("C:P:p:g:G:c:L:a:u:t:d:q:l:o:f:", ARRAY_LEN(topts), topts,
@@ -179,6 +220,20 @@ static tool_rc validate_input_options(void) {
         return tool_rc_option_error;
     }
 
+    if (ctx.load_template_path && (ctx.is_alg_set || ctx.halg || ctx.attrs
+            || ctx.policy || ctx.unique_file || ctx.save_template_path)) {
+        LOG_ERR("Cannot specify the template options with --load-template");
+        return tool_rc_option_error;
+    }
+
+    /* saving a template only compiles it, no key is created */
+    if (ctx.save_template_path && (ctx.context_file || ctx.creation_data_file
+            || ctx.creation_ticket_file || ctx.creation_hash_file
+            || ctx.output_path || ctx.cp_hash_path)) {
+        LOG_ERR("Cannot generate outputs when saving the template");
+        return tool_rc_option_error;
+    }
+
     return tool_rc_success;
 }
 
@@ -205,24 +260,34 @@ static tool_rc process_inputs(ESYS_CONTEXT *ectx) {
 
     tpm2_session_close(&tmp);
 
-    /*
-     * Initialize the public properties of the key
-     */
-    rc = tpm2_alg_util_public_init(ctx.alg, ctx.halg, ctx.attrs,
-            ctx.policy, DEFAULT_ATTRS, &ctx.objdata.in.public);
-    if (rc != tool_rc_success) {
-        return rc;
-    }
-
-    /* Optional unique data */
-    if (ctx.unique_file) {
-        if (!strcmp(ctx.unique_file, "-")) {
-            ctx.unique_file = 0;
+    /* A saved template has the public properties and unique data in place */
+    if (ctx.load_template_path) {
+        bool result = tpm2_primary_template_load(ctx.load_template_path,
+                &ctx.objdata.in.public, &ctx.template_digest);
+        if (!result) {
+            return tool_rc_general_error;
         }
-        rc = files_load_unique_data(ctx.unique_file, &ctx.objdata.in.public);
+    } else {
+        /*
+         * Initialize the public properties of the key
+         */
+        rc = tpm2_alg_util_public_init(ctx.alg, ctx.halg, ctx.attrs,
+                ctx.policy, DEFAULT_ATTRS, &ctx.objdata.in.public);
         if (rc != tool_rc_success) {
             return rc;
         }
+
+        /* Optional unique data */
+        if (ctx.unique_file) {
+            if (!strcmp(ctx.unique_file, "-")) {
+                ctx.unique_file = 0;
+            }
+            rc = files_load_unique_data(ctx.unique_file,
+                    &ctx.objdata.in.public);
+            if (rc != tool_rc_success) {
+                return rc;
+            }
+        }
     }
 
     /* Outside data is optional. If not specified default to 0 */
@@ -274,7 +339,7 @@ static tool_rc no_execute_only_process_params(ESYS_CONTEXT *ectx) {
 
 static tool_rc process_outputs(ESYS_CONTEXT *ectx) {
 
-    tpm2_util_public_to_yaml(ctx.objdata.out.public, NULL);
+    tpm2_util_public_to_yaml(ctx.objdata.out.public);
 
     tool_rc  rc = ctx.context_file ? files_save_tpm_context_to_path(ectx,
     ctx.objdata.out.handle, ctx.context_file) : tool_rc_success;
@@ -322,6 +387,210 @@ static tool_rc process_outputs(ESYS_CONTEXT *ectx) {
     return tool_rc_success;
 }
 
+static tool_rc save_template(void) {
+
+    bool result = tpm2_primary_template_save(ctx.save_template_path,
+            &ctx.objdata.in.public, &ctx.template_digest);
+    if (!result) {
+        return tool_rc_general_error;
+    }
+
+    tpm2_tool_output("template-digest: ");
+    tpm2_util_hexdump(ctx.template_digest.buffer, ctx.template_digest.size);
+    tpm2_tool_output("\n");
+
+    return tool_rc_success;
+}
+
+/*
+ * A cached key is loaded without the hierarchy authorization, so whoever can
+ * read the directory can use the keys, and whoever can write it can plant
+ * contexts. Only a directory of this user no one else can access is used.
+ */
+static bool primary_cache_dir_is_private(const char *dir) {
+
+    struct stat st;
+    if (stat(dir, &st)) {
+        return false;
+    }
+
+    if (!S_ISDIR(st.st_mode) || st.st_uid != geteuid()
+            || (st.st_mode & (S_IRWXG | S_IRWXO))) {
+        LOG_WARN("Ignoring primary cache \"%s\" other users can access", dir);
+        return false;
+    }
+
+    return true;
+}
+
+/*
+ * The primary key only depends on the hierarchy, the template and the
+ * sensitive data, the other inputs only go into the creation data, which is
+ * not cached. The template goes in by its digest, which a saved template
+ * comes with.
+ */
+static bool primary_cache_init(ESYS_CONTEXT *ectx) {
+
+    const char *dir = tpm2_util_getenv(TPM2TOOLS_ENV_PRIMARY_CACHE);
+    if (!dir || !dir[0] || ctx.creation_data_file || ctx.creation_ticket_file
+            || ctx.creation_hash_file || !primary_cache_dir_is_private(dir)) {
+        return false;
+    }
+
+    if (!ctx.template_digest.size) {
+        bool result = tpm2_primary_template_digest(&ctx.objdata.in.public,
+                &ctx.template_digest);
+        if (!result) {
+            return false;
+        }
+    }
+
+    UINT8 buffer[sizeof(UINT32) + sizeof(TPM2B_DIGEST)
+            + sizeof(TPM2B_SENSITIVE_CREATE)];
+    size_t offset = 0;
+    TSS2_RC rval = Tss2_MU_UINT32_Marshal(ctx.objdata.in.hierarchy, buffer,
+            sizeof(buffer), &offset);
+    if (rval == TSS2_RC_SUCCESS) {
+        rval = Tss2_MU_TPM2B_DIGEST_Marshal(&ctx.template_digest, buffer,
+                sizeof(buffer), &offset);
+    }
+    if (rval == TSS2_RC_SUCCESS) {
+        rval = Tss2_MU_TPM2B_SENSITIVE_CREATE_Marshal(
+                &ctx.objdata.in.sensitive, buffer, sizeof(buffer), &offset);
+    }
+    if (rval != TSS2_RC_SUCCESS) {
+        LOG_PERR(Tss2_MU_TPM2B_SENSITIVE_CREATE_Marshal, rval);
+        return false;
+    }
+
+    TPM2B_DIGEST key = TPM2B_TYPE_INIT(TPM2B_DIGEST, buffer);
+    bool result = tpm2_openssl_hash_compute_data(TPM2_ALG_SHA256, buffer,
+            offset, &key);
+    if (!result) {
+        return false;
+    }
+
+    int len = snprintf(ctx.cache.path, sizeof(ctx.cache.path), "%s/", dir);
+    if (len < 0 || (size_t) len + TPM2_HEX_SIZE(key.size)
+            > sizeof(ctx.cache.path)) {
+        LOG_WARN("Primary cache path \"%s\" is too long", dir);
+        return false;
+    }
+    tpm2_hex_encode(key.buffer, key.size, ctx.cache.path + len, false);
+
+    TPMS_TIME_INFO *time_info = NULL;
+    tool_rc rc = tpm2_readclock(ectx, &time_info);
+    if (rc != tool_rc_success) {
+        return false;
+    }
+
+    ctx.cache.reset_count = time_info->clockInfo.resetCount;
+    ctx.cache.restart_count = time_info->clockInfo.restartCount;
+    free(time_info);
+
+    return true;
+}
+
+/*
+ * The public area the TPM reports for a loaded key is the one of the
+ * template, but for the unique field: the TPM replaces it with the key it
+ * derives, from the unique field of the template among others, which goes
+ * into the cache key with the template. The attributes, name algorithm,
+ * policy and parameters are compared marshaled.
+ */
+static bool primary_cache_matches(const TPMT_PUBLIC *loaded) {
+
+    TPMT_PUBLIC publics[2] = { *loaded, ctx.objdata.in.public.publicArea };
+    UINT8 buffers[2][sizeof(TPMT_PUBLIC)];
+    size_t sizes[2] = { 0, 0 };
+
+    size_t i;
+    for (i = 0; i < ARRAY_LEN(publics); i++) {
+        memset(&publics[i].unique, 0, sizeof(publics[i].unique));
+        TSS2_RC rval = Tss2_MU_TPMT_PUBLIC_Marshal(&publics[i], buffers[i],
+                sizeof(buffers[i]), &sizes[i]);
+        if (rval != TSS2_RC_SUCCESS) {
+            LOG_PERR(Tss2_MU_TPMT_PUBLIC_Marshal, rval);
+            return false;
+        }
+    }
+
+    return sizes[0] == sizes[1] && !memcmp(buffers[0], buffers[1], sizes[0]);
+}
+
+static bool primary_cache_load(ESYS_CONTEXT *ectx) {
+
+    FILE *f = fopen(ctx.cache.path, "rb");
+    if (!f) {
+        return false;
+    }
+
+    UINT32 version = 0;
+    UINT32 reset_count = 0;
+    UINT32 restart_count = 0;
+    bool result = files_read_header(f, &version)
+            && version == PRIMARY_CACHE_VERSION
+            && files_read_32(f, &reset_count)
+            && reset_count == ctx.cache.reset_count
+            && files_read_32(f, &restart_count)
+            && restart_count == ctx.cache.restart_count;
+
+    ESYS_TR handle = ESYS_TR_NONE;
+    if (result) {
+        result = files_load_tpm_context_from_file(ectx, &handle, f)
+                == tool_rc_success;
+    }
+
+    fclose(f);
+
+    if (!result) {
+        LOG_INFO("Primary cache entry \"%s\" is stale, creating the key",
+                ctx.cache.path);
+        return false;
+    }
+
+    /*
+     * The TPM only loads a context of one of its objects, its public area is
+     * checked against the template, not against what the file says.
+     */
+    TPM2B_PUBLIC *public = NULL;
+    tool_rc rc = tpm2_readpublic(ectx, handle, &public, NULL, NULL);
+    result = rc == tool_rc_success
+            && primary_cache_matches(&public->publicArea);
+    if (!result) {
+        LOG_WARN("Primary cache entry \"%s\" does not match the key, "
+                "creating the key", ctx.cache.path);
+        free(public);
+        tpm2_flush_context(ectx, handle);
+        return false;
+    }
+
+    ctx.objdata.out.handle = handle;
+    ctx.objdata.out.public = public;
+
+    return true;
+}
+
+static void primary_cache_save(ESYS_CONTEXT *ectx) {
+
+    files_atomic atomic;
+    FILE *f = files_atomic_open(&atomic, ctx.cache.path);
+    if (!f) {
+        return;
+    }
+
+    bool result = files_write_header(f, PRIMARY_CACHE_VERSION)
+            && files_write_32(f, ctx.cache.reset_count)
+            && files_write_32(f, ctx.cache.restart_count)
+            && files_save_tpm_context_to_file(ectx, ctx.objdata.out.handle, f)
+                    == tool_rc_success;
+
+    if (!files_atomic_close(&atomic, f, result)) {
+        LOG_WARN("Could not write primary cache entry \"%s\"",
+                ctx.cache.path);
+    }
+}
+
 static tool_rc tpm2_tool_onrun(ESYS_CONTEXT *ectx, tpm2_option_flags flags) {
 
     UNUSED(flags);
@@ -338,11 +607,21 @@ static tool_rc tpm2_tool_onrun(ESYS_CONTEXT *ectx, tpm2_option_flags flags) {
         return rc;
     }
 
+    if (ctx.save_template_path) {
+        return save_template();
+    }
+
     /* Process & return uncoditionally if no execute paths are to be executed */
     if (ctx.cp_hash_path) { // One of the conditions for no execute
         return no_execute_only_process_params(ectx);
     }
 
+    bool is_cached = primary_cache_init(ectx);
+    if (is_cached && primary_cache_load(ectx)) {
+        LOG_INFO("Loaded primary key from \"%s\"", ctx.cache.path);
+        return process_outputs(ectx);
+    }
+
     /* Dispatch TPM2_CC_CreatePrimary */
     rc = tpm2_hierarchy_create_primary(ectx, ctx.parent.session, &ctx.objdata,
     NULL);
@@ -350,6 +629,10 @@ static tool_rc tpm2_tool_onrun(ESYS_CONTEXT *ectx, tpm2_option_flags flags) {
         return rc;
     }
 
+    if (is_cached) {
+        primary_cache_save(ectx);
+    }
+
     /* Process outputs and return */
     return process_outputs(ectx);
 }
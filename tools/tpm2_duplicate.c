@@ -1,6 +1,7 @@
 /* SPDX-License-Identifier: BSD-3-Clause */
 
 #include <stdbool.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
@@ -11,9 +12,13 @@
 #include "tpm2.h"
 #include "tpm2_tool.h"
 #include "tpm2_alg_util.h"
+#include "tpm2_auth_util.h"
+#include "tpm2_ctx_archive.h"
 #include "tpm2_options.h"
 #include "tpm2_openssl.h"
 #include "tpm2_identity_util.h"
+#include "tpm2_pipeline.h"
+#include "tpm2_policy.h"
 
 typedef struct tpm_duplicate_ctx tpm_duplicate_ctx;
 struct tpm_duplicate_ctx {
@@ -55,6 +60,9 @@ struct tpm_duplicate_ctx {
     } flags;
 
     char *cp_hash_path;
+
+    const char *manifest_path;
+    const char *archive_path;
 };
 
 static tpm_duplicate_ctx ctx = {
@@ -86,6 +94,368 @@ static tool_rc do_duplicate(ESYS_CONTEXT *ectx, TPM2B_DATA *in_key,
             encrypted_seed, NULL);
 }
 
+/* the members of the archive per key: public, duplicate, seed and key */
+#define MANIFEST_MEMBERS 4
+
+/*
+ * A key of a manifest, a "<key-context> <name>" line. The paths point into
+ * the line. The outputs of the TPM are marshaled into the archive members
+ * named <name>.pub, <name>.priv, <name>.seed and, for a key the TPM chose,
+ * <name>.key, once the next duplicate is sent.
+ */
+typedef struct manifest_key manifest_key;
+struct manifest_key {
+    char *line;
+    size_t line_number;
+    const char *ctx_path;
+    const char *name;
+    TPM2B_PUBLIC *public;
+    TPM2B_DATA *out_key;
+    TPM2B_PRIVATE *duplicate;
+    TPM2B_ENCRYPTED_SECRET *encrypted_seed;
+    char *member_names[MANIFEST_MEMBERS];
+    UINT8 *member_data[MANIFEST_MEMBERS];
+    size_t member_sizes[MANIFEST_MEMBERS];
+    size_t member_count;
+};
+
+typedef struct manifest manifest;
+struct manifest {
+    manifest_key *keys;
+    size_t count;
+    const TPM2B_DATA *in_key;
+    const TPMT_SYM_DEF_OBJECT *sym_alg;
+    /* the next key to duplicate, and the one at the TPM */
+    size_t next;
+    manifest_key *in_flight;
+    tpm2_loaded_object object;
+};
+
+static bool manifest_add(void *e, char *line, char **fields, size_t count,
+        size_t line_number, void *userdata) {
+
+    UNUSED(count);
+
+    manifest *m = (manifest *) userdata;
+    manifest_key *key = (manifest_key *) e;
+    key->line = line;
+    key->line_number = line_number;
+    key->ctx_path = fields[0];
+    key->name = fields[1];
+
+    /* the key is the last one */
+    size_t i;
+    for (i = 0; i + 1 < m->count; i++) {
+        if (!strcmp(m->keys[i].name, key->name)) {
+            LOG_ERR("%s:%zu: The name \"%s\" is already used on line %zu",
+                    ctx.manifest_path, line_number, key->name,
+                    m->keys[i].line_number);
+            return false;
+        }
+    }
+
+    return true;
+}
+
+static bool manifest_load(manifest *m) {
+
+    return tpm2_util_manifest_read(ctx.manifest_path, 2, 2,
+            "<key-context> <name>", (void **) &m->keys, &m->count,
+            sizeof(*m->keys), manifest_add, m);
+}
+
+static void manifest_key_release(manifest_key *key) {
+
+    free(key->public);
+    free(key->out_key);
+    free(key->duplicate);
+    free(key->encrypted_seed);
+    key->public = NULL;
+    key->out_key = NULL;
+    key->duplicate = NULL;
+    key->encrypted_seed = NULL;
+}
+
+static void manifest_free(manifest *m) {
+
+    size_t i;
+    for (i = 0; i < m->count; i++) {
+        manifest_key *key = &m->keys[i];
+        manifest_key_release(key);
+
+        size_t j;
+        for (j = 0; j < key->member_count; j++) {
+            free(key->member_names[j]);
+            free(key->member_data[j]);
+        }
+        free(key->line);
+    }
+    free(m->keys);
+}
+
+static bool manifest_key_add_member(manifest_key *key, const char *suffix,
+        UINT8 *data, size_t size) {
+
+    size_t len = strlen(key->name) + strlen(suffix) + 1;
+    char *name = malloc(len);
+    if (!name) {
+        LOG_ERR("oom");
+        free(data);
+        return false;
+    }
+    snprintf(name, len, "%s%s", key->name, suffix);
+
+    key->member_names[key->member_count] = name;
+    key->member_data[key->member_count] = data;
+    key->member_sizes[key->member_count] = size;
+    key->member_count++;
+
+    return true;
+}
+
+#define MARSHAL_MEMBER(type, key, suffix, value) \
+    do { \
+        UINT8 *_data = malloc(sizeof(*value)); \
+        size_t _size = 0; \
+        if (!_data) { \
+            LOG_ERR("oom"); \
+            return false; \
+        } \
+        TSS2_RC _rc = Tss2_MU_##type##_Marshal(value, _data, \
+                sizeof(*value), &_size); \
+        if (_rc != TSS2_RC_SUCCESS) { \
+            LOG_ERR("Error serializing "xstr(type)" structure: 0x%x", _rc); \
+            free(_data); \
+            return false; \
+        } \
+        if (!manifest_key_add_member(key, suffix, _data, _size)) { \
+            return false; \
+        } \
+    } while (0)
+
+static bool manifest_key_marshal(manifest_key *key) {
+
+    MARSHAL_MEMBER(TPM2B_PUBLIC, key, ".pub", key->public);
+    MARSHAL_MEMBER(TPM2B_PRIVATE, key, ".priv", key->duplicate);
+    MARSHAL_MEMBER(TPM2B_ENCRYPTED_SECRET, key, ".seed", key->encrypted_seed);
+
+    if (key->out_key && key->out_key->size) {
+        UINT8 *data = malloc(key->out_key->size);
+        if (!data) {
+            LOG_ERR("oom");
+            return false;
+        }
+        memcpy(data, key->out_key->buffer, key->out_key->size);
+        if (!manifest_key_add_member(key, ".key", data,
+                key->out_key->size)) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+static bool is_session_auth(const char *auth_str) {
+
+    return auth_str && !strncmp(auth_str, "session:", strlen("session:"));
+}
+
+/*
+ * Every Duplicate resets the policy of a policy session, so before the next
+ * key the duplication policy that tpm2_policycommandcode builds is satisfied
+ * again in the same session rather than starting a new one.
+ */
+static tool_rc duplicable_key_restart(ESYS_CONTEXT *ectx,
+        tpm2_session *session) {
+
+    if (!is_session_auth(ctx.duplicable_key.auth_str)) {
+        return tpm2_auth_util_restart(ectx, ctx.duplicable_key.auth_str,
+                session);
+    }
+
+    tool_rc rc = tpm2_session_restart(ectx, session);
+    if (rc != tool_rc_success) {
+        return rc;
+    }
+
+    return tpm2_policy_build_policycommandcode(ectx, session,
+            TPM2_CC_Duplicate);
+}
+
+static tool_rc manifest_prepare(void *userdata, bool *is_next) {
+
+    manifest *m = (manifest *) userdata;
+
+    *is_next = m->next < m->count;
+
+    return tool_rc_success;
+}
+
+/*
+ * Loads the next key, satisfies its authorization and sends its duplicate.
+ * The key of the first line takes the session of -p, the others share it.
+ */
+static tool_rc manifest_submit(ESYS_CONTEXT *ectx, void *userdata) {
+
+    manifest *m = (manifest *) userdata;
+    manifest_key *key = &m->keys[m->next];
+
+    tool_rc rc = !m->next ?
+            tpm2_util_object_load_auth(ectx, key->ctx_path,
+                    ctx.duplicable_key.auth_str, &ctx.duplicable_key.object,
+                    false, TPM2_HANDLE_ALL_W_NV) :
+            tpm2_util_object_load(ectx, key->ctx_path, &m->object,
+                    TPM2_HANDLE_ALL_W_NV);
+    if (rc != tool_rc_success) {
+        LOG_ERR("%s:%zu: Could not load key \"%s\"", ctx.manifest_path,
+                key->line_number, key->ctx_path);
+        return rc;
+    }
+
+    if (!m->next) {
+        m->object = ctx.duplicable_key.object;
+    } else {
+        m->object.session = ctx.duplicable_key.object.session;
+        rc = duplicable_key_restart(ectx, m->object.session);
+    }
+
+    /* the import needs the public area besides the duplicate */
+    if (rc == tool_rc_success) {
+        rc = tpm2_readpublic(ectx, m->object.tr_handle, &key->public, NULL,
+                NULL);
+    }
+    if (rc == tool_rc_success) {
+        rc = tpm2_duplicate_async(ectx, &m->object,
+                &ctx.new_parent_key.object, m->in_key, m->sym_alg);
+    }
+    if (rc != tool_rc_success) {
+        LOG_ERR("%s:%zu: Could not duplicate key \"%s\"", ctx.manifest_path,
+                key->line_number, key->ctx_path);
+        tpm2_util_object_unload(ectx, &m->object);
+        return rc;
+    }
+
+    m->in_flight = key;
+    m->next++;
+
+    return tool_rc_success;
+}
+
+static tool_rc manifest_finish(ESYS_CONTEXT *ectx, void *userdata) {
+
+    manifest *m = (manifest *) userdata;
+    manifest_key *key = m->in_flight;
+
+    tool_rc rc = tpm2_duplicate_finish(ectx,
+            ctx.flags.i || ctx.key_type == TPM2_ALG_NULL ?
+                    NULL : &key->out_key,
+            &key->duplicate, &key->encrypted_seed);
+
+    /* the TPM is idle, so the key is unloaded before the next one */
+    tool_rc tmp_rc = tpm2_util_object_unload(ectx, &m->object);
+    if (rc == tool_rc_success) {
+        rc = tmp_rc;
+    }
+
+    if (rc != tool_rc_success) {
+        LOG_ERR("%s:%zu: Could not duplicate key \"%s\"", ctx.manifest_path,
+                key->line_number, key->ctx_path);
+        manifest_key_release(key);
+    }
+
+    return rc;
+}
+
+static tool_rc manifest_complete(void *userdata) {
+
+    manifest *m = (manifest *) userdata;
+    manifest_key *key = m->in_flight;
+
+    bool result = manifest_key_marshal(key);
+    manifest_key_release(key);
+
+    tpm2_tool_output("- line: %zu\n", key->line_number);
+    tpm2_tool_output("  key-context: %s\n", key->ctx_path);
+    tpm2_tool_output("  name: %s\n", key->name);
+    tpm2_tool_output("  duplicated: %s\n", result ? "true" : "false");
+
+    return result ? tool_rc_success : tool_rc_general_error;
+}
+
+static void manifest_discard(void *userdata) {
+
+    manifest *m = (manifest *) userdata;
+
+    manifest_key_release(m->in_flight);
+}
+
+/*
+ * Duplicates the keys of a manifest to the new parent, loaded once, with the
+ * authorization session of -p reused for every key. The duplicate of the next
+ * key is sent before the outputs of the previous one are marshaled. The
+ * archive holds the duplicates of all keys and is only written when every key
+ * was duplicated, so tpm2_import gets them as <archive>#<name>.priv and so on.
+ */
+static tool_rc manifest_run(ESYS_CONTEXT *ectx, const TPM2B_DATA *in_key,
+        const TPMT_SYM_DEF_OBJECT *sym_alg) {
+
+    static const tpm2_pipeline_ops ops = {
+        .prepare = manifest_prepare,
+        .submit = manifest_submit,
+        .finish = manifest_finish,
+        .complete = manifest_complete,
+        .discard = manifest_discard,
+    };
+
+    manifest m = {
+        .in_key = in_key,
+        .sym_alg = sym_alg,
+        .object = { .tr_handle = ESYS_TR_NONE },
+    };
+    tpm2_ctx_archive_member *members = NULL;
+    tool_rc rc = tool_rc_general_error;
+
+    if (!manifest_load(&m)) {
+        goto out;
+    }
+
+    rc = tpm2_pipeline_run(ectx, &ops, &m);
+    if (rc != tool_rc_success) {
+        goto out;
+    }
+
+    members = calloc(m.count * MANIFEST_MEMBERS + 1, sizeof(*members));
+    if (!members) {
+        LOG_ERR("oom");
+        rc = tool_rc_general_error;
+        goto out;
+    }
+
+    UINT32 count = 0;
+    size_t i;
+    for (i = 0; i < m.count; i++) {
+        const manifest_key *key = &m.keys[i];
+        size_t j;
+        for (j = 0; j < key->member_count; j++) {
+            members[count++] = (tpm2_ctx_archive_member) {
+                .name = key->member_names[j],
+                .data = key->member_data[j],
+                .size = key->member_sizes[j],
+            };
+        }
+    }
+
+    if (!tpm2_ctx_archive_write(ctx.archive_path, members, count)) {
+        rc = tool_rc_general_error;
+    }
+
+out:
+    free(members);
+    manifest_free(&m);
+
+    return rc;
+}
+
 static bool on_option(char key, char *value) {
 
     switch (key) {
@@ -142,6 +512,12 @@ static bool on_option(char key, char *value) {
     case 0:
         ctx.cp_hash_path = value;
         break;
+    case 1:
+        ctx.manifest_path = value;
+        break;
+    case 2:
+        ctx.archive_path = value;
+        break;
     default:
         LOG_ERR("Invalid option");
         return false;
@@ -166,6 +542,8 @@ static bool tpm2_tool_onstart(tpm2_options **opts) {
       { "parent-public",     required_argument, NULL, 'U'},
       { "key-context",       required_argument, NULL, 'c'},
       { "cphash",            required_argument, NULL,  0 },
+      { "manifest",          required_argument, NULL,  1 },
+      { "archive",           required_argument, NULL,  2 },
     };
 
     *opts = tpm2_options_new("p:L:G:i:C:o:s:r:c:U:k:u:", ARRAY_LEN(topts), topts,
@@ -183,6 +561,30 @@ static bool check_options(void) {
 
     bool result = true;
 
+    if (ctx.manifest_path || ctx.archive_path) {
+        if (!ctx.manifest_path || !ctx.archive_path) {
+            LOG_ERR("Expected both --manifest and --archive");
+            result = false;
+        }
+
+        if (ctx.flags.c || ctx.flags.r || ctx.flags.s || ctx.flags.u
+                || ctx.flags.o || ctx.flags.U || ctx.flags.k
+                || ctx.cp_hash_path) {
+            LOG_ERR("The manifest names the keys and the archive holds the "
+                    "outputs, cannot specify -c, -r, -s, -u, -o, -U, -k or "
+                    "--cphash");
+            result = false;
+        }
+
+        if (!ctx.flags.G || !ctx.flags.C) {
+            LOG_ERR("Expected the key type \"-G\" and the new parent "
+                    "\"-C\"");
+            result = false;
+        }
+
+        return result;
+    }
+
     /* Check for NULL alg & (keyin | keyout) */
     if (ctx.flags.G == 0) {
         LOG_ERR("Expected key type to be specified via \"-G\","
@@ -272,81 +674,22 @@ static tool_rc tpm2_create_duplicate(
 {
     bool result;
     tool_rc rc = tool_rc_success;
-    TSS2_RC rval;
 
     /*
-     * Calculate the object name.
+     * The duplicate only has the outer wrapper, the sensitive area is
+     * encrypted with the seed value and covered by the outer HMAC.
      */
-    TPM2B_NAME pubname = TPM2B_TYPE_INIT(TPM2B_NAME, name);
-    result = tpm2_identity_create_name(public, &pubname);
+    tpm2_identity_util_wrap_job job = {
+        .parent_pub = parent_pub,
+        .public = public,
+        .sensitive = privkey,
+    };
+    result = tpm2_identity_util_wrap(NULL, &job);
     if (!result) {
-        return false;
-    }
-
-
-    TPM2B_DIGEST * seed = &privkey->sensitiveArea.seedValue;
-    TPM2B_MAX_BUFFER hmac_key;
-    TPM2B_MAX_BUFFER enc_key;
-    tpm2_identity_util_calc_outer_integrity_hmac_key_and_dupsensitive_enc_key(
-            parent_pub, &pubname, seed, &hmac_key, &enc_key);
-
-    /*
-     * Marshall the private key into a buffer
-     */
-    TPM2B_MAX_BUFFER marshalled_sensitive = TPM2B_EMPTY_INIT;
-    size_t marshalled_sensitive_size = 0;
-    rval = Tss2_MU_TPMT_SENSITIVE_Marshal(&privkey->sensitiveArea,
-            marshalled_sensitive.buffer + sizeof(marshalled_sensitive.size),
-            TPM2_MAX_DIGEST_BUFFER, &marshalled_sensitive_size);
-    if (rval != TPM2_RC_SUCCESS) {
-        LOG_ERR("Error serializing sensitive area");
-        return false;
-    }
-
-    size_t marshalled_sensitive_size_info = 0;
-    rval = Tss2_MU_UINT16_Marshal(marshalled_sensitive_size,
-            marshalled_sensitive.buffer, sizeof(marshalled_sensitive.size),
-            &marshalled_sensitive_size_info);
-    if (rval != TPM2_RC_SUCCESS) {
-        LOG_ERR("Error serializing sensitive area size");
-        return false;
-    }
-
-    marshalled_sensitive.size = marshalled_sensitive_size
-	+ marshalled_sensitive_size_info;
-
-    /*
-     * Compute the outer HMAC over the marshalled sensitive area
-     * and encrypt it with the seed value.
-     */
-    TPM2B_DIGEST outer_hmac = TPM2B_EMPTY_INIT;
-    TPM2B_MAX_BUFFER encrypted_duplicate_sensitive = TPM2B_EMPTY_INIT;
-    tpm2_identity_util_calculate_outer_integrity(parent_pub->publicArea.nameAlg,
-            &pubname, &marshalled_sensitive, &hmac_key, &enc_key,
-            &parent_pub->publicArea.parameters.rsaDetail.symmetric,
-            &encrypted_duplicate_sensitive, &outer_hmac);
-
-    /*
-     * Build the private data structure for writing out
-     */
-    TPM2B_PRIVATE private = TPM2B_EMPTY_INIT;
-    UINT16 parent_hash_size = tpm2_alg_util_get_hash_size(parent_pub->publicArea.nameAlg);
-    private.size = sizeof(parent_hash_size) + parent_hash_size
-	+ encrypted_duplicate_sensitive.size;
-
-    size_t hmac_size_offset = 0;
-    rval = Tss2_MU_UINT16_Marshal(parent_hash_size, private.buffer,
-            sizeof(parent_hash_size), &hmac_size_offset);
-    if (rval != TPM2_RC_SUCCESS) {
-        LOG_ERR("Error serializing hmac size");
-        return false;
+        return tool_rc_general_error;
     }
 
-    memcpy(private.buffer + hmac_size_offset, outer_hmac.buffer,
-            parent_hash_size);
-    memcpy(private.buffer + hmac_size_offset + parent_hash_size,
-            encrypted_duplicate_sensitive.buffer,
-            encrypted_duplicate_sensitive.size);
+    TPM2B_PRIVATE *private = &job.duplicate;
 
     /*
      * Write out the generated files
@@ -359,7 +702,7 @@ static tool_rc tpm2_create_duplicate(
         goto out;
     }
 
-    result = files_save_private(&private, ctx.duplicate_key_private_file);
+    result = files_save_private(private, ctx.duplicate_key_private_file);
     if (!result) {
         LOG_ERR("Failed to save private key into file \"%s\"",
                 ctx.duplicate_key_private_file);
@@ -436,12 +779,15 @@ static tool_rc tpm2_tool_onrun(ESYS_CONTEXT *ectx, tpm2_option_flags flags) {
         return rc;
     }
 
-    rc = tpm2_util_object_load_auth(ectx, ctx.duplicable_key.ctx_path,
-            ctx.duplicable_key.auth_str, &ctx.duplicable_key.object, false,
-            TPM2_HANDLE_ALL_W_NV);
-    if (rc != tool_rc_success) {
-        LOG_ERR("Invalid authorization");
-        return rc;
+    /* the keys of a manifest are loaded one after the other */
+    if (!ctx.manifest_path) {
+        rc = tpm2_util_object_load_auth(ectx, ctx.duplicable_key.ctx_path,
+                ctx.duplicable_key.auth_str, &ctx.duplicable_key.object, false,
+                TPM2_HANDLE_ALL_W_NV);
+        if (rc != tool_rc_success) {
+            LOG_ERR("Invalid authorization");
+            return rc;
+        }
     }
 
     result = set_key_algorithm(ctx.key_type, &sym_alg);
@@ -463,6 +809,10 @@ static tool_rc tpm2_tool_onrun(ESYS_CONTEXT *ectx, tpm2_option_flags flags) {
         }
     }
 
+    if (ctx.manifest_path) {
+        return manifest_run(ectx, ctx.flags.i ? &in_key : NULL, &sym_alg);
+    }
+
     rc = do_duplicate(ectx, ctx.flags.i ? &in_key : NULL, &sym_alg,
             ctx.flags.o ? &out_key : NULL, &duplicate, &out_sym_seed);
     if (rc != tool_rc_success || ctx.cp_hash_path) {
@@ -1,4 +1,10 @@
 /* SPDX-License-Identifier: BSD-3-Clause */
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <tss2/tss2_mu.h>
+
 #include "files.h"
 #include "log.h"
 #include "object.h"
@@ -21,6 +27,8 @@ struct tpm_ecdhzgen_ctx {
 
     TPM2B_ECC_POINT *Z;
     TPM2B_ECC_POINT Q;
+
+    bool is_batch;
 };
 
 static tpm_ecdhzgen_ctx ctx;
@@ -41,6 +49,9 @@ static bool on_option(char key, char *value) {
         case 'o':
             ctx.ecdh_Z_path = value;
             break;
+        case 0:
+            ctx.is_batch = true;
+            break;
     };
 
     return true;
@@ -53,6 +64,7 @@ static bool tpm2_tool_onstart(tpm2_options **opts) {
       { "key-auth",    required_argument, NULL, 'p' },
       { "public",      required_argument, NULL, 'u' },
       { "output",      required_argument, NULL, 'o' },
+      { "batch",       no_argument,       NULL,  0  },
     };
 
     *opts = tpm2_options_new("c:p:u:o:", ARRAY_LEN(topts), topts,
@@ -86,6 +98,11 @@ static tool_rc process_inputs(ESYS_CONTEXT *ectx) {
         return rc;
     }
 
+    /* the points of a batch are streamed as they are computed */
+    if (ctx.is_batch) {
+        return tool_rc_success;
+    }
+
     bool result = true;
     result = files_load_ecc_point(ctx.ecdh_pub_path, &ctx.Q);
     if (!result) {
@@ -96,6 +113,154 @@ static tool_rc process_inputs(ESYS_CONTEXT *ectx) {
     return tool_rc_success;
 }
 
+typedef struct zgen_job zgen_job;
+struct zgen_job {
+    TPM2B_ECC_POINT Q;
+};
+
+/*
+ * Reads the next peer point record and sends it to the TPM. A record holds a
+ * marshaled TPMS_ECC_POINT, so the stream is the same as concatenated public
+ * point files. Returns false at the end of the input, or on an error setting
+ * rc.
+ */
+static bool batch_next(ESYS_CONTEXT *ectx, FILE *input, zgen_job *job,
+        tool_rc *rc) {
+
+    UINT8 buffer[sizeof(TPMS_ECC_POINT)];
+    UINT16 size = sizeof(buffer);
+    bool is_end = false;
+    bool result = files_read_record(input, buffer, &size, &is_end);
+    if (!result) {
+        LOG_ERR("Could not read the public point records");
+        *rc = tool_rc_general_error;
+        return false;
+    }
+
+    if (is_end) {
+        return false;
+    }
+
+    size_t offset = 0;
+    memset(&job->Q, 0, sizeof(job->Q));
+    TSS2_RC rval = Tss2_MU_TPMS_ECC_POINT_Unmarshal(buffer, size, &offset,
+            &job->Q.point);
+    if (rval != TSS2_RC_SUCCESS || offset != size) {
+        LOG_ERR("Invalid public point record");
+        *rc = tool_rc_general_error;
+        return false;
+    }
+    job->Q.size = size;
+
+    tool_rc tmp_rc = tpm2_ecdhzgen_async(ectx, &ctx.ecc_key.object, &job->Q);
+    if (tmp_rc != tool_rc_success) {
+        *rc = tmp_rc;
+        return false;
+    }
+
+    return true;
+}
+
+static bool batch_write(FILE *output, TPM2B_ECC_POINT *Z) {
+
+    UINT8 buffer[sizeof(TPMS_ECC_POINT)];
+    size_t offset = 0;
+    TSS2_RC rval = Tss2_MU_TPMS_ECC_POINT_Marshal(&Z->point, buffer,
+            sizeof(buffer), &offset);
+    if (rval != TSS2_RC_SUCCESS) {
+        LOG_PERR(Tss2_MU_TPMS_ECC_POINT_Marshal, rval);
+        return false;
+    }
+
+    return files_write_record(output, buffer, offset);
+}
+
+/*
+ * Computes the Z point of every peer point of the input with the loaded key
+ * and session. The next point is sent before the Z point of the previous one
+ * is written, so the TPM never waits on the file system. The first failure
+ * stops the batch, the Z points computed so far are all written in order.
+ */
+static tool_rc batch_zgen(ESYS_CONTEXT *ectx, FILE *input, FILE *output) {
+
+    zgen_job jobs[2];
+    zgen_job *cur = &jobs[0];
+    zgen_job *next = &jobs[1];
+
+    tool_rc rc = tool_rc_success;
+    bool has_cur = batch_next(ectx, input, cur, &rc);
+    while (has_cur) {
+        TPM2B_ECC_POINT *Z = NULL;
+        tool_rc tmp_rc = tpm2_ecdhzgen_finish(ectx, &Z);
+        if (tmp_rc != tool_rc_success) {
+            return tmp_rc;
+        }
+
+        bool has_next = batch_next(ectx, input, next, &rc);
+
+        bool result = batch_write(output, Z);
+        free(Z);
+        if (!result) {
+            LOG_ERR("Could not write Z point to \"%s\"", ctx.ecdh_Z_path);
+            if (has_next) {
+                /* the sent command is still owed its response */
+                Z = NULL;
+                tpm2_ecdhzgen_finish(ectx, &Z);
+                free(Z);
+            }
+            return tool_rc_general_error;
+        }
+
+        zgen_job *tmp = cur;
+        cur = next;
+        next = tmp;
+        has_cur = has_next;
+    }
+
+    return rc;
+}
+
+static tool_rc batch_run(ESYS_CONTEXT *ectx) {
+
+    /* a policy session would need satisfying again for every record */
+    if (ctx.ecc_key.object.session && tpm2_session_get_type(
+            ctx.ecc_key.object.session) == TPM2_SE_POLICY) {
+        LOG_ERR("Batch ZGen cannot satisfy a policy session for every "
+                "record");
+        return tool_rc_option_error;
+    }
+
+    FILE *input = ctx.ecdh_pub_path ? files_fopen(ctx.ecdh_pub_path, "rb") : stdin;
+    if (!input) {
+        LOG_ERR("Could not open file \"%s\", error: %s", ctx.ecdh_pub_path,
+                strerror(errno));
+        return tool_rc_general_error;
+    }
+
+    tool_rc rc = tool_rc_general_error;
+    FILE *output = files_fopen(ctx.ecdh_Z_path, "wb");
+    if (!output) {
+        LOG_ERR("Could not open file \"%s\", error: %s", ctx.ecdh_Z_path,
+                strerror(errno));
+        goto out;
+    }
+
+    rc = batch_zgen(ectx, input, output);
+
+    if (fclose(output)) {
+        LOG_ERR("Could not write file \"%s\", error: %s", ctx.ecdh_Z_path,
+                strerror(errno));
+        rc = tool_rc_general_error;
+    }
+
+out:
+    if (input != stdin) {
+        fclose(input);
+    }
+
+    return rc;
+}
+
 static tool_rc tpm2_tool_onrun(ESYS_CONTEXT *ectx, tpm2_option_flags flags) {
 
     UNUSED(flags);
@@ -112,6 +277,10 @@ static tool_rc tpm2_tool_onrun(ESYS_CONTEXT *ectx, tpm2_option_flags flags) {
        return rc;
    }
 
+    if (ctx.is_batch) {
+        return batch_run(ectx);
+    }
+
     // ESAPI call
     rc = tpm2_ecdhzgen(ectx, &ctx.ecc_key.object, &ctx.Z, &ctx.Q);
     if (rc != tool_rc_success) {
@@ -128,5 +297,11 @@ static tool_rc tpm2_tool_onrun(ESYS_CONTEXT *ectx, tpm2_option_flags flags) {
     return tool_rc_success;
 }
 
+static tool_rc tpm2_tool_onstop(ESYS_CONTEXT *ectx) {
+    UNUSED(ectx);
+    return tpm2_session_close(&ctx.ecc_key.object.session);
+}
+
 // Register this tool with tpm2_tool.c
-TPM2_TOOL_REGISTER("ecdhzgen", tpm2_tool_onstart, tpm2_tool_onrun, NULL, NULL)
+TPM2_TOOL_REGISTER("ecdhzgen", tpm2_tool_onstart, tpm2_tool_onrun,
+    tpm2_tool_onstop, NULL)
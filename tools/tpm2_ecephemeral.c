@@ -1,10 +1,13 @@
 /* SPDX-License-Identifier: BSD-3-Clause */
 
+#include <stdlib.h>
+
 #include "files.h"
 #include "log.h"
 #include "tpm2.h"
 #include "tpm2_tool.h"
 #include "tpm2_alg_util.h"
+#include "tpm2_ecc_pool.h"
 #include "tpm2_options.h"
 
 typedef struct tpm_ecephemeral_ctx tpm_ecephemeral_ctx;
@@ -14,6 +17,10 @@ struct tpm_ecephemeral_ctx {
     TPM2B_ECC_POINT *Q;
     char *commit_counter_path;
     char *ephemeral_pub_key_path;
+
+    /* runs EC_Ephemeral ahead of time with fill, takes from the pool without */
+    const char *pool_path;
+    UINT32 fill;
 };
 
 static tpm_ecephemeral_ctx ctx = {
@@ -29,6 +36,16 @@ static bool on_option(char key, char *value) {
     case 't':
         ctx.commit_counter_path = value;
         break;
+    case 0:
+        ctx.pool_path = value;
+        break;
+    case 1:
+        if (!tpm2_util_string_to_uint32(value, &ctx.fill) || !ctx.fill) {
+            LOG_ERR("Invalid number of entries to fill, got: \"%s\"",
+                    value);
+            return false;
+        }
+        break;
     };
 
     return true;
@@ -70,15 +87,41 @@ static bool tpm2_tool_onstart(tpm2_options **opts) {
     static struct option topts[] = {
       { "public",   required_argument, NULL, 'u' },
       { "counter",  required_argument, NULL, 't' },
+      { "pool",     required_argument, NULL,  0  },
+      { "fill",     required_argument, NULL,  1  },
     };
 
+    /* taking from a pool does not need a TPM */
     *opts = tpm2_options_new("u:t:", ARRAY_LEN(topts), topts,
-            on_option, on_args, 0);
+            on_option, on_args, TPM2_OPTIONS_OPTIONAL_SAPI);
 
     return *opts != NULL;
 }
 
-static tool_rc check_options(void) {
+static tool_rc check_options(ESYS_CONTEXT *ectx) {
+
+    if (ctx.fill && !ctx.pool_path) {
+        LOG_ERR("Specify the pool to fill with --pool");
+        return tool_rc_option_error;
+    }
+
+    if (!ectx && (!ctx.pool_path || ctx.fill)) {
+        LOG_ERR("A TPM is only optional when taking from a pool");
+        return tool_rc_option_error;
+    }
+
+    if (ctx.fill) {
+        if (ctx.ephemeral_pub_key_path || ctx.commit_counter_path) {
+            LOG_ERR("Filling a pool saves no public key or commit counter");
+            return tool_rc_option_error;
+        }
+
+        if (ctx.curve_id == TPM2_ECC_NONE) {
+            LOG_ERR("Invalid/ unspecified ECC curve");
+            return tool_rc_option_error;
+        }
+        return tool_rc_success;
+    }
 
     if (!ctx.ephemeral_pub_key_path) {
         LOG_ERR("Invalid path specified for saving the ephemeral public key");
@@ -90,7 +133,8 @@ static tool_rc check_options(void) {
         return tool_rc_option_error;
     }
 
-    if (ctx.curve_id == TPM2_ECC_NONE) {
+    /* the pool knows the curve of its entries */
+    if (ctx.curve_id == TPM2_ECC_NONE && !ctx.pool_path) {
         LOG_ERR("Invalid/ unspecified ECC curve");
         return tool_rc_option_error;
     }
@@ -100,7 +144,7 @@ static tool_rc check_options(void) {
 
 static tool_rc process_outputs(void) {
 
-    FILE *fp = fopen(ctx.commit_counter_path, "wb");
+    FILE *fp = files_fopen(ctx.commit_counter_path, "wb");
     bool result = files_write_16(fp, ctx.counter);
     fclose(fp);
     if (!result) {
@@ -117,16 +161,94 @@ static tool_rc process_outputs(void) {
     return tool_rc_success;
 }
 
+static TPM2B_NAME pool_owner(void) {
+
+    TPM2B_NAME owner = { .size = sizeof(UINT16) };
+    owner.name[0] = ctx.curve_id >> 8;
+    owner.name[1] = ctx.curve_id & 0xff;
+
+    return owner;
+}
+
+/*
+ * Every entry is a counter of the TPM, so the ones produced before a failure
+ * are kept in the pool rather than lost.
+ */
+static tool_rc pool_fill(ESYS_CONTEXT *ectx) {
+
+    tpm2_ecc_pool_entry *entries = calloc(ctx.fill, sizeof(*entries));
+    if (!entries) {
+        LOG_ERR("oom");
+        return tool_rc_general_error;
+    }
+
+    tool_rc rc = tool_rc_success;
+    UINT32 count;
+    for (count = 0; count < ctx.fill; count++) {
+        TPM2B_ECC_POINT *Q = NULL;
+        rc = tpm2_ecephemeral(ectx, ctx.curve_id, &Q,
+                &entries[count].counter);
+        if (rc != tool_rc_success) {
+            break;
+        }
+        entries[count].points[0] = *Q;
+        Esys_Free(Q);
+    }
+
+    TPM2B_NAME owner = pool_owner();
+    size_t remaining = 0;
+    bool result = !count || tpm2_ecc_pool_add(ctx.pool_path,
+            TPM2_CC_EC_Ephemeral, &owner, entries, count, &remaining);
+    free(entries);
+    if (!result) {
+        return tool_rc_general_error;
+    }
+
+    if (count) {
+        tpm2_tool_output("entries: %zu\n", remaining);
+    }
+
+    return rc;
+}
+
+static tool_rc pool_take(void) {
+
+    TPM2B_NAME owner = pool_owner();
+    tpm2_ecc_pool_entry entry;
+    size_t remaining = 0;
+    bool result = tpm2_ecc_pool_take(ctx.pool_path, TPM2_CC_EC_Ephemeral,
+            ctx.curve_id == TPM2_ECC_NONE ? NULL : &owner, &entry,
+            &remaining);
+    if (!result) {
+        return tool_rc_general_error;
+    }
+
+    if (!remaining) {
+        LOG_WARN("Took the last entry of pool \"%s\"", ctx.pool_path);
+    }
+
+    ctx.counter = entry.counter;
+    ctx.Q = &entry.points[0];
+    tool_rc rc = process_outputs();
+    ctx.Q = NULL;
+
+    return rc;
+}
+
 static tool_rc tpm2_tool_onrun(ESYS_CONTEXT *ectx, tpm2_option_flags flags) {
 
     UNUSED(flags);
 
     // Check input options and arguments
-    tool_rc rc = check_options();
+    tool_rc rc = check_options(ectx);
     if (rc != tool_rc_success) {
         return rc;
     }
 
+    if (ctx.pool_path) {
+        return ctx.fill ? pool_fill(ectx) : pool_take();
+    }
+
     // ESAPI call
     rc = tpm2_ecephemeral(ectx, ctx.curve_id, &ctx.Q, &ctx.counter);
     if (rc != tool_rc_success) {
@@ -13,10 +13,9 @@
 #include "tpm2_tool.h"
 #include "tpm2_alg_util.h"
 #include "tpm2_auth_util.h"
+#include "tpm2_capability.h"
 #include "tpm2_options.h"
 
-#define MAX_INPUT_DATA_SIZE UINT16_MAX
-
 typedef struct tpm_encrypt_decrypt_ctx tpm_encrypt_decrypt_ctx;
 struct tpm_encrypt_decrypt_ctx {
     struct {
@@ -27,8 +26,7 @@ struct tpm_encrypt_decrypt_ctx {
 
     TPMI_YES_NO is_decrypt;
 
-    uint8_t input_data[MAX_INPUT_DATA_SIZE];
-    uint16_t input_data_size;
+    files_input input;
 
     const char *input_path;
     char *out_file_path;
@@ -44,163 +42,248 @@ struct tpm_encrypt_decrypt_ctx {
 
     TPM2B_IV iv_start;
     char *cp_hash_path;
-};
 
-static tpm_encrypt_decrypt_ctx ctx = {
-    .mode = TPM2_ALG_NULL,
-    .input_data_size = MAX_INPUT_DATA_SIZE,
-    .padded_block_len = TPM2_MAX_SYM_BLOCK_SIZE,
-    .is_padding_option_enabled = false,
-    .iv_start = { .size = sizeof(ctx.iv_start.buffer), .buffer = { 0 } },
+    /* a multiple of the block length, so the IV chains across chunks */
+    UINT16 chunk_size;
 };
 
-static tool_rc readpub(ESYS_CONTEXT *ectx, TPM2B_PUBLIC **public) {
+static tool_rc readpub(tpm_encrypt_decrypt_ctx *ctx, ESYS_CONTEXT *ectx,
+        TPM2B_PUBLIC **public) {
 
-    return tpm2_readpublic(ectx, ctx.encryption_key.object.tr_handle,
+    return tpm2_readpublic(ectx, ctx->encryption_key.object.tr_handle,
             public, NULL, NULL);
 }
 
-static bool evaluate_pkcs7_padding_requirements(uint16_t remaining_bytes,
-bool expected) {
+static bool is_pkcs7_padding(tpm_encrypt_decrypt_ctx *ctx) {
 
-    if (!ctx.is_padding_option_enabled) {
-        return false;
-    }
+    /*
+     * If no ctx->mode was specified, the default cfb was set.
+     */
+    return ctx->is_padding_option_enabled
+            && (ctx->mode == TPM2_ALG_CBC || ctx->mode == TPM2_ALG_ECB);
+}
 
-    if (ctx.is_decrypt != expected) {
+/*
+ * Fills the chunk with as much input as fits, stopping short only at the end
+ * of input. Mapped inputs are copied straight from the mapping, streams are
+ * read straight into the chunk.
+ */
+static bool read_chunk(tpm_encrypt_decrypt_ctx *ctx, TPM2B_MAX_BUFFER *chunk) {
+
+    size_t size;
+    bool result = files_input_read(&ctx->input, chunk->buffer,
+            ctx->chunk_size, &size);
+    if (!result) {
+        LOG_ERR("Failed to read in the input.");
         return false;
     }
 
-    /*
-     * If no ctx.mode was specified, the default cfb was set.
-     */
-    if (ctx.mode != TPM2_ALG_CBC && ctx.mode != TPM2_ALG_ECB) {
-        return false;
+    chunk->size = size;
+
+    return true;
+}
+
+/*
+ * Pads the last chunk of the input to encrypt. A chunk is a multiple of the
+ * block length, so when it is full the padding block goes into the otherwise
+ * empty next chunk.
+ */
+static void append_pkcs7_padding(tpm_encrypt_decrypt_ctx *ctx,
+        TPM2B_MAX_BUFFER *last, TPM2B_MAX_BUFFER *next) {
+
+    uint8_t pad_data = ctx->padded_block_len
+            - (last->size % ctx->padded_block_len);
+
+    TPM2B_MAX_BUFFER *padded =
+            last->size + pad_data <= ctx->chunk_size ?
+                    last : next;
+    memset(&padded->buffer[padded->size], pad_data, pad_data);
+    padded->size += pad_data;
+}
+
+static bool strip_pkcs7_padding(tpm_encrypt_decrypt_ctx *ctx,
+        TPM2B_MAX_BUFFER *out_data) {
+
+    if (out_data->size % ctx->padded_block_len) {
+        LOG_WARN("Encrypted input is not block length aligned.");
     }
 
-    /*
-     * Is last block?
-     */
-    if (!(remaining_bytes <= TPM2_MAX_DIGEST_BUFFER && remaining_bytes > 0)) {
+    uint8_t pad_data = out_data->size ?
+            out_data->buffer[out_data->size - 1] : 0;
+    if (!pad_data || pad_data > ctx->padded_block_len
+            || pad_data > out_data->size) {
+        LOG_ERR("Invalid pkcs7 padding, got: %u", pad_data);
         return false;
     }
 
-    LOG_WARN("Processing pkcs7 padding.");
+    out_data->size -= pad_data;
 
     return true;
 }
 
-static void append_pkcs7_padding_data_to_input(uint8_t *pad_data,
-        uint16_t *in_data_size, uint16_t *remaining_bytes) {
+static tool_rc calculate_cp_hash(tpm_encrypt_decrypt_ctx *ctx,
+        ESYS_CONTEXT *ectx, const TPM2B_IV *iv_in) {
 
-    bool test_pad_reqs = evaluate_pkcs7_padding_requirements(*remaining_bytes,
-    false);
-    if (!test_pad_reqs) {
-        return;
+    TPM2B_MAX_BUFFER in_data;
+    TPM2B_MAX_BUFFER next;
+    bool result = read_chunk(ctx, &in_data) && read_chunk(ctx, &next);
+    if (!result) {
+        return tool_rc_general_error;
     }
 
-    *pad_data = ctx.padded_block_len - (*in_data_size % ctx.padded_block_len);
+    if (!next.size && !ctx->is_decrypt && is_pkcs7_padding(ctx)) {
+        append_pkcs7_padding(ctx, &in_data, &next);
+    }
 
-    memset(&ctx.input_data[ctx.input_data_size], *pad_data, *pad_data);
+    if (next.size) {
+        LOG_ERR("Cannot calculate cpHash for buffer larger than max digest buffer.");
+        return tool_rc_general_error;
+    }
 
-    if (*pad_data == ctx.padded_block_len) {
-        *remaining_bytes += *pad_data;
+    LOG_WARN("Calculating cpHash. Exiting without performing encryptdecrypt.");
+    TPM2B_DIGEST cp_hash = { .size = 0 };
+    TPM2B_MAX_BUFFER *out_data = NULL;
+    TPM2B_IV *iv_out = NULL;
+    tool_rc rc = tpm2_encryptdecrypt(ectx, &ctx->encryption_key.object,
+            ctx->is_decrypt, ctx->mode, iv_in, &in_data, &out_data, &iv_out,
+            &cp_hash);
+    if (rc != tool_rc_success) {
+        LOG_ERR("CpHash calculation failed!");
+        return rc;
     }
 
-    if (*pad_data < ctx.padded_block_len) {
-        *remaining_bytes = *in_data_size += *pad_data;
+    result = files_save_digest(&cp_hash, ctx->cp_hash_path);
+    if (!result) {
+        rc = tool_rc_general_error;
     }
+
+    return rc;
 }
 
-static void strip_pkcs7_padding_data_from_output(uint8_t *pad_data,
-        TPM2B_MAX_BUFFER *out_data, uint16_t *remaining_bytes) {
+static tool_rc encrypt_decrypt_chunk_async(tpm_encrypt_decrypt_ctx *ctx,
+        ESYS_CONTEXT *ectx, unsigned version, const TPM2B_IV *iv_in,
+        const TPM2B_MAX_BUFFER *in_data) {
 
-    bool test_pad_reqs = evaluate_pkcs7_padding_requirements(*remaining_bytes,
-    true);
-    if (!test_pad_reqs) {
-        return;
-    }
+    return tpm2_encryptdecrypt_async(ectx, &ctx->encryption_key.object,
+            version, ctx->is_decrypt, ctx->mode, iv_in, in_data);
+}
 
-    uint8_t last_block_length = ctx.padded_block_len
-            - (out_data->size % ctx.padded_block_len);
+static tool_rc encrypt_decrypt_chunk_finish(tpm_encrypt_decrypt_ctx *ctx,
+        ESYS_CONTEXT *ectx, unsigned *version, const TPM2B_IV *iv_in,
+        const TPM2B_MAX_BUFFER *in_data, TPM2B_MAX_BUFFER **out_data,
+        TPM2B_IV **iv_out) {
 
-    if (last_block_length != ctx.padded_block_len) {
-        LOG_WARN("Encrypted input is not block length aligned.");
+    tool_rc rc = tpm2_encryptdecrypt_finish(ectx, *version, out_data, iv_out);
+    if (rc != tool_rc_unsupported) {
+        return rc;
     }
 
-    *pad_data = out_data->buffer[last_block_length - 1];
+    /*
+     * try EncryptDecrypt2 first, and if the command is not supported by the
+     * TPM fall back to EncryptDecrypt for this and all further chunks.
+     */
+    *version = 1;
+    rc = encrypt_decrypt_chunk_async(ctx, ectx, *version, iv_in, in_data);
+    if (rc != tool_rc_success) {
+        return rc;
+    }
 
-    out_data->size -= *pad_data;
+    return tpm2_encryptdecrypt_finish(ectx, *version, out_data, iv_out);
 }
 
-static tool_rc encrypt_decrypt(ESYS_CONTEXT *ectx) {
+/*
+ * The input is streamed through the TPM one chunk of the size the TPM accepts
+ * at a time, the IV returned for a chunk is the one the next chunk goes with.
+ * While the TPM works on a chunk, the output of the previous one is written
+ * and the one after the next is read, and the next chunk is sent as soon as
+ * the response arrived, so the TPM does not wait on the input or output.
+ *
+ * Three chunks rotate: the one the TPM works on, which is kept for a resend
+ * with TPM2_EncryptDecrypt, the next one, already read so the last chunk is
+ * known before it is sent, and the one being read.
+ */
+static tool_rc encrypt_decrypt(tpm_encrypt_decrypt_ctx *ctx,
+        ESYS_CONTEXT *ectx) {
+
+    TPM2B_IV *iv_in = &ctx->iv_start;
+    if (ctx->mode == TPM2_ALG_ECB) {
+        iv_in = NULL;
+    }
 
-    tool_rc rc = tool_rc_general_error;
+    ctx->chunk_size = tpm2_capability_max_buffer_size(ectx)
+            / TPM2_MAX_SYM_BLOCK_SIZE * TPM2_MAX_SYM_BLOCK_SIZE;
 
-    /*
-     * try EncryptDecrypt2 first, and if the command is not supported by the TPM
-     * fall back to EncryptDecrypt.
-     */
+    if (ctx->cp_hash_path) {
+        return calculate_cp_hash(ctx, ectx, iv_in);
+    }
 
-    UINT16 data_offset = 0;
-    bool result = true;
     FILE *out_file_ptr =
-            ctx.out_file_path ? fopen(ctx.out_file_path, "wb+") : stdout;
+            ctx->out_file_path ? files_fopen(ctx->out_file_path, "wb+") : stdout;
     if (!out_file_ptr) {
-        LOG_ERR("Could not open file \"%s\", error: %s", ctx.out_file_path,
+        LOG_ERR("Could not open file \"%s\", error: %s", ctx->out_file_path,
                 strerror(errno));
         return tool_rc_general_error;
     }
 
-    TPM2B_MAX_BUFFER *out_data = NULL;
-    TPM2B_MAX_BUFFER in_data;
-    TPM2B_IV *iv_out = NULL;
-    TPM2B_IV *iv_in = &ctx.iv_start;
-    uint8_t pad_data = 0;
-
-    uint16_t remaining_bytes = ctx.input_data_size;
-    if (ctx.mode == TPM2_ALG_ECB) {
-        iv_in = NULL;
+    bool is_padding = is_pkcs7_padding(ctx);
+    if (is_padding) {
+        LOG_WARN("Processing pkcs7 padding.");
     }
 
-    if (ctx.cp_hash_path) {
-        in_data.size = remaining_bytes;
-        append_pkcs7_padding_data_to_input(&pad_data, &in_data.size,
-                    &remaining_bytes);
-        memcpy(in_data.buffer, ctx.input_data, in_data.size);
-        LOG_WARN("Calculating cpHash. Exiting without performing encryptdecrypt.");
-        TPM2B_DIGEST cp_hash = { .size = 0 };
-        tool_rc rc = tpm2_encryptdecrypt(ectx, &ctx.encryption_key.object,
-        ctx.is_decrypt, ctx.mode, iv_in, &in_data, &out_data, &iv_out,
-        &cp_hash);
-        if (rc != tool_rc_success) {
-            LOG_ERR("CpHash calculation failed!");
-            fclose(out_file_ptr);
-            return rc;
-        }
+    tool_rc rc = tool_rc_general_error;
+    TPM2B_MAX_BUFFER chunks[3];
+    TPM2B_MAX_BUFFER *cur = &chunks[0];
+    TPM2B_MAX_BUFFER *next = &chunks[1];
+    TPM2B_MAX_BUFFER *spare = &chunks[2];
+    TPM2B_MAX_BUFFER *pending = NULL;
+    unsigned version = 2;
+
+    bool result = read_chunk(ctx, cur);
+    if (!result) {
+        goto out;
+    }
 
-        bool result = files_save_digest(&cp_hash, ctx.cp_hash_path);
+    if (cur->size) {
+        result = read_chunk(ctx, next);
         if (!result) {
-            rc = tool_rc_general_error;
+            goto out;
         }
-        return rc;
     }
 
-    while (remaining_bytes > 0) {
-        in_data.size =
-                remaining_bytes > TPM2_MAX_DIGEST_BUFFER ?
-                        TPM2_MAX_DIGEST_BUFFER : remaining_bytes;
+    while (cur->size) {
 
-        if (!pad_data) {
-            append_pkcs7_padding_data_to_input(&pad_data, &in_data.size,
-                    &remaining_bytes);
+        bool is_last = !next->size;
+        if (is_last && is_padding && !ctx->is_decrypt) {
+            append_pkcs7_padding(ctx, cur, next);
+            is_last = !next->size;
         }
 
-        memcpy(in_data.buffer, &ctx.input_data[data_offset], in_data.size);
+        rc = encrypt_decrypt_chunk_async(ctx, ectx, version, iv_in, cur);
+        if (rc != tool_rc_success) {
+            goto out;
+        }
 
-        rc = tpm2_encryptdecrypt(ectx, &ctx.encryption_key.object,
-                ctx.is_decrypt, ctx.mode, iv_in, &in_data, &out_data, &iv_out,
-                NULL);
+        /* always collect the response, even if the I/O failed */
+        result = true;
+        if (pending) {
+            result = files_write_bytes(out_file_ptr, pending->buffer,
+                    pending->size);
+            free(pending);
+            pending = NULL;
+            if (!result) {
+                LOG_ERR("Failed to save output data to file");
+            }
+        }
+
+        spare->size = 0;
+        if (result && !is_last) {
+            result = read_chunk(ctx, spare);
+        }
+
+        TPM2B_MAX_BUFFER *out_data = NULL;
+        TPM2B_IV *iv_out = NULL;
+        rc = encrypt_decrypt_chunk_finish(ctx, ectx, &version, iv_in, cur,
+                &out_data, &iv_out);
         if (rc != tool_rc_success) {
             goto out;
         }
@@ -209,43 +292,54 @@ static tool_rc encrypt_decrypt(ESYS_CONTEXT *ectx) {
          * Copy iv_out iv_in to use it in next loop iteration.
          * This copy is also output from the tool for further chaining.
          */
-        if (ctx.mode != TPM2_ALG_ECB) {
-            assert(iv_in);
+        if (iv_in) {
             assert(iv_out);
             *iv_in = *iv_out;
-            free(iv_out);
+        }
+        free(iv_out);
+        pending = out_data;
+
+        if (!result) {
+            rc = tool_rc_general_error;
+            goto out;
         }
 
-        strip_pkcs7_padding_data_from_output(&pad_data, out_data,
-                &remaining_bytes);
+        if (is_last && is_padding && ctx->is_decrypt) {
+            result = strip_pkcs7_padding(ctx, pending);
+            if (!result) {
+                rc = tool_rc_general_error;
+                goto out;
+            }
+        }
+
+        TPM2B_MAX_BUFFER *tmp = cur;
+        cur = next;
+        next = spare;
+        spare = tmp;
+    }
 
-        result = files_write_bytes(out_file_ptr, out_data->buffer,
-                out_data->size);
-        free(out_data);
+    if (pending) {
+        result = files_write_bytes(out_file_ptr, pending->buffer,
+                pending->size);
         if (!result) {
             LOG_ERR("Failed to save output data to file");
+            rc = tool_rc_general_error;
             goto out;
         }
-
-        remaining_bytes -= in_data.size;
-        data_offset += in_data.size;
     }
 
     /*
      * iv_in here is the copy of final iv_out from the loop above.
      */
     result =
-            (ctx.iv.out && iv_in) ?
-                    files_save_bytes_to_file(ctx.iv.out, iv_in->buffer,
+            (ctx->iv.out && iv_in) ?
+                    files_save_bytes_to_file(ctx->iv.out, iv_in->buffer,
                             iv_in->size) :
                     true;
-    if (!result) {
-        goto out;
-    }
-
-    rc = tool_rc_success;
+    rc = result ? tool_rc_success : tool_rc_general_error;
 
 out:
+    free(pending);
     if (out_file_ptr != stdout) {
         fclose(out_file_ptr);
     }
@@ -253,24 +347,24 @@ out:
     return rc;
 }
 
-static void parse_iv(char *value) {
+static void parse_iv(tpm_encrypt_decrypt_ctx *ctx, char *value) {
 
-    ctx.iv.in = value;
+    ctx->iv.in = value;
 
     char *split = strchr(value, ':');
     if (split) {
         *split = '\0';
         split++;
         if (split) {
-            ctx.iv.out = split;
+            ctx->iv.out = split;
         }
     }
 }
 
-static bool setup_alg_mode(ESYS_CONTEXT *ectx) {
+static bool setup_alg_mode(tpm_encrypt_decrypt_ctx *ctx, ESYS_CONTEXT *ectx) {
 
     TPM2B_PUBLIC *public;
-    tool_rc rc = readpub(ectx, &public);
+    tool_rc rc = readpub(ctx, ectx, &public);
     if (rc != tool_rc_success) {
         return false;
     }
@@ -280,14 +374,14 @@ static bool setup_alg_mode(ESYS_CONTEXT *ectx) {
      * else choose CFB.
      * If the caller specifies an invalid mode, just pass it to the TPM and let it error out.
      */
-    if (ctx.mode == TPM2_ALG_NULL) {
+    if (ctx->mode == TPM2_ALG_NULL) {
 
         TPMI_ALG_SYM_MODE objmode =
             public->publicArea.parameters.symDetail.sym.mode.sym;
         if (objmode == TPM2_ALG_NULL) {
-            ctx.mode = TPM2_ALG_CFB;
+            ctx->mode = TPM2_ALG_CFB;
         } else {
-            ctx.mode = objmode;
+            ctx->mode = objmode;
         }
     }
 
@@ -296,55 +390,70 @@ static bool setup_alg_mode(ESYS_CONTEXT *ectx) {
     return true;
 }
 
-static bool on_option(char key, char *value) {
+static bool on_option(void *tool_ctx, char key, char *value) {
+
+    tpm_encrypt_decrypt_ctx *ctx = tool_ctx;
 
     switch (key) {
     case 'c':
-        ctx.encryption_key.ctx_path = value;
+        ctx->encryption_key.ctx_path = value;
         break;
     case 'p':
-        ctx.encryption_key.auth_str = value;
+        ctx->encryption_key.auth_str = value;
         break;
     case 'd':
-        ctx.is_decrypt = 1;
+        ctx->is_decrypt = 1;
         break;
     case 'o':
-        ctx.out_file_path = value;
+        ctx->out_file_path = value;
         break;
     case 'G':
-        ctx.mode = tpm2_alg_util_strtoalg(value, tpm2_alg_util_flags_mode);
-        if (ctx.mode == TPM2_ALG_ERROR) {
+        ctx->mode = tpm2_alg_util_strtoalg(value, tpm2_alg_util_flags_mode);
+        if (ctx->mode == TPM2_ALG_ERROR) {
             LOG_ERR("Invalid mode, got: %s", value);
             return false;
         }
         break;
     case 't':
-        parse_iv(value);
+        parse_iv(ctx, value);
         break;
     case 'e':
-        ctx.is_padding_option_enabled = true;
+        ctx->is_padding_option_enabled = true;
         break;
     case 0:
-        ctx.cp_hash_path = value;
+        ctx->cp_hash_path = value;
         break;
     }
 
     return true;
 }
 
-static bool on_args(int argc, char *argv[]) {
+static bool on_args(void *tool_ctx, int argc, char *argv[]) {
+
+    tpm_encrypt_decrypt_ctx *ctx = tool_ctx;
 
     if (argc != 1) {
         LOG_ERR("Expected one input file, got: %d", argc);
         return false;
     }
 
-    ctx.input_path = argv[0];
+    ctx->input_path = argv[0];
 
     return true;
 }
 
-static bool tpm2_tool_onstart(tpm2_options **opts) {
+static bool tpm2_tool_onstart(tpm2_options **opts, void **tool_ctx) {
+
+    tpm_encrypt_decrypt_ctx *ctx = calloc(1, sizeof(*ctx));
+    if (!ctx) {
+        LOG_ERR("oom");
+        return false;
+    }
+    *tool_ctx = ctx;
+
+    ctx->mode = TPM2_ALG_NULL;
+    ctx->padded_block_len = TPM2_MAX_SYM_BLOCK_SIZE;
+    ctx->iv_start.size = sizeof(ctx->iv_start.buffer);
 
     const struct option topts[] = {
         { "auth",        required_argument, NULL, 'p' },
@@ -357,90 +466,101 @@ static bool tpm2_tool_onstart(tpm2_options **opts) {
         { "cphash",      required_argument, NULL,  0  },
     };
 
-    *opts = tpm2_options_new("p:edi:o:c:G:t:", ARRAY_LEN(topts), topts,
-            on_option, on_args, 0);
+    *opts = tpm2_options_new_ctx("p:edi:o:c:G:t:", ARRAY_LEN(topts), topts,
+            on_option, on_args, 0, ctx);
 
     return *opts != NULL;
 }
 
-static bool is_input_options_args_valid(void) {
+static bool is_input_options_args_valid(tpm_encrypt_decrypt_ctx *ctx) {
 
-    if (!ctx.encryption_key.ctx_path) {
+    if (!ctx->encryption_key.ctx_path) {
         LOG_ERR("Expected a context file or handle, got none.");
         return false;
     }
 
-    bool result = files_load_bytes_from_buffer_or_file_or_stdin(NULL,
-            ctx.input_path, &ctx.input_data_size, ctx.input_data);
+    /*
+     * Regular files are used in place from a mapping, pipes are streamed,
+     * the input is read chunk by chunk as it is encrypted or decrypted.
+     */
+    bool result = files_input_open(&ctx->input, ctx->input_path);
     if (!result) {
         LOG_ERR("Failed to read in the input.");
         return result;
     }
 
-    if (!ctx.iv.in) {
+    if (!ctx->iv.in) {
         LOG_WARN("Using a weak IV, try specifying an IV");
     }
 
-    if (ctx.iv.in) {
+    if (ctx->iv.in) {
         unsigned long file_size;
-        result = files_get_file_size_path(ctx.iv.in, &file_size);
+        result = files_get_file_size_path(ctx->iv.in, &file_size);
         if (!result) {
             LOG_ERR("Could not retrieve iv file size.");
             return false;
         }
 
-        if (file_size != ctx.iv_start.size) {
+        if (file_size != ctx->iv_start.size) {
             LOG_ERR("Iv should be 16 bytes, got %lu", file_size);
             return false;
         }
 
-        result = files_load_bytes_from_path(ctx.iv.in, ctx.iv_start.buffer,
-        &ctx.iv_start.size);
+        result = files_load_bytes_from_path(ctx->iv.in, ctx->iv_start.buffer,
+        &ctx->iv_start.size);
         if (!result) {
             LOG_ERR("Could not load the iv from the file.");
             return false;
         }
     }
 
-    if (ctx.cp_hash_path && ctx.input_data_size > TPM2_MAX_DIGEST_BUFFER) {
-        LOG_ERR("Cannot calculate cpHash for buffer larger than max digest buffer.");
-        return false;
-    }
-
     return true;
 }
 
-static tool_rc tpm2_tool_onrun(ESYS_CONTEXT *ectx, tpm2_option_flags flags) {
+static tool_rc tpm2_tool_onrun(void *tool_ctx, ESYS_CONTEXT *ectx,
+        tpm2_option_flags flags) {
 
     UNUSED(flags);
 
-    bool retval = is_input_options_args_valid();
+    tpm_encrypt_decrypt_ctx *ctx = tool_ctx;
+    bool retval = is_input_options_args_valid(ctx);
     if (!retval) {
         return tool_rc_option_error;
     }
 
-    tool_rc rc = tpm2_util_object_load_auth(ectx, ctx.encryption_key.ctx_path,
-            ctx.encryption_key.auth_str, &ctx.encryption_key.object, false,
+    tool_rc rc = tpm2_util_object_load_auth(ectx, ctx->encryption_key.ctx_path,
+            ctx->encryption_key.auth_str, &ctx->encryption_key.object, false,
             TPM2_HANDLE_ALL_W_NV);
     if (rc != tool_rc_success) {
         LOG_ERR("Invalid object key authorization");
         return rc;
     }
 
-    bool result = setup_alg_mode(ectx);
+    bool result = setup_alg_mode(ctx, ectx);
     if (!result) {
         LOG_ERR("Failure to setup key mode.");
         return tool_rc_general_error;
     }
 
-    return encrypt_decrypt(ectx);
+    return encrypt_decrypt(ctx, ectx);
 }
 
-static tool_rc tpm2_tool_onstop(ESYS_CONTEXT *ectx) {
+static tool_rc tpm2_tool_onstop(void *tool_ctx, ESYS_CONTEXT *ectx) {
     UNUSED(ectx);
 
-    return tpm2_session_close(&ctx.encryption_key.object.session);
+    tpm_encrypt_decrypt_ctx *ctx = tool_ctx;
+
+    return tpm2_session_close(&ctx->encryption_key.object.session);
+}
+
+static void tpm2_tool_onexit(void *tool_ctx) {
+
+    tpm_encrypt_decrypt_ctx *ctx = tool_ctx;
+    if (ctx) {
+        files_input_close(&ctx->input);
+    }
+    free(ctx);
 }
 
 // Register this tool with tpm2_tool.c
-TPM2_TOOL_REGISTER("encryptdecrypt", tpm2_tool_onstart, tpm2_tool_onrun, tpm2_tool_onstop, NULL)
+TPM2_TOOL_REGISTER_CTX("encryptdecrypt", tpm2_tool_onstart, tpm2_tool_onrun, tpm2_tool_onstop, tpm2_tool_onexit)
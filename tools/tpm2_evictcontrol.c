@@ -1,6 +1,8 @@
 /* SPDX-License-Identifier: BSD-3-Clause */
 
 #include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
 
 #include "files.h"
 #include "log.h"
@@ -8,6 +10,8 @@
 #include "tpm2_capability.h"
 #include "tpm2_tool.h"
 
+#define MANIFEST_FIELDS_MAX 3
+
 typedef struct tpm_evictcontrol_ctx tpm_evictcontrol_ctx;
 struct tpm_evictcontrol_ctx {
     struct {
@@ -31,12 +35,30 @@ struct tpm_evictcontrol_ctx {
         UINT8 o :1;
     } flags;
     char *cp_hash_path;
+    char *manifest_path;
 };
 
 static tpm_evictcontrol_ctx ctx = {
     .auth_hierarchy.ctx_path="o",
 };
 
+typedef struct manifest_entry manifest_entry;
+struct manifest_entry {
+    char *line;
+    size_t line_number;
+    const char *ctx_path;
+    const char *output_path;
+    TPMI_DH_PERSISTENT persist_handle;
+    /* the handle is picked from the vacant ones */
+    bool is_vacant;
+};
+
+typedef struct manifest manifest;
+struct manifest {
+    manifest_entry *entries;
+    size_t count;
+};
+
 static bool on_option(char key, char *value) {
 
     switch (key) {
@@ -57,6 +79,9 @@ static bool on_option(char key, char *value) {
     case 0:
         ctx.cp_hash_path = value;
         break;
+    case 1:
+        ctx.manifest_path = value;
+        break;
     }
 
     return true;
@@ -90,6 +115,7 @@ static bool tpm2_tool_onstart(tpm2_options **opts) {
       { "object-context", required_argument, NULL, 'c' },
       { "output",         required_argument, NULL, 'o' },
       { "cphash",         required_argument, NULL,  0  },
+      { "manifest",       required_argument, NULL,  1  },
     };
 
     *opts = tpm2_options_new("C:P:c:o:", ARRAY_LEN(topts), topts, on_option,
@@ -98,10 +124,212 @@ static bool tpm2_tool_onstart(tpm2_options **opts) {
     return *opts != NULL;
 }
 
+static bool manifest_add(void *e, char *line, char **fields, size_t count,
+        size_t line_number, void *userdata) {
+
+    UNUSED(userdata);
+
+    manifest_entry *entry = (manifest_entry *) e;
+    entry->line = line;
+    entry->line_number = line_number;
+    entry->ctx_path = fields[0];
+    entry->output_path = count == MANIFEST_FIELDS_MAX ? fields[2] : NULL;
+    entry->is_vacant = count == 1 || !strcmp(fields[1], "-");
+    if (!entry->is_vacant && !tpm2_util_string_to_uint32(fields[1],
+            &entry->persist_handle)) {
+        LOG_ERR("%s:%zu: Could not convert persistent handle to a number, "
+                "got: \"%s\"", ctx.manifest_path, line_number, fields[1]);
+        return false;
+    }
+
+    return true;
+}
+
+static bool manifest_load(manifest *m) {
+
+    return tpm2_util_manifest_read(ctx.manifest_path, 1, MANIFEST_FIELDS_MAX,
+            "<object> [<persistent-handle>|- [<output>]]",
+            (void **) &m->entries, &m->count, sizeof(*m->entries),
+            manifest_add, NULL);
+}
+
+static void manifest_free(manifest *m) {
+
+    size_t i;
+    for (i = 0; i < m->count; i++) {
+        free(m->entries[i].line);
+    }
+    free(m->entries);
+}
+
+static bool is_manifest_handle(const manifest *m, TPMI_DH_PERSISTENT handle) {
+
+    size_t i;
+    for (i = 0; i < m->count; i++) {
+        if (!m->entries[i].is_vacant
+                && m->entries[i].persist_handle == handle) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/*
+ * Picks the vacant handles of every entry without one from a single query of
+ * the handles in use. The handles the manifest names may be among the vacant
+ * ones, so as many more are asked for and skipped.
+ */
+static tool_rc manifest_assign_handles(ESYS_CONTEXT *ectx, manifest *m) {
+
+    UINT32 vacant_count = 0;
+    size_t i;
+    for (i = 0; i < m->count; i++) {
+        vacant_count += m->entries[i].is_vacant;
+    }
+
+    if (!vacant_count) {
+        return tool_rc_success;
+    }
+
+    TPMI_DH_PERSISTENT *vacant = calloc(m->count, sizeof(*vacant));
+    if (!vacant) {
+        LOG_ERR("oom");
+        return tool_rc_general_error;
+    }
+
+    bool is_platform = ctx.auth_hierarchy.object.handle == TPM2_RH_PLATFORM;
+    tool_rc rc = tpm2_capability_find_vacant_persistent_handles(ectx,
+            is_platform, m->count, vacant);
+    if (rc != tool_rc_success) {
+        LOG_ERR("Could not find %zu vacant persistent handles", m->count);
+        free(vacant);
+        return rc;
+    }
+
+    size_t next = 0;
+    for (i = 0; i < m->count; i++) {
+        manifest_entry *entry = &m->entries[i];
+        if (!entry->is_vacant) {
+            continue;
+        }
+
+        while (is_manifest_handle(m, vacant[next])) {
+            next++;
+        }
+        entry->persist_handle = vacant[next++];
+    }
+
+    free(vacant);
+
+    return tool_rc_success;
+}
+
+static bool manifest_evict_one(ESYS_CONTEXT *ectx, manifest_entry *entry,
+        bool *is_evicted) {
+
+    tpm2_loaded_object object = { 0 };
+    tool_rc rc = tpm2_util_object_load(ectx, entry->ctx_path, &object,
+            TPM2_HANDLE_ALL_W_NV);
+    if (rc != tool_rc_success) {
+        return false;
+    }
+
+    /* a persistent object is evicted from its handle */
+    if (object.handle >> TPM2_HR_SHIFT == TPM2_HT_PERSISTENT) {
+        entry->persist_handle = object.handle;
+    }
+
+    ESYS_TR out_tr = ESYS_TR_NONE;
+    rc = tpm2_evictcontrol(ectx, &ctx.auth_hierarchy.object, &object,
+            entry->persist_handle, &out_tr, NULL);
+    if (rc != tool_rc_success) {
+        tpm2_util_object_unload(ectx, &object);
+        return false;
+    }
+
+    *is_evicted = out_tr == ESYS_TR_NONE;
+    if (*is_evicted) {
+        return true;
+    }
+
+    bool result = !entry->output_path || files_save_ESYS_TR(ectx, out_tr,
+            entry->output_path) == tool_rc_success;
+    result &= tpm2_close(ectx, &out_tr) == tool_rc_success;
+
+    /* the persistent copy stays, the transient object is flushed */
+    result &= tpm2_util_object_unload(ectx, &object) == tool_rc_success;
+
+    return result;
+}
+
+static tool_rc manifest_run(ESYS_CONTEXT *ectx) {
+
+    if (ctx.flags.c || ctx.flags.o || ctx.flags.p || ctx.cp_hash_path) {
+        LOG_ERR("The manifest names the objects, handles and outputs, cannot "
+                "specify -c, -o, a persistent handle or --cphash");
+        return tool_rc_option_error;
+    }
+
+    tool_rc rc = tpm2_util_object_load_auth(ectx, ctx.auth_hierarchy.ctx_path,
+            ctx.auth_hierarchy.auth_str, &ctx.auth_hierarchy.object, false,
+            TPM2_HANDLE_FLAGS_O | TPM2_HANDLE_FLAGS_P);
+    if (rc != tool_rc_success) {
+        return rc;
+    }
+
+    if (ctx.auth_hierarchy.object.session && tpm2_session_get_type(
+            ctx.auth_hierarchy.object.session) == TPM2_SE_POLICY) {
+        LOG_ERR("A manifest cannot satisfy a policy session for every "
+                "command");
+        return tool_rc_option_error;
+    }
+
+    manifest m = { 0 };
+    if (!manifest_load(&m)) {
+        manifest_free(&m);
+        return tool_rc_general_error;
+    }
+
+    rc = manifest_assign_handles(ectx, &m);
+    if (rc != tool_rc_success) {
+        manifest_free(&m);
+        return rc;
+    }
+
+    size_t i;
+    for (i = 0; i < m.count; i++) {
+        manifest_entry *entry = &m.entries[i];
+
+        bool is_evicted = false;
+        bool result = manifest_evict_one(ectx, entry, &is_evicted);
+
+        tpm2_tool_output("- line: %zu\n", entry->line_number);
+        tpm2_tool_output("  persistent-handle: 0x%x\n", entry->persist_handle);
+        tpm2_tool_output("  action: %s\n", !result ? "failed" :
+                is_evicted ? "evicted" : "persisted");
+        tpm2_tool_output_flush();
+
+        if (!result) {
+            LOG_ERR("%s:%zu: Could not persist or evict \"%s\"",
+                    ctx.manifest_path, entry->line_number, entry->ctx_path);
+            rc = tool_rc_general_error;
+        }
+    }
+
+    manifest_free(&m);
+
+    return rc;
+}
+
 static tool_rc tpm2_tool_onrun(ESYS_CONTEXT *ectx, tpm2_option_flags flags) {
 
     UNUSED(flags);
 
+    if (ctx.manifest_path) {
+        return manifest_run(ectx);
+    }
+
     tool_rc rc = tool_rc_general_error;
     bool evicted = false;
 
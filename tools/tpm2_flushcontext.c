@@ -5,12 +5,14 @@
 #include "log.h"
 #include "object.h"
 #include "tpm2.h"
+#include "tpm2_arena.h"
 #include "tpm2_tool.h"
 #include "tpm2_capability.h"
 #include "tpm2_options.h"
 
 struct tpm_flush_context_ctx {
     TPM2_HANDLE property;
+    bool is_all;
     char *context_arg;
     unsigned encountered_option;
 };
@@ -32,28 +34,77 @@ static const char *get_property_name(TPM2_HANDLE handle) {
 }
 
 static tool_rc flush_contexts_tpm2(ESYS_CONTEXT *ectx, TPM2_HANDLE handles[],
-        UINT32 count) {
+        UINT32 count, UINT32 *failed) {
 
+    /*
+     * The handles are flushed back to back, a failing one does not stop the
+     * others from being flushed.
+     */
+    tool_rc result = tool_rc_success;
     UINT32 i;
-
     for (i = 0; i < count; ++i) {
 
-        ESYS_TR handle;
-        tool_rc rc = tpm2_util_sys_handle_to_esys_handle(ectx, handles[i],
-                &handle);
-        if (rc != tool_rc_success) {
-            return rc;
-        }
-
-        rc = tpm2_flush_context(ectx, handle);
+        tool_rc rc = tpm2_flush_context_by_handle(ectx, handles[i]);
         if (rc != tool_rc_success) {
             LOG_ERR("Failed Flush Context for %s handle 0x%x",
                     get_property_name(handles[i]), handles[i]);
-            return rc;
+            if (result == tool_rc_success) {
+                result = rc;
+            }
+            (*failed)++;
         }
     }
 
-    return tool_rc_success;
+    return result;
+}
+
+static tool_rc flush_range(ESYS_CONTEXT *ectx, TPM2_HANDLE property,
+        UINT32 *count, UINT32 *failed) {
+
+    TPMS_CAPABILITY_DATA *capability_data = NULL;
+    tool_rc rc = tpm2_capability_get(ectx, TPM2_CAP_HANDLES, property,
+            TPM2_MAX_CAP_HANDLES, &capability_data);
+    bool is_adopted = tpm2_arena_adopt(tpm2_arena_invocation(),
+            capability_data);
+    if (rc != tool_rc_success || !is_adopted) {
+        return rc != tool_rc_success ? rc : tool_rc_general_error;
+    }
+
+    TPML_HANDLE *handles = &capability_data->data.handles;
+    *count += handles->count;
+
+    return flush_contexts_tpm2(ectx, handles->handle, handles->count, failed);
+}
+
+static tool_rc flush_ranges(ESYS_CONTEXT *ectx) {
+
+    static const TPM2_HANDLE all[] = {
+        TPM2_TRANSIENT_FIRST,
+        TPM2_LOADED_SESSION_FIRST,
+        TPM2_ACTIVE_SESSION_FIRST,
+    };
+
+    const TPM2_HANDLE *properties = ctx.is_all ? all : &ctx.property;
+    size_t property_count = ctx.is_all ? ARRAY_LEN(all) : 1;
+
+    tool_rc result = tool_rc_success;
+    UINT32 count = 0;
+    UINT32 failed = 0;
+    size_t i;
+    for (i = 0; i < property_count; i++) {
+        tool_rc rc = flush_range(ectx, properties[i], &count, &failed);
+        if (rc != tool_rc_success && result == tool_rc_success) {
+            result = rc;
+        }
+    }
+
+    if (failed) {
+        LOG_ERR("Failed to flush %u of %u handles", failed, count);
+    } else {
+        LOG_INFO("Flushed %u handles", count);
+    }
+
+    return result;
 }
 
 static bool flush_contexts_tr(ESYS_CONTEXT *ectx, ESYS_TR handles[],
@@ -75,7 +126,7 @@ static bool on_option(char key, char *value) {
     UNUSED(value);
 
     if (ctx.encountered_option) {
-        LOG_ERR("Options -t, -l and -s are mutually exclusive");
+        LOG_ERR("Options -t, -l, -s and --all are mutually exclusive");
         return false;
     }
 
@@ -91,6 +142,9 @@ static bool on_option(char key, char *value) {
     case 's':
         ctx.property = TPM2_ACTIVE_SESSION_FIRST;
         break;
+    case 0:
+        ctx.is_all = true;
+        break;
     }
 
     return true;
@@ -114,6 +168,7 @@ static bool tpm2_tool_onstart(tpm2_options **opts) {
         { "transient-object", no_argument, NULL, 't' },
         { "loaded-session",   no_argument, NULL, 'l' },
         { "saved-session",    no_argument, NULL, 's' },
+        { "all",              no_argument, NULL,  0  },
     };
 
     *opts = tpm2_options_new("tls", ARRAY_LEN(topts), topts, on_option, on_arg,
@@ -126,18 +181,8 @@ static tool_rc tpm2_tool_onrun(ESYS_CONTEXT *ectx, tpm2_option_flags flags) {
 
     UNUSED(flags);
 
-    if (ctx.property) {
-        TPMS_CAPABILITY_DATA *capability_data;
-        tool_rc rc = tpm2_capability_get(ectx, TPM2_CAP_HANDLES, ctx.property,
-                TPM2_MAX_CAP_HANDLES, &capability_data);
-        if (rc != tool_rc_success) {
-            return rc;
-        }
-
-        TPML_HANDLE *handles = &capability_data->data.handles;
-        rc = flush_contexts_tpm2(ectx, handles->handle, handles->count);
-        free(capability_data);
-        return rc;
+    if (ctx.property || ctx.is_all) {
+        return flush_ranges(ectx);
     }
 
     if (!ctx.context_arg) {
@@ -26,9 +26,6 @@
 #define TPM2_PT_HR_PERSISTENT_AVAIL ((TPM2_PT) (TPM2_PT_VAR + 9))
 #endif
 
-/* convenience macro to convert flags into "1" / "0" strings */
-#define prop_str(val) val ? "1" : "0"
-
 /* number of elements in the capability_map array */
 #define CAPABILITY_MAP_COUNT \
     (sizeof (capability_map) / sizeof (capability_map_entry_t))
@@ -173,11 +170,14 @@ bool sanity_check_capability_opts(void) {
 
 static void print_cap_map() {
 
+    tpm2_writer_list_start(NULL);
     size_t i;
     for (i = 0; i < CAPABILITY_MAP_COUNT; ++i) {
         const char *capstr = capability_map[i].capability_string;
-        tpm2_tool_output("- %s\n", capstr);
+        tpm2_writer_string(NULL, "%s", capstr);
     }
+    tpm2_writer_string(NULL, "all");
+    tpm2_writer_end();
 }
 
 /*
@@ -219,57 +219,74 @@ get_uint32_as_chars(UINT32 value) {
     buf[j] = '\0';
     return buf;
 }
+/*
+ * Print a property that only has a raw value.
+ */
+static void dump_raw(const char *name, UINT32 value) {
+    tpm2_writer_map_start(name);
+    tpm2_writer_number("raw", "0x%X", value);
+    tpm2_writer_end();
+}
+/*
+ * Print a property whose raw value is 4 characters packed into a UINT32.
+ */
+static void dump_chars(const char *name, UINT32 value) {
+    tpm2_writer_map_start(name);
+    tpm2_writer_number("raw", "0x%X", value);
+    tpm2_writer_quoted("value", "%s", get_uint32_as_chars(value));
+    tpm2_writer_end();
+}
+/*
+ * Print a property with a key made unique by its value.
+ */
+static void dump_unknown(UINT32 value) {
+    char key[16];
+    snprintf(key, sizeof(key), "unknown%X", value);
+    tpm2_writer_number(key, "0x%X", value);
+}
 /*
  * Print string representations of the TPMA_MODES.
  */
 static void tpm2_tool_output_tpma_modes(TPMA_MODES modes) {
-    tpm2_tool_output("TPM2_PT_MODES:\n"
-            "  raw: 0x%X\n", modes);
+    tpm2_writer_map_start("TPM2_PT_MODES");
+    tpm2_writer_number("raw", "0x%X", modes);
     if (modes & TPMA_MODES_FIPS_140_2)
-        tpm2_tool_output("  value: TPMA_MODES_FIPS_140_2\n");
+        tpm2_writer_string("value", "TPMA_MODES_FIPS_140_2");
     if (modes & TPMA_MODES_RESERVED1_MASK)
-        tpm2_tool_output(
-                "  value: TPMA_MODES_RESERVED1 (these bits shouldn't be set)\n");
+        tpm2_writer_string("value",
+                "TPMA_MODES_RESERVED1 (these bits shouldn't be set)");
+    tpm2_writer_end();
 }
 /*
  * Print string representation of the TPMA_PERMANENT attributes.
  */
 static void dump_permanent_attrs(TPMA_PERMANENT attrs) {
-    tpm2_tool_output("TPM2_PT_PERSISTENT:\n");
-    tpm2_tool_output("  ownerAuthSet:              %s\n",
-            prop_str (attrs & TPMA_PERMANENT_OWNERAUTHSET));
-    tpm2_tool_output("  endorsementAuthSet:        %s\n",
-            prop_str (attrs & TPMA_PERMANENT_ENDORSEMENTAUTHSET));
-    tpm2_tool_output("  lockoutAuthSet:            %s\n",
-            prop_str (attrs & TPMA_PERMANENT_LOCKOUTAUTHSET));
-    tpm2_tool_output("  reserved1:                 %s\n",
-            prop_str (attrs & TPMA_PERMANENT_RESERVED1_MASK));
-    tpm2_tool_output("  disableClear:              %s\n",
-            prop_str (attrs & TPMA_PERMANENT_DISABLECLEAR));
-    tpm2_tool_output("  inLockout:                 %s\n",
-            prop_str (attrs & TPMA_PERMANENT_INLOCKOUT));
-    tpm2_tool_output("  tpmGeneratedEPS:           %s\n",
-            prop_str (attrs & TPMA_PERMANENT_TPMGENERATEDEPS));
-    tpm2_tool_output("  reserved2:                 %s\n",
-            prop_str (attrs & TPMA_PERMANENT_RESERVED2_MASK));
+    tpm2_writer_map_start("TPM2_PT_PERSISTENT");
+    tpm2_writer_align(27);
+    tpm2_writer_flag("ownerAuthSet", attrs & TPMA_PERMANENT_OWNERAUTHSET);
+    tpm2_writer_flag("endorsementAuthSet",
+            attrs & TPMA_PERMANENT_ENDORSEMENTAUTHSET);
+    tpm2_writer_flag("lockoutAuthSet", attrs & TPMA_PERMANENT_LOCKOUTAUTHSET);
+    tpm2_writer_flag("reserved1", attrs & TPMA_PERMANENT_RESERVED1_MASK);
+    tpm2_writer_flag("disableClear", attrs & TPMA_PERMANENT_DISABLECLEAR);
+    tpm2_writer_flag("inLockout", attrs & TPMA_PERMANENT_INLOCKOUT);
+    tpm2_writer_flag("tpmGeneratedEPS", attrs & TPMA_PERMANENT_TPMGENERATEDEPS);
+    tpm2_writer_flag("reserved2", attrs & TPMA_PERMANENT_RESERVED2_MASK);
+    tpm2_writer_end();
 }
 /*
  * Print string representations of the TPMA_STARTUP_CLEAR attributes.
  */
 static void dump_startup_clear_attrs(TPMA_STARTUP_CLEAR attrs) {
-    tpm2_tool_output("TPM2_PT_STARTUP_CLEAR:\n");
-    tpm2_tool_output("  phEnable:                  %s\n",
-            prop_str (attrs & TPMA_STARTUP_CLEAR_PHENABLE));
-    tpm2_tool_output("  shEnable:                  %s\n",
-            prop_str (attrs & TPMA_STARTUP_CLEAR_SHENABLE));
-    tpm2_tool_output("  ehEnable:                  %s\n",
-            prop_str (attrs & TPMA_STARTUP_CLEAR_EHENABLE));;
-    tpm2_tool_output("  phEnableNV:                %s\n",
-            prop_str (attrs & TPMA_STARTUP_CLEAR_PHENABLENV));
-    tpm2_tool_output("  reserved1:                 %s\n",
-            prop_str (attrs & TPMA_STARTUP_CLEAR_RESERVED1_MASK));
-    tpm2_tool_output("  orderly:                   %s\n",
-            prop_str (attrs & TPMA_STARTUP_CLEAR_ORDERLY));
+    tpm2_writer_map_start("TPM2_PT_STARTUP_CLEAR");
+    tpm2_writer_align(27);
+    tpm2_writer_flag("phEnable", attrs & TPMA_STARTUP_CLEAR_PHENABLE);
+    tpm2_writer_flag("shEnable", attrs & TPMA_STARTUP_CLEAR_SHENABLE);
+    tpm2_writer_flag("ehEnable", attrs & TPMA_STARTUP_CLEAR_EHENABLE);
+    tpm2_writer_flag("phEnableNV", attrs & TPMA_STARTUP_CLEAR_PHENABLENV);
+    tpm2_writer_flag("reserved1", attrs & TPMA_STARTUP_CLEAR_RESERVED1_MASK);
+    tpm2_writer_flag("orderly", attrs & TPMA_STARTUP_CLEAR_ORDERLY);
+    tpm2_writer_end();
 }
 /*
  * Iterate over all fixed properties, call the unique print function for each.
@@ -277,202 +294,153 @@ static void dump_startup_clear_attrs(TPMA_STARTUP_CLEAR attrs) {
 static void dump_tpm_properties_fixed(TPMS_TAGGED_PROPERTY properties[],
         size_t count) {
     size_t i;
-    char *buf;
 
     for (i = 0; i < count; ++i) {
         TPM2_PT property = properties[i].property;
         UINT32 value = properties[i].value;
         switch (property) {
         case TPM2_PT_FAMILY_INDICATOR:
-            buf = get_uint32_as_chars(value);
-            tpm2_tool_output("TPM2_PT_FAMILY_INDICATOR:\n"
-                    "  raw: 0x%X\n"
-                    "  value: \"%s\"\n", value, buf);
+            dump_chars("TPM2_PT_FAMILY_INDICATOR", value);
             break;
         case TPM2_PT_LEVEL:
-            tpm2_tool_output("TPM2_PT_LEVEL:\n"
-                    "  raw: %d\n", value);
+            tpm2_writer_map_start("TPM2_PT_LEVEL");
+            tpm2_writer_number("raw", "%d", value);
+            tpm2_writer_end();
             break;
         case TPM2_PT_REVISION:
-            tpm2_tool_output("TPM2_PT_REVISION:\n"
-                    "  raw: 0x%X\n"
-                    "  value: %.2f\n", value, (float )value / 100);
+            tpm2_writer_map_start("TPM2_PT_REVISION");
+            tpm2_writer_number("raw", "0x%X", value);
+            tpm2_writer_number("value", "%.2f", (float )value / 100);
+            tpm2_writer_end();
             break;
         case TPM2_PT_DAY_OF_YEAR:
-            tpm2_tool_output("TPM2_PT_DAY_OF_YEAR:\n"
-                    "  raw: 0x%X\n", value);
+            dump_raw("TPM2_PT_DAY_OF_YEAR", value);
             break;
         case TPM2_PT_YEAR:
-            tpm2_tool_output("TPM2_PT_YEAR:\n"
-                    "  raw: 0x%X\n", value);
+            dump_raw("TPM2_PT_YEAR", value);
             break;
         case TPM2_PT_MANUFACTURER: {
             UINT32 he_value = tpm2_util_ntoh_32(value);
-            tpm2_tool_output("TPM2_PT_MANUFACTURER:\n"
-                    "  raw: 0x%X\n"
-                    "  value: \"%.*s\"\n", value, (int )sizeof(value),
+            tpm2_writer_map_start("TPM2_PT_MANUFACTURER");
+            tpm2_writer_number("raw", "0x%X", value);
+            tpm2_writer_quoted("value", "%.*s", (int )sizeof(value),
                     (char * )&he_value);
+            tpm2_writer_end();
         }
             break;
         case TPM2_PT_VENDOR_STRING_1:
-            buf = get_uint32_as_chars(value);
-            tpm2_tool_output("TPM2_PT_VENDOR_STRING_1:\n"
-                    "  raw: 0x%X\n"
-                    "  value: \"%s\"\n", value, buf);
+            dump_chars("TPM2_PT_VENDOR_STRING_1", value);
             break;
         case TPM2_PT_VENDOR_STRING_2:
-            buf = get_uint32_as_chars(value);
-            tpm2_tool_output("TPM2_PT_VENDOR_STRING_2:\n"
-                    "  raw: 0x%X\n"
-                    "  value: \"%s\"\n", value, buf);
+            dump_chars("TPM2_PT_VENDOR_STRING_2", value);
             break;
         case TPM2_PT_VENDOR_STRING_3:
-            buf = get_uint32_as_chars(value);
-            tpm2_tool_output("TPM2_PT_VENDOR_STRING_3:\n"
-                    "  raw: 0x%X\n"
-                    "  value: \"%s\"\n", value, buf);
+            dump_chars("TPM2_PT_VENDOR_STRING_3", value);
             break;
         case TPM2_PT_VENDOR_STRING_4:
-            buf = get_uint32_as_chars(value);
-            tpm2_tool_output("TPM2_PT_VENDOR_STRING_4:\n"
-                    "  raw: 0x%X\n"
-                    "  value: \"%s\"\n", value, buf);
+            dump_chars("TPM2_PT_VENDOR_STRING_4", value);
             break;
         case TPM2_PT_VENDOR_TPM_TYPE:
-            tpm2_tool_output("TPM2_PT_VENDOR_TPM_TYPE:\n"
-                    "  raw: 0x%X\n", value);
+            dump_raw("TPM2_PT_VENDOR_TPM_TYPE", value);
             break;
         case TPM2_PT_FIRMWARE_VERSION_1:
-            tpm2_tool_output("TPM2_PT_FIRMWARE_VERSION_1:\n"
-                    "  raw: 0x%X\n", value);
+            dump_raw("TPM2_PT_FIRMWARE_VERSION_1", value);
             break;
         case TPM2_PT_FIRMWARE_VERSION_2:
-            tpm2_tool_output("TPM2_PT_FIRMWARE_VERSION_2:\n"
-                    "  raw: 0x%X\n", value);
+            dump_raw("TPM2_PT_FIRMWARE_VERSION_2", value);
             break;
         case TPM2_PT_INPUT_BUFFER:
-            tpm2_tool_output("TPM2_PT_INPUT_BUFFER:\n"
-                    "  raw: 0x%X\n", value);
+            dump_raw("TPM2_PT_INPUT_BUFFER", value);
             break;
         case TPM2_PT_HR_TRANSIENT_MIN:
-            tpm2_tool_output("TPM2_PT_HR_TRANSIENT_MIN:\n"
-                    "  raw: 0x%X\n", value);
+            dump_raw("TPM2_PT_HR_TRANSIENT_MIN", value);
             break;
         case TPM2_PT_HR_PERSISTENT_MIN:
-            tpm2_tool_output("TPM2_PT_HR_PERSISTENT_MIN:\n"
-                    "  raw: 0x%X\n", value);
+            dump_raw("TPM2_PT_HR_PERSISTENT_MIN", value);
             break;
         case TPM2_PT_HR_LOADED_MIN:
-            tpm2_tool_output("TPM2_PT_HR_LOADED_MIN:\n"
-                    "  raw: 0x%X\n", value);
+            dump_raw("TPM2_PT_HR_LOADED_MIN", value);
             break;
         case TPM2_PT_ACTIVE_SESSIONS_MAX:
-            tpm2_tool_output("TPM2_PT_ACTIVE_SESSIONS_MAX:\n"
-                    "  raw: 0x%X\n", value);
+            dump_raw("TPM2_PT_ACTIVE_SESSIONS_MAX", value);
             break;
         case TPM2_PT_PCR_COUNT:
-            tpm2_tool_output("TPM2_PT_PCR_COUNT:\n"
-                    "  raw: 0x%X\n", value);
+            dump_raw("TPM2_PT_PCR_COUNT", value);
             break;
         case TPM2_PT_PCR_SELECT_MIN:
-            tpm2_tool_output("TPM2_PT_PCR_SELECT_MIN:\n"
-                    "  raw: 0x%X\n", value);
+            dump_raw("TPM2_PT_PCR_SELECT_MIN", value);
             break;
         case TPM2_PT_CONTEXT_GAP_MAX:
-            tpm2_tool_output("TPM2_PT_CONTEXT_GAP_MAX:\n"
-                    "  raw: 0x%X\n", value);
+            dump_raw("TPM2_PT_CONTEXT_GAP_MAX", value);
             break;
         case TPM2_PT_NV_COUNTERS_MAX:
-            tpm2_tool_output("TPM2_PT_NV_COUNTERS_MAX:\n"
-                    "  raw: 0x%X\n", value);
+            dump_raw("TPM2_PT_NV_COUNTERS_MAX", value);
             break;
         case TPM2_PT_NV_INDEX_MAX:
-            tpm2_tool_output("TPM2_PT_NV_INDEX_MAX:\n"
-                    "  raw: 0x%X\n", value);
+            dump_raw("TPM2_PT_NV_INDEX_MAX", value);
             break;
         case TPM2_PT_MEMORY:
-            tpm2_tool_output("TPM2_PT_MEMORY:\n"
-                    "  raw: 0x%X\n", value);
+            dump_raw("TPM2_PT_MEMORY", value);
             break;
         case TPM2_PT_CLOCK_UPDATE:
-            tpm2_tool_output("TPM2_PT_CLOCK_UPDATE:\n"
-                    "  raw: 0x%X\n", value);
+            dump_raw("TPM2_PT_CLOCK_UPDATE", value);
             break;
         case TPM2_PT_CONTEXT_HASH: /* this may be a TPM2_ALG_ID type */
-            tpm2_tool_output("TPM2_PT_CONTEXT_HASH:\n"
-                    "  raw: 0x%X\n", value);
+            dump_raw("TPM2_PT_CONTEXT_HASH", value);
             break;
         case TPM2_PT_CONTEXT_SYM: /* this is a TPM2_ALG_ID type */
-            tpm2_tool_output("TPM2_PT_CONTEXT_SYM:\n"
-                    "  raw: 0x%X\n", value);
+            dump_raw("TPM2_PT_CONTEXT_SYM", value);
             break;
         case TPM2_PT_CONTEXT_SYM_SIZE:
-            tpm2_tool_output("TPM2_PT_CONTEXT_SYM_SIZE:\n"
-                    "  raw: 0x%X\n", value);
+            dump_raw("TPM2_PT_CONTEXT_SYM_SIZE", value);
             break;
         case TPM2_PT_ORDERLY_COUNT:
-            tpm2_tool_output("TPM2_PT_ORDERLY_COUNT:\n"
-                    "  raw: 0x%X\n", value);
+            dump_raw("TPM2_PT_ORDERLY_COUNT", value);
             break;
         case TPM2_PT_MAX_COMMAND_SIZE:
-            tpm2_tool_output("TPM2_PT_MAX_COMMAND_SIZE:\n"
-                    "  raw: 0x%X\n", value);
+            dump_raw("TPM2_PT_MAX_COMMAND_SIZE", value);
             break;
         case TPM2_PT_MAX_RESPONSE_SIZE:
-            tpm2_tool_output("TPM2_PT_MAX_RESPONSE_SIZE:\n"
-                    "  raw: 0x%X\n", value);
+            dump_raw("TPM2_PT_MAX_RESPONSE_SIZE", value);
             break;
         case TPM2_PT_MAX_DIGEST:
-            tpm2_tool_output("TPM2_PT_MAX_DIGEST:\n"
-                    "  raw: 0x%X\n", value);
+            dump_raw("TPM2_PT_MAX_DIGEST", value);
             break;
         case TPM2_PT_MAX_OBJECT_CONTEXT:
-            tpm2_tool_output("TPM2_PT_MAX_OBJECT_CONTEXT:\n"
-                    "  raw: 0x%X\n", value);
+            dump_raw("TPM2_PT_MAX_OBJECT_CONTEXT", value);
             break;
         case TPM2_PT_MAX_SESSION_CONTEXT:
-            tpm2_tool_output("TPM2_PT_MAX_SESSION_CONTEXT:\n"
-                    "  raw: 0x%X\n", value);
+            dump_raw("TPM2_PT_MAX_SESSION_CONTEXT", value);
             break;
         case TPM2_PT_PS_FAMILY_INDICATOR:
-            tpm2_tool_output("TPM2_PT_PS_FAMILY_INDICATOR:\n"
-                    "  raw: 0x%X\n", value);
+            dump_raw("TPM2_PT_PS_FAMILY_INDICATOR", value);
             break;
         case TPM2_PT_PS_LEVEL:
-            tpm2_tool_output("TPM2_PT_PS_LEVEL:\n"
-                    "  raw: 0x%X\n", value);
+            dump_raw("TPM2_PT_PS_LEVEL", value);
             break;
         case TPM2_PT_PS_REVISION:
-            tpm2_tool_output("TPM2_PT_PS_REVISION:\n"
-                    "  raw: 0x%X\n", value);
+            dump_raw("TPM2_PT_PS_REVISION", value);
             break;
         case TPM2_PT_PS_DAY_OF_YEAR:
-            tpm2_tool_output("TPM2_PT_PS_DAY_OF_YEAR:\n"
-                    "  raw: 0x%X\n", value);
+            dump_raw("TPM2_PT_PS_DAY_OF_YEAR", value);
             break;
         case TPM2_PT_PS_YEAR:
-            tpm2_tool_output("TPM2_PT_PS_YEAR:\n"
-                    "  raw: 0x%X\n", value);
+            dump_raw("TPM2_PT_PS_YEAR", value);
             break;
         case TPM2_PT_SPLIT_MAX:
-            tpm2_tool_output("TPM2_PT_SPLIT_MAX:\n"
-                    "  raw: 0x%X\n", value);
+            dump_raw("TPM2_PT_SPLIT_MAX", value);
             break;
         case TPM2_PT_TOTAL_COMMANDS:
-            tpm2_tool_output("TPM2_PT_TOTAL_COMMANDS:\n"
-                    "  raw: 0x%X\n", value);
+            dump_raw("TPM2_PT_TOTAL_COMMANDS", value);
             break;
         case TPM2_PT_LIBRARY_COMMANDS:
-            tpm2_tool_output("TPM2_PT_LIBRARY_COMMANDS:\n"
-                    "  raw: 0x%X\n", value);
+            dump_raw("TPM2_PT_LIBRARY_COMMANDS", value);
             break;
         case TPM2_PT_VENDOR_COMMANDS:
-            tpm2_tool_output("TPM2_PT_VENDOR_COMMANDS:\n"
-                    "  raw: 0x%X\n", value);
+            dump_raw("TPM2_PT_VENDOR_COMMANDS", value);
             break;
         case TPM2_PT_NV_BUFFER_MAX:
-            tpm2_tool_output("TPM2_PT_NV_BUFFER_MAX:\n"
-                    "  raw: 0x%X\n", value);
+            dump_raw("TPM2_PT_NV_BUFFER_MAX", value);
             break;
         case TPM2_PT_MODES:
             tpm2_tool_output_tpma_modes((TPMA_MODES) value);
@@ -498,64 +466,64 @@ static void dump_tpm_properties_var(TPMS_TAGGED_PROPERTY properties[],
             dump_startup_clear_attrs((TPMA_STARTUP_CLEAR) value);
             break;
         case TPM2_PT_HR_NV_INDEX:
-            tpm2_tool_output("TPM2_PT_HR_NV_INDEX: 0x%X\n", value);
+            tpm2_writer_number("TPM2_PT_HR_NV_INDEX", "0x%X", value);
             break;
         case TPM2_PT_HR_LOADED:
-            tpm2_tool_output("TPM2_PT_HR_LOADED: 0x%X\n", value);
+            tpm2_writer_number("TPM2_PT_HR_LOADED", "0x%X", value);
             break;
         case TPM2_PT_HR_LOADED_AVAIL:
-            tpm2_tool_output("TPM2_PT_HR_LOADED_AVAIL: 0x%X\n", value);
+            tpm2_writer_number("TPM2_PT_HR_LOADED_AVAIL", "0x%X", value);
             break;
         case TPM2_PT_HR_ACTIVE:
-            tpm2_tool_output("TPM2_PT_HR_ACTIVE: 0x%X\n", value);
+            tpm2_writer_number("TPM2_PT_HR_ACTIVE", "0x%X", value);
             break;
         case TPM2_PT_HR_ACTIVE_AVAIL:
-            tpm2_tool_output("TPM2_PT_HR_ACTIVE_AVAIL: 0x%X\n", value);
+            tpm2_writer_number("TPM2_PT_HR_ACTIVE_AVAIL", "0x%X", value);
             break;
         case TPM2_PT_HR_TRANSIENT_AVAIL:
-            tpm2_tool_output("TPM2_PT_HR_TRANSIENT_AVAIL: 0x%X\n", value);
+            tpm2_writer_number("TPM2_PT_HR_TRANSIENT_AVAIL", "0x%X", value);
             break;
         case TPM2_PT_HR_PERSISTENT:
-            tpm2_tool_output("TPM2_PT_HR_PERSISTENT: 0x%X\n", value);
+            tpm2_writer_number("TPM2_PT_HR_PERSISTENT", "0x%X", value);
             break;
         case TPM2_PT_HR_PERSISTENT_AVAIL:
-            tpm2_tool_output("TPM2_PT_HR_PERSISTENT_AVAIL: 0x%X\n", value);
+            tpm2_writer_number("TPM2_PT_HR_PERSISTENT_AVAIL", "0x%X", value);
             break;
         case TPM2_PT_NV_COUNTERS:
-            tpm2_tool_output("TPM2_PT_NV_COUNTERS: 0x%X\n", value);
+            tpm2_writer_number("TPM2_PT_NV_COUNTERS", "0x%X", value);
             break;
         case TPM2_PT_NV_COUNTERS_AVAIL:
-            tpm2_tool_output("TPM2_PT_NV_COUNTERS_AVAIL: 0x%X\n", value);
+            tpm2_writer_number("TPM2_PT_NV_COUNTERS_AVAIL", "0x%X", value);
             break;
         case TPM2_PT_ALGORITHM_SET:
-            tpm2_tool_output("TPM2_PT_ALGORITHM_SET: 0x%X\n", value);
+            tpm2_writer_number("TPM2_PT_ALGORITHM_SET", "0x%X", value);
             break;
         case TPM2_PT_LOADED_CURVES:
-            tpm2_tool_output("TPM2_PT_LOADED_CURVES: 0x%X\n", value);
+            tpm2_writer_number("TPM2_PT_LOADED_CURVES", "0x%X", value);
             break;
         case TPM2_PT_LOCKOUT_COUNTER:
-            tpm2_tool_output("TPM2_PT_LOCKOUT_COUNTER: 0x%X\n", value);
+            tpm2_writer_number("TPM2_PT_LOCKOUT_COUNTER", "0x%X", value);
             break;
         case TPM2_PT_MAX_AUTH_FAIL:
-            tpm2_tool_output("TPM2_PT_MAX_AUTH_FAIL: 0x%X\n", value);
+            tpm2_writer_number("TPM2_PT_MAX_AUTH_FAIL", "0x%X", value);
             break;
         case TPM2_PT_LOCKOUT_INTERVAL:
-            tpm2_tool_output("TPM2_PT_LOCKOUT_INTERVAL: 0x%X\n", value);
+            tpm2_writer_number("TPM2_PT_LOCKOUT_INTERVAL", "0x%X", value);
             break;
         case TPM2_PT_LOCKOUT_RECOVERY:
-            tpm2_tool_output("TPM2_PT_LOCKOUT_RECOVERY: 0x%X\n", value);
+            tpm2_writer_number("TPM2_PT_LOCKOUT_RECOVERY", "0x%X", value);
             break;
         case TPM2_PT_NV_WRITE_RECOVERY:
-            tpm2_tool_output("TPM2_PT_NV_WRITE_RECOVERY: 0x%X\n", value);
+            tpm2_writer_number("TPM2_PT_NV_WRITE_RECOVERY", "0x%X", value);
             break;
         case TPM2_PT_AUDIT_COUNTER_0:
-            tpm2_tool_output("TPM2_PT_AUDIT_COUNTER_0: 0x%X\n", value);
+            tpm2_writer_number("TPM2_PT_AUDIT_COUNTER_0", "0x%X", value);
             break;
         case TPM2_PT_AUDIT_COUNTER_1:
-            tpm2_tool_output("TPM2_PT_AUDIT_COUNTER_1: 0x%X\n", value);
+            tpm2_writer_number("TPM2_PT_AUDIT_COUNTER_1", "0x%X", value);
             break;
         default:
-            tpm2_tool_output("unknown%X: 0x%X\n", value, value);
+            dump_unknown(value);
             break;
         }
     }
@@ -569,32 +537,29 @@ static void dump_algorithm_properties(TPM2_ALG_ID id, TPMA_ALGORITHM alg_attrs)
     id_name = id_name ? id_name : "unknown";
 
     if (!is_unknown) {
-        tpm2_tool_output("%s:\n", id_name);
+        tpm2_writer_map_start(id_name);
     } else {
         /* If it's unknown, we don't want N unknowns in the map, so
          * make them unknown42, unknown<alg id> since that's unique.
          * We do it this way, as most folks will want to just look up
          * if a given alg via "friendly" name like rsa is supported.
          */
-        tpm2_tool_output("%s%x:\n", id_name, id);
+        char key[16];
+        snprintf(key, sizeof(key), "%s%x", id_name, id);
+        tpm2_writer_map_start(key);
     }
-    tpm2_tool_output("  value:      0x%X\n", id);
-    tpm2_tool_output("  asymmetric: %s\n",
-            prop_str (alg_attrs & TPMA_ALGORITHM_ASYMMETRIC));
-    tpm2_tool_output("  symmetric:  %s\n",
-            prop_str (alg_attrs & TPMA_ALGORITHM_SYMMETRIC));
-    tpm2_tool_output("  hash:       %s\n",
-            prop_str (alg_attrs & TPMA_ALGORITHM_HASH));
-    tpm2_tool_output("  object:     %s\n",
-            prop_str (alg_attrs & TPMA_ALGORITHM_OBJECT));
-    tpm2_tool_output("  reserved:   0x%X\n",
+    tpm2_writer_align(12);
+    tpm2_writer_number("value", "0x%X", id);
+    tpm2_writer_flag("asymmetric", alg_attrs & TPMA_ALGORITHM_ASYMMETRIC);
+    tpm2_writer_flag("symmetric", alg_attrs & TPMA_ALGORITHM_SYMMETRIC);
+    tpm2_writer_flag("hash", alg_attrs & TPMA_ALGORITHM_HASH);
+    tpm2_writer_flag("object", alg_attrs & TPMA_ALGORITHM_OBJECT);
+    tpm2_writer_number("reserved", "0x%X",
             (alg_attrs & TPMA_ALGORITHM_RESERVED1_MASK) >> 4);
-    tpm2_tool_output("  signing:    %s\n",
-            prop_str (alg_attrs & TPMA_ALGORITHM_SIGNING));
-    tpm2_tool_output("  encrypting: %s\n",
-            prop_str (alg_attrs & TPMA_ALGORITHM_ENCRYPTING));
-    tpm2_tool_output("  method:     %s\n",
-            prop_str (alg_attrs & TPMA_ALGORITHM_METHOD));
+    tpm2_writer_flag("signing", alg_attrs & TPMA_ALGORITHM_SIGNING);
+    tpm2_writer_flag("encrypting", alg_attrs & TPMA_ALGORITHM_ENCRYPTING);
+    tpm2_writer_flag("method", alg_attrs & TPMA_ALGORITHM_METHOD);
+    tpm2_writer_end();
 }
 
 /*
@@ -629,24 +594,23 @@ static bool dump_command_attrs(TPMA_CC tpma_cc) {
         value = _buf;
     }
 
-    tpm2_tool_output("%s:\n", value);
-    tpm2_tool_output("  value: 0x%X\n", tpma_cc);
-    tpm2_tool_output("  commandIndex: 0x%x\n",
+    tpm2_writer_map_start(value);
+    tpm2_writer_number("value", "0x%X", tpma_cc);
+    tpm2_writer_number("commandIndex", "0x%x",
             tpma_cc & TPMA_CC_COMMANDINDEX_MASK);
-    tpm2_tool_output("  reserved1:    0x%x\n",
+    tpm2_writer_align(14);
+    tpm2_writer_number("reserved1", "0x%x",
             (tpma_cc & TPMA_CC_RESERVED1_MASK) >> 16);
-    tpm2_tool_output("  nv:           %s\n", prop_str (tpma_cc & TPMA_CC_NV));
-    tpm2_tool_output("  extensive:    %s\n",
-            prop_str (tpma_cc & TPMA_CC_EXTENSIVE));
-    tpm2_tool_output("  flushed:      %s\n",
-            prop_str (tpma_cc & TPMA_CC_FLUSHED));
-    tpm2_tool_output("  cHandles:     0x%x\n",
+    tpm2_writer_flag("nv", tpma_cc & TPMA_CC_NV);
+    tpm2_writer_flag("extensive", tpma_cc & TPMA_CC_EXTENSIVE);
+    tpm2_writer_flag("flushed", tpma_cc & TPMA_CC_FLUSHED);
+    tpm2_writer_number("cHandles", "0x%x",
             (tpma_cc & TPMA_CC_CHANDLES_MASK) >> TPMA_CC_CHANDLES_SHIFT);
-    tpm2_tool_output("  rHandle:      %s\n",
-            prop_str (tpma_cc & TPMA_CC_RHANDLE));
-    tpm2_tool_output("  V:            %s\n", prop_str (tpma_cc & TPMA_CC_V));
-    tpm2_tool_output("  Res:          0x%x\n",
+    tpm2_writer_flag("rHandle", tpma_cc & TPMA_CC_RHANDLE);
+    tpm2_writer_flag("V", tpma_cc & TPMA_CC_V);
+    tpm2_writer_number("Res", "0x%x",
             (tpma_cc & TPMA_CC_RES_MASK) >> TPMA_CC_RES_SHIFT);
+    tpm2_writer_end();
     return true;
 }
 /*
@@ -659,31 +623,31 @@ static void dump_ecc_curves(TPM2_ECC_CURVE curve[], UINT32 count) {
     for (i = 0; i < count; ++i) {
         switch (curve[i]) {
         case TPM2_ECC_NIST_P192:
-            tpm2_tool_output("TPM2_ECC_NIST_P192: 0x%X\n", curve[i]);
+            tpm2_writer_number("TPM2_ECC_NIST_P192", "0x%X", curve[i]);
             break;
         case TPM2_ECC_NIST_P224:
-            tpm2_tool_output("TPM2_ECC_NIST_P224: 0x%X\n", curve[i]);
+            tpm2_writer_number("TPM2_ECC_NIST_P224", "0x%X", curve[i]);
             break;
         case TPM2_ECC_NIST_P256:
-            tpm2_tool_output("TPM2_ECC_NIST_P256: 0x%X\n", curve[i]);
+            tpm2_writer_number("TPM2_ECC_NIST_P256", "0x%X", curve[i]);
             break;
         case TPM2_ECC_NIST_P384:
-            tpm2_tool_output("TPM2_ECC_NIST_P384: 0x%X\n", curve[i]);
+            tpm2_writer_number("TPM2_ECC_NIST_P384", "0x%X", curve[i]);
             break;
         case TPM2_ECC_NIST_P521:
-            tpm2_tool_output("TPM2_ECC_NIST_P521: 0x%X\n", curve[i]);
+            tpm2_writer_number("TPM2_ECC_NIST_P521", "0x%X", curve[i]);
             break;
         case TPM2_ECC_BN_P256:
-            tpm2_tool_output("TPM2_ECC_BN_P256: 0x%X\n", curve[i]);
+            tpm2_writer_number("TPM2_ECC_BN_P256", "0x%X", curve[i]);
             break;
         case TPM2_ECC_BN_P638:
-            tpm2_tool_output("TPM2_ECC_BN_P638: 0x%X\n", curve[i]);
+            tpm2_writer_number("TPM2_ECC_BN_P638", "0x%X", curve[i]);
             break;
         case TPM2_ECC_SM2_P256:
-            tpm2_tool_output("TPM2_ECC_SM2_P256: 0x%X\n", curve[i]);
+            tpm2_writer_number("TPM2_ECC_SM2_P256", "0x%X", curve[i]);
             break;
         default:
-            tpm2_tool_output("unknown%X: 0x%X\n", curve[i], curve[i]);
+            dump_unknown(curve[i]);
             break;
         }
     }
@@ -704,11 +668,14 @@ static bool dump_command_attr_array(TPMA_CC command_attributes[], UINT32 count)
  * Iterate over an array of TPML_HANDLEs and dump out the handle
  * values.
  */
-static void dump_handles(TPM2_HANDLE handles[], UINT32 count) {
+static void dump_handles(const char *name, TPM2_HANDLE handles[],
+        UINT32 count) {
     UINT32 i;
 
+    tpm2_writer_list_start(name);
     for (i = 0; i < count; ++i)
-        tpm2_tool_output("- 0x%X\n", handles[i]);
+        tpm2_writer_number(NULL, "0x%X", handles[i]);
+    tpm2_writer_end();
 }
 /*
  * Query the TPM for TPM capabilities.
@@ -726,8 +693,16 @@ static tool_rc get_tpm_capability_all(ESYS_CONTEXT *context,
  * On success it will return true, if it fails (is unable to find an
  * appropriate print function for the provided 'capability' / 'property'
  * pair or the print routine fails)  then it will return false.
+ * For "all" the group is nested under its name, which is NULL otherwise.
  */
-static bool dump_tpm_capability(TPMU_CAPABILITIES *capabilities) {
+static bool dump_tpm_capability(const char *name,
+        TPMU_CAPABILITIES *capabilities) {
+
+    /* the handles are a list of their own */
+    bool is_nested = name && options.capability != TPM2_CAP_HANDLES;
+    if (is_nested) {
+        tpm2_writer_map_start(name);
+    }
 
     bool result = true;
     switch (options.capability) {
@@ -751,7 +726,7 @@ static bool dump_tpm_capability(TPMU_CAPABILITIES *capabilities) {
                     capabilities->tpmProperties.count);
             break;
         default:
-            return false;
+            result = false;
         }
         break;
     case TPM2_CAP_ECC_CURVES:
@@ -767,22 +742,94 @@ static bool dump_tpm_capability(TPMU_CAPABILITIES *capabilities) {
         case TPM2_HR_NV_INDEX:
         case TPM2_HT_LOADED_SESSION << TPM2_HR_SHIFT:
         case TPM2_HT_SAVED_SESSION << TPM2_HR_SHIFT:
-            dump_handles(capabilities->handles.handle,
+            dump_handles(name, capabilities->handles.handle,
                     capabilities->handles.count);
             break;
         default:
-            return false;
+            result = false;
         }
         break;
     case TPM2_CAP_PCRS:
         pcr_print_pcr_selections(&capabilities->assignedPCR);
         break;
     default:
-        return false;
+        result = false;
+    }
+
+    if (is_nested) {
+        tpm2_writer_end();
     }
+
     return result;
 }
 
+/*
+ * Dumps every group as one document. The fixed and variable properties are
+ * consecutive, so one query pages through both, and the fixed ones fill the
+ * capability cache on the way.
+ */
+static tool_rc dump_all(ESYS_CONTEXT *context) {
+
+    TPMS_CAPABILITY_DATA *properties = NULL;
+    tool_rc rc = tpm2_capability_get(context, TPM2_CAP_TPM_PROPERTIES,
+            TPM2_PT_FIXED, TPM2_MAX_TPM_PROPERTIES, &properties);
+    if (rc != tool_rc_success) {
+        return rc;
+    }
+
+    TPML_TAGGED_TPM_PROPERTY *p = &properties->data.tpmProperties;
+    UINT32 fixed_count = 0;
+    while (fixed_count < p->count
+            && p->tpmProperty[fixed_count].property < TPM2_PT_VAR) {
+        fixed_count++;
+    }
+
+    /* a full answer may have cut off some of the variable properties */
+    bool is_var_complete = p->count < TPM2_MAX_TPM_PROPERTIES;
+
+    tpm2_capability_cache_fixed(p->tpmProperty, fixed_count);
+
+    size_t i;
+    for (i = 0; i < CAPABILITY_MAP_COUNT && rc == tool_rc_success; i++) {
+        const capability_map_entry_t *entry = &capability_map[i];
+        options.capability = entry->capability;
+        options.property = entry->property;
+
+        TPMS_CAPABILITY_DATA *capability_data = NULL;
+        TPMU_CAPABILITIES view;
+        TPMU_CAPABILITIES *capabilities = &view;
+        bool is_fixed = entry->capability == TPM2_CAP_TPM_PROPERTIES
+                && entry->property == TPM2_PT_FIXED;
+        bool is_var = entry->capability == TPM2_CAP_TPM_PROPERTIES
+                && entry->property == TPM2_PT_VAR;
+        if (is_fixed || (is_var && is_var_complete)) {
+            UINT32 first = is_fixed ? 0 : fixed_count;
+            UINT32 count = is_fixed ? fixed_count : p->count - fixed_count;
+            view.tpmProperties.count = count;
+            memcpy(view.tpmProperties.tpmProperty, &p->tpmProperty[first],
+                    count * sizeof(p->tpmProperty[0]));
+        } else {
+            rc = tpm2_capability_get(context, entry->capability,
+                    entry->property, entry->count, &capability_data);
+            if (rc != tool_rc_success) {
+                break;
+            }
+            capabilities = &capability_data->data;
+        }
+
+        bool result = dump_tpm_capability(entry->capability_string,
+                capabilities);
+        if (!result) {
+            rc = tool_rc_general_error;
+        }
+        free(capability_data);
+    }
+
+    free(properties);
+
+    return rc;
+}
+
 static bool on_option(char key, char *value) {
 
     UNUSED(value);
@@ -814,7 +861,7 @@ static bool tpm2_tool_onstart(tpm2_options **opts) {
     };
 
     *opts = tpm2_options_new("l", ARRAY_LEN(topts), topts, on_option, on_arg,
-            0);
+            TPM2_OPTIONS_JSON);
 
     return *opts != NULL;
 }
@@ -834,6 +881,10 @@ static tool_rc tpm2_tool_onrun(ESYS_CONTEXT *context, tpm2_option_flags flags) {
         return tool_rc_success;
     }
 
+    if (options.capability_string && !strcmp(options.capability_string, "all")) {
+        return dump_all(context);
+    }
+
     /* List a capability, ie <capability group> option */
     TPMS_CAPABILITY_DATA *capability_data = NULL;
 
@@ -847,7 +898,7 @@ static tool_rc tpm2_tool_onrun(ESYS_CONTEXT *context, tpm2_option_flags flags) {
         return rc;
     }
 
-    bool result = dump_tpm_capability(&capability_data->data);
+    bool result = dump_tpm_capability(NULL, &capability_data->data);
     free(capability_data);
     return result ? tool_rc_success : tool_rc_general_error;
 }
@@ -1,10 +1,13 @@
 /* SPDX-License-Identifier: BSD-3-Clause */
 
+#include <stdlib.h>
+
 #include "files.h"
 #include "log.h"
 #include "tpm2.h"
 #include "tpm2_tool.h"
 #include "tpm2_alg_util.h"
+#include "tpm2_capability.h"
 #include "tpm2_options.h"
 
 typedef struct tpm_geteccparameters_ctx tpm_geteccparameters_ctx;
@@ -99,13 +102,14 @@ static tool_rc tpm2_tool_onrun(ESYS_CONTEXT *ectx, tpm2_option_flags flags) {
 
     // ESAPI call
     TPMS_ALGORITHM_DETAIL_ECC *parameters;
-    rc = tpm2_geteccparameters(ectx, ctx.curve_id, &parameters);
+    rc = tpm2_capability_ecc_parameters(ectx, ctx.curve_id, &parameters);
     if (rc != tool_rc_success) {
         return rc;
     }
 
     // Process outputs
     bool result = files_save_ecc_details(parameters, ctx.ecc_parameters_path);
+    free(parameters);
     if (!result) {
         LOG_ERR("Failed to write out the ECC pub key");
         return tool_rc_general_error;
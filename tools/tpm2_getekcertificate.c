@@ -4,22 +4,36 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
 
 #include <curl/curl.h>
-#include <openssl/buffer.h>
+#include <openssl/err.h>
 #include <openssl/evp.h>
+#include <openssl/pem.h>
 #include <openssl/sha.h>
+#include <openssl/x509.h>
 
 #include "files.h"
 #include "log.h"
 #include "object.h"
 #include "tpm2.h"
 #include "tpm2_alg_util.h"
+#include "tpm2_arena.h"
 #include "tpm2_auth_util.h"
 #include "tpm2_capability.h"
+#include "tpm2_convert.h"
+#include "tpm2_hex.h"
 #include "tpm2_nv_util.h"
 #include "tpm2_tool.h"
 
+/* EK public and certificate of a manifest line */
+#define MANIFEST_FIELDS 2
+
+/* the transfers a manifest keeps running at once */
+#define MANIFEST_JOBS_DEFAULT 8
+
 typedef struct tpm_getekcertificate_ctx tpm_getekcertificate_ctx;
 struct tpm_getekcertificate_ctx {
     // TPM Device properties
@@ -44,8 +58,20 @@ struct tpm_getekcertificate_ctx {
     char *ek_server_addr;
     unsigned int SSL_NO_VERIFY;
     char *ek_path;
+    char *ek_path_2;
     bool verbose;
     TPM2B_PUBLIC *out_public;
+    TPM2B_PUBLIC *out_public_2;
+    // Retrieval of many EK certificates from the web
+    const char *manifest_path;
+    UINT32 jobs;
+    // The handle is kept so every request reuses its connection
+    bool is_curl_initialized;
+    CURL *curl;
+    // Certificates kept on disk by the URL they are retrieved from
+    const char *cache_dir;
+    UINT32 cache_ttl;
+    bool is_cache_only;
 };
 
 static tpm_getekcertificate_ctx ctx = {
@@ -53,9 +79,10 @@ static tpm_getekcertificate_ctx ctx = {
     .ek_server_addr = "https://ekop.intel.com/ekcertservice/",
     .is_cert_on_nv = true,
     .cert_count = 0,
+    .jobs = MANIFEST_JOBS_DEFAULT,
 };
 
-static unsigned char *hash_ek_public(void) {
+static unsigned char *hash_ek_public(TPM2B_PUBLIC *public) {
 
     unsigned char *hash = (unsigned char*) malloc(SHA256_DIGEST_LENGTH);
     if (!hash) {
@@ -70,17 +97,17 @@ static unsigned char *hash_ek_public(void) {
         goto err;
     }
 
-    switch (ctx.out_public->publicArea.type) {
+    switch (public->publicArea.type) {
     case TPM2_ALG_RSA:
         is_success = SHA256_Update(&sha256,
-                ctx.out_public->publicArea.unique.rsa.buffer,
-                ctx.out_public->publicArea.unique.rsa.size);
+                public->publicArea.unique.rsa.buffer,
+                public->publicArea.unique.rsa.size);
         if (!is_success) {
             LOG_ERR("SHA256_Update failed");
             goto err;
         }
 
-        if (ctx.out_public->publicArea.parameters.rsaDetail.exponent != 0) {
+        if (public->publicArea.parameters.rsaDetail.exponent != 0) {
             LOG_ERR("non-default exponents unsupported");
             goto err;
         }
@@ -94,16 +121,16 @@ static unsigned char *hash_ek_public(void) {
 
     case TPM2_ALG_ECC:
         is_success = SHA256_Update(&sha256,
-                ctx.out_public->publicArea.unique.ecc.x.buffer,
-                ctx.out_public->publicArea.unique.ecc.x.size);
+                public->publicArea.unique.ecc.x.buffer,
+                public->publicArea.unique.ecc.x.size);
         if (!is_success) {
             LOG_ERR("SHA256_Update failed");
             goto err;
         }
 
         is_success = SHA256_Update(&sha256,
-                ctx.out_public->publicArea.unique.ecc.y.buffer,
-                ctx.out_public->publicArea.unique.ecc.y.size);
+                public->publicArea.unique.ecc.y.buffer,
+                public->publicArea.unique.ecc.y.size);
         if (!is_success) {
             LOG_ERR("SHA256_Update failed");
             goto err;
@@ -121,13 +148,11 @@ static unsigned char *hash_ek_public(void) {
         goto err;
     }
 
-    if (ctx.verbose) {
+    /* a manifest prints its results and nothing else */
+    if (ctx.verbose && !ctx.manifest_path) {
         tpm2_tool_output("public-key-hash:\n");
         tpm2_tool_output("  sha256: ");
-        unsigned i;
-        for (i = 0; i < SHA256_DIGEST_LENGTH; i++) {
-            tpm2_tool_output("%02X", hash[i]);
-        }
+        tpm2_hex_print(hash, SHA256_DIGEST_LENGTH, true);
         tpm2_tool_output("\n");
     }
 
@@ -137,11 +162,44 @@ err:
     return NULL;
 }
 
+/*
+ * The URL safe base64 of a SHA256 digest, each of up to 2 '=' of padding
+ * growing to "%3D", and the NUL.
+ */
+#define EK_HASH_B64_SIZE (4 * ((SHA256_DIGEST_LENGTH + 2) / 3) + 2 * 2 + 1)
+
+typedef struct url_b64 url_b64;
+struct url_b64 {
+    char data[EK_HASH_B64_SIZE];
+    size_t len;
+};
+
+static bool url_b64_sink(const void *data, size_t len, void *userdata) {
+
+    url_b64 *out = (url_b64 *) userdata;
+    const char *b64 = (const char *) data;
+
+    size_t i;
+    for (i = 0; i < len; i++) {
+        bool is_pad = b64[i] == '=';
+        size_t needed = is_pad ? 3 : 1;
+        if (out->len + needed >= sizeof(out->data)) {
+            return false;
+        }
+
+        if (is_pad) {
+            memcpy(&out->data[out->len], "%3D", 3);
+        } else {
+            out->data[out->len] = b64[i];
+        }
+        out->len += needed;
+    }
+
+    return true;
+}
+
 static char *base64_encode(const unsigned char* buffer)
 {
-    BIO *bio, *b64;
-    BUF_MEM *buffer_pointer;
-
     LOG_INFO("Calculating the base64_encode of the hash of the Endorsement"
              "Public Key:");
 
@@ -150,102 +208,426 @@ static char *base64_encode(const unsigned char* buffer)
         return NULL;
     }
 
-    b64 = BIO_new(BIO_f_base64());
-    bio = BIO_new(BIO_s_mem());
-    bio = BIO_push(b64, bio);
-    BIO_set_flags(bio, BIO_FLAGS_BASE64_NO_NL);
-    BIO_write(bio, buffer, SHA256_DIGEST_LENGTH);
-    UNUSED(BIO_flush(bio));
-    BIO_get_mem_ptr(bio, &buffer_pointer);
+    /*
+     * The URL safe alphabet only leaves the padding to escape, which the
+     * sink does as the characters stream by.
+     */
+    url_b64 out = { .len = 0 };
+    tpm2_base64_stream stream;
+    tpm2_base64_stream_init(&stream, tpm2_base64_flags_url, url_b64_sink,
+            &out);
+
+    bool result = tpm2_base64_encode_update(&stream, buffer,
+            SHA256_DIGEST_LENGTH) && tpm2_base64_encode_final(&stream);
+    if (!result) {
+        LOG_ERR("Could not base64 encode the Endorsement Public Key hash");
+        return NULL;
+    }
 
-    /* these are not NULL terminated */
-    char *b64text = buffer_pointer->data;
-    size_t len = buffer_pointer->length;
+    out.data[out.len] = '\0';
 
-    size_t i;
-    for (i = 0; i < len; i++) {
-        if (b64text[i] == '+') {
-            b64text[i] = '-';
-        }
-        if (b64text[i] == '/') {
-            b64text[i] = '_';
-        }
+    return strdup(out.data);
+}
+
+static bool web_init(void) {
+
+    if (ctx.is_curl_initialized) {
+        return true;
     }
 
-    char *final_string = NULL;
+    CURLcode rc = curl_global_init(CURL_GLOBAL_DEFAULT);
+    if (rc != CURLE_OK) {
+        LOG_ERR("curl_global_init failed: %s", curl_easy_strerror(rc));
+        return false;
+    }
+
+    ctx.is_curl_initialized = true;
+
+    return true;
+}
+
+/*
+ * The easy handle shared by the requests of an invocation, libcurl keeps its
+ * connection open for the next one.
+ */
+static CURL *web_curl(void) {
 
-    CURL *curl = curl_easy_init();
+    if (ctx.curl || !web_init()) {
+        return ctx.curl;
+    }
+
+    ctx.curl = curl_easy_init();
+    if (!ctx.curl) {
+        LOG_ERR("curl_easy_init failed");
+    }
+
+    return ctx.curl;
+}
+
+typedef struct ek_transfer ek_transfer;
+struct ek_transfer {
+    char *weblink;
+    /* the response, kept NUL terminated */
+    unsigned char *data;
+    size_t size;
+};
+
+static size_t ek_transfer_write(char *contents, size_t size, size_t nitems,
+    void *userdata) {
+
+    ek_transfer *transfer = (ek_transfer *) userdata;
+    size_t len = size * nitems;
+
+    /* like the ones on NV, certificates are sized in 16 bits */
+    if (transfer->size + len >= UINT16_MAX) {
+        LOG_ERR("EK certificate exceeds %u bytes", UINT16_MAX - 1);
+        return 0;
+    }
+
+    unsigned char *data = realloc(transfer->data, transfer->size + len + 1);
+    if (!data) {
+        LOG_ERR("oom");
+        return 0;
+    }
+
+    memcpy(&data[transfer->size], contents, len);
+    transfer->size += len;
+    data[transfer->size] = '\0';
+    transfer->data = data;
+
+    return len;
+}
+
+static void ek_transfer_free(ek_transfer *transfer) {
+
+    free(transfer->weblink);
+    free(transfer->data);
+    memset(transfer, 0, sizeof(*transfer));
+}
+
+/*
+ * The id of an EK public key, the URL safe base64 of its hash, names its
+ * certificate on the manufacturer server.
+ */
+static char *ek_public_id(TPM2B_PUBLIC *public) {
+
+    unsigned char *hash = hash_ek_public(public);
+    if (!hash) {
+        return NULL;
+    }
+
+    char *b64h = base64_encode(hash);
+    free(hash);
+    if (!b64h) {
+        LOG_ERR("base64_encode returned null");
+        return NULL;
+    }
+
+    LOG_INFO("%s", b64h);
+
+    return b64h;
+}
+
+static char *base64_decode(const char *cert, size_t cert_length) {
+
+    char *final_string = NULL;
+    int outlen;
+    CURL *curl = web_curl();
     if (curl) {
-        char *output = curl_easy_escape(curl, b64text, len);
+        char *output = curl_easy_unescape(curl, cert, cert_length, &outlen);
         if (output) {
             final_string = strdup(output);
             curl_free(output);
         }
     }
-    curl_easy_cleanup(curl);
-    curl_global_cleanup();
-    BIO_free_all(bio);
 
-    /* format to a proper NULL terminated string */
+    if(final_string) {
+        size_t i;
+        for (i = 0; i < strlen(final_string); i++) {
+            final_string[i] = final_string[i] == '-' ? '+'  : final_string[i];
+            final_string[i] = final_string[i] == '_' ? '/'  : final_string[i];
+            final_string[i] = final_string[i] == '"' ? '\0' : final_string[i];
+            final_string[i] = final_string[i] == '}' ? '\0' : final_string[i];
+        }
+    }
+
     return final_string;
 }
 
-static size_t writecallback(char *contents, size_t size, size_t nitems,
-    void *CERT_BUFFER) {
+#define INTC_CERT_PREFIX "{\"pubhash"
+#define PEM_BEGIN_CERT_LINE "\n-----BEGIN CERTIFICATE-----\n"
+#define PEM_END_CERT_LINE "\n-----END CERTIFICATE-----\n"
+
+/*
+ *  Convert Intel EK certificates as received in the URL safe variant of
+ *  Base 64: https://tools.ietf.org/html/rfc4648#section-5 to PEM. The
+ *  response of the Intel service carries the EK public hash in addition to
+ *  the certificate data, anything else is left as is.
+ */
+static bool intc_cert_to_pem(unsigned char **cert_buffer,
+        uint16_t *cert_buffer_size) {
+
+    if (*cert_buffer_size < strlen(INTC_CERT_PREFIX) || memcmp(*cert_buffer,
+            INTC_CERT_PREFIX, strlen(INTC_CERT_PREFIX))) {
+        return true;
+    }
+
+    char *json = strndup((const char *) *cert_buffer, *cert_buffer_size);
+    if (!json) {
+        LOG_ERR("oom");
+        return false;
+    }
+
+    char *split = strstr(json, "certificate");
+    if (!split || strlen(split) < strlen("certficate\" : ")) {
+        LOG_ERR("No certificate in the response of the EK certificate service");
+        free(json);
+        return false;
+    }
+    split += strlen("certficate\" : ");
+
+    char *copy_buffer = base64_decode(split, strlen(split));
+    free(json);
+    if (!copy_buffer) {
+        LOG_ERR("Could not decode the EK certificate");
+        return false;
+    }
+
+    size_t len = strlen(PEM_BEGIN_CERT_LINE) + strlen(copy_buffer) +
+        strlen(PEM_END_CERT_LINE);
+    char *pem = malloc(len + 1);
+    if (!pem) {
+        LOG_ERR("oom");
+        free(copy_buffer);
+        return false;
+    }
+
+    snprintf(pem, len + 1, "%s%s%s", PEM_BEGIN_CERT_LINE, copy_buffer,
+        PEM_END_CERT_LINE);
+    free(copy_buffer);
 
-    strncpy(CERT_BUFFER, (const char *)contents, nitems * size);
-    ctx.rsa_cert_buffer_size = nitems * size;
+    free(*cert_buffer);
+    *cert_buffer = (unsigned char *) pem;
+    *cert_buffer_size = len;
 
-    return ctx.rsa_cert_buffer_size;
+    return true;
 }
 
-static bool retrieve_web_endorsement_certificate(char *b64h) {
+/* the URL of the certificate for the EK public key id on the server */
+static char *ek_cert_url(const char *b64h) {
 
     #define NULL_TERM_LEN 1                 // '\0'
     #define PATH_JOIN_CHAR_LEN 1            // '/'
     size_t len = strlen(ctx.ek_server_addr) + strlen(b64h) + NULL_TERM_LEN +
         PATH_JOIN_CHAR_LEN;
-    char *weblink = (char *) malloc(len);
-    if (!weblink) {
+    char *url = (char *) malloc(len);
+    if (!url) {
+        LOG_ERR("oom");
+        return NULL;
+    }
+
+    snprintf(url, len, "%s%s%s", ctx.ek_server_addr, "/", b64h);
+
+    return url;
+}
+
+/*
+ * Entries are named after the hex of the SHA256 hash of the URL of the
+ * certificate, so servers handing out certificates for the same EK each get
+ * their own.
+ */
+static char *cache_path(const char *b64h) {
+
+    char *url = ek_cert_url(b64h);
+    if (!url) {
+        return NULL;
+    }
+
+    unsigned char hash[SHA256_DIGEST_LENGTH];
+    SHA256((const unsigned char *) url, strlen(url), hash);
+    free(url);
+
+    char name[TPM2_HEX_SIZE(SHA256_DIGEST_LENGTH)];
+    tpm2_hex_encode(hash, sizeof(hash), name, false);
+
+    size_t len = strlen(ctx.cache_dir) + strlen(name) + 2;
+    char *path = malloc(len);
+    if (!path) {
+        LOG_ERR("oom");
+        return NULL;
+    }
+
+    snprintf(path, len, "%s/%s", ctx.cache_dir, name);
+
+    return path;
+}
+
+/*
+ * Whether the response of the server converts as for the output and parses
+ * as an X.509 certificate, PEM or DER.
+ */
+static bool ek_cert_is_valid(const unsigned char *cert_buffer,
+        size_t cert_buffer_size) {
+
+    uint16_t size = cert_buffer_size;
+    unsigned char *buffer = malloc(size);
+    if (!buffer) {
         LOG_ERR("oom");
         return false;
     }
+    memcpy(buffer, cert_buffer, size);
 
-    bool ret = true;
-    CURLcode rc = curl_global_init(CURL_GLOBAL_DEFAULT);
-    if (rc != CURLE_OK) {
-        LOG_ERR("curl_global_init failed: %s", curl_easy_strerror(rc));
-        ret = false;
-        goto out_memory;
+    bool result = intc_cert_to_pem(&buffer, &size);
+    if (!result) {
+        goto out;
     }
 
-    CURL *curl = curl_easy_init();
-    if (!curl) {
-        LOG_ERR("curl_easy_init failed");
-        ret = false;
-        goto out_global_cleanup;
+    X509 *cert = NULL;
+    BIO *bio = BIO_new_mem_buf(buffer, size);
+    if (bio) {
+        cert = PEM_read_bio_X509(bio, NULL, NULL, NULL);
+        BIO_free(bio);
+    }
+
+    if (!cert) {
+        /* not PEM, then DER */
+        ERR_clear_error();
+        const unsigned char *der = buffer;
+        cert = d2i_X509(NULL, &der, size);
+        ERR_clear_error();
+    }
+
+    result = cert != NULL;
+    X509_free(cert);
+
+out:
+    free(buffer);
+
+    return result;
+}
+
+/*
+ * Loads the certificate cached for the EK public key id, as received from the
+ * server. Missing, empty and expired entries are misses.
+ */
+static bool cache_load(const char *b64h, unsigned char **cert_buffer,
+        uint16_t *cert_buffer_size) {
+
+    if (!ctx.cache_dir) {
+        return false;
+    }
+
+    char *path = cache_path(b64h);
+    if (!path) {
+        return false;
+    }
+
+    bool is_hit = false;
+    struct stat st;
+    if (!files_stat(path, &st) || !st.st_size || st.st_size >= UINT16_MAX) {
+        goto out;
+    }
+
+    if (ctx.cache_ttl && time(NULL) - st.st_mtime > (time_t) ctx.cache_ttl) {
+        LOG_INFO("Cached EK certificate \"%s\" expired", path);
+        goto out;
+    }
+
+    UINT16 size = st.st_size;
+    unsigned char *buffer = malloc(size + 1);
+    if (!buffer) {
+        LOG_ERR("oom");
+        goto out;
+    }
+
+    if (!files_load_bytes_from_path(path, buffer, &size)) {
+        free(buffer);
+        goto out;
+    }
+
+    /* like the responses of the server, kept NUL terminated */
+    buffer[size] = '\0';
+    *cert_buffer = buffer;
+    *cert_buffer_size = size;
+    is_hit = true;
+
+    LOG_INFO("Using the cached EK certificate \"%s\"", path);
+
+out:
+    free(path);
+
+    return is_hit;
+}
+
+/*
+ * Caches the certificate as received from the server, once it is known to
+ * convert and parse, so an error page or a truncated response is retrieved
+ * again instead of served from the cache. The entry is written aside and
+ * renamed into place, so concurrent readers never see a partial one. Failing
+ * to cache is not fatal.
+ */
+static void cache_store(const char *b64h, unsigned char *cert_buffer,
+        size_t cert_buffer_size) {
+
+    if (!ctx.cache_dir) {
+        return;
+    }
+
+    if (!ek_cert_is_valid(cert_buffer, cert_buffer_size)) {
+        LOG_WARN("Not caching the EK certificate, it is not a valid "
+                "certificate");
+        return;
+    }
+
+    char *path = cache_path(b64h);
+    if (!path) {
+        return;
+    }
+
+    files_atomic atomic;
+    FILE *f = files_atomic_fopen(&atomic, path);
+    if (!f) {
+        LOG_WARN("Could not cache the EK certificate in \"%s\"",
+                ctx.cache_dir);
+        goto out;
+    }
+
+    bool result = files_write_bytes(f, cert_buffer, cert_buffer_size);
+    if (!files_atomic_close(&atomic, f, result)) {
+        LOG_WARN("Could not cache the EK certificate as \"%s\"", path);
+    }
+
+out:
+    free(path);
+}
+
+/* sets up the request of the EK certificate for the public key id */
+static bool ek_transfer_setup(CURL *curl, ek_transfer *transfer,
+        const char *b64h) {
+
+    transfer->weblink = ek_cert_url(b64h);
+    if (!transfer->weblink) {
+        return false;
     }
 
     /*
      * should not be used - Used only on platforms with older CA certificates.
      */
+    CURLcode rc;
     if (ctx.SSL_NO_VERIFY) {
         rc = curl_easy_setopt(curl, CURLOPT_SSL_VERIFYPEER, 0);
         if (rc != CURLE_OK) {
             LOG_ERR("curl_easy_setopt for CURLOPT_SSL_VERIFYPEER failed: %s",
                     curl_easy_strerror(rc));
-            ret = false;
-            goto out_easy_cleanup;
+            return false;
         }
     }
 
-    snprintf(weblink, len, "%s%s%s", ctx.ek_server_addr, "/", b64h);
-    rc = curl_easy_setopt(curl, CURLOPT_URL, weblink);
+    rc = curl_easy_setopt(curl, CURLOPT_URL, transfer->weblink);
     if (rc != CURLE_OK) {
         LOG_ERR("curl_easy_setopt for CURLOPT_URL failed: %s",
                 curl_easy_strerror(rc));
-        ret = false;
-        goto out_easy_cleanup;
+        return false;
     }
 
     /*
@@ -256,77 +638,76 @@ static bool retrieve_web_endorsement_certificate(char *b64h) {
     if (rc != CURLE_OK) {
         LOG_ERR("curl_easy_setopt for CURLOPT_VERBOSE failed: %s",
                 curl_easy_strerror(rc));
-        ret = false;
-        goto out_easy_cleanup;
+        return false;
     }
 
-    rc = curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, writecallback);
+    rc = curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, ek_transfer_write);
     if (rc != CURLE_OK) {
         LOG_ERR("curl_easy_setopt for CURLOPT_WRITEFUNCTION failed: %s",
                 curl_easy_strerror(rc));
-        ret = false;
-        goto out_easy_cleanup;
+        return false;
     }
-    /*
-     * As only one cert is downloaded at a time, we can simply use
-     * rsa_cert_buffer for either RSA EK cert or ECC EK cert.
-     */
-    ctx.rsa_cert_buffer = malloc(CURL_MAX_WRITE_SIZE);
-    rc = curl_easy_setopt(curl, CURLOPT_WRITEDATA, (void *)ctx.rsa_cert_buffer);
+
+    rc = curl_easy_setopt(curl, CURLOPT_WRITEDATA, (void *)transfer);
     if (rc != CURLE_OK) {
         LOG_ERR("curl_easy_setopt for CURLOPT_WRITEDATA failed: %s",
                 curl_easy_strerror(rc));
-        ret = false;
-        goto out_easy_cleanup;
+        return false;
     }
 
     rc = curl_easy_setopt(curl, CURLOPT_FAILONERROR, true);
     if (rc != CURLE_OK) {
         LOG_ERR("curl_easy_setopt for CURLOPT_FAILONERROR failed: %s",
                 curl_easy_strerror(rc));
-        goto out_easy_cleanup;
-    }
-
-    rc = curl_easy_perform(curl);
-    if (rc != CURLE_OK) {
-        LOG_ERR("curl_easy_perform() failed: %s", curl_easy_strerror(rc));
-        ret = false;
-        goto out_easy_cleanup;
+        return false;
     }
 
-out_easy_cleanup:
-    curl_easy_cleanup(curl);
-out_global_cleanup:
-    curl_global_cleanup();
-out_memory:
-    free(weblink);
-
-    return ret;
+    return true;
 }
 
-static bool get_web_ek_certificate(void) {
+static bool get_web_ek_certificate(TPM2B_PUBLIC *public,
+        unsigned char **cert_buffer, uint16_t *cert_buffer_size) {
 
-    if (ctx.SSL_NO_VERIFY) {
-        LOG_WARN("TLS communication with the said TPM manufacturer server setup"
-                 " with SSL_NO_VERIFY!");
+    char *b64h = ek_public_id(public);
+    if (!b64h) {
+        return false;
     }
 
+    ek_transfer transfer = { 0 };
     bool ret = true;
-    unsigned char *hash = hash_ek_public();
-    char *b64 = base64_encode(hash);
-    if (!b64) {
-        LOG_ERR("base64_encode returned null");
+    if (cache_load(b64h, cert_buffer, cert_buffer_size)) {
+        goto out;
+    }
+
+    if (ctx.is_cache_only) {
+        LOG_ERR("EK certificate not found in the cache");
         ret = false;
         goto out;
     }
 
-    LOG_INFO("%s", b64);
+    CURL *curl = web_curl();
+    ret = curl && ek_transfer_setup(curl, &transfer, b64h);
+    if (!ret) {
+        goto out;
+    }
 
-    ret = retrieve_web_endorsement_certificate(b64);
+    CURLcode rc = curl_easy_perform(curl);
+    if (rc != CURLE_OK) {
+        LOG_ERR("curl_easy_perform() failed: %s", curl_easy_strerror(rc));
+        ret = false;
+        goto out;
+    }
+
+    cache_store(b64h, transfer.data, transfer.size);
+
+    *cert_buffer = transfer.data;
+    *cert_buffer_size = transfer.size;
+    transfer.data = NULL;
 
-    free(b64);
 out:
-    free(hash);
+    ek_transfer_free(&transfer);
+    free(b64h);
+
     return ret;
 }
 
@@ -336,14 +717,17 @@ out:
 #define ECC_EK_CERT_NV_INDEX 0x01C0000A
 tool_rc get_tpm_properties(ESYS_CONTEXT *ectx) {
 
+    /* every result is owned by the arena, whichever way this returns */
+    tpm2_arena *arena = tpm2_arena_invocation();
+
     TPMI_YES_NO more_data;
-    TPMS_CAPABILITY_DATA *capability_data;
-    tool_rc rc = tool_rc_success;
-    rc = tpm2_getcap(ectx, TPM2_CAP_TPM_PROPERTIES, TPM2_PT_MANUFACTURER,
-            1, &more_data, &capability_data);
-    if (rc != tool_rc_success) {
+    TPMS_CAPABILITY_DATA *capability_data = NULL;
+    tool_rc rc = tpm2_capability_get(ectx, TPM2_CAP_TPM_PROPERTIES,
+            TPM2_PT_MANUFACTURER, 1, &capability_data);
+    bool is_adopted = tpm2_arena_adopt(arena, capability_data);
+    if (rc != tool_rc_success || !is_adopted) {
         LOG_ERR("TPM property read failure.");
-        goto get_tpm_properties_out;
+        return rc != tool_rc_success ? rc : tool_rc_general_error;
     }
 
     if (capability_data->data.tpmProperties.tpmProperty[0].value == IBM) {
@@ -354,12 +738,13 @@ tool_rc get_tpm_properties(ESYS_CONTEXT *ectx) {
         ctx.is_intc_cert = true;
     }
 
-    free(capability_data);
+    capability_data = NULL;
     rc = tpm2_getcap(ectx, TPM2_CAP_TPM_PROPERTIES, TPM2_PT_PERMANENT,
             1, &more_data, &capability_data);
-    if (rc != tool_rc_success) {
+    is_adopted = tpm2_arena_adopt(arena, capability_data);
+    if (rc != tool_rc_success || !is_adopted) {
         LOG_ERR("TPM property read failure.");
-        goto get_tpm_properties_out;
+        return rc != tool_rc_success ? rc : tool_rc_general_error;
     }
 
     if (capability_data->data.tpmProperties.tpmProperty[0].value &
@@ -367,19 +752,20 @@ tool_rc get_tpm_properties(ESYS_CONTEXT *ectx) {
             ctx.is_tpmgeneratedeps = true;
     }
 
-    free(capability_data);
+    capability_data = NULL;
     rc = tpm2_getcap(ectx, TPM2_CAP_HANDLES,
         tpm2_util_hton_32(TPM2_HT_NV_INDEX), TPM2_PT_NV_INDEX_MAX, NULL,
         &capability_data);
-    if (rc != tool_rc_success) {
+    is_adopted = tpm2_arena_adopt(arena, capability_data);
+    if (rc != tool_rc_success || !is_adopted) {
         LOG_ERR("Failed to read capability data for NV indices.");
         ctx.is_cert_on_nv = false;
-        goto get_tpm_properties_out;
+        return rc != tool_rc_success ? rc : tool_rc_general_error;
     }
 
     if (capability_data->data.handles.count == 0) {
         ctx.is_cert_on_nv = false;
-        goto get_tpm_properties_out;
+        return tool_rc_success;
     }
 
     UINT32 i;
@@ -398,9 +784,7 @@ tool_rc get_tpm_properties(ESYS_CONTEXT *ectx) {
         ctx.is_cert_on_nv = false;
     }
 
-get_tpm_properties_out:
-    free(capability_data);
-    return rc;
+    return tool_rc_success;
 }
 
 static tool_rc nv_read(ESYS_CONTEXT *ectx, TPMI_RH_NV_INDEX nv_index) {
@@ -525,17 +909,25 @@ static tool_rc get_ek_certificates(ESYS_CONTEXT *ectx) {
         return tool_rc_option_error;
     }
 
-    if (ctx.cert_count > 1) {
+    if (ctx.cert_count > (ctx.ek_path_2 ? 2 : 1)) {
         LOG_ERR("Specify one output path for EK cert file per EK public key");
         return tool_rc_option_error;
     }
 
-    bool retval = get_web_ek_certificate();
-    if (!retval) {
-        return tool_rc_general_error;
+    if (ctx.SSL_NO_VERIFY) {
+        LOG_WARN("TLS communication with the said TPM manufacturer server setup"
+                 " with SSL_NO_VERIFY!");
     }
 
-    return tool_rc_success;
+    /* both certificates are requested over the same connection */
+    bool retval = get_web_ek_certificate(ctx.out_public,
+            &ctx.rsa_cert_buffer, &ctx.rsa_cert_buffer_size);
+    if (retval && ctx.out_public_2) {
+        retval = get_web_ek_certificate(ctx.out_public_2,
+                &ctx.ecc_cert_buffer, &ctx.ecc_cert_buffer_size);
+    }
+
+    return retval ? tool_rc_success : tool_rc_general_error;
 }
 
 static tool_rc process_input(ESYS_CONTEXT *ectx) {
@@ -550,6 +942,19 @@ static tool_rc process_input(ESYS_CONTEXT *ectx) {
         }
     }
 
+    if (ctx.ek_path_2) {
+        ctx.out_public_2 = calloc(1, sizeof(*ctx.out_public_2));
+        if (!ctx.out_public_2) {
+            LOG_ERR("oom");
+            return tool_rc_general_error;
+        }
+        bool res = files_load_public(ctx.ek_path_2, ctx.out_public_2);
+        if (!res) {
+            LOG_ERR("Could not load EK public from file");
+            return tool_rc_general_error;
+        }
+    }
+
     tool_rc rc = tool_rc_success;
     if (ctx.is_tpm2_device_active) {
         rc = get_tpm_properties(ectx);
@@ -561,86 +966,20 @@ static tool_rc process_input(ESYS_CONTEXT *ectx) {
     return print_intel_ek_certificate_warning();
 }
 
-static char *base64_decode(char **split, unsigned int cert_length) {
+static tool_rc process_output(void) {
 
-    *split += strlen("certficate\" : ");
-    char *final_string = NULL;
-    int outlen;
-    CURL *curl = curl_easy_init();
-    if (curl) {
-        char *output = curl_easy_unescape(curl, *split, cert_length, &outlen);
-        if (output) {
-            final_string = strdup(output);
-            curl_free(output);
+    if (!ctx.is_cert_raw) {
+        if (ctx.rsa_cert_buffer && !intc_cert_to_pem(&ctx.rsa_cert_buffer,
+                &ctx.rsa_cert_buffer_size)) {
+            return tool_rc_general_error;
         }
-    }
-    curl_easy_cleanup(curl);
-    curl_global_cleanup();
 
-    if(final_string) {
-        size_t i;
-        for (i = 0; i < strlen(final_string); i++) {
-            final_string[i] = final_string[i] == '-' ? '+'  : final_string[i];
-            final_string[i] = final_string[i] == '_' ? '/'  : final_string[i];
-            final_string[i] = final_string[i] == '"' ? '\0' : final_string[i];
-            final_string[i] = final_string[i] == '}' ? '\0' : final_string[i];
+        if (ctx.ecc_cert_buffer && !intc_cert_to_pem(&ctx.ecc_cert_buffer,
+                &ctx.ecc_cert_buffer_size)) {
+            return tool_rc_general_error;
         }
     }
 
-    return final_string;
-}
-
-#define PEM_BEGIN_CERT_LINE "\n-----BEGIN CERTIFICATE-----\n"
-#define PEM_END_CERT_LINE "\n-----END CERTIFICATE-----\n"
-static tool_rc process_output(void) {
-
-    /*
-     * Check if the cert is from INTC based on certificated data containing
-     * the EK public hash in addition to the certificate data.
-     * If so set the flag.
-     */
-    if (ctx.rsa_cert_buffer) {
-        ctx.is_intc_cert = ctx.is_intc_cert ? ctx.is_intc_cert :
-        !(strncmp((const char *)ctx.rsa_cert_buffer,
-            "{\"pubhash", strlen("{\"pubhash")));
-    }
-
-    if (ctx.ecc_cert_buffer) {
-        ctx.is_intc_cert = ctx.is_intc_cert ? ctx.is_intc_cert :
-        !(strncmp((const char *)ctx.ecc_cert_buffer,
-            "{\"pubhash", strlen("{\"pubhash")));
-    }
-
-    /*
-     *  Convert Intel EK certificates as received in the URL safe variant of
-     *  Base 64: https://tools.ietf.org/html/rfc4648#section-5 to PEM
-     */
-    if (ctx.rsa_cert_buffer && ctx.is_intc_cert && !ctx.is_cert_raw) {
-        char *split = strstr((const char *)ctx.rsa_cert_buffer, "certificate");
-        char *copy_buffer = base64_decode(&split, ctx.rsa_cert_buffer_size);
-        ctx.rsa_cert_buffer_size = strlen(PEM_BEGIN_CERT_LINE) +
-            strlen(copy_buffer) + strlen(PEM_END_CERT_LINE);
-        strcpy((char *)ctx.rsa_cert_buffer, PEM_BEGIN_CERT_LINE);
-        strcpy((char *)ctx.rsa_cert_buffer + strlen(PEM_BEGIN_CERT_LINE),
-            copy_buffer);
-        strcpy((char *)ctx.rsa_cert_buffer + strlen(PEM_BEGIN_CERT_LINE) +
-            strlen(copy_buffer), PEM_END_CERT_LINE);
-        free(copy_buffer);
-    }
-
-    if (ctx.ecc_cert_buffer && ctx.is_intc_cert && !ctx.is_cert_raw) {
-        char *split = strstr((const char *)ctx.ecc_cert_buffer, "certificate");
-        char *copy_buffer = base64_decode(&split, ctx.ecc_cert_buffer_size);
-        ctx.ecc_cert_buffer_size = strlen(PEM_BEGIN_CERT_LINE) +
-            strlen(copy_buffer) + strlen(PEM_END_CERT_LINE);
-        strcpy((char *)ctx.ecc_cert_buffer, PEM_BEGIN_CERT_LINE);
-        strcpy((char *)ctx.ecc_cert_buffer + strlen(PEM_BEGIN_CERT_LINE),
-            copy_buffer);
-        strcpy((char *)ctx.ecc_cert_buffer + strlen(PEM_BEGIN_CERT_LINE) +
-            strlen(copy_buffer), PEM_END_CERT_LINE);
-        free(copy_buffer);
-    }
-
     bool retval = true;
     if (ctx.rsa_cert_buffer) {
         retval = files_write_bytes(
@@ -664,6 +1003,327 @@ static tool_rc process_output(void) {
     return tool_rc_success;
 }
 
+/*
+ * A line of a manifest, naming an EK public key and where its certificate
+ * goes. The paths point into the manifest line.
+ */
+typedef struct manifest_cert manifest_cert;
+struct manifest_cert {
+    char *line;
+    size_t line_number;
+    const char *ek_path;
+    const char *cert_path;
+    char *b64h;
+    bool is_retrieved;
+};
+
+typedef struct manifest manifest;
+struct manifest {
+    manifest_cert *certs;
+    size_t count;
+};
+
+/* an easy handle of the multi handle, reused for one transfer after another */
+typedef struct manifest_slot manifest_slot;
+struct manifest_slot {
+    CURL *curl;
+    manifest_cert *cert;
+    ek_transfer transfer;
+};
+
+static bool manifest_add(void *e, char *line, char **fields, size_t count,
+        size_t line_number, void *userdata) {
+
+    UNUSED(count);
+    UNUSED(userdata);
+
+    manifest_cert *cert = (manifest_cert *) e;
+    cert->line = line;
+    cert->line_number = line_number;
+    cert->ek_path = fields[0];
+    cert->cert_path = fields[1];
+
+    return true;
+}
+
+static bool manifest_load(manifest *m) {
+
+    return tpm2_util_manifest_read(ctx.manifest_path, MANIFEST_FIELDS,
+            MANIFEST_FIELDS, "<ek-public> <ek-certificate>",
+            (void **) &m->certs, &m->count, sizeof(*m->certs), manifest_add,
+            NULL);
+}
+
+static void manifest_free(manifest *m) {
+
+    size_t i;
+    for (i = 0; i < m->count; i++) {
+        free(m->certs[i].line);
+        free(m->certs[i].b64h);
+    }
+    free(m->certs);
+}
+
+/* converts the certificate as requested and saves it, taking the buffer */
+static bool manifest_cert_save(manifest_cert *cert, unsigned char *cert_buffer,
+        uint16_t cert_buffer_size) {
+
+    bool result = ctx.is_cert_raw || intc_cert_to_pem(&cert_buffer,
+            &cert_buffer_size);
+    if (result) {
+        result = files_save_bytes_to_file(cert->cert_path, cert_buffer,
+                cert_buffer_size);
+    }
+
+    free(cert_buffer);
+
+    return result;
+}
+
+/*
+ * Computes the id of the EK public key of the line, which is all a cached
+ * certificate needs. Returns true when the certificate is left to retrieve.
+ */
+static bool manifest_cert_prepare(manifest_cert *cert) {
+
+    TPM2B_PUBLIC public = { 0 };
+    bool result = files_load_public(cert->ek_path, &public);
+    if (!result) {
+        LOG_ERR("%s:%zu: Could not load EK public \"%s\"", ctx.manifest_path,
+                cert->line_number, cert->ek_path);
+        return false;
+    }
+
+    cert->b64h = ek_public_id(&public);
+    if (!cert->b64h) {
+        return false;
+    }
+
+    unsigned char *cert_buffer = NULL;
+    uint16_t cert_buffer_size = 0;
+    if (cache_load(cert->b64h, &cert_buffer, &cert_buffer_size)) {
+        cert->is_retrieved = manifest_cert_save(cert, cert_buffer,
+                cert_buffer_size);
+        return false;
+    }
+
+    if (ctx.is_cache_only) {
+        LOG_ERR("%s:%zu: EK certificate of \"%s\" not found in the cache",
+                ctx.manifest_path, cert->line_number, cert->ek_path);
+        return false;
+    }
+
+    return true;
+}
+
+/* starts the transfer of the certificate in the slot, which must be idle */
+static bool manifest_slot_start(CURLM *multi, manifest_slot *slot,
+        manifest_cert *cert) {
+
+    bool result = ek_transfer_setup(slot->curl, &slot->transfer, cert->b64h);
+    if (!result) {
+        ek_transfer_free(&slot->transfer);
+        return false;
+    }
+
+    curl_easy_setopt(slot->curl, CURLOPT_PRIVATE, (char *) slot);
+
+    CURLMcode rc = curl_multi_add_handle(multi, slot->curl);
+    if (rc != CURLM_OK) {
+        LOG_ERR("curl_multi_add_handle failed: %s", curl_multi_strerror(rc));
+        ek_transfer_free(&slot->transfer);
+        return false;
+    }
+
+    slot->cert = cert;
+
+    return true;
+}
+
+static void manifest_slot_done(CURLM *multi, manifest_slot *slot,
+        CURLcode result) {
+
+    manifest_cert *cert = slot->cert;
+
+    curl_multi_remove_handle(multi, slot->curl);
+
+    if (result != CURLE_OK) {
+        LOG_ERR("%s:%zu: Could not retrieve the EK certificate of \"%s\": %s",
+                ctx.manifest_path, cert->line_number, cert->ek_path,
+                curl_easy_strerror(result));
+        goto out;
+    }
+
+    cache_store(cert->b64h, slot->transfer.data, slot->transfer.size);
+
+    cert->is_retrieved = manifest_cert_save(cert, slot->transfer.data,
+            slot->transfer.size);
+    slot->transfer.data = NULL;
+
+out:
+    ek_transfer_free(&slot->transfer);
+    slot->cert = NULL;
+}
+
+/*
+ * The transfers of a manifest run concurrently on one multi handle. Its
+ * connection cache is shared by the easy handles, so requests to the
+ * manufacturer server reuse the open connections instead of a handshake each,
+ * and are multiplexed over one connection when the server speaks HTTP/2.
+ */
+static bool manifest_retrieve(manifest *m) {
+
+    CURLM *multi = curl_multi_init();
+    if (!multi) {
+        LOG_ERR("curl_multi_init failed");
+        return false;
+    }
+
+#ifdef CURLPIPE_MULTIPLEX
+    curl_multi_setopt(multi, CURLMOPT_PIPELINING, CURLPIPE_MULTIPLEX);
+#endif
+    curl_multi_setopt(multi, CURLMOPT_MAX_HOST_CONNECTIONS, (long) ctx.jobs);
+
+    size_t slot_count = ctx.jobs < m->count ? ctx.jobs : m->count;
+    manifest_slot *slots = calloc(slot_count, sizeof(*slots));
+    if (!slots) {
+        LOG_ERR("oom");
+        curl_multi_cleanup(multi);
+        return false;
+    }
+
+    bool result = true;
+    size_t i;
+    for (i = 0; i < slot_count; i++) {
+        slots[i].curl = curl_easy_init();
+        if (!slots[i].curl) {
+            LOG_ERR("curl_easy_init failed");
+            result = false;
+            goto out;
+        }
+    }
+
+    size_t next = 0;
+    size_t active = 0;
+    for (;;) {
+        /* keep every idle slot busy while certificates are left */
+        for (i = 0; i < slot_count && next < m->count; i++) {
+            /*
+             * Lines served from the cache take no slot, and lines failing to
+             * start are reported without their certificate.
+             */
+            while (!slots[i].cert && next < m->count) {
+                manifest_cert *cert = &m->certs[next++];
+                if (manifest_cert_prepare(cert) &&
+                        manifest_slot_start(multi, &slots[i], cert)) {
+                    active++;
+                }
+            }
+        }
+
+        if (!active) {
+            break;
+        }
+
+        int running = 0;
+        CURLMcode rc = curl_multi_perform(multi, &running);
+        if (rc != CURLM_OK) {
+            LOG_ERR("curl_multi_perform failed: %s", curl_multi_strerror(rc));
+            result = false;
+            goto out;
+        }
+
+        CURLMsg *msg;
+        int left;
+        while ((msg = curl_multi_info_read(multi, &left))) {
+            if (msg->msg != CURLMSG_DONE) {
+                continue;
+            }
+
+            manifest_slot *slot = NULL;
+            curl_easy_getinfo(msg->easy_handle, CURLINFO_PRIVATE,
+                    (char **) &slot);
+            /* the message is gone once its handle is removed */
+            CURLcode done_result = msg->data.result;
+            manifest_slot_done(multi, slot, done_result);
+            active--;
+        }
+
+        if (active) {
+            rc = curl_multi_wait(multi, NULL, 0, 1000, NULL);
+            if (rc != CURLM_OK) {
+                LOG_ERR("curl_multi_wait failed: %s", curl_multi_strerror(rc));
+                result = false;
+                goto out;
+            }
+        }
+    }
+
+out:
+    for (i = 0; i < slot_count; i++) {
+        if (slots[i].cert) {
+            curl_multi_remove_handle(multi, slots[i].curl);
+            ek_transfer_free(&slots[i].transfer);
+        }
+        if (slots[i].curl) {
+            curl_easy_cleanup(slots[i].curl);
+        }
+    }
+    free(slots);
+    curl_multi_cleanup(multi);
+
+    return result;
+}
+
+static tool_rc manifest_run(void) {
+
+    if (!ctx.ek_server_addr) {
+        LOG_ERR("Must specify a valid remote server url!");
+        return tool_rc_option_error;
+    }
+
+    if (ctx.ek_path || ctx.cert_count) {
+        LOG_ERR("The manifest names the EK public and certificate files, got "
+                "-u or -o");
+        return tool_rc_option_error;
+    }
+
+    if (ctx.SSL_NO_VERIFY) {
+        LOG_WARN("TLS communication with the said TPM manufacturer server setup"
+                 " with SSL_NO_VERIFY!");
+    }
+
+    manifest m = { 0 };
+    tool_rc rc = tool_rc_general_error;
+    if (!manifest_load(&m) || (!ctx.is_cache_only && !web_init())) {
+        goto out;
+    }
+
+    /* an empty manifest has nothing to retrieve */
+    if (m.count && !manifest_retrieve(&m)) {
+        goto out;
+    }
+
+    rc = tool_rc_success;
+    size_t i;
+    for (i = 0; i < m.count; i++) {
+        manifest_cert *cert = &m.certs[i];
+        tpm2_tool_output("- line: %zu\n", cert->line_number);
+        tpm2_tool_output("  ek-public: %s\n", cert->ek_path);
+        tpm2_tool_output("  retrieved: %s\n",
+                cert->is_retrieved ? "true" : "false");
+
+        if (!cert->is_retrieved) {
+            rc = tool_rc_general_error;
+        }
+    }
+
+out:
+    manifest_free(&m);
+
+    return rc;
+}
+
 static tool_rc check_input_options(void) {
 
     if (!ctx.ek_path && !ctx.is_cert_on_nv) {
@@ -677,7 +1337,7 @@ static tool_rc check_input_options(void) {
     }
 
     if (ctx.ec_cert_path_1) {
-        ctx.ec_cert_file_handle_1 = fopen(ctx.ec_cert_path_1, "wb");
+        ctx.ec_cert_file_handle_1 = files_fopen(ctx.ec_cert_path_1, "wb");
         if (!ctx.ec_cert_file_handle_1) {
             LOG_ERR("Could not open file for writing: \"%s\"",
                 ctx.ec_cert_path_1);
@@ -686,7 +1346,7 @@ static tool_rc check_input_options(void) {
     }
 
     if (ctx.ec_cert_path_2) {
-        ctx.ec_cert_file_handle_2 = fopen(ctx.ec_cert_path_2, "wb");
+        ctx.ec_cert_file_handle_2 = files_fopen(ctx.ec_cert_path_2, "wb");
         if (!ctx.ec_cert_file_handle_2) {
             LOG_ERR("Could not open file for writing: \"%s\"",
                 ctx.ec_cert_path_2);
@@ -731,7 +1391,14 @@ static bool on_option(char key, char *value) {
         ctx.SSL_NO_VERIFY = 1;
         break;
     case 'u':
-        ctx.ek_path = value;
+        if (!ctx.ek_path) {
+            ctx.ek_path = value;
+        } else if (!ctx.ek_path_2) {
+            ctx.ek_path_2 = value;
+        } else {
+            LOG_ERR("Specify only 2 EK public keys for RSA/ ECC certificates");
+            return false;
+        }
         break;
     case 'x':
         ctx.is_tpm2_device_active = false;
@@ -740,6 +1407,27 @@ static bool on_option(char key, char *value) {
     case 0:
         ctx.is_cert_raw = true;
         break;
+    case 1:
+        ctx.manifest_path = value;
+        break;
+    case 2:
+        if (!tpm2_util_string_to_uint32(value, &ctx.jobs) || !ctx.jobs) {
+            LOG_ERR("Invalid number of jobs, got: \"%s\"", value);
+            return false;
+        }
+        break;
+    case 3:
+        ctx.cache_dir = value;
+        break;
+    case 4:
+        if (!tpm2_util_string_to_uint32(value, &ctx.cache_ttl)) {
+            LOG_ERR("Invalid cache TTL in seconds, got: \"%s\"", value);
+            return false;
+        }
+        break;
+    case 5:
+        ctx.is_cache_only = true;
+        break;
     }
     return true;
 }
@@ -753,17 +1441,38 @@ static bool tpm2_tool_onstart(tpm2_options **opts) {
         { "ek-public",        required_argument, NULL, 'u' },
         { "offline",          no_argument,       NULL, 'x' },
         { "raw",              no_argument,       NULL,  0  },
+        { "manifest",         required_argument, NULL,  1  },
+        { "jobs",             required_argument, NULL,  2  },
+        { "cache",            required_argument, NULL,  3  },
+        { "cache-ttl",        required_argument, NULL,  4  },
+        { "cache-only",       no_argument,       NULL,  5  },
     };
 
     *opts = tpm2_options_new("o:u:Xx", ARRAY_LEN(topts), topts, on_option,
-            on_args, 0);
+            on_args, TPM2_OPTIONS_OPTIONAL_SAPI);
 
     return *opts != NULL;
 }
 
 static tool_rc tpm2_tool_onrun(ESYS_CONTEXT *ectx, tpm2_option_flags flags) {
 
-    UNUSED(ectx);
+    ctx.verbose = flags.verbose;
+
+    if ((ctx.cache_ttl || ctx.is_cache_only) && !ctx.cache_dir) {
+        LOG_ERR("Specify the cache directory with --cache");
+        return tool_rc_option_error;
+    }
+
+    /* the manifest only talks to the manufacturer server */
+    if (ctx.manifest_path) {
+        return manifest_run();
+    }
+
+    /* without a TPM the certificate can only come from the web */
+    if (!ectx) {
+        ctx.is_tpm2_device_active = false;
+        ctx.is_cert_on_nv = false;
+    }
 
     tool_rc rc = check_input_options();
     if (rc != tool_rc_success) {
@@ -775,8 +1484,6 @@ static tool_rc tpm2_tool_onrun(ESYS_CONTEXT *ectx, tpm2_option_flags flags) {
         return rc;
     }
 
-    ctx.verbose = flags.verbose;
-
     rc = get_ek_certificates(ectx);
     if (rc != tool_rc_success) {
         return rc;
@@ -805,6 +1512,14 @@ static tool_rc tpm2_tool_onstop(ESYS_CONTEXT *ectx) {
         free(ctx.ecc_cert_buffer);
     }
 
+    if (ctx.curl) {
+        curl_easy_cleanup(ctx.curl);
+    }
+
+    if (ctx.is_curl_initialized) {
+        curl_global_cleanup();
+    }
+
     return tool_rc_success;
 }
 
@@ -813,6 +1528,8 @@ static void tpm2_tool_onexit(void) {
     if (ctx.out_public) {
         free(ctx.out_public);
     }
+
+    free(ctx.out_public_2);
 }
 
 // Register this tool with tpm2_tool.c
@@ -68,7 +68,7 @@ static tool_rc process_outputs(void) {
     tool_rc rc = tool_rc_success;
     FILE *out = stdout;
     if (ctx.output_file) {
-        out = fopen(ctx.output_file, "wb+");
+        out = files_fopen(ctx.output_file, "wb+");
         if (!out) {
             LOG_ERR("Could not open output file \"%s\", error: %s",
                     ctx.output_file, strerror(errno));
@@ -1,18 +1,34 @@
 /* SPDX-License-Identifier: BSD-3-Clause */
 
 #include <errno.h>
+#include <fcntl.h>
 #include <inttypes.h>
+#include <poll.h>
+#include <signal.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+
+#ifdef __linux__
+#include <linux/random.h>
+#endif
 
 #include "files.h"
 #include "log.h"
 #include "tpm2.h"
+#include "tpm2_arena.h"
 #include "tpm2_capability.h"
 #include "tpm2_tool.h"
 #include "tpm2_alg_util.h"
+#include "tpm2_hex.h"
+#include "tpm2_pipeline.h"
+#include "tpm2_random.h"
 #include "tpm2_util.h"
 
 typedef struct tpm_random_ctx tpm_random_ctx;
@@ -26,6 +42,25 @@ struct tpm_random_ctx {
     bool force;
     bool hex;
 
+    /*
+     * Bulk mode, any number of bytes in pieces of at most max_random
+     */
+    bool is_bulk;
+    UINT32 bulk_size;
+    UINT32 max_random;
+
+    /*
+     * Feeder mode, refills the kernel pool or a FIFO until interrupted
+     */
+    const char *feed_path;
+    UINT32 feed_interval;
+    UINT32 feed_low_water;
+    bool is_feed_low_water;
+    int feed_fd;
+    bool is_feed_credit;
+    const char *stir_path;
+    int stir_fd;
+
     /*
      * Outputs
      */
@@ -56,8 +91,17 @@ static tpm_random_ctx ctx = {
     .aux_session_handle[1] = ESYS_TR_NONE,
     .aux_session_handle[2] = ESYS_TR_NONE,
     .parameter_hash_algorithm = TPM2_ALG_ERROR,
+    .feed_fd = -1,
+    .stir_fd = -1,
 };
 
+#define ENTROPY_AVAIL_PATH "/proc/sys/kernel/random/entropy_avail"
+#define FEED_INTERVAL_DEFAULT 10
+/* the most bytes of --stir mixed in ahead of a refill */
+#define FEED_STIR_MAX 4096
+
+static volatile sig_atomic_t is_feed_stopped;
+
 static tool_rc get_random(ESYS_CONTEXT *ectx) {
 
     /*
@@ -74,6 +118,394 @@ static tool_rc get_random(ESYS_CONTEXT *ectx) {
     return rc;
 }
 
+static FILE *open_output(void) {
+
+    if (!ctx.output_file) {
+        return stdout;
+    }
+
+    FILE *out = files_fopen(ctx.output_file, "wb+");
+    if (!out) {
+        LOG_ERR("Could not open output file \"%s\", error: %s",
+                ctx.output_file, strerror(errno));
+    }
+
+    return out;
+}
+
+static double elapsed_seconds(const struct timespec *start) {
+
+    struct timespec end;
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    return (end.tv_sec - start->tv_sec)
+            + (end.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+typedef bool (*random_sink)(const BYTE *data, size_t size, void *userdata);
+
+typedef struct random_pipeline random_pipeline;
+struct random_pipeline {
+    UINT32 size;
+    UINT32 requested;
+    UINT16 count;
+    UINT16 got;
+    TPM2B_DIGEST *random;
+    random_sink sink;
+    void *userdata;
+};
+
+static tool_rc random_prepare(void *userdata, bool *is_next) {
+
+    random_pipeline *pipeline = (random_pipeline *) userdata;
+
+    *is_next = pipeline->requested < pipeline->size;
+
+    return tool_rc_success;
+}
+
+static tool_rc random_submit(ESYS_CONTEXT *ectx, void *userdata) {
+
+    random_pipeline *pipeline = (random_pipeline *) userdata;
+
+    UINT32 left = pipeline->size - pipeline->requested;
+    pipeline->count = left < ctx.max_random ? left : ctx.max_random;
+
+    tool_rc rc = tpm2_getrandom_async(ectx, pipeline->count,
+            ctx.aux_session_handle[0], ctx.aux_session_handle[1],
+            ctx.aux_session_handle[2]);
+    if (rc == tool_rc_success) {
+        pipeline->requested += pipeline->count;
+    }
+
+    return rc;
+}
+
+static tool_rc random_finish(ESYS_CONTEXT *ectx, void *userdata) {
+
+    random_pipeline *pipeline = (random_pipeline *) userdata;
+
+    tool_rc rc = tpm2_getrandom_finish(ectx, &pipeline->random);
+    if (rc != tool_rc_success) {
+        return rc;
+    }
+
+    if (!pipeline->random->size) {
+        LOG_ERR("TPM returned no random bytes");
+        free(pipeline->random);
+        pipeline->random = NULL;
+        return tool_rc_general_error;
+    }
+
+    /* what the TPM came short of is requested again */
+    pipeline->got = pipeline->random->size < pipeline->count ?
+            pipeline->random->size : pipeline->count;
+    pipeline->requested -= pipeline->count - pipeline->got;
+
+    return tool_rc_success;
+}
+
+static tool_rc random_complete(void *userdata) {
+
+    random_pipeline *pipeline = (random_pipeline *) userdata;
+
+    bool result = pipeline->sink(pipeline->random->buffer, pipeline->got,
+            pipeline->userdata);
+    free(pipeline->random);
+    pipeline->random = NULL;
+
+    return result ? tool_rc_success : tool_rc_general_error;
+}
+
+static void random_discard(void *userdata) {
+
+    random_pipeline *pipeline = (random_pipeline *) userdata;
+
+    free(pipeline->random);
+    pipeline->random = NULL;
+}
+
+/*
+ * Pulls the bytes in pieces of the max digest size the TPM always has random
+ * data for. The sessions are used for every piece. The request for the next
+ * piece is sent before the last one goes to the sink, so the TPM produces
+ * random data while the output is written.
+ */
+static tool_rc get_random_pieces(ESYS_CONTEXT *ectx, UINT32 size,
+        random_sink sink, void *userdata) {
+
+    static const tpm2_pipeline_ops ops = {
+        .prepare = random_prepare,
+        .submit = random_submit,
+        .finish = random_finish,
+        .complete = random_complete,
+        .discard = random_discard,
+    };
+
+    random_pipeline pipeline = {
+        .size = size,
+        .sink = sink,
+        .userdata = userdata,
+    };
+
+    return tpm2_pipeline_run(ectx, &ops, &pipeline);
+}
+
+static bool bulk_sink(const BYTE *data, size_t size, void *userdata) {
+
+    FILE *out = (FILE *) userdata;
+
+    /* with -Q and no output file the bytes are pulled, but go nowhere */
+    if (!ctx.output_file && !output_enabled) {
+        return true;
+    }
+
+    bool result = ctx.hex ? tpm2_hex_fprint(out, data, size, false) :
+            files_write_bytes(out, (UINT8 *) data, size);
+    if (!result) {
+        LOG_ERR("Failed to write the random bytes");
+    }
+
+    return result;
+}
+
+static tool_rc get_random_bulk(ESYS_CONTEXT *ectx) {
+
+    FILE *out = open_output();
+    if (!out) {
+        return tool_rc_general_error;
+    }
+
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    tool_rc rc = get_random_pieces(ectx, ctx.bulk_size, bulk_sink, out);
+
+    double seconds = elapsed_seconds(&start);
+
+    if (out != stdout) {
+        fclose(out);
+    }
+
+    if (rc != tool_rc_success) {
+        return rc;
+    }
+
+    double rate = seconds > 0 ? ctx.bulk_size / seconds : 0;
+    if (ctx.output_file) {
+        tpm2_tool_output("bytes: %"PRIu32"\n", ctx.bulk_size);
+        tpm2_tool_output("seconds: %.3f\n", seconds);
+        tpm2_tool_output("bytes-per-second: %.0f\n", rate);
+    } else {
+        LOG_INFO("Got %"PRIu32" bytes in %.3f seconds, %.0f bytes per second",
+                ctx.bulk_size, seconds, rate);
+    }
+
+    return tool_rc_success;
+}
+
+static void on_feed_signal(int signum) {
+    UNUSED(signum);
+
+    is_feed_stopped = 1;
+}
+
+/* opening a FIFO blocks until there is a reader */
+static bool feed_open(void) {
+
+    do {
+        ctx.feed_fd = files_open(ctx.feed_path, O_WRONLY, 0);
+    } while (ctx.feed_fd < 0 && errno == EINTR && !is_feed_stopped);
+
+    if (ctx.feed_fd < 0) {
+        if (!is_feed_stopped) {
+            LOG_ERR("Could not open \"%s\", error: %s", ctx.feed_path,
+                    strerror(errno));
+        }
+        return false;
+    }
+
+    struct stat st;
+    ctx.is_feed_credit = !fstat(ctx.feed_fd, &st) && S_ISCHR(st.st_mode);
+
+    return true;
+}
+
+static void feed_close(void) {
+
+    if (ctx.feed_fd >= 0) {
+        close(ctx.feed_fd);
+        ctx.feed_fd = -1;
+    }
+}
+
+/*
+ * Bytes written to the random device are mixed into the kernel pool, but
+ * only credited as entropy when added with RNDADDENTROPY, which requires
+ * CAP_SYS_ADMIN.
+ */
+static bool feed_credit(const BYTE *data, size_t size) {
+
+#ifdef RNDADDENTROPY
+    struct rand_pool_info *info = malloc(sizeof(*info) + size);
+    if (!info) {
+        LOG_ERR("oom");
+        return false;
+    }
+
+    info->entropy_count = size * 8;
+    info->buf_size = size;
+    memcpy(info->buf, data, size);
+
+    int rc = ioctl(ctx.feed_fd, RNDADDENTROPY, info);
+    free(info);
+    if (!rc) {
+        return true;
+    }
+
+    LOG_WARN("Could not credit entropy to \"%s\", writing without credit,"
+            " error: %s", ctx.feed_path, strerror(errno));
+#else
+    UNUSED(data);
+    UNUSED(size);
+#endif
+    ctx.is_feed_credit = false;
+
+    return false;
+}
+
+static bool feed_sink(const BYTE *data, size_t size, void *userdata) {
+    UNUSED(userdata);
+
+    if (ctx.is_feed_credit && feed_credit(data, size)) {
+        return true;
+    }
+
+    while (size) {
+        ssize_t written = write(ctx.feed_fd, data, size);
+        if (written < 0 && errno == EINTR && !is_feed_stopped) {
+            continue;
+        }
+
+        /* the reader of the FIFO went away, wait for the next one */
+        if (written < 0 && errno == EPIPE) {
+            LOG_INFO("Reader of \"%s\" is gone, reopening", ctx.feed_path);
+            feed_close();
+            if (!feed_open()) {
+                return is_feed_stopped;
+            }
+            continue;
+        }
+
+        if (written < 0) {
+            if (is_feed_stopped) {
+                return true;
+            }
+            LOG_ERR("Could not write \"%s\", error: %s", ctx.feed_path,
+                    strerror(errno));
+            return false;
+        }
+
+        data += written;
+        size -= written;
+    }
+
+    return true;
+}
+
+static bool is_entropy_low(void) {
+
+    if (!ctx.is_feed_low_water) {
+        return true;
+    }
+
+    FILE *f = fopen(ENTROPY_AVAIL_PATH, "r");
+    if (!f) {
+        LOG_WARN("Could not open \""ENTROPY_AVAIL_PATH"\", refilling,"
+                " error: %s", strerror(errno));
+        return true;
+    }
+
+    unsigned long bits = 0;
+    bool result = fscanf(f, "%lu", &bits) == 1;
+    fclose(f);
+
+    return !result || bits < ctx.feed_low_water;
+}
+
+/*
+ * Refills every interval, or only when the kernel pool holds less than the
+ * low water mark of entropy, with one ESAPI context and the same sessions,
+ * until SIGINT or SIGTERM.
+ */
+static tool_rc feed_random(ESYS_CONTEXT *ectx) {
+
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = on_feed_signal;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+    signal(SIGPIPE, SIG_IGN);
+
+    if (ctx.stir_path) {
+        /* what is there each round, a FIFO without a writer is no error */
+        ctx.stir_fd = files_open(ctx.stir_path, O_RDONLY | O_NONBLOCK, 0);
+        if (ctx.stir_fd < 0) {
+            LOG_ERR("Could not open \"%s\", error: %s", ctx.stir_path,
+                    strerror(errno));
+            return tool_rc_general_error;
+        }
+    }
+
+    if (!feed_open()) {
+        if (ctx.stir_fd >= 0) {
+            close(ctx.stir_fd);
+        }
+        return is_feed_stopped ? tool_rc_success : tool_rc_general_error;
+    }
+
+    UINT32 size = ctx.num_of_bytes ? ctx.num_of_bytes : ctx.max_random;
+    UINT32 interval = ctx.feed_interval ?
+            ctx.feed_interval : FEED_INTERVAL_DEFAULT;
+    int timeout = interval > INT32_MAX / 1000 ?
+            INT32_MAX : (int) interval * 1000;
+    tool_rc rc = tool_rc_success;
+    while (!is_feed_stopped) {
+
+        if (is_entropy_low()) {
+            if (ctx.stir_fd >= 0) {
+                UINT64 stirred = 0;
+                rc = tpm2_random_stir_fd(ectx, ctx.stir_fd, FEED_STIR_MAX,
+                        &stirred);
+                if (rc != tool_rc_success) {
+                    break;
+                }
+                if (stirred) {
+                    LOG_INFO("Stirred %"PRIu64" bytes of \"%s\"", stirred,
+                            ctx.stir_path);
+                }
+            }
+            rc = get_random_pieces(ectx, size, feed_sink, NULL);
+            if (rc != tool_rc_success || ctx.feed_fd < 0) {
+                break;
+            }
+            LOG_INFO("Fed %"PRIu32" bytes to \"%s\"", size, ctx.feed_path);
+        }
+
+        /* a signal cuts the sleep short */
+        poll(NULL, 0, timeout);
+    }
+
+    feed_close();
+    if (ctx.stir_fd >= 0) {
+        close(ctx.stir_fd);
+        ctx.stir_fd = -1;
+    }
+
+    return is_feed_stopped ? tool_rc_success : rc;
+}
+
 static tool_rc process_outputs(void) {
 
     /*
@@ -114,7 +546,7 @@ static tool_rc process_outputs(void) {
      */
     FILE *out = stdout;
     if (ctx.output_file) {
-        out = fopen(ctx.output_file, "wb+");
+        out = files_fopen(ctx.output_file, "wb+");
         if (!out) {
             LOG_ERR("Could not open output file \"%s\", error: %s",
                     ctx.output_file, strerror(errno));
@@ -161,23 +593,21 @@ static tool_rc get_max_random(ESYS_CONTEXT *ectx, UINT32 *value) {
 
     TPMS_CAPABILITY_DATA *cap_data = NULL;
     tool_rc rc = tpm2_capability_get(ectx, TPM2_CAP_TPM_PROPERTIES,
-            TPM2_PT_FIXED, TPM2_MAX_TPM_PROPERTIES, &cap_data);
-    if (rc != tool_rc_success) {
-        return rc;
+            TPM2_PT_MAX_DIGEST, 1, &cap_data);
+    bool is_adopted = tpm2_arena_adopt(tpm2_arena_invocation(), cap_data);
+    if (rc != tool_rc_success || !is_adopted) {
+        return rc != tool_rc_success ? rc : tool_rc_general_error;
     }
 
-    UINT32 i;
-    for (i = 0; i < cap_data->data.tpmProperties.count; i++) {
-        TPMS_TAGGED_PROPERTY *p = &cap_data->data.tpmProperties.tpmProperty[i];
-        if (p->property == TPM2_PT_MAX_DIGEST) {
-            *value = p->value;
-            free(cap_data);
-            return tool_rc_success;
-        }
+    /* the TPM answers with the next property if it does not have this one */
+    TPMS_TAGGED_PROPERTY *p = &cap_data->data.tpmProperties.tpmProperty[0];
+    if (cap_data->data.tpmProperties.count &&
+            p->property == TPM2_PT_MAX_DIGEST) {
+        *value = p->value;
+        return tool_rc_success;
     }
 
     LOG_ERR("TPM does not have property TPM2_PT_MAX_DIGEST");
-    free(cap_data);
 
     return tool_rc_general_error;
 }
@@ -219,6 +649,18 @@ static tool_rc process_inputs(ESYS_CONTEXT *ectx) {
      *
      *  Allow the force flag to override this behavior.
      */
+    if (ctx.is_bulk || ctx.feed_path) {
+        rc = get_max_random(ectx, &ctx.max_random);
+        if (rc == tool_rc_success && !ctx.max_random) {
+            LOG_ERR("TPM reports a max digest size of 0");
+            rc = tool_rc_general_error;
+        }
+        /* a piece is requested with a UINT16 count */
+        ctx.max_random = ctx.max_random > UINT16_MAX ?
+                UINT16_MAX : ctx.max_random;
+        return rc;
+    }
+
     if (!ctx.force) {
         UINT32 max = 0;
         rc = get_max_random(ectx, &max);
@@ -229,8 +671,8 @@ static tool_rc process_inputs(ESYS_CONTEXT *ectx) {
         if (ctx.num_of_bytes > max) {
             LOG_ERR("TPM getrandom is bounded by max hash size, which is: "
                     "%"PRIu32"\n"
-                    "Please lower your request (preferred) and try again or"
-                    " use --force (advanced)", max);
+                    "Please lower your request (preferred) and try again,"
+                    " use --bulk or use --force (advanced)", max);
             return tool_rc_general_error;
         }
     }
@@ -288,6 +730,29 @@ static bool on_option(char key, char *value) {
     case 2:
         ctx.rp_hash_path = value;
         break;
+    case 3:
+        ctx.is_bulk = true;
+        break;
+    case 4:
+        ctx.feed_path = value;
+        break;
+    case 5:
+        if (!tpm2_util_string_to_uint32(value, &ctx.feed_interval)
+                || !ctx.feed_interval) {
+            LOG_ERR("Invalid interval in seconds, got: \"%s\"", value);
+            return false;
+        }
+        break;
+    case 6:
+        if (!tpm2_util_string_to_uint32(value, &ctx.feed_low_water)) {
+            LOG_ERR("Invalid low water mark in bits, got: \"%s\"", value);
+            return false;
+        }
+        ctx.is_feed_low_water = true;
+        break;
+    case 7:
+        ctx.stir_path = value;
+        break;
     case 'S':
         ctx.aux_session_path[ctx.aux_session_cnt] = value;
         if (ctx.aux_session_cnt < MAX_AUX_SESSIONS) {
@@ -310,6 +775,18 @@ static bool on_args(int argc, char **argv) {
         return false;
     }
 
+    /* the options are handled before the arguments */
+    if (ctx.is_bulk) {
+        bool result = tpm2_util_string_to_uint32(argv[0], &ctx.bulk_size);
+        if (!result) {
+            LOG_ERR("Error converting size to a number, got: \"%s\".",
+                    argv[0]);
+            return false;
+        }
+
+        return true;
+    }
+
     bool result = tpm2_util_string_to_uint16(argv[0], &ctx.num_of_bytes);
     if (!result) {
         LOG_ERR("Error converting size to a number, got: \"%s\".", argv[0]);
@@ -319,6 +796,29 @@ static bool on_args(int argc, char **argv) {
     return true;
 }
 
+static bool check_options(void) {
+
+    if ((ctx.is_bulk || ctx.feed_path)
+            && (ctx.cp_hash_path || ctx.rp_hash_path)) {
+        LOG_ERR("Cannot calculate cpHash or rpHash for the many commands of"
+                " --bulk or --feed");
+        return false;
+    }
+
+    if (ctx.feed_path && (ctx.is_bulk || ctx.output_file || ctx.hex)) {
+        LOG_ERR("Cannot combine --feed with --bulk, --output or --hex");
+        return false;
+    }
+
+    if (!ctx.feed_path && (ctx.feed_interval || ctx.is_feed_low_water
+            || ctx.stir_path)) {
+        LOG_ERR("--interval, --low-water and --stir require --feed");
+        return false;
+    }
+
+    return true;
+}
+
 static bool tpm2_tool_onstart(tpm2_options **opts) {
 
     const struct option topts[] = {
@@ -327,7 +827,12 @@ static bool tpm2_tool_onstart(tpm2_options **opts) {
         { "hex",          no_argument,       NULL,  0  },
         { "session",      required_argument, NULL, 'S' },
         { "cphash",       required_argument, NULL,  1  },
-        { "rphash",       required_argument, NULL,  2  }
+        { "rphash",       required_argument, NULL,  2  },
+        { "bulk",         no_argument,       NULL,  3  },
+        { "feed",         required_argument, NULL,  4  },
+        { "interval",     required_argument, NULL,  5  },
+        { "low-water",    required_argument, NULL,  6  },
+        { "stir",         required_argument, NULL,  7  },
     };
 
     *opts = tpm2_options_new("S:o:f", ARRAY_LEN(topts), topts, on_option, on_args,
@@ -343,6 +848,10 @@ static tool_rc tpm2_tool_onrun(ESYS_CONTEXT *ectx, tpm2_option_flags flags) {
     /*
      * 1. Process options
      */
+    bool result = check_options();
+    if (!result) {
+        return tool_rc_option_error;
+    }
 
     /*
      * 2. Process inputs
@@ -352,6 +861,14 @@ static tool_rc tpm2_tool_onrun(ESYS_CONTEXT *ectx, tpm2_option_flags flags) {
         return rc;
     }
 
+    if (ctx.is_bulk) {
+        return get_random_bulk(ectx);
+    }
+
+    if (ctx.feed_path) {
+        return feed_random(ectx);
+    }
+
     /*
      * 3. TPM2_CC_<command> call
      */
@@ -1,10 +1,15 @@
 /* SPDX-License-Identifier: BSD-3-Clause */
 
+#include <errno.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
+#include <openssl/err.h>
+#include <openssl/evp.h>
+#include <tss2/tss2_mu.h>
+
 #include "files.h"
 #include "log.h"
 #include "tpm2.h"
@@ -13,6 +18,8 @@
 #include "tpm2_openssl.h"
 #include "tpm2_tool.h"
 
+#define MAX_AUDIT_SESSIONS 64
+
 typedef struct tpm_getsessionauditdigest_ctx tpm_getsessionauditdigest_ctx;
 struct tpm_getsessionauditdigest_ctx {
     struct {
@@ -37,8 +44,13 @@ struct tpm_getsessionauditdigest_ctx {
     TPMT_SIG_SCHEME in_scheme;
 
     tpm2_session *audit_session;
-    const char *audit_session_path;
+    const char *audit_session_path[MAX_AUDIT_SESSIONS];
+    UINT8 audit_session_cnt;
     ESYS_TR audit_session_handle;
+
+    /* the digests of all the sessions, in one file */
+    const char *bundle_path;
+    const char *verify_key_path;
 };
 
 static tpm_getsessionauditdigest_ctx ctx = {
@@ -94,7 +106,17 @@ static bool on_option(char key, char *value) {
         }
         break;
     case 'S':
-        ctx.audit_session_path = value;
+        if (ctx.audit_session_cnt >= MAX_AUDIT_SESSIONS) {
+            LOG_ERR("Specify a max of %u sessions", MAX_AUDIT_SESSIONS);
+            return false;
+        }
+        ctx.audit_session_path[ctx.audit_session_cnt++] = value;
+        break;
+    case 0:
+        ctx.bundle_path = value;
+        break;
+    case 1:
+        ctx.verify_key_path = value;
         break;
     }
 
@@ -112,7 +134,9 @@ static bool tpm2_tool_onstart(tpm2_options **opts) {
         { "message",        required_argument, NULL, 'm' },
         { "format",         required_argument, NULL, 'f' },
         { "hash-algorithm", required_argument, NULL, 'g' },
-        { "session",        required_argument, NULL, 'S' }
+        { "session",        required_argument, NULL, 'S' },
+        { "bundle",         required_argument, NULL,  0  },
+        { "verify",         required_argument, NULL,  1  },
     };
 
     *opts = tpm2_options_new("S:P:c:p:q:s:m:f:g:", ARRAY_LEN(topts), topts,
@@ -128,6 +152,30 @@ static bool check_input_options_and_args(void) {
         return false;
     }
 
+    if (!ctx.audit_session_cnt) {
+        LOG_ERR("Specify the session to be used to start audit.");
+        return false;
+    }
+
+    if (ctx.bundle_path) {
+        if (ctx.signature_path || ctx.message_path) {
+            LOG_ERR("The bundle holds the attestations and signatures, "
+                    "cannot specify -s or -m");
+            return false;
+        }
+        return true;
+    }
+
+    if (ctx.verify_key_path) {
+        LOG_ERR("Specify --bundle to verify the audit digests");
+        return false;
+    }
+
+    if (ctx.audit_session_cnt > 1) {
+        LOG_ERR("Specify --bundle to get the digests of several sessions");
+        return false;
+    }
+
     if (!ctx.signature_path) {
         LOG_ERR("Specify the file path to store the signature of the attestation data.");
         return false;
@@ -138,28 +186,15 @@ static bool check_input_options_and_args(void) {
         return false;
     }
 
-    if (!ctx.audit_session_path) {
-        LOG_ERR("Specify the session to be used to start audit.");
-        return false;
-    }
-
     return true;
 }
 
 static tool_rc process_inputs(ESYS_CONTEXT *ectx) {
 
-    tool_rc rc = tpm2_session_restore(ectx, ctx.audit_session_path,
-        false, &ctx.audit_session);
-    if (rc != tool_rc_success) {
-        LOG_ERR("Could not restore audit session");
-        return rc;
-    }
-    ctx.audit_session_handle = tpm2_session_get_handle(ctx.audit_session);
-
     /*
      * Load auths
      */
-    rc = tpm2_util_object_load_auth(ectx,
+    tool_rc rc = tpm2_util_object_load_auth(ectx,
         ctx.endorsement_hierarchy.ctx_path, ctx.endorsement_hierarchy.auth_str,
         &ctx.endorsement_hierarchy.object, false, TPM2_HANDLE_FLAGS_E);
     if (rc != tool_rc_success) {
@@ -214,6 +249,209 @@ static tool_rc process_outputs(ESYS_CONTEXT *ectx) {
     return tool_rc_success;
 }
 
+/*
+ * Checks an attestation of the bundle on the host: the signature of the
+ * signing key over it, that it is a session audit of the TPM with the
+ * qualification given, and that its clock follows the one of the previous
+ * attestation in the same TPM boot, so the bundle was collected in order.
+ */
+static bool bundle_verify(EVP_PKEY *pkey, TPM2B_ATTEST *audit_info,
+        TPMT_SIGNATURE *signature, TPMS_CLOCK_INFO *clock_info) {
+
+    TPMS_ATTEST attest;
+    tool_rc rc = files_tpm2b_attest_to_tpms_attest(audit_info, &attest);
+    if (rc != tool_rc_success) {
+        return false;
+    }
+
+    if (attest.magic != TPM2_GENERATED_VALUE
+            || attest.type != TPM2_ST_ATTEST_SESSION_AUDIT) {
+        LOG_ERR("The attestation is not a session audit of a TPM");
+        return false;
+    }
+
+    if (attest.extraData.size != ctx.qualification_data.size
+            || memcmp(attest.extraData.buffer, ctx.qualification_data.buffer,
+                    attest.extraData.size)) {
+        LOG_ERR("The qualification of the attestation does not match");
+        return false;
+    }
+
+    if (clock_info->clock && (attest.clockInfo.resetCount
+            != clock_info->resetCount || attest.clockInfo.restartCount
+            != clock_info->restartCount
+            || attest.clockInfo.clock < clock_info->clock)) {
+        LOG_ERR("The attestation does not follow the previous one");
+        return false;
+    }
+    *clock_info = attest.clockInfo;
+
+    TPM2B_DIGEST digest = TPM2B_TYPE_INIT(TPM2B_DIGEST, buffer);
+    bool result = tpm2_openssl_hash_compute_data(ctx.sig_hash_algorithm,
+            audit_info->attestationData, audit_info->size, &digest);
+    if (!result) {
+        return false;
+    }
+
+    UINT16 size = 0;
+    UINT8 *sig = tpm2_convert_sig(&size, signature);
+    if (!sig) {
+        return false;
+    }
+
+    result = false;
+    EVP_PKEY_CTX *pkey_ctx = EVP_PKEY_CTX_new(pkey, NULL);
+    if (!pkey_ctx || EVP_PKEY_verify_init(pkey_ctx) != 1
+            || EVP_PKEY_CTX_set_signature_md(pkey_ctx,
+                tpm2_openssl_halg_from_tpmhalg(ctx.sig_hash_algorithm)) != 1) {
+        LOG_ERR("Could not set up the verification: %s",
+                ERR_error_string(ERR_get_error(), NULL));
+        goto out;
+    }
+
+    result = EVP_PKEY_verify(pkey_ctx, sig, size, digest.buffer,
+            digest.size) == 1;
+    if (!result) {
+        LOG_ERR("The signature does not verify with the public key given");
+    }
+
+out:
+    EVP_PKEY_CTX_free(pkey_ctx);
+    free(sig);
+
+    return result;
+}
+
+static void bundle_write_hex(FILE *f, const char *key, const BYTE *data,
+        size_t len) {
+
+    fprintf(f, "  %s: ", key);
+    tpm2_util_hexdump2(f, data, len);
+    fprintf(f, "\n");
+}
+
+/*
+ * Restores the audit session and sends the request of its digest. A session
+ * is restored only while its digest is taken, so the sessions of a bundle do
+ * not need to fit the session slots of the TPM at once.
+ */
+static bool bundle_send(ESYS_CONTEXT *ectx, const char *path,
+        tpm2_session **session) {
+
+    tool_rc rc = tpm2_session_restore(ectx, path, false, session);
+    if (rc != tool_rc_success) {
+        LOG_ERR("Could not restore audit session \"%s\"", path);
+        return false;
+    }
+
+    return tpm2_getsessionauditdigest_async(ectx,
+            &ctx.endorsement_hierarchy.object, &ctx.key.object,
+            &ctx.in_scheme, &ctx.qualification_data,
+            tpm2_session_get_handle(*session)) == tool_rc_success;
+}
+
+/*
+ * Gets the digests of all the sessions with the signing key loaded and
+ * authorized once. The digest of the next session is requested before the
+ * previous one is written, and each is verified, if asked, as it comes.
+ */
+static tool_rc bundle_run(ESYS_CONTEXT *ectx) {
+
+    tpm2_session *sessions[] = {
+        ctx.key.object.session, ctx.endorsement_hierarchy.object.session
+    };
+    size_t i;
+    for (i = 0; i < ARRAY_LEN(sessions); i++) {
+        if (sessions[i] && tpm2_session_get_type(sessions[i])
+                == TPM2_SE_POLICY) {
+            LOG_ERR("A bundle cannot satisfy a policy session for every "
+                    "digest");
+            return tool_rc_option_error;
+        }
+    }
+
+    EVP_PKEY *pkey = NULL;
+    if (ctx.verify_key_path && !tpm2_public_load_pkey(ctx.verify_key_path,
+            &pkey)) {
+        return tool_rc_general_error;
+    }
+
+    FILE *f = files_fopen(ctx.bundle_path, "w");
+    if (!f) {
+        LOG_ERR("Could not open bundle \"%s\", error: %s", ctx.bundle_path,
+                strerror(errno));
+        EVP_PKEY_free(pkey);
+        return tool_rc_general_error;
+    }
+
+    tool_rc rc = tool_rc_success;
+    TPMS_CLOCK_INFO clock_info = { 0 };
+    tpm2_session *cur = NULL;
+    tpm2_session *next = NULL;
+    bool is_sent = bundle_send(ectx, ctx.audit_session_path[0], &cur);
+    for (i = 0; i < ctx.audit_session_cnt; i++) {
+        TPM2B_ATTEST *audit_info = NULL;
+        TPMT_SIGNATURE *signature = NULL;
+        bool result = is_sent && tpm2_getsessionauditdigest_finish(ectx,
+                &audit_info, &signature) == tool_rc_success;
+        tpm2_session_close(&cur);
+
+        is_sent = false;
+        if (i + 1 < ctx.audit_session_cnt) {
+            is_sent = bundle_send(ectx, ctx.audit_session_path[i + 1], &next);
+        }
+
+        fprintf(f, "- session: %s\n", ctx.audit_session_path[i]);
+        if (result) {
+            TPMS_ATTEST attest;
+            result = files_tpm2b_attest_to_tpms_attest(audit_info, &attest)
+                    == tool_rc_success;
+            if (result) {
+                TPM2B_DIGEST *digest =
+                        &attest.attested.sessionAudit.sessionDigest;
+                bundle_write_hex(f, "audit-digest", digest->buffer,
+                        digest->size);
+            }
+        }
+        if (result) {
+            bundle_write_hex(f, "attestation", audit_info->attestationData,
+                    audit_info->size);
+
+            UINT8 buffer[sizeof(*signature)];
+            size_t offset = 0;
+            result = Tss2_MU_TPMT_SIGNATURE_Marshal(signature, buffer,
+                    sizeof(buffer), &offset) == TSS2_RC_SUCCESS;
+            if (result) {
+                bundle_write_hex(f, "signature", buffer, offset);
+            }
+        }
+        if (result && pkey) {
+            result = bundle_verify(pkey, audit_info, signature, &clock_info);
+            fprintf(f, "  verified: %s\n", result ? "true" : "false");
+        }
+        free(audit_info);
+        free(signature);
+
+        if (!result) {
+            LOG_ERR("No audit digest of session \"%s\"",
+                    ctx.audit_session_path[i]);
+            rc = tool_rc_general_error;
+        }
+
+        cur = next;
+        next = NULL;
+    }
+
+    if (fclose(f)) {
+        LOG_ERR("Could not write bundle \"%s\", error: %s", ctx.bundle_path,
+                strerror(errno));
+        rc = tool_rc_general_error;
+    }
+    EVP_PKEY_free(pkey);
+
+    return rc;
+}
+
 static tool_rc tpm2_tool_onrun(ESYS_CONTEXT *ectx, tpm2_option_flags flags) {
 
     UNUSED(flags);
@@ -230,6 +468,18 @@ static tool_rc tpm2_tool_onrun(ESYS_CONTEXT *ectx, tpm2_option_flags flags) {
         return rc;
     }
 
+    if (ctx.bundle_path) {
+        return bundle_run(ectx);
+    }
+
+    rc = tpm2_session_restore(ectx, ctx.audit_session_path[0], false,
+        &ctx.audit_session);
+    if (rc != tool_rc_success) {
+        LOG_ERR("Could not restore audit session");
+        return rc;
+    }
+    ctx.audit_session_handle = tpm2_session_get_handle(ctx.audit_session);
+
     //ESAPI call
     rc = tpm2_getsessionauditdigest(ectx, &ctx.endorsement_hierarchy.object,
     &ctx.key.object, &ctx.in_scheme, &ctx.qualification_data, &ctx.audit_info,
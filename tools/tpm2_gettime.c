@@ -1,6 +1,9 @@
 /* SPDX-License-Identifier: BSD-3-Clause */
 
+#include <inttypes.h>
+#include <limits.h>
 #include <stdbool.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
@@ -11,9 +14,11 @@
 #include "tpm2.h"
 #include "tpm2_tool.h"
 #include "tpm2_alg_util.h"
+#include "tpm2_clock_monitor.h"
 #include "tpm2_convert.h"
 #include "tpm2_hash.h"
 #include "tpm2_options.h"
+#include "tpm2_writer.h"
 
 typedef struct tpm_gettime_ctx tpm_gettime_ctx;
 struct tpm_gettime_ctx {
@@ -40,12 +45,22 @@ struct tpm_gettime_ctx {
     const char *output_path;
 
     char *cp_hash_path;
+
+    struct {
+        /* seconds between the samples of the clock, 0 to attest once */
+        UINT32 interval;
+        UINT32 polls;
+        UINT64 max_drift;
+        /* polls between the attestations without an anomaly, 0 for none */
+        UINT32 attest_polls;
+    } watch;
 };
 
 static tpm_gettime_ctx ctx = {
         .halg = TPM2_ALG_NULL,
         .sig_scheme = TPM2_ALG_NULL,
-        .privacy_admin = { .ctx_path = "endorsement" }
+        .privacy_admin = { .ctx_path = "endorsement" },
+        .watch = { .max_drift = 1000 },
 };
 
 static tool_rc init(ESYS_CONTEXT *ectx) {
@@ -60,6 +75,16 @@ static tool_rc init(ESYS_CONTEXT *ectx) {
         return tool_rc_option_error;
     }
 
+    if (ctx.watch.interval && ctx.cp_hash_path) {
+        LOG_ERR("Cannot specify --watch with --cphash");
+        return tool_rc_option_error;
+    }
+
+    if ((ctx.watch.polls || ctx.watch.attest_polls) && !ctx.watch.interval) {
+        LOG_ERR("--polls and --attest-polls require --watch");
+        return tool_rc_option_error;
+    }
+
     /* load the signing key */
     tool_rc rc = tpm2_util_object_load_auth(ectx, ctx.signing_key.ctx_path,
             ctx.signing_key.auth_str, &ctx.signing_key.object, false,
@@ -141,6 +166,34 @@ static bool on_option(char key, char *value) {
     case 0:
         ctx.cp_hash_path = value;
         break;
+    case 3:
+        if (!tpm2_util_string_to_uint32(value, &ctx.watch.interval) ||
+            !ctx.watch.interval) {
+            LOG_ERR("Invalid watch interval, expected a number of seconds, "
+                    "got: \"%s\"", value);
+            return false;
+        }
+        break;
+    case 4:
+        if (!tpm2_util_string_to_uint32(value, &ctx.watch.polls)) {
+            LOG_ERR("Invalid number of polls, got: \"%s\"", value);
+            return false;
+        }
+        break;
+    case 5:
+        if (!tpm2_util_string_to_uint64(value, &ctx.watch.max_drift)) {
+            LOG_ERR("Invalid maximum drift, expected a number of ms, got: "
+                    "\"%s\"", value);
+            return false;
+        }
+        break;
+    case 6:
+        if (!tpm2_util_string_to_uint32(value, &ctx.watch.attest_polls)) {
+            LOG_ERR("Invalid number of polls between attestations, got: "
+                    "\"%s\"", value);
+            return false;
+        }
+        break;
         /* no default */
     }
 
@@ -160,6 +213,10 @@ static bool tpm2_tool_onstart(tpm2_options **opts) {
       { "qualification",        required_argument, NULL, 'q' },
       { "attestation",          required_argument, NULL,  2  },
       { "cphash",               required_argument, NULL,  0  },
+      { "watch",                required_argument, NULL,  3  },
+      { "polls",                required_argument, NULL,  4  },
+      { "max-drift",            required_argument, NULL,  5  },
+      { "attest-polls",         required_argument, NULL,  6  },
     };
 
     *opts = tpm2_options_new("p:g:o:c:f:s:P:q:", ARRAY_LEN(topts), topts,
@@ -168,6 +225,138 @@ static bool tpm2_tool_onstart(tpm2_options **opts) {
     return *opts != NULL;
 }
 
+/* signs the time, saving the signature and the attestation when asked to */
+static tool_rc attest_time(ESYS_CONTEXT *ectx, const char *signature_path,
+        const char *attestation_path, TPMS_ATTEST *attest) {
+
+    TPM2B_ATTEST *time_info = NULL;
+    TPMT_SIGNATURE *signature = NULL;
+    tool_rc rc = tpm2_gettime(ectx,
+            &ctx.privacy_admin.object,
+            &ctx.signing_key.object,
+            &ctx.qualifying_data,
+            &ctx.in_scheme,
+            &time_info,
+            &signature,
+            NULL);
+    if (rc != tool_rc_success) {
+        return rc;
+    }
+
+    /* save the signature */
+    if (signature_path) {
+        bool result = tpm2_convert_sig_save(signature, ctx.sig_format,
+                signature_path);
+        if (!result) {
+            rc = tool_rc_general_error;
+            goto out;
+        }
+    }
+
+    if (attestation_path) {
+        /* save the attestation data */
+        bool result = files_save_bytes_to_file(attestation_path,
+            time_info->attestationData, time_info->size);
+        if (!result) {
+            rc = tool_rc_general_error;
+            goto out;
+        }
+    }
+
+    rc = files_tpm2b_attest_to_tpms_attest(time_info, attest);
+
+out:
+    Esys_Free(time_info);
+    Esys_Free(signature);
+    return rc;
+}
+
+/* the output path of the attestation of a poll, "<path>.<poll>" */
+static bool watch_path(const char *path, UINT32 poll, char *buffer,
+        size_t size) {
+
+    if (!path) {
+        return true;
+    }
+
+    int len = snprintf(buffer, size, "%s.%"PRIu32, path, poll);
+    if (len < 0 || (size_t) len >= size) {
+        LOG_ERR("Output path \"%s\" is too long", path);
+        return false;
+    }
+
+    return true;
+}
+
+/*
+ * Samples the clock with ReadClock every interval like tpm2_readclock
+ * --watch, and signs the time with GetTime only for the first sample, the
+ * samples with an anomaly and every --attest-polls polls. Every sample
+ * output or attested is a document of its own, written out at once.
+ */
+static tool_rc watch_clock(ESYS_CONTEXT *ectx) {
+
+    tpm2_clock_monitor m;
+    tpm2_clock_monitor_init(&m, ctx.watch.max_drift);
+
+    UINT32 last_attested = 0;
+    UINT32 poll;
+    for (poll = 0; !ctx.watch.polls || poll <= ctx.watch.polls; poll++) {
+        if (poll) {
+            tpm2_clock_monitor_sleep(ctx.watch.interval);
+        }
+
+        TPMS_TIME_INFO info;
+        UINT32 anomalies = 0;
+        tool_rc rc = tpm2_clock_monitor_read(ectx, &m, &info, &anomalies);
+        if (rc != tool_rc_success) {
+            return rc;
+        }
+
+        bool is_attested = !poll || anomalies || (ctx.watch.attest_polls
+                && poll - last_attested >= ctx.watch.attest_polls);
+        if (!is_attested) {
+            continue;
+        }
+
+        char signature_path[PATH_MAX];
+        char attestation_path[PATH_MAX];
+        bool result = watch_path(ctx.output_path, poll, signature_path,
+                sizeof(signature_path))
+                && watch_path(ctx.certify_info_path, poll, attestation_path,
+                        sizeof(attestation_path));
+        if (!result) {
+            return tool_rc_general_error;
+        }
+
+        TPMS_ATTEST attest;
+        rc = attest_time(ectx, ctx.output_path ? signature_path : NULL,
+                ctx.certify_info_path ? attestation_path : NULL, &attest);
+        if (rc != tool_rc_success) {
+            return rc;
+        }
+        last_attested = poll;
+
+        tpm2_writer_document_start();
+        tpm2_clock_monitor_print(&m, poll, anomalies);
+        tpm2_writer_map_start("attested");
+        tpm2_writer_number("time", "%"PRIu64, attest.attested.time.time.time);
+        tpm2_writer_number("clock", "%"PRIu64,
+                attest.attested.time.time.clockInfo.clock);
+        if (ctx.output_path) {
+            tpm2_writer_quoted("signature", "%s", signature_path);
+        }
+        if (ctx.certify_info_path) {
+            tpm2_writer_quoted("attestation", "%s", attestation_path);
+        }
+        tpm2_writer_end();
+        tpm2_writer_document_end();
+        fflush(stdout);
+    }
+
+    return tool_rc_success;
+}
+
 static tool_rc tpm2_tool_onrun(ESYS_CONTEXT *ectx, tpm2_option_flags flags) {
 
     UNUSED(flags);
@@ -197,46 +386,16 @@ static tool_rc tpm2_tool_onrun(ESYS_CONTEXT *ectx, tpm2_option_flags flags) {
         return rc;
     }
 
-    rc = tpm2_gettime(ectx,
-            &ctx.privacy_admin.object,
-            &ctx.signing_key.object,
-            &ctx.qualifying_data,
-            &ctx.in_scheme,
-            &time_info,
-            &signature,
-            NULL);
-    if (rc != tool_rc_success) {
-        return rc;
-    }
-
-    /* save the signature */
-    if (ctx.output_path) {
-        bool result = tpm2_convert_sig_save(signature, ctx.sig_format, ctx.output_path);
-        if (!result) {
-            rc = tool_rc_general_error;
-            goto out;
-        }
-    }
-
-    if (ctx.certify_info_path) {
-        /* save the attestation data */
-        bool result = files_save_bytes_to_file(ctx.certify_info_path,
-            time_info->attestationData, time_info->size);
-        if (!result) {
-            rc = tool_rc_general_error;
-            goto out;
-        }
+    if (ctx.watch.interval) {
+        return watch_clock(ectx);
     }
 
     TPMS_ATTEST attest;
-    rc = files_tpm2b_attest_to_tpms_attest(time_info, &attest);
+    rc = attest_time(ectx, ctx.output_path, ctx.certify_info_path, &attest);
     if (rc == tool_rc_success) {
         tpm2_util_print_time(&attest.attested.time.time);
     }
 
-out:
-    Esys_Free(time_info);
-    Esys_Free(signature);
     return rc;
 }
 
@@ -21,6 +21,10 @@ struct tpm_hash_ctx {
     char *output_hash_path;
     char *output_ticket_path;
     bool hex;
+    /* many files, digests written as "<hex digest>  <path>" lines */
+    char **paths;
+    int path_count;
+    char *list_path;
 };
 
 static tpm_hash_ctx ctx = {
@@ -31,12 +35,14 @@ static tpm_hash_ctx ctx = {
 static tool_rc hash_and_save(ESYS_CONTEXT *context) {
 
     TPM2B_DIGEST *out_hash;
-    TPMT_TK_HASHCHECK *validation;
+    TPMT_TK_HASHCHECK *validation = NULL;
 
     FILE *out = stdout;
 
+    /* without a ticket to save the digest is computed on the host */
     tool_rc rc = tpm2_hash_file(context, ctx.halg, ctx.hierarchy_value,
-            ctx.input_file, &out_hash, &validation);
+            ctx.input_file, &out_hash,
+            ctx.output_ticket_path ? &validation : NULL);
     if (rc != tool_rc_success) {
         return rc;
     }
@@ -51,7 +57,7 @@ static tool_rc hash_and_save(ESYS_CONTEXT *context) {
 
     rc = tool_rc_general_error;
     if (ctx.output_hash_path) {
-        out = fopen(ctx.output_hash_path, "wb+");
+        out = files_fopen(ctx.output_hash_path, "wb+");
         if (!out) {
             LOG_ERR("Could not open output file \"%s\", error: %s",
                     ctx.output_hash_path, strerror(errno));
@@ -85,14 +91,68 @@ out:
     return rc;
 }
 
+static tool_rc hash_one_of_files(ESYS_CONTEXT *context, FILE *input,
+        TPM2B_DIGEST **result, void *userdata) {
+
+    UNUSED(userdata);
+
+    return tpm2_hash_file(context, ctx.halg, ctx.hierarchy_value, input,
+            result, NULL);
+}
+
+static tool_rc hash_files_and_save(ESYS_CONTEXT *context) {
+
+    if (ctx.output_ticket_path) {
+        LOG_ERR("Cannot save a ticket when hashing many files");
+        return tool_rc_option_error;
+    }
+
+    FILE *list = NULL;
+    if (ctx.list_path) {
+        list = strcmp(ctx.list_path, "-") ? files_fopen(ctx.list_path, "rb") : stdin;
+        if (!list) {
+            LOG_ERR("Could not open the list of files \"%s\", error: %s",
+                    ctx.list_path, strerror(errno));
+            return tool_rc_general_error;
+        }
+    }
+
+    /* with -Q and no output file the digests go nowhere */
+    FILE *out = output_enabled ? stdout : NULL;
+    if (ctx.output_hash_path) {
+        out = files_fopen(ctx.output_hash_path, "wb+");
+        if (!out) {
+            LOG_ERR("Could not open output file \"%s\", error: %s",
+                    ctx.output_hash_path, strerror(errno));
+            if (list && list != stdin) {
+                fclose(list);
+            }
+            return tool_rc_general_error;
+        }
+    }
+
+    tool_rc rc = tpm2_hash_files(context, list ? NULL : ctx.paths,
+            ctx.path_count, list, out, hash_one_of_files, NULL);
+
+    if (out && out != stdout) {
+        fclose(out);
+    }
+    if (list && list != stdin) {
+        fclose(list);
+    }
+
+    return rc;
+}
+
 static bool on_args(int argc, char **argv) {
 
     if (argc > 1) {
-        LOG_ERR("Only supports one hash input file, got: %d", argc);
-        return false;
+        ctx.paths = argv;
+        ctx.path_count = argc;
+        return true;
     }
 
-    ctx.input_file = fopen(argv[0], "rb");
+    ctx.input_file = files_fopen(argv[0], "rb");
     if (!ctx.input_file) {
         LOG_ERR("Could not open input file \"%s\", error: %s", argv[0],
                 strerror(errno));
@@ -128,6 +188,9 @@ static bool on_option(char key, char *value) {
     case 0:
         ctx.hex = true;
         break;
+    case 1:
+        ctx.list_path = value;
+        break;
     }
 
     return true;
@@ -141,6 +204,7 @@ static bool tpm2_tool_onstart(tpm2_options **opts) {
         {"output",         required_argument, NULL, 'o'},
         {"ticket",         required_argument, NULL, 't'},
         {"hex",            no_argument,       NULL,  0 },
+        {"files0-from",    required_argument, NULL,  1 },
     };
 
     /* set up non-static defaults here */
@@ -156,6 +220,14 @@ static tool_rc tpm2_tool_onrun(ESYS_CONTEXT *context, tpm2_option_flags flags) {
 
     UNUSED(flags);
 
+    if (ctx.paths || ctx.list_path) {
+        if (ctx.paths && ctx.list_path) {
+            LOG_ERR("Specify either files or --files0-from, not both");
+            return tool_rc_option_error;
+        }
+        return hash_files_and_save(context);
+    }
+
     return hash_and_save(context);
 }
 
@@ -11,6 +11,9 @@
 #include "log.h"
 #include "tpm2.h"
 #include "tpm2_alg_util.h"
+#include "tpm2_auth_util.h"
+#include "tpm2_capability.h"
+#include "tpm2_hash.h"
 #include "tpm2_tool.h"
 
 typedef struct tpm_hmac_ctx tpm_hmac_ctx;
@@ -27,30 +30,34 @@ struct tpm_hmac_ctx {
     TPMI_ALG_HASH halg;
     bool hex;
     char *cp_hash_path;
+    /* many files, HMACs written as "<hex hmac>  <path>" lines */
+    char **paths;
+    int path_count;
+    char *list_path;
 };
 
 static tpm_hmac_ctx ctx;
 
-static tool_rc tpm_hmac_file(ESYS_CONTEXT *ectx, TPM2B_DIGEST **result,
-        TPMT_TK_HASHCHECK **validation) {
+static tool_rc tpm_hmac_file(ESYS_CONTEXT *ectx, FILE *input,
+        TPM2B_DIGEST **result, TPMT_TK_HASHCHECK **validation) {
 
     unsigned long file_size = 0;
-    FILE *input = ctx.input;
 
     tool_rc rc;
     /* Suppress error reporting with NULL path */
     bool res = files_get_file_size(input, &file_size, NULL);
 
     /*
-     * If we can get the file size and its less than 1024, just do it in one hash invocation.
+     * If we can get the file size and it fits in a chunk, just do it in one hash invocation.
      * We can't use the one-shot command if we require ticket, as it doesn't provide it in
      * the response from the TPM.
      */
-    if (!ctx.ticket_path && res && file_size <= TPM2_MAX_DIGEST_BUFFER) {
+    if (!ctx.ticket_path && res
+            && file_size <= tpm2_capability_max_buffer_size(ectx)) {
 
         TPM2B_MAX_BUFFER buffer = { .size = file_size };
 
-        res = files_read_bytes(ctx.input, buffer.buffer, buffer.size);
+        res = files_read_bytes(input, buffer.buffer, buffer.size);
         if (!res) {
             LOG_ERR("Error reading input file!");
             return tool_rc_general_error;
@@ -96,53 +103,18 @@ static tool_rc tpm_hmac_file(ESYS_CONTEXT *ectx, TPM2B_DIGEST **result,
         return rc;
     }
 
-    /* If we know the file size, we decrement the amount read and terminate the
-     * loop when 1 block is left, else we go till feof.
-     */
-    size_t left = file_size;
-    bool use_left = !!res;
+    ESYS_TR shandle = ESYS_TR_NONE;
+    rc = tpm2_auth_util_get_shandle(ectx, ctx.hmac_key.object.tr_handle,
+            ctx.hmac_key.object.session, &shandle);
+    if (rc != tool_rc_success) {
+        LOG_ERR("Failed to get hmac key shandle");
+        return rc;
+    }
 
     TPM2B_MAX_BUFFER data;
-
-    bool done = false;
-    while (!done) {
-
-        size_t bytes_read = fread(data.buffer, 1,
-                BUFFER_SIZE(typeof(data), buffer), input);
-        if (ferror(input)) {
-            LOG_ERR("Error reading from input file");
-            return tool_rc_general_error;
-        }
-
-        data.size = bytes_read;
-
-        /* if data was read, update the sequence */
-        rc = tpm2_hmac_sequenceupdate(ectx, sequence_handle,
-                &ctx.hmac_key.object, &data);
-        if (rc != tool_rc_success) {
-            return rc;
-        }
-
-        if (use_left) {
-            left -= bytes_read;
-            if (left <= TPM2_MAX_DIGEST_BUFFER) {
-                done = true;
-                continue;
-            }
-        } else if (feof(input)) {
-            done = true;
-        }
-    } /* end file read/hash update loop */
-
-    if (use_left) {
-        data.size = left;
-        bool res = files_read_bytes(input, data.buffer, left);
-        if (!res) {
-            LOG_ERR("Error reading from input file.");
-            return tool_rc_general_error;
-        }
-    } else {
-        data.size = 0;
+    rc = tpm2_hash_sequence_feed(ectx, sequence_handle, shandle, input, &data);
+    if (rc != tool_rc_success) {
+        return rc;
     }
 
     rc = tpm2_hmac_sequencecomplete(ectx, sequence_handle, &ctx.hmac_key.object,
@@ -161,7 +133,7 @@ static tool_rc do_hmac_and_output(ESYS_CONTEXT *ectx) {
 
     FILE *out = stdout;
 
-    tool_rc rc = tpm_hmac_file(ectx, &hmac_out, &validation);
+    tool_rc rc = tpm_hmac_file(ectx, ctx.input, &hmac_out, &validation);
     if (rc != tool_rc_success || ctx.cp_hash_path) {
         goto out;
     }
@@ -178,7 +150,7 @@ static tool_rc do_hmac_and_output(ESYS_CONTEXT *ectx) {
 
     rc = tool_rc_general_error;
     if (ctx.hmac_output_file_path) {
-        out = fopen(ctx.hmac_output_file_path, "wb+");
+        out = files_fopen(ctx.hmac_output_file_path, "wb+");
         if (!out) {
             LOG_ERR("Could not open output file \"%s\", error: %s",
                     ctx.hmac_output_file_path, strerror(errno));
@@ -211,6 +183,60 @@ out:
     return rc;
 }
 
+static tool_rc hmac_one_of_files(ESYS_CONTEXT *ectx, FILE *input,
+        TPM2B_DIGEST **result, void *userdata) {
+
+    UNUSED(userdata);
+
+    /* the key stays loaded and its session is used for every file */
+    return tpm_hmac_file(ectx, input, result, NULL);
+}
+
+static tool_rc do_hmac_files_and_output(ESYS_CONTEXT *ectx) {
+
+    if (ctx.ticket_path || ctx.cp_hash_path) {
+        LOG_ERR("Cannot save a ticket or cpHash when computing the HMAC of "
+                "many files");
+        return tool_rc_option_error;
+    }
+
+    FILE *list = NULL;
+    if (ctx.list_path) {
+        list = strcmp(ctx.list_path, "-") ? files_fopen(ctx.list_path, "rb") : stdin;
+        if (!list) {
+            LOG_ERR("Could not open the list of files \"%s\", error: %s",
+                    ctx.list_path, strerror(errno));
+            return tool_rc_general_error;
+        }
+    }
+
+    /* with -Q and no output file the digests go nowhere */
+    FILE *out = output_enabled ? stdout : NULL;
+    if (ctx.hmac_output_file_path) {
+        out = files_fopen(ctx.hmac_output_file_path, "wb+");
+        if (!out) {
+            LOG_ERR("Could not open output file \"%s\", error: %s",
+                    ctx.hmac_output_file_path, strerror(errno));
+            if (list && list != stdin) {
+                fclose(list);
+            }
+            return tool_rc_general_error;
+        }
+    }
+
+    tool_rc rc = tpm2_hash_files(ectx, list ? NULL : ctx.paths,
+            ctx.path_count, list, out, hmac_one_of_files, NULL);
+
+    if (out && out != stdout) {
+        fclose(out);
+    }
+    if (list && list != stdin) {
+        fclose(list);
+    }
+
+    return rc;
+}
+
 static bool on_option(char key, char *value) {
 
     switch (key) {
@@ -238,6 +264,9 @@ static bool on_option(char key, char *value) {
     case 1:
         ctx.cp_hash_path = value;
         break;
+    case 2:
+        ctx.list_path = value;
+        break;
         /* no default */
     }
 
@@ -247,11 +276,12 @@ static bool on_option(char key, char *value) {
 static bool on_args(int argc, char **argv) {
 
     if (argc > 1) {
-        LOG_ERR("Expected 1 hmac input file, got: %d", argc);
-        return false;
+        ctx.paths = argv;
+        ctx.path_count = argc;
+        return true;
     }
 
-    ctx.input = fopen(argv[0], "rb");
+    ctx.input = files_fopen(argv[0], "rb");
     if (!ctx.input) {
         LOG_ERR("Error opening file \"%s\", error: %s", argv[0],
                 strerror(errno));
@@ -271,6 +301,7 @@ static bool tpm2_tool_onstart(tpm2_options **opts) {
         { "ticket",         required_argument, NULL, 't' },
         { "hex",            no_argument,       NULL,  0  },
         { "cphash",         required_argument, NULL,  1  },
+        { "files0-from",    required_argument, NULL,  2  },
     };
 
     ctx.input = stdin;
@@ -299,6 +330,11 @@ static tool_rc tpm2_tool_onrun(ESYS_CONTEXT *ectx, tpm2_option_flags flags) {
         return tool_rc_option_error;
     }
 
+    if (ctx.paths && ctx.list_path) {
+        LOG_ERR("Specify either files or --files0-from, not both");
+        return tool_rc_option_error;
+    }
+
     tool_rc rc = tpm2_util_object_load_auth(ectx, ctx.hmac_key.ctx_path,
             ctx.hmac_key.auth_str, &ctx.hmac_key.object, false,
             TPM2_HANDLE_ALL_W_NV);
@@ -331,6 +367,10 @@ static tool_rc tpm2_tool_onrun(ESYS_CONTEXT *ectx, tpm2_option_flags flags) {
         free(pub);
     }
 
+    if (ctx.paths || ctx.list_path) {
+        return do_hmac_files_and_output(ectx);
+    }
+
     return do_hmac_and_output(ectx);
 }
 
@@ -20,11 +20,11 @@
 //**********************************************************************;
 #include <assert.h>
 #include <stdbool.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
-#include <tss2/tss2_mu.h>
-
+#include <openssl/crypto.h>
 #include <openssl/rand.h>
 
 #include "files.h"
@@ -35,9 +35,15 @@
 #include "tpm2_attr_util.h"
 #include "tpm2_auth_util.h"
 #include "tpm2_errata.h"
+#include "tpm2_hex.h"
 #include "tpm2_identity_util.h"
 #include "tpm2_openssl.h"
 #include "tpm2_options.h"
+#include "tpm2_util.h"
+#include "tpm2_work_pool.h"
+
+/* input, public, private and key algorithm */
+#define MANIFEST_FIELDS 4
 
 typedef struct tpm_import_ctx tpm_import_ctx;
 struct tpm_import_ctx {
@@ -61,6 +67,8 @@ struct tpm_import_ctx {
     bool import_tpm; /* Any param that is exclusively used by import tpm object sets this flag */
     TPMI_ALG_PUBLIC key_type;
     char *cp_hash_path;
+    const char *manifest_path;
+    UINT32 jobs;
 };
 
 static tpm_import_ctx ctx = {
@@ -74,92 +82,58 @@ static tool_rc readpublic(ESYS_CONTEXT *ectx, ESYS_TR handle,
     return tpm2_readpublic(ectx, handle, public, NULL, NULL);
 }
 
-static bool create_import_key_private_data(TPM2B_PRIVATE *private,
-        TPMI_ALG_HASH parent_name_alg,
-        TPM2B_MAX_BUFFER *encrypted_duplicate_sensitive,
-        TPM2B_DIGEST *outer_hmac) {
-
-    //UINT16 hash_size = tpm2_alg_util_get_hash_size(ctx.name_alg);
-    UINT16 parent_hash_size = tpm2_alg_util_get_hash_size(parent_name_alg);
-
-    private->size = sizeof(parent_hash_size) + parent_hash_size
-            + encrypted_duplicate_sensitive->size;
-
-    size_t hmac_size_offset = 0;
-    TSS2_RC rval = Tss2_MU_UINT16_Marshal(parent_hash_size, private->buffer,
-            sizeof(parent_hash_size), &hmac_size_offset);
-    if (rval != TPM2_RC_SUCCESS)
-    {
-        LOG_ERR("Error serializing parent hash size");
-        return false;
-    }
-
-    memcpy(private->buffer + hmac_size_offset, outer_hmac->buffer,
-            parent_hash_size);
-    memcpy(private->buffer + hmac_size_offset + parent_hash_size,
-            encrypted_duplicate_sensitive->buffer,
-            encrypted_duplicate_sensitive->size);
-
-    return true;
-}
-
-static tool_rc key_import(ESYS_CONTEXT *ectx, TPM2B_PUBLIC *parent_pub,
-        TPM2B_SENSITIVE *privkey, TPM2B_PUBLIC *pubkey,
-        TPM2B_ENCRYPTED_SECRET *encrypted_seed,
-        TPM2B_PRIVATE **imported_private) {
-
-    TPMI_ALG_HASH name_alg = pubkey->publicArea.nameAlg;
-
-    TPM2B_DIGEST *seed = &privkey->sensitiveArea.seedValue;
+/*
+ * Wraps the key for the parent on the host: the inner and outer integrity
+ * and the encryption of the sensitive area. Needs no TPM.
+ */
+static bool key_wrap(tpm2_identity_util_wrapper *wrapper,
+        TPM2B_PUBLIC *parent_pub, TPM2B_SENSITIVE *privkey,
+        TPM2B_PUBLIC *pubkey, TPM2B_DATA *enc_sensitive_key,
+        TPM2B_PRIVATE *private) {
 
     /*
      * Create the protection encryption key that gets encrypted with the parents public key.
      */
-    TPM2B_DATA enc_sensitive_key = {
-        .size = parent_pub->publicArea.parameters.rsaDetail.symmetric.keyBits.sym / 8
-    };
+    enc_sensitive_key->size =
+            parent_pub->publicArea.parameters.rsaDetail.symmetric.keyBits.sym / 8;
 
-    if(enc_sensitive_key.size < 16) {
-        LOG_ERR("Calculated wrapping keysize is less than 16 bytes, got: %u", enc_sensitive_key.size);
-        return tool_rc_general_error;
+    if(enc_sensitive_key->size < 16) {
+        LOG_ERR("Calculated wrapping keysize is less than 16 bytes, got: %u", enc_sensitive_key->size);
+        return false;
     }
 
-    int ossl_rc = RAND_bytes(enc_sensitive_key.buffer, enc_sensitive_key.size);
+    int ossl_rc = RAND_bytes(enc_sensitive_key->buffer, enc_sensitive_key->size);
     if (ossl_rc != 1) {
         LOG_ERR("RAND_bytes failed: %s", ERR_error_string(ERR_get_error(), NULL));
-        return tool_rc_general_error;
+        return false;
     }
 
-    /*
-     * Calculate the object name.
-     */
-    TPM2B_NAME pubname = TPM2B_TYPE_INIT(TPM2B_NAME, name);
-    bool res = tpm2_identity_create_name(pubkey, &pubname);
-    if (!res) {
-        return false;
+    tpm2_identity_util_wrap_job job = {
+        .parent_pub = parent_pub,
+        .public = pubkey,
+        .sensitive = privkey,
+        .enc_sensitive_key = enc_sensitive_key,
+    };
+
+    bool result = tpm2_identity_util_wrap(wrapper, &job);
+    if (result) {
+        *private = job.duplicate;
     }
 
-    TPM2B_MAX_BUFFER hmac_key;
-    TPM2B_MAX_BUFFER enc_key;
-    tpm2_identity_util_calc_outer_integrity_hmac_key_and_dupsensitive_enc_key(
-            parent_pub, &pubname, seed, &hmac_key, &enc_key);
+    OPENSSL_cleanse(&job.duplicate, sizeof(job.duplicate));
 
-    TPM2B_MAX_BUFFER encrypted_inner_integrity = TPM2B_EMPTY_INIT;
-    tpm2_identity_util_calculate_inner_integrity(name_alg, privkey, &pubname,
-            &enc_sensitive_key,
-            &parent_pub->publicArea.parameters.rsaDetail.symmetric,
-            &encrypted_inner_integrity);
+    return result;
+}
 
-    TPM2B_DIGEST outer_hmac = TPM2B_EMPTY_INIT;
-    TPM2B_MAX_BUFFER encrypted_duplicate_sensitive = TPM2B_EMPTY_INIT;
-    tpm2_identity_util_calculate_outer_integrity(parent_pub->publicArea.nameAlg,
-            &pubname, &encrypted_inner_integrity, &hmac_key, &enc_key,
-            &parent_pub->publicArea.parameters.rsaDetail.symmetric,
-            &encrypted_duplicate_sensitive, &outer_hmac);
+static tool_rc key_import(ESYS_CONTEXT *ectx, TPM2B_PUBLIC *parent_pub,
+        TPM2B_SENSITIVE *privkey, TPM2B_PUBLIC *pubkey,
+        TPM2B_ENCRYPTED_SECRET *encrypted_seed,
+        TPM2B_PRIVATE **imported_private) {
 
+    TPM2B_DATA enc_sensitive_key = TPM2B_EMPTY_INIT;
     TPM2B_PRIVATE private = TPM2B_EMPTY_INIT;
-    res = create_import_key_private_data(&private, parent_pub->publicArea.nameAlg,
-            &encrypted_duplicate_sensitive, &outer_hmac);
+    bool res = key_wrap(NULL, parent_pub, privkey, pubkey, &enc_sensitive_key,
+            &private);
     if (!res) {
         return tool_rc_general_error;
     }
@@ -186,6 +160,279 @@ static tool_rc key_import(ESYS_CONTEXT *ectx, TPM2B_PUBLIC *parent_pub,
     return rc;
 }
 
+/*
+ * A key of a manifest. The paths point into the manifest line. The key is
+ * wrapped for the parent on a worker thread and then imported by the thread
+ * talking to the TPM.
+ */
+typedef struct manifest_key manifest_key;
+struct manifest_key {
+    char *line;
+    size_t line_number;
+    const char *input_key_file;
+    const char *public_key_file;
+    const char *private_key_file;
+    TPMI_ALG_PUBLIC key_type;
+    TPM2B_PUBLIC public;
+    TPM2B_PRIVATE duplicate;
+    TPM2B_DATA enc_sensitive_key;
+    TPM2B_ENCRYPTED_SECRET encrypted_seed;
+};
+
+typedef struct manifest manifest;
+struct manifest {
+    manifest_key *keys;
+    size_t count;
+    TPM2B_PUBLIC *parent_pub;
+    /*
+     * The options shared by all keys, resolved once so that no thread parses
+     * the option strings or reads the auth from stdin again.
+     */
+    char attrs[sizeof("0xffffffff")];
+    char key_auth[sizeof("hex:") + 2 * sizeof(TPMU_HA)];
+};
+
+static bool manifest_add(void *e, char *line, char **fields, size_t count,
+        size_t line_number, void *userdata) {
+
+    UNUSED(userdata);
+
+    manifest_key *key = (manifest_key *) e;
+    key->line = line;
+    key->line_number = line_number;
+    key->input_key_file = fields[0];
+    key->public_key_file = fields[1];
+    key->private_key_file = fields[2];
+    key->key_type = ctx.key_type;
+    if (count > 3) {
+        key->key_type = tpm2_alg_util_from_optarg(fields[3],
+                tpm2_alg_util_flags_asymmetric | tpm2_alg_util_flags_symmetric);
+    }
+    if (key->key_type == TPM2_ALG_ERROR) {
+        LOG_ERR("%s:%zu: Unsupported or missing key algorithm",
+                ctx.manifest_path, line_number);
+        return false;
+    }
+
+    return true;
+}
+
+static bool manifest_load(manifest *m) {
+
+    return tpm2_util_manifest_read(ctx.manifest_path, 3, MANIFEST_FIELDS,
+            "<input> <public> <private> [<key-algorithm>]",
+            (void **) &m->keys, &m->count, sizeof(*m->keys), manifest_add,
+            NULL);
+}
+
+static bool manifest_resolve_options(manifest *m) {
+
+    if (ctx.auth_key_file && (!strcmp(ctx.auth_key_file, "stdin")
+            || !strncmp(ctx.auth_key_file, "fd:", 3))) {
+        LOG_ERR("--passin cannot read the password of every key of a "
+                "manifest from stdin or a file descriptor");
+        return false;
+    }
+
+    if (ctx.attrs) {
+        TPMA_OBJECT attrs;
+        if (!tpm2_attr_util_obj_from_optarg(ctx.attrs, &attrs)) {
+            LOG_ERR("Invalid object attribute, got\"%s\"", ctx.attrs);
+            return false;
+        }
+        snprintf(m->attrs, sizeof(m->attrs), "0x%x", attrs);
+    }
+
+    if (ctx.key_auth_str) {
+        tpm2_session *tmp;
+        tool_rc rc = tpm2_auth_util_from_optarg(NULL, ctx.key_auth_str, &tmp,
+                true);
+        if (rc != tool_rc_success) {
+            LOG_ERR("Invalid key authorization");
+            return false;
+        }
+
+        const TPM2B_AUTH *auth = tpm2_session_get_auth_value(tmp);
+        int len = snprintf(m->key_auth, sizeof(m->key_auth), "hex:");
+        tpm2_hex_encode(auth->buffer, auth->size, &m->key_auth[len], false);
+        tpm2_session_close(&tmp);
+    }
+
+    return true;
+}
+
+static void manifest_free(manifest *m) {
+
+    size_t i;
+    for (i = 0; i < m->count; i++) {
+        free(m->keys[i].line);
+    }
+    free(m->keys);
+}
+
+/* the host side of an import, run on the worker threads */
+static bool manifest_key_wrap(tpm2_identity_util_wrapper *wrapper,
+        manifest *m, manifest_key *key) {
+
+    TPM2B_SENSITIVE private = TPM2B_EMPTY_INIT;
+    bool result = tpm2_openssl_import_keys(m->parent_pub, &private,
+            &key->public, &key->encrypted_seed, key->input_key_file,
+            key->key_type, ctx.auth_key_file, ctx.policy,
+            ctx.key_auth_str ? m->key_auth : NULL,
+            ctx.attrs ? m->attrs : NULL, ctx.name_alg);
+    if (result) {
+        result = key_wrap(wrapper, m->parent_pub, &private, &key->public,
+                &key->enc_sensitive_key, &key->duplicate);
+    }
+
+    OPENSSL_cleanse(&private, sizeof(private));
+
+    if (!result) {
+        LOG_ERR("%s:%zu: Could not wrap key \"%s\"", ctx.manifest_path,
+                key->line_number, key->input_key_file);
+    }
+
+    return result;
+}
+
+/* the TPM side of an import, run on the thread owning the ESAPI context */
+static bool manifest_key_import(ESYS_CONTEXT *ectx, manifest *m,
+        manifest_key *key) {
+
+    TPMT_SYM_DEF_OBJECT *sym_alg =
+            &m->parent_pub->publicArea.parameters.rsaDetail.symmetric;
+
+    TPM2B_PRIVATE *imported_private = NULL;
+    tool_rc rc = tpm2_import(ectx, &ctx.parent.object, &key->enc_sensitive_key,
+            &key->public, &key->duplicate, &key->encrypted_seed, sym_alg,
+            &imported_private, NULL);
+    OPENSSL_cleanse(&key->enc_sensitive_key, sizeof(key->enc_sensitive_key));
+    if (rc != tool_rc_success) {
+        LOG_ERR("%s:%zu: Could not import key \"%s\"", ctx.manifest_path,
+                key->line_number, key->input_key_file);
+        return false;
+    }
+
+    bool result = files_save_public(&key->public, key->public_key_file)
+            && files_save_private(imported_private, key->private_key_file);
+    free(imported_private);
+
+    return result;
+}
+
+typedef struct manifest_run_state manifest_run_state;
+struct manifest_run_state {
+    ESYS_CONTEXT *ectx;
+    manifest *m;
+    /* the wrapper of every worker, set up by its first key */
+    tpm2_identity_util_wrapper **wrappers;
+    tool_rc rc;
+};
+
+static bool manifest_work(tpm2_work_worker *worker, size_t index,
+        void *userdata) {
+
+    manifest_run_state *state = (manifest_run_state *) userdata;
+    tpm2_identity_util_wrapper **wrapper =
+            &state->wrappers[tpm2_work_worker_index(worker)];
+
+    /* NULL makes every key set up its own contexts */
+    if (!*wrapper) {
+        *wrapper = tpm2_identity_util_wrapper_new();
+    }
+
+    return manifest_key_wrap(*wrapper, state->m, &state->m->keys[index]);
+}
+
+static bool manifest_deliver(size_t index, bool result, void *userdata) {
+
+    manifest_run_state *state = (manifest_run_state *) userdata;
+    manifest_key *key = &state->m->keys[index];
+
+    bool is_imported = result
+            && manifest_key_import(state->ectx, state->m, key);
+
+    tpm2_tool_output("- line: %zu\n", key->line_number);
+    tpm2_tool_output("  input: %s\n", key->input_key_file);
+    tpm2_tool_output("  imported: %s\n", is_imported ? "true" : "false");
+    tpm2_tool_output_flush();
+
+    if (!is_imported) {
+        state->rc = tool_rc_general_error;
+    }
+
+    return true;
+}
+
+/*
+ * The keys are wrapped on a work pool, which is CPU bound, while the calling
+ * thread imports them with the TPM one after the other in manifest order as
+ * soon as they are wrapped.
+ */
+static tool_rc manifest_run(ESYS_CONTEXT *ectx) {
+
+    manifest m = { 0 };
+    TPM2B_PUBLIC ppub = TPM2B_EMPTY_INIT;
+    manifest_run_state state = {
+        .ectx = ectx,
+        .m = &m,
+    };
+    tool_rc rc = tool_rc_general_error;
+    UINT32 workers = 0;
+    bool free_ppub = false;
+
+    if (!manifest_load(&m) || !manifest_resolve_options(&m)) {
+        goto out;
+    }
+
+    if (ctx.parent_key_public_file) {
+        if (!files_load_public(ctx.parent_key_public_file, &ppub)) {
+            LOG_ERR("Failed loading parent key public.");
+            goto out;
+        }
+        m.parent_pub = &ppub;
+    } else {
+        rc = readpublic(ectx, ctx.parent.object.tr_handle, &m.parent_pub);
+        if (rc != tool_rc_success) {
+            LOG_ERR("Failed loading parent key public.");
+            goto out;
+        }
+        free_ppub = true;
+        rc = tool_rc_general_error;
+    }
+
+    if (!m.count) {
+        rc = tool_rc_success;
+        goto out;
+    }
+
+    workers = tpm2_work_pool_workers(ctx.jobs, m.count);
+    state.wrappers = calloc(workers, sizeof(*state.wrappers));
+    if (!state.wrappers) {
+        LOG_ERR("oom");
+        goto out;
+    }
+
+    state.rc = tool_rc_success;
+    rc = tpm2_work_pool_run(m.count, ctx.jobs, manifest_work,
+            manifest_deliver, &state) ? state.rc : tool_rc_general_error;
+
+out:
+    if (state.wrappers) {
+        UINT32 i;
+        for (i = 0; i < workers; i++) {
+            tpm2_identity_util_wrapper_free(state.wrappers[i]);
+        }
+        free(state.wrappers);
+    }
+    if (free_ppub) {
+        free(m.parent_pub);
+    }
+    manifest_free(&m);
+
+    return rc;
+}
+
 static bool on_option(char key, char *value) {
 
     switch (key) {
@@ -241,6 +488,15 @@ static bool on_option(char key, char *value) {
     case 1:
         ctx.cp_hash_path = value;
         break;
+    case 2:
+        ctx.manifest_path = value;
+        break;
+    case 3:
+        if (!tpm2_util_string_to_uint32(value, &ctx.jobs) || !ctx.jobs) {
+            LOG_ERR("Invalid number of jobs, got: \"%s\"", value);
+            return false;
+        }
+        break;
     default:
         LOG_ERR("Invalid option");
         return false;
@@ -267,6 +523,8 @@ static bool tpm2_tool_onstart(tpm2_options **opts) {
       { "encryption-key",     required_argument, NULL, 'k'},
       { "passin",             required_argument, NULL,  0 },
       { "cphash",             required_argument, NULL,  1 },
+      { "manifest",           required_argument, NULL,  2 },
+      { "jobs",               required_argument, NULL,  3 },
     };
 
     *opts = tpm2_options_new("P:p:G:i:C:U:u:r:a:g:s:L:k:", ARRAY_LEN(topts),
@@ -284,6 +542,29 @@ static tool_rc check_options(void) {
 
     tool_rc rc = tool_rc_success;
 
+    if (ctx.manifest_path) {
+        if (ctx.import_tpm || ctx.input_key_file || ctx.public_key_file
+                || ctx.private_key_file || ctx.cp_hash_path) {
+            LOG_ERR("--manifest replaces --input (-i), --public (-u) and "
+                    "--private (-r) and imports OpenSSL keys only, without "
+                    "--cphash");
+            rc = tool_rc_option_error;
+        }
+
+        if (!ctx.parent.ctx_path) {
+            LOG_ERR("Expected parent key to be specified via \"-C\","
+                    " missing option.");
+            rc = tool_rc_option_error;
+        }
+
+        return rc;
+    }
+
+    if (ctx.jobs) {
+        LOG_ERR("--jobs requires --manifest");
+        rc = tool_rc_option_error;
+    }
+
     /* Check the tpm import specific options */
     if (ctx.import_tpm) {
         if (!ctx.input_seed_file) {
@@ -420,7 +701,7 @@ static tool_rc openssl_import(ESYS_CONTEXT *ectx) {
     /*
      * Output the stats on the created object on Success.
      */
-    tpm2_util_public_to_yaml(&public, NULL);
+    tpm2_util_public_to_yaml(&public);
 
     rc = tool_rc_success;
 
@@ -568,6 +849,10 @@ static tool_rc tpm2_tool_onrun(ESYS_CONTEXT *ectx, tpm2_option_flags flags) {
         return rc;
     }
 
+    if (ctx.manifest_path) {
+        return manifest_run(ectx);
+    }
+
     return ctx.import_tpm ? tpm_import(ectx) : openssl_import(ectx);
 }
 
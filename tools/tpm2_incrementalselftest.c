@@ -11,12 +11,52 @@ typedef struct tpm_incrementalselftest_ctx tpm_incrementalselftest_ctx;
 
 struct tpm_incrementalselftest_ctx {
     TPML_ALG inputalgs;
+    bool is_schedule;
 };
 
 static tpm_incrementalselftest_ctx ctx;
 
+/*
+ * A TPM that completed its self test has nothing left to schedule, and one in
+ * failure mode would fail the tests.
+ */
+static tool_rc is_tested(ESYS_CONTEXT *ectx, bool *is_complete) {
+
+    TPM2B_MAX_BUFFER *output = NULL;
+    TPM2_RC status = TPM2_RC_SUCCESS;
+    tool_rc rc = tpm2_gettestresult(ectx, &output, &status);
+    free(output);
+    if (rc != tool_rc_success) {
+        return rc;
+    }
+
+    if (status == TPM2_RC_FAILURE) {
+        LOG_ERR("The TPM failed its self test");
+        return tool_rc_general_error;
+    }
+
+    *is_complete = status == TPM2_RC_SUCCESS;
+
+    return tool_rc_success;
+}
+
 static tool_rc do_tpm_incrementalselftest(ESYS_CONTEXT *ectx) {
 
+    if (ctx.is_schedule) {
+        bool is_complete = false;
+        tool_rc rc = is_tested(ectx, &is_complete);
+        if (rc != tool_rc_success) {
+            return rc;
+        }
+
+        if (is_complete) {
+            tpm2_tool_output("status: ");
+            print_yaml_indent(1);
+            tpm2_tool_output("complete\n");
+            return tool_rc_success;
+        }
+    }
+
     TPML_ALG *to_do_list = NULL;
     tool_rc rc = tpm2_incrementalselftest(ectx, &(ctx.inputalgs), &to_do_list);
     if (rc != tool_rc_success) {
@@ -47,32 +87,66 @@ static tool_rc do_tpm_incrementalselftest(ESYS_CONTEXT *ectx) {
     return tool_rc_success;
 }
 
+/*
+ * An argument is an algorithm, or the algorithm specification of a key, ie the
+ * -G of tpm2_create, whose type, schemes, symmetric algorithm and hashes are
+ * all tested.
+ */
 static bool on_arg(int argc, char **argv) {
     int i;
-    TPM2_ALG_ID algorithm;
 
     LOG_INFO("tocheck :");
 
     for (i = 0; i < argc; i++) {
-        algorithm = tpm2_alg_util_from_optarg(argv[i], tpm2_alg_util_flags_any);
+        TPM2_ALG_ID algorithm = tpm2_alg_util_from_optarg(argv[i],
+                tpm2_alg_util_flags_any);
+        if (algorithm != TPM2_ALG_ERROR) {
+            if (ctx.inputalgs.count == ARRAY_LEN(ctx.inputalgs.algorithms)) {
+                LOG_ERR("Too many algorithms");
+                return false;
+            }
+            ctx.inputalgs.algorithms[ctx.inputalgs.count++] = algorithm;
+            LOG_INFO("  - %s", argv[i]);
+            continue;
+        }
 
-        if (algorithm == TPM2_ALG_ERROR) {
+        TPM2B_PUBLIC public = { 0 };
+        if (!tpm2_alg_util_handle_ext_alg(argv[i], &public)) {
             LOG_INFO("\n");
             LOG_ERR("Got invalid or unsupported algorithm: \"%s\"", argv[i]);
             return false;
         }
 
-        ctx.inputalgs.algorithms[i] = algorithm;
-        ctx.inputalgs.count += 1;
+        if (!tpm2_alg_util_public_algs(&public, &ctx.inputalgs)) {
+            return false;
+        }
         LOG_INFO("  - %s", argv[i]);
     }
     LOG_INFO("\n");
     return true;
 }
 
+static bool on_option(char key, char *value) {
+
+    UNUSED(value);
+
+    switch (key) {
+    case 0:
+        ctx.is_schedule = true;
+        break;
+    }
+
+    return true;
+}
+
 static bool tpm2_tool_onstart(tpm2_options **opts) {
 
-    *opts = tpm2_options_new(NULL, 0, NULL, NULL, on_arg, 0);
+    static struct option topts[] = {
+        { "schedule", no_argument, NULL, 0 },
+    };
+
+    *opts = tpm2_options_new(NULL, ARRAY_LEN(topts), topts, on_option, on_arg,
+            0);
 
     return *opts != NULL;
 }
@@ -1,13 +1,17 @@
 /* SPDX-License-Identifier: BSD-3-Clause */
 
 #include <stdlib.h>
+#include <string.h>
 
 #include "files.h"
 #include "log.h"
+#include "object.h"
 #include "tpm2.h"
 #include "tpm2_options.h"
 #include "tpm2_tool.h"
 
+#define MANIFEST_FIELDS 3
+
 typedef struct tpm_load_ctx tpm_load_ctx;
 struct tpm_load_ctx {
     struct {
@@ -27,10 +31,26 @@ struct tpm_load_ctx {
     const char *namepath;
     const char *contextpath;
     char *cp_hash_path;
+    char *manifest_path;
 };
 
 static tpm_load_ctx ctx;
 
+typedef struct manifest_entry manifest_entry;
+struct manifest_entry {
+    char *line;
+    size_t line_number;
+    const char *pubpath;
+    const char *privpath;
+    const char *contextpath;
+};
+
+typedef struct manifest manifest;
+struct manifest {
+    manifest_entry *entries;
+    size_t count;
+};
+
 static bool on_option(char key, char *value) {
 
     switch (key) {
@@ -55,6 +75,9 @@ static bool on_option(char key, char *value) {
     case 0:
         ctx.cp_hash_path = value;
         break;
+    case 1:
+        ctx.manifest_path = value;
+        break;
     }
 
     return true;
@@ -70,6 +93,7 @@ static bool tpm2_tool_onstart(tpm2_options **opts) {
       { "key-context",    required_argument, NULL, 'c' },
       { "parent-context", required_argument, NULL, 'C' },
       { "cphash",         required_argument, NULL,  0  },
+      { "manifest",       required_argument, NULL,  1  },
     };
 
     *opts = tpm2_options_new("P:u:r:n:C:c:", ARRAY_LEN(topts), topts, on_option,
@@ -86,6 +110,17 @@ static tool_rc check_opts(void) {
         rc = tool_rc_option_error;
     }
 
+    if (ctx.manifest_path) {
+        if (ctx.object.pubpath || ctx.object.privpath || ctx.contextpath
+                || ctx.namepath || ctx.cp_hash_path) {
+            LOG_ERR("The manifest names the objects and outputs, cannot "
+                    "specify -u, -r, -c, -n or --cphash");
+            rc = tool_rc_option_error;
+        }
+
+        return rc;
+    }
+
     if (!ctx.object.pubpath) {
         LOG_ERR("Expected public object portion via -u");
         rc = tool_rc_option_error;
@@ -152,6 +187,125 @@ static tool_rc finish(ESYS_CONTEXT *ectx) {
             ctx.contextpath);
 }
 
+static bool manifest_add(void *e, char *line, char **fields, size_t count,
+        size_t line_number, void *userdata) {
+
+    UNUSED(count);
+    UNUSED(userdata);
+
+    manifest_entry *entry = (manifest_entry *) e;
+    entry->line = line;
+    entry->line_number = line_number;
+    entry->pubpath = fields[0];
+    entry->privpath = fields[1];
+    entry->contextpath = fields[2];
+
+    return true;
+}
+
+static bool manifest_load(manifest *m) {
+
+    return tpm2_util_manifest_read(ctx.manifest_path, MANIFEST_FIELDS,
+            MANIFEST_FIELDS, "<public> <private> <context>",
+            (void **) &m->entries, &m->count, sizeof(*m->entries),
+            manifest_add, NULL);
+}
+
+static void manifest_free(manifest *m) {
+
+    size_t i;
+    for (i = 0; i < m->count; i++) {
+        free(m->entries[i].line);
+    }
+    free(m->entries);
+}
+
+/*
+ * Loads the object of an entry under the parent and saves its context. The
+ * object is then handed to the object cache, which keeps it loaded for the
+ * next tools of tpm2_batch or tpm2_serve while transient slots are free, and
+ * is flushed otherwise. So the objects never take more than one slot beside
+ * the cached ones, however many the manifest holds.
+ */
+static bool manifest_load_one(ESYS_CONTEXT *ectx, manifest_entry *entry) {
+
+    TPM2B_PUBLIC public = { 0 };
+    TPM2B_PRIVATE private = { 0 };
+    bool result = files_load_public(entry->pubpath, &public)
+            && files_load_private(entry->privpath, &private);
+    if (!result) {
+        return false;
+    }
+
+    ESYS_TR handle = ESYS_TR_NONE;
+    tool_rc rc = tpm2_load(ectx, &ctx.parent.object, &private, &public,
+            &handle, NULL);
+    if (rc != tool_rc_success) {
+        return false;
+    }
+
+    TPM2B_NAME *name = NULL;
+    rc = tpm2_tr_get_name(ectx, handle, &name);
+    result = rc == tool_rc_success && files_save_tpm_context_to_path(ectx,
+            handle, entry->contextpath) == tool_rc_success;
+
+    if (result) {
+        tpm2_tool_output("  name: ");
+        tpm2_util_print_tpm2b(name);
+        tpm2_tool_output("\n");
+    }
+    free(name);
+
+    rc = result ? tpm2_object_cache_adopt(ectx, entry->contextpath, &handle) :
+            tpm2_flush_context(ectx, handle);
+
+    return result && rc == tool_rc_success;
+}
+
+static tool_rc manifest_run(ESYS_CONTEXT *ectx) {
+
+    tool_rc rc = tpm2_util_object_load_auth(ectx, ctx.parent.ctx_path,
+            ctx.parent.auth_str, &ctx.parent.object, false,
+            TPM2_HANDLE_ALL_W_NV);
+    if (rc != tool_rc_success) {
+        return rc;
+    }
+
+    if (ctx.parent.object.session && tpm2_session_get_type(
+            ctx.parent.object.session) == TPM2_SE_POLICY) {
+        LOG_ERR("A manifest cannot satisfy a policy session for every load");
+        return tool_rc_option_error;
+    }
+
+    manifest m = { 0 };
+    if (!manifest_load(&m)) {
+        manifest_free(&m);
+        return tool_rc_general_error;
+    }
+
+    size_t i;
+    for (i = 0; i < m.count; i++) {
+        manifest_entry *entry = &m.entries[i];
+
+        tpm2_tool_output("- line: %zu\n", entry->line_number);
+        tpm2_tool_output("  context: %s\n", entry->contextpath);
+        bool is_loaded = manifest_load_one(ectx, entry);
+        tpm2_tool_output("  loaded: %s\n", is_loaded ? "true" : "false");
+        tpm2_tool_output_flush();
+
+        if (!is_loaded) {
+            LOG_ERR("%s:%zu: Could not load \"%s\" and \"%s\"",
+                    ctx.manifest_path, entry->line_number, entry->pubpath,
+                    entry->privpath);
+            rc = tool_rc_general_error;
+        }
+    }
+
+    manifest_free(&m);
+
+    return rc;
+}
+
 static tool_rc tpm2_tool_onrun(ESYS_CONTEXT *ectx, tpm2_option_flags flags) {
 
     UNUSED(flags);
@@ -161,6 +315,10 @@ static tool_rc tpm2_tool_onrun(ESYS_CONTEXT *ectx, tpm2_option_flags flags) {
         return rc;
     }
 
+    if (ctx.manifest_path) {
+        return manifest_run(ectx);
+    }
+
     rc = init(ectx);
     if (rc != tool_rc_success) {
         return rc;
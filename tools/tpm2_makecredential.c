@@ -1,10 +1,12 @@
 /* SPDX-License-Identifier: BSD-3-Clause */
 
+#include <errno.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
+#include <openssl/crypto.h>
 #include <openssl/rand.h>
 
 #include "files.h"
@@ -15,6 +17,9 @@
 #include "tpm2_identity_util.h"
 #include "tpm2_options.h"
 #include "tpm2_openssl.h"
+#include "tpm2_work_pool.h"
+
+#define MANIFEST_FIELDS 4
 
 typedef struct tpm_makecred_ctx tpm_makecred_ctx;
 struct tpm_makecred_ctx {
@@ -32,6 +37,9 @@ struct tpm_makecred_ctx {
     } flags;
 
     char *key_type; //type of key attempting to load, defaults to auto attempt
+
+    const char *manifest_path;
+    UINT32 jobs;
 };
 
 static tpm_makecred_ctx ctx = {
@@ -45,7 +53,7 @@ static bool write_cred_and_secret(const char *path, TPM2B_ID_OBJECT *cred,
 
     bool result = false;
 
-    FILE *fp = fopen(path, "wb+");
+    FILE *fp = files_fopen(path, "wb+");
     if (!fp) {
         LOG_ERR("Could not open file \"%s\" error: \"%s\"", path,
                 strerror(errno));
@@ -91,80 +99,20 @@ out:
 
 static tool_rc make_external_credential_and_save(void) {
 
-    /*
-     * Get name_alg from the public key
-     */
-    TPMI_ALG_HASH name_alg = ctx.public.publicArea.nameAlg;
-
-    /*
-     * Generate and encrypt seed
-     */
-    TPM2B_DIGEST seed = TPM2B_TYPE_INIT(TPM2B_DIGEST, buffer);
-    TPM2B_ENCRYPTED_SECRET encrypted_seed = TPM2B_EMPTY_INIT;
-    unsigned char label[10] = { 'I', 'D', 'E', 'N', 'T', 'I', 'T', 'Y', 0 };
-    bool res = tpm2_identity_util_share_secret_with_public_key(&seed,
-            &ctx.public, label, 9, &encrypted_seed);
-    if (!res) {
-        LOG_ERR("Failed Seed Encryption\n");
+    tpm2_identity_util_parent *parent = tpm2_identity_util_parent_new(
+            &ctx.public);
+    if (!parent) {
         return tool_rc_general_error;
     }
 
-    /*
-     * Perform identity structure calculations (off of the TPM)
-     */
-    TPM2B_MAX_BUFFER hmac_key;
-    TPM2B_MAX_BUFFER enc_key;
-    tpm2_identity_util_calc_outer_integrity_hmac_key_and_dupsensitive_enc_key(
-            &ctx.public, &ctx.object_name, &seed, &hmac_key, &enc_key);
-
-    /*
-     * The ctx.credential needs to be marshalled into struct with
-     * both size and contents together (to be encrypted as a block)
-     */
-    TPM2B_MAX_BUFFER marshalled_inner_integrity = TPM2B_EMPTY_INIT;
-    marshalled_inner_integrity.size = ctx.credential.size
-            + sizeof(ctx.credential.size);
-    UINT16 cred_size = ctx.credential.size;
-    if (!tpm2_util_is_big_endian()) {
-        cred_size = tpm2_util_endian_swap_16(cred_size);
-    }
-    memcpy(marshalled_inner_integrity.buffer, &cred_size, sizeof(cred_size));
-    memcpy(&marshalled_inner_integrity.buffer[2], ctx.credential.buffer,
-            ctx.credential.size);
-
-    /*
-     * Perform inner encryption (encIdentity) and outer HMAC (outerHMAC)
-     */
-    TPM2B_DIGEST outer_hmac = TPM2B_EMPTY_INIT;
-    TPM2B_MAX_BUFFER encrypted_sensitive = TPM2B_EMPTY_INIT;
-    tpm2_identity_util_calculate_outer_integrity(name_alg, &ctx.object_name,
-            &marshalled_inner_integrity, &hmac_key, &enc_key,
-            &ctx.public.publicArea.parameters.rsaDetail.symmetric,
-            &encrypted_sensitive, &outer_hmac);
-
-    /*
-     * Package up the info to save
-     * cred_bloc = outer_hmac || encrypted_sensitive
-     * secret = encrypted_seed (with pubEK)
-     */
     TPM2B_ID_OBJECT cred_blob = TPM2B_TYPE_INIT(TPM2B_ID_OBJECT, credential);
-
-    UINT16 outer_hmac_size = outer_hmac.size;
-    if (!tpm2_util_is_big_endian()) {
-        outer_hmac_size = tpm2_util_endian_swap_16(outer_hmac_size);
+    TPM2B_ENCRYPTED_SECRET encrypted_seed = TPM2B_EMPTY_INIT;
+    bool result = tpm2_identity_util_make_credential(NULL, parent,
+            &ctx.object_name, &ctx.credential, &cred_blob, &encrypted_seed);
+    tpm2_identity_util_parent_free(parent);
+    if (!result) {
+        return tool_rc_general_error;
     }
-    int offset = 0;
-    memcpy(cred_blob.credential + offset, &outer_hmac_size,
-            sizeof(outer_hmac.size));
-    offset += sizeof(outer_hmac.size);
-    memcpy(cred_blob.credential + offset, outer_hmac.buffer, outer_hmac.size);
-    offset += outer_hmac.size;
-    //NOTE: do NOT include the encrypted_sensitive size, since it is encrypted with the blob!
-    memcpy(cred_blob.credential + offset, encrypted_sensitive.buffer,
-            encrypted_sensitive.size);
-
-    cred_blob.size = outer_hmac.size + encrypted_sensitive.size
-            + sizeof(outer_hmac.size);
 
     return write_cred_and_secret(ctx.out_file_path, &cred_blob,
             &encrypted_seed) ? tool_rc_success : tool_rc_general_error;
@@ -201,6 +149,334 @@ static tool_rc make_credential_and_save(ESYS_CONTEXT *ectx) {
     return ret ? tool_rc_success : tool_rc_general_error;
 }
 
+static void set_default_TCG_EK_template(TPMI_ALG_PUBLIC alg,
+        TPM2B_PUBLIC *public) {
+
+    switch (alg) {
+        case TPM2_ALG_RSA:
+            public->publicArea.parameters.rsaDetail.symmetric.algorithm =
+                    TPM2_ALG_AES;
+            public->publicArea.parameters.rsaDetail.symmetric.keyBits.aes =
+                    128;
+            public->publicArea.parameters.rsaDetail.symmetric.mode.aes =
+                    TPM2_ALG_CFB;
+            public->publicArea.parameters.rsaDetail.scheme.scheme =
+                    TPM2_ALG_NULL;
+            public->publicArea.parameters.rsaDetail.keyBits = 2048;
+            public->publicArea.parameters.rsaDetail.exponent = 0;
+            public->publicArea.unique.rsa.size = 256;
+            break;
+        case TPM2_ALG_ECC:
+            public->publicArea.parameters.eccDetail.symmetric.algorithm =
+                    TPM2_ALG_AES;
+            public->publicArea.parameters.eccDetail.symmetric.keyBits.aes =
+                    128;
+            public->publicArea.parameters.eccDetail.symmetric.mode.sym =
+                    TPM2_ALG_CFB;
+            public->publicArea.parameters.eccDetail.scheme.scheme =
+                    TPM2_ALG_NULL;
+            public->publicArea.parameters.eccDetail.curveID =
+                    TPM2_ECC_NIST_P256;
+            public->publicArea.parameters.eccDetail.kdf.scheme =
+                    TPM2_ALG_NULL;
+            public->publicArea.unique.ecc.x.size = 32;
+            public->publicArea.unique.ecc.y.size = 32;
+            break;
+    }
+
+    public->publicArea.objectAttributes =
+          TPMA_OBJECT_RESTRICTED  | TPMA_OBJECT_ADMINWITHPOLICY
+        | TPMA_OBJECT_DECRYPT     | TPMA_OBJECT_FIXEDTPM
+        | TPMA_OBJECT_FIXEDPARENT | TPMA_OBJECT_SENSITIVEDATAORIGIN;
+
+    static const TPM2B_DIGEST auth_policy = {
+        .size = 32,
+        .buffer = {
+            0x83, 0x71, 0x97, 0x67, 0x44, 0x84, 0xB3, 0xF8, 0x1A, 0x90, 0xCC,
+            0x8D, 0x46, 0xA5, 0xD7, 0x24, 0xFD, 0x52, 0xD7, 0x6E, 0x06, 0x52,
+            0x0B, 0x64, 0xF2, 0xA1, 0xDA, 0x1B, 0x33, 0x14, 0x69, 0xAA
+        }
+    };
+    public->publicArea.authPolicy = auth_policy;
+
+    public->publicArea.nameAlg = TPM2_ALG_SHA256;
+}
+
+static bool key_type_from_optarg(TPMI_ALG_PUBLIC *alg) {
+
+    if (!ctx.key_type) {
+        return true;
+    }
+
+    LOG_WARN("Because **-G** is specified, assuming input encryption public key is in PEM format.");
+    *alg = tpm2_alg_util_from_optarg(ctx.key_type,
+        tpm2_alg_util_flags_asymmetric);
+    if (*alg == TPM2_ALG_ERROR ||
+       (*alg != TPM2_ALG_RSA && *alg != TPM2_ALG_ECC)) {
+        LOG_ERR("Unsupported key type, got: \"%s\"", ctx.key_type);
+        return false;
+    }
+
+    return true;
+}
+
+/*
+ * The encryption key of a manifest, eg an EK. Every distinct public key file
+ * is loaded and set up once, however many credentials are made for it.
+ */
+typedef struct manifest_parent manifest_parent;
+struct manifest_parent {
+    TPM2B_PUBLIC public;
+    tpm2_identity_util_parent *parent;
+};
+
+/*
+ * A credential of a manifest. The paths point into the manifest line. The
+ * credential is made and saved on a worker thread.
+ */
+typedef struct manifest_cred manifest_cred;
+struct manifest_cred {
+    char *line;
+    size_t line_number;
+    const char *public_key_file;
+    const char *secret_file;
+    const char *out_file;
+    TPM2B_NAME name;
+    manifest_parent *parent;
+};
+
+typedef struct manifest manifest;
+struct manifest {
+    manifest_cred *creds;
+    size_t count;
+    manifest_parent *parents;
+    size_t parents_count;
+};
+
+static bool manifest_add(void *e, char *line, char **fields, size_t count,
+        size_t line_number, void *userdata) {
+
+    UNUSED(count);
+    UNUSED(userdata);
+
+    manifest_cred *cred = (manifest_cred *) e;
+    cred->line = line;
+    cred->line_number = line_number;
+    cred->public_key_file = fields[0];
+    cred->secret_file = fields[2];
+    cred->out_file = fields[3];
+
+    cred->name.size = BUFFER_SIZE(TPM2B_NAME, name);
+    if (tpm2_util_hex_to_byte_structure(fields[1], &cred->name.size,
+            cred->name.name)) {
+        LOG_ERR("%s:%zu: Invalid name, got: \"%s\"", ctx.manifest_path,
+                line_number, fields[1]);
+        return false;
+    }
+
+    return true;
+}
+
+static bool manifest_load(manifest *m) {
+
+    return tpm2_util_manifest_read(ctx.manifest_path, MANIFEST_FIELDS,
+            MANIFEST_FIELDS, "<public> <name> <secret> <credential-blob>",
+            (void **) &m->creds, &m->count, sizeof(*m->creds), manifest_add,
+            NULL);
+}
+
+static int compare_public_key_files(const void *a, const void *b) {
+
+    const manifest_cred *x = *(const manifest_cred * const *) a;
+    const manifest_cred *y = *(const manifest_cred * const *) b;
+
+    return strcmp(x->public_key_file, y->public_key_file);
+}
+
+/* loads every distinct public key file once, on the calling thread */
+static bool manifest_load_parents(manifest *m) {
+
+    TPMI_ALG_PUBLIC alg = TPM2_ALG_NULL;
+    if (!key_type_from_optarg(&alg)) {
+        return false;
+    }
+
+    manifest_cred **sorted = calloc(m->count, sizeof(*sorted));
+    m->parents = calloc(m->count, sizeof(*m->parents));
+    if (m->count && (!sorted || !m->parents)) {
+        LOG_ERR("oom");
+        free(sorted);
+        return false;
+    }
+
+    size_t i;
+    for (i = 0; i < m->count; i++) {
+        sorted[i] = &m->creds[i];
+    }
+    qsort(sorted, m->count, sizeof(*sorted), compare_public_key_files);
+
+    bool result = true;
+    for (i = 0; result && i < m->count; i++) {
+        manifest_cred *cred = sorted[i];
+        if (i && !compare_public_key_files(&sorted[i - 1], &sorted[i])) {
+            cred->parent = sorted[i - 1]->parent;
+            continue;
+        }
+
+        manifest_parent *parent = &m->parents[m->parents_count++];
+        cred->parent = parent;
+
+        result = tpm2_openssl_load_public(cred->public_key_file, alg,
+                &parent->public);
+        if (!result) {
+            LOG_ERR("%s:%zu: Could not load public key \"%s\"",
+                    ctx.manifest_path, cred->line_number,
+                    cred->public_key_file);
+            break;
+        }
+
+        if (ctx.key_type) {
+            set_default_TCG_EK_template(alg, &parent->public);
+        }
+
+        parent->parent = tpm2_identity_util_parent_new(&parent->public);
+        result = parent->parent != NULL;
+    }
+
+    free(sorted);
+
+    return result;
+}
+
+static void manifest_free(manifest *m) {
+
+    size_t i;
+    for (i = 0; i < m->count; i++) {
+        free(m->creds[i].line);
+    }
+    free(m->creds);
+
+    for (i = 0; i < m->parents_count; i++) {
+        tpm2_identity_util_parent_free(m->parents[i].parent);
+    }
+    free(m->parents);
+}
+
+static bool manifest_cred_make(tpm2_identity_util_wrapper *wrapper,
+        manifest_cred *cred) {
+
+    TPM2B_DIGEST credential = TPM2B_EMPTY_INIT;
+    TPM2B_ID_OBJECT cred_blob = TPM2B_TYPE_INIT(TPM2B_ID_OBJECT, credential);
+    TPM2B_ENCRYPTED_SECRET secret = TPM2B_EMPTY_INIT;
+
+    credential.size = TPM2_SHA512_DIGEST_SIZE;
+    bool result = files_load_bytes_from_path(cred->secret_file,
+            credential.buffer, &credential.size);
+    if (result) {
+        result = tpm2_identity_util_make_credential(wrapper,
+                cred->parent->parent, &cred->name, &credential, &cred_blob,
+                &secret)
+                && write_cred_and_secret(cred->out_file, &cred_blob, &secret);
+    }
+
+    OPENSSL_cleanse(&credential, sizeof(credential));
+
+    if (!result) {
+        LOG_ERR("%s:%zu: Could not make credential \"%s\"", ctx.manifest_path,
+                cred->line_number, cred->out_file);
+    }
+
+    return result;
+}
+
+typedef struct manifest_run_state manifest_run_state;
+struct manifest_run_state {
+    manifest *m;
+    /* the wrapper of every worker, set up by its first credential */
+    tpm2_identity_util_wrapper **wrappers;
+    tool_rc rc;
+};
+
+static bool manifest_work(tpm2_work_worker *worker, size_t index,
+        void *userdata) {
+
+    manifest_run_state *state = (manifest_run_state *) userdata;
+    tpm2_identity_util_wrapper **wrapper =
+            &state->wrappers[tpm2_work_worker_index(worker)];
+
+    /* NULL makes every credential set up its own contexts */
+    if (!*wrapper) {
+        *wrapper = tpm2_identity_util_wrapper_new();
+    }
+
+    return manifest_cred_make(*wrapper, &state->m->creds[index]);
+}
+
+static bool manifest_deliver(size_t index, bool result, void *userdata) {
+
+    manifest_run_state *state = (manifest_run_state *) userdata;
+    manifest_cred *cred = &state->m->creds[index];
+
+    tpm2_tool_output("- line: %zu\n", cred->line_number);
+    tpm2_tool_output("  public: %s\n", cred->public_key_file);
+    tpm2_tool_output("  made: %s\n", result ? "true" : "false");
+    tpm2_tool_output_flush();
+
+    if (!result) {
+        state->rc = tool_rc_general_error;
+    }
+
+    return true;
+}
+
+/*
+ * The credentials are made on a work pool, each worker reusing its OpenSSL
+ * contexts, while the calling thread reports them in manifest order.
+ */
+static tool_rc manifest_run(void) {
+
+    manifest m = { 0 };
+    manifest_run_state state = {
+        .m = &m,
+        .rc = tool_rc_general_error,
+    };
+    UINT32 workers = 0;
+
+    if (!manifest_load(&m) || !manifest_load_parents(&m)) {
+        goto out;
+    }
+
+    if (!m.count) {
+        state.rc = tool_rc_success;
+        goto out;
+    }
+
+    workers = tpm2_work_pool_workers(ctx.jobs, m.count);
+    state.wrappers = calloc(workers, sizeof(*state.wrappers));
+    if (!state.wrappers) {
+        LOG_ERR("oom");
+        goto out;
+    }
+
+    state.rc = tool_rc_success;
+    if (!tpm2_work_pool_run(m.count, ctx.jobs, manifest_work,
+            manifest_deliver, &state)) {
+        state.rc = tool_rc_general_error;
+    }
+
+out:
+    if (state.wrappers) {
+        UINT32 i;
+        for (i = 0; i < workers; i++) {
+            tpm2_identity_util_wrapper_free(state.wrappers[i]);
+        }
+        free(state.wrappers);
+    }
+    manifest_free(&m);
+
+    return state.rc;
+}
+
 static bool on_option(char key, char *value) {
 
     switch (key) {
@@ -241,6 +517,15 @@ static bool on_option(char key, char *value) {
     case 'G':
         ctx.key_type = value;
         break;
+    case 0:
+        ctx.manifest_path = value;
+        break;
+    case 1:
+        if (!tpm2_util_string_to_uint32(value, &ctx.jobs) || !ctx.jobs) {
+            LOG_ERR("Invalid number of jobs, got: \"%s\"", value);
+            return false;
+        }
+        break;
     }
 
     return true;
@@ -255,6 +540,8 @@ static bool tpm2_tool_onstart(tpm2_options **opts) {
       {"name",            required_argument, NULL, 'n'},
       {"credential-blob", required_argument, NULL, 'o'},
       { "key-algorithm",  required_argument, NULL, 'G'},
+      { "manifest",       required_argument, NULL,  0 },
+      { "jobs",           required_argument, NULL,  1 },
     };
 
     *opts = tpm2_options_new("G:u:e:s:n:o:", ARRAY_LEN(topts), topts, on_option,
@@ -263,65 +550,11 @@ static bool tpm2_tool_onstart(tpm2_options **opts) {
     return *opts != NULL;
 }
 
-static void set_default_TCG_EK_template(TPMI_ALG_PUBLIC alg) {
-
-    switch (alg) {
-        case TPM2_ALG_RSA:
-            ctx.public.publicArea.parameters.rsaDetail.symmetric.algorithm =
-                    TPM2_ALG_AES;
-            ctx.public.publicArea.parameters.rsaDetail.symmetric.keyBits.aes = 128;
-            ctx.public.publicArea.parameters.rsaDetail.symmetric.mode.aes =
-                    TPM2_ALG_CFB;
-            ctx.public.publicArea.parameters.rsaDetail.scheme.scheme = TPM2_ALG_NULL;
-            ctx.public.publicArea.parameters.rsaDetail.keyBits = 2048;
-            ctx.public.publicArea.parameters.rsaDetail.exponent = 0;
-            ctx.public.publicArea.unique.rsa.size = 256;
-            break;
-        case TPM2_ALG_ECC:
-            ctx.public.publicArea.parameters.eccDetail.symmetric.algorithm =
-                    TPM2_ALG_AES;
-            ctx.public.publicArea.parameters.eccDetail.symmetric.keyBits.aes = 128;
-            ctx.public.publicArea.parameters.eccDetail.symmetric.mode.sym =
-                    TPM2_ALG_CFB;
-            ctx.public.publicArea.parameters.eccDetail.scheme.scheme = TPM2_ALG_NULL;
-            ctx.public.publicArea.parameters.eccDetail.curveID = TPM2_ECC_NIST_P256;
-            ctx.public.publicArea.parameters.eccDetail.kdf.scheme = TPM2_ALG_NULL;
-            ctx.public.publicArea.unique.ecc.x.size = 32;
-            ctx.public.publicArea.unique.ecc.y.size = 32;
-            break;
-    }
-
-    ctx.public.publicArea.objectAttributes =
-          TPMA_OBJECT_RESTRICTED  | TPMA_OBJECT_ADMINWITHPOLICY
-        | TPMA_OBJECT_DECRYPT     | TPMA_OBJECT_FIXEDTPM
-        | TPMA_OBJECT_FIXEDPARENT | TPMA_OBJECT_SENSITIVEDATAORIGIN;
-
-    static const TPM2B_DIGEST auth_policy = {
-        .size = 32,
-        .buffer = {
-            0x83, 0x71, 0x97, 0x67, 0x44, 0x84, 0xB3, 0xF8, 0x1A, 0x90, 0xCC,
-            0x8D, 0x46, 0xA5, 0xD7, 0x24, 0xFD, 0x52, 0xD7, 0x6E, 0x06, 0x52,
-            0x0B, 0x64, 0xF2, 0xA1, 0xDA, 0x1B, 0x33, 0x14, 0x69, 0xAA
-        }
-    };
-    TPM2B_DIGEST *authp = &ctx.public.publicArea.authPolicy;
-    *authp = auth_policy;
-
-    ctx.public.publicArea.nameAlg = TPM2_ALG_SHA256;
-}
-
 static tool_rc process_input(void) {
 
     TPMI_ALG_PUBLIC alg = TPM2_ALG_NULL;
-    if (ctx.key_type) {
-        LOG_WARN("Because **-G** is specified, assuming input encryption public key is in PEM format.");
-        alg = tpm2_alg_util_from_optarg(ctx.key_type,
-            tpm2_alg_util_flags_asymmetric);
-        if (alg == TPM2_ALG_ERROR ||
-           (alg != TPM2_ALG_RSA && alg != TPM2_ALG_ECC)) {
-            LOG_ERR("Unsupported key type, got: \"%s\"", ctx.key_type);
-            return tool_rc_general_error;
-        }
+    if (!key_type_from_optarg(&alg)) {
+        return tool_rc_general_error;
     }
 
     if (ctx.public_key_path) {
@@ -337,7 +570,7 @@ static tool_rc process_input(void) {
      * template since we had to choose "a template".
      */
     if (ctx.key_type) {
-        set_default_TCG_EK_template(alg);
+        set_default_TCG_EK_template(alg, &ctx.public);
     }
 
     if (!ctx.flags.s) {
@@ -378,6 +611,26 @@ static tool_rc tpm2_tool_onrun(ESYS_CONTEXT *ectx, tpm2_option_flags flags) {
 
     UNUSED(flags);
 
+    if (ctx.manifest_path) {
+        if (ctx.flags.e || ctx.flags.s || ctx.flags.n || ctx.flags.o) {
+            LOG_ERR("--manifest replaces options e, s, n and o");
+            return tool_rc_option_error;
+        }
+
+        if (ectx) {
+            LOG_ERR("--manifest makes credentials outside of a TPM only, "
+                    "use -T none");
+            return tool_rc_option_error;
+        }
+
+        return manifest_run();
+    }
+
+    if (ctx.jobs) {
+        LOG_ERR("--jobs requires --manifest");
+        return tool_rc_option_error;
+    }
+
     tool_rc rc = process_input();
     if (rc != tool_rc_success) {
         return rc;
@@ -1,5 +1,6 @@
 /* SPDX-License-Identifier: BSD-3-Clause */
 #include <stdlib.h>
+#include <string.h>
 
 #include "files.h"
 #include "log.h"
@@ -9,6 +10,10 @@
 #include "tpm2_nv_util.h"
 #include "tpm2_tool.h"
 
+/* index, qualification, attestation, signature, size and offset */
+#define MANIFEST_FIELDS_MIN 4
+#define MANIFEST_FIELDS_MAX 6
+
 typedef struct tpm_nvcertify_ctx tpm_nvcertify_ctx;
 struct tpm_nvcertify_ctx {
     //Input
@@ -40,6 +45,9 @@ struct tpm_nvcertify_ctx {
     tpm2_convert_sig_fmt sig_format;
 
     char *cp_hash_path;
+
+    const char *manifest_path;
+    TPMT_SIG_SCHEME in_scheme;
 };
 
 static tpm_nvcertify_ctx ctx = {
@@ -142,6 +150,9 @@ static bool on_option(char key, char *value) {
     case 3:
         ctx.cp_hash_path = value;
         break;
+    case 4:
+        ctx.manifest_path = value;
+        break;
     }
 
 on_option_out:
@@ -149,6 +160,12 @@ on_option_out:
 }
 
 static bool on_arg(int argc, char **argv) {
+
+    if (ctx.manifest_path) {
+        LOG_ERR("The manifest names the NV indices, cannot specify one");
+        return false;
+    }
+
     /*
      * If the user doesn't specify an authorization hierarchy use the index
      */
@@ -174,6 +191,7 @@ static bool tpm2_tool_onstart(tpm2_options **opts) {
         { "offset",             required_argument, NULL,  1  },
         { "attestation",        required_argument, NULL,  2  },
         { "cphash",             required_argument, NULL,  3  },
+        { "manifest",           required_argument, NULL,  4  },
     };
 
     *opts = tpm2_options_new("C:P:c:p:g:s:f:o:q:", ARRAY_LEN(topts), topts,
@@ -295,11 +313,262 @@ static tool_rc process_nvcertify_output(TPMT_SIGNATURE *signature,
     return tool_rc_success;
 }
 
+/*
+ * A certification of a manifest. The paths point into the manifest line.
+ */
+typedef struct manifest_entry manifest_entry;
+struct manifest_entry {
+    char *line;
+    size_t line_number;
+    const char *nv_index_path;
+    TPM2B_DATA policy_qualifier;
+    const char *certify_info_path;
+    const char *signature_path;
+    UINT16 size;
+    UINT16 offset;
+};
+
+typedef struct manifest manifest;
+struct manifest {
+    manifest_entry *entries;
+    size_t count;
+};
+
+/* the NV index of an entry, loaded while the TPM certifies it */
+typedef struct nvcertify_job nvcertify_job;
+struct nvcertify_job {
+    tpm2_loaded_object nv_index;
+    bool is_sent;
+};
+
+static bool manifest_add(void *e, char *line, char **fields, size_t count,
+        size_t line_number, void *userdata) {
+
+    UNUSED(userdata);
+
+    manifest_entry *entry = (manifest_entry *) e;
+    entry->line = line;
+    entry->line_number = line_number;
+    entry->nv_index_path = fields[0];
+    entry->certify_info_path = fields[2];
+    entry->signature_path = fields[3];
+    entry->size = ctx.size;
+    entry->offset = ctx.offset;
+
+    TPMI_RH_NV_INDEX nv_index;
+    if (!tpm2_util_handle_from_optarg(fields[0], &nv_index,
+            TPM2_HANDLE_FLAGS_NV) || !nv_index) {
+        LOG_ERR("%s:%zu: Invalid NV index \"%s\"", ctx.manifest_path,
+                line_number, fields[0]);
+        return false;
+    }
+
+    entry->policy_qualifier.size = 0;
+    if (strcmp(fields[1], "-")) {
+        entry->policy_qualifier.size = sizeof(entry->policy_qualifier.buffer);
+        if (!tpm2_util_bin_from_hex_or_file(fields[1],
+                &entry->policy_qualifier.size,
+                entry->policy_qualifier.buffer)) {
+            LOG_ERR("%s:%zu: Invalid qualification \"%s\"",
+                    ctx.manifest_path, line_number, fields[1]);
+            return false;
+        }
+    }
+
+    if ((count > 4 && !tpm2_util_string_to_uint16(fields[4], &entry->size))
+            || (count > 5
+                && !tpm2_util_string_to_uint16(fields[5], &entry->offset))) {
+        LOG_ERR("%s:%zu: Invalid size or offset", ctx.manifest_path,
+                line_number);
+        return false;
+    }
+
+    return true;
+}
+
+static bool manifest_load(manifest *m) {
+
+    return tpm2_util_manifest_read(ctx.manifest_path, MANIFEST_FIELDS_MIN,
+            MANIFEST_FIELDS_MAX, "<nv-index> <qualification> <attestation> "
+            "<signature> [<size> [<offset>]]", (void **) &m->entries,
+            &m->count, sizeof(*m->entries), manifest_add, NULL);
+}
+
+static void manifest_free(manifest *m) {
+
+    size_t i;
+    for (i = 0; i < m->count; i++) {
+        free(m->entries[i].line);
+    }
+    free(m->entries);
+}
+
+/*
+ * Loads the NV index of the entry and sends its certification. Without a
+ * shared authorization object each index authorizes itself with the
+ * nvauthobj auth, which is restricted to a password, as a policy session
+ * would need satisfying again for each one.
+ */
+static void manifest_send(ESYS_CONTEXT *ectx, manifest_entry *entry,
+        nvcertify_job *job) {
+
+    memset(job, 0, sizeof(*job));
+    job->nv_index.tr_handle = ESYS_TR_NONE;
+
+    tool_rc rc;
+    tpm2_loaded_object *authobj = &ctx.nvindex_authobj.object;
+    if (ctx.nvindex_authobj.ctx_path) {
+        rc = tpm2_util_handle_from_optarg(entry->nv_index_path,
+                &job->nv_index.handle, TPM2_HANDLE_FLAGS_NV) ?
+                tpm2_util_sys_handle_to_esys_handle(ectx,
+                    job->nv_index.handle, &job->nv_index.tr_handle) :
+                tool_rc_general_error;
+    } else {
+        rc = tpm2_util_object_load_auth(ectx, entry->nv_index_path,
+                ctx.nvindex_authobj.auth_str, &job->nv_index, true,
+                TPM2_HANDLE_FLAGS_NV);
+        authobj = &job->nv_index;
+    }
+    if (rc != tool_rc_success) {
+        LOG_ERR("%s:%zu: Could not load NV index \"%s\"", ctx.manifest_path,
+                entry->line_number, entry->nv_index_path);
+        return;
+    }
+
+    job->is_sent = tpm2_nvcertify_async(ectx, &ctx.signing_key.object,
+            authobj, job->nv_index.tr_handle, entry->offset, entry->size,
+            &ctx.in_scheme, &entry->policy_qualifier) == tool_rc_success;
+}
+
+static void manifest_release(ESYS_CONTEXT *ectx, nvcertify_job *job) {
+
+    tpm2_session_close(&job->nv_index.session);
+    tpm2_util_object_unload(ectx, &job->nv_index);
+}
+
+/*
+ * Certifies every NV index of the manifest with the loaded signing key. The
+ * next index is sent before the outputs of the previous one are written, so
+ * the TPM does not wait on the file system. The TPM checks the size and
+ * offset against each index.
+ */
+static tool_rc manifest_certify_all(ESYS_CONTEXT *ectx, manifest *m) {
+
+    nvcertify_job jobs[2];
+    nvcertify_job *cur = &jobs[0];
+    nvcertify_job *next = &jobs[1];
+
+    manifest_send(ectx, &m->entries[0], cur);
+
+    tool_rc rc = tool_rc_success;
+    size_t i;
+    for (i = 0; i < m->count; i++) {
+        manifest_entry *entry = &m->entries[i];
+
+        TPM2B_ATTEST *certify_info = NULL;
+        TPMT_SIGNATURE *signature = NULL;
+        bool is_certified = cur->is_sent && tpm2_nvcertify_finish(ectx,
+                &certify_info, &signature) == tool_rc_success;
+        manifest_release(ectx, cur);
+
+        if (i + 1 < m->count) {
+            manifest_send(ectx, &m->entries[i + 1], next);
+        }
+
+        if (is_certified) {
+            is_certified = tpm2_convert_sig_save(signature, ctx.sig_format,
+                    entry->signature_path)
+                && files_save_bytes_to_file(entry->certify_info_path,
+                    certify_info->attestationData, certify_info->size);
+        }
+        Esys_Free(certify_info);
+        Esys_Free(signature);
+
+        tpm2_tool_output("- line: %zu\n", entry->line_number);
+        tpm2_tool_output("  attestation: %s\n", entry->certify_info_path);
+        tpm2_tool_output("  certified: %s\n",
+                is_certified ? "true" : "false");
+        tpm2_tool_output_flush();
+
+        if (!is_certified) {
+            rc = tool_rc_general_error;
+        }
+
+        nvcertify_job *tmp = cur;
+        cur = next;
+        next = tmp;
+    }
+
+    return rc;
+}
+
+static tool_rc manifest_run(ESYS_CONTEXT *ectx) {
+
+    if (!ctx.signing_key.ctx_path) {
+        LOG_ERR("Must specify the signing key '-C'.");
+        return tool_rc_option_error;
+    }
+
+    if (ctx.signature_path || ctx.certify_info_path || ctx.cp_hash_path
+            || ctx.policy_qualifier_arg) {
+        LOG_ERR("The manifest names the qualifications and outputs, cannot "
+                "specify -o, -q, --attestation or --cphash");
+        return tool_rc_option_error;
+    }
+
+    TPM2B_DATA policy_qualifier = TPM2B_EMPTY_INIT;
+    tool_rc rc = tool_rc_success;
+    if (ctx.nvindex_authobj.ctx_path) {
+        rc = process_nvcertify_input(ectx, &ctx.in_scheme,
+                &policy_qualifier);
+    } else {
+        rc = tpm2_util_object_load_auth(ectx, ctx.signing_key.ctx_path,
+                ctx.signing_key.auth_str, &ctx.signing_key.object, false,
+                TPM2_HANDLES_FLAGS_TRANSIENT|TPM2_HANDLES_FLAGS_PERSISTENT);
+        if (rc == tool_rc_success) {
+            rc = tpm2_alg_util_get_signature_scheme(ectx,
+                    ctx.signing_key.object.tr_handle, &ctx.halg,
+                    ctx.sig_scheme, &ctx.in_scheme);
+        }
+    }
+    if (rc != tool_rc_success) {
+        return rc;
+    }
+
+    tpm2_session *sessions[] = {
+        ctx.signing_key.object.session, ctx.nvindex_authobj.object.session
+    };
+    size_t i;
+    for (i = 0; i < ARRAY_LEN(sessions); i++) {
+        if (sessions[i] && tpm2_session_get_type(sessions[i])
+                == TPM2_SE_POLICY) {
+            LOG_ERR("A manifest cannot satisfy a policy session for every "
+                    "certification");
+            return tool_rc_option_error;
+        }
+    }
+
+    manifest m = { 0 };
+    if (!manifest_load(&m)) {
+        rc = tool_rc_general_error;
+    } else if (m.count) {
+        rc = manifest_certify_all(ectx, &m);
+    }
+
+    manifest_free(&m);
+
+    return rc;
+}
+
 static tool_rc tpm2_tool_onrun(ESYS_CONTEXT *ectx, tpm2_option_flags flags) {
 
     /* opts is unused, avoid compiler warning */
     UNUSED(flags);
 
+    if (ctx.manifest_path) {
+        return manifest_run(ectx);
+    }
+
     bool result = is_input_options_args_valid(ectx);
     if (!result) {
         return tool_rc_option_error;
@@ -2,13 +2,16 @@
 #include <inttypes.h>
 #include <stdbool.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "files.h"
 #include "log.h"
 #include "tpm2.h"
 #include "tpm2_alg_util.h"
+#include "tpm2_arena.h"
 #include "tpm2_attr_util.h"
 #include "tpm2_auth_util.h"
+#include "tpm2_nv_layout.h"
 #include "tpm2_nv_util.h"
 #include "tpm2_options.h"
 #include "tpm2_tool.h"
@@ -59,6 +62,10 @@ struct tpm_nvdefine_ctx {
     tpm2_session *aux_session[MAX_AUX_SESSIONS];
     const char *aux_session_path[MAX_AUX_SESSIONS];
     ESYS_TR aux_session_handle[MAX_AUX_SESSIONS];
+
+    const char *layout_path;
+    /* the max size of an ordinary index, queried once */
+    UINT16 max_size;
 };
 
 static tpm_nvdefine_ctx ctx = {
@@ -124,37 +131,47 @@ static tool_rc process_output(ESYS_CONTEXT *ectx) {
 }
 
 
-static void handle_default_attributes(void) {
-
-    /* attributes set no need for defaults */
-    if (ctx.nv_attribute) {
-        return;
-    }
+static TPMA_NV default_attributes(bool has_policy) {
 
+    TPMA_NV attributes = 0;
     ESYS_TR h = ctx.auth_hierarchy.object.tr_handle;
 
     if (h == ESYS_TR_RH_OWNER) {
-        ctx.nv_attribute |= TPMA_NV_OWNERWRITE | TPMA_NV_OWNERREAD;
+        attributes |= TPMA_NV_OWNERWRITE | TPMA_NV_OWNERREAD;
     } else if (h == ESYS_TR_RH_PLATFORM) {
-        ctx.nv_attribute |= TPMA_NV_PPWRITE | TPMA_NV_PPREAD;
+        attributes |= TPMA_NV_PPWRITE | TPMA_NV_PPREAD;
     } /* else it's an nv index for auth */
 
     /* if it has a policy file, set policy read and write vs auth read and write */
-    if (ctx.policy_file) {
-        ctx.nv_attribute |= TPMA_NV_POLICYWRITE | TPMA_NV_POLICYREAD;
+    if (has_policy) {
+        attributes |= TPMA_NV_POLICYWRITE | TPMA_NV_POLICYREAD;
     } else {
-        ctx.nv_attribute |= TPMA_NV_AUTHWRITE | TPMA_NV_AUTHREAD;
+        attributes |= TPMA_NV_AUTHWRITE | TPMA_NV_AUTHREAD;
     }
+
+    return attributes;
+}
+
+static void handle_default_attributes(void) {
+
+    /* attributes set no need for defaults */
+    if (ctx.nv_attribute) {
+        return;
+    }
+
+    ctx.nv_attribute = default_attributes(!!ctx.policy_file);
 }
 
 static tool_rc handle_no_index_specified(ESYS_CONTEXT *ectx, TPM2_NV_INDEX *chosen) {
 
     /* get the max NV index for the TPM */
+    tpm2_arena *arena = tpm2_arena_invocation();
     TPMS_CAPABILITY_DATA *capabilities = NULL;
-    tool_rc rc = tpm2_getcap(ectx, TPM2_CAP_TPM_PROPERTIES, TPM2_PT_FIXED,
-            TPM2_MAX_TPM_PROPERTIES, NULL, &capabilities);
-    if (rc != tool_rc_success) {
-        return rc;
+    tool_rc rc = tpm2_capability_get(ectx, TPM2_CAP_TPM_PROPERTIES,
+            TPM2_PT_NV_INDEX_MAX, 1, &capabilities);
+    bool is_adopted = tpm2_arena_adopt(arena, capabilities);
+    if (rc != tool_rc_success || !is_adopted) {
+        return rc != tool_rc_success ? rc : tool_rc_general_error;
     }
 
     TPMS_TAGGED_PROPERTY *properties = capabilities->data.tpmProperties.tpmProperty;
@@ -162,8 +179,7 @@ static tool_rc handle_no_index_specified(ESYS_CONTEXT *ectx, TPM2_NV_INDEX *chos
 
     if (!count) {
         LOG_ERR("Could not get maximum NV index, try specifying an NV index");
-        rc = tool_rc_general_error;
-        goto out;
+        return tool_rc_general_error;
     }
 
     TPM2_NV_INDEX max = 0;
@@ -176,18 +192,17 @@ static tool_rc handle_no_index_specified(ESYS_CONTEXT *ectx, TPM2_NV_INDEX *chos
 
     if (!max) {
         LOG_ERR("Could not find max NV indices in capabilities");
-        rc = tool_rc_general_error;
-        goto out;
+        return tool_rc_general_error;
     }
     /* done getting max NV index */
-    free(capabilities);
     capabilities = NULL;
 
     /* now find what NV indexes are in use */
     rc = tpm2_getcap(ectx, TPM2_CAP_HANDLES, tpm2_util_hton_32(TPM2_HT_NV_INDEX),
             TPM2_PT_NV_INDEX_MAX, NULL, &capabilities);
-    if (rc != tool_rc_success) {
-        goto out;
+    is_adopted = tpm2_arena_adopt(arena, capabilities);
+    if (rc != tool_rc_success || !is_adopted) {
+        return rc != tool_rc_success ? rc : tool_rc_general_error;
     }
 
     /*
@@ -217,44 +232,44 @@ static tool_rc handle_no_index_specified(ESYS_CONTEXT *ectx, TPM2_NV_INDEX *chos
 
     if (!found) {
         LOG_ERR("No free NV index found");
-        rc = tool_rc_general_error;
-        goto out;
+        return tool_rc_general_error;
     }
 
     *chosen = choose;
 
-out:
-    free(capabilities);
-
-    return rc;
+    return tool_rc_success;
 }
 
-static tool_rc validate_size(ESYS_CONTEXT *ectx) {
+static tool_rc validate_size(ESYS_CONTEXT *ectx, TPMA_NV attributes,
+        bool is_size_set, UINT16 *size) {
 
     UINT16 hash_size = tpm2_alg_util_get_hash_size(ctx.halg);
 
-    switch ((ctx.nv_attribute & TPMA_NV_TPM2_NT_MASK) >> TPMA_NV_TPM2_NT_SHIFT) {
+    switch ((attributes & TPMA_NV_TPM2_NT_MASK) >> TPMA_NV_TPM2_NT_SHIFT) {
         case TPM2_NT_ORDINARY:
-            if (!ctx.size_set) {
-                ctx.size = tpm2_nv_util_max_allowed_nv_size(ectx, true);
+            if (!is_size_set) {
+                if (!ctx.max_size) {
+                    ctx.max_size = tpm2_nv_util_max_allowed_nv_size(ectx, true);
+                }
+                *size = ctx.max_size;
             }
             break;
         case TPM2_NT_COUNTER:
         case TPM2_NT_BITS:
         case TPM2_NT_PIN_FAIL:
         case TPM2_NT_PIN_PASS:
-            if (!ctx.size_set) {
-                ctx.size = 8;
-            } else if (ctx.size != 8) {
+            if (!is_size_set) {
+                *size = 8;
+            } else if (*size != 8) {
                 LOG_ERR("Size is invalid for an NV index type,"
                         " it must be size of 8");
                 return tool_rc_general_error;
             }
             break;
         case TPM2_NT_EXTEND:
-            if (!ctx.size_set) {
-                ctx.size = hash_size;
-            } else if (ctx.size != hash_size) {
+            if (!is_size_set) {
+                *size = hash_size;
+            } else if (*size != hash_size) {
                 LOG_ERR("Size is invalid for an NV index type: \"extend\","
                         " it must match the name hash algorithm size of %"
                         PRIu16, hash_size);
@@ -266,6 +281,28 @@ static tool_rc validate_size(ESYS_CONTEXT *ectx) {
     return tool_rc_success;
 }
 
+static tool_rc index_auth_get(const char *auth_str, TPM2B_AUTH *nv_auth) {
+
+    tpm2_session *tmp;
+    tool_rc rc = tpm2_auth_util_from_optarg(NULL, auth_str, &tmp, true);
+    if (rc != tool_rc_success) {
+        LOG_ERR("Invalid index authorization");
+        return rc;
+    }
+
+    const TPM2B_AUTH *auth = tpm2_session_get_auth_value(tmp);
+    *nv_auth = *auth;
+
+    return tpm2_session_close(&tmp);
+}
+
+static bool policy_load(const char *path, TPM2B_DIGEST *policy) {
+
+    policy->size = BUFFER_SIZE(TPM2B_DIGEST, buffer);
+
+    return files_load_bytes_from_path(path, policy->buffer, &policy->size);
+}
+
 static tool_rc process_inputs(ESYS_CONTEXT *ectx) {
 
     /*
@@ -275,18 +312,11 @@ static tool_rc process_inputs(ESYS_CONTEXT *ectx) {
     /*
      * 1.a Add the new-auth values to be set for the object.
      */
-    tpm2_session *tmp;
-    tool_rc rc = tpm2_auth_util_from_optarg(NULL, ctx.index_auth_str, &tmp, true);
+    tool_rc rc = index_auth_get(ctx.index_auth_str, &ctx.nv_auth);
     if (rc != tool_rc_success) {
-        LOG_ERR("Invalid index authorization");
         return rc;
     }
 
-    const TPM2B_AUTH *auth = tpm2_session_get_auth_value(tmp);
-    ctx.nv_auth = *auth;
-
-    tpm2_session_close(&tmp);
-
     /*
      * 1.b Add object names and their auth sessions
      */
@@ -319,7 +349,7 @@ static tool_rc process_inputs(ESYS_CONTEXT *ectx) {
         }
     }
 
-    rc = validate_size(ectx);
+    rc = validate_size(ectx, ctx.nv_attribute, ctx.size_set, &ctx.size);
     if (rc != tool_rc_success) {
         return rc;
     }
@@ -330,12 +360,8 @@ static tool_rc process_inputs(ESYS_CONTEXT *ectx) {
     ctx.public_info.nvPublic.dataSize = ctx.size;
 
     if (ctx.policy_file) {
-        ctx.public_info.nvPublic.authPolicy.size = BUFFER_SIZE(TPM2B_DIGEST,
-                buffer);
-
-        bool is_policy_load = files_load_bytes_from_path(ctx.policy_file,
-            ctx.public_info.nvPublic.authPolicy.buffer,
-            &ctx.public_info.nvPublic.authPolicy.size);
+        bool is_policy_load = policy_load(ctx.policy_file,
+            &ctx.public_info.nvPublic.authPolicy);
         if (!is_policy_load) {
             return tool_rc_general_error;
         }
@@ -427,6 +453,9 @@ static bool on_option(char key, char *value) {
     case 1:
         ctx.rp_hash_path = value;
         break;
+    case 2:
+        ctx.layout_path = value;
+        break;
     case 'S':
         ctx.aux_session_path[ctx.aux_session_cnt] = value;
         if (ctx.aux_session_cnt < MAX_AUX_SESSIONS) {
@@ -466,6 +495,7 @@ static bool tpm2_tool_onstart(tpm2_options **opts) {
         { "cphash",         required_argument, NULL,  0  },
         {"rphash",          required_argument, NULL,  1  },
         { "session",        required_argument, NULL, 'S' },
+        { "layout",         required_argument, NULL,  2  },
     };
 
     *opts = tpm2_options_new("S:C:s:a:P:p:L:g:", ARRAY_LEN(topts), topts,
@@ -474,10 +504,250 @@ static bool tpm2_tool_onstart(tpm2_options **opts) {
     return *opts != NULL;
 }
 
+/* the attributes the TPM sets and clears as an index is used */
+#define NV_ATTRIBUTES_STATE \
+    (TPMA_NV_WRITTEN | TPMA_NV_WRITELOCKED | TPMA_NV_READLOCKED)
+
+typedef struct layout_index layout_index;
+struct layout_index {
+    tpm2_nv_layout_entry *entry;
+    TPM2B_NV_PUBLIC public_info;
+    TPM2B_AUTH auth;
+    /* defined, unchanged, conflict or failed, NULL while to be defined */
+    const char *action;
+};
+
+typedef struct layout_define layout_define;
+struct layout_define {
+    tpm2_nv_layout layout;
+    layout_index *indices;
+    ESYS_TR shandle;
+    /* the next index to define and the one at the TPM */
+    size_t next;
+    layout_index *sent;
+};
+
+static bool layout_is_unchanged(const TPMS_NV_PUBLIC *want,
+        const TPMS_NV_PUBLIC *have) {
+
+    return want->nameAlg == have->nameAlg
+            && want->dataSize == have->dataSize
+            && (want->attributes & ~NV_ATTRIBUTES_STATE)
+                    == (have->attributes & ~NV_ATTRIBUTES_STATE)
+            && want->authPolicy.size == have->authPolicy.size
+            && !memcmp(want->authPolicy.buffer, have->authPolicy.buffer,
+                    want->authPolicy.size);
+}
+
+/*
+ * Builds the public area of an index on the host and checks an index that is
+ * already defined against it. The auth of a defined index is not readable and
+ * not checked.
+ */
+static const char *layout_index_setup(ESYS_CONTEXT *ectx, layout_define *d,
+        layout_index *index) {
+
+    tpm2_nv_layout_entry *entry = index->entry;
+    TPMS_NV_PUBLIC *nv_public = &index->public_info.nvPublic;
+
+    nv_public->nvIndex = entry->index;
+    nv_public->nameAlg = ctx.halg;
+    nv_public->attributes = entry->is_attributes_set ? entry->attributes :
+            default_attributes(!!entry->policy_path);
+    nv_public->dataSize = entry->size;
+
+    tool_rc rc = validate_size(ectx, nv_public->attributes,
+            entry->is_size_set, &nv_public->dataSize);
+    if (rc != tool_rc_success) {
+        return "failed";
+    }
+
+    if (entry->policy_path
+            && !policy_load(entry->policy_path, &nv_public->authPolicy)) {
+        return "failed";
+    }
+
+    rc = index_auth_get(entry->auth_str, &index->auth);
+    if (rc != tool_rc_success) {
+        return "failed";
+    }
+
+    if (!entry->is_defined) {
+        return NULL;
+    }
+
+    TPM2B_NV_PUBLIC *defined = NULL;
+    rc = tpm2_util_nv_read_public(ectx, entry->index, &defined);
+    if (rc != tool_rc_success) {
+        LOG_ERR("Failed to read the public part of NV index 0x%x",
+                entry->index);
+        return "failed";
+    }
+
+    bool is_unchanged = layout_is_unchanged(nv_public, &defined->nvPublic);
+    Esys_Free(defined);
+    if (!is_unchanged) {
+        LOG_ERR("%s:%zu: NV index 0x%x is defined with another size, "
+                "attributes, policy or name algorithm", d->layout.path,
+                entry->line_number, entry->index);
+        return "conflict";
+    }
+
+    return "unchanged";
+}
+
+static tool_rc layout_prepare(void *userdata, bool *is_next) {
+
+    layout_define *d = (layout_define *) userdata;
+
+    /* skips the indices that are not to be defined */
+    while (d->next < d->layout.count && d->indices[d->next].action) {
+        d->next++;
+    }
+
+    *is_next = d->next < d->layout.count;
+
+    return tool_rc_success;
+}
+
+static tool_rc layout_submit(ESYS_CONTEXT *ectx, void *userdata) {
+
+    layout_define *d = (layout_define *) userdata;
+    layout_index *index = &d->indices[d->next];
+
+    tool_rc rc = tpm2_nv_definespace_async(ectx,
+            ctx.auth_hierarchy.object.tr_handle, d->shandle,
+            ctx.aux_session_handle[0], ctx.aux_session_handle[1],
+            &index->auth, &index->public_info);
+    if (rc != tool_rc_success) {
+        return rc;
+    }
+
+    d->sent = index;
+    d->next++;
+
+    return tool_rc_success;
+}
+
+static tool_rc layout_finish(ESYS_CONTEXT *ectx, void *userdata) {
+
+    layout_define *d = (layout_define *) userdata;
+
+    /* an index that cannot be defined fails its line, not the others */
+    tool_rc rc = tpm2_nv_definespace_finish(ectx);
+    d->sent->action = rc == tool_rc_success ? "defined" : "failed";
+
+    return tool_rc_success;
+}
+
+static tool_rc layout_run(ESYS_CONTEXT *ectx) {
+
+    if (ctx.nv_index || ctx.size_set || ctx.nv_attribute || ctx.policy_file
+            || ctx.index_auth_str || ctx.cp_hash_path || ctx.rp_hash_path) {
+        LOG_ERR("The layout lists the indices, sizes, attributes, policies "
+                "and auths, cannot specify an NV index, -s, -a, -L, -p, "
+                "--cphash or --rphash");
+        return tool_rc_option_error;
+    }
+
+    /* the hierarchy and its session are shared by all the indices */
+    tool_rc rc = tpm2_util_object_load_auth(ectx, ctx.auth_hierarchy.ctx_path,
+            ctx.auth_hierarchy.auth_str, &ctx.auth_hierarchy.object, false,
+            TPM2_HANDLE_FLAGS_O | TPM2_HANDLE_FLAGS_P);
+    if (rc != tool_rc_success) {
+        LOG_ERR("Invalid authorization");
+        return rc;
+    }
+
+    rc = tpm2_util_aux_sessions_setup(ectx, ctx.aux_session_cnt,
+        ctx.aux_session_path, ctx.aux_session_handle, ctx.aux_session);
+    if (rc != tool_rc_success) {
+        return rc;
+    }
+
+    layout_define d = {
+        .shandle = ESYS_TR_NONE,
+    };
+
+    rc = tpm2_auth_util_get_shandle(ectx, ctx.auth_hierarchy.object.tr_handle,
+            ctx.auth_hierarchy.object.session, &d.shandle);
+    if (rc != tool_rc_success) {
+        LOG_ERR("Failed to get shandle");
+        return rc;
+    }
+
+    if (!tpm2_nv_layout_load(ctx.layout_path, &d.layout)) {
+        tpm2_nv_layout_free(&d.layout);
+        return tool_rc_general_error;
+    }
+
+    d.indices = calloc(d.layout.count ? d.layout.count : 1,
+            sizeof(*d.indices));
+    if (!d.indices) {
+        LOG_ERR("oom");
+        tpm2_nv_layout_free(&d.layout);
+        return tool_rc_general_error;
+    }
+
+    rc = tpm2_nv_layout_get_defined(ectx, &d.layout);
+    if (rc != tool_rc_success) {
+        goto out;
+    }
+
+    size_t i;
+    for (i = 0; i < d.layout.count; i++) {
+        d.indices[i].entry = &d.layout.entries[i];
+        d.indices[i].action = layout_index_setup(ectx, &d, &d.indices[i]);
+    }
+
+    static const tpm2_pipeline_ops ops = {
+        .prepare = layout_prepare,
+        .submit = layout_submit,
+        .finish = layout_finish,
+    };
+
+    rc = tpm2_pipeline_run(ectx, &ops, &d);
+
+    for (i = 0; i < d.layout.count; i++) {
+        layout_index *index = &d.indices[i];
+        tpm2_nv_layout_entry *entry = index->entry;
+
+        /* not sent after the pipeline stopped */
+        if (!index->action) {
+            index->action = "failed";
+        }
+
+        tpm2_tool_output("- line: %zu\n", entry->line_number);
+        tpm2_tool_output("  nv-index: 0x%x\n", entry->index);
+        tpm2_tool_output("  action: %s\n", index->action);
+
+        if (!strcmp(index->action, "failed")) {
+            LOG_ERR("%s:%zu: Failed to create NV index 0x%x.",
+                    ctx.layout_path, entry->line_number, entry->index);
+        }
+
+        if (!strcmp(index->action, "failed")
+                || !strcmp(index->action, "conflict")) {
+            rc = tool_rc_general_error;
+        }
+    }
+    tpm2_tool_output_flush();
+
+out:
+    free(d.indices);
+    tpm2_nv_layout_free(&d.layout);
+
+    return rc;
+}
+
 static tool_rc tpm2_tool_onrun(ESYS_CONTEXT *ectx, tpm2_option_flags flags) {
 
     UNUSED(flags);
 
+    if (ctx.layout_path) {
+        return layout_run(ectx);
+    }
+
     /*
      * 1. Process options
      */
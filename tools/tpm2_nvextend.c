@@ -1,9 +1,15 @@
 /* SPDX-License-Identifier: BSD-3-Clause */
+#include <errno.h>
 #include <stdlib.h>
+#include <string.h>
+
+#include <openssl/evp.h>
 
 #include "files.h"
 #include "log.h"
 #include "tpm2.h"
+#include "tpm2_alg_util.h"
+#include "tpm2_openssl.h"
 #include "tpm2_tool.h"
 #include "tpm2_nv_util.h"
 #include "tpm2_options.h"
@@ -25,6 +31,7 @@ struct tpm_nvextend_ctx {
     const char *input_path;
     TPM2_HANDLE nv_index;
     TPM2B_MAX_NV_BUFFER data;
+    bool is_batch;
 
     /*
      * Outputs
@@ -132,6 +139,11 @@ static tool_rc process_inputs(ESYS_CONTEXT *ectx) {
      */
     ctx.input_path = strcmp(ctx.input_path, "-") ? ctx.input_path : NULL;
 
+    /* the records of a batch are read as they are extended */
+    if (ctx.is_batch) {
+        return rc;
+    }
+
     bool result = files_load_bytes_from_buffer_or_file_or_stdin(NULL,
             ctx.input_path, &ctx.data.size, ctx.data.buffer);
     if (!result) {
@@ -167,6 +179,242 @@ static tool_rc process_inputs(ESYS_CONTEXT *ectx) {
     return rc;
 }
 
+/* reads the value of the index, one read of the whole digest */
+static tool_rc batch_read_digest(ESYS_CONTEXT *ectx, TPM2B_DIGEST *digest) {
+
+    TPM2B_DIGEST cp_hash = { .size = 0 };
+    UINT8 *data = NULL;
+    UINT16 size = 0;
+    tool_rc rc = tpm2_util_nv_read(ectx, ctx.nv_index, 0, 0,
+            &ctx.auth_hierarchy.object, &data, &size, &cp_hash,
+            TPM2_ALG_ERROR);
+    if (rc != tool_rc_success) {
+        LOG_ERR("Could not read NV index 0x%X, the auth has to permit reads",
+                ctx.nv_index);
+        return rc;
+    }
+
+    if (size > sizeof(digest->buffer)) {
+        free(data);
+        return tool_rc_general_error;
+    }
+
+    memcpy(digest->buffer, data, size);
+    digest->size = size;
+    free(data);
+
+    return tool_rc_success;
+}
+
+/*
+ * The value of the index the extends of a batch start from, the zero digest
+ * of its name algorithm until it is first extended.
+ */
+static tool_rc batch_initial_digest(ESYS_CONTEXT *ectx, TPM2B_DIGEST *digest,
+        TPMI_ALG_HASH *halg) {
+
+    TPM2B_NV_PUBLIC *nv_public = NULL;
+    tool_rc rc = tpm2_util_nv_read_public(ectx, ctx.nv_index, &nv_public);
+    if (rc != tool_rc_success) {
+        return rc;
+    }
+
+    *halg = nv_public->nvPublic.nameAlg;
+    TPMA_NV attributes = nv_public->nvPublic.attributes;
+    digest->size = nv_public->nvPublic.dataSize;
+    free(nv_public);
+
+    if ((attributes & TPMA_NV_TPM2_NT_MASK) >> TPMA_NV_TPM2_NT_SHIFT
+            != TPM2_NT_EXTEND) {
+        LOG_ERR("NV index 0x%X is not an extend index", ctx.nv_index);
+        return tool_rc_general_error;
+    }
+
+    if (digest->size > sizeof(digest->buffer)
+            || digest->size != tpm2_alg_util_get_hash_size(*halg)) {
+        LOG_ERR("Unexpected size %u of NV index 0x%X", digest->size,
+                ctx.nv_index);
+        return tool_rc_general_error;
+    }
+
+    if (!(attributes & TPMA_NV_WRITTEN)) {
+        memset(digest->buffer, 0, digest->size);
+        return tool_rc_success;
+    }
+
+    return batch_read_digest(ectx, digest);
+}
+
+/* new value = H(old value || data), as TPM2_NV_Extend computes it */
+static bool batch_chain(EVP_MD_CTX *mdctx, const EVP_MD *md,
+        TPM2B_DIGEST *digest, const TPM2B_MAX_NV_BUFFER *data) {
+
+    unsigned size = 0;
+    bool result = EVP_DigestInit_ex(mdctx, md, NULL)
+        && EVP_DigestUpdate(mdctx, digest->buffer, digest->size)
+        && EVP_DigestUpdate(mdctx, data->buffer, data->size)
+        && EVP_DigestFinal_ex(mdctx, digest->buffer, &size);
+    if (!result) {
+        LOG_ERR("Could not chain the NV extend digest");
+        return false;
+    }
+
+    digest->size = size;
+
+    return true;
+}
+
+/*
+ * Reads the next record. Returns false at the end of the input, or on an error
+ * setting rc.
+ */
+static bool batch_read(FILE *input, TPM2B_MAX_NV_BUFFER *data, tool_rc *rc) {
+
+    bool is_end = false;
+    data->size = sizeof(data->buffer);
+    bool result = files_read_record(input, data->buffer, &data->size,
+            &is_end);
+    if (!result) {
+        LOG_ERR("Could not read the records to extend with");
+        *rc = tool_rc_general_error;
+        return false;
+    }
+
+    return !is_end;
+}
+
+/*
+ * Extends the index with every record of the input. The next record is read
+ * and chained on the host while the TPM extends with the previous one. The
+ * first failure stops the batch.
+ */
+static tool_rc batch_extend(ESYS_CONTEXT *ectx, ESYS_TR nv_index, FILE *input,
+        EVP_MD_CTX *mdctx, const EVP_MD *md, TPM2B_DIGEST *digest,
+        size_t *count) {
+
+    TPM2B_MAX_NV_BUFFER records[2];
+    TPM2B_MAX_NV_BUFFER *cur = &records[0];
+    TPM2B_MAX_NV_BUFFER *next = &records[1];
+
+    tool_rc rc = tool_rc_success;
+    bool has_cur = batch_read(input, cur, &rc);
+    if (has_cur) {
+        rc = tpm2_nvextend_async(ectx, &ctx.auth_hierarchy.object, nv_index,
+                cur, ctx.aux_session_handle[0], ctx.aux_session_handle[1]);
+        has_cur = rc == tool_rc_success;
+    }
+
+    while (has_cur) {
+        bool has_next = batch_read(input, next, &rc);
+        bool result = batch_chain(mdctx, md, digest, cur);
+
+        tool_rc tmp_rc = tpm2_nvextend_finish(ectx);
+        if (tmp_rc != tool_rc_success) {
+            return tmp_rc;
+        }
+        (*count)++;
+
+        if (!result) {
+            return tool_rc_general_error;
+        }
+
+        if (has_next) {
+            rc = tpm2_nvextend_async(ectx, &ctx.auth_hierarchy.object,
+                    nv_index, next, ctx.aux_session_handle[0],
+                    ctx.aux_session_handle[1]);
+            has_next = rc == tool_rc_success;
+        }
+
+        TPM2B_MAX_NV_BUFFER *tmp = cur;
+        cur = next;
+        next = tmp;
+        has_cur = has_next;
+    }
+
+    return rc;
+}
+
+static tool_rc batch_run(ESYS_CONTEXT *ectx) {
+
+    /* a policy session would need satisfying again for every record */
+    if (ctx.auth_hierarchy.object.session && tpm2_session_get_type(
+            ctx.auth_hierarchy.object.session) == TPM2_SE_POLICY) {
+        LOG_ERR("A batch cannot satisfy a policy session for every record");
+        return tool_rc_option_error;
+    }
+
+    TPMI_ALG_HASH halg = TPM2_ALG_NULL;
+    TPM2B_DIGEST digest = { .size = 0 };
+    tool_rc rc = batch_initial_digest(ectx, &digest, &halg);
+    if (rc != tool_rc_success) {
+        return rc;
+    }
+
+    const EVP_MD *md = tpm2_openssl_halg_from_tpmhalg(halg);
+    if (!md) {
+        LOG_ERR("Algorithm 0x%x of NV index 0x%X not supported", halg,
+                ctx.nv_index);
+        return tool_rc_general_error;
+    }
+
+    ESYS_TR nv_index = ESYS_TR_NONE;
+    rc = tpm2_from_tpm_public(ectx, ctx.nv_index, ESYS_TR_NONE, ESYS_TR_NONE,
+            ESYS_TR_NONE, &nv_index);
+    if (rc != tool_rc_success) {
+        return rc;
+    }
+
+    FILE *input = ctx.input_path ? files_fopen(ctx.input_path, "rb") : stdin;
+    if (!input) {
+        LOG_ERR("Could not open file \"%s\", error: %s", ctx.input_path,
+                strerror(errno));
+        tpm2_close(ectx, &nv_index);
+        return tool_rc_general_error;
+    }
+
+    EVP_MD_CTX *mdctx = tpm2_openssl_md_ctx_get();
+    size_t count = 0;
+    rc = mdctx ? batch_extend(ectx, nv_index, input, mdctx, md, &digest,
+            &count) : tool_rc_general_error;
+    tpm2_openssl_md_ctx_put(mdctx);
+
+    if (input != stdin) {
+        fclose(input);
+    }
+
+    tool_rc tmp_rc = tpm2_close(ectx, &nv_index);
+    if (rc == tool_rc_success) {
+        rc = tmp_rc;
+    }
+
+    tpm2_tool_output("records: %zu\n", count);
+    tpm2_tool_output("digest: ");
+    tpm2_util_hexdump(digest.buffer, digest.size);
+    tpm2_tool_output("\n");
+
+    if (rc != tool_rc_success) {
+        return rc;
+    }
+
+    /* one read checks the value all the records chained to */
+    TPM2B_DIGEST value = { .size = 0 };
+    rc = batch_read_digest(ectx, &value);
+    if (rc != tool_rc_success) {
+        return rc;
+    }
+
+    bool is_verified = value.size == digest.size
+            && !memcmp(value.buffer, digest.buffer, digest.size);
+    tpm2_tool_output("verified: %s\n", is_verified ? "true" : "false");
+    if (!is_verified) {
+        LOG_ERR("NV index 0x%X does not hold the digest of the records",
+                ctx.nv_index);
+        return tool_rc_general_error;
+    }
+
+    return tool_rc_success;
+}
+
 static tool_rc check_options(void) {
 
     if (!ctx.input_path) {
@@ -174,6 +422,11 @@ static tool_rc check_options(void) {
         return tool_rc_general_error;
     }
 
+    if (ctx.is_batch && (ctx.cp_hash_path || ctx.rp_hash_path)) {
+        LOG_ERR("Cannot calculate a cpHash or rpHash of a batch");
+        return tool_rc_option_error;
+    }
+
     return tool_rc_success;
 }
 
@@ -196,6 +449,9 @@ static bool on_option(char key, char *value) {
     case 1:
         ctx.rp_hash_path = value;
         break;
+    case 2:
+        ctx.is_batch = true;
+        break;
     case 'S':
         ctx.aux_session_path[ctx.aux_session_cnt] = value;
         if (ctx.aux_session_cnt < MAX_AUX_SESSIONS) {
@@ -229,6 +485,7 @@ static bool tpm2_tool_onstart(tpm2_options **opts) {
         { "cphash",    required_argument, NULL,  0  },
         { "rphash",    required_argument, NULL,  1  },
         { "session",   required_argument, NULL, 'S' },
+        { "batch",     no_argument,       NULL,  2  },
     };
 
     *opts = tpm2_options_new("S:C:P:i:", ARRAY_LEN(topts), topts, on_option,
@@ -257,6 +514,10 @@ static tool_rc tpm2_tool_onrun(ESYS_CONTEXT *ectx, tpm2_option_flags flags) {
         return rc;
     }
 
+    if (ctx.is_batch) {
+        return batch_run(ectx);
+    }
+
     /*
      * 3. TPM2_CC_<command> call
      */
@@ -1,11 +1,32 @@
 /* SPDX-License-Identifier: BSD-3-Clause */
 
+#include <errno.h>
+#include <inttypes.h>
+#include <poll.h>
+#include <signal.h>
 #include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
 
 #include "files.h"
 #include "tpm2_nv_util.h"
 #include "tpm2_tool.h"
 
+#define BATCH_INTERVAL_DEFAULT 1
+#define BATCH_LINE_MAX 64
+
+/*
+ * A counter incremented in batch mode, resolved and authorized once. With
+ * the index authorizing itself, object is its authorization too.
+ */
+typedef struct nvincrement_counter nvincrement_counter;
+struct nvincrement_counter {
+    TPM2_HANDLE nv_index;
+    tpm2_loaded_object object;
+    UINT64 pending;
+};
+
 typedef struct tpm_nvincrement_ctx tpm_nvincrement_ctx;
 struct tpm_nvincrement_ctx {
     struct {
@@ -15,21 +36,282 @@ struct tpm_nvincrement_ctx {
     } auth_hierarchy;
 
     TPM2_HANDLE nv_index;
+    const char *nv_index_str;
+    bool is_index_auth;
 
     char *cp_hash_path;
+
+    bool is_batch;
+    bool is_coalesce;
+    UINT32 interval;
+    nvincrement_counter *counters;
+    size_t counter_count;
 };
 static tpm_nvincrement_ctx ctx;
 
+static volatile sig_atomic_t is_batch_stopped;
+
 static bool on_arg(int argc, char **argv) {
     /* If the user doesn't specify an authorization hierarchy use the index
      * passed to -x/--index for the authorization index.
      */
     if (!ctx.auth_hierarchy.ctx_path) {
         ctx.auth_hierarchy.ctx_path = argv[0];
+        ctx.is_index_auth = true;
     }
+    ctx.nv_index_str = argv[0];
     return on_arg_nv_index(argc, argv, &ctx.nv_index);
 }
 
+static void on_batch_signal(int signum) {
+
+    UNUSED(signum);
+    is_batch_stopped = 1;
+}
+
+static bool is_policy_session(tpm2_session *s) {
+
+    return s && tpm2_session_get_type(s) == TPM2_SE_POLICY;
+}
+
+/*
+ * Returns the counter of an index, resolving it and, when it authorizes
+ * itself, setting up its authorization the first time the index is named.
+ */
+static nvincrement_counter *batch_counter(ESYS_CONTEXT *ectx,
+        const char *index_str) {
+
+    TPM2_HANDLE nv_index = 0;
+    bool result = tpm2_util_handle_from_optarg(index_str, &nv_index,
+            TPM2_HANDLE_FLAGS_NV);
+    if (!result || !nv_index) {
+        LOG_ERR("Could not convert NV index to number, got: \"%s\"",
+                index_str);
+        return NULL;
+    }
+
+    size_t i;
+    for (i = 0; i < ctx.counter_count; i++) {
+        if (ctx.counters[i].nv_index == nv_index) {
+            return &ctx.counters[i];
+        }
+    }
+
+    nvincrement_counter *counters = realloc(ctx.counters,
+            (ctx.counter_count + 1) * sizeof(*counters));
+    if (!counters) {
+        LOG_ERR("oom");
+        return NULL;
+    }
+    ctx.counters = counters;
+
+    nvincrement_counter *counter = &ctx.counters[ctx.counter_count];
+    memset(counter, 0, sizeof(*counter));
+    counter->nv_index = nv_index;
+    counter->object.tr_handle = ESYS_TR_NONE;
+
+    tool_rc rc = ctx.is_index_auth ?
+            tpm2_util_object_load_auth(ectx, index_str,
+                    ctx.auth_hierarchy.auth_str, &counter->object, false,
+                    TPM2_HANDLE_FLAGS_NV) :
+            tpm2_util_object_load(ectx, index_str, &counter->object,
+                    TPM2_HANDLE_FLAGS_NV);
+    if (rc != tool_rc_success) {
+        LOG_ERR("Invalid NV index \"%s\"", index_str);
+        return NULL;
+    }
+
+    if (is_policy_session(counter->object.session)) {
+        LOG_ERR("A batch cannot satisfy a policy session for every "
+                "increment");
+        tpm2_session_close(&counter->object.session);
+        return NULL;
+    }
+
+    ctx.counter_count++;
+
+    return counter;
+}
+
+/*
+ * Sends the pending increments, one per event or, coalescing, one per
+ * counter with any event since the last flush.
+ */
+static tool_rc batch_flush(ESYS_CONTEXT *ectx) {
+
+    tool_rc rc = tool_rc_success;
+    size_t i;
+    for (i = 0; i < ctx.counter_count; i++) {
+        nvincrement_counter *counter = &ctx.counters[i];
+        if (!counter->pending) {
+            continue;
+        }
+
+        tpm2_loaded_object *auth = ctx.is_index_auth ?
+                &counter->object : &ctx.auth_hierarchy.object;
+        UINT64 increments = ctx.is_coalesce ? 1 : counter->pending;
+        UINT64 sent;
+        for (sent = 0; sent < increments; sent++) {
+            rc = tpm2_nv_increment_tr(ectx, auth, counter->object.tr_handle);
+            if (rc != tool_rc_success) {
+                LOG_ERR("Failed to increment NV counter at index 0x%X",
+                        counter->nv_index);
+                break;
+            }
+        }
+
+        tpm2_tool_output("- nv-index: 0x%X\n", counter->nv_index);
+        tpm2_tool_output("  events: %" PRIu64 "\n", counter->pending);
+        tpm2_tool_output("  increments: %" PRIu64 "\n", sent);
+        tpm2_tool_output_flush();
+
+        counter->pending = 0;
+        if (rc != tool_rc_success) {
+            break;
+        }
+    }
+
+    return rc;
+}
+
+/* a line is an event of the index it names, or of the index argument */
+static bool batch_event(ESYS_CONTEXT *ectx, char *line) {
+
+    char *saveptr = NULL;
+    char *index_str = strtok_r(line, " \t\r", &saveptr);
+    if (!index_str) {
+        index_str = (char *) ctx.nv_index_str;
+        if (!index_str) {
+            LOG_ERR("An empty line needs the NV index argument");
+            return false;
+        }
+    }
+
+    nvincrement_counter *counter = batch_counter(ectx, index_str);
+    if (!counter) {
+        return false;
+    }
+
+    counter->pending++;
+
+    return true;
+}
+
+static int64_t now_ms(void) {
+
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (int64_t) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/*
+ * Reads events from stdin, one per line, and sends the increments pending
+ * every interval, at the end of the input and on SIGINT or SIGTERM, with one
+ * ESAPI context and the same sessions throughout.
+ */
+static tool_rc batch_run(ESYS_CONTEXT *ectx) {
+
+    if (!ctx.is_index_auth) {
+        tool_rc rc = tpm2_util_object_load_auth(ectx,
+                ctx.auth_hierarchy.ctx_path, ctx.auth_hierarchy.auth_str,
+                &ctx.auth_hierarchy.object, false,
+                TPM2_HANDLE_FLAGS_NV | TPM2_HANDLE_FLAGS_O
+                | TPM2_HANDLE_FLAGS_P);
+        if (rc != tool_rc_success) {
+            LOG_ERR("Invalid handle authorization");
+            return rc;
+        }
+
+        if (is_policy_session(ctx.auth_hierarchy.object.session)) {
+            LOG_ERR("A batch cannot satisfy a policy session for every "
+                    "increment");
+            return tool_rc_option_error;
+        }
+    }
+
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = on_batch_signal;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+
+    UINT32 interval = ctx.interval ? ctx.interval : BATCH_INTERVAL_DEFAULT;
+    int64_t interval_ms = (int64_t) interval * 1000;
+    int64_t flush_ms = now_ms() + interval_ms;
+
+    char line[BATCH_LINE_MAX];
+    size_t line_size = 0;
+    bool is_eof = false;
+    tool_rc rc = tool_rc_success;
+    while (!is_eof && !is_batch_stopped && rc == tool_rc_success) {
+
+        int64_t timeout = flush_ms - now_ms();
+        struct pollfd fd = { .fd = STDIN_FILENO, .events = POLLIN };
+        int ready = timeout > 0 ? poll(&fd, 1, timeout > INT32_MAX ?
+                INT32_MAX : (int) timeout) : 0;
+        if (ready < 0 && errno != EINTR) {
+            LOG_ERR("Could not poll stdin, error: %s", strerror(errno));
+            rc = tool_rc_general_error;
+            break;
+        }
+
+        if (ready > 0) {
+            char buffer[BUFSIZ];
+            ssize_t size = read(STDIN_FILENO, buffer, sizeof(buffer));
+            if (size < 0 && errno != EINTR) {
+                LOG_ERR("Could not read stdin, error: %s", strerror(errno));
+                rc = tool_rc_general_error;
+                break;
+            }
+            is_eof = !size;
+
+            ssize_t i;
+            for (i = 0; i < size; i++) {
+                if (buffer[i] != '\n') {
+                    if (line_size == sizeof(line) - 1) {
+                        LOG_ERR("An event line exceeds %d bytes",
+                                BATCH_LINE_MAX - 1);
+                        rc = tool_rc_general_error;
+                        break;
+                    }
+                    line[line_size++] = buffer[i];
+                    continue;
+                }
+
+                line[line_size] = '\0';
+                line_size = 0;
+                if (!batch_event(ectx, line)) {
+                    rc = tool_rc_general_error;
+                    break;
+                }
+            }
+        }
+
+        if (now_ms() >= flush_ms) {
+            tool_rc tmp_rc = batch_flush(ectx);
+            if (rc == tool_rc_success) {
+                rc = tmp_rc;
+            }
+            flush_ms = now_ms() + interval_ms;
+        }
+    }
+
+    /* the last line may miss its new line */
+    if (is_eof && line_size && rc == tool_rc_success) {
+        line[line_size] = '\0';
+        if (!batch_event(ectx, line)) {
+            rc = tool_rc_general_error;
+        }
+    }
+
+    /* the events received are not lost when the batch ends */
+    tool_rc tmp_rc = batch_flush(ectx);
+
+    return rc != tool_rc_success ? rc : tmp_rc;
+}
+
 static bool on_option(char key, char *value) {
 
     switch (key) {
@@ -42,6 +324,19 @@ static bool on_option(char key, char *value) {
     case 0:
         ctx.cp_hash_path = value;
         break;
+    case 1:
+        ctx.is_batch = true;
+        break;
+    case 2:
+        ctx.is_coalesce = true;
+        break;
+    case 3:
+        if (!tpm2_util_string_to_uint32(value, &ctx.interval)
+                || !ctx.interval) {
+            LOG_ERR("Invalid interval in seconds, got: \"%s\"", value);
+            return false;
+        }
+        break;
     }
 
     return true;
@@ -53,6 +348,9 @@ static bool tpm2_tool_onstart(tpm2_options **opts) {
         { "hierarchy", required_argument, NULL, 'C' },
         { "auth",      required_argument, NULL, 'P' },
         { "cphash",    required_argument, NULL,  0  },
+        { "batch",     no_argument,       NULL,  1  },
+        { "coalesce",  no_argument,       NULL,  2  },
+        { "interval",  required_argument, NULL,  3  },
     };
 
     *opts = tpm2_options_new("C:P:", ARRAY_LEN(topts), topts, on_option, on_arg,
@@ -65,6 +363,27 @@ static tool_rc tpm2_tool_onrun(ESYS_CONTEXT *ectx, tpm2_option_flags flags) {
 
     UNUSED(flags);
 
+    if (!ctx.is_batch && (ctx.is_coalesce || ctx.interval)) {
+        LOG_ERR("--coalesce and --interval require --batch");
+        return tool_rc_option_error;
+    }
+
+    if (ctx.is_batch) {
+        if (ctx.cp_hash_path) {
+            LOG_ERR("Cannot calculate a cpHash in batch mode");
+            return tool_rc_option_error;
+        }
+        if (!ctx.auth_hierarchy.ctx_path) {
+            ctx.is_index_auth = true;
+        }
+        return batch_run(ectx);
+    }
+
+    if (!ctx.nv_index) {
+        LOG_ERR("Specify at least a single value for NV Index");
+        return tool_rc_option_error;
+    }
+
     tool_rc rc = tpm2_util_object_load_auth(ectx, ctx.auth_hierarchy.ctx_path,
             ctx.auth_hierarchy.auth_str, &ctx.auth_hierarchy.object, false,
             TPM2_HANDLE_FLAGS_NV | TPM2_HANDLE_FLAGS_O | TPM2_HANDLE_FLAGS_P);
@@ -98,10 +417,24 @@ static tool_rc tpm2_tool_onrun(ESYS_CONTEXT *ectx, tpm2_option_flags flags) {
 
 static tool_rc tpm2_tool_onstop(ESYS_CONTEXT *ectx) {
     UNUSED(ectx);
+
+    tool_rc rc = tool_rc_success;
+    size_t i;
+    for (i = 0; i < ctx.counter_count; i++) {
+        tool_rc tmp_rc = tpm2_session_close(&ctx.counters[i].object.session);
+        if (tmp_rc != tool_rc_success) {
+            rc = tmp_rc;
+        }
+    }
+    free(ctx.counters);
+
     if (!ctx.cp_hash_path) {
-        return tpm2_session_close(&ctx.auth_hierarchy.object.session);
+        tool_rc tmp_rc = tpm2_session_close(&ctx.auth_hierarchy.object.session);
+        if (tmp_rc != tool_rc_success) {
+            rc = tmp_rc;
+        }
     }
-    return tool_rc_success;
+    return rc;
 }
 
 // Register this tool with tpm2_tool.c
@@ -1,13 +1,24 @@
 /* SPDX-License-Identifier: BSD-3-Clause */
 
 #include <stdlib.h>
+#include <string.h>
 
 #include "files.h"
+#include "tpm2_nv_bits.h"
 #include "tpm2_tool.h"
 #include "tpm2_nv_util.h"
 #include "tpm2_options.h"
 
 #define MAX_SESSIONS 3
+
+/* a range of --range and the file it is written to, stdout if NULL */
+typedef struct nv_range nv_range;
+struct nv_range {
+    UINT16 offset;
+    UINT16 size;
+    const char *path;
+};
+
 typedef struct tpm_nvread_ctx tpm_nvread_ctx;
 struct tpm_nvread_ctx {
     /*
@@ -22,6 +33,9 @@ struct tpm_nvread_ctx {
     TPM2_HANDLE nv_index;
     UINT32 size_to_read;
     UINT32 offset;
+    bool is_shadow;
+    nv_range *ranges;
+    size_t range_count;
 
     /*
      * Outputs
@@ -50,6 +64,296 @@ static tool_rc nv_read(ESYS_CONTEXT *ectx) {
         &ctx.bytes_written, &ctx.cp_hash, ctx.parameter_hash_algorithm);
 }
 
+/*
+ * Answers the read of a bit field index from the shadow of tpm2_serve, which
+ * includes the bits deferred by tpm2_nvsetbits.
+ */
+static bool nv_read_shadow(void) {
+
+    UINT64 value;
+    if (!tpm2_nv_bits_read(ctx.nv_index, &value)) {
+        return false;
+    }
+
+    ctx.data_buffer = malloc(sizeof(value));
+    if (!ctx.data_buffer) {
+        LOG_ERR("oom");
+        return false;
+    }
+
+    value = tpm2_util_hton_64(value);
+    memcpy(ctx.data_buffer, &value, sizeof(value));
+    ctx.bytes_written = sizeof(value);
+    ctx.is_command_dispatch = true;
+
+    return true;
+}
+
+/* makes the value read from the TPM the shadow of the index */
+static tool_rc nv_update_shadow(void) {
+
+    UINT64 value;
+    if (ctx.bytes_written != sizeof(value)) {
+        LOG_ERR("Option --shadow expects a bit field index");
+        return tool_rc_general_error;
+    }
+
+    memcpy(&value, ctx.data_buffer, sizeof(value));
+    value = tpm2_util_ntoh_64(value);
+    if (!tpm2_nv_bits_shadow(ctx.nv_index, &value)) {
+        return tool_rc_general_error;
+    }
+
+    value = tpm2_util_hton_64(value);
+    memcpy(ctx.data_buffer, &value, sizeof(value));
+
+    return tool_rc_success;
+}
+
+/*
+ * The ranges merged into the spans read from the index, each read in chunks
+ * by one pipeline over all spans, into a buffer of the size of the index.
+ */
+typedef struct nv_span nv_span;
+struct nv_span {
+    UINT16 offset;
+    UINT16 size;
+};
+
+typedef struct nv_ranges_read nv_ranges_read;
+struct nv_ranges_read {
+    tpm2_nv_transfer transfer;
+    nv_span *spans;
+    size_t span_count;
+    size_t next;
+    UINT16 requested;
+    /* the chunk at the TPM and the one whose response is in */
+    UINT16 sent_offset;
+    UINT16 sent_size;
+    UINT16 received_offset;
+    BYTE *data;
+    TPM2B_MAX_NV_BUFFER *nv_data;
+};
+
+static UINT32 nv_chunks(UINT32 size, UINT16 max_chunk_size) {
+
+    return (size + max_chunk_size - 1) / max_chunk_size;
+}
+
+static int nv_span_compare(const void *a, const void *b) {
+
+    const nv_span *x = (const nv_span *) a;
+    const nv_span *y = (const nv_span *) b;
+
+    return x->offset < y->offset ? -1 : x->offset > y->offset;
+}
+
+/*
+ * Merges the ranges into the fewest spans to read: overlapping and adjacent
+ * ranges, and those close enough that reading the gap between them takes no
+ * more NV_Read commands than reading them apart.
+ */
+static size_t nv_ranges_merge(nv_span *spans, UINT16 max_chunk_size) {
+
+    size_t count = 0;
+    size_t i;
+    for (i = 0; i < ctx.range_count; i++) {
+        spans[i].offset = ctx.ranges[i].offset;
+        spans[i].size = ctx.ranges[i].size;
+    }
+    qsort(spans, ctx.range_count, sizeof(*spans), nv_span_compare);
+
+    for (i = 0; i < ctx.range_count; i++) {
+        nv_span *last = count ? &spans[count - 1] : NULL;
+        UINT32 end = (UINT32) spans[i].offset + spans[i].size;
+        if (last) {
+            UINT32 last_end = (UINT32) last->offset + last->size;
+            UINT32 merged = (end > last_end ? end : last_end) - last->offset;
+            bool is_merged = spans[i].offset <= last_end
+                    || nv_chunks(merged, max_chunk_size)
+                            <= nv_chunks(last->size, max_chunk_size)
+                                    + nv_chunks(spans[i].size, max_chunk_size);
+            if (is_merged) {
+                last->size = merged;
+                continue;
+            }
+        }
+        spans[count++] = spans[i];
+    }
+
+    return count;
+}
+
+static tool_rc nv_ranges_prepare(void *userdata, bool *is_next) {
+
+    nv_ranges_read *read = (nv_ranges_read *) userdata;
+
+    while (read->next < read->span_count
+            && read->requested == read->spans[read->next].size) {
+        read->next++;
+        read->requested = 0;
+    }
+
+    *is_next = read->next < read->span_count;
+
+    return tool_rc_success;
+}
+
+static tool_rc nv_ranges_submit(ESYS_CONTEXT *ectx, void *userdata) {
+
+    nv_ranges_read *read = (nv_ranges_read *) userdata;
+    const nv_span *span = &read->spans[read->next];
+
+    UINT16 left = span->size - read->requested;
+    read->sent_size = left > read->transfer.max_chunk_size ?
+            read->transfer.max_chunk_size : left;
+    read->sent_offset = span->offset + read->requested;
+
+    tool_rc rc = tpm2_nv_read_async(ectx, read->transfer.auth_handle,
+            read->transfer.nv_handle, read->transfer.shandle,
+            read->sent_size, read->sent_offset);
+    if (rc == tool_rc_success) {
+        read->requested += read->sent_size;
+    }
+
+    return rc;
+}
+
+static tool_rc nv_ranges_finish(ESYS_CONTEXT *ectx, void *userdata) {
+
+    nv_ranges_read *read = (nv_ranges_read *) userdata;
+
+    /* the response of the chunk is completed after the next one is sent */
+    read->received_offset = read->sent_offset;
+
+    tool_rc rc = tpm2_nv_read_finish(ectx, &read->nv_data);
+    if (rc != tool_rc_success) {
+        return rc;
+    }
+
+    if (read->nv_data->size != read->sent_size) {
+        LOG_ERR("TPM returned %u bytes of NVRAM, expected %u",
+                read->nv_data->size, read->sent_size);
+        free(read->nv_data);
+        read->nv_data = NULL;
+        return tool_rc_general_error;
+    }
+
+    return tool_rc_success;
+}
+
+static tool_rc nv_ranges_complete(void *userdata) {
+
+    nv_ranges_read *read = (nv_ranges_read *) userdata;
+
+    memcpy(read->data + read->received_offset, read->nv_data->buffer,
+            read->nv_data->size);
+
+    free(read->nv_data);
+    read->nv_data = NULL;
+
+    return tool_rc_success;
+}
+
+static void nv_ranges_discard(void *userdata) {
+
+    nv_ranges_read *read = (nv_ranges_read *) userdata;
+
+    free(read->nv_data);
+    read->nv_data = NULL;
+}
+
+/*
+ * Reads all ranges of --range with the public area of the index read once
+ * and one pipeline of NV_Read commands over the merged spans.
+ */
+static tool_rc nv_read_ranges(ESYS_CONTEXT *ectx) {
+
+    TPM2B_NV_PUBLIC *nv_public = NULL;
+    tool_rc rc = tpm2_util_nv_read_public(ectx, ctx.nv_index, &nv_public);
+    if (rc != tool_rc_success) {
+        return rc;
+    }
+
+    UINT16 data_size = nv_public->nvPublic.dataSize;
+    free(nv_public);
+
+    size_t i;
+    for (i = 0; i < ctx.range_count; i++) {
+        const nv_range *range = &ctx.ranges[i];
+        if ((UINT32) range->offset + range->size > data_size) {
+            LOG_ERR("Range %u:%u is past the end of the index of %u bytes",
+                    range->offset, range->size, data_size);
+            return tool_rc_general_error;
+        }
+    }
+
+    nv_span *spans = calloc(ctx.range_count, sizeof(*spans));
+    ctx.data_buffer = malloc(data_size);
+    if (!spans || !ctx.data_buffer) {
+        LOG_ERR("oom");
+        free(spans);
+        return tool_rc_general_error;
+    }
+    ctx.bytes_written = data_size;
+
+    nv_ranges_read read = {
+        .spans = spans,
+        .data = ctx.data_buffer,
+    };
+
+    rc = tpm2_util_nv_transfer_start(ectx, ctx.nv_index,
+            &ctx.auth_hierarchy.object, &read.transfer);
+    if (rc != tool_rc_success) {
+        free(spans);
+        return rc;
+    }
+
+    read.span_count = nv_ranges_merge(spans, read.transfer.max_chunk_size);
+    LOG_INFO("Reading %zu ranges of NV index 0x%X as %zu spans",
+            ctx.range_count, ctx.nv_index, read.span_count);
+
+    static const tpm2_pipeline_ops ops = {
+        .prepare = nv_ranges_prepare,
+        .submit = nv_ranges_submit,
+        .finish = nv_ranges_finish,
+        .complete = nv_ranges_complete,
+        .discard = nv_ranges_discard,
+    };
+    rc = tpm2_pipeline_run(ectx, &ops, &read);
+
+    tool_rc tmp_rc = tpm2_util_nv_transfer_end(ectx, &read.transfer);
+    free(spans);
+    if (rc != tool_rc_success) {
+        LOG_ERR("Failed to read NVRAM area at index 0x%X", ctx.nv_index);
+        return rc;
+    }
+
+    return tmp_rc;
+}
+
+/* writes every range of --range to its file, in the order given */
+static tool_rc process_output_ranges(tpm2_option_flags flags) {
+
+    size_t i;
+    for (i = 0; i < ctx.range_count; i++) {
+        const nv_range *range = &ctx.ranges[i];
+        const BYTE *data = ctx.data_buffer + range->offset;
+        bool result = true;
+        if (range->path) {
+            result = files_save_bytes_to_file(range->path, data, range->size);
+        } else if (!flags.quiet) {
+            result = files_write_bytes(stdout, data, range->size);
+        }
+
+        if (!result) {
+            return tool_rc_general_error;
+        }
+    }
+
+    return tool_rc_success;
+}
+
 static tool_rc process_output(ESYS_CONTEXT *ectx, tpm2_option_flags flags) {
 
     UNUSED(ectx);
@@ -152,6 +456,35 @@ static tool_rc process_inputs(ESYS_CONTEXT *ectx) {
 
 static tool_rc check_options(void) {
 
+    if (ctx.range_count) {
+        if (ctx.is_shadow || ctx.cp_hash_path || ctx.output_file
+                || ctx.offset || ctx.size_to_read) {
+            LOG_ERR("Option --range names the ranges and outputs, it cannot "
+                    "be combined with --shadow, --cphash, -o, --offset or "
+                    "--size");
+            return tool_rc_option_error;
+        }
+
+        return tool_rc_success;
+    }
+
+    if (ctx.is_shadow) {
+        if (!tpm2_nv_bits_is_enabled()) {
+            LOG_ERR("Option --shadow needs tpm2_serve started with "
+                    "--nv-bits-interval");
+            return tool_rc_option_error;
+        }
+
+        if (ctx.cp_hash_path || ctx.offset
+                || (ctx.size_to_read && ctx.size_to_read != sizeof(UINT64))) {
+            LOG_ERR("Option --shadow reads the whole bit field index, it "
+                    "cannot be combined with --cphash, --offset or --size");
+            return tool_rc_option_error;
+        }
+
+        return tool_rc_success;
+    }
+
     if (!ctx.size_to_read) {
         LOG_WARN("Reading full size of the NV index");
     }
@@ -170,6 +503,48 @@ static bool on_arg(int argc, char **argv) {
     return on_arg_nv_index(argc, argv, &ctx.nv_index);
 }
 
+/* parses <offset>:<size>[:<file>] */
+static bool on_range(char *value) {
+
+    nv_range *ranges = realloc(ctx.ranges,
+            (ctx.range_count + 1) * sizeof(*ranges));
+    if (!ranges) {
+        LOG_ERR("oom");
+        return false;
+    }
+    ctx.ranges = ranges;
+
+    char *size_str = strchr(value, ':');
+    if (!size_str) {
+        LOG_ERR("Expected a range of <offset>:<size>[:<file>], got: \"%s\"",
+                value);
+        return false;
+    }
+    *size_str++ = '\0';
+
+    char *path = strchr(size_str, ':');
+    if (path) {
+        *path++ = '\0';
+    }
+
+    UINT16 offset;
+    UINT16 size;
+    bool result = tpm2_util_string_to_uint16(value, &offset)
+            && tpm2_util_string_to_uint16(size_str, &size);
+    if (!result || !size) {
+        LOG_ERR("Could not convert range to an offset and a non zero size, "
+                "got: \"%s:%s\"", value, size_str);
+        return false;
+    }
+
+    nv_range *range = &ctx.ranges[ctx.range_count++];
+    range->offset = offset;
+    range->size = size;
+    range->path = path && path[0] ? path : NULL;
+
+    return true;
+}
+
 static bool on_option(char key, char *value) {
 
     bool result;
@@ -202,6 +577,11 @@ static bool on_option(char key, char *value) {
     case 1:
         ctx.cp_hash_path = value;
         break;
+    case 2:
+        ctx.is_shadow = true;
+        break;
+    case 3:
+        return on_range(value);
         /* no default */
     }
     return true;
@@ -216,6 +596,8 @@ static bool tpm2_tool_onstart(tpm2_options **opts) {
         { "offset",    required_argument, NULL,  0  },
         { "cphash",    required_argument, NULL,  1  },
         { "auth",      required_argument, NULL, 'P' },
+        { "shadow",    no_argument,       NULL,  2  },
+        { "range",     required_argument, NULL,  3  },
     };
 
     *opts = tpm2_options_new("C:s:o:P:", ARRAY_LEN(topts), topts, on_option,
@@ -234,6 +616,10 @@ static tool_rc tpm2_tool_onrun(ESYS_CONTEXT *ectx, tpm2_option_flags flags) {
         return rc;
     }
 
+    if (ctx.is_shadow && nv_read_shadow()) {
+        return process_output(ectx, flags);
+    }
+
     /*
      * 2. Process inputs
      */
@@ -242,6 +628,11 @@ static tool_rc tpm2_tool_onrun(ESYS_CONTEXT *ectx, tpm2_option_flags flags) {
         return rc;
     }
 
+    if (ctx.range_count) {
+        rc = nv_read_ranges(ectx);
+        return rc != tool_rc_success ? rc : process_output_ranges(flags);
+    }
+
     /*
      * 3. TPM2_CC_<command> call
      */
@@ -250,6 +641,13 @@ static tool_rc tpm2_tool_onrun(ESYS_CONTEXT *ectx, tpm2_option_flags flags) {
         return rc;
     }
 
+    if (ctx.is_shadow) {
+        rc = nv_update_shadow();
+        if (rc != tool_rc_success) {
+            return rc;
+        }
+    }
+
     /*
      * 4. Process outputs
      */
@@ -265,6 +663,7 @@ static tool_rc tpm2_tool_onstop(ESYS_CONTEXT *ectx) {
     if (ctx.data_buffer) {
         free(ctx.data_buffer);
     }
+    free(ctx.ranges);
 
     /*
      * 2. Close authorization sessions
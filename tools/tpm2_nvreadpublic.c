@@ -4,25 +4,65 @@
 
 #include "tpm2_alg_util.h"
 #include "tpm2_attr_util.h"
+#include "tpm2_hex.h"
 #include "tpm2_nv_util.h"
 #include "tpm2_tool.h"
 
 typedef struct tpm2_nvreadpublic_ctx tpm2_nvreadpublic_ctx;
 struct tpm2_nvreadpublic_ctx {
     TPMI_RH_NV_INDEX nv_index;
+    bool is_data;
+    struct {
+        const char *ctx_path;
+        const char *auth_str;
+        tpm2_loaded_object object;
+    } auth_hierarchy;
 };
 
-static tpm2_nvreadpublic_ctx ctx;
+static tpm2_nvreadpublic_ctx ctx = {
+    .auth_hierarchy.ctx_path = "o",
+};
+
+/* reading with the hierarchy needs the index to allow it */
+static bool is_data_readable(const TPMS_NV_PUBLIC *nv_public) {
+
+    bool is_platform = ctx.auth_hierarchy.object.handle == TPM2_RH_PLATFORM;
+    TPMA_NV read_attribute = is_platform ? TPMA_NV_PPREAD : TPMA_NV_OWNERREAD;
+
+    return (nv_public->attributes & TPMA_NV_WRITTEN)
+            && !(nv_public->attributes & TPMA_NV_READLOCKED)
+            && (nv_public->attributes & read_attribute);
+}
 
-static tool_rc print_nv_public(ESYS_CONTEXT *context, TPMI_RH_NV_INDEX index, TPM2B_NV_PUBLIC *nv_public) {
+static tool_rc print_nv_data(ESYS_CONTEXT *context, TPMI_RH_NV_INDEX index,
+        const TPMS_NV_PUBLIC *nv_public) {
 
-    ESYS_TR tr_handle = ESYS_TR_NONE;
-    tool_rc rc = tpm2_tr_from_tpm_public(context, index,
-            &tr_handle);
-    if (rc != tool_rc_success) {
-        return rc;
+    if (!is_data_readable(nv_public)) {
+        return tool_rc_success;
     }
 
+    BYTE *data = malloc(nv_public->dataSize);
+    if (!data) {
+        LOG_ERR("oom");
+        return tool_rc_general_error;
+    }
+
+    tool_rc rc = tpm2_util_nv_read_data(context, index, nv_public->dataSize, 0,
+            &ctx.auth_hierarchy.object, data);
+    if (rc == tool_rc_success) {
+        tpm2_tool_output("  data: ");
+        tpm2_util_hexdump(data, nv_public->dataSize);
+        tpm2_tool_output("\n");
+    }
+
+    free(data);
+
+    return rc;
+}
+
+static tool_rc print_nv_public(TPMI_RH_NV_INDEX index,
+        const TPM2B_NV_PUBLIC *nv_public, const TPM2B_NAME *name) {
+
     tpm2_tool_output("0x%x:\n", index);
 
 
@@ -37,23 +77,10 @@ static tool_rc print_nv_public(ESYS_CONTEXT *context, TPMI_RH_NV_INDEX index, TP
         LOG_ERR("Could not convert algorithm to string form");
     }
 
-    TPM2B_NAME *name = NULL;
-    rc = tpm2_tr_get_name(context, tr_handle,
-            &name);
-    if (rc != tool_rc_success) {
-        free(attrs);
-        return rc;
-    }
-
     tpm2_tool_output("  name: ");
-    UINT16 i;
-    for (i = 0; i < name->size; i++) {
-        tpm2_tool_output("%02x", name->name[i]);
-    }
+    tpm2_hex_print(name->name, name->size, false);
     tpm2_tool_output("\n");
 
-    Esys_Free(name);
-
     tpm2_tool_output("  hash algorithm:\n");
     tpm2_tool_output("    friendly: %s\n", alg);
     tpm2_tool_output("    value: 0x%X\n", nv_public->nvPublic.nameAlg);
@@ -67,11 +94,8 @@ static tool_rc print_nv_public(ESYS_CONTEXT *context, TPMI_RH_NV_INDEX index, TP
 
     if (nv_public->nvPublic.authPolicy.size) {
         tpm2_tool_output("  authorization policy: ");
-
-        UINT16 i;
-        for (i = 0; i < nv_public->nvPublic.authPolicy.size; i++) {
-            tpm2_tool_output("%02X", nv_public->nvPublic.authPolicy.buffer[i]);
-        }
+        tpm2_hex_print(nv_public->nvPublic.authPolicy.buffer,
+                nv_public->nvPublic.authPolicy.size, true);
         tpm2_tool_output("\n");
     }
 
@@ -85,8 +109,10 @@ static tool_rc nv_readpublic(ESYS_CONTEXT *context) {
 
     TPMS_CAPABILITY_DATA *capability_data = NULL;
     if (ctx.nv_index == 0) {
-        tool_rc rc = tpm2_getcap(context, TPM2_CAP_HANDLES, TPM2_HT_NV_INDEX << 24,
-                TPM2_PT_NV_INDEX_MAX, NULL, &capability_data);
+        /* the indices are enumerated once, over as many calls as needed */
+        tool_rc rc = tpm2_capability_get(context, TPM2_CAP_HANDLES,
+                TPM2_HT_NV_INDEX << 24, TPM2_MAX_CAP_HANDLES,
+                &capability_data);
         if (rc != tool_rc_success) {
             return rc;
         }
@@ -103,16 +129,21 @@ static tool_rc nv_readpublic(ESYS_CONTEXT *context) {
     for (i = 0; i < capability_data->data.handles.count; i++) {
         TPMI_RH_NV_INDEX index = capability_data->data.handles.handle[i];
 
-        TPM2B_NV_PUBLIC *nv_public;
-        tool_rc rc = tpm2_util_nv_read_public(context, index, &nv_public);
+        /* one round trip per index, straight from its handle */
+        TPM2B_NV_PUBLIC nv_public;
+        TPM2B_NAME name;
+        tool_rc rc = tpm2_nv_readpublic_by_handle(context, index, &nv_public,
+                &name);
         if (rc != tool_rc_success) {
             LOG_ERR("Failed to read the public part of NV index 0x%X", index);
             free(capability_data);
             return rc;
         }
 
-        rc = print_nv_public(context, index, nv_public);
-        free(nv_public);
+        rc = print_nv_public(index, &nv_public, &name);
+        if (rc == tool_rc_success && ctx.is_data) {
+            rc = print_nv_data(context, index, &nv_public.nvPublic);
+        }
         tpm2_tool_output("\n");
         if (rc != tool_rc_success) {
             free(capability_data);
@@ -124,6 +155,23 @@ static tool_rc nv_readpublic(ESYS_CONTEXT *context) {
     return tool_rc_success;
 }
 
+static bool on_option(char key, char *value) {
+
+    switch (key) {
+    case 'C':
+        ctx.auth_hierarchy.ctx_path = value;
+        break;
+    case 'P':
+        ctx.auth_hierarchy.auth_str = value;
+        break;
+    case 0:
+        ctx.is_data = true;
+        break;
+    }
+
+    return true;
+}
+
 static bool on_arg(int argc, char **argv) {
 
     return on_arg_nv_index(argc, argv, &ctx.nv_index);
@@ -131,7 +179,13 @@ static bool on_arg(int argc, char **argv) {
 
 static bool tpm2_tool_onstart(tpm2_options **opts) {
 
-    *opts = tpm2_options_new(NULL, 0, NULL, NULL,
+    const struct option topts[] = {
+        { "hierarchy", required_argument, NULL, 'C' },
+        { "auth",      required_argument, NULL, 'P' },
+        { "data",      no_argument,       NULL,  0  },
+    };
+
+    *opts = tpm2_options_new("C:P:", ARRAY_LEN(topts), topts, on_option,
             on_arg, 0);
 
     return *opts != NULL;
@@ -141,8 +195,25 @@ static tool_rc tpm2_tool_onrun(ESYS_CONTEXT *context, tpm2_option_flags flags) {
 
     UNUSED(flags);
 
+    if (ctx.is_data) {
+        /* one authorization for the data of all indices */
+        tool_rc rc = tpm2_util_object_load_auth(context,
+                ctx.auth_hierarchy.ctx_path, ctx.auth_hierarchy.auth_str,
+                &ctx.auth_hierarchy.object, false,
+                TPM2_HANDLE_FLAGS_O | TPM2_HANDLE_FLAGS_P);
+        if (rc != tool_rc_success) {
+            LOG_ERR("Invalid handle authorization");
+            return rc;
+        }
+    }
+
     return nv_readpublic(context);
 }
 
+static tool_rc tpm2_tool_onstop(ESYS_CONTEXT *context) {
+    UNUSED(context);
+    return tpm2_session_close(&ctx.auth_hierarchy.object.session);
+}
+
 // Register this tool with tpm2_tool.c
-TPM2_TOOL_REGISTER("nvreadpublic", tpm2_tool_onstart, tpm2_tool_onrun, NULL, NULL)
+TPM2_TOOL_REGISTER("nvreadpublic", tpm2_tool_onstart, tpm2_tool_onrun, tpm2_tool_onstop, NULL)
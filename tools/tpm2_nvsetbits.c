@@ -1,9 +1,11 @@
 /* SPDX-License-Identifier: BSD-3-Clause */
 #include <stdlib.h>
+#include <string.h>
 
 #include "files.h"
 #include "log.h"
 #include "tpm2.h"
+#include "tpm2_nv_bits.h"
 #include "tpm2_tool.h"
 #include "tpm2_nv_util.h"
 #include "tpm2_options.h"
@@ -24,6 +26,8 @@ struct tpm_nvsetbits_ctx {
     const char *bit_string;
     UINT64 bits;
     TPM2_HANDLE nv_index;
+    bool is_deferred;
+    TPMI_RH_PROVISION defer_auth_handle;
 
     /*
      * Outputs
@@ -65,6 +69,39 @@ static tool_rc nvsetbits(ESYS_CONTEXT *ectx) {
 
 }
 
+/*
+ * Queues the bits with tpm2_serve instead of setting them, the daemon merges
+ * them with the other bits queued for the index into one NV_SetBits. The
+ * first request of an authorization is not queued but sent to the TPM, which
+ * checks the authorization.
+ */
+static tool_rc nvsetbits_defer(bool *is_queued) {
+
+    bool result = tpm2_util_string_to_uint64(ctx.bit_string, &ctx.bits);
+    if (!result) {
+        LOG_ERR("Could not convert option argument to number, got: \"%s\"",
+                ctx.bit_string);
+        return tool_rc_general_error;
+    }
+
+    TPMI_RH_PROVISION auth_handle = 0;
+    result = tpm2_util_handle_from_optarg(ctx.auth_hierarchy.ctx_path,
+            &auth_handle,
+            TPM2_HANDLE_FLAGS_NV | TPM2_HANDLE_FLAGS_O | TPM2_HANDLE_FLAGS_P);
+    bool is_nv = (auth_handle >> TPM2_HR_SHIFT) == TPM2_HT_NV_INDEX;
+    if (!result || (auth_handle != TPM2_RH_OWNER
+            && auth_handle != TPM2_RH_PLATFORM && !is_nv)) {
+        LOG_ERR("Invalid handle authorization");
+        return tool_rc_option_error;
+    }
+
+    ctx.defer_auth_handle = auth_handle;
+    result = tpm2_nv_bits_add(ctx.nv_index, auth_handle,
+            ctx.auth_hierarchy.auth_str, ctx.bits, is_queued);
+
+    return result ? tool_rc_success : tool_rc_general_error;
+}
+
 static tool_rc process_output(ESYS_CONTEXT *ectx) {
 
     UNUSED(ectx);
@@ -92,6 +129,17 @@ static tool_rc process_output(ESYS_CONTEXT *ectx) {
         is_file_op_success = files_save_digest(&ctx.rp_hash, ctx.rp_hash_path);
     }
 
+    /* keep the shadow of tpm2_serve in line with the index */
+    if (!tpm2_nv_bits_set(ctx.nv_index, ctx.bits)) {
+        is_file_op_success = false;
+    }
+
+    /* the TPM accepted the authorization, the next requests are queued */
+    if (ctx.is_deferred && !tpm2_nv_bits_verified(ctx.nv_index,
+            ctx.defer_auth_handle, ctx.auth_hierarchy.auth_str)) {
+        is_file_op_success = false;
+    }
+
     return is_file_op_success ? tool_rc_success : tool_rc_general_error;
 }
 
@@ -176,6 +224,31 @@ static tool_rc check_options(void) {
         return tool_rc_option_error;
     }
 
+    if (!ctx.is_deferred) {
+        return tool_rc_success;
+    }
+
+    if (!tpm2_nv_bits_is_enabled()) {
+        LOG_ERR("Option --defer needs tpm2_serve started with "
+                "--nv-bits-interval");
+        return tool_rc_option_error;
+    }
+
+    if (ctx.cp_hash_path || ctx.rp_hash_path || ctx.aux_session_cnt) {
+        LOG_ERR("Option --defer cannot be combined with --cphash, --rphash "
+                "or sessions");
+        return tool_rc_option_error;
+    }
+
+    /* the bits are set later by the daemon, from its own directory */
+    const char *auth_str = ctx.auth_hierarchy.auth_str;
+    if (auth_str && (!strncmp(auth_str, "session:", strlen("session:"))
+            || !strncmp(auth_str, "file:", strlen("file:"))
+            || !strncmp(auth_str, "pcr:", strlen("pcr:")))) {
+        LOG_ERR("Option --defer needs a password authorization");
+        return tool_rc_option_error;
+    }
+
     return tool_rc_success;
 }
 
@@ -207,6 +280,9 @@ static bool on_option(char key, char *value) {
     case 1:
         ctx.rp_hash_path = value;
         break;
+    case 2:
+        ctx.is_deferred = true;
+        break;
     case 'S':
         ctx.aux_session_path[ctx.aux_session_cnt] = value;
         if (ctx.aux_session_cnt < MAX_AUX_SESSIONS) {
@@ -230,6 +306,7 @@ static bool tpm2_tool_onstart(tpm2_options **opts) {
         { "cphash",    required_argument, NULL,  0  },
         { "rphash",    required_argument, NULL,  1  },
         { "session",   required_argument, NULL, 'S' },
+        { "defer",     no_argument,       NULL,  2  },
     };
 
     *opts = tpm2_options_new("C:P:i:S:", ARRAY_LEN(topts), topts, on_option,
@@ -250,6 +327,14 @@ static tool_rc tpm2_tool_onrun(ESYS_CONTEXT *ectx, tpm2_option_flags flags) {
         return rc;
     }
 
+    if (ctx.is_deferred) {
+        bool is_queued = false;
+        rc = nvsetbits_defer(&is_queued);
+        if (rc != tool_rc_success || is_queued) {
+            return rc;
+        }
+    }
+
     /*
      * 2. Process inputs
      */
@@ -1,10 +1,13 @@
 /* SPDX-License-Identifier: BSD-3-Clause */
 #include <stdlib.h>
+#include <string.h>
 
 #include "files.h"
 #include "log.h"
 #include "tpm2.h"
+#include "tpm2_nv_bits.h"
 #include "tpm2_tool.h"
+#include "tpm2_nv_layout.h"
 #include "tpm2_nv_util.h"
 #include "tpm2_options.h"
 
@@ -28,6 +31,8 @@ struct tpm_nvundefine_ctx {
     TPM2_HANDLE nv_index;
 
     char *cp_hash_path;
+
+    const char *layout_path;
 };
 
 static tpm_nvundefine_ctx ctx = {
@@ -51,6 +56,9 @@ static bool on_option(char key, char *value) {
     case 0:
         ctx.cp_hash_path = value;
         break;
+    case 1:
+        ctx.layout_path = value;
+        break;
     }
 
     return true;
@@ -68,6 +76,7 @@ static bool tpm2_tool_onstart(tpm2_options **opts) {
         { "auth",      required_argument, NULL, 'P' },
         { "session",   required_argument, NULL, 'S' },
         { "cphash",    required_argument, NULL,  0  },
+        { "layout",    required_argument, NULL,  1  },
     };
 
     *opts = tpm2_options_new("C:P:S:", ARRAY_LEN(topts), topts, on_option, on_arg,
@@ -76,10 +85,221 @@ static bool tpm2_tool_onstart(tpm2_options **opts) {
     return *opts != NULL;
 }
 
+typedef struct layout_index layout_index;
+struct layout_index {
+    tpm2_nv_layout_entry *entry;
+    ESYS_TR tr;
+    /* undefined, absent or failed, NULL while to be undefined */
+    const char *action;
+};
+
+typedef struct layout_undefine layout_undefine;
+struct layout_undefine {
+    tpm2_nv_layout layout;
+    layout_index *indices;
+    ESYS_TR shandle;
+    /* the next index to undefine and the one at the TPM */
+    size_t next;
+    layout_index *sent;
+};
+
+/*
+ * Resolves a defined index to be undefined. An index with
+ * TPMA_NV_POLICY_DELETE needs an admin policy session of its own and is left
+ * to tpm2_nvundefine with -S.
+ */
+static const char *layout_index_setup(ESYS_CONTEXT *ectx, layout_undefine *u,
+        layout_index *index) {
+
+    tpm2_nv_layout_entry *entry = index->entry;
+    if (!entry->is_defined) {
+        return "absent";
+    }
+
+    tool_rc rc = tpm2_from_tpm_public(ectx, entry->index, ESYS_TR_NONE,
+            ESYS_TR_NONE, ESYS_TR_NONE, &index->tr);
+    if (rc != tool_rc_success) {
+        return "failed";
+    }
+
+    TPM2B_NV_PUBLIC *nv_public = NULL;
+    rc = tpm2_nv_readpublic(ectx, index->tr, &nv_public, NULL);
+    if (rc != tool_rc_success) {
+        LOG_ERR("Failed to read the public part of NV index 0x%X",
+                entry->index);
+        return "failed";
+    }
+
+    bool has_policy_delete_set =
+            !!(nv_public->nvPublic.attributes & TPMA_NV_POLICY_DELETE);
+    Esys_Free(nv_public);
+
+    if (has_policy_delete_set) {
+        LOG_ERR("%s:%zu: NV index 0x%X has attribute TPMA_NV_POLICY_DELETE "
+                "set, undefine it with a policy session via \"-S\"",
+                u->layout.path, entry->line_number, entry->index);
+        return "failed";
+    }
+
+    return NULL;
+}
+
+static tool_rc layout_prepare(void *userdata, bool *is_next) {
+
+    layout_undefine *u = (layout_undefine *) userdata;
+
+    /* skips the indices that are not to be undefined */
+    while (u->next < u->layout.count && u->indices[u->next].action) {
+        u->next++;
+    }
+
+    *is_next = u->next < u->layout.count;
+
+    return tool_rc_success;
+}
+
+static tool_rc layout_submit(ESYS_CONTEXT *ectx, void *userdata) {
+
+    layout_undefine *u = (layout_undefine *) userdata;
+    layout_index *index = &u->indices[u->next];
+
+    tool_rc rc = tpm2_nvundefine_async(ectx,
+            ctx.auth_hierarchy.object.tr_handle, index->entry->index,
+            index->tr, u->shandle);
+    if (rc != tool_rc_success) {
+        return rc;
+    }
+
+    u->sent = index;
+    u->next++;
+
+    return tool_rc_success;
+}
+
+static tool_rc layout_finish(ESYS_CONTEXT *ectx, void *userdata) {
+
+    layout_undefine *u = (layout_undefine *) userdata;
+
+    /* an index that cannot be undefined fails its line, not the others */
+    tool_rc rc = tpm2_nvundefine_finish(ectx);
+    if (rc == tool_rc_success) {
+        /* released by ESAPI with the index */
+        u->sent->tr = ESYS_TR_NONE;
+        tpm2_nv_bits_drop(u->sent->entry->index);
+    }
+    u->sent->action = rc == tool_rc_success ? "undefined" : "failed";
+
+    return tool_rc_success;
+}
+
+static tool_rc layout_run(ESYS_CONTEXT *ectx) {
+
+    if (ctx.nv_index || ctx.policy_session.path || ctx.cp_hash_path) {
+        LOG_ERR("The layout lists the indices, cannot specify an NV index, "
+                "-S or --cphash");
+        return tool_rc_option_error;
+    }
+
+    /* the hierarchy and its session are shared by all the indices */
+    tool_rc rc = tpm2_util_object_load_auth(ectx, ctx.auth_hierarchy.ctx_path,
+            ctx.auth_hierarchy.auth_str, &ctx.auth_hierarchy.object, false,
+            TPM2_HANDLE_FLAGS_O | TPM2_HANDLE_FLAGS_P);
+    if (rc != tool_rc_success) {
+        LOG_ERR("Invalid handle authorization");
+        return rc;
+    }
+
+    layout_undefine u = {
+        .shandle = ESYS_TR_NONE,
+    };
+
+    rc = tpm2_auth_util_get_shandle(ectx, ctx.auth_hierarchy.object.tr_handle,
+            ctx.auth_hierarchy.object.session, &u.shandle);
+    if (rc != tool_rc_success) {
+        LOG_ERR("Failed to get shandle");
+        return rc;
+    }
+
+    if (!tpm2_nv_layout_load(ctx.layout_path, &u.layout)) {
+        tpm2_nv_layout_free(&u.layout);
+        return tool_rc_general_error;
+    }
+
+    u.indices = calloc(u.layout.count ? u.layout.count : 1,
+            sizeof(*u.indices));
+    if (!u.indices) {
+        LOG_ERR("oom");
+        tpm2_nv_layout_free(&u.layout);
+        return tool_rc_general_error;
+    }
+
+    size_t i;
+    for (i = 0; i < u.layout.count; i++) {
+        u.indices[i].entry = &u.layout.entries[i];
+        u.indices[i].tr = ESYS_TR_NONE;
+    }
+
+    rc = tpm2_nv_layout_get_defined(ectx, &u.layout);
+    if (rc != tool_rc_success) {
+        goto out;
+    }
+
+    for (i = 0; i < u.layout.count; i++) {
+        u.indices[i].action = layout_index_setup(ectx, &u, &u.indices[i]);
+    }
+
+    static const tpm2_pipeline_ops ops = {
+        .prepare = layout_prepare,
+        .submit = layout_submit,
+        .finish = layout_finish,
+    };
+
+    rc = tpm2_pipeline_run(ectx, &ops, &u);
+
+    for (i = 0; i < u.layout.count; i++) {
+        layout_index *index = &u.indices[i];
+        tpm2_nv_layout_entry *entry = index->entry;
+
+        /* not sent after the pipeline stopped */
+        if (!index->action) {
+            index->action = "failed";
+        }
+
+        tpm2_tool_output("- line: %zu\n", entry->line_number);
+        tpm2_tool_output("  nv-index: 0x%x\n", entry->index);
+        tpm2_tool_output("  action: %s\n", index->action);
+
+        if (!strcmp(index->action, "failed")) {
+            LOG_ERR("%s:%zu: Failed to release NV area at index 0x%X",
+                    ctx.layout_path, entry->line_number, entry->index);
+            rc = tool_rc_general_error;
+        }
+    }
+    tpm2_tool_output_flush();
+
+out:
+    for (i = 0; i < u.layout.count; i++) {
+        if (u.indices[i].tr != ESYS_TR_NONE) {
+            tool_rc tmp_rc = tpm2_close(ectx, &u.indices[i].tr);
+            if (tmp_rc != tool_rc_success) {
+                rc = tmp_rc;
+            }
+        }
+    }
+    free(u.indices);
+    tpm2_nv_layout_free(&u.layout);
+
+    return rc;
+}
+
 static tool_rc tpm2_tool_onrun(ESYS_CONTEXT *ectx, tpm2_option_flags flags) {
 
     UNUSED(flags);
 
+    if (ctx.layout_path) {
+        return layout_run(ectx);
+    }
+
     /*
      * Read the public portion of the NV index so we can ascertain if
      * TPMA_NV_POLICYDELETE is set. This determines which command to use
@@ -142,8 +362,9 @@ static tool_rc tpm2_tool_onrun(ESYS_CONTEXT *ectx, tpm2_option_flags flags) {
         }
 
         if (!ctx.cp_hash_path) {
-            return tpm2_nvundefinespecial(ectx, &ctx.auth_hierarchy.object,
+            rc = tpm2_nvundefinespecial(ectx, &ctx.auth_hierarchy.object,
                 ctx.nv_index, ctx.policy_session.session, NULL);
+            goto nvundefine_dispatched;
         }
 
         rc = tpm2_nvundefinespecial(ectx, &ctx.auth_hierarchy.object,
@@ -160,8 +381,9 @@ static tool_rc tpm2_tool_onrun(ESYS_CONTEXT *ectx, tpm2_option_flags flags) {
     }
 
     if (!ctx.cp_hash_path) {
-        return tpm2_nvundefine(ectx, &ctx.auth_hierarchy.object, ctx.nv_index,
+        rc = tpm2_nvundefine(ectx, &ctx.auth_hierarchy.object, ctx.nv_index,
             NULL);
+        goto nvundefine_dispatched;
     }
 
     rc = tpm2_nvundefine(ectx, &ctx.auth_hierarchy.object, ctx.nv_index,
@@ -176,6 +398,14 @@ nvundefine_out:
         rc = tool_rc_general_error;
     }
 
+    return rc;
+
+nvundefine_dispatched:
+    /* the bits tpm2_serve holds for the index went with it */
+    if (rc == tool_rc_success) {
+        tpm2_nv_bits_drop(ctx.nv_index);
+    }
+
     return rc;
 }
 
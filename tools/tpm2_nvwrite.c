@@ -19,11 +19,14 @@ struct tpm_nvwrite_ctx {
 
     TPM2_HANDLE nv_index;
 
-    BYTE nv_buffer[TPM2_MAX_NV_BUFFER_SIZE];
+    /* sized to the input, allocated when it is loaded */
+    BYTE *nv_buffer;
     FILE *input_file;
     UINT16 data_size;
     UINT16 offset;
     char *cp_hash_path;
+    bool is_diff;
+    bool is_written;
 };
 
 static tpm_nvwrite_ctx ctx = {
@@ -37,6 +40,11 @@ static bool is_input_options_args_valid(ESYS_CONTEXT *ectx) {
         return false;
     }
 
+    if (ctx.cp_hash_path && ctx.is_diff) {
+        LOG_ERR("Cannot calculate cpHash of a differential write");
+        return false;
+    }
+
     if (!ctx.data_size) {
         LOG_WARN("Data to write is of size 0");
     }
@@ -61,18 +69,18 @@ static bool is_input_options_args_valid(ESYS_CONTEXT *ectx) {
         free(nv_public);
         return false;
     }
+
+    ctx.is_written = nv_public->nvPublic.attributes & TPMA_NV_WRITTEN;
     free(nv_public);
     return true;
 }
 
 static tool_rc nv_write(ESYS_CONTEXT *ectx) {
 
-    TPM2B_MAX_NV_BUFFER nv_write_data;
-    UINT16 data_offset = 0;
-
     if (ctx.cp_hash_path) {
+        TPM2B_MAX_NV_BUFFER nv_write_data;
         nv_write_data.size = ctx.data_size;
-        memcpy(nv_write_data.buffer, &ctx.nv_buffer, ctx.data_size);
+        memcpy(nv_write_data.buffer, ctx.nv_buffer, ctx.data_size);
         LOG_WARN("Calculating cpHash. Exiting without performing write.");
         TPM2B_DIGEST cp_hash = { .size = 0 };
         tool_rc rc = tpm2_nvwrite(ectx, &ctx.auth_hierarchy.object, ctx.nv_index,
@@ -89,28 +97,49 @@ static tool_rc nv_write(ESYS_CONTEXT *ectx) {
         return rc;
     }
 
-    uint16_t max_data_size = tpm2_nv_util_max_allowed_nv_size(ectx, false);
-    while (ctx.data_size > 0) {
+    /* an index never written holds nothing to compare with */
+    if (!ctx.is_diff || !ctx.is_written || !ctx.data_size) {
+        return tpm2_util_nv_write(ectx, ctx.nv_index,
+                &ctx.auth_hierarchy.object, ctx.nv_buffer, NULL,
+                ctx.data_size, ctx.offset);
+    }
 
-        nv_write_data.size =
-                ctx.data_size > max_data_size ? max_data_size : ctx.data_size;
+    UINT8 *current = NULL;
+    TPM2B_DIGEST cp_hash = { .size = 0 };
+    tool_rc rc = tpm2_util_nv_read(ectx, ctx.nv_index, ctx.data_size,
+            ctx.offset, &ctx.auth_hierarchy.object, &current, NULL, &cp_hash,
+            TPM2_ALG_ERROR);
+    if (rc != tool_rc_success) {
+        LOG_ERR("Could not read the NV index to compare with, the "
+                "authorization must allow reading too");
+        return rc;
+    }
 
-        LOG_INFO("The data(size=%d) to be written:", nv_write_data.size);
+    rc = tpm2_util_nv_write(ectx, ctx.nv_index, &ctx.auth_hierarchy.object,
+            ctx.nv_buffer, current, ctx.data_size, ctx.offset);
+    free(current);
 
-        memcpy(nv_write_data.buffer, &ctx.nv_buffer[data_offset],
-                nv_write_data.size);
+    return rc;
+}
 
-        tool_rc rc = tpm2_nvwrite(ectx, &ctx.auth_hierarchy.object, ctx.nv_index,
-                &nv_write_data, ctx.offset + data_offset, NULL);
-        if (rc != tool_rc_success) {
-            return rc;
-        }
+static bool load_input(const char *input_file) {
+
+    /* a file is known not to need the worst case buffer */
+    unsigned long file_size = 0;
+    if (input_file && files_get_file_size_path(input_file, &file_size)
+            && file_size < ctx.data_size) {
+        ctx.data_size = file_size;
+    }
 
-        ctx.data_size -= nv_write_data.size;
-        data_offset += nv_write_data.size;
+    free(ctx.nv_buffer);
+    ctx.nv_buffer = malloc(ctx.data_size ? ctx.data_size : 1);
+    if (!ctx.nv_buffer) {
+        LOG_ERR("oom");
+        return false;
     }
 
-    return tool_rc_success;
+    return files_load_bytes_from_buffer_or_file_or_stdin(NULL, input_file,
+            &ctx.data_size, ctx.nv_buffer);
 }
 
 static bool on_option(char key, char *value) {
@@ -124,8 +153,7 @@ static bool on_option(char key, char *value) {
         break;
     case 'i':
         input_file = strcmp("-", value) ? value : NULL;
-        return files_load_bytes_from_buffer_or_file_or_stdin(NULL, input_file,
-                &ctx.data_size, ctx.nv_buffer);
+        return load_input(input_file);
         break;
     case 0:
         if (!tpm2_util_string_to_uint16(value, &ctx.offset)) {
@@ -136,6 +164,9 @@ static bool on_option(char key, char *value) {
     case 1:
         ctx.cp_hash_path = value;
         break;
+    case 2:
+        ctx.is_diff = true;
+        break;
     }
 
     return true;
@@ -159,6 +190,7 @@ static bool tpm2_tool_onstart(tpm2_options **opts) {
         { "input",                required_argument, NULL, 'i' },
         { "offset",               required_argument, NULL,  0  },
         { "cphash",               required_argument, NULL,  1  },
+        { "diff",                 no_argument,       NULL,  2  },
     };
 
     *opts = tpm2_options_new("C:P:i:", ARRAY_LEN(topts), topts, on_option,
@@ -176,6 +208,15 @@ static tool_rc tpm2_tool_onrun(ESYS_CONTEXT *ectx, tpm2_option_flags flags) {
         return tool_rc_option_error;
     }
 
+    /* without input, the index is written with zeros */
+    if (!ctx.nv_buffer) {
+        ctx.nv_buffer = calloc(1, ctx.data_size ? ctx.data_size : 1);
+        if (!ctx.nv_buffer) {
+            LOG_ERR("oom");
+            return tool_rc_general_error;
+        }
+    }
+
     tool_rc rc = tpm2_util_object_load_auth(ectx, ctx.auth_hierarchy.ctx_path,
             ctx.auth_hierarchy.auth_str, &ctx.auth_hierarchy.object, false,
             TPM2_HANDLE_FLAGS_NV | TPM2_HANDLE_FLAGS_O | TPM2_HANDLE_FLAGS_P);
@@ -192,5 +233,10 @@ static tool_rc tpm2_tool_onstop(ESYS_CONTEXT *ectx) {
     return tpm2_session_close(&ctx.auth_hierarchy.object.session);
 }
 
+static void tpm2_tool_onexit(void) {
+
+    free(ctx.nv_buffer);
+}
+
 // Register this tool with tpm2_tool.c
-TPM2_TOOL_REGISTER("nvwrite", tpm2_tool_onstart, tpm2_tool_onrun, tpm2_tool_onstop, NULL)
+TPM2_TOOL_REGISTER("nvwrite", tpm2_tool_onstart, tpm2_tool_onrun, tpm2_tool_onstop, tpm2_tool_onexit)
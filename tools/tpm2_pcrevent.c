@@ -7,12 +7,18 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include <openssl/evp.h>
+
 #include "files.h"
 #include "log.h"
+#include "pcr.h"
 #include "tpm2.h"
 #include "tpm2_alg_util.h"
 #include "tpm2_hierarchy.h"
+#include "tpm2_hex.h"
 #include "tpm2_auth_util.h"
+#include "tpm2_capability.h"
+#include "tpm2_openssl.h"
 #include "tpm2_tool.h"
 
 typedef struct tpm_pcrevent_ctx tpm_pcrevent_ctx;
@@ -23,6 +29,7 @@ struct tpm_pcrevent_ctx {
     } auth;
     ESYS_TR pcr;
     FILE *input;
+    bool is_host_hash;
 };
 
 static tpm_pcrevent_ctx ctx = {
@@ -73,12 +80,12 @@ static tool_rc tpm_pcrevent_file(ESYS_CONTEXT *ectx,
     bool use_left = !!res;
 
     TPM2B_MAX_BUFFER data;
+    UINT16 chunk_size = tpm2_capability_max_buffer_size(ectx);
 
     bool done = false;
     while (!done) {
 
-        size_t bytes_read = fread(data.buffer, 1,
-                BUFFER_SIZE(typeof(data), buffer), input);
+        size_t bytes_read = fread(data.buffer, 1, chunk_size, input);
         if (ferror(input)) {
             LOG_ERR("Error reading from input file");
             return tool_rc_general_error;
@@ -94,7 +101,7 @@ static tool_rc tpm_pcrevent_file(ESYS_CONTEXT *ectx,
 
         if (use_left) {
             left -= bytes_read;
-            if (left <= TPM2_MAX_DIGEST_BUFFER) {
+            if (left <= chunk_size) {
                 done = true;
                 continue;
             }
@@ -118,10 +125,137 @@ static tool_rc tpm_pcrevent_file(ESYS_CONTEXT *ectx,
             ctx.auth.session, &data, result);
 }
 
+/* large enough to amortize the calls, small enough to stay in the cache */
+#define HOST_HASH_CHUNK (1024 * 1024)
+
+/* the hash algorithms of the PCR banks with PCRs allocated */
+static tool_rc host_hash_banks(ESYS_CONTEXT *ectx, tpm2_algorithm *algs) {
+
+    TPMS_CAPABILITY_DATA cap_data;
+    tool_rc rc = pcr_get_banks(ectx, &cap_data, algs);
+    if (rc != tool_rc_success) {
+        return rc;
+    }
+
+    TPML_PCR_SELECTION *assigned = &cap_data.data.assignedPCR;
+    int count = 0;
+    UINT32 i;
+    for (i = 0; i < assigned->count; i++) {
+        TPMS_PCR_SELECTION *bank = &assigned->pcrSelections[i];
+        UINT8 j;
+        for (j = 0; j < bank->sizeofSelect && !bank->pcrSelect[j]; j++);
+        if (j < bank->sizeofSelect) {
+            algs->alg[count++] = bank->hash;
+        }
+    }
+    algs->count = count;
+
+    return tool_rc_success;
+}
+
+/*
+ * Hashes the input with the algorithm of every PCR bank in one pass, mapping
+ * the input when it is a file, and extends the PCR with the digests with a
+ * single TPM2_PCR_Extend. This replaces the event sequence of the TPM, which
+ * receives the input a TPM2B_MAX_BUFFER at a time.
+ */
+static tool_rc host_pcrevent_file(ESYS_CONTEXT *ectx,
+        TPML_DIGEST_VALUES **result) {
+
+    tpm2_algorithm algs;
+    tool_rc rc = host_hash_banks(ectx, &algs);
+    if (rc != tool_rc_success) {
+        return rc;
+    }
+
+    if (!algs.count) {
+        LOG_ERR("The TPM has no PCR bank allocated");
+        return tool_rc_general_error;
+    }
+
+    TPML_DIGEST_VALUES *digests = calloc(1, sizeof(*digests));
+    if (!digests) {
+        LOG_ERR("oom");
+        return tool_rc_general_error;
+    }
+
+    EVP_MD_CTX *mdctx[TPM2_NUM_PCR_BANKS] = { 0 };
+    files_input input;
+    files_input_open_file(&input, ctx.input);
+
+    rc = tool_rc_general_error;
+    int i;
+    for (i = 0; i < algs.count; i++) {
+        const EVP_MD *md = tpm2_openssl_halg_from_tpmhalg(algs.alg[i]);
+        if (!md) {
+            LOG_ERR("Algorithm of PCR bank not supported on the host, got: "
+                    "%s", tpm2_alg_util_algtostr(algs.alg[i],
+                    tpm2_alg_util_flags_hash));
+            goto out;
+        }
+
+        mdctx[i] = tpm2_openssl_md_ctx_get();
+        if (!mdctx[i] || !EVP_DigestInit_ex(mdctx[i], md, NULL)) {
+            LOG_ERR("%s", tpm2_openssl_get_err());
+            goto out;
+        }
+    }
+
+    /* every bank hashes a chunk before the next one is read */
+    for (;;) {
+        const UINT8 *data = NULL;
+        size_t size = 0;
+        if (!files_input_next(&input, HOST_HASH_CHUNK, &data, &size)) {
+            goto out;
+        }
+
+        if (!size) {
+            break;
+        }
+
+        for (i = 0; i < algs.count; i++) {
+            if (!EVP_DigestUpdate(mdctx[i], data, size)) {
+                LOG_ERR("%s", tpm2_openssl_get_err());
+                goto out;
+            }
+        }
+    }
+
+    for (i = 0; i < algs.count; i++) {
+        TPMT_HA *d = &digests->digests[i];
+        d->hashAlg = algs.alg[i];
+        if (!EVP_DigestFinal_ex(mdctx[i], (unsigned char *)&d->digest,
+                NULL)) {
+            LOG_ERR("%s", tpm2_openssl_get_err());
+            goto out;
+        }
+    }
+    digests->count = algs.count;
+
+    rc = ctx.pcr == ESYS_TR_RH_NULL ? tool_rc_success :
+            tpm2_pcr_extend(ectx, ctx.pcr, ctx.auth.session, digests);
+
+out:
+    for (i = 0; i < algs.count; i++) {
+        tpm2_openssl_md_ctx_put(mdctx[i]);
+    }
+    files_input_close(&input);
+
+    if (rc != tool_rc_success) {
+        free(digests);
+        return rc;
+    }
+
+    *result = digests;
+
+    return tool_rc_success;
+}
+
 static tool_rc do_pcrevent_and_output(ESYS_CONTEXT *ectx) {
 
     TPML_DIGEST_VALUES *digests = NULL;
-    tool_rc rc = tpm_pcrevent_file(ectx, &digests);
+    tool_rc rc = ctx.is_host_hash ? host_pcrevent_file(ectx, &digests) :
+            tpm_pcrevent_file(ectx, &digests);
     if (rc != tool_rc_success) {
         return rc;
     }
@@ -168,10 +302,7 @@ static tool_rc do_pcrevent_and_output(ESYS_CONTEXT *ectx) {
         }
         }
 
-        size_t j;
-        for (j = 0; j < size; j++) {
-            tpm2_tool_output("%02x", bytes[j]);
-        }
+        tpm2_hex_print(bytes, size, false);
 
         tpm2_tool_output("\n");
 
@@ -195,7 +326,7 @@ static bool on_arg(int argc, char **argv) {
     /* argc can never be negative so cast is safe */
     for (i = 0; i < (unsigned) argc; i++) {
 
-        FILE *x = fopen(argv[i], "rb");
+        FILE *x = files_fopen(argv[i], "rb");
         /* file already found but got another file */
         if (f && x) {
             LOG_ERR("Only expected one file input");
@@ -237,6 +368,9 @@ static bool on_option(char key, char *value) {
     case 'P':
         ctx.auth.auth_str = value;
         break;
+    case 0:
+        ctx.is_host_hash = true;
+        break;
         /* no default */
     }
 
@@ -247,6 +381,7 @@ static bool tpm2_tool_onstart(tpm2_options **opts) {
 
     static const struct option topts[] = {
         { "auth",      required_argument, NULL, 'P' },
+        { "host-hash", no_argument,       NULL,  0  },
     };
 
     *opts = tpm2_options_new("P:", ARRAY_LEN(topts), topts, on_option, on_arg,
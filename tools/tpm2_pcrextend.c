@@ -1,20 +1,31 @@
 /* SPDX-License-Identifier: BSD-3-Clause */
 
+#include <errno.h>
 #include <stdlib.h>
+#include <string.h>
 
+#include "efi_event.h"
+#include "files.h"
 #include "log.h"
+#include "tpm2.h"
 #include "tpm2_tool.h"
 #include "tpm2_alg_util.h"
+#include "tpm2_eventlog.h"
 #include "tpm2_options.h"
+#include "tpm2_util.h"
 
 typedef struct tpm_pcr_extend_ctx tpm_pcr_extend_ctx;
 struct tpm_pcr_extend_ctx {
     size_t digest_spec_len;
     tpm2_pcr_digest_spec *digest_spec;
+    const char *manifest_path;
+    const char *eventlog_path;
+    FILE *eventlog;
+    /* the algorithms of the SpecID event of the event log */
+    TPMI_ALG_HASH log_algs[TPM2_NUM_PCR_BANKS];
+    UINT32 log_alg_count;
 };
 
-static tpm_pcr_extend_ctx ctx;
-
 static tool_rc pcr_extend_one(ESYS_CONTEXT *ectx,
         TPMI_DH_PCR pcr_index, TPML_DIGEST_VALUES *digests) {;
 
@@ -30,11 +41,267 @@ static tool_rc pcr_extend_one(ESYS_CONTEXT *ectx,
     return tool_rc_success;
 }
 
-static tool_rc pcr_extend(ESYS_CONTEXT *ectx) {
+/* a manifest line, with the event the extension is logged with */
+typedef struct extend_job extend_job;
+struct extend_job {
+    tpm2_pcr_digest_spec spec;
+    UINT32 type;
+    char *data;
+    UINT32 size;
+    /* the line buffer is reused for the following lines of the job */
+    char *line;
+    size_t line_size;
+    size_t line_number;
+};
+
+static bool manifest_parse(tpm_pcr_extend_ctx *ctx, extend_job *job,
+        char *line) {
+
+    char *saveptr = NULL;
+    char *spec = strtok_r(line, " \t", &saveptr);
+
+    memset(&job->spec, 0, sizeof(job->spec));
+    if (!pcr_parse_digest_list(&spec, 1, &job->spec)) {
+        LOG_ERR("%s:%zu: Expected: <pcr index>:<hash alg>=<hash value>,... "
+                "[<event type> [<event data>]]", ctx->manifest_path,
+                job->line_number);
+        return false;
+    }
+
+    job->type = EV_IPL;
+    job->data = NULL;
+    job->size = 0;
+
+    char *type = strtok_r(NULL, " \t", &saveptr);
+    if (type) {
+        if (!tpm2_util_string_to_uint32(type, &job->type)) {
+            LOG_ERR("%s:%zu: Invalid event type, got: \"%s\"",
+                    ctx->manifest_path, job->line_number, type);
+            return false;
+        }
+
+        /* the rest of the line is the event data */
+        if (saveptr && *saveptr) {
+            job->data = saveptr + strspn(saveptr, " \t");
+            job->size = strlen(job->data);
+        }
+    }
+
+    return true;
+}
+
+/*
+ * Reads the next extension of the manifest. Returns false at the end of the
+ * manifest, or on an error setting rc.
+ */
+static bool manifest_read(tpm_pcr_extend_ctx *ctx, FILE *input,
+        extend_job *job, tool_rc *rc) {
+
+    while (getline(&job->line, &job->line_size, input) != -1) {
+        job->line_number++;
+
+        job->line[strcspn(job->line, "\r\n")] = '\0';
+
+        /* empty lines and comments */
+        char *line = job->line + strspn(job->line, " \t");
+        if (!*line || *line == '#') {
+            continue;
+        }
+
+        if (!manifest_parse(ctx, job, line)) {
+            *rc = tool_rc_general_error;
+            return false;
+        }
+
+        return true;
+    }
+
+    if (ferror(input)) {
+        LOG_ERR("Could not read manifest \"%s\", error: %s",
+                ctx->manifest_path, strerror(errno));
+        *rc = tool_rc_general_error;
+    }
+
+    return false;
+}
+
+static bool eventlog_check(tpm_pcr_extend_ctx *ctx, extend_job const *job) {
+
+    TPML_DIGEST_VALUES const *digests = &job->spec.digests;
+    bool result = digests->count == ctx->log_alg_count;
+
+    UINT32 i, j;
+    for (i = 0; result && i < ctx->log_alg_count; i++) {
+        for (j = 0; j < digests->count; j++) {
+            if (digests->digests[j].hashAlg == ctx->log_algs[i]) {
+                break;
+            }
+        }
+        result = j < digests->count;
+    }
+
+    if (!result) {
+        LOG_ERR("%s:%zu: The event log needs exactly one digest of every "
+                "algorithm of its SpecID event", ctx->manifest_path,
+                job->line_number);
+    }
+
+    return result;
+}
+
+/*
+ * Reads and checks the next extension of the manifest and sends it to the
+ * TPM. Returns false at the end of the manifest, or on an error setting rc.
+ */
+static bool manifest_next(tpm_pcr_extend_ctx *ctx, ESYS_CONTEXT *ectx,
+        FILE *input, extend_job *job, size_t line_number, tool_rc *rc) {
+
+    /* the jobs take turns reading, so they continue the line numbers */
+    job->line_number = line_number;
+    if (!manifest_read(ctx, input, job, rc)) {
+        return false;
+    }
+
+    /* a new log takes the algorithms of the first extension */
+    if (ctx->eventlog && !ctx->log_alg_count) {
+        TPML_DIGEST_VALUES const *digests = &job->spec.digests;
+        UINT32 i;
+        for (i = 0; i < digests->count; i++) {
+            ctx->log_algs[i] = digests->digests[i].hashAlg;
+        }
+        ctx->log_alg_count = digests->count;
+
+        if (!tpm2_eventlog_write_specid(ctx->eventlog, ctx->log_algs,
+                ctx->log_alg_count)) {
+            *rc = tool_rc_general_error;
+            return false;
+        }
+    }
+
+    if (ctx->eventlog && !eventlog_check(ctx, job)) {
+        *rc = tool_rc_general_error;
+        return false;
+    }
+
+    tool_rc tmp_rc = tpm2_pcr_extend_async(ectx, job->spec.pcr_index,
+            &job->spec.digests);
+    if (tmp_rc != tool_rc_success) {
+        LOG_ERR("Could not extend pcr index: 0x%X", job->spec.pcr_index);
+        *rc = tmp_rc;
+        return false;
+    }
+
+    return true;
+}
+
+/*
+ * Extends the PCRs with every line of the manifest, the next extension sent
+ * before the previous one is logged. The first failure stops the manifest,
+ * the extensions before it stay logged.
+ */
+static tool_rc manifest_extend(tpm_pcr_extend_ctx *ctx, ESYS_CONTEXT *ectx,
+        FILE *input) {
+
+    extend_job jobs[2] = { 0 };
+    extend_job *cur = &jobs[0];
+    extend_job *next = &jobs[1];
+
+    tool_rc rc = tool_rc_success;
+    bool has_cur = manifest_next(ctx, ectx, input, cur, 0, &rc);
+    while (has_cur) {
+        rc = tpm2_pcr_extend_finish(ectx);
+        if (rc != tool_rc_success) {
+            LOG_ERR("%s:%zu: Could not extend pcr index: 0x%X",
+                    ctx->manifest_path, cur->line_number, cur->spec.pcr_index);
+            break;
+        }
+
+        bool has_next = manifest_next(ctx, ectx, input, next,
+                cur->line_number, &rc);
+
+        if (ctx->eventlog && !tpm2_eventlog_write_event2(ctx->eventlog,
+                cur->spec.pcr_index, cur->type, &cur->spec.digests,
+                (BYTE *)cur->data, cur->size)) {
+            if (has_next) {
+                /* the sent command is still owed its response */
+                tpm2_pcr_extend_finish(ectx);
+            }
+            rc = tool_rc_general_error;
+            break;
+        }
+
+        extend_job *tmp = cur;
+        cur = next;
+        next = tmp;
+        has_cur = has_next;
+    }
+
+    free(jobs[0].line);
+    free(jobs[1].line);
+
+    return rc;
+}
+
+static tool_rc eventlog_open(tpm_pcr_extend_ctx *ctx) {
+
+    ctx->eventlog = files_fopen(ctx->eventlog_path, "a+b");
+    if (!ctx->eventlog) {
+        LOG_ERR("Could not open event log \"%s\", error: %s",
+                ctx->eventlog_path, strerror(errno));
+        return tool_rc_general_error;
+    }
+
+    unsigned long size = 0;
+    if (!files_get_file_size(ctx->eventlog, &size, ctx->eventlog_path)) {
+        return tool_rc_general_error;
+    }
+
+    /* the existing log decides the algorithms, the writes append */
+    rewind(ctx->eventlog);
+    if (size && !tpm2_eventlog_read_specid(ctx->eventlog, ctx->log_algs,
+            &ctx->log_alg_count)) {
+        LOG_ERR("Expected a crypto agile event log: \"%s\"",
+                ctx->eventlog_path);
+        return tool_rc_general_error;
+    }
+
+    return tool_rc_success;
+}
+
+static tool_rc manifest_run(tpm_pcr_extend_ctx *ctx, ESYS_CONTEXT *ectx) {
+
+    bool is_stdin = !strcmp(ctx->manifest_path, "-");
+    FILE *input = is_stdin ? stdin : files_fopen(ctx->manifest_path, "r");
+    if (!input) {
+        LOG_ERR("Could not open manifest \"%s\", error: %s",
+                ctx->manifest_path, strerror(errno));
+        return tool_rc_general_error;
+    }
+
+    tool_rc rc = ctx->eventlog_path ? eventlog_open(ctx) : tool_rc_success;
+    if (rc == tool_rc_success) {
+        rc = manifest_extend(ctx, ectx, input);
+    }
+
+    if (ctx->eventlog && fclose(ctx->eventlog)) {
+        LOG_ERR("Could not write event log \"%s\", error: %s",
+                ctx->eventlog_path, strerror(errno));
+        rc = tool_rc_general_error;
+    }
+    ctx->eventlog = NULL;
+
+    if (!is_stdin) {
+        fclose(input);
+    }
+
+    return rc;
+}
+
+static tool_rc pcr_extend(tpm_pcr_extend_ctx *ctx, ESYS_CONTEXT *ectx) {
 
     size_t i;
-    for (i = 0; i < ctx.digest_spec_len; i++) {
-        tpm2_pcr_digest_spec *dspec = &ctx.digest_spec[i];
+    for (i = 0; i < ctx->digest_spec_len; i++) {
+        tpm2_pcr_digest_spec *dspec = &ctx->digest_spec[i];
         tool_rc rc = pcr_extend_one(ectx, dspec->pcr_index,
                 &dspec->digests);
         if (rc != tool_rc_success) {
@@ -45,7 +312,26 @@ static tool_rc pcr_extend(ESYS_CONTEXT *ectx) {
     return tool_rc_success;
 }
 
-static bool on_arg(int argc, char **argv) {
+static bool on_option(void *tool_ctx, char key, char *value) {
+
+    tpm_pcr_extend_ctx *ctx = tool_ctx;
+
+    switch (key) {
+    case 0:
+        ctx->manifest_path = value;
+        break;
+    case 1:
+        ctx->eventlog_path = value;
+        break;
+        /* no default */
+    }
+
+    return true;
+}
+
+static bool on_arg(void *tool_ctx, int argc, char **argv) {
+
+    tpm_pcr_extend_ctx *ctx = tool_ctx;
 
     if (argc < 1) {
         LOG_ERR("Expected at least one PCR Digest specification,"
@@ -54,35 +340,74 @@ static bool on_arg(int argc, char **argv) {
     }
 
     /* this can never be negative */
-    ctx.digest_spec_len = (size_t) argc;
+    ctx->digest_spec_len = (size_t) argc;
 
-    ctx.digest_spec = calloc(ctx.digest_spec_len, sizeof(*ctx.digest_spec));
-    if (!ctx.digest_spec) {
+    ctx->digest_spec = calloc(ctx->digest_spec_len, sizeof(*ctx->digest_spec));
+    if (!ctx->digest_spec) {
         LOG_ERR("oom");
         return false;
     }
 
-    return pcr_parse_digest_list(argv, ctx.digest_spec_len, ctx.digest_spec);
+    return pcr_parse_digest_list(argv, ctx->digest_spec_len, ctx->digest_spec);
 }
 
-static bool tpm2_tool_onstart(tpm2_options **opts) {
+static bool tpm2_tool_onstart(tpm2_options **opts, void **tool_ctx) {
+
+    tpm_pcr_extend_ctx *ctx = calloc(1, sizeof(*ctx));
+    if (!ctx) {
+        LOG_ERR("oom");
+        return false;
+    }
+    *tool_ctx = ctx;
+
+    const struct option topts[] = {
+        { "manifest", required_argument, NULL, 0 },
+        { "eventlog", required_argument, NULL, 1 },
+    };
 
-    *opts = tpm2_options_new(NULL, 0, NULL, NULL, on_arg, 0);
+    *opts = tpm2_options_new_ctx(NULL, ARRAY_LEN(topts), topts, on_option,
+            on_arg, 0, ctx);
 
     return *opts != NULL;
 }
 
-static tool_rc tpm2_tool_onrun(ESYS_CONTEXT *ectx, tpm2_option_flags flags) {
+static tool_rc tpm2_tool_onrun(void *tool_ctx, ESYS_CONTEXT *ectx,
+        tpm2_option_flags flags) {
 
     UNUSED(flags);
 
-    return pcr_extend(ectx);
+    tpm_pcr_extend_ctx *ctx = tool_ctx;
+
+    if (ctx->manifest_path) {
+        if (ctx->digest_spec_len) {
+            LOG_ERR("Specify either PCR digest specifications or a manifest");
+            return tool_rc_option_error;
+        }
+        return manifest_run(ctx, ectx);
+    }
+
+    if (ctx->eventlog_path) {
+        LOG_ERR("--eventlog requires --manifest");
+        return tool_rc_option_error;
+    }
+
+    if (!ctx->digest_spec_len) {
+        LOG_ERR("Expected at least one PCR Digest specification,"
+                "ie: <pcr index>:<hash alg>=<hash value>, got: 0");
+        return tool_rc_option_error;
+    }
+
+    return pcr_extend(ctx, ectx);
 }
 
-static void tpm2_tool_onexit(void) {
+static void tpm2_tool_onexit(void *tool_ctx) {
 
-    free(ctx.digest_spec);
+    tpm_pcr_extend_ctx *ctx = tool_ctx;
+    if (ctx) {
+        free(ctx->digest_spec);
+    }
+    free(ctx);
 }
 
 // Register this tool with tpm2_tool.c
-TPM2_TOOL_REGISTER("pcrextend", tpm2_tool_onstart, tpm2_tool_onrun, NULL, tpm2_tool_onexit)
+TPM2_TOOL_REGISTER_CTX("pcrextend", tpm2_tool_onstart, tpm2_tool_onrun, NULL, tpm2_tool_onexit)
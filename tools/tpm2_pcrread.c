@@ -1,14 +1,18 @@
 /* SPDX-License-Identifier: BSD-3-Clause */
 
 #include <errno.h>
+#include <inttypes.h>
 #include <stdio.h>
 #include <string.h>
+#include <time.h>
 
+#include "files.h"
 #include "log.h"
 #include "pcr.h"
 #include "tpm2_alg_util.h"
 #include "tpm2_convert.h"
 #include "tpm2_tool.h"
+#include "tpm2_util.h"
 
 typedef struct listpcr_context listpcr_context;
 struct listpcr_context {
@@ -19,19 +23,16 @@ struct listpcr_context {
     tpm2_pcrs pcrs;
     TPML_PCR_SELECTION pcr_selections;
     TPMI_ALG_HASH selected_algorithm;
+    /* seconds between the polls of the update counter, 0 to read once */
+    UINT32 watch_interval;
+    UINT32 polls;
 };
 
 static listpcr_context ctx = {
     .format = pcrs_output_format_values
 };
 
-static tool_rc show_pcr_list_selected_values(ESYS_CONTEXT *esys_context,
-        TPMS_CAPABILITY_DATA *capdata,
-        bool check) {
-
-    if (check && !pcr_check_pcr_selection(capdata, &ctx.pcr_selections)) {
-        return tool_rc_general_error;
-    }
+static tool_rc show_pcr_list_selected_values(ESYS_CONTEXT *esys_context) {
 
     tool_rc rc = pcr_read_pcr_values(esys_context, &ctx.pcr_selections,
             &ctx.pcrs);
@@ -39,7 +40,10 @@ static tool_rc show_pcr_list_selected_values(ESYS_CONTEXT *esys_context,
         return rc;
     }
 
+    /* the banks have always been indented */
+    tpm2_writer_map_start(NULL);
     bool success = pcr_print_values(&ctx.pcr_selections, &ctx.pcrs);
+    tpm2_writer_end();
     if (success && ctx.output_file) {
         if (ctx.format == pcrs_output_format_values) {
             success = pcr_fwrite_values(&ctx.pcr_selections, &ctx.pcrs,
@@ -47,22 +51,94 @@ static tool_rc show_pcr_list_selected_values(ESYS_CONTEXT *esys_context,
         } else if (ctx.format == pcrs_output_format_serialized) {
             success = pcr_fwrite_serialized(&ctx.pcr_selections, &ctx.pcrs,
                                             ctx.output_file);
+        } else if (ctx.format == pcrs_output_format_bundle) {
+            success = pcr_bundle_write(&ctx.pcr_selections, &ctx.pcrs,
+                                       ctx.output_file);
         }
     }
 
     return success ? tool_rc_success : tool_rc_general_error;
 }
 
-static tool_rc show_pcr_alg_or_all_values(ESYS_CONTEXT *esys_context,
-        TPMS_CAPABILITY_DATA *capdata) {
+static void watch_sleep(void) {
 
-    bool res = pcr_init_pcr_selection(capdata, &ctx.pcr_selections,
-            ctx.selected_algorithm);
-    if (!res) {
-        return tool_rc_general_error;
+    struct timespec ts = { .tv_sec = ctx.watch_interval };
+    while (nanosleep(&ts, &ts) && errno == EINTR);
+}
+
+/*
+ * Outputs the selected values, then polls the update counter of the TPM and
+ * re-reads the values only when it changed, outputting the PCRs whose values
+ * changed. Every output is a document of its own, written out at once.
+ */
+static tool_rc watch_pcr_values(ESYS_CONTEXT *esys_context) {
+
+    /* the previous values are kept for the comparison, swapped with a read */
+    tpm2_pcrs old_pcrs = { 0 };
+    tpm2_pcrs *cur = &ctx.pcrs;
+    tpm2_pcrs *old = &old_pcrs;
+
+    UINT32 counter = 0;
+    tool_rc rc = pcr_read_pcr_values_counter(esys_context, &ctx.pcr_selections,
+            cur, &counter);
+    if (rc != tool_rc_success) {
+        return rc;
     }
 
-    return show_pcr_list_selected_values(esys_context, capdata, false);
+    tpm2_writer_document_start();
+    tpm2_writer_number("pcrUpdateCounter", "%" PRIu32, counter);
+    bool result = pcr_print_pcr_struct(&ctx.pcr_selections, cur);
+    tpm2_writer_document_end();
+    fflush(stdout);
+
+    TPMI_ALG_HASH bank = ctx.pcr_selections.pcrSelections[0].hash;
+    UINT32 poll;
+    for (poll = 0; result && (!ctx.polls || poll < ctx.polls); poll++) {
+        watch_sleep();
+
+        UINT32 new_counter = 0;
+        rc = pcr_read_update_counter(esys_context, bank, &new_counter);
+        if (rc != tool_rc_success) {
+            goto out;
+        }
+
+        if (new_counter == counter) {
+            continue;
+        }
+
+        tpm2_pcrs *tmp = old;
+        old = cur;
+        cur = tmp;
+        rc = pcr_read_pcr_values_counter(esys_context, &ctx.pcr_selections,
+                cur, &counter);
+        if (rc != tool_rc_success) {
+            goto out;
+        }
+
+        /* the counter also changes with the PCRs not selected */
+        tpm2_writer_document_start();
+        tpm2_writer_number("pcrUpdateCounter", "%" PRIu32, counter);
+        tpm2_writer_map_start("changed");
+        size_t changed = 0;
+        result = pcr_print_changed_values(&ctx.pcr_selections, old, cur,
+                &changed);
+        tpm2_writer_end();
+        tpm2_writer_document_end();
+        fflush(stdout);
+    }
+
+    rc = result ? tool_rc_success : tool_rc_general_error;
+
+out:
+    /* ctx.pcrs is released on stop, whichever of both it is now */
+    if (cur != &ctx.pcrs) {
+        pcr_pcrs_free(&ctx.pcrs);
+        ctx.pcrs = *cur;
+    } else {
+        pcr_pcrs_free(old);
+    }
+
+    return rc;
 }
 
 static bool on_option(char key, char *value) {
@@ -77,6 +153,20 @@ static bool on_option(char key, char *value) {
             return false;
         }
         break;
+    case 0:
+        if (!tpm2_util_string_to_uint32(value, &ctx.watch_interval) ||
+            !ctx.watch_interval) {
+            LOG_ERR("Invalid watch interval, expected a number of seconds, "
+                    "got: \"%s\"", value);
+            return false;
+        }
+        break;
+    case 1:
+        if (!tpm2_util_string_to_uint32(value, &ctx.polls)) {
+            LOG_ERR("Invalid number of polls, got: \"%s\"", value);
+            return false;
+        }
+        break;
         /* no default */
     }
 
@@ -108,10 +198,12 @@ static bool tpm2_tool_onstart(tpm2_options **opts) {
     static struct option topts[] = {
          { "output",         required_argument, NULL, 'o' },
          { "pcrs_format",    required_argument, NULL, 'F' },
+         { "watch",          required_argument, NULL,  0  },
+         { "polls",          required_argument, NULL,  1  },
      };
 
     *opts = tpm2_options_new("o:F:", ARRAY_LEN(topts), topts, on_option, on_arg,
-            0);
+            TPM2_OPTIONS_JSON);
 
     return *opts != NULL;
 }
@@ -120,8 +212,18 @@ static tool_rc tpm2_tool_onrun(ESYS_CONTEXT *esys_context, tpm2_option_flags fla
 
     UNUSED(flags);
 
+    if (ctx.watch_interval && ctx.output_file_path) {
+        LOG_ERR("Cannot specify --watch with -o");
+        return tool_rc_option_error;
+    }
+
+    if (ctx.polls && !ctx.watch_interval) {
+        LOG_ERR("--polls requires --watch");
+        return tool_rc_option_error;
+    }
+
     if (ctx.output_file_path) {
-        ctx.output_file = fopen(ctx.output_file_path, "wb+");
+        ctx.output_file = files_fopen(ctx.output_file_path, "wb+");
         if (!ctx.output_file) {
             LOG_ERR("Could not open output file \"%s\" error: \"%s\"",
                     ctx.output_file_path, strerror(errno));
@@ -135,11 +237,23 @@ static tool_rc tpm2_tool_onrun(ESYS_CONTEXT *esys_context, tpm2_option_flags fla
         return rc;
     }
 
-    if (ctx.pcr_selections.count > 0) {
-        return show_pcr_list_selected_values(esys_context, &capdata, true);
+    bool res = ctx.pcr_selections.count > 0 ?
+            pcr_check_pcr_selection(&capdata, &ctx.pcr_selections) :
+            pcr_init_pcr_selection(&capdata, &ctx.pcr_selections,
+                    ctx.selected_algorithm);
+    if (!res) {
+        return tool_rc_general_error;
     }
 
-    return show_pcr_alg_or_all_values(esys_context, &capdata);
+    if (ctx.watch_interval) {
+        if (!ctx.pcr_selections.count) {
+            LOG_ERR("No PCR selected to watch");
+            return tool_rc_general_error;
+        }
+        return watch_pcr_values(esys_context);
+    }
+
+    return show_pcr_list_selected_values(esys_context);
 }
 
 static tool_rc tpm2_tool_onstop(ESYS_CONTEXT *esys_context) {
@@ -149,6 +263,8 @@ static tool_rc tpm2_tool_onstop(ESYS_CONTEXT *esys_context) {
         fclose(ctx.output_file);
     }
 
+    pcr_pcrs_free(&ctx.pcrs);
+
     return tool_rc_success;
 }
 
@@ -1,44 +1,264 @@
 /* SPDX-License-Identifier: BSD-3-Clause */
 
+#include <stdlib.h>
 #include <string.h>
 
 #include "log.h"
 #include "pcr.h"
 #include "tpm2.h"
+#include "tpm2_alg_util.h"
+#include "tpm2_openssl.h"
 #include "tpm2_tool.h"
 #include "tpm2_options.h"
+#include "tpm2_writer.h"
 
 typedef struct tpm_pcr_reset_ctx tpm_pcr_reset_ctx;
 struct tpm_pcr_reset_ctx {
     bool pcr_list[TPM2_MAX_PCRS];
+    /* the initial extensions, in the order of the command line */
+    tpm2_pcr_digest_spec *extend;
+    size_t extend_count;
+    bool print_expected;
+    /* the banks of the extensions and the values they leave the PCRs at */
+    TPMI_ALG_HASH banks[TPM2_NUM_PCR_BANKS];
+    UINT32 bank_count;
+    TPM2B_DIGEST expected[TPM2_MAX_PCRS][TPM2_NUM_PCR_BANKS];
 };
 
 static tpm_pcr_reset_ctx ctx;
 
-static tool_rc pcr_reset_one(ESYS_CONTEXT *ectx, TPMI_DH_PCR pcr_index) {
+/*
+ * A command of the transaction, a reset when spec is NULL and an extension
+ * otherwise.
+ */
+typedef struct reset_job reset_job;
+struct reset_job {
+    TPMI_DH_PCR pcr_index;
+    const tpm2_pcr_digest_spec *spec;
+};
+
+static tool_rc job_send(ESYS_CONTEXT *ectx, const reset_job *job) {
+
+    return job->spec ?
+            tpm2_pcr_extend_async(ectx, job->pcr_index, &job->spec->digests) :
+            tpm2_pcr_reset_async(ectx, job->pcr_index);
+}
+
+static tool_rc job_finish(ESYS_CONTEXT *ectx, const reset_job *job) {
 
-    tool_rc rc = tpm2_pcr_reset(ectx, pcr_index);
+    tool_rc rc = job->spec ? tpm2_pcr_extend_finish(ectx) :
+            tpm2_pcr_reset_finish(ectx);
     if (rc != tool_rc_success) {
-        LOG_ERR("Could not reset PCR index: %d", pcr_index);
+        LOG_ERR("Could not %s PCR index: %d", job->spec ? "extend" : "reset",
+                job->pcr_index);
     }
 
     return rc;
 }
 
+static bool bank_index(TPMI_ALG_HASH alg, UINT32 *index) {
+
+    UINT32 i;
+    for (i = 0; i < ctx.bank_count; i++) {
+        if (ctx.banks[i] == alg) {
+            *index = i;
+            return true;
+        }
+    }
+
+    if (ctx.bank_count == TPM2_NUM_PCR_BANKS) {
+        LOG_ERR("Too many PCR banks");
+        return false;
+    }
+
+    *index = ctx.bank_count;
+    ctx.banks[ctx.bank_count++] = alg;
+
+    return true;
+}
+
+/*
+ * Accounts a command in the expected values, a reset zeroes the PCR in every
+ * bank, which is what TPM2_PCR_Reset resets to.
+ */
+static bool job_expect(const reset_job *job) {
+
+    TPM2B_DIGEST *values = ctx.expected[job->pcr_index];
+    UINT32 i;
+    if (!job->spec) {
+        for (i = 0; i < ctx.bank_count; i++) {
+            UINT16 size = tpm2_alg_util_get_hash_size(ctx.banks[i]);
+            values[i].size = size;
+            memset(values[i].buffer, 0, size);
+        }
+        return true;
+    }
+
+    const TPML_DIGEST_VALUES *digests = &job->spec->digests;
+    for (i = 0; i < digests->count; i++) {
+        const TPMT_HA *digest = &digests->digests[i];
+        UINT32 bank;
+        if (!bank_index(digest->hashAlg, &bank)) {
+            return false;
+        }
+
+        UINT16 size = tpm2_alg_util_get_hash_size(digest->hashAlg);
+        TPM2B_DIGEST *value = &values[bank];
+        bool result = tpm2_openssl_pcr_extend(digest->hashAlg, value->buffer,
+                (const BYTE *) &digest->digest, size);
+        if (!result) {
+            return false;
+        }
+        value->size = size;
+    }
+
+    return true;
+}
+
+static size_t jobs_fill(reset_job *jobs) {
+
+    size_t count = 0;
+    TPMI_DH_PCR i;
+    for (i = 0; i < TPM2_MAX_PCRS; i++) {
+        if (!ctx.pcr_list[i]) {
+            continue;
+        }
+
+        jobs[count].pcr_index = i;
+        jobs[count++].spec = NULL;
+
+        size_t j;
+        for (j = 0; j < ctx.extend_count; j++) {
+            if (ctx.extend[j].pcr_index == i) {
+                jobs[count].pcr_index = i;
+                jobs[count++].spec = &ctx.extend[j];
+            }
+        }
+    }
+
+    return count;
+}
+
+/*
+ * Sends the resets and the extensions one after the other, computing the
+ * expected value of the command in flight meanwhile. The first failure stops
+ * the transaction, with the PCRs before it left reset or extended.
+ */
 static tool_rc pcr_reset(ESYS_CONTEXT *ectx) {
+
+    /* a reset per PCR, then its extensions */
+    reset_job *jobs = calloc(TPM2_MAX_PCRS + ctx.extend_count, sizeof(*jobs));
+    if (!jobs) {
+        LOG_ERR("oom");
+        return tool_rc_general_error;
+    }
+
+    /* the banks of all extensions, for the resets to zero them all */
     size_t i;
+    UINT32 j, bank;
+    for (i = 0; i < ctx.extend_count; i++) {
+        const TPML_DIGEST_VALUES *digests = &ctx.extend[i].digests;
+        for (j = 0; j < digests->count; j++) {
+            if (!bank_index(digests->digests[j].hashAlg, &bank)) {
+                free(jobs);
+                return tool_rc_general_error;
+            }
+        }
+    }
+
+    size_t count = jobs_fill(jobs);
+    tool_rc rc = count ? job_send(ectx, &jobs[0]) : tool_rc_success;
+    for (i = 0; rc == tool_rc_success && i < count; i++) {
+        bool result = job_expect(&jobs[i]);
+
+        rc = job_finish(ectx, &jobs[i]);
+        if (rc == tool_rc_success && !result) {
+            rc = tool_rc_general_error;
+        }
+
+        if (rc == tool_rc_success && i + 1 < count) {
+            rc = job_send(ectx, &jobs[i + 1]);
+        }
+    }
+
+    free(jobs);
+
+    return rc;
+}
+
+/* the expected values in the layout of tpm2_pcrread */
+static bool print_expected(void) {
 
+    TPML_PCR_SELECTION pcr_select = { .count = ctx.bank_count };
+    pcr_bitset bits = 0;
+    TPMI_DH_PCR i;
     for (i = 0; i < TPM2_MAX_PCRS; i++) {
-        if (!ctx.pcr_list[i])
-            continue;
+        if (ctx.pcr_list[i]) {
+            bits |= (pcr_bitset) 1 << i;
+        }
+    }
+
+    tpm2_pcrs pcrs = { 0 };
+    TPML_DIGEST *values = NULL;
+    bool result = true;
+    UINT32 bank;
+    for (bank = 0; result && bank < ctx.bank_count; bank++) {
+        TPMS_PCR_SELECTION *sel = &pcr_select.pcrSelections[bank];
+        sel->hash = ctx.banks[bank];
+        sel->sizeofSelect = 3;
+        pcr_bitset_to_select(bits, sel);
+
+        pcr_bitset next = bits;
+        unsigned pcr;
+        while (result && pcr_bitset_next(&next, &pcr)) {
+            if (!values || values->count == ARRAY_LEN(values->digests)) {
+                values = pcr_pcrs_append(&pcrs);
+                result = values != NULL;
+            }
+            if (result) {
+                values->digests[values->count++] = ctx.expected[pcr][bank];
+            }
+        }
+    }
+
+    if (result) {
+        tpm2_writer_map_start(NULL);
+        result = pcr_print_values(&pcr_select, &pcrs);
+        tpm2_writer_end();
+    }
 
-        tool_rc rc = pcr_reset_one(ectx, i);
-        if (rc != tool_rc_success) {
-            return rc;
+    pcr_pcrs_free(&pcrs);
+
+    return result;
+}
+
+static bool on_option(char key, char *value) {
+
+    tpm2_pcr_digest_spec *tmp;
+
+    switch (key) {
+    case 'e':
+        tmp = realloc(ctx.extend, (ctx.extend_count + 1) * sizeof(*tmp));
+        if (!tmp) {
+            LOG_ERR("oom");
+            return false;
         }
+        ctx.extend = tmp;
+        memset(&ctx.extend[ctx.extend_count], 0, sizeof(*tmp));
+        if (!pcr_parse_digest_list(&value, 1,
+                &ctx.extend[ctx.extend_count])) {
+            LOG_ERR("Expected: <pcr index>:<hash alg>=<hash value>,...");
+            return false;
+        }
+        ctx.extend_count++;
+        break;
+    case 0:
+        ctx.print_expected = true;
+        break;
+        /* no default */
     }
 
-    return tool_rc_success;
+    return true;
 }
 
 static bool on_arg(int argc, char** argv) {
@@ -64,7 +284,14 @@ static bool on_arg(int argc, char** argv) {
 }
 
 static bool tpm2_tool_onstart(tpm2_options **opts) {
-    *opts = tpm2_options_new(NULL, 0, NULL, NULL, on_arg, 0);
+
+    static struct option topts[] = {
+        { "extend",   required_argument, NULL, 'e' },
+        { "expected", no_argument,       NULL,  0  },
+    };
+
+    *opts = tpm2_options_new("e:", ARRAY_LEN(topts), topts, on_option, on_arg,
+            TPM2_OPTIONS_JSON);
 
     return *opts != NULL;
 }
@@ -73,8 +300,33 @@ static tool_rc tpm2_tool_onrun(ESYS_CONTEXT *ectx, tpm2_option_flags flags) {
 
     UNUSED(flags);
 
-    return pcr_reset(ectx);
+    size_t i;
+    for (i = 0; i < ctx.extend_count; i++) {
+        TPMI_DH_PCR pcr = ctx.extend[i].pcr_index;
+        if (pcr >= TPM2_MAX_PCRS || !ctx.pcr_list[pcr]) {
+            LOG_ERR("PCR index %d is extended but not reset", pcr);
+            return tool_rc_option_error;
+        }
+    }
+
+    if (ctx.print_expected && !ctx.extend_count) {
+        LOG_ERR("--expected requires --extend");
+        return tool_rc_option_error;
+    }
+
+    tool_rc rc = pcr_reset(ectx);
+    if (rc != tool_rc_success || !ctx.print_expected) {
+        return rc;
+    }
+
+    return print_expected() ? tool_rc_success : tool_rc_general_error;
+}
+
+static void tpm2_tool_onexit(void) {
+
+    free(ctx.extend);
 }
 
 // Register this tool with tpm2_tool.c
-TPM2_TOOL_REGISTER("pcrreset", tpm2_tool_onstart, tpm2_tool_onrun, NULL, NULL)
+TPM2_TOOL_REGISTER("pcrreset", tpm2_tool_onstart, tpm2_tool_onrun, NULL,
+        tpm2_tool_onexit)
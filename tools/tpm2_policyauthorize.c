@@ -4,6 +4,8 @@
 
 #include "files.h"
 #include "log.h"
+#include "tpm2_alg_util.h"
+#include "tpm2_convert.h"
 #include "tpm2_tool.h"
 #include "tpm2_policy.h"
 #include "tpm2_tool.h"
@@ -22,12 +24,23 @@ struct tpm2_policyauthorize_ctx {
     const char *ticket_path;
     //File path for storing the policy digest output
     const char *out_policy_dgst_path;
+    //File path of the approved-policy store and what it takes on a miss
+    const char *store_path;
+    const char *signer_context_arg;
+    tpm2_loaded_object signer;
+    const char *signature_path;
+    TPMI_ALG_SIG_SCHEME sig_scheme;
+    TPMI_ALG_HASH sig_halg;
+    TPMT_SIGNATURE signature;
 
     tpm2_session *session;
     TPM2B_DIGEST *policy_digest;
 };
 
-static tpm2_policyauthorize_ctx ctx;
+static tpm2_policyauthorize_ctx ctx = {
+    .sig_scheme = TPM2_ALG_ERROR,
+    .sig_halg = TPM2_ALG_SHA256,
+};
 
 static bool on_option(char key, char *value) {
 
@@ -50,6 +63,31 @@ static bool on_option(char key, char *value) {
     case 't':
         ctx.ticket_path = value;
         break;
+    case 'c':
+        ctx.signer_context_arg = value;
+        break;
+    case 's':
+        ctx.signature_path = value;
+        break;
+    case 'f':
+        ctx.sig_scheme = tpm2_alg_util_from_optarg(value,
+                tpm2_alg_util_flags_sig);
+        if (ctx.sig_scheme == TPM2_ALG_ERROR) {
+            LOG_ERR("Unknown signing scheme, got: \"%s\"", value);
+            return false;
+        }
+        break;
+    case 'g':
+        ctx.sig_halg = tpm2_alg_util_from_optarg(value,
+                tpm2_alg_util_flags_hash);
+        if (ctx.sig_halg == TPM2_ALG_ERROR) {
+            LOG_ERR("Unable to convert algorithm, got: \"%s\"", value);
+            return false;
+        }
+        break;
+    case 0:
+        ctx.store_path = value;
+        break;
     }
     return true;
 }
@@ -63,10 +101,15 @@ static bool tpm2_tool_onstart(tpm2_options **opts) {
         { "qualification", required_argument, NULL, 'q' },
         { "name",          required_argument, NULL, 'n' },
         { "ticket",        required_argument, NULL, 't' },
+        { "key-context",   required_argument, NULL, 'c' },
+        { "signature",     required_argument, NULL, 's' },
+        { "scheme",        required_argument, NULL, 'f' },
+        { "hash-algorithm", required_argument, NULL, 'g' },
+        { "ticket-cache",  required_argument, NULL,  0  },
     };
 
-    *opts = tpm2_options_new("L:S:i:q:n:t:", ARRAY_LEN(topts), topts, on_option,
-    NULL, 0);
+    *opts = tpm2_options_new("L:S:i:q:n:t:c:s:f:g:", ARRAY_LEN(topts), topts, on_option,
+    NULL, TPM2_OPTIONS_OPTIONAL_SAPI);
 
     return *opts != NULL;
 }
@@ -78,6 +121,25 @@ bool is_check_input_options_ok(void) {
         return false;
     }
 
+    if (ctx.store_path) {
+        if (ctx.ticket_path) {
+            LOG_ERR("The --ticket-cache takes the place of --ticket");
+            return false;
+        }
+
+        if (!ctx.verifying_pubkey_name_path && !ctx.signer_context_arg) {
+            LOG_ERR("Must specify the name -n or the key -c of the signer.");
+            return false;
+        }
+
+        return true;
+    }
+
+    if (ctx.signer_context_arg || ctx.signature_path) {
+        LOG_ERR("The signer key -c and signature -s need --ticket-cache");
+        return false;
+    }
+
     if (!ctx.verifying_pubkey_name_path) {
         LOG_ERR("Must specify name of the public key used for verification -n.");
         return false;
@@ -100,9 +162,36 @@ static tool_rc tpm2_tool_onrun(ESYS_CONTEXT *ectx, tpm2_option_flags flags) {
         return rc;
     }
 
-    rc = tpm2_policy_build_policyauthorize(ectx, ctx.session,
-            ctx.policy_digest_path, ctx.qualifier_data_path,
-            ctx.verifying_pubkey_name_path, ctx.ticket_path);
+    /* a plain signature, ie. of OpenSSL, is of the scheme of -f */
+    if (ctx.signature_path) {
+        tpm2_convert_sig_fmt format = ctx.sig_scheme == TPM2_ALG_ERROR ?
+                signature_format_tss : signature_format_plain;
+        bool result = tpm2_convert_sig_load(ctx.signature_path, format,
+                ctx.sig_scheme, ctx.sig_halg, &ctx.signature);
+        if (!result) {
+            LOG_ERR("Could not load signature \"%s\"", ctx.signature_path);
+            return tool_rc_general_error;
+        }
+    }
+
+    if (ctx.signer_context_arg) {
+        rc = tpm2_util_object_load(ectx, ctx.signer_context_arg, &ctx.signer,
+                TPM2_HANDLE_ALL_W_NV);
+        if (rc != tool_rc_success) {
+            return rc;
+        }
+    }
+
+    rc = ctx.store_path ?
+            tpm2_policy_build_policyauthorize_store(ectx, ctx.session,
+                    ctx.policy_digest_path, ctx.qualifier_data_path,
+                    ctx.verifying_pubkey_name_path,
+                    ctx.signer_context_arg ? &ctx.signer : NULL,
+                    ctx.signature_path ? &ctx.signature : NULL,
+                    ctx.store_path) :
+            tpm2_policy_build_policyauthorize(ectx, ctx.session,
+                    ctx.policy_digest_path, ctx.qualifier_data_path,
+                    ctx.verifying_pubkey_name_path, ctx.ticket_path);
     if (rc != tool_rc_success) {
         LOG_ERR("Could not build tpm authorized policy");
         return rc;
@@ -7,16 +7,27 @@
 #include "log.h"
 #include "tpm2_alg_util.h"
 #include "tpm2_policy.h"
+#include "tpm2_policy_or_tree.h"
 #include "tpm2_tool.h"
+#include "tpm2_writer.h"
 
 typedef struct tpm2_policyor_ctx tpm2_policyor_ctx;
 struct tpm2_policyor_ctx {
     //File path for the session context data
     const char *session_path;
     //List of policy digests that will be compounded
+    char *policy_list_str;
     TPML_DIGEST *policy_list;
     //File path for storing the policy digest output
     const char *out_policy_dgst_path;
+    //File path of a list of hex policy digests, - for stdin
+    const char *digest_list_path;
+    TPMI_ALG_HASH digest_list_halg;
+    TPM2B_DIGEST *digest_list;
+    size_t digest_list_count;
+    //File path of a PolicyOR tree of any number of policy digests
+    const char *tree_path;
+    tpm2_policy_or_tree tree;
 
     TPM2B_DIGEST *policy_digest;
     tpm2_session *session;
@@ -35,12 +46,14 @@ static bool on_option(char key, char *value) {
     case 'S':
         ctx.session_path = value;
         break;
+    case 0:
+        ctx.tree_path = value;
+        break;
+    case 1:
+        ctx.digest_list_path = value;
+        break;
     case 'l':
-        ctx.policy_list = calloc(1, sizeof(TPML_DIGEST));
-        result = tpm2_policy_parse_policy_list(value, ctx.policy_list);
-        if (!result) {
-            return false;
-        }
+        ctx.policy_list_str = value;
         break;
     }
 
@@ -54,11 +67,8 @@ static bool on_arg(int argc, char **argv) {
         return false;
     }
 
-    ctx.policy_list = calloc(1, sizeof(TPML_DIGEST));
-    bool result = tpm2_policy_parse_policy_list(argv[0], ctx.policy_list);
-    if (!result) {
-        return false;
-    }
+    ctx.policy_list_str = argv[0];
+
     return true;
 }
 
@@ -69,14 +79,53 @@ static bool tpm2_tool_onstart(tpm2_options **opts) {
         { "session",                required_argument, NULL, 'S' },
         //Option retained for backwards compatibility - See issue#1894
         { "policy-list",            required_argument, NULL, 'l' },
+        { "tree",                   required_argument, NULL,  0  },
+        { "digest-list",            required_argument, NULL,  1  },
     };
 
     *opts = tpm2_options_new("L:S:l:", ARRAY_LEN(topts), topts, on_option,
-        on_arg, 0);
+        on_arg, TPM2_OPTIONS_OPTIONAL_SAPI);
 
     return *opts != NULL;
 }
 
+static bool digest_list_load(void) {
+
+    bool result = tpm2_alg_util_digest_list_load(ctx.digest_list_path,
+            &ctx.digest_list_halg, &ctx.digest_list, &ctx.digest_list_count);
+    if (!result) {
+        return false;
+    }
+
+    if (!ctx.digest_list_count) {
+        LOG_ERR("Digest list \"%s\" is empty", ctx.digest_list_path);
+        return false;
+    }
+
+    return true;
+}
+
+static bool policy_list_from_digest_list(void) {
+
+    if (!digest_list_load()) {
+        return false;
+    }
+
+    if (ctx.digest_list_count > ARRAY_LEN(ctx.policy_list->digests)) {
+        LOG_ERR("A PolicyOR takes at most %zu policy digests, got %zu",
+                ARRAY_LEN(ctx.policy_list->digests), ctx.digest_list_count);
+        return false;
+    }
+
+    size_t i;
+    for (i = 0; i < ctx.digest_list_count; i++) {
+        ctx.policy_list->digests[i] = ctx.digest_list[i];
+    }
+    ctx.policy_list->count = ctx.digest_list_count;
+
+    return true;
+}
+
 static bool is_input_option_args_valid(void) {
 
     if (!ctx.session_path) {
@@ -84,6 +133,24 @@ static bool is_input_option_args_valid(void) {
         return false;
     }
 
+    if (!ctx.policy_list_str && !ctx.digest_list_path) {
+        LOG_ERR("Must specify the policy list.");
+        return false;
+    }
+
+    ctx.policy_list = calloc(1, sizeof(TPML_DIGEST));
+    if (!ctx.policy_list) {
+        LOG_ERR("oom");
+        return false;
+    }
+
+    bool result = ctx.digest_list_path ? policy_list_from_digest_list() :
+            tpm2_policy_parse_policy_list(ctx.policy_list_str,
+                    ctx.policy_list);
+    if (!result) {
+        return false;
+    }
+
     //Minimum two policies needed to be specified for compounding
     if (ctx.policy_list->count < 1) {
         LOG_ERR("Must specify at least 2 policy digests for compounding.");
@@ -93,10 +160,130 @@ static bool is_input_option_args_valid(void) {
     return true;
 }
 
+/*
+ * Compiles the policy digests into a balanced tree of PolicyOR, saved to the
+ * tree file, with the root as the policy and the path of each leaf in the
+ * output.
+ */
+static tool_rc tree_compile(void) {
+
+    /* the digests of a tree are not limited to those of a TPML_DIGEST */
+    bool result = ctx.digest_list_path ?
+            digest_list_load() && tpm2_policy_or_tree_build(
+                    ctx.digest_list_halg, ctx.digest_list,
+                    ctx.digest_list_count, &ctx.tree) :
+            tpm2_policy_or_tree_from_list(ctx.policy_list_str, &ctx.tree);
+    if (!result) {
+        return tool_rc_general_error;
+    }
+
+    result = tpm2_policy_or_tree_save(&ctx.tree, ctx.tree_path);
+    if (!result) {
+        return tool_rc_general_error;
+    }
+
+    const TPM2B_DIGEST *root = tpm2_policy_or_tree_root(&ctx.tree);
+    if (ctx.out_policy_dgst_path) {
+        result = files_save_bytes_to_file(ctx.out_policy_dgst_path,
+                (UINT8 *) root->buffer, root->size);
+        if (!result) {
+            return tool_rc_general_error;
+        }
+    }
+
+    tpm2_writer_hex("root", NULL, root->buffer, root->size, false);
+    tpm2_writer_number("depth", "%zu", ctx.tree.depth);
+    tpm2_writer_list_start("leaves");
+
+    size_t i;
+    for (i = 0; i < tpm2_policy_or_tree_count(&ctx.tree); i++) {
+        size_t path[TPM2_POLICY_OR_TREE_DEPTH_MAX];
+        tpm2_policy_or_tree_path(&ctx.tree, i, path);
+
+        tpm2_writer_map_start(NULL);
+        tpm2_writer_hex("digest", NULL, ctx.tree.nodes[i].buffer,
+                ctx.tree.nodes[i].size, false);
+        tpm2_writer_flow_start("path");
+        size_t level;
+        for (level = 0; level < ctx.tree.depth; level++) {
+            tpm2_writer_number(NULL, "%zu", path[level]);
+        }
+        tpm2_writer_end();
+        tpm2_writer_end();
+    }
+    tpm2_writer_end();
+
+    return tool_rc_success;
+}
+
+/*
+ * Satisfies the tree for the leaf of the current digest of the session, with
+ * a PolicyOR per level of the tree.
+ */
+static tool_rc tree_satisfy(ESYS_CONTEXT *ectx) {
+
+    bool result = tpm2_policy_or_tree_load(ctx.tree_path, &ctx.tree);
+    if (!result) {
+        return tool_rc_general_error;
+    }
+
+    tool_rc rc = tpm2_session_restore(ectx, ctx.session_path, false,
+            &ctx.session);
+    if (rc != tool_rc_success) {
+        return rc;
+    }
+
+    if (tpm2_session_get_authhash(ctx.session) != ctx.tree.halg) {
+        LOG_ERR("Policy digest hash alg should match that of the session.");
+        return tool_rc_general_error;
+    }
+
+    rc = tpm2_policy_get_digest(ectx, ctx.session, &ctx.policy_digest);
+    if (rc != tool_rc_success) {
+        return rc;
+    }
+
+    size_t leaf;
+    result = tpm2_policy_or_tree_find(&ctx.tree, ctx.policy_digest, &leaf);
+    if (!result) {
+        LOG_ERR("The policy of the session is no branch of tree \"%s\"",
+                ctx.tree_path);
+        return tool_rc_general_error;
+    }
+
+    rc = tpm2_policy_or_tree_satisfy(ectx, ctx.session, &ctx.tree, leaf);
+    if (rc != tool_rc_success) {
+        return rc;
+    }
+
+    return tpm2_policy_tool_finish(ectx, ctx.session, ctx.out_policy_dgst_path);
+}
+
 static tool_rc tpm2_tool_onrun(ESYS_CONTEXT *ectx, tpm2_option_flags flags) {
 
     UNUSED(flags);
 
+    if (ctx.policy_list_str && ctx.digest_list_path) {
+        LOG_ERR("Specify either a policy list or --digest-list");
+        return tool_rc_option_error;
+    }
+
+    if (ctx.tree_path) {
+        if (ctx.policy_list_str || ctx.digest_list_path) {
+            if (ctx.session_path) {
+                LOG_ERR("A tree is compiled offline, cannot specify -S");
+                return tool_rc_option_error;
+            }
+            return tree_compile();
+        }
+
+        if (!ctx.session_path) {
+            LOG_ERR("Must specify -S session file.");
+            return tool_rc_option_error;
+        }
+        return tree_satisfy(ectx);
+    }
+
     bool retval = is_input_option_args_valid();
     if (!retval) {
         return tool_rc_option_error;
@@ -129,6 +316,8 @@ static tool_rc tpm2_tool_onstop(ESYS_CONTEXT *ectx) {
     UNUSED(ectx);
     free(ctx.policy_list);
     free(ctx.policy_digest);
+    free(ctx.digest_list);
+    tpm2_policy_or_tree_free(&ctx.tree);
     return tpm2_session_close(&ctx.session);
 }
 
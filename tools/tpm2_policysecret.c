@@ -38,6 +38,8 @@ struct tpm2_policysecret_ctx {
     } flags;
 
     char *cp_hash_path;
+
+    const char *ticket_cache_path;
 };
 
 static tpm2_policysecret_ctx ctx;
@@ -80,6 +82,9 @@ static bool on_option(char key, char *value) {
     case 2:
         ctx.cp_hash_path = value;
         break;
+    case 3:
+        ctx.ticket_cache_path = value;
+        break;
     }
 
     return result;
@@ -114,6 +119,7 @@ static bool tpm2_tool_onstart(tpm2_options **opts) {
         { "timeout",        required_argument, NULL,  1  },
         { "qualification",  required_argument, NULL, 'q' },
         { "cphash",         required_argument, NULL,  2  },
+        { "ticket-cache",   required_argument, NULL,  3  },
     };
 
     *opts = tpm2_options_new("L:S:c:t:q:x", ARRAY_LEN(topts), topts, on_option,
@@ -139,6 +145,11 @@ static bool is_input_option_args_valid(void) {
         return false;
     }
 
+    if (ctx.ticket_cache_path && ctx.expiration >= 0) {
+        LOG_ERR("Only a negative expiration -t produces a ticket to cache.");
+        return false;
+    }
+
     return true;
 }
 
@@ -220,6 +231,14 @@ static tool_rc tpm2_tool_onrun(ESYS_CONTEXT *ectx, tpm2_option_flags flags) {
         if (!result) {
             LOG_ERR("Failed to save auth ticket");
             rc = tool_rc_general_error;
+            goto tpm2_tool_onrun_out;
+        }
+
+        /* PolicySecret is not bound to a cpHashA */
+        if (ctx.ticket_cache_path) {
+            rc = tpm2_policy_cache_ticket(ectx, ctx.ticket_cache_path,
+                    &ctx.auth_entity.object, ctx.qualifier_data_arg, NULL,
+                    ctx.expiration, timeout, policy_ticket);
         }
 
 tpm2_tool_onrun_out:
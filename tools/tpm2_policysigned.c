@@ -1,15 +1,25 @@
 /* SPDX-License-Identifier: BSD-3-Clause */
 
+#include <errno.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
+
+#include <tss2/tss2_mu.h>
 
 #include "files.h"
 #include "log.h"
 #include "tpm2_alg_util.h"
 #include "tpm2_convert.h"
 #include "tpm2_policy.h"
+#include "tpm2_rpc.h"
 #include "tpm2_tool.h"
 
+/* sign <expiration> <signature> [<cphash> [<qualification>]] */
+#define STREAM_FIELDS_MAX 5
+
+#define STREAM_SOCKET_PREFIX "unix:"
+
 typedef struct tpm2_policysigned_ctx tpm2_policysigned_ctx;
 struct tpm2_policysigned_ctx {
     const char *session_path;
@@ -39,11 +49,16 @@ struct tpm2_policysigned_ctx {
 
     const char *policy_qualifier_data;
 
+    const char *ticket_cache_path;
+
+    const char *stream_path;
+
     union {
         struct {
             UINT8 halg :1;
             UINT8 sig :1;
             UINT8 fmt :1;
+            UINT8 expiration :1;
         };
         UINT8 all;
     } flags;
@@ -105,6 +120,12 @@ static bool on_option(char key, char *value) {
     case 3:
         ctx.cphash_path = value;
         break;
+    case 4:
+        ctx.ticket_cache_path = value;
+        break;
+    case 5:
+        ctx.stream_path = value;
+        break;
     case 'x':
         ctx.is_nonce_tpm = true;
         break;
@@ -115,6 +136,7 @@ static bool on_option(char key, char *value) {
                     value);
             return false;
         }
+        ctx.flags.expiration = 1;
     }
 
     return true;
@@ -136,6 +158,8 @@ static bool tpm2_tool_onstart(tpm2_options **opts) {
         { "timeout",        required_argument, NULL,  1  },
         { "raw-data",       required_argument, NULL,  2  },
         { "cphash-input",   required_argument, NULL,  3  },
+        { "ticket-cache",   required_argument, NULL,  4  },
+        { "stream",         required_argument, NULL,  5  },
     };
 
     *opts = tpm2_options_new("L:S:g:s:f:c:t:q:x", ARRAY_LEN(topts), topts, on_option,
@@ -151,6 +175,25 @@ static bool is_input_option_args_valid(void) {
             return false;
         }
 
+    if (ctx.stream_path) {
+        if (!ctx.session_path) {
+            LOG_ERR("Must specify -S session file.");
+            return false;
+        }
+
+        if (ctx.flags.sig || ctx.flags.expiration || ctx.policy_digest_path
+                || ctx.policy_qualifier_data || ctx.policy_ticket_path
+                || ctx.policy_timeout_path || ctx.raw_data_path
+                || ctx.cphash_path) {
+            LOG_ERR("The records of the stream carry the assertions, cannot "
+                    "specify -s, -t, -q, -L, --ticket, --timeout, --raw-data "
+                    "or --cphash-input");
+            return false;
+        }
+
+        return true;
+    }
+
     if (ctx.raw_data_path) {
         if (ctx.is_nonce_tpm && !ctx.session_path) {
             LOG_ERR("Must specify -S session file.");
@@ -164,9 +207,280 @@ static bool is_input_option_args_valid(void) {
         return false;
     }
 
+    if (ctx.ticket_cache_path && ctx.expiration >= 0) {
+        LOG_ERR("Only a negative expiration -t produces a ticket to cache.");
+        return false;
+    }
+
     return true;
 }
 
+/* a hex field of a record, "-" for none */
+static bool stream_hex(const char *field, BYTE *buffer, UINT16 *size) {
+
+    if (!strcmp(field, "-")) {
+        *size = 0;
+        return true;
+    }
+
+    return tpm2_util_hex_to_byte_structure(field, size, buffer) == 0;
+}
+
+static tool_rc stream_nonce(ESYS_CONTEXT *ectx, FILE *out) {
+
+    tpm2_session *session = NULL;
+    tool_rc rc = tpm2_session_restore(ectx, ctx.session_path, false,
+            &session);
+    if (rc != tool_rc_success) {
+        return rc;
+    }
+
+    TPM2B_NONCE *nonce_tpm = NULL;
+    rc = tpm2_sess_get_noncetpm(ectx, tpm2_session_get_handle(session),
+            &nonce_tpm);
+    if (rc == tool_rc_success) {
+        fprintf(out, "  nonce-tpm: ");
+        tpm2_util_hexdump2(out, nonce_tpm->buffer, nonce_tpm->size);
+        fprintf(out, "\n");
+        Esys_Free(nonce_tpm);
+    }
+
+    tool_rc tmp_rc = tpm2_session_close(&session);
+
+    return rc != tool_rc_success ? rc : tmp_rc;
+}
+
+static tool_rc stream_sign(ESYS_CONTEXT *ectx, char **fields, size_t count,
+        FILE *out) {
+
+    INT32 expiration;
+    bool result = tpm2_util_string_to_int32(fields[1], &expiration);
+    if (!result) {
+        LOG_ERR("Invalid expiration, got: \"%s\"", fields[1]);
+        return tool_rc_general_error;
+    }
+
+    BYTE buffer[sizeof(TPMT_SIGNATURE)];
+    UINT16 size = sizeof(buffer);
+    TPMT_SIGNATURE signature = { 0 };
+    result = stream_hex(fields[2], buffer, &size) && size
+            && Tss2_MU_TPMT_SIGNATURE_Unmarshal(buffer, size, NULL,
+                    &signature) == TSS2_RC_SUCCESS;
+    if (!result) {
+        LOG_ERR("Expected the signature as the hex of a TPMT_SIGNATURE");
+        return tool_rc_general_error;
+    }
+
+    TPM2B_DIGEST cphash = { .size = sizeof(cphash.buffer) };
+    TPM2B_NONCE policy_qualifier = { .size = sizeof(policy_qualifier.buffer) };
+    result = (count < 4 || stream_hex(fields[3], cphash.buffer, &cphash.size))
+            && (count < 5 || stream_hex(fields[4], policy_qualifier.buffer,
+                    &policy_qualifier.size));
+    if (!result) {
+        LOG_ERR("Expected the cpHash and qualification as hex or -");
+        return tool_rc_general_error;
+    }
+    if (count < 4) {
+        cphash.size = 0;
+    }
+    if (count < 5) {
+        policy_qualifier.size = 0;
+    }
+
+    tpm2_session *session = NULL;
+    tool_rc rc = tpm2_session_restore(ectx, ctx.session_path, false,
+            &session);
+    if (rc != tool_rc_success) {
+        return rc;
+    }
+
+    ESYS_TR handle = tpm2_session_get_handle(session);
+    TPM2B_NONCE *nonce_tpm = NULL;
+    TPM2B_TIMEOUT *timeout = NULL;
+    TPMT_TK_AUTH *policy_ticket = NULL;
+    TPM2B_DIGEST *policy_digest = NULL;
+    if (ctx.is_nonce_tpm) {
+        rc = tpm2_sess_get_noncetpm(ectx, handle, &nonce_tpm);
+        if (rc != tool_rc_success) {
+            goto out;
+        }
+    }
+
+    rc = tpm2_policy_signed(ectx, &ctx.key_context_object, handle,
+            &signature, expiration, &timeout, &policy_ticket,
+            &policy_qualifier, nonce_tpm, &cphash);
+    if (rc != tool_rc_success) {
+        goto out;
+    }
+
+    rc = tpm2_policy_get_digest(ectx, session, &policy_digest);
+    if (rc != tool_rc_success) {
+        goto out;
+    }
+
+    fprintf(out, "  policy-digest: ");
+    tpm2_util_hexdump2(out, policy_digest->buffer, policy_digest->size);
+    fprintf(out, "\n");
+    if (timeout->size) {
+        fprintf(out, "  timeout: ");
+        tpm2_util_hexdump2(out, timeout->buffer, timeout->size);
+        fprintf(out, "\n");
+    }
+
+    /* only a negative expiration yields a ticket */
+    if (ctx.ticket_cache_path && expiration < 0
+            && policy_ticket->digest.size) {
+        rc = tpm2_policy_cache_ticket_key(ectx, ctx.ticket_cache_path,
+                &ctx.key_context_object, &policy_qualifier, &cphash,
+                expiration, timeout, policy_ticket);
+        fprintf(out, "  ticket-cached: %s\n",
+                rc == tool_rc_success ? "true" : "false");
+    }
+
+out:
+    Esys_Free(nonce_tpm);
+    Esys_Free(policy_digest);
+    free(timeout);
+    free(policy_ticket);
+
+    /* saved for the tools that use the session between the records */
+    tool_rc tmp_rc = tpm2_session_close(&session);
+
+    return rc != tool_rc_success ? rc : tmp_rc;
+}
+
+static bool stream_record(ESYS_CONTEXT *ectx, char *line, size_t line_number,
+        FILE *out, tool_rc *rc) {
+
+    char *comment = strchr(line, '#');
+    if (comment) {
+        *comment = '\0';
+    }
+
+    char *fields[STREAM_FIELDS_MAX + 1];
+    size_t count = 0;
+    char *saveptr = NULL;
+    char *token = strtok_r(line, " \t\r\n", &saveptr);
+    while (token && count < ARRAY_LEN(fields)) {
+        fields[count++] = token;
+        token = strtok_r(NULL, " \t\r\n", &saveptr);
+    }
+
+    if (!count) {
+        return true;
+    }
+
+    bool is_nonce = !strcmp(fields[0], "nonce") && count == 1;
+    bool is_sign = !strcmp(fields[0], "sign") && count >= 3
+            && count <= STREAM_FIELDS_MAX;
+    if (!is_nonce && !is_sign) {
+        LOG_ERR("%s:%zu: Expected: nonce, or sign <expiration> <signature> "
+                "[<cphash>|- [<qualification>|-]]", ctx.stream_path,
+                line_number);
+        return false;
+    }
+
+    fprintf(out, "- line: %zu\n", line_number);
+    tool_rc tmp_rc = is_nonce ? stream_nonce(ectx, out) :
+            stream_sign(ectx, fields, count, out);
+    if (is_sign) {
+        fprintf(out, "  authorized: %s\n",
+                tmp_rc == tool_rc_success ? "true" : "false");
+    }
+    fflush(out);
+
+    if (tmp_rc != tool_rc_success && *rc == tool_rc_success) {
+        *rc = tmp_rc;
+    }
+
+    return true;
+}
+
+static bool stream_open(FILE **in, FILE **out) {
+
+    if (!strcmp(ctx.stream_path, "-")) {
+        *in = stdin;
+        *out = stdout;
+        return true;
+    }
+
+    size_t len = strlen(STREAM_SOCKET_PREFIX);
+    if (strncmp(ctx.stream_path, STREAM_SOCKET_PREFIX, len)) {
+        *in = files_fopen(ctx.stream_path, "r");
+        if (!*in) {
+            LOG_ERR("Could not open stream \"%s\", error: %s",
+                    ctx.stream_path, strerror(errno));
+            return false;
+        }
+        *out = stdout;
+        return true;
+    }
+
+    /* the replies go back to the signer over the socket */
+    int sock = tpm2_rpc_connect(ctx.stream_path + len);
+    if (sock < 0) {
+        return false;
+    }
+
+    int out_sock = dup(sock);
+    *in = fdopen(sock, "r");
+    *out = out_sock < 0 ? NULL : fdopen(out_sock, "w");
+    if (!*in || !*out) {
+        LOG_ERR("Could not open stream \"%s\", error: %s", ctx.stream_path,
+                strerror(errno));
+        if (*in) {
+            fclose(*in);
+        } else {
+            close(sock);
+        }
+        if (out_sock >= 0 && !*out) {
+            close(out_sock);
+        }
+        return false;
+    }
+
+    return true;
+}
+
+/*
+ * Applies the signed authorizations of the stream to the session as they
+ * arrive, one record per line. The signer need not wait for the answer of a
+ * record before sending the next: the nonceTPM of the session only changes
+ * once the session authorizes a command, so every assertion bound to it stays
+ * valid until then, and one of a negative expiration is kept as a ticket.
+ */
+static tool_rc stream_run(ESYS_CONTEXT *ectx) {
+
+    FILE *in;
+    FILE *out;
+    bool result = stream_open(&in, &out);
+    if (!result) {
+        return tool_rc_general_error;
+    }
+
+    tool_rc rc = tool_rc_success;
+    char *line = NULL;
+    size_t line_size = 0;
+    size_t line_number = 0;
+    while (getline(&line, &line_size, in) != -1) {
+        line_number++;
+        if (!stream_record(ectx, line, line_number, out, &rc)) {
+            rc = tool_rc_general_error;
+            break;
+        }
+    }
+
+    free(line);
+    if (in != stdin) {
+        fclose(in);
+    }
+    if (out != stdout) {
+        fclose(out);
+    }
+
+    return rc;
+}
+
 static tool_rc tpm2_tool_onrun(ESYS_CONTEXT *ectx, tpm2_option_flags flags) {
 
     UNUSED(flags);
@@ -196,6 +510,9 @@ static tool_rc tpm2_tool_onrun(ESYS_CONTEXT *ectx, tpm2_option_flags flags) {
         return tmp_rc;
     }
 
+    if (ctx.stream_path) {
+        return stream_run(ectx);
+    }
 
     tool_rc rc = tpm2_session_restore(ectx, ctx.session_path, false,
             &ctx.session);
@@ -248,6 +565,13 @@ static tool_rc tpm2_tool_onrun(ESYS_CONTEXT *ectx, tpm2_option_flags flags) {
     if (!retval) {
         LOG_ERR("Failed to save auth ticket");
         rc = tool_rc_general_error;
+        goto tpm2_tool_onrun_out;
+    }
+
+    if (ctx.ticket_cache_path) {
+        rc = tpm2_policy_cache_ticket(ectx, ctx.ticket_cache_path,
+                &ctx.key_context_object, ctx.policy_qualifier_data,
+                ctx.cphash_path, ctx.expiration, timeout, policy_ticket);
     }
 
 tpm2_tool_onrun_out:
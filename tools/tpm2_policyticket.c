@@ -24,6 +24,10 @@ struct tpm2_policyticket_ctx {
     char *policy_ticket_path;
 
     const char *auth_name_file;
+
+    const char *cphash_path;
+
+    const char *ticket_cache_path;
 };
 
 static tpm2_policyticket_ctx ctx;
@@ -49,6 +53,12 @@ static bool on_option(char key, char *value) {
     case 1:
         ctx.policy_timeout_path = value;
         break;
+    case 2:
+        ctx.cphash_path = value;
+        break;
+    case 3:
+        ctx.ticket_cache_path = value;
+        break;
     }
 
     return true;
@@ -63,6 +73,8 @@ static bool tpm2_tool_onstart(tpm2_options **opts) {
         { "qualification",  required_argument, NULL, 'q' },
         { "ticket",         required_argument, NULL,  0  },
         { "timeout",        required_argument, NULL,  1  },
+        { "cphash-input",   required_argument, NULL,  2  },
+        { "ticket-cache",   required_argument, NULL,  3  },
     };
 
     *opts = tpm2_options_new("L:S:n:q:", ARRAY_LEN(topts), topts, on_option,
@@ -83,6 +95,15 @@ static bool is_input_option_args_valid(void) {
         return false;
     }
 
+    if (ctx.ticket_cache_path) {
+        if (ctx.policy_ticket_path || ctx.policy_timeout_path) {
+            LOG_ERR("The --ticket-cache takes the place of --ticket and "
+                    "--timeout.");
+            return false;
+        }
+        return true;
+    }
+
     if (!ctx.policy_ticket_path) {
         LOG_ERR("Must specify --ticket policy ticket file.");
         return false;
@@ -113,7 +134,8 @@ static tool_rc tpm2_tool_onrun(ESYS_CONTEXT *ectx, tpm2_option_flags flags) {
 
     rc = tpm2_policy_build_policyticket(ectx, ctx.session,
         ctx.policy_timeout_path, ctx.policy_qualifier_data,
-        ctx.policy_ticket_path, ctx.auth_name_file);
+        ctx.policy_ticket_path, ctx.auth_name_file, ctx.cphash_path,
+        ctx.ticket_cache_path);
     if (rc != tool_rc_success) {
         LOG_ERR("Could not build policyticket TPM");
         return rc;
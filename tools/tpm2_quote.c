@@ -1,5 +1,6 @@
 /* SPDX-License-Identifier: BSD-3-Clause */
 
+#include <errno.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -11,9 +12,13 @@
 #include "tpm2_alg_util.h"
 #include "tpm2_convert.h"
 #include "tpm2_openssl.h"
+#include "tpm2_quote_bundle.h"
 #include "tpm2_systemdeps.h"
 #include "tpm2_tool.h"
 
+/* PCR selection, qualification, message, signature and PCR output */
+#define MANIFEST_FIELDS 5
+
 typedef struct tpm_quote_ctx tpm_quote_ctx;
 struct tpm_quote_ctx {
     struct {
@@ -36,6 +41,9 @@ struct tpm_quote_ctx {
     tpm2_convert_pcrs_output_fmt pcrs_format;
 
     char *cp_hash_path;
+    const char *manifest_path;
+    const char *bundle_path;
+    const char *eventlog_path;
 };
 
 static tpm_quote_ctx ctx = {
@@ -57,6 +65,30 @@ static bool write_output_files(TPM2B_ATTEST *quoted, TPMT_SIGNATURE *signature)
                 (UINT8*) quoted->attestationData, quoted->size);
     }
 
+    if (ctx.bundle_path) {
+        const UINT8 *eventlog = NULL;
+        size_t eventlog_size = 0;
+        files_input input;
+        if (ctx.eventlog_path) {
+            if (!files_input_open(&input, ctx.eventlog_path)) {
+                return false;
+            }
+            if (!files_input_read_all(&input, &eventlog, &eventlog_size)) {
+                LOG_ERR("Could not read the event log \"%s\"",
+                        ctx.eventlog_path);
+                files_input_close(&input);
+                return false;
+            }
+        }
+
+        res &= tpm2_quote_bundle_write(ctx.bundle_path, quoted, signature,
+                &ctx.pcr_selections, &ctx.pcrs, eventlog, eventlog_size);
+
+        if (ctx.eventlog_path) {
+            files_input_close(&input);
+        }
+    }
+
     if (ctx.pcr_output) {
         if (ctx.pcrs_format == pcrs_output_format_serialized) {
             res &= pcr_fwrite_serialized(&ctx.pcr_selections, &ctx.pcrs,
@@ -64,6 +96,9 @@ static bool write_output_files(TPM2B_ATTEST *quoted, TPMT_SIGNATURE *signature)
         } else if (ctx.pcrs_format == pcrs_output_format_values) {
             res &= pcr_fwrite_values(&ctx.pcr_selections, &ctx.pcrs,
                                      ctx.pcr_output);
+        } else if (ctx.pcrs_format == pcrs_output_format_bundle) {
+            res &= pcr_bundle_write(&ctx.pcr_selections, &ctx.pcrs,
+                                    ctx.pcr_output);
         }
     }
 
@@ -121,7 +156,8 @@ static tool_rc quote(ESYS_CONTEXT *ectx, TPML_PCR_SELECTION *pcr_selection) {
     tpm2_tool_output("\n");
     free(sig);
 
-    if (ctx.pcr_output) {
+    /* a bundle carries the quoted PCR values */
+    if (ctx.pcr_output || ctx.bundle_path) {
         // Filter out invalid/unavailable PCR selections
         if (!pcr_check_pcr_selection(&ctx.cap_data, &ctx.pcr_selections)) {
             LOG_ERR("Failed to filter unavailable PCR values for quote!");
@@ -175,6 +211,257 @@ static tool_rc quote(ESYS_CONTEXT *ectx, TPML_PCR_SELECTION *pcr_selection) {
     return res ? tool_rc_success : tool_rc_general_error;
 }
 
+/*
+ * A quote of a manifest. The paths point into the manifest line, the quote is
+ * kept until the PCR values read for all quotes have been checked against it.
+ */
+typedef struct manifest_quote manifest_quote;
+struct manifest_quote {
+    char *line;
+    size_t line_number;
+    TPML_PCR_SELECTION pcr_selections;
+    TPM2B_DATA qualification_data;
+    const char *message_path;
+    const char *signature_path;
+    const char *pcr_path;
+    TPM2B_ATTEST *quoted;
+    bool is_quoted;
+};
+
+typedef struct manifest manifest;
+struct manifest {
+    manifest_quote *quotes;
+    size_t count;
+};
+
+static bool manifest_add(void *e, char *line, char **fields, size_t count,
+        size_t line_number, void *userdata) {
+
+    UNUSED(userdata);
+
+    manifest_quote *quote = (manifest_quote *) e;
+    quote->line = line;
+    quote->line_number = line_number;
+    quote->message_path = fields[2];
+    quote->signature_path = fields[3];
+
+    if (count > 4 && strcmp(fields[4], "-")) {
+        quote->pcr_path = fields[4];
+    }
+
+    if (!pcr_parse_selections(fields[0], &quote->pcr_selections)) {
+        LOG_ERR("%s:%zu: Could not parse pcr selections, got: \"%s\"",
+                ctx.manifest_path, line_number, fields[0]);
+        return false;
+    }
+
+    if (strcmp(fields[1], "-")) {
+        quote->qualification_data.size =
+                sizeof(quote->qualification_data.buffer);
+        if (!tpm2_util_bin_from_hex_or_file(fields[1],
+                &quote->qualification_data.size,
+                quote->qualification_data.buffer)) {
+            LOG_ERR("%s:%zu: Invalid qualification \"%s\"",
+                    ctx.manifest_path, line_number, fields[1]);
+            return false;
+        }
+    }
+
+    return true;
+}
+
+static bool manifest_load(manifest *m) {
+
+    return tpm2_util_manifest_read(ctx.manifest_path, 4, MANIFEST_FIELDS,
+            "<pcr-list> <qualification> <message> <signature> [<pcr>]",
+            (void **) &m->quotes, &m->count, sizeof(*m->quotes),
+            manifest_add, NULL);
+}
+
+static void manifest_free(manifest *m) {
+
+    size_t i;
+    for (i = 0; i < m->count; i++) {
+        free(m->quotes[i].line);
+        free(m->quotes[i].quoted);
+    }
+    free(m->quotes);
+}
+
+/*
+ * Quotes every selection with the loaded AK. The next quote is sent before
+ * the message and signature of the previous one are written, so the TPM
+ * does not wait on the file system.
+ */
+static void manifest_quote_all(ESYS_CONTEXT *ectx, manifest *m,
+        TPMT_SIG_SCHEME *in_scheme) {
+
+    bool is_sent = tpm2_quote_async(ectx, &ctx.key.object, in_scheme,
+            &m->quotes[0].qualification_data,
+            &m->quotes[0].pcr_selections) == tool_rc_success;
+
+    size_t i;
+    for (i = 0; i < m->count; i++) {
+        manifest_quote *quote = &m->quotes[i];
+
+        TPMT_SIGNATURE *signature = NULL;
+        quote->is_quoted = is_sent && tpm2_quote_finish(ectx, &quote->quoted,
+                &signature) == tool_rc_success;
+
+        is_sent = false;
+        if (i + 1 < m->count) {
+            manifest_quote *next = &m->quotes[i + 1];
+            is_sent = tpm2_quote_async(ectx, &ctx.key.object, in_scheme,
+                    &next->qualification_data,
+                    &next->pcr_selections) == tool_rc_success;
+        }
+
+        if (quote->is_quoted) {
+            quote->is_quoted = tpm2_convert_sig_save(signature,
+                    ctx.sig_format, quote->signature_path)
+                && files_save_bytes_to_file(quote->message_path,
+                    (UINT8 *) quote->quoted->attestationData,
+                    quote->quoted->size);
+        }
+        free(signature);
+    }
+}
+
+static bool manifest_quote_pcrs(manifest_quote *quote,
+        TPML_PCR_SELECTION *read_selections, tpm2_pcrs *read_pcrs) {
+
+    tpm2_pcrs pcrs = { 0 };
+    bool result = pcr_select_pcr_values(read_selections, read_pcrs,
+            &quote->pcr_selections, &pcrs);
+    if (!result) {
+        goto out;
+    }
+
+    TPMS_ATTEST attest;
+    result = files_tpm2b_attest_to_tpms_attest(quote->quoted, &attest)
+            == tool_rc_success;
+    if (!result) {
+        goto out;
+    }
+
+    TPM2B_DIGEST pcr_digest = TPM2B_TYPE_INIT(TPM2B_DIGEST, buffer);
+    result = tpm2_openssl_hash_pcr_banks(ctx.sig_hash_algorithm,
+            &quote->pcr_selections, &pcrs, &pcr_digest);
+    if (!result) {
+        LOG_ERR("%s:%zu: Failed to hash PCR values related to quote",
+                ctx.manifest_path, quote->line_number);
+        goto out;
+    }
+
+    result = tpm2_util_verify_digests(&attest.attested.quote.pcrDigest,
+            &pcr_digest);
+    if (!result) {
+        LOG_ERR("%s:%zu: Error validating calculated PCR composite with quote",
+                ctx.manifest_path, quote->line_number);
+        goto out;
+    }
+
+    FILE *f = files_fopen(quote->pcr_path, "wb+");
+    if (!f) {
+        LOG_ERR("Could not open PCR output file \"%s\" error: \"%s\"",
+                quote->pcr_path, strerror(errno));
+        result = false;
+        goto out;
+    }
+
+    if (ctx.pcrs_format == pcrs_output_format_serialized) {
+        result = pcr_fwrite_serialized(&quote->pcr_selections, &pcrs, f);
+    } else if (ctx.pcrs_format == pcrs_output_format_bundle) {
+        result = pcr_bundle_write(&quote->pcr_selections, &pcrs, f);
+    } else {
+        result = pcr_fwrite_values(&quote->pcr_selections, &pcrs, f);
+    }
+    fclose(f);
+
+out:
+    pcr_pcrs_free(&pcrs);
+
+    return result;
+}
+
+/*
+ * The PCRs of all quotes are read once, after the quotes, and each quote
+ * picks its values from that read, so overlapping selections cost nothing.
+ */
+static tool_rc manifest_run(ESYS_CONTEXT *ectx) {
+
+    manifest m = { 0 };
+    tpm2_pcrs pcrs = { 0 };
+    tool_rc rc = tool_rc_general_error;
+
+    if (!manifest_load(&m)) {
+        goto out;
+    }
+
+    if (!m.count) {
+        rc = tool_rc_success;
+        goto out;
+    }
+
+    TPMT_SIG_SCHEME in_scheme = { .scheme = TPM2_ALG_NULL };
+    rc = tpm2_alg_util_get_signature_scheme(ectx, ctx.key.object.tr_handle,
+            &ctx.sig_hash_algorithm, TPM2_ALG_NULL, &in_scheme);
+    if (rc != tool_rc_success) {
+        goto out;
+    }
+
+    manifest_quote_all(ectx, &m, &in_scheme);
+
+    TPML_PCR_SELECTION read_selections = TPML_PCR_SELECTION_EMPTY_INIT;
+    size_t i;
+    for (i = 0; i < m.count; i++) {
+        manifest_quote *quote = &m.quotes[i];
+        if (!quote->is_quoted || !quote->pcr_path) {
+            continue;
+        }
+
+        if (!pcr_check_pcr_selection(&ctx.cap_data, &quote->pcr_selections)
+                || !pcr_merge_selections(&read_selections,
+                        &quote->pcr_selections)) {
+            LOG_ERR("%s:%zu: Failed to filter unavailable PCR values for "
+                    "quote", ctx.manifest_path, quote->line_number);
+            quote->is_quoted = false;
+        }
+    }
+
+    if (read_selections.count) {
+        rc = pcr_read_pcr_values(ectx, &read_selections, &pcrs);
+        if (rc != tool_rc_success) {
+            LOG_ERR("Failed to retrieve PCR values related to quotes!");
+            goto out;
+        }
+    }
+
+    rc = tool_rc_success;
+    for (i = 0; i < m.count; i++) {
+        manifest_quote *quote = &m.quotes[i];
+        if (quote->is_quoted && quote->pcr_path) {
+            quote->is_quoted = manifest_quote_pcrs(quote, &read_selections,
+                    &pcrs);
+        }
+
+        tpm2_tool_output("- line: %zu\n", quote->line_number);
+        tpm2_tool_output("  message: %s\n", quote->message_path);
+        tpm2_tool_output("  quoted: %s\n",
+                quote->is_quoted ? "true" : "false");
+
+        if (!quote->is_quoted) {
+            rc = tool_rc_general_error;
+        }
+    }
+
+out:
+    pcr_pcrs_free(&pcrs);
+    manifest_free(&m);
+
+    return rc;
+}
+
 static bool on_option(char key, char *value) {
 
     switch (key) {
@@ -230,6 +517,15 @@ static bool on_option(char key, char *value) {
     case 0:
         ctx.cp_hash_path = value;
         break;
+    case 1:
+        ctx.manifest_path = value;
+        break;
+    case 2:
+        ctx.bundle_path = value;
+        break;
+    case 3:
+        ctx.eventlog_path = value;
+        break;
     }
 
     return true;
@@ -248,7 +544,10 @@ static bool tpm2_tool_onstart(tpm2_options **opts) {
         { "pcrs_format",    required_argument, NULL, 'F' },
         { "format",         required_argument, NULL, 'f' },
         { "hash-algorithm", required_argument, NULL, 'g' },
-        { "cphash",         required_argument, NULL,  0  }
+        { "cphash",         required_argument, NULL,  0  },
+        { "manifest",       required_argument, NULL,  1  },
+        { "bundle",         required_argument, NULL,  2  },
+        { "eventlog",       required_argument, NULL,  3  },
     };
 
     *opts = tpm2_options_new("c:p:l:q:s:m:o:F:f:g:", ARRAY_LEN(topts), topts,
@@ -261,8 +560,27 @@ static tool_rc tpm2_tool_onrun(ESYS_CONTEXT *ectx, tpm2_option_flags flags) {
 
     UNUSED(flags);
 
+    if (ctx.manifest_path && (ctx.pcr_selections.count
+            || ctx.qualification_data.size || ctx.signature_path
+            || ctx.message_path || ctx.pcr_path || ctx.cp_hash_path)) {
+        LOG_ERR("--manifest replaces --pcr-list (-l), --qualification (-q), "
+                "--signature (-s), --message (-m) and --pcr (-o) and cannot "
+                "calculate cpHash");
+        return tool_rc_option_error;
+    }
+
+    if (ctx.bundle_path && (ctx.manifest_path || ctx.cp_hash_path)) {
+        LOG_ERR("--bundle cannot be used with --manifest or --cphash");
+        return tool_rc_option_error;
+    }
+
+    if (ctx.eventlog_path && !ctx.bundle_path) {
+        LOG_ERR("--eventlog is only carried in a bundle, expected --bundle");
+        return tool_rc_option_error;
+    }
+
     /* TODO this whole file needs to be re-done, especially the option validation */
-    if (!ctx.pcr_selections.count) {
+    if (!ctx.pcr_selections.count && !ctx.manifest_path) {
         LOG_ERR("Expected -l to be specified.");
         return tool_rc_option_error;
     }
@@ -280,7 +598,7 @@ static tool_rc tpm2_tool_onrun(ESYS_CONTEXT *ectx, tpm2_option_flags flags) {
     }
 
     if (ctx.pcr_path) {
-        ctx.pcr_output = fopen(ctx.pcr_path, "wb+");
+        ctx.pcr_output = files_fopen(ctx.pcr_path, "wb+");
         if (!ctx.pcr_output) {
             LOG_ERR("Could not open PCR output file \"%s\" error: \"%s\"",
                     ctx.pcr_path, strerror(errno));
@@ -293,6 +611,10 @@ static tool_rc tpm2_tool_onrun(ESYS_CONTEXT *ectx, tpm2_option_flags flags) {
         return rc;
     }
 
+    if (ctx.manifest_path) {
+        return manifest_run(ectx);
+    }
+
     return quote(ectx, &ctx.pcr_selections);
 }
 
@@ -301,6 +623,7 @@ static tool_rc tpm2_tool_onstop(ESYS_CONTEXT *ectx) {
     if (ctx.pcr_output) {
         fclose(ctx.pcr_output);
     }
+    pcr_pcrs_free(&ctx.pcrs);
     return tpm2_session_close(&ctx.key.object.session);
 }
 
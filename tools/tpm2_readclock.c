@@ -1,12 +1,126 @@
 /* SPDX-License-Identifier: BSD-3-Clause */
+#include <stdio.h>
+
+#include "log.h"
 #include "tpm2.h"
+#include "tpm2_clock_monitor.h"
 #include "tpm2_tool.h"
 #include "tpm2_util.h"
+#include "tpm2_writer.h"
+
+typedef struct tpm_readclock_ctx tpm_readclock_ctx;
+struct tpm_readclock_ctx {
+    /* seconds between the samples of the clock, 0 to read it once */
+    UINT32 watch_interval;
+    UINT32 polls;
+    UINT64 max_drift;
+};
+
+static tpm_readclock_ctx ctx = {
+    .max_drift = 1000,
+};
+
+/*
+ * Outputs the clock, then samples it every interval and outputs the samples
+ * with an anomaly only. Every output is a document of its own, written out
+ * at once.
+ */
+static tool_rc watch_clock(ESYS_CONTEXT *ectx) {
+
+    tpm2_clock_monitor m;
+    tpm2_clock_monitor_init(&m, ctx.max_drift);
+
+    TPMS_TIME_INFO info;
+    UINT32 anomalies = 0;
+    tool_rc rc = tpm2_clock_monitor_read(ectx, &m, &info, &anomalies);
+    if (rc != tool_rc_success) {
+        return rc;
+    }
+
+    tpm2_writer_document_start();
+    tpm2_clock_monitor_print(&m, 0, 0);
+    tpm2_writer_document_end();
+    fflush(stdout);
+
+    UINT32 poll;
+    for (poll = 1; !ctx.polls || poll <= ctx.polls; poll++) {
+        tpm2_clock_monitor_sleep(ctx.watch_interval);
+
+        rc = tpm2_clock_monitor_read(ectx, &m, &info, &anomalies);
+        if (rc != tool_rc_success) {
+            return rc;
+        }
+
+        if (!anomalies) {
+            continue;
+        }
+
+        tpm2_writer_document_start();
+        tpm2_clock_monitor_print(&m, poll, anomalies);
+        tpm2_writer_document_end();
+        fflush(stdout);
+    }
+
+    return tool_rc_success;
+}
+
+static bool on_option(char key, char *value) {
+
+    switch (key) {
+    case 0:
+        if (!tpm2_util_string_to_uint32(value, &ctx.watch_interval) ||
+            !ctx.watch_interval) {
+            LOG_ERR("Invalid watch interval, expected a number of seconds, "
+                    "got: \"%s\"", value);
+            return false;
+        }
+        break;
+    case 1:
+        if (!tpm2_util_string_to_uint32(value, &ctx.polls)) {
+            LOG_ERR("Invalid number of polls, got: \"%s\"", value);
+            return false;
+        }
+        break;
+    case 2:
+        if (!tpm2_util_string_to_uint64(value, &ctx.max_drift)) {
+            LOG_ERR("Invalid maximum drift, expected a number of ms, got: "
+                    "\"%s\"", value);
+            return false;
+        }
+        break;
+        /* no default */
+    }
+
+    return true;
+}
+
+static bool tpm2_tool_onstart(tpm2_options **opts) {
+
+    static struct option topts[] = {
+         { "watch",          required_argument, NULL,  0  },
+         { "polls",          required_argument, NULL,  1  },
+         { "max-drift",      required_argument, NULL,  2  },
+     };
+
+    *opts = tpm2_options_new(NULL, ARRAY_LEN(topts), topts, on_option, NULL,
+            0);
+
+    return *opts != NULL;
+}
 
 static tool_rc tpm2_tool_onrun(ESYS_CONTEXT *ectx, tpm2_option_flags flags) {
 
     UNUSED(flags);
 
+    if (ctx.polls && !ctx.watch_interval) {
+        LOG_ERR("--polls requires --watch");
+        return tool_rc_option_error;
+    }
+
+    if (ctx.watch_interval) {
+        return watch_clock(ectx);
+    }
+
     TPMS_TIME_INFO *current_time = NULL;
     tool_rc rc = tpm2_readclock(ectx, &current_time);
     if (rc == tool_rc_success) {
@@ -18,4 +132,4 @@ static tool_rc tpm2_tool_onrun(ESYS_CONTEXT *ectx, tpm2_option_flags flags) {
 }
 
 // Register this tool with tpm2_tool.c
-TPM2_TOOL_REGISTER("readclock", NULL, tpm2_tool_onrun, NULL, NULL)
+TPM2_TOOL_REGISTER("readclock", tpm2_tool_onstart, tpm2_tool_onrun, NULL, NULL)
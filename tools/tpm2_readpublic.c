@@ -1,11 +1,15 @@
 /* SPDX-License-Identifier: BSD-3-Clause */
 
+#include <limits.h>
 #include <stdbool.h>
+#include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "files.h"
 #include "log.h"
 #include "tpm2.h"
+#include "tpm2_capability.h"
 #include "tpm2_convert.h"
 #include "tpm2_tool.h"
 
@@ -21,6 +25,15 @@ struct tpm_readpub_ctx {
     tpm2_loaded_object context_object;
     const char *context_arg;
     const char *out_tr_file;
+
+    /* the formats of -f, more than one in bulk mode only */
+    tpm2_convert_pubkey_fmt formats[pubkey_format_err];
+    size_t format_count;
+
+    /* bulk mode, the objects of the arguments and/or all persistent ones */
+    char **objects;
+    int object_count;
+    bool is_persistent;
 };
 
 static tpm_readpub_ctx ctx = {
@@ -41,12 +54,7 @@ static tool_rc read_public_and_save(ESYS_CONTEXT *ectx) {
         return tmp_rc;
     }
 
-    tpm2_tool_output("name: ");
-    UINT16 i;
-    for (i = 0; i < name->size; i++) {
-        tpm2_tool_output("%02x", name->name[i]);
-    }
-    tpm2_tool_output("\n");
+    tpm2_writer_hex("name", NULL, name->name, name->size, false);
 
     bool ret = true;
     if (ctx.out_name_file) {
@@ -58,13 +66,10 @@ static tool_rc read_public_and_save(ESYS_CONTEXT *ectx) {
         }
     }
 
-    tpm2_tool_output("qualified name: ");
-    for (i = 0; i < qualified_name->size; i++) {
-        tpm2_tool_output("%02x", qualified_name->name[i]);
-    }
-    tpm2_tool_output("\n");
+    tpm2_writer_hex("qualified name", NULL, qualified_name->name,
+            qualified_name->size, false);
 
-    tpm2_util_public_to_yaml(public, NULL);
+    tpm2_util_public_to_yaml(public);
 
     ret = ctx.output_path ?
             tpm2_convert_pubkey_save(public, ctx.format, ctx.output_path) :
@@ -96,6 +101,192 @@ out:
     return rc;
 }
 
+static const char *format_extension(tpm2_convert_pubkey_fmt format) {
+
+    static const char *extensions[] = {
+        [pubkey_format_tss] = "tss",
+        [pubkey_format_pem] = "pem",
+        [pubkey_format_der] = "der",
+        [pubkey_format_tpmt] = "tpmt",
+        [pubkey_format_ssh] = "ssh",
+    };
+
+    return extensions[format];
+}
+
+/*
+ * Reads the public area of an object once and writes it in every format of
+ * -f, the OpenSSL key of the PEM and DER formats is built once for both.
+ */
+static tool_rc bulk_export(ESYS_CONTEXT *ectx, const char *object_str) {
+
+    tpm2_loaded_object object = { 0 };
+    tool_rc rc = tpm2_util_object_load(ectx, object_str, &object,
+            TPM2_HANDLE_ALL_W_NV);
+    if (rc != tool_rc_success) {
+        return rc;
+    }
+
+    TPM2B_PUBLIC *public = NULL;
+    TPM2B_NAME *name = NULL;
+    TPM2B_NAME *qualified_name = NULL;
+    rc = tpm2_readpublic(ectx, object.tr_handle, &public, &name,
+            &qualified_name);
+    if (rc != tool_rc_success) {
+        goto out;
+    }
+
+    /* the files of a handle are named by it, those of a context by the file */
+    char label[PATH_MAX];
+    if (object.handle) {
+        snprintf(label, sizeof(label), "0x%08x", object.handle);
+    } else {
+        const char *base = strrchr(object_str, '/');
+        snprintf(label, sizeof(label), "%s", base ? base + 1 : object_str);
+    }
+
+    tpm2_writer_map_start(NULL);
+    tpm2_writer_string("object", "%s", label);
+    tpm2_writer_hex("name", NULL, name->name, name->size, false);
+    tpm2_writer_hex("qualified name", NULL, qualified_name->name,
+            qualified_name->size, false);
+    tpm2_util_public_to_yaml(public);
+
+    if (ctx.output_path) {
+        tpm2_writer_flow_start("files");
+
+        tpm2_convert_pubkey key;
+        tpm2_convert_pubkey_init(&key, public);
+
+        size_t i;
+        for (i = 0; i < ctx.format_count; i++) {
+            char path[PATH_MAX];
+            int len = snprintf(path, sizeof(path), "%s/%s.%s",
+                    ctx.output_path, label,
+                    format_extension(ctx.formats[i]));
+            if (len < 0 || (size_t) len >= sizeof(path)) {
+                LOG_ERR("Output path for \"%s\" is too long", label);
+                rc = tool_rc_general_error;
+                break;
+            }
+
+            if (!tpm2_convert_pubkey_write(&key, ctx.formats[i], path)) {
+                rc = tool_rc_general_error;
+                break;
+            }
+            tpm2_writer_string(NULL, "%s", path);
+        }
+
+        tpm2_convert_pubkey_free(&key);
+        tpm2_writer_end();
+    }
+
+    tpm2_writer_end();
+
+out:
+    free(public);
+    free(name);
+    free(qualified_name);
+
+    tool_rc tmp_rc = tpm2_util_object_unload(ectx, &object);
+    if (rc == tool_rc_success) {
+        rc = tmp_rc;
+    }
+
+    return rc;
+}
+
+static tool_rc bulk_run(ESYS_CONTEXT *ectx) {
+
+    tool_rc rc = tool_rc_success;
+
+    tpm2_writer_list_start(NULL);
+
+    /* an object that fails does not keep the others from being exported */
+    int i;
+    for (i = 0; i < ctx.object_count; i++) {
+        tool_rc tmp_rc = bulk_export(ectx, ctx.objects[i]);
+        if (tmp_rc != tool_rc_success) {
+            LOG_ERR("Could not export the public key of \"%s\"",
+                    ctx.objects[i]);
+            rc = tmp_rc;
+        }
+    }
+
+    if (ctx.is_persistent) {
+        TPMS_CAPABILITY_DATA *capability_data = NULL;
+        tool_rc tmp_rc = tpm2_capability_get(ectx, TPM2_CAP_HANDLES,
+                TPM2_PERSISTENT_FIRST, TPM2_MAX_CAP_HANDLES, &capability_data);
+        if (tmp_rc != tool_rc_success) {
+            rc = tmp_rc;
+            goto out;
+        }
+
+        TPML_HANDLE *handles = &capability_data->data.handles;
+        UINT32 j;
+        for (j = 0; j < handles->count; j++) {
+            if (handles->handle[j] >> TPM2_HR_SHIFT != TPM2_HT_PERSISTENT) {
+                break;
+            }
+
+            char handle[sizeof("0x00000000")];
+            snprintf(handle, sizeof(handle), "0x%08x", handles->handle[j]);
+            tmp_rc = bulk_export(ectx, handle);
+            if (tmp_rc != tool_rc_success) {
+                LOG_ERR("Could not export the public key of %s", handle);
+                rc = tmp_rc;
+            }
+        }
+
+        free(capability_data);
+    }
+
+out:
+    tpm2_writer_end();
+
+    return rc;
+}
+
+static bool on_formats(char *value) {
+
+    char *saveptr = NULL;
+    char *label;
+    for (label = strtok_r(value, ",", &saveptr); label;
+            label = strtok_r(NULL, ",", &saveptr)) {
+        tpm2_convert_pubkey_fmt format =
+                tpm2_convert_pubkey_fmt_from_optarg(label);
+        if (format == pubkey_format_err) {
+            return false;
+        }
+
+        size_t i;
+        for (i = 0; i < ctx.format_count; i++) {
+            if (ctx.formats[i] == format) {
+                LOG_ERR("Format \"%s\" given twice", label);
+                return false;
+            }
+        }
+        ctx.formats[ctx.format_count++] = format;
+    }
+
+    if (!ctx.format_count) {
+        LOG_ERR("Expected a public key format");
+        return false;
+    }
+
+    ctx.format = ctx.formats[0];
+
+    return true;
+}
+
+static bool on_args(int argc, char **argv) {
+
+    ctx.objects = argv;
+    ctx.object_count = argc;
+
+    return true;
+}
+
 static bool on_option(char key, char *value) {
 
     switch (key) {
@@ -106,8 +297,8 @@ static bool on_option(char key, char *value) {
         ctx.output_path = value;
         break;
     case 'f':
-        ctx.format = tpm2_convert_pubkey_fmt_from_optarg(value);
-        if (ctx.format == pubkey_format_err) {
+        ctx.format_count = 0;
+        if (!on_formats(value)) {
             return false;
         }
         ctx.flags.f = 1;
@@ -121,6 +312,9 @@ static bool on_option(char key, char *value) {
     case 'q':
         ctx.out_qname_file = value;
         break;
+    case 0:
+        ctx.is_persistent = true;
+        break;
     }
 
     return true;
@@ -134,11 +328,12 @@ static bool tpm2_tool_onstart(tpm2_options **opts) {
         { "format",            required_argument, NULL, 'f' },
         { "name",              required_argument, NULL, 'n' },
         { "serialized-handle", required_argument, NULL, 't' },
-        { "qualified-name",    required_argument, NULL, 'q' }
+        { "qualified-name",    required_argument, NULL, 'q' },
+        { "persistent",        no_argument,       NULL,  0  },
     };
 
     *opts = tpm2_options_new("o:c:f:n:t:q:", ARRAY_LEN(topts), topts, on_option,
-            NULL, 0);
+            on_args, TPM2_OPTIONS_JSON);
 
     return *opts != NULL;
 }
@@ -163,11 +358,46 @@ static tool_rc init(ESYS_CONTEXT *context) {
     return tool_rc_success;
 }
 
+static tool_rc check_options(void) {
+
+    bool is_bulk = ctx.object_count || ctx.is_persistent;
+    if (!is_bulk) {
+        if (ctx.format_count > 1) {
+            LOG_ERR("More than one format needs objects as arguments or "
+                    "--persistent");
+            return tool_rc_option_error;
+        }
+        return tool_rc_success;
+    }
+
+    if (ctx.context_arg || ctx.out_name_file || ctx.out_qname_file
+            || ctx.out_tr_file) {
+        LOG_ERR("Objects as arguments or --persistent cannot be combined "
+                "with -c, -n, -q or -t");
+        return tool_rc_option_error;
+    }
+
+    if (ctx.output_path && !ctx.format_count) {
+        ctx.formats[ctx.format_count++] = ctx.format;
+    }
+
+    return tool_rc_success;
+}
+
 static tool_rc tpm2_tool_onrun(ESYS_CONTEXT *context, tpm2_option_flags flags) {
 
     UNUSED(flags);
 
-    tool_rc rc = init(context);
+    tool_rc rc = check_options();
+    if (rc != tool_rc_success) {
+        return rc;
+    }
+
+    if (ctx.object_count || ctx.is_persistent) {
+        return bulk_run(context);
+    }
+
+    rc = init(context);
     if (rc != tool_rc_success) {
         return rc;
     }
@@ -1,6 +1,8 @@
 /* SPDX-License-Identifier: BSD-3-Clause */
 
+#include <errno.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "files.h"
 #include "log.h"
@@ -26,6 +28,8 @@ struct tpm_rsadecrypt_ctx {
     const char *scheme_str;
 
     char *cp_hash_path;
+
+    bool is_batch;
 };
 
 static tpm_rsadecrypt_ctx ctx = {
@@ -60,7 +64,7 @@ static tool_rc rsa_decrypt_and_save(ESYS_CONTEXT *ectx) {
 
     bool ret = false;
     FILE *f =
-            ctx.output_file_path ? fopen(ctx.output_file_path, "wb+") : stdout;
+            ctx.output_file_path ? files_fopen(ctx.output_file_path, "wb+") : stdout;
     if (!f) {
         goto out;
     }
@@ -76,6 +80,130 @@ out:
     return ret ? tool_rc_success : tool_rc_general_error;
 }
 
+typedef struct decrypt_job decrypt_job;
+struct decrypt_job {
+    TPM2B_PUBLIC_KEY_RSA cipher_text;
+};
+
+/*
+ * Reads the next cipher text record and sends it to the TPM. Returns false at
+ * the end of the input, or on an error setting rc.
+ */
+static bool batch_next(ESYS_CONTEXT *ectx, FILE *input, decrypt_job *job,
+        tool_rc *rc) {
+
+    bool is_end = false;
+    job->cipher_text.size = sizeof(job->cipher_text.buffer);
+    bool result = files_read_record(input, job->cipher_text.buffer,
+            &job->cipher_text.size, &is_end);
+    if (!result) {
+        LOG_ERR("Could not read the cipher text records");
+        *rc = tool_rc_general_error;
+        return false;
+    }
+
+    if (is_end) {
+        return false;
+    }
+
+    tool_rc tmp_rc = tpm2_rsa_decrypt_async(ectx, &ctx.key.object,
+            &job->cipher_text, &ctx.scheme, &ctx.label);
+    if (tmp_rc != tool_rc_success) {
+        *rc = tmp_rc;
+        return false;
+    }
+
+    return true;
+}
+
+/*
+ * Decrypts every record of the input with the loaded key and session. The
+ * next cipher text is sent before the message of the previous one is
+ * written, so the TPM never waits on the file system. The first failure
+ * stops the batch, the messages decrypted so far are all written.
+ */
+static tool_rc batch_decrypt(ESYS_CONTEXT *ectx, FILE *input, FILE *output) {
+
+    decrypt_job jobs[2];
+    decrypt_job *cur = &jobs[0];
+    decrypt_job *next = &jobs[1];
+
+    tool_rc rc = tool_rc_success;
+    bool has_cur = batch_next(ectx, input, cur, &rc);
+    while (has_cur) {
+        TPM2B_PUBLIC_KEY_RSA *message = NULL;
+        tool_rc tmp_rc = tpm2_rsa_decrypt_finish(ectx, &message);
+        if (tmp_rc != tool_rc_success) {
+            return tmp_rc;
+        }
+
+        bool has_next = batch_next(ectx, input, next, &rc);
+
+        bool result = files_write_record(output, message->buffer,
+                message->size);
+        free(message);
+        if (!result) {
+            LOG_ERR("Could not write message to \"%s\"",
+                    ctx.output_file_path);
+            if (has_next) {
+                /* the sent command is still owed its response */
+                message = NULL;
+                tpm2_rsa_decrypt_finish(ectx, &message);
+                free(message);
+            }
+            return tool_rc_general_error;
+        }
+
+        decrypt_job *tmp = cur;
+        cur = next;
+        next = tmp;
+        has_cur = has_next;
+    }
+
+    return rc;
+}
+
+static tool_rc batch_run(ESYS_CONTEXT *ectx) {
+
+    /* a policy session would need satisfying again for every record */
+    if (ctx.key.object.session && tpm2_session_get_type(
+            ctx.key.object.session) == TPM2_SE_POLICY) {
+        LOG_ERR("Batch decryption cannot satisfy a policy session for every "
+                "record");
+        return tool_rc_option_error;
+    }
+
+    FILE *input = ctx.input_path ? files_fopen(ctx.input_path, "rb") : stdin;
+    if (!input) {
+        LOG_ERR("Could not open file \"%s\", error: %s", ctx.input_path,
+                strerror(errno));
+        return tool_rc_general_error;
+    }
+
+    tool_rc rc = tool_rc_general_error;
+    FILE *output = files_fopen(ctx.output_file_path, "wb");
+    if (!output) {
+        LOG_ERR("Could not open file \"%s\", error: %s", ctx.output_file_path,
+                strerror(errno));
+        goto out;
+    }
+
+    rc = batch_decrypt(ectx, input, output);
+
+    if (fclose(output)) {
+        LOG_ERR("Could not write file \"%s\", error: %s",
+                ctx.output_file_path, strerror(errno));
+        rc = tool_rc_general_error;
+    }
+
+out:
+    if (input != stdin) {
+        fclose(input);
+    }
+
+    return rc;
+}
+
 static bool on_option(char key, char *value) {
 
     switch (key) {
@@ -95,6 +223,9 @@ static bool on_option(char key, char *value) {
     case 0:
         ctx.cp_hash_path = value;
         break;
+    case 1:
+        ctx.is_batch = true;
+        break;
     case 'l':
         return tpm2_util_get_label(value, &ctx.label);
     }
@@ -122,6 +253,7 @@ static bool tpm2_tool_onstart(tpm2_options **opts) {
       { "scheme",      required_argument, NULL, 's' },
       { "label",       required_argument, NULL, 'l' },
       { "cphash",      required_argument, NULL,  0  },
+      { "batch",       no_argument,       NULL,  1  },
     };
 
     *opts = tpm2_options_new("p:o:c:s:l:", ARRAY_LEN(topts), topts, on_option,
@@ -142,6 +274,11 @@ static tool_rc init(ESYS_CONTEXT *ectx) {
         return tool_rc_option_error;
     }
 
+    if (ctx.is_batch && (ctx.cp_hash_path || !ctx.output_file_path)) {
+        LOG_ERR("Batch decryption needs an output file, and no cphash");
+        return tool_rc_option_error;
+    }
+
     /*
      * Load the decryption key
      */
@@ -180,6 +317,11 @@ static tool_rc init(ESYS_CONTEXT *ectx) {
         }
     }
 
+    /* the records of a batch are streamed as they are decrypted */
+    if (ctx.is_batch) {
+        goto out;
+    }
+
     /*
      * Get enc data blob
      */
@@ -205,7 +347,7 @@ static tool_rc tpm2_tool_onrun(ESYS_CONTEXT *ectx, tpm2_option_flags flags) {
         return rc;
     }
 
-    return rsa_decrypt_and_save(ectx);
+    return ctx.is_batch ? batch_run(ectx) : rsa_decrypt_and_save(ectx);
 }
 
 static tool_rc tpm2_tool_onstop(ESYS_CONTEXT *ectx) {
@@ -1,7 +1,13 @@
 /* SPDX-License-Identifier: BSD-3-Clause */
 
+#include <errno.h>
 #include <stdbool.h>
 #include <stdlib.h>
+#include <string.h>
+
+#include <openssl/err.h>
+#include <openssl/evp.h>
+#include <openssl/rsa.h>
 
 #include "files.h"
 #include "log.h"
@@ -9,6 +15,8 @@
 #include "tpm2.h"
 #include "tpm2_tool.h"
 #include "tpm2_alg_util.h"
+#include "tpm2_convert.h"
+#include "tpm2_openssl.h"
 #include "tpm2_options.h"
 
 typedef struct tpm_rsaencrypt_ctx tpm_rsaencrypt_ctx;
@@ -21,6 +29,10 @@ struct tpm_rsaencrypt_ctx {
     TPMT_RSA_DECRYPT scheme;
     const char *scheme_str;
     TPM2B_DATA label;
+    /* encrypts on the host with a public key, no TPM involved */
+    const char *public_path;
+    EVP_PKEY *pkey;
+    bool is_batch;
 };
 
 static tpm_rsaencrypt_ctx ctx = {
@@ -28,18 +40,134 @@ static tpm_rsaencrypt_ctx ctx = {
     .scheme = { .scheme = TPM2_ALG_RSAES }
 };
 
+/*
+ * Encrypts like the TPM does for the scheme, so either one decrypts in the
+ * TPM. OAEP labels include their NUL byte in both.
+ */
+static bool host_encrypt(const TPM2B_PUBLIC_KEY_RSA *message,
+        TPM2B_PUBLIC_KEY_RSA *cipher_text) {
+
+    bool result = false;
+    EVP_PKEY_CTX *pkey_ctx = EVP_PKEY_CTX_new(ctx.pkey, NULL);
+    if (!pkey_ctx || EVP_PKEY_encrypt_init(pkey_ctx) <= 0) {
+        LOG_ERR("Could not initialize the encryption: %s",
+                ERR_error_string(ERR_get_error(), NULL));
+        goto out;
+    }
+
+    const BYTE *in = message->buffer;
+    size_t in_size = message->size;
+    BYTE padded[sizeof(message->buffer)];
+    int padding;
+    switch (ctx.scheme.scheme) {
+    case TPM2_ALG_RSAES:
+        padding = RSA_PKCS1_PADDING;
+        break;
+    case TPM2_ALG_OAEP:
+        padding = RSA_PKCS1_OAEP_PADDING;
+        break;
+    case TPM2_ALG_NULL: {
+        /* the message is a number below the modulus, left padded as such */
+        size_t key_size = EVP_PKEY_size(ctx.pkey);
+        if (in_size > key_size || key_size > sizeof(padded)) {
+            LOG_ERR("Message of %zu bytes larger than the key", in_size);
+            goto out;
+        }
+        memset(padded, 0, key_size - in_size);
+        memcpy(&padded[key_size - in_size], in, in_size);
+        in = padded;
+        in_size = key_size;
+        padding = RSA_NO_PADDING;
+    }
+        break;
+    default:
+        LOG_ERR("Cannot encrypt with scheme 0x%x on the host",
+                ctx.scheme.scheme);
+        goto out;
+    }
+
+    if (EVP_PKEY_CTX_set_rsa_padding(pkey_ctx, padding) <= 0) {
+        LOG_ERR("Could not set the padding: %s",
+                ERR_error_string(ERR_get_error(), NULL));
+        goto out;
+    }
+
+    if (ctx.scheme.scheme == TPM2_ALG_OAEP) {
+        const EVP_MD *md = tpm2_openssl_halg_from_tpmhalg(
+                ctx.scheme.details.oaep.hashAlg);
+        if (!md) {
+            LOG_ERR("OAEP hash algorithm 0x%x is not supported on the host",
+                    ctx.scheme.details.oaep.hashAlg);
+            goto out;
+        }
+
+        if (EVP_PKEY_CTX_set_rsa_oaep_md(pkey_ctx, md) <= 0
+                || EVP_PKEY_CTX_set_rsa_mgf1_md(pkey_ctx, md) <= 0) {
+            LOG_ERR("Could not set the OAEP hash: %s",
+                    ERR_error_string(ERR_get_error(), NULL));
+            goto out;
+        }
+
+        if (ctx.label.size) {
+            /* OpenSSL takes the label */
+            void *label = OPENSSL_malloc(ctx.label.size);
+            if (!label) {
+                LOG_ERR("oom");
+                goto out;
+            }
+            memcpy(label, ctx.label.buffer, ctx.label.size);
+            if (EVP_PKEY_CTX_set0_rsa_oaep_label(pkey_ctx, label,
+                    ctx.label.size) <= 0) {
+                LOG_ERR("Could not set the OAEP label: %s",
+                        ERR_error_string(ERR_get_error(), NULL));
+                OPENSSL_free(label);
+                goto out;
+            }
+        }
+    }
+
+    size_t out_size = sizeof(cipher_text->buffer);
+    if (EVP_PKEY_encrypt(pkey_ctx, cipher_text->buffer, &out_size, in,
+            in_size) <= 0) {
+        LOG_ERR("Could not encrypt the message: %s",
+                ERR_error_string(ERR_get_error(), NULL));
+        goto out;
+    }
+
+    cipher_text->size = out_size;
+    result = true;
+
+out:
+    EVP_PKEY_CTX_free(pkey_ctx);
+
+    return result;
+}
+
 static tool_rc rsa_encrypt_and_save(ESYS_CONTEXT *context) {
 
     bool ret = false;
     TPM2B_PUBLIC_KEY_RSA *out_data = NULL;
 
-    tool_rc rc = tpm2_rsa_encrypt(context, &ctx.key_context,
-            &ctx.message, &ctx.scheme, &ctx.label, &out_data);
-    if (rc != tool_rc_success) {
-        return rc;
+    tool_rc rc = tool_rc_success;
+    if (ctx.pkey) {
+        out_data = malloc(sizeof(*out_data));
+        if (!out_data) {
+            LOG_ERR("oom");
+            return tool_rc_general_error;
+        }
+        if (!host_encrypt(&ctx.message, out_data)) {
+            free(out_data);
+            return tool_rc_general_error;
+        }
+    } else {
+        rc = tpm2_rsa_encrypt(context, &ctx.key_context,
+                &ctx.message, &ctx.scheme, &ctx.label, &out_data);
+        if (rc != tool_rc_success) {
+            return rc;
+        }
     }
 
-    FILE *f = ctx.output_path ? fopen(ctx.output_path, "wb+") : stdout;
+    FILE *f = ctx.output_path ? files_fopen(ctx.output_path, "wb+") : stdout;
     if (!f) {
         goto out;
     }
@@ -54,6 +182,145 @@ out:
     return ret ? tool_rc_success : tool_rc_general_error;
 }
 
+typedef struct encrypt_job encrypt_job;
+struct encrypt_job {
+    TPM2B_PUBLIC_KEY_RSA message;
+};
+
+static bool batch_read(FILE *input, encrypt_job *job, tool_rc *rc) {
+
+    bool is_end = false;
+    job->message.size = sizeof(job->message.buffer);
+    bool result = files_read_record(input, job->message.buffer,
+            &job->message.size, &is_end);
+    if (!result) {
+        LOG_ERR("Could not read the message records");
+        *rc = tool_rc_general_error;
+        return false;
+    }
+
+    return !is_end;
+}
+
+/*
+ * Reads the next message record and sends it to the TPM. Returns false at the
+ * end of the input, or on an error setting rc.
+ */
+static bool batch_next(ESYS_CONTEXT *ectx, FILE *input, encrypt_job *job,
+        tool_rc *rc) {
+
+    if (!batch_read(input, job, rc)) {
+        return false;
+    }
+
+    tool_rc tmp_rc = tpm2_rsa_encrypt_async(ectx, &ctx.key_context,
+            &job->message, &ctx.scheme, &ctx.label);
+    if (tmp_rc != tool_rc_success) {
+        *rc = tmp_rc;
+        return false;
+    }
+
+    return true;
+}
+
+/*
+ * Encrypts every record of the input with the loaded key, the next message
+ * sent before the cipher text of the previous one is written. The first
+ * failure stops the batch.
+ */
+static tool_rc batch_encrypt(ESYS_CONTEXT *ectx, FILE *input, FILE *output) {
+
+    encrypt_job jobs[2];
+    encrypt_job *cur = &jobs[0];
+    encrypt_job *next = &jobs[1];
+
+    tool_rc rc = tool_rc_success;
+    bool has_cur = batch_next(ectx, input, cur, &rc);
+    while (has_cur) {
+        TPM2B_PUBLIC_KEY_RSA *cipher_text = NULL;
+        tool_rc tmp_rc = tpm2_rsa_encrypt_finish(ectx, &cipher_text);
+        if (tmp_rc != tool_rc_success) {
+            return tmp_rc;
+        }
+
+        bool has_next = batch_next(ectx, input, next, &rc);
+
+        bool result = files_write_record(output, cipher_text->buffer,
+                cipher_text->size);
+        free(cipher_text);
+        if (!result) {
+            LOG_ERR("Could not write cipher text to \"%s\"", ctx.output_path);
+            if (has_next) {
+                /* the sent command is still owed its response */
+                cipher_text = NULL;
+                tpm2_rsa_encrypt_finish(ectx, &cipher_text);
+                free(cipher_text);
+            }
+            return tool_rc_general_error;
+        }
+
+        encrypt_job *tmp = cur;
+        cur = next;
+        next = tmp;
+        has_cur = has_next;
+    }
+
+    return rc;
+}
+
+static tool_rc batch_host_encrypt(FILE *input, FILE *output) {
+
+    tool_rc rc = tool_rc_success;
+    encrypt_job job;
+    while (batch_read(input, &job, &rc)) {
+        TPM2B_PUBLIC_KEY_RSA cipher_text;
+        if (!host_encrypt(&job.message, &cipher_text)) {
+            return tool_rc_general_error;
+        }
+
+        if (!files_write_record(output, cipher_text.buffer, cipher_text.size)) {
+            LOG_ERR("Could not write cipher text to \"%s\"", ctx.output_path);
+            return tool_rc_general_error;
+        }
+    }
+
+    return rc;
+}
+
+static tool_rc batch_run(ESYS_CONTEXT *ectx) {
+
+    FILE *input = ctx.input_path ? files_fopen(ctx.input_path, "rb") : stdin;
+    if (!input) {
+        LOG_ERR("Could not open file \"%s\", error: %s", ctx.input_path,
+                strerror(errno));
+        return tool_rc_general_error;
+    }
+
+    tool_rc rc = tool_rc_general_error;
+    FILE *output = files_fopen(ctx.output_path, "wb");
+    if (!output) {
+        LOG_ERR("Could not open file \"%s\", error: %s", ctx.output_path,
+                strerror(errno));
+        goto out;
+    }
+
+    rc = ctx.pkey ? batch_host_encrypt(input, output) :
+            batch_encrypt(ectx, input, output);
+
+    if (fclose(output)) {
+        LOG_ERR("Could not write file \"%s\", error: %s", ctx.output_path,
+                strerror(errno));
+        rc = tool_rc_general_error;
+    }
+
+out:
+    if (input != stdin) {
+        fclose(input);
+    }
+
+    return rc;
+}
+
 static bool on_option(char key, char *value) {
 
     switch (key) {
@@ -68,6 +335,12 @@ static bool on_option(char key, char *value) {
         break;
     case 'l':
         return tpm2_util_get_label(value, &ctx.label);
+    case 'u':
+        ctx.public_path = value;
+        break;
+    case 0:
+        ctx.is_batch = true;
+        break;
     }
     return true;
 }
@@ -91,26 +364,87 @@ static bool tpm2_tool_onstart(tpm2_options **opts) {
       {"key-context", required_argument, NULL, 'c'},
       {"scheme",      required_argument, NULL, 's'},
       {"label",       required_argument, NULL, 'l'},
+      {"public",      required_argument, NULL, 'u'},
+      {"batch",       no_argument,       NULL,  0 },
     };
 
-    *opts = tpm2_options_new("o:c:s:l:", ARRAY_LEN(topts), topts, on_option,
-            on_args, 0);
+    *opts = tpm2_options_new("o:c:s:l:u:", ARRAY_LEN(topts), topts, on_option,
+            on_args, TPM2_OPTIONS_OPTIONAL_SAPI);
 
     return *opts != NULL;
 }
 
+/*
+ * The scheme comes from -s, or else from a TSS public key with one, as the
+ * TPM would require.
+ */
+static tool_rc host_init(void) {
+
+    if (!tpm2_public_load_pkey(ctx.public_path, &ctx.pkey)) {
+        return tool_rc_general_error;
+    }
+
+    if (EVP_PKEY_base_id(ctx.pkey) != EVP_PKEY_RSA) {
+        LOG_ERR("Unsupported key type for RSA encryption.");
+        return tool_rc_general_error;
+    }
+
+    TPM2B_PUBLIC public = TPM2B_EMPTY_INIT;
+    bool is_tss = files_load_template_silent(ctx.public_path,
+            &public.publicArea)
+            || files_load_public_silent(ctx.public_path, &public);
+    if (!is_tss) {
+        public.publicArea.type = TPM2_ALG_RSA;
+        public.publicArea.parameters.rsaDetail.scheme.scheme = TPM2_ALG_NULL;
+        public.publicArea.parameters.rsaDetail.keyBits =
+                EVP_PKEY_bits(ctx.pkey);
+    }
+
+    TPMT_RSA_SCHEME *key_scheme = &public.publicArea.parameters.rsaDetail.scheme;
+    if (ctx.scheme_str) {
+        tool_rc rc = tpm2_alg_util_handle_rsa_ext_alg(ctx.scheme_str, &public);
+        if (rc != tool_rc_success) {
+            return rc;
+        }
+    } else if (key_scheme->scheme == TPM2_ALG_NULL) {
+        return tool_rc_success;
+    }
+
+    ctx.scheme.scheme = key_scheme->scheme;
+    ctx.scheme.details.anySig.hashAlg = key_scheme->details.anySig.hashAlg;
+
+    return tool_rc_success;
+}
+
 static tool_rc init(ESYS_CONTEXT *context) {
 
-    if (!ctx.context_arg) {
-        LOG_ERR("Expected option c");
+    if (!ctx.context_arg == !ctx.public_path) {
+        LOG_ERR("Expected either option c or option u");
         return tool_rc_option_error;
     }
 
-    ctx.message.size = BUFFER_SIZE(TPM2B_PUBLIC_KEY_RSA, buffer);
-    bool result = files_load_bytes_from_buffer_or_file_or_stdin(NULL,
-            ctx.input_path, &ctx.message.size, ctx.message.buffer);
-    if (!result) {
-        return tool_rc_general_error;
+    if (ctx.context_arg && !context) {
+        LOG_ERR("Option c needs a TPM, use option u to encrypt on the host");
+        return tool_rc_option_error;
+    }
+
+    if (ctx.is_batch && !ctx.output_path) {
+        LOG_ERR("Batch encryption needs an output file");
+        return tool_rc_option_error;
+    }
+
+    /* the records of a batch are streamed as they are encrypted */
+    if (!ctx.is_batch) {
+        ctx.message.size = BUFFER_SIZE(TPM2B_PUBLIC_KEY_RSA, buffer);
+        bool result = files_load_bytes_from_buffer_or_file_or_stdin(NULL,
+                ctx.input_path, &ctx.message.size, ctx.message.buffer);
+        if (!result) {
+            return tool_rc_general_error;
+        }
+    }
+
+    if (ctx.public_path) {
+        return host_init();
     }
 
     /*
@@ -161,8 +495,13 @@ static tool_rc tpm2_tool_onrun(ESYS_CONTEXT *context, tpm2_option_flags flags) {
         return rc;
     }
 
-    return rsa_encrypt_and_save(context);
+    return ctx.is_batch ? batch_run(context) : rsa_encrypt_and_save(context);
+}
+
+static void tpm2_tool_onexit(void) {
+
+    EVP_PKEY_free(ctx.pkey);
 }
 
 // Register this tool with tpm2_tool.c
-TPM2_TOOL_REGISTER("rsaencrypt", tpm2_tool_onstart, tpm2_tool_onrun, NULL, NULL)
+TPM2_TOOL_REGISTER("rsaencrypt", tpm2_tool_onstart, tpm2_tool_onrun, NULL, tpm2_tool_onexit)
@@ -6,17 +6,47 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 
 #include "files.h"
 #include "log.h"
+#include "tpm2_capture.h"
+#include "tpm2_cc_util.h"
 #include "tpm2_header.h"
 #include "tpm2_tool.h"
 
+/* latencies are counted in power of two buckets of microseconds */
+#define STATS_BUCKETS 32
+#define STATS_COMMANDS_MAX 128
+#define STATS_CAPACITY_MIN 8
+
+typedef struct send_stats send_stats;
+struct send_stats {
+    TPM2_CC cc;
+    UINT32 count;
+    UINT32 errors;
+    uint64_t total_ns;
+    uint64_t min_ns;
+    uint64_t max_ns;
+    UINT32 buckets[STATS_BUCKETS];
+};
+
 typedef struct tpm2_send_ctx tpm2_send_ctx;
 struct tpm2_send_ctx {
     FILE *input;
     FILE *output;
+    bool is_output_set;
     tpm2_command_header *command;
+    int32_t timeout;
+    bool is_stats;
+    bool is_capture;
+    tpm2_capture_reader capture;
+    /* grown with the distinct commands seen, up to STATS_COMMANDS_MAX */
+    send_stats *stats;
+    size_t stats_count;
+    size_t stats_capacity;
+    UINT32 count;
+    uint64_t start_ns;
 };
 
 typedef void (*sighandler_t)(int);
@@ -82,6 +112,33 @@ static int read_command_from_file(FILE *f, tpm2_command_header **c,
     return 1;
 }
 
+static int read_command_from_capture(tpm2_capture_reader *reader,
+        tpm2_command_header **c, UINT32 *size) {
+
+    static tpm2_capture_record record;
+    int result = tpm2_capture_reader_next(reader, &record);
+    if (result <= 0) {
+        return result;
+    }
+
+    tpm2_command_header *command = malloc(record.command_size);
+    if (!command) {
+        LOG_ERR("oom");
+        return -1;
+    }
+
+    memcpy(command, record.command, record.command_size);
+
+    LOG_INFO("command seq:  %"PRIu64, record.seq);
+    LOG_INFO("command size: 0x%08x", record.command_size);
+    LOG_INFO("command code: 0x%08x", record.cc);
+
+    *c = command;
+    *size = record.command_size;
+
+    return 1;
+}
+
 static bool write_response_to_file(FILE *f, UINT8 *rbuf) {
 
     tpm2_response_header *r = tpm2_response_header_from_bytes(rbuf);
@@ -97,8 +154,105 @@ static bool write_response_to_file(FILE *f, UINT8 *rbuf) {
     return rc;
 }
 
+static uint64_t now_ns(void) {
+
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void stats_record(TPM2_CC cc, TPM2_RC rc, uint64_t elapsed_ns) {
+
+    ctx.count++;
+
+    send_stats *s = NULL;
+    size_t i;
+    for (i = 0; i < ctx.stats_count; i++) {
+        if (ctx.stats[i].cc == cc) {
+            s = &ctx.stats[i];
+            break;
+        }
+    }
+
+    if (!s) {
+        if (ctx.stats_count == STATS_COMMANDS_MAX) {
+            return;
+        }
+        if (ctx.stats_count == ctx.stats_capacity) {
+            size_t capacity = ctx.stats_capacity ?
+                    ctx.stats_capacity * 2 : STATS_CAPACITY_MIN;
+            send_stats *stats = realloc(ctx.stats, capacity * sizeof(*stats));
+            if (!stats) {
+                LOG_ERR("oom");
+                return;
+            }
+            ctx.stats = stats;
+            ctx.stats_capacity = capacity;
+        }
+        s = &ctx.stats[ctx.stats_count++];
+        memset(s, 0, sizeof(*s));
+        s->cc = cc;
+        s->min_ns = UINT64_MAX;
+    }
+
+    s->count++;
+    s->errors += rc != TPM2_RC_SUCCESS;
+    s->total_ns += elapsed_ns;
+    if (elapsed_ns < s->min_ns) {
+        s->min_ns = elapsed_ns;
+    }
+    if (elapsed_ns > s->max_ns) {
+        s->max_ns = elapsed_ns;
+    }
+
+    /* bucket n counts the latencies below 2^n microseconds */
+    uint64_t us = elapsed_ns / 1000;
+    unsigned bucket = 0;
+    while (us && bucket < STATS_BUCKETS - 1) {
+        us >>= 1;
+        bucket++;
+    }
+    s->buckets[bucket]++;
+}
+
+static void stats_output(void) {
+
+    uint64_t total_ns = now_ns() - ctx.start_ns;
+
+    tpm2_tool_output("commands: %"PRIu32"\n", ctx.count);
+    tpm2_tool_output("total-us: %"PRIu64"\n", total_ns / 1000);
+    tpm2_tool_output("commands-per-second: %.1f\n",
+            total_ns ? ctx.count * 1e9 / total_ns : 0.0);
+    tpm2_tool_output("latencies:%s\n", ctx.stats_count ? "" : " []");
+
+    size_t i;
+    for (i = 0; i < ctx.stats_count; i++) {
+        const send_stats *s = &ctx.stats[i];
+        const char *name = tpm2_cc_util_to_str(s->cc);
+        tpm2_tool_output("  - name: %s\n", name ? name : "unknown");
+        tpm2_tool_output("    code: 0x%"PRIx32"\n", s->cc);
+        tpm2_tool_output("    count: %"PRIu32"\n", s->count);
+        tpm2_tool_output("    errors: %"PRIu32"\n", s->errors);
+        tpm2_tool_output("    min-us: %"PRIu64"\n", s->min_ns / 1000);
+        tpm2_tool_output("    avg-us: %"PRIu64"\n",
+                s->total_ns / s->count / 1000);
+        tpm2_tool_output("    max-us: %"PRIu64"\n", s->max_ns / 1000);
+        tpm2_tool_output("    histogram:\n");
+        unsigned j;
+        for (j = 0; j < STATS_BUCKETS; j++) {
+            if (s->buckets[j]) {
+                tpm2_tool_output("      - below-us: %"PRIu64"\n",
+                        (uint64_t) 1 << j);
+                tpm2_tool_output("        count: %"PRIu32"\n",
+                        s->buckets[j]);
+            }
+        }
+    }
+}
+
 static FILE *open_file(const char *path, const char *mode) {
-    FILE *f = fopen(path, mode);
+    FILE *f = files_fopen(path, mode);
     if (!f) {
         LOG_ERR("Could not open \"%s\", error: \"%s\"", path, strerror(errno));
     }
@@ -120,8 +274,25 @@ static bool on_option(char key, char *value) {
         if (!ctx.output) {
             return false;
         }
+        ctx.is_output_set = true;
+        break;
+    case 0:
+        ctx.is_stats = true;
         break;
-        /* no break */
+    case 1: {
+        UINT32 timeout;
+        if (!tpm2_util_string_to_uint32(value, &timeout)
+                || timeout > INT32_MAX) {
+            LOG_ERR("Invalid timeout in milliseconds, got: \"%s\"", value);
+            return false;
+        }
+        ctx.timeout = (int32_t) timeout;
+    }
+        break;
+    case 2:
+        ctx.is_capture = true;
+        break;
+        /* no default */
     }
 
     return true;
@@ -134,7 +305,7 @@ static bool on_args(int argc, char **argv) {
         return false;
     }
 
-    ctx.input = fopen(argv[0], "rb");
+    ctx.input = files_fopen(argv[0], "rb");
     if (!ctx.input) {
         LOG_ERR("Error opening file \"%s\", error: %s", argv[0],
                 strerror(errno));
@@ -147,7 +318,10 @@ static bool on_args(int argc, char **argv) {
 static bool tpm2_tool_onstart(tpm2_options **opts) {
 
     static const struct option topts[] = {
-        { "output", required_argument, NULL, 'o' },
+        { "output",  required_argument, NULL, 'o' },
+        { "stats",   no_argument,       NULL,  0  },
+        { "timeout", required_argument, NULL,  1  },
+        { "capture", no_argument,       NULL,  2  },
     };
 
     *opts = tpm2_options_new("o:", ARRAY_LEN(topts), topts, on_option, on_args,
@@ -155,6 +329,7 @@ static bool tpm2_tool_onstart(tpm2_options **opts) {
 
     ctx.input = stdin;
     ctx.output = stdout;
+    ctx.timeout = TSS2_TCTI_TIMEOUT_BLOCK;
 
     return *opts != NULL;
 }
@@ -170,11 +345,22 @@ static tool_rc tpm2_tool_onrun(ESYS_CONTEXT *context, tpm2_option_flags flags) {
 
     UNUSED(flags);
 
+    if (ctx.is_stats && !ctx.is_output_set) {
+        LOG_ERR("--stats is output to stdout, write the responses elsewhere "
+                "with -o, /dev/null to discard them");
+        return tool_rc_option_error;
+    }
+
     sighandler_t old_handler = signal(SIGINT, sig_handler);
     if(old_handler == SIG_ERR) {
         LOG_WARN("Could not set SIGINT handler: %s", strerror(errno));
     }
 
+    /* the end of the ring is fixed here, the replay may be captured too */
+    if (ctx.is_capture && !tpm2_capture_reader_init(&ctx.capture, ctx.input)) {
+        return tool_rc_general_error;
+    }
+
     TSS2_TCTI_CONTEXT *tcti_context;
     TSS2_RC rval = Esys_GetTcti(context, &tcti_context);
     if (rval != TPM2_RC_SUCCESS) {
@@ -182,16 +368,27 @@ static tool_rc tpm2_tool_onrun(ESYS_CONTEXT *context, tpm2_option_flags flags) {
         return tool_rc_from_tpm(rval);
     }
 
+    /*
+     * The commands are sent one after the other, the TCTI only allows for a
+     * single command in flight.
+     */
+    ctx.start_ns = now_ns();
     while (1) {
         UINT32 size;
-        int result = read_command_from_file(ctx.input, &ctx.command, &size);
+        int result = ctx.is_capture ?
+                read_command_from_capture(&ctx.capture, &ctx.command, &size) :
+                read_command_from_file(ctx.input, &ctx.command, &size);
         if (result < 0) {
             LOG_ERR("failed to read TPM2 command buffer from file");
             return tool_rc_general_error;
         } else if (result == 0) {
+            if (ctx.is_stats) {
+                stats_output();
+            }
             return tool_rc_success;
         }
 
+        uint64_t sent_ns = now_ns();
         rval = Tss2_Tcti_Transmit(tcti_context, size, ctx.command->bytes);
         if (rval != TPM2_RC_SUCCESS) {
             LOG_ERR("tss2_tcti_transmit failed: 0x%x", rval);
@@ -200,13 +397,23 @@ static tool_rc tpm2_tool_onrun(ESYS_CONTEXT *context, tpm2_option_flags flags) {
 
         size_t rsize = TPM2_MAX_SIZE;
         UINT8 rbuf[TPM2_MAX_SIZE];
-        rval = Tss2_Tcti_Receive(tcti_context, &rsize, rbuf,
-                TSS2_TCTI_TIMEOUT_BLOCK);
-        if (rval != TPM2_RC_SUCCESS) {
+        rval = Tss2_Tcti_Receive(tcti_context, &rsize, rbuf, ctx.timeout);
+        if (rval == TSS2_TCTI_RC_TRY_AGAIN) {
+            LOG_ERR("No response to command code 0x%08x within %"PRId32" ms",
+                    tpm2_command_header_get_code(ctx.command), ctx.timeout);
+            Tss2_Tcti_Cancel(tcti_context);
+            return tool_rc_general_error;
+        } else if (rval != TPM2_RC_SUCCESS) {
             LOG_ERR("tss2_tcti_receive failed: 0x%x", rval);
             return tool_rc_from_tpm(rval);
         }
 
+        if (ctx.is_stats) {
+            tpm2_response_header *r = tpm2_response_header_from_bytes(rbuf);
+            stats_record(tpm2_command_header_get_code(ctx.command),
+                    tpm2_response_header_get_code(r), now_ns() - sent_ns);
+        }
+
         /*
          * The response buffer, rbuf, all fields are in big-endian, and we save
          * in big-endian.
@@ -231,6 +438,7 @@ static void tpm2_tool_onexit(void) {
     close_file(ctx.output);
 
     free(ctx.command);
+    free(ctx.stats);
 }
 
 // Register this tool with tpm2_tool.c
@@ -0,0 +1,461 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include "log.h"
+#include "object.h"
+#include "pcr.h"
+#include "tpm2_host_cache.h"
+#include "tpm2_name_cache.h"
+#include "tpm2_nv_bits.h"
+#include "tpm2_rpc.h"
+#include "tpm2_sched.h"
+#include "tpm2_session.h"
+#include "tpm2_tool.h"
+
+typedef struct tpm2_serve_ctx tpm2_serve_ctx;
+struct tpm2_serve_ctx {
+    const char *socket_path;
+    UINT32 nv_bits_interval;
+    time_t nv_bits_deadline;
+    tpm2_sched sched;
+};
+
+/* a request waiting in the scheduler for the TPM */
+typedef struct serve_pending serve_pending;
+struct serve_pending {
+    int sock;
+    tpm2_rpc_request request;
+};
+
+static tpm2_serve_ctx ctx;
+
+static volatile sig_atomic_t is_stopping;
+
+static void on_signal(int sig) {
+
+    UNUSED(sig);
+    is_stopping = 1;
+}
+
+static bool set_signal_handlers(void) {
+
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sigemptyset(&sa.sa_mask);
+
+    /* a client that went away shouldn't take the daemon down */
+    sa.sa_handler = SIG_IGN;
+    int rc = sigaction(SIGPIPE, &sa, NULL);
+    if (rc) {
+        LOG_ERR("Could not ignore SIGPIPE, error: %s", strerror(errno));
+        return false;
+    }
+
+    /* no SA_RESTART so accept() returns with EINTR */
+    sa.sa_handler = on_signal;
+    rc = sigaction(SIGTERM, &sa, NULL);
+    rc |= sigaction(SIGINT, &sa, NULL);
+    if (rc) {
+        LOG_ERR("Could not install signal handlers, error: %s",
+                strerror(errno));
+        return false;
+    }
+
+    return true;
+}
+
+/*
+ * Like tpm2_batch, every request runs in a forked child that shares the
+ * daemons TCTI and ESAPI context but gets pristine tool state. The child
+ * takes over the clients stdin, stdout and stderr, and has the client open
+ * the files of the tool, so relative paths, redirections and permissions
+ * behave as when run locally. The daemon never opens a path of the client.
+ */
+static void pending_free(serve_pending *p) {
+
+    tpm2_rpc_request_free(&p->request);
+    close(p->sock);
+    free(p);
+}
+
+static tool_rc run_request(ESYS_CONTEXT *ectx, int listen_sock, int sock,
+        tpm2_rpc_request *request) {
+
+    tpm2_tool_output_flush();
+    log_flush();
+    fflush(stderr);
+
+    pid_t pid = fork();
+    if (pid < 0) {
+        LOG_ERR("Could not fork process to run \"%s\", error: %s",
+                request->argv[0], strerror(errno));
+        return tool_rc_general_error;
+    }
+
+    if (pid == 0) {
+        close(listen_sock);
+
+        /* the clients of the queued requests wait for the daemon only */
+        size_t j;
+        for (j = 0; j < tpm2_sched_count(&ctx.sched); j++) {
+            serve_pending *p = tpm2_sched_get(&ctx.sched, j);
+            tpm2_rpc_request_free(&p->request);
+            close(p->sock);
+        }
+
+        unsigned i;
+        for (i = 0; i < 3; i++) {
+            if (dup2(request->fds[i], i) < 0) {
+                _exit(tool_rc_general_error);
+            }
+        }
+
+        /* the files of the tool are opened by the client */
+        tpm2_rpc_set_client(sock);
+
+        /* buffer for the stdout of the client rather than of the daemon */
+        tpm2_tool_output_init();
+
+        /* the requested tool decides on verbosity and quiet on its own */
+        log_set_level(log_level_warning);
+
+        tool_rc rc = tpm2_tool_dispatch(request->argc, request->argv, ectx);
+        tpm2_tool_output_flush();
+        fflush(stderr);
+        /* the TCTI is still in use by the daemon, skip the atexit handlers */
+        _exit(rc);
+    }
+
+    int status;
+    pid_t done;
+    do {
+        done = waitpid(pid, &status, 0);
+    } while (done < 0 && errno == EINTR);
+
+    if (done < 0) {
+        LOG_ERR("Waiting for \"%s\" failed, error: %s", request->argv[0],
+                strerror(errno));
+        return tool_rc_general_error;
+    }
+
+    if (!WIFEXITED(status)) {
+        LOG_ERR("\"%s\" terminated abnormally", request->argv[0]);
+        return tool_rc_general_error;
+    }
+
+    return (tool_rc) WEXITSTATUS(status);
+}
+
+static void serve_request(ESYS_CONTEXT *ectx, int listen_sock,
+        serve_pending *p) {
+
+    tool_rc rc = run_request(ectx, listen_sock, p->sock, &p->request);
+    LOG_INFO("\"%s\" finished with: %d", p->request.argv[0], rc);
+
+    /* the client opens the session files the tool kept loaded */
+    tpm2_rpc_set_client(p->sock);
+    tpm2_session_pool_adopt();
+    tpm2_rpc_set_client(-1);
+
+    bool result = tpm2_rpc_send_status(p->sock, rc);
+    if (!result) {
+        LOG_WARN("Could not report status for \"%s\"", p->request.argv[0]);
+    }
+
+    pending_free(p);
+}
+
+/* queues the request of a connection */
+static bool serve_connection(int sock) {
+
+    serve_pending *p = calloc(1, sizeof(*p));
+    if (!p) {
+        LOG_ERR("oom");
+        close(sock);
+        return false;
+    }
+
+    p->sock = sock;
+    bool result = tpm2_rpc_recv_request(sock, &p->request);
+    if (!result) {
+        LOG_WARN("Dropping malformed request");
+        close(sock);
+        free(p);
+        return true;
+    }
+
+    result = tpm2_sched_push(&ctx.sched, p->request.argv[0],
+            p->request.argc > 1 ? p->request.argv[1] : NULL, p);
+    if (!result) {
+        /* serve_accept() stops accepting when the queue is full */
+        pending_free(p);
+        return false;
+    }
+
+    return true;
+}
+
+/*
+ * Queues the requests of the connections made so far, up to a full queue,
+ * so the next request to run is picked among all of them.
+ */
+static bool serve_accept(int listen_sock) {
+
+    while (!tpm2_sched_is_full(&ctx.sched)) {
+        struct pollfd pfd = {
+            .fd = listen_sock,
+            .events = POLLIN,
+        };
+        int rc = poll(&pfd, 1, 0);
+        if (rc <= 0) {
+            return rc == 0 || errno == EINTR;
+        }
+
+        int sock = accept4(listen_sock, NULL, NULL, SOCK_CLOEXEC);
+        if (sock < 0) {
+            if (errno == EINTR || errno == ECONNABORTED
+                    || errno == EAGAIN || errno == EWOULDBLOCK) {
+                continue;
+            }
+            LOG_ERR("Could not accept connection, error: %s",
+                    strerror(errno));
+            return false;
+        }
+
+        bool result = serve_connection(sock);
+        if (!result) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+static time_t now(void) {
+
+    struct timespec ts = { 0 };
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec;
+}
+
+/* sets the NV bits deferred by the requests once the interval is over */
+static void serve_nv_bits(ESYS_CONTEXT *ectx) {
+
+    if (!ctx.nv_bits_interval || now() < ctx.nv_bits_deadline) {
+        return;
+    }
+
+    /* failed bits stay queued for the next interval */
+    tpm2_nv_bits_flush(ectx);
+    ctx.nv_bits_deadline = now() + ctx.nv_bits_interval;
+}
+
+/*
+ * Waits for the next connection, setting the NV bits deferred by the requests
+ * every interval in the meantime.
+ */
+static bool serve_wait(ESYS_CONTEXT *ectx, int listen_sock) {
+
+    while (!is_stopping) {
+        int timeout = -1;
+        if (ctx.nv_bits_interval) {
+            serve_nv_bits(ectx);
+            time_t wait = ctx.nv_bits_deadline - now();
+            wait = wait < 0 ? 0 : wait;
+            timeout = wait > INT_MAX / 1000 ? INT_MAX : (int) wait * 1000;
+        }
+
+        struct pollfd pfd = {
+            .fd = listen_sock,
+            .events = POLLIN,
+        };
+        int rc = poll(&pfd, 1, timeout);
+        if (rc > 0) {
+            return true;
+        }
+
+        if (rc < 0 && errno != EINTR) {
+            LOG_ERR("Could not wait for a connection, error: %s",
+                    strerror(errno));
+            return false;
+        }
+    }
+
+    return true;
+}
+
+static tool_rc serve(ESYS_CONTEXT *ectx, int listen_sock) {
+
+    tool_rc rc = tool_rc_success;
+    while (!is_stopping) {
+        if (!tpm2_sched_count(&ctx.sched)) {
+            bool result = serve_wait(ectx, listen_sock);
+            if (!result) {
+                rc = tool_rc_general_error;
+                break;
+            }
+
+            if (is_stopping) {
+                break;
+            }
+        }
+
+        /* the requests that came in while the last one ran compete too */
+        bool result = serve_accept(listen_sock);
+        if (!result) {
+            rc = tool_rc_general_error;
+            break;
+        }
+
+        serve_pending *p = tpm2_sched_pop(&ctx.sched);
+        if (p) {
+            serve_request(ectx, listen_sock, p);
+        }
+
+        serve_nv_bits(ectx);
+    }
+
+    /* the requests never run fail */
+    serve_pending *p;
+    while ((p = tpm2_sched_pop(&ctx.sched))) {
+        LOG_WARN("Dropping \"%s\", the daemon is stopping",
+                p->request.argv[0]);
+        bool result = tpm2_rpc_send_status(p->sock, tool_rc_general_error);
+        UNUSED(result);
+        pending_free(p);
+    }
+
+    return rc;
+}
+
+static bool on_args(int argc, char **argv) {
+
+    if (argc != 1) {
+        LOG_ERR("Expected a socket path, got: %d arguments", argc);
+        return false;
+    }
+
+    ctx.socket_path = argv[0];
+
+    return true;
+}
+
+static bool on_option(char key, char *value) {
+
+    UINT32 max_long;
+    switch (key) {
+    case 0:
+        if (!tpm2_util_string_to_uint32(value, &ctx.nv_bits_interval)
+                || !ctx.nv_bits_interval) {
+            LOG_ERR("Expected an interval of at least a second, got: \"%s\"",
+                    value);
+            return false;
+        }
+        break;
+    case 1:
+        return tpm2_sched_add_rules(&ctx.sched, value);
+    case 2:
+        if (!tpm2_util_string_to_uint32(value, &max_long)) {
+            LOG_ERR("Expected a number of commands, got: \"%s\"", value);
+            return false;
+        }
+        tpm2_sched_set_max_long(&ctx.sched, max_long);
+        break;
+    }
+
+    return true;
+}
+
+static bool tpm2_tool_onstart(tpm2_options **opts) {
+
+    const struct option topts[] = {
+        { "nv-bits-interval", required_argument, NULL, 0 },
+        { "priority",         required_argument, NULL, 1 },
+        { "max-long",         required_argument, NULL, 2 },
+    };
+
+    tpm2_sched_init(&ctx.sched);
+
+    *opts = tpm2_options_new(NULL, ARRAY_LEN(topts), topts, on_option,
+            on_args, 0);
+
+    return *opts != NULL;
+}
+
+static tool_rc tpm2_tool_onrun(ESYS_CONTEXT *ectx, tpm2_option_flags flags) {
+
+    UNUSED(flags);
+
+    if (!ctx.socket_path) {
+        LOG_ERR("Expected a socket path");
+        return tool_rc_option_error;
+    }
+
+    bool result = set_signal_handlers();
+    if (!result) {
+        return tool_rc_general_error;
+    }
+
+    int listen_sock = tpm2_rpc_listen(ctx.socket_path);
+    if (listen_sock < 0) {
+        return tool_rc_general_error;
+    }
+
+    /* serve_accept() drains the pending connections without blocking */
+    int sock_flags = fcntl(listen_sock, F_GETFL);
+    if (sock_flags < 0 ||
+            fcntl(listen_sock, F_SETFL, sock_flags | O_NONBLOCK) < 0) {
+        LOG_ERR("Could not make the socket non blocking, error: %s",
+                strerror(errno));
+        close(listen_sock);
+        unlink(ctx.socket_path);
+        return tool_rc_general_error;
+    }
+
+    /* the tools run here fill the cache every other tool on the host reads */
+    tpm2_host_cache_enable_writes();
+
+    tool_rc rc = tpm2_session_pool_init();
+    if (rc == tool_rc_success) {
+        rc = tpm2_object_cache_init();
+        if (rc == tool_rc_success) {
+            rc = pcr_cache_init();
+            if (rc == tool_rc_success) {
+                rc = ctx.nv_bits_interval ?
+                        tpm2_nv_bits_init() : tool_rc_success;
+                if (rc == tool_rc_success) {
+                    rc = serve(ectx, listen_sock);
+                    tpm2_nv_bits_free(ectx);
+                }
+                pcr_cache_free();
+            }
+            tpm2_object_cache_free(ectx);
+        }
+        tpm2_session_pool_free(ectx);
+    }
+
+    tpm2_name_cache_save_snapshot(ectx);
+
+    close(listen_sock);
+    unlink(ctx.socket_path);
+
+    return rc;
+}
+
+// Register this tool with tpm2_tool.c
+TPM2_TOOL_REGISTER("serve", tpm2_tool_onstart, tpm2_tool_onrun, NULL, NULL)
@@ -1,6 +1,8 @@
 /* SPDX-License-Identifier: BSD-3-Clause */
 
+#include <errno.h>
 #include <stdbool.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
@@ -12,6 +14,12 @@
 #include "tpm2_convert.h"
 #include "tpm2_hash.h"
 #include "tpm2_options.h"
+#include "tpm2_tree_hash.h"
+
+#define MANIFEST_FIELDS 2
+
+/* the tree manifest goes next to the signature by default */
+#define TREE_MANIFEST_SUFFIX ".tree"
 
 typedef struct tpm_sign_ctx tpm_sign_ctx;
 struct tpm_sign_ctx {
@@ -40,6 +48,14 @@ struct tpm_sign_ctx {
 
     char *cp_hash_path;
     char *commit_index;
+
+    const char *manifest_path;
+    bool is_batch;
+
+    UINT32 tree_chunk_size;
+    const char *tree_manifest_path;
+    char *tree_manifest_default;
+    tpm2_tree_hash tree;
 };
 
 static tpm_sign_ctx ctx = {
@@ -88,6 +104,380 @@ out:
     return rc;
 }
 
+/*
+ * A line of a manifest, naming a digest to sign and where its signature goes.
+ * The paths point into the manifest line.
+ */
+typedef struct manifest_entry manifest_entry;
+struct manifest_entry {
+    char *line;
+    size_t line_number;
+    const char *digest_file;
+    const char *signature_file;
+};
+
+/*
+ * The digests of a batch come either from the files of a manifest or from a
+ * stream of concatenated digests, whose signatures are written back to back.
+ */
+typedef struct batch batch;
+struct batch {
+    manifest_entry *entries;
+    size_t count;
+    size_t next;
+    FILE *input;
+    FILE *output;
+    UINT16 digest_size;
+    /* set once the signature stream is broken, drains what is in flight */
+    bool is_stopped;
+};
+
+typedef struct sign_job sign_job;
+struct sign_job {
+    TPM2B_DIGEST digest;
+    manifest_entry *entry;
+    bool is_sent;
+};
+
+static bool manifest_add(void *e, char *line, char **fields, size_t count,
+        size_t line_number, void *userdata) {
+
+    UNUSED(count);
+    UNUSED(userdata);
+
+    manifest_entry *entry = (manifest_entry *) e;
+    entry->line = line;
+    entry->line_number = line_number;
+    entry->digest_file = fields[0];
+    entry->signature_file = fields[1];
+
+    return true;
+}
+
+static bool manifest_load(batch *b) {
+
+    return tpm2_util_manifest_read(ctx.manifest_path, MANIFEST_FIELDS,
+            MANIFEST_FIELDS, "<digest> <signature>", (void **) &b->entries,
+            &b->count, sizeof(*b->entries), manifest_add, NULL);
+}
+
+/*
+ * Reads the next digest and sends it to the TPM. A manifest entry whose
+ * digest cannot be loaded or sent is still returned, so it is reported in
+ * order. Returns false at the end of the input or when the stream is broken.
+ */
+static bool batch_next(ESYS_CONTEXT *ectx, batch *b, sign_job *job,
+        tool_rc *rc) {
+
+    job->is_sent = false;
+    job->entry = NULL;
+
+    if (b->entries) {
+        if (b->next == b->count) {
+            return false;
+        }
+
+        job->entry = &b->entries[b->next++];
+        job->digest.size = sizeof(job->digest.buffer);
+        bool result = files_load_bytes_from_path(job->entry->digest_file,
+                job->digest.buffer, &job->digest.size);
+        if (!result) {
+            LOG_ERR("%s:%zu: Could not load digest \"%s\"", ctx.manifest_path,
+                    job->entry->line_number, job->entry->digest_file);
+            return true;
+        }
+    } else {
+        size_t len = fread(job->digest.buffer, 1, b->digest_size, b->input);
+        if (len != b->digest_size) {
+            if (ferror(b->input)) {
+                LOG_ERR("Could not read digest stream, error: %s",
+                        strerror(errno));
+                *rc = tool_rc_general_error;
+            } else if (len) {
+                LOG_ERR("Digest stream has %zu trailing bytes, expected "
+                        "digests of %u bytes", len, b->digest_size);
+                *rc = tool_rc_general_error;
+            }
+            return false;
+        }
+        job->digest.size = b->digest_size;
+    }
+
+    job->is_sent = tpm2_sign_async(ectx, &ctx.signing_key.object,
+            &job->digest, &ctx.in_scheme, &ctx.validation) == tool_rc_success;
+
+    return true;
+}
+
+static tool_rc batch_save(batch *b, sign_job *job, tool_rc rc,
+        TPMT_SIGNATURE *signature) {
+
+    if (!job->entry) {
+        if (rc == tool_rc_success && !tpm2_convert_sig_write(signature,
+                ctx.sig_format, b->output)) {
+            LOG_ERR("Could not write signature to \"%s\"", ctx.output_path);
+            rc = tool_rc_general_error;
+        }
+        /* a missing signature would misalign all that follow */
+        b->is_stopped = rc != tool_rc_success;
+        return rc;
+    }
+
+    bool is_signed = rc == tool_rc_success && tpm2_convert_sig_save(signature,
+            ctx.sig_format, job->entry->signature_file);
+
+    tpm2_tool_output("- line: %zu\n", job->entry->line_number);
+    tpm2_tool_output("  signature: %s\n", job->entry->signature_file);
+    tpm2_tool_output("  signed: %s\n", is_signed ? "true" : "false");
+    tpm2_tool_output_flush();
+
+    return is_signed ? tool_rc_success : tool_rc_general_error;
+}
+
+/*
+ * Signs every digest of the batch with the loaded key and session. The next
+ * digest is sent before the signature of the previous one is saved, so the
+ * TPM never waits on the file system.
+ */
+static tool_rc batch_sign(ESYS_CONTEXT *ectx, batch *b) {
+
+    sign_job jobs[2];
+    sign_job *cur = &jobs[0];
+    sign_job *next = &jobs[1];
+
+    tool_rc rc = tool_rc_success;
+    bool has_cur = batch_next(ectx, b, cur, &rc);
+    while (has_cur) {
+        TPMT_SIGNATURE *signature = NULL;
+        tool_rc sign_rc = cur->is_sent ?
+                tpm2_sign_finish(ectx, &signature) : tool_rc_general_error;
+
+        bool has_next = !b->is_stopped && batch_next(ectx, b, next, &rc);
+
+        if (!b->is_stopped) {
+            tool_rc tmp_rc = batch_save(b, cur, sign_rc, signature);
+            if (tmp_rc != tool_rc_success) {
+                rc = tmp_rc;
+            }
+        }
+        free(signature);
+
+        sign_job *tmp = cur;
+        cur = next;
+        next = tmp;
+        has_cur = has_next;
+    }
+
+    return rc;
+}
+
+static tool_rc batch_run(ESYS_CONTEXT *ectx) {
+
+    /*
+     * Every digest would need its own TPM produced ticket and a policy
+     * session would need satisfying again for each one.
+     */
+    TPM2B_PUBLIC *public = NULL;
+    tool_rc rc = tpm2_readpublic(ectx, ctx.signing_key.object.tr_handle,
+            &public, NULL, NULL);
+    if (rc != tool_rc_success) {
+        return rc;
+    }
+
+    bool is_restricted = !!(public->publicArea.objectAttributes &
+            TPMA_OBJECT_RESTRICTED);
+    free(public);
+
+    if (is_restricted) {
+        LOG_ERR("Batch signing needs an unrestricted signing key");
+        return tool_rc_option_error;
+    }
+
+    if (ctx.signing_key.object.session && tpm2_session_get_type(
+            ctx.signing_key.object.session) == TPM2_SE_POLICY) {
+        LOG_ERR("Batch signing cannot satisfy a policy session for every "
+                "digest");
+        return tool_rc_option_error;
+    }
+
+    ctx.validation.tag = TPM2_ST_HASHCHECK;
+    ctx.validation.hierarchy = TPM2_RH_NULL;
+    memset(&ctx.validation.digest, 0, sizeof(ctx.validation.digest));
+
+    batch b = { 0 };
+    if (ctx.manifest_path) {
+        if (!manifest_load(&b)) {
+            rc = tool_rc_general_error;
+            goto out;
+        }
+
+        /* an empty manifest has nothing to sign */
+        if (b.count) {
+            rc = batch_sign(ectx, &b);
+        }
+        goto out;
+    }
+
+    b.digest_size = tpm2_alg_util_get_hash_size(ctx.halg);
+    b.input = ctx.input_file ? files_fopen(ctx.input_file, "rb") : stdin;
+    if (!b.input) {
+        LOG_ERR("Could not open file \"%s\", error: %s", ctx.input_file,
+                strerror(errno));
+        rc = tool_rc_general_error;
+        goto out;
+    }
+
+    b.output = files_fopen(ctx.output_path, "wb");
+    if (!b.output) {
+        LOG_ERR("Could not open file \"%s\", error: %s", ctx.output_path,
+                strerror(errno));
+        rc = tool_rc_general_error;
+        goto out;
+    }
+
+    rc = batch_sign(ectx, &b);
+
+    if (fclose(b.output)) {
+        LOG_ERR("Could not write file \"%s\", error: %s", ctx.output_path,
+                strerror(errno));
+        rc = tool_rc_general_error;
+    }
+
+out:
+    if (b.input && b.input != stdin) {
+        fclose(b.input);
+    }
+
+    size_t i;
+    for (i = 0; i < b.count; i++) {
+        free(b.entries[i].line);
+    }
+    free(b.entries);
+
+    return rc;
+}
+
+static tool_rc check_batch_options(void) {
+
+    if (ctx.manifest_path && ctx.is_batch) {
+        LOG_ERR("Specify either a manifest or --batch, not both");
+        return tool_rc_option_error;
+    }
+
+    if (ctx.in_scheme.scheme == TPM2_ALG_ECDAA) {
+        LOG_ERR("Batch signing does not support the ECDAA scheme, which "
+                "needs a commit for every signature");
+        return tool_rc_option_error;
+    }
+
+    if (ctx.flags.t || ctx.cp_hash_path) {
+        LOG_ERR("Cannot specify a ticket or calculate cpHash in batch mode");
+        return tool_rc_option_error;
+    }
+
+    if (ctx.manifest_path && (ctx.flags.o || ctx.input_file)) {
+        LOG_ERR("The manifest names the digest and signature files, got an "
+                "input file or option o too");
+        return tool_rc_option_error;
+    }
+
+    if (ctx.is_batch && !ctx.flags.o) {
+        LOG_ERR("Expected option o");
+        return tool_rc_option_error;
+    }
+
+    return tool_rc_success;
+}
+
+/* only restricted keys need a TPM produced ticket for a digest */
+static tool_rc key_is_restricted(ESYS_CONTEXT *ectx, bool *is_restricted) {
+
+    TPM2B_PUBLIC *public = NULL;
+    tool_rc rc = tpm2_readpublic(ectx, ctx.signing_key.object.tr_handle,
+            &public, NULL, NULL);
+    if (rc != tool_rc_success) {
+        return rc;
+    }
+
+    *is_restricted = !!(public->publicArea.objectAttributes &
+            TPMA_OBJECT_RESTRICTED);
+    free(public);
+
+    return tool_rc_success;
+}
+
+/*
+ * Hashes the chunks of the input on all cores and signs the digest of their
+ * Merkle root, the chunk size and the length. That digest is small, so the
+ * TPM computes it when the key needs a ticket.
+ */
+static tool_rc tree_init(ESYS_CONTEXT *ectx) {
+
+    if (ctx.flags.d || ctx.flags.t) {
+        LOG_ERR("A tree hash is computed from the input, not a digest or "
+                "ticket");
+        return tool_rc_option_error;
+    }
+
+    if (!ctx.input_file) {
+        LOG_ERR("A tree hash needs an input file, it cannot read stdin in "
+                "parallel");
+        return tool_rc_option_error;
+    }
+
+    if (!ctx.tree_manifest_path && !ctx.cp_hash_path) {
+        if (!ctx.output_path) {
+            LOG_ERR("Specify where to save the tree with --tree-manifest");
+            return tool_rc_option_error;
+        }
+
+        size_t len = strlen(ctx.output_path) + sizeof(TREE_MANIFEST_SUFFIX);
+        ctx.tree_manifest_default = malloc(len);
+        if (!ctx.tree_manifest_default) {
+            LOG_ERR("oom");
+            return tool_rc_general_error;
+        }
+        snprintf(ctx.tree_manifest_default, len, "%s%s", ctx.output_path,
+                TREE_MANIFEST_SUFFIX);
+        ctx.tree_manifest_path = ctx.tree_manifest_default;
+    }
+
+    bool is_restricted = false;
+    tool_rc rc = key_is_restricted(ectx, &is_restricted);
+    if (rc != tool_rc_success) {
+        return rc;
+    }
+
+    if (!tpm2_tree_hash_file(ctx.input_file, ctx.halg, ctx.tree_chunk_size, 0,
+            &ctx.tree)) {
+        return tool_rc_general_error;
+    }
+
+    TPM2B_MAX_BUFFER data = { 0 };
+    if (!tpm2_tree_hash_signed_data(&ctx.tree, &data)) {
+        return tool_rc_general_error;
+    }
+
+    TPMT_TK_HASHCHECK *ticket = NULL;
+    rc = tpm2_hash_compute_data(ectx, ctx.halg, TPM2_RH_OWNER, data.buffer,
+            data.size, &ctx.digest, is_restricted ? &ticket : NULL);
+    if (rc != tool_rc_success) {
+        LOG_ERR("Could not hash the tree");
+        return rc;
+    }
+
+    if (ticket) {
+        ctx.validation = *ticket;
+        free(ticket);
+    } else {
+        ctx.validation.tag = TPM2_ST_HASHCHECK;
+        ctx.validation.hierarchy = TPM2_RH_NULL;
+        memset(&ctx.validation.digest, 0, sizeof(ctx.validation.digest));
+    }
+
+    return tool_rc_success;
+}
+
 static tool_rc init(ESYS_CONTEXT *ectx) {
 
     /*
@@ -121,6 +511,19 @@ static tool_rc init(ESYS_CONTEXT *ectx) {
         return tool_rc_option_error;
     }
 
+    if (ctx.manifest_path || ctx.is_batch) {
+        if (ctx.tree_chunk_size) {
+            LOG_ERR("A tree hash signs a single input, not a batch");
+            return tool_rc_option_error;
+        }
+        return check_batch_options();
+    }
+
+    if (ctx.tree_manifest_path && !ctx.tree_chunk_size) {
+        LOG_ERR("--tree-manifest requires --tree-hash");
+        return tool_rc_option_error;
+    }
+
     if (ctx.cp_hash_path && ctx.output_path) {
         LOG_ERR("Cannot output signature when calculating cpHash");
         return tool_rc_option_error;
@@ -136,6 +539,10 @@ static tool_rc init(ESYS_CONTEXT *ectx) {
         return tool_rc_option_error;
     }
 
+    if (ctx.tree_chunk_size) {
+        return tree_init(ectx);
+    }
+
     if (!ctx.flags.d && ctx.flags.t) {
         LOG_WARN("Ignoring the specified validation ticket since no TPM "
                  "calculated digest specified.");
@@ -146,23 +553,40 @@ static tool_rc init(ESYS_CONTEXT *ectx) {
      * A digest is calculated first in this case.
      */
     if (!ctx.flags.d) {
-        FILE *input = ctx.input_file ? fopen(ctx.input_file, "rb") : stdin;
+        FILE *input = ctx.input_file ? files_fopen(ctx.input_file, "rb") : stdin;
         if (!input) {
             LOG_ERR("Could not open file \"%s\"", ctx.input_file);
             return tool_rc_general_error;
         }
 
-        TPMT_TK_HASHCHECK *temp_validation_ticket;
+        /*
+         * Only restricted keys need a TPM produced ticket, for all others
+         * the digest is computed on the host.
+         */
+        bool is_restricted = false;
+        rc = key_is_restricted(ectx, &is_restricted);
+        if (rc != tool_rc_success) {
+            if (input != stdin) {
+                fclose(input);
+            }
+            return rc;
+        }
+
+        TPMT_TK_HASHCHECK *temp_validation_ticket = NULL;
         rc = tpm2_hash_file(ectx, ctx.halg, TPM2_RH_OWNER, input, &ctx.digest,
-                &temp_validation_ticket);
+                is_restricted ? &temp_validation_ticket : NULL);
         if (input != stdin) {
             fclose(input);
         }
 
         if (rc != tool_rc_success) {
             LOG_ERR("Could not hash input");
-        } else {
+        } else if (temp_validation_ticket) {
             ctx.validation = *temp_validation_ticket;
+        } else {
+            ctx.validation.tag = TPM2_ST_HASHCHECK;
+            ctx.validation.hierarchy = TPM2_RH_NULL;
+            memset(&ctx.validation.digest, 0, sizeof(ctx.validation.digest));
         }
 
         free(temp_validation_ticket);
@@ -250,6 +674,22 @@ static bool on_option(char key, char *value) {
     case 1:
         ctx.commit_index = value;
         break;
+    case 2:
+        ctx.manifest_path = value;
+        break;
+    case 3:
+        ctx.is_batch = true;
+        break;
+    case 4:
+        if (!tpm2_util_string_to_uint32(value, &ctx.tree_chunk_size)
+                || !ctx.tree_chunk_size) {
+            LOG_ERR("Invalid chunk size, got: \"%s\"", value);
+            return false;
+        }
+        break;
+    case 5:
+        ctx.tree_manifest_path = value;
+        break;
     case 'f':
         ctx.sig_format = tpm2_convert_sig_fmt_from_optarg(value);
 
@@ -286,7 +726,11 @@ static bool tpm2_tool_onstart(tpm2_options **opts) {
       { "key-context",          required_argument, NULL, 'c' },
       { "format",               required_argument, NULL, 'f' },
       { "cphash",               required_argument, NULL,  0  },
-      { "commit-index",       required_argument, NULL,  1  },
+      { "commit-index",         required_argument, NULL,  1  },
+      { "manifest",             required_argument, NULL,  2  },
+      { "batch",                no_argument,       NULL,  3  },
+      { "tree-hash",            required_argument, NULL,  4  },
+      { "tree-manifest",        required_argument, NULL,  5  },
     };
 
     *opts = tpm2_options_new("p:g:dt:o:c:f:s:", ARRAY_LEN(topts), topts,
@@ -312,7 +756,17 @@ static tool_rc tpm2_tool_onrun(ESYS_CONTEXT *ectx, tpm2_option_flags flags) {
         return rc;
     }
 
-    return sign_and_save(ectx);
+    if (ctx.manifest_path || ctx.is_batch) {
+        return batch_run(ectx);
+    }
+
+    rc = sign_and_save(ectx);
+    if (rc != tool_rc_success || !ctx.tree_chunk_size || ctx.cp_hash_path) {
+        return rc;
+    }
+
+    return tpm2_tree_hash_save(ctx.tree_manifest_path, &ctx.tree) ?
+            tool_rc_success : tool_rc_general_error;
 }
 
 static tool_rc tpm2_tool_onstop(ESYS_CONTEXT *ectx) {
@@ -326,6 +780,8 @@ static void tpm2_tool_onexit(void) {
         free(ctx.digest);
     }
     free(ctx.msg);
+    free(ctx.tree_manifest_default);
+    tpm2_tree_hash_free(&ctx.tree);
 }
 
 // Register this tool with tpm2_tool.c
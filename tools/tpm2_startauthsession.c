@@ -1,7 +1,16 @@
 /* SPDX-License-Identifier: BSD-3-Clause */
 
+#include <dirent.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <limits.h>
 #include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
 
+#include "files.h"
 #include "log.h"
 #include "object.h"
 #include "tpm2.h"
@@ -39,6 +48,13 @@ struct tpm2_startauthsession_ctx {
         const char *path;
     } output;
 
+    struct {
+        const char *dir;
+        /* the number of sessions to top the pool up to */
+        UINT32 fill;
+        bool is_pop;
+    } pool;
+
     tpm2_session_data *session_data;
     TPMA_SESSION attrs;
     bool is_real_policy_session;
@@ -105,6 +121,20 @@ static bool on_option(char key, char *value) {
         ctx.is_hmac_session = true;
         ctx.is_session_encryption_possibly_needed = true;
         break;
+    case 6:
+        ctx.pool.dir = value;
+        break;
+    case 7:
+        if (!tpm2_util_string_to_uint32(value, &ctx.pool.fill)
+                || !ctx.pool.fill) {
+            LOG_ERR("Invalid number of sessions to fill the pool with, got: "
+                    "\"%s\"", value);
+            return false;
+        }
+        break;
+    case 8:
+        ctx.pool.is_pop = true;
+        break;
     }
 
     return true;
@@ -119,20 +149,39 @@ static bool tpm2_tool_onstart(tpm2_options **opts) {
         { "bind-auth",      required_argument, NULL,  3 },
         { "tpmkey-context", required_argument, NULL,  4 },
         { "hmac-session",   no_argument,       NULL,  5 },
+        { "pool",           required_argument, NULL,  6 },
+        { "fill-pool",      required_argument, NULL,  7 },
+        { "from-pool",      no_argument,       NULL,  8 },
         { "hash-algorithm", required_argument, NULL, 'g'},
         { "session",        required_argument, NULL, 'S'},
         { "key-context",    required_argument, NULL, 'c'},
     };
 
     *opts = tpm2_options_new("g:S:c:", ARRAY_LEN(topts), topts, on_option,
-    NULL, 0);
+    NULL, TPM2_OPTIONS_OPTIONAL_SAPI);
 
     return *opts != NULL;
 }
 
 static tool_rc is_input_options_valid(void) {
 
-    if (!ctx.output.path) {
+    if ((ctx.pool.fill || ctx.pool.is_pop) && !ctx.pool.dir) {
+        LOG_ERR("Specify the session pool directory with --pool");
+        return tool_rc_option_error;
+    }
+
+    if (ctx.pool.fill && ctx.pool.is_pop) {
+        LOG_ERR("Specify either --fill-pool or --from-pool, not both");
+        return tool_rc_option_error;
+    }
+
+    /* the sessions of a pool fill are saved to the pool */
+    if (ctx.pool.fill && ctx.output.path) {
+        LOG_ERR("Option -S cannot be given with --fill-pool");
+        return tool_rc_option_error;
+    }
+
+    if (!ctx.output.path && !ctx.pool.fill) {
         LOG_ERR("Expected option -S");
         return tool_rc_option_error;
     }
@@ -237,6 +286,39 @@ static tool_rc setup_session_data(void) {
     return tool_rc_success;
 }
 
+/*
+ * ESAPI encrypts the salt with RSA-OAEP for an RSA key and derives it with an
+ * ECDH of an ephemeral key for an ECC key, which is far cheaper for the TPM.
+ * Either way the key has to be a decryption key of one of these types.
+ */
+static tool_rc check_salt_key(ESYS_CONTEXT *ectx, ESYS_TR tpmkey) {
+
+    TPM2B_PUBLIC *public = NULL;
+    tool_rc rc = tpm2_readpublic(ectx, tpmkey, &public, NULL, NULL);
+    if (rc != tool_rc_success) {
+        return rc;
+    }
+
+    TPMI_ALG_PUBLIC type = public->publicArea.type;
+    TPMA_OBJECT attributes = public->publicArea.objectAttributes;
+    Esys_Free(public);
+
+    if (type != TPM2_ALG_RSA && type != TPM2_ALG_ECC) {
+        LOG_ERR("The tpmkey has to be an RSA or an ECC key");
+        return tool_rc_general_error;
+    }
+
+    if (!(attributes & TPMA_OBJECT_DECRYPT)) {
+        LOG_ERR("The tpmkey has to be a decryption key");
+        return tool_rc_general_error;
+    }
+
+    LOG_INFO("Salting the session with %s",
+            type == TPM2_ALG_ECC ? "ECDH" : "RSA-OAEP");
+
+    return tool_rc_success;
+}
+
 static tool_rc process_input_data(ESYS_CONTEXT *ectx) {
 
     /*
@@ -270,6 +352,12 @@ static tool_rc process_input_data(ESYS_CONTEXT *ectx) {
                 LOG_WARN("check public portion of the tpmkey manually");
             }
         }
+
+        rc = check_salt_key(ectx,
+                ctx.session.tpmkey.key_context_object.tr_handle);
+        if (rc != tool_rc_success) {
+            return rc;
+        }
     }
 
     /*
@@ -306,6 +394,294 @@ static tool_rc process_input_data(ESYS_CONTEXT *ectx) {
     return setup_session_data();
 }
 
+/*
+ * Sessions of the pool are named after the configuration they were started
+ * with and the TPM Reset and Restart counts, as
+ * "<type>-<hash>-<symmetric>-<tpmkey>-<bind>-<reset>.<restart>-<id>.ctx",
+ * where the tpmkey and bind are the tail of their names, so a pool may hold
+ * sessions of several configurations. A session saved before a TPM Reset or
+ * Restart can't be loaded anymore and is dropped.
+ */
+static bool pool_name_id(ESYS_CONTEXT *ectx, const char *arg, ESYS_TR handle,
+        char id[9]) {
+
+    if (!arg) {
+        strcpy(id, "none");
+        return true;
+    }
+
+    TPM2B_NAME *name = NULL;
+    tool_rc rc = tpm2_tr_get_name(ectx, handle, &name);
+    if (rc != tool_rc_success) {
+        return false;
+    }
+
+    /* a digest for an object, the handle itself for a hierarchy */
+    UINT16 offset = name->size > 4 ? name->size - 4 : 0;
+    size_t i;
+    for (i = 0; offset + i < name->size && i < 4; i++) {
+        sprintf(&id[2 * i], "%02x", name->name[offset + i]);
+    }
+    id[2 * i] = '\0';
+    Esys_Free(name);
+
+    return true;
+}
+
+static bool pool_template_name(ESYS_CONTEXT *ectx, char *config,
+        size_t config_size, char *epoch, size_t epoch_size) {
+
+    const char *type_str = ctx.is_session_audit_required ? "audit" :
+            ctx.session.type == TPM2_SE_POLICY ? "policy" :
+            ctx.session.type == TPM2_SE_HMAC ? "hmac" : "trial";
+    const char *hash_str = tpm2_alg_util_algtostr(ctx.session.halg,
+            tpm2_alg_util_flags_hash);
+    if (!hash_str) {
+        LOG_ERR("Unknown session hash algorithm");
+        return false;
+    }
+
+    char tpmkey_id[9];
+    char bind_id[9];
+    bool result = pool_name_id(ectx, ctx.session.tpmkey.key_context_arg_str,
+            ctx.session.tpmkey.key_context_object.tr_handle, tpmkey_id)
+            && pool_name_id(ectx, ctx.session.bind.bind_context_arg_str,
+                    ctx.session.bind.bind_context_object.tr_handle, bind_id);
+    if (!result) {
+        return false;
+    }
+
+    TPMS_TIME_INFO *current_time = NULL;
+    tool_rc rc = tpm2_readclock(ectx, &current_time);
+    if (rc != tool_rc_success) {
+        return false;
+    }
+
+    int len = snprintf(config, config_size, "%s-%s-%s-%s-%s-", type_str,
+            hash_str, ctx.is_session_encryption_possibly_needed ?
+                    "aes128cfb" : "null", tpmkey_id, bind_id);
+    int epoch_len = snprintf(epoch, epoch_size, "%"PRIu32".%"PRIu32"-",
+            current_time->clockInfo.resetCount,
+            current_time->clockInfo.restartCount);
+    Esys_Free(current_time);
+
+    return len > 0 && (size_t) len < config_size
+            && epoch_len > 0 && (size_t) epoch_len < epoch_size;
+}
+
+typedef enum pool_entry pool_entry;
+enum pool_entry {
+    pool_entry_other,
+    pool_entry_stale,
+    pool_entry_candidate,
+};
+
+static pool_entry pool_match(const char *config, const char *epoch,
+        const char *file_name) {
+
+    size_t len = strlen(file_name);
+    size_t config_len = strlen(config);
+    if (strncmp(file_name, config, config_len) || len <= strlen(".ctx")
+            || strcmp(&file_name[len - strlen(".ctx")], ".ctx")) {
+        return pool_entry_other;
+    }
+
+    return strncmp(&file_name[config_len], epoch, strlen(epoch)) ?
+            pool_entry_stale : pool_entry_candidate;
+}
+
+/* counts the candidates of the configuration, dropping the stale ones */
+static bool pool_count(const char *config, const char *epoch, UINT32 *count) {
+
+    DIR *dir = files_opendir(ctx.pool.dir);
+    if (!dir) {
+        LOG_ERR("Could not open session pool \"%s\", error: %s", ctx.pool.dir,
+                strerror(errno));
+        return false;
+    }
+
+    *count = 0;
+    struct dirent *entry;
+    while ((entry = readdir(dir))) {
+        pool_entry match = pool_match(config, epoch, entry->d_name);
+        if (match == pool_entry_candidate) {
+            (*count)++;
+        } else if (match == pool_entry_stale) {
+            char path[PATH_MAX];
+            snprintf(path, sizeof(path), "%s/%s", ctx.pool.dir,
+                    entry->d_name);
+            LOG_INFO("Dropping stale session \"%s\"", path);
+            files_unlink(path);
+        }
+    }
+    closedir(dir);
+
+    return true;
+}
+
+static tool_rc pool_fill(ESYS_CONTEXT *ectx) {
+
+    char config[64];
+    char epoch[32];
+    bool result = pool_template_name(ectx, config, sizeof(config), epoch,
+            sizeof(epoch));
+    if (!result) {
+        return tool_rc_general_error;
+    }
+
+    UINT32 count = 0;
+    result = pool_count(config, epoch, &count);
+    if (!result) {
+        return tool_rc_general_error;
+    }
+
+    tool_rc rc = tool_rc_success;
+    UINT32 created = 0;
+    while (count + created < ctx.pool.fill) {
+        /* the session data of the first one is ready */
+        if (created) {
+            rc = setup_session_data();
+            if (rc != tool_rc_success) {
+                break;
+            }
+        }
+
+        /* the session file is written atomically, never seen partial */
+        char path[PATH_MAX];
+        int len = snprintf(path, sizeof(path), "%s/%s%s%lld-%ld-%u.ctx",
+                ctx.pool.dir, config, epoch, (long long) time(NULL),
+                (long) getpid(), created);
+        if (len < 0 || (size_t) len >= sizeof(path)) {
+            LOG_ERR("Session pool path too long");
+            free(ctx.session_data);
+            rc = tool_rc_general_error;
+            break;
+        }
+        tpm2_session_set_path(ctx.session_data, path);
+
+        tpm2_session *s = NULL;
+        rc = tpm2_session_open(ectx, ctx.session_data, &s);
+        if (rc == tool_rc_success) {
+            rc = tpm2_session_close(&s);
+        }
+
+        if (rc != tool_rc_success) {
+            break;
+        }
+        created++;
+    }
+
+    /* the pool was full already, the session data wasn't used */
+    if (count >= ctx.pool.fill) {
+        free(ctx.session_data);
+    }
+
+    tpm2_tool_output("pool:\n");
+    tpm2_tool_output("  template: %.*s\n", (int) strlen(config) - 1, config);
+    tpm2_tool_output("  candidates: %"PRIu32"\n", count + created);
+    tpm2_tool_output("  created: %"PRIu32"\n", created);
+
+    return rc;
+}
+
+/* moves a claimed session to the session file, copying across filesystems */
+static bool pool_move(const char *claimed_path) {
+
+    if (files_rename(claimed_path, ctx.output.path)) {
+        return true;
+    }
+
+    if (errno != EXDEV) {
+        LOG_ERR("Could not save session \"%s\", error: %s", ctx.output.path,
+                strerror(errno));
+        return false;
+    }
+
+    files_input input;
+    bool result = files_input_open(&input, claimed_path);
+    if (!result) {
+        return false;
+    }
+
+    const UINT8 *data = NULL;
+    size_t size = 0;
+    result = files_input_read_all(&input, &data, &size);
+
+    files_atomic atomic;
+    FILE *f = result ? files_atomic_fopen(&atomic, ctx.output.path) : NULL;
+    if (f) {
+        result = files_write_bytes(f, (UINT8 *) data, size);
+        result = files_atomic_close(&atomic, f, result);
+    } else {
+        result = false;
+    }
+
+    files_input_close(&input);
+
+    return result;
+}
+
+/*
+ * Takes a session of the configuration out of the pool. Renaming it claims
+ * it, so concurrent invocations never share a session.
+ */
+static bool pool_pop(ESYS_CONTEXT *ectx) {
+
+    char config[64];
+    char epoch[32];
+    bool result = pool_template_name(ectx, config, sizeof(config), epoch,
+            sizeof(epoch));
+    if (!result) {
+        return false;
+    }
+
+    DIR *dir = files_opendir(ctx.pool.dir);
+    if (!dir) {
+        LOG_ERR("Could not open session pool \"%s\", error: %s", ctx.pool.dir,
+                strerror(errno));
+        return false;
+    }
+
+    bool is_found = false;
+    struct dirent *entry;
+    while (!is_found && (entry = readdir(dir))) {
+        pool_entry match = pool_match(config, epoch, entry->d_name);
+        if (match == pool_entry_other) {
+            continue;
+        }
+
+        char path[PATH_MAX];
+        char claimed_path[PATH_MAX];
+        int len = snprintf(path, sizeof(path), "%s/%s", ctx.pool.dir,
+                entry->d_name);
+        if (len < 0 || (size_t) len + sizeof(".claimed") > sizeof(path)) {
+            continue;
+        }
+        snprintf(claimed_path, sizeof(claimed_path), "%s.claimed", path);
+
+        if (match == pool_entry_stale) {
+            LOG_INFO("Dropping stale session \"%s\"", path);
+            files_unlink(path);
+            continue;
+        }
+
+        if (!files_rename(path, claimed_path)) {
+            /* taken by another invocation */
+            continue;
+        }
+
+        is_found = pool_move(claimed_path);
+        files_unlink(claimed_path);
+
+        if (is_found) {
+            LOG_INFO("Using session \"%s\" from the pool", path);
+        }
+    }
+    closedir(dir);
+
+    return is_found;
+}
+
 static tool_rc tpm2_tool_onrun(ESYS_CONTEXT *ectx, tpm2_option_flags flags) {
 
     UNUSED(flags);
@@ -316,12 +692,37 @@ static tool_rc tpm2_tool_onrun(ESYS_CONTEXT *ectx, tpm2_option_flags flags) {
         return rc;
     }
 
+    /* only the policy digest of a trial session can be computed on the host */
+    if (!ectx && (ctx.is_real_policy_session || ctx.is_hmac_session)) {
+        LOG_ERR("Only trial sessions can be started without a TPM");
+        return tool_rc_option_error;
+    }
+
+    /* saved sessions of the pool only exist in a TPM */
+    if (!ectx && ctx.pool.dir) {
+        LOG_ERR("The session pool needs a TPM");
+        return tool_rc_option_error;
+    }
+
     //Process inputs
     rc = process_input_data(ectx);
     if (rc != tool_rc_success) {
         return rc;
     }
 
+    if (ctx.pool.fill) {
+        return pool_fill(ectx);
+    }
+
+    if (ctx.pool.is_pop) {
+        if (pool_pop(ectx)) {
+            free(ctx.session_data);
+            return tool_rc_success;
+        }
+        LOG_WARN("No session left in the pool \"%s\", starting one",
+                ctx.pool.dir);
+    }
+
     //ESAPI call to start session
     tpm2_session *s = NULL;
     rc = tpm2_session_open(ectx, ctx.session_data, &s);
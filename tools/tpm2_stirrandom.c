@@ -1,8 +1,15 @@
 /* SPDX-License-Identifier: BSD-3-Clause */
 
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <string.h>
+#include <unistd.h>
+
 #include "files.h"
 #include "log.h"
 #include "tpm2.h"
+#include "tpm2_random.h"
 #include "tpm2_tool.h"
 #include "tpm2_options.h"
 
@@ -13,27 +20,47 @@ typedef struct tpm_stirrandom_ctx tpm_stirrandom_ctx;
 struct tpm_stirrandom_ctx {
     TPM2B_SENSITIVE_DATA in_data;
     char *in_file;
+    /* any number of bytes, in commands of MAX_SIZE_TO_READ */
+    bool is_stream;
 };
 
 static tpm_stirrandom_ctx ctx = {
         .in_data = { .size = MAX_SIZE_TO_READ }
 };
 
+static bool on_option(char key, char *value) {
+
+    UNUSED(value);
+
+    switch (key) {
+    case 0:
+        ctx.is_stream = true;
+        break;
+    }
+
+    return true;
+}
+
 static bool on_args(int argc, char **argv) {
 
-    if (argc != 1) {
+    if (argc > 1) {
         LOG_ERR("Only supports one FILE_INPUT file, got %d arguments", argc);
         return false;
     }
 
-    ctx.in_file = argv[0];
+    ctx.in_file = argc ? argv[0] : NULL;
 
     return true;
 }
 
 static bool tpm2_tool_onstart(tpm2_options **opts) {
 
-    *opts = tpm2_options_new(NULL, 0, NULL, NULL, on_args, 0);
+    const struct option topts[] = {
+        { "stream", no_argument, NULL, 0 },
+    };
+
+    *opts = tpm2_options_new(NULL, ARRAY_LEN(topts), topts, on_option,
+            on_args, 0);
 
     return *opts != NULL;
 }
@@ -57,10 +84,42 @@ static bool load_sensitive(void) {
     return true;
 }
 
+static tool_rc stir_stream(ESYS_CONTEXT *ectx) {
+
+    int fd = STDIN_FILENO;
+    if (ctx.in_file) {
+        fd = files_open(ctx.in_file, O_RDONLY, 0);
+        if (fd < 0) {
+            LOG_ERR("Could not open \"%s\", error: %s", ctx.in_file,
+                    strerror(errno));
+            return tool_rc_general_error;
+        }
+    }
+
+    UINT64 stirred = 0;
+    tool_rc rc = tpm2_random_stir_fd(ectx, fd, 0, &stirred);
+    LOG_INFO("Submitted %"PRIu64" bytes to TPM", stirred);
+
+    if (fd != STDIN_FILENO) {
+        close(fd);
+    }
+
+    if (rc == tool_rc_success && !stirred) {
+        LOG_ERR("Data size to send is zero");
+        return tool_rc_general_error;
+    }
+
+    return rc;
+}
+
 static tool_rc tpm2_tool_onrun(ESYS_CONTEXT *ectx, tpm2_option_flags flags) {
 
     UNUSED(flags);
 
+    if (ctx.is_stream) {
+        return stir_stream(ectx);
+    }
+
     if (!load_sensitive()) {
         return tool_rc_general_error;
     }
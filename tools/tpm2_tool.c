@@ -1,22 +1,36 @@
 /* SPDX-License-Identifier: BSD-3-Clause */
 
+#include <errno.h>
+#include <poll.h>
 #include <stdbool.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-
-#include <openssl/err.h>
-#include <openssl/evp.h>
+#include <unistd.h>
 
 #include <tss2/tss2_tctildr.h>
 
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/wait.h>
 
 #include "log.h"
+#include "tpm2_arena.h"
+#include "tpm2_auth_util.h"
+#include "tpm2_capture.h"
+#include "tpm2_device.h"
 #include "tpm2_errata.h"
+#include "tpm2_host_cache.h"
+#include "tpm2_openssl.h"
 #include "tpm2_options.h"
+#include "tpm2_retry.h"
+#include "tpm2_rpc.h"
+#include "tpm2_stats.h"
+#include "tpm2_swap.h"
 #include "tpm2_tool.h"
 #include "tpm2_tool_output.h"
+#include "tpm2_trace.h"
+#include "tpm2_writer.h"
 
 static void esys_teardown(ESYS_CONTEXT **esys_context) {
 
@@ -40,9 +54,17 @@ static void teardown_full(ESYS_CONTEXT **esys_context) {
     if (rc != TPM2_RC_SUCCESS)
         return;
     esys_teardown(esys_context);
-    Tss2_TctiLdr_Finalize(&tcti_context);
+    tcti_context = tpm2_stats_tcti_unwrap(tcti_context);
+    tcti_context = tpm2_trace_tcti_unwrap(tcti_context);
+    tcti_context = tpm2_retry_tcti_unwrap(tcti_context);
+    tcti_context = tpm2_swap_tcti_unwrap(tcti_context);
+    tcti_context = tpm2_capture_tcti_unwrap(tcti_context);
+    if (!tpm2_device_tcti_finalize(&tcti_context)) {
+        Tss2_TctiLdr_Finalize(&tcti_context);
+    }
 }
 
+COMPILER_ATTR(hot)
 static ESYS_CONTEXT *ctx_init(TSS2_TCTI_CONTEXT *tcti_ctx) {
 
     ESYS_CONTEXT *esys_ctx;
@@ -59,6 +81,17 @@ static ESYS_CONTEXT *ctx_init(TSS2_TCTI_CONTEXT *tcti_ctx) {
 /*
  * Build a list of the TPM2 tools linked into this executable
  */
+#if defined(__ELF__)
+/* weak, so an executable without tools still links */
+extern const tpm2_tool * const __start_tpm2_tools[] __attribute__((weak));
+extern const tpm2_tool * const __stop_tpm2_tools[] __attribute__((weak));
+
+static const tpm2_tool * const *tpm2_tools(unsigned *count) {
+
+    *count = __stop_tpm2_tools - __start_tpm2_tools;
+    return __start_tpm2_tools;
+}
+#else
 #ifndef TPM2_TOOLS_MAX
 #define TPM2_TOOLS_MAX 1024
 #endif
@@ -75,6 +108,13 @@ void tpm2_tool_register(const tpm2_tool *tool) {
     }
 }
 
+static const tpm2_tool * const *tpm2_tools(unsigned *count) {
+
+    *count = tool_count;
+    return tools;
+}
+#endif
+
 static const char *tpm2_tool_name(const char *arg) {
 
     const char *name = rindex(arg, '/');
@@ -108,9 +148,11 @@ static const tpm2_tool *tpm2_tool_lookup(int *argc, char ***argv)
 
 
     // search the tools array for a matching name
-    for(unsigned i = 0 ; i < tool_count ; i++)
+    unsigned count;
+    const tpm2_tool * const *table = tpm2_tools(&count);
+    for(unsigned i = 0 ; i < count ; i++)
     {
-        const tpm2_tool * const tool = tools[i];
+        const tpm2_tool * const tool = table[i];
         if (!tool || !tool->name) {
             continue;
         }
@@ -132,76 +174,66 @@ static const tpm2_tool *tpm2_tool_lookup(int *argc, char ***argv)
 static struct tool_context {
     ESYS_CONTEXT *ectx;
     tpm2_options *tool_opts;
+    /* the tool run by main and its context, if it has one */
+    const tpm2_tool *tool;
+    void *tool_ctx;
 } ctx;
 
 static void main_onexit(void) {
 
+    if (ctx.tool && ctx.tool->onexit_ctx) {
+        ctx.tool->onexit_ctx(ctx.tool_ctx);
+    }
     teardown_full(&ctx.ectx);
     tpm2_options_free(ctx.tool_opts);
 }
 
-int main(int argc, char **argv) {
-
-    /* get rid of:
-     *   owner execute (1)
-     *   group execute (1)
-     *   other write + read + execute (7)
-     */
-    umask(0117);
-
-    if (!strcmp(argv[0], "tpm2")) {
-        if (argc == 1 || (argc == 2 && (!strcmp(argv[1],"--help") ||
-            !strcmp(argv[1], "-h") || !strcmp(argv[1], "--help=man")))) {
-            char *options[2] = {"tpm2","--help=man"};
-            tpm2_handle_options(2, options, 0, 0, 0);
-            exit(tool_rc_success);
-        }
-
-        if ((argc == 2 && (!strcmp(argv[1],"--version") ||
-        !strcmp(argv[1], "-v") ))) {
-            tpm2_handle_options(argc, argv, 0, 0, 0);
-            exit(tool_rc_success);
-        }
-
-    }
-
-    /* don't buffer stdin/stdout/stderr so pipes work */
-    setvbuf (stdin, NULL, _IONBF, 0);
-    setvbuf (stdout, NULL, _IONBF, 0);
-    setvbuf (stderr, NULL, _IONBF, 0);
-
-    const tpm2_tool * const tool = tpm2_tool_lookup(&argc, &argv);
-    if (!tool) {
-        LOG_ERR("%s: unknown tool. Available tpm2 commands:", argv[0]);
-        for(unsigned i = 0 ; i < tool_count ; i++) {
-            fprintf(stderr, "%s\n", tools[i]->name);
-        }
-        exit(tool_rc_general_error);
-    }
+/*
+ * Runs the tool life-cycle: onstart, option handling, onrun and onstop.
+ * When shared_ectx is NULL a new TCTI and ESAPI context are initialized from
+ * the options, otherwise the shared context is used as is. The context of a
+ * tool registered with TPM2_TOOL_REGISTER_CTX() is returned in tool_ctx for
+ * the caller to release with onexit_ctx.
+ */
+COMPILER_ATTR(hot)
+static tool_rc tool_dispatch(const tpm2_tool *tool, int argc, char **argv,
+        ESYS_CONTEXT *shared_ectx, void **tool_ctx) {
 
-    atexit(main_onexit);
+    tpm2_trace_init();
+    tpm2_stats_init();
 
     tool_rc ret = tool_rc_general_error;
-    if (tool->onstart) {
-        bool res = tool->onstart(&ctx.tool_opts);
+    if (tool->onstart_ctx || tool->onstart) {
+        bool res = tool->onstart_ctx ?
+                tool->onstart_ctx(&ctx.tool_opts, tool_ctx) :
+                tool->onstart(&ctx.tool_opts);
         if (!res) {
             LOG_ERR("retrieving tool options");
-            exit(tool_rc_general_error);
+            return tool_rc_general_error;
         }
     }
 
-    if (tool->onexit) {
+    if (tool->onexit && !shared_ectx) {
         atexit(tool->onexit);
     }
 
     tpm2_option_flags flags = { .all = 0 };
     TSS2_TCTI_CONTEXT *tcti = NULL;
+    if (shared_ectx) {
+        TSS2_RC rval = Esys_GetTcti(shared_ectx, &tcti);
+        if (rval != TPM2_RC_SUCCESS) {
+            LOG_PERR(Esys_GetTcti, rval);
+            return tool_rc_tcti_error;
+        }
+    }
+
+    tpm2_trace_phase_begin(tpm2_trace_phase_options);
     tpm2_option_code rc = tpm2_handle_options(argc, argv, ctx.tool_opts, &flags,
             &tcti);
+    tpm2_trace_phase_end(tpm2_trace_phase_options);
     if (rc != tpm2_option_code_continue) {
-        ret = rc == tpm2_option_code_err ?
+        return rc == tpm2_option_code_err ?
                 tool_rc_general_error : tool_rc_success;
-        exit(ret);
     }
 
     if (flags.verbose) {
@@ -219,10 +251,29 @@ int main(int argc, char **argv) {
         tpm2_tool_output_disable();
     }
 
-    if (tcti) {
+    tpm2_writer_set_format(flags.json ?
+            tpm2_writer_format_json : tpm2_writer_format_yaml);
+
+    if (shared_ectx) {
+        bool is_no_sapi = ctx.tool_opts &&
+            (ctx.tool_opts->flags & TPM2_OPTIONS_NO_SAPI);
+        ctx.ectx = (tcti && !is_no_sapi) ? shared_ectx : NULL;
+    } else if (tcti) {
+        /* a shared TCTI is already wrapped by the tool that loaded it */
+        tpm2_trace_phase_begin(tpm2_trace_phase_tcti);
+        tcti = tpm2_capture_tcti_wrap(tcti);
+        tcti = tpm2_swap_tcti_wrap(tcti);
+        tcti = tpm2_retry_tcti_wrap(tcti);
+        tcti = tpm2_trace_tcti_wrap(tcti);
+        if (flags.stats) {
+            tcti = tpm2_stats_tcti_wrap(tcti);
+        }
+        tpm2_trace_phase_begin(tpm2_trace_phase_esys);
         ctx.ectx = ctx_init(tcti);
+        tpm2_trace_phase_end(tpm2_trace_phase_esys);
+        tpm2_trace_phase_end(tpm2_trace_phase_tcti);
         if (!ctx.ectx) {
-            exit(tool_rc_tcti_error);
+            return tool_rc_tcti_error;
         }
     }
 
@@ -230,24 +281,42 @@ int main(int argc, char **argv) {
         tpm2_errata_init(ctx.ectx);
     }
 
-    /*
-     * Load the openssl error strings and algorithms
-     * so library routines work as expected.
-     */
-    OpenSSL_add_all_algorithms();
-    OpenSSL_add_all_ciphers();
-    ERR_load_crypto_strings();
+    tpm2_trace_phase_begin(tpm2_trace_phase_openssl);
+    tpm2_openssl_init();
+    tpm2_trace_phase_end(tpm2_trace_phase_openssl);
 
     /*
      * Call the specific tool, all tools implement this function instead of
      * 'main'.
      */
-    ret = tool->onrun(ctx.ectx, flags);
-    if (tool->onstop) {
-        tool_rc tmp_rc = tool->onstop(ctx.ectx);
+    tpm2_trace_phase_begin(tpm2_trace_phase_onrun);
+    ret = tool->onrun_ctx ? tool->onrun_ctx(*tool_ctx, ctx.ectx, flags) :
+            tool->onrun(ctx.ectx, flags);
+    tpm2_trace_phase_end(tpm2_trace_phase_onrun);
+    if (tool->onstop_ctx || tool->onstop) {
+        tpm2_trace_phase_begin(tpm2_trace_phase_onstop);
+        tool_rc tmp_rc = tool->onstop_ctx ?
+                tool->onstop_ctx(*tool_ctx, ctx.ectx) :
+                tool->onstop(ctx.ectx);
+        tpm2_trace_phase_end(tpm2_trace_phase_onstop);
         /* if onrun() passed, the error code should come from onstop() */
         ret = ret == tool_rc_success ? tmp_rc : ret;
     }
+
+    /* what the tool read while changing the TPM is not kept */
+    tpm2_host_cache_finish();
+
+    /* a failing tool still closes what it output, for the JSON to parse */
+    tpm2_writer_document_end();
+
+    /* the ESAPI results moved to the arena live until the tool is done */
+    tpm2_arena_release(tpm2_arena_invocation());
+    tpm2_auth_util_cache_clear();
+
+    tpm2_trace_summary(tool->name);
+    if (flags.stats) {
+        tpm2_stats_summary(tool->name);
+    }
     switch (ret) {
     case tool_rc_success:
         /* nothing to do here */
@@ -259,5 +328,311 @@ int main(int argc, char **argv) {
         LOG_ERR("Unable to run %s", argv[0]);
     }
 
+    return ret;
+}
+
+tool_rc tpm2_tool_dispatch(int argc, char **argv, ESYS_CONTEXT *shared_ectx) {
+
+    if (argc < 1) {
+        LOG_ERR("Expected a tool name");
+        return tool_rc_general_error;
+    }
+
+    const tpm2_tool * const tool = tpm2_tool_lookup(&argc, &argv);
+    if (!tool) {
+        LOG_ERR("%s: unknown tool", argv[0]);
+        return tool_rc_general_error;
+    }
+
+    /*
+     * The options belong to the dispatching tool, the dispatched one gets
+     * its own set from onstart().
+     */
+    ctx.tool_opts = NULL;
+
+    void *tool_ctx = NULL;
+    tool_rc rc = tool_dispatch(tool, argc, argv, shared_ectx, &tool_ctx);
+    if (tool->onexit_ctx) {
+        tool->onexit_ctx(tool_ctx);
+    } else if (tool->onexit) {
+        tool->onexit();
+    }
+
+    return rc;
+}
+
+#define TARGETS_MAX 64
+
+typedef struct tool_target tool_target;
+struct tool_target {
+    const char *tcti;
+    pid_t pid;
+    int fd;
+    char *output;
+    size_t output_size;
+    int status;
+};
+
+static bool target_read(tool_target *target) {
+
+    char buf[4096];
+    ssize_t n = read(target->fd, buf, sizeof(buf));
+    if (n < 0 && (errno == EINTR || errno == EAGAIN)) {
+        return true;
+    }
+
+    if (n <= 0) {
+        close(target->fd);
+        target->fd = -1;
+        return n == 0;
+    }
+
+    char *tmp = realloc(target->output, target->output_size + n + 1);
+    if (!tmp) {
+        LOG_ERR("oom");
+        close(target->fd);
+        target->fd = -1;
+        return false;
+    }
+
+    memcpy(&tmp[target->output_size], buf, n);
+    target->output = tmp;
+    target->output_size += n;
+    target->output[target->output_size] = '\0';
+
+    return true;
+}
+
+static bool target_start(const tpm2_tool *tool, int argc, char **argv,
+        tool_target *targets, size_t index) {
+
+    int fds[2];
+    if (pipe(fds)) {
+        LOG_ERR("Could not create pipe: %s", strerror(errno));
+        return false;
+    }
+
+    /* flush anything pending so the child doesn't emit it twice */
+    fflush(stdout);
+    log_flush();
+
+    pid_t pid = fork();
+    if (pid < 0) {
+        LOG_ERR("Could not fork for target \"%s\": %s", targets[index].tcti,
+                strerror(errno));
+        close(fds[0]);
+        close(fds[1]);
+        return false;
+    }
+
+    if (pid == 0) {
+        size_t i;
+        for (i = 0; i < index; i++) {
+            close(targets[i].fd);
+        }
+        close(fds[0]);
+        if (dup2(fds[1], STDOUT_FILENO) < 0) {
+            _exit(tool_rc_general_error);
+        }
+        close(fds[1]);
+
+        /* the child is a plain invocation of the tool for its target */
+        unsetenv(TPM2TOOLS_ENV_TARGETS);
+        setenv(TPM2TOOLS_ENV_TCTI, targets[index].tcti, 1);
+
+        ctx.tool = tool;
+        atexit(main_onexit);
+        exit(tool_dispatch(tool, argc, argv, NULL, &ctx.tool_ctx));
+    }
+
+    close(fds[1]);
+    targets[index].pid = pid;
+    targets[index].fd = fds[0];
+
+    return true;
+}
+
+static void target_output(const tool_target *target) {
+
+    int rc = WIFEXITED(target->status) ?
+            WEXITSTATUS(target->status) : tool_rc_general_error;
+
+    tpm2_tool_output("- target: \"%s\"\n", target->tcti);
+    tpm2_tool_output("  rc: %d\n", rc);
+    if (!target->output_size) {
+        return;
+    }
+
+    /* the YAML of the tool nests under the target */
+    tpm2_tool_output("  output:\n");
+    const char *line = target->output;
+    while (*line) {
+        size_t len = strcspn(line, "\n");
+        tpm2_tool_output("    %.*s\n", (int) len, line);
+        line += len;
+        line += *line == '\n';
+    }
+}
+
+/*
+ * Runs the tool against every target of the list concurrently, a forked
+ * process each, as the tools keep their state in static storage. The output
+ * is collected as it is written, so no target blocks on a full pipe, and
+ * printed labelled by the target once all of them are done.
+ */
+static tool_rc run_targets(const tpm2_tool *tool, int argc, char **argv,
+        const char *list) {
+
+    char *copy = strdup(list);
+    if (!copy) {
+        LOG_ERR("oom");
+        return tool_rc_general_error;
+    }
+
+    tool_target targets[TARGETS_MAX] = { 0 };
+    size_t count = 0;
+    char *saveptr = NULL;
+    char *tcti;
+    for (tcti = strtok_r(copy, ";", &saveptr); tcti;
+            tcti = strtok_r(NULL, ";", &saveptr)) {
+        if (count == TARGETS_MAX) {
+            LOG_ERR("Expected at most %d targets", TARGETS_MAX);
+            free(copy);
+            return tool_rc_general_error;
+        }
+        targets[count].tcti = tcti;
+        targets[count].fd = -1;
+        count++;
+    }
+
+    tool_rc rc = tool_rc_success;
+    size_t started;
+    for (started = 0; started < count; started++) {
+        if (!target_start(tool, argc, argv, targets, started)) {
+            rc = tool_rc_general_error;
+            break;
+        }
+    }
+
+    size_t open_count = started;
+    while (open_count) {
+        struct pollfd pfds[TARGETS_MAX];
+        size_t map[TARGETS_MAX];
+        nfds_t nfds = 0;
+        size_t i;
+        for (i = 0; i < started; i++) {
+            if (targets[i].fd >= 0) {
+                pfds[nfds].fd = targets[i].fd;
+                pfds[nfds].events = POLLIN;
+                map[nfds++] = i;
+            }
+        }
+
+        if (poll(pfds, nfds, -1) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            LOG_ERR("poll failed: %s", strerror(errno));
+            rc = tool_rc_general_error;
+            break;
+        }
+
+        nfds_t j;
+        for (j = 0; j < nfds; j++) {
+            if (!pfds[j].revents) {
+                continue;
+            }
+            tool_target *target = &targets[map[j]];
+            if (!target_read(target)) {
+                rc = tool_rc_general_error;
+            }
+            open_count -= target->fd < 0;
+        }
+    }
+
+    size_t i;
+    for (i = 0; i < started; i++) {
+        if (targets[i].fd >= 0) {
+            close(targets[i].fd);
+        }
+        while (waitpid(targets[i].pid, &targets[i].status, 0) < 0
+                && errno == EINTR);
+        target_output(&targets[i]);
+        if (!WIFEXITED(targets[i].status) || WEXITSTATUS(targets[i].status)) {
+            rc = tool_rc_general_error;
+        }
+        free(targets[i].output);
+    }
+
+    free(copy);
+
+    return rc;
+}
+
+COMPILER_ATTR(hot)
+int main(int argc, char **argv) {
+
+    /* get rid of:
+     *   owner execute (1)
+     *   group execute (1)
+     *   other write + read + execute (7)
+     */
+    umask(0117);
+
+    if (!strcmp(argv[0], "tpm2")) {
+        if (argc == 1 || (argc == 2 && (!strcmp(argv[1],"--help") ||
+            !strcmp(argv[1], "-h") || !strcmp(argv[1], "--help=man")))) {
+            char *options[2] = {"tpm2","--help=man"};
+            tpm2_handle_options(2, options, 0, 0, 0);
+            exit(tool_rc_success);
+        }
+
+        if ((argc == 2 && (!strcmp(argv[1],"--version") ||
+        !strcmp(argv[1], "-v") ))) {
+            tpm2_handle_options(argc, argv, 0, 0, 0);
+            exit(tool_rc_success);
+        }
+
+    }
+
+    /*
+     * don't buffer stdin/stderr so pipes work, stdout is buffered and
+     * written out on exit
+     */
+    setvbuf (stdin, NULL, _IONBF, 0);
+    setvbuf (stderr, NULL, _IONBF, 0);
+    log_init();
+    tpm2_tool_output_init();
+
+    const tpm2_tool * const tool = tpm2_tool_lookup(&argc, &argv);
+    if (!tool) {
+        LOG_ERR("%s: unknown tool. Available tpm2 commands:", argv[0]);
+        unsigned count;
+        const tpm2_tool * const *table = tpm2_tools(&count);
+        for(unsigned i = 0 ; i < count ; i++) {
+            fprintf(stderr, "%s\n", table[i]->name);
+        }
+        exit(tool_rc_general_error);
+    }
+
+    const char *targets = getenv(TPM2TOOLS_ENV_TARGETS);
+    if (targets && targets[0] && strcmp(tool->name, "serve")) {
+        exit(run_targets(tool, argc, argv, targets));
+    }
+
+    /*
+     * With a tpm2_serve daemon running, hand the invocation over to it and
+     * skip loading the TCTI and initializing ESAPI and OpenSSL here.
+     */
+    const char *serve_socket = getenv(TPM2TOOLS_ENV_SERVE_SOCKET);
+    if (serve_socket && serve_socket[0] && strcmp(tool->name, "serve")) {
+        exit(tpm2_rpc_forward(serve_socket, argc, argv));
+    }
+
+    ctx.tool = tool;
+    atexit(main_onexit);
+
+    tool_rc ret = tool_dispatch(tool, argc, argv, NULL, &ctx.tool_ctx);
+
     exit(ret);
 }
@@ -9,10 +9,11 @@
 #include "tool_rc.h"
 #include "tpm2_options.h"
 #include "tpm2_tool_output.h"
+#include "tpm2_writer.h"
 
 /**
  * An optional interface for tools to specify what options they support.
- * They are concatenated with main's options and passed to getopt_long.
+ * They are parsed after main's options by tpm2_option_parser_next().
  * @param opts
  *  The callee can choose to set *opts to a tpm_options pointer allocated
  *  via tpm2_options_new(). Setting *opts to NULL is not an error, and
@@ -49,6 +50,41 @@ typedef tool_rc (*tpm2_tool_onstop_t)(ESYS_CONTEXT *ectx);
  */
 typedef void (*tpm2_tool_onexit_t)(void);
 
+/*
+ * The reentrant variant of the interface above, for tools that keep the
+ * state of an invocation in a context of their own instead of file statics,
+ * so that one process can run the tool many times, like batch mode does.
+ */
+
+/**
+ * Allocates the context of one invocation and its options.
+ * @param opts
+ *  As with tpm2_tool_onstart_t, the options are allocated via
+ *  tpm2_options_new_ctx() with the context of the invocation.
+ * @param tool_ctx
+ *  The callee sets *tool_ctx to the context of the invocation, which is
+ *  handed to the other callbacks.
+ * @return
+ *  True on success, false on error.
+ */
+typedef bool (*tpm2_tool_onstart_ctx_t)(tpm2_options **opts, void **tool_ctx);
+
+/**
+ * As tpm2_tool_onrun_t, for the context of the invocation.
+ */
+typedef tool_rc (*tpm2_tool_onrun_ctx_t)(void *tool_ctx, ESYS_CONTEXT *ectx,
+		tpm2_option_flags flags);
+
+/**
+ * As tpm2_tool_onstop_t, for the context of the invocation.
+ */
+typedef tool_rc (*tpm2_tool_onstop_ctx_t)(void *tool_ctx, ESYS_CONTEXT *ectx);
+
+/**
+ * Releases the context of the invocation. Called whenever onstart was,
+ * even if it failed, thus tool_ctx may be NULL.
+ */
+typedef void (*tpm2_tool_onexit_ctx_t)(void *tool_ctx);
 
 typedef struct {
 	const char * name;
@@ -56,9 +92,53 @@ typedef struct {
 	tpm2_tool_onrun_t onrun;
 	tpm2_tool_onstop_t onstop;
 	tpm2_tool_onexit_t onexit;
+	/* set instead of the above by TPM2_TOOL_REGISTER_CTX() */
+	tpm2_tool_onstart_ctx_t onstart_ctx;
+	tpm2_tool_onrun_ctx_t onrun_ctx;
+	tpm2_tool_onstop_ctx_t onstop_ctx;
+	tpm2_tool_onexit_ctx_t onexit_ctx;
 } tpm2_tool;
 
+#if !defined(__ELF__)
 void tpm2_tool_register(const tpm2_tool * tool);
+#endif
+
+/**
+ * Looks up the tool named by argv[0] and runs it against an already
+ * initialized ESAPI context. Used by modes that dispatch many tool
+ * invocations from a single process, like batch mode.
+ * @param argc
+ *  The number of args in argv, including the tool name.
+ * @param argv
+ *  The tool name followed by its options and arguments.
+ * @param shared_ectx
+ *  The ESAPI context to run the tool against. The TCTI of this context is
+ *  reused and never finalized by the dispatched tool.
+ * @return
+ *  A tool_rc indicating status.
+ */
+tool_rc tpm2_tool_dispatch(int argc, char **argv, ESYS_CONTEXT *shared_ectx);
+
+/*
+ * On ELF the linker gathers a pointer to every tool into the tpm2_tools
+ * section, so no code runs per tool at startup. Elsewhere a constructor
+ * registers the tool.
+ */
+#if defined(__ELF__)
+#define TPM2_TOOL_ENTRY \
+	static const tpm2_tool * const _tpm2_tool_entry \
+	__attribute__((__section__("tpm2_tools"))) \
+	__attribute__((__used__)) = &tool;
+#else
+#define TPM2_TOOL_ENTRY \
+	static void \
+	__attribute__((__constructor__)) \
+	__attribute__((__used__)) \
+	_tpm2_tool_init(void) \
+	{ \
+		tpm2_tool_register(&tool); \
+	}
+#endif
 
 #define TPM2_TOOL_REGISTER(tool_name,tool_onstart,tool_onrun,tool_onstop,tool_onexit) \
 	static const tpm2_tool tool = { \
@@ -68,12 +148,16 @@ void tpm2_tool_register(const tpm2_tool * tool);
 		.onstop		= tool_onstop, \
 		.onexit		= tool_onexit, \
 	}; \
-	static void \
-	__attribute__((__constructor__)) \
-	__attribute__((__used__)) \
-	_tpm2_tool_init(void) \
-	{ \
-		tpm2_tool_register(&tool); \
-	}
+	TPM2_TOOL_ENTRY
+
+#define TPM2_TOOL_REGISTER_CTX(tool_name,tool_onstart,tool_onrun,tool_onstop,tool_onexit) \
+	static const tpm2_tool tool = { \
+		.name		= tool_name, \
+		.onstart_ctx	= tool_onstart, \
+		.onrun_ctx	= tool_onrun, \
+		.onstop_ctx	= tool_onstop, \
+		.onexit_ctx	= tool_onexit, \
+	}; \
+	TPM2_TOOL_ENTRY
 
 #endif /* MAIN_H */
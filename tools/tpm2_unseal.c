@@ -1,15 +1,32 @@
 /* SPDX-License-Identifier: BSD-3-Clause */
 
 #include <stdlib.h>
+#include <string.h>
+
+#include <openssl/crypto.h>
 
 #include "files.h"
 #include "log.h"
+#include "object.h"
 #include "tpm2.h"
+#include "tpm2_alg_util.h"
+#include "tpm2_auth_util.h"
 #include "tpm2_tool.h"
 
 typedef struct tpm_unseal_ctx tpm_unseal_ctx;
 #define MAX_SESSIONS 3
 #define MAX_AUX_SESSIONS 2
+#define MANIFEST_FIELDS_MAX 6
+
+/*
+ * The session of a distinct auth of the manifest, readied again for every
+ * object with the same auth.
+ */
+typedef struct unseal_auth unseal_auth;
+struct unseal_auth {
+    char *auth_str;
+    tpm2_session *session;
+};
 struct tpm_unseal_ctx {
     /*
      * Inputs
@@ -43,6 +60,19 @@ struct tpm_unseal_ctx {
     tpm2_session *aux_session[MAX_AUX_SESSIONS];
     const char *aux_session_path[MAX_AUX_SESSIONS];
     ESYS_TR aux_session_handle[MAX_AUX_SESSIONS];
+
+    /*
+     * Manifest
+     */
+    const char *manifest_path;
+    struct {
+        const char *ctx_path;
+        const char *auth_str;
+        tpm2_loaded_object object;
+    } parent;
+    unseal_auth *auths;
+    size_t auths_count;
+    bool is_reseal;
 };
 
 static tpm_unseal_ctx ctx = {
@@ -171,8 +201,313 @@ static tool_rc process_inputs(ESYS_CONTEXT *ectx) {
     return rc;
 }
 
+/*
+ * Returns the session for the auth of an object, starting it for the first
+ * object with that auth and readying it again for the following ones, so a
+ * PCR policy is satisfied in the session already open.
+ */
+static tool_rc manifest_get_session(ESYS_CONTEXT *ectx, const char *auth_str,
+        tpm2_session **session) {
+
+    auth_str = auth_str ? auth_str : "";
+
+    size_t i;
+    for (i = 0; i < ctx.auths_count; i++) {
+        if (!strcmp(ctx.auths[i].auth_str, auth_str)) {
+            *session = ctx.auths[i].session;
+            return tpm2_auth_util_restart(ectx, auth_str, *session);
+        }
+    }
+
+    if (!strncmp(auth_str, "session:", sizeof("session:") - 1)) {
+        LOG_ERR("A manifest cannot satisfy a policy session for every "
+                "object, use \"pcr:\" or a password");
+        return tool_rc_general_error;
+    }
+
+    unseal_auth *auths = realloc(ctx.auths,
+            (ctx.auths_count + 1) * sizeof(*auths));
+    if (!auths) {
+        LOG_ERR("oom");
+        return tool_rc_general_error;
+    }
+    ctx.auths = auths;
+
+    char *key = strdup(auth_str);
+    if (!key) {
+        LOG_ERR("oom");
+        return tool_rc_general_error;
+    }
+
+    tpm2_session *s = NULL;
+    tool_rc rc = tpm2_auth_util_from_optarg(ectx, auth_str, &s, false);
+    if (rc != tool_rc_success) {
+        free(key);
+        return rc;
+    }
+
+    ctx.auths[ctx.auths_count].auth_str = key;
+    ctx.auths[ctx.auths_count].session = s;
+    ctx.auths_count++;
+
+    *session = s;
+
+    return tool_rc_success;
+}
+
+/*
+ * Loads the object of a line, either a context or, with a parent, its public
+ * and private portions.
+ */
+static tool_rc manifest_load_object(ESYS_CONTEXT *ectx, char **fields,
+        tpm2_loaded_object *object) {
+
+    if (!ctx.parent.ctx_path) {
+        return tpm2_util_object_load(ectx, fields[0], object,
+                TPM2_HANDLES_FLAGS_TRANSIENT | TPM2_HANDLES_FLAGS_PERSISTENT);
+    }
+
+    TPM2B_PUBLIC in_public = { 0 };
+    TPM2B_PRIVATE in_private = { 0 };
+    bool result = files_load_public(fields[0], &in_public)
+            && files_load_private(fields[1], &in_private);
+    if (!result) {
+        return tool_rc_general_error;
+    }
+
+    return tpm2_load(ectx, &ctx.parent.object, &in_private, &in_public,
+            &object->tr_handle, NULL);
+}
+
+/*
+ * Seals the data of an object again, as a new object under the parent with
+ * the policy of the line and otherwise the public area of the old object. A
+ * password auth of the old object is kept, the data never leaves the tool.
+ */
+static tool_rc manifest_reseal(ESYS_CONTEXT *ectx, char **fields,
+        tpm2_loaded_object *object, const TPM2B_SENSITIVE_DATA *data) {
+
+    const char *policy_path = fields[3];
+    const char *public_path = fields[4];
+    const char *private_path = fields[5];
+
+    TPM2B_PUBLIC in_public = { 0 };
+    if (!files_load_public(fields[0], &in_public)) {
+        return tool_rc_general_error;
+    }
+
+    TPMT_PUBLIC *public_area = &in_public.publicArea;
+    public_area->authPolicy.size = sizeof(public_area->authPolicy.buffer);
+    bool result = files_load_bytes_from_path(policy_path,
+            public_area->authPolicy.buffer, &public_area->authPolicy.size);
+    if (!result) {
+        return tool_rc_general_error;
+    }
+
+    UINT16 policy_size = tpm2_alg_util_get_hash_size(public_area->nameAlg);
+    if (public_area->authPolicy.size != policy_size) {
+        LOG_ERR("Expected a policy digest of %u bytes in \"%s\", got: %u",
+                policy_size, policy_path, public_area->authPolicy.size);
+        return tool_rc_general_error;
+    }
+
+    /* the TPM computes the unique field of the new object */
+    public_area->unique.keyedHash.size = 0;
+
+    TPM2B_SENSITIVE_CREATE sensitive = { 0 };
+    if (object->session
+            && tpm2_session_get_type(object->session) == TPM2_SE_PASSWORD) {
+        sensitive.sensitive.userAuth =
+                *tpm2_session_get_auth_value(object->session);
+    }
+    sensitive.sensitive.data.size = data->size;
+    memcpy(sensitive.sensitive.data.buffer, data->buffer, data->size);
+
+    TPM2B_DATA outside_info = { 0 };
+    TPML_PCR_SELECTION creation_pcr = { 0 };
+    TPM2B_DIGEST cp_hash = { .size = 0 };
+    TPM2B_DIGEST rp_hash = { .size = 0 };
+    TPM2B_PRIVATE *out_private = NULL;
+    TPM2B_PUBLIC *out_public = NULL;
+    TPM2B_CREATION_DATA *creation_data = NULL;
+    TPM2B_DIGEST *creation_hash = NULL;
+    TPMT_TK_CREATION *creation_ticket = NULL;
+    tool_rc rc = tpm2_create(ectx, &ctx.parent.object, &sensitive, &in_public,
+            &outside_info, &creation_pcr, &out_private, &out_public,
+            &creation_data, &creation_hash, &creation_ticket, &cp_hash,
+            &rp_hash, TPM2_ALG_ERROR, ctx.aux_session_handle[0],
+            ctx.aux_session_handle[1]);
+    OPENSSL_cleanse(&sensitive, sizeof(sensitive));
+    free(creation_data);
+    free(creation_hash);
+    free(creation_ticket);
+
+    result = rc == tool_rc_success
+        && files_save_public(out_public, public_path)
+        && files_save_private(out_private, private_path);
+
+    free(out_private);
+    free(out_public);
+
+    return result ? tool_rc_success : tool_rc_general_error;
+}
+
+static tool_rc manifest_unseal(ESYS_CONTEXT *ectx, char **fields,
+        size_t count) {
+
+    const char *auth_str = fields[ctx.is_reseal ? 2 : count - 2];
+    const char *output_path = fields[count - 1];
+    if (!strcmp(auth_str, "-")) {
+        auth_str = ctx.sealkey.auth_str;
+    }
+
+    tpm2_loaded_object object = { .tr_handle = ESYS_TR_NONE };
+    tool_rc rc = manifest_load_object(ectx, fields, &object);
+    if (rc != tool_rc_success) {
+        return rc;
+    }
+
+    rc = manifest_get_session(ectx, auth_str, &object.session);
+    if (rc == tool_rc_success) {
+        TPM2B_DIGEST cp_hash = { .size = 0 };
+        TPM2B_DIGEST rp_hash = { .size = 0 };
+        TPM2B_SENSITIVE_DATA *data = NULL;
+        rc = tpm2_unseal(ectx, &object, &data, &cp_hash, &rp_hash,
+                TPM2_ALG_ERROR, ctx.aux_session_handle[0],
+                ctx.aux_session_handle[1]);
+        if (rc == tool_rc_success && ctx.is_reseal) {
+            rc = manifest_reseal(ectx, fields, &object, data);
+        } else if (rc == tool_rc_success && !files_save_bytes_to_file(
+                output_path, data->buffer, data->size)) {
+            rc = tool_rc_general_error;
+        }
+        if (data) {
+            OPENSSL_cleanse(data, sizeof(*data));
+        }
+        free(data);
+    }
+
+    /* objects loaded from their portions are not needed after the line */
+    tool_rc tmp_rc = ctx.parent.ctx_path ?
+            tpm2_flush_context(ectx, object.tr_handle) :
+            tpm2_util_object_unload(ectx, &object);
+
+    return rc != tool_rc_success ? rc : tmp_rc;
+}
+
+typedef struct manifest_run_state manifest_run_state;
+struct manifest_run_state {
+    ESYS_CONTEXT *ectx;
+    tool_rc rc;
+};
+
+static bool manifest_line(void *entry, char *line, char **fields,
+        size_t count, size_t line_number, void *userdata) {
+
+    UNUSED(entry);
+
+    manifest_run_state *state = (manifest_run_state *) userdata;
+
+    tool_rc tmp_rc = manifest_unseal(state->ectx, fields, count);
+
+    tpm2_tool_output("- line: %zu\n", line_number);
+    if (ctx.is_reseal) {
+        tpm2_tool_output("  public: %s\n", fields[4]);
+        tpm2_tool_output("  private: %s\n", fields[5]);
+    } else {
+        tpm2_tool_output("  output: %s\n", fields[count - 1]);
+    }
+    tpm2_tool_output("  %s: %s\n", ctx.is_reseal ? "resealed" : "unsealed",
+            tmp_rc == tool_rc_success ? "true" : "false");
+    tpm2_tool_output_flush();
+
+    if (tmp_rc != tool_rc_success && state->rc == tool_rc_success) {
+        state->rc = tmp_rc;
+    }
+
+    free(line);
+
+    return true;
+}
+
+/*
+ * Unseals, or reseals, every object of the manifest. Objects with the same
+ * auth share one session, a PCR policy is satisfied again by restarting it.
+ */
+static tool_rc manifest_run(ESYS_CONTEXT *ectx) {
+
+    tool_rc rc = tool_rc_success;
+    if (ctx.parent.ctx_path) {
+        rc = tpm2_util_object_load_auth(ectx, ctx.parent.ctx_path,
+                ctx.parent.auth_str, &ctx.parent.object, false,
+                TPM2_HANDLE_ALL_W_NV);
+        if (rc != tool_rc_success) {
+            return rc;
+        }
+
+        if (ctx.parent.object.session && tpm2_session_get_type(
+                ctx.parent.object.session) == TPM2_SE_POLICY) {
+            LOG_ERR("A manifest cannot satisfy a policy session for every "
+                    "load under the parent");
+            return tool_rc_option_error;
+        }
+    }
+
+    rc = tpm2_util_aux_sessions_setup(ectx, ctx.aux_session_cnt,
+        ctx.aux_session_path, ctx.aux_session_handle, ctx.aux_session);
+    if (rc != tool_rc_success) {
+        return rc;
+    }
+
+    size_t fields = MANIFEST_FIELDS_MAX;
+    const char *usage = "<public> <private> <auth> <policy> <new-public> "
+            "<new-private>";
+    if (!ctx.is_reseal) {
+        fields = ctx.parent.ctx_path ? 4 : 3;
+        usage = ctx.parent.ctx_path ? "<public> <private> <auth> <output>" :
+                "<object> <auth> <output>";
+    }
+
+    manifest_run_state state = {
+        .ectx = ectx,
+        .rc = tool_rc_success,
+    };
+
+    bool result = tpm2_util_manifest_read(ctx.manifest_path, fields, fields,
+            usage, NULL, NULL, 0, manifest_line, &state);
+
+    return result ? state.rc : tool_rc_general_error;
+}
+
 static tool_rc check_options(void) {
 
+    if (ctx.manifest_path) {
+        if (ctx.sealkey.ctx_path || ctx.output_file_path || ctx.cp_hash_path
+                || ctx.rp_hash_path) {
+            LOG_ERR("The manifest names the objects and outputs, cannot "
+                    "specify -c, -o, --cphash or --rphash");
+            return tool_rc_option_error;
+        }
+
+        if (ctx.is_reseal && !ctx.parent.ctx_path) {
+            LOG_ERR("Resealing creates the new objects under the parent, "
+                    "expected option C");
+            return tool_rc_option_error;
+        }
+
+        return tool_rc_success;
+    }
+
+    if (ctx.is_reseal) {
+        LOG_ERR("Expected the objects to reseal in a manifest");
+        return tool_rc_option_error;
+    }
+
+    if (ctx.parent.ctx_path) {
+        LOG_ERR("A parent is only used to load the objects of a manifest");
+        return tool_rc_option_error;
+    }
+
     if (!ctx.sealkey.ctx_path) {
         LOG_ERR("Expected option c");
         return tool_rc_option_error;
@@ -194,6 +529,18 @@ static bool on_option(char key, char *value) {
     case 'o':
         ctx.output_file_path = value;
         break;
+    case 'C':
+        ctx.parent.ctx_path = value;
+        break;
+    case 'P':
+        ctx.parent.auth_str = value;
+        break;
+    case 2:
+        ctx.manifest_path = value;
+        break;
+    case 3:
+        ctx.is_reseal = true;
+        break;
     case 0:
         ctx.cp_hash_path = value;
         break;
@@ -222,9 +569,13 @@ static bool tpm2_tool_onstart(tpm2_options **opts) {
       { "cphash",           required_argument, NULL,  0  },
       { "rphash",           required_argument, NULL,  1  },
       { "session",          required_argument, NULL, 'S' },
+      { "manifest",         required_argument, NULL,  2  },
+      { "parent-context",   required_argument, NULL, 'C' },
+      { "parent-auth",      required_argument, NULL, 'P' },
+      { "reseal",           no_argument,       NULL,  3  },
     };
 
-    *opts = tpm2_options_new("S:p:o:c:", ARRAY_LEN(topts), topts, on_option,
+    *opts = tpm2_options_new("S:p:o:c:C:P:", ARRAY_LEN(topts), topts, on_option,
         NULL, 0);
 
     return *opts != NULL;
@@ -242,6 +593,10 @@ static tool_rc tpm2_tool_onrun(ESYS_CONTEXT *ectx, tpm2_option_flags flags) {
         return rc;
     }
 
+    if (ctx.manifest_path) {
+        return manifest_run(ectx);
+    }
+
     /*
      * 2. Process inputs
      */
@@ -284,6 +639,21 @@ static tool_rc tpm2_tool_onstop(ESYS_CONTEXT *ectx) {
         }
     }
 
+    size_t j;
+    for (j = 0; j < ctx.auths_count; j++) {
+        free(ctx.auths[j].auth_str);
+        tmp_rc = tpm2_session_close(&ctx.auths[j].session);
+        if (tmp_rc != tool_rc_success) {
+            rc = tmp_rc;
+        }
+    }
+    free(ctx.auths);
+
+    tmp_rc = tpm2_session_close(&ctx.parent.object.session);
+    if (tmp_rc != tool_rc_success) {
+        rc = tmp_rc;
+    }
+
     /*
      * 3. Close auxiliary sessions
      */
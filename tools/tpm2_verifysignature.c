@@ -1,6 +1,13 @@
 /* SPDX-License-Identifier: BSD-3-Clause */
 
+#include <errno.h>
+#include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+
+#include <openssl/err.h>
+#include <openssl/evp.h>
+#include <openssl/rsa.h>
 
 #include "files.h"
 #include "log.h"
@@ -10,7 +17,18 @@
 #include "tpm2_alg_util.h"
 #include "tpm2_convert.h"
 #include "tpm2_hash.h"
+#include "tpm2_openssl.h"
 #include "tpm2_options.h"
+#include "tpm2_tree_hash.h"
+#include "tpm2_util.h"
+#include "tpm2_work_pool.h"
+
+/* public key, message and signature of a manifest line */
+#define MANIFEST_FIELDS 3
+
+#ifndef RSA_PSS_SALTLEN_AUTO
+#define RSA_PSS_SALTLEN_AUTO -2
+#endif
 
 typedef struct tpm2_verifysig_ctx tpm2_verifysig_ctx;
 struct tpm2_verifysig_ctx {
@@ -35,6 +53,16 @@ struct tpm2_verifysig_ctx {
     char *out_file_path;
     const char *context_arg;
     tpm2_loaded_object key_context_object;
+    /* verifies on the host instead of the TPM */
+    const char *public_path;
+    const char *manifest_path;
+    UINT32 jobs;
+    /* the message is checked against the tree the signature is over */
+    const char *tree_path;
+    tpm2_tree_hash tree;
+    bool is_range;
+    UINT64 range_offset;
+    UINT64 range_length;
 };
 
 static tpm2_verifysig_ctx ctx = {
@@ -101,6 +129,177 @@ static TPM2B *message_from_file(const char *msg_file_path) {
     return msg;
 }
 
+static tpm2_convert_sig_fmt sig_format(void) {
+
+    return ctx.flags.fmt ? signature_format_plain : signature_format_tss;
+}
+
+/*
+ * Hashes the message with OpenSSL, anything the host cannot hash needs the
+ * TPM and thus --key-context.
+ */
+static TPM2B_DIGEST *host_hash(const char *msg_file_path) {
+
+    if (!tpm2_openssl_halg_from_tpmhalg(ctx.halg)) {
+        LOG_ERR("Hash algorithm 0x%x is not supported on the host", ctx.halg);
+        return NULL;
+    }
+
+    FILE *f = files_fopen(msg_file_path, "rb");
+    if (!f) {
+        LOG_ERR("Could not open file \"%s\", error: %s", msg_file_path,
+                strerror(errno));
+        return NULL;
+    }
+
+    TPM2B_DIGEST *digest = NULL;
+    tool_rc rc = tpm2_hash_file(NULL, ctx.halg, TPM2_RH_NULL, f, &digest,
+            NULL);
+    fclose(f);
+
+    return rc == tool_rc_success ? digest : NULL;
+}
+
+/*
+ * Checks the signature with the public key in OpenSSL. Only the schemes
+ * OpenSSL knows are supported, HMACs and the others need the TPM.
+ */
+static bool host_verify(EVP_PKEY *pkey, TPMT_SIGNATURE *signature,
+        const TPM2B_DIGEST *digest) {
+
+    switch (signature->sigAlg) {
+    case TPM2_ALG_RSASSA:
+    case TPM2_ALG_RSAPSS:
+    case TPM2_ALG_ECDSA:
+        break;
+    default:
+        LOG_ERR("Cannot verify signature scheme 0x%x on the host, use "
+                "--key-context (-c)", signature->sigAlg);
+        return false;
+    }
+
+    const EVP_MD *md = tpm2_openssl_halg_from_tpmhalg(
+            signature->signature.any.hashAlg);
+    if (!md) {
+        LOG_ERR("Signature hash algorithm 0x%x is not supported on the host",
+                signature->signature.any.hashAlg);
+        return false;
+    }
+
+    UINT16 size;
+    UINT8 *buffer = tpm2_convert_sig(&size, signature);
+    if (!buffer) {
+        return false;
+    }
+
+    bool result = false;
+    EVP_PKEY_CTX *pkey_ctx = EVP_PKEY_CTX_new(pkey, NULL);
+    if (!pkey_ctx) {
+        LOG_ERR("EVP_PKEY_CTX_new failed: %s",
+                ERR_error_string(ERR_get_error(), NULL));
+        goto out;
+    }
+
+    if (EVP_PKEY_verify_init(pkey_ctx) <= 0
+            || EVP_PKEY_CTX_set_signature_md(pkey_ctx, md) <= 0) {
+        LOG_ERR("Could not initialize the verification: %s",
+                ERR_error_string(ERR_get_error(), NULL));
+        goto out;
+    }
+
+    /* the TPM uses either salt length, which OpenSSL can tell */
+    if (signature->sigAlg == TPM2_ALG_RSAPSS
+            && (EVP_PKEY_CTX_set_rsa_padding(pkey_ctx,
+                    RSA_PKCS1_PSS_PADDING) <= 0
+                || EVP_PKEY_CTX_set_rsa_pss_saltlen(pkey_ctx,
+                    RSA_PSS_SALTLEN_AUTO) <= 0)) {
+        LOG_ERR("Could not set the PSS padding: %s",
+                ERR_error_string(ERR_get_error(), NULL));
+        goto out;
+    }
+
+    int rc = EVP_PKEY_verify(pkey_ctx, buffer, size, digest->buffer,
+            digest->size);
+    if (rc != 1) {
+        if (rc == 0) {
+            LOG_ERR("Signature does not match the digest and public key");
+        } else {
+            LOG_ERR("Error %s", ERR_error_string(ERR_get_error(), NULL));
+        }
+        goto out;
+    }
+
+    result = true;
+
+out:
+    EVP_PKEY_CTX_free(pkey_ctx);
+    free(buffer);
+
+    return result;
+}
+
+static tool_rc host_verify_signature(void) {
+
+    EVP_PKEY *pkey = NULL;
+    if (!tpm2_public_load_pkey(ctx.public_path, &pkey)) {
+        return tool_rc_general_error;
+    }
+
+    bool result = host_verify(pkey, &ctx.signature, ctx.msg_hash);
+    EVP_PKEY_free(pkey);
+
+    return result ? tool_rc_success : tool_rc_general_error;
+}
+
+/*
+ * The signature of a tree hash is over the digest of the root, the chunk size
+ * and the length, the chunks of the message are checked once the signature
+ * is.
+ */
+static tool_rc tree_init(ESYS_CONTEXT *context) {
+
+    if (ctx.flags.digest || !ctx.flags.msg) {
+        LOG_ERR("--tree needs the message (-m) it was computed from, not a "
+                "digest (-d)");
+        return tool_rc_option_error;
+    }
+
+    if (!tpm2_tree_hash_load(ctx.tree_path, &ctx.tree)) {
+        return tool_rc_general_error;
+    }
+
+    if (ctx.flags.halg && ctx.halg != ctx.tree.halg) {
+        LOG_ERR("The tree is hashed with algorithm 0x%x", ctx.tree.halg);
+        return tool_rc_option_error;
+    }
+    ctx.halg = ctx.tree.halg;
+
+    TPM2B_MAX_BUFFER data = { 0 };
+    if (!tpm2_tree_hash_signed_data(&ctx.tree, &data)) {
+        return tool_rc_general_error;
+    }
+
+    /* the message is not loaded, the digest of the tree is verified */
+    tool_rc rc = tpm2_hash_compute_data(context, ctx.halg, TPM2_RH_NULL,
+            data.buffer, data.size, &ctx.msg_hash, NULL);
+    if (rc != tool_rc_success) {
+        LOG_ERR("Compute tree hash failed!");
+        return rc;
+    }
+    ctx.flags.digest = 1;
+    ctx.flags.msg = 0;
+
+    return tool_rc_success;
+}
+
+static tool_rc tree_check(void) {
+
+    bool result = tpm2_tree_hash_check(ctx.msg_file_path, &ctx.tree,
+            ctx.range_offset, ctx.range_length, ctx.jobs);
+
+    return result ? tool_rc_success : tool_rc_general_error;
+}
+
 static tool_rc init(ESYS_CONTEXT *context) {
 
     tool_rc rc = tool_rc_general_error;
@@ -111,14 +310,69 @@ static tool_rc init(ESYS_CONTEXT *context) {
         return tool_rc_option_error;
     }
 
-    if (!(ctx.context_arg && ctx.flags.sig)) {
-        LOG_ERR("--key-context (-c) and --sig (-s) are required");
+    if (ctx.is_range && !ctx.tree_path) {
+        LOG_ERR("--range requires --tree");
+        return tool_rc_option_error;
+    }
+
+    if (ctx.tree_path) {
+        rc = tree_init(context);
+        if (rc != tool_rc_success) {
+            return rc;
+        }
+        rc = tool_rc_general_error;
+    }
+
+    if (!((ctx.context_arg || ctx.public_path) && ctx.flags.sig)) {
+        LOG_ERR("--key-context (-c) or --public (-u) and --sig (-s) are "
+                "required");
+        return tool_rc_option_error;
+    }
+
+    if (ctx.context_arg && ctx.public_path) {
+        LOG_ERR("Specify either --key-context (-c) or --public (-u)");
+        return tool_rc_option_error;
+    }
+
+    if (ctx.public_path && ctx.flags.ticket) {
+        LOG_ERR("Only the TPM produces a ticket, use --key-context (-c)");
+        return tool_rc_option_error;
+    }
+
+    if (ctx.context_arg && !context) {
+        LOG_ERR("--key-context (-c) needs a TPM, use --public (-u) to verify "
+                "on the host");
         return tool_rc_option_error;
     }
 
     TPM2B *msg = NULL;
+    tool_rc tmp_rc;
+
+    if (ctx.public_path) {
+        bool res = tpm2_convert_sig_load(ctx.sig_file_path, sig_format(),
+                ctx.format, ctx.halg, &ctx.signature);
+        if (!res) {
+            return tool_rc_general_error;
+        }
+
+        if (!ctx.flags.digest) {
+            if (!ctx.flags.msg) {
+                LOG_ERR("No digest set and no message file to compute from, "
+                        "cannot compute message hash!");
+                return tool_rc_option_error;
+            }
+
+            ctx.msg_hash = host_hash(ctx.msg_file_path);
+            if (!ctx.msg_hash) {
+                LOG_ERR("Compute message hash failed!");
+                return tool_rc_general_error;
+            }
+        }
+
+        return tool_rc_success;
+    }
 
-    tool_rc tmp_rc = tpm2_util_object_load(context, ctx.context_arg,
+    tmp_rc = tpm2_util_object_load(context, ctx.context_arg,
             &ctx.key_context_object, TPM2_HANDLE_ALL_W_NV);
     if (tmp_rc != tool_rc_success) {
         return tmp_rc;
@@ -134,10 +388,8 @@ static tool_rc init(ESYS_CONTEXT *context) {
 
     if (ctx.flags.sig) {
 
-        tpm2_convert_sig_fmt fmt =
-                ctx.flags.fmt ? signature_format_plain : signature_format_tss;
-        bool res = tpm2_convert_sig_load(ctx.sig_file_path, fmt, ctx.format,
-                ctx.halg, &ctx.signature);
+        bool res = tpm2_convert_sig_load(ctx.sig_file_path, sig_format(),
+                ctx.format, ctx.halg, &ctx.signature);
         if (!res) {
             goto err;
         }
@@ -171,6 +423,194 @@ err:
     return rc;
 }
 
+typedef struct manifest_key manifest_key;
+struct manifest_key {
+    char *path;
+    EVP_PKEY *pkey;
+};
+
+typedef struct manifest_sig manifest_sig;
+struct manifest_sig {
+    char *line;
+    size_t line_number;
+    const char *msg_file_path;
+    const char *sig_file_path;
+    size_t key;
+};
+
+typedef struct manifest manifest;
+struct manifest {
+    manifest_sig *sigs;
+    size_t count;
+    manifest_key *keys;
+    size_t key_count;
+    size_t key_capacity;
+};
+
+/* the signatures of a key share its public key, loaded once */
+static manifest_key *manifest_key_get(manifest *m, const char *path,
+        size_t line_number) {
+
+    size_t i;
+    for (i = 0; i < m->key_count; i++) {
+        if (!strcmp(m->keys[i].path, path)) {
+            return &m->keys[i];
+        }
+    }
+
+    if (!tpm2_util_array_grow((void **) &m->keys, &m->key_capacity,
+            m->key_count, sizeof(*m->keys))) {
+        return NULL;
+    }
+
+    manifest_key *key = &m->keys[m->key_count];
+    key->path = strdup(path);
+    if (!key->path) {
+        LOG_ERR("oom");
+        return NULL;
+    }
+
+    /* a key that does not load fails its signatures, not the manifest */
+    key->pkey = NULL;
+    if (!tpm2_public_load_pkey(path, &key->pkey)) {
+        LOG_ERR("%s:%zu: Could not load public key \"%s\"",
+                ctx.manifest_path, line_number, path);
+    }
+    m->key_count++;
+
+    return key;
+}
+
+static bool manifest_add(void *e, char *line, char **fields, size_t count,
+        size_t line_number, void *userdata) {
+
+    UNUSED(count);
+
+    manifest *m = (manifest *) userdata;
+    manifest_sig *sig = (manifest_sig *) e;
+    sig->line = line;
+    sig->line_number = line_number;
+    sig->msg_file_path = fields[1];
+    sig->sig_file_path = fields[2];
+
+    manifest_key *key = manifest_key_get(m, fields[0], line_number);
+    if (!key) {
+        return false;
+    }
+    sig->key = key - m->keys;
+
+    return true;
+}
+
+static bool manifest_load(manifest *m) {
+
+    return tpm2_util_manifest_read(ctx.manifest_path, MANIFEST_FIELDS,
+            MANIFEST_FIELDS, "<public> <message> <signature>",
+            (void **) &m->sigs, &m->count, sizeof(*m->sigs), manifest_add, m);
+}
+
+static void manifest_free(manifest *m) {
+
+    size_t i;
+    for (i = 0; i < m->count; i++) {
+        free(m->sigs[i].line);
+    }
+    free(m->sigs);
+
+    for (i = 0; i < m->key_count; i++) {
+        free(m->keys[i].path);
+        EVP_PKEY_free(m->keys[i].pkey);
+    }
+    free(m->keys);
+}
+
+static bool manifest_sig_verify(manifest *m, manifest_sig *sig) {
+
+    manifest_key *key = &m->keys[sig->key];
+    if (!key->pkey) {
+        return false;
+    }
+
+    TPMT_SIGNATURE signature;
+    bool result = tpm2_convert_sig_load(sig->sig_file_path, sig_format(),
+            ctx.format, ctx.halg, &signature);
+    if (!result) {
+        return false;
+    }
+
+    TPM2B_DIGEST *digest = host_hash(sig->msg_file_path);
+    if (!digest) {
+        return false;
+    }
+
+    result = host_verify(key->pkey, &signature, digest);
+    free(digest);
+
+    return result;
+}
+
+typedef struct manifest_run_state manifest_run_state;
+struct manifest_run_state {
+    manifest *m;
+    tool_rc rc;
+};
+
+static bool manifest_work(tpm2_work_worker *worker, size_t index,
+        void *userdata) {
+
+    UNUSED(worker);
+
+    manifest_run_state *state = (manifest_run_state *) userdata;
+
+    return manifest_sig_verify(state->m, &state->m->sigs[index]);
+}
+
+static bool manifest_deliver(size_t index, bool result, void *userdata) {
+
+    manifest_run_state *state = (manifest_run_state *) userdata;
+    manifest_sig *sig = &state->m->sigs[index];
+
+    tpm2_tool_output("- line: %zu\n", sig->line_number);
+    tpm2_tool_output("  signature: %s\n", sig->sig_file_path);
+    tpm2_tool_output("  verified: %s\n", result ? "true" : "false");
+    tpm2_tool_output_flush();
+
+    if (!result) {
+        state->rc = tool_rc_general_error;
+    }
+
+    return true;
+}
+
+/*
+ * The signatures are independent of each other, so they are verified on the
+ * host by a work pool, while the calling thread prints the results in
+ * manifest order as soon as they are known.
+ */
+static tool_rc manifest_run(void) {
+
+    manifest m = { 0 };
+    manifest_run_state state = {
+        .m = &m,
+        .rc = tool_rc_general_error,
+    };
+
+    if (!manifest_load(&m)) {
+        goto out;
+    }
+
+    state.rc = tool_rc_success;
+    if (!tpm2_work_pool_run(m.count, ctx.jobs, manifest_work,
+            manifest_deliver, &state)) {
+        state.rc = tool_rc_general_error;
+    }
+
+out:
+    manifest_free(&m);
+
+    return state.rc;
+}
+
 static bool on_option(char key, char *value) {
 
     switch (key) {
@@ -222,6 +662,35 @@ static bool on_option(char key, char *value) {
         ctx.out_file_path = value;
         ctx.flags.ticket = 1;
         break;
+    case 'u':
+        ctx.public_path = value;
+        break;
+    case 1:
+        ctx.manifest_path = value;
+        break;
+    case 2:
+        if (!tpm2_util_string_to_uint32(value, &ctx.jobs) || !ctx.jobs) {
+            LOG_ERR("Invalid number of jobs, got: \"%s\"", value);
+            return false;
+        }
+        break;
+    case 3:
+        ctx.tree_path = value;
+        break;
+    case 4: {
+        char *length = strchr(value, ':');
+        if (length) {
+            *length++ = '\0';
+        }
+        if (!tpm2_util_string_to_uint64(value, &ctx.range_offset)
+                || (length && !tpm2_util_string_to_uint64(length,
+                        &ctx.range_length))) {
+            LOG_ERR("Expected a range of <offset>[:<length>]");
+            return false;
+        }
+        ctx.is_range = true;
+    }
+        break;
         /* no default */
     }
 
@@ -239,11 +708,16 @@ static bool tpm2_tool_onstart(tpm2_options **opts) {
             { "signature",      required_argument, NULL, 's' },
             { "ticket",         required_argument, NULL, 't' },
             { "key-context",    required_argument, NULL, 'c' },
+            { "public",         required_argument, NULL, 'u' },
+            { "manifest",       required_argument, NULL,  1  },
+            { "jobs",           required_argument, NULL,  2  },
+            { "tree",           required_argument, NULL,  3  },
+            { "range",          required_argument, NULL,  4  },
     };
 
 
-    *opts = tpm2_options_new("g:m:d:f:s:t:c:", ARRAY_LEN(topts), topts,
-            on_option, NULL, 0);
+    *opts = tpm2_options_new("g:m:d:f:s:t:c:u:", ARRAY_LEN(topts), topts,
+            on_option, NULL, TPM2_OPTIONS_OPTIONAL_SAPI);
 
     return *opts != NULL;
 }
@@ -252,25 +726,45 @@ static tool_rc tpm2_tool_onrun(ESYS_CONTEXT *context, tpm2_option_flags flags) {
 
     UNUSED(flags);
 
+    if (ctx.manifest_path) {
+        if (ctx.context_arg || ctx.public_path || ctx.flags.msg
+                || ctx.flags.digest || ctx.flags.sig || ctx.flags.ticket
+                || ctx.tree_path) {
+            LOG_ERR("--manifest replaces --key-context (-c), --public (-u), "
+                    "--message (-m), --digest (-d), --signature (-s) and "
+                    "--ticket (-t)");
+            return tool_rc_option_error;
+        }
+
+        return manifest_run();
+    }
+
+    if (ctx.jobs && !ctx.tree_path) {
+        LOG_ERR("--jobs requires --manifest or --tree");
+        return tool_rc_option_error;
+    }
+
     /* initialize and process */
     tool_rc rc = init(context);
     if (rc != tool_rc_success) {
         return rc;
     }
 
-    rc = verify_signature(context);
+    rc = ctx.public_path ? host_verify_signature() :
+            verify_signature(context);
     if (rc != tool_rc_success) {
         LOG_ERR("Verify signature failed!");
         return rc;
     }
 
-    return tool_rc_success;
+    return ctx.tree_path ? tree_check() : tool_rc_success;
 }
 
 static void tpm2_tool_onexit(void) {
     if (ctx.msg_hash) {
         free(ctx.msg_hash);
     }
+    tpm2_tree_hash_free(&ctx.tree);
 }
 
 // Register this tool with tpm2_tool.c
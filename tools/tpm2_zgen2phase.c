@@ -1,4 +1,10 @@
 /* SPDX-License-Identifier: BSD-3-Clause */
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <tss2/tss2_mu.h>
+
 #include "files.h"
 #include "log.h"
 #include "object.h"
@@ -6,6 +12,7 @@
 #include "tpm2_tool.h"
 #include "tpm2_auth_util.h"
 #include "tpm2_alg_util.h"
+#include "tpm2_ecc_pool.h"
 #include "tpm2_options.h"
 
 typedef struct tpm_ecdhzgen_ctx tpm_ecdhzgen_ctx;
@@ -29,6 +36,11 @@ struct tpm_ecdhzgen_ctx {
 
     UINT16 commit_counter;
     TPMI_ECC_KEY_EXCHANGE keyexchange_scheme;
+
+    bool is_batch;
+    const char *peers_path;
+    const char *pool_path;
+    const char *output_ephemeral_path;
 };
 
 static tpm_ecdhzgen_ctx ctx = {
@@ -69,6 +81,18 @@ static bool on_option(char key, char *value) {
         case 3:
             ctx.output_z2_path = value;
             break;
+        case 4:
+            ctx.is_batch = true;
+            break;
+        case 5:
+            ctx.peers_path = value;
+            break;
+        case 6:
+            ctx.pool_path = value;
+            break;
+        case 7:
+            ctx.output_ephemeral_path = value;
+            break;
     };
 
     return true;
@@ -85,6 +109,10 @@ static bool tpm2_tool_onstart(tpm2_options **opts) {
       { "ephemeral-public", required_argument, NULL,  1  },
       { "output-Z1",        required_argument, NULL,  2  },
       { "output-Z2",        required_argument, NULL,  3  },
+      { "batch",            no_argument,       NULL,  4  },
+      { "peers",            required_argument, NULL,  5  },
+      { "pool",             required_argument, NULL,  6  },
+      { "output-ephemeral", required_argument, NULL,  7  },
     };
 
     *opts = tpm2_options_new("c:p:s:t:", ARRAY_LEN(topts), topts,
@@ -107,13 +135,20 @@ static tool_rc check_options(void) {
         return tool_rc_option_error;
     }
 
-    if (!ctx.static_public_path) {
-        LOG_ERR("Specify path to read the static public data from.");
-        return tool_rc_option_error;
-    }
-
-    if (!ctx.ephemeral_public_path) {
-        LOG_ERR("Specify path to read the ephemeral public data from.");
+    if (ctx.is_batch) {
+        if (ctx.static_public_path || ctx.ephemeral_public_path
+                || ctx.commit_counter) {
+            LOG_ERR("A batch reads the public points from --peers and takes "
+                    "the counters from --pool");
+            return tool_rc_option_error;
+        }
+        if (!ctx.pool_path) {
+            LOG_ERR("Specify the pool of ephemeral counters with --pool");
+            return tool_rc_option_error;
+        }
+    } else if (ctx.peers_path || ctx.pool_path
+            || ctx.output_ephemeral_path) {
+        LOG_ERR("--peers, --pool and --output-ephemeral require --batch");
         return tool_rc_option_error;
     }
 
@@ -127,6 +162,20 @@ static tool_rc check_options(void) {
         return tool_rc_option_error;
     }
 
+    if (ctx.is_batch) {
+        return tool_rc_success;
+    }
+
+    if (!ctx.static_public_path) {
+        LOG_ERR("Specify path to read the static public data from.");
+        return tool_rc_option_error;
+    }
+
+    if (!ctx.ephemeral_public_path) {
+        LOG_ERR("Specify path to read the ephemeral public data from.");
+        return tool_rc_option_error;
+    }
+
     return tool_rc_success;
 }
 
@@ -139,6 +188,11 @@ static tool_rc process_inputs(ESYS_CONTEXT *ectx) {
         return rc;
     }
 
+    /* the points of a batch are streamed as they are computed */
+    if (ctx.is_batch) {
+        return tool_rc_success;
+    }
+
     bool result = true;
     result = files_load_ecc_point(ctx.static_public_path, &ctx.Q1);
     if (!result) {
@@ -172,6 +226,232 @@ static tool_rc process_outputs(void) {
     return tool_rc_success;
 }
 
+typedef struct zgen_job zgen_job;
+struct zgen_job {
+    TPM2B_ECC_POINT Q1;
+    TPM2B_ECC_POINT Q2;
+    tpm2_ecc_pool_entry entry;
+};
+
+/* a record holds a marshaled TPMS_ECC_POINT, as a public point file does */
+static bool batch_read_point(FILE *input, TPM2B_ECC_POINT *point,
+        bool *is_end) {
+
+    UINT8 buffer[sizeof(TPMS_ECC_POINT)];
+    UINT16 size = sizeof(buffer);
+    bool result = files_read_record(input, buffer, &size, is_end);
+    if (!result) {
+        LOG_ERR("Could not read the public point records");
+        return false;
+    }
+
+    if (*is_end) {
+        return true;
+    }
+
+    size_t offset = 0;
+    memset(point, 0, sizeof(*point));
+    TSS2_RC rval = Tss2_MU_TPMS_ECC_POINT_Unmarshal(buffer, size, &offset,
+            &point->point);
+    if (rval != TSS2_RC_SUCCESS || offset != size) {
+        LOG_ERR("Invalid public point record");
+        return false;
+    }
+    point->size = size;
+
+    return true;
+}
+
+/*
+ * Reads the static and ephemeral points of the next peer, pairs them with
+ * the next counter of the pool and sends them to the TPM. Returns false at
+ * the end of the input, or on an error setting rc.
+ */
+static bool batch_next(ESYS_CONTEXT *ectx, FILE *input, zgen_job *job,
+        tool_rc *rc) {
+
+    bool is_end = false;
+    bool result = batch_read_point(input, &job->Q1, &is_end);
+    if (result && is_end) {
+        return false;
+    }
+
+    result = result && batch_read_point(input, &job->Q2, &is_end);
+    if (result && is_end) {
+        LOG_ERR("Expected the ephemeral point after the static one");
+        result = false;
+    }
+
+    size_t remaining = 0;
+    result = result && tpm2_ecc_pool_take(ctx.pool_path,
+            TPM2_CC_EC_Ephemeral, NULL, &job->entry, &remaining);
+    if (!result) {
+        *rc = tool_rc_general_error;
+        return false;
+    }
+
+    if (!remaining) {
+        LOG_WARN("Took the last entry of pool \"%s\"", ctx.pool_path);
+    }
+
+    tool_rc tmp_rc = tpm2_zgen2phase_async(ectx, &ctx.ecc_key.object,
+            &job->Q1, &job->Q2, ctx.keyexchange_scheme, job->entry.counter);
+    if (tmp_rc != tool_rc_success) {
+        *rc = tmp_rc;
+        return false;
+    }
+
+    return true;
+}
+
+static bool batch_write_point(FILE *output, const TPM2B_ECC_POINT *point) {
+
+    UINT8 buffer[sizeof(TPMS_ECC_POINT)];
+    size_t offset = 0;
+    TSS2_RC rval = Tss2_MU_TPMS_ECC_POINT_Marshal(&point->point, buffer,
+            sizeof(buffer), &offset);
+    if (rval != TSS2_RC_SUCCESS) {
+        LOG_PERR(Tss2_MU_TPMS_ECC_POINT_Marshal, rval);
+        return false;
+    }
+
+    return files_write_record(output, buffer, offset);
+}
+
+typedef struct batch_outputs batch_outputs;
+struct batch_outputs {
+    FILE *z1;
+    FILE *z2;
+    FILE *ephemeral;
+};
+
+static bool batch_write(batch_outputs *outputs, const zgen_job *job,
+        const TPM2B_ECC_POINT *Z1, const TPM2B_ECC_POINT *Z2) {
+
+    bool result = batch_write_point(outputs->z1, Z1)
+            && batch_write_point(outputs->z2, Z2)
+            && (!outputs->ephemeral
+                || batch_write_point(outputs->ephemeral,
+                        &job->entry.points[0]));
+    if (!result) {
+        LOG_ERR("Could not write the Z points");
+    }
+
+    return result;
+}
+
+/*
+ * Computes the Z points of every peer of the input with the loaded key and
+ * session. The next exchange is sent before the Z points of the previous one
+ * are written, so the TPM never waits on the pool or the file system. The
+ * first failure stops the batch, the Z points computed so far are all
+ * written in order.
+ */
+static tool_rc batch_zgen(ESYS_CONTEXT *ectx, FILE *input,
+        batch_outputs *outputs) {
+
+    zgen_job jobs[2];
+    zgen_job *cur = &jobs[0];
+    zgen_job *next = &jobs[1];
+
+    tool_rc rc = tool_rc_success;
+    bool has_cur = batch_next(ectx, input, cur, &rc);
+    while (has_cur) {
+        TPM2B_ECC_POINT *Z1 = NULL;
+        TPM2B_ECC_POINT *Z2 = NULL;
+        tool_rc tmp_rc = tpm2_zgen2phase_finish(ectx, &Z1, &Z2);
+        if (tmp_rc != tool_rc_success) {
+            return tmp_rc;
+        }
+
+        bool has_next = batch_next(ectx, input, next, &rc);
+
+        bool result = batch_write(outputs, cur, Z1, Z2);
+        free(Z1);
+        free(Z2);
+        if (!result) {
+            if (has_next) {
+                /* the sent command is still owed its response */
+                Z1 = Z2 = NULL;
+                tpm2_zgen2phase_finish(ectx, &Z1, &Z2);
+                free(Z1);
+                free(Z2);
+            }
+            return tool_rc_general_error;
+        }
+
+        zgen_job *tmp = cur;
+        cur = next;
+        next = tmp;
+        has_cur = has_next;
+    }
+
+    return rc;
+}
+
+static FILE *batch_open(const char *path) {
+
+    FILE *f = files_fopen(path, "wb");
+    if (!f) {
+        LOG_ERR("Could not open file \"%s\", error: %s", path,
+                strerror(errno));
+    }
+
+    return f;
+}
+
+static bool batch_close(FILE *f, const char *path) {
+
+    if (f && fclose(f)) {
+        LOG_ERR("Could not write file \"%s\", error: %s", path,
+                strerror(errno));
+        return false;
+    }
+
+    return true;
+}
+
+static tool_rc batch_run(ESYS_CONTEXT *ectx) {
+
+    /* a policy session would need satisfying again for every record */
+    if (ctx.ecc_key.object.session && tpm2_session_get_type(
+            ctx.ecc_key.object.session) == TPM2_SE_POLICY) {
+        LOG_ERR("Batch ZGen cannot satisfy a policy session for every "
+                "record");
+        return tool_rc_option_error;
+    }
+
+    FILE *input = ctx.peers_path ? files_fopen(ctx.peers_path, "rb") : stdin;
+    if (!input) {
+        LOG_ERR("Could not open file \"%s\", error: %s", ctx.peers_path,
+                strerror(errno));
+        return tool_rc_general_error;
+    }
+
+    tool_rc rc = tool_rc_general_error;
+    batch_outputs outputs = { 0 };
+    outputs.z1 = batch_open(ctx.output_z1_path);
+    outputs.z2 = outputs.z1 ? batch_open(ctx.output_z2_path) : NULL;
+    outputs.ephemeral = outputs.z2 && ctx.output_ephemeral_path ?
+            batch_open(ctx.output_ephemeral_path) : NULL;
+    if (outputs.z2 && (!ctx.output_ephemeral_path || outputs.ephemeral)) {
+        rc = batch_zgen(ectx, input, &outputs);
+    }
+
+    bool result = batch_close(outputs.z1, ctx.output_z1_path);
+    result &= batch_close(outputs.z2, ctx.output_z2_path);
+    result &= batch_close(outputs.ephemeral, ctx.output_ephemeral_path);
+    if (!result) {
+        rc = tool_rc_general_error;
+    }
+
+    if (input != stdin) {
+        fclose(input);
+    }
+
+    return rc;
+}
+
 static tool_rc tpm2_tool_onrun(ESYS_CONTEXT *ectx, tpm2_option_flags flags) {
 
     UNUSED(flags);
@@ -188,6 +468,10 @@ static tool_rc tpm2_tool_onrun(ESYS_CONTEXT *ectx, tpm2_option_flags flags) {
         return rc;
     }
 
+    if (ctx.is_batch) {
+        return batch_run(ectx);
+    }
+
     // ESAPI call
     rc = tpm2_zgen2phase(ectx, &ctx.ecc_key.object, &ctx.Q1, &ctx.Q2, &ctx.Z1,
     &ctx.Z2, ctx.keyexchange_scheme, ctx.commit_counter);
@@ -201,5 +485,11 @@ static tool_rc tpm2_tool_onrun(ESYS_CONTEXT *ectx, tpm2_option_flags flags) {
     return rc;
 }
 
+static tool_rc tpm2_tool_onstop(ESYS_CONTEXT *ectx) {
+    UNUSED(ectx);
+    return tpm2_session_close(&ctx.ecc_key.object.session);
+}
+
 // Register this tool with tpm2_tool.c
-TPM2_TOOL_REGISTER("zgen2phase", tpm2_tool_onstart, tpm2_tool_onrun, NULL, NULL)
+TPM2_TOOL_REGISTER("zgen2phase", tpm2_tool_onstart, tpm2_tool_onrun,
+    tpm2_tool_onstop, NULL)